@@ -0,0 +1,616 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SkeletalAnimation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace m3d {
+namespace animation {
+
+using namespace m3d::math;
+
+namespace {
+    // range of the three smallest components of a unit quaternion
+    const float SmallestThreeRange = 0.70710678f;
+    const float RotationSteps = 32767.0f;
+    const float RangeSteps = 65535.0f;
+
+    uint16_t quantize(float value, float minimum, float extent, float steps)
+    {
+        if (extent <= 0.0f) {
+            return 0;
+        }
+        const float normalized = std::max(0.0f, std::min(1.0f, (value - minimum) / extent));
+        return static_cast<uint16_t>(normalized * steps + 0.5f);
+    }
+
+    float dequantize(uint16_t value, float minimum, float extent, float steps)
+    {
+        return minimum + value * (extent / steps);
+    }
+
+    RotationKey packRotation(uint16_t frame, const Quaternion& rotation)
+    {
+        float q[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+        uint16_t largest = 0;
+        for (uint16_t c = 1; c < 4; ++c) {
+            if (std::fabs(q[c]) > std::fabs(q[largest])) {
+                largest = c;
+            }
+        }
+        // q and -q are the same rotation, keep the dropped component positive
+        const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+        RotationKey key;
+        key.frame = frame;
+        for (int c = 0, stored = 0; c < 4; ++c) {
+            if (c != largest) {
+                key.packed[stored++] = quantize(q[c] * sign, -SmallestThreeRange, 2.0f * SmallestThreeRange, RotationSteps);
+            }
+        }
+        key.packed[0] |= static_cast<uint16_t>((largest & 1) << 15);
+        key.packed[1] |= static_cast<uint16_t>((largest >> 1) << 15);
+        return key;
+    }
+
+    Quaternion unpackRotation(const RotationKey& key)
+    {
+        const int largest = (key.packed[0] >> 15) | ((key.packed[1] >> 15) << 1);
+        float q[4];
+        float sumSquares = 0.0f;
+        for (int c = 0, stored = 0; c < 4; ++c) {
+            if (c != largest) {
+                q[c] = dequantize(key.packed[stored++] & 0x7FFF, -SmallestThreeRange, 2.0f * SmallestThreeRange, RotationSteps);
+                sumSquares += q[c] * q[c];
+            }
+        }
+        q[largest] = std::sqrt(std::max(0.0f, 1.0f - sumSquares));
+        return Quaternion(q[0], q[1], q[2], q[3]);
+    }
+
+    float dot(const Quaternion& a, const Quaternion& b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    }
+
+    Quaternion nlerp(const Quaternion& a, const Quaternion& b, float alpha)
+    {
+        const float sign = dot(a, b) < 0.0f ? -1.0f : 1.0f;
+        Quaternion q(a.x + (b.x * sign - a.x) * alpha, a.y + (b.y * sign - a.y) * alpha,
+            a.z + (b.z * sign - a.z) * alpha, a.w + (b.w * sign - a.w) * alpha);
+        const float length = std::sqrt(dot(q, q));
+        return Quaternion(q.x / length, q.y / length, q.z / length, q.w / length);
+    }
+
+    // frames a channel keeps, the first and last always. fits(start, end)
+    // tells whether interpolating start to end reproduces every frame between
+    template <typename Fits>
+    std::vector<uint32_t> reduceKeys(uint32_t frameCount, Fits fits)
+    {
+        std::vector<uint32_t> kept(1, 0);
+        uint32_t start = 0;
+        while (start + 1 < frameCount) {
+            uint32_t end = start + 1;
+            while (end + 1 < frameCount && fits(start, end + 1)) {
+                ++end;
+            }
+            kept.push_back(end);
+            start = end;
+        }
+        return kept;
+    }
+
+    // the keys around frame and how far frame is between them
+    template <typename Key>
+    void bracket(const Key* keys, uint32_t count, float frame, uint32_t& key0, uint32_t& key1, float& alpha)
+    {
+        const Key* next = std::upper_bound(keys, keys + count, frame, [](float f, const Key& key) { return f < key.frame; });
+        if (next == keys || next == keys + count) {
+            key0 = key1 = next == keys ? 0 : count - 1;
+            alpha = 0.0f;
+            return;
+        }
+        key1 = static_cast<uint32_t>(next - keys);
+        key0 = key1 - 1;
+        alpha = (frame - keys[key0].frame) / static_cast<float>(keys[key1].frame - keys[key0].frame);
+    }
+
+    // both keys of every channel around frame, alpha is per channel: rotation, translation, scale
+    void bracketTrack(const AnimationClip& clip, const AnimationTrack& track, float frame, JointPose& pose0, JointPose& pose1, float alpha[3])
+    {
+        uint32_t key0, key1;
+        bracket(&clip.rotationKeys[track.rotationFirst], track.rotationCount, frame, key0, key1, alpha[0]);
+        pose0.rotation = unpackRotation(clip.rotationKeys[track.rotationFirst + key0]);
+        pose1.rotation = unpackRotation(clip.rotationKeys[track.rotationFirst + key1]);
+
+        bracket(&clip.translationKeys[track.translationFirst], track.translationCount, frame, key0, key1, alpha[1]);
+        const VectorKey* translations[2] = { &clip.translationKeys[track.translationFirst + key0], &clip.translationKeys[track.translationFirst + key1] };
+        JointPose* poses[2] = { &pose0, &pose1 };
+        for (int k = 0; k < 2; ++k) {
+            poses[k]->translation = Vector3(dequantize(translations[k]->value[0], track.translationMin[0], track.translationExtent[0], RangeSteps),
+                dequantize(translations[k]->value[1], track.translationMin[1], track.translationExtent[1], RangeSteps),
+                dequantize(translations[k]->value[2], track.translationMin[2], track.translationExtent[2], RangeSteps));
+        }
+
+        bracket(&clip.scaleKeys[track.scaleFirst], track.scaleCount, frame, key0, key1, alpha[2]);
+        pose0.scale = dequantize(clip.scaleKeys[track.scaleFirst + key0].value, track.scaleMin, track.scaleExtent, RangeSteps);
+        pose1.scale = dequantize(clip.scaleKeys[track.scaleFirst + key1].value, track.scaleMin, track.scaleExtent, RangeSteps);
+    }
+
+    JointPoseGroup identityGroup()
+    {
+        JointPoseGroup identity = {};
+        for (int lane = 0; lane < 4; ++lane) {
+            identity.rotationW[lane] = 1.0f;
+            identity.scale[lane] = 1.0f;
+        }
+        return identity;
+    }
+
+    void setLane(JointPoseGroup& group, int lane, const JointPose& pose)
+    {
+        group.rotationX[lane] = pose.rotation.x;
+        group.rotationY[lane] = pose.rotation.y;
+        group.rotationZ[lane] = pose.rotation.z;
+        group.rotationW[lane] = pose.rotation.w;
+        group.translationX[lane] = pose.translation.x;
+        group.translationY[lane] = pose.translation.y;
+        group.translationZ[lane] = pose.translation.z;
+        group.scale[lane] = pose.scale;
+    }
+
+    struct GroupRegisters {
+        VectorSIMD rotation[4];
+        VectorSIMD translation[3];
+        VectorSIMD scale;
+    };
+
+    GroupRegisters load(const JointPoseGroup& group)
+    {
+        GroupRegisters registers;
+        registers.rotation[0] = VectorLoad4f(group.rotationX);
+        registers.rotation[1] = VectorLoad4f(group.rotationY);
+        registers.rotation[2] = VectorLoad4f(group.rotationZ);
+        registers.rotation[3] = VectorLoad4f(group.rotationW);
+        registers.translation[0] = VectorLoad4f(group.translationX);
+        registers.translation[1] = VectorLoad4f(group.translationY);
+        registers.translation[2] = VectorLoad4f(group.translationZ);
+        registers.scale = VectorLoad4f(group.scale);
+        return registers;
+    }
+
+    // rotation normalized on the way out
+    void store(const GroupRegisters& registers, JointPoseGroup& group)
+    {
+        VectorSIMD lengthSquared = VectorMultiply(registers.rotation[0], registers.rotation[0]);
+        for (int c = 1; c < 4; ++c) {
+            lengthSquared = VectorMultiplyAdd(registers.rotation[c], registers.rotation[c], lengthSquared);
+        }
+        const VectorSIMD invLength = VectorReciprocalSqrt(lengthSquared);
+        VectorStore4f(VectorMultiply(registers.rotation[0], invLength), group.rotationX);
+        VectorStore4f(VectorMultiply(registers.rotation[1], invLength), group.rotationY);
+        VectorStore4f(VectorMultiply(registers.rotation[2], invLength), group.rotationZ);
+        VectorStore4f(VectorMultiply(registers.rotation[3], invLength), group.rotationW);
+        VectorStore4f(registers.translation[0], group.translationX);
+        VectorStore4f(registers.translation[1], group.translationY);
+        VectorStore4f(registers.translation[2], group.translationZ);
+        VectorStore4f(registers.scale, group.scale);
+    }
+
+    // 1 or -1 per lane, flips b onto the hemisphere of a
+    VectorSIMD hemisphereSigns(const JointPoseGroup& a, const JointPoseGroup& b)
+    {
+        alignas(16) float signs[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            const float dot = a.rotationX[lane] * b.rotationX[lane] + a.rotationY[lane] * b.rotationY[lane]
+                + a.rotationZ[lane] * b.rotationZ[lane] + a.rotationW[lane] * b.rotationW[lane];
+            signs[lane] = dot < 0.0f ? -1.0f : 1.0f;
+        }
+        return VectorLoad4f(signs);
+    }
+}
+
+void SkeletonPose::Reset(const Skeleton& skeleton)
+{
+    pSkeleton = &skeleton;
+    groups.assign((skeleton.jointCount + 3) / 4, identityGroup());
+}
+
+JointPose SkeletonPose::GetJoint(uint32_t joint) const
+{
+    const JointPoseGroup& group = groups[joint / 4];
+    const uint32_t lane = joint % 4;
+    JointPose pose;
+    pose.rotation = Quaternion(group.rotationX[lane], group.rotationY[lane], group.rotationZ[lane], group.rotationW[lane]);
+    pose.translation = Vector3(group.translationX[lane], group.translationY[lane], group.translationZ[lane]);
+    pose.scale = group.scale[lane];
+    return pose;
+}
+
+void SkeletonPose::SetJoint(uint32_t joint, const JointPose& pose)
+{
+    setLane(groups[joint / 4], joint % 4, pose);
+}
+
+AnimationClip AnimationClip::Compress(const std::vector<JointPose>& frames, uint32_t jointCount, float sampleRate,
+    const CompressionTolerance& tolerance)
+{
+    AnimationClip clip;
+    clip.jointCount = jointCount;
+    clip.frameCount = jointCount ? static_cast<uint32_t>(frames.size() / jointCount) : 0;
+    clip.sampleRate = sampleRate;
+    assert(clip.frameCount <= 0x10000);
+    if (clip.frameCount == 0) {
+        clip.jointCount = 0;
+        return clip;
+    }
+
+    const float minRotationDot = std::cos(tolerance.rotation * 0.5f);
+    std::vector<Quaternion> rotations(clip.frameCount);
+    std::vector<Vector3> translations(clip.frameCount);
+    std::vector<float> scales(clip.frameCount);
+    clip.tracks.resize(jointCount);
+    for (uint32_t joint = 0; joint < jointCount; ++joint) {
+        AnimationTrack& track = clip.tracks[joint];
+        float translationMax[3];
+        float scaleMax = frames[joint].scale;
+        track.scaleMin = scaleMax;
+        for (int c = 0; c < 3; ++c) {
+            track.translationMin[c] = translationMax[c] = (&frames[joint].translation.x)[c];
+        }
+        for (uint32_t frame = 0; frame < clip.frameCount; ++frame) {
+            const JointPose& pose = frames[frame * jointCount + joint];
+            Quaternion q = pose.rotation;
+            const float length = std::sqrt(dot(q, q));
+            q = length > 0.0f ? Quaternion(q.x / length, q.y / length, q.z / length, q.w / length) : Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
+            // one hemisphere along the track so the reduction compares the arcs sampling takes
+            if (frame > 0 && dot(q, rotations[frame - 1]) < 0.0f) {
+                q = Quaternion(-q.x, -q.y, -q.z, -q.w);
+            }
+            rotations[frame] = q;
+            translations[frame] = pose.translation;
+            scales[frame] = pose.scale;
+            for (int c = 0; c < 3; ++c) {
+                track.translationMin[c] = std::min(track.translationMin[c], (&pose.translation.x)[c]);
+                translationMax[c] = std::max(translationMax[c], (&pose.translation.x)[c]);
+            }
+            track.scaleMin = std::min(track.scaleMin, pose.scale);
+            scaleMax = std::max(scaleMax, pose.scale);
+        }
+        for (int c = 0; c < 3; ++c) {
+            track.translationExtent[c] = translationMax[c] - track.translationMin[c];
+        }
+        track.scaleExtent = scaleMax - track.scaleMin;
+
+        const std::vector<uint32_t> rotationFrames = reduceKeys(clip.frameCount, [&](uint32_t start, uint32_t end) {
+            for (uint32_t frame = start + 1; frame < end; ++frame) {
+                const Quaternion q = nlerp(rotations[start], rotations[end], float(frame - start) / float(end - start));
+                if (std::fabs(dot(q, rotations[frame])) < minRotationDot) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        const std::vector<uint32_t> translationFrames = reduceKeys(clip.frameCount, [&](uint32_t start, uint32_t end) {
+            for (uint32_t frame = start + 1; frame < end; ++frame) {
+                const float alpha = float(frame - start) / float(end - start);
+                for (int c = 0; c < 3; ++c) {
+                    const float from = (&translations[start].x)[c];
+                    const float to = (&translations[end].x)[c];
+                    if (std::fabs(from + (to - from) * alpha - (&translations[frame].x)[c]) > tolerance.translation) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        });
+        const std::vector<uint32_t> scaleFrames = reduceKeys(clip.frameCount, [&](uint32_t start, uint32_t end) {
+            for (uint32_t frame = start + 1; frame < end; ++frame) {
+                const float alpha = float(frame - start) / float(end - start);
+                if (std::fabs(scales[start] + (scales[end] - scales[start]) * alpha - scales[frame]) > tolerance.scale) {
+                    return false;
+                }
+            }
+            return true;
+        });
+
+        track.rotationFirst = static_cast<uint32_t>(clip.rotationKeys.size());
+        track.rotationCount = static_cast<uint32_t>(rotationFrames.size());
+        for (uint32_t frame : rotationFrames) {
+            clip.rotationKeys.push_back(packRotation(static_cast<uint16_t>(frame), rotations[frame]));
+        }
+        track.translationFirst = static_cast<uint32_t>(clip.translationKeys.size());
+        track.translationCount = static_cast<uint32_t>(translationFrames.size());
+        for (uint32_t frame : translationFrames) {
+            VectorKey key;
+            key.frame = static_cast<uint16_t>(frame);
+            for (int c = 0; c < 3; ++c) {
+                key.value[c] = quantize((&translations[frame].x)[c], track.translationMin[c], track.translationExtent[c], RangeSteps);
+            }
+            clip.translationKeys.push_back(key);
+        }
+        track.scaleFirst = static_cast<uint32_t>(clip.scaleKeys.size());
+        track.scaleCount = static_cast<uint32_t>(scaleFrames.size());
+        for (uint32_t frame : scaleFrames) {
+            ScalarKey key;
+            key.frame = static_cast<uint16_t>(frame);
+            key.value = quantize(scales[frame], track.scaleMin, track.scaleExtent, RangeSteps);
+            clip.scaleKeys.push_back(key);
+        }
+    }
+    return clip;
+}
+
+JointPose AnimationClip::SampleJoint(uint32_t joint, float frame) const
+{
+    JointPose pose0, pose1;
+    float alpha[3];
+    bracketTrack(*this, tracks[joint], frame, pose0, pose1, alpha);
+
+    JointPose pose;
+    pose.rotation = nlerp(pose0.rotation, pose1.rotation, alpha[0]);
+    pose.translation = Vector3(pose0.translation.x + (pose1.translation.x - pose0.translation.x) * alpha[1],
+        pose0.translation.y + (pose1.translation.y - pose0.translation.y) * alpha[1],
+        pose0.translation.z + (pose1.translation.z - pose0.translation.z) * alpha[1]);
+    pose.scale = pose0.scale + (pose1.scale - pose0.scale) * alpha[2];
+    return pose;
+}
+
+/* Keys are bracketed and decoded per joint, the interpolation runs four joints per register */
+void SampleClip(const AnimationClip& clip, float time, bool loop, SkeletonPose& pose, uint32_t lod)
+{
+    assert(pose.pSkeleton);
+    const Skeleton& skeleton = *pose.pSkeleton;
+    const size_t groupCount = (skeleton.jointCount + 3) / 4;
+    if (lod == 0 || pose.groups.size() != groupCount) {
+        pose.groups.assign(groupCount, identityGroup());
+    }
+    if (clip.frameCount == 0) {
+        return;
+    }
+
+    const float lastFrame = static_cast<float>(clip.frameCount - 1);
+    float frame = time * clip.sampleRate;
+    if (loop && lastFrame > 0.0f) {
+        frame = std::fmod(frame, lastFrame);
+        if (frame < 0.0f) {
+            frame += lastFrame;
+        }
+    } else {
+        frame = std::max(0.0f, std::min(lastFrame, frame));
+    }
+
+    const uint32_t jointCount = std::min(clip.jointCount, skeleton.jointCount);
+    for (uint32_t g = 0; g * 4 < jointCount; ++g) {
+        JointPoseGroup keys0 = identityGroup();
+        JointPoseGroup keys1 = identityGroup();
+        alignas(16) float alphas[3][4] = {};
+        uint32_t sampled = 0;
+        for (uint32_t lane = 0; lane < 4 && g * 4 + lane < jointCount; ++lane) {
+            const uint32_t joint = g * 4 + lane;
+            const uint8_t cullLod = skeleton.joint[joint].cullLod;
+            if (lod > 0 && cullLod != 0 && lod >= cullLod) {
+                // both keys at the pose it had, the blend below leaves it as it was
+                const JointPose kept = pose.GetJoint(joint);
+                setLane(keys0, lane, kept);
+                setLane(keys1, lane, kept);
+                continue;
+            }
+            JointPose pose0, pose1;
+            float alpha[3];
+            bracketTrack(clip, clip.tracks[joint], frame, pose0, pose1, alpha);
+            ++sampled;
+            setLane(keys0, lane, pose0);
+            setLane(keys1, lane, pose1);
+            for (int channel = 0; channel < 3; ++channel) {
+                alphas[channel][lane] = alpha[channel];
+            }
+        }
+
+        if (sampled == 0) {
+            continue;
+        }
+
+        // a + (b - a) * alpha, the rotations nlerped along the shorter arc
+        const VectorSIMD rotationAlpha = VectorLoad4f(alphas[0]);
+        const VectorSIMD translationAlpha = VectorLoad4f(alphas[1]);
+        const VectorSIMD scaleAlpha = VectorLoad4f(alphas[2]);
+        const VectorSIMD signs = hemisphereSigns(keys0, keys1);
+        const GroupRegisters a = load(keys0);
+        const GroupRegisters b = load(keys1);
+        GroupRegisters blended;
+        for (int c = 0; c < 4; ++c) {
+            blended.rotation[c] = VectorMultiplyAdd(VectorSubstract(VectorMultiply(b.rotation[c], signs), a.rotation[c]), rotationAlpha, a.rotation[c]);
+        }
+        for (int c = 0; c < 3; ++c) {
+            blended.translation[c] = VectorMultiplyAdd(VectorSubstract(b.translation[c], a.translation[c]), translationAlpha, a.translation[c]);
+        }
+        blended.scale = VectorMultiplyAdd(VectorSubstract(b.scale, a.scale), scaleAlpha, a.scale);
+        store(blended, pose.groups[g]);
+    }
+}
+
+void BlendPoses(const BlendLayer* layers, size_t layerCount, SkeletonPose& result)
+{
+    if (layerCount == 0) {
+        return;
+    }
+    const SkeletonPose& first = *layers[0].pose;
+    result.pSkeleton = first.pSkeleton;
+    result.groups.resize(first.groups.size());
+    const uint32_t jointCount = first.pSkeleton->jointCount;
+
+    for (size_t g = 0; g < first.groups.size(); ++g) {
+        const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+        GroupRegisters sum = { { zero, zero, zero, zero }, { zero, zero, zero }, zero };
+        alignas(16) float totals[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (size_t l = 0; l < layerCount; ++l) {
+            const BlendLayer& layer = layers[l];
+            const JointPoseGroup& group = layer.pose->groups[g];
+            alignas(16) float weights[4];
+            for (uint32_t lane = 0; lane < 4; ++lane) {
+                const uint32_t joint = static_cast<uint32_t>(g * 4 + lane);
+                weights[lane] = layer.weight * (layer.jointWeights && joint < jointCount ? layer.jointWeights[joint] : 1.0f);
+                totals[lane] += weights[lane];
+            }
+            const VectorSIMD weight = VectorLoad4f(weights);
+            const VectorSIMD rotationWeight = VectorMultiply(weight, hemisphereSigns(first.groups[g], group));
+            const GroupRegisters pose = load(group);
+            for (int c = 0; c < 4; ++c) {
+                sum.rotation[c] = VectorMultiplyAdd(pose.rotation[c], rotationWeight, sum.rotation[c]);
+            }
+            for (int c = 0; c < 3; ++c) {
+                sum.translation[c] = VectorMultiplyAdd(pose.translation[c], weight, sum.translation[c]);
+            }
+            sum.scale = VectorMultiplyAdd(pose.scale, weight, sum.scale);
+        }
+
+        // joints no layer contributes to keep the first layer's pose
+        bool empty = false;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (totals[lane] <= 0.0f) {
+                totals[lane] = 1.0f;
+                empty = true;
+            }
+        }
+        const VectorSIMD total = VectorLoad4f(totals);
+        for (int c = 0; c < 3; ++c) {
+            sum.translation[c] = VectorDivide(sum.translation[c], total);
+        }
+        sum.scale = VectorDivide(sum.scale, total);
+        JointPoseGroup blended;
+        store(sum, blended);
+
+        if (empty) {
+            for (uint32_t lane = 0; lane < 4; ++lane) {
+                const uint32_t joint = static_cast<uint32_t>(g * 4 + lane);
+                float weight = 0.0f;
+                for (size_t l = 0; l < layerCount; ++l) {
+                    weight += layers[l].weight * (layers[l].jointWeights && joint < jointCount ? layers[l].jointWeights[joint] : 1.0f);
+                }
+                if (weight <= 0.0f) {
+                    JointPose pose;
+                    pose.rotation = Quaternion(first.groups[g].rotationX[lane], first.groups[g].rotationY[lane], first.groups[g].rotationZ[lane], first.groups[g].rotationW[lane]);
+                    pose.translation = Vector3(first.groups[g].translationX[lane], first.groups[g].translationY[lane], first.groups[g].translationZ[lane]);
+                    pose.scale = first.groups[g].scale[lane];
+                    setLane(blended, lane, pose);
+                }
+            }
+        }
+        result.groups[g] = blended;
+    }
+}
+
+/* Column vector T * R * S for four joints like TransformStore::computeLocals, then parent * local per joint */
+void LocalToModel(const SkeletonPose& pose, Matrix4x3* models)
+{
+    const Skeleton& skeleton = *pose.pSkeleton;
+    const VectorSIMD one = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+
+    for (uint32_t g = 0; g * 4 < skeleton.jointCount; ++g) {
+        const GroupRegisters joints = load(pose.groups[g]);
+        const VectorSIMD qx = joints.rotation[0];
+        const VectorSIMD qy = joints.rotation[1];
+        const VectorSIMD qz = joints.rotation[2];
+        const VectorSIMD qw = joints.rotation[3];
+        const VectorSIMD s = joints.scale;
+
+        const VectorSIMD x2 = VectorAdd(qx, qx);
+        const VectorSIMD y2 = VectorAdd(qy, qy);
+        const VectorSIMD z2 = VectorAdd(qz, qz);
+        const VectorSIMD xx = VectorMultiply(qx, x2);
+        const VectorSIMD yy = VectorMultiply(qy, y2);
+        const VectorSIMD zz = VectorMultiply(qz, z2);
+        const VectorSIMD xy = VectorMultiply(qx, y2);
+        const VectorSIMD xz = VectorMultiply(qx, z2);
+        const VectorSIMD yz = VectorMultiply(qy, z2);
+        const VectorSIMD wx = VectorMultiply(qw, x2);
+        const VectorSIMD wy = VectorMultiply(qw, y2);
+        const VectorSIMD wz = VectorMultiply(qw, z2);
+
+        VectorSIMD row0[4] = {
+            VectorMultiply(VectorSubstract(one, VectorAdd(yy, zz)), s),
+            VectorMultiply(VectorSubstract(xy, wz), s),
+            VectorMultiply(VectorAdd(xz, wy), s),
+            joints.translation[0]
+        };
+        VectorSIMD row1[4] = {
+            VectorMultiply(VectorAdd(xy, wz), s),
+            VectorMultiply(VectorSubstract(one, VectorAdd(xx, zz)), s),
+            VectorMultiply(VectorSubstract(yz, wx), s),
+            joints.translation[1]
+        };
+        VectorSIMD row2[4] = {
+            VectorMultiply(VectorSubstract(xz, wy), s),
+            VectorMultiply(VectorAdd(yz, wx), s),
+            VectorMultiply(VectorSubstract(one, VectorAdd(xx, yy)), s),
+            joints.translation[2]
+        };
+        VectorTranspose4(row0[0], row0[1], row0[2], row0[3]);
+        VectorTranspose4(row1[0], row1[1], row1[2], row1[3]);
+        VectorTranspose4(row2[0], row2[1], row2[2], row2[3]);
+
+        for (uint32_t lane = 0; lane < 4 && g * 4 + lane < skeleton.jointCount; ++lane) {
+            const uint32_t joint = g * 4 + lane;
+            Matrix4x3 local;
+            VectorStore4f(row0[lane], local.m[0]);
+            VectorStore4f(row1[lane], local.m[1]);
+            VectorStore4f(row2[lane], local.m[2]);
+
+            const uint8_t parent = skeleton.joint[joint].parent;
+            if (parent == NoParent) {
+                models[joint] = local;
+            } else {
+                assert(parent < joint);
+                MatrixMultiplyAffine(&models[joint], &models[parent], &local);
+            }
+        }
+    }
+}
+
+void BuildPalette(const Skeleton& skeleton, const Matrix4x3* models, Matrix4x3* palette)
+{
+    for (uint32_t joint = 0; joint < skeleton.jointCount; ++joint) {
+        MatrixMultiplyAffine(&palette[joint], &models[joint], &skeleton.joint[joint].invBindPose);
+    }
+}
+
+BakedAnimation BakeAnimation(const Skeleton& skeleton, const BakeSource* clips, size_t clipCount, float frameRate)
+{
+    BakedAnimation baked;
+    baked.jointCount = skeleton.jointCount;
+    baked.clips.resize(clipCount);
+
+    SkeletonPose pose;
+    pose.Reset(skeleton);
+    std::vector<Matrix4x3> models(skeleton.jointCount);
+    for (size_t c = 0; c < clipCount; ++c) {
+        const AnimationClip& clip = *clips[c].clip;
+        const float duration = clip.Duration();
+        // at least both ends of a clip that moves, a still one is a single frame
+        const uint32_t frameCount = duration > 0.0f ? std::max(2u, static_cast<uint32_t>(std::ceil(duration * frameRate)) + 1) : 1;
+        BakedClip& bakedClip = baked.clips[c];
+        bakedClip.firstMatrix = static_cast<uint32_t>(baked.palettes.size());
+        bakedClip.frameCount = frameCount;
+        bakedClip.frameRate = duration > 0.0f ? (frameCount - 1) / duration : frameRate;
+        bakedClip.loop = clips[c].loop;
+
+        baked.palettes.resize(baked.palettes.size() + frameCount * skeleton.jointCount);
+        for (uint32_t frame = 0; frame < frameCount; ++frame) {
+            // clamped, the last frame is the end of the clip even when it loops
+            const float time = frameCount > 1 ? duration * frame / (frameCount - 1) : 0.0f;
+            SampleClip(clip, time, false, pose);
+            LocalToModel(pose, models.data());
+            BuildPalette(skeleton, models.data(), &baked.palettes[bakedClip.firstMatrix + frame * skeleton.jointCount]);
+        }
+    }
+    return baked;
+}
+}
+}
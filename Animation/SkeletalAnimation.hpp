@@ -1,35 +1,223 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Matrix.h"
+#include "Quaternion.h"
+
+namespace m3d {
+namespace animation {
+
+/*
+ * Skeletal animation runtime, per character and frame:
+ *
+ *   SampleClip       decompress a clip at some time into a SkeletonPose
+ *   BlendPoses       weighted blend of N sampled layers
+ *   LocalToModel     local joint transforms to model space, in parent order
+ *   BuildPalette     model space times invBindPose, the skinning matrices
+ *
+ * Poses are SoA, four joints per JointPoseGroup so every component of four
+ * joints sits in one SIMD register. Matrices are column vector like the
+ * scene's transforms: model = parentModel * local. They are all affine and
+ * kept as Matrix4x3, three rows without the constant fourth one.
+ *
+ * Nothing here holds global state, characters can be evaluated on as many
+ * threads as there are characters.
+ */
+
+const uint8_t NoParent = 0xFF;
+
 struct Joint {
-	Matrix4x3 invBindPose;
-	const char *name;
-	uint8_t parent;
-}
+    m3d::math::Matrix4x3 invBindPose;
+    const char* name;
+    // NoParent for a root, otherwise a joint with a lower index
+    uint8_t parent;
+    // skeleton LOD from which the joint is no longer sampled, like fingers for distant characters; 0 for never
+    uint8_t cullLod;
+};
+
+struct Skeleton {
+    uint32_t jointCount;
+    Joint* joint;
+};
+
+struct JointPose {
+    m3d::math::Quaternion rotation;
+    m3d::math::Vector3 translation;
+    float scale;
+};
+
+// Four joints, lane k of every array belongs to joint 4 * group + k
+struct alignas(16) JointPoseGroup {
+    float rotationX[4];
+    float rotationY[4];
+    float rotationZ[4];
+    float rotationW[4];
+    float translationX[4];
+    float translationY[4];
+    float translationZ[4];
+    float scale[4];
+};
+
+struct SkeletonPose {
+    const Skeleton* pSkeleton;
+    // (jointCount + 3) / 4 groups, the padding lanes hold the identity
+    std::vector<JointPoseGroup> groups;
+
+    void Reset(const Skeleton& skeleton);
+    JointPose GetJoint(uint32_t joint) const;
+    void SetJoint(uint32_t joint, const JointPose& pose);
+};
 
-struct Skeleton
-{
-	uint32_t jointCount;
-	Joint *joint;
+struct SkinnedVertex {
+    float position[3];
+    float normal[3];
+    float u, v;
+    uint8_t jointIndex[4];
+    // the fourth weight is 1 minus these
+    float jointWeight[3];
 };
 
-struct JointPose
-{
-	Quaternion rotation;
-	Vector3f translation;
-	float scale;
+// How far a morph target moves one vertex at full weight, in object space. Targets only keep the vertices they move
+struct MorphDelta {
+    uint32_t vertex;
+    float position[3];
+    float normal[3];
 };
 
-struct SkeletonPose
-{
-	Skeleton *pSkeleton;
-	JointPose *pLocalPose;
+/*
+ * Cooked clip, 8 bytes per kept rotation or translation key and 4 per scale
+ * key instead of 32 per joint and frame:
+ *
+ *   key reduction    each channel keeps only the frames linear interpolation
+ *                    between its neighbours cannot reproduce within tolerance
+ *   rotations        smallest three components, 15 bits each, 48 bits a key
+ *   translations     16 bit fractions of the track's own range, same for scale
+ *
+ * Keys stay on the sample grid, frame is the index of the sample they were
+ * taken from.
+ */
+struct RotationKey {
+    uint16_t frame;
+    // 15 bits of a component in [-1/sqrt(2), 1/sqrt(2)] each, bit 15 of the
+    // first two is the index of the dropped, largest component, stored positive
+    uint16_t packed[3];
 };
 
-struct SkinnedVertex
-{
-	float position[3];
-	float normal[3];
-	float u,v;
-	uint8_t jointIndex[4];
-	float jointWeight[3];
-};
\ No newline at end of file
+struct VectorKey {
+    uint16_t frame;
+    uint16_t value[3];
+};
+
+struct ScalarKey {
+    uint16_t frame;
+    uint16_t value;
+};
+
+// One joint of a clip, its keys are a range of the clip's key arrays
+struct AnimationTrack {
+    float translationMin[3];
+    float translationExtent[3];
+    float scaleMin;
+    float scaleExtent;
+    uint32_t rotationFirst;
+    uint32_t rotationCount;
+    uint32_t translationFirst;
+    uint32_t translationCount;
+    uint32_t scaleFirst;
+    uint32_t scaleCount;
+};
+
+// How far a reduced channel may be off the source samples, quantization comes on top
+struct CompressionTolerance {
+    // radians
+    float rotation = 0.001f;
+    // scene units
+    float translation = 0.01f;
+    float scale = 0.0001f;
+};
+
+struct AnimationClip {
+    uint32_t jointCount = 0;
+    uint32_t frameCount = 0;
+    float sampleRate = 30.0f;
+    // jointCount tracks, every channel of a track has at least its first and last frame
+    std::vector<AnimationTrack> tracks;
+    std::vector<RotationKey> rotationKeys;
+    std::vector<VectorKey> translationKeys;
+    std::vector<ScalarKey> scaleKeys;
+
+    float Duration() const { return frameCount > 1 ? (frameCount - 1) / sampleRate : 0.0f; }
+    size_t KeyBytes() const
+    {
+        return rotationKeys.size() * sizeof(RotationKey) + translationKeys.size() * sizeof(VectorKey) + scaleKeys.size() * sizeof(ScalarKey);
+    }
+
+    // frames: frameCount * jointCount poses, frame major, sampled at sampleRate, at most 65536 frames
+    static AnimationClip Compress(const std::vector<JointPose>& frames, uint32_t jointCount, float sampleRate,
+        const CompressionTolerance& tolerance = CompressionTolerance());
+    // joint at a fractional sample index, clamped to the clip
+    JointPose SampleJoint(uint32_t joint, float frame) const;
+};
+
+// Interpolated pose at time seconds, wrapped around the clip when looping and clamped otherwise.
+// Past lod 0 the joints culled at lod keep the local pose they have in pose, see Joint::cullLod
+void SampleClip(const AnimationClip& clip, float time, bool loop, SkeletonPose& pose, uint32_t lod = 0);
+
+struct BlendLayer {
+    const SkeletonPose* pose;
+    float weight;
+    // optional per joint weights multiplied into weight, nullptr for all joints
+    const float* jointWeights;
+};
+
+// Normalized weighted blend, rotations nlerped on the hemisphere of the first layer
+void BlendPoses(const BlendLayer* layers, size_t layerCount, SkeletonPose& result);
+
+// models[jointCount], parents always come before their children
+void LocalToModel(const SkeletonPose& pose, m3d::math::Matrix4x3* models);
+
+// palette[joint] = models[joint] * invBindPose, ready for the skinning shader
+void BuildPalette(const Skeleton& skeleton, const m3d::math::Matrix4x3* models, m3d::math::Matrix4x3* palette);
+
+/*
+ * Clips baked for instanced crowds: the skinning matrices of every joint at
+ * a fixed rate, evaluated once at cook time so that drawing an agent needs no
+ * animation work at all. The frames of all clips follow each other in
+ * palettes, jointCount matrices a frame, like the rows of a texture a vertex
+ * shader fetches two frames of and interpolates. Frames are spread evenly over
+ * the clip's duration, the last one is the clip's end; a looping clip that
+ * ends where it starts then wraps like any other pair of frames.
+ */
+struct BakedClip {
+    // of its first frame in BakedAnimation::palettes
+    uint32_t firstMatrix;
+    uint32_t frameCount;
+    // frames per second of clip time, close to the rate asked for
+    float frameRate;
+    bool loop;
+};
+
+struct BakedAnimation {
+    uint32_t jointCount = 0;
+    std::vector<BakedClip> clips;
+    std::vector<m3d::math::Matrix4x3> palettes;
+};
+
+struct BakeSource {
+    const AnimationClip* clip;
+    bool loop;
+};
+
+// Model space palettes of every clip at about frameRate frames a second, in the order of clips
+BakedAnimation BakeAnimation(const Skeleton& skeleton, const BakeSource* clips, size_t clipCount, float frameRate = 30.0f);
+}
+}
@@ -1,26 +1,129 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace m3d {
+
+/*
+Composable allocators after Alexandrescu's "std::allocator Is to Allocation
+what std::vector Is to Vexation": each one hands out Blks, says whether it
+owns a Blk and is built from simpler ones, e.g.
+
+	Segregator<64, FreeList<Mallocator, 1, 64>, FallbackAllocator<BitmappedBlock<Mallocator, 4096, 1024>, Mallocator>>
+
+Every Blk is AllocatorAlignment aligned, deallocate takes the length
+allocate was asked for. Nothing here locks, give every thread its own
+instance. StlAllocator puts any of them under a std container.
+*/
+
 struct Blk
 {
 	void* ptr;
 	size_t length;
 };
 
+static const size_t AllocatorAlignment = 16;
+
+inline size_t roundToAligned(size_t n)
+{
+	return (n + AllocatorAlignment - 1) & ~(AllocatorAlignment - 1);
+}
+
+/*
+malloc and free
+*/
+class Mallocator
+{
+public:
+	Blk allocate(size_t bytes)
+	{
+		if (bytes == 0)
+		{
+			return { nullptr, 0 };
+		}
+		void* p = malloc(bytes);
+		return { p, p ? bytes : 0 };
+	}
+
+	void deallocate(Blk blk)
+	{
+		free(blk.ptr);
+	}
+
+	// the catch-all at the end of a chain, whatever reaches it came from the heap
+	bool owns(Blk) const
+	{
+		return true;
+	}
+};
+
+/*
+Never allocates, the end of a chain that must not reach the heap
+*/
+class NullAllocator
+{
+public:
+	Blk allocate(size_t)
+	{
+		return { nullptr, 0 };
+	}
+
+	void deallocate(Blk blk)
+	{
+		assert(blk.ptr == nullptr);
+		(void)blk;
+	}
+
+	bool owns(Blk blk) const
+	{
+		return blk.ptr == nullptr;
+	}
+};
+
+/*
+Primary first, Fallback when it is out of memory
+*/
 template <class Primary, class Fallback>
-class FallbackAllocator : private Primary, private Fallback
+class FallbackAllocator
 {
+	Primary primary_;
+	Fallback fallback_;
+
 public:
-	Blk allocate(size_t);
-	void deallocate(Blk);
-}
+	Blk allocate(size_t n);
+	void deallocate(Blk b);
+	bool owns(Blk b) const;
+
+	Primary& primary() { return primary_; }
+	Fallback& fallback() { return fallback_; }
+};
 
 template <class P, class F>
 Blk FallbackAllocator<P, F>::allocate(size_t n)
 {
-	Blk r = P::allocate(n);
+	Blk r = primary_.allocate(n);
 	if (!r.ptr)
 	{
-		r = F::allocate(n);
+		r = fallback_.allocate(n);
 	}
 
 	return r;
@@ -29,156 +132,716 @@ Blk FallbackAllocator<P, F>::allocate(size_t n)
 template <class P, class F>
 void FallbackAllocator<P, F>::deallocate(Blk b)
 {
-	if (P::owns(b))
+	if (primary_.owns(b))
 	{
-		P::deallocate(b);
+		primary_.deallocate(b);
 	}
 	else
 	{
-		F::deallocate(b);
+		fallback_.deallocate(b);
 	}
 }
 
 template <class P, class F>
-bool FallbackAllocator::owns(Blk b)
+bool FallbackAllocator<P, F>::owns(Blk b) const
 {
-	return P::owns(b) || F::owns(b);
+	return primary_.owns(b) || fallback_.owns(b);
 }
 
 /*
-stack allocator
+stack allocator, bumps a pointer through s bytes held in the object itself.
+Only the most recent block is given back by deallocate, deallocateAll
+rewinds everything.
 */
-template <size_t s> class StackAllocator
+template <size_t s>
+class StackAllocator
 {
-	char d_[s];
+	alignas(AllocatorAlignment) char d_[s];
 	char* p_;
+
 public:
-	StackAllocator() : p_(d_) {};
+	StackAllocator() : p_(d_) {}
+	StackAllocator(const StackAllocator&) = delete;
+	StackAllocator& operator=(const StackAllocator&) = delete;
 
 	Blk allocate(size_t n)
 	{
-		auto n1 = roundToAligned(n);
+		const size_t n1 = roundToAligned(n);
 		// overflow
-		if (n1 > (d_ + s) - p_)
+		if (n == 0 || n1 > static_cast<size_t>((d_ + s) - p_))
 		{
-			return {nullptr, 0};
+			return { nullptr, 0 };
 		}
 
-		Blk result = {p_, n};
+		Blk result = { p_, n };
 		p_ += n1;
 		return result;
 	}
 
 	void deallocate(Blk b)
 	{
-		if (b.ptr + roundToAligned(n) == p_)
+		if (static_cast<char*>(b.ptr) + roundToAligned(b.length) == p_)
 		{
-			p_ = b.ptr;
+			p_ = static_cast<char*>(b.ptr);
 		}
 	}
 
-	bool owns(Blk b)
+	bool owns(Blk b) const
 	{
 		return b.ptr >= d_ && b.ptr < d_ + s;
 	}
 
-	void deallocate()
+	void deallocateAll()
 	{
 		p_ = d_;
 	}
+
+	size_t used() const
+	{
+		return static_cast<size_t>(p_ - d_);
+	}
 };
 
-class Mallocator
+using Localloc = FallbackAllocator<StackAllocator<16384>, Mallocator>;
+
+/*
+NUMA node the calling thread's PageAllocator mappings are bound to, -1 for
+wherever the OS puts them. cpu::BindCurrentThread sets it along with the
+thread's cores.
+*/
+inline int& threadNumaNode()
 {
-public:
-	Blk allocate(size_t bytes)
+	static thread_local int node = -1;
+	return node;
+}
+
+static const size_t SmallPageBytes = 4096;
+static const size_t HugePageBytes = 2 * 1024 * 1024;
+
+/*
+Page allocator, maps whole pages from the OS for large arenas, the parent
+of a BitmappedBlock or RegionAllocator rather than of single objects.
+
+Lengths of at least HugePageBytes are mapped in huge pages, one TLB entry
+for 2 MB instead of 512: on Linux explicit ones (MAP_HUGETLB) when the
+system has them reserved and transparent ones (MADV_HUGEPAGE) otherwise, on
+Windows large pages (MEM_LARGE_PAGES) when the process may lock memory and
+small pages otherwise. They are rounded up to whole huge pages either way,
+so deallocate knows what to unmap from the length alone. On a thread bound
+to a NUMA node the pages are placed on that node, whichever thread touches
+them first.
+*/
+class PageAllocator
+{
+	static size_t mappedLength(size_t n)
 	{
-		return Blk{malloc(bytes), bytes};
+		const size_t page = n >= HugePageBytes ? HugePageBytes : SmallPageBytes;
+		return (n + page - 1) & ~(page - 1);
 	}
 
-	void deallocate(Blk blk)
+#ifdef _WIN32
+	static void* map(size_t length)
 	{
-		free(blk.ptr);
-		blk.ptr = nullptr;
-		blk.length = 0;
+		const int node = threadNumaNode();
+		const DWORD protect = PAGE_READWRITE;
+		if (length >= HugePageBytes)
+		{
+			const SIZE_T large = GetLargePageMinimum();
+			if (large && length % large == 0)
+			{
+				const DWORD flags = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+				void* p = node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, length, flags, protect, static_cast<DWORD>(node))
+					: VirtualAlloc(nullptr, length, flags, protect);
+				if (p)
+				{
+					return p;
+				}
+			}
+		}
+		const DWORD flags = MEM_RESERVE | MEM_COMMIT;
+		return node >= 0 ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, length, flags, protect, static_cast<DWORD>(node))
+			: VirtualAlloc(nullptr, length, flags, protect);
 	}
 
-};
+	static void unmap(void* p, size_t)
+	{
+		VirtualFree(p, 0, MEM_RELEASE);
+	}
+#else
+	static void* map(size_t length)
+	{
+		void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+		if (length >= HugePageBytes)
+		{
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		}
+#endif
+		if (p == MAP_FAILED)
+		{
+			p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+			{
+				return nullptr;
+			}
+#if defined(MADV_HUGEPAGE)
+			if (length >= HugePageBytes)
+			{
+				madvise(p, length, MADV_HUGEPAGE);
+			}
+#endif
+		}
+#if defined(__linux__)
+		// nothing is touched yet, the policy places every page as it is faulted in
+		const int node = threadNumaNode();
+		if (node >= 0 && node < 64)
+		{
+			const unsigned long mask = 1ul << node;
+			syscall(SYS_mbind, p, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+		}
+#endif
+		return p;
+	}
+
+	static void unmap(void* p, size_t length)
+	{
+		munmap(p, length);
+	}
+#endif
+
+public:
+	Blk allocate(size_t n)
+	{
+		if (n == 0)
+		{
+			return { nullptr, 0 };
+		}
+		void* p = map(mappedLength(n));
+		return { p, p ? n : 0 };
+	}
 
-using Localloc = FallbackAllocator<StackAllocator<16284>, Mallocator>;
+	void deallocate(Blk b)
+	{
+		if (b.ptr)
+		{
+			unmap(b.ptr, mappedLength(b.length));
+		}
+	}
+};
 
 /*
-Freelist
+Region allocator, a StackAllocator over s bytes taken from the parent on
+first use instead of held in the object, for arenas that should have pages
+of their own: RegionAllocator<PageAllocator, HugePageBytes> is one huge page.
 */
 template <class A, size_t s>
-class FreeList
+class RegionAllocator
 {
 	A parent_;
+	Blk region_;
+	char* p_;
+
+	char* begin() const { return static_cast<char*>(region_.ptr); }
+
+public:
+	RegionAllocator() : region_(), p_(nullptr) {}
+	RegionAllocator(const RegionAllocator&) = delete;
+	RegionAllocator& operator=(const RegionAllocator&) = delete;
+
+	~RegionAllocator()
+	{
+		if (region_.ptr)
+		{
+			parent_.deallocate(region_);
+		}
+	}
+
+	Blk allocate(size_t n)
+	{
+		if (!region_.ptr)
+		{
+			region_ = parent_.allocate(s);
+			if (!region_.ptr)
+			{
+				return { nullptr, 0 };
+			}
+			p_ = begin();
+		}
+		const size_t n1 = roundToAligned(n);
+		// overflow
+		if (n == 0 || n1 > static_cast<size_t>((begin() + s) - p_))
+		{
+			return { nullptr, 0 };
+		}
+
+		Blk result = { p_, n };
+		p_ += n1;
+		return result;
+	}
+
+	void deallocate(Blk b)
+	{
+		if (static_cast<char*>(b.ptr) + roundToAligned(b.length) == p_)
+		{
+			p_ = static_cast<char*>(b.ptr);
+		}
+	}
+
+	bool owns(Blk b) const
+	{
+		return region_.ptr && b.ptr >= begin() && b.ptr < begin() + s;
+	}
+
+	void deallocateAll()
+	{
+		p_ = begin();
+	}
+
+	size_t used() const
+	{
+		return static_cast<size_t>(p_ - begin());
+	}
+};
+
+/*
+Freelist, keeps up to maxNodes freed blocks of lengths in [minSize, maxSize]
+for reuse. Every such block is maxSize bytes of parent memory, so one list
+serves all the sizes a container's nodes may have.
+*/
+template <class A, size_t minSize, size_t maxSize, size_t maxNodes = 1024>
+class FreeList
+{
 	struct Node
 	{
 		Node* next;
-	} root_;
+	};
+	static_assert(maxSize >= sizeof(Node), "freed blocks hold the list");
+
+	A parent_;
+	Node* root_;
+	size_t count_;
+
+	static bool fits(size_t n)
+	{
+		return n >= minSize && n <= maxSize;
+	}
 
 public:
+	FreeList() : root_(nullptr), count_(0) {}
+	FreeList(const FreeList&) = delete;
+	FreeList& operator=(const FreeList&) = delete;
+
+	~FreeList()
+	{
+		while (root_)
+		{
+			Node* node = root_;
+			root_ = node->next;
+			parent_.deallocate({ node, maxSize });
+		}
+	}
+
 	Blk allocate(size_t n)
 	{
-		if (n == s && root_)
+		if (!fits(n))
+		{
+			return parent_.allocate(n);
+		}
+		if (root_)
 		{
-			Blk b = {root_, n};
-			root_ = root_.next;
+			Blk b = { root_, n };
+			root_ = root_->next;
+			--count_;
 			return b;
 		}
-		return parent_.allocate(n);
+		Blk b = parent_.allocate(maxSize);
+		b.length = b.ptr ? n : 0;
+		return b;
 	}
 
-	bool owns(Blk b)
+	bool owns(Blk b) const
 	{
-		return b.length == s || parent_.owns(b);
+		return fits(b.length) || parent_.owns(b);
 	}
 
-	void deallocate(Blk)
+	void deallocate(Blk b)
 	{
-		if (b.length != s)
+		if (!fits(b.length))
 		{
 			return parent_.deallocate(b);
 		}
-		auto p = (Node*)b.ptr;
-		p.next = root_;
+		if (count_ == maxNodes)
+		{
+			return parent_.deallocate({ b.ptr, maxSize });
+		}
+		Node* p = static_cast<Node*>(b.ptr);
+		p->next = root_;
 		root_ = p;
+		++count_;
 	}
-}
+};
 
 /*
-Affix allocator
+Affix allocator, constructs a Prefix in front of and a Suffix behind every
+block, for bookkeeping the block itself cannot carry
 */
+namespace detail
+{
+	template <class T>
+	struct Affix
+	{
+		static const size_t size = (sizeof(T) + AllocatorAlignment - 1) & ~(AllocatorAlignment - 1);
+		static void construct(void* p) { new (p) T(); }
+		static void destroy(void* p) { static_cast<T*>(p)->~T(); }
+	};
+
+	template <>
+	struct Affix<void>
+	{
+		static const size_t size = 0;
+		static void construct(void*) {}
+		static void destroy(void*) {}
+	};
+}
+
 template <class A, class Prefix, class Suffix = void>
-class AffixAllocator;
+class AffixAllocator
+{
+	A parent_;
 
-/*
-Allocator with status
-*/
-template <class A, ulong flags>
-class AllocatorWithStatus;
+	static const size_t prefixSize = detail::Affix<Prefix>::size;
+	static const size_t suffixSize = detail::Affix<Suffix>::size;
+
+	static Blk outer(Blk b)
+	{
+		return { static_cast<char*>(b.ptr) - prefixSize, prefixSize + roundToAligned(b.length) + suffixSize };
+	}
+
+public:
+	Blk allocate(size_t n)
+	{
+		if (n == 0)
+		{
+			return { nullptr, 0 };
+		}
+		Blk inner = parent_.allocate(prefixSize + roundToAligned(n) + suffixSize);
+		if (!inner.ptr)
+		{
+			return { nullptr, 0 };
+		}
+		Blk b = { static_cast<char*>(inner.ptr) + prefixSize, n };
+		detail::Affix<Prefix>::construct(prefix(b));
+		detail::Affix<Suffix>::construct(suffix(b));
+		return b;
+	}
+
+	void deallocate(Blk b)
+	{
+		if (!b.ptr)
+		{
+			return;
+		}
+		detail::Affix<Suffix>::destroy(suffix(b));
+		detail::Affix<Prefix>::destroy(prefix(b));
+		parent_.deallocate(outer(b));
+	}
+
+	bool owns(Blk b) const
+	{
+		return b.ptr && parent_.owns(outer(b));
+	}
+
+	static Prefix* prefix(Blk b)
+	{
+		return reinterpret_cast<Prefix*>(static_cast<char*>(b.ptr) - prefixSize);
+	}
+
+	// void* when there is no Suffix
+	static void* suffix(Blk b)
+	{
+		return static_cast<char*>(b.ptr) + roundToAligned(b.length);
+	}
+};
 
 /*
-Bitmapped block
+Allocator with status, counts into the calling thread's AllocationStats and
+checks every deallocate against the length recorded in the block's prefix
 */
-template <class A, size_t blockSize>
-class BitmappedBlock;
+struct AllocationStats
+{
+	size_t allocations;
+	size_t deallocations;
+	size_t failures;
+	size_t bytesInUse;
+	size_t peakBytesInUse;
+};
+
+// this thread's counters, blocks freed on another thread count there
+inline AllocationStats& threadAllocationStats()
+{
+	static thread_local AllocationStats stats = {};
+	return stats;
+}
+
+template <class A>
+class StatsAllocator
+{
+	struct Record
+	{
+		size_t length;
+	};
+
+	typedef AffixAllocator<A, Record> Parent;
+	Parent parent_;
+
+public:
+	Blk allocate(size_t n)
+	{
+		AllocationStats& stats = threadAllocationStats();
+		Blk b = parent_.allocate(n);
+		if (!b.ptr)
+		{
+			++stats.failures;
+			return b;
+		}
+		Parent::prefix(b)->length = n;
+		++stats.allocations;
+		stats.bytesInUse += n;
+		if (stats.bytesInUse > stats.peakBytesInUse)
+		{
+			stats.peakBytesInUse = stats.bytesInUse;
+		}
+		return b;
+	}
+
+	void deallocate(Blk b)
+	{
+		if (!b.ptr)
+		{
+			return;
+		}
+		assert(Parent::prefix(b)->length == b.length);
+		AllocationStats& stats = threadAllocationStats();
+		++stats.deallocations;
+		stats.bytesInUse -= b.length;
+		parent_.deallocate(b);
+	}
+
+	bool owns(Blk b) const
+	{
+		return parent_.owns(b);
+	}
+};
 
 /*
+Bitmapped block, one region of blockCount blocks of blockSize bytes taken
+from the parent on first use, a bit per block. Blocks of any length are
+freed in any order, allocations span as many contiguous blocks as needed.
 */
-template <class Creator>
-class CascadingAllocator;
+template <class A, size_t blockSize, size_t blockCount>
+class BitmappedBlock
+{
+	static_assert(blockSize % AllocatorAlignment == 0, "blocks keep the allocator alignment");
+
+	static const size_t WordBits = 64;
+	static const size_t WordCount = (blockCount + WordBits - 1) / WordBits;
+
+	A parent_;
+	Blk region_;
+	uint64_t used_[WordCount];
+
+	bool isUsed(size_t block) const
+	{
+		return (used_[block / WordBits] >> (block % WordBits)) & 1;
+	}
+
+	void mark(size_t first, size_t count, bool used)
+	{
+		for (size_t i = first; i < first + count; ++i)
+		{
+			const uint64_t bit = uint64_t(1) << (i % WordBits);
+			if (used)
+			{
+				used_[i / WordBits] |= bit;
+			}
+			else
+			{
+				used_[i / WordBits] &= ~bit;
+			}
+		}
+	}
+
+	Blk take(size_t first, size_t blocks, size_t n)
+	{
+		mark(first, blocks, true);
+		return { static_cast<char*>(region_.ptr) + first * blockSize, n };
+	}
+
+public:
+	BitmappedBlock() : region_()
+	{
+		memset(used_, 0, sizeof(used_));
+	}
+	BitmappedBlock(const BitmappedBlock&) = delete;
+	BitmappedBlock& operator=(const BitmappedBlock&) = delete;
+
+	~BitmappedBlock()
+	{
+		if (region_.ptr)
+		{
+			parent_.deallocate(region_);
+		}
+	}
+
+	Blk allocate(size_t n)
+	{
+		const size_t blocks = (n + blockSize - 1) / blockSize;
+		if (n == 0 || blocks > blockCount)
+		{
+			return { nullptr, 0 };
+		}
+		if (!region_.ptr)
+		{
+			region_ = parent_.allocate(blockSize * blockCount);
+			if (!region_.ptr)
+			{
+				return { nullptr, 0 };
+			}
+		}
+
+		// first fit, whole words of used or free blocks are passed 64 at a time
+		size_t run = 0;
+		for (size_t i = 0; i < blockCount;)
+		{
+			if (i % WordBits == 0 && i + WordBits <= blockCount)
+			{
+				const uint64_t word = used_[i / WordBits];
+				if (word == ~uint64_t(0))
+				{
+					run = 0;
+					i += WordBits;
+					continue;
+				}
+				if (word == 0 && run + WordBits < blocks)
+				{
+					run += WordBits;
+					i += WordBits;
+					continue;
+				}
+			}
+			if (isUsed(i))
+			{
+				run = 0;
+			}
+			else if (++run == blocks)
+			{
+				return take(i + 1 - blocks, blocks, n);
+			}
+			++i;
+		}
+		return { nullptr, 0 };
+	}
+
+	void deallocate(Blk b)
+	{
+		if (!b.ptr)
+		{
+			return;
+		}
+		const size_t first = (static_cast<char*>(b.ptr) - static_cast<char*>(region_.ptr)) / blockSize;
+		mark(first, (b.length + blockSize - 1) / blockSize, false);
+	}
+
+	bool owns(Blk b) const
+	{
+		return region_.ptr && b.ptr >= region_.ptr && b.ptr < static_cast<char*>(region_.ptr) + blockSize * blockCount;
+	}
+};
 
 /*
-Segregator
+Segregator, lengths up to threshold go to SmallAllocator, the rest to LargeAllocator
 */
 template <size_t threshold, class SmallAllocator, class LargeAllocator>
-struct Segregator
+class Segregator
 {
+	SmallAllocator small_;
+	LargeAllocator large_;
+
+public:
 	Blk allocate(size_t s)
 	{
-		return s <= threshold ? _small.allocate(s) : _large.allocate(s);
+		return s <= threshold ? small_.allocate(s) : large_.allocate(s);
 	}
-};
\ No newline at end of file
+
+	void deallocate(Blk b)
+	{
+		if (b.length <= threshold)
+		{
+			small_.deallocate(b);
+		}
+		else
+		{
+			large_.deallocate(b);
+		}
+	}
+
+	bool owns(Blk b) const
+	{
+		return b.length <= threshold ? small_.owns(b) : large_.owns(b);
+	}
+};
+
+/*
+std container adaptor, copies share the one allocator they were made from,
+which has to outlive every container using it
+*/
+template <class T, class A>
+class StlAllocator
+{
+	template <class U, class B>
+	friend class StlAllocator;
+
+	A* a_;
+
+public:
+	typedef T value_type;
+
+	template <class U>
+	struct rebind
+	{
+		typedef StlAllocator<U, A> other;
+	};
+
+	explicit StlAllocator(A& a) : a_(&a) {}
+
+	template <class U>
+	StlAllocator(const StlAllocator<U, A>& other) : a_(other.a_) {}
+
+	T* allocate(size_t n)
+	{
+		Blk b = a_->allocate(n * sizeof(T));
+		if (!b.ptr)
+		{
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(b.ptr);
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		a_->deallocate({ p, n * sizeof(T) });
+	}
+
+	template <class U>
+	bool operator==(const StlAllocator<U, A>& other) const
+	{
+		return a_ == other.a_;
+	}
+
+	template <class U>
+	bool operator!=(const StlAllocator<U, A>& other) const
+	{
+		return a_ != other.a_;
+	}
+};
+}
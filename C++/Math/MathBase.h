@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
 
 namespace M3D
 {
@@ -11,5 +12,30 @@ namespace M3D
 			// TODO: quake 3, neon
 			return std::sqrt(1.0f / f);
 		}
+
+		/// sines[i] = sin(angles[i]), cosines[i] = cos(angles[i]), within 2e-7 for |angle| < 8192
+		/// Branch free polynomials of the Cephes sinf/cosf on [-pi/4, pi/4] after a reduction by pi/2,
+		/// the loop vectorizes with NEON and SSE
+		static inline void SinCosArray(const float* angles, float* sines, float* cosines, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				const float x = angles[i];
+				const float j = std::floor(x * 0.636619772f + 0.5f);
+				const int quadrant = static_cast<int>(j);
+				// pi/2 in three parts, the first two exact in float
+				const float r = ((x - j * 1.5703125f) - j * 4.83751297e-4f) - j * 7.54978995e-8f;
+				const float z = r * r;
+
+				const float s = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * r + r;
+				const float c = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+
+				// quadrant 1 and 3 swap them, sin is negative in 2 and 3, cos in 1 and 2
+				const float sine = (quadrant & 1) ? c : s;
+				const float cosine = (quadrant & 1) ? s : c;
+				sines[i] = (quadrant & 2) ? -sine : sine;
+				cosines[i] = ((quadrant + 1) & 2) ? -cosine : cosine;
+			}
+		}
 	}
 }
@@ -606,6 +606,19 @@ namespace M3D {
 
 			return result;
 		}
+
+		/// result[i] = left * right[i], result may alias right
+		inline void MatrixMultiplyArray(Matrix4x4* result, const Matrix4x4& left, const Matrix4x4* right, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+#if USE_SIMD
+				MatrixMultiply(&result[i], &left, &right[i]);
+#else
+				result[i] = Matrix4x4(left) * right[i];
+#endif
+			}
+		}
 		
 	} // namespace Math
 } // namespace M3D
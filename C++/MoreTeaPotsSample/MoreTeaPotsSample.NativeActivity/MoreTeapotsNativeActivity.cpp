@@ -252,11 +252,15 @@ int32_t Engine::HandleInput( android_app* app,
             }
             else if( dragState & ndk_helper::GESTURE_STATE_MOVE )
             {
-//                ndk_helper::Vec2 v;
-	            M3D::Math::Vector2 v;	
-                eng->drag_detector_.GetPointer( v );
-                eng->TransformPosition( v );
-                eng->tap_camera_.Drag( v );
+                //Every sample the event batches, the camera integrates them in its next Update
+                int32_t samples = eng->drag_detector_.GetSampleCount();
+                for( int32_t i = 0; i < samples; ++i )
+                {
+	                M3D::Math::Vector2 v;
+                    eng->drag_detector_.GetPointer( v, i );
+                    eng->TransformPosition( v );
+                    eng->tap_camera_.Drag( v );
+                }
             }
             else if( dragState & ndk_helper::GESTURE_STATE_END )
             {
@@ -279,13 +283,16 @@ int32_t Engine::HandleInput( android_app* app,
             else if( pinchState & ndk_helper::GESTURE_STATE_MOVE )
             {
                 //Multi touch
-                //Start new pinch
-	            M3D::Math::Vector2 v1;
-	            M3D::Math::Vector2 v2;	
-                eng->pinch_detector_.GetPointers( v1, v2 );
-                eng->TransformPosition( v1 );
-                eng->TransformPosition( v2 );
-                eng->tap_camera_.Pinch( v1, v2 );
+                int32_t samples = eng->pinch_detector_.GetSampleCount();
+                for( int32_t i = 0; i < samples; ++i )
+                {
+	                M3D::Math::Vector2 v1;
+	                M3D::Math::Vector2 v2;
+                    eng->pinch_detector_.GetPointers( v1, v2, i );
+                    eng->TransformPosition( v1 );
+                    eng->TransformPosition( v2 );
+                    eng->tap_camera_.Pinch( v1, v2 );
+                }
             }
         }
         return 1;
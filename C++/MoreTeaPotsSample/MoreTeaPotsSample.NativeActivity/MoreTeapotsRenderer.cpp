@@ -23,6 +23,7 @@
 //--------------------------------------------------------------------------------
 #include "MoreTeapotsRenderer.h"
 #include <stdlib.h>
+#include <stdio.h>
 //--------------------------------------------------------------------------------
 // Teapot model data
 //--------------------------------------------------------------------------------
@@ -34,9 +35,14 @@ using namespace M3D::Math;
 // Ctor
 //--------------------------------------------------------------------------------
 MoreTeapotsRenderer::MoreTeapotsRenderer() :
+                ubo_( 0 ),
+                ubo_binding_point_( 0 ),
+                ubo_region_size_( 0 ),
+                ubo_ring_index_( 0 ),
                 geometry_instancing_support_( false )
 {
-
+    for( int32_t i = 0; i < UBO_RING_SIZE; ++i )
+        ubo_fences_[i] = 0;
 }
 
 //--------------------------------------------------------------------------------
@@ -134,10 +140,20 @@ void MoreTeapotsRenderer::Init( const int32_t numX,
 
 				float fX = random() / float(RAND_MAX) - 0.5f;
 				float fY = random() / float(RAND_MAX) - 0.5f;
-				vec_rotations_.push_back(M3D::Math::Vector2(fX * 0.05f, fY * 0.05f));
-				vec_current_rotations_.push_back(M3D::Math::Vector2(fX * M_PI, fY * M_PI));
+				rotation_speeds_x_.push_back(fX * 0.05f);
+				rotation_speeds_y_.push_back(fY * 0.05f);
+				rotations_x_.push_back(fX * M_PI);
+				rotations_y_.push_back(fY * M_PI);
 			}
 
+    const int32_t num_teapots = teapot_x_ * teapot_y_ * teapot_z_;
+    sines_x_.resize( num_teapots );
+    cosines_x_.resize( num_teapots );
+    sines_y_.resize( num_teapots );
+    cosines_y_.resize( num_teapots );
+    vec_mat_mv_.resize( num_teapots );
+    vec_mat_mvp_.resize( num_teapots );
+
     if( geometry_instancing_support_ )
     {
         //
@@ -180,7 +196,7 @@ void MoreTeapotsRenderer::Init( const int32_t numX,
 
             glGenBuffers( 1, &ubo_ );
             glBindBuffer( GL_UNIFORM_BUFFER, ubo_ );
-            glBindBufferBase( GL_UNIFORM_BUFFER, bindingPoint, ubo_ );
+            ubo_binding_point_ = bindingPoint;
 
             //Store color value which wouldn't be updated every frame
             int32_t iSize = teapot_x_ * teapot_y_ * teapot_z_
@@ -193,7 +209,18 @@ void MoreTeapotsRenderer::Init( const int32_t numX,
                 pColor += ubo_vector_stride_; //Assuming std140 layout which is 4 DWORD stride for vectors
             }
 
-            glBufferData( GL_UNIFORM_BUFFER, iSize * sizeof(float), pBuffer, GL_DYNAMIC_DRAW );
+            //Ring of UBO_RING_SIZE copies of the block, one per frame in flight
+            //Each copy starts at an offset glBindBufferRange accepts
+            GLint alignment = 0;
+            glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+            ubo_region_size_ = iSize * sizeof(float);
+            if( alignment > 0 )
+                ubo_region_size_ = (ubo_region_size_ + alignment - 1) / alignment * alignment;
+            glBufferData( GL_UNIFORM_BUFFER, ubo_region_size_ * UBO_RING_SIZE, NULL, GL_DYNAMIC_DRAW );
+            for( int32_t i = 0; i < UBO_RING_SIZE; ++i )
+                glBufferSubData( GL_UNIFORM_BUFFER, i * ubo_region_size_, iSize * sizeof(float), pBuffer );
+            glBindBufferRange( GL_UNIFORM_BUFFER, ubo_binding_point_, ubo_, 0, ubo_region_size_ );
+            ubo_ring_index_ = 0;
             delete[] pBuffer;
         }
         else
@@ -234,6 +261,14 @@ void MoreTeapotsRenderer::Unload()
         glDeleteBuffers( 1, &vbo_ );
         vbo_ = 0;
     }
+    for( int32_t i = 0; i < UBO_RING_SIZE; ++i )
+    {
+        if( ubo_fences_[i] )
+        {
+            glDeleteSync( ubo_fences_[i] );
+            ubo_fences_[i] = 0;
+        }
+    }
     if( ubo_ )
     {
         glDeleteBuffers( 1, &ubo_ );
@@ -308,6 +343,8 @@ void MoreTeapotsRenderer::Render()
 
     glUniform3f( shader_param_.light0_, 100.f, -200.f, -600.f );
 
+    UpdateInstances();
+
     if( geometry_instancing_support_ )
     {
         //
@@ -315,37 +352,51 @@ void MoreTeapotsRenderer::Render()
         //
 
         //Update UBO
+        //The copy of this frame was last read UBO_RING_SIZE frames ago, its fence says when
+        //the GPU is done with it. The map is unsynchronized, older drivers would otherwise
+        //wait for every draw still reading the buffer
+        GLsync& fence = ubo_fences_[ubo_ring_index_];
+        if( fence )
+        {
+            while( glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) == GL_TIMEOUT_EXPIRED )
+                ;
+            glDeleteSync( fence );
+            fence = 0;
+        }
+        const GLintptr offset = ubo_ring_index_ * ubo_region_size_;
         glBindBuffer( GL_UNIFORM_BUFFER, ubo_ );
-        float* p = (float*) glMapBufferRange( GL_UNIFORM_BUFFER, 0,
+        float* p = (float*) glMapBufferRange( GL_UNIFORM_BUFFER, offset,
                 teapot_x_ * teapot_y_ * teapot_z_ * (ubo_matrix_stride_ * 2) * sizeof(float),
-                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT );
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
         float* pMVPMat = p;
         float* pMVMat = p + teapot_x_ * teapot_y_ * teapot_z_ * ubo_matrix_stride_;
-        for( int32_t i = 0; i < teapot_x_ * teapot_y_ * teapot_z_; ++i )
+        if( ubo_matrix_stride_ == 16 )
         {
-            //Rotation
-            float fX, fY;
-            vec_current_rotations_[i] += vec_rotations_[i];
-
-	        Matrix4x4 mat_rotation = M3D::Math::Matrix4x4::RotationX(vec_current_rotations_[i].x)
-                    * M3D::Math::Matrix4x4::RotationY(vec_current_rotations_[i].y);
-
-            // Feed Projection and Model View matrices to the shaders
-            Matrix4x4 mat_v = mat_view_ * vec_mat_models_[i] * mat_rotation;
-            Matrix4x4 mat_vp = mat_projection_ * mat_v;
-
-            memcpy( pMVPMat, &mat_vp.m[0][0], sizeof(mat_v) );
-            pMVPMat += ubo_matrix_stride_;
+            //Tightly packed, the arrays go in as a whole
+            memcpy( pMVPMat, &vec_mat_mvp_[0], vec_mat_mvp_.size() * sizeof(Matrix4x4) );
+            memcpy( pMVMat, &vec_mat_mv_[0], vec_mat_mv_.size() * sizeof(Matrix4x4) );
+        }
+        else
+        {
+            for( int32_t i = 0; i < teapot_x_ * teapot_y_ * teapot_z_; ++i )
+            {
+                memcpy( pMVPMat, &vec_mat_mvp_[i].m[0][0], sizeof(Matrix4x4) );
+                pMVPMat += ubo_matrix_stride_;
 
-            memcpy( pMVMat, &mat_v.m[0][0], sizeof(mat_v) );
-            pMVMat += ubo_matrix_stride_;
+                memcpy( pMVMat, &vec_mat_mv_[i].m[0][0], sizeof(Matrix4x4) );
+                pMVMat += ubo_matrix_stride_;
+            }
         }
         glUnmapBuffer( GL_UNIFORM_BUFFER );
+        glBindBufferRange( GL_UNIFORM_BUFFER, ubo_binding_point_, ubo_, offset, ubo_region_size_ );
 
         //Instanced rendering
         glDrawElementsInstanced( GL_TRIANGLES, num_indices_, GL_UNSIGNED_SHORT, BUFFER_OFFSET(0),
                 teapot_x_ * teapot_y_ * teapot_z_ );
 
+        fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        ubo_ring_index_ = (ubo_ring_index_ + 1) % UBO_RING_SIZE;
+
     }
     else
     {
@@ -360,17 +411,9 @@ void MoreTeapotsRenderer::Render()
 	        
             glUniform4f( shader_param_.material_diffuse_, x, y, z, 1.f );
 
-            //Rotation
-            vec_current_rotations_[i] += vec_rotations_[i];
-
-            Matrix4x4 mat_rotation = Matrix4x4::RotationX(vec_current_rotations_[i].x)
-                    * Matrix4x4::RotationY(vec_current_rotations_[i].y);
-
             // Feed Projection and Model View matrices to the shaders
-            Matrix4x4 mat_v = mat_view_ * vec_mat_models_[i] * mat_rotation;
-            Matrix4x4 mat_vp = mat_projection_ * mat_v;
-            glUniformMatrix4fv( shader_param_.matrix_projection_, 1, GL_FALSE, &mat_vp.m[0][0] );
-            glUniformMatrix4fv( shader_param_.matrix_view_, 1, GL_FALSE, &mat_v.m[0][0] );
+            glUniformMatrix4fv( shader_param_.matrix_projection_, 1, GL_FALSE, &vec_mat_mvp_[i].m[0][0] );
+            glUniformMatrix4fv( shader_param_.matrix_view_, 1, GL_FALSE, &vec_mat_mv_[i].m[0][0] );
 
             glDrawElements( GL_TRIANGLES, num_indices_, GL_UNSIGNED_SHORT, BUFFER_OFFSET(0) );
 
@@ -381,6 +424,54 @@ void MoreTeapotsRenderer::Render()
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
 }
 
+//--------------------------------------------------------------------------------
+// UpdateInstances
+// Advance the rotations and build the matrices of all teapots in passes over arrays:
+// the angles, their sines and cosines, the model matrices, then the products
+//--------------------------------------------------------------------------------
+void MoreTeapotsRenderer::UpdateInstances()
+{
+    const int32_t num_teapots = teapot_x_ * teapot_y_ * teapot_z_;
+    for( int32_t i = 0; i < num_teapots; ++i )
+    {
+        rotations_x_[i] += rotation_speeds_x_[i];
+        rotations_y_[i] += rotation_speeds_y_[i];
+    }
+    SinCosArray( &rotations_x_[0], &sines_x_[0], &cosines_x_[0], num_teapots );
+    SinCosArray( &rotations_y_[0], &sines_y_[0], &cosines_y_[0], num_teapots );
+
+    //Translation * RotationX * RotationY, multiplied out
+    //The models are translations, they only set the last column
+    for( int32_t i = 0; i < num_teapots; ++i )
+    {
+        const float sx = sines_x_[i];
+        const float cx = cosines_x_[i];
+        const float sy = sines_y_[i];
+        const float cy = cosines_y_[i];
+        const Matrix4x4& model = vec_mat_models_[i];
+        Matrix4x4& mat = vec_mat_mv_[i];
+        mat.m[0][0] = cy;
+        mat.m[0][1] = 0.f;
+        mat.m[0][2] = -sy;
+        mat.m[0][3] = model.m[0][3];
+        mat.m[1][0] = sx * sy;
+        mat.m[1][1] = cx;
+        mat.m[1][2] = sx * cy;
+        mat.m[1][3] = model.m[1][3];
+        mat.m[2][0] = cx * sy;
+        mat.m[2][1] = -sx;
+        mat.m[2][2] = cx * cy;
+        mat.m[2][3] = model.m[2][3];
+        mat.m[3][0] = 0.f;
+        mat.m[3][1] = 0.f;
+        mat.m[3][2] = 0.f;
+        mat.m[3][3] = 1.f;
+    }
+
+    MatrixMultiplyArray( &vec_mat_mv_[0], mat_view_, &vec_mat_mv_[0], num_teapots );
+    MatrixMultiplyArray( &vec_mat_mvp_[0], mat_projection_, &vec_mat_mv_[0], num_teapots );
+}
+
 //--------------------------------------------------------------------------------
 // LoadShaders
 //--------------------------------------------------------------------------------
@@ -393,60 +484,74 @@ bool MoreTeapotsRenderer::LoadShaders( SHADER_PARAMS* params,
     //In GLES2.0, shader attribute locations need to be explicitly specified before linking
     //
     GLuint program;
-    GLuint vertShader, fragShader;
+    GLuint vertShader = 0, fragShader = 0;
     char *vertShaderPathname, *fragShaderPathname;
 
     // Create shader program
     program = glCreateProgram();
     LOGI( "Created Shader %d", program );
 
-    // Create and compile vertex shader
-    if( !ndk_helper::shader::CompileShader( &vertShader, GL_VERTEX_SHADER, strVsh ) )
-    {
-        LOGI( "Failed to compile vertex shader" );
-        glDeleteProgram( program );
-        return false;
-    }
+    // The attribute bindings below are part of the linked program
+    char link_state[64];
+    snprintf( link_state, sizeof(link_state), "myVertex=%d,myNormal=%d", ATTRIB_VERTEX,
+            ATTRIB_NORMAL );
 
-    // Create and compile fragment shader
-    if( !ndk_helper::shader::CompileShader( &fragShader, GL_FRAGMENT_SHADER, strFsh ) )
+    // Reuse the program binary of an earlier launch if the driver still takes it
+    uint64_t binary_key;
+    bool cacheable = ndk_helper::shader::ProgramBinaryKey( strVsh, strFsh, NULL, link_state, &binary_key );
+    if( !cacheable || !ndk_helper::shader::LoadProgramBinary( program, binary_key ) )
     {
-        LOGI( "Failed to compile fragment shader" );
-        glDeleteProgram( program );
-        return false;
-    }
+        // Create and compile vertex shader
+        if( !ndk_helper::shader::CompileShader( &vertShader, GL_VERTEX_SHADER, strVsh ) )
+        {
+            LOGI( "Failed to compile vertex shader" );
+            glDeleteProgram( program );
+            return false;
+        }
 
-    // Attach vertex shader to program
-    glAttachShader( program, vertShader );
+        // Create and compile fragment shader
+        if( !ndk_helper::shader::CompileShader( &fragShader, GL_FRAGMENT_SHADER, strFsh ) )
+        {
+            LOGI( "Failed to compile fragment shader" );
+            glDeleteProgram( program );
+            return false;
+        }
 
-    // Attach fragment shader to program
-    glAttachShader( program, fragShader );
+        // Attach vertex shader to program
+        glAttachShader( program, vertShader );
 
-    // Bind attribute locations
-    // this needs to be done prior to linking
-    glBindAttribLocation( program, ATTRIB_VERTEX, "myVertex" );
-    glBindAttribLocation( program, ATTRIB_NORMAL, "myNormal" );
+        // Attach fragment shader to program
+        glAttachShader( program, fragShader );
 
-    // Link program
-    if( !ndk_helper::shader::LinkProgram( program ) )
-    {
-        LOGI( "Failed to link program: %d", program );
+        // Bind attribute locations
+        // this needs to be done prior to linking
+        glBindAttribLocation( program, ATTRIB_VERTEX, "myVertex" );
+        glBindAttribLocation( program, ATTRIB_NORMAL, "myNormal" );
 
-        if( vertShader )
-        {
-            glDeleteShader( vertShader );
-            vertShader = 0;
-        }
-        if( fragShader )
+        // Link program
+        if( !ndk_helper::shader::LinkProgram( program ) )
         {
-            glDeleteShader( fragShader );
-            fragShader = 0;
-        }
-        if( program )
-        {
-            glDeleteProgram( program );
+            LOGI( "Failed to link program: %d", program );
+
+            if( vertShader )
+            {
+                glDeleteShader( vertShader );
+                vertShader = 0;
+            }
+            if( fragShader )
+            {
+                glDeleteShader( fragShader );
+                fragShader = 0;
+            }
+            if( program )
+            {
+                glDeleteProgram( program );
+            }
+            return false;
         }
-        return false;
+
+        if( cacheable )
+            ndk_helper::shader::SaveProgramBinary( program, binary_key );
     }
 
     // Get uniform locations
@@ -478,57 +583,66 @@ bool MoreTeapotsRenderer::LoadShadersES3( SHADER_PARAMS* params,
     //In GLES3.0, shader attribute index can be described in a shader code directly with layout() attribute
     //
     GLuint program;
-    GLuint vertShader, fragShader;
+    GLuint vertShader = 0, fragShader = 0;
     char *vertShaderPathname, *fragShaderPathname;
 
     // Create shader program
     program = glCreateProgram();
     LOGI( "Created Shader %d", program );
 
-    // Create and compile vertex shader
-    if( !ndk_helper::shader::CompileShader( &vertShader, GL_VERTEX_SHADER, strVsh, shaderParams ) )
-    {
-        LOGI( "Failed to compile vertex shader" );
-        glDeleteProgram( program );
-        return false;
-    }
-
-    // Create and compile fragment shader
-    if( !ndk_helper::shader::CompileShader( &fragShader, GL_FRAGMENT_SHADER, strFsh,
-            shaderParams ) )
-    {
-        LOGI( "Failed to compile fragment shader" );
-        glDeleteProgram( program );
-        return false;
-    }
-
-    // Attach vertex shader to program
-    glAttachShader( program, vertShader );
-
-    // Attach fragment shader to program
-    glAttachShader( program, fragShader );
-
-    // Link program
-    if( !ndk_helper::shader::LinkProgram( program ) )
+    // Reuse the program binary of an earlier launch if the driver still takes it
+    uint64_t binary_key;
+    bool cacheable = ndk_helper::shader::ProgramBinaryKey( strVsh, strFsh, &shaderParams, NULL, &binary_key );
+    if( !cacheable || !ndk_helper::shader::LoadProgramBinary( program, binary_key ) )
     {
-        LOGI( "Failed to link program: %d", program );
-
-        if( vertShader )
+        // Create and compile vertex shader
+        if( !ndk_helper::shader::CompileShader( &vertShader, GL_VERTEX_SHADER, strVsh, shaderParams ) )
         {
-            glDeleteShader( vertShader );
-            vertShader = 0;
+            LOGI( "Failed to compile vertex shader" );
+            glDeleteProgram( program );
+            return false;
         }
-        if( fragShader )
+
+        // Create and compile fragment shader
+        if( !ndk_helper::shader::CompileShader( &fragShader, GL_FRAGMENT_SHADER, strFsh,
+                shaderParams ) )
         {
-            glDeleteShader( fragShader );
-            fragShader = 0;
+            LOGI( "Failed to compile fragment shader" );
+            glDeleteProgram( program );
+            return false;
         }
-        if( program )
+
+        // Attach vertex shader to program
+        glAttachShader( program, vertShader );
+
+        // Attach fragment shader to program
+        glAttachShader( program, fragShader );
+
+        // Link program
+        if( !ndk_helper::shader::LinkProgram( program ) )
         {
-            glDeleteProgram( program );
+            LOGI( "Failed to link program: %d", program );
+
+            if( vertShader )
+            {
+                glDeleteShader( vertShader );
+                vertShader = 0;
+            }
+            if( fragShader )
+            {
+                glDeleteShader( fragShader );
+                fragShader = 0;
+            }
+            if( program )
+            {
+                glDeleteProgram( program );
+            }
+
+            return false;
         }
 
-        return false;
+        if( cacheable )
+            ndk_helper::shader::SaveProgramBinary( program, binary_key );
     }
 
     // Get uniform locations
@@ -83,6 +83,13 @@ class MoreTeapotsRenderer
     GLuint vbo_;
     GLuint ubo_;
 
+    //Frames the instanced path can have in flight, each one with its own copy of the UBO
+    static const int32_t UBO_RING_SIZE = 3;
+    GLuint ubo_binding_point_;
+    int32_t ubo_region_size_; //Bytes per copy, aligned for glBindBufferRange
+    int32_t ubo_ring_index_;
+    GLsync ubo_fences_[UBO_RING_SIZE];
+
     SHADER_PARAMS shader_param_;
     bool LoadShaders( SHADER_PARAMS* params,
             const char* strVsh,
@@ -96,8 +103,19 @@ class MoreTeapotsRenderer
 	M3D::Math::Matrix4x4 mat_view_;
     std::vector<M3D::Math::Matrix4x4> vec_mat_models_;
 	std::vector<M3D::Math::Vector3> vec_colors_;
-	std::vector<M3D::Math::Vector2> vec_rotations_;
-	std::vector<M3D::Math::Vector2> vec_current_rotations_;
+
+    //Per teapot, as arrays of each component for the batched kernels
+    std::vector<float> rotation_speeds_x_;
+    std::vector<float> rotation_speeds_y_;
+    std::vector<float> rotations_x_;
+    std::vector<float> rotations_y_;
+    std::vector<float> sines_x_;
+    std::vector<float> cosines_x_;
+    std::vector<float> sines_y_;
+    std::vector<float> cosines_y_;
+    //Model view and model view projection matrices of the current frame
+    std::vector<M3D::Math::Matrix4x4> vec_mat_mv_;
+    std::vector<M3D::Math::Matrix4x4> vec_mat_mvp_;
 
     ndk_helper::TapCamera* camera_;
 
@@ -110,6 +128,7 @@ class MoreTeapotsRenderer
     bool arb_support_;
 
     std::string ToString( const int32_t i );
+    void UpdateInstances();
 public:
     MoreTeapotsRenderer();
     virtual ~MoreTeapotsRenderer();
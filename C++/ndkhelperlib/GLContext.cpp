@@ -42,7 +42,8 @@ GLContext::GLContext() :
                 screen_height_( 0 ),
                 gles_initialized_( false ),
                 egl_context_initialized_( false ),
-				es3_supported_( false )
+                es3_supported_( false ),
+                context_valid_( false )
                 
 {
 }
@@ -164,6 +165,10 @@ bool GLContext::InitEGLContext()
 
 EGLint GLContext::Swap()
 {
+    //Uploads that completed by now are handed to the render thread, once per frame
+    if( upload_worker_.IsRunning() )
+        upload_worker_.ProcessCompleted();
+
     bool b = eglSwapBuffers( display_, surface_ );
     if( !b )
     {
@@ -188,6 +193,9 @@ EGLint GLContext::Swap()
 
 void GLContext::Terminate()
 {
+    //The shared context goes before the one it shares with
+    upload_worker_.Stop();
+
     if( display_ != EGL_NO_DISPLAY )
     {
         eglMakeCurrent( display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
@@ -274,6 +282,15 @@ bool GLContext::Invalidate()
     return true;
 }
 
+GLUploadWorker* GLContext::GetUploadWorker()
+{
+    if( upload_worker_.IsRunning() )
+        return &upload_worker_;
+    if( !context_valid_ || !upload_worker_.Start( display_, context_ ) )
+        return NULL;
+    return &upload_worker_;
+}
+
 bool GLContext::CheckExtension( const char* extension )
 {
     if( extension == NULL )
@@ -24,6 +24,7 @@
 #include <GLES2/gl2.h>
 #include <android/log.h>
 
+#include "GLUploadWorker.h"
 #include "JNIHelper.h"
 
 namespace ndk_helper
@@ -47,6 +48,7 @@ namespace ndk_helper
  *
  * Thread safety: OpenGL context is expecting used within dedicated single thread,
  * thus GLContext class is not designed as a thread-safe
+ * GetUploadWorker() hands out a worker thread with a shared context for uploads off that thread
  */
 class GLContext
 {
@@ -71,6 +73,9 @@ private:
     float gl_version_;
     bool context_valid_;
 
+    //Background uploads, started by the first GetUploadWorker()
+    GLUploadWorker upload_worker_;
+
     void InitGLES();
     void Terminate();
     bool InitEGLSurface();
@@ -118,6 +123,14 @@ public:
         return gl_version_;
     }
     bool CheckExtension( const char* extension );
+
+    /*
+     * Worker for uploads on a shared context, started on first use; call on the render thread
+     * Swap() runs the ready callbacks of completed uploads, the worker is stopped with the context
+     *
+     * return: the worker, NULL when no shared context is available and uploads have to stay on this thread
+     */
+    GLUploadWorker* GetUploadWorker();
 };
 
 }   //namespace ndkHelper
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//--------------------------------------------------------------------------------
+// GLUploadWorker.cpp
+//--------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------
+// includes
+//--------------------------------------------------------------------------------
+#include <string.h>
+#include <GLES2/gl2.h>
+#include "GLUploadWorker.h"
+#include "JNIHelper.h"
+
+namespace ndk_helper
+{
+
+//--------------------------------------------------------------------------------
+// Ctor
+//--------------------------------------------------------------------------------
+GLUploadWorker::GLUploadWorker() :
+                display_( EGL_NO_DISPLAY ),
+                context_( EGL_NO_CONTEXT ),
+                surface_( EGL_NO_SURFACE ),
+                create_sync_( NULL ),
+                destroy_sync_( NULL ),
+                client_wait_sync_( NULL ),
+                running_( false ),
+                quit_( false )
+{
+    pthread_mutex_init( &mutex_, NULL );
+    pthread_cond_init( &cond_, NULL );
+}
+
+//--------------------------------------------------------------------------------
+// Dtor
+//--------------------------------------------------------------------------------
+GLUploadWorker::~GLUploadWorker()
+{
+    Stop();
+    pthread_cond_destroy( &cond_ );
+    pthread_mutex_destroy( &mutex_ );
+}
+
+bool GLUploadWorker::Start( EGLDisplay display,
+        EGLContext share_context )
+{
+    if( running_ )
+        return true;
+
+    //The worker draws nothing, a 1x1 pbuffer is enough to make the context current
+    const EGLint attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_SURFACE_TYPE,
+            EGL_PBUFFER_BIT, EGL_BLUE_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_RED_SIZE, 8, EGL_NONE };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    eglChooseConfig( display, attribs, &config, 1, &num_configs );
+    if( !num_configs )
+    {
+        LOGW( "No pbuffer config, uploads stay on the render thread" );
+        return false;
+    }
+
+    const EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    context_ = eglCreateContext( display, config, share_context, context_attribs );
+    if( context_ == EGL_NO_CONTEXT )
+    {
+        LOGW( "Unable to create a shared context, uploads stay on the render thread" );
+        return false;
+    }
+    const EGLint surface_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    surface_ = eglCreatePbufferSurface( display, config, surface_attribs );
+    if( surface_ == EGL_NO_SURFACE )
+    {
+        LOGW( "Unable to create a pbuffer, uploads stay on the render thread" );
+        eglDestroyContext( display, context_ );
+        context_ = EGL_NO_CONTEXT;
+        return false;
+    }
+    display_ = display;
+
+    const char* extensions = eglQueryString( display, EGL_EXTENSIONS );
+    if( extensions && strstr( extensions, "EGL_KHR_fence_sync" ) )
+    {
+        create_sync_ = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress( "eglCreateSyncKHR" );
+        destroy_sync_ = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress( "eglDestroySyncKHR" );
+        client_wait_sync_ = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress(
+                "eglClientWaitSyncKHR" );
+    }
+    if( !create_sync_ || !destroy_sync_ || !client_wait_sync_ )
+    {
+        LOGI( "No EGL_KHR_fence_sync, uploads are finished with glFinish" );
+        create_sync_ = NULL;
+        destroy_sync_ = NULL;
+        client_wait_sync_ = NULL;
+    }
+
+    quit_ = false;
+    if( pthread_create( &thread_, NULL, ThreadMain, this ) != 0 )
+    {
+        LOGW( "Unable to start the upload thread" );
+        eglDestroySurface( display_, surface_ );
+        eglDestroyContext( display_, context_ );
+        surface_ = EGL_NO_SURFACE;
+        context_ = EGL_NO_CONTEXT;
+        display_ = EGL_NO_DISPLAY;
+        return false;
+    }
+    running_ = true;
+    return true;
+}
+
+void GLUploadWorker::Stop()
+{
+    if( !running_ )
+        return;
+
+    pthread_mutex_lock( &mutex_ );
+    quit_ = true;
+    pthread_cond_signal( &cond_ );
+    pthread_mutex_unlock( &mutex_ );
+    pthread_join( thread_, NULL );
+    running_ = false;
+
+    queued_.clear();
+    for( size_t i = 0; i < uploaded_.size(); ++i )
+    {
+        if( uploaded_[i].sync != EGL_NO_SYNC_KHR )
+            destroy_sync_( display_, uploaded_[i].sync );
+    }
+    uploaded_.clear();
+
+    eglDestroySurface( display_, surface_ );
+    eglDestroyContext( display_, context_ );
+    surface_ = EGL_NO_SURFACE;
+    context_ = EGL_NO_CONTEXT;
+    display_ = EGL_NO_DISPLAY;
+}
+
+void GLUploadWorker::Queue( const UploadFunc& upload,
+        const ReadyFunc& ready )
+{
+    UPLOAD_JOB job;
+    job.upload = upload;
+    job.ready = ready;
+    job.sync = EGL_NO_SYNC_KHR;
+
+    pthread_mutex_lock( &mutex_ );
+    queued_.push_back( job );
+    pthread_cond_signal( &cond_ );
+    pthread_mutex_unlock( &mutex_ );
+}
+
+int32_t GLUploadWorker::ProcessCompleted()
+{
+    std::vector<ReadyFunc> ready;
+
+    pthread_mutex_lock( &mutex_ );
+    size_t kept = 0;
+    for( size_t i = 0; i < uploaded_.size(); ++i )
+    {
+        UPLOAD_JOB& job = uploaded_[i];
+        if( job.sync != EGL_NO_SYNC_KHR )
+        {
+            //Timeout 0, only polls the fence
+            if( client_wait_sync_( display_, job.sync, 0, 0 ) == EGL_TIMEOUT_EXPIRED_KHR )
+            {
+                uploaded_[kept++] = job;
+                continue;
+            }
+            destroy_sync_( display_, job.sync );
+        }
+        ready.push_back( job.ready );
+    }
+    uploaded_.resize( kept );
+    pthread_mutex_unlock( &mutex_ );
+
+    //Outside the lock, callbacks may queue further uploads
+    for( size_t i = 0; i < ready.size(); ++i )
+    {
+        if( ready[i] )
+            ready[i]();
+    }
+    return (int32_t) ready.size();
+}
+
+void* GLUploadWorker::ThreadMain( void* arg )
+{
+    static_cast<GLUploadWorker*>( arg )->Run();
+    return NULL;
+}
+
+void GLUploadWorker::Run()
+{
+    if( eglMakeCurrent( display_, surface_, surface_, context_ ) == EGL_FALSE )
+    {
+        LOGW( "Unable to eglMakeCurrent the upload context" );
+        return;
+    }
+
+    pthread_mutex_lock( &mutex_ );
+    while( !quit_ )
+    {
+        if( queued_.empty() )
+        {
+            pthread_cond_wait( &cond_, &mutex_ );
+            continue;
+        }
+        UPLOAD_JOB job = queued_.front();
+        queued_.pop_front();
+        pthread_mutex_unlock( &mutex_ );
+
+        job.upload();
+        if( create_sync_ )
+        {
+            job.sync = create_sync_( display_, EGL_SYNC_FENCE_KHR, NULL );
+            //The fence only signals once the commands before it reached the GPU
+            glFlush();
+        }
+        if( job.sync == EGL_NO_SYNC_KHR )
+            glFinish();
+
+        pthread_mutex_lock( &mutex_ );
+        uploaded_.push_back( job );
+    }
+    pthread_mutex_unlock( &mutex_ );
+
+    eglMakeCurrent( display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+}
+
+}   //namespace ndkHelper
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//--------------------------------------------------------------------------------
+// GLUploadWorker.h
+//--------------------------------------------------------------------------------
+#ifndef GLUPLOADWORKER_H_
+#define GLUPLOADWORKER_H_
+
+#include <pthread.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace ndk_helper
+{
+
+/******************************************************************
+ * Background GL uploads
+ * A worker thread with its own EGL context, shared with the render context, runs uploads
+ * (glTexImage2D, glBufferData, JNIHelper::LoadTexture...) so they do not stall rendering.
+ *
+ * After each upload the worker inserts an EGL fence (EGL_KHR_fence_sync) and flushes.
+ * ProcessCompleted, called on the render thread, runs the ready callback of every upload
+ * whose fence signalled; only then the objects can be used there. Without the extension
+ * the worker waits for the upload with glFinish instead.
+ *
+ * GLContext owns one worker, see GLContext::GetUploadWorker
+ */
+class GLUploadWorker
+{
+public:
+    //Runs on the worker thread, the shared context is current
+    typedef std::function<void()> UploadFunc;
+    //Runs on the render thread once the upload is complete
+    typedef std::function<void()> ReadyFunc;
+
+private:
+    struct UPLOAD_JOB
+    {
+        UploadFunc upload;
+        ReadyFunc ready;
+        EGLSyncKHR sync;
+    };
+
+    EGLDisplay display_;
+    EGLContext context_;
+    EGLSurface surface_;
+
+    PFNEGLCREATESYNCKHRPROC create_sync_;
+    PFNEGLDESTROYSYNCKHRPROC destroy_sync_;
+    PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync_;
+
+    pthread_t thread_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t cond_;
+    bool running_;
+    bool quit_;
+
+    //Guarded by mutex_
+    std::deque<UPLOAD_JOB> queued_;
+    std::vector<UPLOAD_JOB> uploaded_;
+
+    static void* ThreadMain( void* arg );
+    void Run();
+
+    GLUploadWorker( GLUploadWorker const& );
+    void operator=( GLUploadWorker const& );
+
+public:
+    GLUploadWorker();
+    ~GLUploadWorker();
+
+    /*
+     * Create the shared context and start the thread
+     * Call on the thread share_context is current on
+     *
+     * return:
+     * false when no shared context could be created, uploads have to stay on the render thread then
+     */
+    bool Start( EGLDisplay display,
+            EGLContext share_context );
+    /*
+     * Stop the thread and destroy the shared context, call before the render context goes away
+     * Uploads that did not complete yet are dropped without calling their ready callbacks
+     */
+    void Stop();
+    bool IsRunning() const
+    {
+        return running_;
+    }
+
+    /*
+     * Queue an upload, thread safe
+     */
+    void Queue( const UploadFunc& upload,
+            const ReadyFunc& ready );
+    /*
+     * Run the ready callbacks of the completed uploads, on the render thread
+     * Never waits for the GPU
+     *
+     * return: number of callbacks run
+     */
+    int32_t ProcessCompleted();
+};
+
+}   //namespace ndkHelper
+
+#endif /* GLUPLOADWORKER_H_ */
@@ -15,9 +15,14 @@
  */
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
-#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <iostream>
+#include <memory>
 
+#include "GLContext.h"
 #include "JNIHelper.h"
 
 namespace ndk_helper
@@ -29,6 +34,64 @@ namespace ndk_helper
 //JNI Helper functions
 //---------------------------------------------------------------------------
 
+//---------------------------------------------------------------------------
+//AssetData
+//---------------------------------------------------------------------------
+AssetData::AssetData() :
+                data_( NULL ),
+                size_( 0 ),
+                map_base_( NULL ),
+                map_length_( 0 ),
+                asset_( NULL )
+{
+}
+
+AssetData::~AssetData()
+{
+    Reset();
+}
+
+void AssetData::Reset()
+{
+    if( map_base_ )
+    {
+        munmap( map_base_, map_length_ );
+    }
+    if( asset_ )
+    {
+        AAsset_close( asset_ );
+    }
+    data_ = NULL;
+    size_ = 0;
+    map_base_ = NULL;
+    map_length_ = 0;
+    asset_ = NULL;
+}
+
+bool AssetData::Map( int fd,
+        off_t start,
+        size_t length )
+{
+    if( length == 0 )
+    {
+        return true;
+    }
+    //mmap offsets are whole pages, APK entries start anywhere
+    const off_t page_size = sysconf( _SC_PAGESIZE );
+    const off_t aligned_start = start - start % page_size;
+    const size_t delta = start - aligned_start;
+    void* base = mmap( NULL, length + delta, PROT_READ, MAP_PRIVATE, fd, aligned_start );
+    if( base == MAP_FAILED )
+    {
+        return false;
+    }
+    map_base_ = base;
+    map_length_ = length + delta;
+    data_ = (const uint8_t*) base + delta;
+    size_ = length;
+    return true;
+}
+
 //---------------------------------------------------------------------------
 //Singleton
 //---------------------------------------------------------------------------
@@ -88,6 +151,25 @@ void JNIHelper::Init( ANativeActivity* activity,
     const char* appname = env->GetStringUTFChars( packageName, NULL );
     helper.app_name_ = std::string( appname );
 
+    //Cached, file reads need the path without a JNI call
+    jstring str_path = helper.GetExternalFilesDirJString( env );
+    const char* path = str_path ? env->GetStringUTFChars( str_path, NULL ) : NULL;
+    helper.external_files_dir_ = path ? std::string( path ) : std::string();
+    if( path )
+    {
+        env->ReleaseStringUTFChars( str_path, path );
+        env->DeleteLocalRef( str_path );
+    }
+
+    jstring str_cache = helper.GetCacheDirJString( env );
+    const char* cache = str_cache ? env->GetStringUTFChars( str_cache, NULL ) : NULL;
+    helper.cache_dir_ = cache ? std::string( cache ) : std::string();
+    if( cache )
+    {
+        env->ReleaseStringUTFChars( str_cache, cache );
+        env->DeleteLocalRef( str_cache );
+    }
+
     jclass cls = helper.RetrieveClass( env, helper_class_name );
     helper.jni_helper_java_class_ = (jclass) env->NewGlobalRef( cls );
 
@@ -107,6 +189,19 @@ void JNIHelper::Init( ANativeActivity* activity,
 bool JNIHelper::ReadFile( const char* fileName,
         std::vector<uint8_t>* buffer_ref )
 {
+    AssetData asset;
+    if( !OpenAsset( fileName, &asset ) )
+    {
+        return false;
+    }
+    buffer_ref->assign( asset.GetData(), asset.GetData() + asset.GetSize() );
+    return true;
+}
+
+bool JNIHelper::OpenAsset( const char* fileName,
+        AssetData* asset )
+{
+    asset->Reset();
     if( activity_ == NULL )
     {
         LOGI( "JNIHelper has not been initialized.Call init() to initialize the helper" );
@@ -114,66 +209,60 @@ bool JNIHelper::ReadFile( const char* fileName,
     }
 
     //First, try reading from externalFileDir;
-    JNIEnv *env;
-
-    pthread_mutex_lock( &mutex_ );
-    activity_->vm->AttachCurrentThread( &env, NULL );
-
-    jstring str_path = GetExternalFilesDirJString( env );
-    const char* path = env->GetStringUTFChars( str_path, NULL );
-    std::string s( path );
-
+    std::string s( external_files_dir_ );
     if( fileName[0] != '/' )
     {
         s.append( "/" );
     }
     s.append( fileName );
-    std::ifstream f( s.c_str(), std::ios::binary );
-
-    env->ReleaseStringUTFChars( str_path, path );
-    env->DeleteLocalRef( str_path );
-    activity_->vm->DetachCurrentThread();
+    int fd = open( s.c_str(), O_RDONLY );
+    if( fd >= 0 )
+    {
+        struct stat st;
+        bool mapped = fstat( fd, &st ) == 0 && asset->Map( fd, 0, st.st_size );
+        close( fd );
+        if( mapped )
+        {
+            LOGI( "reading:%s", s.c_str() );
+            return true;
+        }
+    }
 
-    if( f )
+    //Fallback to assetManager, it can be used from any thread
+    AAsset* assetFile = AAssetManager_open( activity_->assetManager, fileName, AASSET_MODE_BUFFER );
+    if( !assetFile )
     {
-        LOGI( "reading:%s", s.c_str() );
-        f.seekg( 0, std::ifstream::end );
-        int32_t fileSize = f.tellg();
-        f.seekg( 0, std::ifstream::beg );
-        buffer_ref->reserve( fileSize );
-        buffer_ref->assign( std::istreambuf_iterator<char>( f ), std::istreambuf_iterator<char>() );
-        f.close();
-        pthread_mutex_unlock( &mutex_ );
-        return true;
+        return false;
     }
-    else
+
+    //Uncompressed entries are mapped straight out of the APK
+    off_t start = 0;
+    off_t length = 0;
+    fd = AAsset_openFileDescriptor( assetFile, &start, &length );
+    if( fd >= 0 )
     {
-        //Fallback to assetManager
-        AAssetManager* assetManager = activity_->assetManager;
-        AAsset* assetFile = AAssetManager_open( assetManager, fileName, AASSET_MODE_BUFFER );
-        if( !assetFile )
-        {
-            pthread_mutex_unlock( &mutex_ );
-            return false;
-        }
-        uint8_t* data = (uint8_t*) AAsset_getBuffer( assetFile );
-        int32_t size = AAsset_getLength( assetFile );
-        if( data == NULL )
+        bool mapped = asset->Map( fd, start, length );
+        close( fd );
+        if( mapped )
         {
             AAsset_close( assetFile );
-
-            LOGI( "Failed to load:%s", fileName );
-            pthread_mutex_unlock( &mutex_ );
-            return false;
+            return true;
         }
+    }
 
-        buffer_ref->reserve( size );
-        buffer_ref->assign( data, data + size );
-
+    //Compressed ones are inflated by the asset manager, the buffer lives as long as the asset
+    const uint8_t* data = (const uint8_t*) AAsset_getBuffer( assetFile );
+    if( data == NULL )
+    {
         AAsset_close( assetFile );
-        pthread_mutex_unlock( &mutex_ );
-        return true;
+
+        LOGI( "Failed to load:%s", fileName );
+        return false;
     }
+    asset->asset_ = assetFile;
+    asset->data_ = data;
+    asset->size_ = AAsset_getLength( assetFile );
+    return true;
 }
 
 std::string JNIHelper::GetExternalFilesDir()
@@ -183,24 +272,17 @@ std::string JNIHelper::GetExternalFilesDir()
         LOGI( "JNIHelper has not been initialized. Call init() to initialize the helper" );
         return std::string( "" );
     }
+    return external_files_dir_;
+}
 
-    pthread_mutex_lock( &mutex_ );
-
-    //First, try reading from externalFileDir;
-    JNIEnv *env;
-
-    activity_->vm->AttachCurrentThread( &env, NULL );
-
-    jstring strPath = GetExternalFilesDirJString( env );
-    const char* path = env->GetStringUTFChars( strPath, NULL );
-    std::string s( path );
-
-    env->ReleaseStringUTFChars( strPath, path );
-    env->DeleteLocalRef( strPath );
-    activity_->vm->DetachCurrentThread();
-
-    pthread_mutex_unlock( &mutex_ );
-    return s;
+std::string JNIHelper::GetCacheDir()
+{
+    if( activity_ == NULL )
+    {
+        LOGI( "JNIHelper has not been initialized. Call init() to initialize the helper" );
+        return std::string( "" );
+    }
+    return cache_dir_;
 }
 
 uint32_t JNIHelper::LoadTexture( const char* file_name )
@@ -246,6 +328,29 @@ uint32_t JNIHelper::LoadTexture( const char* file_name )
 
 }
 
+bool JNIHelper::LoadTextureAsync( const char* file_name,
+        const std::function<void( uint32_t )>& on_loaded )
+{
+    GLUploadWorker* worker = GLContext::GetInstance()->GetUploadWorker();
+    if( worker == NULL )
+    {
+        on_loaded( LoadTexture( file_name ) );
+        return false;
+    }
+
+    //Written by the upload, read by the ready callback after it
+    std::shared_ptr<uint32_t> tex = std::make_shared<uint32_t>( 0 );
+    std::string name( file_name );
+    worker->Queue( [this, name, tex]()
+    {
+        *tex = LoadTexture( name.c_str() );
+    }, [on_loaded, tex]()
+    {
+        on_loaded( *tex );
+    } );
+    return true;
+}
+
 std::string JNIHelper::ConvertString( const char* str,
         const char* encode )
 {
@@ -371,4 +476,25 @@ jstring JNIHelper::GetExternalFilesDirJString( JNIEnv *env )
     return obj_Path;
 }
 
+jstring JNIHelper::GetCacheDirJString( JNIEnv *env )
+{
+    if( activity_ == NULL )
+    {
+        LOGI( "JNIHelper has not been initialized. Call init() to initialize the helper" );
+        return NULL;
+    }
+
+    // Invoking getCacheDir() java API
+    jclass cls_Env = env->FindClass( CLASS_NAME );
+    jmethodID mid = env->GetMethodID( cls_Env, "getCacheDir", "()Ljava/io/File;" );
+    jobject obj_File = env->CallObjectMethod( activity_->clazz, mid );
+    if( obj_File == NULL )
+        return NULL;
+    jclass cls_File = env->FindClass( "java/io/File" );
+    jmethodID mid_getPath = env->GetMethodID( cls_File, "getPath", "()Ljava/lang/String;" );
+    jstring obj_Path = (jstring) env->CallObjectMethod( obj_File, mid_getPath );
+
+    return obj_Path;
+}
+
 } //namespace ndkHelper
@@ -17,9 +17,12 @@
 #pragma once
 
 #include <jni.h>
+#include <sys/types.h>
+#include <functional>
 #include <vector>
 #include <string>
 
+#include <android/asset_manager.h>
 #include <android/log.h>
 #include <android_native_app_glue.h>
 
@@ -30,6 +33,49 @@
 namespace ndk_helper
 {
 
+/******************************************************************
+ * Read only contents of a file opened by JNIHelper::OpenAsset
+ * Files of the external storage and uncompressed APK entries are mapped into memory,
+ * compressed entries stay in the buffer the asset manager inflated them into.
+ * The contents stay valid until the object is reset or destroyed.
+ */
+class AssetData
+{
+private:
+    const uint8_t* data_;
+    size_t size_;
+
+    //page aligned mapping data_ points into, or NULL
+    void* map_base_;
+    size_t map_length_;
+    //asset whose buffer data_ points into, or NULL
+    AAsset* asset_;
+
+    AssetData( const AssetData& rhs );
+    AssetData& operator=( const AssetData& rhs );
+
+    friend class JNIHelper;
+    bool Map( int fd, off_t start, size_t length );
+
+public:
+    AssetData();
+    ~AssetData();
+
+    const uint8_t* GetData() const
+    {
+        return data_;
+    }
+    size_t GetSize() const
+    {
+        return size_;
+    }
+
+    /*
+     * Unmap or close what the object holds, it is empty afterwards
+     */
+    void Reset();
+};
+
 /******************************************************************
  * Helper functions for JNI calls
  * This class wraps JNI calls and provides handy interface calling commonly used features
@@ -45,6 +91,10 @@ class JNIHelper
 {
 private:
     std::string app_name_;
+    //getExternalFilesDir() of the activity, retrieved once by Init
+    std::string external_files_dir_;
+    //getCacheDir() of the activity, retrieved once by Init
+    std::string cache_dir_;
 
     ANativeActivity* activity_;
     jobject jni_helper_java_ref_;
@@ -56,6 +106,7 @@ private:
     mutable pthread_mutex_t mutex_;
 
     jstring GetExternalFilesDirJString( JNIEnv *env );
+    jstring GetCacheDirJString( JNIEnv *env );
     jclass RetrieveClass( JNIEnv *jni,
             const char* class_name );
 
@@ -102,6 +153,21 @@ public:
     bool ReadFile( const char* file_name,
             std::vector<uint8_t>* buffer_ref );
 
+    /*
+     * Open a file from a storage without copying its contents.
+     * Looks in the same places as ReadFile, in the same order.
+     * Takes no lock and makes no JNI call, threads may open files at the same time.
+     *
+     * arguments:
+     * in: file_name, file name to open
+     * out: asset, the contents of the file when the call succeeded, empty otherwise
+     * return:
+     * true when the file was opened
+     * false when it failed to open the file
+     */
+    bool OpenAsset( const char* file_name,
+            AssetData* asset );
+
     /*
      * Load and create OpenGL texture from given file name.
      * The method invokes BitmapFactory in Java so it can read jpeg/png formatted files
@@ -119,6 +185,21 @@ public:
      */
     uint32_t LoadTexture( const char* file_name );
 
+    /*
+     * LoadTexture on the upload thread of GLContext, see GLContext::GetUploadWorker
+     * on_loaded gets the texture name on the render thread, from GLContext::Swap, once the
+     * texture is complete there. Call on the render thread.
+     * Without an upload thread the texture is loaded right away and on_loaded called before returning
+     *
+     * arguments:
+     * in: file_name, file name to read, PNG&JPG is supported
+     * in: on_loaded, gets the result of LoadTexture
+     * return:
+     * true when the texture loads in the background
+     */
+    bool LoadTextureAsync( const char* file_name,
+            const std::function<void( uint32_t )>& on_loaded );
+
     /*
      * Convert string from character code other than UTF-8
      *
@@ -132,12 +213,20 @@ public:
     std::string ConvertString( const char* str,
             const char* encode );
     /*
-     * Retrieve external file directory through JNI call
+     * Retrieve external file directory, retrieved through JNI call once by Init
      *
      * return: std::string containing external file diretory
      */
     std::string GetExternalFilesDir();
 
+    /*
+     * Retrieve the app's cache directory, retrieved through JNI call once by Init
+     * The system may delete its files when storage runs low
+     *
+     * return: std::string containing the cache directory
+     */
+    std::string GetCacheDir();
+
     /*
      * Audio helper
      * Retrieves native audio buffer size which is required to achieve low latency audio
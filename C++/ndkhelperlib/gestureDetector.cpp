@@ -41,6 +41,32 @@ void GestureDetector::SetConfiguration( AConfiguration* config )
     dp_factor_ = 160.f / AConfiguration_getDensity( config );
 }
 
+int32_t GestureDetector::GetSampleCount( const AInputEvent* motion_event )
+{
+    if( (AMotionEvent_getAction( motion_event ) & AMOTION_EVENT_ACTION_MASK)
+            != AMOTION_EVENT_ACTION_MOVE )
+        return 1;
+    return static_cast<int32_t>( AMotionEvent_getHistorySize( motion_event ) ) + 1;
+}
+
+void GestureDetector::GetSample( const AInputEvent* motion_event,
+        int32_t index,
+        int32_t sample,
+        float& x,
+        float& y )
+{
+    if( sample < GetSampleCount( motion_event ) - 1 )
+    {
+        x = AMotionEvent_getHistoricalX( motion_event, index, sample );
+        y = AMotionEvent_getHistoricalY( motion_event, index, sample );
+    }
+    else
+    {
+        x = AMotionEvent_getX( motion_event, index );
+        y = AMotionEvent_getY( motion_event, index );
+    }
+}
+
 //--------------------------------------------------------------------------------
 // TapDetector
 //--------------------------------------------------------------------------------
@@ -225,6 +251,16 @@ GESTURE_STATE PinchDetector::Detect( const AInputEvent* event )
 }
 
 	bool PinchDetector::GetPointers(Vector2& v1, Vector2& v2)
+	{
+		return GetPointers(v1, v2, GetSampleCount() - 1);
+	}
+
+	int32_t PinchDetector::GetSampleCount()
+	{
+		return GestureDetector::GetSampleCount(event_);
+	}
+
+	bool PinchDetector::GetPointers(Vector2& v1, Vector2& v2, int32_t sample)
 	{
 		if (vec_pointers_.size() < 2)
 			return false;
@@ -233,15 +269,15 @@ GESTURE_STATE PinchDetector::Detect( const AInputEvent* event )
 		if (index == -1)
 			return false;
 
-		float x = AMotionEvent_getX(event_, index);
-		float y = AMotionEvent_getY(event_, index);
+		float x, y;
+		GetSample(event_, index, sample, x, y);
 
 		index = FindIndex(event_, vec_pointers_[1]);
 		if (index == -1)
 			return false;
 
-		float x2 = AMotionEvent_getX(event_, index);
-		float y2 = AMotionEvent_getY(event_, index);
+		float x2, y2;
+		GetSample(event_, index, sample, x2, y2);
 
 		v1 = Vector2(x, y);
 		v2 = Vector2(x2, y2);
@@ -332,6 +368,16 @@ GESTURE_STATE DragDetector::Detect( const AInputEvent* event )
 }
 
 	bool DragDetector::GetPointer(Vector2& v)
+	{
+		return GetPointer(v, GetSampleCount() - 1);
+	}
+
+	int32_t DragDetector::GetSampleCount()
+	{
+		return GestureDetector::GetSampleCount(event_);
+	}
+
+	bool DragDetector::GetPointer(Vector2& v, int32_t sample)
 	{
 		if (vec_pointers_.size() < 1)
 			return false;
@@ -340,8 +386,8 @@ GESTURE_STATE DragDetector::Detect( const AInputEvent* event )
 		if (iIndex == -1)
 			return false;
 
-		float x = AMotionEvent_getX(event_, iIndex);
-		float y = AMotionEvent_getY(event_, iIndex);
+		float x, y;
+		GetSample(event_, iIndex, sample, x, y);
 
 		v = Vector2(x, y);
 
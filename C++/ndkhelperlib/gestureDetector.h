@@ -69,6 +69,16 @@ public:
     virtual void SetConfiguration( AConfiguration* config );
 
     virtual GESTURE_STATE Detect( const AInputEvent* motion_event ) = 0;
+
+    //Move events batch every sample since the previous event, the older
+    //ones are historical samples. Sample GetSampleCount() - 1 is the
+    //current position, other events have only that one
+    static int32_t GetSampleCount( const AInputEvent* motion_event );
+    static void GetSample( const AInputEvent* motion_event,
+            int32_t index,
+            int32_t sample,
+            float& x,
+            float& y );
 };
 
 /******************************************************************
@@ -139,6 +149,9 @@ public:
     }
     virtual GESTURE_STATE Detect( const AInputEvent* event );
     bool GetPointers( M3D::Math::Vector2& v1, M3D::Math::Vector2& v2 );
+    //Pinch pointers at one sample of the last event, oldest first
+    int32_t GetSampleCount();
+    bool GetPointers( M3D::Math::Vector2& v1, M3D::Math::Vector2& v2, int32_t sample );
 };
 
 /******************************************************************
@@ -161,6 +174,9 @@ public:
     }
     virtual GESTURE_STATE Detect( const AInputEvent* event );
     bool GetPointer( M3D::Math::Vector2& v );
+    //Drag pointer at one sample of the last event, oldest first
+    int32_t GetSampleCount();
+    bool GetPointer( M3D::Math::Vector2& v, int32_t sample );
 };
 
 }   //namespace ndkHelper
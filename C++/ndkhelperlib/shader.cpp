@@ -16,7 +16,11 @@
 
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "gl3stub.h"
 #include "shader.h"
 #include "JNIHelper.h"
 
@@ -128,21 +132,28 @@ bool shader::CompileShader( GLuint *shader,
         const GLenum type,
         const char *strFileName )
 {
-    std::vector<uint8_t> data;
-    bool b = JNIHelper::GetInstance()->ReadFile( strFileName, &data );
+    AssetData asset;
+    bool b = JNIHelper::GetInstance()->OpenAsset( strFileName, &asset );
     if( !b )
     {
         LOGI( "Can not open a file:%s", strFileName );
         return false;
     }
+    if( !asset.GetSize() )
+        return false;
 
-    return shader::CompileShader( shader, type, data );
+    //straight from the mapping, no copy
+    return shader::CompileShader( shader, type, (const GLchar*) asset.GetData(), asset.GetSize() );
 }
 
 bool shader::LinkProgram( const GLuint prog )
 {
     GLint status;
 
+    //Ask for a binary SaveProgramBinary can retrieve, some drivers only keep one then
+    if( glProgramParameteri )
+        glProgramParameteri( prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
     glLinkProgram( prog );
 
 #if defined(DEBUG)
@@ -188,5 +199,163 @@ bool shader::ValidateProgram( const GLuint prog )
     return true;
 }
 
+//--------------------------------------------------------------------------------
+// Program binary cache
+//--------------------------------------------------------------------------------
+//Header of a cache file, the binary follows
+struct PROGRAM_BINARY_HEADER
+{
+    uint32_t magic;
+    uint32_t format;
+    uint32_t length;
+};
+
+static const uint32_t PROGRAM_BINARY_MAGIC = 0x3142504d; //"MPB1"
+
+//FNV-1a
+static uint64_t HashBytes( uint64_t hash,
+        const void* data,
+        size_t size )
+{
+    const uint8_t* p = (const uint8_t*) data;
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t HashString( uint64_t hash,
+        const char* str )
+{
+    //The terminator too, "ab" + "c" and "a" + "bc" differ
+    return str ? HashBytes( hash, str, strlen( str ) + 1 ) : HashBytes( hash, "", 1 );
+}
+
+static std::string ProgramBinaryPath( const uint64_t key )
+{
+    std::string dir = JNIHelper::GetInstance()->GetCacheDir();
+    if( dir.empty() )
+        return dir;
+    char name[64];
+    snprintf( name, sizeof(name), "/program_%016llx.bin", (unsigned long long) key );
+    return dir + name;
+}
+
+bool shader::ProgramBinaryKey( const char* vsh_file_name,
+        const char* fsh_file_name,
+        const std::map<std::string, std::string>* map_parameters,
+        const char* link_state,
+        uint64_t* key )
+{
+    uint64_t hash = 14695981039346656037ull;
+    const char* files[] = { vsh_file_name, fsh_file_name };
+    for( int32_t i = 0; i < 2; ++i )
+    {
+        AssetData asset;
+        if( !JNIHelper::GetInstance()->OpenAsset( files[i], &asset ) )
+            return false;
+        hash = HashBytes( hash, asset.GetData(), asset.GetSize() );
+        hash = HashBytes( hash, "", 1 );
+    }
+    if( map_parameters )
+    {
+        std::map<std::string, std::string>::const_iterator it;
+        for( it = map_parameters->begin(); it != map_parameters->end(); ++it )
+        {
+            hash = HashString( hash, it->first.c_str() );
+            hash = HashString( hash, it->second.c_str() );
+        }
+    }
+    hash = HashString( hash, link_state );
+    //A driver update changes the binary format without telling
+    hash = HashString( hash, (const char*) glGetString( GL_RENDERER ) );
+    hash = HashString( hash, (const char*) glGetString( GL_VERSION ) );
+
+    *key = hash;
+    return true;
+}
+
+bool shader::LoadProgramBinary( const GLuint prog,
+        const uint64_t key )
+{
+    //GLES3 only, the stubs stay NULL on GLES2
+    if( glProgramBinary == NULL )
+        return false;
+
+    std::string path = ProgramBinaryPath( key );
+    if( path.empty() )
+        return false;
+    FILE* file = fopen( path.c_str(), "rb" );
+    if( file == NULL )
+        return false;
+
+    PROGRAM_BINARY_HEADER header;
+    std::vector<uint8_t> binary;
+    bool read = fread( &header, sizeof(header), 1, file ) == 1 && header.magic == PROGRAM_BINARY_MAGIC
+            && header.length > 0;
+    if( read )
+    {
+        binary.resize( header.length );
+        read = fread( &binary[0], header.length, 1, file ) == 1;
+    }
+    fclose( file );
+
+    if( read )
+    {
+        glProgramBinary( prog, header.format, &binary[0], header.length );
+        GLint status = 0;
+        glGetProgramiv( prog, GL_LINK_STATUS, &status );
+        if( status )
+            return true;
+    }
+
+    LOGI( "Program binary %s is stale, compiling", path.c_str() );
+    unlink( path.c_str() );
+    return false;
+}
+
+bool shader::SaveProgramBinary( const GLuint prog,
+        const uint64_t key )
+{
+    if( glGetProgramBinary == NULL )
+        return false;
+
+    std::string path = ProgramBinaryPath( key );
+    if( path.empty() )
+        return false;
+
+    GLint length = 0;
+    glGetProgramiv( prog, GL_PROGRAM_BINARY_LENGTH, &length );
+    if( length <= 0 )
+        return false;
+
+    PROGRAM_BINARY_HEADER header;
+    std::vector<uint8_t> binary( length );
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary( prog, length, &written, &format, &binary[0] );
+    if( written <= 0 )
+        return false;
+    header.magic = PROGRAM_BINARY_MAGIC;
+    header.format = format;
+    header.length = written;
+
+    //Written aside and renamed, a launch killed halfway leaves no broken file behind
+    std::string temp_path = path + ".tmp";
+    FILE* file = fopen( temp_path.c_str(), "wb" );
+    if( file == NULL )
+        return false;
+    bool ok = fwrite( &header, sizeof(header), 1, file ) == 1 && fwrite( &binary[0], written, 1, file ) == 1;
+    ok = fclose( file ) == 0 && ok;
+    if( !ok || rename( temp_path.c_str(), path.c_str() ) != 0 )
+    {
+        unlink( temp_path.c_str() );
+        return false;
+    }
+    return true;
+}
+
 } //namespace ndkHelper
 
@@ -118,6 +118,51 @@ bool LinkProgram( const GLuint prog );
  *
  */
 bool ValidateProgram( const GLuint prog );
+
+/******************************************************************
+ * ProgramBinaryKey()
+ * Key of a program in the binary cache, a hash of everything that goes into it:
+ * the sources, the patch parameters, what the caller sets before linking
+ * (e.g. attribute bindings) and the GL_RENDERER and GL_VERSION of the driver
+ *
+ * arguments:
+ *  in: vsh_file_name, fsh_file_name, shader files as CompileShader() reads them
+ *  in: map_parameters, patch parameters, NULL for none
+ *  in: link_state, anything else the program depends on, NULL for none
+ *  out: key, key of the program
+ * return: false if a file could not be read
+ *
+ */
+bool ProgramBinaryKey( const char* vsh_file_name,
+        const char* fsh_file_name,
+        const std::map<std::string, std::string>* map_parameters,
+        const char* link_state,
+        uint64_t* key );
+
+/******************************************************************
+ * LoadProgramBinary()
+ * Replaces compiling and linking: loads the binary stored under key from the app's cache
+ * directory into prog. A binary the driver rejects, e.g. after an update, is deleted.
+ *
+ * arguments:
+ *  in: prog, program without shaders
+ *  in: key, see ProgramBinaryKey()
+ * return: true if prog is linked, false if it needs a full compile
+ *
+ */
+bool LoadProgramBinary( const GLuint prog, const uint64_t key );
+
+/******************************************************************
+ * SaveProgramBinary()
+ * Stores the binary of a program linked by LinkProgram() for the next launch
+ *
+ * arguments:
+ *  in: prog, linked program
+ *  in: key, see ProgramBinaryKey()
+ * return: true if the binary was written
+ *
+ */
+bool SaveProgramBinary( const GLuint prog, const uint64_t key );
 } //namespace shader
 
 } //namespace ndkHelper
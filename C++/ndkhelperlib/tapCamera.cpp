@@ -86,7 +86,9 @@ namespace ndk_helper
 		camera_rotation_ = 0.f;
 
 		m_Vec2DragDelta = Vector2(0, 0);
+		m_Vec2DragInput = Vector2(0, 0);
 		m_Vec3OffsetDelta = Vector3(0, 0, 0);
+		m_Vec3OffsetLast = Vector3(0, 0, 0);
 
 		momentum_ = false;
 	}
@@ -129,11 +131,28 @@ namespace ndk_helper
 		}
 		else
 		{
+			//the input of the whole frame, whatever number of samples it came in
+			if (dragging_)
+			{
+				m_Vec2DragDelta = m_Vec2DragDelta * MOMENTUM_FACTOR + m_Vec2DragInput;
+				m_Vec2DragInput = Vector2(0, 0);
+			}
+			if (pinching_)
+			{
+				m_Vec3OffsetDelta = m_Vec3OffsetDelta * MOMENTUM_FACTOR + m_Vec3OffsetNow - m_Vec3OffsetLast;
+				m_Vec3OffsetLast = m_Vec3OffsetNow;
+			}
+
 			m_Vec2DragDelta *= MOMENTUM_FACTOR;
 			m_Vec3OffsetDelta = m_Vec3OffsetDelta * MOMENTUM_FACTOR;
 			BallUpdate();
 		}
 
+		TransformUpdate();
+	}
+
+	void TapCamera::TransformUpdate()
+	{
 		Vector3 vec = m_Vec3Offset + m_Vec3OffsetNow;
 		Vector3 vec_tmp(TRANSFORM_FACTOR, -TRANSFORM_FACTOR, TRANSFORM_FACTORZ);
 
@@ -164,7 +183,7 @@ namespace ndk_helper
 	void TapCamera::Reset(const bool bAnimate)
 	{
 		InitParameters();
-		Update();
+		TransformUpdate();
 
 	}
 
@@ -187,10 +206,15 @@ namespace ndk_helper
 		momentum_ = false;
 		m_Vec2LastInput = vec;
 		m_Vec2DragDelta = Vector2(0,0);
+		m_Vec2DragInput = Vector2(0,0);
 	}
 
 	void TapCamera::EndDrag()
 	{
+		//input since the last Update
+		m_Vec2DragDelta = m_Vec2DragDelta * MOMENTUM_FACTOR + m_Vec2DragInput;
+		m_Vec2DragInput = Vector2(0,0);
+
 		m_QuatBallDown = m_QuatBallNow;
 		m_QuatBallRot = M3D::Math::Quaternion(0,0,0,1);
 
@@ -207,7 +231,7 @@ namespace ndk_helper
 		Vector2 vec = v * m_Vec2Flip;
 		m_Vec2BallNow = vec;
 
-		m_Vec2DragDelta = m_Vec2DragDelta * MOMENTUM_FACTOR + (vec - m_Vec2LastInput);
+		m_Vec2DragInput += vec - m_Vec2LastInput;
 		m_Vec2LastInput = vec;
 	}
 
@@ -242,10 +266,15 @@ namespace ndk_helper
 
 		    //Init momentum factors
 		m_Vec3OffsetDelta = Vector3(0,0,0);
+		m_Vec3OffsetLast = m_Vec3OffsetNow;
 	}
 #if USE_M3D_MATH
 	void TapCamera::EndPinch()
 	{
+		//input since the last Update
+		m_Vec3OffsetDelta = m_Vec3OffsetDelta * MOMENTUM_FACTOR + m_Vec3OffsetNow - m_Vec3OffsetLast;
+		m_Vec3OffsetLast = Vector3(0, 0, 0);
+
 		pinching_ = false;
 		momentum_ = true;
 		momemtum_steps_ = 1.f;
@@ -283,8 +312,6 @@ namespace ndk_helper
 		if (!pinching_)
 			return;
 
-		m_Vec3OffsetLast = m_Vec3OffsetNow;
-
 		float x_diff, y_diff;
 		Vector2 vec = v1 - v2;
 		x_diff = vec.x;
@@ -303,8 +330,6 @@ namespace ndk_helper
 		vec = (v1 + v2) / 2.f - m_Vec2PinchStartCenter;
 		m_Vec3OffsetNow = Vector3(vec, flip_z_ * f);
 
-		m_Vec3OffsetDelta = m_Vec3OffsetDelta * MOMENTUM_FACTOR + m_Vec3OffsetNow - m_Vec3OffsetLast;
-
 		float fRotation = atan2f(y_diff, x_diff);
 		camera_rotation_now_ = fRotation - camera_rotation_start_;
 
@@ -69,7 +69,9 @@ private:
     //Momentum support
     bool momentum_;
 
+	//Drag and Pinch only record the input, Update integrates it once per frame
 	M3D::Math::Vector2 m_Vec2DragDelta;
+	M3D::Math::Vector2 m_Vec2DragInput;
 	M3D::Math::Vector2 m_Vec2LastInput;
 	M3D::Math::Vector3 m_Vec3OffsetLast;
 	M3D::Math::Vector3 m_Vec3OffsetDelta;
@@ -87,13 +89,16 @@ private:
 	M3D::Math::Vector3 PointOnSphere(M3D::Math::Vector2& point);
 	
     void BallUpdate();
+    void TransformUpdate();
     void InitParameters();
 public:
     TapCamera();
     virtual ~TapCamera();
     void BeginDrag( const M3D::Math::Vector2& vec );
     void EndDrag();
+    //Any number of samples per frame, Update integrates all of them at once
     void Drag( const M3D::Math::Vector2& vec );
+    //Once per frame
     void Update();
 
 	M3D::Math::Matrix4x4& GetRotation();
@@ -4,6 +4,7 @@
 #include "GUIEvents.h"
 #include <string>
 
+#include "./GUIEventQueue.h"
 #include "./GUIElement.h"
 #include "./GUIStructures.h"
 
@@ -60,6 +61,11 @@ public:
     void SetWhileDownCallback(WhileDownDelegate whileDownDelegate);
     void SetWhileHoverCallback(WhileHoverDelegate whileHoverDelegate);
 
+    //callbacks are recorded to the queue, called in place without one
+    void SetEventQueue(GUIEventQueue* queue);
+    //callbacks go to the queue's defer delegate
+    void SetDeferredCallbacks(bool val);
+
     void SetState(ButtonElementState state);
 
     void AddJoinedButton(GUIButton* btn);
@@ -75,7 +81,11 @@ private:
     bool hasBeenDown;
     std::vector<GUIButton*> joined;
 
+    GUIEventQueue* eventQueue;
+    bool deferredCallbacks;
+
     void SetStateJoined(ButtonElementState state);
+    void Fire(GUIEventType type, fastdelegate::FastDelegate1<GUIElement*>& handler);
 };
 }
 
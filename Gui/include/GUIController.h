@@ -7,10 +7,13 @@ class GUIElement;
 class GUIScreen;
 class GUIButton;
 class GUICheckBox;
+class GUIFlatTree;
 }
 
 #include <string>
 
+#include "./GUIEventQueue.h"
+#include "./GUIHitGrid.h"
 #include "./GUIStructures.h"
 
 namespace GUISystem {
@@ -22,8 +25,14 @@ public:
 
     static bool IsMouseOver(GUIScreen* sc, GUIElement* el, int x, int y);
 
+    //element callbacks are dispatched in one batch at the end
     void UpdateElements();
     GUIElement* GetMouseOverElement() const;
+    //hit test with a scan of tree instead of the grid, laid out by its owner
+    //NULL goes back to the grid
+    void SetFlatTree(GUIFlatTree* tree);
+
+    GUIEventQueue& GetEventQueue();
 
 protected:
     GUIScreen* screen;
@@ -31,6 +40,10 @@ protected:
 
 private:
     std::vector<GUIElement*> lastMouseOverEls;
+    //brought up to date by every query
+    mutable GUIHitGrid hitGrid;
+    GUIFlatTree* flatTree;
+    GUIEventQueue eventQueue;
 
     void UpdateElementsFromControlPoint(int index);
 
@@ -5,6 +5,8 @@ namespace GUISystem {
 class GUIScreen;
 class GUIBakery;
 class GUIController;
+class GUIFlatTree;
+class GUIHitGrid;
 
 class GUIPanel;
 class GUIImage;
@@ -44,6 +46,10 @@ public:
 
     bool IsVisible() const;
     bool IsBaked() const;
+    //set by the renderer while the element's subtree is drawn from a cached texture
+    void SetBaked(bool val);
+    //changes whenever the element or one of its descendants looks different
+    unsigned int GetRevision() const;
 
     bool CanBeBaked() const;
     virtual void SetCanBaBaked(bool val);
@@ -64,11 +70,22 @@ public:
 
     void AddChild(GUIElement* el);
 
+    //proportions of an element with pos, dim and max within parentProportions, in pixels
+    static ElementProportions Place(const ElementPos& pos, const ElementDim& dim, const ElementDimMax& max,
+        const ElementProportions& parentProportions);
+
     friend class GUISystem::GUIScreen;
     friend class GUISystem::GUIBakery;
     friend class GUISystem::GUIController;
+    friend class GUISystem::GUIFlatTree;
+    friend class GUISystem::GUIHitGrid;
 
 protected:
+    //layout of the element changed, relayout it and its children
+    void MarkDirty();
+    //only the look changed, e.g. the active texture
+    void MarkChanged();
+
     std::string name;
 
     ElementPos pos;
@@ -93,6 +110,16 @@ protected:
 private:
     bool baked;
 
+    //a descendant needs its proportions recalculated
+    bool subtreeDirty;
+    unsigned int revision;
+    //parent proportions of the last calculation
+    ElementProportions layoutParent;
+
+    //flat tree the element is stored in and its index there, NULL when none
+    GUIFlatTree* flatTree;
+    int flatIndex;
+
     void SetMouseMove(int x, int y);
     void CalculateProportions(const ElementProportions& parentProportions);
 };
@@ -0,0 +1,72 @@
+#ifndef GUI_SYSTEM_EVENT_QUEUE_H
+#define GUI_SYSTEM_EVENT_QUEUE_H
+
+namespace GUISystem {
+class GUIElement;
+}
+
+#include <string>
+#include <vector>
+
+#include "GUIStructures.h"
+
+namespace GUISystem {
+
+typedef enum GUIEventType {
+    EVENT_CLICK = 0,
+    EVENT_DOWN = 1,
+    EVENT_UP = 2,
+    EVENT_OVER = 3,
+    EVENT_STATE_CHANGE = 4,
+
+    //repeated every update, coalesced within one batch
+    EVENT_WHILE_DOWN = 5,
+    EVENT_WHILE_HOVER = 6
+
+} GUIEventType;
+
+//Recorded call of an element delegate
+typedef struct GUIEvent {
+    GUIEventType type;
+    fastdelegate::FastDelegate1<GUIElement*> handler;
+    GUIElement* element;
+    bool deferred; //handed to the defer delegate instead of called in place
+    int count; //recorded times of a coalesced event
+
+} GUIEvent;
+
+//Runs a deferred event, eg. in a worker job
+typedef fastdelegate::FastDelegate1<const GUIEvent&> GUIEventDeferDelegate;
+
+//Events of one GUI update, dispatched together after it
+//
+//Element delegates are recorded while the states are updated and called
+//in recorded order by Dispatch. While* events of the same handler and
+//element are recorded once per batch, however many control points or
+//state transitions repeat them.
+//Deferred events go to the defer delegate, it may run them on a worker,
+//their handlers must not touch the GUI then.
+class GUIEventQueue {
+public:
+    GUIEventQueue();
+
+    void Push(GUIEventType type, fastdelegate::FastDelegate1<GUIElement*> handler, GUIElement* element, bool deferred);
+
+    //call the recorded events and empty the queue
+    void Dispatch();
+
+    //without a defer delegate deferred events are called in place
+    void SetDeferDelegate(GUIEventDeferDelegate defer);
+
+    int GetCount() const;
+
+private:
+    std::vector<GUIEvent> events;
+    //dispatched batch, kept to avoid reallocating
+    std::vector<GUIEvent> dispatching;
+
+    GUIEventDeferDelegate defer;
+};
+}
+
+#endif
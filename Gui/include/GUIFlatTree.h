@@ -0,0 +1,100 @@
+#ifndef GUI_SYSTEM_FLAT_TREE_H
+#define GUI_SYSTEM_FLAT_TREE_H
+
+namespace GUISystem {
+class GUIElement;
+}
+
+#include <string>
+#include <vector>
+
+#include "GUIStructures.h"
+
+namespace GUISystem {
+
+//Element trees stored flat, in depth first order, with the
+//parent and next sibling of every element as indices
+//The data layout and hit tests read every frame is kept
+//in arrays of its own (proportions, visibility, dirty bits),
+//so both passes are linear scans instead of walking pointers
+//across the heap; the elements themselves are only touched
+//when they are dirty or their proportions changed
+//Elements report layout changes and new childs to the tree
+//they are stored in, a new child flattens the trees again
+//at the next Layout. Elements stay owned by their creator,
+//destroy the tree or Build it again before deleting them
+class GUIFlatTree {
+public:
+    GUIFlatTree();
+    ~GUIFlatTree();
+
+    //flatten the trees of roots, every element is laid out by the next Layout
+    void Build(const std::vector<GUIElement*>& roots);
+    //take trees already in depth first order, parents[i] is the index of the
+    //parent of elements[i] or -1 for a root and comes before i
+    //the childs of every element must be in that order too
+    void Build(const std::vector<GUIElement*>& elements, const std::vector<int>& parents);
+
+    //lay out the dirty elements and the ones whose parent moved, in place
+    //of GUIElement::CalculateProportions for the trees of this one
+    void Layout(const ElementProportions& screen);
+
+    //most top visible element at pixel [x, y], text captions are ignored
+    //same element as GUIHitGrid::Find, up to date after Layout
+    GUIElement* Find(int x, int y) const;
+
+    int GetCount() const;
+    GUIElement* GetElement(int index) const;
+    //-1 for the roots
+    int GetParent(int index) const;
+    //-1 for the last child
+    int GetNextSibling(int index) const;
+
+    friend class GUISystem::GUIElement;
+
+private:
+    typedef enum FLAGS {
+        FLAG_VISIBLE = 1,
+        FLAG_DIRTY = 2,
+        //proportions changed by the running Layout, the childs follow
+        FLAG_MOVED = 4,
+        FLAG_CAPTION = 8,
+        //text panels stay dirty, see GUIElement::CalculateProportions
+        FLAG_TEXT_PANEL = 16
+
+    } FLAGS;
+
+    std::vector<GUIElement*> roots;
+
+    //structure and cold data, by index
+    std::vector<GUIElement*> elements;
+    std::vector<int> parents;
+    std::vector<int> nextSiblings;
+    std::vector<ElementPos> positions;
+    std::vector<ElementDim> dims;
+    std::vector<ElementDimMax> maxs;
+
+    //hot data, by index
+    std::vector<float> left;
+    std::vector<float> top;
+    std::vector<float> right;
+    std::vector<float> bottom;
+    std::vector<float> depth;
+    std::vector<unsigned char> flags;
+
+    ElementProportions screen;
+    bool anyDirty;
+    bool structureChanged;
+
+    void Release();
+    int Flatten(GUIElement* el, int parent);
+    void Store();
+    ElementProportions GetProportions(int index) const;
+
+    void MarkDirty(int index);
+    void SetVisible(int index, bool val);
+    void MarkStructureChanged();
+};
+}
+
+#endif
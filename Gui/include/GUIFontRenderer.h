@@ -0,0 +1,108 @@
+#ifndef GUI_SYSTEM_FONT_RENDERER_H
+#define GUI_SYSTEM_FONT_RENDERER_H
+
+namespace GUISystem {
+class IGlyphRasterizer;
+struct GUIGlyphBitmap;
+}
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace GUISystem {
+
+//One glyph of a shaped text, position in pixels at the base size
+//from the top left of the text, uv in the atlas
+typedef struct GUIGlyphQuad {
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+
+} GUIGlyphQuad;
+
+//Text laid out once at the base size, any font size is a scale of it
+typedef struct GUIShapedText {
+    GUIShapedText()
+        : width(0.0f)
+        , height(0.0f)
+        , baseSize(0)
+        , atlasRevision(0){};
+
+    std::vector<GUIGlyphQuad> quads;
+
+    float width;
+    float height;
+    int baseSize;
+
+    unsigned int atlasRevision; //atlas revision that holds all of the glyphs
+
+} GUIShapedText;
+
+//Glyph cache in one shared signed distance field atlas
+//
+//Glyphs are rasterized on demand at the base size and stored as
+//distances to the glyph outline, spread pixels on either side,
+//0.5 is the outline. Sampled with linear filtering the edge stays
+//sharp at any scale, so sizes never rasterize a glyph again.
+//Atlas texels are written once, glyphs are never moved.
+class GUIFontRenderer {
+public:
+    GUIFontRenderer(IGlyphRasterizer* rasterizer, int atlasSize = 1024, int baseSize = 32, int spread = 4);
+    ~GUIFontRenderer();
+
+    //lay out text of fontFace, missing glyphs are added to the atlas
+    void Shape(const std::string& fontFace, const std::string& text, GUIShapedText& shaped);
+
+    int GetBaseSize() const;
+    int GetSpread() const;
+    int GetAtlasSize() const;
+    const unsigned char* GetAtlas() const;
+    //changes with every glyph written to the atlas
+    unsigned int GetAtlasRevision() const;
+
+    //texels written since the last call, false if there are none
+    bool TakeDirtyRect(int& x, int& y, int& w, int& h);
+
+private:
+    typedef struct Glyph {
+        bool hasQuad;
+        float x0, y0, x1, y1; //relative to the pen position at the top of the line
+        float u0, v0, u1, v1;
+        float advance;
+
+    } Glyph;
+
+    typedef struct Face {
+        float ascent;
+        float lineHeight;
+
+    } Face;
+
+    IGlyphRasterizer* rasterizer;
+
+    int atlasSize;
+    int baseSize;
+    int spread;
+    std::vector<unsigned char> atlas;
+    unsigned int atlasRevision;
+
+    //shelf packing, rows of glyphs from the top
+    int shelfX;
+    int shelfY;
+    int shelfH;
+
+    //dirty texels, empty when dirtyX0 >= dirtyX1
+    int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+
+    std::map<std::pair<std::string, unsigned int>, Glyph> glyphs;
+    std::map<std::string, Face> faces;
+
+    const Face& GetFace(const std::string& fontFace);
+    const Glyph& GetGlyph(const std::string& fontFace, unsigned int codepoint);
+    bool Pack(int w, int h, int& x, int& y);
+    void WriteDistanceField(const GUIGlyphBitmap& bitmap, int x, int y);
+};
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef GUI_SYSTEM_HIT_GRID_H
+#define GUI_SYSTEM_HIT_GRID_H
+
+namespace GUISystem {
+class GUIElement;
+}
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GUIStructures.h"
+
+namespace GUISystem {
+
+//Uniform grid over the screen, every cell lists the elements
+//whose proportions overlap it
+//Hit tests only look at the elements of one cell
+//Trees are indexed again when the revision of their root changes,
+//the whole grid when elements are added or the screen is resized
+class GUIHitGrid {
+public:
+    static const int CELL_SIZE = 64; //pixels
+
+    GUIHitGrid();
+
+    void Update(const std::vector<GUIElement*>& elements, const ElementProportions& screen);
+
+    //most top visible element at pixel [x, y], text captions are ignored
+    GUIElement* Find(int x, int y) const;
+
+private:
+    typedef struct Entry {
+        GUIElement* el;
+        //covered cells, empty when cellX0 > cellX1
+        int cellX0, cellY0, cellX1, cellY1;
+
+    } Entry;
+
+    typedef struct Root {
+        GUIElement* el;
+        unsigned int revision;
+
+    } Root;
+
+    std::vector<Entry> entries; //in order of the screen elements
+    std::vector<Root> roots;
+    std::unordered_map<const GUIElement*, int> indices;
+    std::vector<std::vector<int> > cells;
+
+    int cellsX;
+    int cellsY;
+    float screenW;
+    float screenH;
+
+    void Rebuild(const std::vector<GUIElement*>& elements, const ElementProportions& screen);
+    void Reindex(GUIElement* el);
+    void Insert(int index);
+    void Remove(int index);
+};
+}
+
+#endif
@@ -8,6 +8,7 @@ class GUIFontRenderer;
 #include <string>
 
 #include "GUIElement.h"
+#include "GUIFontRenderer.h"
 #include "GUIStructures.h"
 
 namespace GUISystem {
@@ -27,6 +28,8 @@ public:
     int GetFontSize() const;
     float GetRotationAngle() const;
     float GetFontPercentSize() const;
+    //glyph quads at the font renderer's base size, NULL before the first Update
+    const GUIShapedText* GetShapedText() const;
 
     void SetFontFace(const std::string& fontFace);
     void SetText(const std::string& text);
@@ -45,6 +48,9 @@ protected:
 
     std::string fontAtlasName;
 
+    GUIShapedText shaped;
+    bool shapedDirty;
+
 private:
 };
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace GUISystem {
+
+//Coverage of one glyph, rows from top to bottom
+typedef struct GUIGlyphBitmap {
+    int width;
+    int height;
+
+    //from the pen position on the baseline to the top left texel, y up
+    int bearingX;
+    int bearingY;
+
+    float advance; //pen movement in pixels
+
+    std::vector<unsigned char> coverage; //width * height, 0 - 255
+
+} GUIGlyphBitmap;
+
+//Font backend of GUIFontRenderer (FreeType, stb_truetype, OS fonts...)
+class IGlyphRasterizer {
+public:
+    virtual ~IGlyphRasterizer(){};
+
+    virtual bool GetLineMetrics(const std::string& fontFace, int pixelSize, float& ascent, float& lineHeight) = 0;
+    //false if the face has no such glyph
+    virtual bool Rasterize(const std::string& fontFace, unsigned int codepoint, int pixelSize, GUIGlyphBitmap& glyph) = 0;
+    virtual float GetKerning(const std::string& /*fontFace*/, unsigned int /*left*/, unsigned int /*right*/, int /*pixelSize*/)
+    {
+        return 0.0f;
+    };
+};
+}
@@ -6,6 +6,8 @@ GUIButton::GUIButton(const std::string& name)
 {
     this->actState = BTN_STATE_NON_ACTIVE;
     this->hasBeenDown = false;
+    this->eventQueue = NULL;
+    this->deferredCallbacks = false;
 }
 
 GUIButton::~GUIButton()
@@ -59,7 +61,7 @@ void GUIButton::SetTextures(GUIButtonTextures& textures)
 
     //we need to "rebake" it, because new textures can be in atlas
     //and we need new positions
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 void GUIButton::AddJoinedButton(GUIButton* btn)
@@ -102,10 +104,43 @@ void GUIButton::SetOnStateChangeCallback(OnStateChangeDelegate onStateChange)
     this->delegates.onStateChange = onStateChange;
 }
 
+void GUIButton::SetEventQueue(GUIEventQueue* queue)
+{
+    this->eventQueue = queue;
+}
+
+void GUIButton::SetDeferredCallbacks(bool val)
+{
+    this->deferredCallbacks = val;
+}
+
+/*-----------------------------------------------------------
+Function:	Fire
+Parametrs:
+	[in] type - event type
+	[in] handler - delegate to call
+
+Record the call to the event queue or call it in place
+-------------------------------------------------------------*/
+void GUIButton::Fire(GUIEventType type, fastdelegate::FastDelegate1<GUIElement*>& handler)
+{
+    if (handler.empty()) {
+        return;
+    }
+
+    if (this->eventQueue != NULL) {
+        this->eventQueue->Push(type, handler, this, this->deferredCallbacks);
+    } else {
+        handler(this);
+    }
+}
+
 void GUIButton::SetState(ButtonElementState newState)
 {
 
     for (uint32_t i = 0; i < this->joined.size(); i++) {
+        //joined buttons record to the same queue
+        this->joined[i]->eventQueue = this->eventQueue;
         this->joined[i]->SetStateJoined(newState);
     }
 
@@ -119,18 +154,12 @@ void GUIButton::SetStateJoined(ButtonElementState newState)
         //call repeat triggers
         if ((this->hasBeenDown) && (this->actState == BTN_STATE_CLICKED)) {
             //printf("whileDown button (x) ");
-            // TODO:
-            if (this->delegates.whileDown.empty() == false) {
-                this->delegates.whileDown(this);
-            }
+            this->Fire(EVENT_WHILE_DOWN, this->delegates.whileDown);
         }
 
         if (this->actState == BTN_STATE_OVER) {
             //printf("whileHover button (x) ");
-            // TODO:
-            if (this->delegates.whileHover.empty() == false) {
-                this->delegates.whileHover(this);
-            }
+            this->Fire(EVENT_WHILE_HOVER, this->delegates.whileHover);
         }
 
         return;
@@ -140,38 +169,30 @@ void GUIButton::SetStateJoined(ButtonElementState newState)
         //dummy state to "erase" safely states without trigger
         //delegates associated with action
         //dummy = NON_ACTIVE state
+        if (this->actState != BTN_STATE_NON_ACTIVE) {
+            this->MarkChanged();
+        }
         this->actState = BTN_STATE_NON_ACTIVE;
         return;
     }
-    // TODO:
-    if (this->delegates.onStateChange.empty() == false) {
-        //trigger action for state change
-        this->delegates.onStateChange(this);
-    }
+    //trigger action for state change
+    this->Fire(EVENT_STATE_CHANGE, this->delegates.onStateChange);
 
     //was not active => not mouse over
     if ((this->actState == BTN_STATE_NON_ACTIVE) && (newState == BTN_STATE_OVER)) {
         //printf("onHover button \n");
-        if (this->delegates.onOver.empty() == false) {
-            this->delegates.onOver(this);
-        }
-        if (this->delegates.whileHover.empty() == false) {
-            this->delegates.whileHover(this);
-        }
+        this->Fire(EVENT_OVER, this->delegates.onOver);
+        this->Fire(EVENT_WHILE_HOVER, this->delegates.whileHover);
     }
 
     //was clicked => now non active
     if ((this->actState == BTN_STATE_CLICKED) && (newState == BTN_STATE_NON_ACTIVE)) {
         if (this->hasBeenDown) {
             // printf("onClick button \n");
-            if (this->delegates.onClick.empty() == false) {
-                this->delegates.onClick(this);
-            }
+            this->Fire(EVENT_CLICK, this->delegates.onClick);
         } else {
             // printf("onUp button \n");
-            if (this->delegates.onUp.empty() == false) {
-                this->delegates.onUp(this);
-            }
+            this->Fire(EVENT_UP, this->delegates.onUp);
         }
     }
 
@@ -186,15 +207,12 @@ void GUIButton::SetStateJoined(ButtonElementState newState)
     {
         this->hasBeenDown = true;
         //printf("onDown button \n");
-        if (this->delegates.onDown.empty() == false) {
-            this->delegates.onDown(this);
-        }
-        if (this->delegates.whileDown.empty() == false) {
-            this->delegates.whileDown(this);
-        }
+        this->Fire(EVENT_DOWN, this->delegates.onDown);
+        this->Fire(EVENT_WHILE_DOWN, this->delegates.whileDown);
     } else {
         this->hasBeenDown = false;
     }
 
     this->actState = newState;
+    this->MarkChanged();
 }
\ No newline at end of file
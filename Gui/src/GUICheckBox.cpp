@@ -47,6 +47,7 @@ const GUICheckBoxTextures& GUICheckBox::GetTextures() const
 void GUICheckBox::SetTextures(GUICheckBoxTextures& textures)
 {
     this->textures = textures;
+    this->MarkChanged();
 }
 
 void GUICheckBox::SetState(CheckBoxElementState newState)
@@ -64,4 +65,5 @@ void GUICheckBox::SetState(CheckBoxElementState newState)
     }
 
     this->state = newState;
+    this->MarkChanged();
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "GUIButton.h"
 #include "GUICheckBox.h"
 #include "GUIElement.h"
+#include "GUIFlatTree.h"
 #include "GUIScreen.h"
 #include "GUIStructures.h"
 
@@ -18,6 +19,7 @@ GUIController::GUIController(GUIScreen* sc, IControls* control)
 {
     this->screen = sc;
     this->control = control;
+    this->flatTree = NULL;
 
     for (int i = 0; i < this->control->GetControlsPointsCount(); i++) {
         this->lastMouseOverEls.push_back(NULL);
@@ -86,6 +88,8 @@ Returns:
 
 Get the most top element that has mouse over it
 Text captions are gnored
+Only the elements in the grid cell under the mouse are tested,
+or the whole flat tree when one is set
 -------------------------------------------------------------*/
 GUIElement* GUIController::GetMouseOverElement() const
 {
@@ -97,22 +101,12 @@ GUIElement* GUIController::GetMouseOverElement() const
     }
 
     GUIElement* mouseOver = NULL;
-    float maxDepth = -999999;
-
-    std::vector<GUIElement*>& els = this->screen->GetElements();
-
-    for (uint32_t i = 0; i < els.size(); i++) {
-        if (els[i]->GetTextCaption() != NULL) {
-            //ignore text captions
-            continue;
-        }
-
-        if (GUIController::IsMouseOver(this->screen, els[i], x, y)) {
-            if (els[i]->GetProportions().depth >= maxDepth) {
-                mouseOver = els[i];
-                maxDepth = els[i]->GetProportions().depth;
-            }
-        }
+    if (this->flatTree != NULL) {
+        mouseOver = this->flatTree->Find(x, y);
+    } else {
+        //cheap when no layout changed since the last query
+        this->hitGrid.Update(this->screen->GetElements(), this->screen->GetProportions());
+        mouseOver = this->hitGrid.Find(x, y);
     }
 
     if (mouseOver != NULL) {
@@ -132,6 +126,19 @@ void GUIController::UpdateElements()
     }
 
     this->control->SetActiveControlPoint(active); //restore active point
+
+    //handlers run after all states are updated
+    this->eventQueue.Dispatch();
+}
+
+void GUIController::SetFlatTree(GUIFlatTree* tree)
+{
+    this->flatTree = tree;
+}
+
+GUIEventQueue& GUIController::GetEventQueue()
+{
+    return this->eventQueue;
 }
 
 void GUIController::UpdateElementsFromControlPoint(int index)
@@ -274,6 +281,7 @@ NON_ACTIVE -
 -------------------------------------------------------------*/
 void GUIController::UpdateGUIButtonState(ControlState ctrl, GUIButton* btn)
 {
+    btn->SetEventQueue(&this->eventQueue);
 
     //PROBLEM:
     //dotykove ovladani - co kdyz budou dva prsty na jednom tlacitku
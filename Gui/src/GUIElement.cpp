@@ -1,4 +1,5 @@
 #include "GUIElement.h"
+#include "GUIFlatTree.h"
 #include "GUITextCaption.h"
 
 using namespace GUISystem;
@@ -29,6 +30,12 @@ GUIElement::GUIElement(const std::string& name)
     this->canBeBaked = true;
 
     this->needRebaked = true;
+    this->subtreeDirty = false;
+    this->revision = 0;
+    this->layoutParent = ElementProportions();
+    this->proportions = ElementProportions();
+    this->flatTree = NULL;
+    this->flatIndex = -1;
 
     this->userData = NULL;
 }
@@ -88,11 +95,53 @@ bool GUIElement::IsBaked() const
     return this->baked;
 }
 
+void GUIElement::SetBaked(bool val)
+{
+    this->baked = val;
+}
+
 bool GUIElement::IsVisible() const
 {
     return this->visible;
 }
 
+unsigned int GUIElement::GetRevision() const
+{
+    return this->revision;
+}
+
+/*-----------------------------------------------------------
+Function:	MarkDirty
+
+Element needs its proportions recalculated
+Ancestors are marked, so the next calculation only walks
+down the paths to dirty elements
+-------------------------------------------------------------*/
+void GUIElement::MarkDirty()
+{
+    this->needRebaked = true;
+    if (this->flatTree != NULL) {
+        this->flatTree->MarkDirty(this->flatIndex);
+    }
+    for (GUIElement* el = this->parent; el != NULL; el = el->parent) {
+        el->subtreeDirty = true;
+    }
+    this->MarkChanged();
+}
+
+/*-----------------------------------------------------------
+Function:	MarkChanged
+
+Element has to be drawn again, ancestors too, since their
+revision covers the whole subtree
+-------------------------------------------------------------*/
+void GUIElement::MarkChanged()
+{
+    for (GUIElement* el = this; el != NULL; el = el->parent) {
+        el->revision++;
+    }
+}
+
 /*-----------------------------------------------------------
 Function:	CanBeBaked
 Return:
@@ -167,7 +216,7 @@ void GUIElement::SetColor(int r, int g, int b, int a)
     this->color.z = b / 255.0f;
     this->color.w = a / 255.0f;
 
-    this->needRebaked = true;
+    this->MarkChanged();
 }
 
 /*-----------------------------------------------------------
@@ -179,7 +228,13 @@ Set visibility to object and all of his childrens
 -------------------------------------------------------------*/
 void GUIElement::SetVisible(bool val)
 {
+    if (this->visible != val) {
+        this->MarkChanged();
+    }
     this->visible = val;
+    if (this->flatTree != NULL) {
+        this->flatTree->SetVisible(this->flatIndex, val);
+    }
 
     std::vector<GUIElement*>::iterator it;
     for (it = this->childs.begin(); it != this->childs.end(); it++) {
@@ -197,7 +252,7 @@ Set object position within its parent
 void GUIElement::SetPosition(ElementPos pos)
 {
     this->pos = pos;
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 /*-----------------------------------------------------------
@@ -210,7 +265,7 @@ Set object dimension
 void GUIElement::SetSize(ElementDim dim)
 {
     this->dim = dim;
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 /*-----------------------------------------------------------
@@ -228,7 +283,7 @@ void GUIElement::SetMaxSize(int w, int h)
     this->max.pixelW = w;
     this->max.pixelH = h;
 
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 void GUIElement::SetOnMoveCallback(OnMoveDelegate onMoveDelegate)
@@ -247,6 +302,12 @@ void GUIElement::AddChild(GUIElement* el)
 {
     el->parent = this;
     this->childs.push_back(el);
+    if (this->flatTree != NULL) {
+        //indices behind the new child move, flattened again by the next layout
+        this->flatTree->MarkStructureChanged();
+    }
+    //the child is laid out within its new parent
+    el->MarkDirty();
 
     if (this->visible == false) {
         el->SetVisible(false);
@@ -265,6 +326,13 @@ void GUIElement::SetMouseMove(int x, int y)
     }
 }
 
+static bool SameProportions(const ElementProportions& a, const ElementProportions& b)
+{
+    return a.topLeft.x == b.topLeft.x && a.topLeft.y == b.topLeft.y
+        && a.botRight.x == b.botRight.x && a.botRight.y == b.botRight.y
+        && a.depth == b.depth;
+}
+
 /*-----------------------------------------------------------
 Function:	CalculateProportions
 Paramaters:
@@ -272,84 +340,134 @@ Paramaters:
 
 Calculate real size of object based on set uped
 dimension and position
-Recursively called for each child of element
+Recursively called for the children of element whose
+proportions changed or below which an element is dirty,
+clean subtrees keep their proportions
 Proportions are calculated in pixels
 -------------------------------------------------------------*/
 void GUIElement::CalculateProportions(const ElementProportions& parentProportions)
 {
+    //moved or resized parent
+    if (SameProportions(parentProportions, this->layoutParent) == false) {
+        this->needRebaked = true;
+    }
 
-    if (this->needRebaked) {
-        float x = parentProportions.topLeft.x;
-        x += this->pos.x * parentProportions.width;
-        x += this->pos.offsetX;
+    //text captions are sized by their text, see GUITextCaption::Update
+    if (this->GetTextCaption() != NULL) {
+        this->layoutParent = parentProportions;
+        return;
+    }
 
-        float y = parentProportions.topLeft.y;
-        y += this->pos.y * parentProportions.height;
-        y += this->pos.offsetY;
+    bool changed = false;
+    if (this->needRebaked) {
+        ElementProportions old = this->proportions;
+        this->layoutParent = parentProportions;
+        this->proportions = Place(this->pos, this->dim, this->max, parentProportions);
+        const float w = this->proportions.width;
+        const float h = this->proportions.height;
+
+        if (this->GetTextPanel() == NULL) {
+            this->needRebaked = false;
+        }
 
-        float w = parentProportions.width;
-        w *= this->dim.w;
-        w += this->dim.pixelW;
+        changed = !SameProportions(old, this->proportions) || old.width != w || old.height != h;
+        if (changed) {
+            this->MarkChanged();
+        }
+    }
 
-        float h = parentProportions.height;
-        h *= this->dim.h;
-        h += this->dim.pixelH;
+    if ((changed == false) && (this->subtreeDirty == false)) {
+        return;
+    }
 
-        if (this->dim.AR != 0.0f) {
-            h = (1.0f / this->dim.AR) * w;
+    //text elements stay dirty, so does the path to them
+    this->subtreeDirty = false;
+    std::vector<GUIElement*>::iterator it;
+    for (it = this->childs.begin(); it != this->childs.end(); it++) {
+        (*it)->CalculateProportions(this->proportions);
+        if ((*it)->needRebaked || (*it)->subtreeDirty) {
+            this->subtreeDirty = true;
         }
+    }
+}
 
-        if ((this->max.pixelW > 0) && (w > this->max.pixelW)) {
-            w = static_cast<float>(this->max.pixelW);
-        }
+/*-----------------------------------------------------------
+Function:	Place (static)
+Paramaters:
+	[in] pos - position within the parent
+	[in] dim - dimension
+	[in] max - max size in pixels
+	[in] parentProportions - proportions of parent object
+Returns:
+	proportions in pixels
 
-        if ((this->max.pixelH > 0) && (h > this->max.pixelH)) {
-            h = static_cast<float>(this->max.pixelH);
-        }
+Real size and position of an element within its parent,
+shared by CalculateProportions and GUIFlatTree::Layout
+-------------------------------------------------------------*/
+ElementProportions GUIElement::Place(const ElementPos& pos, const ElementDim& dim, const ElementDimMax& max,
+    const ElementProportions& parentProportions)
+{
+    float x = parentProportions.topLeft.x;
+    x += pos.x * parentProportions.width;
+    x += pos.offsetX;
 
-        //change position based on origin
-        if (this->pos.origin == TL) {
-            //do nothing - top left is default
-        } else if (this->pos.origin == TR) {
-            //swap x coordinate
-            x = parentProportions.botRight.x - (x - parentProportions.topLeft.x); //put x back to top left
-            x -= w;
-        } else if (this->pos.origin == BL) {
-            //swap y coordinate
-            y = parentProportions.botRight.y - (y - parentProportions.topLeft.y); //put y back to top left
-            y -= h;
-        } else if (this->pos.origin == BR) {
-            //swap x & y coordinate
-            x = parentProportions.botRight.x - (x - parentProportions.topLeft.x); //put x back to top left
-            y = parentProportions.botRight.y - (y - parentProportions.topLeft.y); //put y back to top left
-
-            x -= w;
-            y -= h;
-        } else if (this->pos.origin == C) {
-            //center of parent element
-            x = x + (parentProportions.botRight.x - parentProportions.topLeft.x) * 0.5f; //put x back to top left
-            y = y + (parentProportions.botRight.y - parentProportions.topLeft.y) * 0.5f; //put y back to top left
-
-            x -= (w * 0.5f);
-            y -= (h * 0.5f);
-        }
+    float y = parentProportions.topLeft.y;
+    y += pos.y * parentProportions.height;
+    y += pos.offsetY;
 
-        //this will overflow from parent element
-        this->proportions.topLeft = m3d::math::Vector2(x, y);
-        this->proportions.botRight = m3d::math::Vector2(x + w, y + h);
-        this->proportions.width = w;
-        this->proportions.height = h;
-        this->proportions.depth = parentProportions.depth + 0.01f;
-
-        if (this->GetTextCaption() == NULL) {
-            if (this->GetTextPanel() == NULL) {
-                this->needRebaked = false;
-            }
-        }
+    float w = parentProportions.width;
+    w *= dim.w;
+    w += dim.pixelW;
+
+    float h = parentProportions.height;
+    h *= dim.h;
+    h += dim.pixelH;
+
+    if (dim.AR != 0.0f) {
+        h = (1.0f / dim.AR) * w;
     }
 
-    std::vector<GUIElement*>::iterator it;
-    for (it = this->childs.begin(); it != this->childs.end(); it++) {
-        (*it)->CalculateProportions(this->proportions);
+    if ((max.pixelW > 0) && (w > max.pixelW)) {
+        w = static_cast<float>(max.pixelW);
+    }
+
+    if ((max.pixelH > 0) && (h > max.pixelH)) {
+        h = static_cast<float>(max.pixelH);
+    }
+
+    //change position based on origin
+    if (pos.origin == TL) {
+        //do nothing - top left is default
+    } else if (pos.origin == TR) {
+        //swap x coordinate
+        x = parentProportions.botRight.x - (x - parentProportions.topLeft.x); //put x back to top left
+        x -= w;
+    } else if (pos.origin == BL) {
+        //swap y coordinate
+        y = parentProportions.botRight.y - (y - parentProportions.topLeft.y); //put y back to top left
+        y -= h;
+    } else if (pos.origin == BR) {
+        //swap x & y coordinate
+        x = parentProportions.botRight.x - (x - parentProportions.topLeft.x); //put x back to top left
+        y = parentProportions.botRight.y - (y - parentProportions.topLeft.y); //put y back to top left
+
+        x -= w;
+        y -= h;
+    } else if (pos.origin == C) {
+        //center of parent element
+        x = x + (parentProportions.botRight.x - parentProportions.topLeft.x) * 0.5f; //put x back to top left
+        y = y + (parentProportions.botRight.y - parentProportions.topLeft.y) * 0.5f; //put y back to top left
+
+        x -= (w * 0.5f);
+        y -= (h * 0.5f);
     }
+
+    //this will overflow from parent element
+    ElementProportions proportions;
+    proportions.topLeft = m3d::math::Vector2(x, y);
+    proportions.botRight = m3d::math::Vector2(x + w, y + h);
+    proportions.width = w;
+    proportions.height = h;
+    proportions.depth = parentProportions.depth + 0.01f;
+    return proportions;
 }
\ No newline at end of file
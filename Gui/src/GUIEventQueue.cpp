@@ -0,0 +1,76 @@
+#include "GUIEventQueue.h"
+
+using namespace GUISystem;
+
+GUIEventQueue::GUIEventQueue()
+{
+}
+
+/*-----------------------------------------------------------
+Function:	Push
+Parametrs:
+	[in] type - event type
+	[in] handler - delegate set to the element
+	[in] element - element passed to the handler
+	[in] deferred - hand the event to the defer delegate
+
+Record an event of the current update
+Empty handlers are not recorded
+-------------------------------------------------------------*/
+void GUIEventQueue::Push(GUIEventType type, fastdelegate::FastDelegate1<GUIElement*> handler, GUIElement* element, bool deferred)
+{
+    if (handler.empty()) {
+        return;
+    }
+
+    if ((type == EVENT_WHILE_DOWN) || (type == EVENT_WHILE_HOVER)) {
+        std::vector<GUIEvent>::iterator it;
+        for (it = this->events.begin(); it != this->events.end(); it++) {
+            if ((it->type == type) && (it->element == element) && (it->handler == handler)) {
+                it->count++;
+                return;
+            }
+        }
+    }
+
+    GUIEvent e;
+    e.type = type;
+    e.handler = handler;
+    e.element = element;
+    e.deferred = deferred;
+    e.count = 1;
+    this->events.push_back(e);
+}
+
+/*-----------------------------------------------------------
+Function:	Dispatch
+
+Call the recorded events in recorded order
+Events pushed by the handlers are dispatched by the next call
+-------------------------------------------------------------*/
+void GUIEventQueue::Dispatch()
+{
+    this->dispatching.swap(this->events);
+    this->events.clear();
+
+    std::vector<GUIEvent>::const_iterator it;
+    for (it = this->dispatching.begin(); it != this->dispatching.end(); it++) {
+        if (it->deferred && (this->defer.empty() == false)) {
+            this->defer(*it);
+        } else {
+            it->handler(it->element);
+        }
+    }
+
+    this->dispatching.clear();
+}
+
+void GUIEventQueue::SetDeferDelegate(GUIEventDeferDelegate defer)
+{
+    this->defer = defer;
+}
+
+int GUIEventQueue::GetCount() const
+{
+    return static_cast<int>(this->events.size());
+}
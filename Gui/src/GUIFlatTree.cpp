@@ -0,0 +1,329 @@
+#include "GUIFlatTree.h"
+
+#include "GUIElement.h"
+
+using namespace GUISystem;
+
+GUIFlatTree::GUIFlatTree()
+{
+    this->screen = ElementProportions();
+    this->anyDirty = false;
+    this->structureChanged = false;
+}
+
+GUIFlatTree::~GUIFlatTree()
+{
+    this->Release();
+}
+
+/*-----------------------------------------------------------
+Function:	Build
+Parametrs:
+	[in] roots - roots of the element trees
+
+Store the trees flat, depth first, every element is marked
+dirty; elements of an earlier Build are released
+-------------------------------------------------------------*/
+void GUIFlatTree::Build(const std::vector<GUIElement*>& roots)
+{
+    this->Release();
+    this->roots = roots;
+
+    int last = -1;
+    std::vector<GUIElement*>::const_iterator it;
+    for (it = roots.begin(); it != roots.end(); it++) {
+        int index = this->Flatten(*it, -1);
+        if (last >= 0) {
+            this->nextSiblings[last] = index;
+        }
+        last = index;
+    }
+
+    this->Store();
+}
+
+/*-----------------------------------------------------------
+Function:	Build
+Parametrs:
+	[in] elements - elements in depth first order
+	[in] parents - index of the parent of each element, -1 for roots
+
+Store trees that are flat already, e.g. loaded from a file,
+without walking them; the sibling indices follow from the
+parents
+-------------------------------------------------------------*/
+void GUIFlatTree::Build(const std::vector<GUIElement*>& elements, const std::vector<int>& parents)
+{
+    this->Release();
+
+    this->elements = elements;
+    this->parents = parents;
+    this->nextSiblings.assign(elements.size(), -1);
+
+    //last child seen of every element, the roots at the end
+    std::vector<int> lastChilds(elements.size() + 1, -1);
+    for (size_t i = 0; i < elements.size(); i++) {
+        int parent = parents[i];
+        int& last = lastChilds[(parent < 0) ? elements.size() : parent];
+        if (last >= 0) {
+            this->nextSiblings[last] = static_cast<int>(i);
+        }
+        last = static_cast<int>(i);
+
+        if (parent < 0) {
+            this->roots.push_back(elements[i]);
+        }
+        elements[i]->flatTree = this;
+        elements[i]->flatIndex = static_cast<int>(i);
+    }
+
+    this->Store();
+}
+
+void GUIFlatTree::Release()
+{
+    std::vector<GUIElement*>::iterator old;
+    for (old = this->elements.begin(); old != this->elements.end(); old++) {
+        (*old)->flatTree = NULL;
+        (*old)->flatIndex = -1;
+    }
+
+    this->roots.clear();
+    this->elements.clear();
+    this->parents.clear();
+    this->nextSiblings.clear();
+}
+
+int GUIFlatTree::Flatten(GUIElement* el, int parent)
+{
+    int index = static_cast<int>(this->elements.size());
+    this->elements.push_back(el);
+    this->parents.push_back(parent);
+    this->nextSiblings.push_back(-1);
+    el->flatTree = this;
+    el->flatIndex = index;
+
+    int last = -1;
+    const std::vector<GUIElement*>* childs = el->GetChildrens();
+    std::vector<GUIElement*>::const_iterator it;
+    for (it = childs->begin(); it != childs->end(); it++) {
+        int child = this->Flatten(*it, index);
+        if (last >= 0) {
+            this->nextSiblings[last] = child;
+        }
+        last = child;
+    }
+
+    return index;
+}
+
+//fill the arrays of the stored elements, all of them dirty
+void GUIFlatTree::Store()
+{
+    size_t count = this->elements.size();
+    this->positions.resize(count);
+    this->dims.resize(count);
+    this->maxs.resize(count);
+    this->left.resize(count);
+    this->top.resize(count);
+    this->right.resize(count);
+    this->bottom.resize(count);
+    this->depth.resize(count);
+    this->flags.resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+        GUIElement* el = this->elements[i];
+        const ElementProportions& p = el->GetProportions();
+        this->left[i] = p.topLeft.x;
+        this->top[i] = p.topLeft.y;
+        this->right[i] = p.botRight.x;
+        this->bottom[i] = p.botRight.y;
+        this->depth[i] = p.depth;
+
+        unsigned char f = FLAG_DIRTY;
+        f |= el->IsVisible() ? FLAG_VISIBLE : 0;
+        f |= (el->GetTextCaption() != NULL) ? FLAG_CAPTION : 0;
+        f |= (el->GetTextPanel() != NULL) ? FLAG_TEXT_PANEL : 0;
+        this->flags[i] = f;
+    }
+
+    this->anyDirty = true;
+    this->structureChanged = false;
+}
+
+ElementProportions GUIFlatTree::GetProportions(int index) const
+{
+    ElementProportions p;
+    p.topLeft = m3d::math::Vector2(this->left[index], this->top[index]);
+    p.botRight = m3d::math::Vector2(this->right[index], this->bottom[index]);
+    p.width = this->right[index] - this->left[index];
+    p.height = this->bottom[index] - this->top[index];
+    p.depth = this->depth[index];
+    return p;
+}
+
+/*-----------------------------------------------------------
+Function:	Layout
+Parametrs:
+	[in] screen - screen proportions
+
+Calculate the proportions of the dirty elements and of the
+elements whose parent moved, in one pass over the arrays:
+parents come before their childs, so a parent is done when
+its childs are reached
+Changed proportions are written to the elements, which get
+a new revision like from CalculateProportions
+-------------------------------------------------------------*/
+void GUIFlatTree::Layout(const ElementProportions& screen)
+{
+    if (this->structureChanged) {
+        std::vector<GUIElement*> roots = this->roots;
+        this->Build(roots);
+    }
+
+    bool screenChanged = (screen.topLeft.x != this->screen.topLeft.x) || (screen.topLeft.y != this->screen.topLeft.y)
+        || (screen.width != this->screen.width) || (screen.height != this->screen.height) || (screen.depth != this->screen.depth);
+    if ((this->anyDirty == false) && (screenChanged == false)) {
+        return;
+    }
+    this->screen = screen;
+    this->anyDirty = false;
+
+    int count = static_cast<int>(this->elements.size());
+    for (int i = 0; i < count; i++) {
+        int parent = this->parents[i];
+        bool parentMoved = (parent < 0) ? screenChanged : ((this->flags[parent] & FLAG_MOVED) != 0);
+        unsigned char f = this->flags[i] & ~FLAG_MOVED;
+        this->flags[i] = f;
+        if (((f & FLAG_DIRTY) == 0) && (parentMoved == false)) {
+            continue;
+        }
+
+        GUIElement* el = this->elements[i];
+        ElementProportions parentProportions = (parent < 0) ? screen : this->GetProportions(parent);
+
+        //text captions are sized by their text, see GUITextCaption::Update
+        if (f & FLAG_CAPTION) {
+            if (parentMoved) {
+                el->needRebaked = true;
+            }
+            el->layoutParent = parentProportions;
+            this->flags[i] = f & ~FLAG_DIRTY;
+            continue;
+        }
+
+        if (f & FLAG_DIRTY) {
+            this->positions[i] = el->pos;
+            this->dims[i] = el->dim;
+            this->maxs[i] = el->max;
+        }
+
+        ElementProportions p = GUIElement::Place(this->positions[i], this->dims[i], this->maxs[i], parentProportions);
+        bool changed = (p.topLeft.x != this->left[i]) || (p.topLeft.y != this->top[i]) || (p.botRight.x != this->right[i])
+            || (p.botRight.y != this->bottom[i]) || (p.depth != this->depth[i]);
+        if (changed) {
+            this->left[i] = p.topLeft.x;
+            this->top[i] = p.topLeft.y;
+            this->right[i] = p.botRight.x;
+            this->bottom[i] = p.botRight.y;
+            this->depth[i] = p.depth;
+            f |= FLAG_MOVED;
+
+            el->proportions = p;
+            el->MarkChanged();
+        }
+        el->layoutParent = parentProportions;
+        el->subtreeDirty = false;
+
+        if (f & FLAG_TEXT_PANEL) {
+            this->anyDirty = true;
+        } else {
+            el->needRebaked = false;
+            f &= ~FLAG_DIRTY;
+        }
+        this->flags[i] = f;
+    }
+}
+
+/*-----------------------------------------------------------
+Function:	Find
+Parametrs:
+	[in] x - x coordinate in pixels
+	[in] y - y coordinate in pixels
+Returns:
+	most top element at [x, y] or NULL
+
+The deepest element containing the point, of equal depths
+the later one
+-------------------------------------------------------------*/
+GUIElement* GUIFlatTree::Find(int x, int y) const
+{
+    const float fx = static_cast<float>(x);
+    const float fy = static_cast<float>(y);
+
+    int found = -1;
+    float maxDepth = -999999;
+
+    int count = static_cast<int>(this->elements.size());
+    for (int i = 0; i < count; i++) {
+        if ((this->flags[i] & (FLAG_VISIBLE | FLAG_CAPTION)) != FLAG_VISIBLE) {
+            continue;
+        }
+        if ((fx < this->left[i]) || (fx > this->right[i]) || (fy < this->top[i]) || (fy > this->bottom[i])) {
+            continue;
+        }
+        if (this->depth[i] >= maxDepth) {
+            found = i;
+            maxDepth = this->depth[i];
+        }
+    }
+
+    return (found < 0) ? NULL : this->elements[found];
+}
+
+int GUIFlatTree::GetCount() const
+{
+    return static_cast<int>(this->elements.size());
+}
+
+GUIElement* GUIFlatTree::GetElement(int index) const
+{
+    return this->elements[index];
+}
+
+int GUIFlatTree::GetParent(int index) const
+{
+    return this->parents[index];
+}
+
+int GUIFlatTree::GetNextSibling(int index) const
+{
+    return this->nextSiblings[index];
+}
+
+void GUIFlatTree::MarkDirty(int index)
+{
+    //flattened again anyway
+    if (this->structureChanged) {
+        return;
+    }
+    this->flags[index] |= FLAG_DIRTY;
+    this->anyDirty = true;
+}
+
+void GUIFlatTree::SetVisible(int index, bool val)
+{
+    if (this->structureChanged) {
+        return;
+    }
+    if (val) {
+        this->flags[index] |= FLAG_VISIBLE;
+    } else {
+        this->flags[index] &= ~FLAG_VISIBLE;
+    }
+}
+
+void GUIFlatTree::MarkStructureChanged()
+{
+    this->structureChanged = true;
+}
@@ -0,0 +1,334 @@
+#include "GUIFontRenderer.h"
+
+#include "IGlyphRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace GUISystem;
+
+/*-----------------------------------------------------------
+Function:	NextCodepoint
+Parametrs:
+	[in] text - UTF-8 text
+	[in/out] i - byte position, moved past the codepoint
+
+Decode one codepoint, malformed bytes are read as U+FFFD
+-------------------------------------------------------------*/
+static unsigned int NextCodepoint(const std::string& text, size_t& i)
+{
+    unsigned char c = static_cast<unsigned char>(text[i++]);
+    if (c < 0x80) {
+        return c;
+    }
+
+    int extra = 0;
+    unsigned int codepoint = 0;
+    if ((c & 0xE0) == 0xC0) {
+        extra = 1;
+        codepoint = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        extra = 2;
+        codepoint = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+        extra = 3;
+        codepoint = c & 0x07;
+    } else {
+        return 0xFFFD;
+    }
+
+    for (int k = 0; k < extra; k++) {
+        if ((i >= text.size()) || ((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80)) {
+            return 0xFFFD;
+        }
+        codepoint = (codepoint << 6) | (static_cast<unsigned char>(text[i++]) & 0x3F);
+    }
+    return codepoint;
+}
+
+GUIFontRenderer::GUIFontRenderer(IGlyphRasterizer* rasterizer, int atlasSize, int baseSize, int spread)
+{
+    this->rasterizer = rasterizer;
+    this->atlasSize = atlasSize;
+    this->baseSize = baseSize;
+    this->spread = spread;
+    this->atlas.assign(atlasSize * atlasSize, 0);
+    this->atlasRevision = 1;
+
+    this->shelfX = 0;
+    this->shelfY = 0;
+    this->shelfH = 0;
+
+    //the first upload covers the whole (empty) atlas
+    this->dirtyX0 = 0;
+    this->dirtyY0 = 0;
+    this->dirtyX1 = atlasSize;
+    this->dirtyY1 = atlasSize;
+}
+
+GUIFontRenderer::~GUIFontRenderer()
+{
+}
+
+int GUIFontRenderer::GetBaseSize() const
+{
+    return this->baseSize;
+}
+
+int GUIFontRenderer::GetSpread() const
+{
+    return this->spread;
+}
+
+int GUIFontRenderer::GetAtlasSize() const
+{
+    return this->atlasSize;
+}
+
+const unsigned char* GUIFontRenderer::GetAtlas() const
+{
+    return this->atlas.data();
+}
+
+unsigned int GUIFontRenderer::GetAtlasRevision() const
+{
+    return this->atlasRevision;
+}
+
+bool GUIFontRenderer::TakeDirtyRect(int& x, int& y, int& w, int& h)
+{
+    if ((this->dirtyX0 >= this->dirtyX1) || (this->dirtyY0 >= this->dirtyY1)) {
+        return false;
+    }
+
+    x = this->dirtyX0;
+    y = this->dirtyY0;
+    w = this->dirtyX1 - this->dirtyX0;
+    h = this->dirtyY1 - this->dirtyY0;
+
+    this->dirtyX0 = this->atlasSize;
+    this->dirtyY0 = this->atlasSize;
+    this->dirtyX1 = 0;
+    this->dirtyY1 = 0;
+    return true;
+}
+
+/*-----------------------------------------------------------
+Function:	Shape
+Parametrs:
+	[in] fontFace - face passed to the rasterizer
+	[in] text - UTF-8 text, '\n' starts a new line
+	[out] shaped - glyph quads at the base size
+
+Lay out the text left to right with the rasterizer's advances
+and kerning, run it again only when the text or face changes
+-------------------------------------------------------------*/
+void GUIFontRenderer::Shape(const std::string& fontFace, const std::string& text, GUIShapedText& shaped)
+{
+    const Face& face = this->GetFace(fontFace);
+
+    shaped.quads.clear();
+    shaped.width = 0.0f;
+    shaped.height = face.lineHeight;
+    shaped.baseSize = this->baseSize;
+
+    float penX = 0.0f;
+    float penY = 0.0f;
+    unsigned int last = 0;
+
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned int codepoint = NextCodepoint(text, i);
+        if (codepoint == '\n') {
+            penX = 0.0f;
+            penY += face.lineHeight;
+            shaped.height += face.lineHeight;
+            last = 0;
+            continue;
+        }
+
+        if (last != 0) {
+            penX += this->rasterizer->GetKerning(fontFace, last, codepoint, this->baseSize);
+        }
+        last = codepoint;
+
+        const Glyph& g = this->GetGlyph(fontFace, codepoint);
+        if (g.hasQuad) {
+            GUIGlyphQuad q;
+            q.x0 = penX + g.x0;
+            q.y0 = penY + g.y0;
+            q.x1 = penX + g.x1;
+            q.y1 = penY + g.y1;
+            q.u0 = g.u0;
+            q.v0 = g.v0;
+            q.u1 = g.u1;
+            q.v1 = g.v1;
+            shaped.quads.push_back(q);
+        }
+
+        penX += g.advance;
+        shaped.width = std::max(shaped.width, penX);
+    }
+
+    //every glyph of the text is in the atlas from this revision on
+    shaped.atlasRevision = this->atlasRevision;
+}
+
+const GUIFontRenderer::Face& GUIFontRenderer::GetFace(const std::string& fontFace)
+{
+    std::map<std::string, Face>::iterator it = this->faces.find(fontFace);
+    if (it != this->faces.end()) {
+        return it->second;
+    }
+
+    Face face;
+    if (this->rasterizer->GetLineMetrics(fontFace, this->baseSize, face.ascent, face.lineHeight) == false) {
+        printf("GUIFontRenderer: unknown font face %s\n", fontFace.c_str());
+        face.ascent = static_cast<float>(this->baseSize);
+        face.lineHeight = static_cast<float>(this->baseSize);
+    }
+    return this->faces[fontFace] = face;
+}
+
+/*-----------------------------------------------------------
+Function:	GetGlyph
+Parametrs:
+	[in] fontFace - font face
+	[in] codepoint - unicode codepoint
+
+Cached glyph, rasterized into the atlas on first use
+Missing glyphs are cached too, as empty ones
+-------------------------------------------------------------*/
+const GUIFontRenderer::Glyph& GUIFontRenderer::GetGlyph(const std::string& fontFace, unsigned int codepoint)
+{
+    std::pair<std::string, unsigned int> key(fontFace, codepoint);
+    std::map<std::pair<std::string, unsigned int>, Glyph>::iterator it = this->glyphs.find(key);
+    if (it != this->glyphs.end()) {
+        return it->second;
+    }
+
+    Glyph& g = this->glyphs[key];
+    g.hasQuad = false;
+    g.advance = 0.0f;
+
+    GUIGlyphBitmap bitmap;
+    if (this->rasterizer->Rasterize(fontFace, codepoint, this->baseSize, bitmap) == false) {
+        return g;
+    }
+    g.advance = bitmap.advance;
+
+    if ((bitmap.width == 0) || (bitmap.height == 0)) {
+        //white space
+        return g;
+    }
+
+    //the distance field reaches spread texels past the outline
+    int w = bitmap.width + 2 * this->spread;
+    int h = bitmap.height + 2 * this->spread;
+    int x, y;
+    if (this->Pack(w, h, x, y) == false) {
+        printf("GUIFontRenderer: atlas is full, glyph %u of %s is not drawn\n", codepoint, fontFace.c_str());
+        return g;
+    }
+    this->WriteDistanceField(bitmap, x, y);
+
+    const Face& face = this->GetFace(fontFace);
+    g.hasQuad = true;
+    g.x0 = static_cast<float>(bitmap.bearingX - this->spread);
+    g.y0 = face.ascent - bitmap.bearingY - this->spread;
+    g.x1 = g.x0 + w;
+    g.y1 = g.y0 + h;
+    g.u0 = x / static_cast<float>(this->atlasSize);
+    g.v0 = y / static_cast<float>(this->atlasSize);
+    g.u1 = (x + w) / static_cast<float>(this->atlasSize);
+    g.v1 = (y + h) / static_cast<float>(this->atlasSize);
+
+    this->dirtyX0 = std::min(this->dirtyX0, x);
+    this->dirtyY0 = std::min(this->dirtyY0, y);
+    this->dirtyX1 = std::max(this->dirtyX1, x + w);
+    this->dirtyY1 = std::max(this->dirtyY1, y + h);
+    this->atlasRevision++;
+    return g;
+}
+
+/*-----------------------------------------------------------
+Function:	Pack
+Parametrs:
+	[in] w, h - size of the rectangle
+	[out] x, y - its position in the atlas
+Returns:
+	false if the atlas is full
+
+Shelf packing: rectangles go left to right, a new shelf starts
+below the highest one when the row is full. One texel gap keeps
+linear filtering from bleeding in neighbour glyphs
+-------------------------------------------------------------*/
+bool GUIFontRenderer::Pack(int w, int h, int& x, int& y)
+{
+    if ((w + 1 > this->atlasSize) || (h + 1 > this->atlasSize)) {
+        return false;
+    }
+
+    if (this->shelfX + w + 1 > this->atlasSize) {
+        this->shelfX = 0;
+        this->shelfY += this->shelfH;
+        this->shelfH = 0;
+    }
+
+    if (this->shelfY + h + 1 > this->atlasSize) {
+        return false;
+    }
+
+    x = this->shelfX;
+    y = this->shelfY;
+    this->shelfX += w + 1;
+    this->shelfH = std::max(this->shelfH, h + 1);
+    return true;
+}
+
+/*-----------------------------------------------------------
+Function:	WriteDistanceField
+Parametrs:
+	[in] bitmap - glyph coverage
+	[in] x, y - top left atlas texel of the padded glyph
+
+Signed distance of every texel to the nearest texel of the other
+side of the outline, searched within spread texels and mapped to
+0 - 255 with the outline at 128
+Glyphs are small and rasterized once, a search is fast enough
+-------------------------------------------------------------*/
+void GUIFontRenderer::WriteDistanceField(const GUIGlyphBitmap& bitmap, int x, int y)
+{
+    const int s = this->spread;
+    const int w = bitmap.width + 2 * s;
+    const int h = bitmap.height + 2 * s;
+
+    for (int ty = 0; ty < h; ty++) {
+        for (int tx = 0; tx < w; tx++) {
+            const int bx = tx - s;
+            const int by = ty - s;
+            const bool inside = (bx >= 0) && (by >= 0) && (bx < bitmap.width) && (by < bitmap.height)
+                && (bitmap.coverage[by * bitmap.width + bx] >= 128);
+
+            float nearest = static_cast<float>(s);
+            for (int dy = -s; dy <= s; dy++) {
+                for (int dx = -s; dx <= s; dx++) {
+                    const int sx = bx + dx;
+                    const int sy = by + dy;
+                    const bool sampleInside = (sx >= 0) && (sy >= 0) && (sx < bitmap.width) && (sy < bitmap.height)
+                        && (bitmap.coverage[sy * bitmap.width + sx] >= 128);
+                    if (sampleInside != inside) {
+                        nearest = std::min(nearest, std::sqrt(static_cast<float>(dx * dx + dy * dy)));
+                    }
+                }
+            }
+
+            //the outline lies half way to the nearest texel of the other side
+            float distance = inside ? (nearest - 0.5f) : -(nearest - 0.5f);
+            float value = 0.5f + 0.5f * distance / s;
+            value = std::min(std::max(value, 0.0f), 1.0f);
+            this->atlas[(y + ty) * this->atlasSize + (x + tx)] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+        }
+    }
+}
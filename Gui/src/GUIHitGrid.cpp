@@ -0,0 +1,184 @@
+#include "GUIHitGrid.h"
+
+#include "GUIElement.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace GUISystem;
+
+GUIHitGrid::GUIHitGrid()
+{
+    this->cellsX = 0;
+    this->cellsY = 0;
+    this->screenW = 0.0f;
+    this->screenH = 0.0f;
+}
+
+/*-----------------------------------------------------------
+Function:	Update
+Parametrs:
+	[in] elements - all elements of the screen
+	[in] screen - screen proportions
+
+Bring the grid up to date with the element proportions,
+call it after the layout was calculated
+Only trees whose root revision changed are indexed again
+-------------------------------------------------------------*/
+void GUIHitGrid::Update(const std::vector<GUIElement*>& elements, const ElementProportions& screen)
+{
+    bool same = (elements.size() == this->entries.size()) && (screen.width == this->screenW) && (screen.height == this->screenH);
+    for (size_t i = 0; same && (i < elements.size()); i++) {
+        same = (elements[i] == this->entries[i].el);
+    }
+
+    if (same == false) {
+        this->Rebuild(elements, screen);
+        return;
+    }
+
+    std::vector<Root>::iterator it;
+    for (it = this->roots.begin(); it != this->roots.end(); it++) {
+        if (it->el->GetRevision() != it->revision) {
+            it->revision = it->el->GetRevision();
+            this->Reindex(it->el);
+        }
+    }
+}
+
+void GUIHitGrid::Rebuild(const std::vector<GUIElement*>& elements, const ElementProportions& screen)
+{
+    this->screenW = screen.width;
+    this->screenH = screen.height;
+    this->cellsX = std::max(1, static_cast<int>(std::ceil(screen.width / CELL_SIZE)));
+    this->cellsY = std::max(1, static_cast<int>(std::ceil(screen.height / CELL_SIZE)));
+
+    this->cells.assign(this->cellsX * this->cellsY, std::vector<int>());
+    this->entries.resize(elements.size());
+    this->roots.clear();
+    this->indices.clear();
+
+    for (size_t i = 0; i < elements.size(); i++) {
+        Entry& e = this->entries[i];
+        e.el = elements[i];
+        e.cellX0 = 1;
+        e.cellX1 = 0;
+        this->indices[e.el] = static_cast<int>(i);
+
+        if (e.el->parent == NULL) {
+            Root r;
+            r.el = e.el;
+            r.revision = e.el->GetRevision();
+            this->roots.push_back(r);
+        }
+
+        this->Insert(static_cast<int>(i));
+    }
+}
+
+/*-----------------------------------------------------------
+Function:	Reindex
+Parametrs:
+	[in] el - root of the changed tree
+
+Move the element and all of its childrens to the cells
+of their current proportions
+-------------------------------------------------------------*/
+void GUIHitGrid::Reindex(GUIElement* el)
+{
+    std::unordered_map<const GUIElement*, int>::const_iterator found = this->indices.find(el);
+    if (found != this->indices.end()) {
+        this->Remove(found->second);
+        this->Insert(found->second);
+    }
+
+    const std::vector<GUIElement*>* childs = el->GetChildrens();
+    std::vector<GUIElement*>::const_iterator it;
+    for (it = childs->begin(); it != childs->end(); it++) {
+        this->Reindex(*it);
+    }
+}
+
+void GUIHitGrid::Insert(int index)
+{
+    Entry& e = this->entries[index];
+    const ElementProportions& p = e.el->GetProportions();
+
+    //elements overflowing the screen are clamped to the border cells
+    e.cellX0 = std::max(0, static_cast<int>(std::floor(p.topLeft.x / CELL_SIZE)));
+    e.cellY0 = std::max(0, static_cast<int>(std::floor(p.topLeft.y / CELL_SIZE)));
+    e.cellX1 = std::min(this->cellsX - 1, static_cast<int>(std::floor(p.botRight.x / CELL_SIZE)));
+    e.cellY1 = std::min(this->cellsY - 1, static_cast<int>(std::floor(p.botRight.y / CELL_SIZE)));
+
+    for (int y = e.cellY0; y <= e.cellY1; y++) {
+        for (int x = e.cellX0; x <= e.cellX1; x++) {
+            this->cells[y * this->cellsX + x].push_back(index);
+        }
+    }
+}
+
+void GUIHitGrid::Remove(int index)
+{
+    Entry& e = this->entries[index];
+    for (int y = e.cellY0; y <= e.cellY1; y++) {
+        for (int x = e.cellX0; x <= e.cellX1; x++) {
+            std::vector<int>& cell = this->cells[y * this->cellsX + x];
+            cell.erase(std::find(cell.begin(), cell.end(), index));
+        }
+    }
+    e.cellX0 = 1;
+    e.cellX1 = 0;
+}
+
+/*-----------------------------------------------------------
+Function:	Find
+Parametrs:
+	[in] x - x coordinate in pixels
+	[in] y - y coordinate in pixels
+Returns:
+	most top element at [x, y] or NULL
+
+Same element as testing every element with
+GUIController::IsMouseOver: the deepest one, of equal
+depths the later one in the screen elements
+-------------------------------------------------------------*/
+GUIElement* GUIHitGrid::Find(int x, int y) const
+{
+    if ((x < 0) || (y < 0)) {
+        return NULL;
+    }
+
+    if ((x > this->screenW) || (y > this->screenH) || this->cells.empty()) {
+        return NULL;
+    }
+
+    //the right and bottom border belong to the last cells
+    const int cellX = std::min(x / CELL_SIZE, this->cellsX - 1);
+    const int cellY = std::min(y / CELL_SIZE, this->cellsY - 1);
+
+    GUIElement* found = NULL;
+    int foundIndex = -1;
+    float maxDepth = -999999;
+
+    const std::vector<int>& cell = this->cells[cellY * this->cellsX + cellX];
+    std::vector<int>::const_iterator it;
+    for (it = cell.begin(); it != cell.end(); it++) {
+        GUIElement* el = this->entries[*it].el;
+        if ((el->IsVisible() == false) || (el->GetTextCaption() != NULL)) {
+            continue;
+        }
+
+        const ElementProportions& p = el->GetProportions();
+        if ((x < p.topLeft.x) || (x > p.botRight.x) || (y < p.topLeft.y) || (y > p.botRight.y)) {
+            continue;
+        }
+
+        if ((p.depth > maxDepth) || ((p.depth == maxDepth) && (*it > foundIndex))) {
+            found = el;
+            foundIndex = *it;
+            maxDepth = p.depth;
+        }
+    }
+
+    return found;
+}
@@ -48,4 +48,5 @@ Texture must be loaded manually elsewhere into texture pool
 void GUIImage::SetTextureName(const std::string& name)
 {
     this->textureName = name;
+    this->MarkChanged();
 }
\ No newline at end of file
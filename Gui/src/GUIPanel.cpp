@@ -29,4 +29,5 @@ const GUIPanelTextures& GUIPanel::GetTextures() const
 void GUIPanel::SetTextures(GUIPanelTextures& textures)
 {
     this->textures = textures;
+    this->MarkChanged();
 }
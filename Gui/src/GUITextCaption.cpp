@@ -1,6 +1,5 @@
 #include "GUITextCaption.h"
-// TODO:
-//#include "GUIFontRenderer.h"
+#include "GUIFontRenderer.h"
 #include "Matrix.h"
 //#include "../../OpenGL/G_Device.h"
 
@@ -14,6 +13,8 @@ GUITextCaption::GUITextCaption(const std::string& name)
     this->fontSize = 10;
     this->fontAtlasName = "";
     this->percentSize = -1;
+    this->angle = 0.0f;
+    this->shapedDirty = true;
 }
 
 GUITextCaption::~GUITextCaption()
@@ -58,6 +59,14 @@ float GUITextCaption::GetFontPercentSize() const
     return this->percentSize;
 }
 
+const GUIShapedText* GUITextCaption::GetShapedText() const
+{
+    if (this->shaped.baseSize == 0) {
+        return NULL;
+    }
+    return &this->shaped;
+}
+
 int GUITextCaption::GetFontSize() const
 {
     return this->fontSize;
@@ -71,15 +80,17 @@ void GUITextCaption::SetRotationAngle(float angle)
 void GUITextCaption::SetFontFace(const std::string& fontFace)
 {
     this->fontFace = fontFace;
+    this->shapedDirty = true;
 
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 void GUITextCaption::SetText(const std::string& text)
 {
     this->caption = text;
+    this->shapedDirty = true;
 
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 void GUITextCaption::SetFontSize(float size)
@@ -107,7 +118,7 @@ void GUITextCaption::SetFontSize(float size)
         this->percentSize = -1;
     }
 
-    this->needRebaked = true;
+    this->MarkDirty();
 }
 
 void GUITextCaption::Update(const ElementProportions& parentProportions, GUIFontRenderer* fontRenderer)
@@ -123,10 +134,15 @@ void GUITextCaption::Update(const ElementProportions& parentProportions, GUIFont
     float size = parentProportions.height * this->GetFontPercentSize();
     this->SetFontSize(size);
 
-    //fontRenderer->SetFontSize(this->fontSize);
-    //GUISystem::ElementDim dim = fontRenderer->GetFontDimension(this->caption);
-    float w = 10.0F; //= dim.w;
-    float h = 10.0F; //= dim.h; // static_cast<float>(this->fontSize);
+    //text is laid out once at the base size, the font size scales it
+    if (this->shapedDirty) {
+        fontRenderer->Shape(this->fontFace, this->caption, this->shaped);
+        this->shapedDirty = false;
+    }
+
+    float scale = static_cast<float>(this->fontSize) / this->shaped.baseSize;
+    float w = this->shaped.width * scale;
+    float h = this->shaped.height * scale;
 
     //-----
 
@@ -169,6 +185,10 @@ void GUITextCaption::Update(const ElementProportions& parentProportions, GUIFont
     this->proportions.botRight = m3d::math::Vector2(x + w, y + h);
     this->proportions.width = w;
     this->proportions.height = h;
+    this->proportions.depth = parentProportions.depth + 0.01f;
+
+    //drawn again with the new glyphs or proportions
+    this->MarkChanged();
 
     this->needRebaked = false;
 }
\ No newline at end of file
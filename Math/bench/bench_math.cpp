@@ -0,0 +1,474 @@
+/*
+* Copyright (C) 2016 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Microbenchmarks of the Math library, run before and after every SIMD change:
+//   m3d_bench_math --benchmark_filter=Array --benchmark_repetitions=5
+// The single matrix product is timed with the backend of the build (SSE or NEON)
+// next to a plain float loop, the array kernels report the backend they picked.
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <vector>
+
+#include "Matrix.h"
+#include "Quaternion.h"
+#include "SIMD_Batch.h"
+
+using namespace m3d::math;
+
+static const char* backendName()
+{
+    switch (GetSIMDBackend()) {
+    case SIMDBackend::Scalar:
+        return "scalar";
+    case SIMDBackend::Default:
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        return "neon";
+#else
+        return "sse";
+#endif
+    case SIMDBackend::AVX2:
+        return "avx2";
+    case SIMDBackend::NEON:
+        return "neon (runtime)";
+    }
+    return "";
+}
+
+// what Matrix4x4::operator* computes without USE_SIMD
+static void scalarMultiply(Matrix4x4& result, const Matrix4x4& left, const Matrix4x4& right)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            float accumulator = 0.0f;
+            for (int k = 0; k < 4; k++) {
+                accumulator += left.m[i][k] * right.m[k][j];
+            }
+            result.m[i][j] = accumulator;
+        }
+    }
+}
+
+static Matrix4x4 testMatrix(float seed)
+{
+    Matrix4x4 matrix;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            matrix.m[i][j] = seed + 0.25f * i - 0.125f * j;
+        }
+    }
+    return matrix;
+}
+
+static Quaternion testQuaternion(float seed)
+{
+    Vector3 axis(0.3f + seed, 0.8f, 0.5f - seed);
+    axis.Normalize(SqrtPrecision::Exact);
+    return Quaternion(axis, 0.7f + seed);
+}
+
+//-------------------------------------------------------------
+// Single values
+//-------------------------------------------------------------
+
+static void BM_MatrixMultiply(benchmark::State& state)
+{
+    Matrix4x4 left = testMatrix(1.0f);
+    const Matrix4x4 right = testMatrix(-0.5f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(left);
+        Matrix4x4 result;
+#if USE_SIMD
+        MatrixMultiply(&result, &left, &right);
+#else
+        scalarMultiply(result, left, right);
+#endif
+        benchmark::DoNotOptimize(result);
+    }
+#if USE_SIMD
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    state.SetLabel("neon");
+#else
+    state.SetLabel("sse");
+#endif
+#else
+    state.SetLabel("scalar");
+#endif
+}
+BENCHMARK(BM_MatrixMultiply);
+
+static void BM_MatrixMultiplyScalar(benchmark::State& state)
+{
+    Matrix4x4 left = testMatrix(1.0f);
+    const Matrix4x4 right = testMatrix(-0.5f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(left);
+        Matrix4x4 result;
+        scalarMultiply(result, left, right);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_MatrixMultiplyScalar);
+
+static void BM_MatrixMultiplyAffine(benchmark::State& state)
+{
+    Matrix4x3 left(testMatrix(1.0f));
+    const Matrix4x3 right(testMatrix(-0.5f));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(left);
+        Matrix4x3 result = left * right;
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_MatrixMultiplyAffine);
+
+static void BM_QuaternionMultiply(benchmark::State& state)
+{
+    Quaternion q0 = testQuaternion(0.1f);
+    const Quaternion q1 = testQuaternion(0.2f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(q0);
+        benchmark::DoNotOptimize(q0 * q1);
+    }
+}
+BENCHMARK(BM_QuaternionMultiply);
+
+static void BM_QuaternionRotateVector(benchmark::State& state)
+{
+    Quaternion q = testQuaternion(0.1f);
+    const Vector3 v(1.0f, 2.0f, 3.0f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(q);
+        benchmark::DoNotOptimize(q * v);
+    }
+}
+BENCHMARK(BM_QuaternionRotateVector);
+
+static void BM_QuaternionToMatrix(benchmark::State& state)
+{
+    Quaternion q = testQuaternion(0.1f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(q);
+        Matrix4x4 result;
+        q.ToMatrix(result);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_QuaternionToMatrix);
+
+static void BM_QuaternionFromMatrix(benchmark::State& state)
+{
+    Matrix4x4 matrix;
+    testQuaternion(0.1f).ToMatrix(matrix);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(matrix);
+        benchmark::DoNotOptimize(Quaternion(matrix));
+    }
+}
+BENCHMARK(BM_QuaternionFromMatrix);
+
+static void BM_LookAt(benchmark::State& state)
+{
+    Vector3 eye(1.0f, 2.0f, 5.0f);
+    const Vector3 at(0.0f, 0.5f, 0.0f);
+    const Vector3 up(0.0f, 1.0f, 0.0f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(eye);
+        benchmark::DoNotOptimize(Matrix4x4::LookAt(eye, at, up));
+    }
+}
+BENCHMARK(BM_LookAt);
+
+static void BM_Perspective(benchmark::State& state)
+{
+    float fovY = 1.0f;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fovY);
+        benchmark::DoNotOptimize(Matrix4x4::Perspective(fovY, 16.0f / 9.0f, 0.1f, 1000.0f));
+    }
+}
+BENCHMARK(BM_Perspective);
+
+// argument: SqrtPrecision
+static void BM_InvSqrt(benchmark::State& state)
+{
+    const SqrtPrecision precision = static_cast<SqrtPrecision>(state.range(0));
+    float f = 2.0f;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(f);
+        benchmark::DoNotOptimize(InvSqrt(f, precision));
+    }
+    static const char* const names[] = { "estimate", "refined", "exact" };
+    state.SetLabel(names[state.range(0)]);
+}
+BENCHMARK(BM_InvSqrt)->DenseRange(0, 2);
+
+//-------------------------------------------------------------
+// Arrays, from what fits in L1 to what streams from memory
+//-------------------------------------------------------------
+
+static void arrayRange(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->RangeMultiplier(8)->Range(8, 256 << 10);
+}
+
+static void arrayCounters(benchmark::State& state, size_t bytesPerElement)
+{
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0) * static_cast<int64_t>(bytesPerElement));
+    state.SetLabel(backendName());
+}
+
+static void BM_MatrixMultiplyArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Matrix4x4> left(count, testMatrix(1.0f));
+    std::vector<Matrix4x4> right(count, testMatrix(-0.5f));
+    std::vector<Matrix4x4> result(count);
+    for (auto _ : state) {
+        MatrixMultiplyArray(result.data(), left.data(), right.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 3 * sizeof(Matrix4x4));
+}
+BENCHMARK(BM_MatrixMultiplyArray)->Apply(arrayRange);
+
+static void BM_VectorTransformArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    Vector4 vector;
+    vector.x = 1.0f;
+    vector.y = 2.0f;
+    vector.z = 3.0f;
+    vector.w = 1.0f;
+    std::vector<Vector4> vectors(count, vector);
+    std::vector<Vector4> result(count);
+    const Matrix4x4 matrix = testMatrix(0.5f);
+    for (auto _ : state) {
+        VectorTransformArray(result.data(), vectors.data(), matrix, count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 2 * sizeof(Vector4));
+}
+BENCHMARK(BM_VectorTransformArray)->Apply(arrayRange);
+
+static void BM_QuaternionMultiplyArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Quaternion> quat0(count, testQuaternion(0.1f));
+    std::vector<Quaternion> quat1(count, testQuaternion(0.2f));
+    std::vector<Quaternion> result(count);
+    for (auto _ : state) {
+        QuaternionMultiplyArray(result.data(), quat0.data(), quat1.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 3 * sizeof(Quaternion));
+}
+BENCHMARK(BM_QuaternionMultiplyArray)->Apply(arrayRange);
+
+static void BM_TransformPoints(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Vector3> points(count, Vector3(1.0f, 2.0f, 3.0f));
+    std::vector<Vector3> result(count);
+    const Matrix4x4 matrix = testMatrix(0.5f);
+    for (auto _ : state) {
+        TransformPoints(matrix, points.data(), result.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 2 * sizeof(Vector3));
+}
+BENCHMARK(BM_TransformPoints)->Apply(arrayRange);
+
+static void BM_QuaternionToMatrixArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Quaternion> quats(count, testQuaternion(0.1f));
+    std::vector<Matrix4x4> result(count);
+    for (auto _ : state) {
+        QuaternionToMatrixArray(quats.data(), result.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(Quaternion) + sizeof(Matrix4x4));
+}
+BENCHMARK(BM_QuaternionToMatrixArray)->Apply(arrayRange);
+
+static std::vector<Matrix4x4> trsMatrices(size_t count)
+{
+    std::vector<Vector3> positions(count, Vector3(1.0f, 2.0f, 3.0f));
+    std::vector<Vector3> scales(count, Vector3(2.0f, 1.0f, 0.5f));
+    std::vector<Quaternion> rotations;
+    for (size_t i = 0; i < count; ++i) {
+        rotations.push_back(testQuaternion(0.001f * (i % 1000)));
+    }
+    std::vector<Matrix4x4> matrices(count);
+    MatrixComposeArray(positions.data(), scales.data(), rotations.data(), matrices.data(), count);
+    return matrices;
+}
+
+static void BM_MatrixDecomposeArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    const std::vector<Matrix4x4> matrices = trsMatrices(count);
+    std::vector<Vector3> positions(count), scales(count);
+    std::vector<Quaternion> rotations(count);
+    for (auto _ : state) {
+        MatrixDecomposeArray(matrices.data(), positions.data(), scales.data(), rotations.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(Matrix4x4) + 2 * sizeof(Vector3) + sizeof(Quaternion));
+}
+BENCHMARK(BM_MatrixDecomposeArray)->Apply(arrayRange);
+
+// one matrix at a time: column lengths, then Quaternion(const Matrix4x4&) of the unscaled rotation, transposed
+static void BM_MatrixDecomposeScalar(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    const std::vector<Matrix4x4> matrices = trsMatrices(count);
+    std::vector<Vector3> positions(count), scales(count);
+    std::vector<Quaternion> rotations(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; ++i) {
+            const Matrix4x4& matrix = matrices[i];
+            float scale[3];
+            Matrix4x4 rotation;
+            for (int j = 0; j < 3; ++j) {
+                scale[j] = std::sqrt(matrix.m[0][j] * matrix.m[0][j] + matrix.m[1][j] * matrix.m[1][j] + matrix.m[2][j] * matrix.m[2][j]);
+                for (int row = 0; row < 3; ++row) {
+                    rotation.m[j][row] = matrix.m[row][j] / scale[j];
+                }
+            }
+            positions[i] = Vector3(matrix.m[0][3], matrix.m[1][3], matrix.m[2][3]);
+            scales[i] = Vector3(scale[0], scale[1], scale[2]);
+            rotations[i] = Quaternion(rotation);
+        }
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(Matrix4x4) + 2 * sizeof(Vector3) + sizeof(Quaternion));
+}
+BENCHMARK(BM_MatrixDecomposeScalar)->Apply(arrayRange);
+
+static void BM_MatrixComposeArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Vector3> positions(count, Vector3(1.0f, 2.0f, 3.0f));
+    std::vector<Vector3> scales(count, Vector3(2.0f, 1.0f, 0.5f));
+    std::vector<Quaternion> rotations(count, testQuaternion(0.1f));
+    std::vector<Matrix4x4> matrices(count);
+    for (auto _ : state) {
+        MatrixComposeArray(positions.data(), scales.data(), rotations.data(), matrices.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(Matrix4x4) + 2 * sizeof(Vector3) + sizeof(Quaternion));
+}
+BENCHMARK(BM_MatrixComposeArray)->Apply(arrayRange);
+
+// normalizes in place, the vectors keep their length after the first pass
+static void BM_NormalizeArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<Vector3> vectors(count, Vector3(1.0f, 2.0f, 3.0f));
+    for (auto _ : state) {
+        NormalizeArray(vectors.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 2 * sizeof(Vector3));
+}
+BENCHMARK(BM_NormalizeArray)->Apply(arrayRange);
+
+// boxes spread along x across clip space, about a third of them inside
+static void BM_FrustumCullArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<float> lower[3], upper[3];
+    for (size_t i = 0; i < count; ++i) {
+        const float x = -3.0f + 6.0f * i / count;
+        lower[0].push_back(x);
+        upper[0].push_back(x + 0.1f);
+        for (int c = 1; c < 3; ++c) {
+            lower[c].push_back(0.25f);
+            upper[c].push_back(0.5f);
+        }
+    }
+    const float* lowers[3] = { lower[0].data(), lower[1].data(), lower[2].data() };
+    const float* uppers[3] = { upper[0].data(), upper[1].data(), upper[2].data() };
+    std::vector<uint32_t> visible((count + 31) / 32);
+    const Frustum frustum = Frustum::FromViewProjection(Matrix4x4());
+    for (auto _ : state) {
+        FrustumCullArray(frustum, lowers, uppers, count, visible.data());
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, 6 * sizeof(float));
+}
+BENCHMARK(BM_FrustumCullArray)->Apply(arrayRange);
+
+// texture coordinates of a mesh import
+static void BM_FloatToHalfArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = static_cast<float>(i) / count;
+    }
+    std::vector<uint16_t> halves(count);
+    for (auto _ : state) {
+        FloatToHalfArray(values.data(), halves.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(float) + sizeof(uint16_t));
+}
+BENCHMARK(BM_FloatToHalfArray)->Apply(arrayRange);
+
+static void BM_HalfToFloatArray(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<uint16_t> halves(count);
+    for (size_t i = 0; i < count; ++i) {
+        halves[i] = static_cast<uint16_t>(i % 0x7C00);
+    }
+    std::vector<float> values(count);
+    for (auto _ : state) {
+        HalfToFloatArray(halves.data(), values.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(float) + sizeof(uint16_t));
+}
+BENCHMARK(BM_HalfToFloatArray)->Apply(arrayRange);
+
+// octahedral normal components
+static void BM_FloatToSnorm16Array(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = 2.0f * i / count - 1.0f;
+    }
+    std::vector<int16_t> snorm(count);
+    for (auto _ : state) {
+        FloatToSnorm16Array(values.data(), snorm.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(float) + sizeof(int16_t));
+}
+BENCHMARK(BM_FloatToSnorm16Array)->Apply(arrayRange);
+
+static void BM_FloatToUnorm8Array(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = static_cast<float>(i) / count;
+    }
+    std::vector<uint8_t> unorm(count);
+    for (auto _ : state) {
+        FloatToUnorm8Array(values.data(), unorm.data(), count);
+        benchmark::ClobberMemory();
+    }
+    arrayCounters(state, sizeof(float) + sizeof(uint8_t));
+}
+BENCHMARK(BM_FloatToUnorm8Array)->Apply(arrayRange);
+
+BENCHMARK_MAIN();
@@ -7,14 +7,48 @@
 
 #include <cmath>
 
+#ifndef USE_SIMD
+#define USE_SIMD 1
+#endif
+
+// SIMD
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include "SIMD_NEON.h"
+#elif defined(__arm__) || defined(__aarch64__)
+// ARMv7 without NEON, SIMD_Batch.h still picks NEON kernels on devices that have it
+#undef USE_SIMD
+#define USE_SIMD 0
+#else
+#include "SIMD_SSE.h"
+#endif
+
 namespace m3d {
 namespace math {
 	const float  PI_F = 3.14159265358979f;
 
-    static inline float InvSqrt(float f)
+    // What the reciprocal square roots trade for speed
+    enum class SqrtPrecision {
+        // rsqrtps / vrsqrte alone, about 12 (SSE) or 8 (NEON) bits
+        Estimate,
+        // the estimate refined by Newton-Raphson to about 22 bits
+        Refined,
+        // 1 / std::sqrt
+        Exact
+    };
+
+    static inline float InvSqrt(float f, SqrtPrecision precision = SqrtPrecision::Refined)
     {
-        // TODO: quake 3, neon
-        return std::sqrt(1.0f / f);
+#if USE_SIMD
+        if (precision == SqrtPrecision::Estimate) {
+            return VectorGetX(VectorReciprocalSqrtEstimate(MakeVectorSIMD(f, f, f, f)));
+        }
+        if (precision == SqrtPrecision::Refined) {
+            return VectorGetX(VectorReciprocalSqrt(MakeVectorSIMD(f, f, f, f)));
+        }
+#else
+        (void)precision;
+#endif
+        return 1.0f / std::sqrt(f);
     }
 
     struct Range {
@@ -8,19 +8,38 @@
 #include <cstdio>
 #include <cstring>
 
+// SIMD backend and USE_SIMD
 #include "MathUtils.h"
-// SIMD
-#if defined __arm__
-#include "SIMD_NEON.h"
-#else
-#include "SIMD_SSE.h"
-#endif
-
-#define USE_SIMD 1
 
 namespace m3d {
 namespace math {
 
+    /// x * x' + y * y' + z * z' in every lane, w is ignored
+    inline VectorSIMD VectorDot3(VectorSIMD v0, VectorSIMD v1)
+    {
+        VectorSIMD product = VectorMultiply(v0, v1);
+        // only lane 0 is kept, 1 0 3 2 is a single instruction everywhere
+        VectorSIMD sum = VectorAdd(product, VectorSwizzle(product, 1, 0, 3, 2));
+        sum = VectorAdd(sum, VectorSwizzle(product, 2, 2, 2, 2));
+        return VectorReplicate(sum, 0);
+    }
+
+    /// Sum of the four lane products in every lane
+    inline VectorSIMD VectorDot4(VectorSIMD v0, VectorSIMD v1)
+    {
+        VectorSIMD product = VectorMultiply(v0, v1);
+        VectorSIMD sum = VectorAdd(product, VectorSwizzle(product, 1, 0, 3, 2));
+        return VectorAdd(sum, VectorSwizzle(sum, 2, 3, 0, 1));
+    }
+
+    /// Cross product of the xyz lanes, w comes out 0
+    inline VectorSIMD VectorCross3(VectorSIMD v0, VectorSIMD v1)
+    {
+        // (v0 * v1.yzx - v0.yzx * v1).yzx, three swizzles instead of four
+        VectorSIMD zxy = VectorSubstract(VectorMultiply(v0, VectorSwizzle(v1, 1, 2, 0, 3)), VectorMultiply(VectorSwizzle(v0, 1, 2, 0, 3), v1));
+        return VectorSwizzle(zxy, 1, 2, 0, 3);
+    }
+
     struct Vector2 {
     public:
         float x;
@@ -173,7 +192,7 @@ namespace math {
         inline static Vector3 CrossProduct(const Vector3& Left, const Vector3& Right);
         inline static float DotProduct(const Vector3& Left, const Vector3& Right);
 
-        inline void Normalize();
+        inline void Normalize(SqrtPrecision precision = SqrtPrecision::Refined);
 
         void print();
         void ToString(char* const str, size_t size);
@@ -316,15 +335,88 @@ namespace math {
         return Left ^ Right;
     }
 
-    inline void Vector3::Normalize()
+    inline void Vector3::Normalize(SqrtPrecision precision)
     {
-        float length = sqrt(x * x + y * y + z * z);
-        x /= length;
-        y /= length;
-        z /= length;
+        const float scale = InvSqrt(x * x + y * y + z * z, precision);
+        x *= scale;
+        y *= scale;
+        z *= scale;
     }
 
-    typedef struct Vector4 {
+    //-------------------------------------------------------------
+    // Vector3A
+    //-------------------------------------------------------------
+    /// Vector3 in one aligned SIMD register for camera and animation math.
+    /// Vector3 itself stays packed, it is the layout of vertex and scene data.
+    struct alignas(16) Vector3A {
+    public:
+        float x;
+        float y;
+        float z;
+        // padding lane, not part of any result
+        float w;
+
+        inline Vector3A(){};
+        inline Vector3A(float fX, float fY, float fZ)
+            : x(fX)
+            , y(fY)
+            , z(fZ)
+            , w(0.0f)
+        {
+        }
+        inline explicit Vector3A(const Vector3& v)
+            : x(v.x)
+            , y(v.y)
+            , z(v.z)
+            , w(0.0f)
+        {
+        }
+        inline explicit Vector3A(VectorSIMD v)
+        {
+            VectorStore4f(v, this);
+        }
+
+        inline VectorSIMD Load() const { return VectorLoad4f(this); }
+        inline Vector3 ToVector3() const { return Vector3(x, y, z); }
+
+        inline Vector3A operator-() const { return Vector3A(VectorSubstract(MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f), Load())); }
+        inline Vector3A operator+(const Vector3A& other) const { return Vector3A(VectorAdd(Load(), other.Load())); }
+        inline Vector3A operator-(const Vector3A& other) const { return Vector3A(VectorSubstract(Load(), other.Load())); }
+        inline Vector3A operator*(const Vector3A& other) const { return Vector3A(VectorMultiply(Load(), other.Load())); }
+        inline Vector3A operator/(const Vector3A& other) const { return Vector3A(VectorDivide(Load(), other.Load())); }
+        inline Vector3A operator*(const float scale) const { return Vector3A(VectorMultiply(Load(), MakeVectorSIMD(scale, scale, scale, scale))); }
+        inline Vector3A operator/(const float scale) const { return Vector3A(VectorDivide(Load(), MakeVectorSIMD(scale, scale, scale, scale))); }
+        /// Dot product
+        inline float operator|(const Vector3A& other) const { return VectorGetX(VectorDot3(Load(), other.Load())); }
+        /// Cross product
+        inline Vector3A operator^(const Vector3A& other) const { return Vector3A(VectorCross3(Load(), other.Load())); }
+
+        inline Vector3A& operator+=(const Vector3A& other) { return *this = *this + other; }
+        inline Vector3A& operator-=(const Vector3A& other) { return *this = *this - other; }
+        inline Vector3A& operator*=(const Vector3A& other) { return *this = *this * other; }
+        inline Vector3A& operator/=(const Vector3A& other) { return *this = *this / other; }
+        inline Vector3A& operator*=(const float scale) { return *this = *this * scale; }
+        inline Vector3A& operator/=(const float scale) { return *this = *this / scale; }
+
+        inline static float DotProduct(const Vector3A& left, const Vector3A& right) { return left | right; }
+        inline static Vector3A CrossProduct(const Vector3A& left, const Vector3A& right) { return left ^ right; }
+
+        inline float Length() const { return VectorGetX(VectorSqrt(VectorDot3(Load(), Load()))); }
+        inline void Normalize(SqrtPrecision precision = SqrtPrecision::Refined)
+        {
+            const VectorSIMD v = Load();
+            const VectorSIMD lengthSquared = VectorDot3(v, v);
+            if (precision == SqrtPrecision::Exact) {
+                *this = Vector3A(VectorDivide(v, VectorSqrt(lengthSquared)));
+            } else if (precision == SqrtPrecision::Refined) {
+                *this = Vector3A(VectorMultiply(v, VectorReciprocalSqrt(lengthSquared)));
+            } else {
+                *this = Vector3A(VectorMultiply(v, VectorReciprocalSqrtEstimate(lengthSquared)));
+            }
+        }
+    };
+
+    typedef struct alignas(16) Vector4 {
         union {
             float x;
             float r;
@@ -341,6 +433,28 @@ namespace math {
             float w;
             float a;
         };
+
+        inline VectorSIMD Load() const { return VectorLoad4f(this); }
+        inline static Vector4 FromSIMD(VectorSIMD v)
+        {
+            Vector4 result;
+            VectorStore4f(v, &result);
+            return result;
+        }
+
+        inline Vector4 operator+(const Vector4& other) const { return FromSIMD(VectorAdd(Load(), other.Load())); }
+        inline Vector4 operator-(const Vector4& other) const { return FromSIMD(VectorSubstract(Load(), other.Load())); }
+        inline Vector4 operator*(const Vector4& other) const { return FromSIMD(VectorMultiply(Load(), other.Load())); }
+        inline Vector4 operator/(const Vector4& other) const { return FromSIMD(VectorDivide(Load(), other.Load())); }
+        inline Vector4 operator*(const float scale) const { return FromSIMD(VectorMultiply(Load(), MakeVectorSIMD(scale, scale, scale, scale))); }
+        inline Vector4 operator/(const float scale) const { return FromSIMD(VectorDivide(Load(), MakeVectorSIMD(scale, scale, scale, scale))); }
+        /// Dot product of all four lanes
+        inline float operator|(const Vector4& other) const { return VectorGetX(VectorDot4(Load(), other.Load())); }
+
+        inline Vector4& operator+=(const Vector4& other) { return *this = *this + other; }
+        inline Vector4& operator-=(const Vector4& other) { return *this = *this - other; }
+        inline Vector4& operator*=(const Vector4& other) { return *this = *this * other; }
+        inline Vector4& operator*=(const float scale) { return *this = *this * scale; }
     } Vector4;
     typedef Vector4 Color;
 
@@ -375,6 +489,33 @@ namespace math {
         void ToString(char* const str, size_t size);
     };
 
+    //-------------------------------------------------------------
+    // Matrix4x3
+    //-------------------------------------------------------------
+    /// Affine Matrix4x4 without its constant (0, 0, 0, 1) fourth row: the three
+    /// column vector rows, translation in m[row][3]. Joint and skinning matrices
+    /// are affine, the type saves a quarter of their math and of their upload.
+    struct Matrix4x3 {
+    public:
+        alignas(16) float m[3][4];
+
+        inline Matrix4x3();
+        inline explicit Matrix4x3(const Matrix4x4& affine);
+
+        inline void SetIdentity();
+        inline Matrix4x4 ToMatrix4x4() const;
+
+        inline Matrix4x3 operator*(const Matrix4x3& other) const;
+        inline void operator*=(const Matrix4x3& other);
+
+        /// Identity when the 3x3 part is singular
+        inline Matrix4x3 Inverse() const;
+        /// this * (p, 1)
+        inline Vector3A TransformPoint(const Vector3A& p) const;
+        /// this * (v, 0), without the translation
+        inline Vector3A TransformVector(const Vector3A& v) const;
+    };
+
     inline void Matrix4x4::SetIdentity()
     {
         m[0][0] = 1;
@@ -408,22 +549,34 @@ namespace math {
     inline Matrix4x4 Matrix4x4::operator+(const Matrix4x4& other)
     {
         Matrix4x4 result;
+#if USE_SIMD
+        for (int i = 0; i < 4; i++) {
+            VectorStore4f(VectorAdd(VectorLoad4f(m[i]), VectorLoad4f(other.m[i])), result.m[i]);
+        }
+#else
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
                 result.m[i][j] = m[i][j] + other.m[i][j];
             }
         }
+#endif
         return result;
     }
 
     inline Matrix4x4 Matrix4x4::operator-(const Matrix4x4& other)
     {
         Matrix4x4 result;
+#if USE_SIMD
+        for (int i = 0; i < 4; i++) {
+            VectorStore4f(VectorSubstract(VectorLoad4f(m[i]), VectorLoad4f(other.m[i])), result.m[i]);
+        }
+#else
         for (int i = 0; i < 4; i++) {
             for (int j = 0; j < 4; j++) {
                 result.m[i][j] = m[i][j] - other.m[i][j];
             }
         }
+#endif
         return result;
     }
 
@@ -435,8 +588,8 @@ namespace math {
 #else
 
         for (int i = 0; i < 4; i++) {
-            float accumulator;
             for (int j = 0; j < 4; j++) {
+                float accumulator = 0.0f;
                 for (int k = 0; k < 4; k++) {
                     accumulator += m[i][k] * other.m[k][j];
                 }
@@ -466,6 +619,26 @@ namespace math {
     {
         Matrix4x4 result;
 
+#if USE_SIMD
+        // the axes are the columns, transpose them into the rows
+        const VectorSIMD eyeSIMD = Vector3A(eye).Load();
+        VectorSIMD zAxis = VectorSubstract(Vector3A(at).Load(), eyeSIMD);
+        zAxis = VectorDivide(zAxis, VectorSqrt(VectorDot3(zAxis, zAxis)));
+        VectorSIMD xAxis = VectorCross3(Vector3A(up).Load(), zAxis);
+        xAxis = VectorDivide(xAxis, VectorSqrt(VectorDot3(xAxis, xAxis)));
+        VectorSIMD yAxis = VectorCross3(zAxis, xAxis);
+
+        const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+        const VectorSIMD minusEye = VectorSubstract(zero, eyeSIMD);
+        VectorSIMD translation = MakeVectorSIMD(VectorGetX(VectorDot3(minusEye, xAxis)), VectorGetX(VectorDot3(minusEye, yAxis)),
+            VectorGetX(VectorDot3(minusEye, zAxis)), 1.0f);
+        VectorSIMD w = zero;
+        VectorTranspose4(xAxis, yAxis, zAxis, w);
+        VectorStore4f(xAxis, result.m[0]);
+        VectorStore4f(yAxis, result.m[1]);
+        VectorStore4f(zAxis, result.m[2]);
+        VectorStore4f(translation, result.m[3]);
+#else
         Vector3 zAxis = (at - eye);
         zAxis.Normalize();
         Vector3 xAxis = (up ^ zAxis);
@@ -483,6 +656,7 @@ namespace math {
         result.m[3][1] = -eye | yAxis;
         result.m[3][2] = -eye | zAxis;
         result.m[3][3] = 1.0f;
+#endif
 
         return result;
     }
@@ -496,6 +670,16 @@ namespace math {
     {
         Matrix4x4 result;
 
+#if USE_SIMD
+        // the four divisions at once
+        VectorSIMD quotients = VectorDivide(MakeVectorSIMD(2 * n, r + l, 2 * n, t + b), MakeVectorSIMD(r - l, r - l, t - b, t - b));
+        alignas(16) float q[4];
+        VectorStore4f(quotients, q);
+        VectorStore4f(MakeVectorSIMD(q[0], 0.0f, q[1], 0.0f), result.m[0]);
+        VectorStore4f(MakeVectorSIMD(0.0f, q[2], q[3], 0.0f), result.m[1]);
+        VectorStore4f(MakeVectorSIMD(0.0f, 0.0f, -(f + n) / (f - n), -(2 * f * n) / (f - n)), result.m[2]);
+        VectorStore4f(MakeVectorSIMD(0.0f, 0.0f, -1.0f, 0.0f), result.m[3]);
+#else
         result.m[0][0] = 2 * n / (r - l);
         result.m[0][2] = (r + l) / (r - l);
         result.m[1][1] = 2 * n / (t - b);
@@ -504,6 +688,7 @@ namespace math {
         result.m[2][3] = -(2 * f * n) / (f - n);
         result.m[3][2] = -1;
         result.m[3][3] = 0;
+#endif
 
         return result;
     }
@@ -527,12 +712,20 @@ namespace math {
         Matrix4x4 result;
         // set the basic projection matrix
         float scale = 1.0f / tanf(fov * 0.5f * PI_F / 180.0f);
+#if USE_SIMD
+        const float depth = -zFar / (zFar - zNear);
+        VectorStore4f(MakeVectorSIMD(scale, 0.0f, 0.0f, 0.0f), result.m[0]);
+        VectorStore4f(MakeVectorSIMD(0.0f, scale, 0.0f, 0.0f), result.m[1]);
+        VectorStore4f(MakeVectorSIMD(0.0f, 0.0f, depth, -1.0f), result.m[2]);
+        VectorStore4f(MakeVectorSIMD(0.0f, 0.0f, -zFar * zNear / (zFar - zNear), 0.0f), result.m[3]);
+#else
         result.m[0][0] = scale; // scale the x coordinates of the projected point
         result.m[1][1] = scale; // scale the y coordinates of the projected point
         result.m[2][2] = -zFar / (zFar - zNear); // used to remap z to [0,1]
         result.m[3][2] = -zFar * zNear / (zFar - zNear); // used to remap z [0,1]
         result.m[2][3] = -1; // set w = -z
         result.m[3][3] = 0;
+#endif
 
         return result;
     }
@@ -648,5 +841,151 @@ namespace math {
         return result;
     }
 
+    inline void Matrix4x3::SetIdentity()
+    {
+        std::memset(m, 0, sizeof(m));
+        m[0][0] = 1;
+        m[1][1] = 1;
+        m[2][2] = 1;
+    }
+
+    inline Matrix4x3::Matrix4x3()
+    {
+        SetIdentity();
+    }
+
+    inline Matrix4x3::Matrix4x3(const Matrix4x4& affine)
+    {
+        std::memcpy(m, affine.m, sizeof(m));
+    }
+
+    inline Matrix4x4 Matrix4x3::ToMatrix4x4() const
+    {
+        Matrix4x4 result;
+        std::memcpy(result.m, m, sizeof(m));
+        return result;
+    }
+
+    inline Matrix4x3 Matrix4x3::operator*(const Matrix4x3& other) const
+    {
+        Matrix4x3 result;
+#if USE_SIMD
+        MatrixMultiplyAffine(&result, this, &other);
+#else
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                result.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+            }
+            result.m[i][3] += m[i][3];
+        }
+#endif
+        return result;
+    }
+
+    inline void Matrix4x3::operator*=(const Matrix4x3& other)
+    {
+#if USE_SIMD
+        MatrixMultiplyAffine(this, this, &other);
+#else
+        *this = *this * other;
+#endif
+    }
+
+    inline Matrix4x3 Matrix4x3::Inverse() const
+    {
+        Matrix4x3 result;
+
+#if USE_SIMD
+        // the columns of the inverse 3x3 are the cross products of the rows over the determinant
+        const VectorSIMD row0 = VectorLoad4f(m[0]);
+        const VectorSIMD row1 = VectorLoad4f(m[1]);
+        const VectorSIMD row2 = VectorLoad4f(m[2]);
+        VectorSIMD column0 = VectorCross3(row1, row2);
+        VectorSIMD column1 = VectorCross3(row2, row0);
+        VectorSIMD column2 = VectorCross3(row0, row1);
+        const float determinant = VectorGetX(VectorDot3(row0, column0));
+        if (determinant == 0.0f) {
+            return result;
+        }
+        const float reciprocal = 1.0f / determinant;
+        const VectorSIMD scale = MakeVectorSIMD(reciprocal, reciprocal, reciprocal, reciprocal);
+        column0 = VectorMultiply(column0, scale);
+        column1 = VectorMultiply(column1, scale);
+        column2 = VectorMultiply(column2, scale);
+
+        // -inverse * translation, then the translation is the fourth column of the transpose
+        VectorSIMD translation = VectorMultiply(column0, VectorReplicate(row0, 3));
+        translation = VectorMultiplyAdd(column1, VectorReplicate(row1, 3), translation);
+        translation = VectorMultiplyAdd(column2, VectorReplicate(row2, 3), translation);
+        translation = VectorSubstract(MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f), translation);
+        VectorTranspose4(column0, column1, column2, translation);
+        VectorStore4f(column0, result.m[0]);
+        VectorStore4f(column1, result.m[1]);
+        VectorStore4f(column2, result.m[2]);
+#else
+        const float cofactor00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        const float cofactor01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        const float cofactor02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        const float determinant = m[0][0] * cofactor00 + m[0][1] * cofactor01 + m[0][2] * cofactor02;
+        if (determinant == 0.0f) {
+            return result;
+        }
+        const float reciprocal = 1.0f / determinant;
+
+        result.m[0][0] = cofactor00 * reciprocal;
+        result.m[1][0] = cofactor01 * reciprocal;
+        result.m[2][0] = cofactor02 * reciprocal;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * reciprocal;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * reciprocal;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * reciprocal;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * reciprocal;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * reciprocal;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * reciprocal;
+        for (int i = 0; i < 3; i++) {
+            result.m[i][3] = -(result.m[i][0] * m[0][3] + result.m[i][1] * m[1][3] + result.m[i][2] * m[2][3]);
+        }
+#endif
+
+        return result;
+    }
+
+    inline Vector3A Matrix4x3::TransformPoint(const Vector3A& p) const
+    {
+#if USE_SIMD
+        VectorSIMD column0 = VectorLoad4f(m[0]);
+        VectorSIMD column1 = VectorLoad4f(m[1]);
+        VectorSIMD column2 = VectorLoad4f(m[2]);
+        VectorSIMD translation = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+        VectorTranspose4(column0, column1, column2, translation);
+        const VectorSIMD point = p.Load();
+        VectorSIMD result = VectorMultiplyAdd(column0, VectorReplicate(point, 0), translation);
+        result = VectorMultiplyAdd(column1, VectorReplicate(point, 1), result);
+        return Vector3A(VectorMultiplyAdd(column2, VectorReplicate(point, 2), result));
+#else
+        return Vector3A(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+            m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+            m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+#endif
+    }
+
+    inline Vector3A Matrix4x3::TransformVector(const Vector3A& v) const
+    {
+#if USE_SIMD
+        VectorSIMD column0 = VectorLoad4f(m[0]);
+        VectorSIMD column1 = VectorLoad4f(m[1]);
+        VectorSIMD column2 = VectorLoad4f(m[2]);
+        VectorSIMD translation = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+        VectorTranspose4(column0, column1, column2, translation);
+        const VectorSIMD vector = v.Load();
+        VectorSIMD result = VectorMultiply(column0, VectorReplicate(vector, 0));
+        result = VectorMultiplyAdd(column1, VectorReplicate(vector, 1), result);
+        return Vector3A(VectorMultiplyAdd(column2, VectorReplicate(vector, 2), result));
+#else
+        return Vector3A(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+            m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+            m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+#endif
+    }
+
 } // namespace math
 } // namespace m3d
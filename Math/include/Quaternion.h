@@ -5,15 +5,9 @@
 
 #pragma once
 
+// SIMD backend and USE_SIMD
 #include "Matrix.h"
 
-// SIMD
-#if defined __arm__
-#include "SIMD_NEON.h"
-#else
-#include "SIMD_SSE.h"
-#endif
-
 namespace m3d {
 namespace math {
     struct Vector3;
@@ -143,29 +137,35 @@ namespace math {
 
     inline Quaternion Quaternion::operator+(const Quaternion& other) const
     {
+#if USE_SIMD
+        Quaternion result;
+        VectorStore4f(VectorAdd(VectorLoad4f(this), VectorLoad4f(&other)), &result);
+        return result;
+#else
         return Quaternion(x + other.x, y + other.y, z + other.z, w + other.w);
+#endif
     }
 
     inline Quaternion Quaternion::operator+=(const Quaternion& other)
     {
-        x += other.x;
-        y += other.y;
-        z += other.z;
-        w += other.w;
+        *this = *this + other;
         return *this;
     }
 
     inline Quaternion Quaternion::operator-(const Quaternion& other) const
     {
+#if USE_SIMD
+        Quaternion result;
+        VectorStore4f(VectorSubstract(VectorLoad4f(this), VectorLoad4f(&other)), &result);
+        return result;
+#else
         return Quaternion(x - other.x, y - other.y, z - other.z, w - other.w);
+#endif
     }
 
     inline Quaternion Quaternion::operator-=(const Quaternion& other)
     {
-        x -= other.x;
-        y -= other.y;
-        z -= other.z;
-        w -= other.w;
+        *this = *this - other;
         return *this;
     }
 
@@ -189,15 +189,30 @@ namespace math {
 
     float Quaternion::operator|(const Quaternion& other) const
     {
+#if USE_SIMD
+        return VectorGetX(VectorDot4(VectorLoad4f(this), VectorLoad4f(&other)));
+#else
         return x * other.x + y * other.y + z * other.z + w * other.w;
+#endif
     }
 
     inline Vector3 Quaternion::operator*(const Vector3& v0) const
     {
+#if USE_SIMD
+        // v + w * t + q x t with t = 2 * (q x v), the cross products ignore the w lanes
+        const VectorSIMD quat = VectorLoad4f(this);
+        const VectorSIMD v = Vector3A(v0).Load();
+        const VectorSIMD cross = VectorCross3(quat, v);
+        const VectorSIMD normal = VectorAdd(cross, cross);
+        VectorSIMD result = VectorMultiplyAdd(normal, VectorReplicate(quat, 3), v);
+        result = VectorAdd(result, VectorCross3(quat, normal));
+        return Vector3A(result).ToVector3();
+#else
         const Vector3 v1(x, y, z);
         const Vector3 normal = Vector3::CrossProduct(v1, v0) * 2.0f;
         const Vector3 result = v0 + (normal * w) + Vector3::CrossProduct(v1, normal);
         return result;
+#endif
     }
 
     inline Matrix4x4 Quaternion::operator*(const Matrix4x4& mat) const
@@ -221,29 +236,35 @@ namespace math {
     /* Scale */
     inline Quaternion Quaternion::operator*(const float scale) const
     {
+#if USE_SIMD
+        Quaternion result;
+        VectorStore4f(VectorMultiply(VectorLoad4f(this), MakeVectorSIMD(scale, scale, scale, scale)), &result);
+        return result;
+#else
         return Quaternion(x * scale, y * scale, z * scale, w * scale);
+#endif
     }
 
     inline Quaternion Quaternion::operator*=(const float scale)
     {
-        x *= scale;
-        y *= scale;
-        z *= scale;
-        w *= scale;
+        *this = *this * scale;
         return *this;
     }
 
     inline Quaternion Quaternion::operator/(const float scale) const
     {
+#if USE_SIMD
+        Quaternion result;
+        VectorStore4f(VectorDivide(VectorLoad4f(this), MakeVectorSIMD(scale, scale, scale, scale)), &result);
+        return result;
+#else
         return Quaternion(x / scale, y / scale, z / scale, w / scale);
+#endif
     }
 
     inline Quaternion Quaternion::operator/=(const float scale)
     {
-        x /= scale;
-        y /= scale;
-        z /= scale;
-        w /= scale;
+        *this = *this / scale;
         return *this;
     }
 
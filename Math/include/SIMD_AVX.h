@@ -0,0 +1,55 @@
+/*
+* Copyright (C) 2016 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+// 8-wide AVX2/FMA counterpart of SIMD_SSE.h, two 4-wide vectors per register.
+// Only for translation units built with AVX2 and FMA enabled, the rest of the
+// code reaches it through the array functions of SIMD_Batch.h.
+#if !defined(__AVX2__) || !(defined(__FMA__) || defined(_MSC_VER))
+#error "SIMD_AVX.h needs a translation unit compiled for AVX2 and FMA"
+#endif
+
+#include <immintrin.h>
+
+namespace m3d {
+namespace math {
+    using VectorSIMD8 = __m256;
+
+#ifndef SHUFFLEMASK
+#define SHUFFLEMASK(A0, A1, B2, B3) ((A0) | ((A1) << 2) | ((B2) << 4) | ((B3) << 6))
+#endif
+
+    inline VectorSIMD8 MakeVectorSIMD8(float fX, float fY, float fZ, float fW)
+    {
+        return _mm256_setr_ps(fX, fY, fZ, fW, fX, fY, fZ, fW);
+    }
+
+// unaligned, the arrays are only guaranteed 16 byte alignment
+#define Vector8Load(ptr) _mm256_loadu_ps((const float*)(ptr))
+#define Vector8Store(vec, ptr) _mm256_storeu_ps((float*)(ptr), vec)
+// the same four floats in both halves
+#define Vector8Broadcast4f(ptr) _mm256_broadcast_ps((const __m128*)(ptr))
+
+#define Vector8Add(v0, v1) _mm256_add_ps(v0, v1)
+#define Vector8Substract(v0, v1) _mm256_sub_ps(v0, v1)
+#define Vector8Multiply(v0, v1) _mm256_mul_ps(v0, v1)
+// v0 * v1 + v2 with a single rounding
+#define Vector8MultiplyAdd(v0, v1, v2) _mm256_fmadd_ps(v0, v1, v2)
+// per half, like VectorReplicate and VectorSwizzle on both vectors at once
+#define Vector8Replicate(v, index) _mm256_permute_ps(v, SHUFFLEMASK(index, index, index, index))
+#define Vector8Swizzle(vec, x, y, z, w) _mm256_permute_ps(vec, SHUFFLEMASK(x, y, z, w))
+// all bits of a lane set where v0 >= v1, like VectorCompareGreaterEqual
+#define Vector8CompareGreaterEqual(v0, v1) _mm256_cmp_ps(v0, v1, _CMP_GE_OQ)
+#define Vector8And(v0, v1) _mm256_and_ps(v0, v1)
+// the sign bit of every lane, lane 0 in bit 0
+#define Vector8MoveMask(mask) _mm256_movemask_ps(mask)
+#if defined(__F16C__) || defined(_MSC_VER)
+// eight IEEE halves, rounded to nearest even
+#define Vector8StoreHalf(vec, ptr) _mm_storeu_si128((__m128i*)(ptr), _mm256_cvtps_ph(vec, _MM_FROUND_TO_NEAREST_INT))
+#define Vector8LoadHalf(ptr) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(ptr)))
+#endif
+}
+}
@@ -0,0 +1,90 @@
+/*
+* Copyright (C) 2016 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Matrix.h"
+#include "Quaternion.h"
+
+namespace m3d {
+namespace math {
+    // Which kernels the array functions below run
+    enum class SIMDBackend {
+        // plain float loops, USE_SIMD is off
+        Scalar,
+        // SIMD_SSE.h or SIMD_NEON.h, 4-wide
+        Default,
+        // SIMD_AVX.h, 8-wide with fused multiply-add and F16C
+        AVX2,
+        // SIMD_NEON.h kernels of a build without NEON, the device reported it
+        NEON
+    };
+
+    // AVX2 when the build targets it, otherwise when cpuid reports AVX2, FMA and F16C
+    // and the OS saves the ymm registers. ARM builds without NEON run the NEON
+    // kernels when android_getCpuFeatures (or the Linux hwcaps) report NEON.
+    // Decided once, on the first call.
+    //
+    // The kernels stream through the arrays and prefetch a few elements ahead,
+    // the next element is loaded before the current one is stored.
+    SIMDBackend GetSIMDBackend();
+
+    /// result[i] = left[i] * right[i], result may alias either input
+    void MatrixMultiplyArray(Matrix4x4* result, const Matrix4x4* left, const Matrix4x4* right, size_t count);
+
+    /// result[i] = vectors[i] * matrix, the vectors as rows like MatrixMultiply's left operand.
+    /// result may alias vectors
+    void VectorTransformArray(Vector4* result, const Vector4* vectors, const Matrix4x4& matrix, size_t count);
+
+    /// result[i] = quat0[i] * quat1[i], result may alias either input
+    void QuaternionMultiplyArray(Quaternion* result, const Quaternion* quat0, const Quaternion* quat1, size_t count);
+
+    /// result[i] = matrix * (points[i], 1), column vectors like Transform::ToMatrix and the scene's
+    /// world matrices. result may alias points
+    void TransformPoints(const Matrix4x4& matrix, const Vector3* points, Vector3* result, size_t count);
+
+    /// result[i] is what Quaternion::ToMatrix makes of quats[i]
+    void QuaternionToMatrixArray(const Quaternion* quats, Matrix4x4* result, size_t count);
+
+    /// positions[i], scales[i] and rotations[i] with matrices[i] = T * R * S, column vectors like Transform::ToMatrix.
+    /// No branches: every case of Quaternion(const Matrix4x4&) is computed and the one of the largest diagonal sum
+    /// picked per lane, 4 matrices per step. A mirroring matrix gets a negative x scale, shear is dropped and a
+    /// zero scale leaves its axis out of the rotation
+    void MatrixDecomposeArray(const Matrix4x4* matrices, Vector3* positions, Vector3* scales, Quaternion* rotations, size_t count);
+    /// matrices[i] = T * R * S of positions[i], scales[i] and rotations[i], what Transform::ToMatrix makes
+    void MatrixComposeArray(const Vector3* positions, const Vector3* scales, const Quaternion* rotations, Matrix4x4* matrices, size_t count);
+
+    /// Normalize vectors in place, zero length ones stay zero
+    void NormalizeArray(Vector3* vectors, size_t count, SqrtPrecision precision = SqrtPrecision::Refined);
+
+    /// Six normalised planes, inside is dot(plane.xyz, p) + plane.w >= 0
+    struct Frustum {
+        enum { Left, Right, Bottom, Top, Near, Far, PlaneCount };
+        float planes[PlaneCount][4];
+
+        /// Gribb/Hartmann planes for clip = viewProjection * p, Vulkan clips z to [0, w]
+        static Frustum FromViewProjection(const Matrix4x4& viewProjection);
+    };
+
+    /// Boxes as structure of arrays, box i spans lower[axis][i] to upper[axis][i]. Bit i % 32 of visible[i / 32]
+    /// is set when box i is inside or intersects frustum; conservative, only a box outside of a single plane is
+    /// rejected, as are the empty boxes of FLT_MAX lower and -FLT_MAX upper. Writes (count + 31) / 32 words, 4 boxes per step, 8 with AVX2
+    void FrustumCullArray(const Frustum& frustum, const float* const lower[3], const float* const upper[3], size_t count, uint32_t* visible);
+
+    /// result[i] is values[i] as an IEEE half, rounded to nearest even, too large values become infinity.
+    /// F16C with AVX2, the NEON conversions of ARMv8 and neon-fp16 builds, the bits one by one otherwise
+    void FloatToHalfArray(const float* values, uint16_t* result, size_t count);
+    /// The halves back, exactly
+    void HalfToFloatArray(const uint16_t* halves, float* result, size_t count);
+
+    /// result[i] = clamp(values[i], -1, 1) * 32767 rounded to nearest even, the encoding of R16_SNORM. 8 values per step
+    void FloatToSnorm16Array(const float* values, int16_t* result, size_t count);
+    /// result[i] = clamp(values[i], 0, 1) * 255 rounded to nearest even, the encoding of R8_UNORM. 16 values per step
+    void FloatToUnorm8Array(const float* values, uint8_t* result, size_t count);
+}
+}
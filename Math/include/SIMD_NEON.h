@@ -6,6 +6,7 @@
 #pragma once
 
 #include <arm_neon.h>
+#include <cmath>
 
 namespace m3d {
 namespace math {
@@ -36,8 +37,113 @@ namespace math {
         vst1q_f32((float32_t*)ptr, v);
     }
 
-#define VectorReplicate(v, index) vdupq_n_f32(vgetq_lane_f32(v, index))
-#define VectorSwizzle(v, x, y, z, w) __builtin_shufflevector(v, v, x, y, z, w)
+    // vld1q_f32 takes any alignment
+    inline VectorSIMD VectorLoad4fUnaligned(const void* ptr)
+    {
+        return vld1q_f32((float32_t*)ptr);
+    }
+
+    inline void VectorStore4fUnaligned(VectorSIMD v, void* ptr)
+    {
+        vst1q_f32((float32_t*)ptr, v);
+    }
+
+    /// Lanes X, Y, Z and W of v. The generic shuffle is a table lookup on ARMv7 and at best two
+    /// instructions on AArch64, the specializations are the dup, rev, ext, zip, uzp and trn forms
+    template <int X, int Y, int Z, int W>
+    struct VectorSwizzler {
+        static VectorSIMD Apply(VectorSIMD v)
+        {
+#if defined(__clang__)
+            return __builtin_shufflevector(v, v, X, Y, Z, W);
+#else
+            return __builtin_shuffle(v, uint32x4_t{ X, Y, Z, W });
+#endif
+        }
+    };
+    template <int I>
+    struct VectorSwizzler<I, I, I, I> {
+        static VectorSIMD Apply(VectorSIMD v)
+        {
+#if defined(__aarch64__)
+            return vdupq_laneq_f32(v, I);
+#else
+            return vdupq_lane_f32(I < 2 ? vget_low_f32(v) : vget_high_f32(v), I & 1);
+#endif
+        }
+    };
+    template <>
+    struct VectorSwizzler<0, 1, 2, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return v; }
+    };
+    template <>
+    struct VectorSwizzler<1, 0, 3, 2> {
+        static VectorSIMD Apply(VectorSIMD v) { return vrev64q_f32(v); }
+    };
+    template <>
+    struct VectorSwizzler<1, 2, 3, 0> {
+        static VectorSIMD Apply(VectorSIMD v) { return vextq_f32(v, v, 1); }
+    };
+    template <>
+    struct VectorSwizzler<2, 3, 0, 1> {
+        static VectorSIMD Apply(VectorSIMD v) { return vextq_f32(v, v, 2); }
+    };
+    template <>
+    struct VectorSwizzler<3, 0, 1, 2> {
+        static VectorSIMD Apply(VectorSIMD v) { return vextq_f32(v, v, 3); }
+    };
+    template <>
+    struct VectorSwizzler<3, 2, 1, 0> {
+        static VectorSIMD Apply(VectorSIMD v)
+        {
+            VectorSIMD pairs = vrev64q_f32(v);
+            return vextq_f32(pairs, pairs, 2);
+        }
+    };
+    template <>
+    struct VectorSwizzler<0, 1, 0, 1> {
+        static VectorSIMD Apply(VectorSIMD v) { return vcombine_f32(vget_low_f32(v), vget_low_f32(v)); }
+    };
+    template <>
+    struct VectorSwizzler<2, 3, 2, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return vcombine_f32(vget_high_f32(v), vget_high_f32(v)); }
+    };
+#if defined(__aarch64__)
+    template <>
+    struct VectorSwizzler<0, 0, 1, 1> {
+        static VectorSIMD Apply(VectorSIMD v) { return vzip1q_f32(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<2, 2, 3, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return vzip2q_f32(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<0, 2, 0, 2> {
+        static VectorSIMD Apply(VectorSIMD v) { return vuzp1q_f32(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<1, 3, 1, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return vuzp2q_f32(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<0, 0, 2, 2> {
+        static VectorSIMD Apply(VectorSIMD v) { return vtrn1q_f32(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<1, 1, 3, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return vtrn2q_f32(v, v); }
+    };
+#endif
+
+    template <int X, int Y, int Z, int W>
+    inline VectorSIMD Swizzle(VectorSIMD v)
+    {
+        static_assert(X >= 0 && X < 4 && Y >= 0 && Y < 4 && Z >= 0 && Z < 4 && W >= 0 && W < 4, "lanes are 0 to 3");
+        return VectorSwizzler<X, Y, Z, W>::Apply(v);
+    }
+
+#define VectorReplicate(v, index) Swizzle<index, index, index, index>(v)
+#define VectorSwizzle(v, x, y, z, w) Swizzle<x, y, z, w>(v)
 
     /// Add two VectorSIMD
     inline VectorSIMD VectorAdd(VectorSIMD v0, VectorSIMD v1)
@@ -57,9 +163,141 @@ namespace math {
         return vmulq_f32(v0, v1);
     }
 
+    /// Divide a VectorSIMD by another
+    inline VectorSIMD VectorDivide(VectorSIMD v0, VectorSIMD v1)
+    {
+#if defined(__aarch64__)
+        return vdivq_f32(v0, v1);
+#else
+        // ARMv7 has no divide, refine the reciprocal estimate twice
+        VectorSIMD reciprocal = vrecpeq_f32(v1);
+        reciprocal = vmulq_f32(vrecpsq_f32(v1, reciprocal), reciprocal);
+        reciprocal = vmulq_f32(vrecpsq_f32(v1, reciprocal), reciprocal);
+        return vmulq_f32(v0, reciprocal);
+#endif
+    }
+
+    inline VectorSIMD VectorSqrt(VectorSIMD v)
+    {
+#if defined(__aarch64__)
+        return vsqrtq_f32(v);
+#else
+        float lanes[4];
+        vst1q_f32(lanes, v);
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = sqrtf(lanes[i]);
+        }
+        return vld1q_f32(lanes);
+#endif
+    }
+
+    /// 1 / sqrt(v), vrsqrte only gives about 8 bits
+    inline VectorSIMD VectorReciprocalSqrtEstimate(VectorSIMD v)
+    {
+        return vrsqrteq_f32(v);
+    }
+
+    /// 1 / sqrt(v) to about 22 bits like the SSE one, two Newton-Raphson steps on the estimate
+    inline VectorSIMD VectorReciprocalSqrt(VectorSIMD v)
+    {
+        VectorSIMD estimate = vrsqrteq_f32(v);
+        // vrsqrts(a, b) = (3 - a * b) / 2
+        estimate = vmulq_f32(estimate, vrsqrtsq_f32(vmulq_f32(v, estimate), estimate));
+        return vmulq_f32(estimate, vrsqrtsq_f32(vmulq_f32(v, estimate), estimate));
+    }
+
+    /// lane 0 as a float
+    inline float VectorGetX(VectorSIMD v)
+    {
+        return vgetq_lane_f32(v, 0);
+    }
+
+    inline VectorSIMD VectorMin(VectorSIMD v0, VectorSIMD v1)
+    {
+        return vminq_f32(v0, v1);
+    }
+
+    inline VectorSIMD VectorMax(VectorSIMD v0, VectorSIMD v1)
+    {
+        return vmaxq_f32(v0, v1);
+    }
+
+    /// all bits of a lane set where v0 >= v1, clear elsewhere, as floats like the SSE one
+    inline VectorSIMD VectorCompareGreaterEqual(VectorSIMD v0, VectorSIMD v1)
+    {
+        return vreinterpretq_f32_u32(vcgeq_f32(v0, v1));
+    }
+
+    inline VectorSIMD VectorAnd(VectorSIMD v0, VectorSIMD v1)
+    {
+        return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v0), vreinterpretq_u32_f32(v1)));
+    }
+
+    /// lanes of v1 where mask is set, of v0 elsewhere
+    inline VectorSIMD VectorSelect(VectorSIMD mask, VectorSIMD v0, VectorSIMD v1)
+    {
+        return vbslq_f32(vreinterpretq_u32_f32(mask), v1, v0);
+    }
+
+    /// the top bit of every lane of a compare result, lane 0 in bit 0, like movmskps
+    inline int VectorMoveMask(VectorSIMD mask)
+    {
+        const uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+        return static_cast<int>(vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1) | (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3));
+    }
+
+    /// Nearest even integers of lanes within +-2^22: adding 1.5 * 2^23 rounds them
+    /// into the low mantissa bits, ARMv7 has no rounding conversion
+    inline int32x4_t VectorRoundToInt(VectorSIMD v)
+    {
+        const float32x4_t magic = vdupq_n_f32(12582912.0f);
+        return vsubq_s32(vreinterpretq_s32_f32(vaddq_f32(v, magic)), vreinterpretq_s32_f32(magic));
+    }
+
+    /// Rounded and saturated, the lanes of v0 then of v1 as 8 int16. Lanes within +-2^22
+    inline void VectorStoreInt16x8(VectorSIMD v0, VectorSIMD v1, void* ptr)
+    {
+        vst1q_s16((int16_t*)ptr, vcombine_s16(vqmovn_s32(VectorRoundToInt(v0)), vqmovn_s32(VectorRoundToInt(v1))));
+    }
+
+    /// Rounded and saturated, the lanes of v0 to v3 as 16 bytes. Lanes within +-2^22
+    inline void VectorStoreUint8x16(VectorSIMD v0, VectorSIMD v1, VectorSIMD v2, VectorSIMD v3, void* ptr)
+    {
+        const int16x8_t low = vcombine_s16(vqmovn_s32(VectorRoundToInt(v0)), vqmovn_s32(VectorRoundToInt(v1)));
+        const int16x8_t high = vcombine_s16(vqmovn_s32(VectorRoundToInt(v2)), vqmovn_s32(VectorRoundToInt(v3)));
+        vst1q_u8((uint8_t*)ptr, vcombine_u8(vqmovun_s16(low), vqmovun_s16(high)));
+    }
+
+#if defined(__aarch64__) || (defined(__ARM_FP) && (__ARM_FP & 2))
+// the half precision conversions of ARMv8 or of ARMv7 built for neon-fp16
+#define M3D_SIMD_HALF 1
+    /// Four IEEE halves, rounded to nearest even
+    inline void VectorStoreHalf4(VectorSIMD v, void* ptr)
+    {
+        vst1_u16((uint16_t*)ptr, vreinterpret_u16_f16(vcvt_f16_f32(v)));
+    }
+
+    inline VectorSIMD VectorLoadHalf4(const void* ptr)
+    {
+        return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16((const uint16_t*)ptr)));
+    }
+#endif
+
+    /// v0 * v1 + v2 like the SSE one, vmlaq takes the addend first
     inline VectorSIMD VectorMultiplyAdd(VectorSIMD v0, VectorSIMD v1, VectorSIMD v2)
     {
-        return vmlaq_f32(v0, v1, v2);
+        return vmlaq_f32(v2, v0, v1);
+    }
+
+    /// Rows become columns, turns four SoA lanes into four AoS vectors
+    inline void VectorTranspose4(VectorSIMD& v0, VectorSIMD& v1, VectorSIMD& v2, VectorSIMD& v3)
+    {
+        float32x4x2_t t01 = vtrnq_f32(v0, v1);
+        float32x4x2_t t23 = vtrnq_f32(v2, v3);
+        v0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+        v1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+        v2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+        v3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
     }
 
     inline void MatrixMultiply(void* result, const void* m0, const void* m1)
@@ -95,6 +333,33 @@ namespace math {
         _result[3] = row3;
     }
 
+    /// Three rows of affine matrices whose fourth row is (0, 0, 0, 1), left * right
+    inline void MatrixMultiplyAffine(void* result, const void* m0, const void* m1)
+    {
+        const VectorSIMD* left = (const VectorSIMD*)m0;
+        const VectorSIMD* right = (const VectorSIMD*)m1;
+        VectorSIMD* _result = (VectorSIMD*)result;
+        // the implicit fourth row of right only adds the left translation to w
+        const VectorSIMD wOnly = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 1.0f);
+        VectorSIMD temp, row0, row1, row2;
+        temp = vmulq_f32(left[0], wOnly);
+        temp = vmlaq_lane_f32(temp, right[0], vget_low_f32(left[0]), 0);
+        temp = vmlaq_lane_f32(temp, right[1], vget_low_f32(left[0]), 1);
+        row0 = vmlaq_lane_f32(temp, right[2], vget_high_f32(left[0]), 0);
+        temp = vmulq_f32(left[1], wOnly);
+        temp = vmlaq_lane_f32(temp, right[0], vget_low_f32(left[1]), 0);
+        temp = vmlaq_lane_f32(temp, right[1], vget_low_f32(left[1]), 1);
+        row1 = vmlaq_lane_f32(temp, right[2], vget_high_f32(left[1]), 0);
+        temp = vmulq_f32(left[2], wOnly);
+        temp = vmlaq_lane_f32(temp, right[0], vget_low_f32(left[2]), 0);
+        temp = vmlaq_lane_f32(temp, right[1], vget_low_f32(left[2]), 1);
+        row2 = vmlaq_lane_f32(temp, right[2], vget_high_f32(left[2]), 0);
+
+        _result[0] = row0;
+        _result[1] = row1;
+        _result[2] = row2;
+    }
+
     static const VectorSIMD QMULTI_SIGN_MASK0 = MakeVectorSIMD(1.0f, -1.0f, 1.0f, -1.0f);
     static const VectorSIMD QMULTI_SIGN_MASK1 = MakeVectorSIMD(1.0f, 1.0f, -1.0f, -1.0f);
     static const VectorSIMD QMULTI_SIGN_MASK2 = MakeVectorSIMD(-1.0f, 1.0f, 1.0f, -1.0f);
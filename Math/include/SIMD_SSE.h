@@ -6,6 +6,13 @@
 #pragma once
 
 #include <emmintrin.h> // SSE2
+#include <xmmintrin.h> // _MM_TRANSPOSE4_PS
+#if defined(__FMA__) || defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h> // _mm_fmadd_ps, _mm_cvtps_ph
+#endif
+#if defined(__SSE3__)
+#include <pmmintrin.h> // _mm_moveldup_ps
+#endif
 
 namespace m3d {
 namespace math {
@@ -16,15 +23,121 @@ namespace math {
         return _mm_setr_ps(fX, fY, fZ, fW);
     }
 
-#define VectorLoad4f(ptr) _mm_load_ps((float*)(ptr));
+#define VectorLoad4f(ptr) _mm_load_ps((const float*)(ptr))
 #define VectorStore4f(vec, ptr) _mm_store_ps((float*)(ptr), vec)
+#define VectorLoad4fUnaligned(ptr) _mm_loadu_ps((const float*)(ptr))
+#define VectorStore4fUnaligned(vec, ptr) _mm_storeu_ps((float*)(ptr), vec)
 
 #define SHUFFLEMASK(A0, A1, B2, B3) ((A0) | ((A1) << 2) | ((B2) << 4) | ((B3) << 6))
 
+#define VectorAdd(v0, v1) _mm_add_ps(v0, v1)
+#define VectorSubstract(v0, v1) _mm_sub_ps(v0, v1)
 #define VectorMultiply(v0, v1) _mm_mul_ps(v0, v1)
+#define VectorDivide(v0, v1) _mm_div_ps(v0, v1)
+#define VectorSqrt(v) _mm_sqrt_ps(v)
+#if defined(__FMA__) || defined(__AVX2__)
+// the build targets FMA, one instruction and one rounding
+#define VectorMultiplyAdd(v0, v1, v2) _mm_fmadd_ps(v0, v1, v2)
+#else
 #define VectorMultiplyAdd(v0, v1, v2) _mm_add_ps(_mm_mul_ps(v0, v1), v2)
-#define VectorReplicate(v, index) _mm_shuffle_ps(v, v, SHUFFLEMASK(index, index, index, index))
-#define VectorSwizzle(vec, x, y, z, w) _mm_shuffle_ps(vec, vec, SHUFFLEMASK(x, y, z, w))
+#endif
+#define VectorReplicate(v, index) Swizzle<index, index, index, index>(v)
+#define VectorSwizzle(vec, x, y, z, w) Swizzle<x, y, z, w>(vec)
+
+    /// Lanes X, Y, Z and W of v. shufps is the fallback, the specializations need no immediate or
+    /// no copy of v, and broadcast with AVX2
+    template <int X, int Y, int Z, int W>
+    struct VectorSwizzler {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_shuffle_ps(v, v, SHUFFLEMASK(X, Y, Z, W)); }
+    };
+    template <>
+    struct VectorSwizzler<0, 1, 2, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return v; }
+    };
+    template <>
+    struct VectorSwizzler<0, 1, 0, 1> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_movelh_ps(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<2, 3, 2, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_movehl_ps(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<0, 0, 1, 1> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_unpacklo_ps(v, v); }
+    };
+    template <>
+    struct VectorSwizzler<2, 2, 3, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_unpackhi_ps(v, v); }
+    };
+#if defined(__SSE3__)
+    template <>
+    struct VectorSwizzler<0, 0, 2, 2> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_moveldup_ps(v); }
+    };
+    template <>
+    struct VectorSwizzler<1, 1, 3, 3> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_movehdup_ps(v); }
+    };
+#endif
+#if defined(__AVX2__)
+    template <>
+    struct VectorSwizzler<0, 0, 0, 0> {
+        static VectorSIMD Apply(VectorSIMD v) { return _mm_broadcastss_ps(v); }
+    };
+#endif
+
+    template <int X, int Y, int Z, int W>
+    inline VectorSIMD Swizzle(VectorSIMD v)
+    {
+        static_assert(X >= 0 && X < 4 && Y >= 0 && Y < 4 && Z >= 0 && Z < 4 && W >= 0 && W < 4, "lanes are 0 to 3");
+        return VectorSwizzler<X, Y, Z, W>::Apply(v);
+    }
+
+// lane 0 as a float
+#define VectorGetX(v) _mm_cvtss_f32(v)
+#define VectorMin(v0, v1) _mm_min_ps(v0, v1)
+#define VectorMax(v0, v1) _mm_max_ps(v0, v1)
+// all bits of a lane set where v0 >= v1, clear elsewhere
+#define VectorCompareGreaterEqual(v0, v1) _mm_cmpge_ps(v0, v1)
+#define VectorAnd(v0, v1) _mm_and_ps(v0, v1)
+// lanes of v1 where mask is set, of v0 elsewhere
+#define VectorSelect(mask, v0, v1) _mm_or_ps(_mm_andnot_ps(mask, v0), _mm_and_ps(mask, v1))
+// the sign bit of every lane of a compare result, lane 0 in bit 0
+#define VectorMoveMask(mask) _mm_movemask_ps(mask)
+// rounded to nearest even and saturated, the lanes of v0 then of v1 as 8 int16
+#define VectorStoreInt16x8(v0, v1, ptr) _mm_storeu_si128((__m128i*)(ptr), _mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1)))
+// rounded to nearest even and saturated, the lanes of v0 to v3 as 16 bytes
+#define VectorStoreUint8x16(v0, v1, v2, v3, ptr)                                                  \
+    _mm_storeu_si128((__m128i*)(ptr), _mm_packus_epi16(_mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1)), \
+                                          _mm_packs_epi32(_mm_cvtps_epi32(v2), _mm_cvtps_epi32(v3))))
+#if defined(__F16C__)
+// the build targets F16C: four IEEE halves, rounded to nearest even
+#define M3D_SIMD_HALF 1
+#define VectorStoreHalf4(v, ptr) _mm_storel_epi64((__m128i*)(ptr), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+#define VectorLoadHalf4(ptr) _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(ptr)))
+#endif
+
+    /// 1 / sqrt(v) to about 12 bits
+    inline VectorSIMD VectorReciprocalSqrtEstimate(VectorSIMD v)
+    {
+        return _mm_rsqrt_ps(v);
+    }
+
+    /// 1 / sqrt(v) to about 22 bits, the estimate and one Newton-Raphson step
+    inline VectorSIMD VectorReciprocalSqrt(VectorSIMD v)
+    {
+        const VectorSIMD estimate = _mm_rsqrt_ps(v);
+        // estimate * (1.5 - 0.5 * v * estimate^2)
+        const VectorSIMD halfV = _mm_mul_ps(v, _mm_set1_ps(0.5f));
+        return _mm_mul_ps(estimate, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(halfV, _mm_mul_ps(estimate, estimate))));
+    }
+
+    /// Rows become columns, turns four SoA lanes into four AoS vectors
+    inline void VectorTranspose4(VectorSIMD& v0, VectorSIMD& v1, VectorSIMD& v2, VectorSIMD& v3)
+    {
+        _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+    }
 
     inline void MatrixMultiply(void* result, const void* left, const void* right)
     {
@@ -63,6 +176,36 @@ namespace math {
         _result[3] = row3;
     }
 
+    /// Three rows of affine matrices whose fourth row is (0, 0, 0, 1), left * right
+    inline void MatrixMultiplyAffine(void* result, const void* left, const void* right)
+    {
+        const VectorSIMD* _left = (const VectorSIMD*)left;
+        const VectorSIMD* _right = (const VectorSIMD*)right;
+        VectorSIMD* _result = (VectorSIMD*)result;
+        // the implicit fourth row of right only adds the left translation to w
+        const VectorSIMD wOnly = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 1.0f);
+        VectorSIMD temp, row0, row1, row2;
+
+        temp = VectorMultiply(_left[0], wOnly);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[0], 0), _right[0], temp);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[0], 1), _right[1], temp);
+        row0 = VectorMultiplyAdd(VectorReplicate(_left[0], 2), _right[2], temp);
+
+        temp = VectorMultiply(_left[1], wOnly);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[1], 0), _right[0], temp);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[1], 1), _right[1], temp);
+        row1 = VectorMultiplyAdd(VectorReplicate(_left[1], 2), _right[2], temp);
+
+        temp = VectorMultiply(_left[2], wOnly);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[2], 0), _right[0], temp);
+        temp = VectorMultiplyAdd(VectorReplicate(_left[2], 1), _right[1], temp);
+        row2 = VectorMultiplyAdd(VectorReplicate(_left[2], 2), _right[2], temp);
+
+        _result[0] = row0;
+        _result[1] = row1;
+        _result[2] = row2;
+    }
+
     static const VectorSIMD QMULTI_SIGN_MASK0 = MakeVectorSIMD(1.0f, -1.0f, 1.0f, -1.0f);
     static const VectorSIMD QMULTI_SIGN_MASK1 = MakeVectorSIMD(1.0f, 1.0f, -1.0f, -1.0f);
     static const VectorSIMD QMULTI_SIGN_MASK2 = MakeVectorSIMD(-1.0f, 1.0f, 1.0f, -1.0f);
@@ -0,0 +1,212 @@
+#include "SIMD_Kernels.h"
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <cstring>
+
+#include "SIMD_AVX.h"
+
+// 4-wide tails with the same fused rounding as the 8-wide body
+#define VectorReplicate4(v, index) _mm_permute_ps(v, SHUFFLEMASK(index, index, index, index))
+
+namespace m3d {
+namespace math {
+    namespace {
+        /* Two result rows per register: each half replicates its own row of left */
+        void matrixMultiply(float* result, const float* left, const float* right, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 16, left += 16, right += 16) {
+                M3D_PREFETCH(left + PrefetchDistance * 16);
+                M3D_PREFETCH(right + PrefetchDistance * 16);
+                const VectorSIMD8 r0 = Vector8Broadcast4f(right + 0);
+                const VectorSIMD8 r1 = Vector8Broadcast4f(right + 4);
+                const VectorSIMD8 r2 = Vector8Broadcast4f(right + 8);
+                const VectorSIMD8 r3 = Vector8Broadcast4f(right + 12);
+                const VectorSIMD8 l01 = Vector8Load(left + 0);
+                const VectorSIMD8 l23 = Vector8Load(left + 8);
+
+                VectorSIMD8 row01 = Vector8Multiply(Vector8Replicate(l01, 0), r0);
+                VectorSIMD8 row23 = Vector8Multiply(Vector8Replicate(l23, 0), r0);
+                row01 = Vector8MultiplyAdd(Vector8Replicate(l01, 1), r1, row01);
+                row23 = Vector8MultiplyAdd(Vector8Replicate(l23, 1), r1, row23);
+                row01 = Vector8MultiplyAdd(Vector8Replicate(l01, 2), r2, row01);
+                row23 = Vector8MultiplyAdd(Vector8Replicate(l23, 2), r2, row23);
+                row01 = Vector8MultiplyAdd(Vector8Replicate(l01, 3), r3, row01);
+                row23 = Vector8MultiplyAdd(Vector8Replicate(l23, 3), r3, row23);
+
+                // everything is loaded, result may be left or right
+                Vector8Store(row01, result + 0);
+                Vector8Store(row23, result + 8);
+            }
+        }
+
+        void vectorTransform(float* result, const float* vectors, const float* matrix, size_t count)
+        {
+            const VectorSIMD8 r0 = Vector8Broadcast4f(matrix + 0);
+            const VectorSIMD8 r1 = Vector8Broadcast4f(matrix + 4);
+            const VectorSIMD8 r2 = Vector8Broadcast4f(matrix + 8);
+            const VectorSIMD8 r3 = Vector8Broadcast4f(matrix + 12);
+
+            // four vectors per iteration, two registers to hide the fma latency
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                M3D_PREFETCH(vectors + (i + PrefetchDistance * 4) * 4);
+                const VectorSIMD8 v01 = Vector8Load(vectors + i * 4);
+                const VectorSIMD8 v23 = Vector8Load(vectors + i * 4 + 8);
+                VectorSIMD8 out01 = Vector8Multiply(Vector8Replicate(v01, 0), r0);
+                VectorSIMD8 out23 = Vector8Multiply(Vector8Replicate(v23, 0), r0);
+                out01 = Vector8MultiplyAdd(Vector8Replicate(v01, 1), r1, out01);
+                out23 = Vector8MultiplyAdd(Vector8Replicate(v23, 1), r1, out23);
+                out01 = Vector8MultiplyAdd(Vector8Replicate(v01, 2), r2, out01);
+                out23 = Vector8MultiplyAdd(Vector8Replicate(v23, 2), r2, out23);
+                out01 = Vector8MultiplyAdd(Vector8Replicate(v01, 3), r3, out01);
+                out23 = Vector8MultiplyAdd(Vector8Replicate(v23, 3), r3, out23);
+                Vector8Store(out01, result + i * 4);
+                Vector8Store(out23, result + i * 4 + 8);
+            }
+            for (; i < count; ++i) {
+                const __m128 v = _mm_loadu_ps(vectors + i * 4);
+                __m128 out = _mm_mul_ps(VectorReplicate4(v, 0), _mm256_castps256_ps128(r0));
+                out = _mm_fmadd_ps(VectorReplicate4(v, 1), _mm256_castps256_ps128(r1), out);
+                out = _mm_fmadd_ps(VectorReplicate4(v, 2), _mm256_castps256_ps128(r2), out);
+                out = _mm_fmadd_ps(VectorReplicate4(v, 3), _mm256_castps256_ps128(r3), out);
+                _mm_storeu_ps(result + i * 4, out);
+            }
+        }
+
+        /* VectorQuaternionMultiply2 of SIMD_SSE.h, two quaternions per register */
+        void quaternionMultiply(float* result, const float* quat0, const float* quat1, size_t count)
+        {
+            const VectorSIMD8 sign0 = MakeVectorSIMD8(1.0f, -1.0f, 1.0f, -1.0f);
+            const VectorSIMD8 sign1 = MakeVectorSIMD8(1.0f, 1.0f, -1.0f, -1.0f);
+            const VectorSIMD8 sign2 = MakeVectorSIMD8(-1.0f, 1.0f, 1.0f, -1.0f);
+
+            size_t i = 0;
+            for (; i + 2 <= count; i += 2) {
+                M3D_PREFETCH(quat0 + (i + PrefetchDistance * 4) * 4);
+                M3D_PREFETCH(quat1 + (i + PrefetchDistance * 4) * 4);
+                const VectorSIMD8 q0 = Vector8Load(quat0 + i * 4);
+                const VectorSIMD8 q1 = Vector8Load(quat1 + i * 4);
+                VectorSIMD8 out = Vector8Multiply(Vector8Replicate(q0, 3), q1);
+                out = Vector8MultiplyAdd(Vector8Multiply(Vector8Replicate(q0, 0), Vector8Swizzle(q1, 3, 2, 1, 0)), sign0, out);
+                out = Vector8MultiplyAdd(Vector8Multiply(Vector8Replicate(q0, 1), Vector8Swizzle(q1, 2, 3, 0, 1)), sign1, out);
+                out = Vector8MultiplyAdd(Vector8Multiply(Vector8Replicate(q0, 2), Vector8Swizzle(q1, 1, 0, 3, 2)), sign2, out);
+                Vector8Store(out, result + i * 4);
+            }
+            if (i < count) {
+                const __m128 q0 = _mm_loadu_ps(quat0 + i * 4);
+                const __m128 q1 = _mm_loadu_ps(quat1 + i * 4);
+                __m128 out = _mm_mul_ps(VectorReplicate4(q0, 3), q1);
+                out = _mm_fmadd_ps(_mm_mul_ps(VectorReplicate4(q0, 0), _mm_permute_ps(q1, SHUFFLEMASK(3, 2, 1, 0))), _mm256_castps256_ps128(sign0), out);
+                out = _mm_fmadd_ps(_mm_mul_ps(VectorReplicate4(q0, 1), _mm_permute_ps(q1, SHUFFLEMASK(2, 3, 0, 1))), _mm256_castps256_ps128(sign1), out);
+                out = _mm_fmadd_ps(_mm_mul_ps(VectorReplicate4(q0, 2), _mm_permute_ps(q1, SHUFFLEMASK(1, 0, 3, 2))), _mm256_castps256_ps128(sign2), out);
+                _mm_storeu_ps(result + i * 4, out);
+            }
+        }
+
+        /* Eight boxes per iteration, a 4-wide step and single boxes for the rest */
+        void frustumCull(const float* planes, const float* const* lower, const float* const* upper, size_t count, uint32_t* visible)
+        {
+            // the corner furthest along each plane normal, the same array for every box
+            const float* corners[6][3];
+            for (int p = 0; p < 6; ++p) {
+                for (int c = 0; c < 3; ++c) {
+                    corners[p][c] = planes[p * 4 + c] >= 0.0f ? upper[c] : lower[c];
+                }
+            }
+            memset(visible, 0, (count + 31) / 32 * sizeof(uint32_t));
+            const VectorSIMD8 zero = _mm256_setzero_ps();
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                VectorSIMD8 inside = zero;
+                for (int p = 0; p < 6; ++p) {
+                    VectorSIMD8 distance = Vector8MultiplyAdd(_mm256_set1_ps(planes[p * 4]), Vector8Load(corners[p][0] + i), _mm256_set1_ps(planes[p * 4 + 3]));
+                    distance = Vector8MultiplyAdd(_mm256_set1_ps(planes[p * 4 + 1]), Vector8Load(corners[p][1] + i), distance);
+                    distance = Vector8MultiplyAdd(_mm256_set1_ps(planes[p * 4 + 2]), Vector8Load(corners[p][2] + i), distance);
+                    const VectorSIMD8 front = Vector8CompareGreaterEqual(distance, zero);
+                    inside = p == 0 ? front : Vector8And(inside, front);
+                }
+                // i is a multiple of 8, the 8 bits stay in one word
+                visible[i / 32] |= static_cast<uint32_t>(Vector8MoveMask(inside)) << (i % 32);
+            }
+            if (i + 4 <= count) {
+                __m128 inside = _mm_setzero_ps();
+                for (int p = 0; p < 6; ++p) {
+                    __m128 distance = _mm_fmadd_ps(_mm_set1_ps(planes[p * 4]), _mm_loadu_ps(corners[p][0] + i), _mm_set1_ps(planes[p * 4 + 3]));
+                    distance = _mm_fmadd_ps(_mm_set1_ps(planes[p * 4 + 1]), _mm_loadu_ps(corners[p][1] + i), distance);
+                    distance = _mm_fmadd_ps(_mm_set1_ps(planes[p * 4 + 2]), _mm_loadu_ps(corners[p][2] + i), distance);
+                    const __m128 front = _mm_cmpge_ps(distance, _mm_setzero_ps());
+                    inside = p == 0 ? front : _mm_and_ps(inside, front);
+                }
+                visible[i / 32] |= static_cast<uint32_t>(_mm_movemask_ps(inside)) << (i % 32);
+                i += 4;
+            }
+            for (; i < count; ++i) {
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; ++p) {
+                    inside = planes[p * 4 + 3] + planes[p * 4] * corners[p][0][i] + planes[p * 4 + 1] * corners[p][1][i] + planes[p * 4 + 2] * corners[p][2][i] >= 0.0f;
+                }
+                visible[i / 32] |= inside ? 1u << (i % 32) : 0u;
+            }
+        }
+
+#if defined(__F16C__) || defined(_MSC_VER)
+        /* F16C, eight values per iteration, a 4-wide step and single values for the rest */
+        void floatToHalf(const float* values, uint16_t* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                M3D_PREFETCH(values + i + PrefetchDistance * 16);
+                Vector8StoreHalf(Vector8Load(values + i), result + i);
+            }
+            if (i + 4 <= count) {
+                _mm_storel_epi64((__m128i*)(result + i), _mm_cvtps_ph(_mm_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+                i += 4;
+            }
+            for (; i < count; ++i) {
+                result[i] = static_cast<uint16_t>(_mm_extract_epi16(_mm_cvtps_ph(_mm_set_ss(values[i]), _MM_FROUND_TO_NEAREST_INT), 0));
+            }
+        }
+
+        void halfToFloat(const uint16_t* halves, float* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                M3D_PREFETCH(halves + i + PrefetchDistance * 32);
+                Vector8Store(Vector8LoadHalf(halves + i), result + i);
+            }
+            if (i + 4 <= count) {
+                _mm_storeu_ps(result + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(halves + i))));
+                i += 4;
+            }
+            for (; i < count; ++i) {
+                result[i] = _mm_cvtss_f32(_mm_cvtph_ps(_mm_cvtsi32_si128(halves[i])));
+            }
+        }
+#else
+        const auto floatToHalf = nullptr;
+        const auto halfToFloat = nullptr;
+#endif
+
+        // 4-wide points, quaternion conversion, decomposition and normalized integers are load and store bound, the 4-wide
+        // kernels stay
+        const ArrayKernels avx2Kernels = { matrixMultiply, vectorTransform, quaternionMultiply, nullptr, nullptr, nullptr, nullptr, frustumCull,
+            floatToHalf, halfToFloat, nullptr, nullptr };
+    }
+
+    const ArrayKernels* GetAVX2Kernels()
+    {
+        return &avx2Kernels;
+    }
+}
+}
+#else
+namespace m3d {
+namespace math {
+    const ArrayKernels* GetAVX2Kernels()
+    {
+        return nullptr;
+    }
+}
+}
+#endif
@@ -0,0 +1,539 @@
+#include "SIMD_Batch.h"
+#include "SIMD_Kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define M3D_SIMD_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__arm__) && !USE_SIMD
+#define M3D_SIMD_ARM_RUNTIME 1
+#if defined(__ANDROID__)
+#include <cpu-features.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+
+namespace m3d {
+namespace math {
+    namespace {
+        /* Scalar reference, also what runs with USE_SIMD off */
+        void scalarMatrixMultiply(float* result, const float* left, const float* right, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 16, left += 16, right += 16) {
+                float product[16];
+                for (int row = 0; row < 4; ++row) {
+                    for (int column = 0; column < 4; ++column) {
+                        float sum = 0.0f;
+                        for (int k = 0; k < 4; ++k) {
+                            sum += left[row * 4 + k] * right[k * 4 + column];
+                        }
+                        product[row * 4 + column] = sum;
+                    }
+                }
+                memcpy(result, product, sizeof(product));
+            }
+        }
+
+        void scalarVectorTransform(float* result, const float* vectors, const float* matrix, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 4, vectors += 4) {
+                float out[4];
+                for (int column = 0; column < 4; ++column) {
+                    out[column] = vectors[0] * matrix[column] + vectors[1] * matrix[4 + column] + vectors[2] * matrix[8 + column] + vectors[3] * matrix[12 + column];
+                }
+                memcpy(result, out, sizeof(out));
+            }
+        }
+
+        void scalarQuaternionMultiply(float* result, const float* quat0, const float* quat1, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 4, quat0 += 4, quat1 += 4) {
+                const float x0 = quat0[0], y0 = quat0[1], z0 = quat0[2], w0 = quat0[3];
+                const float x1 = quat1[0], y1 = quat1[1], z1 = quat1[2], w1 = quat1[3];
+                // term for term what VectorQuaternionMultiply2 computes
+                result[0] = w0 * x1 + x0 * w1 + y0 * z1 - z0 * y1;
+                result[1] = w0 * y1 - x0 * z1 + y0 * w1 + z0 * x1;
+                result[2] = w0 * z1 + x0 * y1 - y0 * x1 + z0 * w1;
+                result[3] = w0 * w1 - x0 * x1 - y0 * y1 - z0 * z1;
+            }
+        }
+
+        void scalarTransformPoints(const float* matrix, const float* points, float* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 3, points += 3) {
+                const float x = points[0], y = points[1], z = points[2];
+                for (int row = 0; row < 3; ++row) {
+                    result[row] = matrix[row * 4] * x + matrix[row * 4 + 1] * y + matrix[row * 4 + 2] * z + matrix[row * 4 + 3];
+                }
+            }
+        }
+
+        void scalarQuaternionToMatrix(const float* quats, float* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, quats += 4, result += 16) {
+                Quaternion quat(quats[0], quats[1], quats[2], quats[3]);
+                Matrix4x4 matrix;
+                quat.ToMatrix(matrix);
+                memcpy(result, matrix.m, sizeof(matrix.m));
+            }
+        }
+
+        /* Quaternion(const Matrix4x4&) from the largest of the four diagonal sums, what the vector kernel computes in a lane */
+        void scalarMatrixDecompose(const float* matrices, float* positions, float* scales, float* rotations, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, matrices += 16, positions += 3, scales += 3, rotations += 4) {
+                const float(*m)[4] = reinterpret_cast<const float(*)[4]>(matrices);
+                const float determinant = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                    + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+                float scale[3], inverse[3];
+                for (int j = 0; j < 3; ++j) {
+                    const float length = sqrtf(m[0][j] * m[0][j] + m[1][j] * m[1][j] + m[2][j] * m[2][j]);
+                    scale[j] = j == 0 && !(determinant >= 0.0f) ? -length : length;
+                    inverse[j] = length >= MinDecomposeScale ? 1.0f / scale[j] : 0.0f;
+                }
+                float r[3][3];
+                for (int row = 0; row < 3; ++row) {
+                    for (int j = 0; j < 3; ++j) {
+                        r[row][j] = m[row][j] * inverse[j];
+                    }
+                }
+                const float a = r[2][1] - r[1][2], b = r[0][2] - r[2][0], c = r[1][0] - r[0][1];
+                const float p = r[1][0] + r[0][1], q = r[0][2] + r[2][0], s = r[2][1] + r[1][2];
+                const float tw = 1.0f + r[0][0] + r[1][1] + r[2][2];
+                const float tx = 1.0f + r[0][0] - r[1][1] - r[2][2];
+                const float ty = 1.0f - r[0][0] + r[1][1] - r[2][2];
+                const float tz = 1.0f - r[0][0] - r[1][1] + r[2][2];
+                float best = tw;
+                float quat[4] = { a, b, c, tw };
+                if (tx >= best) {
+                    best = tx;
+                    quat[0] = tx, quat[1] = p, quat[2] = q, quat[3] = a;
+                }
+                if (ty >= best) {
+                    best = ty;
+                    quat[0] = p, quat[1] = ty, quat[2] = s, quat[3] = b;
+                }
+                if (tz >= best) {
+                    best = tz;
+                    quat[0] = q, quat[1] = s, quat[2] = tz, quat[3] = c;
+                }
+                const float factor = 0.5f / sqrtf(best);
+                for (int k = 0; k < 4; ++k) {
+                    rotations[k] = quat[k] * factor;
+                }
+                for (int j = 0; j < 3; ++j) {
+                    positions[j] = m[j][3];
+                    scales[j] = scale[j];
+                }
+            }
+        }
+
+        void scalarMatrixCompose(const float* positions, const float* scales, const float* rotations, float* matrices, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, positions += 3, scales += 3, rotations += 4, matrices += 16) {
+                const float x = rotations[0], y = rotations[1], z = rotations[2], w = rotations[3];
+                const float x2 = x + x, y2 = y + y, z2 = z + z;
+                const float xx = x * x2, xy = x * y2, xz = x * z2;
+                const float yy = y * y2, yz = y * z2, zz = z * z2;
+                const float wx = w * x2, wy = w * y2, wz = w * z2;
+                const float sx = scales[0], sy = scales[1], sz = scales[2];
+                const float matrix[16] = {
+                    (1.0f - (yy + zz)) * sx, (xy - wz) * sy, (xz + wy) * sz, positions[0],
+                    (xy + wz) * sx, (1.0f - (xx + zz)) * sy, (yz - wx) * sz, positions[1],
+                    (xz - wy) * sx, (yz + wx) * sy, (1.0f - (xx + yy)) * sz, positions[2],
+                    0.0f, 0.0f, 0.0f, 1.0f
+                };
+                memcpy(matrices, matrix, sizeof(matrix));
+            }
+        }
+
+        void scalarFrustumCull(const float* planes, const float* const* lower, const float* const* upper, size_t count, uint32_t* visible)
+        {
+            memset(visible, 0, (count + 31) / 32 * sizeof(uint32_t));
+            for (size_t i = 0; i < count; ++i) {
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; ++p) {
+                    // corner furthest along the plane normal
+                    const float* plane = planes + p * 4;
+                    float distance = plane[3];
+                    for (int c = 0; c < 3; ++c) {
+                        distance += plane[c] * (plane[c] >= 0.0f ? upper[c][i] : lower[c][i]);
+                    }
+                    inside = distance >= 0.0f;
+                }
+                visible[i / 32] |= inside ? 1u << (i % 32) : 0u;
+            }
+        }
+
+        // round to nearest even, overflow goes to infinity
+        uint16_t floatToHalf(float value)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            uint32_t sign = (bits >> 16) & 0x8000;
+            uint32_t exponent = (bits >> 23) & 0xFF;
+            uint32_t mantissa = bits & 0x7FFFFF;
+
+            if (exponent == 0xFF) {
+                return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+            }
+            int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+            if (halfExponent >= 0x1F) {
+                return static_cast<uint16_t>(sign | 0x7C00);
+            }
+            if (halfExponent <= 0) {
+                if (halfExponent < -10) {
+                    return static_cast<uint16_t>(sign);
+                }
+                // denormal, make the implicit bit explicit and shift it into place
+                mantissa |= 0x800000;
+                uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+                uint32_t half = mantissa >> shift;
+                uint32_t rest = mantissa & ((1u << shift) - 1);
+                uint32_t halfway = 1u << (shift - 1);
+                if (rest > halfway || (rest == halfway && (half & 1))) {
+                    ++half;
+                }
+                return static_cast<uint16_t>(sign | half);
+            }
+            uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+            uint32_t rest = mantissa & 0x1FFF;
+            // a carry into the exponent is the correct rounding
+            if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+                ++half;
+            }
+            return static_cast<uint16_t>(sign | half);
+        }
+
+        float halfToFloat(uint16_t half)
+        {
+            const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+            uint32_t exponent = (half >> 10) & 0x1F;
+            uint32_t mantissa = half & 0x3FF;
+            uint32_t bits;
+            if (exponent == 0x1F) {
+                bits = sign | 0x7F800000 | (mantissa << 13);
+            } else if (exponent == 0) {
+                if (mantissa == 0) {
+                    bits = sign;
+                } else {
+                    // denormal, normalize it into a float exponent
+                    int32_t shift = 0;
+                    while (!(mantissa & 0x400)) {
+                        mantissa <<= 1;
+                        ++shift;
+                    }
+                    bits = sign | (static_cast<uint32_t>(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3FF) << 13);
+                }
+            } else {
+                bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+            }
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        void scalarFloatToHalf(const float* values, uint16_t* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                result[i] = floatToHalf(values[i]);
+            }
+        }
+
+        void scalarHalfToFloat(const uint16_t* halves, float* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                result[i] = halfToFloat(halves[i]);
+            }
+        }
+
+        // nearbyintf rounds to nearest even like the SIMD conversions
+        void scalarFloatToSnorm16(const float* values, int16_t* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                const float clamped = values[i] < -1.0f ? -1.0f : (values[i] > 1.0f ? 1.0f : values[i]);
+                result[i] = static_cast<int16_t>(nearbyintf(clamped * 32767.0f));
+            }
+        }
+
+        void scalarFloatToUnorm8(const float* values, uint8_t* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                const float clamped = values[i] < 0.0f ? 0.0f : (values[i] > 1.0f ? 1.0f : values[i]);
+                result[i] = static_cast<uint8_t>(nearbyintf(clamped * 255.0f));
+            }
+        }
+
+        const ArrayKernels scalarKernels = { scalarMatrixMultiply, scalarVectorTransform, scalarQuaternionMultiply, scalarTransformPoints, scalarQuaternionToMatrix,
+            scalarMatrixDecompose, scalarMatrixCompose, scalarFrustumCull, scalarFloatToHalf, scalarHalfToFloat, scalarFloatToSnorm16, scalarFloatToUnorm8 };
+
+#if USE_SIMD
+#include "SIMD_VectorKernels.h"
+
+#if !M3D_SIMD_HALF
+        // SSE2 has no half conversions, F16C comes with the AVX2 kernels
+        const auto vectorFloatToHalf = scalarFloatToHalf;
+        const auto vectorHalfToFloat = scalarHalfToFloat;
+#endif
+
+        const ArrayKernels vectorKernels = { vectorMatrixMultiply, vectorVectorTransform, vectorQuaternionMultiply, vectorTransformPoints, vectorQuaternionToMatrix,
+            vectorMatrixDecompose, vectorMatrixCompose, vectorFrustumCull, vectorFloatToHalf, vectorHalfToFloat, vectorFloatToSnorm16, vectorFloatToUnorm8 };
+#endif
+
+#if USE_SIMD && M3D_SIMD_X86
+        void cpuid(int leaf, unsigned int regs[4])
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuidex(info, leaf, 0);
+            for (int i = 0; i < 4; ++i) {
+                regs[i] = static_cast<unsigned int>(info[i]);
+            }
+#else
+            regs[0] = regs[1] = regs[2] = regs[3] = 0;
+            __get_cpuid_count(leaf, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+        }
+
+        bool cpuHasAVX2()
+        {
+            unsigned int regs[4];
+            cpuid(0, regs);
+            if (regs[0] < 7) {
+                return false;
+            }
+            cpuid(1, regs);
+            const bool fma = (regs[2] & (1u << 12)) != 0;
+            const bool osxsave = (regs[2] & (1u << 27)) != 0;
+            const bool avx = (regs[2] & (1u << 28)) != 0;
+            // every AVX2 processor has F16C, the half kernels count on it
+            const bool f16c = (regs[2] & (1u << 29)) != 0;
+            if (!fma || !osxsave || !avx || !f16c) {
+                return false;
+            }
+            // the OS has to save the xmm and ymm state on context switches
+#ifdef _MSC_VER
+            const unsigned long long xcr0 = _xgetbv(0);
+#else
+            unsigned int eax, edx;
+            __asm__ volatile("xgetbv"
+                             : "=a"(eax), "=d"(edx)
+                             : "c"(0));
+            const unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+            if ((xcr0 & 0x6) != 0x6) {
+                return false;
+            }
+            cpuid(7, regs);
+            return (regs[1] & (1u << 5)) != 0;
+        }
+#endif
+
+#if M3D_SIMD_ARM_RUNTIME
+        bool cpuHasNEON()
+        {
+#if defined(__ANDROID__)
+            return android_getCpuFamily() == ANDROID_CPU_FAMILY_ARM && (android_getCpuFeatures() & ANDROID_CPU_ARM_FEATURE_NEON) != 0;
+#elif defined(__linux__)
+            // HWCAP_NEON of the 32-bit ARM kernel
+            return (getauxval(AT_HWCAP) & (1ul << 12)) != 0;
+#else
+            return false;
+#endif
+        }
+#endif
+
+        const ArrayKernels* selectKernels()
+        {
+#if USE_SIMD
+            const ArrayKernels* avx2 = GetAVX2Kernels();
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+            // the whole build targets AVX2, nothing to check
+            const bool useAVX2 = avx2 != nullptr;
+#elif M3D_SIMD_X86
+            const bool useAVX2 = avx2 != nullptr && cpuHasAVX2();
+#else
+            const bool useAVX2 = false;
+#endif
+            if (!useAVX2) {
+                return &vectorKernels;
+            }
+            static ArrayKernels merged;
+            merged = *avx2;
+            merged.transformPoints = merged.transformPoints ? merged.transformPoints : vectorKernels.transformPoints;
+            merged.quaternionToMatrix = merged.quaternionToMatrix ? merged.quaternionToMatrix : vectorKernels.quaternionToMatrix;
+            merged.matrixDecompose = merged.matrixDecompose ? merged.matrixDecompose : vectorKernels.matrixDecompose;
+            merged.matrixCompose = merged.matrixCompose ? merged.matrixCompose : vectorKernels.matrixCompose;
+            merged.frustumCull = merged.frustumCull ? merged.frustumCull : vectorKernels.frustumCull;
+            merged.floatToHalf = merged.floatToHalf ? merged.floatToHalf : vectorKernels.floatToHalf;
+            merged.halfToFloat = merged.halfToFloat ? merged.halfToFloat : vectorKernels.halfToFloat;
+            merged.floatToSnorm16 = merged.floatToSnorm16 ? merged.floatToSnorm16 : vectorKernels.floatToSnorm16;
+            merged.floatToUnorm8 = merged.floatToUnorm8 ? merged.floatToUnorm8 : vectorKernels.floatToUnorm8;
+            return &merged;
+#elif M3D_SIMD_ARM_RUNTIME
+            const ArrayKernels* neon = GetNEONKernels();
+            if (neon == nullptr || !cpuHasNEON()) {
+                return &scalarKernels;
+            }
+            // ARMv7 NEON builds have no half conversions without neon-fp16
+            static ArrayKernels merged;
+            merged = *neon;
+            merged.floatToHalf = merged.floatToHalf ? merged.floatToHalf : scalarKernels.floatToHalf;
+            merged.halfToFloat = merged.halfToFloat ? merged.halfToFloat : scalarKernels.halfToFloat;
+            return &merged;
+#else
+            return &scalarKernels;
+#endif
+        }
+
+        const ArrayKernels& kernels()
+        {
+            static const ArrayKernels* selected = selectKernels();
+            return *selected;
+        }
+    }
+
+    SIMDBackend GetSIMDBackend()
+    {
+        const ArrayKernels& selected = kernels();
+        if (&selected == &scalarKernels) {
+            return SIMDBackend::Scalar;
+        }
+#if M3D_SIMD_ARM_RUNTIME
+        // the NEON kernels, merged with the scalar half conversions
+        return SIMDBackend::NEON;
+#endif
+#if USE_SIMD
+        if (&selected == &vectorKernels) {
+            return SIMDBackend::Default;
+        }
+#endif
+        return SIMDBackend::AVX2;
+    }
+
+    void MatrixMultiplyArray(Matrix4x4* result, const Matrix4x4* left, const Matrix4x4* right, size_t count)
+    {
+        kernels().matrixMultiply(reinterpret_cast<float*>(result), reinterpret_cast<const float*>(left), reinterpret_cast<const float*>(right), count);
+    }
+
+    void VectorTransformArray(Vector4* result, const Vector4* vectors, const Matrix4x4& matrix, size_t count)
+    {
+        kernels().vectorTransform(reinterpret_cast<float*>(result), reinterpret_cast<const float*>(vectors), &matrix.m[0][0], count);
+    }
+
+    void QuaternionMultiplyArray(Quaternion* result, const Quaternion* quat0, const Quaternion* quat1, size_t count)
+    {
+        kernels().quaternionMultiply(reinterpret_cast<float*>(result), reinterpret_cast<const float*>(quat0), reinterpret_cast<const float*>(quat1), count);
+    }
+
+    void TransformPoints(const Matrix4x4& matrix, const Vector3* points, Vector3* result, size_t count)
+    {
+        static_assert(sizeof(Vector3) == 3 * sizeof(float), "points are read as packed floats");
+        kernels().transformPoints(&matrix.m[0][0], reinterpret_cast<const float*>(points), reinterpret_cast<float*>(result), count);
+    }
+
+    /* Four reciprocal square roots per register, the packed components are scaled one by one */
+    void NormalizeArray(Vector3* vectors, size_t count, SqrtPrecision precision)
+    {
+        size_t i = 0;
+#if USE_SIMD
+        if (precision != SqrtPrecision::Exact) {
+            for (; i + 4 <= count; i += 4) {
+                M3D_PREFETCH(vectors + i + PrefetchDistance * 4);
+                Vector3* group = vectors + i;
+                alignas(16) float lengthSquared[4];
+                for (int lane = 0; lane < 4; ++lane) {
+                    lengthSquared[lane] = group[lane] | group[lane];
+                }
+                const VectorSIMD squares = VectorLoad4f(lengthSquared);
+                const VectorSIMD scales = precision == SqrtPrecision::Refined ? VectorReciprocalSqrt(squares) : VectorReciprocalSqrtEstimate(squares);
+                alignas(16) float scale[4];
+                VectorStore4f(scales, scale);
+                for (int lane = 0; lane < 4; ++lane) {
+                    if (lengthSquared[lane] > 0.0f) {
+                        group[lane] *= scale[lane];
+                    }
+                }
+            }
+        }
+#endif
+        for (; i < count; ++i) {
+            const float lengthSquared = vectors[i] | vectors[i];
+            if (lengthSquared > 0.0f) {
+                vectors[i] *= InvSqrt(lengthSquared, precision);
+            }
+        }
+    }
+
+    void QuaternionToMatrixArray(const Quaternion* quats, Matrix4x4* result, size_t count)
+    {
+        kernels().quaternionToMatrix(reinterpret_cast<const float*>(quats), reinterpret_cast<float*>(result), count);
+    }
+
+    void MatrixDecomposeArray(const Matrix4x4* matrices, Vector3* positions, Vector3* scales, Quaternion* rotations, size_t count)
+    {
+        static_assert(sizeof(Vector3) == 3 * sizeof(float), "positions and scales are written as packed floats");
+        kernels().matrixDecompose(reinterpret_cast<const float*>(matrices), reinterpret_cast<float*>(positions), reinterpret_cast<float*>(scales),
+            reinterpret_cast<float*>(rotations), count);
+    }
+
+    void MatrixComposeArray(const Vector3* positions, const Vector3* scales, const Quaternion* rotations, Matrix4x4* matrices, size_t count)
+    {
+        kernels().matrixCompose(reinterpret_cast<const float*>(positions), reinterpret_cast<const float*>(scales), reinterpret_cast<const float*>(rotations),
+            reinterpret_cast<float*>(matrices), count);
+    }
+
+    Frustum Frustum::FromViewProjection(const Matrix4x4& viewProjection)
+    {
+        Frustum frustum;
+        const float(*m)[4] = viewProjection.m;
+        for (int c = 0; c < 4; ++c) {
+            frustum.planes[Left][c] = m[3][c] + m[0][c];
+            frustum.planes[Right][c] = m[3][c] - m[0][c];
+            frustum.planes[Bottom][c] = m[3][c] + m[1][c];
+            frustum.planes[Top][c] = m[3][c] - m[1][c];
+            frustum.planes[Near][c] = m[2][c];
+            frustum.planes[Far][c] = m[3][c] - m[2][c];
+        }
+        for (int i = 0; i < PlaneCount; ++i) {
+            float* plane = frustum.planes[i];
+            const float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            if (length > 0.0f) {
+                for (int c = 0; c < 4; ++c) {
+                    plane[c] /= length;
+                }
+            }
+        }
+        return frustum;
+    }
+
+    void FrustumCullArray(const Frustum& frustum, const float* const lower[3], const float* const upper[3], size_t count, uint32_t* visible)
+    {
+        kernels().frustumCull(&frustum.planes[0][0], lower, upper, count, visible);
+    }
+
+    void FloatToHalfArray(const float* values, uint16_t* result, size_t count)
+    {
+        kernels().floatToHalf(values, result, count);
+    }
+
+    void HalfToFloatArray(const uint16_t* halves, float* result, size_t count)
+    {
+        kernels().halfToFloat(halves, result, count);
+    }
+
+    void FloatToSnorm16Array(const float* values, int16_t* result, size_t count)
+    {
+        kernels().floatToSnorm16(values, result, count);
+    }
+
+    void FloatToUnorm8Array(const float* values, uint8_t* result, size_t count)
+    {
+        kernels().floatToUnorm8(values, result, count);
+    }
+}
+}
@@ -0,0 +1,61 @@
+/*
+* Copyright (C) 2016 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Plain float arrays on purpose: SIMD_AVX.cpp must not include Matrix.h, its
+// inline functions compiled for AVX could be the copy the linker keeps.
+#if defined(__GNUC__) || defined(__clang__)
+#define M3D_PREFETCH(ptr) __builtin_prefetch(ptr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define M3D_PREFETCH(ptr) _mm_prefetch((const char*)(ptr), _MM_HINT_T0)
+#else
+#define M3D_PREFETCH(ptr)
+#endif
+
+namespace m3d {
+namespace math {
+    // elements the kernels prefetch ahead, four matrices are four cache lines
+    const size_t PrefetchDistance = 4;
+    // matrix columns shorter than this are a zero scale, left out of the decomposed rotation
+    const float MinDecomposeScale = 1e-12f;
+
+    struct ArrayKernels {
+        // 16 floats per matrix
+        void (*matrixMultiply)(float* result, const float* left, const float* right, size_t count);
+        // 4 floats per vector
+        void (*vectorTransform)(float* result, const float* vectors, const float* matrix, size_t count);
+        // 4 floats per quaternion, x y z w
+        void (*quaternionMultiply)(float* result, const float* quat0, const float* quat1, size_t count);
+        // 3 floats per point
+        void (*transformPoints)(const float* matrix, const float* points, float* result, size_t count);
+        void (*quaternionToMatrix)(const float* quats, float* result, size_t count);
+        // 16 floats per matrix, 3 per position and scale, 4 per rotation
+        void (*matrixDecompose)(const float* matrices, float* positions, float* scales, float* rotations, size_t count);
+        void (*matrixCompose)(const float* positions, const float* scales, const float* rotations, float* matrices, size_t count);
+        // 6 planes of 4 floats, 3 arrays of box lower and upper coordinates, a bit per box
+        void (*frustumCull)(const float* planes, const float* const* lower, const float* const* upper, size_t count, uint32_t* visible);
+        // IEEE halves, round to nearest even
+        void (*floatToHalf)(const float* values, uint16_t* result, size_t count);
+        void (*halfToFloat)(const uint16_t* halves, float* result, size_t count);
+        // clamped to [-1, 1] and [0, 1], rounded to nearest even
+        void (*floatToSnorm16)(const float* values, int16_t* result, size_t count);
+        void (*floatToUnorm8)(const float* values, uint8_t* result, size_t count);
+    };
+
+    // nullptr when SIMD_AVX.cpp was not built for AVX2 and FMA, a nullptr
+    // entry falls back to the 4-wide kernel. The half kernels need F16C too
+    const ArrayKernels* GetAVX2Kernels();
+
+    // nullptr when SIMD_NEON.cpp was not built for NEON. Only asked for when the
+    // rest of the build does not target NEON, e.g. ARMv7 builds for devices without it.
+    // A nullptr entry falls back to the scalar kernel
+    const ArrayKernels* GetNEONKernels();
+}
+}
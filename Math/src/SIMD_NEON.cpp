@@ -1,3 +1,57 @@
-#ifdef __ANDROID__
+#include "SIMD_Kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <cstring>
+
 #include "SIMD_NEON.h"
-#endif
\ No newline at end of file
+
+namespace m3d {
+namespace math {
+    namespace {
+        /* Quaternion::ToMatrix on plain floats, Quaternion.h must not be compiled for NEON here */
+        void scalarQuaternionToMatrix(const float* quats, float* result, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, quats += 4, result += 16) {
+                const float x = quats[0], y = quats[1], z = quats[2], w = quats[3];
+                const float x2 = x + x, y2 = y + y, z2 = z + z;
+                const float xx = x * x2, xy = x * y2, xz = x * z2;
+                const float yy = y * y2, yz = y * z2, zz = z * z2;
+                const float wx = w * x2, wy = w * y2, wz = w * z2;
+                const float matrix[16] = {
+                    1.0f - (yy + zz), xy + wz, xz - wy, 0.0f,
+                    xy - wz, 1.0f - (xx + zz), yz + wx, 0.0f,
+                    xz + wy, yz - wx, 1.0f - (xx + yy), 0.0f,
+                    0.0f, 0.0f, 0.0f, 1.0f
+                };
+                memcpy(result, matrix, sizeof(matrix));
+            }
+        }
+
+#include "SIMD_VectorKernels.h"
+
+#if !M3D_SIMD_HALF
+        // built without neon-fp16, SIMD_Batch.cpp fills in its scalar conversions
+        const auto vectorFloatToHalf = nullptr;
+        const auto vectorHalfToFloat = nullptr;
+#endif
+
+        const ArrayKernels neonKernels = { vectorMatrixMultiply, vectorVectorTransform, vectorQuaternionMultiply, vectorTransformPoints, vectorQuaternionToMatrix,
+            vectorMatrixDecompose, vectorMatrixCompose, vectorFrustumCull, vectorFloatToHalf, vectorHalfToFloat, vectorFloatToSnorm16, vectorFloatToUnorm8 };
+    }
+
+    const ArrayKernels* GetNEONKernels()
+    {
+        return &neonKernels;
+    }
+}
+}
+#else
+namespace m3d {
+namespace math {
+    const ArrayKernels* GetNEONKernels()
+    {
+        return nullptr;
+    }
+}
+}
+#endif
@@ -0,0 +1,468 @@
+/*
+* Copyright (C) 2016 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// 4-wide array kernels on the VectorSIMD functions of SIMD_SSE.h or SIMD_NEON.h,
+// no include guard: included inside an anonymous namespace of m3d::math by
+// SIMD_Batch.cpp and by SIMD_NEON.cpp, which builds them for NEON when the
+// rest of the library does not target it. The including file defines
+// scalarQuaternionToMatrix for the tails.
+
+        /* SIMD_SSE.h or SIMD_NEON.h, one 4-wide register per row or vector */
+        void vectorMatrixMultiply(float* result, const float* left, const float* right, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, result += 16, left += 16, right += 16) {
+                M3D_PREFETCH(left + PrefetchDistance * 16);
+                M3D_PREFETCH(right + PrefetchDistance * 16);
+                // loads all rows before it stores, result may be left or right
+                MatrixMultiply(result, left, right);
+            }
+        }
+
+        void vectorVectorTransform(float* result, const float* vectors, const float* matrix, size_t count)
+        {
+            const VectorSIMD* rows = (const VectorSIMD*)matrix;
+            for (size_t i = 0; i < count; ++i) {
+                M3D_PREFETCH(vectors + (i + PrefetchDistance * 4) * 4);
+                const VectorSIMD vector = VectorLoad4f(vectors + i * 4);
+                VectorSIMD out = VectorMultiply(VectorReplicate(vector, 0), rows[0]);
+                out = VectorMultiplyAdd(VectorReplicate(vector, 1), rows[1], out);
+                out = VectorMultiplyAdd(VectorReplicate(vector, 2), rows[2], out);
+                out = VectorMultiplyAdd(VectorReplicate(vector, 3), rows[3], out);
+                VectorStore4f(out, result + i * 4);
+            }
+        }
+
+        void vectorQuaternionMultiply(float* result, const float* quat0, const float* quat1, size_t count)
+        {
+            // QuaternionMultiply takes restrict pointers, result may alias the inputs here
+            for (size_t i = 0; i < count; ++i) {
+                M3D_PREFETCH(quat0 + (i + PrefetchDistance * 4) * 4);
+                M3D_PREFETCH(quat1 + (i + PrefetchDistance * 4) * 4);
+                const VectorSIMD q0 = ((const VectorSIMD*)quat0)[i];
+                const VectorSIMD q1 = ((const VectorSIMD*)quat1)[i];
+                VectorSIMD out;
+                QuaternionMultiply(&out, &q0, &q1);
+                ((VectorSIMD*)result)[i] = out;
+            }
+        }
+
+        /* One point per iteration against the matrix columns, the next point is loaded before this one is stored */
+        void vectorTransformPoints(const float* matrix, const float* points, float* result, size_t count)
+        {
+            if (count == 0) {
+                return;
+            }
+            const VectorSIMD column0 = MakeVectorSIMD(matrix[0], matrix[4], matrix[8], 0.0f);
+            const VectorSIMD column1 = MakeVectorSIMD(matrix[1], matrix[5], matrix[9], 0.0f);
+            const VectorSIMD column2 = MakeVectorSIMD(matrix[2], matrix[6], matrix[10], 0.0f);
+            const VectorSIMD column3 = MakeVectorSIMD(matrix[3], matrix[7], matrix[11], 0.0f);
+
+            float x = points[0], y = points[1], z = points[2];
+            for (size_t i = 0; i < count; ++i) {
+                M3D_PREFETCH(points + (i + PrefetchDistance * 4) * 3);
+                VectorSIMD out = VectorMultiplyAdd(MakeVectorSIMD(x, x, x, x), column0, column3);
+                out = VectorMultiplyAdd(MakeVectorSIMD(y, y, y, y), column1, out);
+                out = VectorMultiplyAdd(MakeVectorSIMD(z, z, z, z), column2, out);
+                if (i + 1 < count) {
+                    x = points[(i + 1) * 3];
+                    y = points[(i + 1) * 3 + 1];
+                    z = points[(i + 1) * 3 + 2];
+                }
+                alignas(16) float stored[4];
+                VectorStore4f(out, stored);
+                memcpy(result + i * 3, stored, 3 * sizeof(float));
+            }
+        }
+
+        /* Four quaternions per iteration in SoA lanes, like TransformStore::computeLocals */
+        void vectorQuaternionToMatrix(const float* quats, float* result, size_t count)
+        {
+            const VectorSIMD one = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+            const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+            const VectorSIMD row3 = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 1.0f);
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                M3D_PREFETCH(quats + (i + PrefetchDistance * 4) * 4);
+                VectorSIMD qx = VectorLoad4f(quats + i * 4);
+                VectorSIMD qy = VectorLoad4f(quats + i * 4 + 4);
+                VectorSIMD qz = VectorLoad4f(quats + i * 4 + 8);
+                VectorSIMD qw = VectorLoad4f(quats + i * 4 + 12);
+                VectorTranspose4(qx, qy, qz, qw);
+
+                const VectorSIMD x2 = VectorAdd(qx, qx);
+                const VectorSIMD y2 = VectorAdd(qy, qy);
+                const VectorSIMD z2 = VectorAdd(qz, qz);
+                const VectorSIMD xx = VectorMultiply(qx, x2);
+                const VectorSIMD yy = VectorMultiply(qy, y2);
+                const VectorSIMD zz = VectorMultiply(qz, z2);
+                const VectorSIMD xy = VectorMultiply(qx, y2);
+                const VectorSIMD xz = VectorMultiply(qx, z2);
+                const VectorSIMD yz = VectorMultiply(qy, z2);
+                const VectorSIMD wx = VectorMultiply(qw, x2);
+                const VectorSIMD wy = VectorMultiply(qw, y2);
+                const VectorSIMD wz = VectorMultiply(qw, z2);
+
+                VectorSIMD row0[4] = { VectorSubstract(one, VectorAdd(yy, zz)), VectorAdd(xy, wz), VectorSubstract(xz, wy), zero };
+                VectorSIMD row1[4] = { VectorSubstract(xy, wz), VectorSubstract(one, VectorAdd(xx, zz)), VectorAdd(yz, wx), zero };
+                VectorSIMD row2[4] = { VectorAdd(xz, wy), VectorSubstract(yz, wx), VectorSubstract(one, VectorAdd(xx, yy)), zero };
+                VectorTranspose4(row0[0], row0[1], row0[2], row0[3]);
+                VectorTranspose4(row1[0], row1[1], row1[2], row1[3]);
+                VectorTranspose4(row2[0], row2[1], row2[2], row2[3]);
+
+                float* matrices = result + i * 16;
+                for (int lane = 0; lane < 4; ++lane) {
+                    VectorStore4f(row0[lane], matrices + lane * 16);
+                    VectorStore4f(row1[lane], matrices + lane * 16 + 4);
+                    VectorStore4f(row2[lane], matrices + lane * 16 + 8);
+                    VectorStore4f(row3, matrices + lane * 16 + 12);
+                }
+            }
+            scalarQuaternionToMatrix(quats + i * 4, result + i * 16, count - i);
+        }
+
+        /* x, y and z lanes as four packed Vector3: each store's fourth float is overwritten by the next, the last one goes
+           through a copy so nothing past the 12 floats is written */
+        inline void storeVector3x4(VectorSIMD x, VectorSIMD y, VectorSIMD z, float* vectors)
+        {
+            VectorSIMD w = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+            VectorTranspose4(x, y, z, w);
+            VectorStore4fUnaligned(x, vectors);
+            VectorStore4fUnaligned(y, vectors + 3);
+            VectorStore4fUnaligned(z, vectors + 6);
+            alignas(16) float last[4];
+            VectorStore4f(w, last);
+            memcpy(vectors + 9, last, 3 * sizeof(float));
+        }
+
+        // the reverse, the last Vector3 through a copy so nothing past the 12 floats is read
+        inline void loadVector3x4(const float* vectors, VectorSIMD& x, VectorSIMD& y, VectorSIMD& z)
+        {
+            float last[4] = {};
+            memcpy(last, vectors + 9, 3 * sizeof(float));
+            x = VectorLoad4fUnaligned(vectors);
+            y = VectorLoad4fUnaligned(vectors + 3);
+            z = VectorLoad4fUnaligned(vectors + 6);
+            VectorSIMD w = VectorLoad4fUnaligned(last);
+            VectorTranspose4(x, y, z, w);
+        }
+
+        /* Four matrices per step in SoA lanes. Every case of Quaternion(const Matrix4x4&) is computed, VectorSelect keeps the
+           one of the largest diagonal sum per lane, the w case unless x, y or z is at least as large */
+        inline void decomposeStep(const float* matrices, float* positions, float* scales, float* rotations)
+        {
+            const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+            const VectorSIMD one = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+            const VectorSIMD half = MakeVectorSIMD(0.5f, 0.5f, 0.5f, 0.5f);
+            const float minSquared = MinDecomposeScale * MinDecomposeScale;
+            const VectorSIMD minScaleSquared = MakeVectorSIMD(minSquared, minSquared, minSquared, minSquared);
+
+            // m[row][column] of the four matrices
+            VectorSIMD m[3][4];
+            for (int row = 0; row < 3; ++row) {
+                for (int lane = 0; lane < 4; ++lane) {
+                    m[row][lane] = VectorLoad4fUnaligned(matrices + lane * 16 + row * 4);
+                }
+                VectorTranspose4(m[row][0], m[row][1], m[row][2], m[row][3]);
+            }
+
+            const VectorSIMD minor0 = VectorSubstract(VectorMultiply(m[1][1], m[2][2]), VectorMultiply(m[1][2], m[2][1]));
+            const VectorSIMD minor1 = VectorSubstract(VectorMultiply(m[1][0], m[2][2]), VectorMultiply(m[1][2], m[2][0]));
+            const VectorSIMD minor2 = VectorSubstract(VectorMultiply(m[1][0], m[2][1]), VectorMultiply(m[1][1], m[2][0]));
+            const VectorSIMD determinant = VectorAdd(VectorSubstract(VectorMultiply(m[0][0], minor0), VectorMultiply(m[0][1], minor1)), VectorMultiply(m[0][2], minor2));
+
+            // one reciprocal square root per column gives its length and the inverse that unscales it, no division
+            const VectorSIMD positive = VectorCompareGreaterEqual(determinant, zero);
+            VectorSIMD scale[3];
+            VectorSIMD r[3][3];
+            for (int j = 0; j < 3; ++j) {
+                const VectorSIMD squared = VectorMultiplyAdd(m[0][j], m[0][j], VectorMultiplyAdd(m[1][j], m[1][j], VectorMultiply(m[2][j], m[2][j])));
+                const VectorSIMD valid = VectorCompareGreaterEqual(squared, minScaleSquared);
+                VectorSIMD inverse = VectorSelect(valid, zero, VectorReciprocalSqrt(VectorSelect(valid, one, squared)));
+                scale[j] = VectorMultiply(squared, inverse);
+                // a mirror flips x
+                if (j == 0) {
+                    scale[j] = VectorSelect(positive, VectorSubstract(zero, scale[j]), scale[j]);
+                    inverse = VectorSelect(positive, VectorSubstract(zero, inverse), inverse);
+                }
+                for (int row = 0; row < 3; ++row) {
+                    r[row][j] = VectorMultiply(m[row][j], inverse);
+                }
+            }
+
+            const VectorSIMD a = VectorSubstract(r[2][1], r[1][2]);
+            const VectorSIMD b = VectorSubstract(r[0][2], r[2][0]);
+            const VectorSIMD c = VectorSubstract(r[1][0], r[0][1]);
+            const VectorSIMD p = VectorAdd(r[1][0], r[0][1]);
+            const VectorSIMD q = VectorAdd(r[0][2], r[2][0]);
+            const VectorSIMD s = VectorAdd(r[2][1], r[1][2]);
+            const VectorSIMD tw = VectorAdd(one, VectorAdd(r[0][0], VectorAdd(r[1][1], r[2][2])));
+            const VectorSIMD tx = VectorAdd(one, VectorSubstract(r[0][0], VectorAdd(r[1][1], r[2][2])));
+            const VectorSIMD ty = VectorAdd(one, VectorSubstract(r[1][1], VectorAdd(r[0][0], r[2][2])));
+            const VectorSIMD tz = VectorAdd(one, VectorSubstract(r[2][2], VectorAdd(r[0][0], r[1][1])));
+
+            VectorSIMD best = tw;
+            VectorSIMD qx = a, qy = b, qz = c, qw = tw;
+            VectorSIMD mask = VectorCompareGreaterEqual(tx, best);
+            best = VectorSelect(mask, best, tx);
+            qx = VectorSelect(mask, qx, tx);
+            qy = VectorSelect(mask, qy, p);
+            qz = VectorSelect(mask, qz, q);
+            qw = VectorSelect(mask, qw, a);
+            mask = VectorCompareGreaterEqual(ty, best);
+            best = VectorSelect(mask, best, ty);
+            qx = VectorSelect(mask, qx, p);
+            qy = VectorSelect(mask, qy, ty);
+            qz = VectorSelect(mask, qz, s);
+            qw = VectorSelect(mask, qw, b);
+            mask = VectorCompareGreaterEqual(tz, best);
+            best = VectorSelect(mask, best, tz);
+            qx = VectorSelect(mask, qx, q);
+            qy = VectorSelect(mask, qy, s);
+            qz = VectorSelect(mask, qz, tz);
+            qw = VectorSelect(mask, qw, c);
+
+            // the four sums add up to 4, best is at least 1
+            const VectorSIMD factor = VectorMultiply(half, VectorReciprocalSqrt(best));
+            qx = VectorMultiply(qx, factor);
+            qy = VectorMultiply(qy, factor);
+            qz = VectorMultiply(qz, factor);
+            qw = VectorMultiply(qw, factor);
+            VectorTranspose4(qx, qy, qz, qw);
+            VectorStore4fUnaligned(qx, rotations);
+            VectorStore4fUnaligned(qy, rotations + 4);
+            VectorStore4fUnaligned(qz, rotations + 8);
+            VectorStore4fUnaligned(qw, rotations + 12);
+
+            storeVector3x4(m[0][3], m[1][3], m[2][3], positions);
+            storeVector3x4(scale[0], scale[1], scale[2], scales);
+        }
+
+        void vectorMatrixDecompose(const float* matrices, float* positions, float* scales, float* rotations, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                M3D_PREFETCH(matrices + (i + PrefetchDistance * 4) * 16);
+                decomposeStep(matrices + i * 16, positions + i * 3, scales + i * 3, rotations + i * 4);
+            }
+            if (i < count) {
+                // identities fill the step
+                float padded[4 * 16] = {};
+                float paddedPositions[4 * 3], paddedScales[4 * 3], paddedRotations[4 * 4];
+                for (int lane = 0; lane < 4; ++lane) {
+                    for (int d = 0; d < 4; ++d) {
+                        padded[lane * 16 + d * 5] = 1.0f;
+                    }
+                }
+                memcpy(padded, matrices + i * 16, (count - i) * 16 * sizeof(float));
+                decomposeStep(padded, paddedPositions, paddedScales, paddedRotations);
+                memcpy(positions + i * 3, paddedPositions, (count - i) * 3 * sizeof(float));
+                memcpy(scales + i * 3, paddedScales, (count - i) * 3 * sizeof(float));
+                memcpy(rotations + i * 4, paddedRotations, (count - i) * 4 * sizeof(float));
+            }
+        }
+
+        /* Four matrices per step, vectorQuaternionToMatrix transposed and scaled by column with the translation added */
+        inline void composeStep(const float* positions, const float* scales, const float* rotations, float* matrices)
+        {
+            const VectorSIMD one = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+            const VectorSIMD row3 = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 1.0f);
+            VectorSIMD qx = VectorLoad4fUnaligned(rotations);
+            VectorSIMD qy = VectorLoad4fUnaligned(rotations + 4);
+            VectorSIMD qz = VectorLoad4fUnaligned(rotations + 8);
+            VectorSIMD qw = VectorLoad4fUnaligned(rotations + 12);
+            VectorTranspose4(qx, qy, qz, qw);
+
+            VectorSIMD px, py, pz, sx, sy, sz;
+            loadVector3x4(positions, px, py, pz);
+            loadVector3x4(scales, sx, sy, sz);
+
+            const VectorSIMD x2 = VectorAdd(qx, qx);
+            const VectorSIMD y2 = VectorAdd(qy, qy);
+            const VectorSIMD z2 = VectorAdd(qz, qz);
+            const VectorSIMD xx = VectorMultiply(qx, x2);
+            const VectorSIMD yy = VectorMultiply(qy, y2);
+            const VectorSIMD zz = VectorMultiply(qz, z2);
+            const VectorSIMD xy = VectorMultiply(qx, y2);
+            const VectorSIMD xz = VectorMultiply(qx, z2);
+            const VectorSIMD yz = VectorMultiply(qy, z2);
+            const VectorSIMD wx = VectorMultiply(qw, x2);
+            const VectorSIMD wy = VectorMultiply(qw, y2);
+            const VectorSIMD wz = VectorMultiply(qw, z2);
+
+            VectorSIMD row0[4] = { VectorMultiply(VectorSubstract(one, VectorAdd(yy, zz)), sx), VectorMultiply(VectorSubstract(xy, wz), sy),
+                VectorMultiply(VectorAdd(xz, wy), sz), px };
+            VectorSIMD row1[4] = { VectorMultiply(VectorAdd(xy, wz), sx), VectorMultiply(VectorSubstract(one, VectorAdd(xx, zz)), sy),
+                VectorMultiply(VectorSubstract(yz, wx), sz), py };
+            VectorSIMD row2[4] = { VectorMultiply(VectorSubstract(xz, wy), sx), VectorMultiply(VectorAdd(yz, wx), sy),
+                VectorMultiply(VectorSubstract(one, VectorAdd(xx, yy)), sz), pz };
+            VectorTranspose4(row0[0], row0[1], row0[2], row0[3]);
+            VectorTranspose4(row1[0], row1[1], row1[2], row1[3]);
+            VectorTranspose4(row2[0], row2[1], row2[2], row2[3]);
+
+            for (int lane = 0; lane < 4; ++lane) {
+                VectorStore4fUnaligned(row0[lane], matrices + lane * 16);
+                VectorStore4fUnaligned(row1[lane], matrices + lane * 16 + 4);
+                VectorStore4fUnaligned(row2[lane], matrices + lane * 16 + 8);
+                VectorStore4fUnaligned(row3, matrices + lane * 16 + 12);
+            }
+        }
+
+        void vectorMatrixCompose(const float* positions, const float* scales, const float* rotations, float* matrices, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                M3D_PREFETCH(rotations + (i + PrefetchDistance * 4) * 4);
+                composeStep(positions + i * 3, scales + i * 3, rotations + i * 4, matrices + i * 16);
+            }
+            if (i < count) {
+                float paddedPositions[4 * 3] = {}, paddedScales[4 * 3] = {}, paddedRotations[4 * 4] = {};
+                float padded[4 * 16];
+                memcpy(paddedPositions, positions + i * 3, (count - i) * 3 * sizeof(float));
+                memcpy(paddedScales, scales + i * 3, (count - i) * 3 * sizeof(float));
+                memcpy(paddedRotations, rotations + i * 4, (count - i) * 4 * sizeof(float));
+                composeStep(paddedPositions, paddedScales, paddedRotations, padded);
+                memcpy(matrices + i * 16, padded, (count - i) * 16 * sizeof(float));
+            }
+        }
+
+        /* Four boxes per iteration, every plane against the corner of each box furthest along its normal */
+        void vectorFrustumCull(const float* planes, const float* const* lower, const float* const* upper, size_t count, uint32_t* visible)
+        {
+            // the corner is chosen by the sign of the normal, the same array for every box
+            const float* corners[6][3];
+            VectorSIMD normals[6][3];
+            VectorSIMD distances[6];
+            for (int p = 0; p < 6; ++p) {
+                for (int c = 0; c < 3; ++c) {
+                    const float n = planes[p * 4 + c];
+                    corners[p][c] = n >= 0.0f ? upper[c] : lower[c];
+                    normals[p][c] = MakeVectorSIMD(n, n, n, n);
+                }
+                distances[p] = MakeVectorSIMD(planes[p * 4 + 3], planes[p * 4 + 3], planes[p * 4 + 3], planes[p * 4 + 3]);
+            }
+            memset(visible, 0, (count + 31) / 32 * sizeof(uint32_t));
+            const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                VectorSIMD inside = zero;
+                for (int p = 0; p < 6; ++p) {
+                    VectorSIMD distance = VectorMultiplyAdd(normals[p][0], VectorLoad4fUnaligned(corners[p][0] + i), distances[p]);
+                    distance = VectorMultiplyAdd(normals[p][1], VectorLoad4fUnaligned(corners[p][1] + i), distance);
+                    distance = VectorMultiplyAdd(normals[p][2], VectorLoad4fUnaligned(corners[p][2] + i), distance);
+                    const VectorSIMD front = VectorCompareGreaterEqual(distance, zero);
+                    inside = p == 0 ? front : VectorAnd(inside, front);
+                }
+                // i is a multiple of 4, the 4 bits stay in one word
+                visible[i / 32] |= static_cast<uint32_t>(VectorMoveMask(inside)) << (i % 32);
+            }
+            for (; i < count; ++i) {
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; ++p) {
+                    inside = planes[p * 4 + 3] + planes[p * 4] * corners[p][0][i] + planes[p * 4 + 1] * corners[p][1][i] + planes[p * 4 + 2] * corners[p][2][i] >= 0.0f;
+                }
+                visible[i / 32] |= inside ? 1u << (i % 32) : 0u;
+            }
+        }
+
+        /* Eight values per step, the last few through a zero padded copy */
+        inline void snorm16Step(const float* values, int16_t* result)
+        {
+            const VectorSIMD lower = MakeVectorSIMD(-1.0f, -1.0f, -1.0f, -1.0f);
+            const VectorSIMD upper = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+            const VectorSIMD scale = MakeVectorSIMD(32767.0f, 32767.0f, 32767.0f, 32767.0f);
+            const VectorSIMD v0 = VectorMultiply(VectorMin(VectorMax(VectorLoad4fUnaligned(values), lower), upper), scale);
+            const VectorSIMD v1 = VectorMultiply(VectorMin(VectorMax(VectorLoad4fUnaligned(values + 4), lower), upper), scale);
+            VectorStoreInt16x8(v0, v1, result);
+        }
+
+        void vectorFloatToSnorm16(const float* values, int16_t* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                M3D_PREFETCH(values + i + PrefetchDistance * 16);
+                snorm16Step(values + i, result + i);
+            }
+            if (i < count) {
+                float padded[8] = {};
+                int16_t packed[8];
+                memcpy(padded, values + i, (count - i) * sizeof(float));
+                snorm16Step(padded, packed);
+                memcpy(result + i, packed, (count - i) * sizeof(int16_t));
+            }
+        }
+
+        /* Sixteen values per step, the last few through a zero padded copy */
+        inline void unorm8Step(const float* values, uint8_t* result)
+        {
+            const VectorSIMD scale = MakeVectorSIMD(255.0f, 255.0f, 255.0f, 255.0f);
+            // keeps huge values within the range of the NEON rounding, the saturating pack clamps the rest
+            const VectorSIMD lower = MakeVectorSIMD(-1.0f, -1.0f, -1.0f, -1.0f);
+            const VectorSIMD upper = MakeVectorSIMD(2.0f, 2.0f, 2.0f, 2.0f);
+            VectorSIMD v[4];
+            for (int j = 0; j < 4; ++j) {
+                v[j] = VectorMultiply(VectorMin(VectorMax(VectorLoad4fUnaligned(values + j * 4), lower), upper), scale);
+            }
+            VectorStoreUint8x16(v[0], v[1], v[2], v[3], result);
+        }
+
+        void vectorFloatToUnorm8(const float* values, uint8_t* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 16 <= count; i += 16) {
+                M3D_PREFETCH(values + i + PrefetchDistance * 16);
+                unorm8Step(values + i, result + i);
+            }
+            if (i < count) {
+                float padded[16] = {};
+                uint8_t packed[16];
+                memcpy(padded, values + i, (count - i) * sizeof(float));
+                unorm8Step(padded, packed);
+                memcpy(result + i, packed, count - i);
+            }
+        }
+
+#if M3D_SIMD_HALF
+        /* F16C or the NEON conversions, eight values per step */
+        void vectorFloatToHalf(const float* values, uint16_t* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                M3D_PREFETCH(values + i + PrefetchDistance * 16);
+                const VectorSIMD v0 = VectorLoad4fUnaligned(values + i);
+                const VectorSIMD v1 = VectorLoad4fUnaligned(values + i + 4);
+                VectorStoreHalf4(v0, result + i);
+                VectorStoreHalf4(v1, result + i + 4);
+            }
+            for (; i < count; i += 4) {
+                float padded[4] = {};
+                uint16_t packed[4];
+                const size_t n = count - i < 4 ? count - i : 4;
+                memcpy(padded, values + i, n * sizeof(float));
+                VectorStoreHalf4(VectorLoad4fUnaligned(padded), packed);
+                memcpy(result + i, packed, n * sizeof(uint16_t));
+            }
+        }
+
+        void vectorHalfToFloat(const uint16_t* halves, float* result, size_t count)
+        {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                M3D_PREFETCH(halves + i + PrefetchDistance * 32);
+                const VectorSIMD v0 = VectorLoadHalf4(halves + i);
+                const VectorSIMD v1 = VectorLoadHalf4(halves + i + 4);
+                VectorStore4fUnaligned(v0, result + i);
+                VectorStore4fUnaligned(v1, result + i + 4);
+            }
+            for (; i < count; i += 4) {
+                uint16_t padded[4] = {};
+                float unpacked[4];
+                const size_t n = count - i < 4 ? count - i : 4;
+                memcpy(padded, halves + i, n * sizeof(uint16_t));
+                VectorStore4fUnaligned(VectorLoadHalf4(padded), unpacked);
+                memcpy(result + i, unpacked, n * sizeof(float));
+            }
+        }
+#endif
@@ -0,0 +1,181 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// A per frame culling pass over n instances, as Scene stores them and as entities of an ArchetypeStore.
+//   m3d_bench_archetypes --benchmark_filter=Chunks
+// Every instance tests the world bounding sphere of its mesh against a frustum's six planes and keeps the result.
+// Scene:          instances of a Scene, each followed by id to its world matrix in the TransformStore and its
+//                 mesh's bounds; transforms were created in another order than the instances, as merges and
+//                 edits leave them
+// Chunks:         entities with a world matrix, a local sphere and a visible flag, one chunk after the other
+// ParallelChunks: the same, a job per chunk on a JobSystem of every hardware thread
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "ArchetypeStore.hpp"
+#include "JobSystem.hpp"
+#include "Scene.hpp"
+
+static const uint32_t MeshCount = 64;
+
+struct WorldMatrix {
+    m3d::math::Matrix4x4 world;
+};
+struct LocalSphere {
+    float sphere[4];
+};
+struct Visible {
+    uint32_t visible;
+};
+
+// the planes of a 90 degree frustum looking down -z from the origin, 1000 units deep
+static const float Planes[6][4] = {
+    { 0.7071f, 0.0f, -0.7071f, 0.0f },
+    { -0.7071f, 0.0f, -0.7071f, 0.0f },
+    { 0.0f, 0.7071f, -0.7071f, 0.0f },
+    { 0.0f, -0.7071f, -0.7071f, 0.0f },
+    { 0.0f, 0.0f, -1.0f, -1.0f },
+    { 0.0f, 0.0f, 1.0f, 1000.0f },
+};
+
+static uint32_t inFrustum(const m3d::math::Matrix4x4& world, const float sphere[4])
+{
+    float center[3];
+    for (int i = 0; i < 3; ++i) {
+        center[i] = world.m[i][0] * sphere[0] + world.m[i][1] * sphere[1] + world.m[i][2] * sphere[2] + world.m[i][3];
+    }
+    for (const float* plane : Planes) {
+        if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -sphere[3]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the same instances both ways: placement, mesh and sphere radius
+struct Instances {
+    std::vector<m3d::Transform> transforms;
+    std::vector<uint32_t> meshes;
+    float spheres[MeshCount][4];
+
+    explicit Instances(uint32_t count)
+    {
+        std::mt19937 random(5);
+        std::uniform_real_distribution<float> position(-600.0f, 600.0f);
+        std::uniform_int_distribution<uint32_t> mesh(0, MeshCount - 1);
+        for (uint32_t m = 0; m < MeshCount; ++m) {
+            spheres[m][0] = spheres[m][1] = spheres[m][2] = 0.0f;
+            spheres[m][3] = 1.0f + m * 0.25f;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            m3d::Transform transform;
+            transform.position = m3d::math::Vector3(position(random), position(random), position(random));
+            transform.scale = m3d::math::Vector3(1.0f, 1.0f, 1.0f);
+            transform.rotation = m3d::math::Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
+            transforms.push_back(transform);
+            meshes.push_back(mesh(random));
+        }
+    }
+};
+
+static void sizeRange(benchmark::internal::Benchmark* benchmark)
+{
+    for (int count : { 1000, 10000, 100000, 1000000 }) {
+        benchmark->Arg(count);
+    }
+    benchmark->Unit(benchmark::kMicrosecond);
+}
+
+static void BM_Scene(benchmark::State& state)
+{
+    const Instances instances(static_cast<uint32_t>(state.range(0)));
+    m3d::Scene scene;
+    scene.Init();
+    std::vector<uint32_t> meshIDs;
+    for (uint32_t m = 0; m < MeshCount; ++m) {
+        m3d::Mesh mesh;
+        std::copy(instances.spheres[m], instances.spheres[m] + 4, mesh.boundingSphere);
+        meshIDs.push_back(scene.meshes.insert(std::move(mesh)));
+    }
+    std::vector<uint32_t> order(instances.transforms.size());
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(9));
+    std::vector<uint32_t> transformIDs(order.size());
+    for (uint32_t i : order) {
+        transformIDs[i] = scene.AddTransform(instances.transforms[i]);
+    }
+    scene.transformStore.Update();
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        m3d::Instance instance;
+        instance.meshId = meshIDs[instances.meshes[i]];
+        instance.transformId = transformIDs[i];
+        scene.instances.insert(instance);
+    }
+
+    std::vector<uint32_t> visible(order.size());
+    for (auto _ : state) {
+        uint32_t i = 0;
+        for (uint32_t instanceID : scene.instances) {
+            const m3d::Instance& instance = scene.instances[instanceID];
+            visible[i++] = inFrustum(scene.transformStore.GetWorld(instance.transformId), scene.meshes[instance.meshId].boundingSphere);
+        }
+        benchmark::DoNotOptimize(visible.data());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Scene)->Apply(sizeRange);
+
+static void fillStore(m3d::ArchetypeStore& store, const Instances& instances)
+{
+    for (size_t i = 0; i < instances.transforms.size(); ++i) {
+        WorldMatrix world;
+        world.world = instances.transforms[i].ToMatrix();
+        LocalSphere sphere;
+        std::copy(instances.spheres[instances.meshes[i]], instances.spheres[instances.meshes[i]] + 4, sphere.sphere);
+        const Visible visible = { 0 };
+        store.Create(world, sphere, visible);
+    }
+}
+
+static void cullChunk(uint32_t count, const m3d::ArchetypeStore::Entity*, WorldMatrix* worlds, LocalSphere* spheres, Visible* visible)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        visible[i].visible = inFrustum(worlds[i].world, spheres[i].sphere);
+    }
+}
+
+static void BM_Chunks(benchmark::State& state)
+{
+    const Instances instances(static_cast<uint32_t>(state.range(0)));
+    m3d::ArchetypeStore store;
+    fillStore(store, instances);
+    for (auto _ : state) {
+        store.ForEach<WorldMatrix, LocalSphere, Visible>(cullChunk);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Chunks)->Apply(sizeRange);
+
+static void BM_ParallelChunks(benchmark::State& state)
+{
+    const Instances instances(static_cast<uint32_t>(state.range(0)));
+    m3d::ArchetypeStore store;
+    fillStore(store, instances);
+    m3d::JobSystem jobs;
+    for (auto _ : state) {
+        store.ParallelForEach<WorldMatrix, LocalSphere, Visible>(jobs, cullChunk);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_ParallelChunks)->Apply(sizeRange);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,243 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Scene container microbenchmarks, packed_freelist and chunked_freelist next to the std containers
+// they replace: an unordered_map from id to object and a plain vector indexed by position.
+//   m3d_bench_freelist --benchmark_filter=Lookup
+// Objects are 64 bytes, about a Transform plus its bookkeeping. Lookups go through the ids in
+// a shuffled order, iteration walks the dense storage.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "chunked_freelist.h"
+#include "packed_freelist.h"
+
+struct Object {
+    float values[16];
+};
+
+static Object makeObject(uint32_t i)
+{
+    Object object;
+    std::fill(object.values, object.values + 16, static_cast<float>(i));
+    return object;
+}
+
+// packed_freelist ids are 16 bit indices, the sizes stay below its limit
+static void sizeRange(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->RangeMultiplier(8)->Range(64, 32 << 10);
+}
+
+static std::vector<uint32_t> shuffled(std::vector<uint32_t> ids)
+{
+    std::mt19937 random(7);
+    std::shuffle(ids.begin(), ids.end(), random);
+    return ids;
+}
+
+/* The containers behind one interface, ids as each hands them out */
+
+struct PackedList {
+    static const bool Positional = false;
+    explicit PackedList(size_t count)
+        : list(count)
+    {
+    }
+    uint32_t insert(const Object& object) { return list.insert(object); }
+    void erase(uint32_t id) { list.erase(id); }
+    Object& get(uint32_t id) { return list[id]; }
+    template<class F>
+    void each(F f) { list.for_each([&f](uint32_t, Object& object) { f(object); }); }
+    packed_freelist<Object> list;
+};
+
+struct ChunkedList {
+    static const bool Positional = false;
+    explicit ChunkedList(size_t)
+    {
+    }
+    uint32_t insert(const Object& object) { return list.insert(object); }
+    void erase(uint32_t id) { list.erase(id); }
+    Object& get(uint32_t id) { return list[id]; }
+    template<class F>
+    void each(F f) { list.for_each([&f](uint32_t, Object& object) { f(object); }); }
+    chunked_freelist<Object> list;
+};
+
+struct HashMap {
+    static const bool Positional = false;
+    explicit HashMap(size_t count)
+    {
+        map.reserve(count);
+    }
+    uint32_t insert(const Object& object)
+    {
+        map.emplace(next, object);
+        return next++;
+    }
+    void erase(uint32_t id) { map.erase(id); }
+    Object& get(uint32_t id) { return map.find(id)->second; }
+    template<class F>
+    void each(F f)
+    {
+        for (auto& entry : map) {
+            f(entry.second);
+        }
+    }
+    std::unordered_map<uint32_t, Object> map;
+    uint32_t next = 0;
+};
+
+// the baseline without stable ids: an erase swaps the last object into the hole like the freelists
+// do, but the ids of the moved objects change
+struct Vector {
+    // after as many inserts as erases the ids are 0 to size - 1 again
+    static const bool Positional = true;
+    explicit Vector(size_t count)
+    {
+        objects.reserve(count);
+    }
+    uint32_t insert(const Object& object)
+    {
+        objects.push_back(object);
+        return static_cast<uint32_t>(objects.size() - 1);
+    }
+    void erase(uint32_t id)
+    {
+        objects[id] = objects.back();
+        objects.pop_back();
+    }
+    Object& get(uint32_t id) { return objects[id]; }
+    template<class F>
+    void each(F f)
+    {
+        for (Object& object : objects) {
+            f(object);
+        }
+    }
+    std::vector<Object> objects;
+};
+
+template<class Container>
+static void BM_Insert(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    const Object object = makeObject(1);
+    for (auto _ : state) {
+        Container container(count);
+        for (size_t i = 0; i < count; ++i) {
+            benchmark::DoNotOptimize(container.insert(object));
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+// Erase a quarter of the objects, picked at random, and insert as many again: the churn of streaming
+template<class Container>
+static void BM_EraseInsert(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    Container container(count);
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back(container.insert(makeObject(static_cast<uint32_t>(i))));
+    }
+    const Object object = makeObject(2);
+    std::vector<uint32_t> slots(count);
+    for (size_t i = 0; i < count; ++i) {
+        slots[i] = static_cast<uint32_t>(i);
+    }
+    std::mt19937 random(7);
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::shuffle(slots.begin(), slots.end(), random);
+        // highest id first, a vector's ids are positions and the ones below stay valid
+        std::sort(slots.begin(), slots.begin() + count / 4, [&ids](uint32_t a, uint32_t b) { return ids[a] > ids[b]; });
+        state.ResumeTiming();
+        for (size_t i = 0; i < count / 4; ++i) {
+            container.erase(ids[slots[i]]);
+        }
+        for (size_t i = 0; i < count / 4; ++i) {
+            const uint32_t id = container.insert(object);
+            if (!Container::Positional) {
+                ids[slots[i]] = id;
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * (state.range(0) / 4) * 2);
+}
+
+template<class Container>
+static void BM_Lookup(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    Container container(count);
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back(container.insert(makeObject(static_cast<uint32_t>(i))));
+    }
+    ids = shuffled(ids);
+    for (auto _ : state) {
+        float sum = 0.0f;
+        for (uint32_t id : ids) {
+            sum += container.get(id).values[0];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+
+// after erasing every third object, so the freelists' dense arrays went through compaction
+template<class Container>
+static void BM_Iterate(benchmark::State& state)
+{
+    const size_t count = static_cast<size_t>(state.range(0));
+    Container container(count);
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < count; ++i) {
+        ids.push_back(container.insert(makeObject(static_cast<uint32_t>(i))));
+    }
+    for (size_t i = ids.size(); i-- > 0;) {
+        if (i % 3 == 0) {
+            container.erase(ids[i]);
+        }
+    }
+    for (auto _ : state) {
+        float sum = 0.0f;
+        container.each([&sum](Object& object) { sum += object.values[0]; });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0) * 2 / 3);
+}
+
+BENCHMARK_TEMPLATE(BM_Insert, PackedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Insert, ChunkedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Insert, HashMap)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Insert, Vector)->Apply(sizeRange);
+
+BENCHMARK_TEMPLATE(BM_EraseInsert, PackedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_EraseInsert, ChunkedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_EraseInsert, HashMap)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_EraseInsert, Vector)->Apply(sizeRange);
+
+BENCHMARK_TEMPLATE(BM_Lookup, PackedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Lookup, ChunkedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Lookup, HashMap)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Lookup, Vector)->Apply(sizeRange);
+
+BENCHMARK_TEMPLATE(BM_Iterate, PackedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Iterate, ChunkedList)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Iterate, HashMap)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_Iterate, Vector)->Apply(sizeRange);
+
+BENCHMARK_MAIN();
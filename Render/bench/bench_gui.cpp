@@ -0,0 +1,210 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// GUI layout and hit testing on screens of 100 to 50k elements, the baseline of the layout and hit test paths.
+//   m3d_bench_gui --benchmark_filter=Relayout
+// A screen is one full screen panel with 8 childs per element, breadth first, tiling their parent in 4 columns
+// and 2 rows with a margin, 1920x1080. It is laid out with GUIFlatTree::Layout, the layout GuiScreenLayout and
+// GUIController::SetFlatTree use; GUIElement::CalculateProportions is only reachable through the screen.
+// Layout:          every element moves, the screen width changes by a pixel each iteration
+// Relayout:        one element of the screen moves by a pixel, then the layout
+// RelayoutHitGrid: the same, then the hit grid GUIController updates before its next query
+// HitGrid/HitFlat: n pointers per frame against an up to date GUIHitGrid or GUIFlatTree, the grid is the
+//                  default of GUIController, the flat tree scans every element
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "GUIFlatTree.h"
+#include "GUIHitGrid.h"
+#include "GUIPanel.h"
+
+static const int ScreenWidth = 1920;
+static const int ScreenHeight = 1080;
+static const int Childs = 8;
+
+// of the element at index in its parent, shifted right by offset pixels
+static GUISystem::ElementPos slotPosition(int index, int offset)
+{
+    const int slot = (index - 1) % Childs;
+    return GUISystem::ElementPos(0.25f * (slot % 4), 0.5f * (slot / 4), 2 + offset, 2);
+}
+
+static GUISystem::ElementProportions screenProportions(int width)
+{
+    GUISystem::ElementProportions screen;
+    screen.topLeft = m3d::math::Vector2(0.0f, 0.0f);
+    screen.botRight = m3d::math::Vector2(static_cast<float>(width), static_cast<float>(ScreenHeight));
+    screen.width = static_cast<float>(width);
+    screen.height = static_cast<float>(ScreenHeight);
+    screen.depth = 0.0f;
+    return screen;
+}
+
+// The elements in the order they were created, which is the order of the screen's elements. The flat tree goes
+// before the elements it points to
+struct Screen {
+    std::vector<std::unique_ptr<GUISystem::GUIPanel>> panels;
+    std::vector<GUISystem::GUIElement*> elements;
+    GUISystem::GUIFlatTree tree;
+
+    explicit Screen(int count)
+    {
+        for (int i = 0; i < count; ++i) {
+            panels.emplace_back(new GUISystem::GUIPanel("panel"));
+            GUISystem::GUIPanel* panel = panels.back().get();
+            panel->SetVisible(true);
+            if (i == 0) {
+                panel->SetSize(GUISystem::ElementDim(1.0f, 1.0f, 0, 0));
+            } else {
+                panel->SetPosition(slotPosition(i, 0));
+                panel->SetSize(GUISystem::ElementDim(0.25f, 0.5f, -4, -4));
+                panels[(i - 1) / Childs]->AddChild(panel);
+            }
+            elements.push_back(panel);
+        }
+        tree.Build(std::vector<GUISystem::GUIElement*>(1, elements[0]));
+        tree.Layout(screenProportions(ScreenWidth));
+        moved.assign(count, 0);
+    }
+
+    // move the element by a pixel, or back
+    void Move(int index)
+    {
+        moved[index] ^= 1;
+        elements[index]->SetPosition(slotPosition(index, moved[index]));
+    }
+
+    std::vector<uint8_t> moved;
+};
+
+static void sizeRange(benchmark::internal::Benchmark* benchmark)
+{
+    for (int count : { 100, 1000, 10000, 50000 }) {
+        benchmark->Arg(count);
+    }
+    benchmark->Unit(benchmark::kMicrosecond);
+}
+
+// elements, then pointers per frame
+static void pointerRange(benchmark::internal::Benchmark* benchmark)
+{
+    for (int count : { 100, 1000, 10000, 50000 }) {
+        for (int pointers : { 1, 10, 100 }) {
+            benchmark->Args({ count, pointers });
+        }
+    }
+    benchmark->Unit(benchmark::kMicrosecond);
+}
+
+// elements to move, any but the whole screen
+static std::vector<int> changes(int count)
+{
+    std::mt19937 random(7);
+    std::uniform_int_distribution<int> element(1, count - 1);
+    std::vector<int> indices(1024);
+    for (int& index : indices) {
+        index = element(random);
+    }
+    return indices;
+}
+
+// pointers spread over the screen, a frame takes the next ones
+static std::vector<std::pair<int, int>> pointerPositions()
+{
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> x(0, ScreenWidth - 1);
+    std::uniform_int_distribution<int> y(0, ScreenHeight - 1);
+    std::vector<std::pair<int, int>> positions(4096);
+    for (auto& position : positions) {
+        position = std::make_pair(x(random), y(random));
+    }
+    return positions;
+}
+
+static void BM_Layout(benchmark::State& state)
+{
+    Screen screen(static_cast<int>(state.range(0)));
+    int width = ScreenWidth;
+    for (auto _ : state) {
+        width = width == ScreenWidth ? ScreenWidth - 1 : ScreenWidth;
+        screen.tree.Layout(screenProportions(width));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_Layout)->Apply(sizeRange);
+
+static void BM_Relayout(benchmark::State& state)
+{
+    Screen screen(static_cast<int>(state.range(0)));
+    const std::vector<int> indices = changes(static_cast<int>(state.range(0)));
+    const GUISystem::ElementProportions proportions = screenProportions(ScreenWidth);
+    size_t next = 0;
+    for (auto _ : state) {
+        screen.Move(indices[next++ % indices.size()]);
+        screen.tree.Layout(proportions);
+    }
+}
+BENCHMARK(BM_Relayout)->Apply(sizeRange);
+
+static void BM_RelayoutHitGrid(benchmark::State& state)
+{
+    Screen screen(static_cast<int>(state.range(0)));
+    const std::vector<int> indices = changes(static_cast<int>(state.range(0)));
+    const GUISystem::ElementProportions proportions = screenProportions(ScreenWidth);
+    GUISystem::GUIHitGrid grid;
+    grid.Update(screen.elements, proportions);
+    size_t next = 0;
+    for (auto _ : state) {
+        screen.Move(indices[next++ % indices.size()]);
+        screen.tree.Layout(proportions);
+        grid.Update(screen.elements, proportions);
+    }
+}
+BENCHMARK(BM_RelayoutHitGrid)->Apply(sizeRange);
+
+static void BM_HitGrid(benchmark::State& state)
+{
+    Screen screen(static_cast<int>(state.range(0)));
+    const std::vector<std::pair<int, int>> positions = pointerPositions();
+    const GUISystem::ElementProportions proportions = screenProportions(ScreenWidth);
+    GUISystem::GUIHitGrid grid;
+    grid.Update(screen.elements, proportions);
+    const int pointers = static_cast<int>(state.range(1));
+    size_t next = 0;
+    for (auto _ : state) {
+        // a query of GUIController, which brings the grid up to date first
+        grid.Update(screen.elements, proportions);
+        for (int p = 0; p < pointers; ++p) {
+            const std::pair<int, int>& position = positions[next++ % positions.size()];
+            benchmark::DoNotOptimize(grid.Find(position.first, position.second));
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * pointers);
+}
+BENCHMARK(BM_HitGrid)->Apply(pointerRange);
+
+static void BM_HitFlat(benchmark::State& state)
+{
+    Screen screen(static_cast<int>(state.range(0)));
+    const std::vector<std::pair<int, int>> positions = pointerPositions();
+    const int pointers = static_cast<int>(state.range(1));
+    size_t next = 0;
+    for (auto _ : state) {
+        for (int p = 0; p < pointers; ++p) {
+            const std::pair<int, int>& position = positions[next++ % positions.size()];
+            benchmark::DoNotOptimize(screen.tree.Find(position.first, position.second));
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * pointers);
+}
+BENCHMARK(BM_HitFlat)->Apply(pointerRange);
+
+BENCHMARK_MAIN();
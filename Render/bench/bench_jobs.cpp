@@ -0,0 +1,295 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// JobSystem scaling, every graph at 1, 2, 4 ... workers up to the hardware threads.
+//   m3d_bench_jobs --benchmark_filter=Chains
+// Fine:      65536 jobs of about a microsecond each, all from the main thread
+// Coarse:    256 jobs of about 200 microseconds
+// Chains:    64 chains of 512 links, each link runs its successor when it is done
+// ForkJoin:  a binary tree 12 levels deep, every inner job waits for its two children
+// MeshBuild: LoadMeshes' conversion step, Mesh::build of 64 spheres, one job each as convertMeshes runs them
+// Animation: AnimationScheduler on a ThreadPool of the system, 2048 characters of 64 joints without skinning
+// The main thread waits for each graph and runs jobs meanwhile. Besides the time every run reports speedup over
+// the single worker run of its graph, and per iteration the jobs stolen, the share of deque locks found held by
+// another thread and the share of the threads' time spent asleep.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AnimationScheduler.hpp"
+#include "JobSystem.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+
+// 1, 2, 4 ... and the hardware thread count, the main thread waits along with the workers
+static void workerRange(benchmark::internal::Benchmark* benchmark)
+{
+    const int hardwareThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int workers = 1; workers < hardwareThreads; workers *= 2) {
+        benchmark->Arg(workers);
+    }
+    benchmark->Arg(hardwareThreads);
+    benchmark->UseManualTime()->Unit(benchmark::kMillisecond);
+}
+
+// about iterations * 4 ns of work the compiler keeps
+static uint32_t spin(uint32_t iterations)
+{
+    uint32_t value = iterations;
+    for (uint32_t i = 0; i < iterations; ++i) {
+        value = value * 1664525u + 1013904223u;
+    }
+    benchmark::DoNotOptimize(value);
+    return value;
+}
+
+// one iteration of a graph, and what builds it and its state on a system
+typedef std::function<void()> Graph;
+typedef std::function<Graph(m3d::JobSystem&)> GraphBuilder;
+
+// Time each iteration of the graph on a system of state.range(0) workers and report its counters. The graph
+// goes before the system, along with whatever of the system it holds
+static void runGraph(benchmark::State& state, GraphBuilder build)
+{
+    // seconds per iteration of the single worker run of each graph, which runs first
+    static std::map<std::string, double> singleWorker;
+
+    const uint32_t workerCount = static_cast<uint32_t>(state.range(0));
+    m3d::JobSystem jobs(workerCount);
+    Graph graph = build(jobs);
+    // warm, the first run allocates
+    graph();
+    jobs.ResetStats();
+
+    double seconds = 0.0;
+    for (auto _ : state) {
+        auto tStart = std::chrono::high_resolution_clock::now();
+        graph();
+        const double iterationSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+        state.SetIterationTime(iterationSeconds);
+        seconds += iterationSeconds;
+    }
+
+    const m3d::JobSystem::Stats stats = jobs.GetStats();
+    const double iterations = static_cast<double>(std::max<int64_t>(state.iterations(), 1));
+    const double perIteration = seconds / iterations;
+    const std::string name = state.name().substr(0, state.name().find('/'));
+    if (workerCount == 1) {
+        singleWorker[name] = perIteration;
+    }
+    auto baseline = singleWorker.find(name);
+    if (baseline != singleWorker.end() && perIteration > 0.0) {
+        state.counters["speedup"] = baseline->second / perIteration;
+    }
+    state.counters["jobs"] = benchmark::Counter(static_cast<double>(stats.jobs), benchmark::Counter::kAvgIterations);
+    state.counters["steals"] = benchmark::Counter(static_cast<double>(stats.steals), benchmark::Counter::kAvgIterations);
+    state.counters["contended%"] = stats.locks > 0 ? 100.0 * stats.contended / stats.locks : 0.0;
+    // of the workers and the main thread
+    state.counters["idle%"] = seconds > 0.0 ? 100.0 * stats.idleMs / (1000.0 * seconds * (workerCount + 1)) : 0.0;
+}
+
+static void BM_Fine(benchmark::State& state)
+{
+    runGraph(state, [](m3d::JobSystem& jobs) -> Graph {
+        return [&jobs]() {
+            m3d::JobSystem::Counter counter;
+            for (uint32_t i = 0; i < 65536; ++i) {
+                jobs.Run([]() { spin(256); }, &counter);
+            }
+            jobs.WaitFor(counter);
+        };
+    });
+}
+BENCHMARK(BM_Fine)->Apply(workerRange);
+
+static void BM_Coarse(benchmark::State& state)
+{
+    runGraph(state, [](m3d::JobSystem& jobs) -> Graph {
+        return [&jobs]() {
+            m3d::JobSystem::Counter counter;
+            for (uint32_t i = 0; i < 256; ++i) {
+                jobs.Run([]() { spin(50000); }, &counter);
+            }
+            jobs.WaitFor(counter);
+        };
+    });
+}
+BENCHMARK(BM_Coarse)->Apply(workerRange);
+
+// link of a chain, runs the next one on the worker it ran on
+static void chainLink(m3d::JobSystem& jobs, m3d::JobSystem::Counter& counter, uint32_t remaining)
+{
+    spin(256);
+    if (remaining > 1) {
+        jobs.Run([&jobs, &counter, remaining]() { chainLink(jobs, counter, remaining - 1); }, &counter);
+    }
+}
+
+static void BM_Chains(benchmark::State& state)
+{
+    runGraph(state, [](m3d::JobSystem& jobs) -> Graph {
+        return [&jobs]() {
+            m3d::JobSystem::Counter counter;
+            for (uint32_t chain = 0; chain < 64; ++chain) {
+                jobs.Run([&jobs, &counter]() { chainLink(jobs, counter, 512); }, &counter);
+            }
+            jobs.WaitFor(counter);
+        };
+    });
+}
+BENCHMARK(BM_Chains)->Apply(workerRange);
+
+static void forkJoin(m3d::JobSystem& jobs, uint32_t depth)
+{
+    spin(256);
+    if (depth == 0) {
+        return;
+    }
+    m3d::JobSystem::Counter children;
+    jobs.Run([&jobs, depth]() { forkJoin(jobs, depth - 1); }, &children);
+    jobs.Run([&jobs, depth]() { forkJoin(jobs, depth - 1); }, &children);
+    jobs.WaitFor(children);
+}
+
+static void BM_ForkJoin(benchmark::State& state)
+{
+    runGraph(state, [](m3d::JobSystem& jobs) -> Graph {
+        return [&jobs]() {
+            m3d::JobSystem::Counter root;
+            jobs.Run([&jobs]() { forkJoin(jobs, 12); }, &root);
+            jobs.WaitFor(root);
+        };
+    });
+}
+BENCHMARK(BM_ForkJoin)->Apply(workerRange);
+
+// UV sphere of unit radius with segments around and segments / 2 rings in one slice, as an import fills it
+static m3d::Mesh sphereMesh(uint32_t segments)
+{
+    const uint32_t rings = std::max<uint32_t>(segments / 2, 2);
+    const float pi = 3.14159265f;
+
+    m3d::Mesh mesh;
+    mesh.name = m3d::StringId("sphere");
+    for (uint32_t r = 0; r <= rings; ++r) {
+        const float theta = pi * r / rings;
+        for (uint32_t s = 0; s <= segments; ++s) {
+            const float phi = 2.0f * pi * s / segments;
+            const float normal[3] = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+            mesh.vertices.insert(mesh.vertices.end(), { normal[0], normal[1], normal[2], 1.0f });
+            mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+            mesh.uvs.insert(mesh.uvs.end(), { static_cast<float>(s) / segments, static_cast<float>(r) / rings });
+        }
+    }
+    for (uint32_t ring = 0; ring < rings; ++ring) {
+        for (uint32_t s = 0; s < segments; ++s) {
+            const uint32_t a = ring * (segments + 1) + s;
+            const uint32_t b = a + segments + 1;
+            mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+    mesh.slices.push_back(m3d::Mesh::Slice(0, static_cast<int>(mesh.indices.size() / 3)));
+    mesh.materialIds.push_back(0);
+    return mesh;
+}
+
+static void BM_MeshBuild(benchmark::State& state)
+{
+    const m3d::Mesh sphere = sphereMesh(96);
+    std::vector<m3d::Mesh> meshes(64);
+    runGraph(state, [&sphere, &meshes](m3d::JobSystem& jobs) -> Graph {
+        return [&jobs, &sphere, &meshes]() {
+            m3d::JobSystem::Counter counter;
+            for (auto& mesh : meshes) {
+                // the copy stands in for reading the FBX mesh
+                jobs.Run([&sphere, &mesh]() {
+                    mesh = sphere;
+                    mesh.build();
+                }, &counter);
+            }
+            jobs.WaitFor(counter);
+        };
+    });
+}
+BENCHMARK(BM_MeshBuild)->Apply(workerRange);
+
+// Joints in a binary tree, each with a second of random rotations at 30 frames per second
+struct Rig {
+    std::vector<m3d::animation::Joint> joints;
+    m3d::animation::Skeleton skeleton;
+    m3d::animation::AnimationClip clip;
+
+    explicit Rig(uint32_t jointCount)
+        : joints(jointCount)
+    {
+        for (uint32_t j = 0; j < jointCount; ++j) {
+            joints[j].invBindPose.SetIdentity();
+            joints[j].name = "joint";
+            joints[j].parent = j == 0 ? m3d::animation::NoParent : static_cast<uint8_t>((j - 1) / 2);
+            joints[j].cullLod = 0;
+        }
+        skeleton.jointCount = jointCount;
+        skeleton.joint = joints.data();
+
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> angle(-0.5f, 0.5f);
+        const uint32_t frameCount = 30;
+        std::vector<m3d::animation::JointPose> frames(frameCount * jointCount);
+        for (auto& pose : frames) {
+            pose.rotation = m3d::math::Quaternion(m3d::math::Vector3(0.0f, 1.0f, 0.0f), angle(random));
+            pose.translation = m3d::math::Vector3(0.0f, 1.0f, 0.0f);
+            pose.scale = 1.0f;
+        }
+        clip = m3d::animation::AnimationClip::Compress(frames, jointCount, 30.0f);
+    }
+};
+
+static void BM_Animation(benchmark::State& state)
+{
+    const Rig rig(64);
+    std::vector<m3d::AnimationScheduler::Character> characters(2048);
+    for (uint32_t c = 0; c < characters.size(); ++c) {
+        m3d::AnimationScheduler::Character& character = characters[c];
+        character.skeleton = &rig.skeleton;
+        // staggered so the characters sample different keys
+        character.layers.push_back({ &rig.clip, c * 0.01f, 1.0f, true, nullptr });
+        character.world.SetIdentity();
+    }
+    // the scheduler keeps its scratch from frame to frame, as the renderer's
+    struct Scheduler {
+        explicit Scheduler(m3d::JobSystem& jobs)
+            : pool(jobs)
+            , scheduler(pool)
+        {
+        }
+        m3d::ThreadPool pool;
+        m3d::AnimationScheduler scheduler;
+    };
+    runGraph(state, [&characters](m3d::JobSystem& jobs) -> Graph {
+        std::shared_ptr<Scheduler> animation = std::make_shared<Scheduler>(jobs);
+        return [animation, &characters]() {
+            for (auto& character : characters) {
+                character.layers[0].time += 1.0f / 60.0f;
+            }
+            animation->scheduler.Run(characters, nullptr);
+            animation->scheduler.Wait();
+        };
+    });
+}
+BENCHMARK(BM_Animation)->Apply(workerRange);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,122 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Scene manifest JSON to SScene, ParseSceneManifest against the flatbuffers parser flatc uses.
+//   m3d_bench_manifest --benchmark_filter=/65536
+// Run from the repository root, the flatbuffers parser reads data/schema/scene.fbs. The manifests
+// are written as scene_data.json is, one field per line, with n models of distinct names and
+// transforms; the schema is parsed outside the timed loop.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "../../data/schema/scene_generated.h"
+#include "File.hpp"
+#include "SceneManifest.hpp"
+#include "flatbuffers/idl.h"
+
+static const char* SchemaPath = "data/schema/scene.fbs";
+
+static void appendVector(std::string& json, const char* name, float x, float y, float z, bool last)
+{
+    char text[256];
+    snprintf(text, sizeof(text),
+        "                %s: {\n"
+        "                    x: %g,\n"
+        "                    y: %g,\n"
+        "                    z: %g\n"
+        "                }%s\n",
+        name, x, y, z, last ? "" : ",");
+    json += text;
+}
+
+static std::string manifest(uint32_t models)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+    std::uniform_int_distribution<int> degrees(0, 359);
+    std::string json = "{\n    models: [\n";
+    for (uint32_t m = 0; m < models; ++m) {
+        char name[128];
+        snprintf(name, sizeof(name), "        {\n            name: \"models/district_%u/building_%u.fbx\",\n            transform: {\n", m / 64, m);
+        json += name;
+        appendVector(json, "position", position(random), 0.0f, position(random), false);
+        appendVector(json, "rotation", 0.0f, static_cast<float>(degrees(random)), 0.0f, false);
+        appendVector(json, "scale", 1.0f, 1.0f, 1.0f, true);
+        json += m + 1 < models ? "            }\n        },\n" : "            }\n        }\n";
+    }
+    json += "    ]\n}\n";
+    return json;
+}
+
+static void manifestRange(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->RangeMultiplier(16)->Range(16, 64 << 10)->Unit(benchmark::kMillisecond);
+}
+
+static void BM_FlatbuffersParser(benchmark::State& state)
+{
+    std::string schema;
+    if (!m3d::file::readBinary(SchemaPath, schema)) {
+        state.SkipWithError("data/schema/scene.fbs not found, run from the repository root");
+        return;
+    }
+    const std::string json = manifest(static_cast<uint32_t>(state.range(0)));
+    for (auto _ : state) {
+        state.PauseTiming();
+        flatbuffers::Parser parser;
+        const bool schemaParsed = parser.Parse(schema.c_str());
+        state.ResumeTiming();
+        if (!schemaParsed || !parser.Parse(json.c_str())) {
+            state.SkipWithError(parser.error_.c_str());
+            return;
+        }
+        benchmark::DoNotOptimize(parser.builder_.GetBufferPointer());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(json.size()));
+}
+BENCHMARK(BM_FlatbuffersParser)->Apply(manifestRange);
+
+static void BM_ParseSceneManifest(benchmark::State& state)
+{
+    const std::string json = manifest(static_cast<uint32_t>(state.range(0)));
+    for (auto _ : state) {
+        flatbuffers::FlatBufferBuilder builder(m3d::SceneManifestBufferSize(json.size()));
+        std::string error;
+        if (!m3d::ParseSceneManifest(json.data(), json.size(), builder, &error)) {
+            state.SkipWithError(error.c_str());
+            return;
+        }
+        benchmark::DoNotOptimize(builder.GetBufferPointer());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(json.size()));
+
+    // both parsers end up with the same models
+    flatbuffers::FlatBufferBuilder builder(m3d::SceneManifestBufferSize(json.size()));
+    m3d::ParseSceneManifest(json.data(), json.size(), builder);
+    const m3d::schema::SScene* scene = m3d::schema::GetSScene(builder.GetBufferPointer());
+    std::string schema;
+    flatbuffers::Parser parser;
+    if (m3d::file::readBinary(SchemaPath, schema) && parser.Parse(schema.c_str()) && parser.Parse(json.c_str())) {
+        const m3d::schema::SScene* reference = m3d::schema::GetSScene(parser.builder_.GetBufferPointer());
+        bool same = scene->models()->size() == reference->models()->size();
+        for (uint32_t m = 0; same && m < scene->models()->size(); ++m) {
+            const m3d::schema::SModel* model = scene->models()->Get(m);
+            const m3d::schema::SModel* expected = reference->models()->Get(m);
+            same = model->name()->str() == expected->name()->str()
+                && memcmp(model->transform(), expected->transform(), sizeof(m3d::schema::STransform)) == 0;
+        }
+        if (!same) {
+            state.SkipWithError("the SScene differs from the flatbuffers parser's");
+        }
+    }
+}
+BENCHMARK(BM_ParseSceneManifest)->Apply(manifestRange);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,213 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+// VK_KHR_acceleration_structure postdates the vulkan headers
+#ifndef VK_KHR_acceleration_structure
+VK_DEFINE_NON_DISPATCHABLE_HANDLE(VkAccelerationStructureKHR)
+#endif
+
+namespace m3d {
+class CommandBuffer;
+class ResourceTrash;
+class Scene;
+
+/*
+ * Hardware ray tracing acceleration structures of a scene, for ray queries
+ * from any shader stage: shadows traced in the shading pass and picking.
+ *
+ * Every resident mesh gets a bottom level structure of its LOD 0 triangles.
+ * AddMeshes builds the ones still missing in one batch, queries their
+ * compacted sizes and copies them into structures that size, usually less
+ * than half of what the build needed; the build input and scratch are freed
+ * right after, RemoveMesh destroys them. Instances place those in one top level structure per frame
+ * slot, whose instance buffer BeginFrame rewrites from Scene::instances and
+ * the transform store's worlds.
+ *
+ * A slot's top level structure is refit (an update build) when it holds the
+ * same instances of the same meshes as when it was last built, which is what
+ * happens while only transforms change, and rebuilt otherwise. Refits keep
+ * the tree of the original build and trace slower the further things moved,
+ * every MaxRefits refits it is rebuilt anyway.
+ *
+ * The builds are recorded into a command buffer of the compute family per
+ * slot (GetComputeCommandBuffer), submitted ahead of the frame like
+ * GpuSkinning's: beside the frames in flight on an async compute queue, the
+ * frame waits for it. Without one the command buffer goes to the graphics
+ * queue and ends in a barrier to every later command. Buffers either queue
+ * reads are created concurrent across both families.
+ *
+ * Acceleration structures, their scratch and build input count towards
+ * MemoryAllocator::Category::AccelerationStructure; GetStats has the work of
+ * the builds.
+ *
+ * Needs a Vulkan 1.1 device with every extension of ExtensionNames and the
+ * accelerationStructure, bufferDeviceAddress and rayQuery features, and
+ * MemoryAllocator::EnableDeviceAddress before anything was allocated.
+ */
+class AccelerationStructures {
+public:
+    static const uint32_t InvalidInstance = 0xFFFFFFFF;
+    static const uint32_t ExtensionCount = 7;
+    static const char* const ExtensionNames[ExtensionCount];
+    // consecutive refits before a slot's top level structure is rebuilt
+    static const uint32_t MaxRefits = 64;
+
+    // the device has every extension and feature, the instance needs VK_KHR_get_physical_device_properties2
+    static bool IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+    // pNext of the vk::DeviceCreateInfo, enables the features; next is chained behind it
+    static const void* GetFeatureChain(const void* next = nullptr);
+
+    struct BuildStats {
+        // bottom level structures alive and their triangles
+        uint32_t meshes = 0;
+        uint64_t triangles = 0;
+        // of the bottom level structures as built and once compacted
+        vk::DeviceSize builtBytes = 0;
+        vk::DeviceSize compactedBytes = 0;
+        // wall clock of every AddMeshes batch, build, compaction and the waits for both
+        double meshBuildMs = 0.0;
+        // of the last BeginFrame
+        uint32_t instances = 0;
+        // top level builds so far
+        uint32_t rebuilds = 0;
+        uint32_t refits = 0;
+        // GPU time of the last completed top level build or refit, 0 when the compute family has no timestamps
+        double instanceBuildMs = 0.0;
+    };
+
+    // slotCount like Pipeline's frame slots, maxInstances per slot. Builds the top level structures on the queues
+    // of computeQueueFamily when it differs from graphicsQueueFamily
+    AccelerationStructures(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, uint32_t slotCount, uint32_t maxInstances,
+        uint32_t graphicsQueueFamily, uint32_t computeQueueFamily);
+    ~AccelerationStructures();
+
+    // Build the bottom level structures of scene's resident meshes without one, blocks until they are compacted.
+    // Returns how many were built
+    uint32_t AddMeshes(const Scene& scene);
+    // Destroy the bottom level structure of a mesh leaving the scene, through trash: frames in flight may still
+    // trace it
+    void RemoveMesh(uint32_t meshID, ResourceTrash& trash);
+
+    // Trace a ray from origin along direction, up to maxDistance, against the next frame's instances. callback gets
+    // the nearest instance hit and its distance, InvalidInstance and maxDistance when nothing is, in the BeginFrame
+    // reusing the slot; a pick still queued is replaced
+    void Pick(const float origin[3], const float direction[3], float maxDistance, std::function<void(uint32_t instanceID, float distance)> callback);
+
+    // Rewrite slot's instances from scene and record their build, no submitted frame may still read the slot.
+    // The worlds of the transform store must be up to date
+    void BeginFrame(uint32_t slot, const Scene& scene);
+    bool IsAsync() const { return computeQueueFamily != graphicsQueueFamily; }
+    // the builds of slot, submit to the compute queue once BeginFrame of slot returned and before the frame
+    vk::CommandBuffer GetComputeCommandBuffer(uint32_t slot) const { return slots[slot].compute; }
+
+    // binding 0 the slot's top level structure for fragment and compute shaders, data/shaders/camera/raytrace.glsl
+    // declares it; binding 1 is picking's
+    vk::DescriptorSetLayout GetDescriptorSetLayout() const { return setLayout; }
+    vk::DescriptorSet GetDescriptorSet(uint32_t slot) const { return slots[slot].set; }
+
+    BuildStats GetStats() const { return stats; }
+
+private:
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+        uint64_t address = 0;
+    };
+
+    struct MeshStructure {
+        VkAccelerationStructureKHR structure = VK_NULL_HANDLE;
+        Buffer storage;
+        uint64_t address = 0;
+        uint32_t triangles = 0;
+    };
+
+    // std430 layout of pick.comp's ray and hit
+    struct GpuPick {
+        float origin[4];
+        // w the distance to trace up to
+        float direction[4];
+        uint32_t instance;
+        float distance;
+        uint32_t pad[2];
+    };
+
+    struct Slot {
+        VkAccelerationStructureKHR structure = VK_NULL_HANDLE;
+        Buffer storage;
+        Buffer scratch;
+        // maxInstances VkAccelerationStructureInstanceKHR, host visible
+        Buffer instances;
+        Buffer pick;
+        vk::DescriptorSet set;
+        vk::CommandBuffer compute;
+        vk::QueryPool timestamps;
+        // scene instance and mesh ID of every instance of the last build, the structure's instance index is
+        // the position
+        std::vector<uint32_t> instanceIDs;
+        std::vector<uint32_t> instanceMeshes;
+        uint32_t refits = 0;
+        bool built = false;
+        bool timed = false;
+        // picked by the last frame of the slot
+        std::function<void(uint32_t instanceID, float distance)> pickCallback;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer, bool shared = false);
+    void destroyBuffer(Buffer& buffer);
+    void loadEntryPoints();
+    void createPipeline();
+    void writeDescriptors();
+    // the previous use of slot: its pick and its build time
+    void retire(Slot& slot);
+    void recordInstanceBuild(Slot& slot, uint32_t instanceCount, bool refit);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    uint32_t maxInstances;
+    uint32_t graphicsQueueFamily;
+    uint32_t computeQueueFamily;
+    float timestampPeriod;
+    uint64_t timestampMask;
+
+    // by scene mesh ID
+    std::unordered_map<uint32_t, MeshStructure> meshes;
+    std::vector<Slot> slots;
+    vk::DeviceSize instanceStructureSize;
+    vk::DeviceSize instanceScratchSize;
+
+    GpuPick pendingPick;
+    std::function<void(uint32_t instanceID, float distance)> pendingPickCallback;
+
+    vk::CommandPool computePool;
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pickPipeline;
+
+    BuildStats stats;
+
+    PFN_vkVoidFunction createStructure = nullptr;
+    PFN_vkVoidFunction destroyStructure = nullptr;
+    PFN_vkVoidFunction getBuildSizes = nullptr;
+    PFN_vkVoidFunction cmdBuild = nullptr;
+    PFN_vkVoidFunction cmdCopy = nullptr;
+    PFN_vkVoidFunction cmdWriteProperties = nullptr;
+    PFN_vkVoidFunction getStructureAddress = nullptr;
+    PFN_vkVoidFunction getBufferAddress = nullptr;
+};
+}
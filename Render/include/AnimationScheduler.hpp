@@ -0,0 +1,123 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "GpuSkinning.hpp"
+#include "Matrix.h"
+#include "SkeletalAnimation.hpp"
+
+namespace m3d {
+class ThreadPool;
+
+/*
+ * Evaluates many characters per frame as a two level job graph:
+ *
+ *   character jobs   sample every layer, blend, LocalToModel, world * model
+ *                    and BuildPalette, each batch of characters is one task
+ *   palette upload   runs on whichever worker finishes the last batch and
+ *                    adds every character's palette to GpuSkinning
+ *
+ * Characters share nothing while they are evaluated, so batches go to the
+ * pool in any order and idle workers keep taking the next one until the
+ * queue is empty. The upload depends on all of them and keeps the instance
+ * order of the character list, whatever order the batches ran in.
+ *
+ * Distant characters are cheaper: the screen size of a character picks an
+ * LodTier, which samples its clips every updateInterval frames only and at a
+ * skeleton LOD that leaves out the joints culled there. Characters of a tier
+ * update on staggered frames, and in between the model space palettes of their
+ * last two updates are interpolated, a tier's motion lagging one interval
+ * behind. Characters that are not visible are neither evaluated nor skinned.
+ */
+class AnimationScheduler {
+public:
+    struct Layer {
+        const animation::AnimationClip* clip;
+        float time;
+        float weight;
+        bool loop;
+        // optional per joint weights, nullptr for all joints
+        const float* jointWeights;
+    };
+
+    struct Character {
+        const animation::Skeleton* skeleton;
+        std::vector<Layer> layers;
+        m3d::math::Matrix4x4 world;
+        // skinned with the palette when set, otherwise only the palette is built
+        const GpuSkinning::SkinnedMesh* mesh = nullptr;
+        // mesh->morphTargetCount weights of its morph targets, empty to leave them out
+        std::vector<float> morphWeights;
+        // projected height in pixels, picks the LOD tier
+        float screenSize = 1.0e6f;
+        // false when culled, the palette and vertexOffset are then left unchanged / invalid
+        bool visible = true;
+
+        // written by Run
+        std::vector<m3d::math::Matrix4x3> palette;
+        // GpuSkinning::InvalidOffset without a mesh or when the slot was full
+        uint32_t vertexOffset = GpuSkinning::InvalidOffset;
+    };
+
+    struct LodTier {
+        // characters at least this many pixels tall, tiers are sorted from the largest
+        float minScreenSize;
+        // sample the clips every updateInterval frames, 1 for each frame
+        uint32_t updateInterval;
+        // passed to SampleClip, see animation::Joint::cullLod
+        uint32_t skeletonLod;
+    };
+
+    // batchSize characters per task, enough to amortize the queue's lock
+    explicit AnimationScheduler(ThreadPool& pool, uint32_t batchSize = 8);
+    ~AnimationScheduler();
+
+    // Replace the default tiers, the last one takes every character smaller than the others
+    void SetLodTiers(const std::vector<LodTier>& tiers);
+
+    // Start evaluating characters, they must stay alive and unchanged until Wait returns.
+    // skinning may be null, its current slot receives the instances
+    void Run(std::vector<Character>& characters, GpuSkinning* skinning);
+    // Block until the palettes are built and uploaded
+    void Wait();
+
+private:
+    // per character scratch, kept between frames to avoid reallocating
+    struct Scratch {
+        std::vector<animation::SkeletonPose> layerPoses;
+        animation::SkeletonPose blended;
+        std::vector<m3d::math::Matrix4x3> models;
+        std::vector<animation::BlendLayer> blendLayers;
+        // model space palettes of the two last updates, interpolated from previous to current
+        std::vector<m3d::math::Matrix4x3> previous;
+        std::vector<m3d::math::Matrix4x3> current;
+        const animation::Skeleton* skeleton = nullptr;
+        // frames since the last update
+        uint32_t age = 0;
+    };
+
+    const LodTier& tierOf(const Character& character) const;
+    void evaluate(Character& character, Scratch& scratch, uint32_t index);
+    void sample(const Character& character, Scratch& scratch, uint32_t skeletonLod);
+    void upload();
+
+private:
+    ThreadPool& pool;
+    uint32_t batchSize;
+    std::vector<Character>* characters;
+    GpuSkinning* skinning;
+    std::vector<Scratch> scratch;
+    std::vector<LodTier> tiers;
+    uint32_t frame = 0;
+    // batches still running, the one that brings it to zero uploads
+    std::atomic<uint32_t> remaining;
+};
+}
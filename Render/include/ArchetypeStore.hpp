@@ -0,0 +1,214 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "JobSystem.hpp"
+
+namespace m3d {
+
+/*
+ * Entities stored by archetype, the set of component types they have.
+ *
+ * Entities of one archetype live in fixed size chunks, each component in an
+ * array of its own inside the chunk, so a system that reads a few components
+ * of every entity walks them linearly instead of following ids into separate
+ * freelists. A chunk is the unit of work: ForEach hands the arrays of one
+ * chunk to its callback at a time, ParallelForEach runs a job per chunk on a
+ * JobSystem.
+ *
+ * Components are plain data of at most 64 byte alignment, copied with memcpy
+ * when an entity moves, and never constructed or destroyed; any trivially
+ * copyable struct is one. Up to MaxComponents types exist per program, each
+ * gets its index the first time a store uses it.
+ *
+ * Entity ids hold a slot and a reuse count like chunked_freelist ids, an id
+ * stays valid while its entity moves between chunks and archetypes. Adding or
+ * removing components and destroying entities moves other entities of the
+ * archetype to keep the chunks dense, so pointers from Get only last until the
+ * next such change. No structural change while a ForEach runs.
+ */
+class ArchetypeStore {
+public:
+    typedef uint32_t Entity;
+    typedef uint64_t Mask;
+
+    static const Entity InvalidEntity = 0xFFFFFFFF;
+    static const uint32_t MaxComponents = 64;
+    static const size_t ChunkBytes = 16 * 1024;
+
+    ArchetypeStore() = default;
+    ArchetypeStore(const ArchetypeStore&) = delete;
+    ArchetypeStore& operator=(const ArchetypeStore&) = delete;
+
+    template<class T>
+    static uint32_t ComponentIndex()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "components are moved with memcpy");
+        static_assert(alignof(T) <= 64, "component arrays are 64 byte aligned");
+        static const uint32_t index = registerComponent(sizeof(T));
+        return index;
+    }
+
+    template<class... Components>
+    static Mask MaskOf()
+    {
+        Mask mask = 0;
+        int expand[] = { 0, (mask |= Mask(1) << ComponentIndex<Components>(), 0)... };
+        (void)expand;
+        return mask;
+    }
+
+    // Entity with these components, of the given values
+    template<class... Components>
+    Entity Create(const Components&... values)
+    {
+        const Entity entity = create(MaskOf<Components...>());
+        int expand[] = { 0, (new (component(entity, ComponentIndex<Components>())) Components(values), 0)... };
+        (void)expand;
+        return entity;
+    }
+    void Destroy(Entity entity);
+    bool Alive(Entity entity) const;
+
+    // null when entity does not have T
+    template<class T>
+    T* Get(Entity entity)
+    {
+        return static_cast<T*>(component(entity, ComponentIndex<T>()));
+    }
+    template<class T>
+    bool Has(Entity entity) const
+    {
+        return (maskOf(entity) & (Mask(1) << ComponentIndex<T>())) != 0;
+    }
+    // Moves entity to the archetype with T as well, or overwrites its T
+    template<class T>
+    T& Add(Entity entity, const T& value)
+    {
+        const uint32_t index = ComponentIndex<T>();
+        move(entity, maskOf(entity) | (Mask(1) << index));
+        return *new (component(entity, index)) T(value);
+    }
+    template<class T>
+    void Remove(Entity entity)
+    {
+        move(entity, maskOf(entity) & ~(Mask(1) << ComponentIndex<T>()));
+    }
+
+    // f(count, entities, Components*... arrays) for every chunk of an archetype that has at least Components, in
+    // archetype and chunk order. f may write the components, not change the store
+    template<class... Components, class F>
+    void ForEach(F f)
+    {
+        const Mask mask = MaskOf<Components...>();
+        for (const std::unique_ptr<Archetype>& archetype : archetypes) {
+            if ((archetype->mask & mask) != mask) {
+                continue;
+            }
+            for (Chunk& chunk : archetype->chunks) {
+                f(chunk.count, entities(*archetype, chunk), array<Components>(*archetype, chunk)...);
+            }
+        }
+    }
+
+    // ForEach with a job per chunk on jobs, returns once all of them ran; the calling thread runs jobs meanwhile.
+    // f runs concurrently on different chunks
+    template<class... Components, class F>
+    void ParallelForEach(JobSystem& jobs, F f)
+    {
+        const Mask mask = MaskOf<Components...>();
+        JobSystem::Counter counter;
+        for (const std::unique_ptr<Archetype>& archetype : archetypes) {
+            if ((archetype->mask & mask) != mask) {
+                continue;
+            }
+            Archetype* owner = archetype.get();
+            for (Chunk& chunk : archetype->chunks) {
+                Chunk* run = &chunk;
+                jobs.Run([owner, run, &f]() { f(run->count, entities(*owner, *run), array<Components>(*owner, *run)...); }, &counter);
+            }
+        }
+        jobs.WaitFor(counter);
+    }
+
+    // Entities, of every archetype
+    size_t Size() const { return size; }
+    size_t ArchetypeCount() const { return archetypes.size(); }
+    size_t ChunkCount() const;
+    // Destroy every entity, archetypes and their chunks stay for reuse
+    void Clear();
+
+private:
+    struct Chunk {
+        std::unique_ptr<uint8_t[]> memory;
+        // memory, 64 byte aligned
+        uint8_t* data;
+        uint32_t count;
+    };
+    struct Archetype {
+        Mask mask;
+        // entities per chunk
+        uint32_t capacity;
+        // indices of the components in mask, ascending
+        std::vector<uint32_t> components;
+        // byte offset of every component's array in a chunk and the component's size, by component index
+        uint32_t offsets[MaxComponents];
+        uint32_t sizes[MaxComponents];
+        uint32_t entityOffset;
+        // full but for the last, empty ones are dropped
+        std::vector<Chunk> chunks;
+        // chunks of a Clear, handed out again before new ones are allocated
+        std::vector<Chunk> spare;
+    };
+    struct Record {
+        uint32_t archetype;
+        // row in the archetype, chunk row / capacity
+        uint32_t row;
+        uint32_t generation;
+        bool alive;
+    };
+
+    static uint32_t registerComponent(size_t size);
+
+    Entity create(Mask mask);
+    void* component(Entity entity, uint32_t index);
+    Mask maskOf(Entity entity) const;
+    void move(Entity entity, Mask mask);
+    uint32_t archetypeOf(Mask mask);
+    // a row at the end of archetype for slot
+    uint32_t push(uint32_t archetype, uint32_t slot);
+    // fill the hole at row with the archetype's last entity
+    void pop(uint32_t archetype, uint32_t row);
+    const Record* record(Entity entity) const;
+    static uint8_t* rowData(const Archetype& archetype, uint32_t row, uint32_t index);
+
+    static Entity* entities(const Archetype& archetype, const Chunk& chunk)
+    {
+        return reinterpret_cast<Entity*>(chunk.data + archetype.entityOffset);
+    }
+    template<class T>
+    static T* array(const Archetype& archetype, const Chunk& chunk)
+    {
+        return reinterpret_cast<T*>(chunk.data + archetype.offsets[ComponentIndex<T>()]);
+    }
+
+private:
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<Mask, uint32_t> archetypeIndices;
+    std::vector<Record> records;
+    std::vector<uint32_t> freeSlots;
+    size_t size = 0;
+};
+}
@@ -0,0 +1,134 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "Matrix.h"
+#include "SIMD_Batch.h"
+
+namespace m3d {
+
+// Axis aligned box, empty while lower > upper
+struct Aabb {
+    float lower[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float upper[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    bool Empty() const { return lower[0] > upper[0]; }
+
+    void Expand(const float point[3])
+    {
+        for (int c = 0; c < 3; ++c) {
+            lower[c] = std::min(lower[c], point[c]);
+            upper[c] = std::max(upper[c], point[c]);
+        }
+    }
+
+    void Expand(const Aabb& other)
+    {
+        for (int c = 0; c < 3; ++c) {
+            lower[c] = std::min(lower[c], other.lower[c]);
+            upper[c] = std::max(upper[c], other.upper[c]);
+        }
+    }
+
+    float Center(int axis) const { return (lower[axis] + upper[axis]) * 0.5f; }
+
+    float SurfaceArea() const
+    {
+        if (Empty()) {
+            return 0.0f;
+        }
+        float dx = upper[0] - lower[0], dy = upper[1] - lower[1], dz = upper[2] - lower[2];
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    bool Overlaps(const Aabb& other) const
+    {
+        for (int c = 0; c < 3; ++c) {
+            if (lower[c] > other.upper[c] || upper[c] < other.lower[c]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Box around the transformed box (Arvo), world is column vector like Transform::ToMatrix
+    Aabb Transformed(const m3d::math::Matrix4x4& world) const
+    {
+        Aabb result;
+        if (Empty()) {
+            return result;
+        }
+        for (int i = 0; i < 3; ++i) {
+            result.lower[i] = result.upper[i] = world.m[i][3];
+            for (int j = 0; j < 3; ++j) {
+                float a = world.m[i][j] * lower[j];
+                float b = world.m[i][j] * upper[j];
+                result.lower[i] += std::min(a, b);
+                result.upper[i] += std::max(a, b);
+            }
+        }
+        return result;
+    }
+
+    // Slab test against origin + t * direction, invDirection is 1 / direction per axis
+    bool Intersects(const float origin[3], const float invDirection[3], float maxT, float* hitT) const
+    {
+        float tNear = 0.0f;
+        float tFar = maxT;
+        for (int c = 0; c < 3; ++c) {
+            float t0 = (lower[c] - origin[c]) * invDirection[c];
+            float t1 = (upper[c] - origin[c]) * invDirection[c];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        if (tNear > tFar) {
+            return false;
+        }
+        if (hitT) {
+            *hitT = tNear;
+        }
+        return true;
+    }
+};
+
+// Six normalised planes, inside is dot(plane.xyz, p) + plane.w >= 0; m3d::math::FrustumCullArray tests
+// many boxes at once against them
+struct Frustum : m3d::math::Frustum {
+    Frustum() {}
+    Frustum(const m3d::math::Frustum& planes)
+        : m3d::math::Frustum(planes)
+    {
+    }
+
+    // Gribb/Hartmann planes for clip = viewProjection * p, Vulkan clips z to [0, w]
+    static Frustum FromViewProjection(const m3d::math::Matrix4x4& viewProjection)
+    {
+        return m3d::math::Frustum::FromViewProjection(viewProjection);
+    }
+
+    // Conservative: boxes outside a single plane are rejected, corner cases pass
+    bool Intersects(const Aabb& box) const
+    {
+        for (int i = 0; i < PlaneCount; ++i) {
+            const float* plane = planes[i];
+            // corner furthest along the plane normal
+            float distance = plane[3];
+            for (int c = 0; c < 3; ++c) {
+                distance += plane[c] * (plane[c] >= 0.0f ? box.upper[c] : box.lower[c]);
+            }
+            if (distance < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+}
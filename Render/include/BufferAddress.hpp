@@ -0,0 +1,42 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * 64 bit GPU addresses of buffers with VK_KHR_buffer_device_address, which
+ * shaders dereference through GL_EXT_buffer_reference without a descriptor.
+ *
+ * A buffer needs Usage at creation and memory allocated with the flags of
+ * GetAllocateFlags, MemoryAllocator::EnableDeviceAddress adds them to its
+ * blocks. Get is the address of the buffer's first byte, it stays the same
+ * for the buffer's lifetime.
+ *
+ * AccelerationStructures enables the same feature, a device created with its
+ * chain has addresses already and must not get GetFeatureChain again.
+ */
+class BufferAddress {
+public:
+    static const char* const ExtensionName;
+    // VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+    static const vk::BufferUsageFlagBits Usage;
+
+    // a Vulkan 1.1 device with ExtensionName and the bufferDeviceAddress feature, the instance needs
+    // VK_KHR_get_physical_device_properties2
+    static bool IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+    // pNext of the vk::DeviceCreateInfo, enables the feature; next is chained behind it
+    static const void* GetFeatureChain(const void* next = nullptr);
+    // pNext of a vk::MemoryAllocateInfo whose memory backs a buffer of Usage. Immutable, any thread
+    static const void* GetAllocateFlags();
+    // of a buffer of Usage bound to its memory; 0 without the entry point, the device lacks ExtensionName
+    static uint64_t Get(vk::Device device, vk::Buffer buffer);
+};
+}
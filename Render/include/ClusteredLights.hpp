@@ -0,0 +1,110 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "Matrix.h"
+
+namespace m3d {
+class Scene;
+
+/*
+ * Clustered forward lighting of the Scene lights.
+ *
+ * The view frustum is split into GridX x GridY tiles in NDC and GridZ slices
+ * of exponentially growing view depth. RecordCluster runs before the render
+ * pass: one invocation per cluster tests the bounding sphere of every point
+ * and spot light against the cluster's view space box and lists the indices
+ * of the ones that touch it, up to MaxLightsPerCluster. The fragment shader
+ * looks up its cluster from its NDC position and view depth and only shades
+ * with the lights listed there. Directional lights touch every cluster, they
+ * are kept ahead of the others and applied everywhere instead.
+ *
+ * Bindings of the lit indirect fragment shader, see Pipeline::SetClusteredLights:
+ *   binding 5 : cluster parameters (GetParamsDescriptor)
+ *   binding 6 : lights (GetLightDescriptor)
+ *   binding 7 : per cluster light count, then per cluster light indices (GetClusterDescriptor)
+ */
+class ClusteredLights {
+public:
+    static const uint32_t GroupSize = 64;
+    static const uint32_t GridX = 16;
+    static const uint32_t GridY = 9;
+    static const uint32_t GridZ = 24;
+    static const uint32_t ClusterCount = GridX * GridY * GridZ;
+    static const uint32_t MaxLightsPerCluster = 128;
+    static const uint32_t MaxLights = 1024;
+
+    ClusteredLights(vk::Device&, vk::PhysicalDevice&);
+    ~ClusteredLights();
+
+    // Lights of scene where its transforms put them, clustered for the camera of view and projection.
+    // Lights past MaxLights are dropped. The parameter and light buffers must not be in use by the GPU.
+    void Update(Scene& scene, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+
+    // Outside of a render pass, before the draws that shade with the clusters.
+    void RecordCluster(vk::CommandBuffer cmd);
+
+    vk::DescriptorBufferInfo GetParamsDescriptor() const { return vk::DescriptorBufferInfo(params.buffer, 0, sizeof(ClusterParams)); }
+    vk::DescriptorBufferInfo GetLightDescriptor() const { return vk::DescriptorBufferInfo(lights.buffer, 0, VK_WHOLE_SIZE); }
+    vk::DescriptorBufferInfo GetClusterDescriptor() const { return vk::DescriptorBufferInfo(clusters.buffer, 0, VK_WHOLE_SIZE); }
+    // of the last Update, directional ones included
+    uint32_t GetLightCount() const { return mappedParams->lightCount; }
+
+private:
+    // std140 layout of the light_cluster.comp and indirect_clustered.frag parameters
+    struct ClusterParams {
+        m3d::math::Matrix4x4 viewMatrix;
+        // m[0][0], m[1][1], m[0][2], m[1][2] of the projection, view x = (ndc x + m[0][2]) * depth / m[0][0]
+        float unproject[4];
+        // near, far, GridZ / log(far / near), log(near) * GridZ / log(far / near)
+        float depth[4];
+        float ambient[4];
+        uint32_t grid[4];
+        uint32_t lightCount;
+        uint32_t directionalCount;
+        uint32_t pad[2];
+    };
+
+    // std430 layout of one light, world space
+    struct GpuLight {
+        // xyz position, w range
+        float position[4];
+        // rgb color * intensity, w Light::Type
+        float color[4];
+        // xyz unit direction the light shines in, w cos of the outer cone
+        float direction[4];
+        // x cos of the inner cone
+        float cone[4];
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    void createPipeline();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+
+    Buffer params;
+    ClusterParams* mappedParams;
+    Buffer lights;
+    GpuLight* mappedLights;
+    Buffer clusters;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+    vk::DescriptorSet descriptorSet;
+};
+}
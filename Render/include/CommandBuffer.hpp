@@ -5,65 +5,300 @@
 */
 
 #pragma once
+#include <memory>
 #include <vector>
 #include <vulkan/vulkan.hpp>
 
+#include "MemoryAllocator.hpp"
+#include "PerfLint.hpp"
+#include "RenderQueue.hpp"
+
 // TODO: move into namespace ::m3d
 
 namespace m3d {
 class VulkanSwapChain;
+struct Camera;
 class Scene;
 class Pipeline;
+class GeometryArena;
+class FrameArena;
+class IndirectDraws;
+class GpuSkinning;
+class CrowdRenderer;
+class GuiRenderer;
+class ClusteredLights;
+class SoftwareOcclusion;
+class OcclusionQueries;
+class ImpostorRenderer;
+class ParticleSystem;
+class PostProcess;
+class ShadingRate;
+class GpuProfiler;
+class ThreadPool;
+class ResourceTrash;
 
 class CommandBuffer {
 public:
-    CommandBuffer(vk::Device&, vk::PhysicalDevice&, vk::Queue&, VulkanSwapChain&);
+    CommandBuffer(vk::Device&, vk::PhysicalDevice&, vk::Queue&, VulkanSwapChain&, MemoryAllocator&);
     ~CommandBuffer();
 
-    /* frame buffer */
-    void CreateDepthStencil();
+    /* frame buffer, sized to the swapchain extent */
+    // depth and, multisampled, the color attachment, transient when the pipeline does not keep them
+    void CreateDepthStencil(Pipeline&);
     void CreateFramebuffers(Pipeline&);
 
     /* Vertex */
-    void CreateBuffer(vk::BufferUsageFlags, vk::MemoryPropertyFlags, vk::DeviceSize, void* data, vk::Buffer& buffer, vk::DeviceMemory& memory);
-    void CreateVertices(std::vector<float>& vertices, std::vector<uint32_t> &indices);
+    // sharedQueueFamilies: create the buffer in concurrent mode across these families (e.g. transfer + graphics).
+    // memory is suballocated, host visible ones stay mapped at memory.mapped.
+    void CreateBuffer(vk::BufferUsageFlags, vk::MemoryPropertyFlags, vk::DeviceSize, void* data, vk::Buffer& buffer, MemoryAllocator::Allocation& memory,
+        const std::vector<uint32_t>& sharedQueueFamilies = std::vector<uint32_t>(),
+        MemoryAllocator::Strategy strategy = MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category category = MemoryAllocator::Category::Other);
+    // with trash once the frames submitted so far completed, right away otherwise
+    void DestroyBuffer(vk::Buffer buffer, const MemoryAllocator::Allocation& memory, ResourceTrash* trash = nullptr);
+    MemoryAllocator& GetAllocator() { return allocator; }
 
+    // One time command buffer of the transient pool, valid until its Flush. Buffers are reused once every
+    // buffer handed out was flushed, the pool is reset as a whole then
     uint32_t Create(vk::CommandBufferLevel level, bool begin);
+    // submit and wait for index, it goes back to the pool
     void Flush(uint32_t index);
-    void Build(Pipeline&);
+    // With indirect set the scene is drawn from its indirect commands instead of per mesh draws.
+    void Build(Pipeline&, Scene&, GeometryArena&, IndirectDraws* indirect = nullptr);
+    // Re-record the draw command buffers, e.g. after more meshes became resident.
+    // The caller makes sure none of them is still pending.
+    void Record(Pipeline&, Scene&, GeometryArena&, IndirectDraws* indirect = nullptr);
+    // Re-record the draw command buffer of image if it was recorded at another render scale, none of its
+    // submissions may be pending. One image at a time, nothing waits for the others
+    void RecordStale(uint32_t image, Pipeline&, Scene&, GeometryArena&, IndirectDraws* indirect = nullptr);
+
+    /* Dynamic resolution */
+    // Before Build: the scene renders into a color target of its own that is scaled up into the swapchain image.
+    // Needs a pipeline whose finalLayout is TRANSFER_SRC_OPTIMAL and a swapchain image that is a TRANSFER_DST,
+    // or the post stack scales it
+    void EnableDynamicResolution() { dynamicResolution = true; }
+    // The scene covers scale of the targets' width and height, from the next per-frame recording on; static
+    // draw command buffers pick it up in RecordStale. 1 without EnableDynamicResolution
+    void SetRenderScale(float scale);
+    float GetRenderScale() const { return renderScale; }
+    // After the swapchain was recreated: retire the old render targets and draw
+    // command buffers through trash and build new ones, frames in flight keep the old ones.
+    void Resize(Pipeline&, Scene&, GeometryArena&, IndirectDraws* indirect, ResourceTrash& trash);
+
+    vk::CommandBuffer& GetCommandBuffer(uint32_t index) { return tempCmdBuffers[index]; }
+
+    /* ID buffer */
+    // Pipeline::Options::idBuffer only, null otherwise. In TRANSFER_SRC_OPTIMAL after every render pass,
+    // the scene covers GetRenderExtent of it
+    vk::Image GetIdImage() const { return idBuffer.image; }
+    vk::Extent2D GetRenderExtent() const { return renderExtent; }
+
+    /* Per-frame recording */
+    // Instances are split across threadCount workers, each recording a secondary
+    // buffer out of its own pool. Pools are kept per frame in flight.
+    void EnableParallelRecording(uint32_t framesInFlight, uint32_t threadCount);
+    // Record the frame into primary, the caller guarantees the frame's previous submission has completed.
+    // The frame's draw lists come from arena. The draws go through a RenderQueue, by pipeline and
+    // material and then front to back from the main camera when the scene has one. Instances outside of the
+    // frustum of the pipeline's camera are left out, without multiview
+    void RecordFrame(uint32_t frameIndex, uint32_t imageIndex, vk::CommandBuffer primary, Pipeline&, Scene&, GeometryArena&, FrameArena& arena);
 
 	std::vector<vk::CommandBuffer>& GetDrawCommandBuffers() { return drawCmdBuffers; }
+    // Scene draws of the last recording, one per mesh slice or indirect command; skinned and GUI draws are not counted
+    uint32_t GetDrawCount() const { return drawCount; }
+    // Triangles and pipeline binds of the same draws, the depth pre-pass's binds included
+    uint32_t GetTriangleCount() const { return triangleCount; }
+    uint32_t GetPipelineBindCount() const { return pipelineBindCount; }
+
+    // Skin and draw the skinned instances of the frame's slot in every recording from now on
+    void SetSkinning(GpuSkinning* gpuSkinning) { skinning = gpuSkinning; }
+    // Draw the frame slot's crowd agents after the skinned instances in every recording from now on
+    void SetCrowd(CrowdRenderer* crowdRenderer) { crowd = crowdRenderer; }
+    // Draw the frame slot's GUI on top of everything in every recording from now on
+    void SetGui(GuiRenderer* guiRenderer) { gui = guiRenderer; }
+    // Bin the lights into clusters ahead of the indirect draws in every recording from now on
+    void SetClusteredLights(ClusteredLights* clusteredLights) { lights = clusteredLights; }
+    // Leave the instances the occlusion's depth of the frame hides out of every per-frame recording from now on,
+    // its Begin runs before RecordFrame
+    void SetSoftwareOcclusion(SoftwareOcclusion* softwareOcclusion) { occlusion = softwareOcclusion; }
+    // Query the visible instances of at least its minimum triangles behind their boxes, and draw those the previous
+    // per-frame recording queried only where the query passed, in every per-frame recording from now on
+    void SetOcclusionQueries(OcclusionQueries* occlusionQueries) { queries = occlusionQueries; }
+    // Draw the frame slot's impostors after the indirect draws in every recording from now on
+    void SetImpostors(ImpostorRenderer* impostorRenderer) { impostors = impostorRenderer; }
+    // Simulate the frame slot's particles before the render pass and draw them after the opaque geometry in every
+    // recording from now on
+    void SetParticles(ParticleSystem* particleSystem) { particles = particleSystem; }
+    // Before Build: the scene renders into a color target of its own that the post stack reads into the swapchain
+    // image after the render pass. Needs a pipeline of one view whose finalLayout is SHADER_READ_ONLY_OPTIMAL
+    void SetPostProcess(PostProcess* postProcess) { post = postProcess; }
+    // Before Build: fill the shading rate image of the frame slot before the render pass and shade the scene
+    // pipelines at its rates in every recording from now on. Needs a pipeline of Pipeline::Options::shadingRateImage;
+    // with the post stack the rates follow the contrast of the previous frame's scene color
+    void SetShadingRate(ShadingRate* rates) { shadingRate = rates; }
+    // Time every pass of the recordings from now on, in the slot of the recording's uniform block.
+    // Passes are marker regions in captures with or without a profiler, under the same names
+    void SetProfiler(GpuProfiler* gpuProfiler);
 
 private:
+    struct Target {
+        vk::Image image;
+        MemoryAllocator::Allocation mem;
+        vk::ImageView view;
+        vk::Format format;
+        uint32_t layers = 0;
+    };
+
+    enum Pass {
+        CullPass,
+        SkinningPass,
+        PrepassPass,
+        OpaquePass,
+        SkinnedPass,
+        CrowdPass,
+        GuiPass,
+        DepthPyramidPass,
+        LightClusterPass,
+        OcclusionPass,
+        ImpostorPass,
+        ParticleSimulationPass,
+        ParticlePass,
+        PostProcessPass,
+        // the transparent and overlay subpasses up to the composite
+        TransparentPass,
+        ShadingRatePass,
+        // the full screen lighting of the G-buffer
+        DeferredLightingPass,
+        // the whole render pass of a per-frame recording, the secondaries are regions of their own
+        ScenePass,
+        PassCount
+    };
+    // a marker region and the profiler's scope around a pass
+    void beginPass(vk::CommandBuffer cmd, uint32_t slot, Pass pass);
+    void endPass(vk::CommandBuffer cmd, uint32_t slot, Pass pass);
+
     void createCommandPool();
+    void allocateDrawCommandBuffers();
+    void createTargets(Pipeline&, IndirectDraws* indirect, ResourceTrash* trash);
+    // named in captures, more than one layer is an array image and view
+    void createTarget(vk::Format format, vk::ImageUsageFlags usage, vk::SampleCountFlagBits samples, vk::ImageAspectFlags aspect, const char* name,
+        Target& target, uint32_t layers = 1);
+    // multiview, dynamic resolution or post processing, after the render pass: the rendered part of every layer of the scene
+    // color into its tile of the swapchain image, left in PRESENT_SRC; the post stack's pass reads the settings of slot
+    void recordSceneBlit(vk::CommandBuffer cmd, uint32_t slot, uint32_t imageIndex);
+    // deferred only, after the G-buffer subpass's draws: moves on to the shading subpass and lights the G-buffer
+    void recordLighting(vk::CommandBuffer cmd, uint32_t slot, Pipeline& pipeline);
+    // weighted blended only, after what the shading subpass draws: the transparent slices of indirect and their composite,
+    // leaves the overlay subpass current
+    void recordTransparency(vk::CommandBuffer cmd, uint32_t slot, Pipeline& pipeline, GeometryArena& geometry, IndirectDraws* indirect);
+    // the static draw command buffer of swapchain image i
+    void recordImage(uint32_t i, Pipeline&, Scene&, GeometryArena&, IndirectDraws* indirect);
+    // destroy now or, with trash, once the frames using them completed
+    void destroyTargets(ResourceTrash* trash);
+    // every resident mesh where it was modeled into the bound pipeline, returns the draw count and adds the triangles to triangles
+    uint32_t recordMeshes(vk::CommandBuffer cmd, const Pipeline& pipeline, Scene& scene, GeometryArena& geometry, bool materials, uint32_t& triangles);
+    // keys of the slices of visibleInstances [first, last), the pre-pass ones from prepassBase on when it is not 0
+    void buildQueueKeys(Scene& scene, const Camera* camera, uint32_t first, uint32_t last, uint32_t shadingPipeline, uint32_t depthPipeline,
+        uint32_t prepassBase);
+    struct RecordContext;
+    // sorted render queue items [first, last), binds pipelines, buffers and push constants only when they change.
+    // Counts the binds and shaded triangles into context
+    void recordQueue(vk::CommandBuffer cmd, Pipeline& pipeline, Scene& scene, GeometryArena& geometry, uint32_t first, uint32_t last,
+        uint32_t uniformOffset, RecordContext& context);
 
 private:
     vk::Device& device;
     vk::PhysicalDevice& physicalDevice;
     vk::Queue& queue;
     VulkanSwapChain& swapChain;
-    /* Vertices */
-    struct StagingBuffer {
-        vk::DeviceMemory mem;
-        vk::Buffer buf;
-    };
-    struct {
-        StagingBuffer vertices;
-        StagingBuffer indices;
-        uint32_t indexCount;
-    } meshBuffer;
+    MemoryAllocator& allocator;
 
     /* frame buffers */
+    // of the render targets, with multiview that of one view's tile of the swapchain image
+    vk::Extent2D extent;
     std::vector<vk::Framebuffer> frameBuffers;
-    struct
-    {
-        vk::Image image;
-        vk::DeviceMemory mem;
-        vk::ImageView view;
-    } depthStencil;
+    Target depthStencil;
+    // multisampled color, resolved into the swapchain image; null without MSAA
+    Target multisampleColor;
+    // multiview, dynamic resolution or post processing, a layer per view blitted or post processed into the swapchain
+    // image after the render pass
+    Target sceneColor;
+    // transform entry and primitive per pixel, Pipeline::Options::idBuffer only
+    Target idBuffer;
+    // Pipeline::Options::weightedBlended only, in tile memory, and the composite's set reading them; one pool per target set
+    Target transparencyAccum;
+    Target transparencyReveal;
+    vk::DescriptorPool transparencyPool;
+    vk::DescriptorSet transparencySet;
+    // Pipeline::Options::deferred only, likewise, with the lighting's set
+    Target gbufferAlbedo;
+    Target gbufferNormal;
+    Target gbufferDepth;
+    vk::DescriptorPool gbufferPool;
+    vk::DescriptorSet gbufferSet;
+    // tiles of the swapchain image the views are blitted into
+    uint32_t viewColumns = 1;
+    uint32_t viewRows = 1;
+    // top left part of the targets the scene covers, extent times the render scale
+    bool dynamicResolution = false;
+    float renderScale = 1.0f;
+    vk::Extent2D renderExtent;
+    // of each static draw command buffer when it was recorded
+    std::vector<float> recordedScales;
 
     vk::CommandPool cmdPool;
-    std::vector<vk::CommandBuffer> tempCmdBuffers;
     std::vector<vk::CommandBuffer> drawCmdBuffers;
+
+    /* One time command buffers */
+    // of Create and Flush, only the thread that builds the frames uses it
+    vk::CommandPool tempPool;
+    std::vector<vk::CommandBuffer> tempCmdBuffers;
+    std::vector<vk::CommandBufferLevel> tempLevels;
+    // indices of reset buffers, and of flushed ones waiting for the next pool reset
+    std::vector<uint32_t> freeTempBuffers;
+    std::vector<uint32_t> flushedTempBuffers;
+    uint32_t openTempBuffers = 0;
+    // signalled by each Flush, reset before the next one
+    vk::Fence tempFence;
+
+    /* Per-frame recording */
+    struct RecordContext {
+        vk::CommandPool pool;
+        vk::CommandBuffer secondary;
+        // subpass 0 of a pipeline with a depth pre-pass
+        vk::CommandBuffer prepass;
+        // of the worker's last recording
+        uint32_t pipelineBinds;
+        uint32_t triangles;
+        // what the recording bound, for the perf lint
+        perflint::BindTracker binds;
+    };
+    // [frame][thread]
+    std::vector<std::vector<RecordContext>> recordContexts;
+    std::unique_ptr<ThreadPool> recordThreads;
+    // resident instances with their world boxes per axis, and a bit per instance the frustum does not cull
+    std::vector<uint32_t> candidateInstances;
+    std::vector<float> candidateLower[3];
+    std::vector<float> candidateUpper[3];
+    std::vector<uint32_t> candidateVisible;
+    std::vector<uint32_t> visibleInstances;
+    // render queue item of the first slice of every visible instance
+    std::vector<uint32_t> visibleFirstItems;
+    RenderQueue renderQueue;
+    GpuSkinning* skinning = nullptr;
+    CrowdRenderer* crowd = nullptr;
+    GuiRenderer* gui = nullptr;
+    ClusteredLights* lights = nullptr;
+    SoftwareOcclusion* occlusion = nullptr;
+    OcclusionQueries* queries = nullptr;
+    ImpostorRenderer* impostors = nullptr;
+    ParticleSystem* particles = nullptr;
+    PostProcess* post = nullptr;
+    ShadingRate* shadingRate = nullptr;
+    GpuProfiler* profiler = nullptr;
+    // the profiler's ids of the passes
+    uint32_t passScopes[PassCount];
+    uint32_t drawCount = 0;
+    uint32_t triangleCount = 0;
+    uint32_t pipelineBindCount = 0;
 };
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Scene.hpp"
+
+namespace m3d {
+class RendererVulkan;
+
+/*
+ * A renderer's workload as a file, so two builds can be timed on the same
+ * frames rather than on whatever a scene load and an input session gave.
+ *
+ *   renderer.SetCommandCapture("session.m3dcap");   // before Init
+ *   replay session.m3dcap --mode indirect           // examples/replay
+ *
+ * Begin cooks the scene the renderer uploads at Init next to the command
+ * file, at CookedPath(path), and writes the ids it had in the cooked order;
+ * after that every scene edit the renderer is asked for, every RenderOffscreen
+ * and every Draw with the camera it drew with is appended as one command.
+ * Ids are the capturing scene's, a replay maps them to the ones its own load
+ * and its own AddInstance calls gave.
+ *
+ * Only what goes through the renderer is captured: models a SceneStreamer
+ * merges in later, animation and the GUI are not, nor when the uploads
+ * finished. A replay waits for its meshes to be resident before the first
+ * frame and then draws the frames back to back, so it compares steady state
+ * rendering.
+ */
+class CommandCapture {
+public:
+    // the cooked scene goes to CookedPath(path)
+    explicit CommandCapture(const std::string& path);
+    ~CommandCapture();
+
+    CommandCapture(const CommandCapture&) = delete;
+    CommandCapture& operator=(const CommandCapture&) = delete;
+
+    // The scene at Init and what it is drawn at, batch renders per Draw when headless and 0 for a window; first
+    // of all. False when either file can not be written, nothing is captured then
+    bool Begin(const Scene& scene, uint32_t width, uint32_t height, uint32_t batch);
+
+    void AddInstance(uint32_t meshID, const Transform& transform, uint32_t instanceID, uint32_t transformID);
+    void RemoveInstance(uint32_t instanceID);
+    void SetTransform(uint32_t transformID, const Transform& transform);
+    void SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID);
+    void RenderOffscreen(uint64_t id, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+    // a Draw, with the camera of the pipeline a window is drawn with
+    void Frame(const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+
+    uint64_t GetFrames() const { return frames; }
+
+private:
+    void write(const void* data, size_t bytes);
+
+    std::string path;
+    FILE* file = nullptr;
+    uint64_t frames = 0;
+};
+
+/*
+ * Plays a CommandCapture back into a renderer: Open loads the cooked scene
+ * into the scene the renderer is then initialized with, ReplayFrame applies
+ * the commands up to the next Draw and draws. A frame captured from a window
+ * is rendered offscreen with its camera instead, the renderer must be
+ * headless with GetBatch renders per Draw.
+ */
+class CommandReplay {
+public:
+    CommandReplay() {}
+    ~CommandReplay();
+
+    CommandReplay(const CommandReplay&) = delete;
+    CommandReplay& operator=(const CommandReplay&) = delete;
+
+    // Load the capture's scene into scene, which must outlive the replay; threadCount as LoadMeshes takes it
+    bool Open(const std::string& path, Scene& scene, uint32_t threadCount = 0);
+
+    // of the capturing renderer
+    uint32_t GetWidth() const { return width; }
+    uint32_t GetHeight() const { return height; }
+    // renders per Draw, 1 for a capture of a window
+    uint32_t GetBatch() const { return batch; }
+
+    // The commands of the next frame and its Draw, false at the end of the capture
+    bool ReplayFrame(RendererVulkan& renderer);
+
+    // frames replayed, and commands whose ids the replay never saw, such as transforms made outside the renderer
+    uint64_t GetFrames() const { return frames; }
+    uint64_t GetSkipped() const { return skipped; }
+
+private:
+    bool read(void* data, size_t bytes);
+    bool readIds(std::unordered_map<uint32_t, uint32_t>& ids, const std::vector<uint32_t>& replayIds);
+    uint32_t map(const std::unordered_map<uint32_t, uint32_t>& ids, uint32_t id);
+
+    FILE* file = nullptr;
+    Scene* scene = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t batch = 1;
+    bool window = false;
+    // capture ids to the replay's
+    std::unordered_map<uint32_t, uint32_t> meshIds;
+    std::unordered_map<uint32_t, uint32_t> materialIds;
+    std::unordered_map<uint32_t, uint32_t> transformIds;
+    std::unordered_map<uint32_t, uint32_t> instanceIds;
+    uint64_t frames = 0;
+    uint64_t skipped = 0;
+};
+}
@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace m3d {
+namespace cpu {
+
+    // Cores a thread runs on
+    enum class CoreClass : uint8_t {
+        // wherever the OS schedules it
+        Any,
+        // the fast cores of a big.LITTLE or hybrid processor, every core of others
+        Big,
+        // the slow, efficient ones; none on others
+        Little
+    };
+
+    struct Core {
+        uint32_t index;
+        // cpuinfo_max_freq, 0 when it could not be read
+        uint32_t maxFrequencyKHz;
+        bool big;
+        // NUMA node, 0 on machines of one
+        uint32_t node;
+    };
+
+    /*
+     * The cores of the processor and which of them are big, read once.
+     *
+     * On Linux and Android the core count comes from cpufeatureslib's
+     * android_getCpuCount() or the hardware concurrency, the maximum
+     * frequency of every core from /sys/devices/system/cpu/cpuN/cpufreq.
+     * Cores below the middle of the slowest and fastest maximum are little,
+     * when the slowest is clearly slower than the fastest; the small
+     * frequency differences of desktop processors' preferred cores do not
+     * count. Elsewhere, or when a frequency can not be read, every core is
+     * big.
+     *
+     * The NUMA node of every core comes from /sys/devices/system/node/nodeN/
+     * cpulist on Linux and GetNumaProcessorNode on Windows; multi socket
+     * servers have a node per socket, other machines one.
+     */
+    struct Topology {
+        std::vector<Core> cores;
+        // has big and little cores
+        bool heterogeneous = false;
+        uint32_t nodeCount = 1;
+
+        // indices of the cores of a class, every core for Any
+        std::vector<uint32_t> Cores(CoreClass coreClass) const;
+        uint32_t Count(CoreClass coreClass) const { return static_cast<uint32_t>(Cores(coreClass).size()); }
+        // indices of the cores of NUMA node node
+        std::vector<uint32_t> NodeCores(uint32_t node) const;
+    };
+
+    const Topology& GetTopology();
+
+    // Restrict the calling thread to the cores of coreClass, Any lifts the restriction. Only on heterogeneous
+    // processors, false on others and where the platform has no affinity (Apple)
+    bool PinCurrentThread(CoreClass coreClass);
+
+    // Restrict the calling thread to the cores of NUMA node node and place the pages it maps from then on there:
+    // its heap on Linux, its PageAllocator arenas (threadNumaNode) everywhere. -1 lifts both. False on machines
+    // of one node and where the platform has no affinity
+    bool BindCurrentThread(int node);
+
+    // NUMA node of the PCI device at domain:bus:device.function, a GPU's from VK_EXT_pci_bus_info; -1 when
+    // unknown, as on machines of one node and everywhere but Linux
+    int PciDeviceNode(uint32_t domain, uint32_t bus, uint32_t device, uint32_t function);
+}
+}
@@ -0,0 +1,175 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Matrix.h"
+#include "MemoryAllocator.hpp"
+#include "PipelineRegistry.hpp"
+#include "SkeletalAnimation.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class Pipeline;
+
+/*
+ * Instanced crowds animated from baked palettes, for agents too many and
+ * too far away to afford GpuSkinning.
+ *
+ * Clips are baked offline by animation::BakeAnimation and uploaded with
+ * AddAnimation into one device local buffer of skinning matrices, the
+ * animation texture. Meshes keep their SkinnedVertex bind pose and are drawn
+ * straight from it: the vertex shader finds its agent through
+ * gl_InstanceIndex, turns the frame's time into two baked frames of the
+ * agent's clip, blends the four joints of the vertex over both and places
+ * the result with the agent's world matrix.
+ *
+ * Agents only change when they are added or removed. BeginFrame rewrites a
+ * slot's agents, grouped by mesh, and its indexed indirect command per mesh
+ * only when it is older than the last change; otherwise a frame costs the
+ * write of its time. Draw issues every mesh's command in one
+ * drawIndexedIndirect with multiDrawIndirect, one per mesh without, so
+ * command buffers recorded once pick up each frame's crowd.
+ *
+ * The pipeline's set 0 is the scene pipeline's, with its camera block; the
+ * crowd's buffers are set 1. Agents are drawn in the shading subpass after
+ * the skinned instances and write their own depth like them.
+ */
+class CrowdRenderer {
+public:
+    static const uint32_t InvalidAgent = 0xFFFFFFFF;
+
+    struct CrowdMesh {
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        // of its indirect command
+        uint32_t index;
+    };
+
+    struct CrowdAnimation {
+        // of the animation's first clip among every clip added
+        uint32_t firstClip;
+        uint32_t clipCount;
+        uint32_t jointCount;
+    };
+
+    // slotCount like Pipeline's frame slots, maxAgents per slot; drawn with the camera of pipeline
+    CrowdRenderer(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, PipelineRegistry& registry, Pipeline& pipeline, uint32_t slotCount,
+        uint32_t maxVertices, uint32_t maxMatrices, uint32_t maxClips, uint32_t maxMeshes, uint32_t maxAgents);
+    ~CrowdRenderer();
+    // fetch the pipeline from registry again, after PipelineRegistry::SwapReloaded
+    void RefreshPipelines(PipelineRegistry& registry);
+
+    // Upload a bind pose, blocks until it is on the GPU. False when the buffers or the commands are full
+    bool AddMesh(const animation::SkinnedVertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount, CrowdMesh* mesh);
+    // Upload the palettes of every clip of baked, blocks until they are on the GPU. False when the buffers are full
+    bool AddAnimation(const animation::BakedAnimation& baked, CrowdAnimation* animation);
+
+    // An agent drawing mesh, which must be skinned to the skeleton animation was baked from. It plays clip of
+    // animation speed times as fast as baked, timeOffset seconds ahead of the others. Returns its ID, InvalidAgent
+    // when maxAgents are alive or clip is not one of animation's
+    uint32_t AddAgent(const CrowdMesh& mesh, const CrowdAnimation& animation, uint32_t clip, const m3d::math::Matrix4x3& world,
+        float timeOffset = 0.0f, float speed = 1.0f);
+    void RemoveAgent(uint32_t agent);
+    uint32_t GetAgentCount() const { return agentCount; }
+
+    // Start filling slot, no submitted frame may still read it. time in seconds drives every agent's clip
+    void BeginFrame(uint32_t slot, float time);
+    // Inside the render pass, in its shading subpass, with the scene pipeline's descriptor set bound as set 0
+    void Draw(vk::CommandBuffer cmd, uint32_t slot) const;
+
+private:
+    // std430 layout of crowd.vert's agents
+    struct GpuAgent {
+        m3d::math::Matrix4x3 world;
+        uint32_t clip;
+        float timeOffset;
+        float speed;
+        uint32_t pad;
+    };
+
+    // std430 layout of crowd.vert's clips
+    struct GpuClip {
+        uint32_t firstMatrix;
+        uint32_t frameCount;
+        uint32_t jointCount;
+        uint32_t loop;
+        float frameRate;
+        uint32_t pad[3];
+    };
+
+    struct Agent {
+        GpuAgent gpu;
+        // CrowdMesh::index, InvalidAgent once removed
+        uint32_t mesh;
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Slot {
+        Buffer agents;
+        // maxMeshes VkDrawIndexedIndirectCommands, the ones of meshes without agents draw no instance
+        Buffer draws;
+        // the time, a uniform block of its own
+        Buffer frame;
+        vk::DescriptorSet set;
+        // of the agents it holds, behind revision when they changed since
+        uint64_t revision;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    void destroyBuffer(Buffer& buffer);
+    void upload(const void* data, vk::DeviceSize size, vk::Buffer target, vk::DeviceSize offset);
+    void createPipeline(PipelineRegistry& registry, Pipeline& pipeline);
+    void writeDescriptors();
+    // agents grouped by mesh and their commands
+    void writeAgents(Slot& slot);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    uint32_t maxVertices;
+    uint32_t maxMatrices;
+    uint32_t maxClips;
+    uint32_t maxMeshes;
+    uint32_t maxAgents;
+    bool multiDraw;
+
+    Buffer bindPose;
+    Buffer indices;
+    // the baked palettes of every animation
+    Buffer matrices;
+    Buffer clips;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t matrixCount;
+    uint32_t clipCount;
+    std::vector<CrowdMesh> meshes;
+
+    // by ID, removed ones are reused
+    std::vector<Agent> agents;
+    std::vector<uint32_t> freeAgents;
+    uint32_t agentCount;
+    uint64_t revision;
+    std::vector<Slot> slots;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    PipelineDesc pipelineDesc;
+    vk::Pipeline crowdPipeline;
+};
+}
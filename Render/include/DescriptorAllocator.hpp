@@ -0,0 +1,75 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Descriptor sets that live for one frame.
+ *
+ * Each frame in flight allocates from pools of its own. When a pool runs out
+ * (VK_ERROR_OUT_OF_POOL_MEMORY, VK_ERROR_FRAGMENTED_POOL) the allocation moves
+ * on to a spare pool or a new one twice the size, so a frame never fails for
+ * want of descriptors. BeginFrame resets every pool of the frame with one
+ * vkResetDescriptorPool each once its fence has signaled; no set is freed
+ * individually and a steady state frame creates no pools.
+ *
+ * The layouts come from PipelineRegistry::GetDescriptorSetLayout, sets with
+ * the same bindings share one. A set lives as long as its frame, write every
+ * binding each time one is allocated. Main thread only.
+ */
+class DescriptorAllocator {
+public:
+    // descriptors of each type a pool holds per set it is sized for
+    static std::vector<vk::DescriptorPoolSize> DefaultSetSizes();
+
+    // first pools hold setsPerPool sets of setSizes each
+    DescriptorAllocator(vk::Device& device, uint32_t frameCount, uint32_t setsPerPool = 64,
+        const std::vector<vk::DescriptorPoolSize>& setSizes = DefaultSetSizes());
+    ~DescriptorAllocator();
+
+    DescriptorAllocator(const DescriptorAllocator&) = delete;
+    DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+    // Reset the pools of frameIndex and allocate from them, no submission may still use its sets
+    void BeginFrame(uint32_t frameIndex);
+    // A set of layout valid until BeginFrame comes back to the current frame index
+    vk::DescriptorSet Allocate(vk::DescriptorSetLayout layout);
+
+    // pools created so far, over all frames
+    uint32_t GetPoolCount() const { return poolCount; }
+    // sets allocated since the current frame began
+    uint32_t GetFrameSetCount() const { return frames[current].sets; }
+
+private:
+    struct Pool {
+        vk::DescriptorPool pool;
+        uint32_t maxSets;
+    };
+    struct Frame {
+        // the last one is allocated from
+        std::vector<Pool> used;
+        // reset pools waiting to be used again, the largest last
+        std::vector<Pool> spare;
+        uint32_t sets = 0;
+    };
+
+    Pool nextPool(Frame& frame);
+    Pool createPool(uint32_t maxSets);
+
+    vk::Device& device;
+    std::vector<vk::DescriptorPoolSize> setSizes;
+    uint32_t setsPerPool;
+    std::vector<Frame> frames;
+    uint32_t current = 0;
+    uint32_t poolCount = 0;
+};
+}
@@ -0,0 +1,59 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace m3d {
+
+/*
+ * Picks the share of the render targets' width and height the scene is
+ * rendered at so the GPU time of a frame stays at a target.
+ *
+ * AddFrame takes the GPU time of every completed frame and keeps a moving
+ * average of it. Once the average leaves the band of Tolerance around the
+ * target the scale is set so the shaded pixels, which GPU time is taken to
+ * follow, bring it back: scale * sqrt(target / average), by at most MaxStep
+ * and rounded to 1/Steps so small jitter does not change it every frame.
+ * The frames in flight were recorded at the old scale, their times are
+ * skipped for SettleFrames after a change; the average is rescaled by the
+ * pixel ratio instead of starting over.
+ */
+class DynamicResolution {
+public:
+    // of the scale, a change re-records static command buffers
+    static const uint32_t Steps = 64;
+    // frame time band around the target the scale holds in, relative
+    static const float Tolerance;
+    // largest change of the scale at once
+    static const float MaxStep;
+    // completed frames ignored after a change, at least the frames in flight
+    static const uint32_t SettleFrames = 4;
+
+    explicit DynamicResolution(float targetMs);
+
+    // GPU time per frame to hold, e.g. 90% of the refresh interval to leave room for the rest of the frame
+    void SetTarget(float ms) { targetMs = ms; }
+    float GetTarget() const { return targetMs; }
+    // scale never leaves [minScale, maxScale], maxScale at most 1
+    void SetScaleRange(float minScale, float maxScale);
+    // GPU time of a completed frame, 0 when it was not measured. True when the scale changed
+    bool AddFrame(double gpuMs);
+    // of the render targets' width and height
+    float GetScale() const { return scale; }
+    // the moving average AddFrame compares with the target
+    float GetAverage() const { return average; }
+
+private:
+    float targetMs;
+    float minScale;
+    float maxScale;
+    float scale;
+    float average;
+    uint32_t settle;
+};
+}
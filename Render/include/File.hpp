@@ -6,11 +6,25 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
 #include <type_traits>
+#include <vector>
+
+#if defined(__ANDROID__)
+struct AAssetManager;
+#endif
 
 namespace m3d {
 namespace file {
+#if defined(__ANDROID__)
+    // Relative paths are looked up in the APK's assets first, set once from android_app::activity
+    void setAssetManager(AAssetManager* assetManager);
+#endif
+
     template <class T>
     bool readBinary(const char* path, T& container)
     {
@@ -28,5 +42,129 @@ namespace file {
             return false;
         }
     }
+
+    inline bool writeBinary(const char* path, const void* data, size_t size)
+    {
+        std::FILE* fp = std::fopen(path, "wb");
+        if (!fp) {
+            return false;
+        }
+        size_t written = std::fwrite(data, 1, size, fp);
+        std::fclose(fp);
+        return written == size;
+    }
+
+    // How a packed file is stored, readers skip the entries of codecs they do not know
+    enum class PackCodec : uint32_t {
+        Stored = 0,
+    };
+
+    // Where fbxconv pack writes the package of the data directory by default
+    const char* const DefaultPackagePath = "data.m3dp";
+
+    /*
+     * Asset packages, see data/schema/pack.fbs: every file at a 4 KiB aligned
+     * offset so it can be mapped or read with direct I/O, then a table of
+     * contents of path hashes sorted for a binary search and a footer pointing
+     * at it.
+     *
+     * A mounted package is mapped once and MappedFile::open serves the paths it
+     * holds as views into that mapping instead of opening the loose file. A
+     * path is looked up with backslashes turned into slashes and the mount's
+     * root stripped from its front, the rest is the path the package stores.
+     */
+    // False when path is no package. Later mounts are searched first, loose files after all of them
+    bool mountPackage(const char* path, const std::string& root = std::string());
+    void unmountPackages();
+    // Package files, stored by their path relative to root. False when one cannot be read or two hash the same
+    bool writePackage(const char* path, const std::vector<std::string>& files, const std::string& root = std::string());
+
+    // Read only view of a whole file, unmapped when the last reference goes away
+    class MappedFile {
+    public:
+        ~MappedFile();
+        // nullptr when the file does not exist, is empty or cannot be mapped. Mounted packages come first
+        static std::shared_ptr<const MappedFile> open(const char* path);
+
+        const uint8_t* data() const { return view; }
+        size_t size() const { return length; }
+        // Fault every page in now instead of on first access
+        void prefetch() const;
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+    private:
+        friend bool mountPackage(const char* path, const std::string& root);
+        friend class AsyncReader;
+        MappedFile() = default;
+        static std::shared_ptr<const MappedFile> openPacked(const char* path);
+        static std::shared_ptr<const MappedFile> openLoose(const char* path);
+
+        const uint8_t* view = nullptr;
+        size_t length = 0;
+        void* mapping = nullptr;
+        // the package of a packed file, view points into its mapping
+        std::shared_ptr<const MappedFile> package;
+        // the bytes of a file AsyncReader read, view points into it
+        std::unique_ptr<uint8_t[]> buffer;
+#if defined(__ANDROID__)
+        // AAsset of an asset, view points into its buffer
+        void* asset = nullptr;
+#endif
+    };
+
+    typedef std::function<void(std::shared_ptr<const MappedFile>)> ReadCallback;
+
+    /*
+     * Reads whole files into memory with many reads in flight. A file is read
+     * in chunks of ChunkSize, up to queueDepth chunks of all files at once:
+     * through io_uring on Linux, overlapped reads on an I/O completion port on
+     * Windows, and a pool of threads doing blocking reads elsewhere or when the
+     * kernel refuses io_uring.
+     *
+     * Files that did not start yet are started highest priority first, in
+     * request order among equal priorities. Files of a mounted package complete
+     * at once as views of its mapping. onComplete runs on one of the reader's
+     * threads with the file, or nullptr when it could not be read.
+     */
+    class AsyncReader {
+    public:
+        typedef uint64_t Request;
+        static const uint32_t DefaultQueueDepth = 32;
+        static const uint32_t ChunkSize = 1024 * 1024;
+
+        // since the reader was created, latencies from read to the data being in memory
+        struct Stats {
+            uint64_t completed = 0;
+            uint64_t failed = 0;
+            uint64_t cancelled = 0;
+            uint64_t bytes = 0;
+            // files not started yet, chunks being read and the most that ever were
+            uint32_t pending = 0;
+            uint32_t inFlight = 0;
+            uint32_t maxInFlight = 0;
+            double averageLatencyMs = 0.0;
+            double maxLatencyMs = 0.0;
+        };
+
+        explicit AsyncReader(uint32_t queueDepth = DefaultQueueDepth);
+        // Waits for the reads issued so far
+        ~AsyncReader();
+
+        Request read(const std::string& path, ReadCallback onComplete, int32_t priority = 0);
+        // Drop a read that did not start yet, its onComplete never runs. False once it started or completed
+        bool cancel(Request request);
+        // Blocks until every read issued so far has called back or was cancelled
+        void wait();
+
+        Stats getStats() const;
+        // "io_uring", "iocp" or "threads"
+        const char* getBackendName() const;
+
+    private:
+        struct State;
+        std::unique_ptr<State> state;
+    };
 }
 }
@@ -0,0 +1,55 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Allocator.h"
+#include "MemoryTags.hpp"
+
+namespace m3d {
+
+/*
+ * Linear memory for the CPU side temporaries of a frame: culling output,
+ * draw lists, upload and bind descriptors. There is one arena per frame in
+ * flight and BeginFrame rewinds the one of the frame about to be built, so
+ * nothing allocated from it is freed individually and a steady state frame
+ * never reaches malloc for them. Past ArenaBytes allocations fall back to the
+ * heap.
+ *
+ * Every arena is one huge page of a PageAllocator, mapped at its first
+ * allocation, on the NUMA node of the thread that draws when that thread is
+ * bound to one.
+ *
+ * Vulkan copies create infos and descriptors during the call, none of it
+ * is read by the GPU; an allocation stays valid until the same frame index
+ * comes around again. Main thread only.
+ */
+class FrameArena {
+public:
+    static const size_t ArenaBytes = HugePageBytes;
+    // the overflow counted against the allocating thread's memory tag
+    typedef FallbackAllocator<RegionAllocator<PageAllocator, ArenaBytes>, memtag::Mallocator> Allocator;
+
+    explicit FrameArena(uint32_t frameCount);
+
+    void BeginFrame(uint32_t frameIndex);
+
+    // converts to the allocator of any FrameVector
+    StlAllocator<char, Allocator> Get() { return StlAllocator<char, Allocator>(*arenas[current]); }
+
+    size_t GetUsedBytes() const { return arenas[current]->primary().used(); }
+
+private:
+    std::vector<std::unique_ptr<Allocator>> arenas;
+    uint32_t current;
+};
+
+template <class T>
+using FrameVector = std::vector<T, StlAllocator<T, FrameArena::Allocator>>;
+}
@@ -0,0 +1,155 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+#include "RenderCommandQueue.hpp"
+
+namespace m3d {
+
+/*
+ * Captures the frames a renderer presents, or renders headless, as I420 for
+ * a video encoder, without the drawing thread waiting for the GPU or the
+ * encoder.
+ *
+ *   renderer.SetFrameCapture(FrameCapture::Y4mWriter("capture.y4m", 60));   // before Init
+ *
+ * Record copies each image into a device local buffer at the end of its
+ * frame, and a compute pass converts it into a free slot of a host visible
+ * ring of RingSize pictures: full resolution luma, chroma averaged over 2 x 2
+ * pixels, limited range BT.709 or BT.601. Once the frame's submission
+ * completed Resolve hands its slots to the encoder thread through a lock-free
+ * ring, the encoder hands each slot back through another one when it is done
+ * with the picture. The drawing thread never takes a lock; it only wakes the
+ * encoder, under its mutex, when the encoder ran out of pictures and sleeps.
+ *
+ * A frame that finds every slot queued or encoding is dropped rather than
+ * waited for, GetDropped counts them and the pictures' numbers skip them. The
+ * pictures have the size the capture was created with, images of another size
+ * after a resize are dropped as well. The encoder runs until the capture is
+ * destroyed, after every picture handed to it.
+ */
+class FrameCapture {
+public:
+    // pictures queued, encoding or being converted at the same time
+    static const uint32_t RingSize = 8;
+    // compute invocations per 8 x 2 pixel block along x and y
+    static const uint32_t GroupSize = 8;
+
+    enum class ColorMatrix {
+        Bt601,
+        Bt709
+    };
+
+    struct Picture {
+        // Y, U and V, the chroma planes at half the width and height rounded up
+        const uint8_t* planes[3];
+        // bytes per row of each plane, at least its width
+        uint32_t pitches[3];
+        uint32_t width;
+        uint32_t height;
+        // of the frames recorded, dropped ones included, from 0
+        uint64_t number;
+    };
+    // On the encoder thread, the picture is only valid during the call
+    typedef std::function<void(const Picture& picture)> Encoder;
+    // Write the pictures as a YUV4MPEG2 stream of fps frames per second, which ffmpeg and most players read
+    static Encoder Y4mWriter(const std::string& path, uint32_t fps);
+
+    // Images of extent in format, which must be an 8 bit RGBA or BGRA one
+    FrameCapture(vk::Device&, MemoryAllocator&, uint32_t queueFamilyIndex, uint32_t framesInFlight, vk::Extent2D extent, vk::Format format,
+        ColorMatrix matrix, Encoder encoder);
+    ~FrameCapture();
+
+    // Record the conversion of count images of imageExtent in layout, which they are left in, into frame's command
+    // buffer. frame's last submission must have completed and been resolved. False when nothing was recorded, the
+    // command buffer does not need to be submitted then
+    bool Record(uint32_t frame, const vk::Image* images, uint32_t count, vk::Extent2D imageExtent, vk::ImageLayout layout);
+    // submit after the images' draw commands, when Record returned true
+    vk::CommandBuffer GetCommandBuffer(uint32_t frame) const { return frames[frame].commandBuffer; }
+    // frame's last submission completed, hand its pictures to the encoder
+    void Resolve(uint32_t frame);
+
+    uint64_t GetCaptured() const { return captured; }
+    uint64_t GetDropped() const { return dropped; }
+
+private:
+    struct Constants {
+        // of the images
+        uint32_t width;
+        uint32_t height;
+        // the planes' pitches and the slot's planes, in 32 bit words of the ring
+        uint32_t lumaPitch;
+        uint32_t chromaPitch;
+        uint32_t planeOffsets[3];
+        // 1 when the image is BGRA
+        uint32_t swapRedBlue;
+        // rgb weights and offset of Y, U and V, in 0..1
+        float rows[3][4];
+    };
+
+    struct Slot {
+        uint32_t index;
+        uint64_t number;
+    };
+
+    struct Frame {
+        vk::CommandBuffer commandBuffer;
+        // converted by the frame's last submission
+        std::vector<Slot> slots;
+    };
+
+    void createPipeline();
+    void encode();
+
+    vk::Device& device;
+    MemoryAllocator& allocator;
+    vk::Extent2D extent;
+    Constants constants;
+    Encoder encoder;
+
+    std::vector<Frame> frames;
+    vk::CommandPool commandPool;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSet descriptorSet;
+
+    // the image being converted, 4 bytes per pixel
+    vk::Buffer pixels;
+    MemoryAllocator::Allocation pixelsMemory;
+    // RingSize pictures of slotBytes each
+    vk::Buffer ring;
+    MemoryAllocator::Allocation ringMemory;
+    vk::DeviceSize slotBytes = 0;
+
+    // drawing thread to encoder, and the slots it is done with back
+    SpscRing<Slot> filled;
+    SpscRing<uint32_t> freeSlots;
+    uint64_t recorded = 0;
+    std::atomic<uint64_t> captured{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    bool sizeReported = false;
+
+    std::thread thread;
+    std::atomic<bool> running{ true };
+    std::atomic<bool> sleeping{ false };
+    std::mutex mutex;
+    std::condition_variable wake;
+};
+}
@@ -0,0 +1,120 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#if defined(__ANDROID__)
+struct AThermalManager;
+#endif
+
+namespace m3d {
+
+/*
+ * Paces the render loop to a whole fraction of the display refresh and keeps
+ * the frame rate it picks sustainable.
+ *
+ * WaitForFrame sleeps until the next frame is due, on the vsync phase when
+ * one is known: Android feeds it from Choreographer callbacks. EndFrame takes
+ * the frame's CPU and GPU times; the slower of both goes into a history the
+ * pacer evaluates every EvaluateFrames frames. Over budget it first lowers
+ * the render scale, at the lowest scale it halves the frame rate; with room
+ * to spare it steps back up, frame rate first. Every change waits Cooldown before
+ * the next one, a new render scale means a new swapchain.
+ *
+ * The thermal status (polled on Android 11 and up) and power save clamp the
+ * frame rate and the largest render scale, so a hot device settles at a lower
+ * steady rate instead of being throttled down to a fraction of it.
+ * Main thread only.
+ */
+class FramePacer {
+public:
+    // the ATHERMAL_STATUS_* levels
+    enum class ThermalStatus {
+        None,
+        Light,
+        Moderate,
+        Severe,
+        Critical,
+        Emergency,
+        Shutdown
+    };
+
+    static const uint32_t HistoryFrames = 120;
+    static const uint32_t EvaluateFrames = 30;
+    static const std::chrono::milliseconds Cooldown;
+
+    explicit FramePacer(float refreshRate = 60.0f);
+    ~FramePacer();
+
+    // Frame rate the application asks for, rounded down to a divisor of the refresh; 0 is the refresh rate
+    void SetFrameRateCap(uint32_t fps);
+    // Smallest render scale dynamic resolution may pick, 1 turns it off
+    void SetMinRenderScale(float scale);
+    // Battery saver or a low battery: the rate is capped at half the refresh
+    void SetPowerSave(bool enable);
+    // Platforms without a thermal API may report their own, Android polls it
+    void SetThermalStatus(ThermalStatus status);
+
+#if defined(__ANDROID__)
+    // Post Choreographer frame callbacks on the calling thread's looper, they keep the vsync phase
+    void StartChoreographer();
+#endif
+    // A vsync happened at vsyncTime, on the steady clock in nanoseconds
+    void OnVsync(int64_t vsyncTime);
+
+    // Block until the next frame should start
+    void WaitForFrame();
+    // The frame was submitted; gpuMs is 0 when it was not measured
+    void EndFrame(double cpuMs, double gpuMs);
+
+    uint32_t GetFrameRate() const { return refreshRate / swapInterval; }
+    // vsyncs per frame
+    uint32_t GetSwapInterval() const { return swapInterval; }
+    // Fraction of the native window size to render at
+    float GetRenderScale() const { return renderScale; }
+    ThermalStatus GetThermalStatus() const { return thermalStatus; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    uint32_t minSwapInterval() const;
+    float maxRenderScale() const;
+    void clamp();
+    void evaluate();
+    void pollThermalStatus();
+
+private:
+    uint32_t refreshRate;
+    // estimated from the vsync callbacks, starts at 1 / refreshRate
+    int64_t vsyncPeriod;
+    int64_t lastVsync;
+
+    uint32_t requestedInterval;
+    uint32_t swapInterval;
+    float minRenderScale;
+    float renderScale;
+    bool powerSave;
+    ThermalStatus thermalStatus;
+
+    Clock::time_point frameStart;
+    Clock::time_point lastChange;
+    Clock::time_point lastThermalPoll;
+
+    // slower of CPU and GPU time per frame, in ms
+    std::vector<float> history;
+    uint32_t historyNext;
+    uint32_t historyCount;
+    uint32_t framesSinceEvaluate;
+
+#if defined(__ANDROID__)
+    AThermalManager* thermalManager;
+#endif
+};
+}
@@ -0,0 +1,107 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class GpuMeshDecoder;
+struct Mesh;
+class ResourceTrash;
+class Scene;
+class UploadQueue;
+
+/*
+ * Pooled vertex/index storage for every mesh of a scene.
+ *
+ * Geometry is suballocated out of a few large device local blocks. Each block
+ * is one VkBuffer bound to one MemoryAllocator range and is used both as vertex and
+ * index buffer, so a single bind serves every mesh placed in it. Meshes record
+ * their block together with vertexOffset / firstIndex for drawIndexed.
+ *
+ * A block holds either 16 or 32 bit indices (Block::indexType), meshes go to
+ * blocks of their Mesh::indexType, so binding a block once still serves every
+ * mesh in it. Most meshes have few enough vertices for 16 bit indices.
+ *
+ * With an UploadQueue the copies are streamed on the transfer queue and meshes
+ * only become resident (drawable) once their batch has completed.
+ *
+ * Where the allocator has mappable device local memory (unified memory,
+ * resizable BAR) the blocks live in it and meshes are written straight into
+ * them, resident right away, without staging or a copy.
+ *
+ * With a GpuMeshDecoder, meshes LoadMeshes left encoded (Scene::gpuGeometryDecode)
+ * are placed the same way but their MeshCodec streams go to the GPU as they
+ * are and a compute pass decodes them into the block; they become resident
+ * once it completed. Meshes the decoder does not take are decoded on the CPU.
+ */
+class GeometryArena {
+public:
+    static const vk::DeviceSize DefaultBlockSize = 32 * 1024 * 1024;
+    // sizeof(PackedVertex), not a power of two: offsets are kept multiples of it for vertexOffset
+    static const vk::DeviceSize VertexSize = 20;
+    static const vk::DeviceSize IndexSize = sizeof(uint32_t);
+    static const vk::DeviceSize ShortIndexSize = sizeof(uint16_t);
+
+    struct Block {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+        vk::DeviceSize size;
+        vk::DeviceSize used;
+        // of every mesh in the block, what to bind it with
+        vk::IndexType indexType;
+        // placed and not released, the block is freed when the last one goes
+        uint32_t meshes;
+        // with EnableDeviceAddress, of the buffer's first byte; 0 otherwise
+        uint64_t address;
+    };
+
+    GeometryArena(vk::Device&, vk::PhysicalDevice&, CommandBuffer&, UploadQueue* upload = nullptr, vk::DeviceSize blockSize = DefaultBlockSize);
+    ~GeometryArena();
+
+    // Blocks created from now on have a BufferAddress, for shaders that pull their vertices. The device has
+    // BufferAddress's feature and the allocator MemoryAllocator::EnableDeviceAddress; before the first Upload
+    void EnableDeviceAddress() { deviceAddress = true; }
+    // Decode the encoded meshes of the next Uploads with decoder, nullptr decodes them on the CPU again
+    void SetDecoder(GpuMeshDecoder* decoder) { this->decoder = decoder; }
+
+    // Place every mesh of the scene and copy it to the device with a single submit.
+    // onResident runs once the new meshes can be drawn, right away without an UploadQueue or decoded meshes.
+    void Upload(Scene& scene, std::function<void()> onResident = std::function<void()>());
+    // Give up the mesh's range, it is no longer drawable and Upload places it again. Space is reclaimed a block at
+    // a time: the block goes once all of its meshes were released, through trash as Clear does, and its index is
+    // reused by the next new block
+    void Release(Mesh& mesh, ResourceTrash* trash = nullptr);
+    // Release every block, meshes have to be uploaded again afterwards. With trash the blocks are
+    // destroyed once the frames drawing from them completed, right away otherwise.
+    void Clear(ResourceTrash* trash = nullptr);
+
+    const Block& GetBlock(uint32_t index) const { return blocks[index]; }
+    // including released ones, whose buffer is null
+    uint32_t GetBlockCount() const { return static_cast<uint32_t>(blocks.size()); }
+
+private:
+    uint32_t allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::IndexType indexType, vk::DeviceSize* offset);
+    uint32_t createBlock(vk::DeviceSize size, vk::IndexType indexType);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    UploadQueue* upload;
+    GpuMeshDecoder* decoder = nullptr;
+    bool deviceAddress = false;
+    vk::DeviceSize blockSize;
+
+    std::vector<Block> blocks;
+};
+}
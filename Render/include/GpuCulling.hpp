@@ -0,0 +1,126 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Matrix.h"
+
+namespace m3d {
+class CommandBuffer;
+class IndirectDraws;
+class ResourceTrash;
+
+/*
+ * Compute culling of the IndirectDraws commands.
+ *
+ * RecordCull runs before the render pass: one invocation per command tests
+ * its bounding sphere against the view frustum and, with occlusion enabled,
+ * against a depth pyramid (Hi-Z) built from the previous frame's depth buffer.
+ * Commands of one meshlet also carry its normal cone and are dropped when
+ * every triangle of it faces away from the eye.
+ * Survivors are written to the culled command buffer. With VK_AMD_draw_indirect_count
+ * they are compacted per batch and counted, otherwise culled commands keep
+ * their slot with instanceCount = 0.
+ *
+ * RecordDepthPyramid runs after the render pass and reduces the depth buffer
+ * into the max-depth mip chain the next frame tests against.
+ */
+class GpuCulling {
+public:
+    static const uint32_t GroupSize = 64;
+    static const uint32_t MaxBatches = 256;
+    static const uint32_t MaxPyramidLevels = 16;
+
+    GpuCulling(vk::Device&, vk::PhysicalDevice&, IndirectDraws& indirect, bool occlusion);
+    ~GpuCulling();
+
+    // Depth buffer the pyramid is built from, (re)creates the pyramid. Called whenever the depth buffer is created,
+    // with trash the previous pyramid is released once the frames using it completed.
+    void SetDepthSource(CommandBuffer& commandBuffer, vk::Image depthImage, vk::Format depthFormat, uint32_t width, uint32_t height,
+        ResourceTrash* trash = nullptr);
+    // Frustum and world space eye of the camera the scene is rendered with, plus the draw count of the last
+    // IndirectDraws::Update. The parameter buffer must not be in use by the GPU.
+    void Update(const m3d::math::Matrix4x4& viewProjection, const float eye[3]);
+
+    // Outside of a render pass, before the indirect draws.
+    void RecordCull(vk::CommandBuffer cmd);
+    // Outside of a render pass, after the depth buffer was written.
+    void RecordDepthPyramid(vk::CommandBuffer cmd);
+
+    // Count buffer compaction, only with VK_AMD_draw_indirect_count
+    bool IsCompacting() const { return compact; }
+    void DrawIndexedIndirectCount(vk::CommandBuffer cmd, vk::DeviceSize offset, uint32_t batch, uint32_t maxDrawCount, uint32_t stride) const;
+
+    vk::Buffer GetCulledCommandBuffer() const { return culledCommands.buffer; }
+    bool IsOcclusionEnabled() const { return occlusion; }
+
+private:
+    // std140 layout of the cull.comp parameters
+    struct CullParams {
+        float planes[6][4];
+        m3d::math::Matrix4x4 viewProjection;
+        float pyramidSize[4];
+        // xyz world space eye
+        float eye[4];
+        uint32_t drawCount;
+        uint32_t occlusion;
+        uint32_t compact;
+        uint32_t pad;
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    vk::ShaderModule loadShader(const char* fileName);
+    void createPipelines();
+    void destroyPyramid(ResourceTrash* trash);
+    void writeDescriptors();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    IndirectDraws& indirect;
+    bool occlusion;
+    bool compact;
+    PFN_vkCmdDrawIndexedIndirectCountAMD drawIndexedIndirectCountAMD;
+
+    Buffer params;
+    CullParams* mappedParams;
+    Buffer culledCommands;
+    Buffer drawCounts;
+
+    /* Hi-Z */
+    vk::Image depthImage;
+    vk::ImageAspectFlags depthAspect;
+    vk::ImageView depthView;
+    uint32_t depthWidth;
+    uint32_t depthHeight;
+    vk::Image pyramid;
+    vk::DeviceMemory pyramidMemory;
+    vk::ImageView pyramidView;
+    std::vector<vk::ImageView> pyramidMipViews;
+    uint32_t pyramidWidth;
+    uint32_t pyramidHeight;
+    uint32_t pyramidLevels;
+    vk::Sampler sampler;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout cullSetLayout;
+    vk::DescriptorSetLayout reduceSetLayout;
+    vk::PipelineLayout cullPipelineLayout;
+    vk::PipelineLayout reducePipelineLayout;
+    vk::Pipeline cullPipeline;
+    vk::Pipeline reducePipeline;
+    vk::DescriptorSet cullSet;
+    std::vector<vk::DescriptorSet> reduceSets;
+};
+}
@@ -0,0 +1,147 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+struct Mesh;
+class SubmitTimeline;
+
+/*
+ * MeshCodec geometry decoded by a compute shader, into GeometryArena blocks.
+ *
+ * Meshes a LoadMeshes of Scene::gpuGeometryDecode left encoded are uploaded
+ * as they are cooked: Decode writes a mesh's encoded vertex and index streams
+ * into a persistently mapped ring the shader reads, and one job per codec
+ * chunk. Submit closes the batch and defers it on the timeline like an
+ * UploadQueue batch; Poll retires finished batches, recycles their ring space
+ * and runs their callbacks. Only the encoded bytes cross the bus and the CPU
+ * does not decode.
+ *
+ * mesh_decode.comp runs a vertex chunk per workgroup: every invocation takes
+ * a group of 16 vertices of a byte plane at a time, a scan over the
+ * workgroup gives each its bits' offset and the delta sum ahead of it. Index
+ * chunks are varints that depend on each other, an invocation decodes one
+ * sequentially; 16 bit indices are written in pairs, so their chunks have to
+ * start at even indices. Streams that are too short decode to 0, indices at
+ * or past the vertex count to 0, nothing is written outside of the mesh.
+ *
+ * The blocks need storage buffer usage. The queue of the timeline has to
+ * support compute, a frame flushed after a batch draws what it decoded.
+ */
+class GpuMeshDecoder {
+public:
+    typedef std::function<void()> Callback;
+
+    static const vk::DeviceSize DefaultRingSize = 32 * 1024 * 1024;
+    static const uint32_t GroupSize = 64;
+
+    // submits to the queue of timeline, of family queueFamilyIndex
+    GpuMeshDecoder(vk::Device&, vk::PhysicalDevice&, SubmitTimeline& timeline, uint32_t queueFamilyIndex, vk::DeviceSize ringSize = DefaultRingSize);
+    ~GpuMeshDecoder();
+
+    GpuMeshDecoder(const GpuMeshDecoder&) = delete;
+    GpuMeshDecoder& operator=(const GpuMeshDecoder&) = delete;
+
+    // mesh's geometry is released and its encoded streams are intact and fit the ring, Decode takes it
+    bool CanDecode(const Mesh& mesh) const;
+    // Decode mesh into block: its vertices at vertexOffset and its indices of indexType at indexOffset, in bytes
+    void Decode(const Mesh& mesh, vk::Buffer block, vk::DeviceSize vertexOffset, vk::DeviceSize indexOffset, vk::IndexType indexType);
+    // Close the open batch and submit it, onComplete runs from Poll() once the decoded meshes can be drawn
+    void Submit(Callback onComplete = Callback());
+    // Retire finished batches and run their callbacks, call once per frame
+    void Poll();
+    // Block until every submitted batch has finished
+    void WaitIdle();
+    // Nothing decoding or waiting for Poll
+    bool IsIdle() const { return dispatches.empty() && inFlight.empty(); }
+
+    // encoded bytes written to the ring so far, what crossed the bus instead of the decoded geometry
+    uint64_t GetEncodedBytes() const { return encodedBytes; }
+    // bytes the decoded geometry takes in the blocks so far
+    uint64_t GetDecodedBytes() const { return decodedBytes; }
+
+private:
+    // std430 layout of mesh_decode.comp's jobs
+    struct Job {
+        // of the chunk in the ring and its size, in bytes
+        uint32_t source;
+        uint32_t size;
+        // vertices or indices it decodes to
+        uint32_t count;
+        // word of the block its first vertex or index goes to
+        uint32_t target;
+        // of the mesh, larger indices decode to 0
+        uint32_t vertexCount;
+        uint32_t shortIndices;
+        uint32_t pad[2];
+    };
+
+    // push constants of mesh_decode.comp
+    struct Constants {
+        // ring word of the first job
+        uint32_t firstJob;
+        uint32_t jobCount;
+        // 0 vertex jobs, 1 index jobs
+        uint32_t indices;
+    };
+
+    // the vertex jobs of a mesh and its index jobs behind them, firstJob in ring words
+    struct Dispatch {
+        vk::Buffer block;
+        uint32_t firstJob;
+        uint32_t vertexJobs;
+        uint32_t indexJobs;
+    };
+
+    struct Batch {
+        vk::CommandBuffer cmd;
+        // a set per block the batch decodes into
+        vk::DescriptorPool descriptorPool;
+        // SubmitTimeline value
+        uint64_t value;
+        uint64_t ringEnd;
+        std::vector<Callback> callbacks;
+    };
+
+    void createPipeline();
+    // size bytes of the ring, 16 byte aligned; retires or submits batches until there is room
+    uint64_t allocate(vk::DeviceSize size);
+    void submitBatch();
+    void retire(Batch& batch);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    SubmitTimeline& timeline;
+
+    vk::CommandPool cmdPool;
+    std::vector<vk::CommandBuffer> freeCmdBuffers;
+
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+
+    /* Ring of encoded streams and jobs, head and tail are running byte counters */
+    vk::Buffer ringBuffer;
+    vk::DeviceMemory ringMemory;
+    uint8_t* ringMapped;
+    vk::DeviceSize ringSize;
+    uint64_t ringHead = 0;
+    uint64_t ringTail = 0;
+    uint64_t encodedBytes = 0;
+    uint64_t decodedBytes = 0;
+
+    // of the open batch
+    std::vector<Dispatch> dispatches;
+    std::deque<Batch> inFlight;
+};
+}
@@ -0,0 +1,137 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Named GPU and CPU time scopes and a rolling report of them.
+ *
+ * GPU scopes are pairs of timestamps written into a query pool, per frame
+ * slot: a command buffer that renders slot s calls BeginSlot once, outside a
+ * render pass, then Begin and End around each pass. Static command buffers
+ * keep the queries they were recorded with and write them on every
+ * submission. Once a submission's fence passed Resolve reads the slot's
+ * results without waiting, framesInFlight frames after they were recorded.
+ *
+ * With pipeline statistics a GPU scope also counts the vertex, clipping,
+ * fragment and compute shader work of its commands, in a query pool of its
+ * own read back with the timestamps. Such a query must begin and end in one
+ * subpass, a scope that spans subpasses passes countPipeline false; they may
+ * not nest either, a scope begun inside a counted one is only timed. With
+ * multiview the implementation may write a query per view, the renderer does
+ * not count then.
+ *
+ * CPU scopes time main thread work, CpuScope around a block or AddCpuTime.
+ * Both land in a history of the last HistoryFrames frames, EndFrame moves to
+ * the next one; Report prints every scope's average and maximum over it and
+ * whether the frame is bound by the CPU or the GPU. Main thread only.
+ */
+class GpuProfiler {
+public:
+    static const uint32_t MaxScopes = 16;
+    static const uint32_t HistoryFrames = 64;
+    static const uint32_t InvalidScope = 0xFFFFFFFF;
+
+    // what a scope's pipeline statistics count, in the order of their query bits
+    enum Statistic {
+        VertexInvocations,
+        ClippingInvocations,
+        ClippingPrimitives,
+        FragmentInvocations,
+        ComputeInvocations,
+        StatisticCount
+    };
+
+    // Times the scopes of slots frame slots on queue family queueFamilyIndex, and counts their pipeline
+    // statistics when asked to and the device has the pipelineStatisticsQuery feature enabled
+    GpuProfiler(vk::Device&, vk::PhysicalDevice&, uint32_t queueFamilyIndex, uint32_t slots, bool pipelineStatistics = false);
+    ~GpuProfiler();
+
+    // false when the queue family has no timestamps, the GPU scopes record nothing then
+    bool IsSupported() const { return static_cast<bool>(queries); }
+    bool HasStatistics() const { return static_cast<bool>(statistics); }
+
+    // Id of the scope with this name, the same for GPU and CPU time; InvalidScope beyond MaxScopes
+    uint32_t GetScope(const char* name);
+
+    // Reset slot's queries, at the start of each command buffer that writes them
+    void BeginSlot(vk::CommandBuffer cmd, uint32_t slot);
+    void Begin(vk::CommandBuffer cmd, uint32_t slot, uint32_t scope, bool countPipeline = true);
+    void End(vk::CommandBuffer cmd, uint32_t slot, uint32_t scope);
+    // The last submission that wrote slot completed
+    void Resolve(uint32_t slot);
+
+    void AddCpuTime(uint32_t scope, double ms);
+    class CpuScope {
+    public:
+        CpuScope(GpuProfiler* profiler, uint32_t scope)
+            : profiler(profiler)
+            , scope(scope)
+            , start(std::chrono::high_resolution_clock::now())
+        {
+        }
+        ~CpuScope()
+        {
+            if (profiler) {
+                profiler->AddCpuTime(scope, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+            }
+        }
+
+    private:
+        GpuProfiler* profiler;
+        uint32_t scope;
+        std::chrono::high_resolution_clock::time_point start;
+    };
+
+    // CPU times from here on are the next frame's
+    void EndFrame();
+    // Average and maximum of every scope over the history, and the average pipeline statistics of the counted
+    // ones. cpuMs and gpuMs are the frame's totals, the larger one decides what the frame is bound by
+    void Report(double cpuMs, double gpuMs) const;
+    // Average per frame over the history of a statistic of scope, 0 for scopes not counted
+    double GetStatistic(uint32_t scope, Statistic statistic) const;
+
+private:
+    struct Scope {
+        std::string name;
+        // per frame of the history, 0 for frames without the scope
+        float cpu[HistoryFrames];
+        float gpu[HistoryFrames];
+        // per frame of the history, 0 for frames without the scope's counts
+        uint64_t counts[HistoryFrames][StatisticCount];
+    };
+
+    static void summarize(const float* history, float& average, float& maximum);
+
+    vk::Device& device;
+    vk::QueryPool queries;
+    // a query per scope and slot, null without pipeline statistics
+    vk::QueryPool statistics;
+    uint32_t slots;
+    // nanoseconds per tick
+    float timestampPeriod = 0.0f;
+    uint64_t timestampMask = 0;
+
+    std::vector<Scope> scopes;
+    // per slot, bit s: scope s has both of its timestamps in the slot's command buffers
+    std::vector<uint32_t> written;
+    std::vector<uint32_t> begun;
+    // per slot, bit s: scope s's statistics query is active, and has ended
+    std::vector<uint32_t> counting;
+    std::vector<uint32_t> counted;
+    uint32_t cpuFrame = 0;
+    // resolved slots go into the history in completion order
+    uint32_t gpuFrame = 0;
+};
+}
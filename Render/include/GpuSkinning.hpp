@@ -0,0 +1,184 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Matrix.h"
+#include "MemoryAllocator.hpp"
+#include "SkeletalAnimation.hpp"
+
+namespace m3d {
+class CommandBuffer;
+
+/*
+ * Compute skinning of every skinned instance of a frame in one dispatch.
+ *
+ * AddMesh appends a mesh's bind pose vertices and indices to two device
+ * local buffers shared by all skinned meshes. Each frame the instances to
+ * skin are added with their joint palettes, RecordSkinning then runs one
+ * workgroup per GroupSize vertices of any instance: the bind pose position
+ * and normal are blended over up to four palette matrices and written as a
+ * PackedVertex into the frame slot's output buffer. Draw binds that buffer
+ * like a GeometryArena block and draws every instance of the slot.
+ *
+ * Morph targets (blend shapes) are uploaded with their mesh, sparse and
+ * regrouped by vertex: each bind pose vertex has a range of (target, delta)
+ * entries, empty for the vertices no target moves. An instance given morph
+ * weights adds the weighted deltas of its range to the bind pose position and
+ * normal before skinning; an instance whose weights are all 0 skips them.
+ *
+ * Palettes, weights, the group table and the dispatch and draw arguments are host
+ * visible per slot and consumed indirectly, so command buffers recorded
+ * once pick up each frame's instances. Palettes are expected to include the
+ * instance's world transform, the skinned vertices are in world space.
+ *
+ * Given a compute queue family apart from the graphics one, each slot's
+ * dispatch is recorded once into a command buffer of that family instead
+ * (GetComputeCommandBuffer). It is submitted to the compute queue ahead of
+ * the frame and overlaps with the graphics work still in flight; the frame
+ * waits on a semaphore the submission signals and RecordAcquire takes the
+ * output's ownership over to the graphics family.
+ */
+class GpuSkinning {
+public:
+    static const uint32_t GroupSize = 64;
+    static const uint32_t InvalidOffset = 0xFFFFFFFF;
+
+    struct SkinnedMesh {
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        // weights AddInstance takes, 0 without morph targets
+        uint32_t morphTargetCount;
+    };
+
+    // slotCount like Pipeline's frame slots, the limits are per slot except maxBindPoseVertices and maxMorphEntries.
+    // Skins on the queues of computeQueueFamily when it differs from graphicsQueueFamily, in the graphics command
+    // buffers otherwise
+    GpuSkinning(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, uint32_t slotCount, uint32_t maxBindPoseVertices,
+        uint32_t maxSkinnedVertices, uint32_t maxJoints, uint32_t maxInstances, uint32_t maxMorphEntries, uint32_t maxMorphWeights,
+        uint32_t graphicsQueueFamily = VK_QUEUE_FAMILY_IGNORED, uint32_t computeQueueFamily = VK_QUEUE_FAMILY_IGNORED);
+    ~GpuSkinning();
+
+    // Upload a mesh's bind pose and its morph targets, blocks until it is on the GPU. Target t moves the next
+    // morphDeltaCounts[t] of morphDeltas, like Mesh::morphTargets. False when the shared buffers are full
+    bool AddMesh(const animation::SkinnedVertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount, SkinnedMesh* mesh,
+        const animation::MorphDelta* morphDeltas = nullptr, const uint32_t* morphDeltaCounts = nullptr, uint32_t morphTargetCount = 0);
+
+    // Start filling slot, no submitted frame may still read it
+    void BeginFrame(uint32_t slot);
+    // Skin mesh with palette this frame, morphed by mesh.morphTargetCount morphWeights when given. Returns the
+    // vertexOffset of its skinned vertices in the slot's output, InvalidOffset when the slot ran out of vertices,
+    // joints, weights or instances
+    uint32_t AddInstance(const SkinnedMesh& mesh, const m3d::math::Matrix4x3* palette, uint32_t jointCount, const float* morphWeights = nullptr);
+
+    // Outside of a render pass, before Draw. Not with async compute
+    void RecordSkinning(vk::CommandBuffer cmd, uint32_t slot);
+    // Async compute: outside of a render pass, before Draw, of a frame that waits on the slot's compute submission
+    void RecordAcquire(vk::CommandBuffer cmd, uint32_t slot) const;
+    bool IsAsync() const { return static_cast<bool>(computePool); }
+    // Async compute: the skinning of slot for the compute queue, submit once BeginFrame of slot returned
+    vk::CommandBuffer GetComputeCommandBuffer(uint32_t slot) const { return slots[slot].compute; }
+    // Inside the render pass with a pipeline of the PackedVertex layout bound
+    void Draw(vk::CommandBuffer cmd, uint32_t slot) const;
+
+    vk::Buffer GetOutputBuffer(uint32_t slot) const { return slots[slot].output.buffer; }
+    uint32_t GetInstanceCount(uint32_t slot) const { return slots[slot].instanceCount; }
+
+private:
+    // std430 layout of skinning.comp's jobs
+    struct Job {
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstJoint;
+        uint32_t outputVertex;
+        uint32_t firstGroup;
+        // of the instance's first weight, InvalidOffset to skip the morph targets
+        uint32_t firstWeight;
+        uint32_t pad[2];
+    };
+
+    // std430 layout of skinning.comp's morph entries, a vertex's range of them is in morphRanges
+    struct MorphEntry {
+        uint32_t target;
+        float position[3];
+        float normal[3];
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Slot {
+        Buffer palettes;
+        Buffer weights;
+        Buffer jobs;
+        // job index of every workgroup
+        Buffer groups;
+        // one VkDispatchIndirectCommand
+        Buffer dispatch;
+        // maxInstances VkDrawIndexedIndirectCommands, unused ones draw no instance
+        Buffer draws;
+        Buffer output;
+        vk::DescriptorSet set;
+        // async compute: RecordSkinning, then the output's release to the graphics family
+        vk::CommandBuffer compute;
+        uint32_t instanceCount;
+        uint32_t vertexCount;
+        uint32_t jointCount;
+        uint32_t groupCount;
+        uint32_t weightCount;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer,
+        const std::vector<uint32_t>& sharedQueueFamilies = std::vector<uint32_t>());
+    void destroyBuffer(Buffer& buffer);
+    void upload(const void* data, vk::DeviceSize size, vk::Buffer target, vk::DeviceSize offset);
+    void createPipeline();
+    void writeDescriptors();
+    void recordDispatch(vk::CommandBuffer cmd, uint32_t slot);
+    void recordComputeCommandBuffers();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    uint32_t maxBindPoseVertices;
+    uint32_t maxSkinnedVertices;
+    uint32_t maxJoints;
+    uint32_t maxInstances;
+    uint32_t maxMorphEntries;
+    uint32_t maxMorphWeights;
+    uint32_t maxGroups;
+    bool multiDraw;
+    uint32_t graphicsQueueFamily;
+    uint32_t computeQueueFamily;
+    // async compute only
+    vk::CommandPool computePool;
+
+    Buffer bindPose;
+    Buffer indices;
+    // first entry and entry count of every bind pose vertex, only written for meshes with morph targets
+    Buffer morphRanges;
+    Buffer morphEntries;
+    uint32_t bindPoseVertexCount;
+    uint32_t bindPoseIndexCount;
+    uint32_t morphEntryCount;
+    std::vector<Slot> slots;
+    // of the last BeginFrame, AddInstance fills it
+    uint32_t currentSlot;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+};
+}
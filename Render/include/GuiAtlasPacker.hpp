@@ -0,0 +1,45 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace m3d {
+
+/*
+ * Build time packing of the GUI's images and button state sprites into a few
+ * atlases, fbxconv guiatlas runs it. GUIElement::GetActiveTextureName names
+ * one texture per image, so a screen drawn from separate textures breaks
+ * GuiRenderer's batches at every change; packed, a whole screen draws from
+ * one or two.
+ *
+ * Images are sorted by height and placed on shelves of atlasSize square
+ * atlases, with their edge texels repeated into a one texel border so linear
+ * filtering never reaches a neighbour. The atlases are written next to the
+ * table as <table>.<n>.ktx, uncompressed R8G8B8A8 to keep the GUI sharp. The
+ * table, data/schema/guiatlas.fbs, maps every image's texture name, its path
+ * relative to root with forward slashes, to its atlas and rect;
+ * GuiRenderer::LoadAtlases adds both and the elements find their regions by
+ * name at load.
+ */
+struct GuiAtlasPackStats {
+    uint32_t images = 0;
+    uint32_t atlases = 0;
+    // texels covered by images over the texels of all atlases
+    float coverage = 0.0f;
+};
+
+// Bump with any change of the table's layout
+uint32_t GuiAtlasVersion();
+
+// Pack images, opened by the paths given and named by their path relative to root, into at most maxAtlases atlases and write them and the table to output.
+// False with error set when an image cannot be read, does not fit an atlas or a file cannot be written
+bool PackGuiAtlases(const std::vector<std::string>& images, const std::string& root, const std::string& output, uint32_t atlasSize,
+    uint32_t maxAtlases, GuiAtlasPackStats* stats, std::string* error);
+}
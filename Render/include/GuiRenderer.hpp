@@ -0,0 +1,293 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "GUIStructures.h"
+#include "MemoryAllocator.hpp"
+#include "PipelineRegistry.hpp"
+#include "vulkanTextureLoader.hpp"
+
+namespace GUISystem {
+class GUIElement;
+class GUIFontRenderer;
+}
+
+namespace m3d {
+class CommandBuffer;
+class UploadQueue;
+
+/*
+ * Batched renderer of GUISystem element trees, one draw per texture atlas.
+ *
+ * Every texture name an element can show is a region of one of a few
+ * atlases. Each frame the visible elements are walked and their quads
+ * bucketed by tree level and atlas, EndFrame writes the buckets back to
+ * back into the frame slot's host visible vertex buffer and one indexed
+ * indirect command per bucket, so command buffers recorded once pick up
+ * each frame's GUI.
+ *
+ * The quads of every element tree handed to Add are kept with the root's
+ * revision, a tree that did not change since is not walked again. Only the
+ * trees added in a frame stay cached.
+ *
+ * Levels are drawn in order without depth, children cover their parents
+ * whatever atlas they come from; siblings of different atlases that
+ * overlap are drawn in atlas order. Levels below MaxLevels share the last
+ * one.
+ *
+ * Text captions are laid out by the font renderer given to SetFont and drawn
+ * from its distance field atlas, after the images of their level. Glyphs
+ * written to the atlas are uploaded in place at EndFrame; a caption shows up
+ * once the upload of all of its glyphs has finished, so frames in flight
+ * never sample texels being written. Without a font captions are skipped.
+ *
+ * Panels that stopped changing are baked: a visible element with children
+ * whose whole subtree CanBeBaked and that kept its revision for
+ * BakeStableFrames walks is rendered once into a rect of the bake atlas, at
+ * EndFrame, and drawn as one premultiplied quad after the atlases of its
+ * level until its revision changes. A rebake takes a new rect, frames in
+ * flight may still sample the old one; once the atlas is full the next
+ * BeginFrame waits for the device and starts it over. Text captions and
+ * images cannot be baked, so neither can the panels holding them.
+ */
+class GuiRenderer {
+public:
+    static const uint32_t MaxAtlases = 16;
+    static const uint32_t MaxLevels = 8;
+    static const uint32_t InvalidAtlas = 0xFFFFFFFF;
+    // the atlases, the glyphs and the baked panels of every level
+    static const uint32_t BucketsPerLevel = MaxAtlases + 2;
+    // texels per side of the texture the panels are baked into
+    static const uint32_t BakeAtlasSize = 2048;
+    // walks of a panel at the same revision before it is baked, panels that change every frame never are
+    static const uint32_t BakeStableFrames = 2;
+
+    // slotCount like Pipeline's frame slots, maxQuads per slot; drawn in subpass of renderPass, with its sample count and
+    // color attachments, the first is blended into
+    GuiRenderer(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, UploadQueue& upload, PipelineRegistry& registry,
+        vk::RenderPass renderPass, uint32_t subpass, vk::SampleCountFlagBits samples, uint32_t colorAttachments, uint32_t slotCount, uint32_t maxQuads);
+    ~GuiRenderer();
+    // fetch both pipelines from registry again, after PipelineRegistry::SwapReloaded
+    void RefreshPipelines(PipelineRegistry& registry);
+
+    // Sample texture for every region added with the returned index, InvalidAtlas when all are taken.
+    // Static command buffers only draw the atlases added before they were recorded, see HasNewAtlases
+    uint32_t AddAtlas(const vkext::VulkanTexture& texture);
+    // Texture name of an element, shown with the atlas texels [u0, u1] x [v0, v1] in 0..1
+    void AddRegion(const std::string& textureName, uint32_t atlas, float u0, float v0, float u1, float v1);
+    // Add the atlases and the region of every image fbxconv guiatlas packed into the table at path, see PackGuiAtlases.
+    // The atlases are kept by the renderer and uploaded before this returns. False when the table or an atlas cannot
+    // be read or too few atlases are left
+    bool LoadAtlases(const std::string& path);
+    // Lays out and draws the text captions, kept for the lifetime of the renderer. Only one font can be set,
+    // its atlas so far is uploaded before this returns
+    void SetFont(GUISystem::GUIFontRenderer& font);
+    // Cache the panels that stopped changing in the bake atlas, on by default; the atlas is created with the first bake
+    void SetPanelBaking(bool enable) { panelBaking = enable; }
+
+    // Start filling slot, no submitted frame may still read it
+    void BeginFrame(uint32_t slot);
+    // Quads of the visible elements and their children, proportions are in pixels of screen.
+    // Elements are the roots of the trees cached by their revision
+    void Add(const std::vector<GUISystem::GUIElement*>& elements, const GUISystem::ElementProportions& screen);
+    // Write the frame's quads and draw commands
+    void EndFrame();
+
+    // Inside the render pass, after the scene
+    void Draw(vk::CommandBuffer cmd, uint32_t slot);
+    // Atlases, the font or the bake atlas were added after the last Draw was recorded
+    bool HasNewAtlases() const
+    {
+        return recordedAtlasCount != atlasSets.size() || recordedFont != (font != nullptr) || recordedBakes != static_cast<bool>(bakeSet);
+    }
+
+    uint32_t GetQuadCount(uint32_t slot) const { return slots[slot].quadCount; }
+    // non-empty buckets of the slot, the draws that do something
+    uint32_t GetDrawCount(uint32_t slot) const { return slots[slot].drawCount; }
+
+private:
+    // matches gui.vert
+    struct Vertex {
+        float position[2];
+        float uv[2];
+        uint32_t color;
+    };
+
+    struct Region {
+        uint32_t atlas;
+        float uv[4];
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    // quads of one element tree, sorted by bucket
+    struct Tree {
+        unsigned int revision;
+        uint32_t regionVersion;
+        unsigned int fontRevision;
+        float screenWidth;
+        float screenHeight;
+        // EndFrame drops the trees not added in its frame
+        uint32_t frame;
+        uint32_t bakeGeneration;
+        // a panel waits to be baked, the tree is walked again
+        bool pendingBakes;
+        std::vector<Vertex> vertices;
+        // first vertex of every bucket and the end
+        std::vector<uint32_t> offsets;
+    };
+
+    // a panel baked or on its way to be, by element
+    struct Panel {
+        unsigned int revision = 0;
+        uint32_t stableWalks = 0;
+        bool baked = false;
+        // what is in the bake atlas: its revision, size and rect in texels
+        unsigned int bakedRevision = 0;
+        uint32_t regionVersion = 0;
+        float width = 0.0f;
+        float height = 0.0f;
+        uint32_t x = 0;
+        uint32_t y = 0;
+    };
+
+    // quads of one atlas in bakeVertices
+    struct BakeDraw {
+        uint32_t atlas;
+        uint32_t firstVertex;
+        uint32_t quads;
+    };
+
+    // one panel EndFrame renders into the bake atlas, its draws in level order
+    struct BakeJob {
+        uint32_t x;
+        uint32_t y;
+        float width;
+        float height;
+        std::vector<BakeDraw> draws;
+    };
+
+    struct Slot {
+        Buffer vertices;
+        // MaxLevels * BucketsPerLevel VkDrawIndexedIndirectCommands, empty buckets draw no instance
+        Buffer draws;
+        uint32_t quadCount;
+        uint32_t drawCount;
+    };
+
+    void addElement(GUISystem::GUIElement& element, const GUISystem::ElementProportions& parent, const GUISystem::ElementProportions& screen,
+        uint32_t level);
+    void addText(GUISystem::GUIElement& element, const GUISystem::ElementProportions& parent, const GUISystem::ElementProportions& screen,
+        uint32_t level);
+    // element as the quad of its bake when it is a panel that stopped changing, true when it was
+    bool addBaked(GUISystem::GUIElement& element, const GUISystem::ElementProportions& screen, uint32_t level);
+    // quads of the subtree into bakeBuckets, relative to panel
+    void addBakeQuads(GUISystem::GUIElement& element, const GUISystem::ElementProportions& panel, uint32_t level);
+    // queue element's bake, false when it cannot be baked now; walkPendingBakes is set when it may be later
+    bool bakePanel(GUISystem::GUIElement& element, Panel& panel);
+    void createBakeAtlas();
+    void destroyBakeAtlas();
+    // render the queued bakes and wait for them
+    void flushBakes();
+    // the quad of p with frame's extent as NDC -1..1
+    static void appendQuad(std::vector<Vertex>& bucket, const GUISystem::ElementProportions& p, const GUISystem::ElementProportions& frame,
+        uint32_t color, const float uv[4]);
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    void destroyBuffer(Buffer& buffer);
+    void createIndices();
+    void createPipeline(PipelineRegistry& registry, vk::RenderPass renderPass, uint32_t subpass, vk::SampleCountFlagBits samples, uint32_t colorAttachments);
+    void createFontImage();
+    void uploadFont(int x, int y, int w, int h);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    UploadQueue& upload;
+    // the bake pipelines are made with the bake atlas
+    PipelineRegistry& registry;
+    uint32_t maxQuads;
+
+    // two triangles per quad, the same for every slot
+    Buffer indices;
+    std::vector<Slot> slots;
+    // of the last BeginFrame
+    uint32_t currentSlot;
+    // quads of the tree being walked by level and atlas, kept to avoid reallocating
+    std::vector<std::vector<Vertex>> buckets;
+    std::unordered_map<std::string, Region> regions;
+    // changes with every AddRegion, the cached trees may use the old one
+    uint32_t regionVersion;
+    std::unordered_map<const GUISystem::GUIElement*, Tree> trees;
+    // in the order of Add
+    std::vector<const Tree*> frameTrees;
+    uint32_t frameNumber;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    std::vector<vk::DescriptorSet> atlasSets;
+    size_t recordedAtlasCount;
+    // the atlases of LoadAtlases, the others belong to the caller
+    std::vector<vkext::VulkanTexture> loadedAtlases;
+    std::vector<MemoryAllocator::Allocation> loadedAtlasMemory;
+    vk::Sampler loadedAtlasSampler;
+    vk::PipelineLayout pipelineLayout;
+    PipelineDesc pipelineDesc;
+    vk::Pipeline pipeline;
+
+    GUISystem::GUIFontRenderer* font;
+    // R8Unorm distance field, in general layout so new glyphs are copied in place
+    vk::Image fontImage;
+    vk::DeviceMemory fontMemory;
+    vk::ImageView fontView;
+    vk::Sampler fontSampler;
+    vk::DescriptorSet fontSet;
+    PipelineDesc textPipelineDesc;
+    vk::Pipeline textPipeline;
+    // atlas revision whose upload has finished, captions needing a later one wait
+    unsigned int fontRevision;
+    bool recordedFont;
+
+    bool panelBaking;
+    std::unordered_map<const GUISystem::GUIElement*, Panel> panels;
+    // R8G8B8A8Unorm premultiplied, in general layout so bakes render next to rects being sampled
+    vk::Image bakeImage;
+    MemoryAllocator::Allocation bakeMemory;
+    vk::ImageView bakeView;
+    vk::Sampler bakeSampler;
+    vk::RenderPass bakePass;
+    vk::Framebuffer bakeFramebuffer;
+    vk::DescriptorSet bakeSet;
+    PipelineDesc bakePipelineDesc;
+    PipelineDesc compositePipelineDesc;
+    vk::Pipeline bakePipeline;
+    vk::Pipeline compositePipeline;
+    // host visible, maxQuads of them; rewritten by every flushBakes, which waits
+    Buffer bakeVertices;
+    std::vector<std::vector<Vertex>> bakeBuckets;
+    std::vector<BakeJob> bakeJobs;
+    uint32_t bakeQuadCount;
+    // shelves of the atlas, rects are taken left to right and never given back until it starts over
+    uint32_t shelfX;
+    uint32_t shelfY;
+    uint32_t shelfHeight;
+    // counts the restarts, trees and panels of an earlier one are stale
+    uint32_t bakeGeneration;
+    bool bakeRestartPending;
+    // set while a tree is walked
+    bool walkPendingBakes;
+    bool recordedBakes;
+};
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FastDelegate.h"
+#include "GUIFlatTree.h"
+#include "StringId.hpp"
+
+namespace GUISystem {
+class GUIElement;
+}
+
+namespace m3d {
+
+/*
+ * GUI screens as data (data/schema/guiscreen.fbs) instead of AddChild, SetPosition, ... calls.
+ *
+ * Shipping builds load the binary form cooked with
+ *     flatc -b data/schema/guiscreen.fbs <screen>.json
+ * which is memory mapped and read in place. The elements are stored depth first with the index
+ * of their parent, so Load creates them in one pass and hands them to the flat tree as they are,
+ * without flattening anything. During development the JSON text loads through the flatbuffers parser.
+ *
+ * Button callbacks are named in the file and bound on load, the layout owns the elements it created.
+ */
+class GuiScreenLayout {
+public:
+    typedef std::map<std::string, fastdelegate::FastDelegate1<GUISystem::GUIElement*>> Bindings;
+
+    GuiScreenLayout() = default;
+    ~GuiScreenLayout();
+
+    // .json is parsed against the schema, anything else is mapped as the binary form. Replaces the elements of an
+    // earlier Load; a callback name without a binding is reported and left unbound
+    bool Load(const std::string& path, const Bindings& bindings, const std::string& schemaPath = "data/schema/guiscreen.fbs");
+
+    const std::vector<GUISystem::GUIElement*>& GetRoots() const { return roots; }
+    // First element of that name in file order, nullptr when there is none. A hash lookup, "name"_id is hashed at
+    // compile time
+    GUISystem::GUIElement* Find(StringId name) const;
+    GUISystem::GUIElement* Find(const std::string& name) const;
+    // Holds every loaded element, lay it out with GUIFlatTree::Layout
+    GUISystem::GUIFlatTree& GetFlatTree() { return flatTree; }
+
+    GuiScreenLayout(const GuiScreenLayout&) = delete;
+    GuiScreenLayout& operator=(const GuiScreenLayout&) = delete;
+
+private:
+    void clear();
+
+    std::vector<GUISystem::GUIElement*> elements;
+    std::vector<GUISystem::GUIElement*> roots;
+    std::unordered_map<StringId, GUISystem::GUIElement*> names;
+    GUISystem::GUIFlatTree flatTree;
+};
+}
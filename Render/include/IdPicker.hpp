@@ -0,0 +1,94 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+namespace m3d {
+
+/*
+ * Picks read out of Pipeline's ID buffer without waiting for the GPU.
+ *
+ * Pick queues a pixel; Record copies the RegionSize x RegionSize texels
+ * around every queued one into the frame's part of a host visible readback
+ * ring, in a command buffer of the frame submitted right after its draws.
+ * Resolve runs once that submission completed, framesInFlight frames later
+ * at the most, and hands each pick the ID under it or, when nothing was
+ * drawn there, the nearest one of its region, so thin and small things are
+ * hit without aiming at the exact pixel. Neither call waits for anything,
+ * hovering can pick every frame.
+ *
+ * The IDs are the ones the bindless indirect shaders write: the transform
+ * entry of the draw (IndirectDraws) and gl_PrimitiveID, the triangle of the
+ * draw's slice or meshlet.
+ */
+class IdPicker {
+public:
+    // texels on each side of a region, odd so the pick is its center
+    static const uint32_t RegionSize = 5;
+    // queued per frame, more are refused until the next Record
+    static const uint32_t MaxPicks = 8;
+
+    // entry and primitive Pipeline::InvalidId when the region holds no ID
+    typedef std::function<void(uint32_t entry, uint32_t primitive)> Callback;
+
+    IdPicker(vk::Device&, MemoryAllocator&, uint32_t queueFamilyIndex, uint32_t framesInFlight);
+    ~IdPicker();
+
+    // Queue a pick of pixel (x, y) of the ID buffer for the next Record. False when MaxPicks are queued
+    bool Pick(uint32_t x, uint32_t y, Callback callback);
+    bool HasQueued() const { return !queued.empty(); }
+
+    // Record the copies of the queued picks into frame's command buffer, idImage is in TRANSFER_SRC_OPTIMAL after
+    // the render pass and the scene covers extent of it. frame's last submission must have completed and been
+    // resolved. False with nothing queued, nothing needs to be submitted then
+    bool Record(uint32_t frame, vk::Image idImage, vk::Extent2D extent);
+    // submit after the frame's draw commands, when Record returned true
+    vk::CommandBuffer GetCommandBuffer(uint32_t frame) const { return frames[frame].commandBuffer; }
+    // frame's last submission completed, call the callbacks of its picks
+    void Resolve(uint32_t frame);
+
+private:
+    struct Request {
+        uint32_t x;
+        uint32_t y;
+        Callback callback;
+    };
+
+    struct Copy {
+        Callback callback;
+        // the pick within the copied region, which stays inside the scene near its edges
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Frame {
+        vk::CommandBuffer commandBuffer;
+        // in flight, pick i in region i of the frame's part of the ring
+        std::vector<Copy> copies;
+    };
+
+private:
+    vk::Device& device;
+    MemoryAllocator& allocator;
+
+    std::vector<Request> queued;
+    std::vector<Frame> frames;
+
+    vk::CommandPool commandPool;
+    // MaxPicks regions per frame in flight
+    vk::Buffer ring;
+    MemoryAllocator::Allocation ringMemory;
+};
+}
@@ -0,0 +1,196 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+#include "PipelineRegistry.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class GeometryArena;
+class IndirectDraws;
+class Pipeline;
+class Scene;
+class SubmitTimeline;
+
+/*
+ * Octahedral impostors of meshes, one textured quad per distant instance in
+ * place of its slices.
+ *
+ * Bake renders a mesh from FramesPerSide x FramesPerSide directions into its
+ * layer of an RGBA8 atlas array, one FrameSize square frame per direction.
+ * Frame (i, j) looks at the mesh's bounding sphere from the direction its
+ * center decodes to on the octahedral square, orthographic and just covering
+ * the sphere, with the colors of the unlit bindless shader (material diffuse
+ * times texture) and alpha 0 where the mesh is not. Baking is lazy: the
+ * renderer bakes the resident meshes of at least minTriangles without one
+ * ahead of re-recording, in a submission on the timeline ahead of the frames
+ * that draw them. Textures streamed in later do not show up in the atlas.
+ * Meshes leaving the scene give their layer back with Release, another mesh
+ * is baked into it once no frame in flight draws it.
+ *
+ * IndirectDraws gives the instances of baked meshes past the impostor
+ * distance ImpostorLod and no commands. BeginFrame rewrites the slot's list of
+ * their transform entries when it changed and the frame's eye; Draw issues
+ * one indirect draw of six vertices per listed instance. The vertex shader
+ * turns the eye into the object space direction of the instance, picks the
+ * nearest frame and spans the quad of that frame's view at the sphere's
+ * center with the instance's world matrix, read from the indirect transforms
+ * so moves need no rewrite. Frames switch without blending, the quad pops
+ * between neighbouring directions.
+ *
+ * The pipeline's set 0 is the scene pipeline's, with its camera block and
+ * transforms; the impostor buffers and the atlas are set 1. Drawn in the
+ * shading subpass after the indirect draws, alpha tested, writing depth.
+ * GPU culling does not see them. One view only.
+ */
+class ImpostorRenderer {
+public:
+    static const uint32_t FramesPerSide = 8;
+    // texels on each side of a frame, an atlas layer is FramesPerSide * FrameSize square
+    static const uint32_t FrameSize = 64;
+
+    // slotCount like Pipeline's frame slots, maxMeshes atlas layers, maxInstances per slot; meshes of fewer than
+    // minTriangles are never baked. Bakes are submitted on the timeline's queue, of queueFamilyIndex
+    ImpostorRenderer(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, PipelineRegistry& registry, Pipeline& pipeline,
+        SubmitTimeline& timeline, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t maxMeshes, uint32_t maxInstances, uint32_t minTriangles);
+    ~ImpostorRenderer();
+    // fetch the pipelines from registry again, after PipelineRegistry::SwapReloaded
+    void RefreshPipelines(PipelineRegistry& registry);
+
+    // Whether a resident mesh of at least minTriangles has no impostor yet and there is a layer left for it
+    bool HasUnbaked(const Scene& scene) const;
+    // Bake every such mesh, ahead of the submissions of the frames drawing them. The scene pipeline's descriptor
+    // set must hold the meshes' materials. Returns the meshes baked, their instances switch at the next Update
+    uint32_t Bake(Scene& scene, GeometryArena& geometry);
+    bool HasImpostor(uint32_t meshID) const { return meshLayers.count(meshID) != 0; }
+    uint32_t GetImpostorCount() const { return static_cast<uint32_t>(meshLayers.size()); }
+    // Give back the layer of a mesh leaving the scene, with its instances. It is baked into again once the frames
+    // submitted so far completed
+    void Release(uint32_t meshID);
+
+    // Start filling slot, no submitted frame may still read it: the impostor instances of draws and the eye
+    void BeginFrame(uint32_t slot, const Scene& scene, const IndirectDraws& draws, const float eye[3]);
+    // instances the last BeginFrame listed
+    uint32_t GetInstanceCount() const { return instanceCount; }
+    // Inside the render pass, in its shading subpass, with the scene pipeline's descriptor set bound as set 0
+    void Draw(vk::CommandBuffer cmd, uint32_t slot) const;
+
+private:
+    // std430 layout of impostor.vert's impostors, the object space bounding sphere of the mesh of a layer
+    struct GpuImpostor {
+        float sphere[4];
+    };
+
+    // std430 layout of impostor.vert's instances
+    struct GpuInstance {
+        // IndirectDraws transform entry
+        uint32_t transform;
+        uint32_t layer;
+    };
+
+    // push constants of impostor_bake.vert and impostor_bake.frag
+    struct BakeConstants {
+        float sphere[4];
+        // the frame's orthographic view: screen axes and the direction it looks from, object space
+        float right[4];
+        float up[4];
+        float forward[4];
+        uint32_t material;
+        uint32_t pad[3];
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Slot {
+        Buffer instances;
+        // one VkDrawIndirectCommand
+        Buffer draw;
+        // the eye, a uniform block of its own
+        Buffer frame;
+        vk::DescriptorSet set;
+        // of IndirectDraws' impostor entries it lists, and of the layers it had then
+        uint64_t revision;
+        uint64_t layerRevision;
+    };
+
+    struct ReleasedLayer {
+        // timeline value of the last frame that may draw it
+        uint64_t submitted;
+        uint32_t layer;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    void destroyBuffer(Buffer& buffer);
+    void createAtlas();
+    void createBakePipeline(PipelineRegistry& registry);
+    void createPipeline(PipelineRegistry& registry);
+    void writeDescriptors();
+    // every layer transparent and readable, before the first Bake
+    void clearAtlas();
+    bool wantsImpostor(const Scene& scene, uint32_t meshID) const;
+    void bakeMesh(const Scene& scene, GeometryArena& geometry, uint32_t meshID, uint32_t layer);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    Pipeline& pipeline;
+    SubmitTimeline& timeline;
+    uint32_t maxMeshes;
+    uint32_t maxInstances;
+    uint32_t minTriangles;
+
+    // atlas layer of each scene mesh with an impostor
+    std::unordered_map<uint32_t, uint32_t> meshLayers;
+    // layers without a mesh; released ones join them when their frames completed, oldest first
+    std::vector<uint32_t> freeLayers;
+    std::deque<ReleasedLayer> releasedLayers;
+    // changes with every bake and release
+    uint64_t layerRevision;
+    // maxMeshes GpuImpostors, written once per layer before its first draw
+    Buffer impostors;
+    uint32_t instanceCount;
+    std::vector<Slot> slots;
+
+    vk::Image atlas;
+    MemoryAllocator::Allocation atlasMemory;
+    vk::ImageView atlasView;
+    std::vector<vk::ImageView> layerViews;
+    std::vector<vk::Framebuffer> framebuffers;
+    vk::Image depth;
+    MemoryAllocator::Allocation depthMemory;
+    vk::ImageView depthView;
+    vk::Format depthFormat;
+    vk::Sampler sampler;
+    vk::RenderPass bakePass;
+
+    vk::CommandPool commandPool;
+    vk::CommandBuffer bakeCommands;
+    // timeline value of the last bake, the command buffer is reused once it completed
+    uint64_t submitted = 0;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout setLayout;
+    // owned by the registry
+    vk::PipelineLayout bakeLayout;
+    vk::PipelineLayout pipelineLayout;
+    PipelineDesc bakeDesc;
+    PipelineDesc pipelineDesc;
+    vk::Pipeline bakePipeline;
+    vk::Pipeline impostorPipeline;
+};
+}
@@ -0,0 +1,272 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Matrix.h"
+
+namespace m3d {
+class GeometryArena;
+class GpuCulling;
+class ImpostorRenderer;
+class Pipeline;
+class Scene;
+class UploadQueue;
+struct Mesh;
+
+/*
+ * GPU-driven draws built from Scene::instances.
+ *
+ * Every instance slice becomes one VkDrawIndexedIndirectCommand whose
+ * firstInstance is its own index (gl_InstanceIndex in the vertex shader)
+ * into the DrawInfo SSBO, which holds the instance's world matrix slot in
+ * the transform SSBO and the slice's material. Commands are grouped per
+ * GeometryArena block so each block costs one drawIndexedIndirect.
+ *
+ * Each command also gets a world space bounding sphere so a GpuCulling pass
+ * can drop it before the render pass; Draw then reads the culled commands.
+ *
+ * With a LOD view set, every instance draws the slices of the coarsest
+ * Mesh::Lod whose error projects to less than a pixel budget. All levels of a
+ * mesh have the same slice count, the command layout does not depend on them.
+ * With impostors set as well, instances of a mesh ImpostorRenderer baked that
+ * are farther than the impostor distance get ImpostorLod instead: a transform
+ * entry but no commands, ImpostorRenderer draws them from GetImpostorEntries.
+ *
+ * With instancing on, the instances drawing the same slice share one command
+ * whose instanceCount covers their consecutive DrawInfo entries.
+ *
+ * With meshlets on, instances drawn at full resolution get one command per
+ * Mesh::Meshlet instead of per slice, each with the meshlet's sphere, so
+ * culling drops the parts of a large mesh that are off screen or hidden.
+ * With cone culling as well, the meshlet's normal cone goes along and the
+ * culling drops meshlets facing away from the eye; only right for scenes
+ * that look the same with back faces culled.
+ *
+ * Every buffer lives in device local memory and is written through the
+ * UploadQueue. Update copies all of them; UploadChanges only the entries
+ * touched since, coalesced into runs that go out as the regions of one copy
+ * per buffer. The copies are recorded into the upload queue's open batch, the
+ * caller submits it and orders the draws after it.
+ *
+ * With transparency on, the slices of Material::Blend::WeightedBlended
+ * materials go into batches of their own, DrawTransparent draws them with
+ * Pipeline's weighted blended pipeline after the opaque ones.
+ *
+ * Without instancing and with drawIndirectFirstInstance, Update leaves some
+ * empty commands at the end of every batch, drawn along with the rest.
+ * AddInstance writes an instance into free ones of its block's batch and
+ * RemoveInstance empties its commands again, so editing the scene changes
+ * neither the batches nor what was recorded from them.
+ *
+ * With vertex pulling (SetVertexPulling) Draw pushes the BufferAddress of the
+ * transforms, the draw infos and every block instead of binding the blocks
+ * as vertex buffers, see Pipeline::Options::vertexPulling.
+ */
+class IndirectDraws {
+public:
+    static const uint32_t DefaultMaxDraws = 65536;
+    static const uint32_t NoInstance = 0xFFFFFFFF;
+    // LOD of the instances drawn as impostors, past every Mesh::Lod
+    static const uint32_t ImpostorLod = 0xFF;
+
+    struct Batch {
+        uint32_t block;
+        uint32_t firstCommand;
+        uint32_t commandCount;
+        // of weighted blended slices, see SetTransparency
+        bool transparent;
+    };
+
+    // std430 layout of one entry in the cull input buffer, matches cull.comp
+    struct CullInfo {
+        float sphere[4];
+        // xyz world space axis, w cutoff, see Mesh::Meshlet
+        float cone[4];
+        uint32_t batch;
+        uint32_t batchFirst;
+        uint32_t pad[2];
+    };
+
+    // std430 layout of one entry in the draw info buffer, matches indirect.vert
+    struct DrawInfo {
+        uint32_t transform;
+        // MaterialTable::GpuIndex of the slice's material
+        uint32_t material;
+    };
+
+    // deviceAddresses gives the transforms and draw infos a BufferAddress, the device has its feature
+    IndirectDraws(vk::Device&, vk::PhysicalDevice&, UploadQueue& upload, uint32_t maxDraws = DefaultMaxDraws, bool deviceAddresses = false);
+    ~IndirectDraws();
+
+    // Rewrite commands and transforms from the scene, the buffers must not be in use by the GPU.
+    void Update(Scene& scene);
+    // Copy what changed since the last Update or UploadChanges: the world matrices and cull infos of the instances
+    // whose transform moved, and the edits below. The frames reading the buffers must be done before the copies
+    // run. Returns the bytes staged, 0 when nothing the draws read changed. LODs stay, see LodSelectionChanged
+    vk::DeviceSize UploadChanges(Scene& scene);
+    // TransformStore slots whose worlds the last UploadChanges copied, sorted; empty after an Update
+    const std::vector<uint32_t>& GetMovedSlots() const { return movedSlots; }
+
+    // Edits of the written draws, copied by the next UploadChanges. False when only an Update gets the instance
+    // in: instancing, no drawIndirectFirstInstance, its block has no batch for its slices or the batch no room left
+    bool AddInstance(Scene& scene, uint32_t instanceID);
+    // Before or after the scene erased it, false when only an Update takes it out
+    bool RemoveInstance(uint32_t instanceID);
+    // the instances of meshID draw with its current Mesh::materialIds. False when a slice changed between an opaque
+    // and a transparent material, only an Update moves its draws into the other batch
+    bool UpdateMaterials(const Scene& scene, uint32_t meshID);
+    // eye in world space, pixelScale as from Camera::PixelScale; 0 draws every instance at full resolution
+    void SetLodView(const float eye[3], float pixelScale, float maxPixelError = 1.0f);
+    // Whether an instance written by the last Update or AddInstance would pick another LOD for the current view
+    bool LodSelectionChanged(const Scene& scene) const;
+    // Instances of meshes impostors has baked that are at least distance away from the LOD view's eye get ImpostorLod
+    // from the next Update or AddInstance on, nullptr draws every instance with its meshes again
+    void SetImpostors(const ImpostorRenderer* impostorRenderer, float distance)
+    {
+        impostors = impostorRenderer;
+        impostorDistance = distance;
+    }
+    // transform entries at ImpostorLod, and a counter that changes with them
+    const std::vector<uint32_t>& GetImpostorEntries() const { return impostorEntries; }
+    uint64_t GetImpostorRevision() const { return impostorRevision; }
+    // Merge the draws of a slice into one instanced command from the next Update on, no culling then
+    void SetInstancing(bool enable) { instancing = enable; }
+    bool IsInstancing() const { return instancing; }
+    // Cull meshlets instead of whole slices from the next Update on, coneCulling also drops back facing ones.
+    // Only worth it with culling, which has to be supported
+    void SetMeshlets(bool enable, bool coneCulling = false)
+    {
+        meshlets = enable;
+        meshletCones = coneCulling;
+    }
+    // Batch the slices of Material::Blend::WeightedBlended materials apart from the next Update on, for a Pipeline
+    // with Options::weightedBlended; off, every slice is drawn opaque
+    void SetTransparency(bool enable) { transparency = enable; }
+    bool IsTransparency() const { return transparency; }
+    // Bind each block and issue its indirect draws, the indirect pipeline must be bound. The opaque batches, or with
+    // transparent those of weighted blended slices for the pipeline's transparent subpass
+    void Draw(vk::CommandBuffer cmd, GeometryArena& geometry, bool transparent = false) const;
+    // Draw pushes the addresses pipeline's indirect pipelines pull from, nullptr binds vertex buffers again. Needs
+    // deviceAddresses, the pipeline Options::vertexPulling and the geometry GeometryArena::EnableDeviceAddress
+    void SetVertexPulling(const Pipeline* pipeline) { pulling = pipeline; }
+
+    // Draw from the commands written by culling instead, nullptr goes back to the unculled ones.
+    void SetCulling(GpuCulling* gpuCulling) { culling = gpuCulling; }
+    GpuCulling* GetCulling() const { return culling; }
+    // culled commands keep their firstInstance, so culling needs drawIndirectFirstInstance;
+    // it tests one sphere per command, merged commands have many
+    bool SupportsCulling() const { return firstInstance && !instancing; }
+
+    vk::DescriptorBufferInfo GetTransformDescriptor() const;
+    vk::DescriptorBufferInfo GetDrawInfoDescriptor() const;
+    vk::Buffer GetCommandBuffer() const { return commandBuffer.buffer; }
+    vk::Buffer GetCullInfoBuffer() const { return cullInfoBuffer.buffer; }
+    uint32_t GetMaxDraws() const { return maxDraws; }
+    uint32_t GetDrawCount() const { return drawCount; }
+    // of every command and its instances, before culling; the empty commands of AddInstance are counted
+    uint32_t GetTriangleCount() const { return triangleCount; }
+    const std::vector<Batch>& GetBatches() const { return batches; }
+    // scene instance of a DrawInfo::transform, e.g. from Pipeline's ID buffer; NoInstance once removed
+    uint32_t GetEntryInstance(uint32_t entry) const { return entry < entryInstances.size() ? entryInstances[entry] : NoInstance; }
+
+private:
+    struct DeviceBuffer {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+        // with deviceAddresses, of the transforms and draw infos; 0 otherwise
+        uint64_t address;
+    };
+    static const uint32_t NoMeshlet = 0xFFFFFFFF;
+    static const uint32_t NoDraw = 0xFFFFFFFF;
+    // where the draw info (and cull info) at the same index came from, next links the draws of one transform entry
+    struct DrawSource {
+        uint32_t entry;
+        uint32_t slice;
+        // NoMeshlet for a whole slice
+        uint32_t meshlet;
+        uint32_t next;
+    };
+    // the draws of some instances before they have a place
+    struct PendingDraws {
+        std::vector<vk::DrawIndexedIndirectCommand> commands;
+        std::vector<CullInfo> cullInfos;
+        std::vector<DrawInfo> drawInfos;
+        std::vector<DrawSource> sources;
+    };
+
+    // address: usage and memory for a BufferAddress
+    void createBuffer(vk::BufferUsageFlags usage, vk::DeviceSize size, DeviceBuffer& buffer, bool address = false);
+    uint32_t selectLod(uint32_t meshID, const Mesh& mesh, const float sphere[4], float maxScale) const;
+    // whether the slice goes into a transparent batch
+    bool transparentSlice(const Scene& scene, const Mesh& mesh, uint32_t slice) const;
+    // Append the draws of an instance whose world matrix is entry, firstInstance left at 0, none at ImpostorLod. Returns its LOD
+    uint32_t buildDraws(const Scene& scene, uint32_t instanceID, uint32_t entry, PendingDraws& draws) const;
+    // An empty command in its place, the draw goes back to the free ones of its batch
+    void freeDraw(uint32_t draw);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    UploadQueue& upload;
+    uint32_t maxDraws;
+    bool multiDraw;
+    bool firstInstance;
+    bool instancing;
+    bool meshlets;
+    bool meshletCones;
+    bool transparency;
+
+    DeviceBuffer commandBuffer;
+    DeviceBuffer transformBuffer;
+    DeviceBuffer drawInfoBuffer;
+    DeviceBuffer cullInfoBuffer;
+    GpuCulling* culling;
+    const Pipeline* pulling;
+
+    float lodEye[3];
+    float lodPixelScale;
+    float lodMaxPixelError;
+    const ImpostorRenderer* impostors;
+    float impostorDistance;
+
+    // CPU copies of the device local buffers. Per transform entry its instance or NoInstance once removed, its
+    // LOD and its first draw; per draw, of the draw info and cull info at its index, its source
+    std::vector<m3d::math::Matrix4x4> transforms;
+    std::vector<CullInfo> cullInfos;
+    std::vector<DrawInfo> drawInfos;
+    std::vector<DrawSource> drawSources;
+    std::vector<uint32_t> entryInstances;
+    std::vector<uint8_t> entryLods;
+    std::vector<uint32_t> entryFirstDraw;
+    std::vector<uint32_t> impostorEntries;
+    uint64_t impostorRevision;
+    std::vector<uint32_t> freeEntries;
+    std::unordered_map<uint32_t, uint32_t> instanceEntries;
+    // (TransformStore slot, transform entry), sorted
+    std::vector<std::pair<uint32_t, uint32_t>> slotEntries;
+    // per batch, its empty commands
+    std::vector<std::vector<uint32_t>> batchFree;
+    // written since the last upload: transform entries, draw and cull infos, commands
+    std::vector<uint32_t> dirtyEntries;
+    std::vector<uint32_t> dirtyDraws;
+    std::vector<uint32_t> dirtyCommands;
+    // of the last UploadChanges
+    std::vector<uint32_t> movedSlots;
+
+    uint32_t drawCount;
+    uint32_t triangleCount;
+    std::vector<Batch> batches;
+    // CPU copy, replayed on devices without drawIndirectFirstInstance
+    std::vector<vk::DrawIndexedIndirectCommand> commands;
+};
+}
@@ -0,0 +1,70 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Bounds.hpp"
+
+namespace m3d {
+class Scene;
+class ThreadPool;
+
+/*
+ * Bounding volume hierarchy over Scene::instances in world space.
+ *
+ * Build() splits the instance boxes with a binned SAH, Refit() keeps the
+ * topology and only recomputes boxes, which is enough while instances move
+ * but none are added or removed. Nodes are stored depth first, the left child
+ * right after its parent, so refitting is one backwards pass.
+ *
+ * Instance boxes are the mesh Aabb transformed by the TransformStore world
+ * matrix, call scene.transformStore.Update() first.
+ */
+class InstanceBvh {
+public:
+    static const uint32_t MaxLeafSize = 4;
+
+    // instance boxes are computed on pool when given
+    void Build(const Scene& scene, ThreadPool* pool = nullptr);
+    void Refit(const Scene& scene);
+
+    // Instances whose box is inside or intersects the frustum.
+    void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& instanceIDs) const;
+    // Instances whose box overlaps the given box.
+    void QueryBox(const Aabb& box, std::vector<uint32_t>& instanceIDs) const;
+    // Closest instance whose box is hit within maxT, false if none. Boxes only, no triangles.
+    bool Raycast(const float origin[3], const float direction[3], float maxT, uint32_t* instanceID, float* hitT) const;
+
+    uint32_t GetInstanceCount() const { return static_cast<uint32_t>(instances.size()); }
+    const Aabb& GetBounds() const;
+
+private:
+    struct Node {
+        Aabb bounds;
+        // inner: index of the right child, the left one is the next node. leaf: first entry in instances
+        uint32_t offset;
+        // instances in a leaf, 0 for inner nodes
+        uint32_t count;
+    };
+
+    uint32_t build(uint32_t begin, uint32_t end);
+    Aabb instanceBounds(const Scene& scene, uint32_t instanceID) const;
+    // boxes[i] into the per axis arrays
+    void storeBox(uint32_t i);
+
+private:
+    std::vector<Node> nodes;
+    // instance ids in leaf order, with their world boxes
+    std::vector<uint32_t> instances;
+    std::vector<Aabb> boxes;
+    // the same boxes per axis, the leaves are culled against a frustum by FrustumCullArray
+    std::vector<float> lower[3];
+    std::vector<float> upper[3];
+};
+}
@@ -0,0 +1,174 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CpuTopology.hpp"
+
+namespace m3d {
+
+/*
+ * Work stealing job system, the threading primitive under ThreadPool.
+ *
+ * Every worker owns a deque: jobs it spawns go to the back and it takes
+ * from the back, idle workers steal from the front of the others. Jobs
+ * from other threads are dealt round robin over the workers.
+ *
+ * Dependencies are Counters: Run increments one, the job's completion
+ * decrements it, WaitFor returns at zero. A waiting thread runs other jobs
+ * meanwhile, so a job may wait on jobs it spawned without blocking its
+ * worker, the property fibers would otherwise provide.
+ *
+ * Jobs given to RunOnMainThread only run on the thread that created the
+ * system, inside PumpMainThread or a WaitFor there; Vulkan present and
+ * window calls go through it.
+ *
+ * On processors with big and little cores (CpuTopology.hpp) workers are
+ * pinned to a class of cores. A system of Normal placement has big workers
+ * for all big cores but one, which is left to the main or render thread,
+ * and little workers for the rest; High jobs then only run on big workers
+ * and Background jobs only on little ones, Normal jobs on any.
+ * A system of High or Background placement pins every worker to the big or
+ * the little cores. Threads that are not workers run any job they wait for.
+ *
+ * A system created for a NUMA node runs its workers on that node's cores and
+ * maps their pages there (cpu::BindCurrentThread), whatever the placement;
+ * a headless renderer's GetNumaNode is the node of its GPU.
+ *
+ * Every thread counts the jobs it ran, its steals, how often a deque lock it
+ * took was held by another thread and how long it slept, in counters only it
+ * writes; GetStats reads them for Render/bench/bench_jobs.cpp and profiling.
+ */
+class JobSystem {
+public:
+    struct Stats {
+        // jobs run, and of them the ones taken from another worker's deque
+        uint64_t jobs = 0;
+        uint64_t steals = 0;
+        // deque locks taken, and of them the ones another thread held at the time
+        uint64_t locks = 0;
+        uint64_t contended = 0;
+        // asleep for want of jobs or for a counter
+        double idleMs = 0.0;
+    };
+
+    // What a job needs: High is on the frame's critical path (command recording, culling), Background may take
+    // frames (streaming, decoding, shader compiles). The placement of a system is the priority of its workers
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Background
+    };
+
+    class Counter {
+    public:
+        Counter()
+            : value(0)
+        {
+        }
+        bool Done() const { return value.load() == 0; }
+
+    private:
+        friend class JobSystem;
+        std::atomic<uint32_t> value;
+    };
+
+    // workerCount 0 uses every hardware thread but the calling one, every core of the placement's class, or
+    // every core of numaNode but one. numaNode -1 runs the workers on any node
+    explicit JobSystem(uint32_t workerCount = 0, Priority placement = Priority::Normal, int numaNode = -1);
+    // Runs the jobs still queued on the workers, main thread jobs are dropped
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    void Run(std::function<void()> job, Counter* counter = nullptr, Priority priority = Priority::Normal);
+    void RunOnMainThread(std::function<void()> job, Counter* counter = nullptr);
+    // Blocks until counter is zero, running queued jobs in the meantime
+    void WaitFor(Counter& counter);
+    // Runs the main thread jobs queued so far, call it from the main thread once a frame
+    void PumpMainThread();
+
+    uint32_t GetWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+    // cores worker index is pinned to
+    cpu::CoreClass GetWorkerCores(uint32_t index) const { return workers[index]->cores; }
+    int GetNumaNode() const { return numaNode; }
+    bool IsMainThread() const { return std::this_thread::get_id() == mainThread; }
+
+    // Of worker index, GetWorkerCount() for every other thread together, since the system started or ResetStats
+    Stats GetStats(uint32_t index) const;
+    // of every thread
+    Stats GetStats() const;
+    // while no job runs, or the counts of the running ones are split
+    void ResetStats();
+
+private:
+    struct Job {
+        std::function<void()> run;
+        Counter* counter;
+        Priority priority;
+    };
+
+    // written by the thread they belong to, relaxed
+    struct Counters {
+        std::atomic<uint64_t> jobs{ 0 };
+        std::atomic<uint64_t> steals{ 0 };
+        std::atomic<uint64_t> locks{ 0 };
+        std::atomic<uint64_t> contended{ 0 };
+        std::atomic<uint64_t> idleNs{ 0 };
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+        Counters counters;
+        cpu::CoreClass cores = cpu::CoreClass::Any;
+    };
+
+    // whether thread self may run a job of priority, other threads run any
+    bool accepts(uint32_t self, Priority priority) const;
+    // own deque first, then steal, self is workers.size() on other threads
+    bool tryRunOne(uint32_t self);
+    bool tryRunMain();
+    void execute(Job& job, Counters& counters);
+    Counters& countersOf(uint32_t self) { return self < workers.size() ? workers[self]->counters : external; }
+    // sleep on wake until predicate holds, the time goes to counters
+    template <class Predicate>
+    void sleep(std::unique_lock<std::mutex>& lock, Counters& counters, Predicate predicate);
+    void notify();
+    uint32_t currentWorker() const;
+    void workerLoop(uint32_t index);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::thread::id mainThread;
+    std::mutex mainMutex;
+    std::deque<Job> mainJobs;
+    // of the threads that are not workers, shared by them
+    Counters external;
+    // workers are big and little, jobs go by priority
+    bool split;
+    int numaNode;
+
+    // jobs in the worker deques, sleepers wait for it or a counter to change
+    std::atomic<uint32_t> queued;
+    std::atomic<uint32_t> mainQueued;
+    std::atomic<uint32_t> nextWorker;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stop;
+};
+}
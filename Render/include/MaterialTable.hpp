@@ -0,0 +1,95 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTextureLoader.hpp"
+
+namespace m3d {
+class Pipeline;
+class SamplerCache;
+class Scene;
+class TextureArrays;
+class UploadQueue;
+
+/*
+ * GPU copy of Scene::materials and the texture array of a bindless Pipeline.
+ *
+ * A material lives at the slot of its scene id, so the per draw index written
+ * by IndirectDraws needs no lookup. Its texture is the TextureStreamer id of
+ * its diffuse map, which is also the element of the texture array it samples.
+ * Every element starts out as a 1x1 white texture.
+ *
+ * Without bindless the pipeline samples texture arrays instead: SetTexture
+ * queues the texture for TextureArrays, and a material names the array and
+ * layer it landed in, white until its upload completed.
+ *
+ * The descriptor set cannot change while a frame using it is in flight, so
+ * texture changes are only queued by SetTexture(); Flush() writes them once
+ * the renderer waited for its frames.
+ */
+class MaterialTable {
+public:
+    static const uint32_t MaxMaterials = 4096;
+    static const uint32_t InvalidIndex = 0xFFFFFFFF;
+
+    // std430 layout of one material, matches indirect.frag and indirect_array.frag
+    struct GpuMaterial {
+        // rgb the color, a Material::opacity
+        float diffuse[4];
+        // element of the texture array, InvalidIndex for untextured materials. With texture arrays the array
+        uint32_t texture;
+        // with texture arrays the layer of it, unused otherwise
+        uint32_t layer;
+        uint32_t pad[2];
+    };
+
+    // pipeline must be bindless, or use texture arrays with arrays given; the white texture is uploaded before
+    // this returns
+    MaterialTable(vk::Device&, vk::PhysicalDevice&, UploadQueue&, SamplerCache&, Pipeline&, TextureArrays* arrays = nullptr);
+    ~MaterialTable();
+
+    // Slot of a scene material id, InvalidIndex past MaxMaterials
+    static uint32_t GpuIndex(uint32_t materialID);
+
+    // Rewrite every material of the scene, the buffer must not be in use by the GPU.
+    void Update(const Scene& scene);
+    // the last Update wrote it
+    bool Contains(uint32_t materialID) const { return GpuIndex(materialID) != InvalidIndex && writtenIDs[GpuIndex(materialID)] == materialID; }
+    // Point array element textureID at texture once Flush() runs, an empty texture goes back to white
+    void SetTexture(uint32_t textureID, const vkext::VulkanTexture& texture);
+    bool HasPendingWrites() const;
+    // Write the queued textures into the descriptor set, no frame may be using it
+    void Flush();
+
+private:
+    void createWhiteTexture();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    UploadQueue& upload;
+    SamplerCache& samplers;
+    Pipeline& pipeline;
+    // null when bindless
+    TextureArrays* arrays;
+
+    vk::Buffer materialBuffer;
+    vk::DeviceMemory materialMemory;
+    GpuMaterial* materials;
+    // scene id of the material in every slot
+    std::vector<uint32_t> writtenIDs;
+
+    vkext::VulkanTexture white;
+    // current descriptor of every element, written in runs by Flush
+    std::vector<vk::DescriptorImageInfo> textures;
+    std::vector<uint32_t> pendingTextures;
+};
+}
@@ -0,0 +1,209 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Suballocates buffers and images out of a few large VkDeviceMemory blocks,
+ * keeping far below maxMemoryAllocationCount and off vkAllocateMemory's
+ * latency once the blocks exist.
+ *
+ * Blocks are pooled per memory type, strategy and resource kind:
+ *
+ *   Buddy   power of two ranges that merge with their buddy when freed, for
+ *           resources with independent lifetimes (textures, buffers).
+ *   Linear  a bump pointer that rewinds once everything in the block was
+ *           freed, for resources created and destroyed together (render
+ *           targets, staging of one batch).
+ *
+ * Buffers and linear images never share a block with optimal tiling images
+ * when the device has a bufferImageGranularity above 1, so neighbours can
+ * not alias one granularity page. Requests larger than half a block get a
+ * dedicated allocation, so do lazily allocated ones: tile-based GPUs only
+ * commit their memory per allocation, if at all. Host visible blocks stay
+ * mapped for their lifetime.
+ *
+ * Every allocation counts towards a category, what the resource is for, and
+ * the heap of its memory type. With VK_EXT_memory_budget the heaps' budgets
+ * and usage come from the driver, which also sees memory allocated outside
+ * of this allocator; without it a heap's budget is 80% of its size and its
+ * usage what this allocator holds.
+ *
+ * Integrated GPUs, and discrete ones with resizable BAR, let the host map
+ * all of their device local memory. HasMappableDeviceLocal tells, resources
+ * written once can then live in eDeviceLocal | eHostVisible memory and skip
+ * the staging copy. The 256 MB BAR window of other discrete GPUs does not
+ * count, it is too small to hold them.
+ */
+class MemoryAllocator {
+public:
+    static const vk::DeviceSize DefaultBlockSize = 64 * 1024 * 1024;
+    // smallest buddy range, smaller requests round up to it
+    static const vk::DeviceSize MinBuddySize = 256;
+    static const uint32_t InvalidIndex = 0xFFFFFFFF;
+
+    enum class Strategy {
+        Buddy,
+        Linear
+    };
+
+    // what bufferImageGranularity separates: buffers and linear images versus optimal tiling images
+    enum class ResourceKind {
+        Linear,
+        Optimal
+    };
+
+    // what resources are for, counted separately
+    enum class Category {
+        Mesh,
+        Texture,
+        Attachment,
+        Staging,
+        AccelerationStructure,
+        Other
+    };
+    static const uint32_t CategoryCount = 6;
+    static const char* GetCategoryName(Category category);
+
+    struct Allocation {
+        vk::DeviceMemory memory;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        // persistent mapping of the range, nullptr unless host visible
+        void* mapped = nullptr;
+        uint32_t memoryTypeIndex = InvalidIndex;
+        // InvalidIndex for dedicated allocations
+        uint32_t pool = InvalidIndex;
+        uint32_t block = InvalidIndex;
+        // buddy order of the range
+        uint32_t order = 0;
+        Category category = Category::Other;
+
+        explicit operator bool() const { return static_cast<bool>(memory); }
+    };
+
+    struct Stats {
+        // live vkAllocateMemory allocations, blocks and dedicated ones
+        uint32_t deviceAllocations = 0;
+        uint32_t allocations = 0;
+        // device memory held, and of that what allocations requested
+        vk::DeviceSize reservedBytes = 0;
+        vk::DeviceSize usedBytes = 0;
+        // free space of the blocks and its largest contiguous range
+        vk::DeviceSize freeBytes = 0;
+        vk::DeviceSize largestFreeRange = 0;
+        // 1 - largestFreeRange / freeBytes, 0 when the free space is one range
+        float fragmentation = 0.0f;
+    };
+
+    struct CategoryStats {
+        uint32_t allocations = 0;
+        // requested by the allocations, without the rest of their ranges
+        vk::DeviceSize bytes = 0;
+    };
+
+    struct HeapBudget {
+        vk::DeviceSize size = 0;
+        // what the process may use before the driver starts paging, and what it uses
+        vk::DeviceSize budget = 0;
+        vk::DeviceSize usage = 0;
+        // device memory this allocator holds in the heap, blocks and dedicated allocations
+        vk::DeviceSize allocatorBytes = 0;
+        bool deviceLocal = false;
+    };
+
+    // blockSize is rounded up to a power of two
+    MemoryAllocator(vk::Device&, vk::PhysicalDevice&, vk::DeviceSize blockSize = DefaultBlockSize);
+    ~MemoryAllocator();
+
+    // An empty Allocation when no memory type fits or the device is out of memory
+    Allocation Allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, ResourceKind kind,
+        Strategy strategy = Strategy::Buddy, Category category = Category::Other);
+    // Allocate for the resource and bind it
+    Allocation AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties, Strategy strategy = Strategy::Buddy,
+        Category category = Category::Other);
+    Allocation AllocateImage(vk::Image image, vk::MemoryPropertyFlags properties, bool optimalTiling = true,
+        Strategy strategy = Strategy::Buddy, Category category = Category::Other);
+    // Any thread, the resource bound to it must be destroyed or no longer in use
+    void Free(const Allocation& allocation);
+    // Whether the image can live in memory with properties, e.g. eLazilyAllocated, which desktop GPUs do not have
+    bool SupportsImage(vk::Image image, vk::MemoryPropertyFlags properties) const;
+
+    Stats GetStats(uint32_t memoryTypeIndex) const;
+    Stats GetStats() const;
+    CategoryStats GetStats(Category category) const;
+    void PrintStats() const;
+
+    // Ask the driver for the heap budgets from now on. The instance must have VK_KHR_get_physical_device_properties2
+    // and the device VK_EXT_memory_budget enabled
+    void EnableMemoryBudget(vk::Instance instance);
+    bool HasMemoryBudget() const { return getMemoryProperties2 != nullptr; }
+    // One per memory heap, any thread. The driver's numbers change from call to call, query at most once a frame
+    std::vector<HeapBudget> GetHeapBudgets() const;
+
+    // A host visible, coherent device local memory type whose heap is as large as the largest device local heap
+    bool HasMappableDeviceLocal() const { return mappableDeviceLocal; }
+
+    // Allocate every device memory with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT from now on, for buffers read through
+    // their device address. Before the first allocation, the device must have VK_KHR_buffer_device_address enabled
+    void EnableDeviceAddress() { deviceAddress = true; }
+
+private:
+    struct Block {
+        vk::DeviceMemory memory;
+        uint8_t* mapped;
+        uint32_t liveAllocations;
+        vk::DeviceSize usedBytes;
+        // buddy: free range offsets per order
+        std::vector<std::set<vk::DeviceSize>> freeRanges;
+        // linear: bump pointer
+        vk::DeviceSize cursor;
+    };
+    struct Pool {
+        uint32_t memoryTypeIndex;
+        Strategy strategy;
+        ResourceKind kind;
+        std::vector<Block> blocks;
+    };
+
+    uint32_t findMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags properties) const;
+    uint32_t findPool(uint32_t memoryTypeIndex, Strategy strategy, ResourceKind kind);
+    // index of a new block in the pool, InvalidIndex when the device is out of memory
+    uint32_t createBlock(Pool& pool);
+    bool allocateBuddy(Block& block, uint32_t order, vk::DeviceSize* offset);
+    void freeBuddy(Block& block, vk::DeviceSize offset, uint32_t order);
+    void releaseBlock(Block& block);
+    void addStats(const Pool& pool, Stats& stats) const;
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    vk::DeviceSize blockSize;
+    // orders 0 .. maxOrder, MinBuddySize << maxOrder == blockSize
+    uint32_t maxOrder;
+    bool separateKinds;
+    bool mappableDeviceLocal;
+
+    mutable std::mutex mutex;
+    std::vector<Pool> pools;
+    // dedicated allocations per memory type, for the stats
+    std::vector<uint32_t> dedicatedCounts;
+    std::vector<vk::DeviceSize> dedicatedBytes;
+    CategoryStats categories[CategoryCount];
+    // vkGetPhysicalDeviceMemoryProperties2KHR, which the vulkan headers do not declare yet
+    PFN_vkVoidFunction getMemoryProperties2 = nullptr;
+    bool deviceAddress = false;
+};
+}
@@ -0,0 +1,60 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GUIStructures.h"
+
+namespace GUISystem {
+class GUIElement;
+class GUITextCaption;
+}
+
+namespace m3d {
+class GuiRenderer;
+class MemoryAllocator;
+
+/*
+ * Text lines in the top left corner of the screen with the heaps' usage
+ * against their budgets and the bytes of every allocation category, drawn
+ * by a GuiRenderer with the font set on it.
+ *
+ * Refresh re-reads the allocator every refreshFrames calls: the captions
+ * only change, and their quads are only laid out again, when the numbers
+ * do. Heaps above warnFraction of their budget are drawn in red.
+ */
+class MemoryOverlay {
+public:
+    // fontFace as the GuiRenderer's font renderer knows it, fontSize in pixels
+    MemoryOverlay(const std::string& fontFace, int fontSize = 14, uint32_t refreshFrames = 30, float warnFraction = 0.9f);
+    ~MemoryOverlay();
+
+    // Once per frame, before Add
+    void Refresh(const MemoryAllocator& allocator);
+    // From the GUI callback
+    void Add(GuiRenderer& gui, const GUISystem::ElementProportions& screen);
+
+private:
+    // line index, created on first use
+    GUISystem::GUITextCaption& line(uint32_t index);
+    void setLine(uint32_t index, const char* text, bool warn);
+
+    std::string fontFace;
+    int fontSize;
+    uint32_t refreshFrames;
+    float warnFraction;
+    uint32_t frame = 0;
+
+    std::vector<GUISystem::GUITextCaption*> captions;
+    // the captions shown, each its own tree for GuiRenderer
+    std::vector<GUISystem::GUIElement*> elements;
+    std::vector<bool> warnings;
+};
+}
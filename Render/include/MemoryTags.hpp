@@ -0,0 +1,104 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Allocator.h"
+
+/*
+ * Which subsystem owns the process' RAM.
+ *
+ *   M3D_MEMORY_TAG(Scene);           // the rest of the block allocates for the scene
+ *
+ * With M3D_MEMORY_TAGS the global operator new and delete and memtag's
+ * Mallocator put a 16 byte header in front of every block holding its size
+ * and the tag of the innermost scope of the allocating thread; the block is
+ * counted against that tag until it is freed, on whatever thread. Per tag
+ * there are the live bytes, their peak and the allocations made, which
+ * RendererVulkan::SetMetrics exports and the stats overlay shows. Threads
+ * outside any scope allocate Untagged, a scope does not follow work handed to
+ * a job or another thread.
+ *
+ * The counters are relaxed atomics shared by every thread, a profiling
+ * build's cost. Without M3D_MEMORY_TAGS, the default, operator new is the
+ * library's, the scopes compile to nothing and GetStats is all zeros.
+ */
+#if !defined(M3D_MEMORY_TAGS)
+#define M3D_MEMORY_TAGS 0
+#endif
+
+namespace m3d {
+namespace memtag {
+    enum class Tag : uint8_t {
+        Untagged,
+        Scene,
+        Render,
+        Gui,
+        Animation,
+        IO,
+        Count
+    };
+    static const uint32_t TagCount = static_cast<uint32_t>(Tag::Count);
+
+    struct Stats {
+        uint64_t liveBytes;
+        uint64_t peakBytes;
+        // since the start, a rate is the difference of two reads
+        uint64_t allocations;
+    };
+
+    inline bool IsEnabled() { return M3D_MEMORY_TAGS != 0; }
+    const char* GetTagName(Tag tag);
+    Stats GetStats(Tag tag);
+
+    // the calling thread's, what its allocations are counted against
+    Tag GetTag();
+    void SetTag(Tag tag);
+
+    // malloc and free with the header, what the replaced operator new and delete call
+    void* Allocate(size_t bytes);
+    void Free(void* p);
+
+    class Scope {
+    public:
+        explicit Scope(Tag tag)
+            : previous(GetTag())
+        {
+            SetTag(tag);
+        }
+        ~Scope() { SetTag(previous); }
+
+    private:
+        Tag previous;
+    };
+
+    // Mallocator of the composable allocators, counted against the allocating thread's tag
+    class Mallocator {
+    public:
+        Blk allocate(size_t bytes)
+        {
+            if (bytes == 0) {
+                return { nullptr, 0 };
+            }
+            void* p = Allocate(bytes);
+            return { p, p ? bytes : 0 };
+        }
+
+        void deallocate(Blk blk) { Free(blk.ptr); }
+    };
+}
+}
+
+#if M3D_MEMORY_TAGS
+#define M3D_MEMORY_TAG_CONCAT_(a, b) a##b
+#define M3D_MEMORY_TAG_CONCAT(a, b) M3D_MEMORY_TAG_CONCAT_(a, b)
+#define M3D_MEMORY_TAG(tag) ::m3d::memtag::Scope M3D_MEMORY_TAG_CONCAT(memoryTag, __LINE__)(::m3d::memtag::Tag::tag)
+#else
+#define M3D_MEMORY_TAG(tag)
+#endif
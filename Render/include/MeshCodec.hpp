@@ -0,0 +1,52 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace m3d {
+struct PackedVertex;
+
+/*
+ * Lossless codecs of the cooked vertex and index streams.
+ *
+ * Vertices are split into the byte planes of PackedVertex. Every byte is kept
+ * as the zigzag of its difference to the same byte of the previous vertex,
+ * groups of 16 are bit packed at the narrowest of 0, 2, 4 or 8 bits that holds
+ * them, a 2 bit width per group ahead of the plane. The vertex fetch order of
+ * OptimizeVertexFetch keeps neighbours close.
+ *
+ * Indices are one varint each: 0 for the first vertex no index referenced yet,
+ * otherwise 1 + the zigzag of the difference to the previous index.
+ *
+ * Both streams are cut into chunks that start from a reset state, so every
+ * chunk decodes on its own and a mesh decodes on as many threads as it has
+ * chunks.
+ */
+struct CodecChunk {
+    // bytes of the chunk in the encoded stream
+    uint32_t offset;
+    uint32_t size;
+    // vertices or indices it decodes to
+    uint32_t first;
+    uint32_t count;
+};
+
+// Append the encoded vertices to data and one chunk per chunkVertices vertices to chunks.
+void EncodeVertices(const PackedVertex* vertices, size_t count, std::vector<uint8_t>& data, std::vector<CodecChunk>& chunks,
+    uint32_t chunkVertices = 16384);
+// Decode one chunk of EncodeVertices into vertices[chunk.first]. False when data is too short for it.
+bool DecodeVertexChunk(const uint8_t* data, size_t size, const CodecChunk& chunk, PackedVertex* vertices);
+
+// Append the encoded indices to data and one chunk per chunkIndices indices to chunks, chunkIndices a multiple of 3.
+void EncodeIndices(const uint32_t* indices, size_t count, std::vector<uint8_t>& data, std::vector<CodecChunk>& chunks,
+    uint32_t chunkIndices = 3 * 16384);
+// Decode one chunk of EncodeIndices into indices[chunk.first]. False when data is too short for it.
+bool DecodeIndexChunk(const uint8_t* data, size_t size, const CodecChunk& chunk, uint32_t* indices);
+}
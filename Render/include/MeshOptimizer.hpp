@@ -0,0 +1,43 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace m3d {
+struct Mesh;
+
+// Merge vertices whose position, normal and uv are bit-identical and remap the indices. With controlPoints,
+// only vertices of the same control point merge.
+void WeldVertices(Mesh& mesh);
+
+// Reorder the triangles of one index range for the post-transform vertex cache
+// (Forsyth, "Linear-Speed Vertex Cache Optimisation"). Triangles stay inside the range.
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Renumber vertices in first-use order of the index buffer so vertex fetch walks memory
+// linearly. Unreferenced vertices are dropped.
+void OptimizeVertexFetch(Mesh& mesh);
+
+// Weld, then reorder every slice for the vertex cache, then reorder vertices for fetch.
+void OptimizeMesh(Mesh& mesh);
+
+// Fill mesh.lods with up to maxLods coarser levels, each with about half the triangles of the one before.
+// Vertices are clustered on a grid and every cluster collapses onto the member with the smallest quadric
+// error (Lindstrom, "Out-of-Core Simplification of Large Polygonal Models"). Levels only reference existing
+// vertices, their index ranges are appended to mesh.indices. Stops before a level drops under minTriangles.
+void GenerateLods(Mesh& mesh, uint32_t maxLods = 3, uint32_t minTriangles = 64);
+
+// Fill mesh.meshlets by splitting every LOD 0 slice into consecutive triangle runs that reference at most
+// maxVertices distinct vertices and hold at most maxTriangles triangles. The index buffer is left as is, the
+// vertex cache order keeps runs compact. Each gets a bounding sphere and a normal cone for backface culling.
+void BuildMeshlets(Mesh& mesh, uint32_t maxVertices = 64, uint32_t maxTriangles = 124);
+
+// Average cache miss ratio (transformed vertices per triangle) of a FIFO cache, 3.0 is no reuse.
+float AverageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 32);
+}
@@ -0,0 +1,115 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace m3d {
+
+/*
+ * Counters, gauges and histograms for the operations of render servers,
+ * exported in the Prometheus text format.
+ *
+ *   Metrics metrics;
+ *   Metrics::Counter& renders = metrics.AddCounter("m3d_renders_total", "Offscreen renders read back");
+ *   renders.Add();                      // any thread, no lock
+ *   metrics.Serve(9100);                // GET /metrics, or
+ *   metrics.WriteFile("m3d.prom");      // node_exporter's textfile collector
+ *
+ * Metrics are added once at setup and live as long as the Metrics, under a
+ * mutex; updating one is a relaxed atomic operation, a histogram's sum a
+ * compare and swap loop. Format reads every value without stopping the
+ * writers, a scrape may see a histogram's count one observation ahead of its
+ * sum. Rates such as renders per second are the scraper's rate() over a
+ * counter.
+ *
+ * RendererVulkan::SetMetrics adds the renderer's: frame times, offscreen
+ * queue depth, upload bytes, device memory and renders, and the RAM of each
+ * memory tag in builds with M3D_MEMORY_TAGS.
+ */
+class Metrics {
+public:
+    class Counter {
+    public:
+        void Add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value{ 0 };
+    };
+
+    class Gauge {
+    public:
+        void Set(double value);
+        double Get() const;
+
+    private:
+        // the double's bits, std::atomic<double> has no lock free guarantee
+        std::atomic<uint64_t> bits{ 0 };
+    };
+
+    class Histogram {
+    public:
+        // bounds ascending, the upper bound of each bucket; +Inf is added
+        explicit Histogram(const std::vector<double>& bounds);
+        void Observe(double value);
+
+    private:
+        friend class Metrics;
+        std::vector<double> bounds;
+        // per bucket, not cumulative, the last one for +Inf
+        std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+        std::atomic<uint64_t> sumBits{ 0 };
+    };
+
+    Metrics();
+    ~Metrics();
+
+    // name in the Prometheus syntax, help a line of text. The reference stays valid as long as the Metrics
+    Counter& AddCounter(const char* name, const char* help);
+    Gauge& AddGauge(const char* name, const char* help);
+    Histogram& AddHistogram(const char* name, const char* help, const std::vector<double>& bounds);
+
+    // Every metric in the text exposition format, version 0.0.4
+    std::string Format() const;
+    // Format into path, through a file next to it and a rename so readers never see half of it
+    bool WriteFile(const std::string& path) const;
+
+    // Answer GET /metrics with Format on port of every interface, from a thread of its own. false when
+    // the port can not be bound or a server already runs
+    bool Serve(uint16_t port);
+    // Stop the server within its poll interval, nothing without one
+    void StopServing();
+
+private:
+    enum class Type { Counter, Gauge, Histogram };
+    struct Entry {
+        std::string name;
+        std::string help;
+        Type type;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+    };
+
+    void serve();
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+
+    std::thread server;
+    std::atomic<bool> serving{ false };
+    // the listening socket, a SOCKET on Windows
+    intptr_t listener = -1;
+};
+}
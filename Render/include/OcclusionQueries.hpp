@@ -0,0 +1,117 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "Bounds.hpp"
+#include "MemoryAllocator.hpp"
+#include "PipelineRegistry.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class Pipeline;
+
+/*
+ * Hardware occlusion queries of heavy instances, the ones whose mesh has at
+ * least minTriangles, fed into VK_EXT_conditional_rendering so the GPU skips
+ * the draws of those it found hidden without the CPU reading anything back.
+ *
+ * Every frame the world box of each visible heavy instance is drawn at the
+ * end of the shading subpass, depth tested against everything drawn before
+ * and without writing anything, inside an occlusion query of its own. After
+ * the render pass the results are copied into the predicate buffer, one
+ * 32 bit value per query, nonzero when samples passed. The next frame draws
+ * an instance queried by the previous one between a begin and an end of
+ * conditional rendering on its value; the others, and the boxes themselves,
+ * are drawn regardless. A hidden instance coming into view shows up one frame
+ * late, the cost of never waiting for the results.
+ *
+ * The boxes are rasterized from gl_VertexIndex without a vertex buffer, both
+ * faces of each, so the camera being inside one still passes samples.
+ *
+ * Recorded by CommandBuffer::RecordFrame, per-frame recordings only. Needs
+ * VK_EXT_conditional_rendering and its conditionalRendering feature.
+ */
+class OcclusionQueries {
+public:
+    static const uint32_t InvalidQuery = 0xFFFFFFFF;
+    static const char* const ExtensionName;
+
+    // the device has the extension and the feature, the instance needs VK_KHR_get_physical_device_properties2
+    static bool IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+    // pNext of the vk::DeviceCreateInfo, enables the feature; next is chained behind it
+    static const void* GetFeatureChain(const void* next = nullptr);
+
+    // slotCount like Pipeline's frame slots, maxQueries heavy instances per frame; the boxes are drawn with the
+    // camera of pipeline
+    OcclusionQueries(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, PipelineRegistry& registry, Pipeline& pipeline,
+        uint32_t slotCount, uint32_t maxQueries, uint32_t minTriangles);
+    ~OcclusionQueries();
+    // fetch the pipeline from registry again, after PipelineRegistry::SwapReloaded
+    void RefreshPipelines(PipelineRegistry& registry);
+
+    uint32_t GetMinTriangles() const { return minTriangles; }
+
+    // Start a frame in slot, the queries of the last one become the predicates
+    void BeginFrame(uint32_t slot);
+    // Query a visible heavy instance in the frame, box in world space. False once maxQueries were added
+    bool AddQuery(uint32_t instanceID, const Aabb& box);
+    // of the frame, heavy instances queried and those drawn under a predicate
+    uint32_t GetQueryCount() const { return static_cast<uint32_t>(boxes.size()); }
+    uint32_t GetConditionalCount() const { return static_cast<uint32_t>(predicates.size()); }
+
+    // Outside the render pass, before it: reset the frame's queries and wait for the previous frame's results
+    void RecordBegin(vk::CommandBuffer cmd);
+    // Around each draw of instanceID, nothing for instances the previous frame did not query. Any thread
+    void BeginConditional(vk::CommandBuffer cmd, uint32_t instanceID) const;
+    void EndConditional(vk::CommandBuffer cmd, uint32_t instanceID) const;
+    // Inside the shading subpass after the scene, the frame's queries; uniformOffset of the frame's camera block
+    void RecordQueries(vk::CommandBuffer cmd, uint32_t uniformOffset);
+    // Outside the render pass, after it: the results into the predicate buffer
+    void RecordEnd(vk::CommandBuffer cmd);
+
+private:
+    // the push constants of occlusion_box.vert
+    struct GpuBox {
+        float lower[4];
+        float upper[4];
+    };
+
+    void loadEntryPoints();
+    void createPipeline(PipelineRegistry& registry);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    Pipeline& pipeline;
+    uint32_t maxQueries;
+    uint32_t minTriangles;
+
+    // the frame's slot, its queries are maxQueries from slot * maxQueries on
+    uint32_t slot;
+    std::vector<GpuBox> boxes;
+    // instance to the query of this frame and to the predicate, the query of the previous one
+    std::unordered_map<uint32_t, uint32_t> queries;
+    std::unordered_map<uint32_t, uint32_t> predicates;
+
+    vk::QueryPool queryPool;
+    // maxQueries 32 bit results of the previous frame, device local
+    vk::Buffer predicateBuffer;
+    MemoryAllocator::Allocation predicateMemory;
+
+    PipelineDesc pipelineDesc;
+    vk::Pipeline boxPipeline;
+
+    PFN_vkVoidFunction cmdBeginConditional = nullptr;
+    PFN_vkVoidFunction cmdEndConditional = nullptr;
+};
+}
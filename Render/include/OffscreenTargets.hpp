@@ -0,0 +1,72 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+namespace m3d {
+class VulkanSwapChain;
+
+/*
+ * Color images standing in for the swapchain's when rendering without a
+ * window, each with a host visible buffer its pixels are read back into.
+ *
+ * Create hands the images and views to a VulkanSwapChain without a surface,
+ * CommandBuffer and Pipeline render into them as into swapchain images. The
+ * render pass leaves them in TRANSFER_SRC_OPTIMAL (Pipeline::Options), the
+ * readback command buffer of an image is recorded once and copies it into its
+ * buffer; it is submitted right after the image's draw commands. Once that
+ * submission's fence passed GetPixels holds the frame, tightly packed BGRA8
+ * rows, until the image is rendered again.
+ *
+ * The buffers prefer cached host memory, the CPU reads every byte of them.
+ */
+class OffscreenTargets {
+public:
+    static const vk::Format ColorFormat = vk::Format::eB8G8R8A8Unorm;
+
+    OffscreenTargets(vk::Device&, vk::PhysicalDevice&, MemoryAllocator&, uint32_t queueFamilyIndex);
+    ~OffscreenTargets();
+
+    // count images of width x height, set as swapChain's images, extent and color format
+    void Create(VulkanSwapChain& swapChain, uint32_t width, uint32_t height, uint32_t count);
+
+    uint32_t GetCount() const { return static_cast<uint32_t>(targets.size()); }
+    vk::Extent2D GetExtent() const { return extent; }
+    // width * 4 bytes
+    uint32_t GetRowPitch() const { return extent.width * 4; }
+    vk::CommandBuffer GetReadbackCommandBuffer(uint32_t image) const { return targets[image].readback; }
+    // The last readback of the image, its submission must have completed
+    const uint8_t* GetPixels(uint32_t image) const { return static_cast<const uint8_t*>(targets[image].bufferMemory.mapped); }
+
+private:
+    struct Target {
+        vk::Image image;
+        vk::ImageView view;
+        MemoryAllocator::Allocation imageMemory;
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation bufferMemory;
+        vk::CommandBuffer readback;
+    };
+
+    void recordReadback(const Target& target);
+    void destroy();
+
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    MemoryAllocator& allocator;
+    uint32_t queueFamilyIndex;
+
+    vk::CommandPool commandPool;
+    vk::Extent2D extent;
+    std::vector<Target> targets;
+};
+}
@@ -0,0 +1,245 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+#include "PipelineRegistry.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class Pipeline;
+
+/*
+ * Particles emitted, simulated and drawn on the GPU, the CPU only knows the
+ * emitters and how many particles each spawns per frame.
+ *
+ * The particles live in one device local pool of maxParticles. Free slots are
+ * on a dead list, the live ones on one of two alive lists; a counter buffer
+ * holds the list lengths and which alive list is current. RecordSimulation
+ * runs before the render pass:
+ *   emit      one invocation per particle the emitters spawn this frame, each
+ *             pops a dead slot and appends it to the current alive list;
+ *             spawns are dropped while the dead list is empty
+ *   args      the simulation's dispatch from the alive count
+ *   simulate  one invocation per alive particle: ages and integrates it, then
+ *             either pushes it on the dead list or appends it to the other
+ *             alive list, compacting the survivors, and to the draw list of
+ *             its blend mode
+ *   args      flips the current list, the draw arguments and the sort size
+ *   sort      bitonic sort of the alpha blended draw list back to front, one
+ *             dispatch per step of the network for maxSorted keys; steps past
+ *             the next power of two of the frame's count return at once
+ * Every count stays on the GPU, the dispatches and draws read them
+ * indirectly, so command buffers recorded once keep simulating. Additive
+ * particles are order independent and never sorted. Alpha blended ones past
+ * maxSorted in a frame are simulated but not drawn.
+ *
+ * Draw issues two indirect draws of camera facing quads from gl_VertexIndex,
+ * additive then sorted alpha blended, in the shading subpass after the
+ * opaque geometry, depth tested without writing depth. The pipelines' set 0
+ * is the scene pipeline's for its camera block, the particle buffers are set 1.
+ * One view only.
+ */
+class ParticleSystem {
+public:
+    static const uint32_t GroupSize = 64;
+    static const uint32_t InvalidEmitter = 0xFFFFFFFF;
+
+    enum class Blend : uint32_t {
+        Additive,
+        // sorted back to front
+        Alpha
+    };
+
+    struct Emitter {
+        // world space
+        float position[3] = { 0.0f, 0.0f, 0.0f };
+        // unit, particles leave within spread radians of it
+        float direction[3] = { 0.0f, 1.0f, 0.0f };
+        float spread = 0.3f;
+        float speed = 1.0f;
+        // particles per second
+        float rate = 100.0f;
+        // seconds
+        float lifetime = 2.0f;
+        // world space width of a particle's quad
+        float size = 0.1f;
+        // the alpha fades out over the lifetime
+        float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        // downward acceleration, world units per second squared
+        float gravity = 0.0f;
+        Blend blend = Blend::Additive;
+    };
+
+    // slotCount like Pipeline's frame slots; maxParticles alive at once, maxSorted alpha blended ones drawn per
+    // frame, a power of two; maxEmitters at once
+    ParticleSystem(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, PipelineRegistry& registry, Pipeline& pipeline,
+        uint32_t slotCount, uint32_t maxParticles, uint32_t maxSorted, uint32_t maxEmitters);
+    ~ParticleSystem();
+    // fetch the pipelines from registry again, after PipelineRegistry::SwapReloaded
+    void RefreshPipelines(PipelineRegistry& registry);
+
+    // Returns the emitter's id, InvalidEmitter when maxEmitters are in use
+    uint32_t AddEmitter(const Emitter& emitter);
+    // e.g. to move it, takes effect at the next BeginFrame
+    void SetEmitter(uint32_t emitterID, const Emitter& emitter);
+    // its particles live out their lifetime
+    void RemoveEmitter(uint32_t emitterID);
+    uint32_t GetEmitterCount() const { return emitterCount; }
+
+    // Start filling slot, no submitted frame may still read it: the spawns of deltaTime seconds and the eye
+    // the alpha blended particles are sorted for
+    void BeginFrame(uint32_t slot, float deltaTime, const float eye[3]);
+    // particles the last BeginFrame spawns
+    uint32_t GetEmitCount() const { return emitCount; }
+
+    // Outside the render pass, before it
+    void RecordSimulation(vk::CommandBuffer cmd, uint32_t slot);
+    // Inside the render pass, in its shading subpass, with the scene pipeline's descriptor set bound as set 0
+    void Draw(vk::CommandBuffer cmd) const;
+
+private:
+    // std430 layout of a particle, the pool's element
+    struct GpuParticle {
+        // xyz, w age
+        float position[4];
+        // xyz, w lifetime
+        float velocity[4];
+        float color[4];
+        float size;
+        float gravity;
+        uint32_t blend;
+        uint32_t pad;
+    };
+
+    // std430 layout of an emitter's spawns in a frame
+    struct GpuEmitter {
+        // xyz, w speed
+        float position[4];
+        // xyz, w cos of the spread
+        float direction[4];
+        float color[4];
+        float lifetime;
+        float size;
+        float gravity;
+        uint32_t blend;
+        // of the frame's spawns, this emitter's are [firstSpawn, firstSpawn + spawnCount)
+        uint32_t firstSpawn;
+        uint32_t spawnCount;
+        uint32_t pad[2];
+    };
+
+    // std140 layout of the simulation's uniform block
+    struct GpuFrame {
+        float eye[4];
+        float deltaTime;
+        uint32_t emitterCount;
+        uint32_t spawnCount;
+        uint32_t seed;
+        uint32_t maxParticles;
+        uint32_t maxSorted;
+        uint32_t pad[2];
+    };
+
+    // the args buffer: the simulation and sort dispatches, the additive and sorted draws
+    struct GpuArgs {
+        vk::DispatchIndirectCommand simulate;
+        vk::DispatchIndirectCommand sort;
+        vk::DrawIndirectCommand additive;
+        vk::DrawIndirectCommand sorted;
+    };
+
+    // particle_args.comp's push constant
+    enum ArgsMode : uint32_t {
+        AfterEmit,
+        AfterSimulate,
+        Reset
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Slot {
+        // GpuEmitters with spawns this frame
+        Buffer emitters;
+        // one VkDispatchIndirectCommand over the spawns
+        Buffer spawn;
+        Buffer frame;
+        vk::DescriptorSet set;
+    };
+
+    struct EmitterState {
+        Emitter emitter;
+        // spawns carried over to the next frame, below one
+        float pending;
+        bool used;
+    };
+
+    void createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer);
+    void destroyBuffer(Buffer& buffer);
+    void createComputePipelines();
+    vk::Pipeline createComputePipeline(const char* shader, const char* name);
+    void createPipelines(PipelineRegistry& registry);
+    void writeDescriptors();
+    // every slot on the dead list, both alive lists empty
+    void reset();
+    void recordArgs(vk::CommandBuffer cmd, ArgsMode mode);
+    // the compute writes so far before the reads of dstStage
+    void computeBarrier(vk::CommandBuffer cmd, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    Pipeline& pipeline;
+    uint32_t maxParticles;
+    uint32_t maxSorted;
+    uint32_t maxEmitters;
+
+    std::vector<EmitterState> emitters;
+    std::vector<uint32_t> freeEmitters;
+    uint32_t emitterCount;
+    uint32_t emitCount;
+    uint32_t frameCount;
+    std::vector<Slot> slots;
+
+    // device local, see the class comment
+    Buffer particles;
+    Buffer deadList;
+    // two lists of maxParticles
+    Buffer aliveLists;
+    Buffer additiveList;
+    // (key, particle) pairs, the key's order is back to front
+    Buffer sortKeys;
+    Buffer counters;
+    Buffer args;
+
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSetLayout computeSetLayout;
+    vk::PipelineLayout computeLayout;
+    vk::Pipeline emitPipeline;
+    vk::Pipeline argsPipeline;
+    vk::Pipeline simulatePipeline;
+    vk::Pipeline sortPipeline;
+
+    // set 1 of the draws, the same for every slot
+    vk::DescriptorSetLayout drawSetLayout;
+    vk::DescriptorSet drawSet;
+    // owned by the registry
+    vk::PipelineLayout drawLayout;
+    PipelineDesc additiveDesc;
+    PipelineDesc alphaDesc;
+    vk::Pipeline additivePipeline;
+    vk::Pipeline alphaPipeline;
+};
+}
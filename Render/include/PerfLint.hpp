@@ -0,0 +1,99 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+/*
+ * Performance lint: counts of anti-patterns the engine and the validation
+ * layers see, per frame.
+ *
+ *   perflint::Enable(true);          // before RendererVulkan::Init
+ *
+ * The renderer then asks the validation layers for performance warnings too
+ * and counts them, and the engine notes what validation does not know about:
+ * binds of the pipeline or descriptor set already bound (BindTracker), device
+ * memory allocations below SmallAllocationBytes, waits for a queue to go idle
+ * between BeginFrame and EndFrame and more than SubmitsPerFrame queue
+ * submissions in a frame. Each issue keeps the site that noted it last,
+ * string literals.
+ *
+ * EndFrame moves the frame's counts to GetFrame, which the stats overlay
+ * shows, and adds them to the totals that Print writes next to the
+ * profiler's report. Note and the bind trackers may be called from any
+ * thread; without Enable they count nothing and cost a relaxed load.
+ */
+namespace m3d {
+namespace perflint {
+    enum class Issue : uint32_t {
+        ValidationWarning,
+        RedundantPipelineBind,
+        RedundantDescriptorBind,
+        SmallAllocation,
+        WaitIdleInFrame,
+        UnbatchedSubmit,
+        Count
+    };
+    static const uint32_t IssueCount = static_cast<uint32_t>(Issue::Count);
+    // below, an allocation of its own wastes one of maxMemoryAllocationCount and a page of the OS
+    static const vk::DeviceSize SmallAllocationBytes = 256 * 1024;
+    // the frame, the uploads and the instance data, each on its queue
+    static const uint32_t SubmitsPerFrame = 4;
+
+    struct Frame {
+        uint32_t counts[IssueCount];
+        // the last site of each issue, nullptr for none
+        const char* sites[IssueCount];
+        // the last validation message code
+        int32_t validationCode;
+    };
+
+    void Enable(bool enable);
+    bool IsEnabled();
+    const char* GetIssueName(Issue issue);
+
+    void Note(Issue issue, const char* site);
+    // an allocation of size bytes of device memory of its own
+    void Allocate(vk::DeviceSize size, const char* site);
+    // a wait for every submission of a queue or the device, an issue within a frame only
+    void WaitIdle(const char* site);
+    // one vkQueueSubmit
+    void Submit(const char* site);
+
+    // Main thread, around RendererVulkan::Draw
+    void BeginFrame();
+    void EndFrame();
+    // of the last EndFrame
+    const Frame& GetFrame();
+    // Totals of every issue since the last Print, and their sites
+    void Print(uint32_t frames);
+
+    // Debug report callback counting performance warnings, then vkx::debug::messageCallback
+    VkBool32 VKAPI_PTR MessageCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t srcObject, size_t location,
+        int32_t msgCode, const char* pLayerPrefix, const char* pMsg, void* pUserData);
+
+    // What a command buffer has bound, binds go through it. Reset at the start of a recording, nothing
+    // is inherited by a secondary command buffer, and after code that binds without the tracker
+    class BindTracker {
+    public:
+        static const uint32_t MaxSets = 4;
+
+        void Reset();
+        void BindPipeline(vk::CommandBuffer cmd, vk::Pipeline pipeline, const char* site);
+        void BindDescriptorSet(vk::CommandBuffer cmd, vk::PipelineLayout layout, uint32_t index, vk::DescriptorSet set, uint32_t dynamicOffsetCount,
+            const uint32_t* dynamicOffsets, const char* site);
+
+    private:
+        vk::Pipeline pipeline;
+        vk::PipelineLayout layouts[MaxSets];
+        vk::DescriptorSet sets[MaxSets];
+        // the first dynamic offset, every set of the engine has at most one
+        uint32_t offsets[MaxSets] = {};
+    };
+}
+}
@@ -1,17 +1,204 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
 #include "Matrix.h"
+#include "PipelineRegistry.hpp"
+#include "ShaderReflection.hpp"
+#include <memory>
 
 namespace m3d {
+	class UniformRing;
+
+	/*
+	 * Bindless mode: the indirect pipeline reads its material from an SSBO and
+	 * samples one fixed size array of every texture, so a single descriptor
+	 * set bound once per frame covers the whole scene.
+	 *
+	 *   binding 2 : per draw transform and material index (vertex)
+	 *   binding 3 : MaterialTable::GpuMaterial array (fragment)
+	 *   binding 4 : sampler2D textures[MaxTextures], indexed by TextureStreamer id (fragment)
+	 *
+	 * The index is the same for a whole draw, so Vulkan 1.0 dynamic indexing
+	 * (shaderSampledImageArrayDynamicIndexing) suffices. Devices without it, or
+	 * with fewer than MaxTextures samplers per stage, sample texture arrays
+	 * instead: binding 4 holds MaxTextureArrays sampler2DArrays TextureArrays
+	 * packs same size textures into, picked by constant indices, and the
+	 * material names the array and layer. The lit, transparent and deferred
+	 * shaders are bindless only, those draws stay unlit and opaque then.
+	 *
+	 * Clustered lighting swaps in a fragment shader that also shades with the
+	 * lights ClusteredLights binned for its cluster, bindings 5 to 7, the
+	 * main directional light shadowed by the ShadowCascades map, binding 8,
+	 * and the point and spot lights by their ShadowAtlas tiles, bindings 9
+	 * and 10.
+	 *
+	 * Multiview (VK_KHR_multiview): with Options::viewCount above one every
+	 * subpass renders all views at once, each into its layer of array color
+	 * and depth attachments. The vertex shaders are the *_multiview ones, they
+	 * pick their view and projection matrix by gl_ViewIndex from the arrays of
+	 * the uniform block; one draw stream covers all views. The color layers end
+	 * up in TRANSFER_SRC_OPTIMAL, CommandBuffer blits them into the swapchain image.
+	 *
+	 * ID buffer (Options::idBuffer): the shading subpass gets a second color
+	 * attachment of IdFormat, cleared to InvalidId, that the bindless indirect
+	 * shaders write their draw's transform entry and gl_PrimitiveID into. Other
+	 * pipelines leave it alone, what they cover keeps the ID behind it. It ends
+	 * up in TRANSFER_SRC_OPTIMAL for picks to copy texels out of; single sample
+	 * and single view only.
+	 *
+	 * Weighted blended transparency (Options::weightedBlended): two subpasses
+	 * follow the shading one. The transparent subpass draws the slices of
+	 * Material::Blend::WeightedBlended materials unsorted, depth tested but not
+	 * written, summing weighted premultiplied color into an accumulation
+	 * attachment and multiplying a revealage attachment by what each fragment
+	 * lets through. The overlay subpass reads both as input attachments and
+	 * composites them over the shaded scene with one full screen triangle,
+	 * then everything drawn on top of the scene follows. Both attachments stay
+	 * in tile memory. Single sample, single view and bindless only.
+	 *
+	 * Variable rate shading (Options::shadingRateImage): the main, indirect,
+	 * skinned and transparent pipelines shade at the rates of the image
+	 * ShadingRate binds, the depth only ones and everything else at full rate.
+	 *
+	 * Deferred shading (Options::deferred): a G-buffer subpass ahead of the
+	 * shading one, where the indirect opaque draws write albedo, world normal
+	 * and view depth instead of shading. The shading subpass starts with one
+	 * full screen triangle that reads them as input attachments and lights
+	 * every covered pixel once with the clusters and the cascades; whatever is
+	 * drawn forward follows it, depth tested against the G-buffer's draws. The
+	 * G-buffer is transient and never leaves tile memory. Single sample,
+	 * single view and clustered lighting only.
+	 *
+	 * Vertex pulling (Options::vertexPulling): the indirect pipelines have no
+	 * vertex input state, indirect_pull.vert reads the PackedVertex of
+	 * gl_VertexIndex, the world matrix and the draw info through the
+	 * BufferAddress addresses of PullConstants, pushed behind DrawConstants.
+	 * A geometry block costs a push of its address and an index buffer bind
+	 * instead of a vertex buffer bind, and the pipelines no longer depend on
+	 * the vertex format. Single view only.
+	 */
 	class Pipeline
 	{
 	public:
-		Pipeline(vk::Device&, vk::PhysicalDevice&);
+		// size of the texture array, matches indirect.frag
+		static const uint32_t MaxTextures = 1024;
+		// of the texture arrays without bindless, matches indirect_array.frag
+		static const uint32_t MaxTextureArrays = 8;
+		// of the uniform block, matches indirect_clustered.frag
+		static const uint32_t MaxShadowCascades = 4;
+		// views of one multiview render pass, matches the *_multiview.vert shaders
+		static const uint32_t MaxViews = 4;
+		// of the ID buffer, transform entry and primitive; InvalidId where no indirect draw covers the pixel
+		static const vk::Format IdFormat = vk::Format::eR32G32Uint;
+		static const uint32_t InvalidId = 0xFFFFFFFF;
+		// its attachment, in place of the resolve attachment, the ID buffer is single sample
+		static const uint32_t IdAttachment = 2;
+		// of the weighted blended transparency attachments, accumulated color and coverage and the revealage
+		static const vk::Format AccumFormat = vk::Format::eR16G16B16A16Sfloat;
+		static const vk::Format RevealFormat = vk::Format::eR16Sfloat;
+		// of the G-buffer attachments, albedo, world normal in [0, 1] and view depth, 0 where nothing was drawn
+		static const vk::Format GBufferAlbedoFormat = vk::Format::eR8G8B8A8Unorm;
+		static const vk::Format GBufferNormalFormat = vk::Format::eA2B10G10R10UnormPack32;
+		static const vk::Format GBufferDepthFormat = vk::Format::eR32Sfloat;
+		static const uint32_t GBufferAttachmentCount = 3;
+
+		// VK_KHR_multiview postdates the vulkan headers; the device needs the extension and its multiview
+		// feature, which also needs VK_KHR_get_physical_device_properties2 on the instance
+		static const char* const MultiviewExtensionName;
+		static bool SupportsMultiview(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+		// the multiview feature for DeviceCreateInfo::pNext, chained in front of next
+		static const void* GetMultiviewFeatureChain(const void* next = nullptr);
+
+		// Attachments and subpasses of the render pass
+		struct Options {
+			Options() : depthPrepass(false), samples(vk::SampleCountFlagBits::e1), storeDepth(true), finalLayout(vk::ImageLayout::ePresentSrcKHR), bindless(true),
+				clusteredLighting(false), viewCount(1), idBuffer(false), colorFormat(vk::Format::eB8G8R8A8Unorm), weightedBlended(false),
+				shadingRateImage(false), deferred(false), vertexPulling(false) {}
+			// a depth only subpass ahead of the shading one, see CreateRenderPass
+			bool depthPrepass;
+			// of the color and depth attachments, more than one resolves into the swapchain image;
+			// lowered to what the device supports
+			vk::SampleCountFlagBits samples;
+			// keep the depth after the render pass, e.g. for occlusion culling. Otherwise it is
+			// DONT_CARE and a tiled GPU never writes it out of tile memory
+			bool storeDepth;
+			// of the image the scene ends up in, TRANSFER_SRC_OPTIMAL to read back an offscreen one or blit it into the swapchain image,
+			// SHADER_READ_ONLY_OPTIMAL for compute passes to sample it
+			vk::ImageLayout finalLayout;
+			// bindless mode where the device supports it, otherwise texture arrays or, with too few samplers for
+			// them, the untextured indirect shader
+			bool bindless;
+			// lit indirect draws, bindless only; the shader reads bindings 5 to 7 of SetClusteredLights
+			bool clusteredLighting;
+			// more than one renders that many views with VK_KHR_multiview, up to MaxViews; the device must have
+			// been created with the multiview feature. finalLayout is TRANSFER_SRC_OPTIMAL then
+			uint32_t viewCount;
+			// an ID attachment, see above; off with more samples or views or without the independentBlend feature
+			bool idBuffer;
+			// of the color attachments, the swapchain's; a float format renders HDR into a target of its own
+			vk::Format colorFormat;
+			// the transparent and overlay subpasses, see above; off with more samples or views, without bindless or
+			// the independentBlend feature
+			bool weightedBlended;
+			// the scene pipelines read the bound shading rate image, see above; the device must have been created with
+			// ShadingRate's feature
+			bool shadingRateImage;
+			// the G-buffer subpass, see above; off with more samples or views or without clustered lighting
+			bool deferred;
+			// the indirect pipelines pull their vertices, see above; the device must have been created with
+			// BufferAddress's feature. Off with more views
+			bool vertexPulling;
+		};
+
+		// frameSlots copies of the uniform block, one per frame that may be in flight at once
+		Pipeline(vk::Device&, vk::PhysicalDevice&, PipelineRegistry&, uint32_t frameSlots, const Options& options = Options());
 		~Pipeline();
 		// create uniform buffer
 		void CreateUniformBuffers();
-		// create render pass
+		// Rewind the slot's constants and write the camera block, returns its dynamic offset.
+		// No submitted frame may still read the slot.
+		uint32_t BeginFrame(uint32_t slot);
+		// Per draw data of the main pipeline, push constants of the stages that declare the block.
+		// 80 bytes, every device has at least 128.
+		struct DrawConstants {
+			m3d::math::Matrix4x4 modelMatrix;
+			uint32_t material = 0;
+			// first world matrix of binding 1 an instanced draw reads
+			uint32_t instanceOffset = 0;
+			uint32_t pad[2] = { 0, 0 };
+		};
+		// the whole block, for the first draw recorded into a command buffer and when the world matrix changes
+		void PushDrawConstants(vk::CommandBuffer cmd, const DrawConstants& constants) const;
+		// material only, 4 bytes, the rest of the block stays
+		void PushMaterial(vk::CommandBuffer cmd, uint32_t material) const;
+		// Vertex pulling only, the BufferAddress addresses indirect_pull.vert reads, at PullConstantOffset of the
+		// push constants: a GeometryArena block's and IndirectDraws' transforms and draw infos
+		struct PullConstants {
+			uint64_t vertices = 0;
+			uint64_t transforms = 0;
+			uint64_t drawInfos = 0;
+		};
+		static const uint32_t PullConstantOffset = sizeof(DrawConstants);
+		// the whole block, once per command buffer before the first indirect draw
+		void PushPullConstants(vk::CommandBuffer cmd, const PullConstants& constants) const;
+		// the vertices only, 8 bytes, per geometry block
+		void PushVertexAddress(vk::CommandBuffer cmd, uint64_t vertices) const;
+		// dynamic offset of the camera block BeginFrame writes for slot
+		uint32_t GetFrameOffset(uint32_t slot) const;
+		// used from the next BeginFrame on, also the matrices of view 0
+		void SetCamera(const m3d::math::Matrix4x4& viewMatrix, const m3d::math::Matrix4x4& projectionMatrix);
+		// multiview only, the matrices of views [0, count); view 0 also becomes the camera culling and lighting use.
+		// Used from the next BeginFrame on
+		void SetViews(const m3d::math::Matrix4x4* viewMatrices, const m3d::math::Matrix4x4* projectionMatrices, uint32_t count);
+		// create render pass, with a depth pre-pass subpass 0 only writes depth and subpass 1
+		// shades against it with depth writes off, every covered pixel is shaded once.
+		// Attachments: 0 color, 1 depth and, multisampled, 2 the swapchain image color resolves to; with the ID buffer 2 is it.
+		// Weighted blended transparency adds the accumulation and revealage attachments after those and two subpasses,
+		// deferred shading the G-buffer attachments after those and its subpass ahead of the shading one.
+		// Multiview, every subpass has the mask of all views and the attachments are arrays of viewCount layers
 		void CreateRenderPass();
+		// the descriptor bindings, push constants and vertex inputs of every shader of the pass,
+		// the layouts and vertex inputs below follow from it
+		void ReflectShaders();
 		// set vertex data format
 		void SetupVertexInputs();
 		//
@@ -21,28 +208,138 @@ namespace m3d {
 		void CreateDescriptorSet();
 		// shader
 		vk::PipelineShaderStageCreateInfo loadShader(const std::string& fileName, vk::ShaderStageFlagBits stage);
+		// binding 1 : per instance world matrices read by the indirect pipeline
+		void SetInstanceTransforms(const vk::DescriptorBufferInfo& descriptor);
+		// binding 2 : per draw indices read by the indirect pipeline
+		void SetDrawInfos(const vk::DescriptorBufferInfo& descriptor);
+		// bindless only, binding 3 : materials
+		void SetMaterials(const vk::DescriptorBufferInfo& descriptor);
+		// bindless or texture arrays, binding 4 : array elements [first, first + images.size()), the set must not be in use
+		void SetTextures(uint32_t first, const std::vector<vk::DescriptorImageInfo>& images);
+		bool IsBindless() const { return bindless; }
+		// binding 4 holds MaxTextureArrays texture arrays of TextureArrays instead, materials at binding 3 still
+		bool UsesTextureArrays() const { return textureArrays; }
+		// clustered lighting only, bindings 5 to 7 : parameters, lights and clusters of ClusteredLights
+		void SetClusteredLights(const vk::DescriptorBufferInfo& params, const vk::DescriptorBufferInfo& lights, const vk::DescriptorBufferInfo& clusters);
+		bool IsClusteredLighting() const { return options.clusteredLighting; }
+		// clustered lighting only, binding 8 : the cascade depth array of ShadowCascades
+		void SetShadowMap(const vk::DescriptorImageInfo& shadowMap);
+		// world to cascade matrices and the view depth each cascade ends at, up to MaxShadowCascades; count 0 is unshadowed.
+		// Part of the uniform block, frames from the next BeginFrame on see them
+		void SetShadowCascades(const m3d::math::Matrix4x4* matrices, const float* splits, uint32_t count);
+		// clustered lighting only, bindings 9 and 10 : the face table and the depth atlas of ShadowAtlas
+		void SetShadowAtlas(const vk::DescriptorBufferInfo& table, const vk::DescriptorImageInfo& atlas);
+		// render pass, layout and vertex input of this pipeline, fill in shaders and state for permutations
+		PipelineDesc GetBaseDesc();
+		vk::Pipeline GetPipeline(const PipelineDesc& desc) { return registry.Get(desc); }
+		// fetch the pipelines below from the registry again, after PipelineRegistry::SwapReloaded
+		void RefreshPipelines();
 
 	public:
 		const vk::Pipeline&					GetPipeline() { return pipeline; }
+		const vk::Pipeline&					GetIndirectPipeline() { return indirectPipeline; }
+		// depth pre-pass only: the main and indirect pipelines without a fragment shader, for subpass 0
+		bool								HasDepthPrepass() const { return options.depthPrepass; }
+		vk::SampleCountFlagBits				GetSamples() const { return options.samples; }
+		bool								StoresDepth() const { return options.storeDepth; }
+		// layers of the attachments, 1 without multiview
+		uint32_t							GetViewCount() const { return options.viewCount; }
+		bool								HasIdBuffer() const { return options.idBuffer; }
+		vk::Format							GetColorFormat() const { return options.colorFormat; }
+		// of the shading and overlay subpasses, PipelineDesc::colorAttachments of everything drawn in them
+		uint32_t							GetColorAttachmentCount() const { return options.idBuffer ? 2 : 1; }
+		const vk::Pipeline&					GetDepthPipeline() { return depthPipeline; }
+		const vk::Pipeline&					GetIndirectDepthPipeline() { return indirectDepthPipeline; }
+		// skinned instances are not in the pre-pass, their pipeline keeps writing depth; the main one otherwise
+		const vk::Pipeline&					GetSkinnedPipeline() { return options.depthPrepass ? skinnedPipeline : pipeline; }
+		bool								IsDeferred() const { return options.deferred; }
+		bool								IsVertexPulling() const { return options.vertexPulling; }
+		// deferred only: the indirect opaque draws into the G-buffer
+		uint32_t							GetGBufferSubpass() const { return options.depthPrepass ? 1 : 0; }
+		// subpass the scene is shaded in, and everything drawn on top of it without weighted blended transparency
+		uint32_t							GetShadingSubpass() const { return GetGBufferSubpass() + (options.deferred ? 1 : 0); }
+		bool								HasWeightedBlended() const { return options.weightedBlended; }
+		// weighted blended only: the transparent draws into the accumulation and revealage attachments
+		uint32_t							GetTransparentSubpass() const { return GetShadingSubpass() + 1; }
+		// the last subpass, where everything on top of the scene is drawn, e.g. the GUI. The color attachments
+		// and the depth of the shading subpass
+		uint32_t							GetOverlaySubpass() const { return options.weightedBlended ? GetShadingSubpass() + 2 : GetShadingSubpass(); }
+		// of the render pass, the framebuffer and its clear values
+		uint32_t							GetAttachmentCount() const;
+		// weighted blended only, the revealage one follows it
+		uint32_t							GetAccumAttachment() const { return options.idBuffer ? IdAttachment + 1 : 2; }
+		// weighted blended only: the indirect pipeline of the transparent subpass, and the composite of the overlay
+		// subpass that draws three vertices with the set of GetCompositeSetLayout bound
+		const vk::Pipeline&					GetTransparentPipeline() { return transparentPipeline; }
+		const vk::Pipeline&					GetCompositePipeline() { return compositePipeline; }
+		// the accumulation and revealage attachments as input attachments 0 and 1
+		const vk::DescriptorSetLayout&		GetCompositeSetLayout() { return compositeSetLayout; }
+		const vk::PipelineLayout&			GetCompositeLayout() { return compositeLayout; }
+		// deferred only, the albedo one; the normal and depth ones follow it
+		uint32_t							GetGBufferAttachment() const { return GetAccumAttachment() + (options.weightedBlended ? 2 : 0); }
+		// deferred only: the full screen triangle of the shading subpass that lights the G-buffer, three vertices with
+		// the scene's set 0 and the set of GetLightingSetLayout bound as set 1
+		const vk::Pipeline&					GetLightingPipeline() { return lightingPipeline; }
+		// the G-buffer attachments as input attachments 0 to 2
+		const vk::DescriptorSetLayout&		GetLightingSetLayout() { return lightingSetLayout; }
+		const vk::PipelineLayout&			GetLightingLayout() { return lightingLayout; }
 		const vk::RenderPass&				GetRenderPass() { return renderPass; }
 		const vk::PipelineLayout&			GetPipelineLayout() { return pipelineLayout; }
 		const vk::DescriptorSet&			GetDescriptorSet() { return descriptorSet; }
+		// set 0 of pipelines drawn with this one's camera, the push constant range keeps their layouts compatible
+		const vk::DescriptorSetLayout&		GetDescriptorSetLayout() { return descriptorSetLayout; }
+		const vk::PushConstantRange&		GetDrawConstantRange() const { return drawConstantRange; }
+		// camera matrices of the uniform buffer, the frustum GPU culling tests against
+		const m3d::math::Matrix4x4&			GetViewMatrix() { return uboVS.viewMatrix; }
+		const m3d::math::Matrix4x4&			GetProjectionMatrix() { return uboVS.projectionMatrix; }
 	private:
 		vk::Device							&device;
 		vk::PhysicalDevice					&physicalDevice;
+		// owns every vk::Pipeline handed out here
+		PipelineRegistry					&registry;
+		bool								bindless;
+		bool								textureArrays;
+		Options								options;
+		PipelineDesc						mainDesc;
+		PipelineDesc						indirectDesc;
+		PipelineDesc						depthDesc;
+		PipelineDesc						indirectDepthDesc;
+		PipelineDesc						skinnedDesc;
+		PipelineDesc						transparentDesc;
+		PipelineDesc						compositeDesc;
+		PipelineDesc						lightingDesc;
 		vk::Pipeline						pipeline;
+		vk::Pipeline						indirectPipeline;
+		vk::Pipeline						depthPipeline;
+		vk::Pipeline						indirectDepthPipeline;
+		vk::Pipeline						skinnedPipeline;
+		vk::Pipeline						transparentPipeline;
+		vk::Pipeline						compositePipeline;
+		vk::Pipeline						lightingPipeline;
+		// owned by the registry
+		vk::DescriptorSetLayout				compositeSetLayout;
+		vk::PipelineLayout					compositeLayout;
+		vk::DescriptorSetLayout				lightingSetLayout;
+		vk::PipelineLayout					lightingLayout;
 		// uniform buffer
-		struct {
-			vk::Buffer buffer;
-			vk::DeviceMemory memory;
-			vk::DescriptorBufferInfo descriptor;
-		} uniformDataVS;
+		uint32_t							frameSlots;
+		std::unique_ptr<UniformRing>		uniformRing;
+		vk::DescriptorBufferInfo			uniformDescriptor;
 
-		struct {
+		// std140, the vertex shaders declare the camera matrices only
+		struct UniformBlock {
 			m3d::math::Matrix4x4 projectionMatrix;
 			m3d::math::Matrix4x4 modelMatrix;
 			m3d::math::Matrix4x4 viewMatrix;
-		} uboVS;
+			m3d::math::Matrix4x4 shadowMatrices[MaxShadowCascades];
+			float cascadeSplits[MaxShadowCascades];
+			uint32_t cascadeCount;
+			uint32_t pad[3];
+			// multiview only, indexed by gl_ViewIndex
+			m3d::math::Matrix4x4 viewMatrices[MaxViews];
+			m3d::math::Matrix4x4 projectionMatrices[MaxViews];
+		};
+		UniformBlock						uboVS;
 		// render pass
 		vk::RenderPass						renderPass;
 		//
@@ -50,7 +347,11 @@ namespace m3d {
 		vk::DescriptorSetLayout				descriptorSetLayout;
 		vk::DescriptorSet					descriptorSet;
 
+		// owned by the registry, shared with pipelines of the same interface
 		vk::PipelineLayout					pipelineLayout;
+		ShaderLayout						shaderLayout;
+		// of DrawConstants, as far as the shaders declare the block; empty without push constants
+		vk::PushConstantRange				drawConstantRange;
 
 		struct {
 			vk::PipelineVertexInputStateCreateInfo inputState;
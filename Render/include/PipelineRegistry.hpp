@@ -0,0 +1,195 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+class ResourceTrash;
+class ThreadPool;
+struct ShaderLayout;
+namespace file {
+    class MappedFile;
+}
+
+/*
+ * Everything that tells two graphics pipelines apart: render pass, layout,
+ * vertex input and shader state plus the few fixed function switches the
+ * renderer varies. Viewport and scissor are always dynamic.
+ *
+ * Specialization constants make variants of one SPIR-V module, e.g.
+ *     layout (constant_id = 1) const int lightCount = 4;
+ * takes the value of SetConstant(1, ...) and the driver compiles the variant
+ * with it folded in. Both stages see every constant, a module ignores the ids
+ * it does not declare.
+ */
+struct PipelineDesc {
+    struct Constant {
+        uint32_t id;
+        // the 32 bits of an int, uint, float or bool (VK_TRUE or VK_FALSE) constant
+        uint32_t value;
+        bool operator==(const Constant& other) const { return id == other.id && value == other.value; }
+    };
+
+    vk::RenderPass renderPass;
+    uint32_t subpass = 0;
+    vk::PipelineLayout layout;
+
+    // SPIR-V files, no fragment shader for depth only pipelines
+    std::string vertexShader;
+    std::string fragmentShader;
+
+    std::vector<vk::VertexInputBindingDescription> bindings;
+    std::vector<vk::VertexInputAttributeDescription> attributes;
+
+    vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+    vk::CullModeFlags cullMode = vk::CullModeFlagBits::eNone;
+    vk::FrontFace frontFace = vk::FrontFace::eCounterClockwise;
+    bool depthTest = true;
+    bool depthWrite = true;
+    vk::CompareOp depthCompare = vk::CompareOp::eLessOrEqual;
+    // constant and slope scaled depth bias, e.g. against shadow acne; off at 0
+    float depthBiasConstant = 0.0f;
+    float depthBiasSlope = 0.0f;
+    bool blend = false;
+    // with blend, add the source weighted by its alpha instead of mixing, e.g. for additive particles
+    bool additiveBlend = false;
+    // with blend, the source color is premultiplied by its alpha and alpha accumulates like coverage, e.g. the
+    // panels GuiRenderer bakes into transparent black and composites as they are
+    bool premultipliedBlend = false;
+    // two float attachments of weighted blended transparency, see Pipeline: the first sums the source, the second
+    // is multiplied by one minus it; blend is not needed
+    bool weightedBlend = false;
+    // of the subpass, 0 for depth only subpasses. Attachments past the first never blend
+    uint32_t colorAttachments = 1;
+    // the fragment shader writes the attachments past the first, e.g. Pipeline's ID buffer; otherwise
+    // they keep what is behind the pipeline's fragments
+    bool writeExtraAttachments = false;
+    // false keeps every color attachment as it is, e.g. for occlusion query proxies
+    bool colorWrite = true;
+    // of the subpass's attachments
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+    // fragments are shaded at the rate of the bound shading rate image, see ShadingRate; the device needs its feature
+    bool shadingRateImage = false;
+
+    // by id, set through SetConstant
+    std::vector<Constant> constants;
+    // replaces an earlier value of id
+    void SetConstant(uint32_t id, uint32_t value);
+    void SetConstant(uint32_t id, int32_t value);
+    void SetConstant(uint32_t id, float value);
+    void SetConstant(uint32_t id, bool value);
+
+    uint64_t Hash() const;
+    bool operator==(const PipelineDesc& other) const;
+};
+
+/*
+ * Hashed registry of graphics pipelines backed by one VkPipelineCache.
+ *
+ * The cache blob is loaded from cachePath at construction (if it was written
+ * by the same device and driver) and written back by Save() and the
+ * destructor, so later runs skip most of the driver compilation. Warm()
+ * compiles pipelines on background threads; Get() returns a registered
+ * pipeline, waits for it if it is still being warmed, or creates it.
+ *
+ * Shaders reload while the application runs (see ShaderWatcher): ReloadShader
+ * rebuilds the pipelines of a file on the calling thread and holds them back,
+ * SwapReloaded puts them in place at a frame boundary. Handles from Get() are
+ * stale after a swap that returned true, fetch them again.
+ *
+ * Descriptor set and pipeline layouts are cached by content as well, shader
+ * permutations with the same interface share one layout object.
+ */
+class PipelineRegistry {
+public:
+    PipelineRegistry(vk::Device&, vk::PhysicalDevice&, const std::string& cachePath, uint32_t warmThreads = 1);
+    ~PipelineRegistry();
+
+    vk::Pipeline Get(const PipelineDesc& desc);
+    // Queue pipelines for compilation on the warm threads, returns immediately.
+    void Warm(const std::vector<PipelineDesc>& descs);
+    // Write the pipeline cache to disk.
+    bool Save();
+
+    // SPIR-V files of every shader module created so far
+    std::vector<std::string> GetShaderFiles();
+    // Replace the module of fileName with code and create every ready pipeline using it again, they
+    // are swapped in by SwapReloaded. Returns the number of pipelines rebuilt, any thread.
+    uint32_t ReloadShader(const std::string& fileName, const std::vector<uint32_t>& code);
+    // At a frame boundary, on the thread calling Get: registers the rebuilt pipelines, the replaced ones
+    // and modules go to trash. True when a pipeline changed
+    bool SwapReloaded(ResourceTrash& trash);
+    // rebuilt pipelines wait for SwapReloaded, any thread
+    bool HasReloaded();
+
+    // Identical layouts are created once and live as long as the registry, the order of bindings does not matter
+    vk::DescriptorSetLayout GetDescriptorSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings);
+    vk::PipelineLayout GetPipelineLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts, const std::vector<vk::PushConstantRange>& pushConstants);
+    // the layout of every set of a reflected interface, returned in setLayouts, and the pipeline layout over them
+    vk::PipelineLayout GetPipelineLayout(const ShaderLayout& layout, std::vector<vk::DescriptorSetLayout>* setLayouts = nullptr);
+    // descriptor set and pipeline layouts created so far
+    size_t GetLayoutCount();
+
+    vk::PipelineCache GetPipelineCache() const { return pipelineCache; }
+    size_t GetPipelineCount();
+
+private:
+    struct DescHasher {
+        size_t operator()(const PipelineDesc& desc) const { return static_cast<size_t>(desc.Hash()); }
+    };
+    struct Entry {
+        vk::Pipeline pipeline;
+        bool ready = false;
+    };
+    struct Reloaded {
+        PipelineDesc desc;
+        vk::Pipeline pipeline;
+    };
+    struct SetLayout {
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        vk::DescriptorSetLayout layout;
+    };
+    struct PipelineLayout {
+        std::vector<vk::DescriptorSetLayout> setLayouts;
+        std::vector<vk::PushConstantRange> pushConstants;
+        vk::PipelineLayout layout;
+    };
+
+    vk::Pipeline create(const PipelineDesc& desc);
+    vk::ShaderModule getShaderModule(const std::string& fileName);
+    // nullptr when there is no cache or it was written by another device or driver
+    std::shared_ptr<const file::MappedFile> loadCache();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    std::string cachePath;
+    vk::PipelineCache pipelineCache;
+
+    std::mutex mutex;
+    std::condition_variable pipelineReady;
+    std::unordered_map<PipelineDesc, Entry, DescHasher> pipelines;
+    std::mutex shaderMutex;
+    std::unordered_map<std::string, vk::ShaderModule> shaderModules;
+    // waiting for SwapReloaded, under mutex
+    std::vector<Reloaded> reloaded;
+    std::vector<vk::ShaderModule> replacedModules;
+    // by the hash of their contents
+    std::mutex layoutMutex;
+    std::unordered_multimap<uint64_t, SetLayout> setLayouts;
+    std::unordered_multimap<uint64_t, PipelineLayout> pipelineLayouts;
+
+    std::unique_ptr<ThreadPool> warmThreads;
+};
+}
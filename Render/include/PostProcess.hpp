@@ -0,0 +1,183 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class ResourceTrash;
+class VulkanSwapChain;
+
+/*
+ * The post stack between the HDR scene color and the swapchain image, two
+ * compute dispatches after the render pass instead of a full screen pass per
+ * effect.
+ *
+ * The render pass resolves or renders into a scene color of GetSceneFormat,
+ * left in SHADER_READ_ONLY_OPTIMAL. Record then runs
+ *   bloom  bloom_downsample.comp, one dispatch for the whole mip chain: a
+ *          workgroup reads its BloomTileSize square of level 0, half the
+ *          scene's size, through the bright pass and reduces it to the last
+ *          of BloomLevels in shared memory, writing every level on the way
+ *   post   post.comp, every effect fused: a workgroup reads its pixels of
+ *          the scene once with a one pixel border into shared memory,
+ *          sharpens from there, adds the bloom levels, exposes, tonemaps
+ *          with the fitted ACES curve, grades, vignettes and stores the
+ *          pixel into the swapchain image
+ * So the scene is read twice and the swapchain image written once, the
+ * bloom levels are a quarter of the scene and less.
+ *
+ * The swapchain images are storage images where the surface and the format
+ * allow it, see SupportsDirectOutput. Otherwise post.comp writes an RGBA8
+ * image of its own that is blitted into the swapchain image. Either way the
+ * output is declared without a format, which needs the
+ * shaderStorageImageWriteWithoutFormat feature, see IsSupported.
+ *
+ * With dynamic resolution the scene covers the top left part of its target;
+ * both passes sample that part and scale it to the whole swapchain image.
+ * Everything drawn in the render pass goes through the stack, the GUI
+ * included. One view only.
+ */
+class PostProcess {
+public:
+    // post.comp's workgroup is GroupSize square, one invocation per pixel
+    static const uint32_t GroupSize = 8;
+    // bloom_downsample.comp: a workgroup covers BloomTileSize square texels of level 0, each of its 16 x 16
+    // invocations 4 x 4 of them
+    static const uint32_t BloomTileSize = 64;
+    // level 0 is half the scene, the last one 1/64 of it; a tile reduces to a 2 x 2 texel block of it
+    static const uint32_t BloomLevels = 6;
+    static const vk::Format BloomFormat = vk::Format::eR16G16B16A16Sfloat;
+    // of the image post.comp writes without direct output
+    static const vk::Format OutputFormat = vk::Format::eR8G8B8A8Unorm;
+
+    struct Settings {
+        // scales the scene color ahead of the tonemap
+        float exposure = 1.0f;
+        // of the bloom added to the scene color, 0 for none
+        float bloomIntensity = 0.04f;
+        // HDR brightness where the bloom starts, faded in over knee below it
+        float bloomThreshold = 1.0f;
+        float bloomKnee = 0.5f;
+        // of the limited unsharp mask, 0 for none
+        float sharpen = 0.25f;
+        // grading of the tonemapped color: multiplied by colorFilter, then saturation and contrast around mid gray
+        float colorFilter[3] = { 1.0f, 1.0f, 1.0f };
+        float saturation = 1.0f;
+        float contrast = 1.0f;
+        // darkening of the corners, 0 for none
+        float vignette = 0.25f;
+    };
+
+    // Whether the device can store into an image declared without a format
+    static bool IsSupported(vk::PhysicalDevice physicalDevice);
+    // Whether swapchain images of format on surface can be storage images, before the swapchain is created; its
+    // images need VK_IMAGE_USAGE_STORAGE_BIT then, TRANSFER_DST otherwise
+    static bool SupportsDirectOutput(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, vk::Format format);
+    // Of the scene color, Pipeline::Options::colorFormat: B10G11R11 where it can be blended into and sampled
+    // linearly, RGBA16F otherwise
+    static vk::Format GetSceneFormat(vk::PhysicalDevice physicalDevice);
+
+    // slotCount like Pipeline's frame slots, directOutput after SupportsDirectOutput
+    PostProcess(vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, uint32_t slotCount, bool directOutput);
+    ~PostProcess();
+
+    // from the next BeginFrame on
+    void SetSettings(const Settings& settings) { this->settings = settings; }
+    const Settings& GetSettings() const { return settings; }
+    // Start filling slot, no submitted frame may still read it
+    void BeginFrame(uint32_t slot);
+
+    // The scene color of extent and the swapchain's images, (re)creates the bloom levels and the output image.
+    // Called whenever CommandBuffer creates its targets, with trash the previous ones are released once the frames
+    // using them completed
+    void SetTargets(vk::ImageView sceneView, vk::Extent2D extent, const VulkanSwapChain& swapChain, ResourceTrash* trash = nullptr);
+    // After the render pass: bloom and post into swapchain image imageIndex, left in PRESENT_SRC. The scene covers
+    // renderExtent of its target
+    void Record(vk::CommandBuffer cmd, uint32_t slot, uint32_t imageIndex, vk::Extent2D renderExtent) const;
+
+private:
+    // std140 layout of the settings block, a dynamic uniform buffer of a stride per slot
+    struct GpuSettings {
+        float exposure;
+        float bloomIntensity;
+        float bloomThreshold;
+        float bloomKnee;
+        // rgb, w the saturation
+        float colorFilter[4];
+        float sharpen;
+        float contrast;
+        float vignette;
+        float pad;
+    };
+
+    // push constants of both passes, fixed when recorded
+    struct Constants {
+        // the part of the scene color the scene covers, in texture coordinates, and the size of its texel
+        float sceneScale[2];
+        float sceneTexel[2];
+        uint32_t outputSize[2];
+        uint32_t bloomSize[2];
+        uint32_t bloomLevels;
+        uint32_t pad[3];
+    };
+
+    struct Buffer {
+        vk::Buffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Image {
+        vk::Image image;
+        MemoryAllocator::Allocation memory;
+        vk::ImageView view;
+    };
+
+    void createPipelines();
+    vk::Pipeline createPipeline(const char* shader, const char* name);
+    void createImage(vk::Format format, vk::ImageUsageFlags usage, vk::Extent2D size, uint32_t levels, const char* name, Image& image);
+    void writeDescriptors(vk::ImageView sceneView, const VulkanSwapChain& swapChain);
+    // destroy now or, with trash, once the frames using them completed
+    void destroyTargets(ResourceTrash* trash);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    bool directOutput;
+    Settings settings;
+
+    // slotCount GpuSettings, settingsStride apart
+    Buffer settingsBuffer;
+    uint32_t settingsStride;
+
+    // of the scene color and the swapchain
+    vk::Extent2D extent;
+    std::vector<vk::Image> swapchainImages;
+    // BloomLevels or fewer for small targets, in GENERAL for good
+    Image bloom;
+    vk::Extent2D bloomSize;
+    uint32_t bloomLevels;
+    std::vector<vk::ImageView> bloomLevelViews;
+    // without direct output
+    Image output;
+
+    vk::Sampler sampler;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline bloomPipeline;
+    vk::Pipeline postPipeline;
+    // one per target set, retired with it; a set per swapchain image
+    vk::DescriptorPool descriptorPool;
+    std::vector<vk::DescriptorSet> sets;
+};
+}
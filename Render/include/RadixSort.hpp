@@ -0,0 +1,125 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+namespace m3d {
+
+// Key that orders floats like their value, e.g. view depths
+inline uint32_t FloatSortKey(float value)
+{
+    union {
+        float f;
+        uint32_t u;
+    } bits;
+    bits.f = value;
+    // negative floats sort descending as integers, flip them all; positive ones only need the sign bit set
+    return (bits.u & 0x80000000u) ? ~bits.u : (bits.u | 0x80000000u);
+}
+
+/*
+ * Stable least significant byte first radix sort of items by their uint64_t
+ * key member. Bytes that are the same in every key are skipped, a key whose
+ * high fields rarely change costs little more than its varying bytes.
+ *
+ * With threads, large arrays are cut into one chunk per thread; every pass
+ * histograms the chunks in parallel and then scatters them in parallel, each
+ * chunk to its own offsets within the buckets, which keeps the order of equal
+ * keys. Runs Enqueue and Wait on threads, so it can not be called from one of
+ * its tasks. scratch is resized to items and can be kept between calls.
+ */
+template <typename T>
+void RadixSort(std::vector<T>& items, std::vector<T>& scratch, ThreadPool* threads = nullptr)
+{
+    // fewer items are faster on one thread than handed out
+    const size_t MinChunkSize = 4096;
+
+    const size_t count = items.size();
+    if (count < 2) {
+        return;
+    }
+    scratch.resize(count);
+
+    size_t chunkCount = threads ? std::min<size_t>(threads->GetThreadCount(), (count + MinChunkSize - 1) / MinChunkSize) : 1;
+    chunkCount = std::max<size_t>(chunkCount, 1);
+    const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    auto forChunks = [&](const std::function<void(size_t first, size_t last, size_t chunk)>& task) {
+        if (chunkCount == 1) {
+            task(0, count, 0);
+            return;
+        }
+        for (size_t c = 0; c < chunkCount; ++c) {
+            const size_t first = c * chunkSize;
+            const size_t last = std::min(first + chunkSize, count);
+            threads->Enqueue([&task, first, last, c]() { task(first, last, c); });
+        }
+        threads->Wait();
+    };
+
+    // a byte varies when some key has a bit of it set that another one has not
+    std::vector<std::array<uint64_t, 2>> ranges(chunkCount);
+    forChunks([&](size_t first, size_t last, size_t chunk) {
+        uint64_t any = 0;
+        uint64_t all = ~0ull;
+        for (size_t i = first; i < last; ++i) {
+            any |= items[i].key;
+            all &= items[i].key;
+        }
+        ranges[chunk][0] = any;
+        ranges[chunk][1] = all;
+    });
+    uint64_t varying = 0;
+    uint64_t all = ~0ull;
+    for (const std::array<uint64_t, 2>& range : ranges) {
+        varying |= range[0];
+        all &= range[1];
+    }
+    varying ^= all;
+
+    std::vector<std::array<uint32_t, 256>> histograms(chunkCount);
+    T* source = items.data();
+    T* destination = scratch.data();
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (((varying >> shift) & 0xff) == 0) {
+            continue;
+        }
+        forChunks([&](size_t first, size_t last, size_t chunk) {
+            std::array<uint32_t, 256>& histogram = histograms[chunk];
+            histogram.fill(0);
+            for (size_t i = first; i < last; ++i) {
+                ++histogram[(source[i].key >> shift) & 0xff];
+            }
+        });
+        // bucket by bucket, the chunks in order
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < 256; ++bucket) {
+            for (std::array<uint32_t, 256>& histogram : histograms) {
+                const uint32_t size = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += size;
+            }
+        }
+        forChunks([&](size_t first, size_t last, size_t chunk) {
+            std::array<uint32_t, 256>& offsets = histograms[chunk];
+            for (size_t i = first; i < last; ++i) {
+                destination[offsets[(source[i].key >> shift) & 0xff]++] = source[i];
+            }
+        });
+        std::swap(source, destination);
+    }
+    if (source != items.data()) {
+        items.swap(scratch);
+    }
+}
+}
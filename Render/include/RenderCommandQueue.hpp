@@ -0,0 +1,224 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace m3d {
+class RendererVulkan;
+
+// Work for the render thread, it runs with the renderer between frames
+typedef std::function<void(RendererVulkan&)> RenderCommand;
+
+// a cache line of padding keeps what is on either side of it off each other's lines. Padding instead of alignas, the
+// rings live in objects created with a plain new, which C++11 does not align past alignof(std::max_align_t)
+static const size_t RingPadding = 64;
+
+// smallest power of two holding capacity, so positions wrap with a mask
+inline size_t RingCapacity(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/*
+ * Bounded lock-free ring between one producer and one consumer thread.
+ *
+ * head and tail only grow and are padded onto cache lines of their own; each side
+ * keeps a copy of the other's position and only reloads it when the ring
+ * looks full or empty, so a push or pop normally touches no line the other
+ * thread writes. TryPush fails on a full ring instead of blocking, the
+ * producer decides whether to retry or drop. Popped cells are reset so the
+ * resources a value holds go with the pop, not with the next push over it.
+ */
+template <class T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity)
+        : size(RingCapacity(capacity))
+        , mask(size - 1)
+        , cells(new T[size])
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer thread only
+    bool TryPush(T value)
+    {
+        const size_t position = tail.load(std::memory_order_relaxed);
+        if (position - headCache == size) {
+            headCache = head.load(std::memory_order_acquire);
+            if (position - headCache == size) {
+                return false;
+            }
+        }
+        cells[position & mask] = std::move(value);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only
+    bool TryPop(T& value)
+    {
+        const size_t position = head.load(std::memory_order_relaxed);
+        if (position == tailCache) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (position == tailCache) {
+                return false;
+            }
+        }
+        value = std::move(cells[position & mask]);
+        cells[position & mask] = T();
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t GetCapacity() const { return size; }
+
+private:
+    const size_t size;
+    const size_t mask;
+    std::unique_ptr<T[]> cells;
+    // the consumer's position and its copy of the producer's
+    char headPadding[RingPadding];
+    std::atomic<size_t> head{ 0 };
+    size_t tailCache = 0;
+    // the producer's position and its copy of the consumer's
+    char tailPadding[RingPadding];
+    std::atomic<size_t> tail{ 0 };
+    size_t headCache = 0;
+    char endPadding[RingPadding];
+};
+
+/*
+ * Bounded lock-free ring of any number of producers and one consumer.
+ *
+ * Every cell carries a sequence number: position while it is free for the
+ * push of that position, position + 1 once the value is in, and position +
+ * capacity after the pop handed the cell to the next lap. Producers claim a
+ * position with a compare exchange of tail and publish the value with the
+ * cell's sequence, so a slow producer only holds back the pops behind its
+ * own cell, never the other producers.
+ */
+template <class T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity)
+        : size(RingCapacity(capacity))
+        , mask(size - 1)
+        , cells(new Cell[size])
+    {
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Any thread
+    bool TryPush(T value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[position & mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (lap == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lap < 0) {
+                // the consumer did not free the cell of the previous lap, full
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only. False when the ring is empty or the oldest push did not finish yet
+    bool TryPop(T& value)
+    {
+        Cell& cell = cells[head & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        value = std::move(cell.value);
+        cell.value = T();
+        cell.sequence.store(head + size, std::memory_order_release);
+        ++head;
+        return true;
+    }
+
+    size_t GetCapacity() const { return size; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    const size_t size;
+    const size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    char tailPadding[RingPadding];
+    std::atomic<size_t> tail{ 0 };
+    // the consumer's alone
+    char headPadding[RingPadding];
+    size_t head = 0;
+    char endPadding[RingPadding];
+};
+
+/*
+ * Commands for the render thread: resource creation and destruction such as
+ * mesh uploads, texture loads and pipeline builds, which touch the device and
+ * the renderer's arenas and so must not run on the threads asking for them.
+ *
+ * The game thread submits through an SpscRing, workers through an MpscRing;
+ * neither takes a lock. The render thread drains both at the start of every
+ * frame, before the frame's snapshot is applied, so the snapshot may refer to
+ * what the commands created, and once more when its loop ends.
+ */
+class RenderCommandQueue {
+public:
+    explicit RenderCommandQueue(size_t capacity = 1024);
+
+    // Game thread only: the one producer of the single producer ring
+    bool TrySubmit(RenderCommand command);
+    // TrySubmit, yielding while the ring is full. Never from the render thread, it only empties between frames
+    void Submit(RenderCommand command);
+    // Any other thread
+    bool TrySubmitFromWorker(RenderCommand command);
+    void SubmitFromWorker(RenderCommand command);
+
+    // Render thread only: run every command submitted so far, the game thread's first. Returns how many ran
+    size_t Drain(RendererVulkan& renderer);
+
+    // commands run by Drain since the queue was made
+    uint64_t GetExecuted() const { return executed; }
+
+private:
+    SpscRing<RenderCommand> game;
+    MpscRing<RenderCommand> workers;
+    uint64_t executed = 0;
+};
+}
@@ -0,0 +1,200 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace m3d {
+
+/*
+ * A frame as a list of passes and the textures they read and write, without
+ * any graphics API in it; a backend such as RenderGraphVulkan creates the
+ * textures and runs the passes.
+ *
+ * Textures are either imported, like the swapchain image or anything that
+ * outlives the frame, or transient: created by the pass that first uses them
+ * and dead after the last one. Compile
+ *   - drops the passes nothing reads from: a pass stays when it writes an
+ *     imported texture, has a side effect, or writes what a kept pass reads
+ *   - walks the kept passes in the order they were added and emits a barrier
+ *     wherever a texture's access changes or a write is involved, imported
+ *     textures start and end in the access they were imported with
+ *   - places the transient textures in one heap, textures whose lifetimes do
+ *     not overlap share memory. The first use of a texture that reuses memory
+ *     discards the old contents and waits for the accesses of the textures
+ *     that were there before
+ *
+ * Passes must be added in an order that works, the graph does not reorder.
+ */
+class RenderGraph {
+public:
+    static const uint32_t InvalidId = 0xFFFFFFFF;
+    static const uint64_t NotAliased = 0xFFFFFFFFFFFFFFFFull;
+
+    enum class PassType {
+        Graphics,
+        Compute,
+        Transfer
+    };
+
+    enum class Format {
+        RGBA8,
+        BGRA8,
+        RGBA16F,
+        RG16F,
+        R32F,
+        Depth32F,
+        Depth24Stencil8,
+        Depth32FStencil8
+    };
+
+    enum class Access {
+        // before the first use of a transient texture, the contents are discarded
+        Undefined,
+        ColorAttachment,
+        DepthAttachment,
+        // depth test without writes, or sampled while bound as depth
+        DepthRead,
+        Sampled,
+        StorageRead,
+        StorageWrite,
+        TransferSrc,
+        TransferDst,
+        Present
+    };
+
+    // What an attachment pass does with the previous contents
+    enum class LoadOp {
+        Load,
+        Clear,
+        DontCare
+    };
+
+    struct TextureDesc {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 1;
+        Format format = Format::RGBA8;
+        // color, or depth in [0] and stencil in [1], of LoadOp::Clear
+        float clearValue[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    };
+
+    // The backend's memory requirements for a transient texture
+    struct MemoryRequirements {
+        uint64_t size = 0;
+        uint64_t alignment = 1;
+        // memory types the texture may live in, the heap uses the ones every texture accepts
+        uint32_t typeBits = 0xFFFFFFFF;
+    };
+
+    struct Use {
+        uint32_t texture;
+        Access access;
+        LoadOp load;
+    };
+
+    struct Barrier {
+        uint32_t texture;
+        Access before;
+        PassType beforeType;
+        Access after;
+        PassType afterType;
+        // first use of memory other textures used before: a mask of 1 << Access of their last accesses,
+        // their pass types are not kept, backends wait for every stage that may do those accesses
+        uint32_t aliasedAccesses;
+    };
+
+    struct Pass {
+        std::string name;
+        PassType type;
+        std::vector<Use> uses;
+        bool sideEffect = false;
+        bool culled = false;
+        // transitions ahead of the pass
+        std::vector<Barrier> barriers;
+    };
+
+    struct Texture {
+        std::string name;
+        TextureDesc desc;
+        bool imported = false;
+        Access initialAccess = Access::Undefined;
+        Access finalAccess = Access::Undefined;
+        // kept passes that use it, in order; InvalidId when none does
+        uint32_t firstPass = InvalidId;
+        uint32_t lastPass = InvalidId;
+        // heap placement of a transient texture, NotAliased when it did not fit the heap's memory types
+        MemoryRequirements requirements;
+        uint64_t heapOffset = NotAliased;
+    };
+
+    // Declares what one pass uses, valid while its setup callback runs
+    class PassBuilder {
+    public:
+        // Transient texture, its first use must write it
+        uint32_t CreateTexture(const char* name, const TextureDesc& desc);
+        void Read(uint32_t texture, Access access);
+        // load only matters for attachments
+        void Write(uint32_t texture, Access access, LoadOp load = LoadOp::Load);
+        // Keep the pass even when nothing in the graph reads what it writes, e.g. it fills a buffer
+        void SetSideEffect() { pass.sideEffect = true; }
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, Pass& pass)
+            : graph(graph)
+            , pass(pass)
+        {
+        }
+        void use(uint32_t texture, Access access, LoadOp load);
+
+        RenderGraph& graph;
+        Pass& pass;
+    };
+
+    // The texture lives on past the frame, it enters the frame in initial access and leaves it in final
+    uint32_t ImportTexture(const char* name, const TextureDesc& desc, Access initial, Access final);
+    uint32_t AddPass(const char* name, PassType type, const std::function<void(PassBuilder&)>& setup);
+    // Forget every pass and texture, the next frame's graph is built anew
+    void Clear();
+
+    // Cull, lifetimes, barriers and heap placement; requirements is asked once per transient texture
+    void Compile(const std::function<MemoryRequirements(uint32_t texture)>& requirements);
+
+    const std::vector<Pass>& GetPasses() const { return passes; }
+    const std::vector<Texture>& GetTextures() const { return textures; }
+    // transitions of the imported textures back to their final access, after the last pass
+    const std::vector<Barrier>& GetFinalBarriers() const { return finalBarriers; }
+
+    // the transient heap, its alignment and memory types
+    uint64_t GetHeapSize() const { return heapSize; }
+    uint64_t GetHeapAlignment() const { return heapAlignment; }
+    uint32_t GetHeapTypeBits() const { return heapTypeBits; }
+    // what the transient textures would take without aliasing
+    uint64_t GetTransientSize() const { return transientSize; }
+
+    static bool IsWrite(Access access);
+
+private:
+    void cull();
+    void computeLifetimes();
+    void placeTransients(const std::function<MemoryRequirements(uint32_t texture)>& requirements);
+    void computeBarriers();
+
+    std::vector<Pass> passes;
+    std::vector<Texture> textures;
+    std::vector<Barrier> finalBarriers;
+
+    uint64_t heapSize = 0;
+    uint64_t heapAlignment = 1;
+    uint32_t heapTypeBits = 0xFFFFFFFF;
+    uint64_t transientSize = 0;
+};
+}
@@ -0,0 +1,67 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "File.hpp"
+#include "RenderGraphVulkan.hpp"
+
+namespace m3d {
+namespace schema {
+    struct SRenderGraph;
+}
+
+/*
+ * The passes and textures of a RenderGraph, as data (data/schema/rendergraph.fbs).
+ *
+ * Shipping builds load the binary form cooked with
+ *     flatc -b data/schema/rendergraph.fbs <graph>.json
+ * which is memory mapped and read in place, there is nothing to parse. During
+ * development the JSON text loads through the flatbuffers parser and
+ * ReloadIfChanged picks up edits while the application runs.
+ *
+ * Build adds the graph of one device tier to a RenderGraphVulkan. Passes name
+ * the execute callback they run, so a tier can swap a pass's variant, or drop
+ * the pass, without a rebuild of the application.
+ */
+class RenderGraphConfig {
+public:
+    typedef std::map<std::string, RenderGraphVulkan::ExecuteCallback> Executes;
+
+    // .json is parsed against the schema, anything else is mapped as the binary form
+    bool Load(const std::string& path, const std::string& schemaPath = "data/schema/rendergraph.fbs");
+    // true when the file changed since it was loaded and the new one is valid, the old one stays otherwise
+    bool ReloadIfChanged();
+
+    // Clears graph, with trash as RenderGraphVulkan::Clear, then adds the textures and the passes of tier in the
+    // order of the file. Textures scale with width and height unless they have a size of their own.
+    // false when a pass has no execute callback.
+    bool Build(RenderGraphVulkan& graph, uint8_t tier, uint32_t width, uint32_t height, const Executes& executes,
+        ResourceTrash* trash = nullptr);
+    // Id of a texture in the graph of the last Build, RenderGraph::InvalidId when no pass of the tier writes a transient one
+    uint32_t GetTexture(const std::string& name) const;
+
+private:
+    bool load(const std::string& path, std::vector<uint8_t>& parsed, std::shared_ptr<const file::MappedFile>& mapped) const;
+    const schema::SRenderGraph* root() const;
+
+    std::string path;
+    std::string schemaPath;
+    int64_t modified = 0;
+
+    // one of the two holds the buffer
+    std::vector<uint8_t> parsed;
+    std::shared_ptr<const file::MappedFile> mapped;
+
+    std::map<std::string, uint32_t> textures;
+};
+}
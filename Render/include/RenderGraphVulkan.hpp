@@ -0,0 +1,104 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+#include "RenderGraph.hpp"
+
+namespace m3d {
+class ResourceTrash;
+
+/*
+ * Runs a RenderGraph on Vulkan.
+ *
+ * Compile creates the transient images and binds them into one device local
+ * allocation at the offsets the graph placed them, so textures that are never
+ * alive at the same time share memory. Every graphics pass gets a render pass
+ * of its attachments: color and depth uses, with the load op of the builder
+ * and a store op that drops what no later pass reads. The layouts do not
+ * change inside a render pass, Execute puts the graph's barriers ahead of
+ * each pass, all of a pass's in one vkCmdPipelineBarrier.
+ *
+ * Pipelines for a pass are created against GetRenderPass after Compile. They
+ * stay usable across later Compiles of the same graph, render pass
+ * compatibility only depends on the formats and sample counts.
+ *
+ * Build the graph once and Compile again when the imported textures change
+ * size, e.g. on a swapchain resize; Execute records it any number of times.
+ */
+class RenderGraphVulkan {
+public:
+    typedef std::function<void(vk::CommandBuffer, RenderGraphVulkan&)> ExecuteCallback;
+
+    RenderGraphVulkan(vk::Device&, MemoryAllocator&);
+    ~RenderGraphVulkan();
+
+    // The image and view can change until Execute, e.g. per swapchain image
+    uint32_t ImportTexture(const char* name, const RenderGraph::TextureDesc& desc, RenderGraph::Access initial,
+        RenderGraph::Access final, vk::Image image = vk::Image(), vk::ImageView view = vk::ImageView());
+    void SetImportedTexture(uint32_t texture, vk::Image image, vk::ImageView view);
+    // A graphics pass's execute runs inside its render pass, with the viewport and scissor set to the attachments
+    uint32_t AddPass(const char* name, RenderGraph::PassType type, const std::function<void(RenderGraph::PassBuilder&)>& setup,
+        const ExecuteCallback& execute);
+
+    // With trash the resources of the previous Compile are released once the frames using them completed,
+    // otherwise right away
+    void Compile(ResourceTrash* trash = nullptr);
+    // Forget every pass and texture to build a different graph, releases like Compile
+    void Clear(ResourceTrash* trash = nullptr);
+    // Outside of a render pass, every pass and the transitions to the imported textures' final accesses
+    void Execute(vk::CommandBuffer cmd);
+
+    vk::Image GetImage(uint32_t texture) const { return images[texture]; }
+    vk::ImageView GetView(uint32_t texture) const { return views[texture]; }
+    // Null for culled passes and passes without attachments
+    vk::RenderPass GetRenderPass(uint32_t pass) const { return passResources[pass].renderPass; }
+    const RenderGraph& GetGraph() const { return graph; }
+
+    static vk::Format ToVulkan(RenderGraph::Format format);
+
+private:
+    struct Framebuffer {
+        std::vector<vk::ImageView> views;
+        vk::Framebuffer framebuffer;
+    };
+    struct PassResources {
+        vk::RenderPass renderPass;
+        // the pass's attachment textures, in attachment order
+        std::vector<uint32_t> attachments;
+        std::vector<vk::ClearValue> clearValues;
+        vk::Extent2D extent;
+        // one per set of imported views seen
+        std::vector<Framebuffer> framebuffers;
+    };
+
+    vk::ImageUsageFlags usage(uint32_t texture) const;
+    void createImages();
+    void createRenderPass(uint32_t pass);
+    vk::Framebuffer framebuffer(PassResources& resources);
+    void recordBarriers(vk::CommandBuffer cmd, const std::vector<RenderGraph::Barrier>& barriers);
+    void release(ResourceTrash* trash);
+
+    vk::Device& device;
+    MemoryAllocator& allocator;
+
+    RenderGraph graph;
+    std::vector<ExecuteCallback> executes;
+
+    // per texture, imported ones are set by the caller
+    std::vector<vk::Image> images;
+    std::vector<vk::ImageView> views;
+    // transient images that did not fit the heap's memory types
+    std::vector<MemoryAllocator::Allocation> ownAllocations;
+    MemoryAllocator::Allocation heap;
+    std::vector<PassResources> passResources;
+};
+}
@@ -0,0 +1,73 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "RadixSort.hpp"
+
+namespace m3d {
+class ThreadPool;
+
+/*
+ * The draws of a frame as 64-bit sort keys, most significant first:
+ *
+ *   pass : 4 | pipeline : 12 | material : 16 | depth : 32
+ *
+ * Sorted, the draws of a pass are contiguous, within it the draws of a
+ * pipeline and within those the draws of a material, front to back. Recording
+ * then only binds a pipeline or pushes a material when the key changes. The
+ * depth pre-pass keys leave the material out, they are front to back only.
+ *
+ * Pipelines are registered per frame, the key holds their index.
+ * Materials only group, keys keep the low 16 bits of the index; recording
+ * reads the real one from the draw's mesh slice.
+ */
+class RenderQueue {
+public:
+    enum Pass : uint32_t {
+        DepthPrepass = 0,
+        Opaque = 1,
+    };
+    static const uint32_t MaxPipelines = 1 << 12;
+
+    struct Item {
+        uint64_t key;
+        uint32_t instance;
+        uint32_t slice;
+    };
+
+    static uint64_t MakeKey(uint32_t pass, uint32_t pipeline, uint32_t material, float depth)
+    {
+        return (static_cast<uint64_t>(pass & 0xf) << 60) | (static_cast<uint64_t>(pipeline & 0xfff) << 48)
+            | (static_cast<uint64_t>(material & 0xffff) << 32) | FloatSortKey(depth);
+    }
+    static uint32_t GetPass(uint64_t key) { return static_cast<uint32_t>(key >> 60); }
+    static uint32_t GetPipeline(uint64_t key) { return static_cast<uint32_t>(key >> 48) & 0xfff; }
+
+    // Forget the draws and pipelines of the last frame
+    void Clear();
+    // Index for the keys, at most MaxPipelines per frame
+    uint32_t AddPipeline(vk::Pipeline pipeline);
+    vk::Pipeline GetPipeline(uint32_t index) const { return pipelines[index]; }
+
+    // Resize and fill in, threads may write disjoint items at once
+    std::vector<Item>& GetItems() { return items; }
+    const std::vector<Item>& GetItems() const { return items; }
+    // Radix sort by key, in parallel on threads for large queues; not from a task of threads
+    void Sort(ThreadPool* threads = nullptr);
+    // Items of pass after Sort, empty when first == last
+    void GetPassRange(uint32_t pass, uint32_t& first, uint32_t& last) const;
+
+private:
+    std::vector<vk::Pipeline> pipelines;
+    std::vector<Item> items;
+    std::vector<Item> scratch;
+};
+}
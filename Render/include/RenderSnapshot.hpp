@@ -0,0 +1,79 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Scene.hpp"
+
+namespace m3d {
+
+/*
+ * What the simulation hands the render thread for one frame, everything the
+ * renderer reads of the scene that changes while it runs. The render thread
+ * applies it to the Scene before it draws, so the rest of the renderer keeps
+ * reading the Scene as before.
+ */
+struct RenderSnapshot {
+    // frames filled so far, the first snapshot is 1
+    uint64_t frame = 0;
+    // the main camera: Scene::cameras[Scene::mainCameraID] when the scene has one, and what the scene is drawn with
+    bool hasCamera = false;
+    Camera camera;
+    // transforms that changed since the previous snapshot, by transform id, applied with Scene::SetTransform
+    std::vector<std::pair<uint32_t, Transform>> transforms;
+    // CPU time of the simulation that filled it, for the report
+    double simulateMs = 0.0;
+
+    // empty the changes for the next frame, keeps the capacity
+    void Clear();
+};
+
+/*
+ * Two RenderSnapshots the simulation thread and the render thread trade.
+ *
+ * The writer fills one while the reader draws from the other, so simulating
+ * frame N + 1 overlaps drawing frame N. BeginWrite blocks while the snapshot
+ * it returns is still being read, EndWrite while the reader did not take the
+ * previous one yet: the reader sees every snapshot in order and the writer
+ * is never more than one frame ahead.
+ */
+class SnapshotBuffer {
+public:
+    SnapshotBuffer();
+
+    // Writer: the next snapshot to fill, cleared
+    RenderSnapshot& BeginWrite();
+    // Hand the filled snapshot to the reader
+    void EndWrite();
+
+    // Reader: the oldest snapshot written and not read, blocks until there is one. nullptr once closed and drained
+    const RenderSnapshot* BeginRead();
+    void EndRead();
+
+    // No more snapshots, wakes a waiting reader
+    void Close();
+
+private:
+    static const int None = -1;
+
+    RenderSnapshot snapshots[2];
+    std::mutex mutex;
+    std::condition_variable changed;
+    int writing = None;
+    // written and not taken yet, and taken and not released
+    int ready = None;
+    int reading = None;
+    int next = 0;
+    uint64_t frame = 0;
+    bool closed = false;
+};
+}
@@ -1,6 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
 namespace m3d {
 
 class Scene;
+struct Transform;
 
 class Renderer {
 public:
@@ -18,6 +23,12 @@ public:
     virtual void OnWindowSizeChanged() = 0;
     virtual void Draw() = 0;
 
+    /* Scene edits, see Scene::AddInstance; what the renderer built from the scene follows without a rebuild where it can */
+    virtual uint32_t AddInstance(uint32_t meshID, const Transform& transform) = 0;
+    virtual void RemoveInstance(uint32_t instanceID) = 0;
+    virtual void SetTransform(uint32_t transformID, const Transform& transform) = 0;
+    virtual void SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID) = 0;
+
 protected:
     /* Create Device */
     virtual void CreateDevice() = 0;
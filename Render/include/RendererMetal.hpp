@@ -0,0 +1,133 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <Matrix.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Renderer.hpp"
+
+namespace m3d {
+class Scene;
+// Metal objects of the renderer, only RendererMetal.mm sees their Objective-C types
+struct MetalContext;
+
+/*
+ * Scene renderer on Metal, for iOS and macOS.
+ *
+ * Init packs the meshes into one vertex and one index buffer. Every instance
+ * slice becomes one draw whose baseInstance selects its DrawInfo, as the
+ * firstInstance of the Vulkan indirect draws does. The vertex and fragment
+ * functions reach the draw infos and materials through one argument buffer.
+ *
+ * The per-frame uniforms and the world matrices of the drawn instances live
+ * in FramesInFlight slots of one buffer. The CPU only writes a slot once the
+ * GPU has completed the frame that last read it.
+ *
+ * With indirect draws, the default, the draws are encoded once into an
+ * indirect command buffer that every frame replays. Otherwise the render
+ * encoder issues them each frame. Draws need baseInstance, which means an A9
+ * or newer GPU on iOS.
+ */
+class RendererMetal : Renderer {
+public:
+    static const uint32_t FramesInFlight = 3;
+
+    RendererMetal();
+    ~RendererMetal();
+
+    // The CAMetalLayer frames present to, an MTKView's or a UIView's layer; set before Init
+    void SetLayer(void* metalLayer) { layer = metalLayer; }
+    // Replay the draws from an indirect command buffer instead of encoding them every frame, set before Init
+    void SetIndirectDraw(bool enable) { useIndirect = enable; }
+    // Row major like Pipeline::SetCamera, the image matches RendererVulkan's for the same matrices
+    void SetCamera(const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+    // Meshes or instances were added or removed, the next Draw rebuilds geometry and draws
+    void SetSceneDirty() { sceneDirty = true; }
+    // Scene edits. The world matrices are written every frame, so moving costs nothing; the others rebuild the
+    // draws like SetSceneDirty
+    uint32_t AddInstance(uint32_t meshID, const Transform& transform) override;
+    void RemoveInstance(uint32_t instanceID) override;
+    void SetTransform(uint32_t transformID, const Transform& transform) override;
+    void SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID) override;
+
+    struct FrameStats {
+        // the last Draw that submitted a frame, on the CPU, without waiting for a free slot and drawable
+        double cpuMs = 0.0;
+        // the frame's command buffer on the GPU, FramesInFlight frames behind
+        double gpuMs = 0.0;
+        // scene draws of the frame
+        uint32_t draws = 0;
+    };
+    const FrameStats& GetFrameStats() const { return frameStats; }
+
+    void Init(Scene*) override;
+    // The layer's bounds or scale changed, the drawables and depth buffer follow them
+    void OnWindowSizeChanged() override;
+    void Draw() override;
+
+protected:
+    void CreateDevice() override;
+
+private:
+    // same layouts as in data/shaders/metal/scene.metal
+    struct DrawInfo {
+        uint32_t transform;
+        uint32_t material;
+    };
+    struct GpuMaterial {
+        float diffuse[4];
+    };
+    struct DrawCommand {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t baseVertex;
+    };
+    // where a mesh landed in the shared vertex and index buffers
+    struct GeometryRange {
+        int32_t baseVertex = 0;
+        uint32_t firstIndex = 0;
+        bool valid = false;
+    };
+
+    void CreatePipeline();
+    void CreateDepthBuffer();
+    void BuildGeometry();
+    void BuildDraws();
+    void EncodeIndirectCommands();
+    void WriteFrame(uint32_t slot);
+    void WaitIdle();
+
+    MetalContext* metal = nullptr;
+    void* layer = nullptr;
+    Scene* scene = nullptr;
+
+    bool useIndirect = true;
+    bool inited = false;
+    bool sceneDirty = false;
+    uint32_t frameIndex = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    m3d::math::Matrix4x4 viewMatrix;
+    m3d::math::Matrix4x4 projectionMatrix;
+    bool customCamera = false;
+
+    // by mesh id, ids carry a generation in their top bits and are far from dense
+    std::unordered_map<uint32_t, GeometryRange> geometryRanges;
+    std::vector<DrawCommand> drawCommands;
+    std::vector<DrawInfo> drawInfos;
+    // transform id of every drawn instance, DrawInfo::transform indexes it
+    std::vector<uint32_t> drawTransforms;
+    // bytes of one frame slot: uniforms, then the world matrices
+    size_t slotSize = 0;
+    size_t transformsOffset = 0;
+
+    FrameStats frameStats;
+};
+}
@@ -6,18 +6,72 @@
 #pragma once
 
 #include <Matrix.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <vulkan/vulkan.hpp>
 
+#include "FrameCapture.hpp"
+#include "MemoryTags.hpp"
+#include "RenderCommandQueue.hpp"
+#include "Metrics.hpp"
 #include "Renderer.hpp"
+#include "ResourceTrash.hpp"
 #include "VulkanSwapchain.hpp"
 
 #define DEFAULT_FENCE_TIMEOUT 100000000000
 
 namespace m3d {
 class Scene;
+class FramePacer;
 class Pipeline;
 class RenderPass;
 class CommandBuffer;
+class AccelerationStructures;
+class GeometryArena;
+class FrameArena;
+class UploadQueue;
+class IndirectDraws;
+class JobSystem;
+class ClusteredLights;
+class CommandCapture;
+class GpuCulling;
+class GpuMeshDecoder;
+class GpuProfiler;
+class GpuSkinning;
+class CrowdRenderer;
+class ImpostorRenderer;
+class ParticleSystem;
+class PostProcess;
+class DescriptorAllocator;
+class DynamicResolution;
+class GuiRenderer;
+class IdPicker;
+class MaterialTable;
+class MemoryAllocator;
+class MemoryOverlay;
+struct MergedIDs;
+class StatsOverlay;
+class OcclusionQueries;
+class OffscreenTargets;
+class PipelineRegistry;
+struct RenderSnapshot;
+class SamplerCache;
+class SceneStreamer;
+class ShaderWatcher;
+class ShadowAtlas;
+class ShadowCascades;
+class ShadingRate;
+class SoftwareOcclusion;
+class SubmitTimeline;
+class TextureArrays;
+class TextureStreamer;
+class WorldStreamer;
 
 class RendererVulkan : Renderer {
 public:
@@ -25,11 +79,311 @@ public:
     ~RendererVulkan();
 
 	void Init(Scene*) override;
+    // What Init does before it needs the scene: instance, device, swapchain or headless targets, the upload
+    // path and the pipeline cache. Init calls it unless it ran, see StartRenderer. The settings below are read
+    // by it, set them first
+    void InitDevice();
+
+    // Number of frames the CPU may record ahead of the GPU, set before Init
+    void SetFramesInFlight(uint32_t count) { framesInFlight = count; }
+    // Record every frame on threadCount workers instead of replaying static command buffers, set before Init
+    void SetRecordThreads(uint32_t threadCount) { recordThreads = threadCount; }
+    // Draw Scene::instances with drawIndexedIndirect and a transform SSBO, set before Init.
+    // instanced merges the instances of a mesh slice into one command, GPU culling is skipped then
+    void SetIndirectDraw(bool enable, bool instanced = false)
+    {
+        useIndirect = enable;
+        useInstancing = instanced;
+    }
+    // Cull the indirect draws in a compute pass, optionally against last frame's depth, set before Init
+    void SetGpuCulling(bool enable, bool occlusion = true)
+    {
+        useGpuCulling = enable;
+        useOcclusionCulling = occlusion;
+    }
+    // Cull the meshlets of meshes drawn at full resolution one by one, backfaces also by their normal cones.
+    // Needs GPU culling, set before Init
+    void SetMeshletCulling(bool enable, bool backfaces = false)
+    {
+        useMeshletCulling = enable;
+        useMeshletConeCulling = backfaces;
+    }
+    // Skin animated meshes in a compute pass and draw them after the scene, set before Init.
+    // callback runs every frame once the frame's slot may be refilled, it adds that frame's instances
+    void SetGpuSkinning(bool enable, std::function<void(GpuSkinning&)> callback = nullptr)
+    {
+        useGpuSkinning = enable;
+        skinningCallback = callback;
+    }
+    // Meshes are added to it after Init, null without SetGpuSkinning
+    GpuSkinning* GetGpuSkinning() const { return gpuSkinning; }
+    // Draw crowds of agents animated from baked palettes after the skinned instances, set before Init
+    void SetCrowds(bool enable) { useCrowds = enable; }
+    // Meshes, baked animations and agents are added to it after Init, null without SetCrowds
+    CrowdRenderer* GetCrowds() const { return crowds; }
+    // Simulate and draw particles on the GPU, emitted from the emitters of GetParticles. Needs one view, set before Init
+    void SetParticles(bool enable) { useParticles = enable; }
+    // Emitters are added to it after Init, null without SetParticles
+    ParticleSystem* GetParticles() const { return particles; }
+    // Tonemap, grade, vignette and sharpen the HDR scene with bloom in one compute pass into the swapchain image,
+    // where the device stores into images without a format. Needs one view and a window, set before Init
+    void SetPostProcess(bool enable) { usePostProcess = enable; }
+    // Its settings are changed after Init, null without SetPostProcess
+    PostProcess* GetPostProcess() const { return postProcess; }
+    // Build ray tracing acceleration structures of the scene every frame, for ray queried shadows and picking,
+    // where the device has VK_KHR_acceleration_structure and VK_KHR_ray_query. Set before Init
+    void SetRayTracing(bool enable) { useRayTracing = enable; }
+    // null without SetRayTracing or when the device can not trace rays
+    AccelerationStructures* GetAccelerationStructures() const { return accelerationStructures; }
+    // Write the transform entry and triangle of every pixel the indirect draws cover into an ID buffer, for Pick.
+    // Needs SetIndirectDraw and bindless materials, one sample and one view; not headless. Set before Init
+    void SetIdBuffer(bool enable) { useIdBuffer = enable; }
+    // Draw the slices of Material::Blend::WeightedBlended materials with weighted blended order-independent
+    // transparency after the opaque scene, opaque otherwise. Needs SetIndirectDraw and bindless materials, one sample
+    // and one view. Set before Init
+    void SetTransparency(bool enable) { useTransparency = enable; }
+    // Write the indirect opaque draws into a G-buffer that stays in tile memory and light every covered pixel once
+    // in a full screen pass, instead of every fragment drawn. Needs SetIndirectDraw and SetClusteredLighting, one
+    // sample and one view. Set before Init
+    void SetDeferred(bool enable) { useDeferred = enable; }
+    // Shade the scene coarser where the previous frame was flat and, with ShadingRate::Settings::foveated, towards
+    // the periphery, where the device has VK_NV_shading_rate_image. The contrast needs SetPostProcess. Not headless,
+    // set before Init
+    void SetShadingRate(bool enable) { useShadingRate = enable; }
+    // Its settings are changed after Init, null without SetShadingRate or the extension
+    ShadingRate* GetShadingRate() const { return shadingRate; }
+    // The indirect draws fetch vertices, world matrices and draw infos through buffer device addresses in push
+    // constants instead of vertex buffers, where the device has VK_KHR_buffer_device_address; every vertex format
+    // shares their pipelines. Needs SetIndirectDraw and one view, set before Init
+    void SetVertexPulling(bool enable) { useVertexPulling = enable; }
+    // instanceID IndirectDraws::NoInstance and primitive Pipeline::InvalidId where nothing was hit
+    typedef std::function<void(uint32_t instanceID, uint32_t primitive)> PickCallback;
+    // Which instance covers window pixel (x, y), or the nearest one within IdPicker::RegionSize pixels, and the
+    // triangle of its draw. The next frame copies it out, callback runs once that frame completed, on the drawing
+    // thread; nothing waits. False without the ID buffer or with IdPicker::MaxPicks queued
+    bool Pick(uint32_t x, uint32_t y, PickCallback callback);
+    // Skin on a compute only queue family where the device has one, overlapping with the graphics work of the
+    // frames in flight; the graphics queue skins otherwise. Set before Init
+    void SetAsyncCompute(bool enable) { useAsyncCompute = enable; }
+    // Draw GUI element trees on top of the scene, set before Init.
+    // callback runs every frame once the frame's slot may be refilled, it adds that frame's elements
+    void SetGui(bool enable, std::function<void(GuiRenderer&)> callback = nullptr)
+    {
+        useGui = enable;
+        guiCallback = callback;
+    }
+    // Atlases, regions and the font are added to it after Init, null without SetGui
+    GuiRenderer* GetGui() const { return gui; }
+    // Heap usage against the budgets and the bytes of every allocation category on top of the GUI, any time
+    // after Init. Needs SetGui and the GuiRenderer's font; fontFace as its font renderer knows it, empty hides it
+    void SetMemoryOverlay(const std::string& fontFace);
+    // Frame time graphs and the scene's draws, triangles, pipeline binds, uploads and memory on top of the GUI, in the
+    // top right corner. The bars show barTexture, a solid white region added to the GUI; empty fontFace hides it
+    void SetStatsOverlay(const std::string& fontFace, const std::string& barTexture);
+    // Valid after Init: the heap budgets, VK_EXT_memory_budget's where the driver has it, and per category statistics
+    MemoryAllocator* GetMemoryAllocator() const { return memoryAllocator; }
+    // Run the system's main thread jobs at the start of every Draw, when Draw runs on the system's main thread
+    void SetJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+    // Merge the streamer's models into the scene as they finish loading, nearest to the camera first
+    void SetSceneStreamer(SceneStreamer* streamer) { sceneStreamer = streamer; }
+    // Keep the streamer's cells around the camera in the scene, their instances, geometry blocks and textures
+    // leave the renderer with them. Cell ids are reused, per mesh state of ray tracing, impostors and occlusion
+    // does not follow unloads
+    void SetWorldStreamer(WorldStreamer* streamer) { worldStreamer = streamer; }
+    // Time the submission of every frame with timestamp queries, and each pass and the main steps of Draw
+    // with a GpuProfiler whose report DrawLoop prints, set before Init
+    void SetGpuTimer(bool enable) { useGpuTimer = enable; }
+    // Null without SetGpuTimer, valid after Init; the application may add scopes of its own
+    GpuProfiler* GetProfiler() const { return profiler; }
+    // Descriptor sets of the frame being built, valid after Init; their pools are reset when the frame's
+    // index comes around again and its fence has signaled
+    DescriptorAllocator* GetFrameDescriptors() const { return frameDescriptors; }
+    // Objects the frames in flight may still use go here instead of being destroyed, e.g. by streaming
+    // or a reload; they are destroyed once those frames completed
+    ResourceTrash& GetTrash() { return trash; }
+    // Scene edits of the drawing thread, from others through the command queue. With indirect draws they reach
+    // the instance data in the next Draw without re-recording; an Update of everything only follows when an
+    // added instance does not fit its batch, with instancing, or for a material the table did not write yet
+    uint32_t AddInstance(uint32_t meshID, const Transform& transform) override;
+    void RemoveInstance(uint32_t instanceID) override;
+    void SetTransform(uint32_t transformID, const Transform& transform) override;
+    void SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID) override;
+    // Resource creation and destruction from other threads: the commands run on the drawing thread at the start
+    // of the next frame of DrawLoop or DrawLoopThreaded, and once more when the loop ends
+    RenderCommandQueue& GetCommandQueue() { return commands; }
+    // Lay down the scene's depth in a subpass of its own before shading it, set before Init
+    void SetDepthPrepass(bool enable) { useDepthPrepass = enable; }
+    // Render the scene with samples per pixel and resolve it into the swapchain image, set before Init.
+    // Lowered to what the device supports; turns occlusion culling off
+    void SetMsaa(vk::SampleCountFlagBits samples) { msaaSamples = samples; }
+    // Materials and textures of the indirect draws from one descriptor set where the device supports it, the
+    // default; off they are drawn untextured. Set before Init
+    void SetBindless(bool enable) { useBindless = enable; }
+    // Shade the indirect draws with the scene's lights, binned into view space clusters by a compute pass
+    // every frame so each fragment only loops over the lights near it. Needs SetIndirectDraw and bindless
+    // materials, set before Init
+    void SetClusteredLighting(bool enable) { useClusteredLighting = enable; }
+    // Shadow the main directional light with cascaded shadow maps fit between the main camera's near and far
+    // planes. Static geometry maps are cached and only redrawn when a cascade moved or the scene changed.
+    // Point and spot lights get tiles of a ShadowAtlas sized by their screen coverage, redrawn when they or the
+    // casters in their range move, within a texel budget per frame. Needs SetClusteredLighting, set before Init
+    void SetShadows(bool enable) { useShadows = enable; }
+    // Upload compressed cooked geometry as it is and decode it with a compute pass on the graphics queue. A scene
+    // StartRenderer loads is left encoded for it, a scene given to Init needs Scene::gpuGeometryDecode before
+    // LoadMeshes, a WorldStreamer's cells its gpuGeometryDecode setting. Not with ray tracing or software
+    // occlusion, which read the vertices on the CPU. Set before InitDevice
+    void SetGpuGeometryDecode(bool enable) { useGpuGeometryDecode = enable; }
+    // what InitDevice will do, known before it runs
+    bool GetGpuGeometryDecode() const { return useGpuGeometryDecode && !useRayTracing && !useSoftwareOcclusion; }
+    // Cull the instances of per-frame recordings against the depth of a few occluders, rasterized on the CPU while
+    // the frame is prepared, for GPUs that cannot spare a depth pyramid pass. Needs SetRecordThreads, set before Init
+    void SetSoftwareOcclusion(bool enable) { useSoftwareOcclusion = enable; }
+    // Occluder instances are added to it after Init, null without SetSoftwareOcclusion
+    SoftwareOcclusion* GetSoftwareOcclusion() const { return softwareOcclusion; }
+    // Skip the draws of instances with at least minTriangles whose world box was hidden in the previous frame, by
+    // occlusion queries and VK_EXT_conditional_rendering, without the CPU waiting on the results. Needs
+    // SetRecordThreads and one view, set before Init
+    void SetOcclusionQueries(bool enable, uint32_t minTriangles = 10000)
+    {
+        useOcclusionQueries = enable;
+        occlusionMinTriangles = minTriangles;
+    }
+    // Draw the instances of heavy meshes from distance on as octahedral impostors, baked on the GPU the first time
+    // their mesh is resident. Needs SetIndirectDraw, bindless materials and one view, set before Init
+    void SetImpostors(bool enable, float distance = 150.0f)
+    {
+        useImpostors = enable;
+        impostorDistance = distance;
+    }
+    // Recompile the GLSL sources of the graphics pipelines' shaders when they change and swap the rebuilt
+    // pipelines in between frames, see ShaderWatcher. For development, set before Init
+    void SetShaderHotReload(bool enable) { useShaderHotReload = enable; }
+    // Draw several of Scene::cameras in one pass with VK_KHR_multiview, one draw stream for all views, e.g. both
+    // eyes of a stereo headset or the four views of a CAD layout. Each view gets a tile of the window: two side
+    // by side, more in rows of two. Up to Pipeline::MaxViews, set before Init. GPU culling and clustered lighting
+    // work for one camera and are turned off; without multiview support or headless only the main camera is drawn
+    void SetViews(const std::vector<uint32_t>& cameraIDs) { viewCameras = cameraIDs; }
+
+    // Present mode of the swapchain, falls back to a supported one as VulkanSwapChain::selectPresentMode does.
+    // FIFO idles the GPU until the vertical blank and saves power, mailbox and immediate present as soon as
+    // a frame is done. Any time, the swapchain is recreated at the next Draw; a non zero imageCount asks for
+    // that many images and is only applied before Init
+    void SetPresentMode(vk::PresentModeKHR mode, uint32_t imageCount = 0);
+    // Start a frame only once all but count - 1 of the submitted ones completed on the GPU, 0 for no more
+    // than framesInFlight. Fewer queued frames read input closer to when it is shown
+    void SetMaxQueuedFrames(uint32_t count) { maxQueuedFrames = count; }
+    // One queued frame and the fewest swapchain images the surface allows, set before Init
+    void SetLowLatency(bool enable)
+    {
+        SetMaxQueuedFrames(enable ? 1 : 0);
+        swapChain.requestedImageCount = enable ? 1 : 0;
+    }
+
+    // Render into offscreen images instead of a window, set before Init. No surface and no swapchain:
+    // every Draw renders up to batchSize queued RenderOffscreen requests in one submission and reads
+    // them back into host memory. Without per frame recording, GPU culling, skinning and GUI
+    void SetHeadless(uint32_t w, uint32_t h, uint32_t batchSize = 8)
+    {
+        headless = true;
+        width = w;
+        height = h;
+        headlessBatch = std::max<uint32_t>(batchSize, 1);
+    }
+    // Physical device to render with, an index into EnumerateDevices, set before Init. 0, the default, is
+    // the best device of the machine
+    void SetDeviceIndex(uint32_t index) { deviceIndex = index; }
+    // A headless renderer binds the thread that calls Init, and so draws, to the NUMA node of its device, on
+    // servers of more than one; its FrameArena and the pages it maps from then on are placed there. On by
+    // default, set before Init
+    void SetNumaBinding(bool enable) { numaBinding = enable; }
+    // NUMA node of the device after Init, -1 when unknown or on machines of one node. Create the JobSystem
+    // that feeds the renderer for it, JobSystem(0, JobSystem::Priority::Normal, GetNumaNode())
+    int GetNumaNode() const { return numaNode; }
+    struct DeviceInfo {
+        std::string name;
+        vk::PhysicalDeviceType type;
+        vk::DeviceSize localMemory;
+        // vkhelper::scorePhysicalDevice
+        uint64_t score;
+    };
+    // The devices that can render, best first as SetDeviceIndex counts them. Creates an instance of its own,
+    // any time before or after Init
+    static std::vector<DeviceInfo> EnumerateDevices();
+    // One renderer per device renders with all of a machine's GPUs: Init them one after the other, then
+    // DrawAll runs every renderer's Draw as a job of jobs and waits for all of them. Call it from the
+    // thread that created jobs, which runs the main thread jobs meanwhile; each renderer only touches
+    // its own device and objects
+    static void DrawAll(const std::vector<RendererVulkan*>& renderers, JobSystem& jobs);
+    // id of the RenderOffscreen request, width * 4 bytes per row of BGRA8 pixels. Runs on the thread
+    // that draws once the GPU finished, the pixels are only valid during the call
+    typedef std::function<void(uint64_t id, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch)> ReadbackCallback;
+    void SetReadbackCallback(ReadbackCallback callback) { readbackCallback = callback; }
+    // Queue a render of the scene from view and projection, row major like Pipeline::SetCamera
+    void RenderOffscreen(uint64_t id, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+    // Renders still queued or in flight, every one is read back before FinishOffscreen returns
+    size_t GetPendingOffscreen() const;
+    void FinishOffscreen();
+
+    // Pace Draw to the pacer's frame rate and feed it the frame times; on Android the window
+    // buffers follow its render scale and the compositor scales them up. nullptr stops pacing
+    void SetFramePacer(FramePacer* pacer) { framePacer = pacer; }
+    // Add the renderer's metrics to metrics, which outlives it, and update them every frame: CPU and GPU frame
+    // times, offscreen requests queued, bytes uploaded, device local memory and renders read back, and with
+    // M3D_MEMORY_TAGS the RAM of every memory tag. Set before Init
+    void SetMetrics(Metrics& metrics);
+    // Hand every presented frame, or every headless render, to encoder as I420 on a thread of its own, at the size
+    // of the window at Init; frames are dropped rather than waited for when it falls behind. Set before Init
+    void SetFrameCapture(FrameCapture::Encoder encoder, FrameCapture::ColorMatrix matrix = FrameCapture::ColorMatrix::Bt709)
+    {
+        captureEncoder = encoder;
+        captureMatrix = matrix;
+    }
+    // Write the scene at Init and every edit, offscreen render and Draw after it to path, for examples/replay to
+    // play back headless on another build (CommandCapture.hpp). Set before Init
+    void SetCommandCapture(const std::string& path) { commandCapturePath = path; }
+    // Render the scene at the controller's scale of the window and scale it up into the swapchain image, the
+    // render targets stay at the full size and only the render area changes. The controller gets the GPU time
+    // of every frame, timestamps are taken without SetGpuTimer too. Turns occlusion culling off; set before Init,
+    // not headless
+    void SetDynamicResolution(DynamicResolution* controller) { dynamicResolution = controller; }
+
+    struct FrameStats {
+        // the last Draw that submitted a frame, on the CPU, without waiting for the GPU and the swapchain
+        double cpuMs = 0.0;
+        // the frame's command buffers on the GPU, framesInFlight frames behind; 0 without SetGpuTimer or device support
+        double gpuMs = 0.0;
+        // scene draws of the frame, as counted by CommandBuffer::GetDrawCount, their triangles and pipeline binds
+        uint32_t draws = 0;
+        uint32_t triangles = 0;
+        uint32_t pipelineBinds = 0;
+        // copied to the GPU by the upload queue during the Draw
+        uint64_t uploadBytes = 0;
+        // blocked in vkAcquireNextImageKHR because the presentation engine held every image
+        double acquireWaitMs = 0.0;
+        // from the swapchain image being acquired to it being queued for presentation, on the CPU
+        double acquireToPresentMs = 0.0;
+    };
+    const FrameStats& GetFrameStats() const { return frameStats; }
+    // Streams texture mips within the VRAM budget, residency changes land from the per-frame upload poll; valid after Init
+    TextureStreamer* GetTextureStreamer() const { return textureStreamer; }
 
 	void OnWindowSizeChanged() override;
 	void Draw() override;
+
+#if defined(__ANDROID__)
+    // android_native_app_glue lifecycle, called from the thread that draws.
+    // APP_CMD_INIT_WINDOW: the window of the surface, set before Init; a later one recreates the surface and swapchain
+    void SetWindow(ANativeWindow* window);
+    // APP_CMD_TERM_WINDOW: the surface goes away with the window, Draw does nothing until the next SetWindow
+    void OnWindowTerm();
+#endif
+    // Focus lost, Draw does nothing until resumed
+    void SetPaused(bool pause) { paused = pause; }
+    bool IsPaused() const { return paused || surfaceLost; }
 private:
+#if defined(_WIN32)
     void CreateConsole(const char* title);
+#endif
 
     bool CreateInstance();
 
@@ -39,17 +393,72 @@ private:
 
     bool GetDeviceQueue();
 
-    void CreateFences();
+    void CreateFrameContexts();
 
     void CreateSwapChain();
 
+    void CreateGpuTimer();
+
 private:
-    void PrepareFrame();
+    bool PrepareFrame();
     void SubmitFrame();
+    bool PrepareOffscreenFrame();
+    void SubmitOffscreenFrame();
+    void DeliverReadbacks(uint32_t frame);
+    void ResolveProfiler(uint32_t frame);
+    void UpdateCulling();
+    void UpdateLights();
+    void UpdateShadows();
+    // multiview only, the matrices of the SetViews cameras for the next frame
+    void UpdateViews();
+    void UpdateStreaming();
+    // WorldStreamer's release, before the cell's objects leave the scene
+    void ReleaseCell(const MergedIDs& cell);
+    void LoadTextures();
+    // GeometryArena::Upload's onResident: re-record, and drop the CPU geometry Scene::cpuGeometry lets go of
+    void MeshesResident();
+    void UpdateLods();
+    void GetViewerPosition(float eye[3]);
+    void ReadGpuTimer(uint32_t frame);
+    void ApplyRenderScale();
+    void ApplySnapshot(const RenderSnapshot& snapshot);
+    void SubmitInstanceData();
+
+    // averages of the frames DrawLoop drew since its last report
+    struct LoopReport {
+        uint32_t frames = 0;
+        double cpuMs = 0.0;
+        double gpuMs = 0.0;
+        double simulateMs = 0.0;
+        double acquireWaitMs = 0.0;
+        double acquireToPresentMs = 0.0;
+        uint64_t draws = 0;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    };
+    // Draw one frame, print the averages once a second
+    void DrawAndReport(LoopReport& report);
+    // Whether the loops draw the next frame: always unless rendering on demand, then when something changed, is
+    // still landing or changed a few frames ago
+    bool NeedsFrame();
+    // until RequestRedraw or a short timeout, which catches what completes without one
+    void WaitForRedraw();
 
 public:
 
     void DrawLoop();
+    // DrawLoop with the drawing on a thread of its own. simulate fills the snapshot of the next frame on the calling
+    // thread while the previous one draws, until it returns false; a frame then costs the longer of the two instead
+    // of their sum. Every Vulkan call moves to the render thread, the GUI and skinning callbacks run there too
+    void DrawLoopThreaded(std::function<bool(RenderSnapshot&)> simulate);
+    // Draw frames only when something changed, for editor views that sit idle: scene edits, a camera moved by a
+    // snapshot, window input and resizes, commands, models, textures, uploads or shader reloads still landing, or
+    // RequestRedraw. DrawLoop blocks in between and DrawLoopThreaded skips the snapshots; the last presented image
+    // stays on screen. Crowds, particles and skinning animate and keep drawing. Set before the loop
+    void SetRenderOnDemand(bool enable) { renderOnDemand = enable; }
+    // Draw the next frame of an on-demand loop, any thread; for changes the renderer does not see, e.g. of the GUI
+    void RequestRedraw();
+    // Rendering on demand and the last frame found nothing to draw, the window's thread may block on its events
+    bool IsIdle() const { return idle; }
     uint32_t frameCounter;
     float frameTimer;
 
@@ -66,11 +475,12 @@ private:
         vk::Fence fence;
     };
     /* Utils */
-    std::vector<const char*> RendererVulkan::getAvailableWSIExtensions();
+    std::vector<const char*> getAvailableWSIExtensions();
 
     vk::SurfaceKHR createVulkanSurface();
     vk::PipelineShaderStageCreateInfo loadShader(const std::string& fileName, vk::ShaderStageFlagBits stage);
 
+#if defined(_WIN32)
     /* Windows window */
 public:
     void createWin32Window(HINSTANCE hinstance, WNDPROC wndproc, uint32_t width, uint32_t height);
@@ -80,6 +490,13 @@ private:
     HINSTANCE hinstance_;
     HWND hwnd_;
     HMODULE hmodule_;
+#elif defined(__ANDROID__)
+private:
+    ANativeWindow* window = nullptr;
+    // buffer size of the window before the render scale
+    int32_t nativeWidth = 0;
+    int32_t nativeHeight = 0;
+#endif
 
 private:
     vk::Instance instance;
@@ -88,10 +505,175 @@ private:
     vk::Device device;
     vk::Queue queue;
     uint32_t graphicsQueueIndex;
-
-    vk::Semaphore presentComplete;
-    vk::Semaphore renderComplete;
-    std::vector<vk::Fence> waitFences;
+    vk::Queue transferQueue;
+    uint32_t transferQueueIndex;
+    // the graphics queue without a compute only family or SetAsyncCompute
+    vk::Queue computeQueue;
+    uint32_t computeQueueIndex;
+    // the submissions of each queue above, counted; with VK_KHR_timeline_semaphore one semaphore per queue
+    bool timelineSemaphores = false;
+    SubmitTimeline* graphicsTimeline = nullptr;
+    SubmitTimeline* transferTimeline = nullptr;
+    SubmitTimeline* computeTimeline = nullptr;
+
+    /* Frames in flight */
+    struct FrameContext {
+        vk::Semaphore presentComplete;
+        vk::Semaphore renderComplete;
+        // async compute without timeline semaphores: the frame's skinning finished, its draws wait on it
+        vk::Semaphore computeComplete;
+        // transient per-frame allocations, reset once the serial completed
+        vk::CommandPool commandPool;
+        // primary buffer for per-frame recording
+        vk::CommandBuffer drawCommandBuffer;
+        // graphicsTimeline value of the last submission, the ResourceTrash serial too
+        uint64_t serial;
+        // write the frame's two timestamps around the draw commands, recorded once
+        vk::CommandBuffer timerBegin;
+        vk::CommandBuffer timerEnd;
+        // the last submission wrote them
+        bool timed;
+        // GpuProfiler slots the last submission wrote timestamps of, slotCount from firstSlot on
+        uint32_t firstSlot;
+        uint32_t slotCount;
+        // headless: the requests the last submission rendered, into images frame * headlessBatch on
+        std::vector<uint64_t> rendered;
+    };
+    struct OffscreenRequest {
+        uint64_t id;
+        m3d::math::Matrix4x4 view;
+        m3d::math::Matrix4x4 projection;
+    };
+    uint32_t framesInFlight = 2;
+    uint32_t recordThreads = 0;
+    bool useIndirect = false;
+    bool useInstancing = false;
+    bool useGpuCulling = false;
+    bool useOcclusionCulling = false;
+    bool useMeshletCulling = false;
+    bool useMeshletConeCulling = false;
+    bool useGpuSkinning = false;
+    bool useAsyncCompute = false;
+    std::function<void(GpuSkinning&)> skinningCallback;
+    bool useCrowds = false;
+    // the crowds' clips play on the time since Init
+    std::chrono::high_resolution_clock::time_point crowdStart;
+    bool useParticles = false;
+    // the particles advance by the time since the previous frame
+    std::chrono::high_resolution_clock::time_point particleTime;
+    bool usePostProcess = false;
+    // the post stack stores into the swapchain images, it blits an image of its own into them otherwise
+    bool postDirectOutput = false;
+    bool useRayTracing = false;
+    bool useIdBuffer = false;
+    bool useTransparency = false;
+    bool useDeferred = false;
+    bool useShadingRate = false;
+    bool useVertexPulling = false;
+    bool useGui = false;
+    std::function<void(GuiRenderer&)> guiCallback;
+    bool useGpuTimer = false;
+    bool useDepthPrepass = false;
+    vk::SampleCountFlagBits msaaSamples = vk::SampleCountFlagBits::e1;
+    bool useBindless = true;
+    bool useClusteredLighting = false;
+    bool useShadows = false;
+    bool useSoftwareOcclusion = false;
+    bool useGpuGeometryDecode = false;
+    bool useOcclusionQueries = false;
+    uint32_t occlusionMinTriangles = 0;
+    bool useImpostors = false;
+    float impostorDistance = 0.0f;
+    bool useShaderHotReload = false;
+    // of SetViews, drawn at once when the device has multiview
+    std::vector<uint32_t> viewCameras;
+    bool multiview = false;
+    bool headless = false;
+    uint32_t headlessBatch = 1;
+    // VK_KHR_get_physical_device_properties2 on the instance and VK_EXT_memory_budget on the device
+    bool instanceProperties2 = false;
+    bool memoryBudget = false;
+    // every extension and feature of AccelerationStructures on the device
+    bool rayTracing = false;
+    // VK_EXT_conditional_rendering and its feature on the device
+    bool conditionalRendering = false;
+    // VK_NV_shading_rate_image and its feature on the device
+    bool shadingRateImage = false;
+    // VK_KHR_buffer_device_address and its feature on the device, for SetVertexPulling
+    bool vertexPulling = false;
+    uint32_t deviceIndex = 0;
+    bool numaBinding = true;
+    int numaNode = -1;
+    ReadbackCallback readbackCallback;
+    std::deque<OffscreenRequest> offscreenRequests;
+    // two timestamps per frame in flight, null when not timing
+    vk::QueryPool timerQueries;
+    vk::CommandPool timerPool;
+    // nanoseconds per timestamp tick
+    float timestampPeriod = 0.0f;
+    uint64_t timestampMask = 0;
+    FrameStats frameStats;
+    // the upload queue's and the mesh decoder's byte counters at the end of the last Draw
+    uint64_t uploadedBytes = 0;
+    GpuProfiler* profiler = nullptr;
+    // the profiler's ids of the steps of Draw
+    struct {
+        uint32_t wait;
+        uint32_t streaming;
+        uint32_t uploads;
+        uint32_t lods;
+        uint32_t record;
+        uint32_t submit;
+    } cpuScopes;
+    // PrepareFrame blocked on fences and the swapchain for this long
+    double frameWaitMs = 0.0;
+    uint32_t maxQueuedFrames = 0;
+    // when PrepareFrame got the current image
+    std::chrono::high_resolution_clock::time_point acquireTime;
+    FramePacer* framePacer = nullptr;
+    DynamicResolution* dynamicResolution = nullptr;
+    // of SetMetrics, all null without
+    struct FrameMetrics {
+        Metrics::Counter* frames = nullptr;
+        Metrics::Counter* renders = nullptr;
+        Metrics::Counter* uploadBytes = nullptr;
+        Metrics::Histogram* cpuMs = nullptr;
+        Metrics::Histogram* gpuMs = nullptr;
+        Metrics::Gauge* draws = nullptr;
+        Metrics::Gauge* queueDepth = nullptr;
+        Metrics::Gauge* deviceMemoryUsage = nullptr;
+        Metrics::Gauge* deviceMemoryBudget = nullptr;
+        // per memory tag, with M3D_MEMORY_TAGS only
+        Metrics::Gauge* ramLive[memtag::TagCount] = {};
+        Metrics::Gauge* ramPeak[memtag::TagCount] = {};
+        Metrics::Counter* ramAllocations[memtag::TagCount] = {};
+        // the tag's allocations already added to its counter
+        uint64_t ramAllocationsAdded[memtag::TagCount] = {};
+    } metrics;
+    void UpdateMetrics();
+    float renderScale = 1.0f;
+    uint32_t frameIndex = 0;
+    std::vector<FrameContext> frames;
+    // graphicsTimeline value of the frame that last rendered into each swapchain image, 0 for none
+    std::vector<uint64_t> imagesInFlight;
+    // objects retired by a resize, destroyed as the frames using them complete
+    ResourceTrash trash;
+    RenderCommandQueue commands;
+    // WM_SIZE or an out of date swapchain, recreated at the start of the next Draw.
+    // Set by the window's thread, which is not the drawing one with DrawLoopThreaded
+    std::atomic<bool> resizePending{ false };
+    std::atomic<bool> minimized{ false };
+    bool renderOnDemand = false;
+    // frames still drawn after the last change, see NeedsFrame
+    uint32_t settleFrames = 0;
+    // RequestRedraw, or a change seen by the drawing thread itself
+    std::atomic<bool> redrawRequested{ true };
+    std::atomic<bool> idle{ false };
+    std::mutex redrawMutex;
+    std::condition_variable redrawSignal;
+    bool paused = false;
+    // the native window was terminated, no surface to present to
+    bool surfaceLost = false;
 
     bool inited = false;
     uint32_t width, height;
@@ -103,16 +685,70 @@ private:
     uint32_t imageCount;
 
     /* Vertex Data */
-    struct StagingBuffer {
-        vk::DeviceMemory mem;
-        vk::Buffer buf;
-    };
-
-    struct {
-        StagingBuffer vertices;
-        StagingBuffer indices;
-        uint32_t indexCount;
-    } meshBuffer;
+    Scene* scene;
+    GeometryArena* geometry;
+    UploadQueue* uploadQueue;
+    // with SetGpuGeometryDecode
+    GpuMeshDecoder* meshDecoder = nullptr;
+    // device memory of the buffers, render targets and streamed textures
+    MemoryAllocator* memoryAllocator = nullptr;
+    IndirectDraws* indirectDraws = nullptr;
+    GpuCulling* gpuCulling = nullptr;
+    // null without SetClusteredLighting or bindless materials
+    ClusteredLights* clusteredLights = nullptr;
+    // with clusteredLights, a map that is never drawn without SetShadows
+    ShadowCascades* shadowCascades = nullptr;
+    // with clusteredLights, an atlas that is never drawn without SetShadows
+    ShadowAtlas* shadowAtlas = nullptr;
+    SoftwareOcclusion* softwareOcclusion = nullptr;
+    // null without conditional rendering or per-frame recordings
+    OcclusionQueries* occlusionQueries = nullptr;
+    GpuSkinning* gpuSkinning = nullptr;
+    CrowdRenderer* crowds = nullptr;
+    ParticleSystem* particles = nullptr;
+    PostProcess* postProcess = nullptr;
+    // null without shadingRateImage
+    ShadingRate* shadingRate = nullptr;
+    // null without indirect draws, bindless materials or with several views
+    ImpostorRenderer* impostors = nullptr;
+    AccelerationStructures* accelerationStructures = nullptr;
+    // null without the ID buffer
+    IdPicker* idPicker = nullptr;
+    // null without SetFrameCapture
+    FrameCapture* frameCapture = nullptr;
+    FrameCapture::Encoder captureEncoder;
+    FrameCapture::ColorMatrix captureMatrix = FrameCapture::ColorMatrix::Bt709;
+    // null without SetCommandCapture
+    CommandCapture* commandCapture = nullptr;
+    std::string commandCapturePath;
+    GuiRenderer* gui = nullptr;
+    MemoryOverlay* memoryOverlay = nullptr;
+    StatsOverlay* statsOverlay = nullptr;
+    // bindless materials of the indirect pipeline, or its texture array ones, null when the device lacks both
+    MaterialTable* materialTable = nullptr;
+    // packed material textures of a pipeline that uses texture arrays, null otherwise
+    TextureArrays* textureArrays = nullptr;
+    // every graphics pipeline, its cache persists between runs
+    PipelineRegistry* pipelineRegistry = nullptr;
+    // null without SetShaderHotReload
+    ShaderWatcher* shaderWatcher = nullptr;
+    SceneStreamer* sceneStreamer = nullptr;
+    WorldStreamer* worldStreamer = nullptr;
+    JobSystem* jobSystem = nullptr;
+    // CPU side temporaries of each frame in flight
+    FrameArena* frameArena = nullptr;
+    // and its descriptor sets
+    DescriptorAllocator* frameDescriptors = nullptr;
+    TextureStreamer* textureStreamer = nullptr;
+    // samplers of every texture, shared by the ones with the same state
+    SamplerCache* samplerCache = nullptr;
+    // headless stand-ins of the swapchain images, framesInFlight * headlessBatch of them
+    OffscreenTargets* offscreen = nullptr;
+    bool commandBuffersDirty = false;
+    // InitDevice ran
+    bool deviceReady = false;
+    // transforms moved or the scene was edited, IndirectDraws copies what changed at the next Draw
+    bool instancesChanged = false;
 
     struct {
         vk::PipelineVertexInputStateCreateInfo inputState;
@@ -135,7 +771,6 @@ private:
     /* Submit */
     uint32_t currentImage;
     vk::PipelineStageFlags submitPipelineStages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    vk::SubmitInfo submitInfo;
 
     /* Render Pass */
     Pipeline* pipeLine;
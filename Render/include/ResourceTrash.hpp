@@ -0,0 +1,47 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+namespace m3d {
+
+/*
+ * Deferred destruction of Vulkan objects.
+ *
+ * Objects retired while frames are still in flight (old swapchains, frame
+ * buffers, depth buffers after a resize) are queued together with the serial
+ * of the last submitted frame and destroyed once the GPU got past it, instead
+ * of idling the device. The serials are the values of the graphics queue's
+ * SubmitTimeline.
+ */
+class ResourceTrash {
+public:
+    typedef std::function<void()> Destroyer;
+
+    ~ResourceTrash();
+
+    // destroy runs once every frame submitted so far has completed
+    void Trash(Destroyer destroy);
+    // A frame submission with serial, increasing from 1 on
+    void Submitted(uint64_t serial) { submitted = serial; }
+    // The submission with this serial and all before it have completed
+    void Collect(uint64_t completedSerial);
+    // Destroy everything, the device has to be idle
+    void Flush();
+
+private:
+    struct Entry {
+        uint64_t serial;
+        Destroyer destroy;
+    };
+    std::deque<Entry> entries;
+    uint64_t submitted = 0;
+};
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Samplers shared by every texture with the same sampler state.
+ *
+ * Samplers hold no per texture data, the levels a texture samples are limited
+ * by its image view, so textures that filter and address alike use one
+ * sampler instead of creating their own. Devices limit the number of samplers
+ * (maxSamplerAllocationCount), a few thousand on some of them. Samplers are
+ * immutable and live as long as the cache: never destroy one returned by Get,
+ * it can also be used as an immutable sampler of a descriptor set layout.
+ */
+class SamplerCache {
+public:
+    // maxLod of Sampler(), no clamp beyond what the view holds
+    static const float NoLodClamp;
+
+    SamplerCache(vk::Device&);
+    ~SamplerCache();
+
+    // The sampler of info, created the first time it is asked for, any thread. info.pNext must be null
+    vk::Sampler Get(const vk::SamplerCreateInfo& info);
+    // Trilinear with repeat addressing, what textures sample with
+    vk::Sampler Get(vk::Filter filter = vk::Filter::eLinear, vk::SamplerAddressMode addressMode = vk::SamplerAddressMode::eRepeat,
+        float maxAnisotropy = 8.0f);
+    // samplers created so far
+    size_t GetSamplerCount();
+
+    // the state behind the second Get, anisotropy 1 or less disables it
+    static vk::SamplerCreateInfo Sampler(vk::Filter filter, vk::SamplerAddressMode addressMode, float maxAnisotropy);
+
+private:
+    struct Entry {
+        vk::SamplerCreateInfo info;
+        vk::Sampler sampler;
+    };
+
+    vk::Device& device;
+    std::mutex mutex;
+    // by the hash of their state
+    std::unordered_multimap<uint64_t, Entry> samplers;
+};
+}
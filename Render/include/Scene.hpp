@@ -6,13 +6,21 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "Matrix.h"
 #include "Quaternion.h"
 
-#include "packed_freelist.h"
+#include "Bounds.hpp"
+#include "MeshCodec.hpp"
+#include "SkeletalAnimation.hpp"
+
+#include "StringId.hpp"
+#include "TransformStore.hpp"
+#include "VertexFormat.hpp"
+#include "chunked_freelist.h"
 #include "vulkanTextureLoader.hpp"
 
 namespace fbxsdk {
@@ -23,30 +31,90 @@ class FbxMesh;
 }
 
 namespace m3d {
+namespace file {
+    class MappedFile;
+}
+
 struct DiffuseMap {
     vkext::VulkanTexture texture;
+    // image file the FBX references, resolved against the FBX's directory when relative
+    std::string path;
+    // TextureStreamer id once the renderer queued it, 0xFFFFFFFF before
+    uint32_t textureID = 0xFFFFFFFF;
 };
 
 struct Light {
-    bool init(fbxsdk::FbxLight* fbxLight) { return true; }
+    enum Type : uint32_t {
+        Point,
+        Spot,
+        Directional
+    };
+
+    // type, color, intensity, range and cone of the FBX light; false for area and volume lights
+    bool init(fbxsdk::FbxLight* fbxLight);
+
+    Type type = Point;
+    // linear, intensity is applied on top
+    float color[3] = { 1.0f, 1.0f, 1.0f };
+    float intensity = 1.0f;
+    // world units, point and spot lights fall off to nothing there
+    float range = 16.0f;
+    // half angles in radians of the full and the falling off part of a spot light's cone
+    float innerCone = 0.0f;
+    float outerCone = 0.7853982f;
+    // world placement of the light's node, spot and directional lights shine down its -Y axis
+    uint32_t transformId = 0;
 };
 
 struct Material {
-    bool init(fbxsdk::FbxSurfaceMaterial* fbxMaterial)
-    {
-        // TODO
-        return true;
-    }
-    std::string name;
+    // how the slices of the material are composited
+    enum class Blend : uint8_t {
+        // depth tested and written, drawn with the rest of the scene
+        Opaque,
+        // weighted blended order-independent transparency where Pipeline::Options::weightedBlended is on, opaque otherwise;
+        // no sorting, the slices are not depth written
+        WeightedBlended
+    };
+
+    // name, colors times their factors, shininess and opacity of a Lambert or Phong material, the loader resolves diffuseMapId.
+    // Materials that are not fully opaque blend WeightedBlended
+    bool init(fbxsdk::FbxSurfaceMaterial* fbxMaterial);
+    StringId name;
     float ambient[3];
     float diffuse[3];
     float specular[3];
     float shininess;
+    // of Scene::diffuseMaps, 0xFFFFFFFF untextured
     uint32_t diffuseMapId;
+    // coverage of the diffuse color, one minus the FBX transparency factor
+    float opacity = 1.0f;
+    Blend blend = Blend::Opaque;
 };
 
+// Interleaved GPU vertex, 20 bytes instead of the 36 of separate float streams
+struct PackedVertex {
+    float position[3];
+    // octahedral encoded unit normal, R16G16_SNORM
+    int16_t normal[2];
+    // R16G16_SFLOAT
+    uint16_t uv[2];
+};
+typedef VertexFormat<PackedVertex,
+    VertexAttribute<VertexSemantic::Position, vk::Format::eR32G32B32Sfloat, offsetof(PackedVertex, position)>,
+    VertexAttribute<VertexSemantic::Normal, vk::Format::eR16G16Snorm, offsetof(PackedVertex, normal)>,
+    VertexAttribute<VertexSemantic::UV, vk::Format::eR16G16Sfloat, offsetof(PackedVertex, uv)>>
+    PackedVertexFormat;
+
 struct Mesh {
+    static const uint32_t InvalidBlock = 0xFFFFFFFF;
+    // meshes with at most this many vertices have 16 bit indices on the GPU and in cooked files
+    static const size_t MaxShortIndexVertices = 65536;
+
     bool init(fbxsdk::FbxMesh* fbxMesh);
+    // weld, bound, simplify and pack once vertices, normals, uvs, indices and slices are filled, init ends with it
+    void build();
+    // build packedVertices from vertices, normals and uvs, init calls it while they are filled
+    void pack();
 
     struct Slice {
         Slice(int offset, int count)
@@ -56,25 +124,149 @@ struct Mesh {
         }
         int indexOffset;
         int triangleCount;
+        // object space, of the vertices this slice references
+        Aabb bounds;
     };
 
-    std::string name;
+    // Coarser version of slices, same slice count with index ranges further down the same index buffer
+    struct Lod {
+        std::vector<Slice> slices;
+        // object space distance the simplified surface may be off by
+        float error;
+    };
+
+    // of the FBX node, or of the cooked mesh
+    StringId name;
 
+    // LOD 0, at full resolution
     std::vector<Slice> slices;
+    // LOD 1 and up, coarsest last
+    std::vector<Lod> lods;
+
+    // Run of at most MeshletVertices vertices and MeshletTriangles triangles of a LOD 0 slice, with its
+    // object space bounding sphere and the cone its triangle normals fit in. A coneCutoff of 1 never culls.
+    struct Meshlet {
+        uint32_t slice;
+        int indexOffset;
+        int triangleCount;
+        float sphere[4];
+        float coneAxis[3];
+        float coneCutoff;
+    };
+    static const uint32_t MeshletVertices = 64;
+    static const uint32_t MeshletTriangles = 124;
+
+    // LOD 0 meshlets, slice after slice in index order, covering every triangle of the slices
+    std::vector<Meshlet> meshlets;
+
+    // An FBX blend shape channel at full weight, sparse: morphDeltas[firstDelta, firstDelta + deltaCount) in vertex order
+    struct MorphTarget {
+        std::string name;
+        uint32_t firstDelta;
+        uint32_t deltaCount;
+    };
+    std::vector<MorphTarget> morphTargets;
+    // of every target, one after the other
+    std::vector<animation::MorphDelta> morphDeltas;
+
+    uint32_t LodCount() const { return static_cast<uint32_t>(lods.size()) + 1; }
+    const std::vector<Slice>& LodSlices(uint32_t lod) const { return lod == 0 ? slices : lods[lod - 1].slices; }
+    // Coarsest LOD whose error, at pixelsPerUnit pixels per object space unit, stays below maxPixelError
+    uint32_t SelectLod(float pixelsPerUnit, float maxPixelError = 1.0f) const;
 
+    // float streams of the import, empty once init returned
     std::vector<float> vertices;
     std::vector<float> uvs;
     std::vector<float> normals;
     std::vector<uint32_t> indices;
+    // meshes with blend shapes: per vertex the control point and the import vertex (corner, or control point when
+    // every attribute maps by control point) it was read from. Welding keeps control points apart, the optimizer
+    // permutes both with the float streams
+    std::vector<uint32_t> controlPoints;
+    std::vector<uint32_t> importVertices;
+    // what GeometryArena uploads, one per vertex
+    std::vector<PackedVertex> packedVertices;
+    // meshes of a cooked scene point into the mapped file instead of filling packedVertices and indices
+    const PackedVertex* mappedVertices = nullptr;
+    const uint32_t* mappedIndices = nullptr;
+    // instead of mappedIndices when the cooked mesh has 16 bit indices
+    const uint16_t* mappedShortIndices = nullptr;
+    uint32_t mappedVertexCount = 0;
+    uint32_t mappedIndexCount = 0;
+
+    // What of packedVertices and indices stays on the CPU once the mesh is resident, Scene::ReleaseGeometry drops the
+    // rest. Bounds, slices, LODs and meshlets always stay, mapped geometry is the file's and never released
+    enum class CpuGeometry {
+        // Scene::cpuGeometry
+        Default,
+        Keep,
+        // a MeshCodec copy RestoreGeometry decodes
+        Compressed,
+        // nothing, a cooked mesh with compressed geometry decodes it from its file again
+        Release
+    };
+    CpuGeometry cpuGeometry = CpuGeometry::Default;
+    // MeshCodec streams RestoreGeometry decodes: encodedGeometry, or the cooked file's of a mesh loaded compressed
+    std::vector<uint8_t> encodedGeometry;
+    const uint8_t* mappedEncodedVertices = nullptr;
+    const uint8_t* mappedEncodedIndices = nullptr;
+    uint32_t mappedEncodedVertexBytes = 0;
+    uint32_t mappedEncodedIndexBytes = 0;
+    std::vector<CodecChunk> vertexChunks;
+    std::vector<CodecChunk> indexChunks;
+    // packedVertices and indices were dropped, vertexCount and indexCount still tell their sizes
+    bool geometryReleased = false;
+    uint32_t releasedVertexCount = 0;
+    uint32_t releasedIndexCount = 0;
+
+    // vertexData and the indices can be read, false once released until RestoreGeometry
+    bool HasGeometry() const { return !geometryReleased; }
+    // Drop packedVertices and indices as policy says, the bytes freed
+    size_t ReleaseGeometry(CpuGeometry policy);
+    // Decode released geometry again, false when nothing was kept to decode it from
+    bool RestoreGeometry();
+
+    const PackedVertex* vertexData() const { return mappedVertices ? mappedVertices : packedVertices.data(); }
+    size_t vertexCount() const { return mappedVertices ? mappedVertexCount : geometryReleased ? releasedVertexCount : packedVertices.size(); }
+    // null for a cooked mesh with 16 bit indices, they are in shortIndexData then
+    const uint32_t* indexData() const { return mappedIndices ? mappedIndices : mappedShortIndices ? nullptr : indices.data(); }
+    const uint16_t* shortIndexData() const { return mappedShortIndices; }
+    size_t indexCount() const { return mappedIndices || mappedShortIndices ? mappedIndexCount : geometryReleased ? releasedIndexCount : indices.size(); }
+    // what the GPU index buffer holds, 32 bit indices are narrowed on upload when the vertices allow it
+    vk::IndexType indexType() const { return vertexCount() <= MaxShortIndexVertices ? vk::IndexType::eUint16 : vk::IndexType::eUint32; }
+    // index i as 32 bit, whichever width it is stored with
+    uint32_t index(size_t i) const { return mappedShortIndices ? mappedShortIndices[i] : indexData()[i]; }
 
     std::vector<vk::CommandBuffer> drawCommands;
     std::vector<uint32_t> materialIds;
+
+    // placement inside the GeometryArena, filled on upload
+    uint32_t geometryBlock = InvalidBlock;
+    int32_t vertexOffset = 0;
+    uint32_t firstIndex = 0;
+    // set once the upload finished on the GPU
+    bool resident = false;
+
+    // object space bounding sphere: center xyz, radius
+    float boundingSphere[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    // object space box, the union of the slice boxes
+    Aabb bounds;
 };
 
 struct Transform {
     m3d::math::Vector3 position;
     m3d::math::Vector3 scale;
     m3d::math::Quaternion rotation;
+
+    // world matrix T * R * S (column vector convention, same as Matrix4x4::Translation)
+    m3d::math::Matrix4x4 ToMatrix() const;
+};
+
+// One FBX animation stack, track i of clip drives the local transform of transformIds[i]
+struct Animation {
+    std::string name;
+    animation::AnimationClip clip;
+    std::vector<uint32_t> transformIds;
 };
 
 struct Instance {
@@ -91,26 +283,140 @@ struct Camera {
     float fovY;
     float aspect;
     float nearZ;
+    float farZ;
+
+    // pixels covered by one unit at distance one, fovY in degrees like Matrix4x4::Perspective
+    float PixelScale(uint32_t viewportHeight) const;
 };
 
 class Scene {
 public:
     std::string loadPath;
 
-    packed_freelist<DiffuseMap> diffuseMaps;
-    packed_freelist<Material> materials;
-    packed_freelist<Mesh> meshes;
-    packed_freelist<Transform> transforms;
-    packed_freelist<Instance> instances;
-    packed_freelist<Camera> cameras;
+    // grow as needed, loaders may insert from several threads at once
+    chunked_freelist<DiffuseMap> diffuseMaps;
+    chunked_freelist<Material> materials;
+    chunked_freelist<Mesh> meshes;
+    chunked_freelist<Transform> transforms;
+    chunked_freelist<Instance> instances;
+    chunked_freelist<Camera> cameras;
+    chunked_freelist<Light> lights;
+    // only the FBX nodes an animation stack moves have tracks
+    std::vector<Animation> animations;
+    // world matrices of transforms, kept in sync by AddTransform / SetTransform
+    TransformStore transformStore;
+    // of FindMesh / FindMaterial
+    NameIndex<chunked_freelist<Mesh>> meshNames;
+    NameIndex<chunked_freelist<Material>> materialNames;
+
+    static const uint32_t InvalidCameraID = 0xFFFFFFFF;
+    uint32_t mainCameraID = InvalidCameraID;
 
-    uint32_t mainCameraID;
+    // policy of the meshes with Mesh::CpuGeometry::Default
+    Mesh::CpuGeometry cpuGeometry = Mesh::CpuGeometry::Keep;
+    // LoadMeshes leaves compressed cooked geometry encoded, the meshes released: a GeometryArena with a GpuMeshDecoder
+    // uploads it as it is and decodes it on the GPU, whoever reads vertices calls Mesh::RestoreGeometry
+    bool gpuGeometryDecode = false;
+
+    // cooked scene of loadPath, mapped by Init when present; meshes loaded from it reference its memory
+    std::shared_ptr<const file::MappedFile> cooked;
+    // cooked files of the models a SceneStreamer merged in, same as cooked
+    std::vector<std::shared_ptr<const file::MappedFile>> mappedModels;
+    // where each of mappedModels was mapped from, same order
+    std::vector<std::string> mappedModelPaths;
 
     Scene();
+    // Empty scene, filled by LoadMeshes / AddInstance or a SceneStreamer
     void Init();
+    void Init(const std::string& fbxPath, bool useCooked = true);
+    // Empty scene of a cooked scene read some other way, e.g. by file::AsyncReader; path is what it was cooked
+    // from. False, and the scene stays empty of it, when the file is not a cooked scene of this version
+    bool Init(std::shared_ptr<const file::MappedFile> cookedFile, const std::string& path);
+
+    uint32_t AddTransform(const Transform& transform);
+    // only the changed transform's group is recomputed by the next transformStore.Update()
+    void SetTransform(uint32_t transformID, const Transform& transform);
+    // SetTransform of count matrices at once, as physics or animation hand them back; decomposed to TRS in one batch
+    void SetTransforms(const uint32_t* transformIDs, const m3d::math::Matrix4x4* matrices, size_t count);
+    // transformID becomes local to parentID, TransformStore::NoParent detaches it
+    void SetParent(uint32_t transformID, uint32_t parentID);
+    // no instance, light or child transform may still refer to it
+    void RemoveTransform(uint32_t transformID);
+
+    // Edits of a scene being drawn. A renderer built from it learns of them through its methods of the same
+    // names, which call these and update only what they touch
+    uint32_t AddInstance(uint32_t meshID, const Transform& transform);
+    // its transform stays, children or other instances may hang off it
+    void RemoveInstance(uint32_t instanceID);
+    void SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID);
+
+    // First mesh or material of that name in iteration order, 0xFFFFFFFF when there is none. A hash lookup, the
+    // index behind it is rebuilt on the first call after meshes or materials had objects inserted or erased
+    uint32_t FindMesh(StringId name);
+    uint32_t FindMaterial(StringId name);
+
+    // Drop the CPU geometry of every resident mesh per its policy, the bytes freed. Once the GPU holds it the
+    // renderer only needs the bounds and slices; whoever reads vertices later calls Mesh::RestoreGeometry
+    size_t ReleaseGeometry();
 };
 
-void LoadMeshes(Scene* scene, std::vector<uint32_t>* loadedMeshIDs);
+// Where fbxconv writes the cooked version of an FBX file
+std::string CookedPath(const std::string& fbxPath);
+// SCookedScene::version this build writes and maps, cooked scenes of others are imported again
+uint32_t CookedSceneVersion();
+// Write meshes, materials, transforms, instances and animations in the data/schema/cooked.fbs format.
+// compressGeometry stores vertices and indices with the MeshCodec instead of as they are uploaded
+bool CookScene(const Scene& scene, const std::string& path, bool compressGeometry = true);
+
+// What a MergeScene created in the target scene, by kind
+struct MergedIDs {
+    std::vector<uint32_t> diffuseMaps;
+    std::vector<uint32_t> materials;
+    std::vector<uint32_t> meshes;
+    std::vector<uint32_t> transforms;
+    std::vector<uint32_t> instances;
+};
+// Move the meshes meshIDs of source, its diffuse maps, materials, transforms and instances into target, with their
+// ids remapped. Root transforms of source become children of parentID, TransformStore::NoParent keeps them roots.
+// A source without instances gets one per mesh at parentID, none when that is NoParent. Cooked meshes keep
+// pointing into source.cooked, which target.mappedModels holds on to. merged, when given, gets the new ids
+void MergeScene(Scene& source, const std::vector<uint32_t>& meshIDs, Scene& target, uint32_t parentID, MergedIDs* merged = nullptr);
+
+// Where a LoadMeshes spent its time, in milliseconds
+struct LoadStats {
+    // FBX: reading the file, converting its axes and units
+    double importMs = 0.0;
+    double triangulateMs = 0.0;
+    // Mesh::init of every mesh summed over the converting threads, dedupMs of it welding and reordering in OptimizeMesh
+    double meshInitMs = 0.0;
+    double dedupMs = 0.0;
+    // wall clock of converting all meshes
+    double convertMs = 0.0;
+    // transforms, instances and animations
+    double hierarchyMs = 0.0;
+    // a cooked scene instead: meshes, materials and instances out of the mapping
+    double cookedMs = 0.0;
+    // of cookedMs, decoding compressed geometry
+    double decodeMs = 0.0;
+};
+
+// From the cooked scene when Init mapped one, which also restores its transforms, instances and diffuse map paths.
+// Its compressed geometry is decoded on threadCount threads, unless Scene::gpuGeometryDecode. Otherwise meshes are imported from FBX and converted
+// on threadCount threads, 0 uses one per hardware thread, every FBX node gets a transform parented like the node and every mesh node an instance. stats, when given,
+// gets the time of every step
+void LoadMeshes(Scene* scene, std::vector<uint32_t>* loadedMeshIDs, uint32_t threadCount = 0, LoadStats* stats = nullptr);
+
+// The live state of scene in a flatbuffer (data/schema/snapshot.fbs), for getting an editing session back without
+// importing again: meshes as references into the cooked scenes they are mapped from, with their slice materials,
+// and materials, diffuse maps, transforms, instances, lights and cameras as they are now. Meshes of no cooked scene
+// are cooked uncompressed into a file of their own next to path, which the snapshot references the same way.
+// Animations are not kept. False when a file could not be written
+bool SaveSnapshot(const Scene& scene, const std::string& path);
+// scene as SaveSnapshot found it, with the cooked scenes mapped and held in mappedModels and their compressed
+// geometry decoded on threadCount threads, 0 one per hardware thread. Ids are handed out in the saved order, ids
+// left unused by removals are not kept. False, with an empty scene, when the snapshot or one of its cooked scenes
+// can not be read
+bool LoadSnapshot(Scene& scene, const std::string& path, uint32_t threadCount = 0, LoadStats* stats = nullptr);
 
 void AddInstance(Scene& scene, uint32_t meshID, uint32_t* newInstanceID);
 } // End of namspace m3d
@@ -0,0 +1,40 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace m3d {
+
+/*
+ * The JSON form of a scene manifest (data/schema/scene.fbs) straight into an
+ * SScene buffer, without the flatbuffers parser and its schema.
+ *
+ * Generated manifests list hundreds of thousands of models. The general parser
+ * tokenizes a char at a time and builds every value through its reflection
+ * tables; this one knows the three tables and structs of the schema. It skips
+ * whitespace and finds the end of strings 16 bytes at a time (SSE2 or NEON),
+ * converts eight digits at a time with integer arithmetic, copies names
+ * without escapes straight from the text and builds into a builder sized up
+ * front.
+ *
+ * The accepted text is what flatc accepts for the schema: quoted or bare field
+ * names, trailing commas, // and C comments. Every struct field has to be there
+ * and unknown fields are errors, as flatc reports them.
+ */
+
+// Initial size of the builder for a manifest of jsonLength bytes. A model with a transform takes less than
+// half of its text, manifests of mostly empty models still make the builder grow
+size_t SceneManifestBufferSize(size_t jsonLength);
+
+// Finishes builder with the SScene of json, false with "line n: what" in error when it does not parse.
+// The builder is left unfinished then
+bool ParseSceneManifest(const char* json, size_t length, flatbuffers::FlatBufferBuilder& builder, std::string* error = nullptr);
+}
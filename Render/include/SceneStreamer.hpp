@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+#include "Scene.hpp"
+
+namespace m3d {
+class ThreadPool;
+
+/*
+ * Loads every SModel of a scene manifest (data/schema/scene.fbs) into one Scene.
+ *
+ * Models are imported on worker threads into scenes of their own, nearest to
+ * the viewer first. Poll() moves the finished ones into the target scene on the
+ * calling thread, placing their instances with the model's STransform, so
+ * rendering can start with an empty scene and pick models up as they arrive.
+ */
+class SceneStreamer {
+public:
+    static const char* DefaultManifestPath;
+
+    // threadCount models are imported at the same time, each import converts its meshes on its own threads
+    explicit SceneStreamer(uint32_t threadCount = 1);
+    ~SceneStreamer();
+
+    SceneStreamer(const SceneStreamer&) = delete;
+    SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+    // Read the manifest and queue all of its models, false if it could not be read. A .json one is parsed
+    // with ParseSceneManifest, anything else is mapped as the binary form.
+    bool Open(const std::string& manifestPath);
+    // Models still queued are picked by distance to this position.
+    void SetViewer(const m3d::math::Vector3& position);
+    // Merge the models that finished loading, true when the scene got new meshes.
+    bool Poll(Scene& scene);
+    // Block until every queued model has loaded, Poll still has to merge them.
+    void Wait();
+
+    uint32_t GetModelCount() const { return static_cast<uint32_t>(models.size()); }
+    uint32_t GetMergedCount() const { return mergedCount; }
+    bool Done() const { return mergedCount + failedCount == models.size(); }
+
+private:
+    struct Model {
+        std::string path;
+        Transform transform;
+        bool started = false;
+    };
+    struct Loaded {
+        uint32_t model;
+        std::unique_ptr<Scene> scene;
+        std::vector<uint32_t> meshIDs;
+    };
+
+    void loadNext();
+    void merge(Loaded& loaded, Scene& scene);
+
+private:
+    std::unique_ptr<ThreadPool> threads;
+    std::vector<Model> models;
+    m3d::math::Vector3 viewer;
+    // models, viewer and loaded are shared with the workers
+    std::mutex mutex;
+    std::vector<Loaded> loaded;
+    uint32_t mergedCount = 0;
+    uint32_t failedCount = 0;
+};
+}
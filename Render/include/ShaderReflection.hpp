@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * The resource interface of SPIR-V shaders, read from the modules instead of
+ * written down next to them: descriptor bindings, the push constant block and
+ * the vertex inputs.
+ *
+ * Reflect one module per stage and Merge them into the interface of a
+ * pipeline, or of a family of pipelines sharing one layout. The descriptor
+ * set and pipeline layouts then come from PipelineRegistry, which hands
+ * identical layouts out once.
+ *
+ * What SPIR-V can not tell is left to the caller: whether a uniform or storage
+ * buffer takes a dynamic offset (SetDynamic) and how the vertex buffers store
+ * the inputs, SelectVertexAttributes picks those of a stream.
+ */
+struct ShaderLayout {
+    struct Binding {
+        uint32_t set;
+        uint32_t binding;
+        vk::DescriptorType type;
+        // array size, 1 for a single descriptor
+        uint32_t count;
+        vk::ShaderStageFlags stages;
+    };
+    // vertex stage inputs, builtins are not listed
+    struct Input {
+        uint32_t location;
+        // of the shader variable, e.g. R32G32Sfloat for a vec2
+        vk::Format format;
+    };
+
+    vk::ShaderStageFlags stages;
+    // by set, then binding
+    std::vector<Binding> bindings;
+    // by location
+    std::vector<Input> inputs;
+    // one block from offset 0, no push constants with size 0
+    uint32_t pushConstantSize = 0;
+    vk::ShaderStageFlags pushConstantStages;
+
+    // Add the interface of other stages. false with error when the two declare a binding or an input of a
+    // different type, this one is left partially merged then
+    bool Merge(const ShaderLayout& other, std::string* error = nullptr);
+    // turn the uniform or storage buffer at set, binding into its dynamic kind, false when there is none
+    bool SetDynamic(uint32_t set, uint32_t binding);
+
+    // highest set used plus one
+    uint32_t GetSetCount() const;
+    std::vector<vk::DescriptorSetLayoutBinding> GetSetBindings(uint32_t set) const;
+    std::vector<vk::PushConstantRange> GetPushConstantRanges() const;
+    // descriptors of each type in set, for sizing a pool
+    std::vector<vk::DescriptorPoolSize> GetPoolSizes(uint32_t set) const;
+};
+
+// false with error when words is not a SPIR-V module of a single entry point or uses an unsupported resource
+bool ReflectSpirv(const uint32_t* words, size_t wordCount, ShaderLayout& layout, std::string* error = nullptr);
+// the memory mapped module at path
+bool ReflectSpirv(const std::string& path, ShaderLayout& layout, std::string* error = nullptr);
+
+// The attributes of stream the vertex inputs of layout read, in location order. false with error when the
+// stream lacks one or feeds integers to a float input or floats to an integer one
+bool SelectVertexAttributes(const ShaderLayout& layout, const vk::VertexInputAttributeDescription* stream, size_t streamCount,
+    std::vector<vk::VertexInputAttributeDescription>& attributes, std::string* error = nullptr);
+}
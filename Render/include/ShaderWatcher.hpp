@@ -0,0 +1,66 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace m3d {
+class PipelineRegistry;
+
+/*
+ * Shader hot reload for development builds.
+ *
+ * A background thread polls the GLSL sources of every SPIR-V file the
+ * registry loaded, data/shaders/camera/triangle.vert for triangle.vert.spv.
+ * When one changes it is compiled with glslang on that thread, the .spv is
+ * written next to it for the next run and PipelineRegistry::ReloadShader
+ * rebuilds the pipelines using it, still off the render thread. The renderer
+ * swaps them in at its next frame boundary. A source that does not compile
+ * prints glslang's log and the running shader stays.
+ *
+ * The stage follows the extension of the source: .vert, .frag, .comp, .geom,
+ * .tesc or .tese. Shaders without their source next to them are not watched.
+ */
+class ShaderWatcher {
+public:
+    ShaderWatcher(PipelineRegistry& registry, uint32_t intervalMs = 250);
+    ~ShaderWatcher();
+
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    // shaders compiled and handed to the registry so far
+    uint32_t GetReloadCount() const { return reloads; }
+
+private:
+    struct Source {
+        int64_t modified = 0;
+        int64_t size = 0;
+    };
+
+    void run();
+    void poll();
+    bool compile(const std::string& spvPath, const std::string& sourcePath);
+
+    PipelineRegistry& registry;
+    uint32_t intervalMs;
+    // last seen state of each source, watcher thread only
+    std::map<std::string, Source> sources;
+    std::atomic<uint32_t> reloads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+};
+}
@@ -0,0 +1,149 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+
+namespace m3d {
+class CommandBuffer;
+class ResourceTrash;
+
+/*
+ * Variable rate shading of the scene pipelines with VK_NV_shading_rate_image:
+ * a texel of the shading rate image covers GetTexelSize pixels of the render
+ * targets and picks the entry of a fixed palette its fragments are shaded at,
+ * from once per pixel down to once per 4 x 4 pixels. Coverage, depth and the
+ * attachments stay per sample, only the fragment shader runs less often.
+ *
+ * Before the render pass Record fills the image with one compute dispatch,
+ * shading_rate.comp, an invocation per texel. A texel's rate is the coarser of
+ *   contrast   where the previous frame's scene color, sampled across the
+ *              texel, varies by less than Settings::contrastThreshold, 2 x 1
+ *              and below half of it 2 x 2; flat and dark regions hide it
+ *   foveation  full rate within innerRadius of center, coarsening to 4 x 4
+ *              at outerRadius, for head mounted displays whose lenses blur
+ *              the periphery anyway
+ * The contrast needs a scene color the post stack samples, see SetTargets;
+ * without one shading_rate_foveated.comp applies the foveation only. The
+ * previous frame stands in for this one, what moved fast is shaded at the
+ * rate of what was there.
+ *
+ * With multiview every view reads the one layer, the pattern is the same for
+ * each eye. Dynamic resolution moves center with the part the scene covers.
+ * Pipelines opt in through PipelineDesc::shadingRateImage, the others shade
+ * every pixel.
+ */
+class ShadingRate {
+public:
+    // shading_rate.comp's workgroup is GroupSize square, one invocation per texel of the image
+    static const uint32_t GroupSize = 8;
+    // the palette's entries, 1 x 1, 2 x 1, 2 x 2, 4 x 2 and 4 x 4 pixels per fragment; the image holds indices into it
+    static const uint32_t PaletteSize = 5;
+    static const vk::Format Format = vk::Format::eR8Uint;
+    static const char* const ExtensionName;
+
+    struct Settings {
+        // coarser where the luminance across a texel varies by less than it, relative to the texel's brightest;
+        // 0 for never
+        float contrastThreshold = 0.08f;
+        // foveation around center, in the part of the targets the scene covers; the radii are relative to half its
+        // height
+        bool foveated = false;
+        float center[2] = { 0.5f, 0.5f };
+        float innerRadius = 0.6f;
+        float outerRadius = 1.4f;
+    };
+
+    // the device has the extension, the shadingRateImage feature and room for the palette; the instance needs
+    // VK_KHR_get_physical_device_properties2
+    static bool IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+    // pNext of the vk::DeviceCreateInfo, enables the feature; next is chained behind it
+    static const void* GetFeatureChain(const void* next = nullptr);
+    // pNext of a pipeline's viewport state, the palette of one viewport. Immutable, any thread
+    static const void* GetViewportState();
+
+    // slotCount like Pipeline's frame slots; the device was created with GetFeatureChain
+    ShadingRate(vk::Instance instance, vk::Device&, vk::PhysicalDevice&, CommandBuffer& commandBuffer, uint32_t slotCount);
+    ~ShadingRate();
+
+    // from the next BeginFrame on
+    void SetSettings(const Settings& settings) { this->settings = settings; }
+    const Settings& GetSettings() const { return settings; }
+    // Start filling slot, no submitted frame may still read it
+    void BeginFrame(uint32_t slot);
+
+    // pixels of the render targets per texel of the image
+    vk::Extent2D GetTexelSize() const { return texelSize; }
+    // The render targets' extent, (re)creates the image. sceneImage and sceneView are the single layer scene color
+    // the render pass leaves in SHADER_READ_ONLY_OPTIMAL, null for foveation only. Called whenever CommandBuffer
+    // creates its targets, with trash the previous ones are released once the frames using them completed
+    void SetTargets(vk::Image sceneImage, vk::ImageView sceneView, vk::Extent2D extent, ResourceTrash* trash = nullptr);
+    // Before the render pass: the rates of the frame in slot, the scene covers renderExtent of the targets
+    void Record(vk::CommandBuffer cmd, uint32_t slot, vk::Extent2D renderExtent) const;
+    // the image for the draws recorded into cmd after it, in or outside the render pass; secondaries bind it again
+    void Bind(vk::CommandBuffer cmd) const;
+
+private:
+    // std140 layout of the settings block, a dynamic uniform buffer of a stride per slot
+    struct GpuSettings {
+        float center[2];
+        float innerRadius;
+        float outerRadius;
+        float contrastThreshold;
+        float pad[3];
+    };
+
+    // push constants, fixed when recorded
+    struct Constants {
+        uint32_t imageSize[2];
+        uint32_t texelSize[2];
+        // the part of the targets the scene covers and a pixel of the scene color in texture coordinates
+        uint32_t renderSize[2];
+        float sceneTexel[2];
+    };
+
+    void loadEntryPoints();
+    void createPipelines();
+    vk::Pipeline createPipeline(const char* shader, const char* name);
+    // destroy now or, with trash, once the frames using them completed
+    void destroyTargets(ResourceTrash* trash);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    CommandBuffer& commandBuffer;
+    Settings settings;
+    vk::Extent2D texelSize;
+
+    // slotCount GpuSettings, settingsStride apart
+    vk::Buffer settingsBuffer;
+    MemoryAllocator::Allocation settingsMemory;
+    uint32_t settingsStride;
+
+    // of the render targets and of the image, which stays in SHADING_RATE_OPTIMAL between frames
+    vk::Extent2D extent;
+    vk::Extent2D imageSize;
+    vk::Image image;
+    MemoryAllocator::Allocation imageMemory;
+    vk::ImageView view;
+    bool contrast = false;
+
+    vk::Sampler sampler;
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline contrastPipeline;
+    vk::Pipeline foveatedPipeline;
+    // one per target set, retired with it
+    vk::DescriptorPool descriptorPool;
+    vk::DescriptorSet set;
+
+    PFN_vkVoidFunction cmdBindShadingRateImage = nullptr;
+};
+}
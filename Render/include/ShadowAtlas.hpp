@@ -0,0 +1,203 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "InstanceBvh.hpp"
+#include "Matrix.h"
+
+namespace m3d {
+class GeometryArena;
+class PipelineRegistry;
+class Scene;
+class SubmitTimeline;
+
+/*
+ * Shadow maps of the point and spot lights, tiles of one depth atlas.
+ *
+ * Every Update sizes the lights in view by their screen coverage, the share
+ * of the screen height their range sphere spans: a power of two tile between
+ * MinTileSize and MaxTileSize, a spot light one perspective tile of its cone,
+ * a point light six of half the size, one per cube face. The MaxShadowedLights
+ * largest get tiles, from a quadtree of MaxTileSize squares where a freed tile
+ * merges with its siblings again; a light that does not fit takes smaller
+ * tiles, or stays unshadowed.
+ *
+ * A tile keeps what was drawn into it, lights are drawn again only when:
+ *   - they moved, turned, changed range or cone or got another tile,
+ *   - casters inside their range moved (CastersMoved); lights below
+ *     NearCoverage at most every RefreshInterval frames then,
+ *   - the static geometry changed (Invalidate).
+ * The faces drawn per Update stay within TexelBudget, largest lights first
+ * and the longest waiting ones among equals; the rest wait for the next.
+ * A light keeps shading with its last drawing meanwhile, one that has none
+ * yet is unshadowed. Casters are the Scene::instances an InstanceBvh finds in
+ * a face's frustum, as for ShadowCascades; skinned instances cast no shadows.
+ *
+ * The lit shaders look a light up by its index among the point and spot
+ * lights, in the order ClusteredLights lists them after the directional ones:
+ *   binding 9  : first face of every light, NoShadow when unshadowed, then the
+ *                faces' world to tile matrix and place in the atlas (GetTableDescriptor)
+ *   binding 10 : the atlas with a comparing sampler (GetDescriptor)
+ * The table is copied and the tiles drawn in one submission ahead of the frame.
+ */
+class ShadowAtlas {
+public:
+    static const uint32_t Resolution = 4096;
+    static const uint32_t MaxTileSize = 1024;
+    static const uint32_t MinTileSize = 64;
+    static const uint32_t MaxShadowedLights = 32;
+    // a point light's, its cube faces
+    static const uint32_t MaxFacesPerLight = 6;
+    static const uint32_t MaxFaces = MaxShadowedLights * MaxFacesPerLight;
+    // of the table, ClusteredLights::MaxLights
+    static const uint32_t MaxLocalLights = 1024;
+    static const uint32_t NoShadow = 0xFFFFFFFF;
+    // of the atlas drawn per Update at most, two of the largest tiles; the first face goes ahead regardless
+    static const uint32_t TexelBudget = 2 * MaxTileSize * MaxTileSize;
+    static const uint32_t RefreshInterval = 8;
+    static const float NearCoverage;
+
+    // resolution 1 keeps an atlas that is never drawn and a table without shadows, for lit shaders that
+    // sample them regardless. Tiles are drawn on the timeline's queue, of queueFamilyIndex
+    ShadowAtlas(vk::Device&, vk::PhysicalDevice&, PipelineRegistry&, SubmitTimeline& timeline, uint32_t queueFamilyIndex,
+        uint32_t resolution = Resolution);
+    ~ShadowAtlas();
+
+    // Instances were added or removed or meshes turned resident, every tile is drawn again
+    void Invalidate() { staticDirty = true; }
+    // The transform slots IndirectDraws::UploadChanges rewrote, lights whose range held their instances before
+    // or holds them now are drawn again
+    void CastersMoved(const Scene& scene, const std::vector<uint32_t>& slots);
+    // Size and place the tiles for the camera of view and projection, copy the table and draw what is due.
+    // Ahead of the submission of the frame that samples them
+    void Update(Scene& scene, GeometryArena& geometry, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection);
+
+    // lights with a tile, and with a drawing the shaders use, of the last Update
+    uint32_t GetShadowedCount() const { return shadowedCount; }
+    // faces the last Update drew and their texels
+    uint32_t GetRedrawCount() const { return redrawCount; }
+    uint32_t GetRedrawTexels() const { return redrawTexels; }
+    // the atlas with a comparing sampler, in DEPTH_STENCIL_READ_ONLY_OPTIMAL
+    vk::DescriptorImageInfo GetDescriptor() const { return vk::DescriptorImageInfo(sampler, view, vk::ImageLayout::eDepthStencilReadOnlyOptimal); }
+    vk::DescriptorBufferInfo GetTableDescriptor() const { return vk::DescriptorBufferInfo(table.buffer, 0, VK_WHOLE_SIZE); }
+
+private:
+    struct Tile {
+        uint32_t x;
+        uint32_t y;
+        uint32_t size;
+    };
+
+    // std430 layout of one face in indirect_clustered.frag and deferred_lighting.frag
+    struct GpuFace {
+        // world to the face's clip space, z in [0, 1]
+        m3d::math::Matrix4x4 matrix;
+        // atlas uv of the tile's corner, its size and half an atlas texel
+        float rect[4];
+    };
+
+    // what a drawing was made for, the light is drawn again once it changes
+    struct LightKey {
+        float position[3];
+        float direction[3];
+        float range;
+        float cone;
+        uint32_t type;
+        uint32_t tileSize;
+        bool operator==(const LightKey& other) const;
+    };
+
+    struct LightShadow {
+        LightKey key;
+        uint32_t faceCount = 0;
+        Tile tiles[MaxFacesPerLight];
+        GpuFace faces[MaxFacesPerLight];
+        // the tiles hold a drawing for key
+        bool drawn = false;
+        // casters in range moved since the drawing
+        bool castersMoved = false;
+        uint64_t drawnFrame = 0;
+        uint64_t seenFrame = 0;
+        // of the current Update
+        float coverage = 0.0f;
+        // among the point and spot lights, ClusteredLights' order
+        uint32_t localIndex = 0;
+        // the drawing is of the current key, faces is what the table shows
+        bool current = false;
+    };
+
+    // the tile quadtree, MaxTileSize squares split down to MinTileSize
+    bool allocateTile(uint32_t size, Tile& tile);
+    void freeTile(const Tile& tile);
+    void releaseTiles(LightShadow& shadow);
+    void resetTiles();
+
+    void createTargets();
+    void createPipeline();
+    // the atlas at the far plane and a table without shadows, before the first Update
+    void clear();
+    void placeFaces(LightShadow& shadow, const m3d::math::Vector3& position, const m3d::math::Vector3& direction, float range, float cone);
+    void record(Scene& scene, GeometryArena& geometry, const std::vector<LightShadow*>& redraw, bool copyTable);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    PipelineRegistry& registry;
+    SubmitTimeline& timeline;
+    uint32_t resolution;
+
+    vk::Format depthFormat;
+    vk::Image image;
+    vk::DeviceMemory memory;
+    vk::ImageView view;
+    vk::Framebuffer framebuffer;
+    vk::Sampler sampler;
+    vk::RenderPass renderPass;
+    // owned by the registry
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+
+    struct Buffer {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+    };
+    Buffer table;
+    // what the table holds once the last submission ran, copied again when it changes
+    std::vector<uint32_t> firstFaces;
+    std::vector<GpuFace> faces;
+    std::vector<uint32_t> uploadedFirstFaces;
+    std::vector<GpuFace> uploadedFaces;
+
+    vk::CommandPool commandPool;
+    vk::CommandBuffer commandBuffer;
+    // timeline value of the last submission, the command buffer is reused once it completed
+    uint64_t submitted = 0;
+
+    // free tiles by size, MaxTileSize first
+    std::vector<std::vector<Tile>> freeTiles;
+    // by light id
+    std::unordered_map<uint32_t, LightShadow> shadows;
+
+    InstanceBvh bvh;
+    bool staticDirty = true;
+    bool bvhStale = false;
+    // (transform slot, instance) of every instance, sorted, and the world box of every slot's instances as of the last
+    // CastersMoved or Invalidate
+    std::vector<std::pair<uint32_t, uint32_t>> slotInstances;
+    std::vector<Aabb> slotBounds;
+    uint64_t frame = 0;
+    uint32_t shadowedCount = 0;
+    uint32_t redrawCount = 0;
+    uint32_t redrawTexels = 0;
+    std::vector<uint32_t> casters;
+};
+}
@@ -0,0 +1,118 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "InstanceBvh.hpp"
+#include "Matrix.h"
+
+namespace m3d {
+class GeometryArena;
+class PipelineRegistry;
+class Scene;
+class SubmitTimeline;
+
+/*
+ * Cascaded shadow maps of the main directional light, the first one of
+ * Scene::lights.
+ *
+ * The view range between the camera's near and far planes is split into
+ * CascadeCount cascades, logarithmically blended with uniformly (SplitLambda).
+ * Each cascade is an orthographic map along the light around the bounding
+ * sphere of its slice of the view frustum, one layer of a depth array image.
+ * The sphere keeps its size while the camera turns and its center is snapped
+ * to a grid of an eighth of its radius, so a cascade only moves once the
+ * camera moved that far.
+ *
+ * The maps hold the static geometry, Scene::instances, and are cached: Update
+ * only draws the cascades that moved, or all of them after the light or the
+ * static geometry changed (Invalidate). The casters of a cascade are the
+ * instances an InstanceBvh query finds in its box along the light, drawn in a
+ * submission of its own ahead of the frame. Skinned instances cast no shadows.
+ */
+class ShadowCascades {
+public:
+    static const uint32_t CascadeCount = 4;
+    static const uint32_t Resolution = 2048;
+    static const float SplitLambda;
+
+    // resolution 1 keeps a map that is never drawn, for lit shaders that sample one regardless.
+    // Maps are drawn on the timeline's queue, of queueFamilyIndex
+    ShadowCascades(vk::Device&, vk::PhysicalDevice&, PipelineRegistry&, SubmitTimeline& timeline, uint32_t queueFamilyIndex,
+        uint32_t resolution = Resolution);
+    ~ShadowCascades();
+
+    // Instances were added, moved or removed or meshes turned resident, every map is drawn again by the next Update
+    void Invalidate() { staticDirty = true; }
+    // Fit the cascades to the camera of view and projection between nearZ and farZ and draw the maps that moved.
+    // Ahead of the submission of the frame that samples them. False without a directional light, no cascades then.
+    bool Update(Scene& scene, GeometryArena& geometry, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection, float nearZ,
+        float farZ);
+
+    // of the last Update, world to the light space of a cascade with z in [0, 1]
+    const m3d::math::Matrix4x4* GetMatrices() const { return matrices; }
+    // view depth each cascade ends at
+    const float* GetSplits() const { return splits; }
+    uint32_t GetCascadeCount() const { return cascadeCount; }
+    // cascades the last Update drew, 0 while every map stayed cached
+    uint32_t GetRedrawCount() const { return redrawCount; }
+    // the depth array with a comparing sampler, in DEPTH_STENCIL_READ_ONLY_OPTIMAL
+    vk::DescriptorImageInfo GetDescriptor() const { return vk::DescriptorImageInfo(sampler, arrayView, vk::ImageLayout::eDepthStencilReadOnlyOptimal); }
+
+private:
+    // what a cached map was drawn for, the map is drawn again once it changes
+    struct CascadeKey {
+        float direction[3];
+        float center[2];
+        float halfExtent;
+        float depthRange[2];
+        bool operator==(const CascadeKey& other) const;
+    };
+
+    void createTargets();
+    void createPipeline();
+    // fill every layer with the far plane and leave it readable, before the first Update
+    void clearMaps();
+    void drawCascades(Scene& scene, GeometryArena& geometry, const std::vector<uint32_t>& cascades);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    PipelineRegistry& registry;
+    SubmitTimeline& timeline;
+    uint32_t resolution;
+
+    vk::Format depthFormat;
+    vk::Image image;
+    vk::DeviceMemory memory;
+    vk::ImageView arrayView;
+    vk::ImageView layerViews[CascadeCount];
+    vk::Framebuffer framebuffers[CascadeCount];
+    vk::Sampler sampler;
+    vk::RenderPass renderPass;
+    // owned by the registry
+    vk::PipelineLayout pipelineLayout;
+    vk::Pipeline pipeline;
+
+    vk::CommandPool commandPool;
+    vk::CommandBuffer commandBuffer;
+    // timeline value of the last drawing, the command buffer is reused once it completed
+    uint64_t submitted = 0;
+
+    InstanceBvh bvh;
+    bool staticDirty = true;
+    bool cached[CascadeCount];
+    CascadeKey keys[CascadeCount];
+    m3d::math::Matrix4x4 matrices[CascadeCount];
+    float splits[CascadeCount];
+    uint32_t cascadeCount = 0;
+    uint32_t redrawCount = 0;
+    std::vector<uint32_t> casters;
+};
+}
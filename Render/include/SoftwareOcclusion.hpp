@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Bounds.hpp"
+#include "Matrix.h"
+
+namespace m3d {
+class Scene;
+class ThreadPool;
+
+/*
+ * Occlusion culling on the CPU, for GPUs too weak to afford a depth pyramid.
+ *
+ * A few occluder instances, large and simple, are rasterized into a Width x
+ * Height depth buffer of their own on a worker thread while the frame is
+ * prepared: Begin snapshots their matrices and starts the worker, IsOccluded
+ * tests an instance's world box once Wait returned. Occluders are drawn with
+ * the coarsest LOD of their mesh, copied when the first instance of the mesh
+ * is added. The rasterizer walks 4 pixels at a time with the SSE or NEON
+ * kernels of MathUtils.h and keeps the nearest depth, then reduces the buffer
+ * into Levels mips of the farthest depth of 2x2 texels. A box is occluded when
+ * its nearest corner is behind the farthest depth of every texel it covers in
+ * the mip where it spans at most 4x4 of them.
+ *
+ * It errs on the side of drawing: triangles crossing the near plane are left
+ * out and boxes crossing it or outside of the view are never occluded.
+ */
+class SoftwareOcclusion {
+public:
+    static const uint32_t Width = 256;
+    static const uint32_t Height = 128;
+    // Width x Height down to 8 x 4
+    static const uint32_t Levels = 6;
+
+    SoftwareOcclusion();
+    ~SoftwareOcclusion();
+
+    // Draw instanceID of scene as an occluder from the next Begin on; it is never occluded itself.
+    // Both wait for a rasterization still running
+    void AddOccluder(const Scene& scene, uint32_t instanceID);
+    void RemoveOccluder(uint32_t instanceID);
+    bool IsOccluder(uint32_t instanceID) const { return occluders.count(instanceID) > 0; }
+
+    // Rasterize the occluders where scene's transforms put them, for the camera of viewProjection
+    // (column vectors, projection * view). Their world matrices are read before it returns
+    void Begin(const Scene& scene, const m3d::math::Matrix4x4& viewProjection);
+    // until the depth of the last Begin is ready for IsOccluded
+    void Wait();
+    // worldBox is hidden behind the occluders, false before the first Begin
+    bool IsOccluded(const Aabb& worldBox) const;
+
+    // of the last Begin
+    uint32_t GetOccluderTriangles() const { return triangles; }
+
+private:
+    struct OccluderMesh {
+        // object space, w 1
+        std::vector<m3d::math::Vector4> positions;
+        std::vector<uint32_t> indices;
+        // occluder instances drawing it
+        uint32_t users = 0;
+    };
+    struct Job {
+        const OccluderMesh* mesh;
+        // of viewProjection * world, for VectorTransformArray's row vectors
+        m3d::math::Matrix4x4 transposedMvp;
+    };
+
+    // on the worker
+    void rasterize();
+    // screen space x, y and depth of each corner
+    void drawTriangle(const float* v0, const float* v1, const float* v2);
+    void buildMips();
+
+    std::unordered_map<uint32_t, OccluderMesh> meshes;
+    // instance ID to mesh ID
+    std::unordered_map<uint32_t, uint32_t> occluders;
+    std::vector<Job> jobs;
+    // clip space positions of the mesh being drawn
+    std::vector<m3d::math::Vector4> clip;
+    // of the last Begin, IsOccluded projects the boxes with it
+    m3d::math::Matrix4x4 frameViewProjection;
+
+    // every level after the other, level 0 16 byte aligned for the 4 pixel loads
+    std::vector<float> storage;
+    float* levels[Levels];
+    bool ready = false;
+    uint32_t triangles = 0;
+    std::unique_ptr<ThreadPool> worker;
+};
+}
@@ -0,0 +1,46 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Scene.hpp"
+
+namespace m3d {
+class RendererVulkan;
+
+// Where a StartRenderer spent its time, in milliseconds of wall clock
+struct StartupStats {
+    // Scene::Init and LoadMeshes on the loading thread
+    double sceneMs = 0.0;
+    // RendererVulkan::InitDevice on the calling thread, meanwhile
+    double deviceMs = 0.0;
+    // the calling thread waiting for the scene once its device was up, 0 when the scene was first
+    double waitMs = 0.0;
+    // RendererVulkan::Init with the scene: textures, the geometry upload and the pipelines
+    double initMs = 0.0;
+    double totalMs = 0.0;
+    LoadStats load;
+};
+
+/*
+ * Overlapped startup: reads the scene at path into scene (Scene::Init and
+ * LoadMeshes, on loadThreads threads) on a thread of its own while the
+ * calling thread brings renderer's instance, device, swapchain, upload path
+ * and pipeline cache up, then joins the two at the first upload and calls
+ * renderer.Init(&scene). Startup takes the longer of the two instead of
+ * their sum.
+ *
+ * The calling thread must be the one owning the window, the swapchain is
+ * created on it. Set the renderer up as for Init before; scene must not be
+ * touched by anyone else until StartRenderer returns. Every step is a zone
+ * of the trace, see Trace.hpp, the loading thread shows as "startup scene".
+ */
+void StartRenderer(RendererVulkan& renderer, Scene& scene, const std::string& path, bool useCooked = true,
+    uint32_t loadThreads = 0, StartupStats* stats = nullptr);
+} // End of namespace m3d
@@ -0,0 +1,45 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace m3d {
+class Scene;
+
+/*
+ * Cook time merging of static geometry, fbxconv runs it before CookScene.
+ *
+ * An instance is static when no animation moves its transform or one of its
+ * parents. Static instances of meshes with at most maxMeshVertices vertices
+ * are sorted into the cells of a cellSize grid by the center of their world
+ * bounds. Every cell holding two or more of them gets merged meshes, one per
+ * material, with the instances' triangles pre-transformed into world space.
+ * A merged mesh holds up to maxMergedVertices vertices before the next one is
+ * started; it is built like an imported mesh (welded, optimized, bounded and
+ * simplified into LODs) and placed once by an identity transform, so culling
+ * and LOD selection work per cell instead of per prop.
+ *
+ * The merged instances are removed, their transforms stay for the nodes
+ * parented to them. Meshes that no instance references afterwards are removed.
+ */
+struct StaticMergeSettings {
+    float cellSize = 32.0f;
+    uint32_t maxMeshVertices = 4096;
+    uint32_t maxMergedVertices = 65536;
+};
+
+struct StaticMergeStats {
+    uint32_t mergedInstances = 0;
+    // added to the scene
+    uint32_t mergedMeshes = 0;
+    // no longer referenced once their instances were merged
+    uint32_t removedMeshes = 0;
+};
+
+void MergeStaticInstances(Scene& scene, const StaticMergeSettings& settings = StaticMergeSettings(), StaticMergeStats* stats = nullptr);
+}
@@ -0,0 +1,100 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GUIStructures.h"
+#include "MemoryTags.hpp"
+#include "PerfLint.hpp"
+
+namespace GUISystem {
+class GUIElement;
+class GUITextCaption;
+}
+
+namespace m3d {
+class GuiRenderer;
+class RendererVulkan;
+
+/*
+ * Frame statistics in the top right corner of the screen: bar graphs of the
+ * last frames' CPU and GPU times and text lines with the draws, triangles
+ * and pipeline binds of the scene, the bytes uploaded per frame, the
+ * device local memory against its budget and the texture streamer's reads
+ * in flight and their latency, drawn by a GuiRenderer.
+ *
+ * Every Refresh adds the renderer's last frame to the graphs, the text is
+ * only rewritten every refreshFrames calls and its quads only laid out
+ * again when it changed; the graphs are one element tree of a few hundred
+ * quads. Nothing waits on the GPU, the overlay can stay on in release
+ * builds.
+ *
+ * The bars are elements showing barTexture, a region of a solid white
+ * texel the application added to the GuiRenderer, tinted by how the frame
+ * compares to targetMs; without the region only the text is drawn. With the
+ * perf lint on, a line has its issues per frame and the most frequent; with
+ * M3D_MEMORY_TAGS the last one has the RAM of the memory tag holding the most
+ * and the tag allocating the most often.
+ */
+class StatsOverlay {
+public:
+    static const uint32_t HistoryFrames = 120;
+
+    // fontFace as the GuiRenderer's font renderer knows it, fontSize in pixels
+    StatsOverlay(const std::string& fontFace, const std::string& barTexture, int fontSize = 14, uint32_t refreshFrames = 30, float targetMs = 16.7f);
+    ~StatsOverlay();
+
+    // Once per frame, before Add
+    void Refresh(const RendererVulkan& renderer);
+    // From the GUI callback
+    void Add(GuiRenderer& gui, const GUISystem::ElementProportions& screen);
+
+private:
+    class Bar;
+
+    struct Graph {
+        // the background and its bars, the tree handed to the GuiRenderer
+        Bar* background;
+        std::vector<Bar*> bars;
+        // milliseconds, oldest at next
+        float samples[HistoryFrames];
+        uint32_t next;
+    };
+
+    void createGraph(Graph& graph, const char* name);
+    void destroyGraph(Graph& graph);
+    void placeGraph(Graph& graph, float left, float top);
+    GUISystem::GUITextCaption& line(uint32_t index);
+    void setLine(uint32_t index, const char* text);
+
+    std::string fontFace;
+    std::string barTexture;
+    int fontSize;
+    uint32_t refreshFrames;
+    float targetMs;
+    uint32_t frame = 0;
+
+    Graph cpuGraph;
+    Graph gpuGraph;
+    // without GPU timings the second graph stays hidden
+    bool gpuTimed = false;
+    // summed over the frames since the text was last rewritten
+    uint64_t uploadBytes = 0;
+    uint32_t uploadFrames = 0;
+    uint32_t lintCounts[perflint::IssueCount] = {};
+    // memtag::Stats::allocations at the last rewrite
+    uint64_t ramAllocations[memtag::TagCount] = {};
+
+    std::vector<GUISystem::GUITextCaption*> captions;
+    // the captions shown
+    uint32_t lineCount = 0;
+    std::vector<GUISystem::GUIElement*> elements;
+};
+}
@@ -0,0 +1,172 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace m3d {
+
+namespace detail {
+    constexpr uint64_t fnv1a64(const char* text, size_t length, uint64_t hash)
+    {
+        return length == 0 ? hash : fnv1a64(text + 1, length - 1, (hash ^ static_cast<uint8_t>(*text)) * 1099511628211ull);
+    }
+    constexpr uint32_t fnv1a32(const char* text, size_t length, uint32_t hash)
+    {
+        return length == 0 ? hash : fnv1a32(text + 1, length - 1, (hash ^ static_cast<uint8_t>(*text)) * 16777619u);
+    }
+}
+
+// FNV-1a of text, 0 for the empty string. constexpr, a literal is hashed at compile time
+constexpr uint64_t StringHash64(const char* text, size_t length)
+{
+    return length == 0 ? 0 : detail::fnv1a64(text, length, 14695981039346656037ull);
+}
+constexpr uint32_t StringHash32(const char* text, size_t length)
+{
+    return length == 0 ? 0 : detail::fnv1a32(text, length, 2166136261u);
+}
+
+/*
+ * Name of an asset or object as the 64 bit hash of its text.
+ *
+ * Comparing and hashing is an integer compare, and objects of the same name
+ * share one copy of the text in a global interner instead of a std::string
+ * each. The constructors taking text intern it, from any thread; interned
+ * text is kept until the program exits, so it is meant for names, not for
+ * text that changes every frame. Two texts of the same hash are reported
+ * when the second is interned, the first keeps the id.
+ *
+ * "name"_id is the id of a literal computed at compile time, without
+ * interning, so it compares equal to the id of an object named so but its
+ * str() is empty until something interned the text.
+ */
+class StringId {
+public:
+    constexpr StringId()
+        : value(0)
+    {
+    }
+    explicit StringId(const std::string& text);
+    explicit StringId(const char* text);
+    StringId(const char* text, size_t length);
+
+    // id of a hash, from FromValue / Value or StringHash64, nothing is interned
+    static constexpr StringId FromValue(uint64_t value) { return StringId(value, 0); }
+
+    constexpr uint64_t Value() const { return value; }
+    // the 64 bit id folded to 32 bits, for keys that have to be small; two names are far likelier to collide in it
+    constexpr uint32_t Value32() const { return static_cast<uint32_t>(value ^ (value >> 32)); }
+    constexpr bool empty() const { return value == 0; }
+
+    // The interned text, empty when the id was never interned
+    const std::string& str() const;
+    const char* c_str() const { return str().c_str(); }
+
+    constexpr bool operator==(const StringId& other) const { return value == other.value; }
+    constexpr bool operator!=(const StringId& other) const { return value != other.value; }
+    constexpr bool operator<(const StringId& other) const { return value < other.value; }
+
+    // Distinct texts interned so far
+    static size_t InternedCount();
+
+private:
+    constexpr StringId(uint64_t hash, int)
+        : value(hash)
+    {
+    }
+
+    uint64_t value;
+};
+
+constexpr StringId operator"" _id(const char* text, size_t length)
+{
+    return StringId::FromValue(StringHash64(text, length));
+}
+}
+
+namespace std {
+template<>
+struct hash<m3d::StringId> {
+    size_t operator()(const m3d::StringId& id) const { return static_cast<size_t>(id.Value()); }
+};
+}
+
+namespace m3d {
+
+/*
+ * Name to id index of the objects of a chunked_freelist, for finding one by
+ * its StringId name with a hash lookup instead of comparing the name of every
+ * object.
+ *
+ * The index is built from the list on the first Find and again on the first
+ * Find after the list changed, so it needs no call at the many places that
+ * insert and erase. An object renamed in place is only found under its new
+ * name after the list changed or Invalidate.
+ */
+template<class List>
+class NameIndex {
+public:
+    static const uint32_t NotFound = 0xFFFFFFFF;
+
+    // id of an object named name, the first in iteration order when several are, NotFound when none is. No insert or
+    // erase on list meanwhile
+    uint32_t Find(const List& list, StringId name)
+    {
+        if (name.empty()) {
+            return NotFound;
+        }
+        if (stale(list)) {
+            build(list);
+        }
+        auto it = ids.find(name);
+        if (it != ids.end() && list.contains(it->second) && list[it->second].name == name) {
+            return it->second;
+        }
+        if (it != ids.end()) {
+            // renamed since the build
+            build(list);
+            it = ids.find(name);
+            return it == ids.end() ? NotFound : it->second;
+        }
+        return NotFound;
+    }
+
+    // Rebuild on the next Find
+    void Invalidate() { built = false; }
+
+private:
+    bool stale(const List& list) const
+    {
+        return !built || list.size() != size || list.erase_count() != erases;
+    }
+
+    void build(const List& list)
+    {
+        ids.clear();
+        ids.reserve(list.size());
+        for (uint32_t id : list) {
+            const StringId name = list[id].name;
+            if (!name.empty()) {
+                ids.emplace(name, id);
+            }
+        }
+        size = list.size();
+        erases = list.erase_count();
+        built = true;
+    }
+
+    std::unordered_map<StringId, uint32_t> ids;
+    bool built = false;
+    size_t size = 0;
+    uint64_t erases = 0;
+};
+}
@@ -0,0 +1,114 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * The submissions of one queue, counted.
+ *
+ * Every Submit gets the next value of a counter, from 1 on, and whatever has
+ * to outlive a submission (trashed objects, staging space, a frame slot) is
+ * kept against that value. GetCompleted tells how far the GPU got, Wait
+ * blocks until it got to a value.
+ *
+ * With VK_KHR_timeline_semaphore the counter is a timeline semaphore the
+ * submissions signal: no fence per submission, and another queue's timeline
+ * can wait on a value on the GPU (AddWait). Without it every submission
+ * signals a fence of a pool and GPU waits stay with binary semaphores.
+ *
+ * Defer queues a submission instead, Flush hands every queued one to the
+ * queue in one vkQueueSubmit, a batch each: the renderer defers the passes
+ * and uploads of a frame and flushes them with the frame's own submission.
+ * The values are taken right away, Wait flushes when it has to.
+ *
+ * One timeline per queue, its values are signaled in submission order.
+ * Not thread safe, submit from one thread.
+ */
+class SubmitTimeline {
+public:
+    static const char* const ExtensionName;
+
+    // the device has VK_KHR_timeline_semaphore and its timelineSemaphore feature, the instance needs
+    // VK_KHR_get_physical_device_properties2
+    static bool IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice);
+    // pNext of the vk::DeviceCreateInfo, enables the feature; next is chained behind it
+    static const void* GetFeatureChain(const void* next = nullptr);
+
+    // timelineSemaphores with ExtensionName and GetFeatureChain on device
+    SubmitTimeline(vk::Device& device, vk::Queue queue, bool timelineSemaphores);
+    ~SubmitTimeline();
+
+    SubmitTimeline(const SubmitTimeline&) = delete;
+    SubmitTimeline& operator=(const SubmitTimeline&) = delete;
+
+    // Submit info to the queue with the waits of AddWait, after the deferred ones; returns the value complete with it
+    uint64_t Submit(const vk::SubmitInfo& info);
+    // The same on the next Submit or Flush. info's arrays are copied, its pNext chain must live until then
+    uint64_t Defer(const vk::SubmitInfo& info);
+    // one vkQueueSubmit of everything deferred
+    void Flush();
+    // The next Submit waits on the GPU for other to reach value, at stage. Timeline semaphores only, false
+    // without: order the two with a binary semaphore
+    bool AddWait(const SubmitTimeline& other, uint64_t value, vk::PipelineStageFlags stage);
+
+    // every submission up to value completed
+    bool IsComplete(uint64_t value);
+    uint64_t GetCompleted();
+    void Wait(uint64_t value);
+    void WaitIdle();
+
+    uint64_t GetSubmitted() const { return submitted; }
+    bool HasTimelineSemaphore() const { return static_cast<bool>(semaphore); }
+    vk::Queue GetQueue() const { return queue; }
+
+private:
+    struct Pending {
+        uint64_t value;
+        vk::Fence fence;
+    };
+    // a deferred submission, the waits and signals include the timeline's own
+    struct Batch {
+        const void* next;
+        std::vector<vk::CommandBuffer> commandBuffers;
+        std::vector<vk::Semaphore> waits;
+        std::vector<vk::PipelineStageFlags> waitStages;
+        std::vector<uint64_t> waitValues;
+        std::vector<vk::Semaphore> signals;
+        std::vector<uint64_t> signalValues;
+    };
+
+    // fences of completed submissions back to the pool, oldest first
+    void retireFences(bool wait, uint64_t value);
+
+private:
+    vk::Device& device;
+    vk::Queue queue;
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    // values up to it reached the queue
+    uint64_t flushed = 0;
+    std::vector<Batch> batches;
+
+    /* timeline semaphores */
+    vk::Semaphore semaphore;
+    PFN_vkVoidFunction getCounterValue = nullptr;
+    PFN_vkVoidFunction waitSemaphores = nullptr;
+    std::vector<vk::Semaphore> waits;
+    std::vector<uint64_t> waitValues;
+    std::vector<vk::PipelineStageFlags> waitStages;
+
+    /* fences */
+    std::deque<Pending> pending;
+    std::vector<vk::Fence> freeFences;
+};
+}
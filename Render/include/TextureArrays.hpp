@@ -0,0 +1,107 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "MemoryAllocator.hpp"
+#include "vulkanTextureLoader.hpp"
+
+namespace m3d {
+class ResourceTrash;
+class SamplerCache;
+class TextureStreamer;
+class UploadQueue;
+
+/*
+ * Material textures packed into a few 2D array images, for devices that cannot
+ * index Pipeline's array of MaxTextures samplers (no
+ * shaderSampledImageArrayDynamicIndexing, or too few samplers per stage).
+ *
+ * Textures of the same format, size and level count share an array, like the
+ * layers VulkanTextureLoader::loadTextureArray reads from one file, so
+ * Pipeline::MaxTextureArrays descriptors cover the whole scene and every
+ * indirect draw samples through the one set bound per frame.
+ * indirect_array.frag picks the array with constant indices and the layer
+ * from its material.
+ *
+ * Add copies all of a texture's levels from TextureStreamer's loaded data,
+ * levels larger than MaxExtent are left out. There is no streaming: a layer
+ * holds the whole chain once its upload completed, until Remove gives it
+ * back. Textures that find no array stay white.
+ */
+class TextureArrays {
+public:
+    // layers of every array image, within maxImageArrayLayers of every device
+    static const uint32_t LayersPerArray = 64;
+    // the finest level packed, wider or taller ones are skipped
+    static const uint32_t MaxExtent = 1024;
+    static const uint32_t InvalidLayer = 0xFFFFFFFF;
+
+    TextureArrays(vk::Device&, vk::PhysicalDevice&, UploadQueue&, MemoryAllocator&, SamplerCache&, TextureStreamer&);
+    ~TextureArrays();
+
+    // Queue the upload of textureID's levels into a layer, creating its array. False when it is packed already,
+    // its decode did not finish or no array is left for its format and size
+    bool Add(uint32_t textureID);
+    // Forget textureID's layer before TextureStreamer::Release, the id may come back for another texture. With trash
+    // the layer is reused once the frames submitted so far completed, right away otherwise
+    void Remove(uint32_t textureID, ResourceTrash* trash = nullptr);
+    // array and layer of textureID once its upload completed, InvalidLayer before
+    uint32_t GetArray(uint32_t textureID) const;
+    uint32_t GetLayer(uint32_t textureID) const;
+    // One per array, unused ones a white 1x1 array
+    const std::vector<vk::DescriptorImageInfo>& GetDescriptors() const { return descriptors; }
+    // uploads completed or arrays created since the last TakeChanges: materials may point at new layers and the
+    // descriptors need a rewrite
+    bool HasChanges() const { return completed || descriptorsChanged; }
+    // forget them, true when the descriptors changed
+    bool TakeChanges();
+
+private:
+    struct Array {
+        vk::Format format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        vkext::VulkanTexture texture;
+        MemoryAllocator::Allocation memory;
+        std::vector<uint32_t> freeLayers;
+    };
+    // where a texture is packed, ready once its upload completed
+    struct Slot {
+        uint32_t array = InvalidLayer;
+        uint32_t layer = InvalidLayer;
+        bool ready = false;
+        // bumped by Remove, an upload completing after it is not the slot's
+        uint32_t serial = 0;
+    };
+
+    // the array with a free layer for textures like it, a new one when none has; InvalidLayer without room
+    uint32_t findArray(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels);
+    void createWhiteArray();
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    UploadQueue& upload;
+    MemoryAllocator& allocator;
+    SamplerCache& samplers;
+    TextureStreamer& streamer;
+
+    std::vector<Array> arrays;
+    // by texture id
+    std::vector<Slot> slots;
+    vkext::VulkanTexture white;
+    std::vector<vk::DescriptorImageInfo> descriptors;
+    bool descriptorsChanged = false;
+    bool completed = false;
+    bool reportedFull = false;
+};
+}
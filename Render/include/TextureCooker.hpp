@@ -0,0 +1,82 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Offline block compression of source images (png, jpg, tga, ...) into KTX
+ * files TextureStreamer maps and uploads without decoding.
+ *
+ * Every image is cooked once per block family, BC for desktop GPUs and
+ * ETC2/EAC for mobile ones, with a box filtered mip chain. The loader picks
+ * the family the device samples, see PickBlockFamily.
+ *
+ *   usage        BC     ETC2
+ *   Color        BC1    ETC2 RGB8
+ *   ColorAlpha   BC3    ETC2 RGBA8 (EAC alpha)
+ *   Normal       BC5    EAC RG11
+ *
+ * Normal maps keep x and y only, shaders rebuild z = sqrt(1 - x*x - y*y).
+ */
+enum class TextureUsage {
+    Color,
+    ColorAlpha,
+    Normal
+};
+
+enum class BlockFamily {
+    BC,
+    ETC2
+};
+
+struct RgbaImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // 4 bytes per texel, rows top to bottom
+    std::vector<uint8_t> texels;
+};
+
+// Decode any image stb_image reads into 4 channels, false when it cannot
+bool LoadRgbaImage(const std::string& imagePath, RgbaImage* image);
+// image as an uncompressed R8G8B8A8 KTX file of one level, false when it cannot be written
+bool WriteRgbaKtx(const RgbaImage& image, const std::string& path);
+// image as an 8 bit RGBA PNG, fixed Huffman deflate of filtered rows: fast, not the smallest. False when it cannot be written
+bool WriteRgbaPng(const RgbaImage& image, const std::string& path);
+
+// Level 0 is the image itself, every further level halves it with a box filter down to 1x1.
+// normals renormalizes the filtered rgb as unit vectors.
+std::vector<RgbaImage> BuildMipChain(const RgbaImage& image, bool normals = false);
+
+vk::Format CookedFormat(TextureUsage usage, BlockFamily family);
+// Where CookTexture writes the given family of an image, next to it like CookedPath
+std::string CookedTexturePath(const std::string& imagePath, BlockFamily family);
+// Decode, build the mips, compress them and write a KTX file, false when the image cannot be read or the file written
+bool CookTexture(const std::string& imagePath, TextureUsage usage, BlockFamily family, const std::string& path);
+
+// vk::Format of a KTX glInternalFormat, eUndefined for ones not written here
+vk::Format KtxFormat(uint32_t glInternalFormat);
+
+// One level of a KTX file, pointing into the file's bytes
+struct KtxLevel {
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t width;
+    uint32_t height;
+};
+// Levels of a plain 2D KTX file in place, nothing is copied. False for anything else or a truncated file.
+// glInternalFormat may be null
+bool ParseKtx(const uint8_t* data, size_t size, std::vector<KtxLevel>* levels, uint32_t* glInternalFormat = nullptr);
+
+// First family whose format for usage the device samples with optimal tiling, BC before ETC2
+bool PickBlockFamily(vk::PhysicalDevice& physicalDevice, TextureUsage usage, BlockFamily* family);
+}
@@ -0,0 +1,266 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "FrameArena.hpp"
+#include "MemoryAllocator.hpp"
+#include "TextureCooker.hpp"
+#include "vulkanTextureLoader.hpp"
+
+namespace m3d {
+class ResourceTrash;
+class SamplerCache;
+class ThreadPool;
+class UploadQueue;
+
+/*
+ * Mip streaming for 2D textures inside a fixed VRAM budget.
+ *
+ * Load() keeps the file mapped and only uploads the mip tail, the levels no
+ * larger than TailSize, so a texture can be sampled after a few KB landed.
+ * RequestMip() records the finest level the renderer wants, from distance or
+ * screen space feedback, and Update() moves every texture's residency towards
+ * its request.
+ *
+ * Without sparse residency an image has memory for all of its levels, so a
+ * change builds a new image holding levels [residentMip, mipLevels) straight
+ * from the mapping. It is swapped in from the upload's completion and the old
+ * image goes to the ResourceTrash.
+ *
+ * When the requests do not fit the budget, textures that were requested
+ * longest ago lose their top levels first, down to the tail which always stays.
+ *
+ * LoadAsync() and LoadCookedAsync() read through a file::AsyncReader with
+ * many reads in flight and decode on a pool of worker threads instead, so a
+ * scene's textures decode on every core. The id is valid at once, Update()
+ * starts the tail upload once the decode finished.
+ *
+ * After EnableSparse(), textures wider or taller than SparseMinExtent that the
+ * device can make sparse resident are created once with their full chain and
+ * no memory. The sparse mip tail gets its own allocation at load, every level
+ * above it commits memory per tile (the format's sparse granularity) out of
+ * shared pages. RequestRegion() asks for the tiles under a uv rectangle and
+ * tiles requested longest ago are unbound first when the budget runs out.
+ * Unbound tiles read as zero on devices with residencyNonResidentStrict,
+ * shaders should otherwise clamp to the levels they requested.
+ */
+class TextureStreamer {
+public:
+    static const vk::DeviceSize DefaultBudget = 256 * 1024 * 1024;
+    // bytes Update() starts uploading per call, keeps a burst of requests from stalling a frame
+    static const vk::DeviceSize UploadPerUpdate = 16 * 1024 * 1024;
+    // levels with both sides at or below this many texels are the resident tail
+    static const uint32_t TailSize = 64;
+    // frames without a request before a texture falls back to its tail
+    static const uint32_t RequestTimeout = 120;
+    static const uint32_t InvalidTexture = 0xFFFFFFFF;
+    // smaller textures keep using whole images even with sparse residency enabled
+    static const uint32_t SparseMinExtent = 4096;
+    // tiles per device memory allocation backing sparse tiles
+    static const uint32_t SparsePageTiles = 256;
+
+    // the texture's view, sampler and descriptor changed, descriptor sets using it need a rewrite
+    typedef std::function<void(uint32_t textureID, const vkext::VulkanTexture& texture)> ChangedCallback;
+
+    // decodeThreads workers for the async loads, 0 uses one per hardware thread, started with the first one
+    TextureStreamer(vk::Device&, vk::PhysicalDevice&, UploadQueue&, ResourceTrash&, MemoryAllocator&, SamplerCache&,
+        vk::DeviceSize budget = DefaultBudget, uint32_t decodeThreads = 0);
+    ~TextureStreamer();
+
+    // Map the file and upload its mip tail, InvalidTexture when it cannot be read.
+    // KTX levels are staged straight from the mapping, other formats are decoded by gli or stb_image first.
+    // eUndefined takes the format from the KTX header, stb_image decodes to eR8G8B8A8Unorm.
+    uint32_t Load(const std::string& path, vk::Format format);
+    // The cooked KTX of imagePath in the block family the device samples, the image itself when it was not cooked
+    uint32_t LoadCooked(const std::string& imagePath, TextureUsage usage);
+    // Same as above with the read and decode in the background, higher priorities are read first.
+    // Get() stays empty until the tail landed, and for good when the file could not be read.
+    uint32_t LoadAsync(const std::string& path, vk::Format format, int32_t priority = 0);
+    uint32_t LoadCookedAsync(const std::string& imagePath, TextureUsage usage, int32_t priority = 0);
+    // Release works on textures that are still decoding, a read that did not start yet is cancelled
+    void Release(uint32_t textureID);
+    // Async loads still decoding
+    uint32_t GetDecodingCount() const { return decodingCount; }
+    // I/O of the async loads, all zero before the first one
+    file::AsyncReader::Stats GetReadStats() const { return reader ? reader->getStats() : file::AsyncReader::Stats(); }
+
+    // Create big textures as sparse resident images, bindQueue needs eSparseBinding. Call before Load,
+    // a no-op unless the device was created with sparseBinding and sparseResidencyImage2D.
+    void EnableSparse(vk::Queue bindQueue);
+    bool IsSparse(uint32_t textureID) const { return entries[textureID].sparse != nullptr; }
+
+    // Finest level wanted for the next frames, 0 is full resolution. Sparse textures take it for the whole image.
+    void RequestMip(uint32_t textureID, uint32_t mip);
+    // Sparse textures: the tiles covering uvMin..uvMax at mip and every coarser level, others fall back to RequestMip
+    void RequestRegion(uint32_t textureID, uint32_t mip, const float uvMin[2], const float uvMax[2]);
+    // Level matching a texture width that covers projectedPixels pixels on screen
+    static uint32_t MipForScreenSize(uint32_t width, float projectedPixels);
+
+    // Fit the requests into the budget and start the residency changes, call once per frame after UploadQueue::Poll.
+    // Temporaries of the pass come from arena
+    void Update(FrameArena& arena);
+
+    // texels of one level as loaded, in the mapped file or the decoded copy
+    struct Level {
+        const uint8_t* data;
+        vk::DeviceSize size;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // mipLevels counts the resident levels only, the object changes whenever the changed callback runs
+    const vkext::VulkanTexture& Get(uint32_t textureID) const { return entries[textureID].texture; }
+    // every level whether resident or not, e.g. to copy them elsewhere; empty until the decode finished and after
+    // Release, valid as long as the texture is alive
+    const std::vector<Level>& GetLevels(uint32_t textureID) const { return entries[textureID].levels; }
+    vk::Format GetFormat(uint32_t textureID) const { return entries[textureID].format; }
+    uint32_t GetResidentMip(uint32_t textureID) const { return entries[textureID].residentMip; }
+    void SetChangedCallback(ChangedCallback callback) { onChanged = callback; }
+
+    void SetBudget(vk::DeviceSize bytes) { budget = bytes; }
+    vk::DeviceSize GetBudget() const { return budget; }
+    // device memory of the resident images plus the ones still uploading
+    vk::DeviceSize GetResidentBytes() const { return residentBytes; }
+
+private:
+    struct Sparse;
+    struct Decode;
+
+    struct Entry {
+        bool alive = false;
+        // mapped file or decoded gli texture the level pointers point into
+        std::shared_ptr<const void> source;
+        std::vector<Level> levels;
+        vk::Format format;
+
+        vkext::VulkanTexture texture = {};
+        // range texture.deviceMemory points into, empty for sparse images
+        MemoryAllocator::Allocation memory;
+        vk::DeviceSize textureBytes = 0;
+        uint32_t residentMip = 0;
+        uint32_t tailMip = 0;
+        // a replacement image is uploading, no other change until it landed
+        bool pending = false;
+        // bumped by every change and release, completions of stale uploads drop their image
+        uint32_t serial = 0;
+
+        uint32_t requestedMip = 0;
+        uint64_t requestedFrame = 0;
+        // what Update settled on within the budget
+        uint32_t targetMip = 0;
+
+        // tile residency instead of the levels above, texture then always covers the whole chain
+        std::shared_ptr<Sparse> sparse;
+        // the async load until Update took it
+        std::shared_ptr<Decode> loading;
+    };
+
+    // file to try and its format, async loads go through them in order
+    typedef std::vector<std::pair<std::string, vk::Format>> Candidates;
+    // an async load, written by the worker until it is queued in decoded
+    struct Decode {
+        uint32_t textureID;
+        uint32_t serial;
+        int32_t priority;
+        Candidates candidates;
+        // the candidate being read and its read, written under decodedMutex
+        size_t candidate = 0;
+        file::AsyncReader::Request request = 0;
+        Entry entry;
+        bool succeeded = false;
+    };
+
+    // one tile of device memory out of a page
+    struct TileSlot {
+        uint32_t page;
+        uint32_t index;
+    };
+    struct Page {
+        vk::DeviceMemory memory;
+        uint32_t memoryTypeIndex;
+        vk::DeviceSize tileBytes;
+        std::vector<uint32_t> freeTiles;
+    };
+    // tiles whose memory binding is on the queue, their copies are recorded once the fence signaled
+    struct PendingBind {
+        vk::Fence fence;
+        std::vector<std::pair<uint32_t, uint32_t>> tiles;
+        std::vector<uint32_t> serials;
+    };
+
+    // map and decode into entry's levels, source and format, safe on any thread
+    static bool decode(const std::string& path, vk::Format format, Entry& entry);
+    static bool decode(const std::shared_ptr<const file::MappedFile>& file, vk::Format format, Entry& entry);
+    static bool parseKtx(const std::shared_ptr<const file::MappedFile>& file, Entry& entry);
+    static bool decodeGli(const std::shared_ptr<const file::MappedFile>& file, Entry& entry);
+    static bool decodeImage(const std::shared_ptr<const file::MappedFile>& file, Entry& entry);
+    static vk::DeviceSize levelBytes(const Entry& entry, uint32_t firstMip);
+    Candidates cookedCandidates(const std::string& imagePath, TextureUsage usage);
+    uint32_t allocateEntry();
+    // alive entry for the decoded levels, uploads the tail
+    void makeLoaded(uint32_t textureID, Entry& decoded);
+    uint32_t loadAsync(const Candidates& candidates, int32_t priority);
+    // read job's current candidate, the next one once it fails, until one decoded or none is left. Under decodedMutex
+    void readCandidate(const std::shared_ptr<Decode>& job);
+    // upload levels [firstMip, mipLevels) into a new image and swap it in once done
+    vk::DeviceSize makeResident(uint32_t textureID, uint32_t firstMip);
+    // view and descriptor over all of the texture's levels, with the shared sampler
+    void createView(vkext::VulkanTexture& texture, vk::Format format);
+    // memory: the texture's suballocation, without one texture.deviceMemory is freed as is
+    void destroy(const vkext::VulkanTexture& texture, bool deferred, const MemoryAllocator::Allocation& memory = MemoryAllocator::Allocation());
+
+    // sparse resident image with only the mip tail bound, false when the device cannot make one
+    bool createSparse(uint32_t textureID);
+    // bind the requested tiles and copy the ones whose binding completed, evict within the budget
+    void updateSparse(const FrameVector<uint32_t>& live, vk::DeviceSize uploaded, FrameArena& arena);
+    void uploadTile(Entry& entry, uint32_t tile);
+    TileSlot allocateTile(uint32_t memoryTypeIndex, vk::DeviceSize tileBytes);
+    void releaseTile(const TileSlot& slot, bool deferred);
+    // return the tiles of a released sparse texture, its image goes with the texture
+    void releaseSparse(Entry& entry, bool deferred);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    UploadQueue& upload;
+    ResourceTrash& trash;
+    MemoryAllocator& allocator;
+    SamplerCache& samplers;
+    vk::DeviceSize budget;
+    vk::DeviceSize residentBytes;
+    uint64_t frame;
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeEntries;
+    ChangedCallback onChanged;
+
+    uint32_t decodeThreads;
+    std::unique_ptr<ThreadPool> decoders;
+    std::unique_ptr<file::AsyncReader> reader;
+    // reads issued and not called back or cancelled
+    std::atomic<uint32_t> reading;
+    // finished async loads, shared with the workers
+    std::mutex decodedMutex;
+    std::vector<std::shared_ptr<Decode>> decoded;
+    uint32_t decodingCount;
+
+    vk::Queue sparseQueue;
+    bool sparseEnabled;
+    std::vector<Page> pages;
+    std::vector<PendingBind> pendingBinds;
+    // evicted tiles come back from the trash once no frame samples them anymore
+    std::shared_ptr<std::vector<TileSlot>> freedTiles;
+};
+}
@@ -0,0 +1,43 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "JobSystem.hpp"
+
+namespace m3d {
+
+/*
+ * A group of tasks on a JobSystem, either its own or one shared with the
+ * rest of the engine. Wait() blocks until every task enqueued so far has
+ * finished, running queued tasks on the calling thread meanwhile.
+ */
+class ThreadPool {
+public:
+    // owns a JobSystem of threadCount workers placed on the cores for priority, see JobSystem
+    explicit ThreadPool(uint32_t threadCount, JobSystem::Priority priority = JobSystem::Priority::Normal);
+    // tasks run with priority
+    explicit ThreadPool(JobSystem& jobSystem, JobSystem::Priority priority = JobSystem::Priority::Normal);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Enqueue(std::function<void()> task);
+    void Wait();
+
+    uint32_t GetThreadCount() const { return jobs->GetWorkerCount(); }
+
+private:
+    std::unique_ptr<JobSystem> ownJobs;
+    JobSystem* jobs;
+    JobSystem::Priority priority;
+    JobSystem::Counter pending;
+};
+}
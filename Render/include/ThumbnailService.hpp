@@ -0,0 +1,102 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <Matrix.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TextureCooker.hpp"
+
+namespace m3d {
+class RendererVulkan;
+class ThreadPool;
+
+/*
+ * Renders batches of thumbnails with a headless RendererVulkan and encodes
+ * them on worker threads.
+ *
+ *   ThumbnailService thumbnails(renderer, loadScene, encoders);
+ *   thumbnails.Submit(request);          // any thread, as many as there are
+ *   thumbnails.Run();                    // the drawing thread, until all are written
+ *
+ * Run takes every request submitted so far and groups them by scene, in the
+ * order each scene was first asked for: the loader makes a scene the
+ * renderer's once, then its requests are queued with RenderOffscreen and
+ * every Draw renders SetHeadless's batch of them into that many offscreen
+ * targets in one submission. All requests share the renderer's pipelines,
+ * the scene is all there is to group by.
+ *
+ * A readback is copied out of the target and handed to the encoders, which
+ * scale it to the request's size with a box filter and write it as a PNG or
+ * an uncompressed KTX. The projection should have the aspect ratio of the
+ * headless size, the whole image is scaled. At most MaxEncodes copies wait
+ * for an encoder, Run encodes on the drawing thread as well beyond that.
+ *
+ * The service takes the renderer's readback callback over for its lifetime.
+ */
+class ThumbnailService {
+public:
+    static const uint32_t MaxEncodes = 256;
+
+    enum class Encoding {
+        Png,
+        Ktx
+    };
+    struct Request {
+        // what the loader loads, grouped by equality
+        std::string scene;
+        m3d::math::Matrix4x4 view;
+        m3d::math::Matrix4x4 projection;
+        // of the written image, 0 for the headless size
+        uint32_t width = 0;
+        uint32_t height = 0;
+        Encoding encoding = Encoding::Png;
+        std::string path;
+    };
+    // On the drawing thread, before the scene's first render: make it the renderer's, its geometry and textures
+    // resident. false skips its requests, they are reported as not written
+    typedef std::function<bool(const std::string& scene)> SceneLoader;
+    // The request's image is written, or could not be; on an encoder
+    typedef std::function<void(const Request& request, bool written)> DoneCallback;
+
+    ThumbnailService(RendererVulkan& renderer, SceneLoader loader, ThreadPool& encoders);
+    ~ThumbnailService();
+
+    void SetDoneCallback(DoneCallback callback) { done = callback; }
+    // Any thread
+    void Submit(const Request& request);
+    // Render and write every request submitted before the call, the number written
+    uint32_t Run();
+
+private:
+    struct Job {
+        Request request;
+        RgbaImage image;
+    };
+
+    void readback(uint64_t id, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch);
+    void encode(Job& job);
+    void finish(const Request& request, bool written);
+
+    RendererVulkan& renderer;
+    SceneLoader loader;
+    ThreadPool& encoders;
+    DoneCallback done;
+
+    std::mutex mutex;
+    std::vector<Request> submitted;
+    // of the Run in progress, by the ids RenderOffscreen got
+    std::vector<Request> running;
+    std::atomic<uint32_t> encodes{ 0 };
+    std::atomic<uint32_t> written{ 0 };
+};
+}
@@ -0,0 +1,83 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Scoped CPU zones on a timeline across threads.
+ *
+ *   M3D_TRACE_ZONE("LoadMeshes");    // the rest of the block
+ *   M3D_TRACE_THREAD("worker");      // the calling thread's name in the trace
+ *
+ * A zone is one event, pushed onto a ring of the calling thread when it ends.
+ * The rings are single producer, single consumer: the owning thread writes,
+ * Flush drains every thread's into the trace file, any thread may call it;
+ * a full ring drops events and counts them. Names must outlive the trace,
+ * string literals.
+ *
+ * The file is Chrome trace event JSON (chrome://tracing, Perfetto), which
+ * Tracy's import-chrome converts. M3D_TRACE decides whether the macros
+ * compile to anything, by default everything but NDEBUG builds.
+ */
+#if !defined(M3D_TRACE)
+#if defined(NDEBUG)
+#define M3D_TRACE 0
+#else
+#define M3D_TRACE 1
+#endif
+#endif
+
+namespace m3d {
+namespace trace {
+    // events per thread between two flushes
+    static const uint32_t RingSize = 64 * 1024;
+
+    // Start writing to path, events before it are dropped. false when the file can not be created
+    bool Begin(const char* path);
+    // Drain every thread's ring into the file, nothing without Begin
+    void Flush();
+    // Flush and close the file
+    void End();
+
+    // the calling thread's ring, created on its first event
+    void SetThreadName(const char* name);
+    void Record(const char* name, uint64_t beginNs, uint64_t endNs);
+
+    inline uint64_t Now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    class Zone {
+    public:
+        explicit Zone(const char* name)
+            : name(name)
+            , begin(Now())
+        {
+        }
+        ~Zone() { Record(name, begin, Now()); }
+
+    private:
+        const char* name;
+        uint64_t begin;
+    };
+}
+}
+
+#if M3D_TRACE
+#define M3D_TRACE_CONCAT_(a, b) a##b
+#define M3D_TRACE_CONCAT(a, b) M3D_TRACE_CONCAT_(a, b)
+#define M3D_TRACE_ZONE(name) ::m3d::trace::Zone M3D_TRACE_CONCAT(traceZone, __LINE__)(name)
+#define M3D_TRACE_THREAD(name) ::m3d::trace::SetThreadName(name)
+#else
+#define M3D_TRACE_ZONE(name)
+#define M3D_TRACE_THREAD(name)
+#endif
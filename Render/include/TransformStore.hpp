@@ -0,0 +1,95 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Matrix.h"
+
+namespace m3d {
+struct Transform;
+
+/*
+ * Structure of arrays copy of Scene::transforms with cached world matrices,
+ * each component stored four entries at a time (one SIMD register).
+ *
+ * Entries are addressed by the slot of the transform id, which chunked_freelist
+ * keeps stable, so the arrays only grow. Set() marks the group of four entries
+ * it falls into; Update() recomputes dirty groups four at a time with the
+ * SSE / NEON helpers of the Math library and leaves clean ones alone.
+ *
+ * Transforms are local to their parent. The parent table is flattened into a
+ * depth sorted order, parents ahead of children, so world matrices propagate
+ * in one linear pass that only multiplies nodes below a changed one.
+ *
+ * The slots whose world matrix Update recomputed pile up until TakeMoved, so
+ * a copy of the worlds elsewhere (the GPU's instance data) only rewrites
+ * those instead of all of them.
+ */
+class TransformStore {
+public:
+    static const uint32_t GroupSize = 4;
+    static const uint32_t NoParent = 0xFFFFFFFF;
+
+    void Set(uint32_t transformID, const Transform& transform);
+    // The slot is free for the id the freelist hands out next, children of it must be gone or moved first
+    void Remove(uint32_t transformID);
+    // Attach to parentID, NoParent makes it a root again. Cycles are not allowed.
+    void SetParent(uint32_t transformID, uint32_t parentID);
+    uint32_t GetParent(uint32_t transformID) const;
+    // Recompute local matrices of changed groups and the world matrices below them, returns the world count.
+    uint32_t Update();
+    void Clear();
+
+    // valid after Update, parent world * T * R * S
+    const m3d::math::Matrix4x4& GetWorld(uint32_t transformID) const { return worlds[slot(transformID)]; }
+    bool Contains(uint32_t transformID) const { return slot(transformID) < used.size() && used[slot(transformID)]; }
+    // Slots of the worlds Update recomputed since the last call, each once and in no particular order
+    void TakeMoved(std::vector<uint32_t>& slots);
+    static uint32_t Slot(uint32_t transformID) { return slot(transformID); }
+
+private:
+    static uint32_t slot(uint32_t transformID);
+    void grow(uint32_t count);
+    void sortByDepth();
+
+private:
+    // four entries per component, each loads with one aligned load
+    struct Group {
+        alignas(16) float positionX[GroupSize];
+        alignas(16) float positionY[GroupSize];
+        alignas(16) float positionZ[GroupSize];
+        alignas(16) float scaleX[GroupSize];
+        alignas(16) float scaleY[GroupSize];
+        alignas(16) float scaleZ[GroupSize];
+        alignas(16) float rotationX[GroupSize];
+        alignas(16) float rotationY[GroupSize];
+        alignas(16) float rotationZ[GroupSize];
+        alignas(16) float rotationW[GroupSize];
+    };
+    static void computeLocals(const Group& group, m3d::math::Matrix4x4* locals);
+
+    std::vector<Group> groups;
+    std::vector<m3d::math::Matrix4x4> locals;
+    std::vector<m3d::math::Matrix4x4> worlds;
+
+    std::vector<uint8_t> groupDirty;
+    std::vector<uint32_t> dirtyGroups;
+
+    // per slot: parent id or NoParent, set by Set, local or world changed since the last Update
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> used;
+    std::vector<uint8_t> changed;
+    // per slot: in movedSlots, the worlds recomputed since the last TakeMoved
+    std::vector<uint8_t> moved;
+    std::vector<uint32_t> movedSlots;
+    // used slots, parents ahead of their children, rebuilt when the hierarchy changes
+    std::vector<uint32_t> order;
+    bool orderDirty = false;
+};
+}
@@ -0,0 +1,76 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+
+/*
+ * Persistently mapped, host coherent uniform memory for per-frame and per-draw
+ * constants, bound as a dynamic uniform buffer.
+ *
+ * The buffer is split into one region per frame slot. BeginFrame() rewinds a
+ * slot once the GPU is done with it and Allocate() bumps through it, every
+ * slice aligned to minUniformBufferOffsetAlignment. The returned offset goes
+ * into bindDescriptorSets as the dynamic offset, so nothing is ever mapped,
+ * unmapped or rewritten while a frame in flight reads it.
+ *
+ * Allocate() may run on several recording threads at once.
+ */
+class UniformRing {
+public:
+    static const vk::DeviceSize DefaultFrameBytes = 2 * 1024 * 1024;
+
+    struct Allocation {
+        // host pointer to write the constants to, nullptr when the slot is full
+        void* data;
+        uint32_t offset;
+    };
+
+    UniformRing(vk::Device&, vk::PhysicalDevice&, uint32_t frameSlots, vk::DeviceSize frameBytes = DefaultFrameBytes);
+    ~UniformRing();
+
+    // Rewind slot and allocate from it, the caller guarantees no submitted frame still reads its region
+    void BeginFrame(uint32_t slot);
+    Allocation Allocate(vk::DeviceSize size);
+    // Copy value into a new slice and return its dynamic offset, the slot's first offset when it is full
+    template<class T>
+    uint32_t Push(const T& value)
+    {
+        Allocation allocation = Allocate(sizeof(T));
+        if (!allocation.data) {
+            return GetFrameOffset(currentSlot);
+        }
+        memcpy(allocation.data, &value, sizeof(T));
+        return allocation.offset;
+    }
+
+    // Where BeginFrame's first allocation of slot lands
+    uint32_t GetFrameOffset(uint32_t slot) const { return static_cast<uint32_t>((slot % frameSlots) * frameBytes); }
+    uint32_t GetFrameSlots() const { return frameSlots; }
+    vk::Buffer GetBuffer() const { return buffer; }
+
+private:
+    vk::Device& device;
+    uint32_t frameSlots;
+    vk::DeviceSize frameBytes;
+    vk::DeviceSize alignment;
+
+    vk::Buffer buffer;
+    vk::DeviceMemory memory;
+    uint8_t* mapped;
+
+    uint32_t currentSlot;
+    // bytes handed out of the current slot
+    std::atomic<vk::DeviceSize> cursor;
+    std::atomic<bool> overflowReported;
+};
+}
@@ -0,0 +1,114 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace m3d {
+class SubmitTimeline;
+
+/*
+ * Streaming uploads on a transfer queue.
+ *
+ * Source data is copied, or written by the caller (Stage), into a persistently
+ * mapped staging ring and the copy commands are recorded into an open batch. Submit() closes the batch and
+ * defers it on the queue's SubmitTimeline, whose owner flushes it once per frame; Poll() retires finished batches in
+ * submission order, recycles their ring space and runs the completion
+ * callbacks. Nothing in here waits on the queue unless the ring is full.
+ */
+class UploadQueue {
+public:
+    typedef std::function<void()> Callback;
+
+    // Ring space handed out by Stage, the caller writes the source data into data itself
+    struct Staging {
+        uint8_t* data;
+        vk::DeviceSize size;
+        vk::Buffer buffer;
+        vk::DeviceSize offset;
+    };
+
+    static const vk::DeviceSize DefaultRingSize = 64 * 1024 * 1024;
+
+    // submits to the queue of timeline, of family queueFamilyIndex
+    UploadQueue(vk::Device&, vk::PhysicalDevice&, SubmitTimeline& timeline, uint32_t queueFamilyIndex, uint32_t graphicsFamilyIndex, vk::DeviceSize ringSize = DefaultRingSize);
+    ~UploadQueue();
+
+    void CopyToBuffer(const void* data, vk::DeviceSize size, vk::Buffer dst, vk::DeviceSize dstOffset);
+    // regions are relative to the start of data, the image ends up in finalLayout. The range is transitioned from
+    // initialLayout, undefined discards what it held; with eGeneral on both sides the copy runs in place.
+    void CopyToImage(const void* data, vk::DeviceSize size, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions,
+        const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout, vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined);
+
+    // Reserve size bytes of mapped staging memory, so a decoder or parser writes the texels there once instead of
+    // into a buffer of its own that is copied again. Record the copy out of it with the Staging overloads of
+    // CopyToBuffer or CopyToImage before anything else is staged, the space may be recycled after that.
+    Staging Stage(vk::DeviceSize size);
+    // all of staged
+    void CopyToBuffer(const Staging& staged, vk::Buffer dst, vk::DeviceSize dstOffset);
+    // scattered ranges of staged in one copy, the regions' srcOffset is relative to the start of staged
+    void CopyToBuffer(const Staging& staged, vk::Buffer dst, const std::vector<vk::BufferCopy>& regions);
+    // regions are relative to the start of staged
+    void CopyToImage(const Staging& staged, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions,
+        const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout, vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined);
+
+    // Close the open batch and submit it, onComplete runs from Poll() once the GPU is done with it.
+    void Submit(Callback onComplete = Callback());
+    // Retire finished batches and run their callbacks, call once per frame.
+    void Poll();
+    // Block until every submitted batch has finished.
+    void WaitIdle();
+    // Nothing staged or waiting for Poll
+    bool IsIdle() const { return !batchOpen && inFlight.empty(); }
+
+    // Resources written here and read on the graphics queue have to be shared between both families.
+    const std::vector<uint32_t>& GetSharingFamilies() const { return sharingFamilies; }
+    uint32_t GetQueueFamilyIndex() const { return queueFamilyIndex; }
+    // Source bytes of every copy so far, the difference between two calls is what was uploaded in between
+    uint64_t GetUploadedBytes() const { return uploadedBytes; }
+
+private:
+    struct Batch {
+        vk::CommandBuffer cmd;
+        // SubmitTimeline value
+        uint64_t value;
+        uint64_t ringEnd;
+        std::vector<std::pair<vk::Buffer, vk::DeviceMemory>> overflow;
+        std::vector<Callback> callbacks;
+    };
+
+    void beginBatch();
+    void submitBatch();
+    void retire(Batch& batch);
+
+private:
+    vk::Device& device;
+    vk::PhysicalDevice& physicalDevice;
+    SubmitTimeline& timeline;
+    uint32_t queueFamilyIndex;
+    std::vector<uint32_t> sharingFamilies;
+
+    vk::CommandPool cmdPool;
+
+    /* Staging ring, head and tail are running byte counters */
+    vk::Buffer ringBuffer;
+    vk::DeviceMemory ringMemory;
+    uint8_t* ringMapped;
+    vk::DeviceSize ringSize;
+    uint64_t ringHead;
+    uint64_t ringTail;
+    uint64_t uploadedBytes;
+
+    bool batchOpen;
+    Batch openBatch;
+    std::deque<Batch> inFlight;
+    std::vector<vk::CommandBuffer> freeCmdBuffers;
+};
+}
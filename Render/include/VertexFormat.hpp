@@ -0,0 +1,154 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "SIMD_Batch.h"
+
+namespace m3d {
+
+/*
+ * Interleaved vertex layouts described once, at compile time.
+ *
+ *     typedef VertexFormat<PackedVertex,
+ *         VertexAttribute<VertexSemantic::Position, vk::Format::eR32G32B32Sfloat, offsetof(PackedVertex, position)>,
+ *         ...> PackedVertexFormat;
+ *
+ * gives the vertex input descriptions of the pipelines, a constant array the
+ * compiler builds, and Pack, which fills the vertices from float streams with
+ * the batched conversions of each format. A semantic is the shader location it
+ * is read from, a format without VertexFormatTraits does not compile.
+ */
+enum class VertexSemantic : uint32_t {
+    Position = 0,
+    // octahedral unit normal, two components in [-1, 1]
+    Normal = 1,
+    UV = 2,
+    Count
+};
+
+// How floats become the components of a format
+template <vk::Format F>
+struct VertexFormatTraits;
+
+template <>
+struct VertexFormatTraits<vk::Format::eR32G32B32Sfloat> {
+    typedef float Component;
+    static const uint32_t Components = 3;
+    static void Encode(const float* values, size_t count, Component* out) { memcpy(out, values, count * sizeof(float)); }
+};
+
+template <>
+struct VertexFormatTraits<vk::Format::eR16G16Snorm> {
+    typedef int16_t Component;
+    static const uint32_t Components = 2;
+    static void Encode(const float* values, size_t count, Component* out) { math::FloatToSnorm16Array(values, out, count); }
+};
+
+template <>
+struct VertexFormatTraits<vk::Format::eR16G16Sfloat> {
+    typedef uint16_t Component;
+    static const uint32_t Components = 2;
+    static void Encode(const float* values, size_t count, Component* out) { math::FloatToHalfArray(values, out, count); }
+};
+
+template <VertexSemantic S, vk::Format F, uint32_t O>
+struct VertexAttribute {
+    static const VertexSemantic Semantic = S;
+    static const vk::Format Format = F;
+    static const uint32_t Offset = O;
+    typedef VertexFormatTraits<F> Traits;
+    static const uint32_t Size = Traits::Components * sizeof(typename Traits::Component);
+};
+
+// Source of one semantic for Pack, stride floats apart. Without values the attribute is left zero
+struct VertexStream {
+    const float* values = nullptr;
+    uint32_t stride = 0;
+};
+
+namespace vertex_format {
+    constexpr uint32_t maxEnd() { return 0; }
+    template <typename... Rest>
+    constexpr uint32_t maxEnd(uint32_t first, Rest... rest)
+    {
+        return first > maxEnd(rest...) ? first : maxEnd(rest...);
+    }
+}
+
+template <typename Vertex, typename... Attributes>
+struct VertexFormat {
+    static const uint32_t AttributeCount = sizeof...(Attributes);
+    static_assert(vertex_format::maxEnd((Attributes::Offset + Attributes::Size)...) <= sizeof(Vertex), "an attribute ends past the vertex");
+
+    // binding 0, in the order of Attributes
+    static constexpr VkVertexInputAttributeDescription descriptions[AttributeCount] = {
+        { static_cast<uint32_t>(Attributes::Semantic), 0, static_cast<VkFormat>(Attributes::Format), Attributes::Offset }...
+    };
+
+    static vk::VertexInputBindingDescription Binding()
+    {
+        return vk::VertexInputBindingDescription(0, sizeof(Vertex), vk::VertexInputRate::eVertex);
+    }
+    // the layout is the one of the C struct, as vulkan.hpp asserts
+    static const vk::VertexInputAttributeDescription* Descriptions() { return reinterpret_cast<const vk::VertexInputAttributeDescription*>(descriptions); }
+    // vk::Format::eUndefined when the format has no such attribute
+    static vk::VertexInputAttributeDescription Attribute(VertexSemantic semantic)
+    {
+        for (uint32_t i = 0; i < AttributeCount; ++i) {
+            if (descriptions[i].location == static_cast<uint32_t>(semantic)) {
+                return descriptions[i];
+            }
+        }
+        return vk::VertexInputAttributeDescription();
+    }
+
+    // Fill count vertices, streams indexed by VertexSemantic. Each attribute is converted in one batch
+    static void Pack(const VertexStream (&streams)[static_cast<size_t>(VertexSemantic::Count)], size_t count, Vertex* vertices)
+    {
+        std::vector<float> gathered;
+        std::vector<uint8_t> encoded;
+        const int expand[] = { 0, (pack<Attributes>(streams[static_cast<size_t>(Attributes::Semantic)], count, vertices, gathered, encoded), 0)... };
+        (void)expand;
+    }
+
+private:
+    template <typename Attribute>
+    static void pack(const VertexStream& stream, size_t count, Vertex* vertices, std::vector<float>& gathered, std::vector<uint8_t>& encoded)
+    {
+        const uint32_t components = Attribute::Traits::Components;
+        uint8_t* first = reinterpret_cast<uint8_t*>(vertices) + Attribute::Offset;
+        if (!stream.values) {
+            for (size_t i = 0; i < count; ++i) {
+                memset(first + i * sizeof(Vertex), 0, Attribute::Size);
+            }
+            return;
+        }
+        const float* values = stream.values;
+        if (stream.stride != components) {
+            gathered.resize(count * components);
+            for (size_t i = 0; i < count; ++i) {
+                memcpy(&gathered[i * components], stream.values + i * stream.stride, components * sizeof(float));
+            }
+            values = gathered.data();
+        }
+        encoded.resize(count * Attribute::Size);
+        Attribute::Traits::Encode(values, count * components, reinterpret_cast<typename Attribute::Traits::Component*>(encoded.data()));
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(first + i * sizeof(Vertex), &encoded[i * Attribute::Size], Attribute::Size);
+        }
+    }
+};
+
+template <typename Vertex, typename... Attributes>
+constexpr VkVertexInputAttributeDescription VertexFormat<Vertex, Attributes...>::descriptions[];
+}
@@ -6,10 +6,25 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vulkan/vulkan.hpp>
 
+#include "File.hpp"
+
 namespace vkhelper
 {
+	// SPIR-V straight from the mapped file, a null handle when the file cannot be opened
+	static vk::ShaderModule loadShaderModule(const vk::Device& device, const char* fileName) {
+		auto file = m3d::file::MappedFile::open(fileName);
+		if (!file) {
+			return vk::ShaderModule();
+		}
+		vk::ShaderModuleCreateInfo moduleCreateInfo;
+		moduleCreateInfo.codeSize = file->size();
+		moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(file->data());
+		return device.createShaderModule(moduleCreateInfo);
+	}
+
 	static vk::Bool32 checkDeviceExtensionPresent(vk::PhysicalDevice &physicalDevice, const char* extensionName) {
 		uint32_t extensionCount = 0;
 		std::vector<vk::ExtensionProperties> extensions = physicalDevice.enumerateDeviceExtensionProperties();
@@ -35,6 +50,18 @@ namespace vkhelper
 		throw std::runtime_error("No queue matches the flags " + vk::to_string(flags));
 	}
 
+	// Find a queue family supporting flags but none of the excluded flags, e.g. a transfer only (DMA) queue
+	static bool findDedicatedQueue(vk::PhysicalDevice& physicalDevice, const vk::QueueFlags& flags, const vk::QueueFlags& excluded, uint32_t* index) {
+		std::vector<vk::QueueFamilyProperties> queueProps = physicalDevice.getQueueFamilyProperties();
+		for (uint32_t i = 0; i < queueProps.size(); i++) {
+			if ((queueProps[i].queueFlags & flags) == flags && !(queueProps[i].queueFlags & excluded)) {
+				*index = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
 	static vk::Bool32 getMemoryType(vk::PhysicalDevice& device, uint32_t typeBits, const vk::MemoryPropertyFlags& properties, uint32_t * typeIndex) {
 		for (uint32_t i = 0; i < 32; i++) {
 			if ((typeBits & 1) == 1) {
@@ -56,6 +83,70 @@ namespace vkhelper
 		return result;
 	}
 
+	// Bytes of the device local heaps, shared system memory for most integrated GPUs
+	static vk::DeviceSize getDeviceLocalMemory(const vk::PhysicalDevice& physicalDevice) {
+		vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+		vk::DeviceSize bytes = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+				bytes += memoryProperties.memoryHeaps[i].size;
+			}
+		}
+		return bytes;
+	}
+
+	// Higher is better, 0 for devices without a graphics queue. The device type decides first (discrete, integrated,
+	// virtual, CPU), then the device local memory in MiB, then a transfer only and a compute only queue family
+	static uint64_t scorePhysicalDevice(const vk::PhysicalDevice& physicalDevice) {
+		std::vector<vk::QueueFamilyProperties> queueProps = physicalDevice.getQueueFamilyProperties();
+		bool graphics = false;
+		uint64_t queueScore = 0;
+		for (auto& props : queueProps) {
+			graphics |= static_cast<bool>(props.queueFlags & vk::QueueFlagBits::eGraphics);
+			if ((props.queueFlags & vk::QueueFlagBits::eTransfer) && !(props.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))) {
+				queueScore |= 2;
+			}
+			if ((props.queueFlags & vk::QueueFlagBits::eCompute) && !(props.queueFlags & vk::QueueFlagBits::eGraphics)) {
+				queueScore |= 1;
+			}
+		}
+		if (!graphics) {
+			return 0;
+		}
+
+		uint64_t typeScore = 1;
+		switch (physicalDevice.getProperties().deviceType) {
+		case vk::PhysicalDeviceType::eDiscreteGpu: typeScore = 5; break;
+		case vk::PhysicalDeviceType::eIntegratedGpu: typeScore = 4; break;
+		case vk::PhysicalDeviceType::eVirtualGpu: typeScore = 3; break;
+		case vk::PhysicalDeviceType::eCpu: typeScore = 2; break;
+		default: break;
+		}
+		// 40 bits of MiB are far beyond any heap
+		const uint64_t memoryScore = std::min<uint64_t>(getDeviceLocalMemory(physicalDevice) >> 20, (1ull << 40) - 1);
+		return (typeScore << 56) | (memoryScore << 2) | queueScore;
+	}
+
+	// Best first by scorePhysicalDevice, devices without a graphics queue are left out. Equal devices keep the
+	// enumeration order, so an index into the result names the same device on every run
+	static std::vector<vk::PhysicalDevice> rankPhysicalDevices(const std::vector<vk::PhysicalDevice>& physicalDevices) {
+		std::vector<std::pair<uint64_t, vk::PhysicalDevice>> scored;
+		for (auto& physicalDevice : physicalDevices) {
+			const uint64_t score = scorePhysicalDevice(physicalDevice);
+			if (score > 0) {
+				scored.push_back(std::make_pair(score, physicalDevice));
+			}
+		}
+		std::stable_sort(scored.begin(), scored.end(), [](const std::pair<uint64_t, vk::PhysicalDevice>& a, const std::pair<uint64_t, vk::PhysicalDevice>& b) {
+			return a.first > b.first;
+		});
+		std::vector<vk::PhysicalDevice> ranked;
+		for (auto& device : scored) {
+			ranked.push_back(device.second);
+		}
+		return ranked;
+	}
+
 	static bool getSupportedDepthFormat(vk::PhysicalDevice &physicalDevice, vk::Format& depthFormat)
 	{
 		// Since all depth formats may be optional, we need to find a suitable depth format to use
@@ -205,6 +296,65 @@ namespace vkhelper
 		cmdbuffer.pipelineBarrier(srcStageFlags, destStageFlags, vk::DependencyFlags(), nullptr, nullptr, imageMemoryBarrier);
 	}
 
+	// Whether vkCmdBlitImage can build the mip chain of format: blits from and to optimal tiling, linear filtered
+	static bool canGenerateMipmaps(vk::PhysicalDevice& physicalDevice, vk::Format format)
+	{
+		const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		return (physicalDevice.getFormatProperties(format).optimalTilingFeatures & needed) == needed;
+	}
+
+	// Levels of the full chain down to 1x1
+	static uint32_t mipLevelCount(uint32_t width, uint32_t height)
+	{
+		uint32_t levels = 1;
+		while ((width | height) >> levels) {
+			++levels;
+		}
+		return levels;
+	}
+
+	// Fill levels 1 to mipLevels - 1 of every layer by halving the level above with linear blits, on a graphics queue.
+	// Every level starts out in TRANSFER_DST_OPTIMAL with level 0 written, and ends up in SHADER_READ_ONLY_OPTIMAL
+	static void generateMipmaps(
+		vk::CommandBuffer cmdbuffer,
+		vk::Image image,
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevels,
+		uint32_t layerCount = 1)
+	{
+		vk::ImageMemoryBarrier barrier;
+		barrier.image = image;
+		barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, layerCount);
+		for (uint32_t level = 1; level <= mipLevels; ++level) {
+			// the level above is written, read it from now on
+			barrier.subresourceRange.baseMipLevel = level - 1;
+			barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+			barrier.newLayout = level < mipLevels ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+			barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+			barrier.dstAccessMask = level < mipLevels ? vk::AccessFlagBits::eTransferRead : vk::AccessFlagBits::eShaderRead;
+			cmdbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+				level < mipLevels ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+			if (level == mipLevels) {
+				break;
+			}
+
+			vk::ImageBlit blit;
+			blit.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, layerCount);
+			blit.srcOffsets[1] = vk::Offset3D(std::max<int32_t>(width >> (level - 1), 1), std::max<int32_t>(height >> (level - 1), 1), 1);
+			blit.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, layerCount);
+			blit.dstOffsets[1] = vk::Offset3D(std::max<int32_t>(width >> level, 1), std::max<int32_t>(height >> level, 1), 1);
+			cmdbuffer.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image, vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eLinear);
+
+			// done reading the level above
+			barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+			barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+			barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+			cmdbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+		}
+	}
+
 	// Fixed sub resource on first mip level and layer
 	static void setImageLayout(
 		vk::CommandBuffer cmdbuffer,
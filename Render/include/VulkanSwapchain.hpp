@@ -11,8 +11,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
 #include <fstream>
+#include <functional>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -27,7 +29,7 @@
 #include <vulkan/vulkan.hpp>
 
 #ifdef __ANDROID__
-#include "vulkanandroid.h"
+#include <android/native_window.h>
 #endif
 
 namespace m3d {
@@ -51,10 +53,24 @@ public:
 
     std::vector<vk::Image> images;
     std::vector<SwapChainBuffer> buffers;
+    /** @brief Size of the swapchain images, every render target follows it */
+    vk::Extent2D extent = {};
     // Index of the deteced graphics and presenting device queue
     /** @brief Queue family index of the detected graphics and presenting device queue */
     uint32_t queueNodeIndex = UINT32_MAX;
 
+    /** @brief Present mode create asks for, see selectPresentMode for the fallbacks */
+    vk::PresentModeKHR requestedPresentMode = vk::PresentModeKHR::eMailbox;
+    /** @brief Images create asks for, 0 for one more than the surface's minimum; clamped to what the surface allows */
+    uint32_t requestedImageCount = 0;
+    /** @brief Usage create adds to COLOR_ATTACHMENT, e.g. TRANSFER_DST for images filled by copies */
+    vk::ImageUsageFlags requestedUsage = {};
+    /** @brief Present mode of the current swap chain */
+    vk::PresentModeKHR presentMode = vk::PresentModeKHR::eFifo;
+
+    /** @brief Surface of the last initSurface, e.g. for its capabilities before create */
+    vk::SurfaceKHR getSurface() const { return surface; }
+
     // Creates an os specific surface
     /**
 		* Create the surface object, an abstraction for the native platform window
@@ -97,10 +113,9 @@ public:
         surface = instance.createWin32SurfaceKHR(surfaceInfo);
 #else
 #ifdef __ANDROID__
-        VkAndroidSurfaceCreateInfoKHR surfaceCreateInfo = {};
-        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_ANDROID_SURFACE_CREATE_INFO_KHR;
-        surfaceCreateInfo.window = window;
-        err = vkCreateAndroidSurfaceKHR(instance, &surfaceCreateInfo, NULL, &surface);
+        vk::AndroidSurfaceCreateInfoKHR surfaceInfo = vk::AndroidSurfaceCreateInfoKHR()
+                                                          .setWindow(window);
+        surface = instance.createAndroidSurfaceKHR(surfaceInfo);
 #else
 #if defined(_DIRECT2DISPLAY)
         createDirect2DisplaySurface(width, height);
@@ -206,9 +221,15 @@ public:
 		*
 		* @param width Pointer to the width of the swapchain (may be adjusted to fit the requirements of the swapchain)
 		* @param height Pointer to the height of the swapchain (may be adjusted to fit the requirements of the swapchain)
-		* @param vsync (Optional) Can be used to force vsync'd rendering (by using VK_PRESENT_MODE_FIFO_KHR as presentation mode)
+		* @param vsync (Optional) Can be used to force vsync'd rendering (by using VK_PRESENT_MODE_FIFO_KHR as presentation mode),
+		* requestedPresentMode otherwise
+		* @param retire (Optional) Takes over the old swapchain and its image views instead of destroying them right away,
+		* frames still in flight may reference them
+		*
+		* @return false if the surface currently has no area (minimized window), the old swapchain is kept then
 		*/
-    void create(uint32_t* width, uint32_t* height, bool vsync = false)
+    typedef std::function<void(vk::SwapchainKHR, const std::vector<SwapChainBuffer>&)> RetireCallback;
+    bool create(uint32_t* width, uint32_t* height, bool vsync = false, RetireCallback retire = RetireCallback())
     {
         //VkResult err;
         vk::SwapchainKHR oldSwapchain = swapChain;
@@ -234,29 +255,17 @@ public:
             *width = surfCaps.currentExtent.width;
             *height = surfCaps.currentExtent.height;
         }
+        if (swapchainExtent.width == 0 || swapchainExtent.height == 0) {
+            return false;
+        }
+        extent = swapchainExtent;
 
         // Select a present mode for the swapchain
-
-        // The VK_PRESENT_MODE_FIFO_KHR mode must always be present as per spec
-        // This mode waits for the vertical blank ("v-sync")
-        vk::PresentModeKHR swapchainPresentMode = vk::PresentModeKHR::eFifo;
-
-        // If v-sync is not requested, try to find a mailbox mode
-        // It's the lowest latency non-tearing present mode available
-        if (!vsync) {
-            for (size_t i = 0; i < presentModes.size(); i++) {
-                if (presentModes[i] == vk::PresentModeKHR::eMailbox) {
-                    swapchainPresentMode = vk::PresentModeKHR::eMailbox;
-                    break;
-                }
-                if ((swapchainPresentMode != vk::PresentModeKHR::eMailbox) && (presentModes[i] == vk::PresentModeKHR::eImmediate)) {
-                    swapchainPresentMode = vk::PresentModeKHR::eImmediate;
-                }
-            }
-        }
+        presentMode = vsync ? vk::PresentModeKHR::eFifo : selectPresentMode(requestedPresentMode, presentModes);
 
         // Determine the number of images
-        uint32_t desiredNumberOfSwapchainImages = surfCaps.minImageCount + 1;
+        uint32_t desiredNumberOfSwapchainImages = requestedImageCount > 0 ? requestedImageCount : surfCaps.minImageCount + 1;
+        desiredNumberOfSwapchainImages = std::max(desiredNumberOfSwapchainImages, surfCaps.minImageCount);
         if ((surfCaps.maxImageCount > 0) && (desiredNumberOfSwapchainImages > surfCaps.maxImageCount)) {
             desiredNumberOfSwapchainImages = surfCaps.maxImageCount;
         }
@@ -278,13 +287,13 @@ public:
         swapchainCI.imageFormat = colorFormat;
         swapchainCI.imageColorSpace = colorSpace;
         swapchainCI.imageExtent = { swapchainExtent.width, swapchainExtent.height };
-        swapchainCI.imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+        swapchainCI.imageUsage = vk::ImageUsageFlagBits::eColorAttachment | requestedUsage;
         swapchainCI.preTransform = preTransform;
         swapchainCI.imageArrayLayers = 1;
         swapchainCI.imageSharingMode = vk::SharingMode::eExclusive;
         swapchainCI.queueFamilyIndexCount = 0;
         swapchainCI.pQueueFamilyIndices = NULL;
-        swapchainCI.presentMode = swapchainPresentMode;
+        swapchainCI.presentMode = presentMode;
         swapchainCI.oldSwapchain = oldSwapchain;
         // Setting clipped to VK_TRUE allows the implementation to discard rendering outside of the surface area
         swapchainCI.clipped = VK_TRUE;
@@ -304,7 +313,9 @@ public:
 
         // If an existing swap chain is re-created, destroy the old swap chain
         // This also cleans up all the presentable images
-        if (oldSwapchain) {
+        if (oldSwapchain && retire) {
+            retire(oldSwapchain, buffers);
+        } else if (oldSwapchain) {
             for (uint32_t i = 0; i < images.size(); i++) {
                 //vkDestroyImageView(device, buffers[i].view, nullptr);
                 device.destroyImageView(buffers[i].view);
@@ -344,6 +355,32 @@ public:
             buffers[i].view = device.createImageView(colorAttachmentView);
             //assert(!err);
         }
+        return true;
+    }
+
+    /**
+		* Pick the present mode closest to the requested one
+		*
+		* The VK_PRESENT_MODE_FIFO_KHR mode must always be present as per spec, it waits for the vertical blank
+		* ("v-sync") and lets the GPU idle between frames. Mailbox and immediate stand in for each other, both
+		* present as soon as a frame is done, mailbox without tearing; FIFO relaxed falls back to FIFO.
+		*
+		* @return The requested mode if the surface supports it, the fallback otherwise
+		*/
+    static vk::PresentModeKHR selectPresentMode(vk::PresentModeKHR requested, const std::vector<vk::PresentModeKHR>& presentModes)
+    {
+        std::vector<vk::PresentModeKHR> candidates(1, requested);
+        if (requested == vk::PresentModeKHR::eMailbox) {
+            candidates.push_back(vk::PresentModeKHR::eImmediate);
+        } else if (requested == vk::PresentModeKHR::eImmediate) {
+            candidates.push_back(vk::PresentModeKHR::eMailbox);
+        }
+        for (vk::PresentModeKHR candidate : candidates) {
+            if (std::find(presentModes.begin(), presentModes.end(), candidate) != presentModes.end()) {
+                return candidate;
+            }
+        }
+        return vk::PresentModeKHR::eFifo;
     }
 
     /**
@@ -385,7 +422,30 @@ public:
             presentInfo.pWaitSemaphores = &waitSemaphore;
             presentInfo.waitSemaphoreCount = 1;
         }
-        return queue.presentKHR(presentInfo);
+        // out of date / suboptimal is reported to the caller instead of thrown
+        return queue.presentKHR(&presentInfo);
+    }
+
+    /**
+		* Destroy the swapchain and the surface when the native window goes away (Android pauses)
+		*
+		* @note No frame may still use the swapchain images, initSurface and create bring them back
+		*/
+    void destroySurface()
+    {
+        for (auto& buffer : buffers) {
+            device.destroyImageView(buffer.view);
+        }
+        buffers.clear();
+        images.clear();
+        if (swapChain) {
+            device.destroySwapchainKHR(swapChain);
+            swapChain = vk::SwapchainKHR();
+        }
+        if (surface) {
+            instance.destroySurfaceKHR(surface);
+            surface = vk::SurfaceKHR();
+        }
     }
 
     /**
@@ -0,0 +1,151 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Bounds.hpp"
+#include "File.hpp"
+#include "Matrix.h"
+#include "Scene.hpp"
+
+namespace m3d {
+class ThreadPool;
+
+// Split scene into square cells of cellSize on the ground plane (x and z) and cook each into a scene of its own,
+// "<path>_x_z.m3dc" next to the index at path. An instance goes to the cell its world box is centered in, with its
+// transform and the transform's parents, its mesh, the mesh's materials and their diffuse maps. A mesh instanced in
+// several cells is in each of their files. The meshes need their geometry, animations, lights and cameras are not
+// written. False when a file could not be written
+bool CookWorld(Scene& scene, const std::string& path, float cellSize, bool compressGeometry = true);
+
+/*
+ * Keeps the cells of a CookWorld index around the viewer resident in one Scene.
+ *
+ * Cells within the load radius are read by a file::AsyncReader nearest first
+ * and decoded on worker threads into scenes of their own, Poll() merges them
+ * into the target scene on the calling thread and removes the cells beyond
+ * the unload radius again, so the scene only ever holds the world near the
+ * viewer. Distances are on the ground plane, to the cell's box.
+ */
+class WorldStreamer {
+public:
+    struct Settings {
+        // cells this near are loaded
+        float loadRadius = 256.0f;
+        // resident cells this far are unloaded, above loadRadius so a viewer on a cell border does not load and
+        // unload the cell over and over
+        float unloadRadius = 320.0f;
+        // geometry bytes of the cells resident and loading; a cell over it unloads farther resident cells first,
+        // farthest first, and waits when that does not make room
+        uint64_t budgetBytes = 512ull * 1024 * 1024;
+        // cells read and decoded at the same time
+        uint32_t maxLoading = 4;
+        // cells one Poll merges, merging copies a cell's objects on the drawing thread
+        uint32_t maxMerges = 1;
+        // leave the cells' geometry encoded, RendererVulkan::GetGpuGeometryDecode
+        bool gpuGeometryDecode = false;
+    };
+
+    struct Stats {
+        uint32_t cells = 0;
+        uint32_t resident = 0;
+        uint32_t loading = 0;
+        uint64_t residentBytes = 0;
+        // since Open
+        uint64_t loaded = 0;
+        uint64_t unloaded = 0;
+        // loads dropped because the viewer went out of their range first
+        uint64_t cancelled = 0;
+        uint64_t failed = 0;
+    };
+
+    // Runs for a cell about to leave the scene, with the objects its merge created, while they still exist
+    typedef std::function<void(const MergedIDs& cell)> ReleaseCallback;
+
+    // threadCount cells are decoded at the same time
+    explicit WorldStreamer(uint32_t threadCount = 1);
+    ~WorldStreamer();
+
+    WorldStreamer(const WorldStreamer&) = delete;
+    WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+    // Read the index CookWorld wrote, false if it could not be read or cells of the index opened before are still
+    // resident or loading, Clear them first
+    bool Open(const std::string& indexPath);
+    void SetSettings(const Settings& settings);
+    const Settings& GetSettings() const { return settings; }
+    void SetViewer(const m3d::math::Vector3& position);
+
+    // Unload the cells out of range, start loads of the ones in range and merge those that finished, true when
+    // scene changed. release runs before a cell's instances, meshes, materials, diffuse maps and transforms are
+    // erased from scene; whatever it erased itself is skipped
+    bool Poll(Scene& scene, const ReleaseCallback& release = ReleaseCallback());
+    // Unload every resident cell and drop the loads
+    void Clear(Scene& scene, const ReleaseCallback& release = ReleaseCallback());
+
+    // nothing loading or waiting to be merged, a Poll only changes the scene when the viewer moved
+    bool Idle() const;
+    Stats GetStats() const;
+
+private:
+    enum class CellState {
+        Unloaded,
+        Loading,
+        // decoded, waiting for a Poll to merge it
+        Loaded,
+        Resident
+    };
+    struct Cell {
+        int32_t x, z;
+        Aabb bounds;
+        uint64_t bytes;
+        std::string path;
+        CellState state = CellState::Unloaded;
+        file::AsyncReader::Request request = 0;
+        // what the merge created, and the file its meshes point into
+        MergedIDs ids;
+        std::shared_ptr<const file::MappedFile> file;
+    };
+    struct Decoded {
+        uint32_t cell;
+        // null when the file could not be read or is not a cooked scene
+        std::unique_ptr<Scene> scene;
+        std::vector<uint32_t> meshIDs;
+    };
+
+    float distance(const Cell& cell) const;
+    void load(uint32_t cellIndex);
+    void decode(uint32_t cellIndex, std::shared_ptr<const file::MappedFile> file, bool gpuGeometryDecode);
+    void merge(Scene& scene, Decoded& result);
+    void unload(Scene& scene, uint32_t cellIndex, const ReleaseCallback& release);
+    // drop a load that did not merge yet, a read already running is dropped once its decode finished
+    void drop(uint32_t cellIndex);
+
+private:
+    std::unique_ptr<file::AsyncReader> reader;
+    std::unique_ptr<ThreadPool> threads;
+    Settings settings;
+    m3d::math::Vector3 viewer;
+    std::vector<Cell> cells;
+    // of Loading and Loaded cells
+    uint64_t loadingBytes = 0;
+    uint64_t residentBytes = 0;
+    Stats stats;
+
+    // shared with the reader and the workers
+    std::mutex mutex;
+    std::vector<Decoded> decoded;
+    // Loaded cells, in the order they finished
+    std::vector<Decoded> ready;
+};
+}
@@ -0,0 +1,375 @@
+#pragma once
+
+// growable variant of packed_freelist with stable object addresses and a concurrent insert path
+//
+// * ids are 32 bit: the 22 LSBs index a slot, the 10 MSBs count how often the slot was reused
+// * objects live in fixed size chunks that are allocated on demand and never move, so references
+//   and ids stay valid while other threads insert
+// * iteration walks a packed array of the live ids, erase swaps the last id into the hole
+//
+// insert / emplace may run on any number of threads at once, also while other threads read
+// objects through existing ids. erase, clear and iteration must not overlap with any insert.
+//
+// for_each and parallel_for_each read the packed ids a chunk at a time instead of looking each
+// one up, objects are in slot order so a list that is mostly appended to streams them linearly
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<class T>
+class chunked_freelist
+{
+public:
+    static const uint32_t index_bits = 22;
+    static const uint32_t index_mask = (1u << index_bits) - 1;
+    static const uint32_t max_objects = index_mask;
+    static const uint32_t chunk_bits = 10;
+    static const uint32_t chunk_size = 1u << chunk_bits;
+    static const uint32_t max_chunks = (max_objects + chunk_size - 1) / chunk_size;
+
+private:
+    struct slot_t
+    {
+        // reuse count, the MSBs of the id
+        uint32_t generation;
+        // position of the id in the packed id array
+        uint32_t dense_index;
+        bool alive;
+    };
+
+    struct chunk_t
+    {
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type objects[chunk_size];
+        slot_t slots[chunk_size];
+    };
+
+    // chunk tables are fixed size so lookups never race with a reallocation
+    std::atomic<chunk_t*> _chunks[max_chunks];
+    std::atomic<uint32_t*> _id_chunks[max_chunks];
+
+    // slots ever handed out, erased ones are recycled through _free first
+    std::atomic<uint32_t> _next_slot;
+    // live objects, also the length of the packed id array
+    std::atomic<uint32_t> _num_objects;
+
+    std::mutex _free_mutex;
+    std::vector<uint32_t> _free;
+    std::atomic<uint32_t> _num_free;
+    // erase calls, erase never overlaps with anything
+    uint64_t _num_erased;
+
+public:
+    struct iterator
+    {
+        iterator(const chunked_freelist* list, uint32_t position)
+            : _list(list)
+            , _position(position)
+        {
+        }
+
+        iterator& operator++()
+        {
+            _position++;
+            return *this;
+        }
+
+        uint32_t operator*()
+        {
+            return _list->id_at(_position);
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return _position != other._position;
+        }
+
+    private:
+        const chunked_freelist* _list;
+        uint32_t _position;
+    };
+
+    chunked_freelist()
+        : _next_slot(0)
+        , _num_objects(0)
+        , _num_free(0)
+        , _num_erased(0)
+    {
+        for (uint32_t i = 0; i < max_chunks; i++)
+        {
+            _chunks[i].store(nullptr, std::memory_order_relaxed);
+            _id_chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~chunked_freelist()
+    {
+        clear();
+        for (uint32_t i = 0; i < max_chunks; i++)
+        {
+            delete _chunks[i].load(std::memory_order_relaxed);
+            delete[] _id_chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // objects are referenced by address from other threads, the list itself never moves
+    chunked_freelist(const chunked_freelist&) = delete;
+    chunked_freelist& operator=(const chunked_freelist&) = delete;
+
+    bool contains(uint32_t id) const
+    {
+        uint32_t index = id & index_mask;
+        if (index >= _next_slot.load(std::memory_order_acquire))
+            return false;
+        chunk_t* chunk = _chunks[index >> chunk_bits].load(std::memory_order_acquire);
+        if (!chunk)
+            return false;
+        const slot_t& slot = chunk->slots[index & (chunk_size - 1)];
+        return slot.alive && slot.generation == (id >> index_bits);
+    }
+
+    T& operator[](uint32_t id) const
+    {
+        uint32_t index = id & index_mask;
+        chunk_t* chunk = _chunks[index >> chunk_bits].load(std::memory_order_acquire);
+        return *reinterpret_cast<T*>(&chunk->objects[index & (chunk_size - 1)]);
+    }
+
+    uint32_t insert(const T& val)
+    {
+        return emplace(val);
+    }
+
+    uint32_t insert(T&& val)
+    {
+        return emplace(std::move(val));
+    }
+
+    template<class... Args>
+    uint32_t emplace(Args&&... args)
+    {
+        uint32_t index = pop_free();
+        if (index == index_mask)
+        {
+            index = _next_slot.fetch_add(1, std::memory_order_acq_rel);
+            assert(index < max_objects);
+        }
+
+        chunk_t* chunk = acquire_chunk(_chunks[index >> chunk_bits]);
+        slot_t& slot = chunk->slots[index & (chunk_size - 1)];
+        new (&chunk->objects[index & (chunk_size - 1)]) T(std::forward<Args>(args)...);
+
+        uint32_t id = (slot.generation << index_bits) | index;
+        uint32_t dense_index = _num_objects.fetch_add(1, std::memory_order_acq_rel);
+        uint32_t* ids = acquire_ids(_id_chunks[dense_index >> chunk_bits]);
+        ids[dense_index & (chunk_size - 1)] = id;
+        slot.dense_index = dense_index;
+        slot.alive = true;
+        return id;
+    }
+
+    void erase(uint32_t id)
+    {
+        assert(contains(id));
+
+        uint32_t index = id & index_mask;
+        chunk_t* chunk = _chunks[index >> chunk_bits].load(std::memory_order_relaxed);
+        slot_t& slot = chunk->slots[index & (chunk_size - 1)];
+        reinterpret_cast<T*>(&chunk->objects[index & (chunk_size - 1)])->~T();
+
+        // objects stay where they are, only the packed id array is kept hole free
+        uint32_t last = _num_objects.load(std::memory_order_relaxed) - 1;
+        if (slot.dense_index != last)
+        {
+            uint32_t last_id = id_at(last);
+            set_id_at(slot.dense_index, last_id);
+            uint32_t last_index = last_id & index_mask;
+            _chunks[last_index >> chunk_bits].load(std::memory_order_relaxed)->slots[last_index & (chunk_size - 1)].dense_index = slot.dense_index;
+        }
+        _num_objects.store(last, std::memory_order_relaxed);
+
+        slot.alive = false;
+        slot.generation = (slot.generation + 1) & (0xFFFFFFFFu >> index_bits);
+        _num_erased++;
+
+        std::lock_guard<std::mutex> lock(_free_mutex);
+        _free.push_back(index);
+        _num_free.store(static_cast<uint32_t>(_free.size()), std::memory_order_release);
+    }
+
+    // destroy every object, chunks are kept for reuse and ids of the old objects stop being contained
+    void clear()
+    {
+        uint32_t count = _num_objects.load(std::memory_order_relaxed);
+        while (count > 0)
+        {
+            erase(id_at(count - 1));
+            count--;
+        }
+    }
+
+    iterator begin() const
+    {
+        return iterator(this, 0);
+    }
+
+    iterator end() const
+    {
+        return iterator(this, _num_objects.load(std::memory_order_acquire));
+    }
+
+    // packed ids from position first on, *count is clipped to the end of their chunk
+    const uint32_t* id_span(uint32_t first, uint32_t* count) const
+    {
+        const uint32_t offset = first & (chunk_size - 1);
+        *count = std::min(*count, std::min(static_cast<uint32_t>(size()) - first, chunk_size - offset));
+        return _id_chunks[first >> chunk_bits].load(std::memory_order_acquire) + offset;
+    }
+
+    // f(id, object) in iteration order
+    template<class F>
+    void for_each(F f) const
+    {
+        for_each_range(0, static_cast<uint32_t>(size()), f);
+    }
+
+    // f(first, last) over the positions [0, size()) split into ranges of grain, each one a task on
+    // pool, which is anything with Enqueue(std::function<void()>) and Wait(). Returns once all of
+    // them ran. No insert or erase meanwhile.
+    template<class Pool, class F>
+    void parallel_for_ranges(Pool& pool, F f, uint32_t grain = chunk_size) const
+    {
+        const uint32_t count = static_cast<uint32_t>(size());
+        grain = std::max(grain, 1u);
+        if (count <= grain)
+        {
+            f(0u, count);
+            return;
+        }
+        for (uint32_t first = 0; first < count; first += grain)
+        {
+            const uint32_t last = std::min(count, first + grain);
+            pool.Enqueue([first, last, &f]() { f(first, last); });
+        }
+        pool.Wait();
+    }
+
+    // f(id, object) on parallel_for_ranges, f runs concurrently and may only write its own object
+    template<class Pool, class F>
+    void parallel_for_each(Pool& pool, F f, uint32_t grain = chunk_size) const
+    {
+        parallel_for_ranges(pool, [this, &f](uint32_t first, uint32_t last) { for_each_range(first, last, f); }, grain);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_t size() const
+    {
+        return _num_objects.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return max_objects;
+    }
+
+    // erases since construction; inserts only grow size(), so the list is unchanged while both stay the same
+    uint64_t erase_count() const
+    {
+        return _num_erased;
+    }
+
+private:
+    template<class F>
+    void for_each_range(uint32_t first, uint32_t last, F& f) const
+    {
+        while (first < last)
+        {
+            uint32_t count = last - first;
+            const uint32_t* ids = id_span(first, &count);
+            for (uint32_t i = 0; i < count; i++)
+            {
+                f(ids[i], (*this)[ids[i]]);
+            }
+            first += count;
+        }
+    }
+
+    uint32_t id_at(uint32_t position) const
+    {
+        return _id_chunks[position >> chunk_bits].load(std::memory_order_acquire)[position & (chunk_size - 1)];
+    }
+
+    void set_id_at(uint32_t position, uint32_t id)
+    {
+        _id_chunks[position >> chunk_bits].load(std::memory_order_relaxed)[position & (chunk_size - 1)] = id;
+    }
+
+    uint32_t pop_free()
+    {
+        // the common case of nothing erased stays lock free
+        if (_num_free.load(std::memory_order_acquire) == 0)
+            return index_mask;
+
+        std::lock_guard<std::mutex> lock(_free_mutex);
+        if (_free.empty())
+            return index_mask;
+        uint32_t index = _free.back();
+        _free.pop_back();
+        _num_free.store(static_cast<uint32_t>(_free.size()), std::memory_order_release);
+        return index;
+    }
+
+    // first thread to need a chunk publishes it, the others drop theirs
+    static chunk_t* acquire_chunk(std::atomic<chunk_t*>& entry)
+    {
+        chunk_t* chunk = entry.load(std::memory_order_acquire);
+        if (chunk)
+            return chunk;
+
+        chunk_t* created = new chunk_t;
+        for (uint32_t i = 0; i < chunk_size; i++)
+        {
+            created->slots[i].generation = 0;
+            created->slots[i].dense_index = 0;
+            created->slots[i].alive = false;
+        }
+        if (entry.compare_exchange_strong(chunk, created, std::memory_order_acq_rel, std::memory_order_acquire))
+            return created;
+        delete created;
+        return chunk;
+    }
+
+    static uint32_t* acquire_ids(std::atomic<uint32_t*>& entry)
+    {
+        uint32_t* ids = entry.load(std::memory_order_acquire);
+        if (ids)
+            return ids;
+
+        uint32_t* created = new uint32_t[chunk_size];
+        if (entry.compare_exchange_strong(ids, created, std::memory_order_acq_rel, std::memory_order_acquire))
+            return created;
+        delete[] created;
+        return ids;
+    }
+};
+
+template<class T>
+typename chunked_freelist<T>::iterator begin(const chunked_freelist<T>& fl)
+{
+    return fl.begin();
+}
+
+template<class T>
+typename chunked_freelist<T>::iterator end(const chunked_freelist<T>& fl)
+{
+    return fl.end();
+}
@@ -1,8 +1,9 @@
 #pragma once
 
 // self-packing freelist implementation based on http://bitsquid.blogspot.ca/2011/09/managing-decoupling-part-4-id-lookup.html
-// has NOT been unit tested. beware of using in production.
+// covered by tests/test_freelist.cpp, Render/bench/bench_freelist.cpp compares it against std containers
 
+#include <algorithm>
 #include <cstdint>
 #include <cassert>
 #include <utility>
@@ -191,6 +192,12 @@ public:
                     _object_alloc_ids[i] = other._object_alloc_ids[i];
                 }
 
+                // objects past the end of other's are gone
+                for (size_t i = other._num_objects; i < _num_objects; i++)
+                {
+                    _objects[i].~T();
+                }
+
                 for (size_t i = 0; i < other._max_objects; i++)
                 {
                     _allocations[i] = other._allocations[i];
@@ -306,7 +313,10 @@ public:
         o->~T();
         _num_objects = _num_objects - 1;
 
-        // push the deleted allocation onto the FIFO
+        // push the deleted allocation onto the FIFO. A full list emptied it, _next_allocation still
+        // points at the live allocation the circular links lead to and must start over from this one
+        if (_num_objects + 1 == _max_objects)
+            _next_allocation = alloc->allocation_id & alloc_index_mask;
         _allocations[_last_allocation].next_allocation = alloc->allocation_id & alloc_index_mask;
         _last_allocation = alloc->allocation_id & alloc_index_mask;
 
@@ -324,6 +334,44 @@ public:
         return iterator{ _object_alloc_ids + _num_objects };
     }
 
+    // dense storage: object i has the id id_data()[i], both valid until the next insert or erase
+    T* data() const
+    {
+        return _objects;
+    }
+
+    const uint32_t* id_data() const
+    {
+        return _object_alloc_ids;
+    }
+
+    // f(id, object) straight over the dense arrays
+    template<class F>
+    void for_each(F f) const
+    {
+        for_each_range(0, _num_objects, f);
+    }
+
+    // f(id, object) with the dense arrays split into ranges of grain, each one a task on pool, which
+    // is anything with Enqueue(std::function<void()>) and Wait(). Returns once all of them ran.
+    // f runs concurrently and may only write its own object, no insert or erase meanwhile.
+    template<class Pool, class F>
+    void parallel_for_each(Pool& pool, F f, size_t grain = 1024) const
+    {
+        grain = std::max<size_t>(grain, 1);
+        if (_num_objects <= grain)
+        {
+            for_each_range(0, _num_objects, f);
+            return;
+        }
+        for (size_t first = 0; first < _num_objects; first += grain)
+        {
+            const size_t last = std::min(_num_objects, first + grain);
+            pool.Enqueue([this, first, last, &f]() { for_each_range(first, last, f); });
+        }
+        pool.Wait();
+    }
+
     bool empty() const
     {
         return _num_objects == 0;
@@ -340,6 +388,15 @@ public:
     }
 
 private:
+    template<class F>
+    void for_each_range(size_t first, size_t last, F& f) const
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            f(_object_alloc_ids[i], _objects[i]);
+        }
+    }
+
     allocation_t* insert_alloc()
     {
         assert(_num_objects < _max_objects);
@@ -23,7 +23,7 @@ namespace vkx {
 
         // Load debug function pointers and set debug callback
         // if callBack is NULL, default message callback will be used
-        void setupDebugging(vk::Instance instance, vk::DebugReportFlagsEXT flags);
+        void setupDebugging(vk::Instance instance, vk::DebugReportFlagsEXT flags, PFN_vkDebugReportCallbackEXT callBack = nullptr);
         // Clear debug callback
         void freeDebugCallback(vk::Instance instance);
 
@@ -75,6 +75,15 @@ namespace vkx {
             void setFenceName(VkDevice device, VkFence fence, const char * name);
             void setEventName(VkDevice device, VkEvent _event, const char * name);
 
+            // The same for vulkan.hpp handles, nothing unless active; the layer copies the name
+            inline void setName(vk::Device device, vk::CommandBuffer cmdBuffer, const char* name) { setCommandBufferName(VkDevice(device), VkCommandBuffer(cmdBuffer), name); }
+            inline void setName(vk::Device device, vk::Queue queue, const char* name) { setQueueName(VkDevice(device), VkQueue(queue), name); }
+            inline void setName(vk::Device device, vk::Image image, const char* name) { setImageName(VkDevice(device), VkImage(image), name); }
+            inline void setName(vk::Device device, vk::Buffer buffer, const char* name) { setBufferName(VkDevice(device), VkBuffer(buffer), name); }
+            inline void setName(vk::Device device, vk::Pipeline pipeline, const char* name) { setPipelineName(VkDevice(device), VkPipeline(pipeline), name); }
+            inline void setName(vk::Device device, vk::RenderPass renderPass, const char* name) { setRenderPassName(VkDevice(device), VkRenderPass(renderPass), name); }
+            inline void setName(vk::Device device, vk::Framebuffer framebuffer, const char* name) { setFramebufferName(VkDevice(device), VkFramebuffer(framebuffer), name); }
+
             class Marker {
             public:
 				Marker(const vk::CommandBuffer& cmdBuffer, const std::string& name, const std::array<float, 4>& color = {0.8f, 0.8f, 0.8f, 0.8f}) : cmdBuffer(cmdBuffer) {
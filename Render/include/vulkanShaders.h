@@ -9,8 +9,17 @@
 
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <string>
 #include <vulkan/vulkan.hpp>
 
+namespace m3d {
+    class ThreadPool;
+    namespace file {
+        class MappedFile;
+    }
+}
+
 namespace vkx {
     namespace shader {
         using SpvBuffer = std::vector<uint32_t>;
@@ -19,6 +28,66 @@ namespace vkx {
         void initDebugReport(const vk::Instance& instance);
 
         SpvBuffer glslToSpv(vk::ShaderStageFlagBits shaderType, const std::string& shaderSource);
+        // defines are "NAME" or "NAME=VALUE", injected as a preamble ahead of the source
+        SpvBuffer glslToSpv(vk::ShaderStageFlagBits shaderType, const std::string& shaderSource, const std::vector<std::string>& defines);
         vk::ShaderModule glslToShaderModule(const vk::Device& device, const vk::ShaderStageFlagBits shaderType, const std::string& shaderSource);
+
+        struct SpvRequest {
+            vk::ShaderStageFlagBits stage;
+            std::string source;
+            std::vector<std::string> defines;
+        };
+
+        // SPIR-V words, memory mapped from the cache directory or owned after a compile
+        class SpvCode {
+        public:
+            explicit SpvCode(SpvBuffer&& compiled);
+            // nullptr when the file cannot be mapped
+            static std::shared_ptr<const SpvCode> map(const std::string& path);
+
+            const uint32_t* data() const { return words; }
+            // in words
+            size_t size() const { return wordCount; }
+
+            SpvCode(const SpvCode&) = delete;
+            SpvCode& operator=(const SpvCode&) = delete;
+
+        private:
+            SpvCode() = default;
+
+            SpvBuffer owned;
+            std::shared_ptr<const m3d::file::MappedFile> file;
+            const uint32_t* words = nullptr;
+            size_t wordCount = 0;
+        };
+        using SpvCodePtr = std::shared_ptr<const SpvCode>;
+
+        //
+        // Content addressed SPIR-V cache.
+        //
+        // Every request is keyed by a hash of its stage, defines and source and
+        // stored as <directory>/<key>.spv. Hits are memory mapped and never touch
+        // glslang; misses are compiled on a thread pool and written back.
+        //
+        class SpvCache {
+        public:
+            // compileThreads 0 uses one thread per hardware thread
+            explicit SpvCache(const std::string& directory, uint32_t compileThreads = 0);
+            ~SpvCache();
+
+            static uint64_t key(const SpvRequest& request);
+            std::string path(const SpvRequest& request) const;
+
+            SpvCodePtr load(const SpvRequest& request);
+            // results in request order, the misses compile in parallel; nullptr where a compile failed
+            std::vector<SpvCodePtr> load(const std::vector<SpvRequest>& requests);
+            vk::ShaderModule loadModule(const vk::Device& device, const SpvRequest& request);
+
+        private:
+            SpvCodePtr compile(const SpvRequest& request);
+
+            std::string directory;
+            std::unique_ptr<m3d::ThreadPool> compileThreads;
+        };
     }
 }
@@ -11,12 +11,17 @@
 
 #include <vulkan/vulkan.hpp>
 #include <gli/gli.hpp>
+#include <functional>
 #include <vector>
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
 #endif
 
+#include "File.hpp"
+#include "SamplerCache.hpp"
+#include "TextureCooker.hpp"
+#include "UploadQueue.hpp"
 #include "VulkanHelper.hpp"
 
 #define DEFAULT_FENCE_TIMEOUT 100000000000
@@ -47,9 +52,21 @@ namespace vkext
 	private:
 		vk::Device&		device;
 		vk::PhysicalDevice& physicalDevice;
+		// textures reference its samplers, they outlive the texture objects
+		m3d::SamplerCache& samplers;
 		vk::Queue queue;
 		vk::CommandBuffer cmdBuffer;
 		vk::CommandPool cmdPool;
+
+		// gli parses straight out of the mapped file instead of reading it into a buffer first
+		static gli::texture loadFile(const std::string& filename)
+		{
+			auto file = m3d::file::MappedFile::open(filename.c_str());
+			if (!file) {
+				return gli::texture();
+			}
+			return gli::load(reinterpret_cast<const char*>(file->data()), file->size());
+		}
 	public:
 #if defined(__ANDROID__)
 		AAssetManager* assetManager = nullptr;
@@ -61,9 +78,10 @@ namespace vkext
 		* @param vulkanDevice Pointer to a valid VulkanDevice
 		* @param queue Queue for the copy commands when using staging (queue must support transfers)
 		* @param cmdPool Commandpool used to get command buffers for copies and layout transitions
+		* @param samplers Cache the samplers of the textures come from, shared between textures with the same sampler state
 		*/
-		VulkanTextureLoader(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue& queue, vk::CommandPool& cmdPool)
-			:device(device), physicalDevice(physicalDevice)
+		VulkanTextureLoader(vk::Device& device, vk::PhysicalDevice& physicalDevice, vk::Queue& queue, vk::CommandPool& cmdPool, m3d::SamplerCache& samplers)
+			:device(device), physicalDevice(physicalDevice), samplers(samplers)
 		{
 			this->device = device;
 			this->physicalDevice = physicalDevice;
@@ -109,20 +127,18 @@ namespace vkext
 
 			// Textures are stored inside the apk on Android (compressed)
 			// So they need to be loaded via the asset manager
-			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			// Parsed out of the asset's own buffer instead of reading it into one first, which
+			// is the memory mapped file for assets stored uncompressed
+			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_BUFFER);
 			assert(asset);
 			size_t size = AAsset_getLength(asset);
 			assert(size > 0);
 
-			void *textureData = malloc(size);
-			AAsset_read(asset, textureData, size);
-			AAsset_close(asset);
-
-			gli::texture2D tex2D(gli::load((const char*)textureData, size));
+			gli::texture2D tex2D(gli::load(static_cast<const char*>(AAsset_getBuffer(asset)), size));
 
-			free(textureData);
+			AAsset_close(asset);
 #else
-			gli::texture2d tex2D(gli::load(filename.c_str()));
+			gli::texture2d tex2D(loadFile(filename));
 #endif		
 			assert(!tex2D.empty());
 
@@ -364,24 +380,8 @@ namespace vkext
 				queue.waitIdle();
 			}
 
-			// Create sampler
-			vk::SamplerCreateInfo sampler = {};
-			sampler.magFilter = vk::Filter::eLinear;
-			sampler.minFilter = vk::Filter::eLinear;
-			sampler.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler.addressModeU = vk::SamplerAddressMode::eRepeat;
-			sampler.addressModeV = vk::SamplerAddressMode::eRepeat;
-			sampler.addressModeW = vk::SamplerAddressMode::eRepeat;
-			sampler.mipLodBias = 0.0f;
-			sampler.compareOp = vk::CompareOp::eNever;
-			sampler.minLod = 0.0f;
-			// Max level-of-detail should match mip level count
-			sampler.maxLod = (useStaging) ? (float)texture->mipLevels : 0.0f;
-			// Enable anisotropic filtering
-			sampler.maxAnisotropy = 8;
-			sampler.anisotropyEnable = VK_TRUE;
-			sampler.borderColor = vk::BorderColor::eFloatOpaqueWhite;
-			texture->sampler = device.createSampler(sampler);
+			// Shared sampler, the view limits the levels
+			texture->sampler = samplers.Get();
 
 			// Create image view
 			// Textures are not directly accessed by the shaders and
@@ -405,6 +405,125 @@ namespace vkext
 			texture->descriptor.sampler = texture->sampler;
 		}
 
+		/**
+		* Load a 2D texture including all mip levels without waiting for the copy
+		*
+		* @param filename File to load
+		* @param format Vulkan format of the image data stored in the file
+		* @param texture Pointer to the texture object to load the image into
+		* @param upload Streaming upload queue the copy is recorded into
+		* @param (Optional) onComplete Called from UploadQueue::Poll once the texture can be sampled
+		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
+		*
+		* @note Returns as soon as the image data has been copied into the staging ring,
+		* the texture must not be used before onComplete has been called
+		* @note Uploads every level, m3d::TextureStreamer keeps only the needed ones within a VRAM budget
+		*/
+		void loadTextureAsync(std::string filename, vk::Format format, VulkanTexture *texture, m3d::UploadQueue& upload, std::function<void()> onComplete = std::function<void()>(), vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled)
+		{
+			auto file = m3d::file::MappedFile::open(filename.c_str());
+			assert(file);
+
+			// KTX levels are used in place, each one is copied once from the mapped file into the staging ring.
+			// Other containers are parsed by gli, which keeps a copy of its own.
+			std::vector<m3d::KtxLevel> levels;
+			gli::texture2d tex2D;
+			if (!m3d::ParseKtx(file->data(), file->size(), &levels))
+			{
+				tex2D = gli::texture2d(gli::load(reinterpret_cast<const char*>(file->data()), file->size()));
+				assert(!tex2D.empty());
+				levels.clear();
+				for (size_t i = 0; i < tex2D.levels(); i++)
+				{
+					m3d::KtxLevel level;
+					level.data = static_cast<const uint8_t*>(tex2D[i].data());
+					level.size = static_cast<uint32_t>(tex2D[i].size());
+					level.width = static_cast<uint32_t>(tex2D[i].extent().x);
+					level.height = static_cast<uint32_t>(tex2D[i].extent().y);
+					levels.push_back(level);
+				}
+			}
+			assert(!levels.empty());
+
+			texture->width = levels[0].width;
+			texture->height = levels[0].height;
+			texture->mipLevels = static_cast<uint32_t>(levels.size());
+			texture->layerCount = 1;
+
+			std::vector<vk::BufferImageCopy> bufferCopyRegions;
+			uint32_t offset = 0;
+			for (uint32_t i = 0; i < texture->mipLevels; i++)
+			{
+				vk::BufferImageCopy bufferCopyRegion = {};
+				bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+				bufferCopyRegion.imageSubresource.mipLevel = i;
+				bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+				bufferCopyRegion.imageSubresource.layerCount = 1;
+				bufferCopyRegion.imageExtent.width = levels[i].width;
+				bufferCopyRegion.imageExtent.height = levels[i].height;
+				bufferCopyRegion.imageExtent.depth = 1;
+				bufferCopyRegion.bufferOffset = offset;
+
+				bufferCopyRegions.push_back(bufferCopyRegion);
+
+				offset += levels[i].size;
+			}
+
+			// Create optimal tiled target image, shared with the graphics queue when uploads run on a transfer queue
+			const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+			vk::ImageCreateInfo imageCreateInfo;
+			imageCreateInfo.imageType = vk::ImageType::e2D;
+			imageCreateInfo.format = format;
+			imageCreateInfo.mipLevels = texture->mipLevels;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+			imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+			imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+			imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+			imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+			imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+			imageCreateInfo.extent = { texture->width, texture->height, 1 };
+			imageCreateInfo.usage = imageUsageFlags | vk::ImageUsageFlagBits::eTransferDst;
+			texture->image = device.createImage(imageCreateInfo);
+
+			vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(texture->image);
+			vk::MemoryAllocateInfo memAllocInfo;
+			memAllocInfo.allocationSize = memReqs.size;
+			memAllocInfo.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			texture->deviceMemory = device.allocateMemory(memAllocInfo);
+			device.bindImageMemory(texture->image, texture->deviceMemory, 0);
+
+			vk::ImageSubresourceRange subresourceRange;
+			subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+			subresourceRange.baseMipLevel = 0;
+			subresourceRange.levelCount = texture->mipLevels;
+			subresourceRange.layerCount = 1;
+
+			texture->imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			m3d::UploadQueue::Staging staged = upload.Stage(offset);
+			for (uint32_t i = 0; i < texture->mipLevels; i++)
+			{
+				memcpy(staged.data + bufferCopyRegions[i].bufferOffset, levels[i].data, levels[i].size);
+			}
+			upload.CopyToImage(staged, texture->image, bufferCopyRegions, subresourceRange, texture->imageLayout);
+			upload.Submit(onComplete);
+
+			// Sampler and view do not depend on the image contents
+			texture->sampler = samplers.Get();
+
+			vk::ImageViewCreateInfo view;
+			view.viewType = vk::ImageViewType::e2D;
+			view.format = format;
+			view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+			view.subresourceRange = subresourceRange;
+			view.image = texture->image;
+			texture->view = device.createImageView(view);
+
+			texture->descriptor.imageLayout = texture->imageLayout;
+			texture->descriptor.imageView = texture->view;
+			texture->descriptor.sampler = texture->sampler;
+		}
+
 		/**
 		* Load a cubemap texture including all mip levels from a single file
 		*
@@ -421,20 +540,18 @@ namespace vkext
 
 			// Textures are stored inside the apk on Android (compressed)
 			// So they need to be loaded via the asset manager
-			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			// Parsed out of the asset's own buffer instead of reading it into one first, which
+			// is the memory mapped file for assets stored uncompressed
+			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_BUFFER);
 			assert(asset);
 			size_t size = AAsset_getLength(asset);
 			assert(size > 0);
 
-			void *textureData = malloc(size);
-			AAsset_read(asset, textureData, size);
-			AAsset_close(asset);
-
-			gli::textureCube texCube(gli::load((const char*)textureData, size));
+			gli::textureCube texCube(gli::load(static_cast<const char*>(AAsset_getBuffer(asset)), size));
 
-			free(textureData);
+			AAsset_close(asset);
 #else
-			gli::texture_cube texCube(gli::load(filename));
+			gli::texture_cube texCube(loadFile(filename));
 #endif	
 			assert(!texCube.empty());
 
@@ -574,21 +691,8 @@ namespace vkext
 			device.waitForFences(copyFence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
 			device.destroyFence(copyFence);
 
-			// Create sampler
-			vk::SamplerCreateInfo sampler;
-			sampler.magFilter = vk::Filter::eLinear;
-			sampler.minFilter = vk::Filter::eLinear;
-			sampler.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler.addressModeU = vk::SamplerAddressMode::eClampToEdge;
-			sampler.addressModeV = sampler.addressModeU;
-			sampler.addressModeW = sampler.addressModeU;
-			sampler.mipLodBias = 0.0f;
-			sampler.maxAnisotropy = 8;
-			sampler.compareOp = vk::CompareOp::eNever;
-			sampler.minLod = 0.0f;
-			sampler.maxLod = (float)texture->mipLevels;
-			sampler.borderColor = vk::BorderColor::eFloatOpaqueWhite;
-			texture->sampler = device.createSampler(sampler);
+			// Shared sampler, the view limits the levels
+			texture->sampler = samplers.Get(vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge, 1.0f);
 
 			// Create image view
 			vk::ImageViewCreateInfo view;
@@ -627,20 +731,18 @@ namespace vkext
 
 			// Textures are stored inside the apk on Android (compressed)
 			// So they need to be loaded via the asset manager
-			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_STREAMING);
+			// Parsed out of the asset's own buffer instead of reading it into one first, which
+			// is the memory mapped file for assets stored uncompressed
+			AAsset* asset = AAssetManager_open(assetManager, filename.c_str(), AASSET_MODE_BUFFER);
 			assert(asset);
 			size_t size = AAsset_getLength(asset);
 			assert(size > 0);
 
-			void *textureData = malloc(size);
-			AAsset_read(asset, textureData, size);
-			AAsset_close(asset);
-
-			gli::texture2DArray tex2DArray(gli::load((const char*)textureData, size));
+			gli::texture2DArray tex2DArray(gli::load(static_cast<const char*>(AAsset_getBuffer(asset)), size));
 
-			free(textureData);
+			AAsset_close(asset);
 #else
-			gli::texture2d_array tex2DArray(gli::load(filename));
+			gli::texture2d_array tex2DArray(loadFile(filename));
 #endif	
 
 			assert(!tex2DArray.empty());
@@ -775,21 +877,8 @@ namespace vkext
 
 			device.waitForFences(copyFence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
 			device.destroyFence(copyFence);
-			// Create sampler
-			vk::SamplerCreateInfo sampler;
-			sampler.magFilter = vk::Filter::eLinear;
-			sampler.minFilter = vk::Filter::eLinear;
-			sampler.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler.addressModeU = vk::SamplerAddressMode::eClampToEdge;
-			sampler.addressModeV = sampler.addressModeU;
-			sampler.addressModeW = sampler.addressModeU;
-			sampler.mipLodBias = 0.0f;
-			sampler.maxAnisotropy = 8;
-			sampler.compareOp = vk::CompareOp::eNever;
-			sampler.minLod = 0.0f;
-			sampler.maxLod = (float)texture->mipLevels;
-			sampler.borderColor = vk::BorderColor::eFloatOpaqueWhite;
-			texture->sampler = device.createSampler(sampler);
+			// Shared sampler, the view limits the levels
+			texture->sampler = samplers.Get(vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge, 1.0f);
 			// Create image view
 			vk::ImageViewCreateInfo view;
 			view.viewType = vk::ImageViewType::e2D;
@@ -820,14 +909,17 @@ namespace vkext
 		* @param texture Pointer to the texture object to load the image into
 		* @param (Optional) filter Texture filtering for the sampler (defaults to VK_FILTER_LINEAR)
 		* @param (Optional) imageUsageFlags Usage flags for the texture's image (defaults to VK_IMAGE_USAGE_SAMPLED_BIT)
+		* @param (Optional) generateMipmaps Blit the full mip chain from the buffer's level on the loader's queue, which must
+		*        support graphics; a single level where the format can not be blitted (defaults to true)
 		*/
-		void createTexture(void* buffer, vk::DeviceSize bufferSize, vk::Format format, uint32_t width, uint32_t height, VulkanTexture *texture, vk::Filter filter = vk::Filter::eLinear, vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled)
+		void createTexture(void* buffer, vk::DeviceSize bufferSize, vk::Format format, uint32_t width, uint32_t height, VulkanTexture *texture, vk::Filter filter = vk::Filter::eLinear, vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled, bool generateMipmaps = true)
 		{
 			assert(buffer);
 
 			texture->width = width;
 			texture->height = height;
-			texture->mipLevels = 1;
+			generateMipmaps = generateMipmaps && vkhelper::canGenerateMipmaps(physicalDevice, format);
+			texture->mipLevels = generateMipmaps ? vkhelper::mipLevelCount(width, height) : 1;
 
 			vk::MemoryAllocateInfo memAllocInfo;
 			vk::MemoryRequirements memReqs;
@@ -888,6 +980,11 @@ namespace vkext
 			{
 				imageCreateInfo.usage |= vk::ImageUsageFlagBits::eTransferDst;
 			}
+			// every level but the last is blitted from
+			if (texture->mipLevels > 1)
+			{
+				imageCreateInfo.usage |= vk::ImageUsageFlagBits::eTransferSrc;
+			}
 			texture->image = device.createImage(imageCreateInfo);
 			memReqs = device.getImageMemoryRequirements(texture->image);
 
@@ -919,13 +1016,21 @@ namespace vkext
 			// Change texture image layout to shader read after all mip levels have been copied
 			texture->imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
 
-			vkhelper::setImageLayout(
-				cmdBuffer,
-				texture->image,
-				vk::ImageAspectFlagBits::eColor,
-				vk::ImageLayout::eTransferDstOptimal,
-				texture->imageLayout,
-				subresourceRange);
+			if (texture->mipLevels > 1)
+			{
+				// the chain is halved down from the copied level, each level leaves in the shader read layout
+				vkhelper::generateMipmaps(cmdBuffer, texture->image, width, height, texture->mipLevels);
+			}
+			else
+			{
+				vkhelper::setImageLayout(
+					cmdBuffer,
+					texture->image,
+					vk::ImageAspectFlagBits::eColor,
+					vk::ImageLayout::eTransferDstOptimal,
+					texture->imageLayout,
+					subresourceRange);
+			}
 
 			// Submit command buffer containing copy and image layout commands
 			cmdBuffer.end();
@@ -945,19 +1050,8 @@ namespace vkext
 			device.freeMemory(stagingMemory);
 			device.destroyBuffer(stagingBuffer);
 
-			// Create sampler
-			vk::SamplerCreateInfo sampler;
-			sampler.magFilter = vk::Filter::eLinear;
-			sampler.minFilter = vk::Filter::eLinear;
-			sampler.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler.addressModeU = vk::SamplerAddressMode::eRepeat;
-			sampler.addressModeV = vk::SamplerAddressMode::eRepeat;
-			sampler.addressModeW = vk::SamplerAddressMode::eRepeat;
-			sampler.mipLodBias = 0.0f;
-			sampler.compareOp = vk::CompareOp::eNever;
-			sampler.minLod = 0.0f;
-			sampler.maxLod = 0.0f;
-			texture->sampler = device.createSampler(sampler);
+			// Shared sampler, the view limits the levels
+			texture->sampler = samplers.Get(vk::Filter::eLinear, vk::SamplerAddressMode::eRepeat, 1.0f);
 
 			// Create image view
 			vk::ImageViewCreateInfo view;
@@ -966,7 +1060,7 @@ namespace vkext
 			view.format = format;
 			view.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
 			view.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-			view.subresourceRange.levelCount = 1;
+			view.subresourceRange.levelCount = texture->mipLevels;
 			view.image = texture->image;
 			texture->view = device.createImageView(view);
 
@@ -979,13 +1073,13 @@ namespace vkext
 		/**
 		* Free all Vulkan resources used by a texture object
 		*
+		* @note The sampler belongs to the sampler cache and stays alive
 		* @param texture Texture object whose resources are to be freed
 		*/
 		void destroyTexture(VulkanTexture texture)
 		{
 			device.destroyImageView(texture.view);
 			device.destroyImage(texture.image);
-			device.destroySampler(texture.sampler);
 			device.freeMemory(texture.deviceMemory);
 		}
 	};
@@ -0,0 +1,840 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "AccelerationStructures.hpp"
+#include "CommandBuffer.hpp"
+#include "ResourceTrash.hpp"
+#include "Scene.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+namespace m3d {
+
+// VK_KHR_acceleration_structure, VK_KHR_buffer_device_address and VK_KHR_ray_query postdate the vulkan headers
+static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+static const VkStructureType PhysicalDeviceBufferDeviceAddressFeaturesType = static_cast<VkStructureType>(1000257000);
+static const VkStructureType BufferDeviceAddressInfoType = static_cast<VkStructureType>(1000244001);
+static const VkStructureType WriteDescriptorSetAccelerationStructureType = static_cast<VkStructureType>(1000150007);
+static const VkStructureType AccelerationStructureBuildGeometryInfoType = static_cast<VkStructureType>(1000150000);
+static const VkStructureType AccelerationStructureDeviceAddressInfoType = static_cast<VkStructureType>(1000150002);
+static const VkStructureType AccelerationStructureGeometryInstancesDataType = static_cast<VkStructureType>(1000150004);
+static const VkStructureType AccelerationStructureGeometryTrianglesDataType = static_cast<VkStructureType>(1000150005);
+static const VkStructureType AccelerationStructureGeometryType = static_cast<VkStructureType>(1000150006);
+static const VkStructureType CopyAccelerationStructureInfoType = static_cast<VkStructureType>(1000150010);
+static const VkStructureType PhysicalDeviceAccelerationStructureFeaturesType = static_cast<VkStructureType>(1000150013);
+static const VkStructureType AccelerationStructureCreateInfoType = static_cast<VkStructureType>(1000150017);
+static const VkStructureType AccelerationStructureBuildSizesInfoType = static_cast<VkStructureType>(1000150020);
+static const VkStructureType PhysicalDeviceRayQueryFeaturesType = static_cast<VkStructureType>(1000348013);
+
+static const uint32_t StructureTypeTopLevel = 0;
+static const uint32_t StructureTypeBottomLevel = 1;
+static const uint32_t GeometryTypeTriangles = 0;
+static const uint32_t GeometryTypeInstances = 2;
+static const uint32_t GeometryOpaque = 0x1;
+static const uint32_t BuildAllowUpdate = 0x1;
+static const uint32_t BuildAllowCompaction = 0x2;
+static const uint32_t BuildPreferFastTrace = 0x4;
+static const uint32_t BuildModeBuild = 0;
+static const uint32_t BuildModeUpdate = 1;
+static const uint32_t BuildTypeDevice = 1;
+static const uint32_t CopyModeCompact = 1;
+static const uint32_t InstanceTriangleFacingCullDisable = 0x1;
+static const vk::QueryType QueryTypeCompactedSize = static_cast<vk::QueryType>(1000150000);
+static const vk::DescriptorType DescriptorTypeAccelerationStructure = static_cast<vk::DescriptorType>(1000150000);
+static const vk::BufferUsageFlagBits BufferUsageDeviceAddress = static_cast<vk::BufferUsageFlagBits>(0x00020000);
+static const vk::BufferUsageFlagBits BufferUsageBuildInput = static_cast<vk::BufferUsageFlagBits>(0x00080000);
+static const vk::BufferUsageFlagBits BufferUsageStructureStorage = static_cast<vk::BufferUsageFlagBits>(0x00100000);
+static const vk::PipelineStageFlagBits StageStructureBuild = static_cast<vk::PipelineStageFlagBits>(0x02000000);
+static const vk::AccessFlagBits AccessStructureRead = static_cast<vk::AccessFlagBits>(0x00200000);
+static const vk::AccessFlagBits AccessStructureWrite = static_cast<vk::AccessFlagBits>(0x00400000);
+
+struct PhysicalDeviceFeatures2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceFeatures features;
+};
+
+struct PhysicalDeviceAccelerationStructureFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 accelerationStructure;
+    VkBool32 accelerationStructureCaptureReplay;
+    VkBool32 accelerationStructureIndirectBuild;
+    VkBool32 accelerationStructureHostCommands;
+    VkBool32 descriptorBindingAccelerationStructureUpdateAfterBind;
+};
+
+struct PhysicalDeviceBufferDeviceAddressFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 bufferDeviceAddress;
+    VkBool32 bufferDeviceAddressCaptureReplay;
+    VkBool32 bufferDeviceAddressMultiDevice;
+};
+
+struct PhysicalDeviceRayQueryFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 rayQuery;
+};
+
+struct BufferDeviceAddressInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkBuffer buffer;
+};
+
+union DeviceOrHostAddressConst {
+    uint64_t deviceAddress;
+    const void* hostAddress;
+};
+
+union DeviceOrHostAddress {
+    uint64_t deviceAddress;
+    void* hostAddress;
+};
+
+struct AccelerationStructureGeometryTrianglesData {
+    VkStructureType sType;
+    const void* pNext;
+    VkFormat vertexFormat;
+    DeviceOrHostAddressConst vertexData;
+    VkDeviceSize vertexStride;
+    uint32_t maxVertex;
+    VkIndexType indexType;
+    DeviceOrHostAddressConst indexData;
+    DeviceOrHostAddressConst transformData;
+};
+
+struct AccelerationStructureGeometryInstancesData {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 arrayOfPointers;
+    DeviceOrHostAddressConst data;
+};
+
+// the AABB member has the size of the instances one, triangles are the largest
+union AccelerationStructureGeometryData {
+    AccelerationStructureGeometryTrianglesData triangles;
+    AccelerationStructureGeometryInstancesData instances;
+};
+
+struct AccelerationStructureGeometry {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t geometryType;
+    AccelerationStructureGeometryData geometry;
+    VkFlags flags;
+};
+
+struct AccelerationStructureBuildGeometryInfo {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t type;
+    VkFlags flags;
+    uint32_t mode;
+    VkAccelerationStructureKHR srcAccelerationStructure;
+    VkAccelerationStructureKHR dstAccelerationStructure;
+    uint32_t geometryCount;
+    const AccelerationStructureGeometry* pGeometries;
+    const AccelerationStructureGeometry* const* ppGeometries;
+    DeviceOrHostAddress scratchData;
+};
+
+struct AccelerationStructureBuildRangeInfo {
+    uint32_t primitiveCount;
+    uint32_t primitiveOffset;
+    uint32_t firstVertex;
+    uint32_t transformOffset;
+};
+
+struct AccelerationStructureCreateInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkFlags createFlags;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t type;
+    uint64_t deviceAddress;
+};
+
+struct AccelerationStructureBuildSizesInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkDeviceSize accelerationStructureSize;
+    VkDeviceSize updateScratchSize;
+    VkDeviceSize buildScratchSize;
+};
+
+struct AccelerationStructureDeviceAddressInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkAccelerationStructureKHR accelerationStructure;
+};
+
+struct CopyAccelerationStructureInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkAccelerationStructureKHR src;
+    VkAccelerationStructureKHR dst;
+    uint32_t mode;
+};
+
+struct WriteDescriptorSetAccelerationStructure {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t accelerationStructureCount;
+    const VkAccelerationStructureKHR* pAccelerationStructures;
+};
+
+// VkAccelerationStructureInstanceKHR with its bit fields spelled out
+struct AccelerationStructureInstance {
+    // row major 3x4, Matrix4x3's layout
+    float transform[3][4];
+    // custom index in the low 24 bits, the visibility mask in the high 8
+    uint32_t customIndexAndMask;
+    // shader binding table offset in the low 24 bits, instance flags in the high 8
+    uint32_t bindingTableOffsetAndFlags;
+    uint64_t accelerationStructureReference;
+};
+static_assert(sizeof(AccelerationStructureInstance) == 64, "VkAccelerationStructureInstanceKHR is 64 bytes");
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+typedef VkResult(VKAPI_PTR* CreateAccelerationStructure)(VkDevice device, const AccelerationStructureCreateInfo* createInfo,
+    const VkAllocationCallbacks* allocator, VkAccelerationStructureKHR* structure);
+typedef void(VKAPI_PTR* DestroyAccelerationStructure)(VkDevice device, VkAccelerationStructureKHR structure, const VkAllocationCallbacks* allocator);
+typedef void(VKAPI_PTR* GetAccelerationStructureBuildSizes)(VkDevice device, uint32_t buildType, const AccelerationStructureBuildGeometryInfo* buildInfo,
+    const uint32_t* maxPrimitiveCounts, AccelerationStructureBuildSizesInfo* sizeInfo);
+typedef void(VKAPI_PTR* CmdBuildAccelerationStructures)(VkCommandBuffer commandBuffer, uint32_t infoCount, const AccelerationStructureBuildGeometryInfo* infos,
+    const AccelerationStructureBuildRangeInfo* const* buildRangeInfos);
+typedef void(VKAPI_PTR* CmdCopyAccelerationStructure)(VkCommandBuffer commandBuffer, const CopyAccelerationStructureInfo* info);
+typedef void(VKAPI_PTR* CmdWriteAccelerationStructuresProperties)(VkCommandBuffer commandBuffer, uint32_t structureCount,
+    const VkAccelerationStructureKHR* structures, VkQueryType queryType, VkQueryPool queryPool, uint32_t firstQuery);
+typedef uint64_t(VKAPI_PTR* GetAccelerationStructureDeviceAddress)(VkDevice device, const AccelerationStructureDeviceAddressInfo* info);
+typedef uint64_t(VKAPI_PTR* GetBufferDeviceAddress)(VkDevice device, const BufferDeviceAddressInfo* info);
+
+// meshes built, compacted and waited for at once
+static const uint32_t MeshBatchSize = 32;
+
+const char* const AccelerationStructures::ExtensionNames[ExtensionCount] = {
+    "VK_KHR_acceleration_structure",
+    "VK_KHR_ray_query",
+    "VK_KHR_buffer_device_address",
+    "VK_KHR_deferred_host_operations",
+    "VK_EXT_descriptor_indexing",
+    "VK_KHR_spirv_1_4",
+    "VK_KHR_shader_float_controls"
+};
+
+bool AccelerationStructures::IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    // acceleration structures need 1.1 devices, the extensions of ExtensionNames build on its core
+    if (physicalDevice.getProperties().apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
+        return false;
+    }
+    for (const char* extension : ExtensionNames) {
+        if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, extension)) {
+            return false;
+        }
+    }
+    PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!getFeatures2) {
+        return false;
+    }
+    PhysicalDeviceRayQueryFeatures rayQuery = {};
+    rayQuery.sType = PhysicalDeviceRayQueryFeaturesType;
+    PhysicalDeviceBufferDeviceAddressFeatures deviceAddress = {};
+    deviceAddress.sType = PhysicalDeviceBufferDeviceAddressFeaturesType;
+    deviceAddress.pNext = &rayQuery;
+    PhysicalDeviceAccelerationStructureFeatures structures = {};
+    structures.sType = PhysicalDeviceAccelerationStructureFeaturesType;
+    structures.pNext = &deviceAddress;
+    PhysicalDeviceFeatures2 features = {};
+    features.sType = PhysicalDeviceFeatures2Type;
+    features.pNext = &structures;
+    reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+    return structures.accelerationStructure == VK_TRUE && deviceAddress.bufferDeviceAddress == VK_TRUE && rayQuery.rayQuery == VK_TRUE;
+}
+
+const void* AccelerationStructures::GetFeatureChain(const void* next)
+{
+    // read by vkCreateDevice only, one device at a time
+    static PhysicalDeviceRayQueryFeatures rayQuery = {};
+    rayQuery.sType = PhysicalDeviceRayQueryFeaturesType;
+    rayQuery.pNext = next;
+    rayQuery.rayQuery = VK_TRUE;
+    static PhysicalDeviceBufferDeviceAddressFeatures deviceAddress = {};
+    deviceAddress.sType = PhysicalDeviceBufferDeviceAddressFeaturesType;
+    deviceAddress.pNext = &rayQuery;
+    deviceAddress.bufferDeviceAddress = VK_TRUE;
+    static PhysicalDeviceAccelerationStructureFeatures structures = {};
+    structures.sType = PhysicalDeviceAccelerationStructureFeaturesType;
+    structures.pNext = &deviceAddress;
+    structures.accelerationStructure = VK_TRUE;
+    return &structures;
+}
+
+AccelerationStructures::AccelerationStructures(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, uint32_t slotCount,
+    uint32_t MaxInstances, uint32_t GraphicsQueueFamily, uint32_t ComputeQueueFamily)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , maxInstances(MaxInstances)
+    , graphicsQueueFamily(GraphicsQueueFamily)
+    , computeQueueFamily(ComputeQueueFamily)
+    , instanceStructureSize(0)
+    , instanceScratchSize(0)
+    , pendingPick()
+{
+    loadEntryPoints();
+
+    const uint32_t validBits = physicalDevice.getQueueFamilyProperties()[computeQueueFamily].timestampValidBits;
+    timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    // every slot is sized for maxInstances, a build of fewer fits
+    AccelerationStructureGeometry geometry = {};
+    geometry.sType = AccelerationStructureGeometryType;
+    geometry.geometryType = GeometryTypeInstances;
+    geometry.geometry.instances.sType = AccelerationStructureGeometryInstancesDataType;
+    AccelerationStructureBuildGeometryInfo buildInfo = {};
+    buildInfo.sType = AccelerationStructureBuildGeometryInfoType;
+    buildInfo.type = StructureTypeTopLevel;
+    buildInfo.flags = BuildAllowUpdate | BuildPreferFastTrace;
+    buildInfo.mode = BuildModeBuild;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &geometry;
+    AccelerationStructureBuildSizesInfo sizes = {};
+    sizes.sType = AccelerationStructureBuildSizesInfoType;
+    reinterpret_cast<GetAccelerationStructureBuildSizes>(getBuildSizes)(VkDevice(device), BuildTypeDevice, &buildInfo, &maxInstances, &sizes);
+    instanceStructureSize = sizes.accelerationStructureSize;
+    instanceScratchSize = std::max(sizes.buildScratchSize, sizes.updateScratchSize);
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = computeQueueFamily;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    computePool = device.createCommandPool(poolInfo);
+    vk::CommandBufferAllocateInfo allocateInfo;
+    allocateInfo.commandPool = computePool;
+    allocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocateInfo.commandBufferCount = slotCount;
+    std::vector<vk::CommandBuffer> buffers = device.allocateCommandBuffers(allocateInfo);
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    slots.resize(slotCount);
+    for (uint32_t i = 0; i < slotCount; ++i) {
+        Slot& slot = slots[i];
+        // built on the compute queue, traced on both
+        createBuffer(BufferUsageStructureStorage | BufferUsageDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, instanceStructureSize, slot.storage, true);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | BufferUsageDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, instanceScratchSize, slot.scratch);
+        createBuffer(BufferUsageBuildInput | BufferUsageDeviceAddress, hostVisible, maxInstances * sizeof(AccelerationStructureInstance), slot.instances);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, sizeof(GpuPick), slot.pick);
+        vkx::debug::marker::setName(device, slot.storage.buffer, "instance acceleration structure");
+        vkx::debug::marker::setName(device, slot.scratch.buffer, "acceleration structure scratch");
+        vkx::debug::marker::setName(device, slot.instances.buffer, "acceleration structure instances");
+        vkx::debug::marker::setName(device, slot.pick.buffer, "pick");
+
+        AccelerationStructureCreateInfo createInfo = {};
+        createInfo.sType = AccelerationStructureCreateInfoType;
+        createInfo.buffer = VkBuffer(slot.storage.buffer);
+        createInfo.size = instanceStructureSize;
+        createInfo.type = StructureTypeTopLevel;
+        reinterpret_cast<CreateAccelerationStructure>(createStructure)(VkDevice(device), &createInfo, nullptr, &slot.structure);
+
+        slot.compute = buffers[i];
+        vkx::debug::marker::setName(device, slot.compute, "acceleration structures");
+        if (validBits > 0) {
+            vk::QueryPoolCreateInfo queryInfo;
+            queryInfo.queryType = vk::QueryType::eTimestamp;
+            queryInfo.queryCount = 2;
+            slot.timestamps = device.createQueryPool(queryInfo);
+        }
+    }
+
+    createPipeline();
+    writeDescriptors();
+}
+
+AccelerationStructures::~AccelerationStructures()
+{
+    DestroyAccelerationStructure destroy = reinterpret_cast<DestroyAccelerationStructure>(destroyStructure);
+    for (auto& mesh : meshes) {
+        destroy(VkDevice(device), mesh.second.structure, nullptr);
+        destroyBuffer(mesh.second.storage);
+    }
+    for (Slot& slot : slots) {
+        destroy(VkDevice(device), slot.structure, nullptr);
+        for (Buffer* buffer : { &slot.storage, &slot.scratch, &slot.instances, &slot.pick }) {
+            destroyBuffer(*buffer);
+        }
+        device.destroyQueryPool(slot.timestamps);
+    }
+    device.destroyCommandPool(computePool);
+    device.destroyPipeline(pickPipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorPool(descriptorPool);
+    device.destroyDescriptorSetLayout(setLayout);
+}
+
+void AccelerationStructures::loadEntryPoints()
+{
+    createStructure = device.getProcAddr("vkCreateAccelerationStructureKHR");
+    destroyStructure = device.getProcAddr("vkDestroyAccelerationStructureKHR");
+    getBuildSizes = device.getProcAddr("vkGetAccelerationStructureBuildSizesKHR");
+    cmdBuild = device.getProcAddr("vkCmdBuildAccelerationStructuresKHR");
+    cmdCopy = device.getProcAddr("vkCmdCopyAccelerationStructureKHR");
+    cmdWriteProperties = device.getProcAddr("vkCmdWriteAccelerationStructuresPropertiesKHR");
+    getStructureAddress = device.getProcAddr("vkGetAccelerationStructureDeviceAddressKHR");
+    getBufferAddress = device.getProcAddr("vkGetBufferDeviceAddressKHR");
+    assert(createStructure && destroyStructure && getBuildSizes && cmdBuild && cmdCopy && cmdWriteProperties && getStructureAddress && getBufferAddress
+        && "the device was created without ExtensionNames");
+}
+
+void AccelerationStructures::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer, bool shared)
+{
+    std::vector<uint32_t> families;
+    if (shared && IsAsync()) {
+        families = { graphicsQueueFamily, computeQueueFamily };
+    }
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory, families, MemoryAllocator::Strategy::Buddy,
+        MemoryAllocator::Category::AccelerationStructure);
+    if (usage & BufferUsageDeviceAddress) {
+        BufferDeviceAddressInfo addressInfo = {};
+        addressInfo.sType = BufferDeviceAddressInfoType;
+        addressInfo.buffer = VkBuffer(buffer.buffer);
+        buffer.address = reinterpret_cast<GetBufferDeviceAddress>(getBufferAddress)(VkDevice(device), &addressInfo);
+    }
+}
+
+void AccelerationStructures::destroyBuffer(Buffer& buffer)
+{
+    if (buffer.buffer) {
+        commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    }
+    buffer = Buffer();
+}
+
+void AccelerationStructures::createPipeline()
+{
+    // the frame's instances for ray queries anywhere, picking's ray and hit
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = DescriptorTypeAccelerationStructure;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, "D:\\workspace\\m3d\\data\\shaders\\camera\\pick.comp.spv");
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    pickPipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, pickPipeline, "pick");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+}
+
+void AccelerationStructures::writeDescriptors()
+{
+    const uint32_t slotCount = static_cast<uint32_t>(slots.size());
+    std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+        vk::DescriptorPoolSize(DescriptorTypeAccelerationStructure, slotCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, slotCount)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = slotCount;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(slotCount, setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = slotCount;
+    allocInfo.pSetLayouts = layouts.data();
+    std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        Slot& slot = slots[s];
+        slot.set = sets[s];
+
+        WriteDescriptorSetAccelerationStructure structureInfo = {};
+        structureInfo.sType = WriteDescriptorSetAccelerationStructureType;
+        structureInfo.accelerationStructureCount = 1;
+        structureInfo.pAccelerationStructures = &slot.structure;
+        vk::DescriptorBufferInfo pickInfo(slot.pick.buffer, 0, VK_WHOLE_SIZE);
+
+        std::array<vk::WriteDescriptorSet, 2> writes;
+        writes[0].pNext = &structureInfo;
+        writes[0].dstSet = slot.set;
+        writes[0].dstBinding = 0;
+        writes[0].descriptorCount = 1;
+        writes[0].descriptorType = DescriptorTypeAccelerationStructure;
+        writes[1].dstSet = slot.set;
+        writes[1].dstBinding = 1;
+        writes[1].descriptorCount = 1;
+        writes[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[1].pBufferInfo = &pickInfo;
+        device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+uint32_t AccelerationStructures::AddMeshes(const Scene& scene)
+{
+    std::vector<uint32_t> pending;
+    for (uint32_t meshID : scene.meshes) {
+        const Mesh& mesh = scene.meshes[meshID];
+        // the renderer keeps the CPU geometry while it builds them
+        if (mesh.resident && mesh.vertexCount() > 0 && mesh.HasGeometry() && meshes.count(meshID) == 0) {
+            pending.push_back(meshID);
+        }
+    }
+    if (pending.empty()) {
+        return 0;
+    }
+    const auto start = std::chrono::high_resolution_clock::now();
+    CreateAccelerationStructure create = reinterpret_cast<CreateAccelerationStructure>(createStructure);
+    DestroyAccelerationStructure destroy = reinterpret_cast<DestroyAccelerationStructure>(destroyStructure);
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+    struct Build {
+        uint32_t meshID;
+        // the positions of the mesh's vertices and its LOD 0 indices, widened to 32 bits
+        Buffer input;
+        Buffer scratch;
+        MeshStructure built;
+        AccelerationStructureGeometry geometry;
+        AccelerationStructureBuildRangeInfo range;
+    };
+
+    uint32_t built = 0;
+    for (size_t first = 0; first < pending.size(); first += MeshBatchSize) {
+        const uint32_t count = static_cast<uint32_t>(std::min<size_t>(MeshBatchSize, pending.size() - first));
+        // the build infos point into builds, it is not resized from here on
+        std::vector<Build> builds(count);
+        std::vector<AccelerationStructureBuildGeometryInfo> infos(count);
+        std::vector<const AccelerationStructureBuildRangeInfo*> ranges(count);
+        std::vector<VkAccelerationStructureKHR> structures(count);
+
+        for (uint32_t b = 0; b < count; ++b) {
+            Build& build = builds[b];
+            build.meshID = pending[first + b];
+            const Mesh& mesh = scene.meshes[build.meshID];
+            std::vector<uint32_t> indices;
+            for (const Mesh::Slice& slice : mesh.slices) {
+                for (int i = 0; i < slice.triangleCount * 3; ++i) {
+                    indices.push_back(mesh.index(slice.indexOffset + i));
+                }
+            }
+            const vk::DeviceSize vertexBytes = mesh.vertexCount() * sizeof(PackedVertex);
+            const vk::DeviceSize indexBytes = std::max<size_t>(indices.size(), 1) * sizeof(uint32_t);
+            createBuffer(BufferUsageBuildInput | BufferUsageDeviceAddress, hostVisible, vertexBytes + indexBytes, build.input);
+            uint8_t* input = static_cast<uint8_t*>(build.input.memory.mapped);
+            memcpy(input, mesh.vertexData(), vertexBytes);
+            memcpy(input + vertexBytes, indices.data(), indices.size() * sizeof(uint32_t));
+
+            // PackedVertex starts with its float position, the rest of the vertex is stepped over
+            build.geometry = {};
+            build.geometry.sType = AccelerationStructureGeometryType;
+            build.geometry.geometryType = GeometryTypeTriangles;
+            build.geometry.flags = GeometryOpaque;
+            AccelerationStructureGeometryTrianglesData& triangles = build.geometry.geometry.triangles;
+            triangles.sType = AccelerationStructureGeometryTrianglesDataType;
+            triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+            triangles.vertexData.deviceAddress = build.input.address;
+            triangles.vertexStride = sizeof(PackedVertex);
+            triangles.maxVertex = static_cast<uint32_t>(mesh.vertexCount() - 1);
+            triangles.indexType = VK_INDEX_TYPE_UINT32;
+            triangles.indexData.deviceAddress = build.input.address + vertexBytes;
+            build.range = {};
+            build.range.primitiveCount = static_cast<uint32_t>(indices.size() / 3);
+            build.built.triangles = build.range.primitiveCount;
+
+            AccelerationStructureBuildGeometryInfo& info = infos[b];
+            info = {};
+            info.sType = AccelerationStructureBuildGeometryInfoType;
+            info.type = StructureTypeBottomLevel;
+            info.flags = BuildAllowCompaction | BuildPreferFastTrace;
+            info.mode = BuildModeBuild;
+            info.geometryCount = 1;
+            info.pGeometries = &build.geometry;
+            AccelerationStructureBuildSizesInfo sizes = {};
+            sizes.sType = AccelerationStructureBuildSizesInfoType;
+            reinterpret_cast<GetAccelerationStructureBuildSizes>(getBuildSizes)(VkDevice(device), BuildTypeDevice, &info, &build.range.primitiveCount, &sizes);
+
+            createBuffer(BufferUsageStructureStorage | BufferUsageDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, sizes.accelerationStructureSize,
+                build.built.storage);
+            createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | BufferUsageDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal,
+                std::max<vk::DeviceSize>(sizes.buildScratchSize, 1), build.scratch);
+            AccelerationStructureCreateInfo createInfo = {};
+            createInfo.sType = AccelerationStructureCreateInfoType;
+            createInfo.buffer = VkBuffer(build.built.storage.buffer);
+            createInfo.size = sizes.accelerationStructureSize;
+            createInfo.type = StructureTypeBottomLevel;
+            create(VkDevice(device), &createInfo, nullptr, &build.built.structure);
+            info.dstAccelerationStructure = build.built.structure;
+            info.scratchData.deviceAddress = build.scratch.address;
+            ranges[b] = &build.range;
+            structures[b] = build.built.structure;
+            stats.builtBytes += sizes.accelerationStructureSize;
+        }
+
+        // build, then the sizes the structures compact to
+        vk::QueryPoolCreateInfo queryInfo;
+        queryInfo.queryType = QueryTypeCompactedSize;
+        queryInfo.queryCount = count;
+        vk::QueryPool sizeQueries = device.createQueryPool(queryInfo);
+        uint32_t buildCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+        vk::CommandBuffer& buildCmd = commandBuffer.GetCommandBuffer(buildCmdIndex);
+        reinterpret_cast<CmdBuildAccelerationStructures>(cmdBuild)(VkCommandBuffer(buildCmd), count, infos.data(), ranges.data());
+        vk::MemoryBarrier buildDone(AccessStructureWrite, AccessStructureRead);
+        buildCmd.pipelineBarrier(StageStructureBuild, StageStructureBuild, vk::DependencyFlags(), buildDone, nullptr, nullptr);
+        buildCmd.resetQueryPool(sizeQueries, 0, count);
+        reinterpret_cast<CmdWriteAccelerationStructuresProperties>(cmdWriteProperties)(VkCommandBuffer(buildCmd), count, structures.data(),
+            static_cast<VkQueryType>(QueryTypeCompactedSize), VkQueryPool(sizeQueries), 0);
+        commandBuffer.Flush(buildCmdIndex);
+
+        std::vector<uint64_t> compactedSizes(count);
+        device.getQueryPoolResults(sizeQueries, 0, count, compactedSizes.size() * sizeof(uint64_t), compactedSizes.data(), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+        device.destroyQueryPool(sizeQueries);
+
+        // copied into structures of the compacted size, read by the instance builds of both queues
+        uint32_t copyCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+        vk::CommandBuffer& copyCmd = commandBuffer.GetCommandBuffer(copyCmdIndex);
+        std::vector<MeshStructure> compacted(count);
+        for (uint32_t b = 0; b < count; ++b) {
+            createBuffer(BufferUsageStructureStorage | BufferUsageDeviceAddress, vk::MemoryPropertyFlagBits::eDeviceLocal, compactedSizes[b],
+                compacted[b].storage, true);
+            AccelerationStructureCreateInfo createInfo = {};
+            createInfo.sType = AccelerationStructureCreateInfoType;
+            createInfo.buffer = VkBuffer(compacted[b].storage.buffer);
+            createInfo.size = compactedSizes[b];
+            createInfo.type = StructureTypeBottomLevel;
+            create(VkDevice(device), &createInfo, nullptr, &compacted[b].structure);
+            CopyAccelerationStructureInfo copyInfo = {};
+            copyInfo.sType = CopyAccelerationStructureInfoType;
+            copyInfo.src = builds[b].built.structure;
+            copyInfo.dst = compacted[b].structure;
+            copyInfo.mode = CopyModeCompact;
+            reinterpret_cast<CmdCopyAccelerationStructure>(cmdCopy)(VkCommandBuffer(copyCmd), &copyInfo);
+        }
+        commandBuffer.Flush(copyCmdIndex);
+
+        for (uint32_t b = 0; b < count; ++b) {
+            Build& build = builds[b];
+            destroy(VkDevice(device), build.built.structure, nullptr);
+            destroyBuffer(build.built.storage);
+            destroyBuffer(build.scratch);
+            destroyBuffer(build.input);
+
+            MeshStructure& mesh = compacted[b];
+            AccelerationStructureDeviceAddressInfo addressInfo = {};
+            addressInfo.sType = AccelerationStructureDeviceAddressInfoType;
+            addressInfo.accelerationStructure = mesh.structure;
+            mesh.address = reinterpret_cast<GetAccelerationStructureDeviceAddress>(getStructureAddress)(VkDevice(device), &addressInfo);
+            mesh.triangles = build.built.triangles;
+            meshes[build.meshID] = mesh;
+            stats.meshes++;
+            stats.triangles += mesh.triangles;
+            stats.compactedBytes += compactedSizes[b];
+        }
+        built += count;
+    }
+    stats.meshBuildMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return built;
+}
+
+void AccelerationStructures::RemoveMesh(uint32_t meshID, ResourceTrash& trash)
+{
+    auto found = meshes.find(meshID);
+    if (found == meshes.end()) {
+        return;
+    }
+    const MeshStructure mesh = found->second;
+    meshes.erase(found);
+    stats.meshes--;
+    stats.triangles -= mesh.triangles;
+
+    // the slots' top level structures drop it with their next build, the mesh's instances are gone
+    vk::Device dev = device;
+    DestroyAccelerationStructure destroy = reinterpret_cast<DestroyAccelerationStructure>(destroyStructure);
+    VkAccelerationStructureKHR structure = mesh.structure;
+    trash.Trash([dev, destroy, structure]() { destroy(VkDevice(dev), structure, nullptr); });
+    commandBuffer.DestroyBuffer(mesh.storage.buffer, mesh.storage.memory, &trash);
+}
+
+void AccelerationStructures::Pick(const float origin[3], const float direction[3], float maxDistance,
+    std::function<void(uint32_t instanceID, float distance)> callback)
+{
+    pendingPick = GpuPick();
+    for (uint32_t i = 0; i < 3; ++i) {
+        pendingPick.origin[i] = origin[i];
+        pendingPick.direction[i] = direction[i];
+    }
+    pendingPick.origin[3] = 1.0f;
+    pendingPick.direction[3] = maxDistance;
+    pendingPickCallback = callback;
+}
+
+void AccelerationStructures::retire(Slot& slot)
+{
+    if (slot.pickCallback) {
+        const GpuPick* pick = static_cast<const GpuPick*>(slot.pick.memory.mapped);
+        // pick.comp reports the structure's instance index, the slot's instances are still the ones it traced
+        const uint32_t instanceID = pick->instance < slot.instanceIDs.size() ? slot.instanceIDs[pick->instance] : InvalidInstance;
+        slot.pickCallback(instanceID, instanceID == InvalidInstance ? pick->direction[3] : pick->distance);
+        slot.pickCallback = nullptr;
+    }
+    if (slot.timed) {
+        uint64_t timestamps[2];
+        // the frame waiting on the build completed, nothing to wait for
+        vk::Result result = device.getQueryPoolResults(slot.timestamps, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+        if (result == vk::Result::eSuccess) {
+            stats.instanceBuildMs = ((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0;
+        }
+        slot.timed = false;
+    }
+}
+
+void AccelerationStructures::BeginFrame(uint32_t slotIndex, const Scene& scene)
+{
+    Slot& slot = slots[slotIndex];
+    retire(slot);
+
+    // the same instances of the same meshes in the same order only moved, the slot's structure can be refit
+    AccelerationStructureInstance* out = static_cast<AccelerationStructureInstance*>(slot.instances.memory.mapped);
+    bool unchanged = slot.built;
+    uint32_t count = 0;
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        auto mesh = meshes.find(instance.meshId);
+        if (mesh == meshes.end()) {
+            continue;
+        }
+        if (count == maxInstances) {
+            printf("AccelerationStructures: more than %u instances, the rest is not traced\n", maxInstances);
+            break;
+        }
+        const m3d::math::Matrix4x3 world(scene.transformStore.GetWorld(instance.transformId));
+        AccelerationStructureInstance& gpu = out[count];
+        memcpy(gpu.transform, world.m, sizeof(gpu.transform));
+        // shaders find the mesh's materials through the custom index
+        gpu.customIndexAndMask = (instance.meshId & 0xFFFFFF) | (0xFFu << 24);
+        gpu.bindingTableOffsetAndFlags = InstanceTriangleFacingCullDisable << 24;
+        gpu.accelerationStructureReference = mesh->second.address;
+
+        if (count < slot.instanceIDs.size()) {
+            unchanged = unchanged && slot.instanceIDs[count] == instanceID && slot.instanceMeshes[count] == instance.meshId;
+            slot.instanceIDs[count] = instanceID;
+            slot.instanceMeshes[count] = instance.meshId;
+        } else {
+            unchanged = false;
+            slot.instanceIDs.push_back(instanceID);
+            slot.instanceMeshes.push_back(instance.meshId);
+        }
+        ++count;
+    }
+    unchanged = unchanged && count == slot.instanceIDs.size();
+    slot.instanceIDs.resize(count);
+    slot.instanceMeshes.resize(count);
+
+    const bool refit = unchanged && slot.refits < MaxRefits;
+    slot.refits = refit ? slot.refits + 1 : 0;
+    slot.built = true;
+    stats.instances = count;
+    if (refit) {
+        stats.refits++;
+    } else {
+        stats.rebuilds++;
+    }
+
+    if (pendingPickCallback) {
+        memcpy(slot.pick.memory.mapped, &pendingPick, sizeof(GpuPick));
+        slot.pickCallback = pendingPickCallback;
+        pendingPickCallback = nullptr;
+    }
+    recordInstanceBuild(slot, count, refit);
+}
+
+// Recorded every frame, the build mode and instance count change. The instances and the pick ray are host writes
+// before the submission, visible to it without a barrier
+void AccelerationStructures::recordInstanceBuild(Slot& slot, uint32_t instanceCount, bool refit)
+{
+    vk::CommandBuffer cmd = slot.compute;
+    cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    if (slot.timestamps) {
+        cmd.resetQueryPool(slot.timestamps, 0, 2);
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, slot.timestamps, 0);
+    }
+
+    AccelerationStructureGeometry geometry = {};
+    geometry.sType = AccelerationStructureGeometryType;
+    geometry.geometryType = GeometryTypeInstances;
+    geometry.flags = GeometryOpaque;
+    geometry.geometry.instances.sType = AccelerationStructureGeometryInstancesDataType;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data.deviceAddress = slot.instances.address;
+    AccelerationStructureBuildGeometryInfo info = {};
+    info.sType = AccelerationStructureBuildGeometryInfoType;
+    info.type = StructureTypeTopLevel;
+    info.flags = BuildAllowUpdate | BuildPreferFastTrace;
+    info.mode = refit ? BuildModeUpdate : BuildModeBuild;
+    // refit in place
+    info.srcAccelerationStructure = refit ? slot.structure : VK_NULL_HANDLE;
+    info.dstAccelerationStructure = slot.structure;
+    info.geometryCount = 1;
+    info.pGeometries = &geometry;
+    info.scratchData.deviceAddress = slot.scratch.address;
+    AccelerationStructureBuildRangeInfo range = {};
+    range.primitiveCount = instanceCount;
+    const AccelerationStructureBuildRangeInfo* ranges = &range;
+    reinterpret_cast<CmdBuildAccelerationStructures>(cmdBuild)(VkCommandBuffer(cmd), 1, &info, &ranges);
+
+    if (slot.pickCallback) {
+        vk::MemoryBarrier built(AccessStructureWrite, AccessStructureRead);
+        cmd.pipelineBarrier(StageStructureBuild, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), built, nullptr, nullptr);
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pickPipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &slot.set, 0, nullptr);
+        cmd.dispatch(1, 1, 1);
+        // read back on the host once the frame completed
+        vk::MemoryBarrier picked(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), picked, nullptr, nullptr);
+    }
+    if (!IsAsync()) {
+        // the frame follows on the same queue without a semaphore, its ray queries wait for the build here
+        vk::MemoryBarrier built(AccessStructureWrite, AccessStructureRead | vk::AccessFlagBits::eShaderRead);
+        cmd.pipelineBarrier(StageStructureBuild, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), built, nullptr, nullptr);
+    }
+
+    if (slot.timestamps) {
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, slot.timestamps, 1);
+        slot.timed = true;
+    }
+    cmd.end();
+}
+}
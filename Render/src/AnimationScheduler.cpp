@@ -0,0 +1,200 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "AnimationScheduler.hpp"
+#include "MemoryTags.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace m3d {
+
+namespace {
+    // a + (b - a) * alpha, row by row
+    m3d::math::Matrix4x3 lerp(const m3d::math::Matrix4x3& a, const m3d::math::Matrix4x3& b, float alpha)
+    {
+        using namespace m3d::math;
+        const VectorSIMD alphas = MakeVectorSIMD(alpha, alpha, alpha, alpha);
+        Matrix4x3 result;
+        for (int r = 0; r < 3; ++r) {
+            const VectorSIMD row = VectorLoad4f(a.m[r]);
+            VectorStore4f(VectorMultiplyAdd(VectorSubstract(VectorLoad4f(b.m[r]), row), alphas, row), result.m[r]);
+        }
+        return result;
+    }
+}
+
+AnimationScheduler::AnimationScheduler(ThreadPool& pool, uint32_t batchSize)
+    : pool(pool)
+    , batchSize(std::max(1u, batchSize))
+    , characters(nullptr)
+    , skinning(nullptr)
+    , remaining(0)
+{
+    // full rate down to about 200 pixels, then halving the rate and dropping a skeleton LOD per tier
+    tiers = {
+        { 200.0f, 1, 0 },
+        { 80.0f, 2, 1 },
+        { 30.0f, 4, 2 },
+        { 0.0f, 8, 3 },
+    };
+}
+
+AnimationScheduler::~AnimationScheduler()
+{
+    Wait();
+}
+
+void AnimationScheduler::SetLodTiers(const std::vector<LodTier>& lodTiers)
+{
+    Wait();
+    if (lodTiers.empty()) {
+        printf("AnimationScheduler: no LOD tier, keeping the current ones\n");
+        return;
+    }
+    tiers = lodTiers;
+}
+
+void AnimationScheduler::Run(std::vector<Character>& characterList, GpuSkinning* gpuSkinning)
+{
+    M3D_MEMORY_TAG(Animation);
+    Wait();
+    characters = &characterList;
+    skinning = gpuSkinning;
+    ++frame;
+    if (scratch.size() < characterList.size()) {
+        scratch.resize(characterList.size());
+    }
+
+    const uint32_t count = static_cast<uint32_t>(characterList.size());
+    const uint32_t batchCount = (count + batchSize - 1) / batchSize;
+    if (batchCount == 0) {
+        upload();
+        return;
+    }
+
+    remaining.store(batchCount);
+    for (uint32_t b = 0; b < batchCount; ++b) {
+        const uint32_t first = b * batchSize;
+        const uint32_t last = std::min(count, first + batchSize);
+        pool.Enqueue([this, first, last]() {
+            M3D_MEMORY_TAG(Animation);
+            for (uint32_t i = first; i < last; ++i) {
+                evaluate((*characters)[i], scratch[i], i);
+            }
+            // the edge into the upload: only the last batch to finish may read every palette
+            if (remaining.fetch_sub(1) == 1) {
+                upload();
+            }
+        });
+    }
+}
+
+void AnimationScheduler::Wait()
+{
+    pool.Wait();
+}
+
+const AnimationScheduler::LodTier& AnimationScheduler::tierOf(const Character& character) const
+{
+    for (const LodTier& tier : tiers) {
+        if (character.screenSize >= tier.minScreenSize) {
+            return tier;
+        }
+    }
+    return tiers.back();
+}
+
+void AnimationScheduler::evaluate(Character& character, Scratch& s, uint32_t index)
+{
+    if (!character.visible) {
+        // updated as soon as it shows again rather than interpolated from where it was culled
+        s.skeleton = nullptr;
+        return;
+    }
+
+    const LodTier& tier = tierOf(character);
+    const uint32_t interval = std::max(1u, tier.updateInterval);
+    const animation::Skeleton& skeleton = *character.skeleton;
+    const bool fresh = s.skeleton != &skeleton;
+    // offset by the index, the characters of a tier spread their updates over its interval
+    if (fresh || (frame + index) % interval == 0) {
+        s.previous.swap(s.current);
+        sample(character, s, tier.skeletonLod);
+        s.current.resize(skeleton.jointCount);
+        animation::BuildPalette(skeleton, s.models.data(), s.current.data());
+        if (fresh) {
+            s.previous = s.current;
+            s.skeleton = &skeleton;
+        }
+        s.age = 0;
+    } else {
+        ++s.age;
+    }
+
+    // GpuSkinning writes world space vertices, the palette carries the character's placement each frame
+    const m3d::math::Matrix4x3 world(character.world);
+    const float alpha = std::min(1.0f, static_cast<float>(s.age + 1) / static_cast<float>(interval));
+    character.palette.resize(skeleton.jointCount);
+    for (uint32_t j = 0; j < skeleton.jointCount; ++j) {
+        character.palette[j] = world * (alpha < 1.0f ? lerp(s.previous[j], s.current[j], alpha) : s.current[j]);
+    }
+}
+
+void AnimationScheduler::sample(const Character& character, Scratch& s, uint32_t skeletonLod)
+{
+    const animation::Skeleton& skeleton = *character.skeleton;
+    const size_t layerCount = character.layers.size();
+    if (s.layerPoses.size() < layerCount) {
+        s.layerPoses.resize(layerCount);
+    }
+
+    const animation::SkeletonPose* pose = nullptr;
+    if (layerCount == 0) {
+        s.blended.Reset(skeleton);
+        pose = &s.blended;
+    } else if (layerCount == 1) {
+        const Layer& layer = character.layers[0];
+        if (s.layerPoses[0].pSkeleton != &skeleton) {
+            s.layerPoses[0].Reset(skeleton);
+        }
+        animation::SampleClip(*layer.clip, layer.time, layer.loop, s.layerPoses[0], skeletonLod);
+        pose = &s.layerPoses[0];
+    } else {
+        s.blendLayers.resize(layerCount);
+        for (size_t l = 0; l < layerCount; ++l) {
+            const Layer& layer = character.layers[l];
+            if (s.layerPoses[l].pSkeleton != &skeleton) {
+                s.layerPoses[l].Reset(skeleton);
+            }
+            animation::SampleClip(*layer.clip, layer.time, layer.loop, s.layerPoses[l], skeletonLod);
+            s.blendLayers[l].pose = &s.layerPoses[l];
+            s.blendLayers[l].weight = layer.weight;
+            s.blendLayers[l].jointWeights = layer.jointWeights;
+        }
+        if (s.blended.pSkeleton != &skeleton) {
+            s.blended.Reset(skeleton);
+        }
+        animation::BlendPoses(s.blendLayers.data(), layerCount, s.blended);
+        pose = &s.blended;
+    }
+
+    s.models.resize(skeleton.jointCount);
+    animation::LocalToModel(*pose, s.models.data());
+}
+
+void AnimationScheduler::upload()
+{
+    for (Character& character : *characters) {
+        character.vertexOffset = GpuSkinning::InvalidOffset;
+        if (skinning && character.mesh && character.visible) {
+            const float* morphWeights = character.morphWeights.size() >= character.mesh->morphTargetCount ? character.morphWeights.data() : nullptr;
+            character.vertexOffset = skinning->AddInstance(*character.mesh, character.palette.data(), character.skeleton->jointCount, morphWeights);
+        }
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,259 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ArchetypeStore.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace m3d {
+
+static const uint32_t SlotBits = 22;
+static const uint32_t SlotMask = (1u << SlotBits) - 1;
+static const uint32_t ArrayAlignment = 64;
+
+namespace {
+    // sizes of the component types by index, shared by every store
+    struct Components {
+        std::mutex mutex;
+        uint32_t sizes[ArchetypeStore::MaxComponents];
+        uint32_t count = 0;
+    };
+
+    Components& components()
+    {
+        static Components instance;
+        return instance;
+    }
+
+    uint32_t alignUp(uint32_t offset)
+    {
+        return (offset + ArrayAlignment - 1) & ~(ArrayAlignment - 1);
+    }
+}
+
+uint32_t ArchetypeStore::registerComponent(size_t size)
+{
+    Components& types = components();
+    std::lock_guard<std::mutex> lock(types.mutex);
+    if (types.count == MaxComponents) {
+        printf("ArchetypeStore: more than %u component types\n", MaxComponents);
+        assert(false);
+        return MaxComponents - 1;
+    }
+    types.sizes[types.count] = static_cast<uint32_t>(size);
+    return types.count++;
+}
+
+const ArchetypeStore::Record* ArchetypeStore::record(Entity entity) const
+{
+    const uint32_t slot = entity & SlotMask;
+    if (slot >= records.size() || !records[slot].alive || records[slot].generation != entity >> SlotBits) {
+        return nullptr;
+    }
+    return &records[slot];
+}
+
+bool ArchetypeStore::Alive(Entity entity) const
+{
+    return record(entity) != nullptr;
+}
+
+ArchetypeStore::Mask ArchetypeStore::maskOf(Entity entity) const
+{
+    const Record* entry = record(entity);
+    return entry ? archetypes[entry->archetype]->mask : 0;
+}
+
+uint8_t* ArchetypeStore::rowData(const Archetype& archetype, uint32_t row, uint32_t index)
+{
+    const Chunk& chunk = archetype.chunks[row / archetype.capacity];
+    return chunk.data + archetype.offsets[index] + (row % archetype.capacity) * archetype.sizes[index];
+}
+
+uint32_t ArchetypeStore::archetypeOf(Mask mask)
+{
+    auto found = archetypeIndices.find(mask);
+    if (found != archetypeIndices.end()) {
+        return found->second;
+    }
+
+    std::unique_ptr<Archetype> archetype(new Archetype());
+    archetype->mask = mask;
+    uint32_t rowBytes = sizeof(Entity);
+    {
+        Components& types = components();
+        std::lock_guard<std::mutex> lock(types.mutex);
+        for (uint32_t index = 0; index < MaxComponents; ++index) {
+            const bool present = index < types.count && (mask & (Mask(1) << index));
+            archetype->sizes[index] = present ? types.sizes[index] : 0;
+            archetype->offsets[index] = 0;
+            if (present) {
+                archetype->components.push_back(index);
+                rowBytes += types.sizes[index];
+            }
+        }
+    }
+    // every array may lose up to an alignment to padding
+    const uint32_t padding = static_cast<uint32_t>(archetype->components.size() + 1) * ArrayAlignment;
+    archetype->capacity = std::max((static_cast<uint32_t>(ChunkBytes) - padding) / rowBytes, 1u);
+
+    uint32_t offset = 0;
+    for (uint32_t index : archetype->components) {
+        archetype->offsets[index] = offset;
+        offset = alignUp(offset + archetype->capacity * archetype->sizes[index]);
+    }
+    archetype->entityOffset = offset;
+
+    const uint32_t archetypeIndex = static_cast<uint32_t>(archetypes.size());
+    archetypes.push_back(std::move(archetype));
+    archetypeIndices.emplace(mask, archetypeIndex);
+    return archetypeIndex;
+}
+
+uint32_t ArchetypeStore::push(uint32_t archetypeIndex, uint32_t slot)
+{
+    Archetype& archetype = *archetypes[archetypeIndex];
+    if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity) {
+        if (!archetype.spare.empty()) {
+            archetype.chunks.push_back(std::move(archetype.spare.back()));
+            archetype.spare.pop_back();
+        } else {
+            const size_t bytes = archetype.entityOffset + archetype.capacity * sizeof(Entity);
+            Chunk chunk;
+            chunk.memory.reset(new uint8_t[bytes + ArrayAlignment]);
+            const uintptr_t address = reinterpret_cast<uintptr_t>(chunk.memory.get());
+            chunk.data = chunk.memory.get() + (ArrayAlignment - address % ArrayAlignment) % ArrayAlignment;
+            chunk.count = 0;
+            archetype.chunks.push_back(std::move(chunk));
+        }
+    }
+    Chunk& chunk = archetype.chunks.back();
+    const uint32_t row = static_cast<uint32_t>(archetype.chunks.size() - 1) * archetype.capacity + chunk.count;
+    entities(archetype, chunk)[chunk.count] = (records[slot].generation << SlotBits) | slot;
+    ++chunk.count;
+    return row;
+}
+
+void ArchetypeStore::pop(uint32_t archetypeIndex, uint32_t row)
+{
+    Archetype& archetype = *archetypes[archetypeIndex];
+    Chunk& last = archetype.chunks.back();
+    const uint32_t lastRow = static_cast<uint32_t>(archetype.chunks.size() - 1) * archetype.capacity + last.count - 1;
+    if (row != lastRow) {
+        const Entity moved = entities(archetype, last)[last.count - 1];
+        for (uint32_t index : archetype.components) {
+            memcpy(rowData(archetype, row, index), rowData(archetype, lastRow, index), archetype.sizes[index]);
+        }
+        Chunk& chunk = archetype.chunks[row / archetype.capacity];
+        entities(archetype, chunk)[row % archetype.capacity] = moved;
+        records[moved & SlotMask].row = row;
+    }
+    if (--last.count == 0) {
+        archetype.spare.push_back(std::move(last));
+        archetype.chunks.pop_back();
+    }
+}
+
+ArchetypeStore::Entity ArchetypeStore::create(Mask mask)
+{
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else {
+        slot = static_cast<uint32_t>(records.size());
+        assert(slot < SlotMask);
+        const Record unused = { 0, 0, 0, false };
+        records.push_back(unused);
+    }
+    Record& entry = records[slot];
+    entry.archetype = archetypeOf(mask);
+    entry.row = push(entry.archetype, slot);
+    entry.alive = true;
+    ++size;
+    return (entry.generation << SlotBits) | slot;
+}
+
+void ArchetypeStore::Destroy(Entity entity)
+{
+    if (!Alive(entity)) {
+        return;
+    }
+    const uint32_t slot = entity & SlotMask;
+    Record& entry = records[slot];
+    pop(entry.archetype, entry.row);
+    entry.alive = false;
+    entry.generation = (entry.generation + 1) & (0xFFFFFFFFu >> SlotBits);
+    freeSlots.push_back(slot);
+    --size;
+}
+
+void* ArchetypeStore::component(Entity entity, uint32_t index)
+{
+    const Record* entry = record(entity);
+    if (!entry) {
+        return nullptr;
+    }
+    const Archetype& archetype = *archetypes[entry->archetype];
+    return archetype.mask & (Mask(1) << index) ? rowData(archetype, entry->row, index) : nullptr;
+}
+
+void ArchetypeStore::move(Entity entity, Mask mask)
+{
+    const Record* entry = record(entity);
+    if (!entry || archetypes[entry->archetype]->mask == mask) {
+        return;
+    }
+    const uint32_t slot = entity & SlotMask;
+    const uint32_t from = entry->archetype;
+    const uint32_t fromRow = entry->row;
+    const uint32_t to = archetypeOf(mask);
+    const uint32_t toRow = push(to, slot);
+
+    const Archetype& source = *archetypes[from];
+    const Archetype& target = *archetypes[to];
+    for (uint32_t index : source.components) {
+        if (target.mask & (Mask(1) << index)) {
+            memcpy(rowData(target, toRow, index), rowData(source, fromRow, index), source.sizes[index]);
+        }
+    }
+    pop(from, fromRow);
+    records[slot].archetype = to;
+    records[slot].row = toRow;
+}
+
+size_t ArchetypeStore::ChunkCount() const
+{
+    size_t count = 0;
+    for (const std::unique_ptr<Archetype>& archetype : archetypes) {
+        count += archetype->chunks.size();
+    }
+    return count;
+}
+
+void ArchetypeStore::Clear()
+{
+    for (const std::unique_ptr<Archetype>& archetype : archetypes) {
+        for (Chunk& chunk : archetype->chunks) {
+            chunk.count = 0;
+            archetype->spare.push_back(std::move(chunk));
+        }
+        archetype->chunks.clear();
+    }
+    for (uint32_t slot = 0; slot < records.size(); ++slot) {
+        if (records[slot].alive) {
+            records[slot].alive = false;
+            records[slot].generation = (records[slot].generation + 1) & (0xFFFFFFFFu >> SlotBits);
+            freeSlots.push_back(slot);
+        }
+    }
+    size = 0;
+}
+} // End of namespace m3d
@@ -0,0 +1,102 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "BufferAddress.hpp"
+#include "VulkanHelper.hpp"
+
+namespace m3d {
+
+// VK_KHR_get_physical_device_properties2, VK_KHR_device_group and VK_KHR_buffer_device_address postdate the vulkan headers
+static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+static const VkStructureType PhysicalDeviceBufferDeviceAddressFeaturesType = static_cast<VkStructureType>(1000257000);
+static const VkStructureType BufferDeviceAddressInfoType = static_cast<VkStructureType>(1000244001);
+static const VkStructureType MemoryAllocateFlagsInfoType = static_cast<VkStructureType>(1000060000);
+static const VkFlags MemoryAllocateDeviceAddress = 0x2;
+
+struct PhysicalDeviceFeatures2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceFeatures features;
+};
+
+struct PhysicalDeviceBufferDeviceAddressFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 bufferDeviceAddress;
+    VkBool32 bufferDeviceAddressCaptureReplay;
+    VkBool32 bufferDeviceAddressMultiDevice;
+};
+
+struct BufferDeviceAddressInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkBuffer buffer;
+};
+
+struct MemoryAllocateFlagsInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkFlags flags;
+    uint32_t deviceMask;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+typedef uint64_t(VKAPI_PTR* GetBufferDeviceAddress)(VkDevice device, const BufferDeviceAddressInfo* info);
+
+const char* const BufferAddress::ExtensionName = "VK_KHR_buffer_device_address";
+const vk::BufferUsageFlagBits BufferAddress::Usage = static_cast<vk::BufferUsageFlagBits>(0x00020000);
+
+bool BufferAddress::IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    // the allocate flags are VK_KHR_device_group's, core in 1.1
+    if (physicalDevice.getProperties().apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
+        return false;
+    }
+    if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, ExtensionName)) {
+        return false;
+    }
+    PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!getFeatures2) {
+        return false;
+    }
+    PhysicalDeviceBufferDeviceAddressFeatures deviceAddress = {};
+    deviceAddress.sType = PhysicalDeviceBufferDeviceAddressFeaturesType;
+    PhysicalDeviceFeatures2 features = {};
+    features.sType = PhysicalDeviceFeatures2Type;
+    features.pNext = &deviceAddress;
+    reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+    return deviceAddress.bufferDeviceAddress == VK_TRUE;
+}
+
+const void* BufferAddress::GetFeatureChain(const void* next)
+{
+    // read by vkCreateDevice only, one device at a time
+    static PhysicalDeviceBufferDeviceAddressFeatures features = {};
+    features.sType = PhysicalDeviceBufferDeviceAddressFeaturesType;
+    features.pNext = next;
+    features.bufferDeviceAddress = VK_TRUE;
+    return &features;
+}
+
+const void* BufferAddress::GetAllocateFlags()
+{
+    static const MemoryAllocateFlagsInfo flags = { MemoryAllocateFlagsInfoType, nullptr, MemoryAllocateDeviceAddress, 0 };
+    return &flags;
+}
+
+uint64_t BufferAddress::Get(vk::Device device, vk::Buffer buffer)
+{
+    // once per buffer, not worth caching per device
+    PFN_vkVoidFunction getAddress = device.getProcAddr("vkGetBufferDeviceAddressKHR");
+    if (!getAddress) {
+        return 0;
+    }
+    BufferDeviceAddressInfo info = {};
+    info.sType = BufferDeviceAddressInfoType;
+    info.buffer = VkBuffer(buffer);
+    return reinterpret_cast<GetBufferDeviceAddress>(getAddress)(VkDevice(device), &info);
+}
+}
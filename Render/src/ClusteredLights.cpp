@@ -0,0 +1,219 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ClusteredLights.hpp"
+#include "Scene.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace m3d {
+
+ClusteredLights::ClusteredLights(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+{
+    createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        sizeof(ClusterParams), params);
+    mappedParams = static_cast<ClusterParams*>(device.mapMemory(params.memory, 0, sizeof(ClusterParams)));
+    *mappedParams = ClusterParams();
+    mappedParams->grid[0] = GridX;
+    mappedParams->grid[1] = GridY;
+    mappedParams->grid[2] = GridZ;
+    mappedParams->grid[3] = MaxLightsPerCluster;
+    // what an unlit surface keeps, scenes without lights are not black
+    std::fill(mappedParams->ambient, mappedParams->ambient + 3, 0.1f);
+
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        MaxLights * sizeof(GpuLight), lights);
+    mappedLights = static_cast<GpuLight*>(device.mapMemory(lights.memory, 0, MaxLights * sizeof(GpuLight)));
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        ClusterCount * (1 + MaxLightsPerCluster) * sizeof(uint32_t), clusters);
+    vkx::debug::marker::setName(device, params.buffer, "cluster params");
+    vkx::debug::marker::setName(device, lights.buffer, "lights");
+    vkx::debug::marker::setName(device, clusters.buffer, "light clusters");
+
+    createPipeline();
+}
+
+ClusteredLights::~ClusteredLights()
+{
+    device.destroyPipeline(pipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorSetLayout(setLayout);
+    device.destroyDescriptorPool(descriptorPool);
+
+    device.unmapMemory(params.memory);
+    device.unmapMemory(lights.memory);
+    for (Buffer* buffer : { &params, &lights, &clusters }) {
+        device.destroyBuffer(buffer->buffer);
+        device.freeMemory(buffer->memory);
+    }
+}
+
+void ClusteredLights::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(usage);
+    bufferCreateInfo.setSize(size);
+    buffer.buffer = device.createBuffer(bufferCreateInfo);
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(buffer.buffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, properties);
+    buffer.memory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+}
+
+void ClusteredLights::createPipeline()
+{
+    // parameters, lights, clusters
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    bindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, "D:\\workspace\\m3d\\data\\shaders\\camera\\light_cluster.comp.spv");
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    pipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, pipeline, "light cluster");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+
+    std::array<vk::DescriptorPoolSize, 2> poolSizes;
+    poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = vk::DescriptorType::eStorageBuffer;
+    poolSizes[1].descriptorCount = 2;
+
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    descriptorSet = device.allocateDescriptorSets(allocInfo)[0];
+
+    std::array<vk::DescriptorBufferInfo, 3> bufferInfos = { GetParamsDescriptor(), GetLightDescriptor(), GetClusterDescriptor() };
+    std::vector<vk::WriteDescriptorSet> writes(bufferInfos.size());
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = i == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+}
+
+void ClusteredLights::Update(Scene& scene, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection)
+{
+    scene.transformStore.Update();
+
+    // directional lights first, the clusters only index the rest
+    uint32_t count = 0;
+    uint32_t directionalCount = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t lightID : scene.lights) {
+            const Light& light = scene.lights[lightID];
+            if ((light.type == Light::Directional) != (pass == 0) || count == MaxLights) {
+                continue;
+            }
+            // column vector world matrix: translation in the last column, -Y is the negated second one
+            const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(light.transformId);
+            float scale = 0.0f;
+            float direction[3];
+            for (int c = 0; c < 3; ++c) {
+                const float axisLength = std::sqrt(world.m[0][c] * world.m[0][c] + world.m[1][c] * world.m[1][c] + world.m[2][c] * world.m[2][c]);
+                scale = std::max(scale, axisLength);
+                direction[c] = -world.m[c][1];
+            }
+            const float directionLength = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+            GpuLight& gpuLight = mappedLights[count++];
+            for (int c = 0; c < 3; ++c) {
+                gpuLight.position[c] = world.m[c][3];
+                gpuLight.color[c] = light.color[c] * light.intensity;
+                gpuLight.direction[c] = directionLength > 0.0f ? direction[c] / directionLength : (c == 1 ? -1.0f : 0.0f);
+            }
+            gpuLight.position[3] = light.range * scale;
+            gpuLight.color[3] = static_cast<float>(light.type);
+            gpuLight.direction[3] = std::cos(light.outerCone);
+            gpuLight.cone[0] = std::cos(light.innerCone);
+            gpuLight.cone[1] = gpuLight.cone[2] = gpuLight.cone[3] = 0.0f;
+            if (pass == 0) {
+                ++directionalCount;
+            }
+        }
+    }
+    if (count < scene.lights.size()) {
+        printf("ClusteredLights: %u of %u lights, MaxLights is %u\n", count, static_cast<uint32_t>(scene.lights.size()), MaxLights);
+    }
+
+    // near and far of the OpenGL style perspective, clip z = A * z + B with A = m[2][2] and B = m[2][3]
+    const float a = projection.m[2][2];
+    const float b = projection.m[2][3];
+    const float nearZ = b / (a - 1.0f);
+    const float farZ = b / (a + 1.0f);
+    const float sliceScale = static_cast<float>(GridZ) / std::log(farZ / nearZ);
+
+    mappedParams->viewMatrix = view;
+    mappedParams->unproject[0] = projection.m[0][0];
+    mappedParams->unproject[1] = projection.m[1][1];
+    mappedParams->unproject[2] = projection.m[0][2];
+    mappedParams->unproject[3] = projection.m[1][2];
+    mappedParams->depth[0] = nearZ;
+    mappedParams->depth[1] = farZ;
+    mappedParams->depth[2] = sliceScale;
+    mappedParams->depth[3] = std::log(nearZ) * sliceScale;
+    mappedParams->lightCount = count;
+    mappedParams->directionalCount = directionalCount;
+}
+
+void ClusteredLights::RecordCluster(vk::CommandBuffer cmd)
+{
+    // The previous frame is done shading with the clusters
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    cmd.dispatch((ClusterCount + GroupSize - 1) / GroupSize, 1, 1);
+
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+}
+} // End of namespace m3d
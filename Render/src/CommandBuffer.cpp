@@ -1,79 +1,158 @@
 #include "../include/CommandBuffer.hpp"
+#include "../include/ClusteredLights.hpp"
+#include "../include/CrowdRenderer.hpp"
+#include "../include/FrameArena.hpp"
+#include "../include/GeometryArena.hpp"
+#include "../include/GpuCulling.hpp"
+#include "../include/GpuProfiler.hpp"
+#include "../include/GpuSkinning.hpp"
+#include "../include/GuiRenderer.hpp"
+#include "../include/ImpostorRenderer.hpp"
+#include "../include/IndirectDraws.hpp"
+#include "../include/MaterialTable.hpp"
+#include "../include/OcclusionQueries.hpp"
+#include "../include/ParticleSystem.hpp"
+#include "../include/PerfLint.hpp"
 #include "../include/Pipeline.hpp"
+#include "../include/PostProcess.hpp"
+#include "../include/ResourceTrash.hpp"
 #include "../include/Scene.hpp"
+#include "../include/ShadingRate.hpp"
+#include "../include/SoftwareOcclusion.hpp"
+#include "../include/ThreadPool.hpp"
+#include "../include/Trace.hpp"
 #include "../include/VulkanHelper.hpp"
 #include "../include/VulkanSwapchain.hpp"
+#include "../include/vulkanDebug.h"
 
-static const uint32_t width = 1280;
-static const uint32_t height = 720;
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 
 namespace m3d {
-CommandBuffer::CommandBuffer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, vk::Queue& Queue, VulkanSwapChain& swapChain)
+CommandBuffer::CommandBuffer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, vk::Queue& Queue, VulkanSwapChain& swapChain, MemoryAllocator& Allocator)
     : device(Device)
     , physicalDevice(PhysicalDevice)
     , queue(Queue)
     , swapChain(swapChain)
+    , allocator(Allocator)
 {
     createCommandPool();
+    allocateDrawCommandBuffers();
+}
 
-    drawCmdBuffers.resize(swapChain.images.size());
-
+void CommandBuffer::allocateDrawCommandBuffers()
+{
     vk::CommandBufferAllocateInfo cmdBufAllocateInfo = {};
     cmdBufAllocateInfo.commandPool = cmdPool;
     cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
-    cmdBufAllocateInfo.commandBufferCount = drawCmdBuffers.size();
+    cmdBufAllocateInfo.commandBufferCount = static_cast<uint32_t>(swapChain.images.size());
 
     drawCmdBuffers = device.allocateCommandBuffers(cmdBufAllocateInfo);
+    for (size_t i = 0; i < drawCmdBuffers.size(); ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "draw %u", static_cast<uint32_t>(i));
+        vkx::debug::marker::setName(device, drawCmdBuffers[i], name);
+    }
 }
 
 /* Create Frame Buffer */
-void CommandBuffer::CreateDepthStencil()
+void CommandBuffer::createTarget(vk::Format format, vk::ImageUsageFlags usage, vk::SampleCountFlagBits samples, vk::ImageAspectFlags aspect, const char* name,
+    Target& target, uint32_t layers)
 {
-    vk::Format depthFormat;
-    assert(vkhelper::getSupportedDepthFormat(physicalDevice, depthFormat));
+    target.format = format;
+    target.layers = layers;
 
     vk::ImageCreateInfo image = {};
-    image.setSType(vk::StructureType::eImageCreateInfo);
-    image.setPNext(nullptr);
     image.imageType = vk::ImageType::e2D;
-    image.format = depthFormat;
-    image.extent = { width, height, 1 };
+    image.format = format;
+    image.extent = { extent.width, extent.height, 1 };
     image.mipLevels = 1;
-    image.arrayLayers = 1;
-    image.samples = vk::SampleCountFlagBits::e1;
+    image.arrayLayers = layers;
+    image.samples = samples;
     image.tiling = vk::ImageTiling::eOptimal;
-    image.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc;
-
-    vk::MemoryAllocateInfo memAlloc = {};
-    memAlloc.setSType(vk::StructureType::eMemoryAllocateInfo);
-    memAlloc.pNext = nullptr;
-    memAlloc.setAllocationSize(0);
-    memAlloc.memoryTypeIndex = 0;
-
-    vk::ImageViewCreateInfo depthStencilView = {};
-    depthStencilView.setSType(vk::StructureType::eImageViewCreateInfo);
-    depthStencilView.setViewType(vk::ImageViewType::e2D);
-    depthStencilView.format = depthFormat;
-
-    depthStencilView.subresourceRange = vk::ImageSubresourceRange{
-        vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
-        0,
-        1,
-        0,
-        1
-    };
+    image.usage = usage;
+    target.image = device.createImage(image, nullptr);
+    vkx::debug::marker::setName(device, target.image, name);
 
-    vk::MemoryRequirements memReqs;
-    depthStencil.image = device.createImage(image, nullptr);
-    memReqs = device.getImageMemoryRequirements(depthStencil.image);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    depthStencil.mem = device.allocateMemory(memAlloc, nullptr);
-    device.bindImageMemory(depthStencil.image, depthStencil.mem, 0);
+    // Attachments that never leave the render pass stay in tile memory on tile-based GPUs,
+    // lazily allocated memory is only committed if the driver spills them
+    vk::MemoryPropertyFlags properties = vk::MemoryPropertyFlagBits::eDeviceLocal;
+    if ((usage & vk::ImageUsageFlagBits::eTransientAttachment) && allocator.SupportsImage(target.image, vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+        properties = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+    }
+    // render targets come and go together with the swapchain
+    target.mem = allocator.AllocateImage(target.image, properties, true, MemoryAllocator::Strategy::Linear, MemoryAllocator::Category::Attachment);
 
-    depthStencilView.image = depthStencil.image;
+    vk::ImageViewCreateInfo view = {};
+    view.viewType = layers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D;
+    view.format = format;
+    view.subresourceRange = vk::ImageSubresourceRange{ aspect, 0, 1, 0, layers };
+    view.image = target.image;
+    target.view = device.createImageView(view, nullptr);
+}
 
-    depthStencil.view = device.createImageView(depthStencilView, nullptr);
+void CommandBuffer::CreateDepthStencil(Pipeline& pipeline)
+{
+    vk::Format depthFormat = {};
+    bool depthFormatFound = vkhelper::getSupportedDepthFormat(physicalDevice, depthFormat);
+    assert(depthFormatFound);
+    extent = swapChain.extent;
+    // multiview: the views tile the swapchain image, two side by side and more in rows of two
+    const uint32_t views = pipeline.GetViewCount();
+    viewColumns = views > 1 ? 2 : 1;
+    viewRows = (views + viewColumns - 1) / viewColumns;
+    extent.width /= viewColumns;
+    extent.height /= viewRows;
+    SetRenderScale(renderScale);
+
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    if (pipeline.StoresDepth()) {
+        // sampled: GPU culling builds its depth pyramid from the previous frame
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+        if (physicalDevice.getFormatProperties(depthFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) {
+            usage |= vk::ImageUsageFlagBits::eSampled;
+        }
+    } else {
+        // cleared at the start of the render pass and dropped at its end
+        usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+    }
+    createTarget(depthFormat, usage, pipeline.GetSamples(), vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil, "depth stencil",
+        depthStencil, views);
+
+    // resolved into the swapchain image, or the view layers, within the render pass
+    if (pipeline.GetSamples() != vk::SampleCountFlagBits::e1) {
+        createTarget(pipeline.GetColorFormat(), vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment, pipeline.GetSamples(),
+            vk::ImageAspectFlagBits::eColor, "multisample color", multisampleColor, views);
+    }
+    // blitted into the swapchain image after the render pass, or sampled by the post stack
+    if (views > 1 || dynamicResolution || post) {
+        const vk::ImageUsageFlags read = post ? vk::ImageUsageFlagBits::eSampled : vk::ImageUsageFlagBits::eTransferSrc;
+        createTarget(pipeline.GetColorFormat(), vk::ImageUsageFlagBits::eColorAttachment | read, vk::SampleCountFlagBits::e1,
+            vk::ImageAspectFlagBits::eColor, "scene color", sceneColor, views);
+    }
+    // picks copy texels of it after the render pass
+    if (pipeline.HasIdBuffer()) {
+        createTarget(Pipeline::IdFormat, vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc, vk::SampleCountFlagBits::e1,
+            vk::ImageAspectFlagBits::eColor, "id buffer", idBuffer);
+    }
+    // weighted blended transparency, written and read within the render pass only
+    if (pipeline.HasWeightedBlended()) {
+        const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment
+            | vk::ImageUsageFlagBits::eTransientAttachment;
+        createTarget(Pipeline::AccumFormat, usage, vk::SampleCountFlagBits::e1, vk::ImageAspectFlagBits::eColor, "transparency accumulation",
+            transparencyAccum);
+        createTarget(Pipeline::RevealFormat, usage, vk::SampleCountFlagBits::e1, vk::ImageAspectFlagBits::eColor, "transparency revealage",
+            transparencyReveal);
+    }
+    // deferred shading, the same
+    if (pipeline.IsDeferred()) {
+        const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eInputAttachment
+            | vk::ImageUsageFlagBits::eTransientAttachment;
+        createTarget(Pipeline::GBufferAlbedoFormat, usage, vk::SampleCountFlagBits::e1, vk::ImageAspectFlagBits::eColor, "g-buffer albedo", gbufferAlbedo);
+        createTarget(Pipeline::GBufferNormalFormat, usage, vk::SampleCountFlagBits::e1, vk::ImageAspectFlagBits::eColor, "g-buffer normal", gbufferNormal);
+        createTarget(Pipeline::GBufferDepthFormat, usage, vk::SampleCountFlagBits::e1, vk::ImageAspectFlagBits::eColor, "g-buffer depth", gbufferDepth);
+    }
 }
 
 void CommandBuffer::CreateFramebuffers(Pipeline& pipeline)
@@ -81,12 +160,29 @@ void CommandBuffer::CreateFramebuffers(Pipeline& pipeline)
     // Create frame buffers for every swap chain image
     frameBuffers.resize(swapChain.images.size());
 
-    
-
     for (size_t i = 0; i < frameBuffers.size(); i++) {
-		std::array<vk::ImageView, 2> attachments;
-        attachments[0] = swapChain.buffers[i].view;
-		attachments[1] = depthStencil.view;
+        // in the order of Pipeline::CreateRenderPass, multisampled the swapchain image is the resolve target.
+        // Multiview and dynamic resolution render into the scene color instead; with multiview the framebuffer keeps
+        // one layer and the view mask picks them
+        const vk::ImageView target = sceneColor.view ? sceneColor.view : swapChain.buffers[i].view;
+        std::vector<vk::ImageView> attachments;
+        attachments.push_back(multisampleColor.view ? multisampleColor.view : target);
+        attachments.push_back(depthStencil.view);
+        if (multisampleColor.view) {
+            attachments.push_back(target);
+        }
+        if (idBuffer.view) {
+            attachments.push_back(idBuffer.view);
+        }
+        if (transparencyAccum.view) {
+            attachments.push_back(transparencyAccum.view);
+            attachments.push_back(transparencyReveal.view);
+        }
+        if (gbufferAlbedo.view) {
+            attachments.push_back(gbufferAlbedo.view);
+            attachments.push_back(gbufferNormal.view);
+            attachments.push_back(gbufferDepth.view);
+        }
 
         vk::FramebufferCreateInfo frameBufferCreateInfo = {};
         //frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -94,202 +190,1086 @@ void CommandBuffer::CreateFramebuffers(Pipeline& pipeline)
         frameBufferCreateInfo.renderPass = pipeline.GetRenderPass();
         frameBufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
         frameBufferCreateInfo.pAttachments = attachments.data();
-        frameBufferCreateInfo.width = width;
-        frameBufferCreateInfo.height = height;
+        frameBufferCreateInfo.width = extent.width;
+        frameBufferCreateInfo.height = extent.height;
         frameBufferCreateInfo.layers = 1;
         // Create the framebuffer
         frameBuffers[i] = device.createFramebuffer(frameBufferCreateInfo);
+
+        char name[32];
+        snprintf(name, sizeof(name), "framebuffer %u", static_cast<uint32_t>(i));
+        vkx::debug::marker::setName(device, frameBuffers[i], name);
     }
 }
 
-void CommandBuffer::CreateBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, void* data, vk::Buffer& buffer, vk::DeviceMemory& memory)
+void CommandBuffer::CreateBuffer(vk::BufferUsageFlags usageFlags, vk::MemoryPropertyFlags memoryPropertyFlags, vk::DeviceSize size, void* data, vk::Buffer& buffer, MemoryAllocator::Allocation& memory,
+    const std::vector<uint32_t>& sharedQueueFamilies, MemoryAllocator::Strategy strategy, MemoryAllocator::Category category)
 {
-    vk::MemoryRequirements memReqs = {};
-    vk::MemoryAllocateInfo memAlloc = {};
     vk::BufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.setUsage(usageFlags);
     bufferCreateInfo.setSize(size);
+    if (sharedQueueFamilies.size() > 1) {
+        bufferCreateInfo.setSharingMode(vk::SharingMode::eConcurrent);
+        bufferCreateInfo.setQueueFamilyIndexCount(static_cast<uint32_t>(sharedQueueFamilies.size()));
+        bufferCreateInfo.setPQueueFamilyIndices(sharedQueueFamilies.data());
+    }
 
     //VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, buffer));
     buffer = device.createBuffer(bufferCreateInfo);
-    //vkGetBufferMemoryRequirements(device, buffer, &memReqs);
-    memReqs = device.getBufferMemoryRequirements(buffer);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, memoryPropertyFlags);
-
-    //VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, memory));
-    memory = device.allocateMemory(memAlloc);
-    if (data != nullptr) {
-        void* mapped;
-        //VK_CHECK_RESULT(vkMapMemory(device, *memory, 0, size, 0, &mapped));
-        mapped = device.mapMemory(memory, 0, size);
-        memcpy(mapped, data, size);
-        //vkUnmapMemory(device, *memory);
-        device.unmapMemory(memory);
-    }
-    //VK_CHECK_RESULT(vkBindBufferMemory(device, *buffer, *memory, 0));
-    device.bindBufferMemory(buffer, memory, 0);
-}
-
-void CommandBuffer::CreateVertices(std::vector<float>& vertices, std::vector<uint32_t> &indices)
-{
-    size_t vertexBufferSize = vertices.size() * sizeof(float);
-    size_t indexBufferSize = indices.size() * sizeof(uint32_t);
-    // TODO
-    meshBuffer.indexCount = indices.size();
-
-    struct {
-        vk::Buffer buffer;
-        vk::DeviceMemory memory;
-    } vertexStaging, indexStaging;
-
-    // Create staging buffers
-    // Vertex data
-    CreateBuffer(
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible,
-        vertexBufferSize,
-        vertices.data(),
-        vertexStaging.buffer,
-        vertexStaging.memory);
-    // Index data
-    CreateBuffer(
-        vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible,
-        indexBufferSize,
-        indices.data(),
-        indexStaging.buffer,
-        indexStaging.memory);
-
-    // Create device local buffers
-    // Vertex buffer
-    CreateBuffer(
-        vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        vk::MemoryPropertyFlagBits::eDeviceLocal,
-        vertexBufferSize,
-        nullptr,
-        meshBuffer.vertices.buf,
-        meshBuffer.vertices.mem);
-    // Index buffer
-    CreateBuffer(
-        vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        vk::MemoryPropertyFlagBits::eDeviceLocal,
-        indexBufferSize,
-        nullptr,
-        meshBuffer.indices.buf,
-        meshBuffer.indices.mem);
-
-    // Copy from staging buffers
-    uint32_t copyCmdIndex = Create(vk::CommandBufferLevel::ePrimary, true);
-
-    vk::BufferCopy copyRegion = {};
-
-    copyRegion.size = vertexBufferSize;
-
-    tempCmdBuffers[copyCmdIndex].copyBuffer(vertexStaging.buffer, meshBuffer.vertices.buf, copyRegion);
-
-    copyRegion.size = indexBufferSize;
-
-    tempCmdBuffers[copyCmdIndex].copyBuffer(indexStaging.buffer, meshBuffer.indices.buf, copyRegion);
-
-    Flush(copyCmdIndex);
-
-    device.destroyBuffer(vertexStaging.buffer);
-    device.freeMemory(vertexStaging.memory);
-    device.destroyBuffer(indexStaging.buffer);
-    device.freeMemory(indexStaging.memory);
-}
-
-void CommandBuffer::Build(Pipeline& pipeline)
-{
-    {
-        CreateDepthStencil();
-        CreateFramebuffers(pipeline);
+    // suballocated and bound, host visible blocks are mapped for good
+    memory = allocator.AllocateBuffer(buffer, memoryPropertyFlags, strategy, category);
+    if (data != nullptr && memory.mapped) {
+        memcpy(memory.mapped, data, size);
+    }
+}
+
+void CommandBuffer::DestroyBuffer(vk::Buffer buffer, const MemoryAllocator::Allocation& memory, ResourceTrash* trash)
+{
+    if (trash) {
+        vk::Device dev = device;
+        MemoryAllocator* memoryAllocator = &allocator;
+        trash->Trash([dev, buffer, memory, memoryAllocator]() {
+            dev.destroyBuffer(buffer);
+            memoryAllocator->Free(memory);
+        });
+        return;
+    }
+    device.destroyBuffer(buffer);
+    allocator.Free(memory);
+}
+
+void CommandBuffer::Build(Pipeline& pipeline, Scene& scene, GeometryArena& geometry, IndirectDraws* indirect)
+{
+    M3D_TRACE_ZONE("CommandBuffer::Build");
+    createTargets(pipeline, indirect, nullptr);
+    Record(pipeline, scene, geometry, indirect);
+}
+
+void CommandBuffer::createTargets(Pipeline& pipeline, IndirectDraws* indirect, ResourceTrash* trash)
+{
+    CreateDepthStencil(pipeline);
+    CreateFramebuffers(pipeline);
+    if (pipeline.HasWeightedBlended()) {
+        // input attachments 0 and 1 of the composite
+        vk::DescriptorPoolSize poolSize(vk::DescriptorType::eInputAttachment, 2);
+        vk::DescriptorPoolCreateInfo poolInfo;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        transparencyPool = device.createDescriptorPool(poolInfo);
+
+        vk::DescriptorSetAllocateInfo allocInfo;
+        allocInfo.descriptorPool = transparencyPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &pipeline.GetCompositeSetLayout();
+        transparencySet = device.allocateDescriptorSets(allocInfo)[0];
+
+        std::array<vk::DescriptorImageInfo, 2> images;
+        images[0] = vk::DescriptorImageInfo(vk::Sampler(), transparencyAccum.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        images[1] = vk::DescriptorImageInfo(vk::Sampler(), transparencyReveal.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        vk::WriteDescriptorSet write;
+        write.dstSet = transparencySet;
+        write.dstBinding = 0;
+        write.descriptorCount = static_cast<uint32_t>(images.size());
+        write.descriptorType = vk::DescriptorType::eInputAttachment;
+        write.pImageInfo = images.data();
+        device.updateDescriptorSets(write, nullptr);
+    }
+    if (pipeline.IsDeferred()) {
+        // input attachments 0 to 2 of the lighting
+        vk::DescriptorPoolSize poolSize(vk::DescriptorType::eInputAttachment, Pipeline::GBufferAttachmentCount);
+        vk::DescriptorPoolCreateInfo poolInfo;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        gbufferPool = device.createDescriptorPool(poolInfo);
+
+        vk::DescriptorSetAllocateInfo allocInfo;
+        allocInfo.descriptorPool = gbufferPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &pipeline.GetLightingSetLayout();
+        gbufferSet = device.allocateDescriptorSets(allocInfo)[0];
+
+        std::array<vk::DescriptorImageInfo, Pipeline::GBufferAttachmentCount> images;
+        images[0] = vk::DescriptorImageInfo(vk::Sampler(), gbufferAlbedo.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        images[1] = vk::DescriptorImageInfo(vk::Sampler(), gbufferNormal.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        images[2] = vk::DescriptorImageInfo(vk::Sampler(), gbufferDepth.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        vk::WriteDescriptorSet write;
+        write.dstSet = gbufferSet;
+        write.dstBinding = 0;
+        write.descriptorCount = static_cast<uint32_t>(images.size());
+        write.descriptorType = vk::DescriptorType::eInputAttachment;
+        write.pImageInfo = images.data();
+        device.updateDescriptorSets(write, nullptr);
+    }
+    if (indirect && indirect->GetCulling()) {
+        indirect->GetCulling()->SetDepthSource(*this, depthStencil.image, depthStencil.format, extent.width, extent.height, trash);
+    }
+    if (post) {
+        post->SetTargets(sceneColor.view, extent, swapChain, trash);
+    }
+    // the contrast of the scene color where the post stack samples it
+    if (shadingRate) {
+        shadingRate->SetTargets(post ? sceneColor.image : vk::Image(), post ? sceneColor.view : vk::ImageView(), extent, trash);
+    }
+}
+
+uint32_t CommandBuffer::recordMeshes(vk::CommandBuffer cmd, const Pipeline& pipeline, Scene& scene, GeometryArena& geometry, bool materials, uint32_t& triangles)
+{
+    vk::DeviceSize offsets[1] = { 0 };
+    uint32_t pushedMaterial = 0;
+
+    // Every mesh lives in one of a few arena blocks, rebind only when the block changes
+    uint32_t boundBlock = Mesh::InvalidBlock;
+    uint32_t draws = 0;
+    for (uint32_t meshID : scene.meshes) {
+        const Mesh& mesh = scene.meshes[meshID];
+        if (!mesh.resident) {
+            continue;
+        }
+        if (mesh.geometryBlock != boundBlock) {
+            const GeometryArena::Block& block = geometry.GetBlock(mesh.geometryBlock);
+            cmd.bindVertexBuffers(0, 1, &block.buffer, offsets);
+            cmd.bindIndexBuffer(block.buffer, 0, block.indexType);
+            boundBlock = mesh.geometryBlock;
+        }
+        for (size_t s = 0; s < mesh.slices.size(); ++s) {
+            const uint32_t material = s < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[s]) : MaterialTable::InvalidIndex;
+            if (materials && material != pushedMaterial) {
+                pipeline.PushMaterial(cmd, material);
+                pushedMaterial = material;
+            }
+            const Mesh::Slice& slice = mesh.slices[s];
+            cmd.drawIndexed(slice.triangleCount * 3, 1, mesh.firstIndex + slice.indexOffset, mesh.vertexOffset, 0);
+            triangles += slice.triangleCount;
+        }
+        draws += static_cast<uint32_t>(mesh.slices.size());
+    }
+    return draws;
+}
+
+// names of the passes in the profiler and in captures, colors of their marker regions
+static const char* const passNames[] = { "cull", "skinning", "depth prepass", "opaque", "skinned", "crowd", "gui", "depth pyramid", "light cluster", "occlusion queries", "impostors", "particle simulation", "particles", "post process", "transparent", "shading rate", "deferred lighting", "scene" };
+static const std::array<float, 4> passColors[] = {
+    { { 0.9f, 0.6f, 0.1f, 1.0f } },
+    { { 0.7f, 0.3f, 0.9f, 1.0f } },
+    { { 0.4f, 0.4f, 0.4f, 1.0f } },
+    { { 0.2f, 0.7f, 0.3f, 1.0f } },
+    { { 0.3f, 0.5f, 0.9f, 1.0f } },
+    { { 0.5f, 0.3f, 0.7f, 1.0f } },
+    { { 0.9f, 0.9f, 0.2f, 1.0f } },
+    { { 0.6f, 0.6f, 0.6f, 1.0f } },
+    { { 0.9f, 0.8f, 0.6f, 1.0f } },
+    { { 0.8f, 0.2f, 0.2f, 1.0f } },
+    { { 0.6f, 0.8f, 0.4f, 1.0f } },
+    { { 1.0f, 0.5f, 0.3f, 1.0f } },
+    { { 1.0f, 0.7f, 0.5f, 1.0f } },
+    { { 0.7f, 0.5f, 0.8f, 1.0f } },
+    { { 0.4f, 0.8f, 0.9f, 1.0f } },
+    { { 0.8f, 0.8f, 0.3f, 1.0f } },
+    { { 0.9f, 0.7f, 0.3f, 1.0f } },
+    { { 0.1f, 0.5f, 0.5f, 1.0f } },
+};
+
+// nothing unless a capture tool enabled the markers
+static void beginRegion(vk::CommandBuffer cmd, uint32_t pass)
+{
+    if (vkx::debug::marker::active) {
+        vkx::debug::marker::beginRegion(VkCommandBuffer(cmd), passNames[pass], passColors[pass]);
+    }
+}
+
+static void endRegion(vk::CommandBuffer cmd)
+{
+    if (vkx::debug::marker::active) {
+        vkx::debug::marker::endRegion(VkCommandBuffer(cmd));
     }
+}
+
+void CommandBuffer::beginPass(vk::CommandBuffer cmd, uint32_t slot, Pass pass)
+{
+    beginRegion(cmd, pass);
+    if (profiler) {
+        // a statistics query ends in the subpass it began in, and the primary's is not inherited by secondaries
+        const bool countPipeline = pass != DeferredLightingPass && pass != TransparentPass && pass != ScenePass;
+        profiler->Begin(cmd, slot, passScopes[pass], countPipeline);
+    }
+}
 
+void CommandBuffer::endPass(vk::CommandBuffer cmd, uint32_t slot, Pass pass)
+{
+    if (profiler) {
+        profiler->End(cmd, slot, passScopes[pass]);
+    }
+    endRegion(cmd);
+}
+
+void CommandBuffer::SetProfiler(GpuProfiler* gpuProfiler)
+{
+    profiler = gpuProfiler;
+    if (!profiler) {
+        return;
+    }
+    for (uint32_t pass = 0; pass < PassCount; ++pass) {
+        passScopes[pass] = profiler->GetScope(passNames[pass]);
+    }
+}
+
+void CommandBuffer::Record(Pipeline& pipeline, Scene& scene, GeometryArena& geometry, IndirectDraws* indirect)
+{
+    M3D_TRACE_ZONE("CommandBuffer::Record");
+    recordedScales.assign(drawCmdBuffers.size(), renderScale);
+    for (uint32_t i = 0; i < drawCmdBuffers.size(); ++i) {
+        recordImage(i, pipeline, scene, geometry, indirect);
+    }
+}
+
+void CommandBuffer::RecordStale(uint32_t image, Pipeline& pipeline, Scene& scene, GeometryArena& geometry, IndirectDraws* indirect)
+{
+    if (recordedScales[image] == renderScale) {
+        return;
+    }
+    recordedScales[image] = renderScale;
+    recordImage(image, pipeline, scene, geometry, indirect);
+}
+
+void CommandBuffer::recordImage(uint32_t i, Pipeline& pipeline, Scene& scene, GeometryArena& geometry, IndirectDraws* indirect)
+{
     vk::CommandBufferBeginInfo cmdBufInfo = {};
 
-    vk::ClearValue clearValues[2];
+    vk::ClearValue clearValues[8];
     std::array<float, 4> tmpColor = { 1.0f, 1.0f, 1.0f, 1.0f };
     clearValues[0].color = vk::ClearColorValue(tmpColor);
     clearValues[1].depthStencil = { 1.0f, 0 };
+    const std::array<uint32_t, 4> noId = { { Pipeline::InvalidId, Pipeline::InvalidId, 0, 0 } };
+    clearValues[2].color = vk::ClearColorValue(noId);
+    // nothing accumulated, everything revealed
+    const std::array<float, 4> noCoverage = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+    const std::array<float, 4> revealed = { { 1.0f, 0.0f, 0.0f, 0.0f } };
+    if (pipeline.HasWeightedBlended()) {
+        clearValues[pipeline.GetAccumAttachment()].color = vk::ClearColorValue(noCoverage);
+        clearValues[pipeline.GetAccumAttachment() + 1].color = vk::ClearColorValue(revealed);
+    }
+    // no surface, a view depth of 0 is where the lighting leaves the clear color
+    const std::array<float, 4> nothing = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+    if (pipeline.IsDeferred()) {
+        for (uint32_t a = 0; a < Pipeline::GBufferAttachmentCount; ++a) {
+            clearValues[pipeline.GetGBufferAttachment() + a].color = vk::ClearColorValue(nothing);
+        }
+    }
 
     vk::RenderPassBeginInfo renderPassBeginInfo = {};
     renderPassBeginInfo.renderPass = pipeline.GetRenderPass();
     renderPassBeginInfo.renderArea.offset.x = 0;
     renderPassBeginInfo.renderArea.offset.y = 0;
-    renderPassBeginInfo.renderArea.extent.width = width;
-    renderPassBeginInfo.renderArea.extent.height = height;
-    renderPassBeginInfo.clearValueCount = 2;
+    renderPassBeginInfo.renderArea.extent = renderExtent;
+    renderPassBeginInfo.clearValueCount = pipeline.GetAttachmentCount();
     renderPassBeginInfo.pClearValues = clearValues;
+    renderPassBeginInfo.framebuffer = frameBuffers[i];
 
-    for (int32_t i = 0; i < drawCmdBuffers.size(); ++i) {
-        renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-        //VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffers[i], &cmdBufInfo));
-        drawCmdBuffers[i].begin(cmdBufInfo);
+    //VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffers[i], &cmdBufInfo));
+    drawCmdBuffers[i].begin(cmdBufInfo);
+    // image i writes the timestamps of slot i, like its camera block
+    if (profiler) {
+        profiler->BeginSlot(drawCmdBuffers[i], i);
+    }
 
-        //vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-        drawCmdBuffers[i].beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-		vk::Viewport viewport = {0, 0, (float)width, (float)height, 0.0f, 1.0f};
-        drawCmdBuffers[i].setViewport(0, 1, &viewport);
-		vk::Rect2D rect2d = { (0, 0), (width, height) };
-        drawCmdBuffers[i].setScissor(0, 1, &rect2d);
+    // cull against the depth pyramid of the previous frame before any draw reads the commands
+    GpuCulling* culling = indirect ? indirect->GetCulling() : nullptr;
+    if (culling) {
+        beginPass(drawCmdBuffers[i], i, CullPass);
+        culling->RecordCull(drawCmdBuffers[i]);
+        endPass(drawCmdBuffers[i], i, CullPass);
+    }
+    if (skinning && skinning->IsAsync()) {
+        skinning->RecordAcquire(drawCmdBuffers[i], i);
+    } else if (skinning) {
+        beginPass(drawCmdBuffers[i], i, SkinningPass);
+        skinning->RecordSkinning(drawCmdBuffers[i], i);
+        endPass(drawCmdBuffers[i], i, SkinningPass);
+    }
+    // only the indirect draws shade with the clusters
+    if (indirect && lights) {
+        beginPass(drawCmdBuffers[i], i, LightClusterPass);
+        lights->RecordCluster(drawCmdBuffers[i]);
+        endPass(drawCmdBuffers[i], i, LightClusterPass);
+    }
+    if (particles) {
+        beginPass(drawCmdBuffers[i], i, ParticleSimulationPass);
+        particles->RecordSimulation(drawCmdBuffers[i], i);
+        endPass(drawCmdBuffers[i], i, ParticleSimulationPass);
+    }
+    if (shadingRate) {
+        beginPass(drawCmdBuffers[i], i, ShadingRatePass);
+        shadingRate->Record(drawCmdBuffers[i], i, renderExtent);
+        endPass(drawCmdBuffers[i], i, ShadingRatePass);
+        shadingRate->Bind(drawCmdBuffers[i]);
+    }
 
-        vk::DeviceSize offsets[1] = { 0 };
+    //vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    drawCmdBuffers[i].beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+		vk::Viewport viewport = {0, 0, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f};
+    drawCmdBuffers[i].setViewport(0, 1, &viewport);
+		vk::Rect2D rect2d = { { 0, 0 }, renderExtent };
+    drawCmdBuffers[i].setScissor(0, 1, &rect2d);
 
-        drawCmdBuffers[i].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.GetPipelineLayout(), 0, 1, &pipeline.GetDescriptorSet(), 0, nullptr);
-        drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetPipeline());
+    // image i reads the camera block of frame slot i
+    const uint32_t uniformOffset = pipeline.GetFrameOffset(i);
+    drawCmdBuffers[i].bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.GetPipelineLayout(), 0, 1, &pipeline.GetDescriptorSet(), 1, &uniformOffset);
 
-        drawCmdBuffers[i].bindVertexBuffers(0, 1, &meshBuffer.vertices.buf, offsets);
-        drawCmdBuffers[i].bindIndexBuffer(meshBuffer.indices.buf, 0, vk::IndexType::eUint32);
-        drawCmdBuffers[i].drawIndexed(meshBuffer.indexCount, 1, 0, 0, 1);
+    if (indirect) {
+        if (pipeline.HasDepthPrepass()) {
+            beginPass(drawCmdBuffers[i], i, PrepassPass);
+            drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetIndirectDepthPipeline());
+            indirect->Draw(drawCmdBuffers[i], geometry);
+            endPass(drawCmdBuffers[i], i, PrepassPass);
+            drawCmdBuffers[i].nextSubpass(vk::SubpassContents::eInline);
+        }
+        beginPass(drawCmdBuffers[i], i, OpaquePass);
+        drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetIndirectPipeline());
+        indirect->Draw(drawCmdBuffers[i], geometry);
+        endPass(drawCmdBuffers[i], i, OpaquePass);
+        if (pipeline.IsDeferred()) {
+            recordLighting(drawCmdBuffers[i], i, pipeline);
+        }
+        if (impostors) {
+            beginPass(drawCmdBuffers[i], i, ImpostorPass);
+            impostors->Draw(drawCmdBuffers[i], i);
+            endPass(drawCmdBuffers[i], i, ImpostorPass);
+        }
+        drawCount = indirect->GetDrawCount();
+        triangleCount = indirect->GetTriangleCount();
+        pipelineBindCount = pipeline.HasDepthPrepass() ? 2 : 1;
+        if (skinning) {
+            // skinned vertices are in world space, the model matrix is the identity
+            beginPass(drawCmdBuffers[i], i, SkinnedPass);
+            drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetSkinnedPipeline());
+            pipeline.PushDrawConstants(drawCmdBuffers[i], Pipeline::DrawConstants());
+            skinning->Draw(drawCmdBuffers[i], i);
+            endPass(drawCmdBuffers[i], i, SkinnedPass);
+        }
+        if (crowd) {
+            beginPass(drawCmdBuffers[i], i, CrowdPass);
+            crowd->Draw(drawCmdBuffers[i], i);
+            endPass(drawCmdBuffers[i], i, CrowdPass);
+        }
+        if (particles) {
+            beginPass(drawCmdBuffers[i], i, ParticlePass);
+            particles->Draw(drawCmdBuffers[i]);
+            endPass(drawCmdBuffers[i], i, ParticlePass);
+        }
+        if (pipeline.HasWeightedBlended()) {
+            recordTransparency(drawCmdBuffers[i], i, pipeline, geometry, indirect);
+        }
+        if (gui) {
+            beginPass(drawCmdBuffers[i], i, GuiPass);
+            gui->Draw(drawCmdBuffers[i], i);
+            endPass(drawCmdBuffers[i], i, GuiPass);
+        }
         drawCmdBuffers[i].endRenderPass();
+        recordSceneBlit(drawCmdBuffers[i], i, i);
+        if (culling) {
+            beginPass(drawCmdBuffers[i], i, DepthPyramidPass);
+            culling->RecordDepthPyramid(drawCmdBuffers[i]);
+            endPass(drawCmdBuffers[i], i, DepthPyramidPass);
+        }
         drawCmdBuffers[i].end();
+        return;
+    }
+
+    // meshes are drawn where they were modeled, only the material changes from slice to slice
+    if (pipeline.HasDepthPrepass()) {
+        beginPass(drawCmdBuffers[i], i, PrepassPass);
+        drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetDepthPipeline());
+        pipeline.PushDrawConstants(drawCmdBuffers[i], Pipeline::DrawConstants());
+        uint32_t depthTriangles = 0;
+        recordMeshes(drawCmdBuffers[i], pipeline, scene, geometry, false, depthTriangles);
+        endPass(drawCmdBuffers[i], i, PrepassPass);
+        drawCmdBuffers[i].nextSubpass(vk::SubpassContents::eInline);
+    }
+    // nothing fills the G-buffer, the main pipeline shades forward after the lighting finds it empty
+    if (pipeline.IsDeferred()) {
+        recordLighting(drawCmdBuffers[i], i, pipeline);
+    }
+    beginPass(drawCmdBuffers[i], i, OpaquePass);
+    drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetPipeline());
+    pipeline.PushDrawConstants(drawCmdBuffers[i], Pipeline::DrawConstants());
+    triangleCount = 0;
+    drawCount = recordMeshes(drawCmdBuffers[i], pipeline, scene, geometry, true, triangleCount);
+    pipelineBindCount = pipeline.HasDepthPrepass() ? 2 : 1;
+    endPass(drawCmdBuffers[i], i, OpaquePass);
+    if (skinning) {
+        beginPass(drawCmdBuffers[i], i, SkinnedPass);
+        drawCmdBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetSkinnedPipeline());
+        pipeline.PushDrawConstants(drawCmdBuffers[i], Pipeline::DrawConstants());
+        skinning->Draw(drawCmdBuffers[i], i);
+        endPass(drawCmdBuffers[i], i, SkinnedPass);
     }
+    if (crowd) {
+        beginPass(drawCmdBuffers[i], i, CrowdPass);
+        crowd->Draw(drawCmdBuffers[i], i);
+        endPass(drawCmdBuffers[i], i, CrowdPass);
+    }
+    if (particles) {
+        beginPass(drawCmdBuffers[i], i, ParticlePass);
+        particles->Draw(drawCmdBuffers[i]);
+        endPass(drawCmdBuffers[i], i, ParticlePass);
+    }
+    if (pipeline.HasWeightedBlended()) {
+        recordTransparency(drawCmdBuffers[i], i, pipeline, geometry, nullptr);
+    }
+    if (gui) {
+        beginPass(drawCmdBuffers[i], i, GuiPass);
+        gui->Draw(drawCmdBuffers[i], i);
+        endPass(drawCmdBuffers[i], i, GuiPass);
+    }
+    drawCmdBuffers[i].endRenderPass();
+    recordSceneBlit(drawCmdBuffers[i], i, i);
+    drawCmdBuffers[i].end();
 }
 
-uint32_t CommandBuffer::Create(vk::CommandBufferLevel level, bool begin)
+void CommandBuffer::recordLighting(vk::CommandBuffer cmd, uint32_t slot, Pipeline& pipeline)
 {
-    vk::CommandBuffer _cmdBuffer;
+    beginPass(cmd, slot, DeferredLightingPass);
+    // set 0 stays bound, the G-buffer joins it as set 1
+    cmd.nextSubpass(vk::SubpassContents::eInline);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetLightingPipeline());
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.GetLightingLayout(), 1, 1, &gbufferSet, 0, nullptr);
+    cmd.draw(3, 1, 0, 0);
+    endPass(cmd, slot, DeferredLightingPass);
+}
 
-    vk::CommandBufferAllocateInfo cmdBufAllocateInfo = {};
-    cmdBufAllocateInfo.commandPool = cmdPool;
-    cmdBufAllocateInfo.level = level;
-    cmdBufAllocateInfo.commandBufferCount = 1;
+void CommandBuffer::recordTransparency(vk::CommandBuffer cmd, uint32_t slot, Pipeline& pipeline, GeometryArena& geometry, IndirectDraws* indirect)
+{
+    beginPass(cmd, slot, TransparentPass);
+    // unsorted, the weights order what overlaps; the scene's descriptor set stays bound
+    cmd.nextSubpass(vk::SubpassContents::eInline);
+    if (indirect) {
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetTransparentPipeline());
+        indirect->Draw(cmd, geometry, true);
+    }
+    cmd.nextSubpass(vk::SubpassContents::eInline);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline.GetCompositePipeline());
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.GetCompositeLayout(), 0, 1, &transparencySet, 0, nullptr);
+    cmd.draw(3, 1, 0, 0);
+    endPass(cmd, slot, TransparentPass);
+}
 
-    device.allocateCommandBuffers(&cmdBufAllocateInfo, &_cmdBuffer);
+void CommandBuffer::SetRenderScale(float scale)
+{
+    renderScale = dynamicResolution ? scale : 1.0f;
+    renderExtent.width = std::max<uint32_t>(1, static_cast<uint32_t>(extent.width * renderScale + 0.5f));
+    renderExtent.height = std::max<uint32_t>(1, static_cast<uint32_t>(extent.height * renderScale + 0.5f));
+}
 
-    if (begin) {
-        vk::CommandBufferBeginInfo cmdBufInfo = {};
-        _cmdBuffer.begin(cmdBufInfo);
+void CommandBuffer::recordSceneBlit(vk::CommandBuffer cmd, uint32_t slot, uint32_t imageIndex)
+{
+    if (!sceneColor.image) {
+        return;
     }
+    if (post) {
+        beginPass(cmd, slot, PostProcessPass);
+        post->Record(cmd, slot, imageIndex, renderExtent);
+        endPass(cmd, slot, PostProcessPass);
+        return;
+    }
+    // the render pass left the layers in TRANSFER_SRC_OPTIMAL and made them visible to transfers. The swapchain image
+    // is only known to be acquired at COLOR_ATTACHMENT_OUTPUT, the barrier chains the blits behind that wait
+    vk::ImageMemoryBarrier toTransfer;
+    toTransfer.srcAccessMask = vk::AccessFlags();
+    toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+    toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = swapChain.images[imageIndex];
+    toTransfer.subresourceRange = vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr,
+        toTransfer);
 
-    tempCmdBuffers.emplace_back(_cmdBuffer);
+    // an odd view count leaves a tile without a view
+    const uint32_t views = sceneColor.layers;
+    if (views < viewColumns * viewRows) {
+        std::array<float, 4> black = { 0.0f, 0.0f, 0.0f, 1.0f };
+        cmd.clearColorImage(toTransfer.image, vk::ImageLayout::eTransferDstOptimal, vk::ClearColorValue(black), toTransfer.subresourceRange);
+        vk::MemoryBarrier cleared;
+        cleared.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        cleared.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), cleared, nullptr, nullptr);
+    }
+    // the rendered part of every view, scaled up to its whole tile; at full scale a plain copy
+    std::vector<vk::ImageBlit> blits(views);
+    for (uint32_t view = 0; view < views; ++view) {
+        const int32_t x = static_cast<int32_t>((view % viewColumns) * extent.width);
+        const int32_t y = static_cast<int32_t>((view / viewColumns) * extent.height);
+        blits[view].srcSubresource = vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, view, 1 };
+        blits[view].srcOffsets[1] = vk::Offset3D{ static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1 };
+        blits[view].dstSubresource = vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+        blits[view].dstOffsets[0] = vk::Offset3D{ x, y, 0 };
+        blits[view].dstOffsets[1] = vk::Offset3D{ x + static_cast<int32_t>(extent.width), y + static_cast<int32_t>(extent.height), 1 };
+    }
+    cmd.blitImage(sceneColor.image, vk::ImageLayout::eTransferSrcOptimal, toTransfer.image, vk::ImageLayout::eTransferDstOptimal, blits,
+        renderScale < 1.0f ? vk::Filter::eLinear : vk::Filter::eNearest);
 
-    return tempCmdBuffers.size() - 1;
+    vk::ImageMemoryBarrier toPresent = toTransfer;
+    toPresent.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toPresent.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+    toPresent.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    toPresent.newLayout = vk::ImageLayout::ePresentSrcKHR;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, toPresent);
 }
 
-void CommandBuffer::Flush(uint32_t index)
+void CommandBuffer::destroyTargets(ResourceTrash* trash)
+{
+    vk::Device dev = device;
+    std::vector<vk::Framebuffer> oldFrameBuffers;
+    oldFrameBuffers.swap(frameBuffers);
+    std::array<Target, 9> targets = { { depthStencil, multisampleColor, sceneColor, idBuffer, transparencyAccum, transparencyReveal, gbufferAlbedo,
+        gbufferNormal, gbufferDepth } };
+    MemoryAllocator* memoryAllocator = &allocator;
+    const std::array<vk::DescriptorPool, 2> pools = { { transparencyPool, gbufferPool } };
+    depthStencil = Target();
+    multisampleColor = Target();
+    sceneColor = Target();
+    idBuffer = Target();
+    transparencyAccum = Target();
+    transparencyReveal = Target();
+    transparencyPool = vk::DescriptorPool();
+    transparencySet = vk::DescriptorSet();
+    gbufferAlbedo = Target();
+    gbufferNormal = Target();
+    gbufferDepth = Target();
+    gbufferPool = vk::DescriptorPool();
+    gbufferSet = vk::DescriptorSet();
+
+    ResourceTrash::Destroyer destroy = [dev, oldFrameBuffers, targets, memoryAllocator, pools]() {
+        for (auto& frameBuffer : oldFrameBuffers) {
+            dev.destroyFramebuffer(frameBuffer);
+        }
+        // their sets go with them
+        for (const vk::DescriptorPool pool : pools) {
+            if (pool) {
+                dev.destroyDescriptorPool(pool);
+            }
+        }
+        for (const Target& target : targets) {
+            if (target.image) {
+                dev.destroyImageView(target.view);
+                dev.destroyImage(target.image);
+                memoryAllocator->Free(target.mem);
+            }
+        }
+    };
+    if (trash) {
+        trash->Trash(destroy);
+    } else {
+        destroy();
+    }
+}
+
+void CommandBuffer::Resize(Pipeline& pipeline, Scene& scene, GeometryArena& geometry, IndirectDraws* indirect, ResourceTrash& trash)
+{
+    destroyTargets(&trash);
+
+    // static draw buffers of the old extent may still be pending, record into fresh ones
+    vk::Device dev = device;
+    vk::CommandPool pool = cmdPool;
+    std::vector<vk::CommandBuffer> oldCmdBuffers;
+    oldCmdBuffers.swap(drawCmdBuffers);
+    trash.Trash([dev, pool, oldCmdBuffers]() { dev.freeCommandBuffers(pool, oldCmdBuffers); });
+    allocateDrawCommandBuffers();
+
+    createTargets(pipeline, indirect, &trash);
+    Record(pipeline, scene, geometry, indirect);
+}
+
+void CommandBuffer::EnableParallelRecording(uint32_t framesInFlight, uint32_t threadCount)
+{
+    recordThreads.reset(new ThreadPool(threadCount, JobSystem::Priority::High));
+
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = swapChain.queueNodeIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+    recordContexts.resize(framesInFlight);
+    for (uint32_t f = 0; f < framesInFlight; ++f) {
+        std::vector<RecordContext>& frame = recordContexts[f];
+        frame.resize(recordThreads->GetThreadCount());
+        for (uint32_t t = 0; t < frame.size(); ++t) {
+            RecordContext& context = frame[t];
+            context.pool = device.createCommandPool(cmdPoolInfo);
+
+            vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+            cmdBufAllocateInfo.commandPool = context.pool;
+            cmdBufAllocateInfo.level = vk::CommandBufferLevel::eSecondary;
+            cmdBufAllocateInfo.commandBufferCount = 2;
+            std::vector<vk::CommandBuffer> secondaries = device.allocateCommandBuffers(cmdBufAllocateInfo);
+            context.secondary = secondaries[0];
+            context.prepass = secondaries[1];
+
+            char name[48];
+            snprintf(name, sizeof(name), "frame %u thread %u", f, t);
+            vkx::debug::marker::setName(device, context.secondary, name);
+            snprintf(name, sizeof(name), "frame %u thread %u prepass", f, t);
+            vkx::debug::marker::setName(device, context.prepass, name);
+        }
+    }
+}
+
+void CommandBuffer::buildQueueKeys(Scene& scene, const Camera* camera, uint32_t first, uint32_t last, uint32_t shadingPipeline,
+    uint32_t depthPipeline, uint32_t prepassBase)
 {
+    m3d::math::Vector3 forward(0.0f, 0.0f, 0.0f);
+    if (camera) {
+        forward = camera->target - camera->eye;
+        forward.Normalize();
+    }
+
+    std::vector<RenderQueue::Item>& items = renderQueue.GetItems();
+    for (uint32_t i = first; i < last; ++i) {
+        const uint32_t instanceID = visibleInstances[i];
+        const Instance& instance = scene.instances[instanceID];
+        const Mesh& mesh = scene.meshes[instance.meshId];
+
+        // view depth of the nearest point of the bounds, scene order without a camera
+        float depth = 0.0f;
+        if (camera) {
+            const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(instance.transformId);
+            const m3d::math::Vector3& scale = scene.transforms[instance.transformId].scale;
+            float center[3];
+            for (int c = 0; c < 3; ++c) {
+                center[c] = world.m[c][0] * mesh.boundingSphere[0] + world.m[c][1] * mesh.boundingSphere[1]
+                    + world.m[c][2] * mesh.boundingSphere[2] + world.m[c][3];
+            }
+            const float radius = mesh.boundingSphere[3] * std::max(std::fabs(scale.x), std::max(std::fabs(scale.y), std::fabs(scale.z)));
+            depth = (center[0] - camera->eye.x) * forward.x + (center[1] - camera->eye.y) * forward.y
+                + (center[2] - camera->eye.z) * forward.z - radius;
+        }
+
+        for (uint32_t s = 0; s < static_cast<uint32_t>(mesh.slices.size()); ++s) {
+            const uint32_t item = visibleFirstItems[i] + s;
+            const uint32_t material = s < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[s]) : MaterialTable::InvalidIndex;
+            items[item].key = RenderQueue::MakeKey(RenderQueue::Opaque, shadingPipeline, material, depth);
+            items[item].instance = instanceID;
+            items[item].slice = s;
+            if (prepassBase > 0) {
+                items[prepassBase + item].key = RenderQueue::MakeKey(RenderQueue::DepthPrepass, depthPipeline, 0, depth);
+                items[prepassBase + item].instance = instanceID;
+                items[prepassBase + item].slice = s;
+            }
+        }
+    }
+}
+
+void CommandBuffer::recordQueue(vk::CommandBuffer cmd, Pipeline& pipeline, Scene& scene, GeometryArena& geometry, uint32_t first, uint32_t last,
+    uint32_t uniformOffset, RecordContext& context)
+{
+    const std::vector<RenderQueue::Item>& items = renderQueue.GetItems();
+    vk::DeviceSize offsets[1] = { 0 };
+    vk::Pipeline boundPipeline;
+    uint32_t boundBlock = Mesh::InvalidBlock;
+    uint32_t boundInstance = Mesh::InvalidBlock;
+    Pipeline::DrawConstants constants;
+    for (uint32_t i = first; i < last; ++i) {
+        const RenderQueue::Item& item = items[i];
+        // every pipeline of the queue has the main layout, the set stays bound across pipelines
+        const vk::Pipeline itemPipeline = renderQueue.GetPipeline(RenderQueue::GetPipeline(item.key));
+        if (itemPipeline != boundPipeline) {
+            context.binds.BindPipeline(cmd, itemPipeline, "CommandBuffer::recordQueue");
+            ++context.pipelineBinds;
+            if (!boundPipeline) {
+                context.binds.BindDescriptorSet(cmd, pipeline.GetPipelineLayout(), 0, pipeline.GetDescriptorSet(), 1, &uniformOffset, "CommandBuffer::recordQueue");
+            }
+            boundPipeline = itemPipeline;
+        }
+
+        const Instance& instance = scene.instances[item.instance];
+        const Mesh& mesh = scene.meshes[instance.meshId];
+        if (mesh.geometryBlock != boundBlock) {
+            const GeometryArena::Block& block = geometry.GetBlock(mesh.geometryBlock);
+            cmd.bindVertexBuffers(0, 1, &block.buffer, offsets);
+            cmd.bindIndexBuffer(block.buffer, 0, block.indexType);
+            boundBlock = mesh.geometryBlock;
+        }
+        // depth only draws do not read the material
+        const bool shaded = RenderQueue::GetPass(item.key) != RenderQueue::DepthPrepass;
+        const uint32_t material = shaded && item.slice < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[item.slice]) : MaterialTable::InvalidIndex;
+        if (item.instance != boundInstance) {
+            constants.modelMatrix = scene.transformStore.GetWorld(instance.transformId);
+            constants.material = material;
+            pipeline.PushDrawConstants(cmd, constants);
+            boundInstance = item.instance;
+        } else if (material != constants.material) {
+            pipeline.PushMaterial(cmd, material);
+            constants.material = material;
+        }
+        const Mesh::Slice& slice = mesh.slices[item.slice];
+        // heavy instances only where their box passed the previous frame's query
+        if (queries) {
+            queries->BeginConditional(cmd, item.instance);
+        }
+        cmd.drawIndexed(slice.triangleCount * 3, 1, mesh.firstIndex + slice.indexOffset, mesh.vertexOffset, 0);
+        if (queries) {
+            queries->EndConditional(cmd, item.instance);
+        }
+        if (shaded) {
+            context.triangles += slice.triangleCount;
+        }
+    }
+}
+
+void CommandBuffer::RecordFrame(uint32_t frameIndex, uint32_t imageIndex, vk::CommandBuffer primary, Pipeline& pipeline, Scene& scene, GeometryArena& geometry,
+    FrameArena& arena)
+{
+    M3D_TRACE_ZONE("CommandBuffer::RecordFrame");
+    assert(recordThreads && frameIndex < recordContexts.size());
+    std::vector<RecordContext>& contexts = recordContexts[frameIndex];
+    const uint32_t threadCount = static_cast<uint32_t>(contexts.size());
+    const bool prepass = pipeline.HasDepthPrepass();
+
+    scene.transformStore.Update();
+    visibleInstances.clear();
+    visibleFirstItems.clear();
+    drawCount = 0;
+    // world boxes of the resident instances, culled against the camera's frustum in bulk. The views of
+    // multiview each have their own, they draw everything
+    candidateInstances.clear();
+    for (int c = 0; c < 3; ++c) {
+        candidateLower[c].clear();
+        candidateUpper[c].clear();
+    }
+    scene.instances.for_each([this, &scene](uint32_t instanceID, const Instance& instance) {
+        const Mesh& mesh = scene.meshes[instance.meshId];
+        if (mesh.resident) {
+            const Aabb box = mesh.bounds.Transformed(scene.transformStore.GetWorld(instance.transformId));
+            candidateInstances.push_back(instanceID);
+            for (int c = 0; c < 3; ++c) {
+                candidateLower[c].push_back(box.lower[c]);
+                candidateUpper[c].push_back(box.upper[c]);
+            }
+        }
+    });
+    const uint32_t candidateCount = static_cast<uint32_t>(candidateInstances.size());
+    candidateVisible.assign((candidateCount + 31) / 32, 0xFFFFFFFF);
+    if (pipeline.GetViewCount() == 1) {
+        m3d::math::Matrix4x4 viewProjection = pipeline.GetProjectionMatrix();
+        const m3d::math::Frustum frustum = m3d::math::Frustum::FromViewProjection(viewProjection * pipeline.GetViewMatrix());
+        const float* lower[3] = { candidateLower[0].data(), candidateLower[1].data(), candidateLower[2].data() };
+        const float* upper[3] = { candidateUpper[0].data(), candidateUpper[1].data(), candidateUpper[2].data() };
+        m3d::math::FrustumCullArray(frustum, lower, upper, candidateCount, candidateVisible.data());
+    }
+    if (occlusion) {
+        occlusion->Wait();
+    }
+    if (queries) {
+        queries->BeginFrame(frameIndex);
+    }
+    for (uint32_t i = 0; i < candidateCount; ++i) {
+        if (!(candidateVisible[i / 32] & (1u << (i % 32)))) {
+            continue;
+        }
+        const uint32_t instanceID = candidateInstances[i];
+        // behind the occluders, which are always drawn
+        if (occlusion && !occlusion->IsOccluder(instanceID)) {
+            Aabb box;
+            for (int c = 0; c < 3; ++c) {
+                box.lower[c] = candidateLower[c][i];
+                box.upper[c] = candidateUpper[c][i];
+            }
+            if (occlusion->IsOccluded(box)) {
+                continue;
+            }
+        }
+        const Mesh& mesh = scene.meshes[scene.instances[instanceID].meshId];
+        if (queries) {
+            uint32_t meshTriangles = 0;
+            for (const Mesh::Slice& slice : mesh.slices) {
+                meshTriangles += slice.triangleCount;
+            }
+            if (meshTriangles >= queries->GetMinTriangles()) {
+                Aabb box;
+                for (int c = 0; c < 3; ++c) {
+                    box.lower[c] = candidateLower[c][i];
+                    box.upper[c] = candidateUpper[c][i];
+                }
+                queries->AddQuery(instanceID, box);
+            }
+        }
+        visibleInstances.push_back(instanceID);
+        visibleFirstItems.push_back(drawCount);
+        drawCount += static_cast<uint32_t>(mesh.slices.size());
+    }
+
+    // A draw per mesh slice, and one more in the depth pre-pass. Every scene draw is opaque,
+    // nearest first lets early depth tests reject what is hidden. The keys are built on the
+    // workers while this thread starts the frame
+    renderQueue.Clear();
+    const uint32_t shadingPipeline = renderQueue.AddPipeline(pipeline.GetPipeline());
+    const uint32_t depthPipeline = prepass ? renderQueue.AddPipeline(pipeline.GetDepthPipeline()) : 0;
+    renderQueue.GetItems().resize(prepass ? 2 * drawCount : drawCount);
+    const Camera* camera = scene.cameras.contains(scene.mainCameraID) ? &scene.cameras[scene.mainCameraID] : nullptr;
+    const uint32_t visibleCount = static_cast<uint32_t>(visibleInstances.size());
+    const uint32_t perThread = (visibleCount + threadCount - 1) / threadCount;
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        const uint32_t first = std::min(t * perThread, visibleCount);
+        const uint32_t last = std::min(first + perThread, visibleCount);
+        const uint32_t prepassBase = prepass ? drawCount : 0;
+        recordThreads->Enqueue([this, &scene, camera, first, last, shadingPipeline, depthPipeline, prepassBase]() {
+            buildQueueKeys(scene, camera, first, last, shadingPipeline, depthPipeline, prepassBase);
+        });
+    }
 
+    vk::ClearValue clearValues[8];
+    std::array<float, 4> tmpColor = { 1.0f, 1.0f, 1.0f, 1.0f };
+    clearValues[0].color = vk::ClearColorValue(tmpColor);
+    clearValues[1].depthStencil = { 1.0f, 0 };
+    const std::array<uint32_t, 4> noId = { { Pipeline::InvalidId, Pipeline::InvalidId, 0, 0 } };
+    clearValues[2].color = vk::ClearColorValue(noId);
+    // nothing accumulated, everything revealed
+    const std::array<float, 4> noCoverage = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+    const std::array<float, 4> revealed = { { 1.0f, 0.0f, 0.0f, 0.0f } };
+    if (pipeline.HasWeightedBlended()) {
+        clearValues[pipeline.GetAccumAttachment()].color = vk::ClearColorValue(noCoverage);
+        clearValues[pipeline.GetAccumAttachment() + 1].color = vk::ClearColorValue(revealed);
+    }
+
+    vk::RenderPassBeginInfo renderPassBeginInfo;
+    renderPassBeginInfo.renderPass = pipeline.GetRenderPass();
+    renderPassBeginInfo.framebuffer = frameBuffers[imageIndex];
+    renderPassBeginInfo.renderArea.extent = renderExtent;
+    renderPassBeginInfo.clearValueCount = pipeline.GetAttachmentCount();
+    renderPassBeginInfo.pClearValues = clearValues;
+
+    vk::CommandBufferBeginInfo primaryBeginInfo;
+    primaryBeginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    primary.begin(primaryBeginInfo);
+    if (profiler) {
+        profiler->BeginSlot(primary, frameIndex);
+    }
+    if (skinning && skinning->IsAsync()) {
+        skinning->RecordAcquire(primary, frameIndex);
+    } else if (skinning) {
+        beginPass(primary, frameIndex, SkinningPass);
+        skinning->RecordSkinning(primary, frameIndex);
+        endPass(primary, frameIndex, SkinningPass);
+    }
+    if (particles) {
+        beginPass(primary, frameIndex, ParticleSimulationPass);
+        particles->RecordSimulation(primary, frameIndex);
+        endPass(primary, frameIndex, ParticleSimulationPass);
+    }
+    if (shadingRate) {
+        beginPass(primary, frameIndex, ShadingRatePass);
+        shadingRate->Record(primary, frameIndex, renderExtent);
+        endPass(primary, frameIndex, ShadingRatePass);
+    }
+    if (queries) {
+        queries->RecordBegin(primary);
+    }
+    // a subpass of secondaries takes no timestamps of the primary, the render pass is one scope
+    beginPass(primary, frameIndex, ScenePass);
+    primary.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+
+    recordThreads->Wait();
+    renderQueue.Sort(recordThreads.get());
+
+    vk::CommandBufferInheritanceInfo inheritanceInfo;
+    inheritanceInfo.renderPass = pipeline.GetRenderPass();
+    inheritanceInfo.subpass = pipeline.GetShadingSubpass();
+    inheritanceInfo.framebuffer = frameBuffers[imageIndex];
+    vk::CommandBufferInheritanceInfo prepassInheritanceInfo = inheritanceInfo;
+    prepassInheritanceInfo.subpass = 0;
+
+    uint32_t opaqueFirst = 0, opaqueLast = 0, prepassFirst = 0, prepassLast = 0;
+    renderQueue.GetPassRange(RenderQueue::Opaque, opaqueFirst, opaqueLast);
+    renderQueue.GetPassRange(RenderQueue::DepthPrepass, prepassFirst, prepassLast);
+    const uint32_t opaquePerThread = (opaqueLast - opaqueFirst + threadCount - 1) / threadCount;
+    const uint32_t prepassPerThread = (prepassLast - prepassFirst + threadCount - 1) / threadCount;
+
+    for (uint32_t t = 0; t < threadCount; ++t) {
+        RecordContext* context = &contexts[t];
+        // every worker records a contiguous run of each pass's sorted draws
+        const uint32_t first = std::min(opaqueFirst + t * opaquePerThread, opaqueLast);
+        const uint32_t last = std::min(first + opaquePerThread, opaqueLast);
+        const uint32_t depthFirst = std::min(prepassFirst + t * prepassPerThread, prepassLast);
+        const uint32_t depthLast = std::min(depthFirst + prepassPerThread, prepassLast);
+
+        // the first worker also draws the skinned instances and the crowd, with the frame's camera block,
+        // the last one the occlusion boxes, the particles and the GUI, its secondary is executed after all others
+        const bool drawSkinned = skinning && t == 0;
+        const bool drawCrowd = crowd && t == 0;
+        const bool drawQueries = queries && t == threadCount - 1;
+        const bool drawParticles = particles && t == threadCount - 1;
+        const bool drawGui = gui && t == threadCount - 1;
+        recordThreads->Enqueue([this, context, first, last, depthFirst, depthLast, drawSkinned, drawCrowd, drawQueries, drawParticles, drawGui, prepass, frameIndex, inheritanceInfo,
+                                   prepassInheritanceInfo, &pipeline, &scene, &geometry]() {
+            device.resetCommandPool(context->pool, vk::CommandPoolResetFlags());
+            context->pipelineBinds = 0;
+            context->triangles = 0;
+
+            vk::CommandBufferBeginInfo beginInfo;
+            beginInfo.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            // dynamic state is not inherited by secondary command buffers
+            vk::Viewport viewport = { 0, 0, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
+            vk::Rect2D scissor = { { 0, 0 }, renderExtent };
+            // the camera block of the frame, bound once, everything per draw is a push constant
+            const uint32_t uniformOffset = pipeline.GetFrameOffset(frameIndex);
+
+            if (prepass) {
+                beginInfo.pInheritanceInfo = &prepassInheritanceInfo;
+                vk::CommandBuffer cmd = context->prepass;
+                cmd.begin(beginInfo);
+                context->binds.Reset();
+                cmd.setViewport(0, 1, &viewport);
+                cmd.setScissor(0, 1, &scissor);
+                // every worker's run of the pass is a region of its own in captures
+                beginRegion(cmd, PrepassPass);
+                recordQueue(cmd, pipeline, scene, geometry, depthFirst, depthLast, uniformOffset, *context);
+                endRegion(cmd);
+                cmd.end();
+            }
+
+            beginInfo.pInheritanceInfo = &inheritanceInfo;
+            vk::CommandBuffer cmd = context->secondary;
+            cmd.begin(beginInfo);
+            context->binds.Reset();
+            cmd.setViewport(0, 1, &viewport);
+            cmd.setScissor(0, 1, &scissor);
+            // like the dynamic state, the bound shading rate image is not inherited
+            if (shadingRate) {
+                shadingRate->Bind(cmd);
+            }
+            beginRegion(cmd, OpaquePass);
+            recordQueue(cmd, pipeline, scene, geometry, first, last, uniformOffset, *context);
+            endRegion(cmd);
+            if (drawSkinned) {
+                beginRegion(cmd, SkinnedPass);
+                context->binds.BindPipeline(cmd, pipeline.GetSkinnedPipeline(), "CommandBuffer skinned pass");
+                if (first == last) {
+                    context->binds.BindDescriptorSet(cmd, pipeline.GetPipelineLayout(), 0, pipeline.GetDescriptorSet(), 1, &uniformOffset, "CommandBuffer skinned pass");
+                }
+                pipeline.PushDrawConstants(cmd, Pipeline::DrawConstants());
+                skinning->Draw(cmd, frameIndex);
+                // what the passes bind themselves is not tracked
+                context->binds.Reset();
+                endRegion(cmd);
+            }
+            if (drawCrowd) {
+                beginRegion(cmd, CrowdPass);
+                // set 0 is the camera's, unless a draw before bound it
+                if (first == last && !drawSkinned) {
+                    context->binds.BindDescriptorSet(cmd, pipeline.GetPipelineLayout(), 0, pipeline.GetDescriptorSet(), 1, &uniformOffset, "CommandBuffer crowd pass");
+                }
+                crowd->Draw(cmd, frameIndex);
+                context->binds.Reset();
+                endRegion(cmd);
+            }
+            // the boxes test against everything drawn before them
+            if (drawQueries) {
+                beginRegion(cmd, OcclusionPass);
+                queries->RecordQueries(cmd, uniformOffset);
+                context->binds.Reset();
+                endRegion(cmd);
+            }
+            // blended over all opaque geometry, the other workers' secondaries are executed before
+            if (drawParticles) {
+                beginRegion(cmd, ParticlePass);
+                context->binds.BindDescriptorSet(cmd, pipeline.GetPipelineLayout(), 0, pipeline.GetDescriptorSet(), 1, &uniformOffset, "CommandBuffer particle pass");
+                particles->Draw(cmd);
+                context->binds.Reset();
+                endRegion(cmd);
+            }
+            if (drawGui) {
+                beginRegion(cmd, GuiPass);
+                gui->Draw(cmd, frameIndex);
+                endRegion(cmd);
+            }
+            cmd.end();
+        });
+    }
+
+    recordThreads->Wait();
+    triangleCount = 0;
+    pipelineBindCount = 0;
+    for (const auto& context : contexts) {
+        triangleCount += context.triangles;
+        pipelineBindCount += context.pipelineBinds;
+    }
+
+    FrameVector<vk::CommandBuffer> secondaries(arena.Get());
+    secondaries.reserve(contexts.size());
+    if (prepass) {
+        for (auto& context : contexts) {
+            secondaries.push_back(context.prepass);
+        }
+        primary.executeCommands(secondaries);
+        primary.nextSubpass(vk::SubpassContents::eSecondaryCommandBuffers);
+        secondaries.clear();
+    }
+    for (auto& context : contexts) {
+        secondaries.push_back(context.secondary);
+    }
+    primary.executeCommands(secondaries);
+    primary.endRenderPass();
+    if (queries) {
+        queries->RecordEnd(primary);
+    }
+    recordSceneBlit(primary, frameIndex, imageIndex);
+    endPass(primary, frameIndex, ScenePass);
+    primary.end();
+}
+
+uint32_t CommandBuffer::Create(vk::CommandBufferLevel level, bool begin)
+{
+    uint32_t index = static_cast<uint32_t>(tempCmdBuffers.size());
+    for (size_t i = 0; i < freeTempBuffers.size(); ++i) {
+        if (tempLevels[freeTempBuffers[i]] == level) {
+            index = freeTempBuffers[i];
+            freeTempBuffers.erase(freeTempBuffers.begin() + i);
+            break;
+        }
+    }
+    if (index == tempCmdBuffers.size()) {
+        vk::CommandBufferAllocateInfo cmdBufAllocateInfo = {};
+        cmdBufAllocateInfo.commandPool = tempPool;
+        cmdBufAllocateInfo.level = level;
+        cmdBufAllocateInfo.commandBufferCount = 1;
+
+        tempCmdBuffers.push_back(device.allocateCommandBuffers(cmdBufAllocateInfo)[0]);
+        tempLevels.push_back(level);
+    }
+    ++openTempBuffers;
+
+    if (begin) {
+        vk::CommandBufferBeginInfo cmdBufInfo = {};
+        cmdBufInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        tempCmdBuffers[index].begin(cmdBufInfo);
+    }
+    return index;
+}
+
+void CommandBuffer::Flush(uint32_t index)
+{
     tempCmdBuffers[index].end();
 
     vk::SubmitInfo _submitInfo = {};
     _submitInfo.commandBufferCount = 1;
     _submitInfo.pCommandBuffers = &tempCmdBuffers[index];
 
-    vk::FenceCreateInfo fenceCreateInfo = {};
-    vk::Fence fence;
-    fence = device.createFence(fenceCreateInfo);
+    queue.submit(_submitInfo, tempFence);
+    perflint::Submit("CommandBuffer::Flush");
+    // only wait for this submission, not for everything else on the queue
+    device.waitForFences(tempFence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+    device.resetFences(tempFence);
 
-    queue.submit(_submitInfo, fence);
-    queue.waitIdle();
-
-    device.destroyFence(fence);
-    //if (free) {
-    //	device.freeCommandBuffers(cmdPool, 1, &tempCmdBuffers[index]);
-    //}
+    // buffers of a pool without individual resets come back together, once none is recording
+    flushedTempBuffers.push_back(index);
+    assert(openTempBuffers > 0);
+    if (--openTempBuffers == 0) {
+        device.resetCommandPool(tempPool, vk::CommandPoolResetFlags());
+        freeTempBuffers.insert(freeTempBuffers.end(), flushedTempBuffers.begin(), flushedTempBuffers.end());
+        flushedTempBuffers.clear();
+    }
 }
 
 void CommandBuffer::createCommandPool()
@@ -298,16 +1278,31 @@ void CommandBuffer::createCommandPool()
     cmdPoolInfo.queueFamilyIndex = swapChain.queueNodeIndex;
     cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
     cmdPool = device.createCommandPool(cmdPoolInfo);
+
+    // short lived uploads and layout changes, recycled by resetting the whole pool
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    tempPool = device.createCommandPool(cmdPoolInfo);
+    tempFence = device.createFence(vk::FenceCreateInfo());
 }
 
 CommandBuffer::~CommandBuffer()
 {
-    // clear temp command buffers
-    for (auto& cmdbuffer : tempCmdBuffers) {
-        device.freeCommandBuffers(cmdPool, cmdbuffer);
+    // per-frame recording pools free their secondary buffers with them
+    recordThreads.reset();
+    for (auto& frame : recordContexts) {
+        for (auto& context : frame) {
+            device.destroyCommandPool(context.pool);
+        }
     }
+    recordContexts.clear();
+
+    // temp command buffers go with their pool
+    device.destroyCommandPool(tempPool);
+    device.destroyFence(tempFence);
     tempCmdBuffers.clear();
 
+    destroyTargets(nullptr);
+
     // clear draw command buffers
     for (auto& cmdbuffer : drawCmdBuffers) {
         device.freeCommandBuffers(cmdPool, cmdbuffer);
@@ -0,0 +1,343 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "CommandCapture.hpp"
+#include "RendererVulkan.hpp"
+
+#include <cstring>
+
+namespace m3d {
+
+static const char CaptureMagic[4] = { 'M', '3', 'D', 'C' };
+static const uint32_t CaptureVersion = 1;
+static const uint32_t InvalidId = 0xFFFFFFFF;
+
+enum class CaptureCommand : uint32_t {
+    AddInstance,
+    RemoveInstance,
+    SetTransform,
+    SetSliceMaterial,
+    RenderOffscreen,
+    Frame
+};
+
+// position, rotation xyzw and scale
+struct CapturedTransform {
+    float values[10];
+};
+
+static CapturedTransform toCaptured(const Transform& transform)
+{
+    CapturedTransform captured = { { transform.position.x, transform.position.y, transform.position.z, transform.rotation.x, transform.rotation.y,
+        transform.rotation.z, transform.rotation.w, transform.scale.x, transform.scale.y, transform.scale.z } };
+    return captured;
+}
+
+static Transform fromCaptured(const CapturedTransform& captured)
+{
+    const float* v = captured.values;
+    Transform transform;
+    transform.position = m3d::math::Vector3(v[0], v[1], v[2]);
+    transform.rotation = m3d::math::Quaternion(v[3], v[4], v[5], v[6]);
+    transform.scale = m3d::math::Vector3(v[7], v[8], v[9]);
+    return transform;
+}
+
+CommandCapture::CommandCapture(const std::string& Path)
+    : path(Path)
+{
+}
+
+CommandCapture::~CommandCapture()
+{
+    if (file) {
+        fclose(file);
+        printf("CommandCapture: %llu frames in %s\n", static_cast<unsigned long long>(frames), path.c_str());
+    }
+}
+
+void CommandCapture::write(const void* data, size_t bytes)
+{
+    if (file && fwrite(data, bytes, 1, file) != 1) {
+        printf("CommandCapture: can not write %s, the capture ends after %llu frames\n", path.c_str(), static_cast<unsigned long long>(frames));
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool CommandCapture::Begin(const Scene& scene, uint32_t width, uint32_t height, uint32_t batch)
+{
+    // uncompressed, a replay maps the geometry instead of decoding it before its first frame
+    const std::string scenePath = CookedPath(path);
+    if (!CookScene(scene, scenePath, false)) {
+        printf("CommandCapture: can not write the scene to %s\n", scenePath.c_str());
+        return false;
+    }
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("CommandCapture: can not write %s\n", path.c_str());
+        return false;
+    }
+    const uint32_t header[4] = { CaptureVersion, width, height, batch };
+    write(CaptureMagic, sizeof(CaptureMagic));
+    write(header, sizeof(header));
+
+    // in the order CookScene wrote them, which is the order a load of the cooked scene creates them in
+    std::vector<uint32_t> ids[4];
+    for (uint32_t meshID : scene.meshes) {
+        ids[0].push_back(meshID);
+    }
+    for (uint32_t materialID : scene.materials) {
+        ids[1].push_back(materialID);
+    }
+    for (uint32_t transformID : scene.transforms) {
+        ids[2].push_back(transformID);
+    }
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        // as CookScene, which drops instances of a removed mesh or transform
+        if (scene.meshes.contains(instance.meshId) && scene.transforms.contains(instance.transformId)) {
+            ids[3].push_back(instanceID);
+        }
+    }
+    for (const auto& list : ids) {
+        const uint32_t count = static_cast<uint32_t>(list.size());
+        write(&count, sizeof(count));
+        if (count > 0) {
+            write(list.data(), count * sizeof(uint32_t));
+        }
+    }
+    return file != nullptr;
+}
+
+void CommandCapture::AddInstance(uint32_t meshID, const Transform& transform, uint32_t instanceID, uint32_t transformID)
+{
+    const CaptureCommand command = CaptureCommand::AddInstance;
+    const uint32_t ids[3] = { meshID, instanceID, transformID };
+    const CapturedTransform captured = toCaptured(transform);
+    write(&command, sizeof(command));
+    write(ids, sizeof(ids));
+    write(&captured, sizeof(captured));
+}
+
+void CommandCapture::RemoveInstance(uint32_t instanceID)
+{
+    const CaptureCommand command = CaptureCommand::RemoveInstance;
+    write(&command, sizeof(command));
+    write(&instanceID, sizeof(instanceID));
+}
+
+void CommandCapture::SetTransform(uint32_t transformID, const Transform& transform)
+{
+    const CaptureCommand command = CaptureCommand::SetTransform;
+    const CapturedTransform captured = toCaptured(transform);
+    write(&command, sizeof(command));
+    write(&transformID, sizeof(transformID));
+    write(&captured, sizeof(captured));
+}
+
+void CommandCapture::SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID)
+{
+    const CaptureCommand command = CaptureCommand::SetSliceMaterial;
+    const uint32_t ids[3] = { meshID, slice, materialID };
+    write(&command, sizeof(command));
+    write(ids, sizeof(ids));
+}
+
+void CommandCapture::RenderOffscreen(uint64_t id, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection)
+{
+    const CaptureCommand command = CaptureCommand::RenderOffscreen;
+    write(&command, sizeof(command));
+    write(&id, sizeof(id));
+    write(view.m, sizeof(view.m));
+    write(projection.m, sizeof(projection.m));
+}
+
+void CommandCapture::Frame(const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection)
+{
+    const CaptureCommand command = CaptureCommand::Frame;
+    write(&command, sizeof(command));
+    write(view.m, sizeof(view.m));
+    write(projection.m, sizeof(projection.m));
+    ++frames;
+}
+
+CommandReplay::~CommandReplay()
+{
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool CommandReplay::read(void* data, size_t bytes)
+{
+    return file && fread(data, bytes, 1, file) == 1;
+}
+
+bool CommandReplay::readIds(std::unordered_map<uint32_t, uint32_t>& ids, const std::vector<uint32_t>& replayIds)
+{
+    uint32_t count = 0;
+    if (!read(&count, sizeof(count)) || count != replayIds.size()) {
+        return false;
+    }
+    std::vector<uint32_t> captureIds(count);
+    if (count > 0 && !read(captureIds.data(), count * sizeof(uint32_t))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        ids[captureIds[i]] = replayIds[i];
+    }
+    return true;
+}
+
+uint32_t CommandReplay::map(const std::unordered_map<uint32_t, uint32_t>& ids, uint32_t id)
+{
+    auto found = ids.find(id);
+    return found != ids.end() ? found->second : InvalidId;
+}
+
+bool CommandReplay::Open(const std::string& path, Scene& replayScene, uint32_t threadCount)
+{
+    scene = &replayScene;
+    scene->Init(path);
+    if (!scene->cooked) {
+        printf("CommandReplay: no scene of %s at %s\n", path.c_str(), CookedPath(path).c_str());
+        return false;
+    }
+    LoadMeshes(scene, nullptr, threadCount);
+
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        printf("CommandReplay: can not read %s\n", path.c_str());
+        return false;
+    }
+    char magic[sizeof(CaptureMagic)];
+    uint32_t header[4];
+    if (!read(magic, sizeof(magic)) || memcmp(magic, CaptureMagic, sizeof(magic)) != 0 || !read(header, sizeof(header))
+        || header[0] != CaptureVersion) {
+        printf("CommandReplay: %s is not a capture of this version\n", path.c_str());
+        return false;
+    }
+    width = header[1];
+    height = header[2];
+    window = header[3] == 0;
+    batch = window ? 1 : header[3];
+
+    // the load created them in the capture's order
+    std::vector<uint32_t> replayIds[4];
+    for (uint32_t meshID : scene->meshes) {
+        replayIds[0].push_back(meshID);
+    }
+    for (uint32_t materialID : scene->materials) {
+        replayIds[1].push_back(materialID);
+    }
+    for (uint32_t transformID : scene->transforms) {
+        replayIds[2].push_back(transformID);
+    }
+    for (uint32_t instanceID : scene->instances) {
+        replayIds[3].push_back(instanceID);
+    }
+    if (!readIds(meshIds, replayIds[0]) || !readIds(materialIds, replayIds[1]) || !readIds(transformIds, replayIds[2])
+        || !readIds(instanceIds, replayIds[3])) {
+        printf("CommandReplay: the scene of %s does not match its commands\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CommandReplay::ReplayFrame(RendererVulkan& renderer)
+{
+    CaptureCommand command;
+    while (read(&command, sizeof(command))) {
+        switch (command) {
+        case CaptureCommand::AddInstance: {
+            uint32_t ids[3];
+            CapturedTransform captured;
+            if (!read(ids, sizeof(ids)) || !read(&captured, sizeof(captured))) {
+                return false;
+            }
+            const uint32_t meshID = map(meshIds, ids[0]);
+            if (meshID == InvalidId) {
+                ++skipped;
+                break;
+            }
+            const uint32_t instanceID = renderer.AddInstance(meshID, fromCaptured(captured));
+            instanceIds[ids[1]] = instanceID;
+            transformIds[ids[2]] = scene->instances[instanceID].transformId;
+            break;
+        }
+        case CaptureCommand::RemoveInstance: {
+            uint32_t id;
+            if (!read(&id, sizeof(id))) {
+                return false;
+            }
+            const uint32_t instanceID = map(instanceIds, id);
+            if (instanceID == InvalidId) {
+                ++skipped;
+                break;
+            }
+            renderer.RemoveInstance(instanceID);
+            instanceIds.erase(id);
+            break;
+        }
+        case CaptureCommand::SetTransform: {
+            uint32_t id;
+            CapturedTransform captured;
+            if (!read(&id, sizeof(id)) || !read(&captured, sizeof(captured))) {
+                return false;
+            }
+            const uint32_t transformID = map(transformIds, id);
+            if (transformID == InvalidId) {
+                ++skipped;
+                break;
+            }
+            renderer.SetTransform(transformID, fromCaptured(captured));
+            break;
+        }
+        case CaptureCommand::SetSliceMaterial: {
+            uint32_t ids[3];
+            if (!read(ids, sizeof(ids))) {
+                return false;
+            }
+            const uint32_t meshID = map(meshIds, ids[0]);
+            const uint32_t materialID = map(materialIds, ids[2]);
+            if (meshID == InvalidId || materialID == InvalidId) {
+                ++skipped;
+                break;
+            }
+            renderer.SetSliceMaterial(meshID, ids[1], materialID);
+            break;
+        }
+        case CaptureCommand::RenderOffscreen: {
+            uint64_t id;
+            float view[16], projection[16];
+            if (!read(&id, sizeof(id)) || !read(view, sizeof(view)) || !read(projection, sizeof(projection))) {
+                return false;
+            }
+            renderer.RenderOffscreen(id, m3d::math::Matrix4x4(view), m3d::math::Matrix4x4(projection));
+            break;
+        }
+        case CaptureCommand::Frame: {
+            float view[16], projection[16];
+            if (!read(view, sizeof(view)) || !read(projection, sizeof(projection))) {
+                return false;
+            }
+            // what the window showed, as the one render of the frame
+            if (window) {
+                renderer.RenderOffscreen(frames, m3d::math::Matrix4x4(view), m3d::math::Matrix4x4(projection));
+            }
+            renderer.Draw();
+            ++frames;
+            return true;
+        }
+        default:
+            printf("CommandReplay: unknown command %u after %llu frames\n", static_cast<uint32_t>(command), static_cast<unsigned long long>(frames));
+            return false;
+        }
+    }
+    return false;
+}
+}
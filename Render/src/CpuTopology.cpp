@@ -0,0 +1,284 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "CpuTopology.hpp"
+#include "Allocator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__) || defined(__ANDROID__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__ANDROID__)
+#include "cpu-features.h"
+#endif
+
+namespace m3d {
+namespace cpu {
+
+    // a slowest core at this share of the fastest or above is the same kind of core
+    static const float SameClassRatio = 0.85f;
+
+    static uint32_t coreCount()
+    {
+#if defined(__ANDROID__)
+        const int count = android_getCpuCount();
+        if (count > 0) {
+            return static_cast<uint32_t>(count);
+        }
+#endif
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    static uint32_t maxFrequency(uint32_t core)
+    {
+#if defined(__linux__) || defined(__ANDROID__)
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/cpuinfo_max_freq", core);
+        FILE* file = fopen(path, "r");
+        if (!file) {
+            return 0;
+        }
+        unsigned int frequency = 0;
+        if (fscanf(file, "%u", &frequency) != 1) {
+            frequency = 0;
+        }
+        fclose(file);
+        return frequency;
+#else
+        (void)core;
+        return 0;
+#endif
+    }
+
+    // nodes above are not looked for, the mbind and set_mempolicy masks are one word
+    static const uint32_t MaxNodes = 64;
+
+#if defined(__linux__) || defined(__ANDROID__)
+    // node of the cores of a cpulist like 0-15,32-47
+    static void readNodeCores(FILE* file, uint32_t node, std::vector<Core>& cores)
+    {
+        unsigned int first = 0;
+        while (fscanf(file, "%u", &first) == 1) {
+            unsigned int last = first;
+            int separator = fgetc(file);
+            if (separator == '-') {
+                if (fscanf(file, "%u", &last) != 1) {
+                    return;
+                }
+                separator = fgetc(file);
+            }
+            for (unsigned int core = first; core <= last && core < cores.size(); ++core) {
+                cores[core].node = node;
+            }
+            if (separator != ',') {
+                return;
+            }
+        }
+    }
+#endif
+
+    // node of every core and the node count
+    static uint32_t detectNodes(std::vector<Core>& cores)
+    {
+        uint32_t count = 1;
+#ifdef _WIN32
+        for (Core& core : cores) {
+            UCHAR node = 0;
+            if (core.index < 256 && GetNumaProcessorNode(static_cast<UCHAR>(core.index), &node) && node < MaxNodes) {
+                core.node = node;
+                count = std::max(count, node + 1u);
+            }
+        }
+#elif defined(__linux__) || defined(__ANDROID__)
+        for (uint32_t node = 0; node < MaxNodes; ++node) {
+            char path[64];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+            FILE* file = fopen(path, "r");
+            if (!file) {
+                continue;
+            }
+            readNodeCores(file, node, cores);
+            fclose(file);
+            count = node + 1;
+        }
+#else
+        (void)cores;
+#endif
+        return count;
+    }
+
+    static Topology detect()
+    {
+        Topology topology;
+        const uint32_t count = coreCount();
+        uint32_t slowest = 0xFFFFFFFF;
+        uint32_t fastest = 0;
+        for (uint32_t index = 0; index < count; ++index) {
+            Core core;
+            core.index = index;
+            core.maxFrequencyKHz = maxFrequency(index);
+            core.big = true;
+            core.node = 0;
+            topology.cores.push_back(core);
+            slowest = std::min(slowest, core.maxFrequencyKHz);
+            fastest = std::max(fastest, core.maxFrequencyKHz);
+        }
+        topology.nodeCount = detectNodes(topology.cores);
+        if (topology.nodeCount > 1) {
+            printf("CpuTopology: %u NUMA nodes\n", topology.nodeCount);
+        }
+        if (slowest == 0 || slowest >= fastest * SameClassRatio) {
+            return topology;
+        }
+        const uint32_t middle = slowest + (fastest - slowest) / 2;
+        for (Core& core : topology.cores) {
+            core.big = core.maxFrequencyKHz >= middle;
+        }
+        topology.heterogeneous = true;
+        printf("CpuTopology: %u big and %u little cores\n", topology.Count(CoreClass::Big), topology.Count(CoreClass::Little));
+        return topology;
+    }
+
+    std::vector<uint32_t> Topology::Cores(CoreClass coreClass) const
+    {
+        std::vector<uint32_t> indices;
+        for (const Core& core : cores) {
+            if (coreClass == CoreClass::Any || core.big == (coreClass == CoreClass::Big)) {
+                indices.push_back(core.index);
+            }
+        }
+        return indices;
+    }
+
+    std::vector<uint32_t> Topology::NodeCores(uint32_t node) const
+    {
+        std::vector<uint32_t> indices;
+        for (const Core& core : cores) {
+            if (core.node == node) {
+                indices.push_back(core.index);
+            }
+        }
+        return indices;
+    }
+
+    const Topology& GetTopology()
+    {
+        static const Topology topology = detect();
+        return topology;
+    }
+
+    bool PinCurrentThread(CoreClass coreClass)
+    {
+        const Topology& topology = GetTopology();
+        if (!topology.heterogeneous) {
+            return false;
+        }
+        const std::vector<uint32_t> cores = topology.Cores(coreClass);
+#ifdef _WIN32
+        DWORD_PTR mask = 0;
+        for (uint32_t core : cores) {
+            if (core < sizeof(DWORD_PTR) * 8) {
+                mask |= DWORD_PTR(1) << core;
+            }
+        }
+        return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__) || defined(__ANDROID__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (uint32_t core : cores) {
+            if (core < CPU_SETSIZE) {
+                CPU_SET(core, &set);
+            }
+        }
+        // 0 is the calling thread
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            printf("CpuTopology: can not pin a thread to its cores\n");
+            return false;
+        }
+        return true;
+#else
+        (void)cores;
+        return false;
+#endif
+    }
+
+    bool BindCurrentThread(int node)
+    {
+        const Topology& topology = GetTopology();
+        if (topology.nodeCount < 2 || node >= static_cast<int>(topology.nodeCount)) {
+            return false;
+        }
+        const std::vector<uint32_t> cores = node < 0 ? topology.Cores(CoreClass::Any) : topology.NodeCores(static_cast<uint32_t>(node));
+        threadNumaNode() = node;
+#ifdef _WIN32
+        DWORD_PTR mask = 0;
+        for (uint32_t core : cores) {
+            if (core < sizeof(DWORD_PTR) * 8) {
+                mask |= DWORD_PTR(1) << core;
+            }
+        }
+        return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__) || defined(__ANDROID__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (uint32_t core : cores) {
+            if (core < CPU_SETSIZE) {
+                CPU_SET(core, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            printf("CpuTopology: can not bind a thread to NUMA node %d\n", node);
+            return false;
+        }
+        // preferred, not bound: a full node spills over instead of failing the allocation
+        const unsigned long mask = node < 0 ? 0 : 1ul << node;
+        if (syscall(SYS_set_mempolicy, node < 0 ? MPOL_DEFAULT : MPOL_PREFERRED, node < 0 ? nullptr : &mask, sizeof(mask) * 8) != 0) {
+            printf("CpuTopology: can not place the memory of a thread on NUMA node %d\n", node);
+        }
+        return true;
+#else
+        (void)cores;
+        return false;
+#endif
+    }
+
+    int PciDeviceNode(uint32_t domain, uint32_t bus, uint32_t device, uint32_t function)
+    {
+#if defined(__linux__)
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node", domain, bus, device, function);
+        FILE* file = fopen(path, "r");
+        if (!file) {
+            return -1;
+        }
+        // -1 when the firmware does not say
+        int node = -1;
+        if (fscanf(file, "%d", &node) != 1) {
+            node = -1;
+        }
+        fclose(file);
+        return node < static_cast<int>(GetTopology().nodeCount) ? node : -1;
+#else
+        (void)domain;
+        (void)bus;
+        (void)device;
+        (void)function;
+        return -1;
+#endif
+    }
+}
+}
@@ -0,0 +1,360 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "CrowdRenderer.hpp"
+#include "CommandBuffer.hpp"
+#include "Pipeline.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+namespace m3d {
+
+static_assert(sizeof(animation::SkinnedVertex) == 48, "crowd.vert reads the bind pose with a 48 byte stride");
+
+CrowdRenderer::CrowdRenderer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, PipelineRegistry& registry,
+    Pipeline& pipeline, uint32_t slotCount, uint32_t MaxVertices, uint32_t MaxMatrices, uint32_t MaxClips, uint32_t MaxMeshes, uint32_t MaxAgents)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , maxVertices(MaxVertices)
+    , maxMatrices(MaxMatrices)
+    , maxClips(MaxClips)
+    , maxMeshes(MaxMeshes)
+    , maxAgents(MaxAgents)
+    , vertexCount(0)
+    , indexCount(0)
+    , matrixCount(0)
+    , clipCount(0)
+    , agentCount(0)
+    , revision(1)
+{
+    static_assert(sizeof(GpuAgent) == 64, "crowd.vert reads 16 words per agent");
+    static_assert(sizeof(GpuClip) == 32, "crowd.vert reads 8 words per clip");
+    vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+    multiDraw = features.multiDrawIndirect == VK_TRUE;
+
+    createBuffer(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxVertices * sizeof(animation::SkinnedVertex), bindPose);
+    // room for three indices per vertex
+    createBuffer(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        3 * maxVertices * sizeof(uint32_t), indices);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxMatrices * sizeof(m3d::math::Matrix4x3), matrices);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxClips * sizeof(GpuClip), clips);
+    vkx::debug::marker::setName(device, bindPose.buffer, "crowd bind pose");
+    vkx::debug::marker::setName(device, indices.buffer, "crowd indices");
+    vkx::debug::marker::setName(device, matrices.buffer, "crowd baked palettes");
+    vkx::debug::marker::setName(device, clips.buffer, "crowd clips");
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    slots.resize(slotCount);
+    for (Slot& slot : slots) {
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxAgents * sizeof(GpuAgent), slot.agents);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, maxMeshes * sizeof(vk::DrawIndexedIndirectCommand), slot.draws);
+        // a std140 block is at least 16 bytes
+        createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, hostVisible, 4 * sizeof(float), slot.frame);
+        vkx::debug::marker::setName(device, slot.agents.buffer, "crowd agents");
+        vkx::debug::marker::setName(device, slot.draws.buffer, "crowd draws");
+        vkx::debug::marker::setName(device, slot.frame.buffer, "crowd frame");
+        memset(slot.draws.memory.mapped, 0, maxMeshes * sizeof(vk::DrawIndexedIndirectCommand));
+        memset(slot.frame.memory.mapped, 0, 4 * sizeof(float));
+        slot.revision = 0;
+    }
+
+    createPipeline(registry, pipeline);
+    writeDescriptors();
+}
+
+CrowdRenderer::~CrowdRenderer()
+{
+    // the registry owns the pipeline and its layouts
+    device.destroyDescriptorPool(descriptorPool);
+    for (Slot& slot : slots) {
+        destroyBuffer(slot.agents);
+        destroyBuffer(slot.draws);
+        destroyBuffer(slot.frame);
+    }
+    destroyBuffer(bindPose);
+    destroyBuffer(indices);
+    destroyBuffer(matrices);
+    destroyBuffer(clips);
+}
+
+void CrowdRenderer::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory);
+    assert(buffer.memory && "out of device memory for crowds");
+}
+
+void CrowdRenderer::destroyBuffer(Buffer& buffer)
+{
+    commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    buffer = Buffer();
+}
+
+// Meshes and animations are added at load time, a blocking copy is fine there
+void CrowdRenderer::upload(const void* data, vk::DeviceSize size, vk::Buffer target, vk::DeviceSize offset)
+{
+    Buffer staging;
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        size, const_cast<void*>(data), staging.buffer, staging.memory, std::vector<uint32_t>(), MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Staging);
+
+    uint32_t copyCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& copyCmd = commandBuffer.GetCommandBuffer(copyCmdIndex);
+    copyCmd.copyBuffer(staging.buffer, target, vk::BufferCopy(0, offset, size));
+    commandBuffer.Flush(copyCmdIndex);
+
+    destroyBuffer(staging);
+}
+
+void CrowdRenderer::createPipeline(PipelineRegistry& registry, Pipeline& pipeline)
+{
+    // agents, baked palettes, clips and the frame's time
+    std::array<vk::DescriptorSetLayoutBinding, 4> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 3 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eVertex;
+    }
+    setLayout = registry.GetDescriptorSetLayout(std::vector<vk::DescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+
+    // set 0 and the push constants as the scene pipeline has them, its camera stays bound across both
+    std::vector<vk::PushConstantRange> pushConstants;
+    if (pipeline.GetDrawConstantRange().size) {
+        pushConstants.push_back(pipeline.GetDrawConstantRange());
+    }
+    pipelineLayout = registry.GetPipelineLayout({ pipeline.GetDescriptorSetLayout(), setLayout }, pushConstants);
+
+    PipelineDesc desc;
+    desc.renderPass = pipeline.GetRenderPass();
+    desc.subpass = pipeline.GetShadingSubpass();
+    desc.samples = pipeline.GetSamples();
+    desc.colorAttachments = pipeline.GetColorAttachmentCount();
+    desc.layout = pipelineLayout;
+    desc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\crowd.vert.spv";
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\triangle.frag.spv";
+    desc.bindings.push_back(vk::VertexInputBindingDescription(0, sizeof(animation::SkinnedVertex), vk::VertexInputRate::eVertex));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32Sfloat, offsetof(animation::SkinnedVertex, position)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(animation::SkinnedVertex, normal)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32Sfloat, offsetof(animation::SkinnedVertex, u)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(3, 0, vk::Format::eR8G8B8A8Uint, offsetof(animation::SkinnedVertex, jointIndex)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(4, 0, vk::Format::eR32G32B32Sfloat, offsetof(animation::SkinnedVertex, jointWeight)));
+    pipelineDesc = desc;
+    RefreshPipelines(registry);
+}
+
+void CrowdRenderer::RefreshPipelines(PipelineRegistry& registry)
+{
+    crowdPipeline = registry.Get(pipelineDesc);
+    vkx::debug::marker::setName(device, crowdPipeline, "crowd");
+}
+
+void CrowdRenderer::writeDescriptors()
+{
+    const uint32_t slotCount = static_cast<uint32_t>(slots.size());
+    std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 3 * slotCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, slotCount)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = slotCount;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(slotCount, setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = slotCount;
+    allocInfo.pSetLayouts = layouts.data();
+    std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        Slot& slot = slots[s];
+        slot.set = sets[s];
+
+        std::array<vk::DescriptorBufferInfo, 4> bufferInfos = {
+            vk::DescriptorBufferInfo(slot.agents.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(matrices.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(clips.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.frame.buffer, 0, VK_WHOLE_SIZE)
+        };
+        std::vector<vk::WriteDescriptorSet> writes(bufferInfos.size());
+        for (uint32_t i = 0; i < writes.size(); ++i) {
+            writes[i].dstSet = slot.set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = i == 3 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+bool CrowdRenderer::AddMesh(const animation::SkinnedVertex* vertices, uint32_t meshVertexCount, const uint32_t* meshIndices, uint32_t meshIndexCount,
+    CrowdMesh* mesh)
+{
+    if (vertexCount + meshVertexCount > maxVertices || indexCount + meshIndexCount > 3 * maxVertices || meshVertexCount == 0
+        || meshes.size() == maxMeshes) {
+        printf("CrowdRenderer: no room for a mesh of %u vertices\n", meshVertexCount);
+        return false;
+    }
+    mesh->firstVertex = vertexCount;
+    mesh->vertexCount = meshVertexCount;
+    mesh->firstIndex = indexCount;
+    mesh->indexCount = meshIndexCount;
+    mesh->index = static_cast<uint32_t>(meshes.size());
+
+    upload(vertices, meshVertexCount * sizeof(animation::SkinnedVertex), bindPose.buffer, vertexCount * sizeof(animation::SkinnedVertex));
+    if (meshIndexCount > 0) {
+        upload(meshIndices, meshIndexCount * sizeof(uint32_t), indices.buffer, indexCount * sizeof(uint32_t));
+    }
+    vertexCount += meshVertexCount;
+    indexCount += meshIndexCount;
+    meshes.push_back(*mesh);
+    return true;
+}
+
+bool CrowdRenderer::AddAnimation(const animation::BakedAnimation& baked, CrowdAnimation* animation)
+{
+    const uint32_t bakedMatrices = static_cast<uint32_t>(baked.palettes.size());
+    const uint32_t bakedClips = static_cast<uint32_t>(baked.clips.size());
+    if (matrixCount + bakedMatrices > maxMatrices || clipCount + bakedClips > maxClips || bakedClips == 0) {
+        printf("CrowdRenderer: no room for %u clips of %u baked matrices\n", bakedClips, bakedMatrices);
+        return false;
+    }
+    animation->firstClip = clipCount;
+    animation->clipCount = bakedClips;
+    animation->jointCount = baked.jointCount;
+
+    // clip matrices are relative to the animation's, they move to where it lands in the shared buffer
+    std::vector<GpuClip> gpuClips(bakedClips);
+    for (uint32_t c = 0; c < bakedClips; ++c) {
+        const animation::BakedClip& clip = baked.clips[c];
+        GpuClip& gpuClip = gpuClips[c];
+        gpuClip.firstMatrix = matrixCount + clip.firstMatrix;
+        gpuClip.frameCount = clip.frameCount;
+        gpuClip.jointCount = baked.jointCount;
+        gpuClip.loop = clip.loop ? 1 : 0;
+        gpuClip.frameRate = clip.frameRate;
+        memset(gpuClip.pad, 0, sizeof(gpuClip.pad));
+    }
+    if (bakedMatrices > 0) {
+        upload(baked.palettes.data(), bakedMatrices * sizeof(m3d::math::Matrix4x3), matrices.buffer, matrixCount * sizeof(m3d::math::Matrix4x3));
+    }
+    upload(gpuClips.data(), bakedClips * sizeof(GpuClip), clips.buffer, clipCount * sizeof(GpuClip));
+    matrixCount += bakedMatrices;
+    clipCount += bakedClips;
+    return true;
+}
+
+uint32_t CrowdRenderer::AddAgent(const CrowdMesh& mesh, const CrowdAnimation& animation, uint32_t clip, const m3d::math::Matrix4x3& world,
+    float timeOffset, float speed)
+{
+    if (agentCount == maxAgents || clip >= animation.clipCount) {
+        return InvalidAgent;
+    }
+    uint32_t id;
+    if (!freeAgents.empty()) {
+        id = freeAgents.back();
+        freeAgents.pop_back();
+    } else {
+        id = static_cast<uint32_t>(agents.size());
+        agents.emplace_back();
+    }
+    Agent& agent = agents[id];
+    agent.gpu.world = world;
+    agent.gpu.clip = animation.firstClip + clip;
+    agent.gpu.timeOffset = timeOffset;
+    agent.gpu.speed = speed;
+    agent.gpu.pad = 0;
+    agent.mesh = mesh.index;
+    agentCount++;
+    revision++;
+    return id;
+}
+
+void CrowdRenderer::RemoveAgent(uint32_t id)
+{
+    if (id >= agents.size() || agents[id].mesh == InvalidAgent) {
+        return;
+    }
+    agents[id].mesh = InvalidAgent;
+    freeAgents.push_back(id);
+    agentCount--;
+    revision++;
+}
+
+void CrowdRenderer::writeAgents(Slot& slot)
+{
+    // counting sort by mesh, a mesh's agents are the consecutive instances of its command
+    const uint32_t meshCount = static_cast<uint32_t>(meshes.size());
+    std::vector<uint32_t> firstAgent(meshCount + 1, 0);
+    for (const Agent& agent : agents) {
+        if (agent.mesh != InvalidAgent) {
+            firstAgent[agent.mesh + 1]++;
+        }
+    }
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        firstAgent[m + 1] += firstAgent[m];
+    }
+
+    vk::DrawIndexedIndirectCommand* draws = static_cast<vk::DrawIndexedIndirectCommand*>(slot.draws.memory.mapped);
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        vk::DrawIndexedIndirectCommand& draw = draws[m];
+        draw.indexCount = meshes[m].indexCount;
+        draw.instanceCount = firstAgent[m + 1] - firstAgent[m];
+        draw.firstIndex = meshes[m].firstIndex;
+        draw.vertexOffset = static_cast<int32_t>(meshes[m].firstVertex);
+        draw.firstInstance = firstAgent[m];
+    }
+
+    GpuAgent* gpuAgents = static_cast<GpuAgent*>(slot.agents.memory.mapped);
+    for (const Agent& agent : agents) {
+        if (agent.mesh != InvalidAgent) {
+            gpuAgents[firstAgent[agent.mesh]++] = agent.gpu;
+        }
+    }
+    slot.revision = revision;
+}
+
+void CrowdRenderer::BeginFrame(uint32_t slotIndex, float time)
+{
+    Slot& slot = slots[slotIndex];
+    if (slot.revision != revision) {
+        writeAgents(slot);
+    }
+    static_cast<float*>(slot.frame.memory.mapped)[0] = time;
+}
+
+void CrowdRenderer::Draw(vk::CommandBuffer cmd, uint32_t slotIndex) const
+{
+    const Slot& slot = slots[slotIndex];
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, crowdPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 1, 1, &slot.set, 0, nullptr);
+    vk::DeviceSize offsets[1] = { 0 };
+    cmd.bindVertexBuffers(0, 1, &bindPose.buffer, offsets);
+    cmd.bindIndexBuffer(indices.buffer, 0, vk::IndexType::eUint32);
+
+    // every command is recorded, the ones of meshes added later or without agents draw nothing
+    const uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    if (multiDraw) {
+        cmd.drawIndexedIndirect(slot.draws.buffer, 0, maxMeshes, stride);
+    } else {
+        for (uint32_t m = 0; m < maxMeshes; ++m) {
+            cmd.drawIndexedIndirect(slot.draws.buffer, m * stride, 1, stride);
+        }
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,123 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "DescriptorAllocator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace m3d {
+
+// VK_KHR_maintenance1, newer than the vendored header; drivers without it report fragmentation instead
+static const vk::Result ErrorOutOfPoolMemory = static_cast<vk::Result>(-1000069000);
+// pools stop doubling here
+static const uint32_t MaxSetsPerPool = 4096;
+
+std::vector<vk::DescriptorPoolSize> DescriptorAllocator::DefaultSetSizes()
+{
+    // buffers and a few textures per set, about what a material or a pass binds
+    return {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 4),
+        vk::DescriptorPoolSize(vk::DescriptorType::eSampledImage, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eSampler, 1),
+    };
+}
+
+DescriptorAllocator::DescriptorAllocator(vk::Device& Device, uint32_t frameCount, uint32_t SetsPerPool,
+    const std::vector<vk::DescriptorPoolSize>& SetSizes)
+    : device(Device)
+    , setSizes(SetSizes)
+    , setsPerPool(std::max(1u, SetsPerPool))
+    , frames(std::max(1u, frameCount))
+{
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+    for (Frame& frame : frames) {
+        for (Pool& pool : frame.used) {
+            device.destroyDescriptorPool(pool.pool);
+        }
+        for (Pool& pool : frame.spare) {
+            device.destroyDescriptorPool(pool.pool);
+        }
+    }
+}
+
+void DescriptorAllocator::BeginFrame(uint32_t frameIndex)
+{
+    current = frameIndex % frames.size();
+    Frame& frame = frames[current];
+    for (Pool& pool : frame.used) {
+        device.resetDescriptorPool(pool.pool, vk::DescriptorPoolResetFlags());
+        frame.spare.push_back(pool);
+    }
+    frame.used.clear();
+    // the largest is taken first, a frame that needed several small ones fits in fewer of them next time
+    std::sort(frame.spare.begin(), frame.spare.end(), [](const Pool& a, const Pool& b) { return a.maxSets < b.maxSets; });
+    frame.sets = 0;
+}
+
+DescriptorAllocator::Pool DescriptorAllocator::createPool(uint32_t maxSets)
+{
+    std::vector<vk::DescriptorPoolSize> sizes = setSizes;
+    for (vk::DescriptorPoolSize& size : sizes) {
+        size.descriptorCount *= maxSets;
+    }
+    vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.maxSets = maxSets;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+    poolInfo.pPoolSizes = sizes.data();
+    Pool pool;
+    pool.pool = device.createDescriptorPool(poolInfo);
+    pool.maxSets = maxSets;
+    poolCount++;
+    return pool;
+}
+
+DescriptorAllocator::Pool DescriptorAllocator::nextPool(Frame& frame)
+{
+    if (!frame.spare.empty()) {
+        Pool pool = frame.spare.back();
+        frame.spare.pop_back();
+        return pool;
+    }
+    // twice the last one, a frame needing many sets soon needs few pools
+    const uint32_t maxSets = frame.used.empty() ? setsPerPool : std::min(MaxSetsPerPool, frame.used.back().maxSets * 2);
+    return createPool(maxSets);
+}
+
+vk::DescriptorSet DescriptorAllocator::Allocate(vk::DescriptorSetLayout layout)
+{
+    Frame& frame = frames[current];
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+    vk::DescriptorSet set;
+    // the current pool, then a fresh one; a set that does not fit an empty pool never will
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (frame.used.empty() || attempt == 1) {
+            frame.used.push_back(nextPool(frame));
+        }
+        allocInfo.descriptorPool = frame.used.back().pool;
+        const vk::Result result = device.allocateDescriptorSets(&allocInfo, &set);
+        if (result == vk::Result::eSuccess) {
+            frame.sets++;
+            return set;
+        }
+        if (result != ErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool) {
+            printf("DescriptorAllocator: %s\n", vk::to_string(result).c_str());
+            break;
+        }
+    }
+    printf("DescriptorAllocator: a set does not fit a pool of %u sets, raise the set sizes\n", frame.used.back().maxSets);
+    return vk::DescriptorSet();
+}
+} // End of namespace m3d
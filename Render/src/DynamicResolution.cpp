@@ -0,0 +1,66 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "DynamicResolution.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace m3d {
+
+const float DynamicResolution::Tolerance = 0.03f;
+const float DynamicResolution::MaxStep = 0.125f;
+
+// weight of the newest frame in the average, about the last 10 frames count
+static const float AverageWeight = 0.1f;
+
+DynamicResolution::DynamicResolution(float TargetMs)
+    : targetMs(TargetMs)
+    , minScale(0.5f)
+    , maxScale(1.0f)
+    , scale(1.0f)
+    , average(0.0f)
+    , settle(0)
+{
+}
+
+void DynamicResolution::SetScaleRange(float MinScale, float MaxScale)
+{
+    maxScale = std::min(std::max(MaxScale, 1.0f / Steps), 1.0f);
+    minScale = std::min(std::max(MinScale, 1.0f / Steps), maxScale);
+    scale = std::min(std::max(scale, minScale), maxScale);
+}
+
+bool DynamicResolution::AddFrame(double gpuMs)
+{
+    if (gpuMs <= 0.0 || targetMs <= 0.0f) {
+        return false;
+    }
+    if (settle > 0) {
+        --settle;
+        return false;
+    }
+    average = average == 0.0f ? static_cast<float>(gpuMs) : average + (static_cast<float>(gpuMs) - average) * AverageWeight;
+    const float ratio = average / targetMs;
+    if (std::fabs(ratio - 1.0f) <= Tolerance) {
+        return false;
+    }
+
+    // time follows the pixel count, the square of the scale
+    float next = scale * std::sqrt(1.0f / ratio);
+    next = std::min(std::max(next, scale - MaxStep), scale + MaxStep);
+    // round towards the current scale, a step is only taken once the error is worth a whole one
+    next = next < scale ? std::ceil(next * Steps) / Steps : std::floor(next * Steps) / Steps;
+    next = std::min(std::max(next, minScale), maxScale);
+    if (next == scale) {
+        return false;
+    }
+    average *= (next * next) / (scale * scale);
+    scale = next;
+    settle = SettleFrames;
+    return true;
+}
+}
@@ -0,0 +1,841 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "File.hpp"
+#include "CpuTopology.hpp"
+#include "MemoryTags.hpp"
+#include "ThreadPool.hpp"
+
+#include "../../data/schema/pack_generated.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define M3D_IO_URING 1
+#endif
+#endif
+
+namespace m3d {
+namespace file {
+
+#if defined(__ANDROID__)
+    static AAssetManager* assets = nullptr;
+
+    void setAssetManager(AAssetManager* assetManager)
+    {
+        assets = assetManager;
+    }
+#endif
+
+    // SPackage::version of the packages writePackage writes
+    static const uint32_t PackVersion = 1;
+    static const uint64_t PackAlignment = 4096;
+
+    // last bytes of a package
+    struct PackFooter {
+        char magic[4];
+        uint32_t version;
+        uint64_t tocOffset;
+    };
+
+    struct MountedPackage {
+        std::shared_ptr<const MappedFile> file;
+        std::string root;
+        const schema::SPackage* toc;
+    };
+
+    static std::mutex mountMutex;
+    static std::vector<MountedPackage> mounted;
+
+    static uint64_t pathHash(const std::string& path)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : path) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static std::string normalizePath(const std::string& path)
+    {
+        std::string normalized = path;
+        std::replace(normalized.begin(), normalized.end(), '\\', '/');
+        while (normalized.compare(0, 2, "./") == 0) {
+            normalized.erase(0, 2);
+        }
+        return normalized;
+    }
+
+    /* path relative to root, as the package stores it */
+    static std::string packedPath(const std::string& path, const std::string& root)
+    {
+        std::string relative = normalizePath(path);
+        std::string prefix = normalizePath(root);
+        if (!prefix.empty() && prefix.back() != '/') {
+            prefix += '/';
+        }
+        if (!prefix.empty() && relative.compare(0, prefix.size(), prefix) == 0) {
+            relative.erase(0, prefix.size());
+        }
+        return relative;
+    }
+
+    bool mountPackage(const char* path, const std::string& root)
+    {
+        auto file = MappedFile::openLoose(path);
+        if (!file || file->size() < sizeof(PackFooter)) {
+            return false;
+        }
+        PackFooter footer;
+        memcpy(&footer, file->data() + file->size() - sizeof(PackFooter), sizeof(PackFooter));
+        if (memcmp(footer.magic, schema::SPackageIdentifier(), 4) != 0 || footer.version != PackVersion
+            || footer.tocOffset % PackAlignment != 0 || footer.tocOffset >= file->size() - sizeof(PackFooter)) {
+            printf("File: %s is no package of version %u\n", path, PackVersion);
+            return false;
+        }
+        const uint8_t* toc = file->data() + footer.tocOffset;
+        flatbuffers::Verifier verifier(toc, file->size() - sizeof(PackFooter) - footer.tocOffset);
+        if (!schema::VerifySPackageBuffer(verifier) || !schema::GetSPackage(toc)->entries()) {
+            printf("File: %s has a corrupt table of contents\n", path);
+            return false;
+        }
+
+        MountedPackage package;
+        package.file = file;
+        package.root = root;
+        package.toc = schema::GetSPackage(toc);
+        std::lock_guard<std::mutex> lock(mountMutex);
+        mounted.insert(mounted.begin(), package);
+        return true;
+    }
+
+    void unmountPackages()
+    {
+        std::lock_guard<std::mutex> lock(mountMutex);
+        mounted.clear();
+    }
+
+    bool writePackage(const char* path, const std::vector<std::string>& files, const std::string& root)
+    {
+        std::FILE* fp = std::fopen(path, "wb");
+        if (!fp) {
+            return false;
+        }
+        std::vector<std::pair<schema::SPackEntry, std::string>> entries;
+        std::vector<uint8_t> data;
+        const std::vector<uint8_t> padding(PackAlignment, 0);
+        uint64_t offset = 0;
+        bool written = true;
+        for (const std::string& file : files) {
+            if (!readBinary(file.c_str(), data)) {
+                printf("File: can not read %s into %s\n", file.c_str(), path);
+                written = false;
+                break;
+            }
+            const std::string relative = packedPath(file, root);
+            entries.emplace_back(schema::SPackEntry(pathHash(relative), offset, data.size(), static_cast<uint32_t>(PackCodec::Stored), 0), relative);
+            const size_t pad = static_cast<size_t>((PackAlignment - data.size() % PackAlignment) % PackAlignment);
+            written = std::fwrite(data.data(), 1, data.size(), fp) == data.size() && std::fwrite(padding.data(), 1, pad, fp) == pad;
+            offset += data.size() + pad;
+            if (!written) {
+                break;
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const std::pair<schema::SPackEntry, std::string>& a, const std::pair<schema::SPackEntry, std::string>& b) {
+            return a.first.hash() < b.first.hash();
+        });
+        for (size_t i = 1; written && i < entries.size(); ++i) {
+            if (entries[i].first.hash() == entries[i - 1].first.hash()) {
+                printf("File: %s and %s hash the same, can not package both\n", entries[i - 1].second.c_str(), entries[i].second.c_str());
+                written = false;
+            }
+        }
+
+        if (written) {
+            std::vector<schema::SPackEntry> tocEntries;
+            flatbuffers::FlatBufferBuilder fbb;
+            std::vector<flatbuffers::Offset<flatbuffers::String>> paths;
+            for (const auto& entry : entries) {
+                tocEntries.push_back(entry.first);
+                paths.push_back(fbb.CreateString(entry.second));
+            }
+            auto toc = schema::CreateSPackage(fbb, PackVersion, fbb.CreateVectorOfStructs(tocEntries.data(), tocEntries.size()), fbb.CreateVector(paths));
+            schema::FinishSPackageBuffer(fbb, toc);
+
+            PackFooter footer;
+            memcpy(footer.magic, schema::SPackageIdentifier(), 4);
+            footer.version = PackVersion;
+            footer.tocOffset = offset;
+            written = std::fwrite(fbb.GetBufferPointer(), 1, fbb.GetSize(), fp) == fbb.GetSize()
+                && std::fwrite(&footer, 1, sizeof(footer), fp) == sizeof(footer);
+        }
+        std::fclose(fp);
+        if (!written) {
+            std::remove(path);
+        }
+        return written;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (package || buffer) {
+            return;
+        }
+#if defined(__ANDROID__)
+        if (asset) {
+            AAsset_close(static_cast<AAsset*>(asset));
+            return;
+        }
+#endif
+#ifdef _WIN32
+        if (view) {
+            UnmapViewOfFile(view);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+#else
+        if (view) {
+            munmap(const_cast<uint8_t*>(view), length);
+        }
+#endif
+    }
+
+    std::shared_ptr<const MappedFile> MappedFile::open(const char* path)
+    {
+        M3D_MEMORY_TAG(IO);
+        auto packed = openPacked(path);
+        return packed ? packed : openLoose(path);
+    }
+
+    std::shared_ptr<const MappedFile> MappedFile::openPacked(const char* path)
+    {
+        std::lock_guard<std::mutex> lock(mountMutex);
+        for (const MountedPackage& package : mounted) {
+            const std::string relative = packedPath(path, package.root);
+            const uint64_t hash = pathHash(relative);
+            const auto* entries = package.toc->entries();
+            // first entry whose hash is not below the path's
+            uint32_t lower = 0, upper = entries->size();
+            while (lower < upper) {
+                const uint32_t middle = lower + (upper - lower) / 2;
+                if (entries->Get(middle)->hash() < hash) {
+                    lower = middle + 1;
+                } else {
+                    upper = middle;
+                }
+            }
+            if (lower == entries->size()) {
+                continue;
+            }
+            const schema::SPackEntry* entry = entries->Get(lower);
+            const auto* paths = package.toc->paths();
+            if (entry->hash() != hash || entry->size() == 0 || entry->codec() != static_cast<uint32_t>(PackCodec::Stored)
+                || entry->offset() + entry->size() > package.file->size() || (paths && lower < paths->size() && paths->Get(lower)->str() != relative)) {
+                continue;
+            }
+            std::shared_ptr<MappedFile> file(new MappedFile());
+            file->package = package.file;
+            file->view = package.file->data() + entry->offset();
+            file->length = static_cast<size_t>(entry->size());
+            return file;
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const MappedFile> MappedFile::openLoose(const char* path)
+    {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+        HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return nullptr;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+            CloseHandle(handle);
+            return nullptr;
+        }
+        // the mapping keeps the file open, the handle is not needed past this point
+        file->mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(handle);
+        if (!file->mapping) {
+            return nullptr;
+        }
+        file->view = static_cast<const uint8_t*>(MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!file->view) {
+            return nullptr;
+        }
+        file->length = static_cast<size_t>(size.QuadPart);
+#else
+#if defined(__ANDROID__)
+        if (assets && path[0] != '/') {
+            // uncompressed assets are mapped straight from the APK
+            AAsset* asset = AAssetManager_open(assets, path, AASSET_MODE_BUFFER);
+            if (asset) {
+                file->asset = asset;
+                file->view = static_cast<const uint8_t*>(AAsset_getBuffer(asset));
+                file->length = static_cast<size_t>(AAsset_getLength(asset));
+                if (!file->view || file->length == 0) {
+                    return nullptr;
+                }
+                return file;
+            }
+        }
+#endif
+        int handle = ::open(path, O_RDONLY);
+        if (handle < 0) {
+            return nullptr;
+        }
+        struct stat info;
+        if (fstat(handle, &info) != 0 || info.st_size == 0) {
+            ::close(handle);
+            return nullptr;
+        }
+        void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+        ::close(handle);
+        if (view == MAP_FAILED) {
+            return nullptr;
+        }
+        file->view = static_cast<const uint8_t*>(view);
+        file->length = static_cast<size_t>(info.st_size);
+#endif
+        return file;
+    }
+
+    void MappedFile::prefetch() const
+    {
+#ifndef _WIN32
+        madvise(const_cast<uint8_t*>(view), length, MADV_WILLNEED);
+#endif
+        // one read per page, the sum only keeps the loop from being optimized away
+        const size_t pageSize = 4096;
+        volatile uint8_t sink = 0;
+        for (size_t offset = 0; offset < length; offset += pageSize) {
+            sink += view[offset];
+        }
+        (void)sink;
+    }
+
+    const uint32_t AsyncReader::DefaultQueueDepth;
+    const uint32_t AsyncReader::ChunkSize;
+
+    struct AsyncReader::State {
+        typedef std::chrono::high_resolution_clock Clock;
+
+        struct File {
+            Request id;
+            std::string path;
+            ReadCallback onComplete;
+            Clock::time_point requested;
+            std::shared_ptr<MappedFile> file;
+#ifdef _WIN32
+            HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+            int handle = -1;
+#endif
+            uint32_t chunksLeft = 0;
+            bool failed = false;
+        };
+
+        struct Chunk {
+#ifdef _WIN32
+            // first, the completion port hands back its address
+            OVERLAPPED overlapped;
+#else
+            struct iovec target;
+#endif
+            File* file;
+            uint64_t offset;
+            uint32_t size;
+        };
+
+        explicit State(uint32_t queueDepth);
+        ~State();
+
+        void submitLoop();
+        void completionLoop();
+        // open the file and read its chunks, or complete it at once
+        void start(File* file);
+        bool submit(Chunk* chunk);
+        void completeChunk(Chunk* chunk, bool succeeded);
+        void finish(File* file);
+
+        uint32_t queueDepth;
+        const char* backend = "threads";
+
+        mutable std::mutex mutex;
+        // the submit thread waits for files to start and for free slots
+        std::condition_variable wake;
+        std::condition_variable idle;
+        // by (-priority, request), the first one starts next
+        std::map<std::pair<int64_t, Request>, std::unique_ptr<File>> pending;
+        std::unordered_map<Request, int64_t> pendingPriorities;
+        Request nextRequest = 1;
+        // files started and not called back yet, chunks submitted and not completed
+        uint32_t started = 0;
+        uint32_t inFlight = 0;
+        bool stopping = false;
+        Stats stats;
+        double latencySumMs = 0.0;
+
+        std::thread submitter;
+        std::thread completer;
+#ifdef _WIN32
+        HANDLE port = nullptr;
+#else
+        std::unique_ptr<ThreadPool> threads;
+#endif
+#ifdef M3D_IO_URING
+        bool setupRing(uint32_t entries);
+        void closeRing();
+        // only the submit thread and the destructor fill the submission queue, never at the same time
+        int ring = -1;
+        void* sqRing = MAP_FAILED;
+        void* cqRing = MAP_FAILED;
+        size_t sqRingSize = 0;
+        size_t cqRingSize = 0;
+        struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+        size_t sqesSize = 0;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        struct io_uring_cqe* cqes = nullptr;
+        bool pushSqe(const struct io_uring_sqe& sqe);
+#endif
+    };
+
+#ifdef M3D_IO_URING
+    bool AsyncReader::State::setupRing(uint32_t entries)
+    {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring < 0) {
+            return false;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            closeRing();
+            return false;
+        }
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        sqes = static_cast<struct io_uring_sqe*>(sqeMap);
+        if (cqRing == MAP_FAILED || sqeMap == MAP_FAILED) {
+            closeRing();
+            return false;
+        }
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void AsyncReader::State::closeRing()
+    {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+        sqRing = cqRing = MAP_FAILED;
+        if (ring >= 0) {
+            ::close(ring);
+        }
+        ring = -1;
+    }
+
+    bool AsyncReader::State::pushSqe(const struct io_uring_sqe& sqe)
+    {
+        // the ring has a slot more than queueDepth and the kernel consumes every entry at submission
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & *sqMask;
+        sqes[index] = sqe;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        return syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0) == 1;
+    }
+#endif
+
+    AsyncReader::State::State(uint32_t queueDepth)
+        : queueDepth(std::max(1u, queueDepth))
+    {
+#ifdef _WIN32
+        port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+        backend = "iocp";
+#else
+#ifdef M3D_IO_URING
+        // a slot more for the entry that stops the completion thread
+        if (setupRing(this->queueDepth + 1)) {
+            backend = "io_uring";
+        } else {
+            printf("AsyncReader: io_uring is not available, reading on threads\n");
+        }
+#endif
+        if (ring < 0) {
+            threads.reset(new ThreadPool(std::min(this->queueDepth, std::max(1u, std::thread::hardware_concurrency())), JobSystem::Priority::Background));
+        }
+#endif
+        submitter = std::thread(&State::submitLoop, this);
+#ifdef _WIN32
+        completer = std::thread(&State::completionLoop, this);
+#elif defined(M3D_IO_URING)
+        if (ring >= 0) {
+            completer = std::thread(&State::completionLoop, this);
+        }
+#endif
+    }
+
+    AsyncReader::State::~State()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this]() { return pending.empty() && started == 0; });
+            stopping = true;
+        }
+        wake.notify_all();
+        submitter.join();
+#ifdef _WIN32
+        PostQueuedCompletionStatus(port, 0, 0, nullptr);
+        completer.join();
+        CloseHandle(port);
+#else
+#ifdef M3D_IO_URING
+        if (ring >= 0) {
+            // a nop without a chunk stops the completion thread
+            struct io_uring_sqe sqe;
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_NOP;
+            pushSqe(sqe);
+            completer.join();
+            closeRing();
+        }
+#endif
+        if (threads) {
+            threads->Wait();
+        }
+#endif
+    }
+
+    void AsyncReader::State::submitLoop()
+    {
+        M3D_MEMORY_TAG(IO);
+        cpu::PinCurrentThread(cpu::CoreClass::Little);
+        for (;;) {
+            std::unique_ptr<File> file;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || (!pending.empty() && inFlight < queueDepth); });
+                if (pending.empty()) {
+                    return;
+                }
+                file = std::move(pending.begin()->second);
+                pending.erase(pending.begin());
+                pendingPriorities.erase(file->id);
+                ++started;
+            }
+            start(file.release());
+        }
+    }
+
+    void AsyncReader::State::start(File* file)
+    {
+        auto packed = MappedFile::openPacked(file->path.c_str());
+#if defined(__ANDROID__)
+        // assets of the APK come mapped from it
+        if (!packed && assets && file->path[0] != '/') {
+            packed = MappedFile::open(file->path.c_str());
+        }
+#endif
+        if (packed) {
+            file->file = std::const_pointer_cast<MappedFile>(packed);
+            finish(file);
+            return;
+        }
+
+        uint64_t size = 0;
+#ifdef _WIN32
+        file->handle = CreateFileA(file->path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file->handle != INVALID_HANDLE_VALUE && GetFileSizeEx(file->handle, &fileSize)
+            && CreateIoCompletionPort(file->handle, port, 1, 0) == port) {
+            size = static_cast<uint64_t>(fileSize.QuadPart);
+        }
+#else
+        file->handle = ::open(file->path.c_str(), O_RDONLY);
+        struct stat info;
+        if (file->handle >= 0 && fstat(file->handle, &info) == 0) {
+            size = static_cast<uint64_t>(info.st_size);
+        }
+#endif
+        if (size == 0 || size > SIZE_MAX) {
+            file->failed = true;
+            finish(file);
+            return;
+        }
+        std::shared_ptr<MappedFile> buffer(new MappedFile());
+        buffer->buffer.reset(new (std::nothrow) uint8_t[static_cast<size_t>(size)]);
+        if (!buffer->buffer) {
+            file->failed = true;
+            finish(file);
+            return;
+        }
+        buffer->view = buffer->buffer.get();
+        buffer->length = static_cast<size_t>(size);
+        file->file = buffer;
+
+        // counted before the first chunk goes out, so no completion finishes the file early
+        file->chunksLeft = static_cast<uint32_t>((size + ChunkSize - 1) / ChunkSize);
+        for (uint64_t offset = 0; offset < size; offset += ChunkSize) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return inFlight < queueDepth; });
+                ++inFlight;
+                stats.maxInFlight = std::max(stats.maxInFlight, inFlight);
+            }
+            Chunk* chunk = new Chunk();
+            chunk->file = file;
+            chunk->offset = offset;
+            chunk->size = static_cast<uint32_t>(std::min<uint64_t>(ChunkSize, size - offset));
+            if (!submit(chunk)) {
+                completeChunk(chunk, false);
+            }
+        }
+    }
+
+    bool AsyncReader::State::submit(Chunk* chunk)
+    {
+        uint8_t* target = chunk->file->file->buffer.get() + chunk->offset;
+#ifdef _WIN32
+        std::memset(&chunk->overlapped, 0, sizeof(chunk->overlapped));
+        chunk->overlapped.Offset = static_cast<DWORD>(chunk->offset);
+        chunk->overlapped.OffsetHigh = static_cast<DWORD>(chunk->offset >> 32);
+        // completed right away or not, the completion goes to the port
+        return ReadFile(chunk->file->handle, target, chunk->size, nullptr, &chunk->overlapped) || GetLastError() == ERROR_IO_PENDING;
+#else
+        chunk->target.iov_base = target;
+        chunk->target.iov_len = chunk->size;
+#ifdef M3D_IO_URING
+        if (ring >= 0) {
+            // readv rather than read, which needs Linux 5.6
+            struct io_uring_sqe sqe;
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READV;
+            sqe.fd = chunk->file->handle;
+            sqe.off = chunk->offset;
+            sqe.addr = reinterpret_cast<uint64_t>(&chunk->target);
+            sqe.len = 1;
+            sqe.user_data = reinterpret_cast<uint64_t>(chunk);
+            return pushSqe(sqe);
+        }
+#endif
+        threads->Enqueue([this, chunk]() {
+            completeChunk(chunk, pread(chunk->file->handle, chunk->target.iov_base, chunk->size, static_cast<off_t>(chunk->offset)) == chunk->size);
+        });
+        return true;
+#endif
+    }
+
+    void AsyncReader::State::completionLoop()
+    {
+        M3D_MEMORY_TAG(IO);
+        cpu::PinCurrentThread(cpu::CoreClass::Little);
+#ifdef _WIN32
+        for (;;) {
+            DWORD transferred = 0;
+            ULONG_PTR key = 0;
+            OVERLAPPED* overlapped = nullptr;
+            const BOOL succeeded = GetQueuedCompletionStatus(port, &transferred, &key, &overlapped, INFINITE);
+            if (!overlapped) {
+                // the destructor's packet, or the port is gone
+                return;
+            }
+            Chunk* chunk = reinterpret_cast<Chunk*>(overlapped);
+            completeChunk(chunk, succeeded && transferred == chunk->size);
+        }
+#elif defined(M3D_IO_URING)
+        for (;;) {
+            unsigned head = *cqHead;
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                continue;
+            }
+            const struct io_uring_cqe cqe = cqes[head & *cqMask];
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            if (cqe.user_data == 0) {
+                return;
+            }
+            Chunk* chunk = reinterpret_cast<Chunk*>(cqe.user_data);
+            // regular files only read short at their end, the sizes come from fstat
+            completeChunk(chunk, cqe.res >= 0 && static_cast<uint32_t>(cqe.res) == chunk->size);
+        }
+#endif
+    }
+
+    void AsyncReader::State::completeChunk(Chunk* chunk, bool succeeded)
+    {
+        File* file = chunk->file;
+        delete chunk;
+        bool done = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --inFlight;
+            file->failed = file->failed || !succeeded;
+            done = --file->chunksLeft == 0;
+        }
+        wake.notify_all();
+        if (done) {
+            finish(file);
+        }
+    }
+
+    void AsyncReader::State::finish(File* file)
+    {
+        std::unique_ptr<File> owned(file);
+#ifdef _WIN32
+        if (file->handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(file->handle);
+        }
+#else
+        if (file->handle >= 0) {
+            ::close(file->handle);
+        }
+#endif
+        std::shared_ptr<const MappedFile> result;
+        if (!file->failed) {
+            result = file->file;
+        }
+        file->file.reset();
+        const double latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - file->requested).count();
+        file->onComplete(result);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (result) {
+                ++stats.completed;
+                stats.bytes += result->size();
+                latencySumMs += latencyMs;
+                stats.averageLatencyMs = latencySumMs / stats.completed;
+                stats.maxLatencyMs = std::max(stats.maxLatencyMs, latencyMs);
+            } else {
+                ++stats.failed;
+            }
+            --started;
+        }
+        idle.notify_all();
+    }
+
+    AsyncReader::AsyncReader(uint32_t queueDepth)
+        : state(new State(queueDepth))
+    {
+    }
+
+    AsyncReader::~AsyncReader()
+    {
+    }
+
+    AsyncReader::Request AsyncReader::read(const std::string& path, ReadCallback onComplete, int32_t priority)
+    {
+        std::unique_ptr<State::File> file(new State::File());
+        file->path = path;
+        file->onComplete = std::move(onComplete);
+        file->requested = State::Clock::now();
+        Request request;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            request = file->id = state->nextRequest++;
+            state->pendingPriorities[request] = -static_cast<int64_t>(priority);
+            state->pending[std::make_pair(-static_cast<int64_t>(priority), request)] = std::move(file);
+        }
+        state->wake.notify_all();
+        return request;
+    }
+
+    bool AsyncReader::cancel(Request request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            auto found = state->pendingPriorities.find(request);
+            if (found == state->pendingPriorities.end()) {
+                return false;
+            }
+            state->pending.erase(std::make_pair(found->second, request));
+            state->pendingPriorities.erase(found);
+            ++state->stats.cancelled;
+        }
+        state->idle.notify_all();
+        return true;
+    }
+
+    void AsyncReader::wait()
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->idle.wait(lock, [this]() { return state->pending.empty() && state->started == 0; });
+    }
+
+    AsyncReader::Stats AsyncReader::getStats() const
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        Stats stats = state->stats;
+        stats.pending = static_cast<uint32_t>(state->pending.size());
+        stats.inFlight = state->inFlight;
+        return stats;
+    }
+
+    const char* AsyncReader::getBackendName() const
+    {
+        return state->backend;
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,25 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "FrameArena.hpp"
+
+namespace m3d {
+
+FrameArena::FrameArena(uint32_t frameCount)
+    : current(0)
+{
+    arenas.resize(frameCount ? frameCount : 1);
+    for (auto& arena : arenas) {
+        arena.reset(new Allocator());
+    }
+}
+
+void FrameArena::BeginFrame(uint32_t frameIndex)
+{
+    current = frameIndex % arenas.size();
+    arenas[current]->primary().deallocateAll();
+}
+} // End of namespace m3d
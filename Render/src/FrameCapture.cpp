@@ -0,0 +1,387 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "FrameCapture.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace m3d {
+
+const uint32_t FrameCapture::RingSize;
+const uint32_t FrameCapture::GroupSize;
+// the renderer creates it with a plain new, its SpscRing is padded rather than over-aligned
+static_assert(alignof(FrameCapture) <= alignof(std::max_align_t), "FrameCapture needs an aligned allocation");
+
+// the encoder looks for pictures this often even when a wake up got lost
+static const std::chrono::milliseconds IdlePoll(10);
+
+FrameCapture::Encoder FrameCapture::Y4mWriter(const std::string& path, uint32_t fps)
+{
+    std::shared_ptr<FILE> file(fopen(path.c_str(), "wb"), [](FILE* f) {
+        if (f) {
+            fclose(f);
+        }
+    });
+    if (!file) {
+        printf("FrameCapture: can not write %s\n", path.c_str());
+    }
+    return [file, fps, path](const Picture& picture) {
+        if (!file) {
+            return;
+        }
+        // the header goes with the first picture, which knows the size
+        if (ftell(file.get()) == 0) {
+            fprintf(file.get(), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", picture.width, picture.height, fps);
+        }
+        fputs("FRAME\n", file.get());
+        const uint32_t widths[3] = { picture.width, (picture.width + 1) / 2, (picture.width + 1) / 2 };
+        const uint32_t heights[3] = { picture.height, (picture.height + 1) / 2, (picture.height + 1) / 2 };
+        bool written = true;
+        for (int plane = 0; plane < 3; ++plane) {
+            for (uint32_t y = 0; y < heights[plane]; ++y) {
+                written = fwrite(picture.planes[plane] + y * picture.pitches[plane], 1, widths[plane], file.get()) == widths[plane] && written;
+            }
+        }
+        if (!written) {
+            printf("FrameCapture: can not write picture %llu to %s\n", static_cast<unsigned long long>(picture.number), path.c_str());
+        }
+    };
+}
+
+FrameCapture::FrameCapture(vk::Device& Device, MemoryAllocator& Allocator, uint32_t queueFamilyIndex, uint32_t framesInFlight, vk::Extent2D Extent,
+    vk::Format format, ColorMatrix matrix, Encoder Encoder)
+    : device(Device)
+    , allocator(Allocator)
+    , extent(Extent)
+    , encoder(Encoder)
+    , filled(RingSize)
+    , freeSlots(RingSize)
+{
+    // 8 pixels of luma per block, the chroma rows half of that
+    const uint32_t lumaPitchBytes = (extent.width + 7) / 8 * 8;
+    const uint32_t chromaHeight = (extent.height + 1) / 2;
+    constants.width = extent.width;
+    constants.height = extent.height;
+    constants.lumaPitch = lumaPitchBytes / 4;
+    constants.chromaPitch = lumaPitchBytes / 8;
+    constants.swapRedBlue = format == vk::Format::eB8G8R8A8Unorm || format == vk::Format::eB8G8R8A8Srgb ? 1 : 0;
+    slotBytes = static_cast<vk::DeviceSize>(lumaPitchBytes) * extent.height + static_cast<vk::DeviceSize>(lumaPitchBytes / 2) * chromaHeight * 2;
+
+    // limited range: Y in 16..235, U and V in 16..240 around 128
+    const float kr = matrix == ColorMatrix::Bt709 ? 0.2126f : 0.299f;
+    const float kb = matrix == ColorMatrix::Bt709 ? 0.0722f : 0.114f;
+    const float kg = 1.0f - kr - kb;
+    const float luma = 219.0f / 255.0f;
+    const float chroma = 224.0f / 255.0f;
+    const float rows[3][4] = {
+        { kr * luma, kg * luma, kb * luma, 16.0f / 255.0f },
+        { -kr / (2.0f - 2.0f * kb) * chroma, -kg / (2.0f - 2.0f * kb) * chroma, 0.5f * chroma, 128.0f / 255.0f },
+        { 0.5f * chroma, -kg / (2.0f - 2.0f * kr) * chroma, -kb / (2.0f - 2.0f * kr) * chroma, 128.0f / 255.0f },
+    };
+    memcpy(constants.rows, rows, sizeof(rows));
+
+    // re-recorded every captured frame
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    commandPool = device.createCommandPool(cmdPoolInfo);
+
+    vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+    cmdBufAllocateInfo.commandPool = commandPool;
+    cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    cmdBufAllocateInfo.commandBufferCount = framesInFlight;
+    std::vector<vk::CommandBuffer> commandBuffers = device.allocateCommandBuffers(cmdBufAllocateInfo);
+    frames.resize(framesInFlight);
+    for (uint32_t f = 0; f < framesInFlight; ++f) {
+        frames[f].commandBuffer = commandBuffers[f];
+        char name[32];
+        snprintf(name, sizeof(name), "frame capture %u", f);
+        vkx::debug::marker::setName(device, frames[f].commandBuffer, name);
+    }
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = static_cast<vk::DeviceSize>(extent.width) * extent.height * 4;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eStorageBuffer;
+    pixels = device.createBuffer(bufferInfo);
+    vkx::debug::marker::setName(device, pixels, "frame capture pixels");
+    pixelsMemory = allocator.AllocateBuffer(pixels, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    bufferInfo.size = slotBytes * RingSize;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer;
+    ring = device.createBuffer(bufferInfo);
+    vkx::debug::marker::setName(device, ring, "frame capture ring");
+    // read by the encoder, cached where the device has it
+    ringMemory = allocator.AllocateBuffer(ring, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached,
+        MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+    if (!ringMemory) {
+        ringMemory = allocator.AllocateBuffer(ring, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+    }
+    if (!pixelsMemory || !ringMemory) {
+        printf("FrameCapture: out of memory for %u x %u pictures, capturing nothing\n", extent.width, extent.height);
+    }
+
+    createPipeline();
+
+    // the encoder's side of freeSlots until now, the thread starts after
+    for (uint32_t slot = 0; slot < RingSize; ++slot) {
+        freeSlots.TryPush(slot);
+    }
+    thread = std::thread(&FrameCapture::encode, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_one();
+    thread.join();
+
+    device.destroyPipeline(pipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorSetLayout(setLayout);
+    device.destroyDescriptorPool(descriptorPool);
+    device.destroyBuffer(pixels);
+    allocator.Free(pixelsMemory);
+    device.destroyBuffer(ring);
+    allocator.Free(ringMemory);
+    device.destroyCommandPool(commandPool);
+}
+
+void FrameCapture::createPipeline()
+{
+    // pixels, ring
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, "D:\\workspace\\m3d\\data\\shaders\\camera\\rgb_to_yuv.comp.spv");
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    pipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, pipeline, "rgb to yuv");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, 2);
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    descriptorSet = device.allocateDescriptorSets(allocInfo)[0];
+
+    // the slot's planes are offsets in the push constants, one set covers every slot
+    std::array<vk::DescriptorBufferInfo, 2> bufferInfos = { { vk::DescriptorBufferInfo(pixels, 0, VK_WHOLE_SIZE), vk::DescriptorBufferInfo(ring, 0, VK_WHOLE_SIZE) } };
+    std::array<vk::WriteDescriptorSet, 2> writes;
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+}
+
+bool FrameCapture::Record(uint32_t f, const vk::Image* images, uint32_t count, vk::Extent2D imageExtent, vk::ImageLayout layout)
+{
+    Frame& frame = frames[f];
+    if (count == 0 || !pixelsMemory || !ringMemory) {
+        return false;
+    }
+    if (imageExtent != extent) {
+        // an encoder takes one size per stream
+        if (!sizeReported) {
+            printf("FrameCapture: %u x %u frames do not fit the %u x %u capture, dropping them\n", imageExtent.width, imageExtent.height, extent.width,
+                extent.height);
+            sizeReported = true;
+        }
+        recorded += count;
+        dropped += count;
+        return false;
+    }
+
+    vk::CommandBuffer cmd = frame.commandBuffer;
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint64_t number = recorded++;
+        Slot slot;
+        slot.number = number;
+        // every picture still queued or encoding, the frame is not worth a stall
+        if (!freeSlots.TryPop(slot.index)) {
+            ++dropped;
+            continue;
+        }
+        if (frame.slots.empty()) {
+            vk::CommandBufferBeginInfo beginInfo;
+            beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+            cmd.begin(beginInfo);
+        }
+        frame.slots.push_back(slot);
+
+        // the last conversion, of this frame or an earlier one, read the pixels
+        vk::BufferMemoryBarrier toCopy;
+        toCopy.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+        toCopy.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        toCopy.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toCopy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toCopy.buffer = pixels;
+        toCopy.offset = 0;
+        toCopy.size = VK_WHOLE_SIZE;
+        // whatever wrote the image last: the render pass, the post stack or a blit
+        vk::ImageMemoryBarrier toTransfer;
+        toTransfer.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite;
+        toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+        toTransfer.oldLayout = layout;
+        toTransfer.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+        toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.image = images[i];
+        toTransfer.subresourceRange = vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer,
+            vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, toCopy, toTransfer);
+
+        vk::BufferImageCopy region;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+        region.imageExtent = vk::Extent3D(extent.width, extent.height, 1);
+        cmd.copyImageToBuffer(images[i], vk::ImageLayout::eTransferSrcOptimal, pixels, region);
+
+        vk::BufferMemoryBarrier toConvert = toCopy;
+        toConvert.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        toConvert.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, toConvert, nullptr);
+        if (layout != vk::ImageLayout::eTransferSrcOptimal) {
+            // presented or read back after the submission
+            vk::ImageMemoryBarrier toLayout = toTransfer;
+            toLayout.srcAccessMask = vk::AccessFlagBits::eTransferRead;
+            toLayout.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+            toLayout.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+            toLayout.newLayout = layout;
+            cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, toLayout);
+        }
+
+        const uint32_t slotWords = static_cast<uint32_t>(slotBytes / 4);
+        constants.planeOffsets[0] = slot.index * slotWords;
+        constants.planeOffsets[1] = constants.planeOffsets[0] + constants.lumaPitch * extent.height;
+        constants.planeOffsets[2] = constants.planeOffsets[1] + constants.chromaPitch * ((extent.height + 1) / 2);
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, descriptorSet, nullptr);
+        cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+        const uint32_t blocksX = (extent.width + 7) / 8;
+        const uint32_t blocksY = (extent.height + 1) / 2;
+        cmd.dispatch((blocksX + GroupSize - 1) / GroupSize, (blocksY + GroupSize - 1) / GroupSize, 1);
+    }
+    if (frame.slots.empty()) {
+        return false;
+    }
+
+    // the frame's serial makes the pictures visible to the encoder once this is done
+    vk::BufferMemoryBarrier toHost;
+    toHost.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = ring;
+    toHost.offset = 0;
+    toHost.size = VK_WHOLE_SIZE;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, toHost, nullptr);
+
+    cmd.end();
+    return true;
+}
+
+void FrameCapture::Resolve(uint32_t f)
+{
+    Frame& frame = frames[f];
+    if (frame.slots.empty()) {
+        return;
+    }
+    for (const Slot& slot : frame.slots) {
+        // RingSize cells for RingSize slots, never full
+        filled.TryPush(slot);
+    }
+    frame.slots.clear();
+    // only an encoder that ran dry waits for the mutex
+    if (sleeping.load()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_one();
+    }
+}
+
+void FrameCapture::encode()
+{
+    const uint8_t* base = static_cast<const uint8_t*>(ringMemory.mapped);
+    const uint32_t chromaOffset = constants.lumaPitch * 4 * extent.height;
+    const uint32_t chromaBytes = constants.chromaPitch * 4 * ((extent.height + 1) / 2);
+    Picture picture;
+    picture.pitches[0] = constants.lumaPitch * 4;
+    picture.pitches[1] = constants.chromaPitch * 4;
+    picture.pitches[2] = constants.chromaPitch * 4;
+    picture.width = extent.width;
+    picture.height = extent.height;
+    for (;;) {
+        Slot slot;
+        if (!filled.TryPop(slot)) {
+            if (!running) {
+                // every picture handed over before the destructor is encoded
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            // a Resolve that pushed before sleeping was set did not notify, the poll picks its pictures up
+            sleeping = true;
+            if (running) {
+                wake.wait_for(lock, IdlePoll);
+            }
+            sleeping = false;
+            continue;
+        }
+        const uint8_t* planes = base + slot.index * slotBytes;
+        picture.planes[0] = planes;
+        picture.planes[1] = planes + chromaOffset;
+        picture.planes[2] = planes + chromaOffset + chromaBytes;
+        picture.number = slot.number;
+        if (encoder) {
+            encoder(picture);
+        }
+        ++captured;
+        freeSlots.TryPush(slot.index);
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,294 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#if defined(__ANDROID__)
+#include <android/choreographer.h>
+#if __ANDROID_API__ >= 30
+#include <android/thermal.h>
+#endif
+#endif
+
+namespace m3d {
+
+const std::chrono::milliseconds FramePacer::Cooldown(2000);
+
+// render scale per step, a 1/8 of the native size
+static const float ScaleStep = 0.125f;
+// slowest rate load may push the pacer to, in vsyncs per frame
+static const uint32_t MaxSwapInterval = 4;
+// share of the frame interval a frame may take, the rest is slack for composition and clock drops
+static const float BudgetShare = 0.85f;
+// a step up has to leave this much of the new budget unused
+static const float StepUpShare = 0.75f;
+
+static int64_t toNanoseconds(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+FramePacer::FramePacer(float RefreshRate)
+    : refreshRate(std::max<uint32_t>(1, static_cast<uint32_t>(RefreshRate + 0.5f)))
+    , lastVsync(0)
+    , requestedInterval(1)
+    , swapInterval(1)
+    , minRenderScale(0.5f)
+    , renderScale(1.0f)
+    , powerSave(false)
+    , thermalStatus(ThermalStatus::None)
+    , history(HistoryFrames, 0.0f)
+    , historyNext(0)
+    , historyCount(0)
+    , framesSinceEvaluate(0)
+{
+    vsyncPeriod = 1000000000ll / refreshRate;
+    frameStart = Clock::now();
+    lastChange = frameStart;
+    lastThermalPoll = frameStart;
+#if defined(__ANDROID__)
+    thermalManager = nullptr;
+#if __ANDROID_API__ >= 30
+    thermalManager = AThermal_acquireManager();
+#endif
+#endif
+}
+
+FramePacer::~FramePacer()
+{
+#if defined(__ANDROID__) && __ANDROID_API__ >= 30
+    if (thermalManager) {
+        AThermal_releaseManager(thermalManager);
+    }
+#endif
+}
+
+void FramePacer::SetFrameRateCap(uint32_t fps)
+{
+    // the fastest whole number of vsyncs per frame that stays at or below fps
+    requestedInterval = fps == 0 ? 1 : std::max<uint32_t>(1, (refreshRate + fps - 1) / fps);
+    clamp();
+}
+
+void FramePacer::SetMinRenderScale(float scale)
+{
+    minRenderScale = std::min(std::max(scale, ScaleStep), 1.0f);
+    renderScale = std::max(renderScale, minRenderScale);
+    clamp();
+}
+
+void FramePacer::SetPowerSave(bool enable)
+{
+    powerSave = enable;
+    clamp();
+}
+
+void FramePacer::SetThermalStatus(ThermalStatus status)
+{
+    if (status == thermalStatus) {
+        return;
+    }
+    thermalStatus = status;
+    clamp();
+    printf("FramePacer: thermal status %d, %u fps at %.3f render scale at most\n", static_cast<int>(status), refreshRate / minSwapInterval(), maxRenderScale());
+}
+
+uint32_t FramePacer::minSwapInterval() const
+{
+    uint32_t interval = requestedInterval;
+    if (powerSave || thermalStatus >= ThermalStatus::Moderate) {
+        interval = std::max<uint32_t>(interval, 2);
+    }
+    return interval;
+}
+
+float FramePacer::maxRenderScale() const
+{
+    float scale = 1.0f;
+    switch (thermalStatus) {
+    case ThermalStatus::None:
+    case ThermalStatus::Light:
+        break;
+    case ThermalStatus::Moderate:
+        scale = 1.0f - 1.0f * ScaleStep;
+        break;
+    case ThermalStatus::Severe:
+        scale = 1.0f - 2.0f * ScaleStep;
+        break;
+    default:
+        scale = minRenderScale;
+        break;
+    }
+    return std::max(scale, minRenderScale);
+}
+
+// the limits changed, the current choice may step down but never up
+void FramePacer::clamp()
+{
+    const uint32_t minInterval = minSwapInterval();
+    const float maxScale = maxRenderScale();
+    if (swapInterval < minInterval || renderScale > maxScale) {
+        swapInterval = std::max(swapInterval, minInterval);
+        renderScale = std::min(renderScale, maxScale);
+        lastChange = Clock::now();
+        historyCount = 0;
+        historyNext = 0;
+    }
+}
+
+#if defined(__ANDROID__)
+#if __ANDROID_API__ >= 29
+static void onChoreographerFrame(int64_t frameTimeNanos, void* data)
+{
+    static_cast<FramePacer*>(data)->OnVsync(frameTimeNanos);
+    AChoreographer_postFrameCallback64(AChoreographer_getInstance(), onChoreographerFrame, data);
+}
+#elif __ANDROID_API__ >= 24
+static void onChoreographerFrame(long frameTimeNanos, void* data)
+{
+    static_cast<FramePacer*>(data)->OnVsync(frameTimeNanos);
+    AChoreographer_postFrameCallback(AChoreographer_getInstance(), onChoreographerFrame, data);
+}
+#endif
+
+void FramePacer::StartChoreographer()
+{
+#if __ANDROID_API__ >= 29
+    AChoreographer_postFrameCallback64(AChoreographer_getInstance(), onChoreographerFrame, this);
+#elif __ANDROID_API__ >= 24
+    AChoreographer_postFrameCallback(AChoreographer_getInstance(), onChoreographerFrame, this);
+#else
+    printf("FramePacer: Choreographer needs API 24, pacing without the vsync phase\n");
+#endif
+}
+#endif
+
+// frame times are CLOCK_MONOTONIC, the steady clock on Android and Linux
+void FramePacer::OnVsync(int64_t vsyncTime)
+{
+    if (lastVsync > 0 && vsyncTime > lastVsync) {
+        // callbacks may skip vsyncs while a frame runs long, the interval is a whole number of them
+        const int64_t elapsed = vsyncTime - lastVsync;
+        const int64_t vsyncs = std::max<int64_t>(1, (elapsed + vsyncPeriod / 2) / vsyncPeriod);
+        const int64_t period = elapsed / vsyncs;
+        const int64_t error = period > vsyncPeriod ? period - vsyncPeriod : vsyncPeriod - period;
+        if (error < vsyncPeriod / 5) {
+            vsyncPeriod += (period - vsyncPeriod) / 8;
+        }
+    }
+    lastVsync = vsyncTime;
+}
+
+void FramePacer::WaitForFrame()
+{
+    const Clock::time_point now = Clock::now();
+    // without a vsync phase a FIFO swapchain paces a frame per vsync by itself
+    if (swapInterval == 1 && lastVsync == 0) {
+        frameStart = now;
+        return;
+    }
+
+    int64_t target = toNanoseconds(frameStart) + vsyncPeriod * swapInterval;
+    if (lastVsync > 0) {
+        // start right at a vsync, a quarter period of jitter snaps back to the earlier one
+        const int64_t sinceVsync = target - vsyncPeriod / 4 - lastVsync;
+        const int64_t vsyncs = sinceVsync > 0 ? (sinceVsync + vsyncPeriod - 1) / vsyncPeriod : 0;
+        target = lastVsync + vsyncs * vsyncPeriod;
+    }
+
+    const int64_t wait = target - toNanoseconds(now);
+    // a frame that ran long starts at once, the next one is paced from it
+    if (wait > 0 && wait <= vsyncPeriod * swapInterval) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+    }
+    frameStart = Clock::now();
+}
+
+void FramePacer::EndFrame(double cpuMs, double gpuMs)
+{
+    history[historyNext] = static_cast<float>(std::max(cpuMs, gpuMs));
+    historyNext = (historyNext + 1) % HistoryFrames;
+    historyCount = historyCount < HistoryFrames ? historyCount + 1 : HistoryFrames;
+
+    pollThermalStatus();
+    if (++framesSinceEvaluate >= EvaluateFrames) {
+        framesSinceEvaluate = 0;
+        evaluate();
+    }
+}
+
+void FramePacer::pollThermalStatus()
+{
+#if defined(__ANDROID__) && __ANDROID_API__ >= 30
+    const Clock::time_point now = Clock::now();
+    if (!thermalManager || now - lastThermalPoll < std::chrono::seconds(1)) {
+        return;
+    }
+    lastThermalPoll = now;
+    const AThermalStatus status = AThermal_getCurrentThermalStatus(thermalManager);
+    if (status >= ATHERMAL_STATUS_NONE) {
+        SetThermalStatus(static_cast<ThermalStatus>(std::min<int>(status, static_cast<int>(ThermalStatus::Shutdown))));
+    }
+#endif
+}
+
+void FramePacer::evaluate()
+{
+    const Clock::time_point now = Clock::now();
+    if (historyCount < EvaluateFrames || now - lastChange < Cooldown) {
+        return;
+    }
+
+    // 90th percentile, a single hitch is a load and not what the device sustains
+    // the history restarts at 0 with every change, the first historyCount entries are filled
+    std::vector<float> frames(history.begin(), history.begin() + historyCount);
+    std::vector<float>::iterator p90 = frames.begin() + (frames.size() * 9) / 10;
+    std::nth_element(frames.begin(), p90, frames.end());
+    const float frameMs = *p90;
+
+    const float vsyncMs = vsyncPeriod / 1000000.0f;
+    const float budget = vsyncMs * swapInterval * BudgetShare;
+    bool changed = false;
+
+    if (frameMs > budget) {
+        // resolution goes first, a lower rate is what the user notices
+        if (renderScale > minRenderScale) {
+            renderScale = std::max(minRenderScale, renderScale - ScaleStep);
+            changed = true;
+        } else if (swapInterval < MaxSwapInterval) {
+            ++swapInterval;
+            changed = true;
+        }
+    } else if (swapInterval > minSwapInterval()) {
+        // the frame costs the same at a higher rate, it only has less time
+        if (frameMs < vsyncMs * (swapInterval - 1) * BudgetShare * StepUpShare) {
+            --swapInterval;
+            changed = true;
+        }
+    } else if (renderScale < maxRenderScale()) {
+        // pixel bound in the worst case, the cost grows with the area
+        const float scale = std::min(maxRenderScale(), renderScale + ScaleStep);
+        const float area = (scale * scale) / (renderScale * renderScale);
+        if (frameMs * area < budget * StepUpShare) {
+            renderScale = scale;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        printf("FramePacer: %.3f ms per frame, now %u fps at %.3f render scale\n", frameMs, GetFrameRate(), renderScale);
+        lastChange = now;
+        // the history was measured at the old settings
+        historyCount = 0;
+        historyNext = 0;
+    }
+}
+} // End of namespace m3d
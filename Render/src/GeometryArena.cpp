@@ -0,0 +1,300 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GeometryArena.hpp"
+#include "BufferAddress.hpp"
+#include "CommandBuffer.hpp"
+#include "GpuMeshDecoder.hpp"
+#include "Scene.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <cstring>
+#include <memory>
+
+namespace m3d {
+
+const vk::DeviceSize GeometryArena::IndexSize;
+const vk::DeviceSize GeometryArena::ShortIndexSize;
+
+static_assert(sizeof(PackedVertex) == GeometryArena::VertexSize, "GeometryArena::VertexSize must match PackedVertex");
+// index data follows the vertices of a mesh
+static_assert(GeometryArena::VertexSize % GeometryArena::IndexSize == 0 && GeometryArena::VertexSize % GeometryArena::ShortIndexSize == 0,
+    "vertex data must keep indices aligned");
+
+static vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static vk::DeviceSize indexSize(vk::IndexType indexType)
+{
+    return indexType == vk::IndexType::eUint16 ? GeometryArena::ShortIndexSize : GeometryArena::IndexSize;
+}
+
+// The mesh's indices as its block holds them, narrowed to 16 bit while they are written
+static void writeIndices(const Mesh& mesh, uint8_t* dst)
+{
+    const size_t count = mesh.indexCount();
+    if (mesh.indexType() == vk::IndexType::eUint32) {
+        memcpy(dst, mesh.indexData(), count * GeometryArena::IndexSize);
+    } else if (mesh.shortIndexData()) {
+        memcpy(dst, mesh.shortIndexData(), count * GeometryArena::ShortIndexSize);
+    } else {
+        const uint32_t* indices = mesh.indexData();
+        uint16_t* shortIndices = reinterpret_cast<uint16_t*>(dst);
+        for (size_t i = 0; i < count; ++i) {
+            shortIndices[i] = static_cast<uint16_t>(indices[i]);
+        }
+    }
+}
+
+GeometryArena::GeometryArena(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CmdBuffer, UploadQueue* Upload, vk::DeviceSize BlockSize)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CmdBuffer)
+    , upload(Upload)
+    , blockSize(BlockSize)
+{
+}
+
+GeometryArena::~GeometryArena()
+{
+    Clear();
+}
+
+void GeometryArena::Clear(ResourceTrash* trash)
+{
+    for (auto& block : blocks) {
+        if (block.buffer) {
+            commandBuffer.DestroyBuffer(block.buffer, block.memory, trash);
+        }
+    }
+    blocks.clear();
+}
+
+void GeometryArena::Release(Mesh& mesh, ResourceTrash* trash)
+{
+    if (mesh.geometryBlock == Mesh::InvalidBlock) {
+        return;
+    }
+    Block& block = blocks[mesh.geometryBlock];
+    mesh.geometryBlock = Mesh::InvalidBlock;
+    mesh.resident = false;
+    if (--block.meshes > 0) {
+        return;
+    }
+    commandBuffer.DestroyBuffer(block.buffer, block.memory, trash);
+    block = Block();
+}
+
+uint32_t GeometryArena::createBlock(vk::DeviceSize size, vk::IndexType indexType)
+{
+    Block block = {};
+    block.size = size;
+    block.used = 0;
+    block.indexType = indexType;
+    block.meshes = 0;
+    // storage for the GpuMeshDecoder's writes
+    vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst
+        | vk::BufferUsageFlagBits::eStorageBuffer;
+    if (deviceAddress) {
+        usage |= BufferAddress::Usage;
+    }
+    const std::vector<uint32_t> sharingFamilies = upload ? upload->GetSharingFamilies() : std::vector<uint32_t>();
+    if (commandBuffer.GetAllocator().HasMappableDeviceLocal()) {
+        // written by Upload directly, no staging
+        commandBuffer.CreateBuffer(usage,
+            vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            size, nullptr, block.buffer, block.memory, sharingFamilies, MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Mesh);
+        if (!block.memory) {
+            // the mappable heap is full, stage into the rest of video memory
+            device.destroyBuffer(block.buffer);
+        }
+    }
+    if (!block.memory) {
+        commandBuffer.CreateBuffer(usage, vk::MemoryPropertyFlagBits::eDeviceLocal, size, nullptr, block.buffer, block.memory, sharingFamilies,
+            MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Mesh);
+    }
+    vkx::debug::marker::setName(device, block.buffer, "geometry block");
+    block.address = deviceAddress ? BufferAddress::Get(device, block.buffer) : 0;
+    // the slot of a released block, meshes keep the indices of the others
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        if (!blocks[i].buffer) {
+            blocks[i] = block;
+            return i;
+        }
+    }
+    blocks.push_back(block);
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+uint32_t GeometryArena::allocate(vk::DeviceSize size, vk::DeviceSize alignment, vk::IndexType indexType, vk::DeviceSize* offset)
+{
+    // first fit in the existing blocks of the index type
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        if (!blocks[i].buffer || blocks[i].indexType != indexType) {
+            continue;
+        }
+        vk::DeviceSize start = alignUp(blocks[i].used, alignment);
+        if (start + size <= blocks[i].size) {
+            blocks[i].used = start + size;
+            *offset = start;
+            return i;
+        }
+    }
+
+    // meshes larger than a block get a block of their own
+    uint32_t index = createBlock(size > blockSize ? alignUp(size, alignment) : blockSize, indexType);
+    blocks[index].used = size;
+    *offset = 0;
+    return index;
+}
+
+void GeometryArena::Upload(Scene& scene, std::function<void()> onResident)
+{
+    struct Placement {
+        uint32_t meshID;
+        Mesh* mesh;
+        uint32_t block;
+        vk::DeviceSize offset;
+        vk::DeviceSize vertexBytes;
+        vk::DeviceSize indexBytes;
+    };
+    std::vector<Placement> placements;
+    vk::DeviceSize stagingSize = 0;
+    // meshes the decoder expands in their blocks
+    std::vector<uint32_t> decodedIDs;
+
+    for (uint32_t meshID : scene.meshes) {
+        Mesh& mesh = scene.meshes[meshID];
+        if (mesh.geometryBlock != Mesh::InvalidBlock || mesh.indexCount() == 0) {
+            continue;
+        }
+        // encoded geometry goes to the decoder as it is; otherwise uploaded before Clear, decoded again if
+        // Scene::ReleaseGeometry dropped it since
+        const bool gpuDecode = decoder && decoder->CanDecode(mesh);
+        if (!gpuDecode && !mesh.RestoreGeometry()) {
+            continue;
+        }
+
+        Placement placement;
+        placement.meshID = meshID;
+        placement.mesh = &mesh;
+        placement.vertexBytes = mesh.vertexCount() * VertexSize;
+        placement.indexBytes = mesh.indexCount() * indexSize(mesh.indexType());
+        placement.block = allocate(placement.vertexBytes + placement.indexBytes, VertexSize, mesh.indexType(), &placement.offset);
+
+        mesh.geometryBlock = placement.block;
+        ++blocks[placement.block].meshes;
+        mesh.vertexOffset = static_cast<int32_t>(placement.offset / VertexSize);
+        mesh.firstIndex = static_cast<uint32_t>((placement.offset + placement.vertexBytes) / indexSize(mesh.indexType()));
+
+        if (gpuDecode) {
+            decoder->Decode(mesh, blocks[placement.block].buffer, placement.offset, placement.offset + placement.vertexBytes, mesh.indexType());
+            decodedIDs.push_back(meshID);
+            continue;
+        }
+
+        // host visible blocks are written in place and drawable right away, the GPU only reads other ranges
+        uint8_t* mapped = static_cast<uint8_t*>(blocks[placement.block].memory.mapped);
+        if (mapped) {
+            memcpy(mapped + placement.offset, mesh.vertexData(), placement.vertexBytes);
+            writeIndices(mesh, mapped + placement.offset + placement.vertexBytes);
+            mesh.resident = true;
+            continue;
+        }
+
+        placements.push_back(placement);
+        stagingSize += placement.vertexBytes + placement.indexBytes;
+    }
+
+    if (placements.empty() && decodedIDs.empty()) {
+        if (onResident) {
+            onResident();
+        }
+        return;
+    }
+
+    // onResident once the copies and the decoding both completed
+    Scene* pScene = &scene;
+    std::shared_ptr<uint32_t> pending = std::make_shared<uint32_t>((placements.empty() ? 0 : 1) + (decodedIDs.empty() ? 0 : 1));
+    auto resident = [pScene, pending, onResident](const std::vector<uint32_t>& meshIDs) {
+        for (uint32_t meshID : meshIDs) {
+            if (pScene->meshes.contains(meshID)) {
+                pScene->meshes[meshID].resident = true;
+            }
+        }
+        if (--*pending == 0 && onResident) {
+            onResident();
+        }
+    };
+    if (!decodedIDs.empty()) {
+        decoder->Submit([resident, decodedIDs]() { resident(decodedIDs); });
+    }
+    if (placements.empty()) {
+        return;
+    }
+
+    std::vector<uint32_t> meshIDs;
+    for (auto& placement : placements) {
+        meshIDs.push_back(placement.meshID);
+    }
+
+    if (upload) {
+        // Stream through the staging ring, mark meshes resident once the batch retired
+        for (auto& placement : placements) {
+            Mesh& mesh = *placement.mesh;
+            // vertices and indices are back to back in the block as in the staging ring
+            UploadQueue::Staging staged = upload->Stage(placement.vertexBytes + placement.indexBytes);
+            memcpy(staged.data, mesh.vertexData(), placement.vertexBytes);
+            writeIndices(mesh, staged.data + placement.vertexBytes);
+            upload->CopyToBuffer(staged, blocks[placement.block].buffer, placement.offset);
+        }
+        upload->Submit([resident, meshIDs]() { resident(meshIDs); });
+        return;
+    }
+
+    // One staging buffer for the whole batch
+    vk::Buffer stagingBuffer;
+    MemoryAllocator::Allocation stagingMemory;
+    commandBuffer.CreateBuffer(
+        vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        stagingSize,
+        nullptr,
+        stagingBuffer,
+        stagingMemory,
+        std::vector<uint32_t>(),
+        MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Staging);
+
+    std::vector<std::vector<vk::BufferCopy>> regions(blocks.size());
+    uint8_t* mapped = static_cast<uint8_t*>(stagingMemory.mapped);
+    vk::DeviceSize stagingOffset = 0;
+    for (auto& placement : placements) {
+        memcpy(mapped + stagingOffset, placement.mesh->vertexData(), placement.vertexBytes);
+        writeIndices(*placement.mesh, mapped + stagingOffset + placement.vertexBytes);
+
+        regions[placement.block].push_back(vk::BufferCopy(stagingOffset, placement.offset, placement.vertexBytes + placement.indexBytes));
+        stagingOffset += placement.vertexBytes + placement.indexBytes;
+    }
+
+    uint32_t copyCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& copyCmd = commandBuffer.GetCommandBuffer(copyCmdIndex);
+    for (uint32_t i = 0; i < regions.size(); ++i) {
+        if (!regions[i].empty()) {
+            copyCmd.copyBuffer(stagingBuffer, blocks[i].buffer, regions[i]);
+        }
+    }
+    commandBuffer.Flush(copyCmdIndex);
+
+    commandBuffer.DestroyBuffer(stagingBuffer, stagingMemory);
+
+    resident(meshIDs);
+}
+} // End of namespace m3d
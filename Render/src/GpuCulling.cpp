@@ -0,0 +1,486 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GpuCulling.hpp"
+#include "Bounds.hpp"
+#include "CommandBuffer.hpp"
+#include "File.hpp"
+#include "IndirectDraws.hpp"
+#include "ResourceTrash.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace m3d {
+
+struct ReduceConstants {
+    int32_t srcSize[2];
+    int32_t dstSize[2];
+};
+
+GpuCulling::GpuCulling(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, IndirectDraws& Indirect, bool Occlusion)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , indirect(Indirect)
+    , occlusion(Occlusion)
+    , compact(false)
+    , drawIndexedIndirectCountAMD(nullptr)
+    , depthWidth(0)
+    , depthHeight(0)
+    , pyramidWidth(0)
+    , pyramidHeight(0)
+    , pyramidLevels(0)
+{
+    // compaction needs the GPU to read the draw count, the renderer enables the extension when present
+    if (vkhelper::checkDeviceExtensionPresent(physicalDevice, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+        drawIndexedIndirectCountAMD = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountAMD>(device.getProcAddr("vkCmdDrawIndexedIndirectCountAMD"));
+        compact = drawIndexedIndirectCountAMD != nullptr;
+    }
+
+    createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        sizeof(CullParams), params);
+    mappedParams = static_cast<CullParams*>(device.mapMemory(params.memory, 0, sizeof(CullParams)));
+    *mappedParams = CullParams();
+    mappedParams->compact = compact ? 1 : 0;
+
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        indirect.GetMaxDraws() * sizeof(vk::DrawIndexedIndirectCommand), culledCommands);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+        vk::MemoryPropertyFlagBits::eDeviceLocal, MaxBatches * sizeof(uint32_t), drawCounts);
+    vkx::debug::marker::setName(device, params.buffer, "cull params");
+    vkx::debug::marker::setName(device, culledCommands.buffer, "culled commands");
+    vkx::debug::marker::setName(device, drawCounts.buffer, "culled draw counts");
+
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eNearest;
+    samplerInfo.minFilter = vk::Filter::eNearest;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.maxLod = static_cast<float>(MaxPyramidLevels);
+    sampler = device.createSampler(samplerInfo);
+
+    createPipelines();
+}
+
+GpuCulling::~GpuCulling()
+{
+    destroyPyramid(nullptr);
+
+    device.destroyPipeline(cullPipeline);
+    device.destroyPipeline(reducePipeline);
+    device.destroyPipelineLayout(cullPipelineLayout);
+    device.destroyPipelineLayout(reducePipelineLayout);
+    device.destroyDescriptorSetLayout(cullSetLayout);
+    device.destroyDescriptorSetLayout(reduceSetLayout);
+    device.destroySampler(sampler);
+
+    device.unmapMemory(params.memory);
+    for (Buffer* buffer : { &params, &culledCommands, &drawCounts }) {
+        device.destroyBuffer(buffer->buffer);
+        device.freeMemory(buffer->memory);
+    }
+}
+
+void GpuCulling::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(usage);
+    bufferCreateInfo.setSize(size);
+    buffer.buffer = device.createBuffer(bufferCreateInfo);
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(buffer.buffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, properties);
+    buffer.memory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+}
+
+vk::ShaderModule GpuCulling::loadShader(const char* fileName)
+{
+    vk::ShaderModule module = vkhelper::loadShaderModule(device, fileName);
+    assert(module);
+    return module;
+}
+
+void GpuCulling::createPipelines()
+{
+    // Cull: parameters, cull infos, source commands, culled commands, draw counts, depth pyramid
+    std::array<vk::DescriptorSetLayoutBinding, 6> cullBindings;
+    for (uint32_t i = 0; i < cullBindings.size(); ++i) {
+        cullBindings[i].binding = i;
+        cullBindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        cullBindings[i].descriptorCount = 1;
+        cullBindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    cullBindings[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+    cullBindings[5].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(cullBindings.size());
+    descriptorLayout.pBindings = cullBindings.data();
+    cullSetLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    // Reduce: source level, destination level
+    std::array<vk::DescriptorSetLayoutBinding, 2> reduceBindings;
+    reduceBindings[0].binding = 0;
+    reduceBindings[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    reduceBindings[0].descriptorCount = 1;
+    reduceBindings[0].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    reduceBindings[1].binding = 1;
+    reduceBindings[1].descriptorType = vk::DescriptorType::eStorageImage;
+    reduceBindings[1].descriptorCount = 1;
+    reduceBindings[1].stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    descriptorLayout.bindingCount = static_cast<uint32_t>(reduceBindings.size());
+    descriptorLayout.pBindings = reduceBindings.data();
+    reduceSetLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &cullSetLayout;
+    cullPipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(ReduceConstants));
+    pipelineLayoutInfo.pSetLayouts = &reduceSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    reducePipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+
+    pipelineInfo.stage.module = loadShader("D:\\workspace\\m3d\\data\\shaders\\camera\\cull.comp.spv");
+    pipelineInfo.layout = cullPipelineLayout;
+    cullPipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, cullPipeline, "cull");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+
+    pipelineInfo.stage.module = loadShader("D:\\workspace\\m3d\\data\\shaders\\camera\\depth_pyramid.comp.spv");
+    pipelineInfo.layout = reducePipelineLayout;
+    reducePipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, reducePipeline, "depth pyramid");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+}
+
+void GpuCulling::destroyPyramid(ResourceTrash* trash)
+{
+    if (!pyramid) {
+        return;
+    }
+
+    // the descriptor sets go with their pool, frames in flight may still read all of it
+    vk::Device dev = device;
+    vk::Image image = pyramid;
+    vk::DeviceMemory memory = pyramidMemory;
+    std::vector<vk::ImageView> views(pyramidMipViews);
+    views.push_back(pyramidView);
+    vk::ImageView oldDepthView = depthView;
+    vk::DescriptorPool pool = descriptorPool;
+
+    ResourceTrash::Destroyer destroy = [dev, image, memory, views, oldDepthView, pool]() {
+        dev.destroyDescriptorPool(pool);
+        for (auto& view : views) {
+            dev.destroyImageView(view);
+        }
+        if (oldDepthView) {
+            dev.destroyImageView(oldDepthView);
+        }
+        dev.destroyImage(image);
+        dev.freeMemory(memory);
+    };
+    if (trash) {
+        trash->Trash(destroy);
+    } else {
+        destroy();
+    }
+
+    pyramidMipViews.clear();
+    pyramid = vk::Image();
+    pyramidView = vk::ImageView();
+    depthView = vk::ImageView();
+    descriptorPool = vk::DescriptorPool();
+    cullSet = vk::DescriptorSet();
+    reduceSets.clear();
+}
+
+void GpuCulling::SetDepthSource(CommandBuffer& commandBuffer, vk::Image DepthImage, vk::Format depthFormat, uint32_t width, uint32_t height, ResourceTrash* trash)
+{
+    destroyPyramid(trash);
+    depthImage = DepthImage;
+    depthWidth = width;
+    depthHeight = height;
+
+    bool hasStencil = depthFormat == vk::Format::eD32SfloatS8Uint || depthFormat == vk::Format::eD24UnormS8Uint || depthFormat == vk::Format::eD16UnormS8Uint;
+    depthAspect = hasStencil ? vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil : vk::ImageAspectFlags(vk::ImageAspectFlagBits::eDepth);
+
+    // Hi-Z samples the depth buffer, not every depth format can be sampled
+    vk::FormatProperties formatProps = physicalDevice.getFormatProperties(depthFormat);
+    if (occlusion && !(formatProps.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage)) {
+        printf("GpuCulling: depth format can not be sampled, occlusion culling disabled\n");
+        occlusion = false;
+    }
+
+    if (occlusion) {
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.image = depthImage;
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = depthFormat;
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
+        depthView = device.createImageView(viewInfo);
+    }
+
+    // Level 0 is half the depth buffer, every texel holds the farthest depth it covers
+    pyramidWidth = std::max(1u, width / 2);
+    pyramidHeight = std::max(1u, height / 2);
+    pyramidLevels = 1;
+    while ((std::max(pyramidWidth, pyramidHeight) >> pyramidLevels) > 0 && pyramidLevels < MaxPyramidLevels) {
+        ++pyramidLevels;
+    }
+
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = vk::Format::eR32Sfloat;
+    imageInfo.extent = vk::Extent3D(pyramidWidth, pyramidHeight, 1);
+    imageInfo.mipLevels = pyramidLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    pyramid = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, pyramid, "depth pyramid");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(pyramid);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    pyramidMemory = device.allocateMemory(memAlloc);
+    device.bindImageMemory(pyramid, pyramidMemory, 0);
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = pyramid;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = vk::Format::eR32Sfloat;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, pyramidLevels, 0, 1);
+    pyramidView = device.createImageView(viewInfo);
+    for (uint32_t level = 0; level < pyramidLevels; ++level) {
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1);
+        pyramidMipViews.push_back(device.createImageView(viewInfo));
+    }
+
+    // The pyramid stays in general layout; start at the far plane so nothing
+    // is occluded before the first frame wrote depth
+    uint32_t clearCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& clearCmd = commandBuffer.GetCommandBuffer(clearCmdIndex);
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, pyramidLevels, 0, 1);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eGeneral;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = pyramid;
+    barrier.subresourceRange = range;
+    clearCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    std::array<float, 4> farDepth = { 1.0f, 1.0f, 1.0f, 1.0f };
+    clearCmd.clearColorImage(pyramid, vk::ImageLayout::eGeneral, vk::ClearColorValue(farDepth), range);
+    commandBuffer.Flush(clearCmdIndex);
+
+    mappedParams->pyramidSize[0] = static_cast<float>(pyramidWidth);
+    mappedParams->pyramidSize[1] = static_cast<float>(pyramidHeight);
+    mappedParams->pyramidSize[2] = static_cast<float>(pyramidLevels);
+    mappedParams->occlusion = occlusion ? 1 : 0;
+
+    writeDescriptors();
+}
+
+void GpuCulling::writeDescriptors()
+{
+    // one pool per depth source, it is retired together with the pyramid
+    std::array<vk::DescriptorPoolSize, 4> poolSizes;
+    poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = vk::DescriptorType::eStorageBuffer;
+    poolSizes[1].descriptorCount = 4;
+    poolSizes[2].type = vk::DescriptorType::eCombinedImageSampler;
+    poolSizes[2].descriptorCount = 1 + MaxPyramidLevels;
+    poolSizes[3].type = vk::DescriptorType::eStorageImage;
+    poolSizes[3].descriptorCount = MaxPyramidLevels;
+
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = 1 + MaxPyramidLevels;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &cullSetLayout;
+    cullSet = device.allocateDescriptorSets(allocInfo)[0];
+
+    std::array<vk::DescriptorBufferInfo, 5> bufferInfos = {
+        vk::DescriptorBufferInfo(params.buffer, 0, sizeof(CullParams)),
+        vk::DescriptorBufferInfo(indirect.GetCullInfoBuffer(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(indirect.GetCommandBuffer(), 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(culledCommands.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(drawCounts.buffer, 0, VK_WHOLE_SIZE)
+    };
+    vk::DescriptorImageInfo pyramidInfo(sampler, pyramidView, vk::ImageLayout::eGeneral);
+
+    std::vector<vk::WriteDescriptorSet> writes(6);
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = cullSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        if (i < bufferInfos.size()) {
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+    }
+    writes[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+    writes[5].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    writes[5].pImageInfo = &pyramidInfo;
+    device.updateDescriptorSets(writes, nullptr);
+
+    reduceSets.clear();
+    if (!occlusion) {
+        return;
+    }
+
+    // level 0 reads the depth buffer, every other level the one above it
+    std::vector<vk::DescriptorSetLayout> layouts(pyramidLevels, reduceSetLayout);
+    allocInfo.descriptorSetCount = pyramidLevels;
+    allocInfo.pSetLayouts = layouts.data();
+    reduceSets = device.allocateDescriptorSets(allocInfo);
+
+    std::vector<vk::DescriptorImageInfo> srcInfos(pyramidLevels);
+    std::vector<vk::DescriptorImageInfo> dstInfos(pyramidLevels);
+    writes.resize(2 * pyramidLevels);
+    for (uint32_t level = 0; level < pyramidLevels; ++level) {
+        srcInfos[level] = level == 0
+            ? vk::DescriptorImageInfo(sampler, depthView, vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+            : vk::DescriptorImageInfo(sampler, pyramidMipViews[level - 1], vk::ImageLayout::eGeneral);
+        dstInfos[level] = vk::DescriptorImageInfo(vk::Sampler(), pyramidMipViews[level], vk::ImageLayout::eGeneral);
+
+        vk::WriteDescriptorSet& src = writes[2 * level];
+        src = vk::WriteDescriptorSet();
+        src.dstSet = reduceSets[level];
+        src.dstBinding = 0;
+        src.descriptorCount = 1;
+        src.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+        src.pImageInfo = &srcInfos[level];
+
+        vk::WriteDescriptorSet& dst = writes[2 * level + 1];
+        dst = vk::WriteDescriptorSet();
+        dst.dstSet = reduceSets[level];
+        dst.dstBinding = 1;
+        dst.descriptorCount = 1;
+        dst.descriptorType = vk::DescriptorType::eStorageImage;
+        dst.pImageInfo = &dstInfos[level];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+}
+
+void GpuCulling::Update(const m3d::math::Matrix4x4& viewProjection, const float eye[3])
+{
+    Frustum frustum = Frustum::FromViewProjection(viewProjection);
+    memcpy(mappedParams->planes, frustum.planes, sizeof(frustum.planes));
+    mappedParams->viewProjection = viewProjection;
+    for (int c = 0; c < 3; ++c) {
+        mappedParams->eye[c] = eye[c];
+    }
+    mappedParams->drawCount = indirect.GetDrawCount();
+}
+
+void GpuCulling::RecordCull(vk::CommandBuffer cmd)
+{
+    assert(pyramid && "SetDepthSource has to be called before recording");
+    assert(indirect.GetBatches().size() <= MaxBatches);
+
+    // The previous frame is done drawing from the outputs and building the pyramid
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eIndirectCommandRead;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect,
+        vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+    if (compact) {
+        cmd.fillBuffer(drawCounts.buffer, 0, MaxBatches * sizeof(uint32_t), 0);
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+    }
+
+    uint32_t drawCount = indirect.GetDrawCount();
+    if (drawCount > 0) {
+        cmd.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullPipelineLayout, 0, 1, &cullSet, 0, nullptr);
+        cmd.dispatch((drawCount + GroupSize - 1) / GroupSize, 1, 1);
+    }
+
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect, vk::DependencyFlags(), barrier, nullptr, nullptr);
+}
+
+void GpuCulling::RecordDepthPyramid(vk::CommandBuffer cmd)
+{
+    if (!occlusion) {
+        return;
+    }
+
+    vk::ImageMemoryBarrier depthBarrier;
+    depthBarrier.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    depthBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    depthBarrier.oldLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    depthBarrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    depthBarrier.image = depthImage;
+    depthBarrier.subresourceRange = vk::ImageSubresourceRange(depthAspect, 0, 1, 0, 1);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eLateFragmentTests, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, nullptr, depthBarrier);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, reducePipeline);
+
+    vk::MemoryBarrier levelBarrier;
+    levelBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    levelBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    ReduceConstants constants;
+    constants.srcSize[0] = static_cast<int32_t>(depthWidth);
+    constants.srcSize[1] = static_cast<int32_t>(depthHeight);
+    for (uint32_t level = 0; level < pyramidLevels; ++level) {
+        constants.dstSize[0] = static_cast<int32_t>(std::max(1u, pyramidWidth >> level));
+        constants.dstSize[1] = static_cast<int32_t>(std::max(1u, pyramidHeight >> level));
+
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, reducePipelineLayout, 0, 1, &reduceSets[level], 0, nullptr);
+        cmd.pushConstants(reducePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(ReduceConstants), &constants);
+        cmd.dispatch((constants.dstSize[0] + 7) / 8, (constants.dstSize[1] + 7) / 8, 1);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), levelBarrier, nullptr, nullptr);
+
+        constants.srcSize[0] = constants.dstSize[0];
+        constants.srcSize[1] = constants.dstSize[1];
+    }
+
+    // hand the depth buffer back before the next frame's render pass clears it
+    depthBarrier.srcAccessMask = vk::AccessFlags();
+    depthBarrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    depthBarrier.oldLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    depthBarrier.newLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests,
+        vk::DependencyFlags(), nullptr, nullptr, depthBarrier);
+}
+
+void GpuCulling::DrawIndexedIndirectCount(vk::CommandBuffer cmd, vk::DeviceSize offset, uint32_t batch, uint32_t maxDrawCount, uint32_t stride) const
+{
+    drawIndexedIndirectCountAMD(static_cast<VkCommandBuffer>(cmd), static_cast<VkBuffer>(culledCommands.buffer), offset,
+        static_cast<VkBuffer>(drawCounts.buffer), batch * sizeof(uint32_t), maxDrawCount, stride);
+}
+} // End of namespace m3d
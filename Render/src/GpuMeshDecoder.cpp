@@ -0,0 +1,395 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GpuMeshDecoder.hpp"
+#include "PerfLint.hpp"
+#include "Scene.hpp"
+#include "SubmitTimeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t GpuMeshDecoder::GroupSize;
+
+// ring offsets of jobs and streams, the shader reads both as words
+static const uint64_t RingAlignment = 16;
+static const uint32_t JobWords = 8;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// the streams RestoreGeometry would decode, one buffer for both when the mesh encoded its own
+static void encodedStreams(const Mesh& mesh, const uint8_t** vertexStream, size_t* vertexBytes, const uint8_t** indexStream, size_t* indexBytes)
+{
+    *vertexStream = mesh.mappedEncodedVertices ? mesh.mappedEncodedVertices : mesh.encodedGeometry.data();
+    *indexStream = mesh.mappedEncodedIndices ? mesh.mappedEncodedIndices : mesh.encodedGeometry.data();
+    *vertexBytes = mesh.mappedEncodedVertices ? mesh.mappedEncodedVertexBytes : mesh.encodedGeometry.size();
+    *indexBytes = mesh.mappedEncodedIndices ? mesh.mappedEncodedIndexBytes : mesh.encodedGeometry.size();
+}
+
+GpuMeshDecoder::GpuMeshDecoder(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, SubmitTimeline& Timeline, uint32_t queueFamilyIndex, vk::DeviceSize RingSize)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , timeline(Timeline)
+    , ringSize(RingSize)
+{
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
+    cmdPool = device.createCommandPool(cmdPoolInfo);
+
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+    bufferCreateInfo.setSize(ringSize);
+    ringBuffer = device.createBuffer(bufferCreateInfo);
+    vkx::debug::marker::setName(device, ringBuffer, "mesh decode ring");
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ringBuffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    ringMemory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(ringBuffer, ringMemory, 0);
+
+    // stays mapped for the lifetime of the decoder
+    ringMapped = static_cast<uint8_t*>(device.mapMemory(ringMemory, 0, ringSize));
+
+    createPipeline();
+}
+
+GpuMeshDecoder::~GpuMeshDecoder()
+{
+    submitBatch();
+    WaitIdle();
+
+    for (auto& cmd : freeCmdBuffers) {
+        device.freeCommandBuffers(cmdPool, cmd);
+    }
+    device.destroyCommandPool(cmdPool);
+
+    device.destroyPipeline(pipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorSetLayout(setLayout);
+
+    device.unmapMemory(ringMemory);
+    device.destroyBuffer(ringBuffer);
+    device.freeMemory(ringMemory);
+}
+
+void GpuMeshDecoder::createPipeline()
+{
+    // the ring, the block decoded into
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, "D:\\workspace\\m3d\\data\\shaders\\camera\\mesh_decode.comp.spv");
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    pipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, pipeline, "mesh decode");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+}
+
+bool GpuMeshDecoder::CanDecode(const Mesh& mesh) const
+{
+    if (!mesh.geometryReleased || mesh.vertexChunks.empty() || mesh.indexChunks.empty()) {
+        return false;
+    }
+    const uint8_t* vertexStream;
+    const uint8_t* indexStream;
+    size_t vertexBytes, indexBytes;
+    encodedStreams(mesh, &vertexStream, &vertexBytes, &indexStream, &indexBytes);
+    if (!vertexStream || !indexStream) {
+        return false;
+    }
+    const bool sharedStream = vertexStream == indexStream;
+    const uint64_t size = (mesh.vertexChunks.size() + mesh.indexChunks.size()) * sizeof(Job) + alignUp(vertexBytes, RingAlignment)
+        + (sharedStream ? 0 : alignUp(indexBytes, RingAlignment));
+    if (size > ringSize) {
+        return false;
+    }
+    // chunks the CPU decoder would reject are left to it, it reports them
+    for (const CodecChunk& chunk : mesh.vertexChunks) {
+        if (static_cast<size_t>(chunk.offset) + chunk.size > vertexBytes || static_cast<size_t>(chunk.first) + chunk.count > mesh.releasedVertexCount) {
+            return false;
+        }
+    }
+    const bool shortIndices = mesh.indexType() == vk::IndexType::eUint16;
+    for (const CodecChunk& chunk : mesh.indexChunks) {
+        if (static_cast<size_t>(chunk.offset) + chunk.size > indexBytes || static_cast<size_t>(chunk.first) + chunk.count > mesh.releasedIndexCount
+            || (shortIndices && chunk.first % 2 != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t GpuMeshDecoder::allocate(vk::DeviceSize size)
+{
+    uint64_t start;
+    for (;;) {
+        start = alignUp(ringHead, RingAlignment);
+        // the shader reads a mesh's streams and jobs without wrapping around the end of the ring
+        if (start % ringSize + size > ringSize) {
+            start = alignUp(start, ringSize);
+        }
+        if (start + size <= ringTail + ringSize) {
+            break;
+        }
+
+        // Ring is full, make room by retiring the oldest batch
+        if (inFlight.empty()) {
+            if (!dispatches.empty()) {
+                submitBatch();
+            } else {
+                ringHead = ringTail = alignUp(ringHead, ringSize);
+            }
+            continue;
+        }
+        timeline.Wait(inFlight.front().value);
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+
+    ringHead = start + size;
+    return start % ringSize;
+}
+
+void GpuMeshDecoder::Decode(const Mesh& mesh, vk::Buffer block, vk::DeviceSize vertexOffset, vk::DeviceSize indexOffset, vk::IndexType indexType)
+{
+    const uint8_t* vertexStream;
+    const uint8_t* indexStream;
+    size_t vertexBytes, indexBytes;
+    encodedStreams(mesh, &vertexStream, &vertexBytes, &indexStream, &indexBytes);
+    const bool sharedStream = vertexStream == indexStream;
+
+    // the jobs, then the streams as they are cooked
+    const uint32_t jobCount = static_cast<uint32_t>(mesh.vertexChunks.size() + mesh.indexChunks.size());
+    const uint64_t jobBytes = jobCount * sizeof(Job);
+    const uint64_t vertexStreamBytes = alignUp(vertexBytes, RingAlignment);
+    const uint64_t size = jobBytes + vertexStreamBytes + (sharedStream ? 0 : alignUp(indexBytes, RingAlignment));
+    const uint64_t start = allocate(size);
+    const uint64_t vertexSource = start + jobBytes;
+    const uint64_t indexSource = sharedStream ? vertexSource : vertexSource + vertexStreamBytes;
+    memcpy(ringMapped + vertexSource, vertexStream, vertexBytes);
+    if (!sharedStream) {
+        memcpy(ringMapped + indexSource, indexStream, indexBytes);
+    }
+
+    Job* jobs = reinterpret_cast<Job*>(ringMapped + start);
+    const bool shortIndices = indexType == vk::IndexType::eUint16;
+    const vk::DeviceSize indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+    for (const CodecChunk& chunk : mesh.vertexChunks) {
+        Job job = {};
+        job.source = static_cast<uint32_t>(vertexSource + chunk.offset);
+        job.size = chunk.size;
+        job.count = chunk.count;
+        job.target = static_cast<uint32_t>((vertexOffset + chunk.first * sizeof(PackedVertex)) / sizeof(uint32_t));
+        *jobs++ = job;
+    }
+    for (const CodecChunk& chunk : mesh.indexChunks) {
+        Job job = {};
+        job.source = static_cast<uint32_t>(indexSource + chunk.offset);
+        job.size = chunk.size;
+        job.count = chunk.count;
+        // 16 bit chunks start at even indices, CanDecode
+        job.target = static_cast<uint32_t>((indexOffset + chunk.first * indexSize) / sizeof(uint32_t));
+        job.vertexCount = static_cast<uint32_t>(mesh.vertexCount());
+        job.shortIndices = shortIndices ? 1 : 0;
+        *jobs++ = job;
+    }
+
+    Dispatch dispatch;
+    dispatch.block = block;
+    dispatch.firstJob = static_cast<uint32_t>(start / sizeof(uint32_t));
+    dispatch.vertexJobs = static_cast<uint32_t>(mesh.vertexChunks.size());
+    dispatch.indexJobs = static_cast<uint32_t>(mesh.indexChunks.size());
+    dispatches.push_back(dispatch);
+
+    encodedBytes += size - jobBytes;
+    decodedBytes += mesh.vertexCount() * sizeof(PackedVertex) + mesh.indexCount() * indexSize;
+}
+
+void GpuMeshDecoder::submitBatch()
+{
+    if (dispatches.empty()) {
+        return;
+    }
+
+    Batch batch;
+    if (freeCmdBuffers.empty()) {
+        vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+        cmdBufAllocateInfo.commandPool = cmdPool;
+        cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+        cmdBufAllocateInfo.commandBufferCount = 1;
+        batch.cmd = device.allocateCommandBuffers(cmdBufAllocateInfo)[0];
+    } else {
+        batch.cmd = freeCmdBuffers.back();
+        freeCmdBuffers.pop_back();
+    }
+
+    // a set per block, the ring and the block
+    std::vector<vk::Buffer> blocks;
+    for (const Dispatch& dispatch : dispatches) {
+        if (std::find(blocks.begin(), blocks.end(), dispatch.block) == blocks.end()) {
+            blocks.push_back(dispatch.block);
+        }
+    }
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, static_cast<uint32_t>(2 * blocks.size()));
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    descriptorPoolInfo.maxSets = static_cast<uint32_t>(blocks.size());
+    batch.descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(blocks.size(), setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = batch.descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+    allocInfo.pSetLayouts = layouts.data();
+    const std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    const vk::DescriptorBufferInfo ringInfo(ringBuffer, 0, VK_WHOLE_SIZE);
+    std::vector<vk::DescriptorBufferInfo> blockInfos;
+    for (vk::Buffer block : blocks) {
+        blockInfos.push_back(vk::DescriptorBufferInfo(block, 0, VK_WHOLE_SIZE));
+    }
+    std::vector<vk::WriteDescriptorSet> writes;
+    for (uint32_t i = 0; i < sets.size(); ++i) {
+        for (uint32_t binding = 0; binding < 2; ++binding) {
+            vk::WriteDescriptorSet write;
+            write.dstSet = sets[i];
+            write.dstBinding = binding;
+            write.descriptorCount = 1;
+            write.descriptorType = vk::DescriptorType::eStorageBuffer;
+            write.pBufferInfo = binding == 0 ? &ringInfo : &blockInfos[i];
+            writes.push_back(write);
+        }
+    }
+    device.updateDescriptorSets(writes, nullptr);
+
+    vk::CommandBufferBeginInfo cmdBufInfo;
+    cmdBufInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    batch.cmd.begin(cmdBufInfo);
+    batch.cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    vk::Buffer bound;
+    for (const Dispatch& dispatch : dispatches) {
+        if (dispatch.block != bound) {
+            const size_t set = std::find(blocks.begin(), blocks.end(), dispatch.block) - blocks.begin();
+            batch.cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, sets[set], nullptr);
+            bound = dispatch.block;
+        }
+        // a workgroup per vertex chunk, an invocation per index chunk
+        Constants constants = { dispatch.firstJob, dispatch.vertexJobs, 0 };
+        batch.cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants), &constants);
+        batch.cmd.dispatch(dispatch.vertexJobs, 1, 1);
+        constants = { dispatch.firstJob + dispatch.vertexJobs * JobWords, dispatch.indexJobs, 1 };
+        batch.cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants), &constants);
+        batch.cmd.dispatch((dispatch.indexJobs + GroupSize - 1) / GroupSize, 1, 1);
+    }
+    // draws and culling of submissions after this one on the queue read the decoded geometry
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead | vk::AccessFlagBits::eShaderRead;
+    batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(), barrier, nullptr, nullptr);
+    batch.cmd.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.cmd;
+    // reaches the queue with the frame's submissions, or when something waits for it
+    batch.value = timeline.Defer(submitInfo);
+    batch.ringEnd = ringHead;
+    inFlight.push_back(std::move(batch));
+    dispatches.clear();
+}
+
+void GpuMeshDecoder::retire(Batch& batch)
+{
+    ringTail = batch.ringEnd;
+    device.destroyDescriptorPool(batch.descriptorPool);
+    freeCmdBuffers.push_back(batch.cmd);
+
+    for (auto& callback : batch.callbacks) {
+        callback();
+    }
+}
+
+void GpuMeshDecoder::Submit(Callback onComplete)
+{
+    if (dispatches.empty()) {
+        // nothing to decode, complete together with the newest batch
+        if (onComplete) {
+            if (inFlight.empty()) {
+                onComplete();
+            } else {
+                inFlight.back().callbacks.push_back(onComplete);
+            }
+        }
+        return;
+    }
+
+    submitBatch();
+    if (onComplete) {
+        inFlight.back().callbacks.push_back(onComplete);
+    }
+}
+
+void GpuMeshDecoder::Poll()
+{
+    // batches finish in submission order on a single queue
+    const uint64_t completed = timeline.GetCompleted();
+    while (!inFlight.empty() && inFlight.front().value <= completed) {
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+}
+
+void GpuMeshDecoder::WaitIdle()
+{
+    if (!inFlight.empty()) {
+        perflint::WaitIdle("GpuMeshDecoder::WaitIdle");
+    }
+    while (!inFlight.empty()) {
+        timeline.Wait(inFlight.front().value);
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+}
+} // End of namespace m3d
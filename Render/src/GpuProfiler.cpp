@@ -0,0 +1,231 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GpuProfiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace m3d {
+
+// the query bits of the statistics, results come in the order of the bits
+static const vk::QueryPipelineStatisticFlags StatisticFlags = vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+    | vk::QueryPipelineStatisticFlagBits::eClippingInvocations | vk::QueryPipelineStatisticFlagBits::eClippingPrimitives
+    | vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations | vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations;
+
+GpuProfiler::GpuProfiler(vk::Device& Device, vk::PhysicalDevice& physicalDevice, uint32_t queueFamilyIndex, uint32_t Slots, bool pipelineStatistics)
+    : device(Device)
+    , slots(Slots)
+    , written(Slots, 0)
+    , begun(Slots, 0)
+    , counting(Slots, 0)
+    , counted(Slots, 0)
+{
+    // the renderer enables every feature the device has
+    if (pipelineStatistics && physicalDevice.getFeatures().pipelineStatisticsQuery) {
+        vk::QueryPoolCreateInfo statisticsPoolInfo;
+        statisticsPoolInfo.queryType = vk::QueryType::ePipelineStatistics;
+        statisticsPoolInfo.queryCount = MaxScopes * slots;
+        statisticsPoolInfo.pipelineStatistics = StatisticFlags;
+        statistics = device.createQueryPool(statisticsPoolInfo);
+    } else if (pipelineStatistics) {
+        printf("GpuProfiler: the device has no pipeline statistics queries, the scopes are only timed\n");
+    }
+
+    const uint32_t validBits = physicalDevice.getQueueFamilyProperties()[queueFamilyIndex].timestampValidBits;
+    if (validBits == 0) {
+        printf("GpuProfiler: the queue family has no timestamps, only CPU scopes are timed\n");
+        return;
+    }
+    timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    vk::QueryPoolCreateInfo queryPoolInfo;
+    queryPoolInfo.queryType = vk::QueryType::eTimestamp;
+    queryPoolInfo.queryCount = 2 * MaxScopes * slots;
+    queries = device.createQueryPool(queryPoolInfo);
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    if (queries) {
+        device.destroyQueryPool(queries);
+    }
+    if (statistics) {
+        device.destroyQueryPool(statistics);
+    }
+}
+
+uint32_t GpuProfiler::GetScope(const char* name)
+{
+    for (uint32_t s = 0; s < scopes.size(); ++s) {
+        if (scopes[s].name == name) {
+            return s;
+        }
+    }
+    if (scopes.size() == MaxScopes) {
+        return InvalidScope;
+    }
+    scopes.push_back(Scope());
+    Scope& scope = scopes.back();
+    scope.name = name;
+    memset(scope.cpu, 0, sizeof(scope.cpu));
+    memset(scope.gpu, 0, sizeof(scope.gpu));
+    memset(scope.counts, 0, sizeof(scope.counts));
+    return static_cast<uint32_t>(scopes.size() - 1);
+}
+
+void GpuProfiler::BeginSlot(vk::CommandBuffer cmd, uint32_t slot)
+{
+    written[slot] = 0;
+    begun[slot] = 0;
+    counting[slot] = 0;
+    counted[slot] = 0;
+    if (queries) {
+        cmd.resetQueryPool(queries, 2 * MaxScopes * slot, 2 * MaxScopes);
+    }
+    if (statistics) {
+        cmd.resetQueryPool(statistics, MaxScopes * slot, MaxScopes);
+    }
+}
+
+void GpuProfiler::Begin(vk::CommandBuffer cmd, uint32_t slot, uint32_t scope, bool countPipeline)
+{
+    if (scope == InvalidScope) {
+        return;
+    }
+    if (queries) {
+        cmd.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queries, 2 * (MaxScopes * slot + scope));
+        begun[slot] |= 1u << scope;
+    }
+    // after the timestamp, the counts are of the scope's commands only; one statistics query can be active at a
+    // time, a scope nested in a counted one is only timed
+    if (statistics && countPipeline && !counting[slot]) {
+        cmd.beginQuery(statistics, MaxScopes * slot + scope, vk::QueryControlFlags());
+        counting[slot] |= 1u << scope;
+    }
+}
+
+void GpuProfiler::End(vk::CommandBuffer cmd, uint32_t slot, uint32_t scope)
+{
+    if (scope == InvalidScope) {
+        return;
+    }
+    if (counting[slot] & (1u << scope)) {
+        cmd.endQuery(statistics, MaxScopes * slot + scope);
+        counting[slot] &= ~(1u << scope);
+        counted[slot] |= 1u << scope;
+    }
+    if (!queries || !(begun[slot] & (1u << scope))) {
+        return;
+    }
+    // once every command before it finished
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queries, 2 * (MaxScopes * slot + scope) + 1);
+    written[slot] |= 1u << scope;
+}
+
+void GpuProfiler::Resolve(uint32_t slot)
+{
+    if (!written[slot] && !counted[slot]) {
+        return;
+    }
+    const uint32_t frame = gpuFrame % HistoryFrames;
+    for (uint32_t s = 0; s < scopes.size(); ++s) {
+        scopes[s].gpu[frame] = 0.0f;
+        memset(scopes[s].counts[frame], 0, sizeof(scopes[s].counts[frame]));
+        if (counted[slot] & (1u << s)) {
+            // in the order of the query bits, with the timestamps' fence passed
+            vk::Result result = device.getQueryPoolResults(statistics, MaxScopes * slot + s, 1, sizeof(scopes[s].counts[frame]), scopes[s].counts[frame],
+                sizeof(scopes[s].counts[frame]), vk::QueryResultFlagBits::e64);
+            if (result != vk::Result::eSuccess) {
+                memset(scopes[s].counts[frame], 0, sizeof(scopes[s].counts[frame]));
+            }
+        }
+        if (!(written[slot] & (1u << s))) {
+            continue;
+        }
+        uint64_t timestamps[2];
+        // the fence passed, nothing to wait for
+        vk::Result result = device.getQueryPoolResults(queries, 2 * (MaxScopes * slot + s), 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64);
+        if (result == vk::Result::eSuccess) {
+            scopes[s].gpu[frame] = static_cast<float>(((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0);
+        }
+    }
+    ++gpuFrame;
+}
+
+void GpuProfiler::AddCpuTime(uint32_t scope, double ms)
+{
+    if (scope < scopes.size()) {
+        scopes[scope].cpu[cpuFrame % HistoryFrames] += static_cast<float>(ms);
+    }
+}
+
+void GpuProfiler::EndFrame()
+{
+    ++cpuFrame;
+    const uint32_t frame = cpuFrame % HistoryFrames;
+    for (auto& scope : scopes) {
+        scope.cpu[frame] = 0.0f;
+    }
+}
+
+void GpuProfiler::summarize(const float* history, float& average, float& maximum)
+{
+    float sum = 0.0f;
+    maximum = 0.0f;
+    for (uint32_t f = 0; f < HistoryFrames; ++f) {
+        sum += history[f];
+        maximum = std::max(maximum, history[f]);
+    }
+    average = sum / HistoryFrames;
+}
+
+void GpuProfiler::Report(double cpuMs, double gpuMs) const
+{
+    printf("  %-16s %9s %9s %9s %9s\n", "scope", "cpu avg", "cpu max", "gpu avg", "gpu max");
+    for (auto& scope : scopes) {
+        float cpuAverage, cpuMaximum, gpuAverage, gpuMaximum;
+        summarize(scope.cpu, cpuAverage, cpuMaximum);
+        summarize(scope.gpu, gpuAverage, gpuMaximum);
+        printf("  %-16s %9.3f %9.3f %9.3f %9.3f\n", scope.name.c_str(), cpuAverage, cpuMaximum, gpuAverage, gpuMaximum);
+    }
+    if (queries && gpuMs > 0.0) {
+        printf("  %s bound: cpu %.3f ms, gpu %.3f ms\n", gpuMs > cpuMs ? "GPU" : "CPU", cpuMs, gpuMs);
+    }
+    if (!statistics) {
+        return;
+    }
+    // per frame, culling and LODs show up as fewer vertices, overdraw and early depth as fewer fragments
+    printf("  %-16s %12s %12s %12s %12s %12s\n", "scope", "vertices", "clip in", "clip out", "fragments", "compute");
+    for (uint32_t s = 0; s < scopes.size(); ++s) {
+        double averages[StatisticCount];
+        double total = 0.0;
+        for (uint32_t i = 0; i < StatisticCount; ++i) {
+            averages[i] = GetStatistic(s, static_cast<Statistic>(i));
+            total += averages[i];
+        }
+        if (total > 0.0) {
+            printf("  %-16s %12.0f %12.0f %12.0f %12.0f %12.0f\n", scopes[s].name.c_str(), averages[VertexInvocations], averages[ClippingInvocations],
+                averages[ClippingPrimitives], averages[FragmentInvocations], averages[ComputeInvocations]);
+        }
+    }
+}
+
+double GpuProfiler::GetStatistic(uint32_t scope, Statistic statistic) const
+{
+    if (scope >= scopes.size()) {
+        return 0.0;
+    }
+    uint64_t sum = 0;
+    for (uint32_t f = 0; f < HistoryFrames; ++f) {
+        sum += scopes[scope].counts[f][statistic];
+    }
+    return static_cast<double>(sum) / HistoryFrames;
+}
+} // End of namespace m3d
@@ -0,0 +1,442 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GpuSkinning.hpp"
+#include "CommandBuffer.hpp"
+#include "Scene.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+namespace m3d {
+
+static_assert(sizeof(animation::SkinnedVertex) == 48, "skinning.comp reads 12 words per bind pose vertex");
+static_assert(sizeof(PackedVertex) == 20, "skinning.comp writes 5 words per skinned vertex");
+
+GpuSkinning::GpuSkinning(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, uint32_t slotCount,
+    uint32_t MaxBindPoseVertices, uint32_t MaxSkinnedVertices, uint32_t MaxJoints, uint32_t MaxInstances, uint32_t MaxMorphEntries,
+    uint32_t MaxMorphWeights, uint32_t GraphicsQueueFamily, uint32_t ComputeQueueFamily)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , maxBindPoseVertices(MaxBindPoseVertices)
+    , maxSkinnedVertices(MaxSkinnedVertices)
+    , maxJoints(MaxJoints)
+    , maxInstances(MaxInstances)
+    , maxMorphEntries(MaxMorphEntries)
+    , maxMorphWeights(MaxMorphWeights)
+    // every instance may leave one partial group
+    , maxGroups(MaxSkinnedVertices / GroupSize + MaxInstances)
+    , graphicsQueueFamily(GraphicsQueueFamily)
+    , computeQueueFamily(ComputeQueueFamily)
+    , bindPoseVertexCount(0)
+    , bindPoseIndexCount(0)
+    , morphEntryCount(0)
+    , currentSlot(0)
+{
+    vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+    multiDraw = features.multiDrawIndirect == VK_TRUE;
+    const bool async = computeQueueFamily != VK_QUEUE_FAMILY_IGNORED && graphicsQueueFamily != VK_QUEUE_FAMILY_IGNORED
+        && computeQueueFamily != graphicsQueueFamily;
+
+    // written once by the graphics queue's uploads, then only read by the compute queue; shared instead of transferred
+    std::vector<uint32_t> bindPoseFamilies;
+    if (async) {
+        bindPoseFamilies = { graphicsQueueFamily, computeQueueFamily };
+    }
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxBindPoseVertices * sizeof(animation::SkinnedVertex), bindPose, bindPoseFamilies);
+    // room for three indices per bind pose vertex
+    createBuffer(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        3 * maxBindPoseVertices * sizeof(uint32_t), indices);
+    // storage buffers can't be empty, room for one entry and weight when morphing is off
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxBindPoseVertices * 2 * sizeof(uint32_t), morphRanges, bindPoseFamilies);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        std::max(maxMorphEntries, 1u) * sizeof(MorphEntry), morphEntries, bindPoseFamilies);
+    vkx::debug::marker::setName(device, bindPose.buffer, "skinning bind pose");
+    vkx::debug::marker::setName(device, indices.buffer, "skinning indices");
+    vkx::debug::marker::setName(device, morphRanges.buffer, "morph ranges");
+    vkx::debug::marker::setName(device, morphEntries.buffer, "morph entries");
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    slots.resize(slotCount);
+    for (Slot& slot : slots) {
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxJoints * sizeof(m3d::math::Matrix4x3), slot.palettes);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, std::max(maxMorphWeights, 1u) * sizeof(float), slot.weights);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxInstances * sizeof(Job), slot.jobs);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxGroups * sizeof(uint32_t), slot.groups);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, sizeof(vk::DispatchIndirectCommand), slot.dispatch);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, maxInstances * sizeof(vk::DrawIndexedIndirectCommand), slot.draws);
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal,
+            maxSkinnedVertices * sizeof(PackedVertex), slot.output);
+        vkx::debug::marker::setName(device, slot.palettes.buffer, "skinning palettes");
+        vkx::debug::marker::setName(device, slot.weights.buffer, "morph weights");
+        vkx::debug::marker::setName(device, slot.jobs.buffer, "skinning jobs");
+        vkx::debug::marker::setName(device, slot.groups.buffer, "skinning groups");
+        vkx::debug::marker::setName(device, slot.dispatch.buffer, "skinning dispatch");
+        vkx::debug::marker::setName(device, slot.draws.buffer, "skinned draws");
+        vkx::debug::marker::setName(device, slot.output.buffer, "skinned vertices");
+        memset(slot.draws.memory.mapped, 0, maxInstances * sizeof(vk::DrawIndexedIndirectCommand));
+        slot.instanceCount = 0;
+        BeginFrame(static_cast<uint32_t>(&slot - slots.data()));
+    }
+    currentSlot = 0;
+
+    createPipeline();
+    writeDescriptors();
+    if (async) {
+        recordComputeCommandBuffers();
+    }
+}
+
+GpuSkinning::~GpuSkinning()
+{
+    device.destroyCommandPool(computePool);
+    device.destroyPipeline(pipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorPool(descriptorPool);
+    device.destroyDescriptorSetLayout(setLayout);
+
+    for (Slot& slot : slots) {
+        for (Buffer* buffer : { &slot.palettes, &slot.weights, &slot.jobs, &slot.groups, &slot.dispatch, &slot.draws, &slot.output }) {
+            destroyBuffer(*buffer);
+        }
+    }
+    destroyBuffer(bindPose);
+    destroyBuffer(indices);
+    destroyBuffer(morphRanges);
+    destroyBuffer(morphEntries);
+}
+
+void GpuSkinning::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer,
+    const std::vector<uint32_t>& sharedQueueFamilies)
+{
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory, sharedQueueFamilies);
+    assert(buffer.memory && "out of device memory for skinning");
+}
+
+void GpuSkinning::destroyBuffer(Buffer& buffer)
+{
+    commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    buffer = Buffer();
+}
+
+// Meshes are added at load time, a blocking copy is fine there
+void GpuSkinning::upload(const void* data, vk::DeviceSize size, vk::Buffer target, vk::DeviceSize offset)
+{
+    Buffer staging;
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        size, const_cast<void*>(data), staging.buffer, staging.memory, std::vector<uint32_t>(), MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Staging);
+
+    uint32_t copyCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& copyCmd = commandBuffer.GetCommandBuffer(copyCmdIndex);
+    copyCmd.copyBuffer(staging.buffer, target, vk::BufferCopy(0, offset, size));
+    commandBuffer.Flush(copyCmdIndex);
+
+    destroyBuffer(staging);
+}
+
+bool GpuSkinning::AddMesh(const animation::SkinnedVertex* vertices, uint32_t vertexCount, const uint32_t* meshIndices, uint32_t indexCount, SkinnedMesh* mesh,
+    const animation::MorphDelta* morphDeltas, const uint32_t* morphDeltaCounts, uint32_t morphTargetCount)
+{
+    static_assert(sizeof(MorphEntry) == 28, "skinning.comp reads 7 words per morph entry");
+    uint32_t deltaCount = 0;
+    for (uint32_t t = 0; t < morphTargetCount; ++t) {
+        deltaCount += morphDeltaCounts[t];
+    }
+    if (bindPoseVertexCount + vertexCount > maxBindPoseVertices || bindPoseIndexCount + indexCount > 3 * maxBindPoseVertices || vertexCount == 0
+        || morphEntryCount + deltaCount > maxMorphEntries) {
+        printf("GpuSkinning: no room for a mesh of %u vertices and %u morph deltas\n", vertexCount, deltaCount);
+        return false;
+    }
+    for (uint32_t d = 0; d < deltaCount; ++d) {
+        if (morphDeltas[d].vertex >= vertexCount) {
+            printf("GpuSkinning: morph delta of vertex %u past the mesh's %u\n", morphDeltas[d].vertex, vertexCount);
+            return false;
+        }
+    }
+    mesh->firstVertex = bindPoseVertexCount;
+    mesh->vertexCount = vertexCount;
+    mesh->firstIndex = bindPoseIndexCount;
+    mesh->indexCount = indexCount;
+    mesh->morphTargetCount = deltaCount > 0 ? morphTargetCount : 0;
+
+    upload(vertices, vertexCount * sizeof(animation::SkinnedVertex), bindPose.buffer, bindPoseVertexCount * sizeof(animation::SkinnedVertex));
+    if (indexCount > 0) {
+        upload(meshIndices, indexCount * sizeof(uint32_t), indices.buffer, bindPoseIndexCount * sizeof(uint32_t));
+    }
+    if (deltaCount > 0) {
+        // target major to vertex major, a skinning thread walks only the entries of its vertex
+        std::vector<uint32_t> ranges(vertexCount * 2, 0);
+        for (uint32_t d = 0; d < deltaCount; ++d) {
+            ranges[morphDeltas[d].vertex * 2 + 1]++;
+        }
+        uint32_t first = morphEntryCount;
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            ranges[v * 2] = first;
+            first += ranges[v * 2 + 1];
+        }
+        std::vector<MorphEntry> entries(deltaCount);
+        std::vector<uint32_t> fill(vertexCount);
+        const animation::MorphDelta* delta = morphDeltas;
+        for (uint32_t t = 0; t < morphTargetCount; ++t) {
+            for (uint32_t d = 0; d < morphDeltaCounts[t]; ++d, ++delta) {
+                const uint32_t v = delta->vertex;
+                MorphEntry& entry = entries[ranges[v * 2] - morphEntryCount + fill[v]++];
+                entry.target = t;
+                memcpy(entry.position, delta->position, sizeof(entry.position));
+                memcpy(entry.normal, delta->normal, sizeof(entry.normal));
+            }
+        }
+        upload(ranges.data(), ranges.size() * sizeof(uint32_t), morphRanges.buffer, bindPoseVertexCount * 2 * sizeof(uint32_t));
+        upload(entries.data(), entries.size() * sizeof(MorphEntry), morphEntries.buffer, morphEntryCount * sizeof(MorphEntry));
+        morphEntryCount += deltaCount;
+    }
+    bindPoseVertexCount += vertexCount;
+    bindPoseIndexCount += indexCount;
+    return true;
+}
+
+void GpuSkinning::createPipeline()
+{
+    // bind pose vertices, palettes, jobs, group table, skinned output, morph ranges, morph entries, morph weights
+    std::array<vk::DescriptorSetLayoutBinding, 8> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, "D:\\workspace\\m3d\\data\\shaders\\camera\\skinning.comp.spv");
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    pipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, pipeline, "skinning");
+    device.destroyShaderModule(pipelineInfo.stage.module);
+}
+
+void GpuSkinning::writeDescriptors()
+{
+    const uint32_t slotCount = static_cast<uint32_t>(slots.size());
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer, 8 * slotCount);
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    descriptorPoolInfo.maxSets = slotCount;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(slotCount, setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = slotCount;
+    allocInfo.pSetLayouts = layouts.data();
+    std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        Slot& slot = slots[s];
+        slot.set = sets[s];
+
+        std::array<vk::DescriptorBufferInfo, 8> bufferInfos = {
+            vk::DescriptorBufferInfo(bindPose.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.palettes.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.jobs.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.groups.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.output.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(morphRanges.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(morphEntries.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.weights.buffer, 0, VK_WHOLE_SIZE)
+        };
+        std::vector<vk::WriteDescriptorSet> writes(bufferInfos.size());
+        for (uint32_t i = 0; i < writes.size(); ++i) {
+            writes[i].dstSet = slot.set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+void GpuSkinning::BeginFrame(uint32_t slotIndex)
+{
+    currentSlot = slotIndex;
+    Slot& slot = slots[slotIndex];
+    // only the commands of last time's instances can be non-zero
+    memset(slot.draws.memory.mapped, 0, slot.instanceCount * sizeof(vk::DrawIndexedIndirectCommand));
+    slot.instanceCount = 0;
+    slot.vertexCount = 0;
+    slot.jointCount = 0;
+    slot.groupCount = 0;
+    slot.weightCount = 0;
+
+    vk::DispatchIndirectCommand* dispatch = static_cast<vk::DispatchIndirectCommand*>(slot.dispatch.memory.mapped);
+    dispatch->x = 0;
+    dispatch->y = 1;
+    dispatch->z = 1;
+}
+
+uint32_t GpuSkinning::AddInstance(const SkinnedMesh& mesh, const m3d::math::Matrix4x3* palette, uint32_t jointCount, const float* morphWeights)
+{
+    Slot& slot = slots[currentSlot];
+    const uint32_t groupCount = (mesh.vertexCount + GroupSize - 1) / GroupSize;
+    // a face at rest skins like any other mesh
+    bool morphed = false;
+    for (uint32_t t = 0; morphWeights && t < mesh.morphTargetCount && !morphed; ++t) {
+        morphed = morphWeights[t] != 0.0f;
+    }
+    const uint32_t weightCount = morphed ? mesh.morphTargetCount : 0;
+    if (slot.instanceCount == maxInstances || slot.vertexCount + mesh.vertexCount > maxSkinnedVertices
+        || slot.jointCount + jointCount > maxJoints || slot.groupCount + groupCount > maxGroups || slot.weightCount + weightCount > maxMorphWeights) {
+        return InvalidOffset;
+    }
+    if (morphed) {
+        memcpy(static_cast<float*>(slot.weights.memory.mapped) + slot.weightCount, morphWeights, weightCount * sizeof(float));
+    }
+
+    memcpy(static_cast<m3d::math::Matrix4x3*>(slot.palettes.memory.mapped) + slot.jointCount, palette, jointCount * sizeof(m3d::math::Matrix4x3));
+
+    Job& job = static_cast<Job*>(slot.jobs.memory.mapped)[slot.instanceCount];
+    job.firstVertex = mesh.firstVertex;
+    job.vertexCount = mesh.vertexCount;
+    job.firstJoint = slot.jointCount;
+    job.outputVertex = slot.vertexCount;
+    job.firstGroup = slot.groupCount;
+    job.firstWeight = morphed ? slot.weightCount : InvalidOffset;
+
+    uint32_t* groups = static_cast<uint32_t*>(slot.groups.memory.mapped);
+    for (uint32_t g = 0; g < groupCount; ++g) {
+        groups[slot.groupCount + g] = slot.instanceCount;
+    }
+
+    // indices are relative to the mesh, vertexOffset moves them onto the skinned copy
+    vk::DrawIndexedIndirectCommand& draw = static_cast<vk::DrawIndexedIndirectCommand*>(slot.draws.memory.mapped)[slot.instanceCount];
+    draw.indexCount = mesh.indexCount;
+    draw.instanceCount = 1;
+    draw.firstIndex = mesh.firstIndex;
+    draw.vertexOffset = static_cast<int32_t>(slot.vertexCount);
+    draw.firstInstance = 0;
+
+    const uint32_t vertexOffset = slot.vertexCount;
+    slot.instanceCount++;
+    slot.vertexCount += mesh.vertexCount;
+    slot.jointCount += jointCount;
+    slot.groupCount += groupCount;
+    slot.weightCount += weightCount;
+    static_cast<vk::DispatchIndirectCommand*>(slot.dispatch.memory.mapped)->x = slot.groupCount;
+    return vertexOffset;
+}
+
+void GpuSkinning::RecordSkinning(vk::CommandBuffer cmd, uint32_t slotIndex)
+{
+    assert(!IsAsync() && "the compute queue skins, RecordAcquire takes the output");
+
+    // the previous frame of this slot is done drawing from the output
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+    recordDispatch(cmd, slotIndex);
+
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(), barrier, nullptr, nullptr);
+}
+
+void GpuSkinning::recordDispatch(vk::CommandBuffer cmd, uint32_t slotIndex)
+{
+    const Slot& slot = slots[slotIndex];
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &slot.set, 0, nullptr);
+    cmd.dispatchIndirect(slot.dispatch.buffer, 0);
+}
+
+// Recorded once, the dispatch arguments are read indirectly. A slot is refilled only after the frame that drew
+// from it completed, which waited on its compute submission, so neither queue still uses the buffers
+void GpuSkinning::recordComputeCommandBuffers()
+{
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = computeQueueFamily;
+    computePool = device.createCommandPool(poolInfo);
+
+    vk::CommandBufferAllocateInfo allocateInfo;
+    allocateInfo.commandPool = computePool;
+    allocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocateInfo.commandBufferCount = static_cast<uint32_t>(slots.size());
+    std::vector<vk::CommandBuffer> buffers = device.allocateCommandBuffers(allocateInfo);
+
+    for (uint32_t i = 0; i < slots.size(); ++i) {
+        Slot& slot = slots[i];
+        slot.compute = buffers[i];
+        vkx::debug::marker::setName(device, slot.compute, "async skinning");
+
+        // the output's previous contents are not needed, it is written without taking it back from graphics
+        slot.compute.begin(vk::CommandBufferBeginInfo());
+        recordDispatch(slot.compute, i);
+        vk::BufferMemoryBarrier release;
+        release.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+        release.srcQueueFamilyIndex = computeQueueFamily;
+        release.dstQueueFamilyIndex = graphicsQueueFamily;
+        release.buffer = slot.output.buffer;
+        release.size = VK_WHOLE_SIZE;
+        slot.compute.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+            nullptr, release, nullptr);
+        slot.compute.end();
+    }
+}
+
+void GpuSkinning::RecordAcquire(vk::CommandBuffer cmd, uint32_t slotIndex) const
+{
+    assert(IsAsync());
+    // the other half of the release at the end of the compute command buffer, the semaphore wait made it visible
+    vk::BufferMemoryBarrier acquire;
+    acquire.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+    acquire.srcQueueFamilyIndex = computeQueueFamily;
+    acquire.dstQueueFamilyIndex = graphicsQueueFamily;
+    acquire.buffer = slots[slotIndex].output.buffer;
+    acquire.size = VK_WHOLE_SIZE;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(), nullptr, acquire, nullptr);
+}
+
+void GpuSkinning::Draw(vk::CommandBuffer cmd, uint32_t slotIndex) const
+{
+    const Slot& slot = slots[slotIndex];
+    const uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    vk::DeviceSize offsets[1] = { 0 };
+    cmd.bindVertexBuffers(0, 1, &slot.output.buffer, offsets);
+    cmd.bindIndexBuffer(indices.buffer, 0, vk::IndexType::eUint32);
+
+    // every command is recorded, the ones past this frame's instances draw nothing
+    if (multiDraw) {
+        cmd.drawIndexedIndirect(slot.draws.buffer, 0, maxInstances, stride);
+    } else {
+        for (uint32_t i = 0; i < maxInstances; ++i) {
+            cmd.drawIndexedIndirect(slot.draws.buffer, i * stride, 1, stride);
+        }
+    }
+}
+} // End of namespace m3d
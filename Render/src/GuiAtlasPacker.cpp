@@ -0,0 +1,203 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GuiAtlasPacker.hpp"
+#include "../../data/schema/guiatlas_generated.h"
+#include "File.hpp"
+#include "TextureCooker.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+namespace m3d {
+
+static const uint32_t GuiAtlasTableVersion = 1;
+// repeated edge texels around every image
+static const uint32_t Border = 1;
+
+namespace {
+    struct Placement {
+        uint32_t atlas;
+        uint32_t x;
+        uint32_t y;
+    };
+
+    struct Shelves {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t height = 0;
+    };
+
+    std::string textureName(const std::string& path, const std::string& root)
+    {
+        std::string name = path;
+        std::string prefix = root;
+        std::replace(name.begin(), name.end(), '\\', '/');
+        std::replace(prefix.begin(), prefix.end(), '\\', '/');
+        while (name.compare(0, 2, "./") == 0) {
+            name.erase(0, 2);
+        }
+        if (!prefix.empty() && prefix.back() != '/') {
+            prefix += '/';
+        }
+        if (!prefix.empty() && name.compare(0, prefix.size(), prefix) == 0) {
+            name.erase(0, prefix.size());
+        }
+        return name;
+    }
+
+    // on the current shelf of the atlas or a new one below it
+    bool place(Shelves& shelves, uint32_t width, uint32_t height, uint32_t atlasSize, uint32_t* x, uint32_t* y)
+    {
+        if (shelves.x + width > atlasSize) {
+            shelves.x = 0;
+            shelves.y += shelves.height;
+            shelves.height = 0;
+        }
+        if (shelves.y + height > atlasSize) {
+            return false;
+        }
+        *x = shelves.x;
+        *y = shelves.y;
+        shelves.x += width;
+        shelves.height = std::max(shelves.height, height);
+        return true;
+    }
+
+    // image into the atlas at x, y inside its border, the border repeats the edge texels
+    void blit(const RgbaImage& image, RgbaImage& atlas, uint32_t x, uint32_t y)
+    {
+        const int width = static_cast<int>(image.width);
+        const int height = static_cast<int>(image.height);
+        for (int ty = -static_cast<int>(Border); ty < height + static_cast<int>(Border); ++ty) {
+            const int sy = std::min(std::max(ty, 0), height - 1);
+            for (int tx = -static_cast<int>(Border); tx < width + static_cast<int>(Border); ++tx) {
+                const int sx = std::min(std::max(tx, 0), width - 1);
+                const uint8_t* src = &image.texels[(static_cast<size_t>(sy) * image.width + sx) * 4];
+                uint8_t* dst = &atlas.texels[(static_cast<size_t>(y + Border + ty) * atlas.width + x + Border + tx) * 4];
+                std::copy(src, src + 4, dst);
+            }
+        }
+    }
+}
+
+uint32_t GuiAtlasVersion()
+{
+    return GuiAtlasTableVersion;
+}
+
+bool PackGuiAtlases(const std::vector<std::string>& images, const std::string& root, const std::string& output, uint32_t atlasSize,
+    uint32_t maxAtlases, GuiAtlasPackStats* stats, std::string* error)
+{
+    std::vector<RgbaImage> decoded(images.size());
+    std::vector<std::string> names(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        if (!LoadRgbaImage(images[i], &decoded[i])) {
+            *error = "can not read " + images[i];
+            return false;
+        }
+        if (decoded[i].width + 2 * Border > atlasSize || decoded[i].height + 2 * Border > atlasSize) {
+            *error = images[i] + " does not fit an atlas of " + std::to_string(atlasSize);
+            return false;
+        }
+        names[i] = textureName(images[i], root);
+    }
+
+    // tallest first, the shelves fill up evenly
+    std::vector<uint32_t> order(images.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&decoded](uint32_t a, uint32_t b) {
+        return decoded[a].height != decoded[b].height ? decoded[a].height > decoded[b].height : decoded[a].width > decoded[b].width;
+    });
+
+    std::vector<Shelves> shelves;
+    std::vector<Placement> placements(images.size());
+    for (uint32_t i : order) {
+        const uint32_t width = decoded[i].width + 2 * Border;
+        const uint32_t height = decoded[i].height + 2 * Border;
+        Placement& placement = placements[i];
+        placement.atlas = 0;
+        while (placement.atlas < shelves.size() && !place(shelves[placement.atlas], width, height, atlasSize, &placement.x, &placement.y)) {
+            placement.atlas++;
+        }
+        if (placement.atlas == shelves.size()) {
+            if (shelves.size() == maxAtlases) {
+                *error = "the images do not fit " + std::to_string(maxAtlases) + " atlases of " + std::to_string(atlasSize);
+                return false;
+            }
+            shelves.push_back(Shelves());
+            place(shelves.back(), width, height, atlasSize, &placement.x, &placement.y);
+        }
+    }
+
+    std::vector<RgbaImage> atlases(shelves.size());
+    for (RgbaImage& atlas : atlases) {
+        atlas.width = atlasSize;
+        atlas.height = atlasSize;
+        atlas.texels.assign(static_cast<size_t>(atlasSize) * atlasSize * 4, 0);
+    }
+    uint64_t covered = 0;
+    for (size_t i = 0; i < images.size(); ++i) {
+        blit(decoded[i], atlases[placements[i].atlas], placements[i].x, placements[i].y);
+        covered += static_cast<uint64_t>(decoded[i].width) * decoded[i].height;
+    }
+
+    // the atlases next to the table, named relative to it
+    const size_t slash = output.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : output.substr(0, slash + 1);
+    std::string stem = output.substr(directory.size());
+    stem = stem.substr(0, stem.find_last_of('.'));
+    std::vector<std::string> atlasNames(atlases.size());
+    for (size_t a = 0; a < atlases.size(); ++a) {
+        atlasNames[a] = stem + "." + std::to_string(a) + ".ktx";
+        if (!WriteRgbaKtx(atlases[a], directory + atlasNames[a])) {
+            *error = "failed to write " + directory + atlasNames[a];
+            return false;
+        }
+    }
+
+    // sorted by name, the regions in the same order
+    std::sort(order.begin(), order.end(), [&names](uint32_t a, uint32_t b) { return names[a] < names[b]; });
+    std::vector<std::string> sortedNames;
+    std::vector<schema::SGuiRegion> regions;
+    const float size = static_cast<float>(atlasSize);
+    for (uint32_t i : order) {
+        if (!sortedNames.empty() && sortedNames.back() == names[i]) {
+            *error = "two images are named " + names[i];
+            return false;
+        }
+        const Placement& placement = placements[i];
+        const float u0 = (placement.x + Border) / size;
+        const float v0 = (placement.y + Border) / size;
+        regions.push_back(schema::SGuiRegion(placement.atlas, u0, v0, u0 + decoded[i].width / size, v0 + decoded[i].height / size));
+        sortedNames.push_back(names[i]);
+    }
+
+    flatbuffers::FlatBufferBuilder fbb;
+    std::vector<flatbuffers::Offset<flatbuffers::String>> atlasStrings, nameStrings;
+    for (const std::string& name : atlasNames) {
+        atlasStrings.push_back(fbb.CreateString(name));
+    }
+    for (const std::string& name : sortedNames) {
+        nameStrings.push_back(fbb.CreateString(name));
+    }
+    auto table = schema::CreateSGuiAtlases(fbb, GuiAtlasTableVersion, fbb.CreateVector(atlasStrings), fbb.CreateVector(nameStrings),
+        fbb.CreateVectorOfStructs(regions.data(), regions.size()));
+    schema::FinishSGuiAtlasesBuffer(fbb, table);
+    if (!file::writeBinary(output.c_str(), fbb.GetBufferPointer(), fbb.GetSize())) {
+        *error = "failed to write " + output;
+        return false;
+    }
+
+    if (stats) {
+        stats->images = static_cast<uint32_t>(images.size());
+        stats->atlases = static_cast<uint32_t>(atlases.size());
+        stats->coverage = atlases.empty() ? 0.0f : static_cast<float>(covered / (static_cast<double>(atlasSize) * atlasSize * atlases.size()));
+    }
+    return true;
+}
+}
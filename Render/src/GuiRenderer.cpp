@@ -0,0 +1,1017 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GuiRenderer.hpp"
+#include "../../data/schema/guiatlas_generated.h"
+#include "CommandBuffer.hpp"
+#include "File.hpp"
+#include "GUIElement.h"
+#include "GUIFontRenderer.h"
+#include "GUITextCaption.h"
+#include "GuiAtlasPacker.hpp"
+#include "PerfLint.hpp"
+#include "PipelineRegistry.hpp"
+#include "TextureCooker.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace m3d {
+
+static const uint32_t BucketCount = GuiRenderer::MaxLevels * GuiRenderer::BucketsPerLevel;
+static const uint32_t TextBucket = GuiRenderer::MaxAtlases;
+static const uint32_t BakedBucket = GuiRenderer::MaxAtlases + 1;
+
+// R8G8B8A8Unorm, red in the lowest byte
+static uint32_t packColor(const m3d::math::Vector4& color)
+{
+    uint32_t packed = 0;
+    const float channels[4] = { color.x, color.y, color.z, color.w };
+    for (uint32_t i = 0; i < 4; ++i) {
+        const float c = std::min(std::max(channels[i], 0.0f), 1.0f);
+        packed |= static_cast<uint32_t>(c * 255.0f + 0.5f) << (8 * i);
+    }
+    return packed;
+}
+
+GuiRenderer::GuiRenderer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, UploadQueue& Upload,
+    PipelineRegistry& Registry, vk::RenderPass renderPass, uint32_t subpass, vk::SampleCountFlagBits samples, uint32_t colorAttachments, uint32_t slotCount,
+    uint32_t MaxQuads)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , upload(Upload)
+    , registry(Registry)
+    , maxQuads(MaxQuads)
+    , currentSlot(0)
+    , buckets(BucketCount)
+    , regionVersion(0)
+    , frameNumber(0)
+    , recordedAtlasCount(0)
+    , font(nullptr)
+    , fontRevision(0)
+    , recordedFont(false)
+    , panelBaking(true)
+    , bakeBuckets(BucketCount)
+    , bakeQuadCount(0)
+    , shelfX(0)
+    , shelfY(0)
+    , shelfHeight(0)
+    , bakeGeneration(0)
+    , bakeRestartPending(false)
+    , walkPendingBakes(false)
+    , recordedBakes(false)
+{
+    createIndices();
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    slots.resize(slotCount);
+    for (Slot& slot : slots) {
+        createBuffer(vk::BufferUsageFlagBits::eVertexBuffer, hostVisible, 4 * maxQuads * sizeof(Vertex), slot.vertices);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, BucketCount * sizeof(vk::DrawIndexedIndirectCommand), slot.draws);
+        vkx::debug::marker::setName(device, slot.vertices.buffer, "gui vertices");
+        vkx::debug::marker::setName(device, slot.draws.buffer, "gui draws");
+        memset(slot.draws.memory.mapped, 0, BucketCount * sizeof(vk::DrawIndexedIndirectCommand));
+        slot.quadCount = 0;
+        slot.drawCount = 0;
+    }
+
+    createPipeline(registry, renderPass, subpass, samples, colorAttachments);
+}
+
+GuiRenderer::~GuiRenderer()
+{
+    // the registry owns the pipelines and their layouts
+    if (font) {
+        // finishes the font uploads and runs their callbacks while we are still here
+        upload.WaitIdle();
+        device.destroySampler(fontSampler);
+        device.destroyImageView(fontView);
+        device.destroyImage(fontImage);
+        device.freeMemory(fontMemory);
+    }
+    destroyBakeAtlas();
+    for (size_t i = 0; i < loadedAtlases.size(); ++i) {
+        device.destroyImageView(loadedAtlases[i].view);
+        device.destroyImage(loadedAtlases[i].image);
+        commandBuffer.GetAllocator().Free(loadedAtlasMemory[i]);
+    }
+    device.destroySampler(loadedAtlasSampler);
+    device.destroyDescriptorPool(descriptorPool);
+
+    for (Slot& slot : slots) {
+        destroyBuffer(slot.vertices);
+        destroyBuffer(slot.draws);
+    }
+    destroyBuffer(indices);
+}
+
+void GuiRenderer::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory);
+    assert(buffer.memory && "out of device memory for the GUI");
+}
+
+void GuiRenderer::destroyBuffer(Buffer& buffer)
+{
+    commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    buffer = Buffer();
+}
+
+void GuiRenderer::createIndices()
+{
+    std::vector<uint32_t> quadIndices(6 * maxQuads);
+    for (uint32_t q = 0; q < maxQuads; ++q) {
+        const uint32_t v = 4 * q;
+        const uint32_t quad[6] = { v, v + 1, v + 2, v + 2, v + 3, v };
+        memcpy(&quadIndices[6 * q], quad, sizeof(quad));
+    }
+    const vk::DeviceSize size = quadIndices.size() * sizeof(uint32_t);
+    createBuffer(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, size, indices);
+    vkx::debug::marker::setName(device, indices.buffer, "gui indices");
+
+    // created once at Init, a blocking copy is fine there
+    Buffer staging;
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        size, quadIndices.data(), staging.buffer, staging.memory, std::vector<uint32_t>(), MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Staging);
+    uint32_t copyCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& copyCmd = commandBuffer.GetCommandBuffer(copyCmdIndex);
+    copyCmd.copyBuffer(staging.buffer, indices.buffer, vk::BufferCopy(0, 0, size));
+    commandBuffer.Flush(copyCmdIndex);
+    destroyBuffer(staging);
+}
+
+void GuiRenderer::createPipeline(PipelineRegistry& registry, vk::RenderPass renderPass, uint32_t subpass, vk::SampleCountFlagBits samples, uint32_t colorAttachments)
+{
+    vk::DescriptorSetLayoutBinding binding;
+    binding.binding = 0;
+    binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    binding.descriptorCount = 1;
+    binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+    // one sampled texture, the layout of any other single texture set as well
+    setLayout = registry.GetDescriptorSetLayout({ binding });
+
+    // the atlases, the font and the bake atlas
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eCombinedImageSampler, MaxAtlases + 2);
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = 1;
+    descriptorPoolInfo.pPoolSizes = &poolSize;
+    descriptorPoolInfo.maxSets = MaxAtlases + 2;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    pipelineLayout = registry.GetPipelineLayout({ setLayout }, {});
+
+    PipelineDesc desc;
+    desc.renderPass = renderPass;
+    desc.subpass = subpass;
+    desc.samples = samples;
+    desc.colorAttachments = colorAttachments;
+    desc.layout = pipelineLayout;
+    desc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\gui\\gui.vert.spv";
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\gui\\gui.frag.spv";
+    desc.bindings.push_back(vk::VertexInputBindingDescription(0, sizeof(Vertex), vk::VertexInputRate::eVertex));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, position)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, uv)));
+    desc.attributes.push_back(vk::VertexInputAttributeDescription(2, 0, vk::Format::eR8G8B8A8Unorm, offsetof(Vertex, color)));
+    // drawn in order on top of the scene, the depth buffer stays the scene's for culling
+    desc.depthTest = false;
+    desc.depthWrite = false;
+    desc.blend = true;
+    pipelineDesc = desc;
+
+    // baked panels are premultiplied, the bake pipeline is made with the bake pass
+    compositePipelineDesc = desc;
+    compositePipelineDesc.premultipliedBlend = true;
+
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\gui\\gui_text.frag.spv";
+    textPipelineDesc = desc;
+    RefreshPipelines(registry);
+}
+
+void GuiRenderer::RefreshPipelines(PipelineRegistry& registry)
+{
+    pipeline = registry.Get(pipelineDesc);
+    textPipeline = registry.Get(textPipelineDesc);
+    vkx::debug::marker::setName(device, pipeline, "gui");
+    vkx::debug::marker::setName(device, textPipeline, "gui text");
+    if (bakePass) {
+        bakePipeline = registry.Get(bakePipelineDesc);
+        compositePipeline = registry.Get(compositePipelineDesc);
+        vkx::debug::marker::setName(device, bakePipeline, "gui panel bake");
+        vkx::debug::marker::setName(device, compositePipeline, "gui baked panels");
+    }
+}
+
+uint32_t GuiRenderer::AddAtlas(const vkext::VulkanTexture& texture)
+{
+    if (atlasSets.size() == MaxAtlases) {
+        printf("GuiRenderer: all %u atlases are taken\n", MaxAtlases);
+        return InvalidAtlas;
+    }
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    vk::DescriptorSet set = device.allocateDescriptorSets(allocInfo)[0];
+
+    vk::DescriptorImageInfo image(texture.sampler, texture.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::WriteDescriptorSet write;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image;
+    device.updateDescriptorSets(write, nullptr);
+
+    atlasSets.push_back(set);
+    return static_cast<uint32_t>(atlasSets.size() - 1);
+}
+
+void GuiRenderer::AddRegion(const std::string& textureName, uint32_t atlas, float u0, float v0, float u1, float v1)
+{
+    assert(atlas < atlasSets.size());
+    Region& region = regions[textureName];
+    region.atlas = atlas;
+    region.uv[0] = u0;
+    region.uv[1] = v0;
+    region.uv[2] = u1;
+    region.uv[3] = v1;
+    regionVersion++;
+}
+
+bool GuiRenderer::LoadAtlases(const std::string& path)
+{
+    std::string table;
+    if (!file::readBinary(path.c_str(), table)) {
+        printf("GuiRenderer: can not read %s\n", path.c_str());
+        return false;
+    }
+    flatbuffers::Verifier verifier(reinterpret_cast<const uint8_t*>(table.data()), table.size());
+    if (!schema::VerifySGuiAtlasesBuffer(verifier) || schema::GetSGuiAtlases(table.data())->version() != GuiAtlasVersion()) {
+        printf("GuiRenderer: %s is no GUI atlas table of version %u\n", path.c_str(), GuiAtlasVersion());
+        return false;
+    }
+    const schema::SGuiAtlases* atlases = schema::GetSGuiAtlases(table.data());
+    if (!atlases->atlases() || !atlases->names() || !atlases->regions() || atlases->names()->size() != atlases->regions()->size()) {
+        printf("GuiRenderer: %s is incomplete\n", path.c_str());
+        return false;
+    }
+    if (atlasSets.size() + atlases->atlases()->size() > MaxAtlases) {
+        printf("GuiRenderer: %s needs %u atlases, %zu are left\n", path.c_str(), atlases->atlases()->size(), MaxAtlases - atlasSets.size());
+        return false;
+    }
+
+    if (!loadedAtlasSampler) {
+        // drawn about the size they were packed, the borders keep linear filtering inside every image
+        vk::SamplerCreateInfo sampler;
+        sampler.magFilter = vk::Filter::eLinear;
+        sampler.minFilter = vk::Filter::eLinear;
+        sampler.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+        sampler.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+        sampler.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+        sampler.compareOp = vk::CompareOp::eNever;
+        sampler.borderColor = vk::BorderColor::eFloatTransparentBlack;
+        loadedAtlasSampler = device.createSampler(sampler);
+    }
+
+    // the KTX files are next to the table
+    const size_t slash = path.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    std::vector<uint32_t> atlasIndices;
+    std::vector<std::vector<uint8_t>> files(atlases->atlases()->size());
+    for (uint32_t a = 0; a < atlases->atlases()->size(); ++a) {
+        const std::string atlasPath = directory + atlases->atlases()->Get(a)->str();
+        std::vector<KtxLevel> levels;
+        uint32_t glInternalFormat = 0;
+        if (!file::readBinary(atlasPath.c_str(), files[a]) || !ParseKtx(files[a].data(), files[a].size(), &levels, &glInternalFormat)
+            || KtxFormat(glInternalFormat) != vk::Format::eR8G8B8A8Unorm) {
+            printf("GuiRenderer: %s is no R8G8B8A8 KTX file\n", atlasPath.c_str());
+            return false;
+        }
+
+        const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+        vk::ImageCreateInfo imageCreateInfo;
+        imageCreateInfo.imageType = vk::ImageType::e2D;
+        imageCreateInfo.format = vk::Format::eR8G8B8A8Unorm;
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+        imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+        imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+        imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+        imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+        imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+        imageCreateInfo.extent = vk::Extent3D(levels[0].width, levels[0].height, 1);
+        imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+
+        vkext::VulkanTexture texture;
+        texture.width = levels[0].width;
+        texture.height = levels[0].height;
+        texture.mipLevels = 1;
+        texture.layerCount = 1;
+        texture.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        texture.image = device.createImage(imageCreateInfo);
+        vkx::debug::marker::setName(device, texture.image, atlases->atlases()->Get(a)->c_str());
+        MemoryAllocator::Allocation memory = commandBuffer.GetAllocator().AllocateImage(texture.image, vk::MemoryPropertyFlagBits::eDeviceLocal, true,
+            MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Texture);
+        if (!memory) {
+            printf("GuiRenderer: out of device memory for %s\n", atlasPath.c_str());
+            device.destroyImage(texture.image);
+            return false;
+        }
+        texture.deviceMemory = memory.memory;
+
+        vk::BufferImageCopy region;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+        region.imageExtent = imageCreateInfo.extent;
+        upload.CopyToImage(levels[0].data, levels[0].size, texture.image, std::vector<vk::BufferImageCopy>(1, region),
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), texture.imageLayout);
+
+        vk::ImageViewCreateInfo view;
+        view.viewType = vk::ImageViewType::e2D;
+        view.format = imageCreateInfo.format;
+        view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+        view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        view.image = texture.image;
+        texture.view = device.createImageView(view);
+        texture.sampler = loadedAtlasSampler;
+
+        loadedAtlases.push_back(texture);
+        loadedAtlasMemory.push_back(memory);
+        atlasIndices.push_back(AddAtlas(texture));
+    }
+    // sampled by the next frame, only happens at load
+    upload.Submit();
+    upload.WaitIdle();
+
+    for (uint32_t i = 0; i < atlases->names()->size(); ++i) {
+        const schema::SGuiRegion* region = atlases->regions()->Get(i);
+        if (region->atlas() >= atlasIndices.size()) {
+            continue;
+        }
+        AddRegion(atlases->names()->Get(i)->str(), atlasIndices[region->atlas()], region->u0(), region->v0(), region->u1(), region->v1());
+    }
+    return true;
+}
+
+void GuiRenderer::SetFont(GUISystem::GUIFontRenderer& Font)
+{
+    if (font) {
+        printf("GuiRenderer: a font is already set\n");
+        return;
+    }
+    font = &Font;
+    createFontImage();
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    fontSet = device.allocateDescriptorSets(allocInfo)[0];
+
+    vk::DescriptorImageInfo image(fontSampler, fontView, vk::ImageLayout::eGeneral);
+    vk::WriteDescriptorSet write;
+    write.dstSet = fontSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image;
+    device.updateDescriptorSets(write, nullptr);
+}
+
+void GuiRenderer::createFontImage()
+{
+    const uint32_t size = static_cast<uint32_t>(font->GetAtlasSize());
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = vk::Format::eR8Unorm;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(size, size, 1);
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    fontImage = device.createImage(imageCreateInfo);
+    vkx::debug::marker::setName(device, fontImage, "gui font");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(fontImage);
+    vk::MemoryAllocateInfo memAllocInfo;
+    memAllocInfo.allocationSize = memReqs.size;
+    memAllocInfo.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    fontMemory = device.allocateMemory(memAllocInfo);
+    device.bindImageMemory(fontImage, fontMemory, 0);
+
+    // the whole atlas so far, from undefined; sampled by the next frame, only happens once
+    int x, y, w, h;
+    font->TakeDirtyRect(x, y, w, h);
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = vk::Extent3D(size, size, 1);
+    upload.CopyToImage(font->GetAtlas(), size * size, fontImage, std::vector<vk::BufferImageCopy>(1, region),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eGeneral);
+    upload.Submit();
+    upload.WaitIdle();
+    fontRevision = font->GetAtlasRevision();
+
+    // linear filtering of the distances keeps the edges sharp at any scale
+    vk::SamplerCreateInfo sampler;
+    sampler.magFilter = vk::Filter::eLinear;
+    sampler.minFilter = vk::Filter::eLinear;
+    sampler.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    sampler.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    sampler.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler.compareOp = vk::CompareOp::eNever;
+    sampler.borderColor = vk::BorderColor::eFloatTransparentBlack;
+    fontSampler = device.createSampler(sampler);
+
+    vk::ImageViewCreateInfo view;
+    view.viewType = vk::ImageViewType::e2D;
+    view.format = imageCreateInfo.format;
+    view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+    view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    view.image = fontImage;
+    fontView = device.createImageView(view);
+}
+
+// Copy the glyphs written since the last upload in place. Frames in flight only sample glyphs of finished
+// uploads, so none of them reads the texels we write, and the layout never changes.
+void GuiRenderer::uploadFont(int x, int y, int w, int h)
+{
+    const int size = font->GetAtlasSize();
+    // buffer offsets of copies on transfer queues have to be multiples of 4
+    w += x & 3;
+    x &= ~3;
+
+    vk::BufferImageCopy region;
+    region.bufferOffset = x;
+    region.bufferRowLength = size;
+    region.bufferImageHeight = h;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageOffset = vk::Offset3D(x, y, 0);
+    region.imageExtent = vk::Extent3D(w, h, 1);
+    upload.CopyToImage(font->GetAtlas() + y * size, static_cast<vk::DeviceSize>(h) * size, fontImage, std::vector<vk::BufferImageCopy>(1, region),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral);
+
+    const unsigned int revision = font->GetAtlasRevision();
+    upload.Submit([this, revision]() { fontRevision = revision; });
+}
+
+void GuiRenderer::BeginFrame(uint32_t slot)
+{
+    currentSlot = slot;
+    frameTrees.clear();
+    if (bakeRestartPending) {
+        // the frames in flight sample rects that are about to be taken again
+        perflint::WaitIdle("GuiRenderer::BeginFrame");
+        device.waitIdle();
+        shelfX = 0;
+        shelfY = 0;
+        shelfHeight = 0;
+        bakeGeneration++;
+        panels.clear();
+        bakeRestartPending = false;
+    }
+}
+
+void GuiRenderer::Add(const std::vector<GUISystem::GUIElement*>& elements, const GUISystem::ElementProportions& screen)
+{
+    for (GUISystem::GUIElement* element : elements) {
+        Tree& tree = trees[element];
+        tree.frame = frameNumber;
+        frameTrees.push_back(&tree);
+
+        const bool valid = !tree.offsets.empty() && tree.revision == element->GetRevision() && tree.regionVersion == regionVersion
+            && tree.fontRevision == fontRevision && tree.screenWidth == screen.width && tree.screenHeight == screen.height
+            && tree.bakeGeneration == bakeGeneration && !tree.pendingBakes;
+        if (valid) {
+            continue;
+        }
+
+        for (auto& bucket : buckets) {
+            bucket.clear();
+        }
+        walkPendingBakes = false;
+        addElement(*element, screen, screen, 0);
+
+        tree.vertices.clear();
+        tree.offsets.resize(BucketCount + 1);
+        for (uint32_t b = 0; b < BucketCount; ++b) {
+            tree.offsets[b] = static_cast<uint32_t>(tree.vertices.size());
+            tree.vertices.insert(tree.vertices.end(), buckets[b].begin(), buckets[b].end());
+        }
+        tree.offsets[BucketCount] = static_cast<uint32_t>(tree.vertices.size());
+        tree.revision = element->GetRevision();
+        tree.regionVersion = regionVersion;
+        tree.fontRevision = fontRevision;
+        tree.screenWidth = screen.width;
+        tree.screenHeight = screen.height;
+        tree.bakeGeneration = bakeGeneration;
+        tree.pendingBakes = walkPendingBakes;
+    }
+}
+
+void GuiRenderer::appendQuad(std::vector<Vertex>& bucket, const GUISystem::ElementProportions& p, const GUISystem::ElementProportions& frame,
+    uint32_t color, const float uv[4])
+{
+    // pixels to NDC, Vulkan's y points down like the GUI's
+    const float x0 = 2.0f * (p.topLeft.x - frame.topLeft.x) / frame.width - 1.0f;
+    const float y0 = 2.0f * (p.topLeft.y - frame.topLeft.y) / frame.height - 1.0f;
+    const float x1 = 2.0f * (p.botRight.x - frame.topLeft.x) / frame.width - 1.0f;
+    const float y1 = 2.0f * (p.botRight.y - frame.topLeft.y) / frame.height - 1.0f;
+    const Vertex quad[4] = {
+        { { x0, y0 }, { uv[0], uv[1] }, color },
+        { { x1, y0 }, { uv[2], uv[1] }, color },
+        { { x1, y1 }, { uv[2], uv[3] }, color },
+        { { x0, y1 }, { uv[0], uv[3] }, color }
+    };
+    bucket.insert(bucket.end(), quad, quad + 4);
+}
+
+void GuiRenderer::addElement(GUISystem::GUIElement& element, const GUISystem::ElementProportions& parent, const GUISystem::ElementProportions& screen,
+    uint32_t level)
+{
+    // SetVisible hides the children with their parent
+    if (!element.IsVisible()) {
+        return;
+    }
+    if (panelBaking && addBaked(element, screen, level)) {
+        return;
+    }
+
+    if (element.GetTextCaption() && font) {
+        addText(element, parent, screen, level);
+    }
+
+    auto region = regions.find(element.GetActiveTextureName());
+    if (!element.GetTextCaption() && region != regions.end()) {
+        std::vector<Vertex>& bucket = buckets[std::min(level, MaxLevels - 1) * BucketsPerLevel + region->second.atlas];
+        appendQuad(bucket, element.GetProportions(), screen, packColor(element.GetColor()), region->second.uv);
+    }
+
+    const std::vector<GUISystem::GUIElement*>* children = element.GetChildrens();
+    for (GUISystem::GUIElement* child : *children) {
+        addElement(*child, element.GetProportions(), screen, level + 1);
+    }
+}
+
+void GuiRenderer::addText(GUISystem::GUIElement& element, const GUISystem::ElementProportions& parent, const GUISystem::ElementProportions& screen,
+    uint32_t level)
+{
+    GUISystem::GUITextCaption* caption = element.GetTextCaption();
+    // lays the text out when it or the parent changed
+    caption->Update(parent, font);
+
+    const GUISystem::GUIShapedText* shaped = caption->GetShapedText();
+    if (!shaped || shaped->atlasRevision > fontRevision) {
+        // glyphs still being uploaded, the tree is walked again once they are
+        return;
+    }
+
+    const GUISystem::ElementProportions& p = caption->GetProportions();
+    const float scale = static_cast<float>(caption->GetFontSize()) / shaped->baseSize;
+    const uint32_t color = packColor(caption->GetColor());
+    std::vector<Vertex>& bucket = buckets[std::min(level, MaxLevels - 1) * BucketsPerLevel + TextBucket];
+    for (const GUISystem::GUIGlyphQuad& q : shaped->quads) {
+        const float x0 = 2.0f * (p.topLeft.x + q.x0 * scale) / screen.width - 1.0f;
+        const float y0 = 2.0f * (p.topLeft.y + q.y0 * scale) / screen.height - 1.0f;
+        const float x1 = 2.0f * (p.topLeft.x + q.x1 * scale) / screen.width - 1.0f;
+        const float y1 = 2.0f * (p.topLeft.y + q.y1 * scale) / screen.height - 1.0f;
+        const Vertex quad[4] = {
+            { { x0, y0 }, { q.u0, q.v0 }, color },
+            { { x1, y0 }, { q.u1, q.v0 }, color },
+            { { x1, y1 }, { q.u1, q.v1 }, color },
+            { { x0, y1 }, { q.u0, q.v1 }, color }
+        };
+        bucket.insert(bucket.end(), quad, quad + 4);
+    }
+}
+
+// whether every element of the subtree can be baked
+static bool canBake(const GUISystem::GUIElement& element)
+{
+    if (!element.CanBeBaked()) {
+        return false;
+    }
+    for (const GUISystem::GUIElement* child : *element.GetChildrens()) {
+        if (!canBake(*child)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool GuiRenderer::addBaked(GUISystem::GUIElement& element, const GUISystem::ElementProportions& screen, uint32_t level)
+{
+    if (!element.HasChilds() || !canBake(element)) {
+        return false;
+    }
+    const GUISystem::ElementProportions& p = element.GetProportions();
+    // a texel of gutter right and below, linear filtering does not reach the neighbours
+    if (p.width < 1.0f || p.height < 1.0f || std::ceil(p.width) + 1.0f > BakeAtlasSize || std::ceil(p.height) + 1.0f > BakeAtlasSize) {
+        return false;
+    }
+
+    Panel& panel = panels[&element];
+    if (panel.revision != element.GetRevision()) {
+        panel.revision = element.GetRevision();
+        panel.stableWalks = 0;
+    }
+    const bool current = panel.baked && panel.bakedRevision == panel.revision && panel.regionVersion == regionVersion && panel.width == p.width
+        && panel.height == p.height;
+    if (!current) {
+        if (panel.baked) {
+            panel.baked = false;
+            element.SetBaked(false);
+        }
+        // drawn as it is until it stayed the same for a few frames
+        if (++panel.stableWalks < BakeStableFrames) {
+            walkPendingBakes = true;
+            return false;
+        }
+        if (!bakePanel(element, panel)) {
+            return false;
+        }
+    }
+
+    const float size = static_cast<float>(BakeAtlasSize);
+    const float uv[4] = { panel.x / size, panel.y / size, (panel.x + p.width) / size, (panel.y + p.height) / size };
+    // transparent, the bake is shown as it is
+    appendQuad(buckets[std::min(level, MaxLevels - 1) * BucketsPerLevel + BakedBucket], p, screen, 0, uv);
+    return true;
+}
+
+void GuiRenderer::addBakeQuads(GUISystem::GUIElement& element, const GUISystem::ElementProportions& panel, uint32_t level)
+{
+    if (!element.IsVisible()) {
+        return;
+    }
+    auto region = regions.find(element.GetActiveTextureName());
+    if (region != regions.end()) {
+        std::vector<Vertex>& bucket = bakeBuckets[std::min(level, MaxLevels - 1) * BucketsPerLevel + region->second.atlas];
+        appendQuad(bucket, element.GetProportions(), panel, packColor(element.GetColor()), region->second.uv);
+    }
+    for (GUISystem::GUIElement* child : *element.GetChildrens()) {
+        addBakeQuads(*child, panel, level + 1);
+    }
+}
+
+bool GuiRenderer::bakePanel(GUISystem::GUIElement& element, Panel& panel)
+{
+    if (bakeRestartPending) {
+        walkPendingBakes = true;
+        return false;
+    }
+    if (!bakePass) {
+        createBakeAtlas();
+    }
+
+    for (auto& bucket : bakeBuckets) {
+        bucket.clear();
+    }
+    const GUISystem::ElementProportions& p = element.GetProportions();
+    addBakeQuads(element, p, 0);
+    uint32_t quads = 0;
+    for (const auto& bucket : bakeBuckets) {
+        quads += static_cast<uint32_t>(bucket.size() / 4);
+    }
+    if (quads == 0 || quads > maxQuads) {
+        return false;
+    }
+    if (bakeQuadCount + quads > maxQuads) {
+        // the next frame's flush has room again
+        walkPendingBakes = true;
+        return false;
+    }
+
+    // on the current shelf, or a new one below it
+    const uint32_t width = static_cast<uint32_t>(std::ceil(p.width)) + 1;
+    const uint32_t height = static_cast<uint32_t>(std::ceil(p.height)) + 1;
+    if (shelfX + width > BakeAtlasSize) {
+        shelfX = 0;
+        shelfY += shelfHeight;
+        shelfHeight = 0;
+    }
+    if (shelfY + height > BakeAtlasSize) {
+        bakeRestartPending = true;
+        walkPendingBakes = true;
+        return false;
+    }
+    BakeJob job;
+    job.x = shelfX;
+    job.y = shelfY;
+    job.width = p.width;
+    job.height = p.height;
+    shelfX += width;
+    shelfHeight = std::max(shelfHeight, height);
+
+    Vertex* vertices = static_cast<Vertex*>(bakeVertices.memory.mapped);
+    for (uint32_t b = 0; b < BucketCount; ++b) {
+        const std::vector<Vertex>& bucket = bakeBuckets[b];
+        if (bucket.empty()) {
+            continue;
+        }
+        BakeDraw draw;
+        draw.atlas = b % BucketsPerLevel;
+        draw.firstVertex = 4 * bakeQuadCount;
+        draw.quads = static_cast<uint32_t>(bucket.size() / 4);
+        memcpy(vertices + draw.firstVertex, bucket.data(), bucket.size() * sizeof(Vertex));
+        job.draws.push_back(draw);
+        bakeQuadCount += draw.quads;
+    }
+    bakeJobs.push_back(job);
+
+    panel.baked = true;
+    panel.bakedRevision = panel.revision;
+    panel.regionVersion = regionVersion;
+    panel.width = p.width;
+    panel.height = p.height;
+    panel.x = job.x;
+    panel.y = job.y;
+    element.SetBaked(true);
+    return true;
+}
+
+void GuiRenderer::createBakeAtlas()
+{
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = vk::Format::eR8G8B8A8Unorm;
+    imageInfo.extent = vk::Extent3D(BakeAtlasSize, BakeAtlasSize, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    bakeImage = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, bakeImage, "gui bake atlas");
+    bakeMemory = commandBuffer.GetAllocator().AllocateImage(bakeImage, vk::MemoryPropertyFlagBits::eDeviceLocal, true,
+        MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Texture);
+    assert(bakeMemory && "out of device memory for the gui bake atlas");
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = bakeImage;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = imageInfo.format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    bakeView = device.createImageView(viewInfo);
+
+    // the panels are drawn at the size they were baked, linear only blends the edges
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    bakeSampler = device.createSampler(samplerInfo);
+
+    // loaded, every bake clears its own rect and leaves the others as they are
+    vk::AttachmentDescription attachment;
+    attachment.format = imageInfo.format;
+    attachment.samples = vk::SampleCountFlagBits::e1;
+    attachment.loadOp = vk::AttachmentLoadOp::eLoad;
+    attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachment.initialLayout = vk::ImageLayout::eGeneral;
+    attachment.finalLayout = vk::ImageLayout::eGeneral;
+
+    vk::AttachmentReference colorReference(0, vk::ImageLayout::eGeneral);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+
+    // frames submitted later sample what was drawn
+    vk::SubpassDependency dependency;
+    dependency.srcSubpass = 0;
+    dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependency.dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    dependency.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::RenderPassCreateInfo renderPassInfo;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+    bakePass = device.createRenderPass(renderPassInfo);
+    vkx::debug::marker::setName(device, bakePass, "gui bake pass");
+
+    vk::FramebufferCreateInfo framebufferInfo;
+    framebufferInfo.renderPass = bakePass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &bakeView;
+    framebufferInfo.width = BakeAtlasSize;
+    framebufferInfo.height = BakeAtlasSize;
+    framebufferInfo.layers = 1;
+    bakeFramebuffer = device.createFramebuffer(framebufferInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    bakeSet = device.allocateDescriptorSets(allocInfo)[0];
+    vk::DescriptorImageInfo image(bakeSampler, bakeView, vk::ImageLayout::eGeneral);
+    vk::WriteDescriptorSet write;
+    write.dstSet = bakeSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    write.pImageInfo = &image;
+    device.updateDescriptorSets(write, nullptr);
+
+    createBuffer(vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        4 * maxQuads * sizeof(Vertex), bakeVertices);
+    vkx::debug::marker::setName(device, bakeVertices.buffer, "gui bake vertices");
+
+    // from undefined to transparent, only happens once
+    uint32_t clearCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& clearCmd = commandBuffer.GetCommandBuffer(clearCmdIndex);
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eGeneral;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = bakeImage;
+    barrier.subresourceRange = range;
+    clearCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    vk::ClearColorValue transparent;
+    clearCmd.clearColorImage(bakeImage, vk::ImageLayout::eGeneral, transparent, range);
+    commandBuffer.Flush(clearCmdIndex);
+
+    // the bake pass draws the atlases like the frames, single sampled into one attachment and premultiplied
+    bakePipelineDesc = pipelineDesc;
+    bakePipelineDesc.renderPass = bakePass;
+    bakePipelineDesc.subpass = 0;
+    bakePipelineDesc.samples = vk::SampleCountFlagBits::e1;
+    bakePipelineDesc.colorAttachments = 1;
+    bakePipelineDesc.premultipliedBlend = true;
+    bakePipelineDesc.SetConstant(0, true);
+    RefreshPipelines(registry);
+}
+
+void GuiRenderer::destroyBakeAtlas()
+{
+    if (!bakePass) {
+        return;
+    }
+    // the registry owns the bake pipelines
+    device.destroyFramebuffer(bakeFramebuffer);
+    device.destroyRenderPass(bakePass);
+    device.destroySampler(bakeSampler);
+    device.destroyImageView(bakeView);
+    device.destroyImage(bakeImage);
+    commandBuffer.GetAllocator().Free(bakeMemory);
+    destroyBuffer(bakeVertices);
+    bakePass = vk::RenderPass();
+}
+
+// Render the bakes queued by this frame's walks. Their rects are not sampled by any frame yet, the rects of the
+// panels drawn by frames in flight are not touched; waits, so bakeVertices can be filled again.
+void GuiRenderer::flushBakes()
+{
+    if (bakeJobs.empty()) {
+        return;
+    }
+    uint32_t bakeCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& cmd = commandBuffer.GetCommandBuffer(bakeCmdIndex);
+    vk::RenderPassBeginInfo beginInfo;
+    beginInfo.renderPass = bakePass;
+    beginInfo.framebuffer = bakeFramebuffer;
+    beginInfo.renderArea.extent = vk::Extent2D(BakeAtlasSize, BakeAtlasSize);
+    cmd.beginRenderPass(beginInfo, vk::SubpassContents::eInline);
+
+    vk::DeviceSize offsets[1] = { 0 };
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, bakePipeline);
+    cmd.bindVertexBuffers(0, 1, &bakeVertices.buffer, offsets);
+    cmd.bindIndexBuffer(indices.buffer, 0, vk::IndexType::eUint32);
+    for (const BakeJob& job : bakeJobs) {
+        // the texels of the gutter as well
+        const vk::Rect2D rect(vk::Offset2D(job.x, job.y),
+            vk::Extent2D(static_cast<uint32_t>(std::ceil(job.width)) + 1, static_cast<uint32_t>(std::ceil(job.height)) + 1));
+        vk::ClearAttachment clear;
+        clear.aspectMask = vk::ImageAspectFlagBits::eColor;
+        clear.colorAttachment = 0;
+        clear.clearValue.color = vk::ClearColorValue();
+        cmd.clearAttachments(clear, vk::ClearRect(rect, 0, 1));
+
+        cmd.setViewport(0, vk::Viewport(static_cast<float>(job.x), static_cast<float>(job.y), job.width, job.height, 0.0f, 1.0f));
+        cmd.setScissor(0, rect);
+        for (const BakeDraw& draw : job.draws) {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &atlasSets[draw.atlas], 0, nullptr);
+            cmd.drawIndexed(6 * draw.quads, 1, 0, static_cast<int32_t>(draw.firstVertex), 0);
+        }
+    }
+    cmd.endRenderPass();
+    commandBuffer.Flush(bakeCmdIndex);
+
+    bakeJobs.clear();
+    bakeQuadCount = 0;
+}
+
+void GuiRenderer::EndFrame()
+{
+    int x, y, w, h;
+    if (font && font->TakeDirtyRect(x, y, w, h)) {
+        uploadFont(x, y, w, h);
+    }
+    // before the frame that draws them is submitted
+    flushBakes();
+
+    Slot& slot = slots[currentSlot];
+    Vertex* vertices = static_cast<Vertex*>(slot.vertices.memory.mapped);
+    vk::DrawIndexedIndirectCommand* draws = static_cast<vk::DrawIndexedIndirectCommand*>(slot.draws.memory.mapped);
+
+    slot.quadCount = 0;
+    slot.drawCount = 0;
+    bool full = false;
+    for (uint32_t b = 0; b < BucketCount; ++b) {
+        const uint32_t firstQuad = slot.quadCount;
+        for (const Tree* tree : frameTrees) {
+            const uint32_t treeQuads = (tree->offsets[b + 1] - tree->offsets[b]) / 4;
+            const uint32_t quads = std::min(treeQuads, maxQuads - slot.quadCount);
+            memcpy(vertices + 4 * slot.quadCount, tree->vertices.data() + tree->offsets[b], 4 * quads * sizeof(Vertex));
+            slot.quadCount += quads;
+            full = full || quads < treeQuads;
+        }
+
+        const uint32_t quads = slot.quadCount - firstQuad;
+        vk::DrawIndexedIndirectCommand& draw = draws[b];
+        draw.indexCount = 6 * quads;
+        draw.instanceCount = quads > 0 ? 1 : 0;
+        draw.firstIndex = 0;
+        draw.vertexOffset = static_cast<int32_t>(4 * firstQuad);
+        draw.firstInstance = 0;
+        slot.drawCount += quads > 0 ? 1 : 0;
+    }
+    if (full) {
+        printf("GuiRenderer: more than %u quads, the rest is not drawn\n", maxQuads);
+    }
+
+    for (auto it = trees.begin(); it != trees.end();) {
+        if (it->second.frame != frameNumber) {
+            it = trees.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    frameNumber++;
+}
+
+void GuiRenderer::Draw(vk::CommandBuffer cmd, uint32_t slotIndex)
+{
+    const Slot& slot = slots[slotIndex];
+    vk::DeviceSize offsets[1] = { 0 };
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    cmd.bindVertexBuffers(0, 1, &slot.vertices.buffer, offsets);
+    cmd.bindIndexBuffer(indices.buffer, 0, vk::IndexType::eUint32);
+
+    // one command per level and atlas known now, the ones without quads this frame draw nothing
+    const uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    for (uint32_t level = 0; level < MaxLevels; ++level) {
+        if ((font || bakeSet) && level > 0) {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        }
+        for (uint32_t a = 0; a < atlasSets.size(); ++a) {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &atlasSets[a], 0, nullptr);
+            cmd.drawIndexedIndirect(slot.draws.buffer, (level * BucketsPerLevel + a) * stride, 1, stride);
+        }
+        // the panels baked at the level, captions cannot be baked and stay on top
+        if (bakeSet) {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, compositePipeline);
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &bakeSet, 0, nullptr);
+            cmd.drawIndexedIndirect(slot.draws.buffer, (level * BucketsPerLevel + BakedBucket) * stride, 1, stride);
+        }
+        // the captions of the level on top of its images
+        if (font) {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, textPipeline);
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &fontSet, 0, nullptr);
+            cmd.drawIndexedIndirect(slot.draws.buffer, (level * BucketsPerLevel + TextBucket) * stride, 1, stride);
+        }
+    }
+    recordedAtlasCount = atlasSets.size();
+    recordedFont = font != nullptr;
+    recordedBakes = static_cast<bool>(bakeSet);
+}
+} // End of namespace m3d
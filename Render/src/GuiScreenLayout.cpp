@@ -0,0 +1,249 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "GuiScreenLayout.hpp"
+
+#include "../../data/schema/guiscreen_generated.h"
+#include "File.hpp"
+#include "GUIButton.h"
+#include "GUICheckBox.h"
+#include "GUIImage.h"
+#include "GUIPanel.h"
+#include "GUITextCaption.h"
+#include "flatbuffers/idl.h"
+
+#include <cstdio>
+
+namespace m3d {
+
+using namespace m3d::schema;
+
+static bool isJson(const std::string& path)
+{
+    const std::string extension = ".json";
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// hashed only, the elements keep their names
+static StringId nameId(const std::string& name)
+{
+    return StringId::FromValue(StringHash64(name.data(), name.size()));
+}
+
+static std::string texture(const SGuiElement* sElement, uint32_t index)
+{
+    return sElement->textures() && index < sElement->textures()->size() ? sElement->textures()->Get(index)->str() : std::string();
+}
+
+static fastdelegate::FastDelegate1<GUISystem::GUIElement*> binding(const flatbuffers::String* name, const GuiScreenLayout::Bindings& bindings,
+    const std::string& path)
+{
+    if (!name) {
+        return fastdelegate::FastDelegate1<GUISystem::GUIElement*>();
+    }
+    GuiScreenLayout::Bindings::const_iterator it = bindings.find(name->str());
+    if (it == bindings.end()) {
+        printf("GuiScreenLayout: %s binds %s, which has no callback\n", path.c_str(), name->c_str());
+        return fastdelegate::FastDelegate1<GUISystem::GUIElement*>();
+    }
+    return it->second;
+}
+
+static GUISystem::GUIElement* createElement(const SGuiElement* sElement, const GuiScreenLayout::Bindings& bindings, const std::string& path)
+{
+    const std::string name = sElement->name() ? sElement->name()->str() : std::string();
+    GUISystem::GUIElement* element = nullptr;
+    switch (sElement->type()) {
+    case SGuiElementType_Panel: {
+        GUISystem::GUIPanel* panel = new GUISystem::GUIPanel(name);
+        GUISystem::GUIPanelTextures textures;
+        textures.textureName = texture(sElement, 0);
+        textures.textureNameHover = texture(sElement, 1);
+        textures.textureNameClicked = texture(sElement, 2);
+        textures.textureNameChecked = texture(sElement, 3);
+        textures.textureNameCheckedHover = texture(sElement, 4);
+        panel->SetTextures(textures);
+        element = panel;
+        break;
+    }
+    case SGuiElementType_Image: {
+        GUISystem::GUIImage* image = new GUISystem::GUIImage(name);
+        image->SetTextureName(texture(sElement, 0));
+        element = image;
+        break;
+    }
+    case SGuiElementType_Button: {
+        GUISystem::GUIButton* button = new GUISystem::GUIButton(name);
+        GUISystem::GUIButtonTextures textures;
+        textures.textureName = texture(sElement, 0);
+        textures.textureNameClicked = texture(sElement, 1);
+        textures.textureNameHover = texture(sElement, 2);
+        button->SetTextures(textures);
+        button->SetOnClickCallback(binding(sElement->onClick(), bindings, path));
+        button->SetOnDownCallback(binding(sElement->onDown(), bindings, path));
+        button->SetOnUpCallback(binding(sElement->onUp(), bindings, path));
+        button->SetOnOverCallback(binding(sElement->onOver(), bindings, path));
+        button->SetOnStateChangeCallback(binding(sElement->onStateChange(), bindings, path));
+        button->SetWhileDownCallback(binding(sElement->whileDown(), bindings, path));
+        button->SetWhileHoverCallback(binding(sElement->whileHover(), bindings, path));
+        element = button;
+        break;
+    }
+    case SGuiElementType_CheckBox: {
+        GUISystem::GUICheckBox* checkBox = new GUISystem::GUICheckBox(name);
+        GUISystem::GUICheckBoxTextures textures;
+        textures.textureName = texture(sElement, 0);
+        textures.textureNameHover = texture(sElement, 1);
+        textures.textureNameClicked = texture(sElement, 2);
+        textures.textureNameChecked = texture(sElement, 3);
+        textures.textureNameCheckedHover = texture(sElement, 4);
+        checkBox->SetTextures(textures);
+        element = checkBox;
+        break;
+    }
+    case SGuiElementType_TextCaption: {
+        GUISystem::GUITextCaption* caption = new GUISystem::GUITextCaption(name);
+        if (sElement->fontFace()) {
+            caption->SetFontFace(sElement->fontFace()->str());
+        }
+        if (sElement->fontSize() > 0.0f) {
+            caption->SetFontSize(sElement->fontSize());
+        }
+        if (sElement->text()) {
+            caption->SetText(sElement->text()->str());
+        }
+        element = caption;
+        break;
+    }
+    default:
+        printf("GuiScreenLayout: %s has an element of unknown type %u\n", path.c_str(), static_cast<uint32_t>(sElement->type()));
+        return nullptr;
+    }
+
+    GUISystem::ElementPos pos;
+    if (sElement->pos()) {
+        pos = GUISystem::ElementPos(sElement->pos()->x(), sElement->pos()->y(), sElement->pos()->offsetX(), sElement->pos()->offsetY());
+    }
+    pos.origin = static_cast<GUISystem::ORIGIN>(sElement->origin());
+    element->SetPosition(pos);
+    if (sElement->dim()) {
+        GUISystem::ElementDim dim(sElement->dim()->w(), sElement->dim()->h(), sElement->dim()->pixelW(), sElement->dim()->pixelH());
+        dim.AR = sElement->dim()->ar();
+        element->SetSize(dim);
+    }
+    if (sElement->maxW() || sElement->maxH()) {
+        element->SetMaxSize(sElement->maxW(), sElement->maxH());
+    }
+    if (sElement->color()) {
+        element->SetColor(sElement->color()->r(), sElement->color()->g(), sElement->color()->b(), sElement->color()->a());
+    }
+    if (!sElement->visible()) {
+        element->SetVisible(false);
+    }
+    return element;
+}
+
+GuiScreenLayout::~GuiScreenLayout()
+{
+    clear();
+}
+
+void GuiScreenLayout::clear()
+{
+    // the tree lets go of the elements before they are gone
+    flatTree.Build(std::vector<GUISystem::GUIElement*>());
+    for (GUISystem::GUIElement* element : elements) {
+        delete element;
+    }
+    elements.clear();
+    roots.clear();
+    names.clear();
+}
+
+bool GuiScreenLayout::Load(const std::string& path, const Bindings& bindings, const std::string& schemaPath)
+{
+    clear();
+
+    std::vector<uint8_t> parsed;
+    std::shared_ptr<const file::MappedFile> mapped;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    if (isJson(path)) {
+        std::string schema;
+        std::string json;
+        if (!file::readBinary(schemaPath.c_str(), schema) || !file::readBinary(path.c_str(), json)) {
+            printf("GuiScreenLayout: can not read %s or %s\n", schemaPath.c_str(), path.c_str());
+            return false;
+        }
+        const std::string schemaDirectory = schemaPath.substr(0, schemaPath.find_last_of("/\\") + 1);
+        const char* includePaths[] = { schemaDirectory.c_str(), nullptr };
+        flatbuffers::Parser parser;
+        if (!parser.Parse(schema.c_str(), includePaths, schemaPath.c_str()) || !parser.Parse(json.c_str(), includePaths, path.c_str())) {
+            printf("GuiScreenLayout: %s\n", parser.error_.c_str());
+            return false;
+        }
+        parsed.assign(parser.builder_.GetBufferPointer(), parser.builder_.GetBufferPointer() + parser.builder_.GetSize());
+        data = parsed.data();
+        size = parsed.size();
+    } else {
+        mapped = file::MappedFile::open(path.c_str());
+        if (!mapped) {
+            printf("GuiScreenLayout: can not open %s\n", path.c_str());
+            return false;
+        }
+        data = mapped->data();
+        size = mapped->size();
+    }
+
+    flatbuffers::Verifier verifier(data, size);
+    if (!SGuiScreenBufferHasIdentifier(data) || !VerifySGuiScreenBuffer(verifier)) {
+        printf("GuiScreenLayout: %s is not a GUI screen\n", path.c_str());
+        return false;
+    }
+    const SGuiScreen* sScreen = GetSGuiScreen(data);
+    const uint32_t count = sScreen->elements() ? sScreen->elements()->size() : 0;
+
+    std::vector<int> parents(count);
+    elements.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        const SGuiElement* sElement = sScreen->elements()->Get(i);
+        const int parent = sElement->parent();
+        if (parent >= static_cast<int>(i)) {
+            printf("GuiScreenLayout: element %u of %s comes before its parent %d\n", i, path.c_str(), parent);
+            clear();
+            return false;
+        }
+        GUISystem::GUIElement* element = createElement(sElement, bindings, path);
+        if (!element) {
+            clear();
+            return false;
+        }
+        elements.push_back(element);
+        // the first of a name stays
+        names.emplace(nameId(element->GetName()), element);
+        parents[i] = parent < 0 ? -1 : parent;
+        if (parent < 0) {
+            roots.push_back(element);
+        } else {
+            elements[parent]->AddChild(element);
+        }
+    }
+
+    flatTree.Build(elements, parents);
+    return true;
+}
+
+GUISystem::GUIElement* GuiScreenLayout::Find(StringId name) const
+{
+    auto it = names.find(name);
+    return it == names.end() ? nullptr : it->second;
+}
+
+GUISystem::GUIElement* GuiScreenLayout::Find(const std::string& name) const
+{
+    return Find(nameId(name));
+}
+} // End of namespace m3d
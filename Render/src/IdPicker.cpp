@@ -0,0 +1,170 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "IdPicker.hpp"
+#include "Pipeline.hpp"
+#include "vulkanDebug.h"
+
+#include <cstdio>
+
+namespace m3d {
+
+const uint32_t IdPicker::RegionSize;
+const uint32_t IdPicker::MaxPicks;
+
+// 8 bytes of Pipeline::IdFormat per texel
+static const vk::DeviceSize RegionBytes = IdPicker::RegionSize * IdPicker::RegionSize * 8;
+
+IdPicker::IdPicker(vk::Device& Device, MemoryAllocator& Allocator, uint32_t queueFamilyIndex, uint32_t framesInFlight)
+    : device(Device)
+    , allocator(Allocator)
+{
+    // re-recorded whenever the frame has picks
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    commandPool = device.createCommandPool(cmdPoolInfo);
+
+    vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+    cmdBufAllocateInfo.commandPool = commandPool;
+    cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    cmdBufAllocateInfo.commandBufferCount = framesInFlight;
+    std::vector<vk::CommandBuffer> commandBuffers = device.allocateCommandBuffers(cmdBufAllocateInfo);
+    frames.resize(framesInFlight);
+    for (uint32_t f = 0; f < framesInFlight; ++f) {
+        frames[f].commandBuffer = commandBuffers[f];
+        char name[32];
+        snprintf(name, sizeof(name), "id picks %u", f);
+        vkx::debug::marker::setName(device, frames[f].commandBuffer, name);
+    }
+
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = RegionBytes * MaxPicks * framesInFlight;
+    bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+    ring = device.createBuffer(bufferInfo);
+    vkx::debug::marker::setName(device, ring, "id pick readback");
+    // read by the CPU, cached where the device has it
+    ringMemory = allocator.AllocateBuffer(ring, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached,
+        MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+    if (!ringMemory) {
+        ringMemory = allocator.AllocateBuffer(ring, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+            MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+    }
+    if (!ringMemory) {
+        printf("IdPicker: out of memory for the readback ring\n");
+    }
+}
+
+IdPicker::~IdPicker()
+{
+    device.destroyBuffer(ring);
+    allocator.Free(ringMemory);
+    device.destroyCommandPool(commandPool);
+}
+
+bool IdPicker::Pick(uint32_t x, uint32_t y, Callback callback)
+{
+    if (queued.size() >= MaxPicks) {
+        return false;
+    }
+    Request request;
+    request.x = x;
+    request.y = y;
+    request.callback = callback;
+    queued.push_back(request);
+    return true;
+}
+
+bool IdPicker::Record(uint32_t f, vk::Image idImage, vk::Extent2D extent)
+{
+    Frame& frame = frames[f];
+    if (queued.empty() || !idImage || !ringMemory || extent.width == 0 || extent.height == 0) {
+        return false;
+    }
+
+    vk::CommandBuffer cmd = frame.commandBuffer;
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    cmd.begin(beginInfo);
+
+    // the render pass left it in TRANSFER_SRC_OPTIMAL, its dependency on later transfers covers the IDs
+    std::vector<vk::BufferImageCopy> regions;
+    for (const Request& request : queued) {
+        Copy copy;
+        copy.callback = request.callback;
+        copy.width = RegionSize < extent.width ? RegionSize : extent.width;
+        copy.height = RegionSize < extent.height ? RegionSize : extent.height;
+        // centered on the pick, shifted inwards at the edges of the scene
+        const uint32_t x = request.x < extent.width ? request.x : extent.width - 1;
+        const uint32_t y = request.y < extent.height ? request.y : extent.height - 1;
+        uint32_t left = x > RegionSize / 2 ? x - RegionSize / 2 : 0;
+        uint32_t top = y > RegionSize / 2 ? y - RegionSize / 2 : 0;
+        left = left + copy.width > extent.width ? extent.width - copy.width : left;
+        top = top + copy.height > extent.height ? extent.height - copy.height : top;
+        copy.x = x - left;
+        copy.y = y - top;
+
+        vk::BufferImageCopy region;
+        region.bufferOffset = (static_cast<vk::DeviceSize>(f) * MaxPicks + frame.copies.size()) * RegionBytes;
+        region.bufferRowLength = copy.width;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+        region.imageOffset = vk::Offset3D(static_cast<int32_t>(left), static_cast<int32_t>(top), 0);
+        region.imageExtent = vk::Extent3D(copy.width, copy.height, 1);
+        regions.push_back(region);
+        frame.copies.push_back(copy);
+    }
+    queued.clear();
+    cmd.copyImageToBuffer(idImage, vk::ImageLayout::eTransferSrcOptimal, ring, regions);
+
+    // the frame's serial makes the copies visible to the host once this is done
+    vk::BufferMemoryBarrier toHost;
+    toHost.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = ring;
+    toHost.offset = static_cast<vk::DeviceSize>(f) * MaxPicks * RegionBytes;
+    toHost.size = MaxPicks * RegionBytes;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, toHost, nullptr);
+
+    cmd.end();
+    return true;
+}
+
+void IdPicker::Resolve(uint32_t f)
+{
+    Frame& frame = frames[f];
+    const uint8_t* base = static_cast<const uint8_t*>(ringMemory.mapped) + static_cast<vk::DeviceSize>(f) * MaxPicks * RegionBytes;
+    for (uint32_t i = 0; i < frame.copies.size(); ++i) {
+        const Copy& copy = frame.copies[i];
+        const uint32_t* texels = reinterpret_cast<const uint32_t*>(base + i * RegionBytes);
+        // the texel under the pick, otherwise the closest one something was drawn into
+        uint32_t entry = Pipeline::InvalidId;
+        uint32_t primitive = Pipeline::InvalidId;
+        uint32_t nearest = ~0u;
+        for (uint32_t y = 0; y < copy.height; ++y) {
+            for (uint32_t x = 0; x < copy.width; ++x) {
+                const uint32_t* texel = texels + (y * copy.width + x) * 2;
+                if (texel[0] == Pipeline::InvalidId) {
+                    continue;
+                }
+                const int32_t dx = static_cast<int32_t>(x) - static_cast<int32_t>(copy.x);
+                const int32_t dy = static_cast<int32_t>(y) - static_cast<int32_t>(copy.y);
+                const uint32_t distance = static_cast<uint32_t>(dx * dx + dy * dy);
+                if (distance < nearest) {
+                    nearest = distance;
+                    entry = texel[0];
+                    primitive = texel[1];
+                }
+            }
+        }
+        if (copy.callback) {
+            copy.callback(entry, primitive);
+        }
+    }
+    frame.copies.clear();
+}
+} // End of namespace m3d
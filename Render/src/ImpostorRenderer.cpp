@@ -0,0 +1,602 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ImpostorRenderer.hpp"
+#include "CommandBuffer.hpp"
+#include "GeometryArena.hpp"
+#include "IndirectDraws.hpp"
+#include "MaterialTable.hpp"
+#include "Pipeline.hpp"
+#include "Scene.hpp"
+#include "SubmitTimeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t ImpostorRenderer::FramesPerSide;
+const uint32_t ImpostorRenderer::FrameSize;
+
+static const vk::Format AtlasFormat = vk::Format::eR8G8B8A8Unorm;
+static const uint32_t LayerSize = ImpostorRenderer::FramesPerSide * ImpostorRenderer::FrameSize;
+
+/* Unit direction of a point of the octahedral square [-1, 1]^2, the inverse of the encoding of Mesh::pack */
+static void decodeOctahedral(float x, float y, float n[3])
+{
+    n[0] = x;
+    n[1] = y;
+    n[2] = 1.0f - std::fabs(x) - std::fabs(y);
+    const float t = std::max(-n[2], 0.0f);
+    n[0] += n[0] >= 0.0f ? -t : t;
+    n[1] += n[1] >= 0.0f ? -t : t;
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    for (int c = 0; c < 3; ++c) {
+        n[c] /= length;
+    }
+}
+
+/* Screen axes of a view from forward, the same as impostor.vert builds */
+static void frameBasis(const float forward[3], float right[3], float up[3])
+{
+    const float worldUp[3] = { std::fabs(forward[1]) < 0.99f ? 0.0f : 1.0f, std::fabs(forward[1]) < 0.99f ? 1.0f : 0.0f, 0.0f };
+    // worldUp x forward
+    right[0] = worldUp[1] * forward[2] - worldUp[2] * forward[1];
+    right[1] = worldUp[2] * forward[0] - worldUp[0] * forward[2];
+    right[2] = worldUp[0] * forward[1] - worldUp[1] * forward[0];
+    const float length = std::sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+    for (int c = 0; c < 3; ++c) {
+        right[c] /= length;
+    }
+    // forward x right
+    up[0] = forward[1] * right[2] - forward[2] * right[1];
+    up[1] = forward[2] * right[0] - forward[0] * right[2];
+    up[2] = forward[0] * right[1] - forward[1] * right[0];
+}
+
+ImpostorRenderer::ImpostorRenderer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, PipelineRegistry& registry,
+    Pipeline& Pipeline, SubmitTimeline& Timeline, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t MaxMeshes, uint32_t MaxInstances,
+    uint32_t MinTriangles)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , pipeline(Pipeline)
+    , timeline(Timeline)
+    , maxMeshes(MaxMeshes)
+    , maxInstances(MaxInstances)
+    , minTriangles(MinTriangles)
+    , layerRevision(0)
+    , instanceCount(0)
+{
+    static_assert(sizeof(GpuImpostor) == 16, "impostor.vert reads 4 words per impostor");
+    static_assert(sizeof(GpuInstance) == 8, "impostor.vert reads 2 words per instance");
+    static_assert(sizeof(BakeConstants) == 80, "the bake shaders' push constants are 80 bytes");
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    commandPool = device.createCommandPool(poolInfo);
+    vk::CommandBufferAllocateInfo allocInfo;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = 1;
+    bakeCommands = device.allocateCommandBuffers(allocInfo)[0];
+    vkx::debug::marker::setName(device, bakeCommands, "impostor bakes");
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxMeshes * sizeof(GpuImpostor), impostors);
+    vkx::debug::marker::setName(device, impostors.buffer, "impostors");
+    slots.resize(slotCount);
+    for (Slot& slot : slots) {
+        createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostVisible, maxInstances * sizeof(GpuInstance), slot.instances);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, sizeof(vk::DrawIndirectCommand), slot.draw);
+        createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, hostVisible, 4 * sizeof(float), slot.frame);
+        vkx::debug::marker::setName(device, slot.instances.buffer, "impostor instances");
+        vkx::debug::marker::setName(device, slot.draw.buffer, "impostor draw");
+        vkx::debug::marker::setName(device, slot.frame.buffer, "impostor frame");
+        vk::DrawIndirectCommand* draw = static_cast<vk::DrawIndirectCommand*>(slot.draw.memory.mapped);
+        draw->vertexCount = 6;
+        draw->instanceCount = 0;
+        draw->firstVertex = 0;
+        draw->firstInstance = 0;
+        memset(slot.frame.memory.mapped, 0, 4 * sizeof(float));
+        slot.revision = 0;
+        slot.layerRevision = 0;
+    }
+
+    createAtlas();
+    createBakePipeline(registry);
+    createPipeline(registry);
+    writeDescriptors();
+    clearAtlas();
+    // taken from the back, the lowest layers first
+    freeLayers.reserve(maxMeshes);
+    for (uint32_t layer = maxMeshes; layer > 0; --layer) {
+        freeLayers.push_back(layer - 1);
+    }
+}
+
+ImpostorRenderer::~ImpostorRenderer()
+{
+    // the registry owns the pipelines and their layouts
+    timeline.Wait(submitted);
+    device.destroyCommandPool(commandPool);
+    device.destroyDescriptorPool(descriptorPool);
+    for (uint32_t layer = 0; layer < maxMeshes; ++layer) {
+        device.destroyFramebuffer(framebuffers[layer]);
+        device.destroyImageView(layerViews[layer]);
+    }
+    device.destroyImageView(atlasView);
+    device.destroyImage(atlas);
+    commandBuffer.GetAllocator().Free(atlasMemory);
+    device.destroyImageView(depthView);
+    device.destroyImage(depth);
+    commandBuffer.GetAllocator().Free(depthMemory);
+    device.destroySampler(sampler);
+    device.destroyRenderPass(bakePass);
+    for (Slot& slot : slots) {
+        destroyBuffer(slot.instances);
+        destroyBuffer(slot.draw);
+        destroyBuffer(slot.frame);
+    }
+    destroyBuffer(impostors);
+}
+
+void ImpostorRenderer::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory);
+    assert(buffer.memory && "out of device memory for impostors");
+}
+
+void ImpostorRenderer::destroyBuffer(Buffer& buffer)
+{
+    commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    buffer = Buffer();
+}
+
+void ImpostorRenderer::createAtlas()
+{
+    MemoryAllocator& allocator = commandBuffer.GetAllocator();
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = AtlasFormat;
+    imageInfo.extent = vk::Extent3D(LayerSize, LayerSize, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = maxMeshes;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    atlas = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, atlas, "impostor atlas");
+    atlasMemory = allocator.AllocateImage(atlas, vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Texture);
+    assert(atlasMemory && "out of device memory for the impostor atlas");
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = atlas;
+    viewInfo.viewType = vk::ImageViewType::e2DArray;
+    viewInfo.format = AtlasFormat;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, maxMeshes);
+    atlasView = device.createImageView(viewInfo);
+
+    // one layer's worth, the frames of a bake are drawn one after the other
+    vkhelper::getSupportedDepthFormat(physicalDevice, depthFormat);
+    imageInfo.format = depthFormat;
+    imageInfo.arrayLayers = 1;
+    imageInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    depth = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, depth, "impostor bake depth");
+    depthMemory = allocator.AllocateImage(depth, vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Attachment);
+    vk::ImageViewCreateInfo depthViewInfo;
+    depthViewInfo.image = depth;
+    depthViewInfo.viewType = vk::ImageViewType::e2D;
+    depthViewInfo.format = depthFormat;
+    depthViewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
+    depthView = device.createImageView(depthViewInfo);
+
+    // color and depth, cleared per layer; the depth is of no use after it
+    std::array<vk::AttachmentDescription, 2> attachments;
+    attachments[0].format = AtlasFormat;
+    attachments[0].samples = vk::SampleCountFlagBits::e1;
+    attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
+    attachments[0].storeOp = vk::AttachmentStoreOp::eStore;
+    attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[0].initialLayout = vk::ImageLayout::eUndefined;
+    attachments[0].finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    attachments[1].format = depthFormat;
+    attachments[1].samples = vk::SampleCountFlagBits::e1;
+    attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
+    attachments[1].storeOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachments[1].initialLayout = vk::ImageLayout::eUndefined;
+    attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+    vk::AttachmentReference colorReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+    vk::AttachmentReference depthReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorReference;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    // the previous bake's depth tests are done, frames submitted later sample what was drawn
+    std::array<vk::SubpassDependency, 2> dependencies;
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+    dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+    dependencies[0].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[0].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::RenderPassCreateInfo renderPassInfo;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+    bakePass = device.createRenderPass(renderPassInfo);
+    vkx::debug::marker::setName(device, bakePass, "impostor bake pass");
+
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    layerViews.resize(maxMeshes);
+    framebuffers.resize(maxMeshes);
+    for (uint32_t layer = 0; layer < maxMeshes; ++layer) {
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, layer, 1);
+        layerViews[layer] = device.createImageView(viewInfo);
+
+        const vk::ImageView views[2] = { layerViews[layer], depthView };
+        vk::FramebufferCreateInfo framebufferInfo;
+        framebufferInfo.renderPass = bakePass;
+        framebufferInfo.attachmentCount = 2;
+        framebufferInfo.pAttachments = views;
+        framebufferInfo.width = LayerSize;
+        framebufferInfo.height = LayerSize;
+        framebufferInfo.layers = 1;
+        framebuffers[layer] = device.createFramebuffer(framebufferInfo);
+    }
+
+    // frames are sampled a little larger than their texels at the impostor distance, no mips
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler = device.createSampler(samplerInfo);
+}
+
+void ImpostorRenderer::createBakePipeline(PipelineRegistry& registry)
+{
+    // set 0 for the materials and textures of the scene pipeline's set, the frame and material are pushed
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(BakeConstants));
+    bakeLayout = registry.GetPipelineLayout({ pipeline.GetDescriptorSetLayout() }, { pushConstantRange });
+
+    PipelineDesc desc;
+    desc.renderPass = bakePass;
+    desc.layout = bakeLayout;
+    desc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\impostor_bake.vert.spv";
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\impostor_bake.frag.spv";
+    desc.bindings = { PackedVertexFormat::Binding() };
+    desc.attributes = { PackedVertexFormat::Attribute(VertexSemantic::Position), PackedVertexFormat::Attribute(VertexSemantic::UV) };
+    bakeDesc = desc;
+}
+
+void ImpostorRenderer::createPipeline(PipelineRegistry& registry)
+{
+    // instances, impostors and the eye for the vertex shader, the atlas for the fragment shader
+    std::array<vk::DescriptorSetLayoutBinding, 4> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 2 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eVertex;
+    }
+    bindings[3].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[3].stageFlags = vk::ShaderStageFlagBits::eFragment;
+    setLayout = registry.GetDescriptorSetLayout(std::vector<vk::DescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+
+    // set 0 and the push constants as the scene pipeline has them, its camera stays bound across both
+    std::vector<vk::PushConstantRange> pushConstants;
+    if (pipeline.GetDrawConstantRange().size) {
+        pushConstants.push_back(pipeline.GetDrawConstantRange());
+    }
+    pipelineLayout = registry.GetPipelineLayout({ pipeline.GetDescriptorSetLayout(), setLayout }, pushConstants);
+
+    PipelineDesc desc;
+    desc.renderPass = pipeline.GetRenderPass();
+    desc.subpass = pipeline.GetShadingSubpass();
+    desc.samples = pipeline.GetSamples();
+    desc.colorAttachments = pipeline.GetColorAttachmentCount();
+    // picking an impostor picks its instance
+    desc.writeExtraAttachments = true;
+    desc.layout = pipelineLayout;
+    desc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\impostor.vert.spv";
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\impostor.frag.spv";
+    pipelineDesc = desc;
+    RefreshPipelines(registry);
+}
+
+void ImpostorRenderer::RefreshPipelines(PipelineRegistry& registry)
+{
+    bakePipeline = registry.Get(bakeDesc);
+    impostorPipeline = registry.Get(pipelineDesc);
+    vkx::debug::marker::setName(device, bakePipeline, "impostor bake");
+    vkx::debug::marker::setName(device, impostorPipeline, "impostors");
+}
+
+void ImpostorRenderer::writeDescriptors()
+{
+    const uint32_t slotCount = static_cast<uint32_t>(slots.size());
+    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2 * slotCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, slotCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, slotCount)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = slotCount;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(slotCount, setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = slotCount;
+    allocInfo.pSetLayouts = layouts.data();
+    std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    const vk::DescriptorImageInfo imageInfo(sampler, atlasView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        Slot& slot = slots[s];
+        slot.set = sets[s];
+
+        std::array<vk::DescriptorBufferInfo, 3> bufferInfos = {
+            vk::DescriptorBufferInfo(slot.instances.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(impostors.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.frame.buffer, 0, VK_WHOLE_SIZE)
+        };
+        std::vector<vk::WriteDescriptorSet> writes(4);
+        for (uint32_t i = 0; i < writes.size(); ++i) {
+            writes[i].dstSet = slot.set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            if (i == 3) {
+                writes[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+                writes[i].pImageInfo = &imageInfo;
+            } else {
+                writes[i].descriptorType = i == 2 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+        }
+        device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+void ImpostorRenderer::clearAtlas()
+{
+    bakeCommands.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, maxMeshes);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = atlas;
+    barrier.subresourceRange = range;
+    bakeCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    vk::ClearColorValue transparent;
+    bakeCommands.clearColorImage(atlas, vk::ImageLayout::eTransferDstOptimal, transparent, range);
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    bakeCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    bakeCommands.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &bakeCommands;
+    // ahead of the frame, in its vkQueueSubmit
+    submitted = timeline.Defer(submitInfo);
+}
+
+bool ImpostorRenderer::wantsImpostor(const Scene& scene, uint32_t meshID) const
+{
+    if (HasImpostor(meshID)) {
+        return false;
+    }
+    const Mesh& mesh = scene.meshes[meshID];
+    if (!mesh.resident || mesh.boundingSphere[3] <= 0.0f) {
+        return false;
+    }
+    uint32_t triangles = 0;
+    for (const Mesh::Slice& slice : mesh.slices) {
+        triangles += slice.triangleCount;
+    }
+    return triangles >= minTriangles;
+}
+
+bool ImpostorRenderer::HasUnbaked(const Scene& scene) const
+{
+    if (freeLayers.empty()) {
+        return false;
+    }
+    for (uint32_t meshID : scene.meshes) {
+        if (wantsImpostor(scene, meshID)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t ImpostorRenderer::Bake(Scene& scene, GeometryArena& geometry)
+{
+    if (!HasUnbaked(scene)) {
+        return 0;
+    }
+    // normally long done, the command buffer is recorded again
+    timeline.Wait(submitted);
+    bakeCommands.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    // the bake shaders read the materials and textures only, any slot's camera block will do
+    const uint32_t uniformOffset = pipeline.GetFrameOffset(0);
+    bakeCommands.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bakeLayout, 0, 1, &pipeline.GetDescriptorSet(), 1, &uniformOffset);
+
+    uint32_t baked = 0;
+    for (uint32_t meshID : scene.meshes) {
+        if (freeLayers.empty()) {
+            printf("ImpostorRenderer: all %u atlas layers in use, further meshes keep their LODs\n", maxMeshes);
+            break;
+        }
+        if (!wantsImpostor(scene, meshID)) {
+            continue;
+        }
+        const uint32_t layer = freeLayers.back();
+        freeLayers.pop_back();
+        bakeMesh(scene, geometry, meshID, layer);
+        meshLayers[meshID] = layer;
+        baked++;
+    }
+    bakeCommands.end();
+    layerRevision++;
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &bakeCommands;
+    // ahead of the frame, in its vkQueueSubmit
+    submitted = timeline.Defer(submitInfo);
+    return baked;
+}
+
+void ImpostorRenderer::Release(uint32_t meshID)
+{
+    std::unordered_map<uint32_t, uint32_t>::iterator found = meshLayers.find(meshID);
+    if (found == meshLayers.end()) {
+        return;
+    }
+    // frames in flight may still sample it, a bake must not draw over it before they completed
+    ReleasedLayer released;
+    released.submitted = timeline.GetSubmitted();
+    released.layer = found->second;
+    releasedLayers.push_back(released);
+    meshLayers.erase(found);
+    layerRevision++;
+}
+
+void ImpostorRenderer::bakeMesh(const Scene& scene, GeometryArena& geometry, uint32_t meshID, uint32_t layer)
+{
+    const Mesh& mesh = scene.meshes[meshID];
+    GpuImpostor& impostor = static_cast<GpuImpostor*>(impostors.memory.mapped)[layer];
+    memcpy(impostor.sphere, mesh.boundingSphere, sizeof(impostor.sphere));
+
+    std::array<vk::ClearValue, 2> clearValues;
+    clearValues[0].color = vk::ClearColorValue();
+    clearValues[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+    vk::RenderPassBeginInfo renderPassBeginInfo;
+    renderPassBeginInfo.renderPass = bakePass;
+    renderPassBeginInfo.framebuffer = framebuffers[layer];
+    renderPassBeginInfo.renderArea.extent = vk::Extent2D(LayerSize, LayerSize);
+    renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassBeginInfo.pClearValues = clearValues.data();
+    bakeCommands.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+    bakeCommands.bindPipeline(vk::PipelineBindPoint::eGraphics, bakePipeline);
+
+    const GeometryArena::Block& block = geometry.GetBlock(mesh.geometryBlock);
+    vk::DeviceSize offsets[1] = { 0 };
+    bakeCommands.bindVertexBuffers(0, 1, &block.buffer, offsets);
+    bakeCommands.bindIndexBuffer(block.buffer, 0, block.indexType);
+
+    const vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    BakeConstants constants;
+    memset(&constants, 0, sizeof(constants));
+    memcpy(constants.sphere, mesh.boundingSphere, sizeof(constants.sphere));
+    for (uint32_t j = 0; j < FramesPerSide; ++j) {
+        for (uint32_t i = 0; i < FramesPerSide; ++i) {
+            // the center of frame (i, j) on the octahedral square is the direction it is viewed from
+            const float x = (i + 0.5f) / FramesPerSide * 2.0f - 1.0f;
+            const float y = (j + 0.5f) / FramesPerSide * 2.0f - 1.0f;
+            decodeOctahedral(x, y, constants.forward);
+            frameBasis(constants.forward, constants.right, constants.up);
+
+            vk::Viewport viewport(static_cast<float>(i * FrameSize), static_cast<float>(j * FrameSize), static_cast<float>(FrameSize),
+                static_cast<float>(FrameSize), 0.0f, 1.0f);
+            vk::Rect2D scissor(vk::Offset2D(i * FrameSize, j * FrameSize), vk::Extent2D(FrameSize, FrameSize));
+            bakeCommands.setViewport(0, 1, &viewport);
+            bakeCommands.setScissor(0, 1, &scissor);
+            for (uint32_t s = 0; s < mesh.slices.size(); ++s) {
+                const Mesh::Slice& slice = mesh.slices[s];
+                constants.material = s < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[s]) : MaterialTable::InvalidIndex;
+                bakeCommands.pushConstants(bakeLayout, stages, 0, sizeof(constants), &constants);
+                bakeCommands.drawIndexed(slice.triangleCount * 3, 1, mesh.firstIndex + slice.indexOffset, mesh.vertexOffset, 0);
+            }
+        }
+    }
+    bakeCommands.endRenderPass();
+}
+
+void ImpostorRenderer::BeginFrame(uint32_t slotIndex, const Scene& scene, const IndirectDraws& draws, const float eye[3])
+{
+    Slot& slot = slots[slotIndex];
+    float* frame = static_cast<float*>(slot.frame.memory.mapped);
+    frame[0] = eye[0];
+    frame[1] = eye[1];
+    frame[2] = eye[2];
+
+    while (!releasedLayers.empty() && timeline.IsComplete(releasedLayers.front().submitted)) {
+        freeLayers.push_back(releasedLayers.front().layer);
+        releasedLayers.pop_front();
+    }
+
+    const std::vector<uint32_t>& entries = draws.GetImpostorEntries();
+    instanceCount = std::min(static_cast<uint32_t>(entries.size()), maxInstances);
+    if (slot.revision == draws.GetImpostorRevision() && slot.layerRevision == layerRevision) {
+        return;
+    }
+    GpuInstance* instances = static_cast<GpuInstance*>(slot.instances.memory.mapped);
+    uint32_t written = 0;
+    for (uint32_t e = 0; e < instanceCount; ++e) {
+        const uint32_t instanceID = draws.GetEntryInstance(entries[e]);
+        if (instanceID == IndirectDraws::NoInstance || !scene.instances.contains(instanceID)) {
+            continue;
+        }
+        std::unordered_map<uint32_t, uint32_t>::const_iterator found = meshLayers.find(scene.instances[instanceID].meshId);
+        if (found == meshLayers.end()) {
+            continue;
+        }
+        instances[written].transform = entries[e];
+        instances[written].layer = found->second;
+        written++;
+    }
+    instanceCount = written;
+    static_cast<vk::DrawIndirectCommand*>(slot.draw.memory.mapped)->instanceCount = written;
+    slot.revision = draws.GetImpostorRevision();
+    slot.layerRevision = layerRevision;
+}
+
+void ImpostorRenderer::Draw(vk::CommandBuffer cmd, uint32_t slotIndex) const
+{
+    const Slot& slot = slots[slotIndex];
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, impostorPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 1, 1, &slot.set, 0, nullptr);
+    // the instance count is the slot's, recorded once
+    cmd.drawIndirect(slot.draw.buffer, 0, 1, sizeof(vk::DrawIndirectCommand));
+}
+} // End of namespace m3d
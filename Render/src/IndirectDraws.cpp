@@ -0,0 +1,708 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "IndirectDraws.hpp"
+#include "BufferAddress.hpp"
+#include "GeometryArena.hpp"
+#include "GpuCulling.hpp"
+#include "ImpostorRenderer.hpp"
+#include "MaterialTable.hpp"
+#include "Pipeline.hpp"
+#include "Scene.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t IndirectDraws::NoMeshlet;
+const uint32_t IndirectDraws::NoDraw;
+const uint32_t IndirectDraws::NoInstance;
+const uint32_t IndirectDraws::ImpostorLod;
+
+// clean entries between two changed ones that are copied along rather than starting another region
+static const uint32_t RunGap = 4;
+// empty commands Update leaves in a batch for AddInstance, at least, or an eighth of its commands
+static const uint32_t BatchSlack = 16;
+
+IndirectDraws::IndirectDraws(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, UploadQueue& Upload, uint32_t MaxDraws, bool deviceAddresses)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , upload(Upload)
+    , maxDraws(MaxDraws)
+    , instancing(false)
+    , meshlets(false)
+    , meshletCones(false)
+    , transparency(false)
+    , culling(nullptr)
+    , pulling(nullptr)
+    , lodPixelScale(0.0f)
+    , lodMaxPixelError(1.0f)
+    , impostors(nullptr)
+    , impostorDistance(0.0f)
+    , impostorRevision(0)
+    , drawCount(0)
+    , triangleCount(0)
+{
+    lodEye[0] = lodEye[1] = lodEye[2] = 0.0f;
+    vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+    multiDraw = features.multiDrawIndirect == VK_TRUE;
+    firstInstance = features.drawIndirectFirstInstance == VK_TRUE;
+
+    // storage usage lets the culling pass read the commands as its source
+    createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eStorageBuffer,
+        maxDraws * sizeof(vk::DrawIndexedIndirectCommand), commandBuffer);
+    // read through their addresses with vertex pulling
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, maxDraws * sizeof(m3d::math::Matrix4x4), transformBuffer, deviceAddresses);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, maxDraws * sizeof(DrawInfo), drawInfoBuffer, deviceAddresses);
+    createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, maxDraws * sizeof(CullInfo), cullInfoBuffer);
+    vkx::debug::marker::setName(device, commandBuffer.buffer, "indirect commands");
+    vkx::debug::marker::setName(device, transformBuffer.buffer, "indirect transforms");
+    vkx::debug::marker::setName(device, drawInfoBuffer.buffer, "indirect draw infos");
+    vkx::debug::marker::setName(device, cullInfoBuffer.buffer, "indirect cull infos");
+}
+
+IndirectDraws::~IndirectDraws()
+{
+    for (DeviceBuffer* buffer : { &commandBuffer, &transformBuffer, &drawInfoBuffer, &cullInfoBuffer }) {
+        device.destroyBuffer(buffer->buffer);
+        device.freeMemory(buffer->memory);
+    }
+}
+
+void IndirectDraws::createBuffer(vk::BufferUsageFlags usage, vk::DeviceSize size, DeviceBuffer& buffer, bool address)
+{
+    vk::BufferCreateInfo bufferCreateInfo;
+    if (address) {
+        usage |= BufferAddress::Usage;
+    }
+    bufferCreateInfo.setUsage(usage | vk::BufferUsageFlagBits::eTransferDst);
+    bufferCreateInfo.setSize(size);
+    // the transfer queue writes it, the graphics queue reads it
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    if (sharingFamilies.size() > 1) {
+        bufferCreateInfo.setSharingMode(vk::SharingMode::eConcurrent);
+        bufferCreateInfo.setQueueFamilyIndexCount(static_cast<uint32_t>(sharingFamilies.size()));
+        bufferCreateInfo.setPQueueFamilyIndices(sharingFamilies.data());
+    }
+    buffer.buffer = device.createBuffer(bufferCreateInfo);
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(buffer.buffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (address) {
+        memAlloc.pNext = BufferAddress::GetAllocateFlags();
+    }
+    buffer.memory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+    buffer.address = address ? BufferAddress::Get(device, buffer.buffer) : 0;
+}
+
+/* World space sphere of an instance, returns the largest scale of its transform */
+static float worldSphere(const Mesh& mesh, const Transform& transform, const m3d::math::Matrix4x4& world, float sphere[4])
+{
+    for (int i = 0; i < 3; ++i) {
+        sphere[i] = world.m[i][0] * mesh.boundingSphere[0] + world.m[i][1] * mesh.boundingSphere[1]
+            + world.m[i][2] * mesh.boundingSphere[2] + world.m[i][3];
+    }
+    float maxScale = std::max(std::fabs(transform.scale.x), std::max(std::fabs(transform.scale.y), std::fabs(transform.scale.z)));
+    sphere[3] = mesh.boundingSphere[3] * maxScale;
+    return maxScale;
+}
+
+/* World space sphere and cone of a meshlet, the cone only survives rotation, uniform scale and translation */
+static void worldMeshlet(const Mesh::Meshlet& meshlet, const Transform& transform, const m3d::math::Matrix4x4& world, float maxScale, bool cones,
+    IndirectDraws::CullInfo& cullInfo)
+{
+    for (int i = 0; i < 3; ++i) {
+        cullInfo.sphere[i] = world.m[i][0] * meshlet.sphere[0] + world.m[i][1] * meshlet.sphere[1] + world.m[i][2] * meshlet.sphere[2] + world.m[i][3];
+    }
+    cullInfo.sphere[3] = meshlet.sphere[3] * maxScale;
+
+    cullInfo.cone[0] = cullInfo.cone[1] = cullInfo.cone[2] = 0.0f;
+    cullInfo.cone[3] = 1.0f;
+    const float minScale = std::min(std::fabs(transform.scale.x), std::min(std::fabs(transform.scale.y), std::fabs(transform.scale.z)));
+    const bool mirrored = transform.scale.x * transform.scale.y * transform.scale.z < 0.0f;
+    if (!cones || meshlet.coneCutoff >= 1.0f || mirrored || minScale <= 0.0f || maxScale > minScale * 1.001f) {
+        return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        cullInfo.cone[i] = (world.m[i][0] * meshlet.coneAxis[0] + world.m[i][1] * meshlet.coneAxis[1] + world.m[i][2] * meshlet.coneAxis[2]) / maxScale;
+    }
+    cullInfo.cone[3] = meshlet.coneCutoff;
+}
+
+void IndirectDraws::SetLodView(const float eye[3], float pixelScale, float maxPixelError)
+{
+    for (int c = 0; c < 3; ++c) {
+        lodEye[c] = eye[c];
+    }
+    lodPixelScale = pixelScale;
+    lodMaxPixelError = maxPixelError;
+}
+
+uint32_t IndirectDraws::selectLod(uint32_t meshID, const Mesh& mesh, const float sphere[4], float maxScale) const
+{
+    if (lodPixelScale <= 0.0f || (mesh.lods.empty() && !impostors)) {
+        return 0;
+    }
+    // distance to the closest point of the bounds, full resolution from inside
+    float distanceSq = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        distanceSq += (sphere[c] - lodEye[c]) * (sphere[c] - lodEye[c]);
+    }
+    const float distance = sqrtf(distanceSq) - sphere[3];
+    if (distance <= 0.0f) {
+        return 0;
+    }
+    if (impostors && distance >= impostorDistance && impostors->HasImpostor(meshID)) {
+        return ImpostorLod;
+    }
+    if (mesh.lods.empty()) {
+        return 0;
+    }
+    return mesh.SelectLod(lodPixelScale * maxScale / distance, lodMaxPixelError);
+}
+
+bool IndirectDraws::transparentSlice(const Scene& scene, const Mesh& mesh, uint32_t slice) const
+{
+    if (!transparency || slice >= mesh.materialIds.size() || !scene.materials.contains(mesh.materialIds[slice])) {
+        return false;
+    }
+    return scene.materials[mesh.materialIds[slice]].blend == Material::Blend::WeightedBlended;
+}
+
+bool IndirectDraws::LodSelectionChanged(const Scene& scene) const
+{
+    for (uint32_t entry = 0; entry < entryInstances.size(); ++entry) {
+        const uint32_t instanceID = entryInstances[entry];
+        if (instanceID == NoInstance || !scene.instances.contains(instanceID)) {
+            continue;
+        }
+        const Instance& instance = scene.instances[instanceID];
+        const Mesh& mesh = scene.meshes[instance.meshId];
+        float sphere[4];
+        float maxScale = worldSphere(mesh, scene.transforms[instance.transformId], scene.transformStore.GetWorld(instance.transformId), sphere);
+        if (selectLod(instance.meshId, mesh, sphere, maxScale) != entryLods[entry]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t IndirectDraws::buildDraws(const Scene& scene, uint32_t instanceID, uint32_t entry, PendingDraws& draws) const
+{
+    const Instance& instance = scene.instances[instanceID];
+    const Mesh& mesh = scene.meshes[instance.meshId];
+    // world space bounds shared by every slice of the instance
+    const Transform& transform = scene.transforms[instance.transformId];
+    const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(instance.transformId);
+    CullInfo cullInfo = {};
+    cullInfo.cone[3] = 1.0f;
+    float maxScale = worldSphere(mesh, transform, world, cullInfo.sphere);
+    const uint32_t lod = selectLod(instance.meshId, mesh, cullInfo.sphere, maxScale);
+    if (lod == ImpostorLod) {
+        return lod;
+    }
+    // a mesh that is a single meshlet per slice gains nothing from them
+    const bool byMeshlet = meshlets && lod == 0 && mesh.meshlets.size() > mesh.slices.size();
+    const size_t instanceCommands = byMeshlet ? mesh.meshlets.size() : mesh.slices.size();
+
+    // one command per slice, or per meshlet with its own bounds
+    const std::vector<Mesh::Slice>& slices = mesh.LodSlices(lod);
+    for (uint32_t i = 0; i < instanceCommands; ++i) {
+        const uint32_t s = byMeshlet ? mesh.meshlets[i].slice : i;
+        vk::DrawIndexedIndirectCommand command;
+        if (byMeshlet) {
+            const Mesh::Meshlet& meshlet = mesh.meshlets[i];
+            command.indexCount = meshlet.triangleCount * 3;
+            command.firstIndex = mesh.firstIndex + meshlet.indexOffset;
+            worldMeshlet(meshlet, transform, world, maxScale, meshletCones, cullInfo);
+        } else {
+            command.indexCount = slices[s].triangleCount * 3;
+            command.firstIndex = mesh.firstIndex + slices[s].indexOffset;
+        }
+        command.instanceCount = 1;
+        command.vertexOffset = mesh.vertexOffset;
+        // set once the command's final position is known
+        command.firstInstance = 0;
+        draws.commands.push_back(command);
+        draws.cullInfos.push_back(cullInfo);
+
+        DrawInfo drawInfo;
+        drawInfo.transform = entry;
+        drawInfo.material = s < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[s]) : MaterialTable::InvalidIndex;
+        draws.drawInfos.push_back(drawInfo);
+
+        DrawSource source;
+        source.entry = entry;
+        source.slice = s;
+        source.meshlet = byMeshlet ? i : NoMeshlet;
+        source.next = NoDraw;
+        draws.sources.push_back(source);
+    }
+    return lod;
+}
+
+void IndirectDraws::Update(Scene& scene)
+{
+    // group the commands per geometry block, one indirect draw call each; the opaque slices of block b at 2 * b,
+    // the transparent ones at 2 * b + 1
+    std::vector<PendingDraws> perBlock;
+    PendingDraws instanceDraws;
+    uint32_t commandCount = 0;
+    scene.transformStore.Update();
+    transforms.clear();
+    entryInstances.clear();
+    entryLods.clear();
+    impostorEntries.clear();
+    impostorRevision++;
+    freeEntries.clear();
+    instanceEntries.clear();
+
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        const Mesh& mesh = scene.meshes[instance.meshId];
+        if (!mesh.resident) {
+            continue;
+        }
+        const uint32_t entry = static_cast<uint32_t>(transforms.size());
+        instanceDraws = PendingDraws();
+        const uint32_t lod = buildDraws(scene, instanceID, entry, instanceDraws);
+        if (entry == maxDraws || commandCount + instanceDraws.commands.size() > maxDraws) {
+            printf("IndirectDraws: more than %u draws, dropping the rest\n", maxDraws);
+            break;
+        }
+        transforms.push_back(scene.transformStore.GetWorld(instance.transformId));
+        entryInstances.push_back(instanceID);
+        entryLods.push_back(static_cast<uint8_t>(lod));
+        instanceEntries[instanceID] = entry;
+        if (lod == ImpostorLod) {
+            impostorEntries.push_back(entry);
+        }
+
+        if (perBlock.size() <= 2 * mesh.geometryBlock + 1) {
+            perBlock.resize(2 * mesh.geometryBlock + 2);
+        }
+        for (uint32_t i = 0; i < instanceDraws.commands.size(); ++i) {
+            PendingDraws& blockDraws = perBlock[2 * mesh.geometryBlock + (transparentSlice(scene, mesh, instanceDraws.sources[i].slice) ? 1 : 0)];
+            blockDraws.commands.push_back(instanceDraws.commands[i]);
+            blockDraws.cullInfos.push_back(instanceDraws.cullInfos[i]);
+            blockDraws.drawInfos.push_back(instanceDraws.drawInfos[i]);
+            blockDraws.sources.push_back(instanceDraws.sources[i]);
+        }
+        commandCount += static_cast<uint32_t>(instanceDraws.commands.size());
+    }
+
+    // empty commands for AddInstance, as many as fit
+    const bool editable = firstInstance && !instancing;
+    uint32_t spare = maxDraws - commandCount;
+
+    commands.clear();
+    batches.clear();
+    batchFree.clear();
+    cullInfos.clear();
+    drawInfos.clear();
+    drawSources.clear();
+    entryFirstDraw.assign(transforms.size(), NoDraw);
+    std::vector<uint32_t> order;
+    for (uint32_t group = 0; group < perBlock.size(); ++group) {
+        PendingDraws& blockDraws = perBlock[group];
+        if (blockDraws.commands.empty()) {
+            continue;
+        }
+        std::vector<vk::DrawIndexedIndirectCommand>& blockCommands = blockDraws.commands;
+        order.resize(blockCommands.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        if (instancing) {
+            // the instances of a slice next to each other, in scene order
+            std::stable_sort(order.begin(), order.end(), [&blockCommands](uint32_t a, uint32_t b) {
+                const vk::DrawIndexedIndirectCommand& ca = blockCommands[a];
+                const vk::DrawIndexedIndirectCommand& cb = blockCommands[b];
+                if (ca.vertexOffset != cb.vertexOffset) {
+                    return ca.vertexOffset < cb.vertexOffset;
+                }
+                if (ca.firstIndex != cb.firstIndex) {
+                    return ca.firstIndex < cb.firstIndex;
+                }
+                return ca.indexCount < cb.indexCount;
+            });
+        }
+
+        Batch batch;
+        batch.block = group / 2;
+        batch.transparent = group % 2 != 0;
+        batch.firstCommand = static_cast<uint32_t>(commands.size());
+        // one draw info per instance slice, equal to the command index unless draws are merged
+        for (uint32_t i : order) {
+            const uint32_t draw = static_cast<uint32_t>(drawInfos.size());
+            CullInfo cullInfo = blockDraws.cullInfos[i];
+            cullInfo.batch = static_cast<uint32_t>(batches.size());
+            cullInfo.batchFirst = batch.firstCommand;
+            cullInfos.push_back(cullInfo);
+            drawInfos.push_back(blockDraws.drawInfos[i]);
+            DrawSource source = blockDraws.sources[i];
+            source.next = entryFirstDraw[source.entry];
+            entryFirstDraw[source.entry] = draw;
+            drawSources.push_back(source);
+
+            vk::DrawIndexedIndirectCommand& command = blockCommands[i];
+            command.firstInstance = draw;
+            if (instancing && commands.size() > batch.firstCommand) {
+                vk::DrawIndexedIndirectCommand& last = commands.back();
+                if (last.vertexOffset == command.vertexOffset && last.firstIndex == command.firstIndex && last.indexCount == command.indexCount) {
+                    // gl_InstanceIndex walks the consecutive draw infos
+                    ++last.instanceCount;
+                    continue;
+                }
+            }
+            commands.push_back(command);
+        }
+
+        batchFree.emplace_back();
+        if (editable) {
+            const uint32_t used = static_cast<uint32_t>(commands.size()) - batch.firstCommand;
+            const uint32_t slack = std::min(spare, std::max(BatchSlack, used / 8));
+            spare -= slack;
+            for (uint32_t i = 0; i < slack; ++i) {
+                const uint32_t draw = static_cast<uint32_t>(commands.size());
+                commands.push_back(vk::DrawIndexedIndirectCommand());
+                cullInfos.push_back(CullInfo());
+                cullInfos.back().batch = static_cast<uint32_t>(batches.size());
+                cullInfos.back().batchFirst = batch.firstCommand;
+                drawInfos.push_back(DrawInfo());
+                drawSources.push_back(DrawSource());
+                freeDraw(draw);
+            }
+        }
+        batch.commandCount = static_cast<uint32_t>(commands.size()) - batch.firstCommand;
+        batches.push_back(batch);
+    }
+
+    drawCount = static_cast<uint32_t>(commands.size());
+    triangleCount = 0;
+    for (const vk::DrawIndexedIndirectCommand& command : commands) {
+        triangleCount += command.indexCount / 3 * command.instanceCount;
+    }
+
+    // the entries of every transform slot, for UploadChanges
+    slotEntries.clear();
+    for (uint32_t entry = 0; entry < transforms.size(); ++entry) {
+        slotEntries.push_back(std::make_pair(TransformStore::Slot(scene.instances[entryInstances[entry]].transformId), entry));
+    }
+    std::sort(slotEntries.begin(), slotEntries.end());
+    // all of it goes out below, what moved or was edited before is in there
+    scene.transformStore.TakeMoved(movedSlots);
+    movedSlots.clear();
+    dirtyEntries.clear();
+    dirtyDraws.clear();
+    dirtyCommands.clear();
+
+    if (drawCount > 0) {
+        upload.CopyToBuffer(commands.data(), drawCount * sizeof(vk::DrawIndexedIndirectCommand), commandBuffer.buffer, 0);
+        upload.CopyToBuffer(cullInfos.data(), cullInfos.size() * sizeof(CullInfo), cullInfoBuffer.buffer, 0);
+        upload.CopyToBuffer(drawInfos.data(), drawInfos.size() * sizeof(DrawInfo), drawInfoBuffer.buffer, 0);
+    }
+    if (!transforms.empty()) {
+        upload.CopyToBuffer(transforms.data(), transforms.size() * sizeof(m3d::math::Matrix4x4), transformBuffer.buffer, 0);
+    }
+}
+
+void IndirectDraws::freeDraw(uint32_t draw)
+{
+    // draws nothing, and culling copies it as it is
+    vk::DrawIndexedIndirectCommand& command = commands[draw];
+    triangleCount -= command.indexCount / 3 * command.instanceCount;
+    command = vk::DrawIndexedIndirectCommand();
+    command.firstInstance = draw;
+    CullInfo& cullInfo = cullInfos[draw];
+    std::fill(cullInfo.sphere, cullInfo.sphere + 4, 0.0f);
+    std::fill(cullInfo.cone, cullInfo.cone + 3, 0.0f);
+    cullInfo.cone[3] = 1.0f;
+    drawInfos[draw].transform = 0;
+    drawInfos[draw].material = MaterialTable::InvalidIndex;
+    drawSources[draw].entry = NoInstance;
+    drawSources[draw].next = NoDraw;
+    batchFree[cullInfo.batch].push_back(draw);
+    dirtyDraws.push_back(draw);
+    dirtyCommands.push_back(draw);
+}
+
+bool IndirectDraws::AddInstance(Scene& scene, uint32_t instanceID)
+{
+    const Instance& instance = scene.instances[instanceID];
+    const Mesh& mesh = scene.meshes[instance.meshId];
+    if (!mesh.resident) {
+        // the Update after its geometry landed draws it
+        return true;
+    }
+    if (!firstInstance || instancing || (freeEntries.empty() && transforms.size() == maxDraws)) {
+        return false;
+    }
+
+    scene.transformStore.Update();
+    const uint32_t entry = freeEntries.empty() ? static_cast<uint32_t>(transforms.size()) : freeEntries.back();
+    PendingDraws draws;
+    const uint32_t lod = buildDraws(scene, instanceID, entry, draws);
+    // the batch of every draw, opaque and transparent slices of the block have their own
+    std::vector<uint32_t> drawBatches(draws.commands.size());
+    std::vector<uint32_t> needed(batches.size(), 0);
+    for (uint32_t i = 0; i < draws.commands.size(); ++i) {
+        const bool transparent = transparentSlice(scene, mesh, draws.sources[i].slice);
+        auto batch = std::find_if(batches.begin(), batches.end(),
+            [&mesh, transparent](const Batch& b) { return b.block == mesh.geometryBlock && b.transparent == transparent; });
+        if (batch == batches.end()) {
+            return false;
+        }
+        drawBatches[i] = static_cast<uint32_t>(batch - batches.begin());
+        if (++needed[drawBatches[i]] > batchFree[drawBatches[i]].size()) {
+            return false;
+        }
+    }
+    if (freeEntries.empty()) {
+        transforms.emplace_back();
+        entryInstances.push_back(NoInstance);
+        entryLods.push_back(0);
+        entryFirstDraw.push_back(NoDraw);
+    } else {
+        freeEntries.pop_back();
+    }
+    transforms[entry] = scene.transformStore.GetWorld(instance.transformId);
+    entryInstances[entry] = instanceID;
+    entryLods[entry] = static_cast<uint8_t>(lod);
+    instanceEntries[instanceID] = entry;
+    if (lod == ImpostorLod) {
+        impostorEntries.push_back(entry);
+        impostorRevision++;
+    }
+    const std::pair<uint32_t, uint32_t> slotEntry(TransformStore::Slot(instance.transformId), entry);
+    slotEntries.insert(std::upper_bound(slotEntries.begin(), slotEntries.end(), slotEntry), slotEntry);
+    dirtyEntries.push_back(entry);
+
+    for (uint32_t i = 0; i < draws.commands.size(); ++i) {
+        std::vector<uint32_t>& free = batchFree[drawBatches[i]];
+        const uint32_t draw = free.back();
+        free.pop_back();
+        vk::DrawIndexedIndirectCommand& command = commands[draw];
+        command = draws.commands[i];
+        command.firstInstance = draw;
+        triangleCount += command.indexCount / 3;
+        // the place in the batch stays
+        CullInfo& cullInfo = cullInfos[draw];
+        const uint32_t cullBatch = cullInfo.batch;
+        const uint32_t batchFirst = cullInfo.batchFirst;
+        cullInfo = draws.cullInfos[i];
+        cullInfo.batch = cullBatch;
+        cullInfo.batchFirst = batchFirst;
+        drawInfos[draw] = draws.drawInfos[i];
+        drawSources[draw] = draws.sources[i];
+        drawSources[draw].next = entryFirstDraw[entry];
+        entryFirstDraw[entry] = draw;
+        dirtyDraws.push_back(draw);
+        dirtyCommands.push_back(draw);
+    }
+    return true;
+}
+
+bool IndirectDraws::RemoveInstance(uint32_t instanceID)
+{
+    auto found = instanceEntries.find(instanceID);
+    if (found == instanceEntries.end()) {
+        // never drawn
+        return true;
+    }
+    if (!firstInstance || instancing) {
+        return false;
+    }
+    const uint32_t entry = found->second;
+    instanceEntries.erase(found);
+    for (uint32_t draw = entryFirstDraw[entry]; draw != NoDraw;) {
+        const uint32_t next = drawSources[draw].next;
+        freeDraw(draw);
+        draw = next;
+    }
+    entryFirstDraw[entry] = NoDraw;
+    entryInstances[entry] = NoInstance;
+    if (entryLods[entry] == ImpostorLod) {
+        impostorEntries.erase(std::find(impostorEntries.begin(), impostorEntries.end(), entry));
+        impostorRevision++;
+    }
+    freeEntries.push_back(entry);
+    // the scene may have erased the instance already, its transform slot is not known
+    slotEntries.erase(std::find_if(slotEntries.begin(), slotEntries.end(),
+        [entry](const std::pair<uint32_t, uint32_t>& slotEntry) { return slotEntry.second == entry; }));
+    return true;
+}
+
+bool IndirectDraws::UpdateMaterials(const Scene& scene, uint32_t meshID)
+{
+    const Mesh& mesh = scene.meshes[meshID];
+    bool inPlace = true;
+    for (uint32_t entry = 0; entry < entryInstances.size(); ++entry) {
+        const uint32_t instanceID = entryInstances[entry];
+        if (instanceID == NoInstance || !scene.instances.contains(instanceID) || scene.instances[instanceID].meshId != meshID) {
+            continue;
+        }
+        for (uint32_t draw = entryFirstDraw[entry]; draw != NoDraw; draw = drawSources[draw].next) {
+            const uint32_t slice = drawSources[draw].slice;
+            drawInfos[draw].material = slice < mesh.materialIds.size() ? MaterialTable::GpuIndex(mesh.materialIds[slice]) : MaterialTable::InvalidIndex;
+            dirtyDraws.push_back(draw);
+            inPlace = inPlace && batches[cullInfos[draw].batch].transparent == transparentSlice(scene, mesh, slice);
+        }
+    }
+    return inPlace;
+}
+
+/* Runs of sorted indices, each (first, count); gaps of up to RunGap are copied along */
+static void coalesce(std::vector<uint32_t>& indices, std::vector<std::pair<uint32_t, uint32_t>>& runs)
+{
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    runs.clear();
+    for (uint32_t index : indices) {
+        if (!runs.empty() && index <= runs.back().first + runs.back().second + RunGap) {
+            runs.back().second = index + 1 - runs.back().first;
+        } else {
+            runs.push_back(std::make_pair(index, 1u));
+        }
+    }
+}
+
+/* Stage the runs of source and copy them, one region per run */
+template <class T>
+static vk::DeviceSize copyRuns(UploadQueue& upload, const std::vector<T>& source, const std::vector<std::pair<uint32_t, uint32_t>>& runs, vk::Buffer dst)
+{
+    vk::DeviceSize size = 0;
+    for (const auto& run : runs) {
+        size += run.second * sizeof(T);
+    }
+    if (size == 0) {
+        return 0;
+    }
+    UploadQueue::Staging staged = upload.Stage(size);
+    std::vector<vk::BufferCopy> regions;
+    regions.reserve(runs.size());
+    vk::DeviceSize offset = 0;
+    for (const auto& run : runs) {
+        const vk::DeviceSize bytes = run.second * sizeof(T);
+        memcpy(staged.data + offset, &source[run.first], bytes);
+        regions.push_back(vk::BufferCopy(offset, run.first * sizeof(T), bytes));
+        offset += bytes;
+    }
+    upload.CopyToBuffer(staged, dst, regions);
+    return size;
+}
+
+vk::DeviceSize IndirectDraws::UploadChanges(Scene& scene)
+{
+    scene.transformStore.Update();
+    scene.transformStore.TakeMoved(movedSlots);
+    // both sorted by slot, one walk finds the entries of every moved slot
+    std::sort(movedSlots.begin(), movedSlots.end());
+    auto slotEntry = slotEntries.begin();
+    for (uint32_t slot : movedSlots) {
+        slotEntry = std::lower_bound(slotEntry, slotEntries.end(), std::make_pair(slot, 0u));
+        for (; slotEntry != slotEntries.end() && slotEntry->first == slot; ++slotEntry) {
+            const uint32_t entry = slotEntry->second;
+            if (!scene.instances.contains(entryInstances[entry])) {
+                continue;
+            }
+            const Instance& instance = scene.instances[entryInstances[entry]];
+            const Mesh& mesh = scene.meshes[instance.meshId];
+            const Transform& transform = scene.transforms[instance.transformId];
+            const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(instance.transformId);
+            transforms[entry] = world;
+            dirtyEntries.push_back(entry);
+            float sphere[4];
+            float maxScale = worldSphere(mesh, transform, world, sphere);
+            for (uint32_t draw = entryFirstDraw[entry]; draw != NoDraw; draw = drawSources[draw].next) {
+                CullInfo& cullInfo = cullInfos[draw];
+                if (drawSources[draw].meshlet != NoMeshlet) {
+                    worldMeshlet(mesh.meshlets[drawSources[draw].meshlet], transform, world, maxScale, meshletCones, cullInfo);
+                } else {
+                    memcpy(cullInfo.sphere, sphere, sizeof(sphere));
+                }
+                dirtyDraws.push_back(draw);
+            }
+        }
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    coalesce(dirtyEntries, runs);
+    vk::DeviceSize staged = copyRuns(upload, transforms, runs, transformBuffer.buffer);
+    coalesce(dirtyDraws, runs);
+    staged += copyRuns(upload, cullInfos, runs, cullInfoBuffer.buffer);
+    staged += copyRuns(upload, drawInfos, runs, drawInfoBuffer.buffer);
+    coalesce(dirtyCommands, runs);
+    staged += copyRuns(upload, commands, runs, commandBuffer.buffer);
+    dirtyEntries.clear();
+    dirtyDraws.clear();
+    dirtyCommands.clear();
+    return staged;
+}
+
+void IndirectDraws::Draw(vk::CommandBuffer cmd, GeometryArena& geometry, bool transparent) const
+{
+    const uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+    vk::DeviceSize offsets[1] = { 0 };
+    // the culling pass writes the same layout, compacted per batch when it can count draws
+    vk::Buffer drawBuffer = culling ? culling->GetCulledCommandBuffer() : commandBuffer.buffer;
+    if (pulling) {
+        Pipeline::PullConstants constants;
+        constants.transforms = transformBuffer.address;
+        constants.drawInfos = drawInfoBuffer.address;
+        pulling->PushPullConstants(cmd, constants);
+    }
+
+    for (uint32_t b = 0; b < batches.size(); ++b) {
+        const Batch& batch = batches[b];
+        if (batch.transparent != transparent) {
+            continue;
+        }
+        const GeometryArena::Block& block = geometry.GetBlock(batch.block);
+        // the index buffer stays bound either way, indexed draws keep the post transform cache
+        if (pulling) {
+            pulling->PushVertexAddress(cmd, block.address);
+        } else {
+            cmd.bindVertexBuffers(0, 1, &block.buffer, offsets);
+        }
+        cmd.bindIndexBuffer(block.buffer, 0, block.indexType);
+
+        if (culling && culling->IsCompacting()) {
+            culling->DrawIndexedIndirectCount(cmd, batch.firstCommand * stride, b, batch.commandCount, stride);
+        } else if (!firstInstance) {
+            // indirect commands need firstInstance == 0 here, replay them as direct draws
+            for (uint32_t i = batch.firstCommand; i < batch.firstCommand + batch.commandCount; ++i) {
+                const vk::DrawIndexedIndirectCommand& c = commands[i];
+                cmd.drawIndexed(c.indexCount, c.instanceCount, c.firstIndex, c.vertexOffset, c.firstInstance);
+            }
+        } else if (multiDraw) {
+            cmd.drawIndexedIndirect(drawBuffer, batch.firstCommand * stride, batch.commandCount, stride);
+        } else {
+            for (uint32_t i = batch.firstCommand; i < batch.firstCommand + batch.commandCount; ++i) {
+                cmd.drawIndexedIndirect(drawBuffer, i * stride, 1, stride);
+            }
+        }
+    }
+}
+
+vk::DescriptorBufferInfo IndirectDraws::GetTransformDescriptor() const
+{
+    return vk::DescriptorBufferInfo(transformBuffer.buffer, 0, maxDraws * sizeof(m3d::math::Matrix4x4));
+}
+
+vk::DescriptorBufferInfo IndirectDraws::GetDrawInfoDescriptor() const
+{
+    return vk::DescriptorBufferInfo(drawInfoBuffer.buffer, 0, maxDraws * sizeof(DrawInfo));
+}
+} // End of namespace m3d
@@ -0,0 +1,295 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "InstanceBvh.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace m3d {
+
+namespace {
+    const uint32_t BinCount = 12;
+}
+
+const uint32_t InstanceBvh::MaxLeafSize;
+
+Aabb InstanceBvh::instanceBounds(const Scene& scene, uint32_t instanceID) const
+{
+    const Instance& instance = scene.instances[instanceID];
+    if (!scene.meshes.contains(instance.meshId) || !scene.transformStore.Contains(instance.transformId)) {
+        return Aabb();
+    }
+    return scene.meshes[instance.meshId].bounds.Transformed(scene.transformStore.GetWorld(instance.transformId));
+}
+
+void InstanceBvh::Build(const Scene& scene, ThreadPool* pool)
+{
+    nodes.clear();
+    instances.resize(scene.instances.size());
+    boxes.resize(scene.instances.size());
+    // straight over the packed ids, every range writes its own part of the arrays
+    auto gather = [this, &scene](uint32_t first, uint32_t last) {
+        while (first < last) {
+            uint32_t count = last - first;
+            const uint32_t* ids = scene.instances.id_span(first, &count);
+            for (uint32_t i = 0; i < count; ++i) {
+                instances[first + i] = ids[i];
+                boxes[first + i] = instanceBounds(scene, ids[i]);
+            }
+            first += count;
+        }
+    };
+    if (pool) {
+        scene.instances.parallel_for_ranges(*pool, gather);
+    } else {
+        gather(0, static_cast<uint32_t>(instances.size()));
+    }
+    if (instances.empty()) {
+        return;
+    }
+    nodes.reserve(2 * instances.size() / MaxLeafSize + 1);
+    build(0, static_cast<uint32_t>(instances.size()));
+    // in leaf order, once build is done moving them
+    for (int c = 0; c < 3; ++c) {
+        lower[c].resize(boxes.size());
+        upper[c].resize(boxes.size());
+    }
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+        storeBox(i);
+    }
+}
+
+void InstanceBvh::storeBox(uint32_t i)
+{
+    for (int c = 0; c < 3; ++c) {
+        lower[c][i] = boxes[i].lower[c];
+        upper[c][i] = boxes[i].upper[c];
+    }
+}
+
+uint32_t InstanceBvh::build(uint32_t begin, uint32_t end)
+{
+    const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node());
+
+    Aabb bounds, centers;
+    for (uint32_t i = begin; i < end; ++i) {
+        bounds.Expand(boxes[i]);
+        if (!boxes[i].Empty()) {
+            float center[3] = { boxes[i].Center(0), boxes[i].Center(1), boxes[i].Center(2) };
+            centers.Expand(center);
+        }
+    }
+    nodes[nodeIndex].bounds = bounds;
+
+    const uint32_t count = end - begin;
+    int axis = 0;
+    float extent = 0.0f;
+    if (!centers.Empty()) {
+        for (int c = 0; c < 3; ++c) {
+            if (centers.upper[c] - centers.lower[c] > extent) {
+                extent = centers.upper[c] - centers.lower[c];
+                axis = c;
+            }
+        }
+    }
+    if (count <= MaxLeafSize || extent <= 0.0f) {
+        nodes[nodeIndex].offset = begin;
+        nodes[nodeIndex].count = count;
+        return nodeIndex;
+    }
+
+    // binned SAH along the widest centroid axis
+    struct Bin {
+        Aabb bounds;
+        uint32_t count = 0;
+    } bins[BinCount];
+    const float scale = BinCount / extent;
+    auto binOf = [&](const Aabb& box) {
+        const float center = box.Empty() ? centers.lower[axis] : box.Center(axis);
+        return std::min(BinCount - 1, static_cast<uint32_t>((center - centers.lower[axis]) * scale));
+    };
+    for (uint32_t i = begin; i < end; ++i) {
+        Bin& bin = bins[binOf(boxes[i])];
+        bin.bounds.Expand(boxes[i]);
+        ++bin.count;
+    }
+
+    // right to left sweep first, then pick the cheapest split on the way back
+    float rightArea[BinCount];
+    uint32_t rightCount[BinCount];
+    Aabb sweep;
+    uint32_t sweepCount = 0;
+    for (uint32_t b = BinCount - 1; b > 0; --b) {
+        sweep.Expand(bins[b].bounds);
+        sweepCount += bins[b].count;
+        rightArea[b] = sweep.SurfaceArea();
+        rightCount[b] = sweepCount;
+    }
+    uint32_t split = 0;
+    float bestCost = FLT_MAX;
+    sweep = Aabb();
+    sweepCount = 0;
+    for (uint32_t b = 1; b < BinCount; ++b) {
+        sweep.Expand(bins[b - 1].bounds);
+        sweepCount += bins[b - 1].count;
+        if (sweepCount == 0 || rightCount[b] == 0) {
+            continue;
+        }
+        const float cost = sweep.SurfaceArea() * sweepCount + rightArea[b] * rightCount[b];
+        if (cost < bestCost) {
+            bestCost = cost;
+            split = b;
+        }
+    }
+
+    uint32_t middle = begin;
+    if (split != 0) {
+        for (uint32_t i = begin; i < end; ++i) {
+            if (binOf(boxes[i]) < split) {
+                std::swap(boxes[i], boxes[middle]);
+                std::swap(instances[i], instances[middle]);
+                ++middle;
+            }
+        }
+    }
+    if (middle == begin || middle == end) {
+        // degenerate bins, fall back to halving
+        middle = begin + count / 2;
+    }
+
+    build(begin, middle);
+    const uint32_t right = build(middle, end);
+    nodes[nodeIndex].offset = right;
+    nodes[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+void InstanceBvh::Refit(const Scene& scene)
+{
+    // children are stored after their parent
+    for (uint32_t n = static_cast<uint32_t>(nodes.size()); n-- > 0;) {
+        Node& node = nodes[n];
+        node.bounds = Aabb();
+        if (node.count == 0) {
+            node.bounds.Expand(nodes[n + 1].bounds);
+            node.bounds.Expand(nodes[node.offset].bounds);
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            boxes[i] = instanceBounds(scene, instances[i]);
+            storeBox(i);
+            node.bounds.Expand(boxes[i]);
+        }
+    }
+}
+
+const Aabb& InstanceBvh::GetBounds() const
+{
+    static const Aabb empty;
+    return nodes.empty() ? empty : nodes[0].bounds;
+}
+
+void InstanceBvh::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& instanceIDs) const
+{
+    if (nodes.empty()) {
+        return;
+    }
+    // left child on top, the stack never gets deeper than the tree
+    std::vector<uint32_t> stack(1, 0);
+    std::vector<uint32_t> visible;
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.bounds.Empty() || !frustum.Intersects(node.bounds)) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(static_cast<uint32_t>(&node - nodes.data()) + 1);
+            continue;
+        }
+        // the leaf's boxes in one go, empty ones are rejected as well
+        const float* leafLower[3] = { &lower[0][node.offset], &lower[1][node.offset], &lower[2][node.offset] };
+        const float* leafUpper[3] = { &upper[0][node.offset], &upper[1][node.offset], &upper[2][node.offset] };
+        visible.resize((node.count + 31) / 32);
+        m3d::math::FrustumCullArray(frustum, leafLower, leafUpper, node.count, visible.data());
+        for (uint32_t i = 0; i < node.count; ++i) {
+            if (visible[i / 32] & (1u << (i % 32))) {
+                instanceIDs.push_back(instances[node.offset + i]);
+            }
+        }
+    }
+}
+
+void InstanceBvh::QueryBox(const Aabb& box, std::vector<uint32_t>& instanceIDs) const
+{
+    if (nodes.empty() || box.Empty()) {
+        return;
+    }
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.bounds.Empty() || !node.bounds.Overlaps(box)) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(static_cast<uint32_t>(&node - nodes.data()) + 1);
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            if (!boxes[i].Empty() && boxes[i].Overlaps(box)) {
+                instanceIDs.push_back(instances[i]);
+            }
+        }
+    }
+}
+
+bool InstanceBvh::Raycast(const float origin[3], const float direction[3], float maxT, uint32_t* instanceID, float* hitT) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+    float invDirection[3];
+    for (int c = 0; c < 3; ++c) {
+        invDirection[c] = direction[c] != 0.0f ? 1.0f / direction[c] : (direction[c] < 0.0f ? -FLT_MAX : FLT_MAX);
+    }
+
+    bool hit = false;
+    float closest = maxT;
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.bounds.Empty() || !node.bounds.Intersects(origin, invDirection, closest, nullptr)) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack.push_back(node.offset);
+            stack.push_back(static_cast<uint32_t>(&node - nodes.data()) + 1);
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+            float t;
+            if (!boxes[i].Empty() && boxes[i].Intersects(origin, invDirection, closest, &t)) {
+                closest = t;
+                hit = true;
+                if (instanceID) {
+                    *instanceID = instances[i];
+                }
+            }
+        }
+    }
+    if (hit && hitT) {
+        *hitT = closest;
+    }
+    return hit;
+}
+} // End of namespace m3d
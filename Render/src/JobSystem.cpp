@@ -0,0 +1,313 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "JobSystem.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace m3d {
+
+// the system and index of the worker running on this thread
+static thread_local const JobSystem* currentSystem = nullptr;
+static thread_local uint32_t currentIndex = 0;
+
+// Lock mutex, counting the lock and whether another thread held it
+template <class Counters>
+static std::unique_lock<std::mutex> lockCounted(std::mutex& mutex, Counters& counters)
+{
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    counters.locks.fetch_add(1, std::memory_order_relaxed);
+    if (!lock.owns_lock()) {
+        counters.contended.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+    }
+    return lock;
+}
+
+JobSystem::JobSystem(uint32_t workerCount, Priority placement, int node)
+    : mainThread(std::this_thread::get_id())
+    , split(false)
+    // one node is no node, big and little placement still applies
+    , numaNode(cpu::GetTopology().nodeCount > 1 && node < static_cast<int>(cpu::GetTopology().nodeCount) ? node : -1)
+    , queued(0)
+    , mainQueued(0)
+    , nextWorker(0)
+    , stop(false)
+{
+    const cpu::Topology& topology = cpu::GetTopology();
+    const uint32_t bigCores = topology.Count(cpu::CoreClass::Big);
+    const uint32_t littleCores = topology.Count(cpu::CoreClass::Little);
+    if (workerCount == 0) {
+        uint32_t cores = static_cast<uint32_t>(topology.cores.size()) - 1;
+        if (numaNode >= 0) {
+            cores = std::max(1u, static_cast<uint32_t>(topology.NodeCores(static_cast<uint32_t>(numaNode)).size())) - 1;
+        } else if (topology.heterogeneous && placement != Priority::Normal) {
+            cores = placement == Priority::High ? bigCores : littleCores;
+        }
+        workerCount = std::max(1u, cores);
+    }
+    // big workers first, multi socket servers have no little cores to place them on
+    uint32_t bigWorkers = 0;
+    if (topology.heterogeneous && numaNode < 0) {
+        if (placement == Priority::High) {
+            bigWorkers = workerCount;
+        } else if (placement == Priority::Normal) {
+            bigWorkers = std::min(std::max(bigCores, 2u) - 1, workerCount - 1);
+        }
+        split = placement == Priority::Normal && bigWorkers > 0 && bigWorkers < workerCount;
+    }
+    // a Normal system too small to split runs wherever the OS puts it
+    const bool pinned = topology.heterogeneous && numaNode < 0 && (placement != Priority::Normal || split);
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back(new Worker());
+        if (pinned) {
+            workers.back()->cores = i < bigWorkers ? cpu::CoreClass::Big : cpu::CoreClass::Little;
+        }
+    }
+    // every deque exists before the first worker may steal from it
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+void JobSystem::Run(std::function<void()> job, Counter* counter, Priority priority)
+{
+    if (counter) {
+        counter->value.fetch_add(1);
+    }
+
+    const uint32_t workerCount = GetWorkerCount();
+    const uint32_t self = currentWorker();
+    uint32_t target = self;
+    if (target >= workerCount || !accepts(target, priority)) {
+        // a split system has workers of either class, one of the next workerCount takes it
+        do {
+            target = nextWorker.fetch_add(1) % workerCount;
+        } while (!accepts(target, priority));
+    }
+    Worker& worker = *workers[target];
+    {
+        std::unique_lock<std::mutex> lock = lockCounted(worker.mutex, countersOf(self));
+        worker.jobs.push_back(Job{ std::move(job), counter, priority });
+        queued.fetch_add(1);
+    }
+    notify();
+}
+
+void JobSystem::RunOnMainThread(std::function<void()> job, Counter* counter)
+{
+    if (counter) {
+        counter->value.fetch_add(1);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        mainJobs.push_back(Job{ std::move(job), counter, Priority::Normal });
+        mainQueued.fetch_add(1);
+    }
+    notify();
+}
+
+void JobSystem::WaitFor(Counter& counter)
+{
+    const uint32_t self = currentWorker();
+    const bool onMain = IsMainThread();
+    while (!counter.Done()) {
+        if (onMain && tryRunMain()) {
+            continue;
+        }
+        if (tryRunOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleep(lock, countersOf(self), [this, &counter, onMain]() {
+            return counter.Done() || queued.load() > 0 || (onMain && mainQueued.load() > 0);
+        });
+    }
+}
+
+void JobSystem::PumpMainThread()
+{
+    // jobs the pumped ones queue wait for the next pump
+    for (uint32_t count = mainQueued.load(); count > 0 && tryRunMain(); --count) {
+    }
+}
+
+bool JobSystem::accepts(uint32_t self, Priority priority) const
+{
+    if (!split || self >= workers.size() || priority == Priority::Normal) {
+        return true;
+    }
+    return (priority == Priority::High) == (workers[self]->cores == cpu::CoreClass::Big);
+}
+
+bool JobSystem::tryRunOne(uint32_t self)
+{
+    const uint32_t workerCount = GetWorkerCount();
+    Counters& counters = countersOf(self);
+    Job job;
+    bool found = false;
+    if (self < workerCount) {
+        Worker& own = *workers[self];
+        std::unique_lock<std::mutex> lock = lockCounted(own.mutex, counters);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued.fetch_sub(1);
+            found = true;
+        }
+    }
+    // steal the oldest job, the one furthest from what its owner works on
+    for (uint32_t i = 0; i < workerCount && !found; ++i) {
+        const uint32_t victimIndex = (self + 1 + i) % workerCount;
+        Worker& victim = *workers[victimIndex];
+        std::unique_lock<std::mutex> lock = lockCounted(victim.mutex, counters);
+        // jobs only ever go to deques of workers that take them, the own deque needs no check
+        if (!victim.jobs.empty() && accepts(self, victim.jobs.front().priority)) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued.fetch_sub(1);
+            // the last one tried is the worker's own deque again
+            if (victimIndex != self) {
+                counters.steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    execute(job, counters);
+    return true;
+}
+
+bool JobSystem::tryRunMain()
+{
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        if (mainJobs.empty()) {
+            return false;
+        }
+        job = std::move(mainJobs.front());
+        mainJobs.pop_front();
+        mainQueued.fetch_sub(1);
+    }
+    execute(job, external);
+    return true;
+}
+
+void JobSystem::execute(Job& job, Counters& counters)
+{
+    {
+        M3D_TRACE_ZONE("job");
+        job.run();
+    }
+    counters.jobs.fetch_add(1, std::memory_order_relaxed);
+    if (job.counter && job.counter->value.fetch_sub(1) == 1) {
+        notify();
+    }
+}
+
+void JobSystem::notify()
+{
+    // taking the lock orders the change before a sleeper's predicate check
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_all();
+}
+
+uint32_t JobSystem::currentWorker() const
+{
+    return currentSystem == this ? currentIndex : GetWorkerCount();
+}
+
+void JobSystem::workerLoop(uint32_t index)
+{
+    currentSystem = this;
+    currentIndex = index;
+    M3D_TRACE_THREAD("JobSystem worker");
+    if (numaNode >= 0) {
+        cpu::BindCurrentThread(numaNode);
+    } else {
+        cpu::PinCurrentThread(workers[index]->cores);
+    }
+    for (;;) {
+        if (tryRunOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        if (stop && queued.load() == 0) {
+            return;
+        }
+        sleep(lock, workers[index]->counters, [this]() { return stop || queued.load() > 0; });
+    }
+}
+
+template <class Predicate>
+void JobSystem::sleep(std::unique_lock<std::mutex>& lock, Counters& counters, Predicate predicate)
+{
+    if (predicate()) {
+        return;
+    }
+    auto tStart = std::chrono::steady_clock::now();
+    wake.wait(lock, predicate);
+    const auto slept = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart);
+    counters.idleNs.fetch_add(static_cast<uint64_t>(slept.count()), std::memory_order_relaxed);
+}
+
+JobSystem::Stats JobSystem::GetStats(uint32_t index) const
+{
+    const Counters& counters = index < workers.size() ? workers[index]->counters : external;
+    Stats stats;
+    stats.jobs = counters.jobs.load(std::memory_order_relaxed);
+    stats.steals = counters.steals.load(std::memory_order_relaxed);
+    stats.locks = counters.locks.load(std::memory_order_relaxed);
+    stats.contended = counters.contended.load(std::memory_order_relaxed);
+    stats.idleMs = counters.idleNs.load(std::memory_order_relaxed) / 1000000.0;
+    return stats;
+}
+
+JobSystem::Stats JobSystem::GetStats() const
+{
+    Stats total;
+    for (uint32_t i = 0; i <= GetWorkerCount(); ++i) {
+        const Stats stats = GetStats(i);
+        total.jobs += stats.jobs;
+        total.steals += stats.steals;
+        total.locks += stats.locks;
+        total.contended += stats.contended;
+        total.idleMs += stats.idleMs;
+    }
+    return total;
+}
+
+void JobSystem::ResetStats()
+{
+    for (uint32_t i = 0; i <= GetWorkerCount(); ++i) {
+        Counters& counters = countersOf(i);
+        counters.jobs.store(0, std::memory_order_relaxed);
+        counters.steals.store(0, std::memory_order_relaxed);
+        counters.locks.store(0, std::memory_order_relaxed);
+        counters.contended.store(0, std::memory_order_relaxed);
+        counters.idleNs.store(0, std::memory_order_relaxed);
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,217 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MaterialTable.hpp"
+#include "Pipeline.hpp"
+#include "SamplerCache.hpp"
+#include "Scene.hpp"
+#include "TextureArrays.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t MaterialTable::MaxMaterials;
+const uint32_t MaterialTable::InvalidIndex;
+
+MaterialTable::MaterialTable(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, UploadQueue& Upload, SamplerCache& Samplers, Pipeline& BindlessPipeline,
+    TextureArrays* Arrays)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , upload(Upload)
+    , samplers(Samplers)
+    , pipeline(BindlessPipeline)
+    , arrays(Arrays)
+    , white()
+{
+    const vk::DeviceSize size = MaxMaterials * sizeof(GpuMaterial);
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(vk::BufferUsageFlagBits::eStorageBuffer);
+    bufferCreateInfo.setSize(size);
+    materialBuffer = device.createBuffer(bufferCreateInfo);
+    vkx::debug::marker::setName(device, materialBuffer, "materials");
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(materialBuffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    materialMemory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(materialBuffer, materialMemory, 0);
+    materials = static_cast<GpuMaterial*>(device.mapMemory(materialMemory, 0, size));
+    memset(materials, 0, size);
+    writtenIDs.assign(MaxMaterials, InvalidIndex);
+    pipeline.SetMaterials(vk::DescriptorBufferInfo(materialBuffer, 0, size));
+
+    if (arrays) {
+        // binding 4 holds the arrays, written by Flush
+        return;
+    }
+    // every element has to be valid, the array as a whole is statically used
+    createWhiteTexture();
+    textures.assign(Pipeline::MaxTextures, white.descriptor);
+    pipeline.SetTextures(0, textures);
+}
+
+MaterialTable::~MaterialTable()
+{
+    device.unmapMemory(materialMemory);
+    device.destroyBuffer(materialBuffer);
+    device.freeMemory(materialMemory);
+
+    device.destroyImageView(white.view);
+    device.destroyImage(white.image);
+    device.freeMemory(white.deviceMemory);
+}
+
+void MaterialTable::createWhiteTexture()
+{
+    white.width = 1;
+    white.height = 1;
+    white.mipLevels = 1;
+    white.layerCount = 1;
+    white.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = vk::Format::eR8G8B8A8Unorm;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(1, 1, 1);
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    white.image = device.createImage(imageCreateInfo);
+    vkx::debug::marker::setName(device, white.image, "white texture");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(white.image);
+    vk::MemoryAllocateInfo memAllocInfo;
+    memAllocInfo.allocationSize = memReqs.size;
+    memAllocInfo.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    white.deviceMemory = device.allocateMemory(memAllocInfo);
+    device.bindImageMemory(white.image, white.deviceMemory, 0);
+
+    const uint32_t texel = 0xFFFFFFFF;
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = vk::Extent3D(1, 1, 1);
+    upload.CopyToImage(&texel, sizeof(texel), white.image, std::vector<vk::BufferImageCopy>(1, region),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), white.imageLayout);
+    // sampled by the first frame, only happens once at startup
+    upload.Submit();
+    upload.WaitIdle();
+
+    white.sampler = samplers.Get(vk::Filter::eNearest, vk::SamplerAddressMode::eRepeat, 1.0f);
+
+    vk::ImageViewCreateInfo view;
+    view.viewType = vk::ImageViewType::e2D;
+    view.format = imageCreateInfo.format;
+    view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+    view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    view.image = white.image;
+    white.view = device.createImageView(view);
+
+    white.descriptor.imageLayout = white.imageLayout;
+    white.descriptor.imageView = white.view;
+    white.descriptor.sampler = white.sampler;
+}
+
+uint32_t MaterialTable::GpuIndex(uint32_t materialID)
+{
+    const uint32_t slot = materialID & chunked_freelist<Material>::index_mask;
+    return slot < MaxMaterials ? slot : InvalidIndex;
+}
+
+void MaterialTable::Update(const Scene& scene)
+{
+    for (uint32_t materialID : scene.materials) {
+        const uint32_t slot = GpuIndex(materialID);
+        if (slot == InvalidIndex) {
+            continue;
+        }
+        const Material& material = scene.materials[materialID];
+        writtenIDs[slot] = materialID;
+        GpuMaterial& gpuMaterial = materials[slot];
+        for (int c = 0; c < 3; ++c) {
+            gpuMaterial.diffuse[c] = material.diffuse[c];
+        }
+        // the coverage weighted blended draws composite with, opaque ones ignore it
+        gpuMaterial.diffuse[3] = material.opacity;
+
+        // sampled as white until the streamer's tail landed
+        gpuMaterial.texture = InvalidIndex;
+        gpuMaterial.layer = 0;
+        if (scene.diffuseMaps.contains(material.diffuseMapId)) {
+            const uint32_t textureID = scene.diffuseMaps[material.diffuseMapId].textureID;
+            if (arrays && arrays->GetArray(textureID) != TextureArrays::InvalidLayer) {
+                // or until its layer's upload completed
+                gpuMaterial.texture = arrays->GetArray(textureID);
+                gpuMaterial.layer = arrays->GetLayer(textureID);
+            } else if (!arrays && textureID < Pipeline::MaxTextures) {
+                gpuMaterial.texture = textureID;
+            }
+        }
+    }
+}
+
+void MaterialTable::SetTexture(uint32_t textureID, const vkext::VulkanTexture& texture)
+{
+    if (arrays) {
+        // packed from the streamer's levels by Flush, a layer is never released
+        if (texture.view) {
+            pendingTextures.push_back(textureID);
+        }
+        return;
+    }
+    if (textureID >= Pipeline::MaxTextures) {
+        return;
+    }
+    textures[textureID] = texture.view ? texture.descriptor : white.descriptor;
+    pendingTextures.push_back(textureID);
+}
+
+bool MaterialTable::HasPendingWrites() const
+{
+    // completed array uploads change the materials pointing at them
+    return !pendingTextures.empty() || (arrays && arrays->HasChanges());
+}
+
+void MaterialTable::Flush()
+{
+    if (arrays) {
+        for (uint32_t textureID : pendingTextures) {
+            arrays->Add(textureID);
+        }
+        pendingTextures.clear();
+        if (arrays->TakeChanges()) {
+            pipeline.SetTextures(0, arrays->GetDescriptors());
+        }
+        return;
+    }
+
+    // one write per run of consecutive elements
+    std::sort(pendingTextures.begin(), pendingTextures.end());
+    pendingTextures.erase(std::unique(pendingTextures.begin(), pendingTextures.end()), pendingTextures.end());
+    for (size_t first = 0; first < pendingTextures.size();) {
+        size_t last = first + 1;
+        while (last < pendingTextures.size() && pendingTextures[last] == pendingTextures[last - 1] + 1) {
+            ++last;
+        }
+        const uint32_t element = pendingTextures[first];
+        pipeline.SetTextures(element, std::vector<vk::DescriptorImageInfo>(textures.begin() + element, textures.begin() + element + (last - first)));
+        first = last;
+    }
+    pendingTextures.clear();
+}
+} // End of namespace m3d
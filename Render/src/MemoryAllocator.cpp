@@ -0,0 +1,543 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MemoryAllocator.hpp"
+#include "PerfLint.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+namespace m3d {
+
+const vk::DeviceSize MemoryAllocator::DefaultBlockSize;
+const vk::DeviceSize MemoryAllocator::MinBuddySize;
+const uint32_t MemoryAllocator::InvalidIndex;
+const uint32_t MemoryAllocator::CategoryCount;
+
+// VK_KHR_get_physical_device_properties2 and VK_EXT_memory_budget postdate the vulkan headers
+static const VkStructureType PhysicalDeviceMemoryProperties2Type = static_cast<VkStructureType>(1000059006);
+static const VkStructureType PhysicalDeviceMemoryBudgetPropertiesType = static_cast<VkStructureType>(1000237000);
+
+struct PhysicalDeviceMemoryBudgetProperties {
+    VkStructureType sType;
+    void* pNext;
+    VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+};
+
+struct PhysicalDeviceMemoryProperties2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceMemoryProperties2)(VkPhysicalDevice physicalDevice, PhysicalDeviceMemoryProperties2* properties);
+
+// VK_KHR_device_group's, core in 1.1; VK_KHR_buffer_device_address added the device address bit
+static const VkStructureType MemoryAllocateFlagsInfoType = static_cast<VkStructureType>(1000060000);
+static const VkFlags MemoryAllocateDeviceAddress = 0x2;
+
+struct MemoryAllocateFlagsInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkFlags flags;
+    uint32_t deviceMask;
+};
+
+static MemoryAllocateFlagsInfo deviceAddressFlags()
+{
+    MemoryAllocateFlagsInfo flagsInfo = {};
+    flagsInfo.sType = MemoryAllocateFlagsInfoType;
+    flagsInfo.flags = MemoryAllocateDeviceAddress;
+    return flagsInfo;
+}
+
+const char* MemoryAllocator::GetCategoryName(Category category)
+{
+    switch (category) {
+    case Category::Mesh:
+        return "meshes";
+    case Category::Texture:
+        return "textures";
+    case Category::Attachment:
+        return "attachments";
+    case Category::Staging:
+        return "staging";
+    case Category::AccelerationStructure:
+        return "acceleration structures";
+    default:
+        return "other";
+    }
+}
+
+MemoryAllocator::MemoryAllocator(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, vk::DeviceSize BlockSize)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , maxOrder(0)
+    , mappableDeviceLocal(false)
+{
+    memoryProperties = physicalDevice.getMemoryProperties();
+    separateKinds = physicalDevice.getProperties().limits.bufferImageGranularity > 1;
+
+    // unified memory or resizable BAR: the mappable type covers all of video memory
+    vk::DeviceSize deviceLocalSize = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+            deviceLocalSize = std::max(deviceLocalSize, memoryProperties.memoryHeaps[i].size);
+        }
+    }
+    const vk::MemoryPropertyFlags mappable = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible
+        | vk::MemoryPropertyFlagBits::eHostCoherent;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        const vk::MemoryType& type = memoryProperties.memoryTypes[i];
+        if ((type.propertyFlags & mappable) == mappable && memoryProperties.memoryHeaps[type.heapIndex].size >= deviceLocalSize) {
+            mappableDeviceLocal = true;
+        }
+    }
+
+    while ((MinBuddySize << maxOrder) < BlockSize) {
+        ++maxOrder;
+    }
+    blockSize = MinBuddySize << maxOrder;
+
+    dedicatedCounts.assign(VK_MAX_MEMORY_TYPES, 0);
+    dedicatedBytes.assign(VK_MAX_MEMORY_TYPES, 0);
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    for (auto& pool : pools) {
+        for (auto& block : pool.blocks) {
+            releaseBlock(block);
+        }
+    }
+    for (uint32_t type = 0; type < dedicatedCounts.size(); ++type) {
+        if (dedicatedCounts[type] > 0) {
+            printf("MemoryAllocator: %u dedicated allocations of memory type %u were not freed\n", dedicatedCounts[type], type);
+        }
+    }
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, vk::MemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    return InvalidIndex;
+}
+
+uint32_t MemoryAllocator::findPool(uint32_t memoryTypeIndex, Strategy strategy, ResourceKind kind)
+{
+    // without a granularity both kinds may share pages
+    if (!separateKinds) {
+        kind = ResourceKind::Linear;
+    }
+    for (uint32_t i = 0; i < pools.size(); ++i) {
+        if (pools[i].memoryTypeIndex == memoryTypeIndex && pools[i].strategy == strategy && pools[i].kind == kind) {
+            return i;
+        }
+    }
+    Pool pool;
+    pool.memoryTypeIndex = memoryTypeIndex;
+    pool.strategy = strategy;
+    pool.kind = kind;
+    pools.push_back(pool);
+    return static_cast<uint32_t>(pools.size() - 1);
+}
+
+uint32_t MemoryAllocator::createBlock(Pool& pool)
+{
+    Block block = {};
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = blockSize;
+    memAlloc.memoryTypeIndex = pool.memoryTypeIndex;
+    MemoryAllocateFlagsInfo flagsInfo = deviceAddressFlags();
+    if (deviceAddress) {
+        memAlloc.pNext = &flagsInfo;
+    }
+    try {
+        block.memory = device.allocateMemory(memAlloc);
+    } catch (const std::exception& e) {
+        printf("MemoryAllocator: can not allocate a block of memory type %u: %s\n", pool.memoryTypeIndex, e.what());
+        return InvalidIndex;
+    }
+    if (memoryProperties.memoryTypes[pool.memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        block.mapped = static_cast<uint8_t*>(device.mapMemory(block.memory, 0, blockSize));
+    }
+    if (pool.strategy == Strategy::Buddy) {
+        block.freeRanges.resize(maxOrder + 1);
+        block.freeRanges[maxOrder].insert(0);
+    }
+
+    // reuse the slot of a released block, allocations keep their block index
+    for (uint32_t i = 0; i < pool.blocks.size(); ++i) {
+        if (!pool.blocks[i].memory) {
+            pool.blocks[i] = block;
+            return i;
+        }
+    }
+    pool.blocks.push_back(block);
+    return static_cast<uint32_t>(pool.blocks.size() - 1);
+}
+
+void MemoryAllocator::releaseBlock(Block& block)
+{
+    if (!block.memory) {
+        return;
+    }
+    if (block.mapped) {
+        device.unmapMemory(block.memory);
+    }
+    device.freeMemory(block.memory);
+    block = Block();
+}
+
+bool MemoryAllocator::allocateBuddy(Block& block, uint32_t order, vk::DeviceSize* offset)
+{
+    uint32_t from = order;
+    while (from <= maxOrder && block.freeRanges[from].empty()) {
+        ++from;
+    }
+    if (from > maxOrder) {
+        return false;
+    }
+    // lowest offset first keeps the live ranges packed towards the start
+    vk::DeviceSize start = *block.freeRanges[from].begin();
+    block.freeRanges[from].erase(block.freeRanges[from].begin());
+    // split down, the upper halves become free ranges of the lower orders
+    while (from > order) {
+        --from;
+        block.freeRanges[from].insert(start + (MinBuddySize << from));
+    }
+    *offset = start;
+    return true;
+}
+
+void MemoryAllocator::freeBuddy(Block& block, vk::DeviceSize offset, uint32_t order)
+{
+    // merge with the buddy as long as it is free as a whole
+    while (order < maxOrder) {
+        const vk::DeviceSize buddy = offset ^ (MinBuddySize << order);
+        auto it = block.freeRanges[order].find(buddy);
+        if (it == block.freeRanges[order].end()) {
+            break;
+        }
+        block.freeRanges[order].erase(it);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    block.freeRanges[order].insert(offset);
+}
+
+MemoryAllocator::Allocation MemoryAllocator::Allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties,
+    ResourceKind kind, Strategy strategy, Category category)
+{
+    Allocation allocation;
+    allocation.category = category;
+    const uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+    if (memoryTypeIndex == InvalidIndex) {
+        printf("MemoryAllocator: no memory type for bits 0x%x\n", requirements.memoryTypeBits);
+        return allocation;
+    }
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.size = requirements.size;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // big resources would waste most of a block
+    if (requirements.size > blockSize / 2 || (properties & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+        vk::MemoryAllocateInfo memAlloc;
+        memAlloc.allocationSize = requirements.size;
+        memAlloc.memoryTypeIndex = memoryTypeIndex;
+        MemoryAllocateFlagsInfo flagsInfo = deviceAddressFlags();
+        if (deviceAddress) {
+            memAlloc.pNext = &flagsInfo;
+        }
+        try {
+            allocation.memory = device.allocateMemory(memAlloc);
+            perflint::Allocate(memAlloc.allocationSize, "MemoryAllocator::Allocate");
+        } catch (const std::exception& e) {
+            printf("MemoryAllocator: can not allocate %llu bytes: %s\n", static_cast<unsigned long long>(requirements.size), e.what());
+            return Allocation();
+        }
+        if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible) {
+            allocation.mapped = device.mapMemory(allocation.memory, 0, requirements.size);
+        }
+        dedicatedCounts[memoryTypeIndex]++;
+        dedicatedBytes[memoryTypeIndex] += requirements.size;
+        categories[static_cast<uint32_t>(category)].allocations++;
+        categories[static_cast<uint32_t>(category)].bytes += requirements.size;
+        return allocation;
+    }
+
+    allocation.pool = findPool(memoryTypeIndex, strategy, kind);
+    Pool& pool = pools[allocation.pool];
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(requirements.alignment, 1);
+
+    // buddy ranges are aligned to their own size, one as large as the alignment satisfies it
+    uint32_t order = 0;
+    const vk::DeviceSize rangeSize = std::max(requirements.size, alignment);
+    while ((MinBuddySize << order) < rangeSize) {
+        ++order;
+    }
+
+    for (uint32_t attempt = 0; attempt < 2; ++attempt) {
+        for (uint32_t i = 0; i < pool.blocks.size(); ++i) {
+            Block& block = pool.blocks[i];
+            if (!block.memory) {
+                continue;
+            }
+            vk::DeviceSize offset = 0;
+            if (strategy == Strategy::Buddy) {
+                if (!allocateBuddy(block, order, &offset)) {
+                    continue;
+                }
+                allocation.order = order;
+            } else {
+                offset = (block.cursor + alignment - 1) / alignment * alignment;
+                if (offset + requirements.size > blockSize) {
+                    continue;
+                }
+                block.cursor = offset + requirements.size;
+            }
+            block.liveAllocations++;
+            block.usedBytes += requirements.size;
+            allocation.memory = block.memory;
+            allocation.offset = offset;
+            allocation.block = i;
+            if (block.mapped) {
+                allocation.mapped = block.mapped + offset;
+            }
+            categories[static_cast<uint32_t>(category)].allocations++;
+            categories[static_cast<uint32_t>(category)].bytes += requirements.size;
+            return allocation;
+        }
+        // every block is full, add one and retry
+        if (attempt == 0 && createBlock(pool) == InvalidIndex) {
+            break;
+        }
+    }
+    return Allocation();
+}
+
+MemoryAllocator::Allocation MemoryAllocator::AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties, Strategy strategy, Category category)
+{
+    Allocation allocation = Allocate(device.getBufferMemoryRequirements(buffer), properties, ResourceKind::Linear, strategy, category);
+    if (allocation) {
+        device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    }
+    return allocation;
+}
+
+MemoryAllocator::Allocation MemoryAllocator::AllocateImage(vk::Image image, vk::MemoryPropertyFlags properties, bool optimalTiling, Strategy strategy,
+    Category category)
+{
+    Allocation allocation = Allocate(device.getImageMemoryRequirements(image), properties,
+        optimalTiling ? ResourceKind::Optimal : ResourceKind::Linear, strategy, category);
+    if (allocation) {
+        device.bindImageMemory(image, allocation.memory, allocation.offset);
+    }
+    return allocation;
+}
+
+bool MemoryAllocator::SupportsImage(vk::Image image, vk::MemoryPropertyFlags properties) const
+{
+    return findMemoryType(device.getImageMemoryRequirements(image).memoryTypeBits, properties) != InvalidIndex;
+}
+
+void MemoryAllocator::Free(const Allocation& allocation)
+{
+    if (!allocation) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    categories[static_cast<uint32_t>(allocation.category)].allocations--;
+    categories[static_cast<uint32_t>(allocation.category)].bytes -= allocation.size;
+
+    if (allocation.pool == InvalidIndex) {
+        if (allocation.mapped) {
+            device.unmapMemory(allocation.memory);
+        }
+        device.freeMemory(allocation.memory);
+        dedicatedCounts[allocation.memoryTypeIndex]--;
+        dedicatedBytes[allocation.memoryTypeIndex] -= allocation.size;
+        return;
+    }
+
+    Pool& pool = pools[allocation.pool];
+    Block& block = pool.blocks[allocation.block];
+    assert(block.memory == allocation.memory && block.liveAllocations > 0);
+    if (pool.strategy == Strategy::Buddy) {
+        freeBuddy(block, allocation.offset, allocation.order);
+    }
+    block.liveAllocations--;
+    block.usedBytes -= allocation.size;
+    if (block.liveAllocations > 0) {
+        return;
+    }
+    block.cursor = 0;
+
+    // keep one empty block per pool for the next allocation, return the others
+    for (uint32_t i = 0; i < pool.blocks.size(); ++i) {
+        if (i != allocation.block && pool.blocks[i].memory && pool.blocks[i].liveAllocations == 0) {
+            releaseBlock(block);
+            return;
+        }
+    }
+}
+
+void MemoryAllocator::addStats(const Pool& pool, Stats& stats) const
+{
+    for (const Block& block : pool.blocks) {
+        if (!block.memory) {
+            continue;
+        }
+        stats.deviceAllocations++;
+        stats.allocations += block.liveAllocations;
+        stats.reservedBytes += blockSize;
+        stats.usedBytes += block.usedBytes;
+        if (pool.strategy == Strategy::Buddy) {
+            for (uint32_t order = 0; order <= maxOrder; ++order) {
+                const vk::DeviceSize rangeSize = MinBuddySize << order;
+                stats.freeBytes += rangeSize * block.freeRanges[order].size();
+                if (!block.freeRanges[order].empty()) {
+                    stats.largestFreeRange = std::max(stats.largestFreeRange, rangeSize);
+                }
+            }
+        } else {
+            // space below the cursor only comes back once the block is empty
+            const vk::DeviceSize tail = block.liveAllocations > 0 ? blockSize - block.cursor : blockSize;
+            stats.freeBytes += tail;
+            stats.largestFreeRange = std::max(stats.largestFreeRange, tail);
+        }
+    }
+}
+
+MemoryAllocator::Stats MemoryAllocator::GetStats(uint32_t memoryTypeIndex) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    for (const Pool& pool : pools) {
+        if (pool.memoryTypeIndex == memoryTypeIndex) {
+            addStats(pool, stats);
+        }
+    }
+    if (memoryTypeIndex < dedicatedCounts.size()) {
+        stats.deviceAllocations += dedicatedCounts[memoryTypeIndex];
+        stats.allocations += dedicatedCounts[memoryTypeIndex];
+        stats.reservedBytes += dedicatedBytes[memoryTypeIndex];
+        stats.usedBytes += dedicatedBytes[memoryTypeIndex];
+    }
+    if (stats.freeBytes > 0) {
+        stats.fragmentation = 1.0f - static_cast<float>(stats.largestFreeRange) / static_cast<float>(stats.freeBytes);
+    }
+    return stats;
+}
+
+MemoryAllocator::Stats MemoryAllocator::GetStats() const
+{
+    Stats total;
+    for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; ++type) {
+        Stats stats = GetStats(type);
+        total.deviceAllocations += stats.deviceAllocations;
+        total.allocations += stats.allocations;
+        total.reservedBytes += stats.reservedBytes;
+        total.usedBytes += stats.usedBytes;
+        total.freeBytes += stats.freeBytes;
+        total.largestFreeRange = std::max(total.largestFreeRange, stats.largestFreeRange);
+    }
+    if (total.freeBytes > 0) {
+        total.fragmentation = 1.0f - static_cast<float>(total.largestFreeRange) / static_cast<float>(total.freeBytes);
+    }
+    return total;
+}
+
+MemoryAllocator::CategoryStats MemoryAllocator::GetStats(Category category) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return categories[static_cast<uint32_t>(category)];
+}
+
+void MemoryAllocator::EnableMemoryBudget(vk::Instance instance)
+{
+    getMemoryProperties2 = instance.getProcAddr("vkGetPhysicalDeviceMemoryProperties2KHR");
+    if (!getMemoryProperties2) {
+        printf("MemoryAllocator: no vkGetPhysicalDeviceMemoryProperties2KHR, heap budgets are estimated\n");
+    }
+}
+
+std::vector<MemoryAllocator::HeapBudget> MemoryAllocator::GetHeapBudgets() const
+{
+    std::vector<HeapBudget> heaps(memoryProperties.memoryHeapCount);
+    for (uint32_t heap = 0; heap < heaps.size(); ++heap) {
+        heaps[heap].size = memoryProperties.memoryHeaps[heap].size;
+        heaps[heap].deviceLocal = static_cast<bool>(memoryProperties.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Pool& pool : pools) {
+            HeapBudget& heap = heaps[memoryProperties.memoryTypes[pool.memoryTypeIndex].heapIndex];
+            for (const Block& block : pool.blocks) {
+                if (block.memory) {
+                    heap.allocatorBytes += blockSize;
+                }
+            }
+        }
+        for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; ++type) {
+            heaps[memoryProperties.memoryTypes[type].heapIndex].allocatorBytes += dedicatedBytes[type];
+        }
+    }
+
+    PhysicalDeviceMemoryBudgetProperties budget = {};
+    budget.sType = PhysicalDeviceMemoryBudgetPropertiesType;
+    PhysicalDeviceMemoryProperties2 properties = {};
+    properties.sType = PhysicalDeviceMemoryProperties2Type;
+    properties.pNext = &budget;
+    if (getMemoryProperties2) {
+        reinterpret_cast<GetPhysicalDeviceMemoryProperties2>(getMemoryProperties2)(VkPhysicalDevice(physicalDevice), &properties);
+    }
+    for (uint32_t heap = 0; heap < heaps.size(); ++heap) {
+        if (getMemoryProperties2 && budget.heapBudget[heap] > 0) {
+            heaps[heap].budget = budget.heapBudget[heap];
+            heaps[heap].usage = budget.heapUsage[heap];
+        } else {
+            // what other processes and the driver leave is unknown, keep a fifth of the heap for them
+            heaps[heap].budget = heaps[heap].size / 5 * 4;
+            heaps[heap].usage = heaps[heap].allocatorBytes;
+        }
+    }
+    return heaps;
+}
+
+void MemoryAllocator::PrintStats() const
+{
+    for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; ++type) {
+        Stats stats = GetStats(type);
+        if (stats.deviceAllocations == 0) {
+            continue;
+        }
+        printf("memory type %u: %u device allocations, %u resources, %.1f of %.1f MB used, %.1f MB free, %.0f%% fragmented\n",
+            type, stats.deviceAllocations, stats.allocations, stats.usedBytes / (1024.0 * 1024.0), stats.reservedBytes / (1024.0 * 1024.0),
+            stats.freeBytes / (1024.0 * 1024.0), stats.fragmentation * 100.0f);
+    }
+    for (uint32_t category = 0; category < CategoryCount; ++category) {
+        CategoryStats stats = GetStats(static_cast<Category>(category));
+        if (stats.allocations > 0) {
+            printf("  %-12s %6u resources, %.1f MB\n", GetCategoryName(static_cast<Category>(category)), stats.allocations, stats.bytes / (1024.0 * 1024.0));
+        }
+    }
+    const std::vector<HeapBudget> heaps = GetHeapBudgets();
+    for (uint32_t heap = 0; heap < heaps.size(); ++heap) {
+        const float fraction = heaps[heap].budget > 0 ? static_cast<float>(heaps[heap].usage) / heaps[heap].budget : 0.0f;
+        printf("heap %u%s: %.1f of %.1f MB budget (%.0f%%), %.1f MB by the allocator, %.1f MB heap%s\n", heap, heaps[heap].deviceLocal ? " (device local)" : "",
+            heaps[heap].usage / (1024.0 * 1024.0), heaps[heap].budget / (1024.0 * 1024.0), fraction * 100.0f, heaps[heap].allocatorBytes / (1024.0 * 1024.0),
+            heaps[heap].size / (1024.0 * 1024.0), fraction > 0.9f ? ", near the budget" : "");
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MemoryOverlay.hpp"
+#include "GUITextCaption.h"
+#include "GuiRenderer.hpp"
+#include "MemoryAllocator.hpp"
+
+#include <cstdio>
+
+namespace m3d {
+
+static const double MB = 1024.0 * 1024.0;
+
+MemoryOverlay::MemoryOverlay(const std::string& FontFace, int FontSize, uint32_t RefreshFrames, float WarnFraction)
+    : fontFace(FontFace)
+    , fontSize(FontSize)
+    , refreshFrames(RefreshFrames > 0 ? RefreshFrames : 1)
+    , warnFraction(WarnFraction)
+{
+}
+
+MemoryOverlay::~MemoryOverlay()
+{
+    for (GUISystem::GUITextCaption* caption : captions) {
+        delete caption;
+    }
+}
+
+GUISystem::GUITextCaption& MemoryOverlay::line(uint32_t index)
+{
+    while (captions.size() <= index) {
+        GUISystem::GUITextCaption* caption = new GUISystem::GUITextCaption("memory overlay");
+        caption->SetFontFace(fontFace);
+        caption->SetFontSize(static_cast<float>(fontSize));
+        // a line and a bit of spacing below the previous one
+        const int offset = 4 + static_cast<int>(captions.size()) * (fontSize + fontSize / 4);
+        caption->SetPosition(GUISystem::ElementPos(0.0f, 0.0f, 4, offset));
+        captions.push_back(caption);
+        warnings.push_back(false);
+    }
+    return *captions[index];
+}
+
+void MemoryOverlay::setLine(uint32_t index, const char* text, bool warn)
+{
+    GUISystem::GUITextCaption& caption = line(index);
+    // unchanged text keeps the laid out quads
+    if (caption.GetText() != text) {
+        caption.SetText(text);
+    }
+    // captions start out white
+    if (warnings[index] != warn) {
+        if (warn) {
+            caption.SetColor(255, 64, 64, 255);
+        } else {
+            caption.SetColor(255, 255, 255, 255);
+        }
+        warnings[index] = warn;
+    }
+}
+
+void MemoryOverlay::Refresh(const MemoryAllocator& allocator)
+{
+    if (frame++ % refreshFrames != 0) {
+        return;
+    }
+
+    char text[128];
+    uint32_t lines = 0;
+    const std::vector<MemoryAllocator::HeapBudget> heaps = allocator.GetHeapBudgets();
+    for (uint32_t heap = 0; heap < heaps.size(); ++heap) {
+        const MemoryAllocator::HeapBudget& budget = heaps[heap];
+        const float fraction = budget.budget > 0 ? static_cast<float>(budget.usage) / budget.budget : 0.0f;
+        snprintf(text, sizeof(text), "heap %u%s: %.0f / %.0f MB (%.0f%%)", heap, budget.deviceLocal ? " local" : "", budget.usage / MB,
+            budget.budget / MB, fraction * 100.0f);
+        setLine(lines++, text, fraction > warnFraction);
+    }
+    if (!allocator.HasMemoryBudget()) {
+        setLine(lines++, "budgets estimated, no VK_EXT_memory_budget", false);
+    }
+    for (uint32_t category = 0; category < MemoryAllocator::CategoryCount; ++category) {
+        const MemoryAllocator::CategoryStats stats = allocator.GetStats(static_cast<MemoryAllocator::Category>(category));
+        snprintf(text, sizeof(text), "%s: %.1f MB in %u", MemoryAllocator::GetCategoryName(static_cast<MemoryAllocator::Category>(category)),
+            stats.bytes / MB, stats.allocations);
+        setLine(lines++, text, false);
+    }
+
+    elements.assign(captions.begin(), captions.begin() + lines);
+}
+
+void MemoryOverlay::Add(GuiRenderer& gui, const GUISystem::ElementProportions& screen)
+{
+    if (!elements.empty()) {
+        gui.Add(elements, screen);
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,182 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MemoryTags.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace m3d {
+namespace memtag {
+
+// keeps the blocks AllocatorAlignment aligned
+static const size_t HeaderBytes = 16;
+
+struct Header {
+    uint64_t bytes;
+    Tag tag;
+};
+
+// zero before any constructor runs, operator new is called during static initialization
+struct Counters {
+    std::atomic<uint64_t> liveBytes;
+    std::atomic<uint64_t> peakBytes;
+    std::atomic<uint64_t> allocations;
+};
+static Counters counters[TagCount];
+static thread_local Tag currentTag = Tag::Untagged;
+
+const char* GetTagName(Tag tag)
+{
+    static const char* const names[] = { "untagged", "scene", "render", "gui", "animation", "io" };
+    return names[static_cast<uint32_t>(tag)];
+}
+
+Stats GetStats(Tag tag)
+{
+    const Counters& tagCounters = counters[static_cast<uint32_t>(tag)];
+    Stats stats;
+    stats.liveBytes = tagCounters.liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = tagCounters.peakBytes.load(std::memory_order_relaxed);
+    stats.allocations = tagCounters.allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+Tag GetTag()
+{
+    return currentTag;
+}
+
+void SetTag(Tag tag)
+{
+    currentTag = tag;
+}
+
+void* Allocate(size_t bytes)
+{
+#if M3D_MEMORY_TAGS
+    uint8_t* block = static_cast<uint8_t*>(malloc(bytes + HeaderBytes));
+    if (!block) {
+        return nullptr;
+    }
+    Header header;
+    header.bytes = bytes;
+    header.tag = currentTag;
+    memcpy(block, &header, sizeof(header));
+    Counters& tagCounters = counters[static_cast<uint32_t>(header.tag)];
+    tagCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t live = tagCounters.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    uint64_t peak = tagCounters.peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !tagCounters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    return block + HeaderBytes;
+#else
+    return malloc(bytes);
+#endif
+}
+
+void Free(void* p)
+{
+#if M3D_MEMORY_TAGS
+    if (!p) {
+        return;
+    }
+    uint8_t* block = static_cast<uint8_t*>(p) - HeaderBytes;
+    Header header;
+    memcpy(&header, block, sizeof(header));
+    counters[static_cast<uint32_t>(header.tag)].liveBytes.fetch_sub(header.bytes, std::memory_order_relaxed);
+    free(block);
+#else
+    free(p);
+#endif
+}
+}
+} // End of namespace m3d
+
+#if M3D_MEMORY_TAGS
+// Replacements of the global ones, the library's defaults of the others end up in these
+static void* allocateOrThrow(size_t bytes)
+{
+    // a distinct pointer even for nothing
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    for (;;) {
+        if (void* p = m3d::memtag::Allocate(bytes)) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* allocateOrNull(size_t bytes) noexcept
+{
+    try {
+        return allocateOrThrow(bytes);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t bytes)
+{
+    return allocateOrThrow(bytes);
+}
+
+void* operator new[](size_t bytes)
+{
+    return allocateOrThrow(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+    return allocateOrNull(bytes);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+    return allocateOrNull(bytes);
+}
+
+void operator delete(void* p) noexcept
+{
+    m3d::memtag::Free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    m3d::memtag::Free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    m3d::memtag::Free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    m3d::memtag::Free(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+// the size is in the header, but a sanitizer's or another library's own may not forward to the unsized ones
+void operator delete(void* p, size_t) noexcept
+{
+    m3d::memtag::Free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    m3d::memtag::Free(p);
+}
+#endif
+#endif
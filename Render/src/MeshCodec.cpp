@@ -0,0 +1,198 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MeshCodec.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace m3d {
+
+static const size_t VertexSize = sizeof(PackedVertex);
+// bytes of one plane packed together, and the bit widths a group can pick
+static const size_t GroupSize = 16;
+static const uint32_t GroupWidths[4] = { 0, 2, 4, 8 };
+
+static uint8_t zigzag8(uint8_t delta)
+{
+    const int8_t value = static_cast<int8_t>(delta);
+    return static_cast<uint8_t>((value << 1) ^ (value >> 7));
+}
+
+static uint8_t unzigzag8(uint8_t value)
+{
+    return static_cast<uint8_t>((value >> 1) ^ (0u - (value & 1u)));
+}
+
+static uint32_t zigzag32(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+static int32_t unzigzag32(uint32_t value)
+{
+    return static_cast<int32_t>((value >> 1) ^ (0u - (value & 1u)));
+}
+
+static void writeVarint(uint32_t value, std::vector<uint8_t>& data)
+{
+    while (value >= 0x80) {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+static bool readVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (uint32_t shift = 0; shift < 35; shift += 7) {
+        if (p == end) {
+            return false;
+        }
+        const uint8_t byte = *p++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void encodeVertexChunk(const uint8_t* vertices, size_t count, std::vector<uint8_t>& data)
+{
+    const size_t groupCount = (count + GroupSize - 1) / GroupSize;
+    std::vector<uint8_t> deltas(groupCount * GroupSize, 0);
+    std::vector<uint8_t> widths(groupCount);
+    for (size_t k = 0; k < VertexSize; ++k) {
+        uint8_t previous = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t value = vertices[i * VertexSize + k];
+            deltas[i] = zigzag8(static_cast<uint8_t>(value - previous));
+            previous = value;
+        }
+
+        // four 2 bit widths per header byte
+        const size_t header = data.size();
+        data.resize(header + (groupCount + 3) / 4, 0);
+        for (size_t g = 0; g < groupCount; ++g) {
+            const uint8_t largest = *std::max_element(deltas.begin() + g * GroupSize, deltas.begin() + (g + 1) * GroupSize);
+            widths[g] = largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+            data[header + g / 4] |= static_cast<uint8_t>(widths[g] << ((g % 4) * 2));
+        }
+        for (size_t g = 0; g < groupCount; ++g) {
+            const uint32_t width = GroupWidths[widths[g]];
+            const size_t payload = data.size();
+            data.resize(payload + GroupSize * width / 8, 0);
+            for (size_t j = 0; j < GroupSize && width > 0; ++j) {
+                const size_t bit = j * width;
+                data[payload + bit / 8] |= static_cast<uint8_t>(deltas[g * GroupSize + j] << (bit % 8));
+            }
+        }
+        std::fill(deltas.begin(), deltas.end(), 0);
+    }
+}
+
+void EncodeVertices(const PackedVertex* vertices, size_t count, std::vector<uint8_t>& data, std::vector<CodecChunk>& chunks, uint32_t chunkVertices)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(vertices);
+    for (size_t first = 0; first < count; first += chunkVertices) {
+        CodecChunk chunk;
+        chunk.offset = static_cast<uint32_t>(data.size());
+        chunk.first = static_cast<uint32_t>(first);
+        chunk.count = static_cast<uint32_t>(std::min<size_t>(chunkVertices, count - first));
+        encodeVertexChunk(bytes + first * VertexSize, chunk.count, data);
+        chunk.size = static_cast<uint32_t>(data.size()) - chunk.offset;
+        chunks.push_back(chunk);
+    }
+}
+
+bool DecodeVertexChunk(const uint8_t* data, size_t size, const CodecChunk& chunk, PackedVertex* vertices)
+{
+    if (static_cast<size_t>(chunk.offset) + chunk.size > size) {
+        return false;
+    }
+    const uint8_t* p = data + chunk.offset;
+    const uint8_t* end = p + chunk.size;
+    uint8_t* out = reinterpret_cast<uint8_t*>(vertices + chunk.first);
+    const size_t groupCount = (chunk.count + GroupSize - 1) / GroupSize;
+    for (size_t k = 0; k < VertexSize; ++k) {
+        const uint8_t* header = p;
+        p += (groupCount + 3) / 4;
+        if (p > end) {
+            return false;
+        }
+        uint8_t previous = 0;
+        for (size_t g = 0; g < groupCount; ++g) {
+            const uint32_t width = GroupWidths[(header[g / 4] >> ((g % 4) * 2)) & 3];
+            if (p + GroupSize * width / 8 > end) {
+                return false;
+            }
+            const size_t groupEnd = std::min<size_t>((g + 1) * GroupSize, chunk.count);
+            for (size_t i = g * GroupSize; i < groupEnd; ++i) {
+                uint8_t delta = 0;
+                if (width > 0) {
+                    const size_t bit = (i - g * GroupSize) * width;
+                    delta = static_cast<uint8_t>((p[bit / 8] >> (bit % 8)) & ((1u << width) - 1));
+                }
+                previous = static_cast<uint8_t>(previous + unzigzag8(delta));
+                out[i * VertexSize + k] = previous;
+            }
+            p += GroupSize * width / 8;
+        }
+    }
+    return true;
+}
+
+void EncodeIndices(const uint32_t* indices, size_t count, std::vector<uint8_t>& data, std::vector<CodecChunk>& chunks, uint32_t chunkIndices)
+{
+    // one past the highest vertex referenced so far, in vertex fetch order that is the next new vertex
+    uint32_t next = 0;
+    for (size_t first = 0; first < count; first += chunkIndices) {
+        CodecChunk chunk;
+        chunk.offset = static_cast<uint32_t>(data.size());
+        chunk.first = static_cast<uint32_t>(first);
+        chunk.count = static_cast<uint32_t>(std::min<size_t>(chunkIndices, count - first));
+        // the state a chunk starts from, the previous index is reset to the next new vertex
+        writeVarint(next, data);
+        uint32_t last = next;
+        for (size_t i = first; i < first + chunk.count; ++i) {
+            const uint32_t index = indices[i];
+            writeVarint(index == next ? 0 : 1 + zigzag32(static_cast<int32_t>(index - last)), data);
+            last = index;
+            next = std::max(next, index + 1);
+        }
+        chunk.size = static_cast<uint32_t>(data.size()) - chunk.offset;
+        chunks.push_back(chunk);
+    }
+}
+
+bool DecodeIndexChunk(const uint8_t* data, size_t size, const CodecChunk& chunk, uint32_t* indices)
+{
+    if (static_cast<size_t>(chunk.offset) + chunk.size > size) {
+        return false;
+    }
+    const uint8_t* p = data + chunk.offset;
+    const uint8_t* end = p + chunk.size;
+    uint32_t next = 0;
+    if (!readVarint(p, end, next)) {
+        return false;
+    }
+    uint32_t last = next;
+    for (uint32_t i = 0; i < chunk.count; ++i) {
+        uint32_t code = 0;
+        if (!readVarint(p, end, code)) {
+            return false;
+        }
+        const uint32_t index = code == 0 ? next : last + static_cast<uint32_t>(unzigzag32(code - 1));
+        indices[chunk.first + i] = index;
+        last = index;
+        next = std::max(next, index + 1);
+    }
+    return true;
+}
+} // End of namespace m3d
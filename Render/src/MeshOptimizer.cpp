@@ -0,0 +1,654 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Allocator.h"
+#include "MeshOptimizer.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace m3d {
+
+// Layout of the Mesh attribute streams, see Mesh::init
+static const size_t VertexStride = 4;
+static const size_t NormalStride = 3;
+static const size_t UVStride = 2;
+
+/*
+ * Scratch memory of the load time passes, one per thread as meshes convert in
+ * parallel. Hash nodes are recycled by a free list, the vertex sized arrays
+ * come from a 16 MB bitmap region of huge pages that is reused from mesh to
+ * mesh, placed on the NUMA node of a thread bound to one.
+ */
+typedef Segregator<64, FreeList<Mallocator, 1, 64, 65536>,
+    FallbackAllocator<BitmappedBlock<PageAllocator, 4096, 4096>, Mallocator>>
+    ScratchAllocator;
+
+static StlAllocator<char, ScratchAllocator> scratch()
+{
+    static thread_local ScratchAllocator allocator;
+    return StlAllocator<char, ScratchAllocator>(allocator);
+}
+
+template <class T>
+using ScratchVector = std::vector<T, StlAllocator<T, ScratchAllocator>>;
+template <class Key, class Value, class Hash = std::hash<Key>>
+using ScratchMap = std::unordered_map<Key, Value, Hash, std::equal_to<Key>, StlAllocator<std::pair<const Key, Value>, ScratchAllocator>>;
+
+namespace {
+    struct VertexKey {
+        float data[VertexStride + NormalStride + UVStride];
+        // of meshes with blend shapes, which may move coinciding vertices apart
+        uint32_t controlPoint;
+
+        bool operator==(const VertexKey& other) const { return memcmp(this, &other, sizeof(VertexKey)) == 0; }
+    };
+
+    struct VertexKeyHasher {
+        size_t operator()(const VertexKey& key) const
+        {
+            // FNV-1a over the raw bits, welding only merges exact duplicates
+            uint64_t hash = 14695981039346656037ull;
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&key);
+            for (size_t i = 0; i < sizeof(VertexKey); ++i) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+}
+
+/* Permute the attribute streams, remap[old] is the new index or UINT32_MAX to drop the vertex */
+static void remapVertices(Mesh& mesh, const std::vector<uint32_t>& remap, size_t newCount)
+{
+    const size_t vertexCount = remap.size();
+    const bool hasNormal = mesh.normals.size() >= vertexCount * NormalStride;
+    const bool hasUV = mesh.uvs.size() >= vertexCount * UVStride;
+    const bool hasSources = mesh.controlPoints.size() == vertexCount && mesh.importVertices.size() == vertexCount;
+
+    // the replaced streams become the next call's targets, a thread keeps reusing the same buffers
+    static thread_local std::vector<float> vertices, normals, uvs;
+    vertices.assign(newCount * VertexStride, 0.0f);
+    normals.assign(hasNormal ? newCount * NormalStride : 0, 0.0f);
+    uvs.assign(hasUV ? newCount * UVStride : 0, 0.0f);
+    std::vector<uint32_t> controlPoints(hasSources ? newCount : 0);
+    std::vector<uint32_t> importVertices(hasSources ? newCount : 0);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        const uint32_t target = remap[i];
+        if (target == UINT32_MAX) {
+            continue;
+        }
+        std::copy_n(&mesh.vertices[i * VertexStride], VertexStride, &vertices[target * VertexStride]);
+        if (hasNormal) {
+            std::copy_n(&mesh.normals[i * NormalStride], NormalStride, &normals[target * NormalStride]);
+        }
+        if (hasUV) {
+            std::copy_n(&mesh.uvs[i * UVStride], UVStride, &uvs[target * UVStride]);
+        }
+        if (hasSources) {
+            controlPoints[target] = mesh.controlPoints[i];
+            importVertices[target] = mesh.importVertices[i];
+        }
+    }
+    mesh.vertices.swap(vertices);
+    mesh.normals.swap(normals);
+    mesh.uvs.swap(uvs);
+    if (hasSources) {
+        mesh.controlPoints.swap(controlPoints);
+        mesh.importVertices.swap(importVertices);
+    }
+
+    for (auto& index : mesh.indices) {
+        index = remap[index];
+    }
+}
+
+void WeldVertices(Mesh& mesh)
+{
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    const bool hasNormal = mesh.normals.size() >= vertexCount * NormalStride;
+    const bool hasUV = mesh.uvs.size() >= vertexCount * UVStride;
+    const bool hasControlPoints = mesh.controlPoints.size() == vertexCount;
+
+    ScratchMap<VertexKey, uint32_t, VertexKeyHasher> unique(vertexCount, VertexKeyHasher(), std::equal_to<VertexKey>(), scratch());
+    std::vector<uint32_t> remap(vertexCount);
+    uint32_t uniqueCount = 0;
+    for (size_t i = 0; i < vertexCount; ++i) {
+        VertexKey key = {};
+        std::copy_n(&mesh.vertices[i * VertexStride], VertexStride, key.data);
+        if (hasNormal) {
+            std::copy_n(&mesh.normals[i * NormalStride], NormalStride, key.data + VertexStride);
+        }
+        if (hasUV) {
+            std::copy_n(&mesh.uvs[i * UVStride], UVStride, key.data + VertexStride + NormalStride);
+        }
+        if (hasControlPoints) {
+            key.controlPoint = mesh.controlPoints[i];
+        }
+        auto inserted = unique.emplace(key, uniqueCount);
+        remap[i] = inserted.first->second;
+        if (inserted.second) {
+            ++uniqueCount;
+        }
+    }
+
+    if (uniqueCount < vertexCount) {
+        // first occurrences keep their relative order, so the remap is monotonic for them
+        remapVertices(mesh, remap, uniqueCount);
+    }
+}
+
+/* Forsyth vertex cache optimisation */
+static const uint32_t CacheSize = 32;
+static const uint32_t MaxValenceScore = 32;
+
+static float cacheScore(int32_t cachePosition)
+{
+    if (cachePosition < 0) {
+        return 0.0f;
+    }
+    // the last triangle's vertices are used regardless of where they land
+    if (cachePosition < 3) {
+        return 0.75f;
+    }
+    const float scale = 1.0f / (CacheSize - 3);
+    return powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+}
+
+static float valenceScore(uint32_t activeTriangles)
+{
+    // boost vertices with few triangles left so they get finished off
+    return 2.0f * powf(static_cast<float>(activeTriangles), -0.5f);
+}
+
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2) {
+        return;
+    }
+
+    float cacheTable[CacheSize];
+    for (uint32_t i = 0; i < CacheSize; ++i) {
+        cacheTable[i] = cacheScore(i);
+    }
+    float valenceTable[MaxValenceScore + 1];
+    valenceTable[0] = 0.0f;
+    for (uint32_t i = 1; i <= MaxValenceScore; ++i) {
+        valenceTable[i] = valenceScore(i);
+    }
+
+    // triangles of each vertex, packed by vertex
+    ScratchVector<uint32_t> activeCount(vertexCount, 0, scratch());
+    for (size_t i = 0; i < indexCount; ++i) {
+        ++activeCount[indices[i]];
+    }
+    ScratchVector<uint32_t> triangleOffset(vertexCount + 1, 0, scratch());
+    for (size_t v = 0; v < vertexCount; ++v) {
+        triangleOffset[v + 1] = triangleOffset[v] + activeCount[v];
+    }
+    ScratchVector<uint32_t> vertexTriangles(indexCount, 0, scratch());
+    {
+        ScratchVector<uint32_t> fill(triangleOffset.begin(), triangleOffset.end() - 1, scratch());
+        for (size_t t = 0; t < triangleCount; ++t) {
+            for (int c = 0; c < 3; ++c) {
+                const uint32_t v = indices[t * 3 + c];
+                vertexTriangles[fill[v]++] = static_cast<uint32_t>(t);
+            }
+        }
+    }
+
+    ScratchVector<int32_t> cachePosition(vertexCount, -1, scratch());
+    ScratchVector<float> vertexScore(vertexCount, 0.0f, scratch());
+    auto scoreVertex = [&](uint32_t v) {
+        const uint32_t active = activeCount[v];
+        if (active == 0) {
+            return -1.0f;
+        }
+        const int32_t position = cachePosition[v];
+        return (position >= 0 ? cacheTable[position] : 0.0f) + valenceTable[std::min(active, MaxValenceScore)];
+    };
+    for (size_t v = 0; v < vertexCount; ++v) {
+        vertexScore[v] = scoreVertex(static_cast<uint32_t>(v));
+    }
+
+    ScratchVector<float> triangleScore(triangleCount, 0.0f, scratch());
+    ScratchVector<bool> emitted(triangleCount, false, scratch());
+    for (size_t t = 0; t < triangleCount; ++t) {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    ScratchVector<uint32_t> output(scratch());
+    output.reserve(indexCount);
+    uint32_t cache[CacheSize + 3];
+    uint32_t cacheCount = 0;
+    size_t scanCursor = 0;
+
+    // start with the best triangle overall
+    size_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+        if (best == SIZE_MAX) {
+            // nothing in the cache has triangles left, continue with the next unemitted one
+            while (emitted[scanCursor]) {
+                ++scanCursor;
+            }
+            best = scanCursor;
+        }
+
+        const uint32_t* triangle = &indices[best * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        emitted[best] = true;
+
+        // retire the triangle from its vertices
+        for (int c = 0; c < 3; ++c) {
+            const uint32_t v = triangle[c];
+            uint32_t* begin = &vertexTriangles[triangleOffset[v]];
+            uint32_t* end = begin + activeCount[v];
+            *std::find(begin, end, static_cast<uint32_t>(best)) = *(end - 1);
+            --activeCount[v];
+        }
+
+        // the new triangle goes to the front of the cache, the rest shifts back
+        uint32_t newCache[CacheSize + 3];
+        uint32_t newCount = 0;
+        for (int c = 0; c < 3; ++c) {
+            newCache[newCount++] = triangle[c];
+        }
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                newCache[newCount++] = v;
+            }
+        }
+        for (uint32_t i = CacheSize; i < newCount; ++i) {
+            cachePosition[newCache[i]] = -1;
+            vertexScore[newCache[i]] = scoreVertex(newCache[i]);
+        }
+        cacheCount = std::min(newCount, CacheSize);
+        for (uint32_t i = 0; i < cacheCount; ++i) {
+            cache[i] = newCache[i];
+            cachePosition[cache[i]] = static_cast<int32_t>(i);
+            vertexScore[cache[i]] = scoreVertex(cache[i]);
+        }
+
+        // rescore the triangles touched by the cache, evicted vertices also changed
+        best = SIZE_MAX;
+        float bestScore = -1.0f;
+        for (uint32_t i = 0; i < newCount; ++i) {
+            const uint32_t v = newCache[i];
+            for (uint32_t j = 0; j < activeCount[v]; ++j) {
+                const uint32_t t = vertexTriangles[triangleOffset[v] + j];
+                const float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                triangleScore[t] = score;
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void OptimizeVertexFetch(Mesh& mesh)
+{
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+    for (uint32_t index : mesh.indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = next++;
+        }
+    }
+    remapVertices(mesh, remap, next);
+}
+
+void OptimizeMesh(Mesh& mesh)
+{
+    if (mesh.indices.empty()) {
+        return;
+    }
+    WeldVertices(mesh);
+
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    for (const auto& slice : mesh.slices) {
+        OptimizeVertexCache(&mesh.indices[slice.indexOffset], slice.triangleCount * 3, vertexCount);
+    }
+
+    OptimizeVertexFetch(mesh);
+}
+
+/* Grid clustering LODs */
+static const uint32_t MaxGridResolution = 1024;
+
+namespace {
+    // symmetric 4x4 sum of squared plane distances, upper triangle
+    struct Quadric {
+        double q[10] = {};
+
+        void AddPlane(double a, double b, double c, double d, double weight)
+        {
+            const double plane[4] = { a, b, c, d };
+            int k = 0;
+            for (int i = 0; i < 4; ++i) {
+                for (int j = i; j < 4; ++j) {
+                    q[k++] += weight * plane[i] * plane[j];
+                }
+            }
+        }
+
+        void Add(const Quadric& other)
+        {
+            for (int i = 0; i < 10; ++i) {
+                q[i] += other.q[i];
+            }
+        }
+
+        double Error(const float* p) const
+        {
+            const double x = p[0], y = p[1], z = p[2];
+            return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                + q[7] * z * z + 2.0 * q[8] * z
+                + q[9];
+        }
+    };
+
+    struct Clustering {
+        // per vertex, the vertex it collapses onto
+        std::vector<uint32_t> representative;
+        // per slice, triangles that survived
+        std::vector<std::vector<uint32_t>> sliceIndices;
+        size_t triangleCount = 0;
+        float error = 0.0f;
+    };
+}
+
+static void clusterVertices(const Mesh& mesh, const std::vector<Quadric>& quadrics, const Aabb& bounds, uint32_t resolution, Clustering& result)
+{
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    float extent = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        extent = std::max(extent, bounds.upper[c] - bounds.lower[c]);
+    }
+    const float cellScale = extent > 0.0f ? resolution / extent : 0.0f;
+
+    ScratchMap<uint64_t, uint32_t> cells(vertexCount, std::hash<uint64_t>(), std::equal_to<uint64_t>(), scratch());
+    ScratchVector<uint32_t> cluster(vertexCount, UINT32_MAX, scratch());
+    ScratchVector<Quadric> clusterQuadrics(scratch());
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const float* position = &mesh.vertices[v * VertexStride];
+        uint64_t key = 0;
+        for (int c = 0; c < 3; ++c) {
+            const uint32_t cell = std::min(resolution - 1, static_cast<uint32_t>((position[c] - bounds.lower[c]) * cellScale));
+            key = key * MaxGridResolution + cell;
+        }
+        auto inserted = cells.emplace(key, static_cast<uint32_t>(clusterQuadrics.size()));
+        if (inserted.second) {
+            clusterQuadrics.push_back(Quadric());
+        }
+        cluster[v] = inserted.first->second;
+        clusterQuadrics[cluster[v]].Add(quadrics[v]);
+    }
+
+    // the member that best fits the planes of the whole cluster
+    ScratchVector<uint32_t> best(clusterQuadrics.size(), UINT32_MAX, scratch());
+    ScratchVector<double> bestError(clusterQuadrics.size(), DBL_MAX, scratch());
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const double error = clusterQuadrics[cluster[v]].Error(&mesh.vertices[v * VertexStride]);
+        if (error < bestError[cluster[v]]) {
+            bestError[cluster[v]] = error;
+            best[cluster[v]] = static_cast<uint32_t>(v);
+        }
+    }
+
+    result.representative.resize(vertexCount);
+    result.error = 0.0f;
+    for (size_t v = 0; v < vertexCount; ++v) {
+        const uint32_t target = best[cluster[v]];
+        result.representative[v] = target;
+        float distanceSq = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            const float d = mesh.vertices[v * VertexStride + c] - mesh.vertices[target * VertexStride + c];
+            distanceSq += d * d;
+        }
+        result.error = std::max(result.error, distanceSq);
+    }
+    result.error = sqrtf(result.error);
+
+    // triangles whose corners landed in fewer than three clusters vanish
+    result.sliceIndices.resize(mesh.slices.size());
+    result.triangleCount = 0;
+    for (size_t s = 0; s < mesh.slices.size(); ++s) {
+        const Mesh::Slice& slice = mesh.slices[s];
+        std::vector<uint32_t>& indices = result.sliceIndices[s];
+        indices.clear();
+        for (int t = 0; t < slice.triangleCount; ++t) {
+            const uint32_t* triangle = &mesh.indices[slice.indexOffset + t * 3];
+            const uint32_t a = result.representative[triangle[0]];
+            const uint32_t b = result.representative[triangle[1]];
+            const uint32_t c = result.representative[triangle[2]];
+            if (a != b && b != c && a != c) {
+                indices.push_back(a);
+                indices.push_back(b);
+                indices.push_back(c);
+            }
+        }
+        result.triangleCount += indices.size() / 3;
+    }
+}
+
+void GenerateLods(Mesh& mesh, uint32_t maxLods, uint32_t minTriangles)
+{
+    mesh.lods.clear();
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    size_t triangleCount = 0;
+    for (const auto& slice : mesh.slices) {
+        triangleCount += slice.triangleCount;
+    }
+    if (vertexCount == 0 || triangleCount / 2 < minTriangles) {
+        return;
+    }
+
+    // area weighted planes of the triangles around each vertex
+    std::vector<Quadric> quadrics(vertexCount);
+    Aabb bounds;
+    for (const auto& slice : mesh.slices) {
+        for (int t = 0; t < slice.triangleCount; ++t) {
+            const uint32_t* triangle = &mesh.indices[slice.indexOffset + t * 3];
+            const float* p0 = &mesh.vertices[triangle[0] * VertexStride];
+            const float* p1 = &mesh.vertices[triangle[1] * VertexStride];
+            const float* p2 = &mesh.vertices[triangle[2] * VertexStride];
+            const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            const double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length > 0.0) {
+                for (int c = 0; c < 3; ++c) {
+                    n[c] /= length;
+                }
+                const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+                for (int c = 0; c < 3; ++c) {
+                    quadrics[triangle[c]].AddPlane(n[0], n[1], n[2], d, length * 0.5);
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                bounds.Expand(&mesh.vertices[triangle[c] * VertexStride]);
+            }
+        }
+    }
+
+    size_t previous = triangleCount;
+    Clustering clustering, best;
+    for (uint32_t lod = 0; lod < maxLods; ++lod) {
+        const size_t target = previous / 2;
+        if (target < minTriangles) {
+            break;
+        }
+        // finest grid that still gets under the target, the triangle count grows with the resolution
+        uint32_t lower = 1, upper = MaxGridResolution;
+        bool found = false;
+        while (lower <= upper) {
+            const uint32_t resolution = lower + (upper - lower) / 2;
+            clusterVertices(mesh, quadrics, bounds, resolution, clustering);
+            if (clustering.triangleCount <= target) {
+                std::swap(best, clustering);
+                found = true;
+                lower = resolution + 1;
+            } else {
+                upper = resolution - 1;
+            }
+        }
+        if (!found || best.triangleCount < minTriangles) {
+            break;
+        }
+
+        Mesh::Lod level;
+        level.error = best.error;
+        for (size_t s = 0; s < mesh.slices.size(); ++s) {
+            const std::vector<uint32_t>& indices = best.sliceIndices[s];
+            level.slices.emplace_back(static_cast<int>(mesh.indices.size()), static_cast<int>(indices.size() / 3));
+            // the coarse triangles only use vertices of the full level, its bounds still hold
+            level.slices.back().bounds = mesh.slices[s].bounds;
+            if (!indices.empty()) {
+                mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+                OptimizeVertexCache(&mesh.indices[mesh.indices.size() - indices.size()], indices.size(), vertexCount);
+            }
+        }
+        mesh.lods.push_back(level);
+        previous = best.triangleCount;
+    }
+}
+
+/* Bounding sphere and normal cone of the triangles a meshlet covers */
+static void boundMeshlet(const Mesh& mesh, Mesh::Meshlet& meshlet)
+{
+    const uint32_t* indices = &mesh.indices[meshlet.indexOffset];
+    const size_t indexCount = meshlet.triangleCount * 3;
+    Aabb box;
+    for (size_t i = 0; i < indexCount; ++i) {
+        box.Expand(&mesh.vertices[indices[i] * VertexStride]);
+    }
+    float radiusSq = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        meshlet.sphere[c] = box.Center(c);
+    }
+    for (size_t i = 0; i < indexCount; ++i) {
+        const float* p = &mesh.vertices[indices[i] * VertexStride];
+        float distSq = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            distSq += (p[c] - meshlet.sphere[c]) * (p[c] - meshlet.sphere[c]);
+        }
+        radiusSq = std::max(radiusSq, distSq);
+    }
+    meshlet.sphere[3] = sqrtf(radiusSq);
+
+    // the axis is the average of the unit face normals, the cone opens to the one furthest off it
+    ScratchVector<float> normals(scratch());
+    normals.reserve(meshlet.triangleCount * 3);
+    float axis[3] = { 0.0f, 0.0f, 0.0f };
+    for (int t = 0; t < meshlet.triangleCount; ++t) {
+        const float* p0 = &mesh.vertices[indices[t * 3] * VertexStride];
+        const float* p1 = &mesh.vertices[indices[t * 3 + 1] * VertexStride];
+        const float* p2 = &mesh.vertices[indices[t * 3 + 2] * VertexStride];
+        const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        const float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length <= 0.0f) {
+            continue;
+        }
+        for (int c = 0; c < 3; ++c) {
+            n[c] /= length;
+            axis[c] += n[c];
+            normals.push_back(n[c]);
+        }
+    }
+    const float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float minDot = 1.0f;
+    for (int c = 0; c < 3; ++c) {
+        meshlet.coneAxis[c] = axisLength > 0.0f ? axis[c] / axisLength : 0.0f;
+    }
+    for (size_t i = 0; i < normals.size(); i += 3) {
+        minDot = std::min(minDot, normals[i] * meshlet.coneAxis[0] + normals[i + 1] * meshlet.coneAxis[1] + normals[i + 2] * meshlet.coneAxis[2]);
+    }
+    // back facing from everywhere the view direction is within 90 degrees minus the cone's angle of the axis,
+    // a cone wider than a half space never is
+    meshlet.coneCutoff = axisLength > 0.0f && minDot > 0.0f ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+}
+
+void BuildMeshlets(Mesh& mesh, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    mesh.meshlets.clear();
+    const size_t vertexCount = mesh.vertices.size() / VertexStride;
+    if (vertexCount == 0) {
+        return;
+    }
+    // meshlet a vertex was last counted for, a vertex is new to a meshlet until stamped with its number
+    ScratchVector<uint32_t> stamp(vertexCount, UINT32_MAX, scratch());
+    uint32_t meshletNumber = 0;
+    for (uint32_t s = 0; s < mesh.slices.size(); ++s) {
+        const Mesh::Slice& slice = mesh.slices[s];
+        Mesh::Meshlet meshlet = {};
+        meshlet.slice = s;
+        meshlet.indexOffset = slice.indexOffset;
+        uint32_t meshletVertices = 0;
+        for (int t = 0; t < slice.triangleCount; ++t) {
+            const uint32_t* triangle = &mesh.indices[slice.indexOffset + t * 3];
+            // distinct vertices of the triangle the meshlet does not reference yet
+            uint32_t added = stamp[triangle[0]] != meshletNumber ? 1 : 0;
+            added += stamp[triangle[1]] != meshletNumber && triangle[1] != triangle[0] ? 1 : 0;
+            added += stamp[triangle[2]] != meshletNumber && triangle[2] != triangle[0] && triangle[2] != triangle[1] ? 1 : 0;
+            if (meshlet.triangleCount > 0 && (meshletVertices + added > maxVertices || static_cast<uint32_t>(meshlet.triangleCount) == maxTriangles)) {
+                boundMeshlet(mesh, meshlet);
+                mesh.meshlets.push_back(meshlet);
+                meshlet.indexOffset += meshlet.triangleCount * 3;
+                meshlet.triangleCount = 0;
+                meshletVertices = 0;
+                // every vertex of the triangle is new to the next meshlet
+                ++meshletNumber;
+            }
+            for (int c = 0; c < 3; ++c) {
+                if (stamp[triangle[c]] != meshletNumber) {
+                    stamp[triangle[c]] = meshletNumber;
+                    ++meshletVertices;
+                }
+            }
+            ++meshlet.triangleCount;
+        }
+        if (meshlet.triangleCount > 0) {
+            boundMeshlet(mesh, meshlet);
+            mesh.meshlets.push_back(meshlet);
+        }
+        ++meshletNumber;
+    }
+}
+
+float AverageCacheMissRatio(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+    if (indexCount < 3) {
+        return 0.0f;
+    }
+    // FIFO: a vertex is a hit while fewer than cacheSize misses happened since it was loaded
+    std::vector<size_t> loadedAt(vertexCount, SIZE_MAX);
+    size_t misses = 0;
+    for (size_t i = 0; i < indexCount; ++i) {
+        const uint32_t v = indices[i];
+        if (loadedAt[v] == SIZE_MAX || misses - loadedAt[v] >= cacheSize) {
+            loadedAt[v] = misses;
+            ++misses;
+        }
+    }
+    return static_cast<float>(misses) / (indexCount / 3);
+}
+} // End of namespace m3d
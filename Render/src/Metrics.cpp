@@ -0,0 +1,354 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Metrics.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closesocket close
+#endif
+
+#ifndef MSG_NOSIGNAL
+// a scraper that hung up must not raise SIGPIPE, Windows and macOS do not have the flag
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace m3d {
+
+// StopServing waits for at most this long
+static const long PollMs = 100;
+// a request line and headers, anything longer is not a scraper's
+static const size_t MaxRequest = 4096;
+
+static uint64_t toBits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double fromBits(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// shortest text that reads back as the same double, Prometheus' spelling of the infinities
+static void appendValue(std::string& text, double value)
+{
+    char buffer[32];
+    if (value != value) {
+        text += "NaN";
+        return;
+    }
+    if (value > 1.7976931348623157e308) {
+        text += "+Inf";
+        return;
+    }
+    if (value < -1.7976931348623157e308) {
+        text += "-Inf";
+        return;
+    }
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    for (int precision = 6; precision < 17; ++precision) {
+        char shorter[32];
+        snprintf(shorter, sizeof(shorter), "%.*g", precision, value);
+        if (strtod(shorter, nullptr) == value) {
+            memcpy(buffer, shorter, sizeof(buffer));
+            break;
+        }
+    }
+    text += buffer;
+}
+
+static void appendUnsigned(std::string& text, uint64_t value)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value));
+    text += buffer;
+}
+
+void Metrics::Gauge::Set(double value)
+{
+    bits.store(toBits(value), std::memory_order_relaxed);
+}
+
+double Metrics::Gauge::Get() const
+{
+    return fromBits(bits.load(std::memory_order_relaxed));
+}
+
+Metrics::Histogram::Histogram(const std::vector<double>& Bounds)
+    : bounds(Bounds)
+    , buckets(new std::atomic<uint64_t>[Bounds.size() + 1])
+{
+    for (size_t i = 0; i <= bounds.size(); ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::Histogram::Observe(double value)
+{
+    // a handful of bounds, a scan beats a search
+    size_t bucket = 0;
+    while (bucket < bounds.size() && value > bounds[bucket]) {
+        ++bucket;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    uint64_t expected = sumBits.load(std::memory_order_relaxed);
+    while (!sumBits.compare_exchange_weak(expected, toBits(fromBits(expected) + value), std::memory_order_relaxed)) {
+    }
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics::~Metrics()
+{
+    StopServing();
+}
+
+Metrics::Counter& Metrics::AddCounter(const char* name, const char* help)
+{
+    Entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = Type::Counter;
+    entry.counter.reset(new Counter());
+    Counter& counter = *entry.counter;
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(std::move(entry));
+    return counter;
+}
+
+Metrics::Gauge& Metrics::AddGauge(const char* name, const char* help)
+{
+    Entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = Type::Gauge;
+    entry.gauge.reset(new Gauge());
+    Gauge& gauge = *entry.gauge;
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(std::move(entry));
+    return gauge;
+}
+
+Metrics::Histogram& Metrics::AddHistogram(const char* name, const char* help, const std::vector<double>& bounds)
+{
+    Entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = Type::Histogram;
+    entry.histogram.reset(new Histogram(bounds));
+    Histogram& histogram = *entry.histogram;
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(std::move(entry));
+    return histogram;
+}
+
+std::string Metrics::Format() const
+{
+    static const char* const typeNames[] = { "counter", "gauge", "histogram" };
+    std::string text;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Entry& entry : entries) {
+        text += "# HELP " + entry.name + " " + entry.help + "\n";
+        text += "# TYPE " + entry.name + " " + typeNames[static_cast<int>(entry.type)] + "\n";
+        switch (entry.type) {
+        case Type::Counter:
+            text += entry.name + " ";
+            appendUnsigned(text, entry.counter->Get());
+            text += "\n";
+            break;
+        case Type::Gauge:
+            text += entry.name + " ";
+            appendValue(text, entry.gauge->Get());
+            text += "\n";
+            break;
+        case Type::Histogram: {
+            const Histogram& histogram = *entry.histogram;
+            // the exposition's buckets are cumulative
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i <= histogram.bounds.size(); ++i) {
+                cumulative += histogram.buckets[i].load(std::memory_order_relaxed);
+                text += entry.name + "_bucket{le=\"";
+                if (i < histogram.bounds.size()) {
+                    appendValue(text, histogram.bounds[i]);
+                } else {
+                    text += "+Inf";
+                }
+                text += "\"} ";
+                appendUnsigned(text, cumulative);
+                text += "\n";
+            }
+            text += entry.name + "_sum ";
+            appendValue(text, fromBits(histogram.sumBits.load(std::memory_order_relaxed)));
+            text += "\n" + entry.name + "_count ";
+            // the +Inf bucket, consistent with the buckets even while an observation lands
+            appendUnsigned(text, cumulative);
+            text += "\n";
+            break;
+        }
+        }
+    }
+    return text;
+}
+
+bool Metrics::WriteFile(const std::string& path) const
+{
+    const std::string text = Format();
+    const std::string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) {
+        printf("Metrics: can not write %s\n", temp.c_str());
+        return false;
+    }
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = fclose(file) == 0 && written;
+#ifdef _WIN32
+    // rename does not replace on Windows
+    remove(path.c_str());
+#endif
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        printf("Metrics: can not write %s\n", path.c_str());
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Metrics::Serve(uint16_t port)
+{
+    if (serving) {
+        return false;
+    }
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        return false;
+    }
+#endif
+    const auto fail = [this](const char* what, uint16_t port) {
+        printf("Metrics: can not %s port %u\n", what, port);
+        if (listener != -1) {
+            closesocket(static_cast<int>(listener));
+            listener = -1;
+        }
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return false;
+    };
+    listener = static_cast<intptr_t>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (listener < 0) {
+        listener = -1;
+        return fail("open a socket for", port);
+    }
+    // a restarted server binds the port of the last one right away
+    int reuse = 1;
+    setsockopt(static_cast<int>(listener), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(static_cast<int>(listener), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        return fail("bind", port);
+    }
+    if (listen(static_cast<int>(listener), 8) != 0) {
+        return fail("listen on", port);
+    }
+    serving = true;
+    server = std::thread(&Metrics::serve, this);
+    return true;
+}
+
+void Metrics::StopServing()
+{
+    if (!server.joinable()) {
+        return;
+    }
+    serving = false;
+    server.join();
+    closesocket(static_cast<int>(listener));
+    listener = -1;
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void Metrics::serve()
+{
+    const int socket = static_cast<int>(listener);
+    while (serving) {
+        // a timeout rather than a blocking accept, StopServing only has to clear serving
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(socket, &readable);
+        timeval timeout = { 0, PollMs * 1000 };
+        if (select(socket + 1, &readable, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+        const int client = static_cast<int>(accept(socket, nullptr, nullptr));
+        if (client < 0) {
+            continue;
+        }
+        // one request per connection, a scraper sends it at once
+#ifdef _WIN32
+        DWORD receiveMs = 1000;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&receiveMs), sizeof(receiveMs));
+#else
+        timeval receiveTimeout = { 1, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+#endif
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < MaxRequest) {
+            const int received = static_cast<int>(recv(client, buffer, sizeof(buffer), 0));
+            if (received <= 0) {
+                break;
+            }
+            request.append(buffer, received);
+        }
+
+        std::string status = "404 Not Found";
+        std::string body = "not found\n";
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0) {
+            status = "200 OK";
+            body = Format();
+        }
+        std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: ";
+        appendUnsigned(response, body.size());
+        response += "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const int written = static_cast<int>(send(client, response.data() + sent, static_cast<int>(response.size() - sent), MSG_NOSIGNAL));
+            if (written <= 0) {
+                break;
+            }
+            sent += written;
+        }
+        closesocket(client);
+    }
+}
+} // End of namespace m3d
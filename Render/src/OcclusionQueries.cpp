@@ -0,0 +1,237 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "OcclusionQueries.hpp"
+#include "CommandBuffer.hpp"
+#include "Pipeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <cstdio>
+
+namespace m3d {
+
+const uint32_t OcclusionQueries::InvalidQuery;
+const char* const OcclusionQueries::ExtensionName = "VK_EXT_conditional_rendering";
+
+// VK_KHR_get_physical_device_properties2 and VK_EXT_conditional_rendering postdate the vulkan headers
+static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+static const VkStructureType PhysicalDeviceConditionalRenderingFeaturesType = static_cast<VkStructureType>(1000081001);
+static const VkStructureType ConditionalRenderingBeginInfoType = static_cast<VkStructureType>(1000081002);
+static const vk::BufferUsageFlagBits ConditionalRenderingBufferUsage = static_cast<vk::BufferUsageFlagBits>(0x00000200);
+static const vk::PipelineStageFlagBits ConditionalRenderingStage = static_cast<vk::PipelineStageFlagBits>(0x00040000);
+static const vk::AccessFlagBits ConditionalRenderingReadAccess = static_cast<vk::AccessFlagBits>(0x00100000);
+
+struct PhysicalDeviceFeatures2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceFeatures features;
+};
+
+struct PhysicalDeviceConditionalRenderingFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 conditionalRendering;
+    VkBool32 inheritedConditionalRendering;
+};
+
+struct ConditionalRenderingBeginInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkFlags flags;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+typedef void(VKAPI_PTR* CmdBeginConditionalRendering)(VkCommandBuffer commandBuffer, const ConditionalRenderingBeginInfo* beginInfo);
+typedef void(VKAPI_PTR* CmdEndConditionalRendering)(VkCommandBuffer commandBuffer);
+
+// both faces of a box, 12 triangles
+static const uint32_t BoxVertexCount = 36;
+
+bool OcclusionQueries::IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, ExtensionName)) {
+        return false;
+    }
+    PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!getFeatures2) {
+        return false;
+    }
+    PhysicalDeviceConditionalRenderingFeatures conditional = {};
+    conditional.sType = PhysicalDeviceConditionalRenderingFeaturesType;
+    PhysicalDeviceFeatures2 features = {};
+    features.sType = PhysicalDeviceFeatures2Type;
+    features.pNext = &conditional;
+    reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+    return conditional.conditionalRendering == VK_TRUE;
+}
+
+const void* OcclusionQueries::GetFeatureChain(const void* next)
+{
+    // read by vkCreateDevice only, one device at a time
+    static PhysicalDeviceConditionalRenderingFeatures features = {};
+    features.sType = PhysicalDeviceConditionalRenderingFeaturesType;
+    features.pNext = next;
+    features.conditionalRendering = VK_TRUE;
+    return &features;
+}
+
+OcclusionQueries::OcclusionQueries(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, PipelineRegistry& registry,
+    Pipeline& Pipeline, uint32_t slotCount, uint32_t MaxQueries, uint32_t MinTriangles)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , pipeline(Pipeline)
+    , maxQueries(MaxQueries)
+    , minTriangles(MinTriangles)
+    , slot(0)
+{
+    loadEntryPoints();
+
+    vk::QueryPoolCreateInfo queryPoolInfo;
+    queryPoolInfo.queryType = vk::QueryType::eOcclusion;
+    queryPoolInfo.queryCount = slotCount * maxQueries;
+    queryPool = device.createQueryPool(queryPoolInfo);
+
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eTransferDst | ConditionalRenderingBufferUsage, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        maxQueries * sizeof(uint32_t), nullptr, predicateBuffer, predicateMemory);
+    vkx::debug::marker::setName(device, predicateBuffer, "occlusion predicates");
+
+    boxes.reserve(maxQueries);
+    createPipeline(registry);
+}
+
+OcclusionQueries::~OcclusionQueries()
+{
+    // the registry owns the pipeline
+    commandBuffer.DestroyBuffer(predicateBuffer, predicateMemory);
+    device.destroyQueryPool(queryPool);
+}
+
+void OcclusionQueries::loadEntryPoints()
+{
+    cmdBeginConditional = device.getProcAddr("vkCmdBeginConditionalRenderingEXT");
+    cmdEndConditional = device.getProcAddr("vkCmdEndConditionalRenderingEXT");
+    if (!cmdBeginConditional || !cmdEndConditional) {
+        printf("OcclusionQueries: no conditional rendering entry points, heavy instances are always drawn\n");
+    }
+}
+
+void OcclusionQueries::createPipeline(PipelineRegistry& registry)
+{
+    // the scene pipeline's layout, its camera block set stays bound across the boxes
+    pipelineDesc = pipeline.GetBaseDesc();
+    pipelineDesc.subpass = pipeline.GetShadingSubpass();
+    pipelineDesc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\occlusion_box.vert.spv";
+    pipelineDesc.fragmentShader.clear();
+    pipelineDesc.bindings.clear();
+    pipelineDesc.attributes.clear();
+    pipelineDesc.cullMode = vk::CullModeFlagBits::eNone;
+    pipelineDesc.depthWrite = false;
+    pipelineDesc.colorWrite = false;
+    RefreshPipelines(registry);
+}
+
+void OcclusionQueries::RefreshPipelines(PipelineRegistry& registry)
+{
+    boxPipeline = registry.Get(pipelineDesc);
+    vkx::debug::marker::setName(device, boxPipeline, "occlusion boxes");
+}
+
+void OcclusionQueries::BeginFrame(uint32_t frameSlot)
+{
+    slot = frameSlot;
+    predicates.swap(queries);
+    queries.clear();
+    boxes.clear();
+}
+
+bool OcclusionQueries::AddQuery(uint32_t instanceID, const Aabb& box)
+{
+    if (boxes.size() >= maxQueries) {
+        return false;
+    }
+    queries[instanceID] = static_cast<uint32_t>(boxes.size());
+    GpuBox gpuBox;
+    for (int c = 0; c < 3; ++c) {
+        gpuBox.lower[c] = box.lower[c];
+        gpuBox.upper[c] = box.upper[c];
+    }
+    gpuBox.lower[3] = 1.0f;
+    gpuBox.upper[3] = 1.0f;
+    boxes.push_back(gpuBox);
+    return true;
+}
+
+void OcclusionQueries::RecordBegin(vk::CommandBuffer cmd)
+{
+    cmd.resetQueryPool(queryPool, slot * maxQueries, maxQueries);
+    // the previous frame's copy is the one predicates point into
+    vk::BufferMemoryBarrier toPredicate;
+    toPredicate.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toPredicate.dstAccessMask = ConditionalRenderingReadAccess;
+    toPredicate.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toPredicate.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toPredicate.buffer = predicateBuffer;
+    toPredicate.size = VK_WHOLE_SIZE;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, ConditionalRenderingStage, vk::DependencyFlags(), nullptr, toPredicate, nullptr);
+}
+
+void OcclusionQueries::BeginConditional(vk::CommandBuffer cmd, uint32_t instanceID) const
+{
+    if (!cmdBeginConditional) {
+        return;
+    }
+    auto predicate = predicates.find(instanceID);
+    if (predicate == predicates.end()) {
+        return;
+    }
+    ConditionalRenderingBeginInfo beginInfo = {};
+    beginInfo.sType = ConditionalRenderingBeginInfoType;
+    beginInfo.buffer = VkBuffer(predicateBuffer);
+    beginInfo.offset = predicate->second * sizeof(uint32_t);
+    reinterpret_cast<CmdBeginConditionalRendering>(cmdBeginConditional)(VkCommandBuffer(cmd), &beginInfo);
+}
+
+void OcclusionQueries::EndConditional(vk::CommandBuffer cmd, uint32_t instanceID) const
+{
+    if (cmdEndConditional && predicates.count(instanceID)) {
+        reinterpret_cast<CmdEndConditionalRendering>(cmdEndConditional)(VkCommandBuffer(cmd));
+    }
+}
+
+void OcclusionQueries::RecordQueries(vk::CommandBuffer cmd, uint32_t uniformOffset)
+{
+    if (boxes.empty()) {
+        return;
+    }
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, boxPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipeline.GetPipelineLayout(), 0, 1, &pipeline.GetDescriptorSet(), 1, &uniformOffset);
+    const vk::PushConstantRange& range = pipeline.GetDrawConstantRange();
+    const uint32_t first = slot * maxQueries;
+    for (uint32_t i = 0; i < boxes.size(); ++i) {
+        cmd.pushConstants(pipeline.GetPipelineLayout(), range.stageFlags, 0, sizeof(GpuBox), &boxes[i]);
+        // any sample passing is enough, no precise counts
+        cmd.beginQuery(queryPool, first + i, vk::QueryControlFlags());
+        cmd.draw(BoxVertexCount, 1, 0, 0);
+        cmd.endQuery(queryPool, first + i);
+    }
+}
+
+void OcclusionQueries::RecordEnd(vk::CommandBuffer cmd)
+{
+    if (boxes.empty()) {
+        return;
+    }
+    // this frame's predicates were read before the results replace them
+    cmd.pipelineBarrier(ConditionalRenderingStage, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, nullptr);
+    // waits on the GPU for the queries of the render pass, the CPU never does
+    cmd.copyQueryPoolResults(queryPool, slot * maxQueries, static_cast<uint32_t>(boxes.size()), predicateBuffer, 0, sizeof(uint32_t),
+        vk::QueryResultFlagBits::eWait);
+}
+} // End of namespace m3d
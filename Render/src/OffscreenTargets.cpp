@@ -0,0 +1,158 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "OffscreenTargets.hpp"
+#include "VulkanSwapchain.hpp"
+#include "vulkanDebug.h"
+
+#include <cstdio>
+
+namespace m3d {
+
+const vk::Format OffscreenTargets::ColorFormat;
+
+OffscreenTargets::OffscreenTargets(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, MemoryAllocator& Allocator, uint32_t QueueFamilyIndex)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , allocator(Allocator)
+    , queueFamilyIndex(QueueFamilyIndex)
+{
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+    commandPool = device.createCommandPool(cmdPoolInfo);
+}
+
+OffscreenTargets::~OffscreenTargets()
+{
+    destroy();
+    device.destroyCommandPool(commandPool);
+}
+
+void OffscreenTargets::destroy()
+{
+    for (auto& target : targets) {
+        device.destroyImageView(target.view);
+        device.destroyImage(target.image);
+        allocator.Free(target.imageMemory);
+        device.destroyBuffer(target.buffer);
+        allocator.Free(target.bufferMemory);
+    }
+    targets.clear();
+    device.resetCommandPool(commandPool, vk::CommandPoolResetFlags());
+}
+
+void OffscreenTargets::Create(VulkanSwapChain& swapChain, uint32_t width, uint32_t height, uint32_t count)
+{
+    destroy();
+    extent = vk::Extent2D(width, height);
+
+    vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+    cmdBufAllocateInfo.commandPool = commandPool;
+    cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    cmdBufAllocateInfo.commandBufferCount = count;
+    std::vector<vk::CommandBuffer> readbacks = device.allocateCommandBuffers(cmdBufAllocateInfo);
+
+    targets.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        Target& target = targets[i];
+
+        vk::ImageCreateInfo imageInfo;
+        imageInfo.imageType = vk::ImageType::e2D;
+        imageInfo.format = ColorFormat;
+        imageInfo.extent = vk::Extent3D(width, height, 1);
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = vk::SampleCountFlagBits::e1;
+        imageInfo.tiling = vk::ImageTiling::eOptimal;
+        imageInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+        target.image = device.createImage(imageInfo);
+        char name[32];
+        snprintf(name, sizeof(name), "offscreen image %u", i);
+        vkx::debug::marker::setName(device, target.image, name);
+        // the images live as long as the renderer, the same as render targets
+        target.imageMemory = allocator.AllocateImage(target.image, vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryAllocator::Strategy::Linear,
+            MemoryAllocator::Category::Attachment);
+
+        vk::ImageViewCreateInfo viewInfo;
+        viewInfo.viewType = vk::ImageViewType::e2D;
+        viewInfo.format = ColorFormat;
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+        viewInfo.image = target.image;
+        target.view = device.createImageView(viewInfo);
+
+        vk::BufferCreateInfo bufferInfo;
+        bufferInfo.size = static_cast<vk::DeviceSize>(GetRowPitch()) * height;
+        bufferInfo.usage = vk::BufferUsageFlagBits::eTransferDst;
+        target.buffer = device.createBuffer(bufferInfo);
+        snprintf(name, sizeof(name), "offscreen readback %u", i);
+        vkx::debug::marker::setName(device, target.buffer, name);
+        // uncached reads run at a fraction of the bandwidth, not every device has coherent cached memory
+        target.bufferMemory = allocator.AllocateBuffer(target.buffer,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostCached,
+            MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+        if (!target.bufferMemory) {
+            target.bufferMemory = allocator.AllocateBuffer(target.buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+                MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Staging);
+        }
+        if (!target.imageMemory || !target.bufferMemory) {
+            printf("OffscreenTargets: out of memory for %u x %u image %u\n", width, height, i);
+        }
+
+        target.readback = readbacks[i];
+        recordReadback(target);
+    }
+
+    // no surface: the swapchain only carries the images for CommandBuffer and Pipeline
+    swapChain.colorFormat = ColorFormat;
+    swapChain.extent = extent;
+    swapChain.queueNodeIndex = queueFamilyIndex;
+    swapChain.images.resize(count);
+    swapChain.buffers.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        swapChain.images[i] = targets[i].image;
+        swapChain.buffers[i].image = targets[i].image;
+        swapChain.buffers[i].view = targets[i].view;
+    }
+}
+
+// After the render pass, which left the image in TRANSFER_SRC_OPTIMAL
+void OffscreenTargets::recordReadback(const Target& target)
+{
+    vk::CommandBufferBeginInfo beginInfo;
+    target.readback.begin(beginInfo);
+
+    vk::ImageMemoryBarrier toCopy;
+    toCopy.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+    toCopy.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+    toCopy.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toCopy.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toCopy.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toCopy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toCopy.image = target.image;
+    toCopy.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    target.readback.pipelineBarrier(vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, toCopy);
+
+    // rows tightly packed, bufferRowLength 0
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = vk::Extent3D(extent.width, extent.height, 1);
+    target.readback.copyImageToBuffer(target.image, vk::ImageLayout::eTransferSrcOptimal, target.buffer, region);
+
+    // the fence makes the copy visible to the host once this is done
+    vk::BufferMemoryBarrier toHost;
+    toHost.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toHost.dstAccessMask = vk::AccessFlagBits::eHostRead;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = target.buffer;
+    toHost.size = VK_WHOLE_SIZE;
+    target.readback.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+        vk::DependencyFlags(), nullptr, toHost, nullptr);
+
+    target.readback.end();
+}
+} // End of namespace m3d
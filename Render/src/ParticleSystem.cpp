@@ -0,0 +1,436 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ParticleSystem.hpp"
+#include "CommandBuffer.hpp"
+#include "Pipeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t ParticleSystem::GroupSize;
+const uint32_t ParticleSystem::InvalidEmitter;
+
+// the counters of particle_*.comp: dead count, two alive counts, the current list, the additive and sorted draw
+// counts, the sort size
+static const uint32_t CounterCount = 8;
+
+ParticleSystem::ParticleSystem(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, PipelineRegistry& registry,
+    Pipeline& Pipeline, uint32_t slotCount, uint32_t MaxParticles, uint32_t MaxSorted, uint32_t MaxEmitters)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , pipeline(Pipeline)
+    , maxParticles(MaxParticles)
+    , maxSorted(MaxSorted)
+    , maxEmitters(MaxEmitters)
+    , emitterCount(0)
+    , emitCount(0)
+    , frameCount(0)
+{
+    static_assert(sizeof(GpuParticle) == 64, "particle_*.comp and particle.vert read 16 words per particle");
+    static_assert(sizeof(GpuEmitter) == 80, "particle_emit.comp reads 20 words per emitter");
+    static_assert(sizeof(GpuArgs) == 14 * sizeof(uint32_t), "particle_args.comp writes 14 words of arguments");
+    assert(maxSorted > 0 && (maxSorted & (maxSorted - 1)) == 0 && "the bitonic network sorts a power of two");
+
+    const vk::BufferUsageFlags storage = vk::BufferUsageFlagBits::eStorageBuffer;
+    createBuffer(storage, vk::MemoryPropertyFlagBits::eDeviceLocal, maxParticles * sizeof(GpuParticle), particles);
+    createBuffer(storage, vk::MemoryPropertyFlagBits::eDeviceLocal, maxParticles * sizeof(uint32_t), deadList);
+    createBuffer(storage, vk::MemoryPropertyFlagBits::eDeviceLocal, 2 * maxParticles * sizeof(uint32_t), aliveLists);
+    createBuffer(storage, vk::MemoryPropertyFlagBits::eDeviceLocal, maxParticles * sizeof(uint32_t), additiveList);
+    createBuffer(storage | vk::BufferUsageFlagBits::eTransferDst, vk::MemoryPropertyFlagBits::eDeviceLocal, maxSorted * 2 * sizeof(uint32_t), sortKeys);
+    createBuffer(storage, vk::MemoryPropertyFlagBits::eDeviceLocal, CounterCount * sizeof(uint32_t), counters);
+    createBuffer(storage | vk::BufferUsageFlagBits::eIndirectBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, sizeof(GpuArgs), args);
+    vkx::debug::marker::setName(device, particles.buffer, "particles");
+    vkx::debug::marker::setName(device, deadList.buffer, "dead particles");
+    vkx::debug::marker::setName(device, aliveLists.buffer, "alive particles");
+    vkx::debug::marker::setName(device, additiveList.buffer, "additive particles");
+    vkx::debug::marker::setName(device, sortKeys.buffer, "particle sort keys");
+    vkx::debug::marker::setName(device, counters.buffer, "particle counters");
+    vkx::debug::marker::setName(device, args.buffer, "particle arguments");
+
+    const vk::MemoryPropertyFlags hostVisible = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+    slots.resize(slotCount);
+    for (Slot& slot : slots) {
+        createBuffer(storage, hostVisible, maxEmitters * sizeof(GpuEmitter), slot.emitters);
+        createBuffer(vk::BufferUsageFlagBits::eIndirectBuffer, hostVisible, sizeof(vk::DispatchIndirectCommand), slot.spawn);
+        createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, hostVisible, sizeof(GpuFrame), slot.frame);
+        vkx::debug::marker::setName(device, slot.emitters.buffer, "particle emitters");
+        vkx::debug::marker::setName(device, slot.spawn.buffer, "particle spawns");
+        vkx::debug::marker::setName(device, slot.frame.buffer, "particle frame");
+        *static_cast<vk::DispatchIndirectCommand*>(slot.spawn.memory.mapped) = vk::DispatchIndirectCommand(0, 1, 1);
+        GpuFrame* frame = static_cast<GpuFrame*>(slot.frame.memory.mapped);
+        memset(frame, 0, sizeof(GpuFrame));
+        frame->maxParticles = maxParticles;
+        frame->maxSorted = maxSorted;
+    }
+
+    createComputePipelines();
+    createPipelines(registry);
+    writeDescriptors();
+    reset();
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    // the registry owns the draw pipelines and their layout
+    device.destroyPipeline(emitPipeline);
+    device.destroyPipeline(argsPipeline);
+    device.destroyPipeline(simulatePipeline);
+    device.destroyPipeline(sortPipeline);
+    device.destroyPipelineLayout(computeLayout);
+    device.destroyDescriptorSetLayout(computeSetLayout);
+    device.destroyDescriptorPool(descriptorPool);
+
+    for (Slot& slot : slots) {
+        for (Buffer* buffer : { &slot.emitters, &slot.spawn, &slot.frame }) {
+            destroyBuffer(*buffer);
+        }
+    }
+    for (Buffer* buffer : { &particles, &deadList, &aliveLists, &additiveList, &sortKeys, &counters, &args }) {
+        destroyBuffer(*buffer);
+    }
+}
+
+void ParticleSystem::createBuffer(vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::DeviceSize size, Buffer& buffer)
+{
+    commandBuffer.CreateBuffer(usage, properties, size, nullptr, buffer.buffer, buffer.memory);
+    assert(buffer.memory && "out of device memory for particles");
+}
+
+void ParticleSystem::destroyBuffer(Buffer& buffer)
+{
+    commandBuffer.DestroyBuffer(buffer.buffer, buffer.memory);
+    buffer = Buffer();
+}
+
+void ParticleSystem::createComputePipelines()
+{
+    // frame, emitters, particles, dead list, alive lists, additive list, sort keys, counters, arguments
+    std::array<vk::DescriptorSetLayoutBinding, 9> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    computeSetLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    // the args mode, or the bitonic step's block and distance
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, 2 * sizeof(uint32_t));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &computeSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    computeLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    emitPipeline = createComputePipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\particle_emit.comp.spv", "particle emit");
+    argsPipeline = createComputePipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\particle_args.comp.spv", "particle arguments");
+    simulatePipeline = createComputePipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\particle_simulate.comp.spv", "particle simulate");
+    sortPipeline = createComputePipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\particle_sort.comp.spv", "particle sort");
+}
+
+vk::Pipeline ParticleSystem::createComputePipeline(const char* shader, const char* name)
+{
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, shader);
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = computeLayout;
+    vk::Pipeline computePipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, computePipeline, name);
+    device.destroyShaderModule(pipelineInfo.stage.module);
+    return computePipeline;
+}
+
+void ParticleSystem::createPipelines(PipelineRegistry& registry)
+{
+    // particles, additive list, sort keys
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eVertex;
+    }
+    drawSetLayout = registry.GetDescriptorSetLayout(std::vector<vk::DescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+
+    // set 0 and the push constants as the scene pipeline has them, its camera stays bound across both
+    std::vector<vk::PushConstantRange> pushConstants;
+    if (pipeline.GetDrawConstantRange().size) {
+        pushConstants.push_back(pipeline.GetDrawConstantRange());
+    }
+    drawLayout = registry.GetPipelineLayout({ pipeline.GetDescriptorSetLayout(), drawSetLayout }, pushConstants);
+
+    PipelineDesc desc;
+    desc.renderPass = pipeline.GetRenderPass();
+    desc.subpass = pipeline.GetShadingSubpass();
+    desc.samples = pipeline.GetSamples();
+    desc.colorAttachments = pipeline.GetColorAttachmentCount();
+    desc.layout = drawLayout;
+    desc.vertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\particle.vert.spv";
+    desc.fragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\particle.frag.spv";
+    // tested against the opaque depth, blended over each other
+    desc.depthWrite = false;
+    desc.blend = true;
+    additiveDesc = desc;
+    additiveDesc.additiveBlend = true;
+    // particle.vert's sorted constant, reading the sort keys instead of the additive list
+    alphaDesc = desc;
+    alphaDesc.SetConstant(0, true);
+    RefreshPipelines(registry);
+}
+
+void ParticleSystem::RefreshPipelines(PipelineRegistry& registry)
+{
+    additivePipeline = registry.Get(additiveDesc);
+    alphaPipeline = registry.Get(alphaDesc);
+    vkx::debug::marker::setName(device, additivePipeline, "additive particles");
+    vkx::debug::marker::setName(device, alphaPipeline, "sorted particles");
+}
+
+void ParticleSystem::writeDescriptors()
+{
+    const uint32_t slotCount = static_cast<uint32_t>(slots.size());
+    std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, slotCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 8 * slotCount + 3)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = slotCount + 1;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(slotCount, computeSetLayout);
+    layouts.push_back(drawSetLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = slotCount + 1;
+    allocInfo.pSetLayouts = layouts.data();
+    std::vector<vk::DescriptorSet> sets = device.allocateDescriptorSets(allocInfo);
+
+    for (uint32_t s = 0; s < slotCount; ++s) {
+        Slot& slot = slots[s];
+        slot.set = sets[s];
+
+        std::array<vk::DescriptorBufferInfo, 9> bufferInfos = {
+            vk::DescriptorBufferInfo(slot.frame.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(slot.emitters.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(particles.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(deadList.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(aliveLists.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(additiveList.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(sortKeys.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(counters.buffer, 0, VK_WHOLE_SIZE),
+            vk::DescriptorBufferInfo(args.buffer, 0, VK_WHOLE_SIZE)
+        };
+        std::vector<vk::WriteDescriptorSet> writes(bufferInfos.size());
+        for (uint32_t i = 0; i < writes.size(); ++i) {
+            writes[i].dstSet = slot.set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = i == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+        device.updateDescriptorSets(writes, nullptr);
+    }
+
+    drawSet = sets[slotCount];
+    std::array<vk::DescriptorBufferInfo, 3> bufferInfos = {
+        vk::DescriptorBufferInfo(particles.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(additiveList.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(sortKeys.buffer, 0, VK_WHOLE_SIZE)
+    };
+    std::vector<vk::WriteDescriptorSet> writes(bufferInfos.size());
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].dstSet = drawSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[i].pBufferInfo = &bufferInfos[i];
+    }
+    device.updateDescriptorSets(writes, nullptr);
+}
+
+void ParticleSystem::reset()
+{
+    uint32_t resetCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& cmd = commandBuffer.GetCommandBuffer(resetCmdIndex);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, argsPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeLayout, 0, 1, &slots[0].set, 0, nullptr);
+    const uint32_t mode[2] = { Reset, 0 };
+    cmd.pushConstants(computeLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(mode), mode);
+    cmd.dispatch((maxParticles + GroupSize - 1) / GroupSize, 1, 1);
+    commandBuffer.Flush(resetCmdIndex);
+}
+
+uint32_t ParticleSystem::AddEmitter(const Emitter& emitter)
+{
+    uint32_t emitterID;
+    if (!freeEmitters.empty()) {
+        emitterID = freeEmitters.back();
+        freeEmitters.pop_back();
+    } else if (emitters.size() < maxEmitters) {
+        emitterID = static_cast<uint32_t>(emitters.size());
+        emitters.push_back(EmitterState());
+    } else {
+        return InvalidEmitter;
+    }
+    EmitterState& state = emitters[emitterID];
+    state.emitter = emitter;
+    state.pending = 0.0f;
+    state.used = true;
+    emitterCount++;
+    return emitterID;
+}
+
+void ParticleSystem::SetEmitter(uint32_t emitterID, const Emitter& emitter)
+{
+    assert(emitterID < emitters.size() && emitters[emitterID].used);
+    emitters[emitterID].emitter = emitter;
+}
+
+void ParticleSystem::RemoveEmitter(uint32_t emitterID)
+{
+    assert(emitterID < emitters.size() && emitters[emitterID].used);
+    emitters[emitterID].used = false;
+    freeEmitters.push_back(emitterID);
+    emitterCount--;
+}
+
+void ParticleSystem::BeginFrame(uint32_t slotIndex, float deltaTime, const float eye[3])
+{
+    Slot& slot = slots[slotIndex];
+    GpuEmitter* gpuEmitters = static_cast<GpuEmitter*>(slot.emitters.memory.mapped);
+    uint32_t spawning = 0;
+    emitCount = 0;
+    for (EmitterState& state : emitters) {
+        if (!state.used) {
+            continue;
+        }
+        // whole particles this frame, the fraction carries over
+        const Emitter& emitter = state.emitter;
+        state.pending += std::max(emitter.rate, 0.0f) * deltaTime;
+        const uint32_t spawns = std::min(static_cast<uint32_t>(state.pending), maxParticles - emitCount);
+        state.pending -= std::floor(state.pending);
+        if (spawns == 0) {
+            continue;
+        }
+        GpuEmitter& gpuEmitter = gpuEmitters[spawning++];
+        for (int c = 0; c < 3; ++c) {
+            gpuEmitter.position[c] = emitter.position[c];
+            gpuEmitter.direction[c] = emitter.direction[c];
+        }
+        gpuEmitter.position[3] = emitter.speed;
+        gpuEmitter.direction[3] = std::cos(emitter.spread);
+        memcpy(gpuEmitter.color, emitter.color, sizeof(gpuEmitter.color));
+        gpuEmitter.lifetime = emitter.lifetime;
+        gpuEmitter.size = emitter.size;
+        gpuEmitter.gravity = emitter.gravity;
+        gpuEmitter.blend = static_cast<uint32_t>(emitter.blend);
+        gpuEmitter.firstSpawn = emitCount;
+        gpuEmitter.spawnCount = spawns;
+        emitCount += spawns;
+    }
+
+    GpuFrame* frame = static_cast<GpuFrame*>(slot.frame.memory.mapped);
+    frame->eye[0] = eye[0];
+    frame->eye[1] = eye[1];
+    frame->eye[2] = eye[2];
+    frame->deltaTime = deltaTime;
+    frame->emitterCount = spawning;
+    frame->spawnCount = emitCount;
+    frame->seed = frameCount++;
+    static_cast<vk::DispatchIndirectCommand*>(slot.spawn.memory.mapped)->x = (emitCount + GroupSize - 1) / GroupSize;
+}
+
+void ParticleSystem::computeBarrier(vk::CommandBuffer cmd, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+{
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.dstAccessMask = dstAccess;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, dstStage, vk::DependencyFlags(), barrier, nullptr, nullptr);
+}
+
+void ParticleSystem::recordArgs(vk::CommandBuffer cmd, ArgsMode mode)
+{
+    const uint32_t constants[2] = { mode, 0 };
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, argsPipeline);
+    cmd.pushConstants(computeLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), constants);
+    cmd.dispatch(1, 1, 1);
+}
+
+void ParticleSystem::RecordSimulation(vk::CommandBuffer cmd, uint32_t slotIndex)
+{
+    const Slot& slot = slots[slotIndex];
+    const vk::AccessFlags shaderAccess = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+    const vk::AccessFlags argsAccess = shaderAccess | vk::AccessFlagBits::eIndirectCommandRead;
+    const vk::PipelineStageFlags argsStages = vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect;
+
+    // the previous frame's draws are done reading the lists and arguments, on this queue in submission order
+    vk::MemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlags();
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite | shaderAccess;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eDrawIndirect,
+        vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+    // keys past the frame's alpha blended particles sort last
+    cmd.fillBuffer(sortKeys.buffer, 0, VK_WHOLE_SIZE, 0xFFFFFFFF);
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = shaderAccess;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, computeLayout, 0, 1, &slot.set, 0, nullptr);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, emitPipeline);
+    cmd.dispatchIndirect(slot.spawn.buffer, 0);
+    computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, shaderAccess);
+    recordArgs(cmd, AfterEmit);
+    computeBarrier(cmd, argsStages, argsAccess);
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, simulatePipeline);
+    cmd.dispatchIndirect(args.buffer, offsetof(GpuArgs, simulate));
+    computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, shaderAccess);
+    recordArgs(cmd, AfterSimulate);
+    computeBarrier(cmd, argsStages, argsAccess);
+
+    // the whole network for maxSorted keys, each step is dispatched over the frame's power of two only
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, sortPipeline);
+    for (uint32_t block = 2; block <= maxSorted; block <<= 1) {
+        for (uint32_t distance = block >> 1; distance > 0; distance >>= 1) {
+            const uint32_t step[2] = { block, distance };
+            cmd.pushConstants(computeLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(step), step);
+            cmd.dispatchIndirect(args.buffer, offsetof(GpuArgs, sort));
+            computeBarrier(cmd, vk::PipelineStageFlagBits::eComputeShader, shaderAccess);
+        }
+    }
+    computeBarrier(cmd, vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eDrawIndirect,
+        vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eIndirectCommandRead);
+}
+
+void ParticleSystem::Draw(vk::CommandBuffer cmd) const
+{
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, drawLayout, 1, 1, &drawSet, 0, nullptr);
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, additivePipeline);
+    cmd.drawIndirect(args.buffer, offsetof(GpuArgs, additive), 1, sizeof(vk::DrawIndirectCommand));
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, alphaPipeline);
+    cmd.drawIndirect(args.buffer, offsetof(GpuArgs, sorted), 1, sizeof(vk::DrawIndirectCommand));
+}
+} // End of namespace m3d
@@ -0,0 +1,198 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "PerfLint.hpp"
+#include "vulkanDebug.h"
+
+#include <atomic>
+#include <cstdio>
+
+namespace m3d {
+namespace perflint {
+
+static const char* const issueNames[IssueCount] = {
+    "validation performance warnings",
+    "redundant pipeline binds",
+    "redundant descriptor binds",
+    "small allocations",
+    "waits for idle in a frame",
+    "unbatched submits",
+};
+
+static std::atomic<bool> enabled(false);
+static std::atomic<bool> inFrame(false);
+// the frame's, from any thread
+static std::atomic<uint32_t> counts[IssueCount];
+static std::atomic<const char*> sites[IssueCount];
+static std::atomic<int32_t> validationCode(0);
+static std::atomic<uint32_t> submits(0);
+static std::atomic<const char*> submitSite(nullptr);
+
+// main thread
+static Frame lastFrame = {};
+static uint64_t totals[IssueCount] = {};
+static const char* totalSites[IssueCount] = {};
+
+void Enable(bool enable)
+{
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool IsEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+const char* GetIssueName(Issue issue)
+{
+    return issueNames[static_cast<uint32_t>(issue)];
+}
+
+void Note(Issue issue, const char* site)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+    const uint32_t i = static_cast<uint32_t>(issue);
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+    sites[i].store(site, std::memory_order_relaxed);
+}
+
+void Allocate(vk::DeviceSize size, const char* site)
+{
+    if (size < SmallAllocationBytes) {
+        Note(Issue::SmallAllocation, site);
+    }
+}
+
+void WaitIdle(const char* site)
+{
+    if (inFrame.load(std::memory_order_relaxed)) {
+        Note(Issue::WaitIdleInFrame, site);
+    }
+}
+
+void Submit(const char* site)
+{
+    if (!IsEnabled()) {
+        return;
+    }
+    submits.fetch_add(1, std::memory_order_relaxed);
+    submitSite.store(site, std::memory_order_relaxed);
+}
+
+void BeginFrame()
+{
+    inFrame.store(IsEnabled(), std::memory_order_relaxed);
+}
+
+void EndFrame()
+{
+    inFrame.store(false, std::memory_order_relaxed);
+    if (!IsEnabled()) {
+        return;
+    }
+    // whatever the frame took beyond the budget counts once per submit
+    const uint32_t frameSubmits = submits.exchange(0, std::memory_order_relaxed);
+    if (frameSubmits > SubmitsPerFrame) {
+        const uint32_t i = static_cast<uint32_t>(Issue::UnbatchedSubmit);
+        counts[i].fetch_add(frameSubmits - SubmitsPerFrame, std::memory_order_relaxed);
+        sites[i].store(submitSite.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < IssueCount; ++i) {
+        lastFrame.counts[i] = counts[i].exchange(0, std::memory_order_relaxed);
+        lastFrame.sites[i] = lastFrame.counts[i] > 0 ? sites[i].load(std::memory_order_relaxed) : nullptr;
+        totals[i] += lastFrame.counts[i];
+        if (lastFrame.sites[i]) {
+            totalSites[i] = lastFrame.sites[i];
+        }
+    }
+    lastFrame.validationCode = validationCode.load(std::memory_order_relaxed);
+}
+
+const Frame& GetFrame()
+{
+    return lastFrame;
+}
+
+void Print(uint32_t frames)
+{
+    if (!IsEnabled() || frames == 0) {
+        return;
+    }
+    bool clean = true;
+    for (uint32_t i = 0; i < IssueCount; ++i) {
+        if (totals[i] == 0) {
+            continue;
+        }
+        if (clean) {
+            printf("  perf lint:\n");
+            clean = false;
+        }
+        printf("    %-32s %.2f/frame, last at %s", issueNames[i], double(totals[i]) / frames, totalSites[i] ? totalSites[i] : "?");
+        if (i == static_cast<uint32_t>(Issue::ValidationWarning)) {
+            printf(", code %d", lastFrame.validationCode);
+        }
+        printf("\n");
+        totals[i] = 0;
+        totalSites[i] = nullptr;
+    }
+    if (clean) {
+        printf("  perf lint: clean\n");
+    }
+}
+
+VkBool32 VKAPI_PTR MessageCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t srcObject, size_t location,
+    int32_t msgCode, const char* pLayerPrefix, const char* pMsg, void* pUserData)
+{
+    if (flags & VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT) {
+        validationCode.store(msgCode, std::memory_order_relaxed);
+        // the message is gone once the callback returned, the layer is what lives on
+        Note(Issue::ValidationWarning, "validation layers");
+    }
+    return vkx::debug::messageCallback(flags, objType, srcObject, location, msgCode, pLayerPrefix, pMsg, pUserData);
+}
+
+void BindTracker::Reset()
+{
+    pipeline = vk::Pipeline();
+    for (uint32_t i = 0; i < MaxSets; ++i) {
+        layouts[i] = vk::PipelineLayout();
+        sets[i] = vk::DescriptorSet();
+        offsets[i] = 0;
+    }
+}
+
+void BindTracker::BindPipeline(vk::CommandBuffer cmd, vk::Pipeline bound, const char* site)
+{
+    if (bound == pipeline) {
+        Note(Issue::RedundantPipelineBind, site);
+    }
+    cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, bound);
+    pipeline = bound;
+}
+
+void BindTracker::BindDescriptorSet(vk::CommandBuffer cmd, vk::PipelineLayout layout, uint32_t index, vk::DescriptorSet set,
+    uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets, const char* site)
+{
+    const uint32_t offset = dynamicOffsetCount > 0 ? dynamicOffsets[0] : 0;
+    if (index < MaxSets) {
+        if (set == sets[index] && layout == layouts[index] && offset == offsets[index]) {
+            Note(Issue::RedundantDescriptorBind, site);
+        } else if (layout != layouts[index]) {
+            // another layout may disturb the other sets, they count as unbound
+            const vk::Pipeline boundPipeline = pipeline;
+            Reset();
+            pipeline = boundPipeline;
+        }
+        layouts[index] = layout;
+        sets[index] = set;
+        offsets[index] = offset;
+    }
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, index, 1, &set, dynamicOffsetCount, dynamicOffsets);
+}
+}
+}
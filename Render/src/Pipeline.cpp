@@ -1,76 +1,182 @@
 #include "../include/Pipeline.hpp"
 #include "../include/File.hpp"
+#include "../include/PipelineRegistry.hpp"
+#include "../include/Scene.hpp"
+#include "../include/ShaderReflection.hpp"
+#include "../include/UniformRing.hpp"
 #include "../include/VulkanHelper.hpp"
+#include "../include/vulkanDebug.h"
 #include "Matrix.h"
+#include <algorithm>
+#include <cstddef>
 #define VERTEX_BUFFER_BIND_ID 0
 namespace m3d {
+	const uint32_t Pipeline::MaxTextures;
+	const uint32_t Pipeline::MaxTextureArrays;
+	const uint32_t Pipeline::MaxViews;
+	const uint32_t Pipeline::PullConstantOffset;
+	const vk::Format Pipeline::IdFormat;
+	const uint32_t Pipeline::InvalidId;
+	const uint32_t Pipeline::IdAttachment;
+	const vk::Format Pipeline::AccumFormat;
+	const vk::Format Pipeline::RevealFormat;
+	const char* const Pipeline::MultiviewExtensionName = "VK_KHR_multiview";
+
+	// VK_KHR_get_physical_device_properties2 and VK_KHR_multiview postdate the vulkan headers
+	static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+	static const VkStructureType RenderPassMultiviewCreateInfoType = static_cast<VkStructureType>(1000053000);
+	static const VkStructureType PhysicalDeviceMultiviewFeaturesType = static_cast<VkStructureType>(1000053001);
+
+	struct PhysicalDeviceFeatures2 {
+		VkStructureType sType;
+		void* pNext;
+		VkPhysicalDeviceFeatures features;
+	};
+
+	struct PhysicalDeviceMultiviewFeatures {
+		VkStructureType sType;
+		const void* pNext;
+		VkBool32 multiview;
+		VkBool32 multiviewGeometryShader;
+		VkBool32 multiviewTessellationShader;
+	};
+
+	struct RenderPassMultiviewCreateInfo {
+		VkStructureType sType;
+		const void* pNext;
+		uint32_t subpassCount;
+		const uint32_t* pViewMasks;
+		uint32_t dependencyCount;
+		const int32_t* pViewOffsets;
+		uint32_t correlationMaskCount;
+		const uint32_t* pCorrelationMasks;
+	};
+
+	typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+
+	bool Pipeline::SupportsMultiview(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+	{
+		if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, MultiviewExtensionName)) {
+			return false;
+		}
+		PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+		if (!getFeatures2) {
+			return false;
+		}
+		PhysicalDeviceMultiviewFeatures multiview = {};
+		multiview.sType = PhysicalDeviceMultiviewFeaturesType;
+		PhysicalDeviceFeatures2 features = {};
+		features.sType = PhysicalDeviceFeatures2Type;
+		features.pNext = &multiview;
+		reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+		return multiview.multiview == VK_TRUE;
+	}
+
+	const void* Pipeline::GetMultiviewFeatureChain(const void* next)
+	{
+		// read by vkCreateDevice only, one device at a time
+		static PhysicalDeviceMultiviewFeatures features = {};
+		features.sType = PhysicalDeviceMultiviewFeaturesType;
+		features.pNext = next;
+		features.multiview = VK_TRUE;
+		return &features;
+	}
+
+	static const char* TriangleVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\triangle.vert.spv";
+	static const char* TriangleFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\triangle.frag.spv";
+	static const char* IndirectVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect.vert.spv";
+	// the same with the matrices of gl_ViewIndex, for multiview render passes
+	static const char* TriangleMultiviewVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\triangle_multiview.vert.spv";
+	static const char* IndirectMultiviewVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_multiview.vert.spv";
+	// vertex pulling, the vertices and instance data through the addresses of PullConstants
+	static const char* IndirectPullVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_pull.vert.spv";
+	static const char* IndirectFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect.frag.spv";
+	static const char* IndirectClusteredFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_clustered.frag.spv";
+	// without bindless, the material's layer of one of MaxTextureArrays texture arrays
+	static const char* IndirectArrayFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_array.frag.spv";
+	// weighted blended transparency, the bindless material unlit into the accumulation and revealage
+	static const char* IndirectTransparentFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_oit.frag.spv";
+	static const char* CompositeVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\oit_composite.vert.spv";
+	static const char* CompositeFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\oit_composite.frag.spv";
+	// deferred shading, the bindless material into the G-buffer and the full screen lighting of it
+	static const char* IndirectGBufferFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\indirect_gbuffer.frag.spv";
+	static const char* LightingVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\deferred_lighting.vert.spv";
+	static const char* LightingFragmentShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\deferred_lighting.frag.spv";
+
+	void Pipeline::ReflectShaders()
+	{
+		// every pipeline of the pass binds the one descriptor set, its layout covers all of their shaders
+		const bool multiview = options.viewCount > 1;
+		std::vector<const char*> shaders = { multiview ? TriangleMultiviewVertexShader : TriangleVertexShader, TriangleFragmentShader,
+			multiview ? IndirectMultiviewVertexShader : IndirectVertexShader };
+		if (bindless) {
+			shaders.push_back(options.clusteredLighting ? IndirectClusteredFragmentShader : IndirectFragmentShader);
+		}
+		else if (textureArrays) {
+			shaders.push_back(IndirectArrayFragmentShader);
+		}
+		if (options.weightedBlended) {
+			shaders.push_back(IndirectTransparentFragmentShader);
+		}
+		// its push constants follow DrawConstants
+		if (options.vertexPulling) {
+			shaders.push_back(IndirectPullVertexShader);
+		}
+		// the lighting reads set 0 like the clustered shader, which stays in the list for it
+		if (options.deferred) {
+			shaders.push_back(IndirectGBufferFragmentShader);
+		}
+		shaderLayout = ShaderLayout();
+		for (const char* shader : shaders) {
+			ShaderLayout stage;
+			std::string error;
+			if (!ReflectSpirv(shader, stage, &error) || !shaderLayout.Merge(stage, &error)) {
+				printf("Pipeline: %s\n", error.c_str());
+				assert(false);
+			}
+		}
+		// Binding 0 : the camera block, offset per frame and draw
+		shaderLayout.SetDynamic(0, 0);
+		assert(shaderLayout.GetSetCount() <= 1);
+		for (const ShaderLayout::Binding& binding : shaderLayout.bindings) {
+			if (binding.binding == 4 && !textureArrays && binding.count != MaxTextures) {
+				printf("Pipeline: indirect.frag samples %u textures, MaxTextures is %u\n", binding.count, MaxTextures);
+			}
+			if (binding.binding == 4 && textureArrays && binding.count != MaxTextureArrays) {
+				printf("Pipeline: indirect_array.frag samples %u arrays, MaxTextureArrays is %u\n", binding.count, MaxTextureArrays);
+			}
+		}
+	}
+
 	void Pipeline::SetupVertexInputs()
 	{
-		// Binding description
-	    vertexInputs.bindingDescriptions.resize(1);
-	    vertexInputs.bindingDescriptions[0].binding = VERTEX_BUFFER_BIND_ID;
-	    vertexInputs.bindingDescriptions[0].stride = sizeof(float) * 4;
-	    vertexInputs.bindingDescriptions[0].inputRate = vk::VertexInputRate::eVertex;
-
-	    // Attribute descriptions
-	    // Describes memory layout and shader positions
-	    vertexInputs.attributeDescriptions.resize(1);
-	    // Location 0 : Position
-	    vertexInputs.attributeDescriptions[0].binding = VERTEX_BUFFER_BIND_ID;
-	    vertexInputs.attributeDescriptions[0].location = 0;
-	    vertexInputs.attributeDescriptions[0].format = vk::Format::eR32G32B32A32Sfloat;
-	    vertexInputs.attributeDescriptions[0].offset = 0;
-	    //vkTools::initializers::vertexInputAttributeDescription(
-	    //	VERTEX_BUFFER_BIND_ID,
-	    //	0,
-	    //	VK_FORMAT_R32G32B32_SFLOAT,
-	    //	0);
-
-	    // Location 1 : Normal
-	    // Location 2 : Texture coordinates
-	    // Location 3 : Color
-	    // Location 4 : Bone weights
-	    // Location 5 : Bone IDs
-
-		//vertexInputs.inputState.flags = vk::PipelineVertexInputStateCreateFlagBits::;
-	    vertexInputs.inputState.vertexBindingDescriptionCount = vertexInputs.bindingDescriptions.size();
-	    vertexInputs.inputState.pVertexBindingDescriptions = vertexInputs.bindingDescriptions.data();
-	    vertexInputs.inputState.vertexAttributeDescriptionCount = vertexInputs.attributeDescriptions.size();
-	    vertexInputs.inputState.pVertexAttributeDescriptions = vertexInputs.attributeDescriptions.data();
+		// One interleaved PackedVertex stream at VERTEX_BUFFER_BIND_ID 0, the vertex shaders pick the locations they read
+		vertexInputs.bindingDescriptions = { PackedVertexFormat::Binding() };
+		std::string error;
+		if (!SelectVertexAttributes(shaderLayout, PackedVertexFormat::Descriptions(), PackedVertexFormat::AttributeCount, vertexInputs.attributeDescriptions, &error)) {
+			printf("Pipeline: %s\n", error.c_str());
+			assert(false);
+		}
+
+		vertexInputs.inputState.vertexBindingDescriptionCount = vertexInputs.bindingDescriptions.size();
+		vertexInputs.inputState.pVertexBindingDescriptions = vertexInputs.bindingDescriptions.data();
+		vertexInputs.inputState.vertexAttributeDescriptionCount = vertexInputs.attributeDescriptions.size();
+		vertexInputs.inputState.pVertexAttributeDescriptions = vertexInputs.attributeDescriptions.data();
 	}
 	void Pipeline::CreateUniformBuffers()
 	{
 		// Prepare and initialize a uniform buffer block containing shader uniforms
 		// In Vulkan there are no more single uniforms like in GL
 		// All shader uniforms are passed as uniform buffer blocks
-		vk::MemoryRequirements memReqs;
-
-		// Vertex shader uniform buffer block
-		vk::BufferCreateInfo bufferInfo;
-		vk::MemoryAllocateInfo allocInfo;
-		allocInfo.allocationSize = 0;
-		allocInfo.memoryTypeIndex = 0;
-		bufferInfo.size = sizeof(uboVS);
-		bufferInfo.usage = vk::BufferUsageFlagBits::eUniformBuffer;
-
-		// Create a new buffer
-		uniformDataVS.buffer = device.createBuffer(bufferInfo);
-		// Get memory requirements including size, alignment and memory type
-		memReqs = device.getBufferMemoryRequirements(uniformDataVS.buffer);
-		allocInfo.allocationSize = memReqs.size;
-		// Get the memory type index that supports host visibile memory access
-		// Most implementations offer multiple memory tpyes and selecting the
-		// correct one to allocate memory from is important
-		allocInfo.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible);
-		// Allocate memory for the uniform buffer
-		(uniformDataVS.memory) = device.allocateMemory(allocInfo);
-		// Bind memory to buffer
-		device.bindBufferMemory(uniformDataVS.buffer, uniformDataVS.memory, 0);
-
-		// Store information in the uniform's descriptor
-		uniformDataVS.descriptor.buffer = uniformDataVS.buffer;
-		uniformDataVS.descriptor.offset = 0;
-		uniformDataVS.descriptor.range = sizeof(uboVS);
+
+		// One persistently mapped ring, every frame slot gets its own copy of the
+		// block and draws pick theirs through the dynamic offset
+		uniformRing.reset(new UniformRing(device, physicalDevice, frameSlots));
+
+		// Store information in the uniform's descriptor, the range of one block
+		uniformDescriptor.buffer = uniformRing->GetBuffer();
+		uniformDescriptor.offset = 0;
+		uniformDescriptor.range = sizeof(uboVS);
 
 		// Update matrices
 		float pMat[16] = {
@@ -93,42 +199,143 @@ namespace m3d {
 		uboVS.viewMatrix.ToString(buf, 512);
 		printf("vmat = %s\n", buf);
 		uboVS.modelMatrix = m3d::math::Matrix4x4();
+		SetCamera(uboVS.viewMatrix, uboVS.projectionMatrix);
+		SetShadowCascades(nullptr, nullptr, 0);
+
+		// Every slot starts out with the initial matrices, static command buffers
+		// read them even if no frame ever calls BeginFrame
+		for (uint32_t slot = 0; slot < frameSlots; ++slot) {
+			BeginFrame(slot);
+		}
+	}
 
-		// Map uniform buffer and update it
-		// If you want to keep a handle to the memory and not unmap it afer updating,
-		// create the memory with the vk::MemoryPropertyFlagBits::eHostCoherent
-		void* pData = device.mapMemory(uniformDataVS.memory, 0, sizeof(uboVS), vk::MemoryMapFlags());
-		// TODO:
-		size_t uboSize = sizeof(uboVS);
-		printf("sizeof ubo = %d", uboSize);
-		memcpy(pData, &uboVS, sizeof(uboVS));
-		device.unmapMemory(uniformDataVS.memory);
+	uint32_t Pipeline::BeginFrame(uint32_t slot)
+	{
+		uniformRing->BeginFrame(slot);
+		return uniformRing->Push(uboVS);
 	}
 
-	void Pipeline::CreateRenderPass()
+	void Pipeline::PushDrawConstants(vk::CommandBuffer cmd, const DrawConstants& constants) const
+	{
+		// the range goes on to PullConstants with vertex pulling
+		const uint32_t size = std::min<uint32_t>(drawConstantRange.size, sizeof(DrawConstants));
+		if (size) {
+			cmd.pushConstants(pipelineLayout, drawConstantRange.stageFlags, 0, size, &constants);
+		}
+	}
+
+	void Pipeline::PushMaterial(vk::CommandBuffer cmd, uint32_t material) const
+	{
+		// the shaders may end the block before the material
+		if (offsetof(DrawConstants, material) + sizeof(uint32_t) <= drawConstantRange.size) {
+			cmd.pushConstants(pipelineLayout, drawConstantRange.stageFlags, offsetof(DrawConstants, material), sizeof(uint32_t), &material);
+		}
+	}
+
+	void Pipeline::PushPullConstants(vk::CommandBuffer cmd, const PullConstants& constants) const
+	{
+		assert(options.vertexPulling);
+		cmd.pushConstants(pipelineLayout, drawConstantRange.stageFlags, PullConstantOffset, sizeof(PullConstants), &constants);
+	}
+
+	void Pipeline::PushVertexAddress(vk::CommandBuffer cmd, uint64_t vertices) const
 	{
-		std::array<vk::AttachmentDescription, 2> attachments;
+		assert(options.vertexPulling);
+		cmd.pushConstants(pipelineLayout, drawConstantRange.stageFlags, PullConstantOffset + offsetof(PullConstants, vertices), sizeof(uint64_t), &vertices);
+	}
 
-		// Color attachment
-		attachments[0].format = vk::Format::eB8G8R8A8Unorm;
-		attachments[0].samples = vk::SampleCountFlagBits::e1;
+	uint32_t Pipeline::GetFrameOffset(uint32_t slot) const
+	{
+		return uniformRing->GetFrameOffset(slot);
+	}
+
+	void Pipeline::SetCamera(const m3d::math::Matrix4x4& viewMatrix, const m3d::math::Matrix4x4& projectionMatrix)
+	{
+		uboVS.viewMatrix = viewMatrix;
+		uboVS.projectionMatrix = projectionMatrix;
+		// every view until SetViews says otherwise
+		for (uint32_t i = 0; i < MaxViews; ++i) {
+			uboVS.viewMatrices[i] = viewMatrix;
+			uboVS.projectionMatrices[i] = projectionMatrix;
+		}
+	}
+
+	void Pipeline::SetViews(const m3d::math::Matrix4x4* viewMatrices, const m3d::math::Matrix4x4* projectionMatrices, uint32_t count)
+	{
+		assert(count > 0);
+		SetCamera(viewMatrices[0], projectionMatrices[0]);
+		count = count < MaxViews ? count : MaxViews;
+		for (uint32_t i = 1; i < count; ++i) {
+			uboVS.viewMatrices[i] = viewMatrices[i];
+			uboVS.projectionMatrices[i] = projectionMatrices[i];
+		}
+	}
+
+	void Pipeline::CreateRenderPass()
+	{
+		const bool multisampled = options.samples != vk::SampleCountFlagBits::e1;
+		const bool multiview = options.viewCount > 1;
+		// the layers are blitted into the swapchain image after the pass
+		const vk::ImageLayout finalLayout = multiview ? vk::ImageLayout::eTransferSrcOptimal : options.finalLayout;
+		std::array<vk::AttachmentDescription, 8> attachments;
+
+		// Color attachment, multisampled it only lives in tile memory until it is resolved
+		attachments[0].format = options.colorFormat;
+		attachments[0].samples = options.samples;
 		attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
-		attachments[0].storeOp = vk::AttachmentStoreOp::eStore;
+		attachments[0].storeOp = multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
 		attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 		attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 		attachments[0].initialLayout = vk::ImageLayout::eUndefined;
-		attachments[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
+		attachments[0].finalLayout = multisampled ? vk::ImageLayout::eColorAttachmentOptimal : finalLayout;
 		// Depth attachment
 		vk::Format depthFormat = {};
 		vkhelper::getSupportedDepthFormat(physicalDevice, depthFormat);
 		attachments[1].format = depthFormat;
-		attachments[1].samples = vk::SampleCountFlagBits::e1;
+		attachments[1].samples = options.samples;
 		attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
-		attachments[1].storeOp = vk::AttachmentStoreOp::eStore;
+		attachments[1].storeOp = options.storeDepth ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
 		attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 		attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 		attachments[1].initialLayout = vk::ImageLayout::eUndefined;
 		attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+		// Resolve attachment, the swapchain image, every pixel is written by the resolve
+		attachments[2].format = options.colorFormat;
+		attachments[2].samples = vk::SampleCountFlagBits::e1;
+		attachments[2].loadOp = vk::AttachmentLoadOp::eDontCare;
+		attachments[2].storeOp = vk::AttachmentStoreOp::eStore;
+		attachments[2].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+		attachments[2].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+		attachments[2].initialLayout = vk::ImageLayout::eUndefined;
+		attachments[2].finalLayout = finalLayout;
+		if (options.idBuffer) {
+			// ID attachment, nothing drawn reads as InvalidId; kept for the picks copied out after the pass
+			attachments[IdAttachment].format = IdFormat;
+			attachments[IdAttachment].loadOp = vk::AttachmentLoadOp::eClear;
+			attachments[IdAttachment].finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+		}
+		// Accumulation and revealage, cleared to nothing and full revealage, read by the overlay subpass and dropped
+		const uint32_t accumAttachment = GetAccumAttachment();
+		const uint32_t revealAttachment = accumAttachment + 1;
+		if (options.weightedBlended) {
+			attachments[accumAttachment] = attachments[1];
+			attachments[accumAttachment].format = AccumFormat;
+			attachments[accumAttachment].storeOp = vk::AttachmentStoreOp::eDontCare;
+			attachments[accumAttachment].finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			attachments[revealAttachment] = attachments[accumAttachment];
+			attachments[revealAttachment].format = RevealFormat;
+		}
+		// G-buffer, cleared to nothing drawn, read by the shading subpass and dropped
+		const uint32_t gbufferAttachment = GetGBufferAttachment();
+		if (options.deferred) {
+			const std::array<vk::Format, GBufferAttachmentCount> formats = { { GBufferAlbedoFormat, GBufferNormalFormat, GBufferDepthFormat } };
+			for (uint32_t i = 0; i < GBufferAttachmentCount; ++i) {
+				attachments[gbufferAttachment + i] = attachments[1];
+				attachments[gbufferAttachment + i].format = formats[i];
+				attachments[gbufferAttachment + i].storeOp = vk::AttachmentStoreOp::eDontCare;
+				attachments[gbufferAttachment + i].finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			}
+		}
 
 		vk::AttachmentReference colorReference = {};
 		colorReference.attachment = 0;
@@ -138,60 +345,207 @@ namespace m3d {
 		depthReference.attachment = 1;
 		depthReference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
-		vk::SubpassDescription subpassDescription = {};
-
+		vk::AttachmentReference resolveReference = {};
+		resolveReference.attachment = 2;
+		resolveReference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
+		// location 0 the color, 1 the IDs
+		std::array<vk::AttachmentReference, 2> colorReferences = { { colorReference, {} } };
+		colorReferences[1].attachment = IdAttachment;
+		colorReferences[1].layout = vk::ImageLayout::eColorAttachmentOptimal;
+
+		// the transparent subpass writes accumulation and revealage, the overlay subpass reads them
+		std::array<vk::AttachmentReference, 2> transparentReferences = { { {}, {} } };
+		transparentReferences[0].attachment = accumAttachment;
+		transparentReferences[0].layout = vk::ImageLayout::eColorAttachmentOptimal;
+		transparentReferences[1].attachment = revealAttachment;
+		transparentReferences[1].layout = vk::ImageLayout::eColorAttachmentOptimal;
+		std::array<vk::AttachmentReference, 2> inputReferences = transparentReferences;
+		inputReferences[0].layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		inputReferences[1].layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		// what the shading subpass wrote lives through the transparent one
+		const std::array<uint32_t, 2> preserved = { { 0, IdAttachment } };
+
+		// the G-buffer subpass writes albedo, normal, depth and the IDs, the shading subpass reads the first three
+		std::array<vk::AttachmentReference, GBufferAttachmentCount + 1> gbufferReferences;
+		std::array<vk::AttachmentReference, GBufferAttachmentCount> gbufferInputReferences;
+		for (uint32_t i = 0; i < GBufferAttachmentCount; ++i) {
+			gbufferReferences[i].attachment = gbufferAttachment + i;
+			gbufferReferences[i].layout = vk::ImageLayout::eColorAttachmentOptimal;
+			gbufferInputReferences[i].attachment = gbufferAttachment + i;
+			gbufferInputReferences[i].layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+		}
+		gbufferReferences[GBufferAttachmentCount] = colorReferences[1];
+
+		// the pre-pass subpass has no color attachment
+		std::array<vk::SubpassDescription, 5> subpassDescriptions;
+		subpassDescriptions[0].pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+		subpassDescriptions[0].pDepthStencilAttachment = &depthReference;
+
+		vk::SubpassDescription& subpassDescription = subpassDescriptions[GetShadingSubpass()];
 		subpassDescription.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-		subpassDescription.colorAttachmentCount = 1;
-		subpassDescription.pColorAttachments = &colorReference;
+		subpassDescription.colorAttachmentCount = GetColorAttachmentCount();
+		subpassDescription.pColorAttachments = colorReferences.data();
+		subpassDescription.pResolveAttachments = multisampled ? &resolveReference : nullptr;
 		subpassDescription.pDepthStencilAttachment = &depthReference;
 
-		std::array<vk::SubpassDependency, 2> subpassDependencies;
+		if (options.deferred) {
+			// the depth is written here, the shading subpass tests its forward draws against it
+			vk::SubpassDescription& gbufferDescription = subpassDescriptions[GetGBufferSubpass()];
+			gbufferDescription.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+			gbufferDescription.colorAttachmentCount = options.idBuffer ? GBufferAttachmentCount + 1 : GBufferAttachmentCount;
+			gbufferDescription.pColorAttachments = gbufferReferences.data();
+			gbufferDescription.pDepthStencilAttachment = &depthReference;
+
+			subpassDescription.inputAttachmentCount = GBufferAttachmentCount;
+			subpassDescription.pInputAttachments = gbufferInputReferences.data();
+		}
+
+		if (options.weightedBlended) {
+			// the depth stays attached, its layout too; no pipeline of the subpass writes it
+			vk::SubpassDescription& transparentDescription = subpassDescriptions[GetTransparentSubpass()];
+			transparentDescription.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+			transparentDescription.colorAttachmentCount = static_cast<uint32_t>(transparentReferences.size());
+			transparentDescription.pColorAttachments = transparentReferences.data();
+			transparentDescription.pDepthStencilAttachment = &depthReference;
+			transparentDescription.preserveAttachmentCount = options.idBuffer ? 2 : 1;
+			transparentDescription.pPreserveAttachments = preserved.data();
+
+			// the shading subpass's attachments again, pipelines of both are compatible
+			vk::SubpassDescription& overlayDescription = subpassDescriptions[GetOverlaySubpass()];
+			overlayDescription = subpassDescription;
+			overlayDescription.inputAttachmentCount = static_cast<uint32_t>(inputReferences.size());
+			overlayDescription.pInputAttachments = inputReferences.data();
+		}
+
+		std::vector<vk::SubpassDependency> subpassDependencies(2);
 
 		subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-		subpassDependencies[0].dstSubpass = 0;
+		subpassDependencies[0].dstSubpass = GetShadingSubpass();
 		subpassDependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;
 		subpassDependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
 		subpassDependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
 		subpassDependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 		subpassDependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+		if (options.deferred) {
+			// the G-buffer subpass writes the IDs picks of earlier frames copied
+			vk::SubpassDependency gbufferDependency = subpassDependencies[0];
+			gbufferDependency.dstSubpass = GetGBufferSubpass();
+			subpassDependencies.push_back(gbufferDependency);
+		}
 
 		subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-		subpassDependencies[1].srcSubpass = 0;
+		subpassDependencies[1].srcSubpass = GetOverlaySubpass();
 		subpassDependencies[1].dstAccessMask = vk::AccessFlagBits::eMemoryRead;
 		subpassDependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
 		subpassDependencies[1].dstStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
 		subpassDependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 		subpassDependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+		if (finalLayout == vk::ImageLayout::eTransferSrcOptimal || options.idBuffer) {
+			// blits into the swapchain image or readbacks and picks copy it right after the pass
+			subpassDependencies[1].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+			subpassDependencies[1].dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+			subpassDependencies[1].dependencyFlags = vk::DependencyFlags();
+		}
+		if (finalLayout == vk::ImageLayout::eShaderReadOnlyOptimal) {
+			// post processing samples it in compute passes right after the pass, picks may still copy the IDs
+			subpassDependencies[1].dstAccessMask |= vk::AccessFlagBits::eShaderRead;
+			subpassDependencies[1].dstStageMask |= vk::PipelineStageFlagBits::eComputeShader;
+			subpassDependencies[1].dependencyFlags = vk::DependencyFlags();
+		}
+
+		// the shading subpass tests against the depth the pre-pass wrote
+		vk::SubpassDependency depthDependency;
+		depthDependency.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+		depthDependency.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+		depthDependency.srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+		depthDependency.dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+		depthDependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+		if (options.depthPrepass) {
+			depthDependency.srcSubpass = 0;
+			depthDependency.dstSubpass = 1;
+			subpassDependencies.push_back(depthDependency);
+		}
+		if (options.deferred) {
+			// the lighting reads the G-buffer at its own pixel, the forward draws test against its depth
+			vk::SubpassDependency gbufferDependency;
+			gbufferDependency.srcSubpass = GetGBufferSubpass();
+			gbufferDependency.dstSubpass = GetShadingSubpass();
+			gbufferDependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+			gbufferDependency.dstAccessMask = vk::AccessFlagBits::eInputAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentRead
+				| vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+			gbufferDependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests;
+			gbufferDependency.dstStageMask = vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eEarlyFragmentTests;
+			gbufferDependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+			subpassDependencies.push_back(gbufferDependency);
+		}
+		if (options.weightedBlended) {
+			// transparent fragments test against the shaded scene's depth
+			depthDependency.srcSubpass = GetShadingSubpass();
+			depthDependency.dstSubpass = GetTransparentSubpass();
+			depthDependency.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead;
+			subpassDependencies.push_back(depthDependency);
+			// the composite reads accumulation and revealage at its own pixel
+			vk::SubpassDependency inputDependency;
+			inputDependency.srcSubpass = GetTransparentSubpass();
+			inputDependency.dstSubpass = GetOverlaySubpass();
+			inputDependency.srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+			inputDependency.dstAccessMask = vk::AccessFlagBits::eInputAttachmentRead;
+			inputDependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+			inputDependency.dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+			inputDependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+			subpassDependencies.push_back(inputDependency);
+			// and blends over the shaded color
+			vk::SubpassDependency colorDependency = inputDependency;
+			colorDependency.srcSubpass = GetShadingSubpass();
+			colorDependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+			colorDependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+			subpassDependencies.push_back(colorDependency);
+		}
 
 		vk::RenderPassCreateInfo renderPassInfo;
-		renderPassInfo.attachmentCount = (uint32_t)attachments.size();
+		renderPassInfo.attachmentCount = GetAttachmentCount();
 		renderPassInfo.pAttachments = attachments.data();
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpassDescription;
-		renderPassInfo.dependencyCount = (uint32_t)subpassDependencies.size();
+		renderPassInfo.subpassCount = GetOverlaySubpass() + 1;
+		renderPassInfo.pSubpasses = subpassDescriptions.data();
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
 		renderPassInfo.pDependencies = subpassDependencies.data();
 
+		// every subpass renders all views, their geometry is the same so it may be processed once for all of them
+		const uint32_t viewMask = (1u << options.viewCount) - 1;
+		const std::array<uint32_t, 5> viewMasks = { { viewMask, viewMask, viewMask, viewMask, viewMask } };
+		RenderPassMultiviewCreateInfo multiviewInfo = {};
+		multiviewInfo.sType = RenderPassMultiviewCreateInfoType;
+		multiviewInfo.subpassCount = renderPassInfo.subpassCount;
+		multiviewInfo.pViewMasks = viewMasks.data();
+		multiviewInfo.correlationMaskCount = 1;
+		multiviewInfo.pCorrelationMasks = &viewMask;
+		if (multiview) {
+			renderPassInfo.pNext = &multiviewInfo;
+		}
+
 		renderPass = device.createRenderPass(renderPassInfo);
+		vkx::debug::marker::setName(device, renderPass, options.deferred ? "scene pass, deferred" : options.depthPrepass ? "scene pass, depth prepass" : "scene pass");
+	}
+
+	uint32_t Pipeline::GetAttachmentCount() const
+	{
+		uint32_t count = options.samples != vk::SampleCountFlagBits::e1 || options.idBuffer ? 3 : 2;
+		count = options.weightedBlended ? count + 2 : count;
+		return options.deferred ? count + GBufferAttachmentCount : count;
 	}
 
 	void Pipeline::CreateDescriptorPool()
 	{
-		// We need to tell the API the number of max. requested descriptors per type
-		vk::DescriptorPoolSize typeCounts[1];
-		// This example only uses one descriptor type (uniform buffer) and only
-		// requests one descriptor of this type
-		typeCounts[0].type = vk::DescriptorType::eUniformBuffer;
-		typeCounts[0].descriptorCount = 1;
-		// For additional types you need to add new entries in the type count list
-		// E.g. for two combined image samplers :
-		// typeCounts[1].type = vk::DescriptorType::eCombinedImageSampler;
-		// typeCounts[1].descriptorCount = 2;
+		// We need to tell the API the number of max. requested descriptors per type,
+		// exactly those of the one set the shaders declare
+		std::vector<vk::DescriptorPoolSize> typeCounts = shaderLayout.GetPoolSizes(0);
 
 		// Create the global descriptor pool
 		// All descriptors used in this example are allocated from this pool
 		vk::DescriptorPoolCreateInfo descriptorPoolInfo;
-		descriptorPoolInfo.poolSizeCount = 1;
-		descriptorPoolInfo.pPoolSizes = typeCounts;
+		descriptorPoolInfo.poolSizeCount = (uint32_t)typeCounts.size();
+		descriptorPoolInfo.pPoolSizes = typeCounts.data();
 		// Set the max. number of sets that can be requested
 		// Requesting descriptors beyond maxSets will result in an error
 		descriptorPoolInfo.maxSets = 1;
@@ -201,37 +555,25 @@ namespace m3d {
 
 	void Pipeline::CreateDescriptorSetLayout()
 	{
-		// Setup layout of descriptors used in this example
-		// Basically connects the different shader stages to descriptors
-		// for binding uniform buffers, image samplers, etc.
-		// So every shader binding should map to one descriptor set layout
-		// binding
-
-		// Binding 0 : Uniform buffer (Vertex shader)
-		vk::DescriptorSetLayoutBinding layoutBinding = {};
-		layoutBinding.descriptorType = vk::DescriptorType::eUniformBuffer;
-		layoutBinding.descriptorCount = 1;
-		layoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
-		layoutBinding.pImmutableSamplers = nullptr;
-
-		vk::DescriptorSetLayoutCreateInfo descriptorLayout = {};
-		descriptorLayout.bindingCount = 1;
-		descriptorLayout.pBindings = &layoutBinding;
-
-		descriptorSetLayout = device.createDescriptorSetLayout(descriptorLayout);
+		// Binding 0 : camera uniform buffer (vertex), 1 and 2 : instance transforms and per draw
+		// indices of the indirect pipeline (vertex), bindless only 3 and 4 : materials and every
+		// texture of the scene, or the texture arrays without bindless (fragment), clustered lighting only 5 to 7 : cluster parameters, lights
+		// and clusters, 8 : the shadow cascades and 9 and 10 : the shadow atlas table and tiles (fragment). As the
+		// shaders declare them, see ReflectShaders
+		descriptorSetLayout = registry.GetDescriptorSetLayout(shaderLayout.GetSetBindings(0));
 	}
 
 	void Pipeline::CreatePipelineLayout()
 	{
-		// Create the pipeline layout that is used to generate the rendering pipelines that
-		// are based on this descriptor set layout
-		// In a more complex scenario you would have different pipeline layouts for different
-		// descriptor set layouts that could be reused
-		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {};
-		pPipelineLayoutCreateInfo.setLayoutCount = 1;
-		pPipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-
-		pipelineLayout = device.createPipelineLayout(pPipelineLayoutCreateInfo);
+		// per draw data, a draw changes it without a buffer write or a descriptor set bind.
+		// The range of the block the shaders declare, DrawConstants may be longer
+		std::vector<vk::PushConstantRange> pushConstantRanges = shaderLayout.GetPushConstantRanges();
+		if (!pushConstantRanges.empty()) {
+			drawConstantRange = pushConstantRanges[0];
+			assert(drawConstantRange.size <= PullConstantOffset + sizeof(PullConstants));
+		}
+		// shared with every permutation of the same interface
+		pipelineLayout = registry.GetPipelineLayout({ descriptorSetLayout }, pushConstantRanges);
 	}
 
 	void Pipeline::CreateDescriptorSet()
@@ -253,40 +595,187 @@ namespace m3d {
 		// Binding 0 : Uniform buffer
 		writeDescriptorSet.dstSet = descriptorSet;
 		writeDescriptorSet.descriptorCount = 1;
-		writeDescriptorSet.descriptorType = vk::DescriptorType::eUniformBuffer;
-		writeDescriptorSet.pBufferInfo = &uniformDataVS.descriptor;
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+		writeDescriptorSet.pBufferInfo = &uniformDescriptor;
 		// Binds this uniform buffer to binding point 0
 		writeDescriptorSet.dstBinding = 0;
 
 		device.updateDescriptorSets(writeDescriptorSet, nullptr);
 	}
 
+	void Pipeline::SetInstanceTransforms(const vk::DescriptorBufferInfo& descriptor)
+	{
+		vk::WriteDescriptorSet writeDescriptorSet;
+		writeDescriptorSet.dstSet = descriptorSet;
+		writeDescriptorSet.descriptorCount = 1;
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eStorageBuffer;
+		writeDescriptorSet.pBufferInfo = &descriptor;
+		writeDescriptorSet.dstBinding = 1;
+
+		device.updateDescriptorSets(writeDescriptorSet, nullptr);
+	}
+
+	void Pipeline::SetDrawInfos(const vk::DescriptorBufferInfo& descriptor)
+	{
+		vk::WriteDescriptorSet writeDescriptorSet;
+		writeDescriptorSet.dstSet = descriptorSet;
+		writeDescriptorSet.descriptorCount = 1;
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eStorageBuffer;
+		writeDescriptorSet.pBufferInfo = &descriptor;
+		writeDescriptorSet.dstBinding = 2;
+
+		device.updateDescriptorSets(writeDescriptorSet, nullptr);
+	}
+
+	void Pipeline::SetMaterials(const vk::DescriptorBufferInfo& descriptor)
+	{
+		vk::WriteDescriptorSet writeDescriptorSet;
+		writeDescriptorSet.dstSet = descriptorSet;
+		writeDescriptorSet.descriptorCount = 1;
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eStorageBuffer;
+		writeDescriptorSet.pBufferInfo = &descriptor;
+		writeDescriptorSet.dstBinding = 3;
+
+		device.updateDescriptorSets(writeDescriptorSet, nullptr);
+	}
+
+	void Pipeline::SetTextures(uint32_t first, const std::vector<vk::DescriptorImageInfo>& images)
+	{
+		if (images.empty()) {
+			return;
+		}
+		vk::WriteDescriptorSet writeDescriptorSet;
+		writeDescriptorSet.dstSet = descriptorSet;
+		writeDescriptorSet.dstArrayElement = first;
+		writeDescriptorSet.descriptorCount = (uint32_t)images.size();
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		writeDescriptorSet.pImageInfo = images.data();
+		writeDescriptorSet.dstBinding = 4;
+
+		device.updateDescriptorSets(writeDescriptorSet, nullptr);
+	}
+
+	void Pipeline::SetClusteredLights(const vk::DescriptorBufferInfo& params, const vk::DescriptorBufferInfo& lights, const vk::DescriptorBufferInfo& clusters)
+	{
+		std::array<vk::WriteDescriptorSet, 3> writeDescriptorSets;
+		const vk::DescriptorBufferInfo* descriptors[] = { &params, &lights, &clusters };
+		for (uint32_t i = 0; i < writeDescriptorSets.size(); ++i) {
+			writeDescriptorSets[i].dstSet = descriptorSet;
+			writeDescriptorSets[i].descriptorCount = 1;
+			writeDescriptorSets[i].descriptorType = i == 0 ? vk::DescriptorType::eUniformBuffer : vk::DescriptorType::eStorageBuffer;
+			writeDescriptorSets[i].pBufferInfo = descriptors[i];
+			writeDescriptorSets[i].dstBinding = 5 + i;
+		}
+
+		device.updateDescriptorSets(writeDescriptorSets, nullptr);
+	}
+
+	void Pipeline::SetShadowMap(const vk::DescriptorImageInfo& shadowMap)
+	{
+		vk::WriteDescriptorSet writeDescriptorSet;
+		writeDescriptorSet.dstSet = descriptorSet;
+		writeDescriptorSet.descriptorCount = 1;
+		writeDescriptorSet.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		writeDescriptorSet.pImageInfo = &shadowMap;
+		writeDescriptorSet.dstBinding = 8;
+
+		device.updateDescriptorSets(writeDescriptorSet, nullptr);
+	}
+
+	void Pipeline::SetShadowAtlas(const vk::DescriptorBufferInfo& table, const vk::DescriptorImageInfo& atlas)
+	{
+		std::array<vk::WriteDescriptorSet, 2> writeDescriptorSets;
+		writeDescriptorSets[0].dstSet = descriptorSet;
+		writeDescriptorSets[0].descriptorCount = 1;
+		writeDescriptorSets[0].descriptorType = vk::DescriptorType::eStorageBuffer;
+		writeDescriptorSets[0].pBufferInfo = &table;
+		writeDescriptorSets[0].dstBinding = 9;
+		writeDescriptorSets[1].dstSet = descriptorSet;
+		writeDescriptorSets[1].descriptorCount = 1;
+		writeDescriptorSets[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		writeDescriptorSets[1].pImageInfo = &atlas;
+		writeDescriptorSets[1].dstBinding = 10;
+
+		device.updateDescriptorSets(writeDescriptorSets, nullptr);
+	}
+
+	void Pipeline::SetShadowCascades(const m3d::math::Matrix4x4* matrices, const float* splits, uint32_t count)
+	{
+		uboVS.cascadeCount = count < MaxShadowCascades ? count : MaxShadowCascades;
+		for (uint32_t i = 0; i < MaxShadowCascades; ++i) {
+			uboVS.shadowMatrices[i] = i < uboVS.cascadeCount ? matrices[i] : m3d::math::Matrix4x4();
+			uboVS.cascadeSplits[i] = i < uboVS.cascadeCount ? splits[i] : 0.0f;
+		}
+		uboVS.pad[0] = uboVS.pad[1] = uboVS.pad[2] = 0;
+	}
+
 	vk::ShaderModule _loadShader(const std::string& filename, vk::Device device, vk::ShaderStageFlagBits stage)
 	{
-		std::vector<uint8_t> binaryData; // = readBinaryFile(filename);
-		m3d::file::readBinary(filename.c_str(), binaryData);
-		vk::ShaderModuleCreateInfo moduleCreateInfo;
-		moduleCreateInfo.codeSize = binaryData.size();
-		moduleCreateInfo.pCode = (uint32_t*)binaryData.data();
-		return device.createShaderModule(moduleCreateInfo);
+		return vkhelper::loadShaderModule(device, filename.c_str());
 	}
 
 	vk::PipelineShaderStageCreateInfo Pipeline::loadShader(const std::string& fileName, vk::ShaderStageFlagBits stage)
 	{
 		vk::PipelineShaderStageCreateInfo shaderStage;
 		shaderStage.stage = stage;
-#if defined(__ANDROID__)
-		shaderStage.module = _loadShader(androidApp->activity->assetManager, fileName.c_str(), device, stage);
-#else
+		// Android reads it from the APK assets, see file::setAssetManager
 		shaderStage.module = _loadShader(fileName.c_str(), device, stage);
-#endif
 		shaderStage.pName = "main"; // todo : make param
 		assert(shaderStage.module);
 		return shaderStage;
 	}
 
-	Pipeline::Pipeline(vk::Device &Device, vk::PhysicalDevice &PhysicalDevice) : device(Device), physicalDevice(PhysicalDevice)
+	Pipeline::Pipeline(vk::Device &Device, vk::PhysicalDevice &PhysicalDevice, PipelineRegistry &Registry, uint32_t FrameSlots, const Options& PassOptions) : device(Device), physicalDevice(PhysicalDevice), registry(Registry), options(PassOptions), frameSlots(FrameSlots)
 	{
+		// one texture index per draw is dynamically uniform, plain array indexing covers it
+		vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+		vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+		bindless = options.bindless && features.shaderSampledImageArrayDynamicIndexing == VK_TRUE
+			&& limits.maxPerStageDescriptorSamplers >= MaxTextures && limits.maxDescriptorSetSamplers >= MaxTextures;
+		// otherwise a few texture arrays, picked by constant indices, hold the textures
+		textureArrays = options.bindless && !bindless && limits.maxPerStageDescriptorSamplers >= MaxTextureArrays
+			&& limits.maxDescriptorSetSamplers >= MaxTextureArrays;
+		if (options.bindless && !bindless) {
+			printf(textureArrays ? "no bindless textures on this device, indirect draws sample texture arrays\n"
+				: "no bindless textures on this device, indirect draws stay untextured\n");
+		}
+		// the lit shader is the bindless one plus the lights
+		options.clusteredLighting = options.clusteredLighting && bindless;
+		assert(options.viewCount > 0 && options.viewCount <= MaxViews);
+		// the next lower count color and depth attachments both support
+		const vk::SampleCountFlags sampleCounts = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+		const vk::SampleCountFlagBits requestedSamples = options.samples;
+		while (options.samples != vk::SampleCountFlagBits::e1 && !(sampleCounts & options.samples)) {
+			options.samples = static_cast<vk::SampleCountFlagBits>(static_cast<uint32_t>(options.samples) >> 1);
+		}
+		if (options.samples != requestedSamples) {
+			printf("%u samples are not supported, using %u\n", static_cast<uint32_t>(requestedSamples), static_cast<uint32_t>(options.samples));
+		}
+		// the ID attachment takes the resolve attachment's place and never blends while the color one may
+		if (options.idBuffer && (options.samples != vk::SampleCountFlagBits::e1 || options.viewCount > 1 || features.independentBlend != VK_TRUE)) {
+			printf("the ID buffer needs one sample, one view and independent blending, picks read nothing\n");
+			options.idBuffer = false;
+		}
+		// the composite reads single sampled input attachments, the accumulation and revealage blend differently
+		if (options.weightedBlended && (!bindless || options.samples != vk::SampleCountFlagBits::e1 || options.viewCount > 1
+			|| features.independentBlend != VK_TRUE)) {
+			printf("weighted blended transparency needs bindless materials, one sample, one view and independent blending, "
+				"transparent materials draw opaque\n");
+			options.weightedBlended = false;
+		}
+		// the lighting reads single sampled input attachments with the camera of the one view, and shades like the
+		// clustered shader
+		if (options.deferred && (!options.clusteredLighting || options.samples != vk::SampleCountFlagBits::e1 || options.viewCount > 1)) {
+			printf("deferred shading needs clustered lighting, one sample and one view, shading forward\n");
+			options.deferred = false;
+		}
+		// indirect_pull.vert has the matrices of the one view
+		if (options.vertexPulling && options.viewCount > 1) {
+			printf("vertex pulling needs one view, the indirect draws bind their vertex buffers\n");
+			options.vertexPulling = false;
+		}
+
+		ReflectShaders();
 		CreateDescriptorPool();
 		CreateDescriptorSetLayout();
 		CreateUniformBuffers();
@@ -294,118 +783,180 @@ namespace m3d {
 		CreatePipelineLayout();
 
 		CreateRenderPass();
-		// Create our rendering pipeline used in this example
-	    // Vulkan uses the concept of rendering pipelines to encapsulate
-	    // fixed states
-	    // This replaces OpenGL's huge (and cumbersome) state machine
-	    // A pipeline is then stored and hashed on the GPU making
-	    // pipeline changes much faster than having to set dozens of
-	    // states
-	    // In a real world application you'd have dozens of pipelines
-	    // for every shader set used in a scene
-	    // Note that there are a few states that are not stored with
-	    // the pipeline. These are called dynamic states and the
-	    // pipeline only stores that they are used with this pipeline,
-	    // but not their states
-
-		
-
-	    // Vertex input state
-	    // Describes the topoloy used with this pipeline
-		vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
-	    inputAssemblyState.topology = vk::PrimitiveTopology::eTriangleList;
-
-	    // Rasterization state
-		vk::PipelineRasterizationStateCreateInfo rasterizationState = {};
-	    rasterizationState.polygonMode = vk::PolygonMode::eFill;
-	    rasterizationState.cullMode = vk::CullModeFlagBits::eNone;
-	    rasterizationState.frontFace = vk::FrontFace::eCounterClockwise;
-	    rasterizationState.depthClampEnable = VK_FALSE;
-	    rasterizationState.rasterizerDiscardEnable = VK_FALSE;
-	    rasterizationState.depthBiasEnable = VK_FALSE;
-	    rasterizationState.lineWidth = 1.0f;
-
-	    // Color blend state
-	    // Describes blend modes and color masks
-		
-	    // One blend attachment state
-	    // Blending is not used in this example
-	    vk::PipelineColorBlendAttachmentState blendAttachmentState[1] = {};
-	    blendAttachmentState[0].colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
-	    blendAttachmentState[0].blendEnable = VK_FALSE;
-	    
-		vk::PipelineColorBlendStateCreateInfo colorBlendState = {};
-		colorBlendState.attachmentCount = 1;
-	    colorBlendState.pAttachments = blendAttachmentState;
-
-	    // vk::Viewport state
-		vk::PipelineViewportStateCreateInfo viewportState = {};
-	    // One viewport
-	    viewportState.viewportCount = 1;
-	    // One scissor rectangle
-	    viewportState.scissorCount = 1;
-
-	    // Enable dynamic states
-	    // Describes the dynamic states to be used with this pipeline
-	    // Dynamic states can be set even after the pipeline has been created
-	    // So there is no need to create new pipelines just for changing
-	    // a viewport's dimensions or a scissor box
-		vk::PipelineDynamicStateCreateInfo dynamicState = {};
-	    // The dynamic state properties themselves are stored in the command buffer
-	    std::vector<vk::DynamicState> dynamicStateEnables;
-	    dynamicStateEnables.push_back(vk::DynamicState::eViewport);
-	    dynamicStateEnables.push_back(vk::DynamicState::eScissor);
-	    dynamicState.pDynamicStates = dynamicStateEnables.data();
-	    dynamicState.dynamicStateCount = dynamicStateEnables.size();
-
-	    // Depth and stencil state
-	    // Describes depth and stenctil test and compare ops
-		vk::PipelineDepthStencilStateCreateInfo depthStencilState = {};
-	    // Basic depth compare setup with depth writes and depth test enabled
-	    // No stencil used
-	    depthStencilState.depthTestEnable = VK_TRUE;
-	    depthStencilState.depthWriteEnable = VK_TRUE;
-	    depthStencilState.depthCompareOp = vk::CompareOp::eLessOrEqual;
-	    depthStencilState.depthBoundsTestEnable = VK_FALSE;
-	    depthStencilState.back.failOp = vk::StencilOp::eKeep;
-	    depthStencilState.back.passOp = vk::StencilOp::eKeep;
-	    depthStencilState.back.compareOp = vk::CompareOp::eAlways;
-	    depthStencilState.stencilTestEnable = VK_FALSE;
-	    depthStencilState.front = depthStencilState.back;
-
-	    // Multi sampling state
-		vk::PipelineMultisampleStateCreateInfo multisampleState = {};
-	    multisampleState.pSampleMask = nullptr;
-	    multisampleState.rasterizationSamples = vk::SampleCountFlagBits::e1;
-
-	    // Load shaders
-	    // Shaders are loaded from the SPIR-V format, which can be generated from glsl
-	    std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages;
-	    shaderStages[0] = loadShader("D:\\workspace\\m3d\\data\\shaders\\camera\\triangle.vert.spv", vk::ShaderStageFlagBits::eVertex);
-	    shaderStages[1] = loadShader("D:\\workspace\\m3d\\data\\shaders\\camera\\triangle.frag.spv", vk::ShaderStageFlagBits::eFragment);
-
-	    // Assign states
-	    // Assign pipeline state create information
 		SetupVertexInputs();
 
-		vk::GraphicsPipelineCreateInfo pipelineCreateInfo = {};
-		pipelineCreateInfo.layout = pipelineLayout;
-		pipelineCreateInfo.renderPass = renderPass;
-	    pipelineCreateInfo.stageCount = shaderStages.size();
-	    pipelineCreateInfo.pStages = shaderStages.data();
-	    pipelineCreateInfo.pVertexInputState = &vertexInputs.inputState;
-	    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-	    pipelineCreateInfo.pRasterizationState = &rasterizationState;
-	    pipelineCreateInfo.pColorBlendState = &colorBlendState;
-	    pipelineCreateInfo.pMultisampleState = &multisampleState;
-	    pipelineCreateInfo.pViewportState = &viewportState;
-	    pipelineCreateInfo.pDepthStencilState = &depthStencilState;
-	    pipelineCreateInfo.pDynamicState = &dynamicState;
-
-	    // Create rendering pipeline
-	    // TODO: release
-	    vk::PipelineCache pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
-		pipeline = device.createGraphicsPipeline(pipelineCache , pipelineCreateInfo);
+		// Fixed state lives in the registry, pipelines only differ by their description
+		mainDesc = GetBaseDesc();
+		mainDesc.subpass = GetShadingSubpass();
+		mainDesc.vertexShader = options.viewCount > 1 ? TriangleMultiviewVertexShader : TriangleVertexShader;
+		mainDesc.fragmentShader = TriangleFragmentShader;
+		mainDesc.shadingRateImage = options.shadingRateImage;
+
+		// Same state, the vertex shader fetches its draw's world matrix through gl_InstanceIndex
+		indirectDesc = mainDesc;
+		indirectDesc.vertexShader = options.viewCount > 1 ? IndirectMultiviewVertexShader : IndirectVertexShader;
+		if (options.vertexPulling) {
+			// no vertex input, every geometry block and vertex format draws with the same pipelines
+			indirectDesc.vertexShader = IndirectPullVertexShader;
+			indirectDesc.bindings.clear();
+			indirectDesc.attributes.clear();
+		}
+		if (bindless) {
+			// material and texture from the per draw index, lit by the lights of the fragment's cluster
+			indirectDesc.fragmentShader = options.clusteredLighting ? IndirectClusteredFragmentShader : IndirectFragmentShader;
+			// both write the ID buffer too
+			indirectDesc.writeExtraAttachments = true;
+		}
+		else if (textureArrays) {
+			// unlit, the layer of the material's array; writes the ID buffer too
+			indirectDesc.fragmentShader = IndirectArrayFragmentShader;
+			indirectDesc.writeExtraAttachments = true;
+		}
+		if (options.deferred) {
+			// only the surface, the lighting subpass shades it; the IDs follow the G-buffer
+			indirectDesc.subpass = GetGBufferSubpass();
+			indirectDesc.fragmentShader = IndirectGBufferFragmentShader;
+			indirectDesc.colorAttachments = options.idBuffer ? GBufferAttachmentCount + 1 : GBufferAttachmentCount;
+		}
+
+		if (options.depthPrepass) {
+			// the same vertex shaders lay down depth, shading only passes where its depth is the nearest
+			depthDesc = mainDesc;
+			depthDesc.subpass = 0;
+			depthDesc.fragmentShader.clear();
+			depthDesc.colorAttachments = 0;
+			depthDesc.shadingRateImage = false;
+			indirectDepthDesc = indirectDesc;
+			indirectDepthDesc.subpass = 0;
+			indirectDepthDesc.fragmentShader.clear();
+			indirectDepthDesc.colorAttachments = 0;
+			indirectDepthDesc.shadingRateImage = false;
+
+			mainDesc.depthWrite = false;
+			mainDesc.depthCompare = vk::CompareOp::eLessOrEqual;
+			indirectDesc.depthWrite = false;
+			indirectDesc.depthCompare = vk::CompareOp::eLessOrEqual;
+			// skinned vertices are not known before the shading subpass, they write their own depth
+			skinnedDesc = mainDesc;
+			skinnedDesc.depthWrite = true;
+
+			registry.Warm({ depthDesc, indirectDepthDesc, skinnedDesc });
+			depthPipeline = registry.Get(depthDesc);
+			indirectDepthPipeline = registry.Get(indirectDepthDesc);
+			skinnedPipeline = registry.Get(skinnedDesc);
+			vkx::debug::marker::setName(device, depthPipeline, "depth");
+			vkx::debug::marker::setName(device, indirectDepthPipeline, "indirect depth");
+			vkx::debug::marker::setName(device, skinnedPipeline, "skinned");
+		}
+
+		if (options.weightedBlended) {
+			// the indirect draws of transparent slices, tested against the scene's depth without writing it
+			transparentDesc = indirectDesc;
+			transparentDesc.subpass = GetTransparentSubpass();
+			transparentDesc.fragmentShader = IndirectTransparentFragmentShader;
+			transparentDesc.depthWrite = false;
+			transparentDesc.depthCompare = vk::CompareOp::eLessOrEqual;
+			transparentDesc.colorAttachments = 2;
+			transparentDesc.writeExtraAttachments = true;
+			transparentDesc.weightedBlend = true;
+
+			// Binding 0 : accumulation, 1 : revealage (fragment)
+			std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
+			for (uint32_t i = 0; i < bindings.size(); ++i) {
+				bindings[i].binding = i;
+				bindings[i].descriptorType = vk::DescriptorType::eInputAttachment;
+				bindings[i].descriptorCount = 1;
+				bindings[i].stageFlags = vk::ShaderStageFlagBits::eFragment;
+			}
+			compositeSetLayout = registry.GetDescriptorSetLayout(std::vector<vk::DescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+			compositeLayout = registry.GetPipelineLayout({ compositeSetLayout }, std::vector<vk::PushConstantRange>());
+
+			// a full screen triangle blended over the scene by the coverage, IDs stay those of the opaque draws
+			compositeDesc = GetBaseDesc();
+			compositeDesc.subpass = GetOverlaySubpass();
+			compositeDesc.layout = compositeLayout;
+			compositeDesc.vertexShader = CompositeVertexShader;
+			compositeDesc.fragmentShader = CompositeFragmentShader;
+			compositeDesc.bindings.clear();
+			compositeDesc.attributes.clear();
+			compositeDesc.depthTest = false;
+			compositeDesc.depthWrite = false;
+			compositeDesc.blend = true;
+
+			registry.Warm({ transparentDesc, compositeDesc });
+			transparentPipeline = registry.Get(transparentDesc);
+			compositePipeline = registry.Get(compositeDesc);
+			vkx::debug::marker::setName(device, transparentPipeline, "indirect transparent");
+			vkx::debug::marker::setName(device, compositePipeline, "transparency composite");
+		}
+
+		if (options.deferred) {
+			// Binding 0 : albedo, 1 : normal, 2 : depth (fragment)
+			std::array<vk::DescriptorSetLayoutBinding, GBufferAttachmentCount> bindings;
+			for (uint32_t i = 0; i < bindings.size(); ++i) {
+				bindings[i].binding = i;
+				bindings[i].descriptorType = vk::DescriptorType::eInputAttachment;
+				bindings[i].descriptorCount = 1;
+				bindings[i].stageFlags = vk::ShaderStageFlagBits::eFragment;
+			}
+			lightingSetLayout = registry.GetDescriptorSetLayout(std::vector<vk::DescriptorSetLayoutBinding>(bindings.begin(), bindings.end()));
+			// set 0 and the push constants of the scene's layout, the set bound for the draws before stays valid
+			lightingLayout = registry.GetPipelineLayout({ descriptorSetLayout, lightingSetLayout }, shaderLayout.GetPushConstantRanges());
+
+			// a full screen triangle ahead of the forward draws, it neither tests nor writes depth; the IDs stay
+			lightingDesc = GetBaseDesc();
+			lightingDesc.subpass = GetShadingSubpass();
+			lightingDesc.layout = lightingLayout;
+			lightingDesc.vertexShader = LightingVertexShader;
+			lightingDesc.fragmentShader = LightingFragmentShader;
+			lightingDesc.bindings.clear();
+			lightingDesc.attributes.clear();
+			lightingDesc.depthTest = false;
+			lightingDesc.depthWrite = false;
+			lightingDesc.shadingRateImage = options.shadingRateImage;
+
+			registry.Warm({ lightingDesc });
+			lightingPipeline = registry.Get(lightingDesc);
+			vkx::debug::marker::setName(device, lightingPipeline, "deferred lighting");
+		}
+
+		// Compile both on the warm threads, Get waits for whichever is still in flight
+		registry.Warm({ mainDesc, indirectDesc });
+		pipeline = registry.Get(mainDesc);
+		indirectPipeline = registry.Get(indirectDesc);
+		vkx::debug::marker::setName(device, pipeline, "main");
+		vkx::debug::marker::setName(device, indirectPipeline, "indirect");
+	}
+
+	void Pipeline::RefreshPipelines()
+	{
+		// lookups of registered pipelines, nothing is compiled here
+		pipeline = registry.Get(mainDesc);
+		indirectPipeline = registry.Get(indirectDesc);
+		if (options.depthPrepass) {
+			depthPipeline = registry.Get(depthDesc);
+			indirectDepthPipeline = registry.Get(indirectDepthDesc);
+			skinnedPipeline = registry.Get(skinnedDesc);
+		}
+		if (options.weightedBlended) {
+			transparentPipeline = registry.Get(transparentDesc);
+			compositePipeline = registry.Get(compositeDesc);
+		}
+		if (options.deferred) {
+			lightingPipeline = registry.Get(lightingDesc);
+		}
+	}
+
+	PipelineDesc Pipeline::GetBaseDesc()
+	{
+		PipelineDesc desc;
+		desc.renderPass = renderPass;
+		desc.layout = pipelineLayout;
+		desc.samples = options.samples;
+		desc.colorAttachments = GetColorAttachmentCount();
+		desc.bindings = vertexInputs.bindingDescriptions;
+		desc.attributes = vertexInputs.attributeDescriptions;
+		return desc;
 	}
 
 	Pipeline::~Pipeline()
@@ -0,0 +1,563 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "PipelineRegistry.hpp"
+#include "File.hpp"
+#include "ResourceTrash.hpp"
+#include "ShaderReflection.hpp"
+#include "ShadingRate.hpp"
+#include "ThreadPool.hpp"
+#include "VulkanHelper.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace m3d {
+
+/* FNV-1a */
+static void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+template <class T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+    hashBytes(hash, &value, sizeof(T));
+}
+
+uint64_t PipelineDesc::Hash() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    hashValue(hash, static_cast<VkRenderPass>(renderPass));
+    hashValue(hash, subpass);
+    hashValue(hash, static_cast<VkPipelineLayout>(layout));
+    hashBytes(hash, vertexShader.data(), vertexShader.size());
+    hashBytes(hash, fragmentShader.data(), fragmentShader.size());
+    for (const auto& binding : bindings) {
+        hashValue(hash, binding.binding);
+        hashValue(hash, binding.stride);
+        hashValue(hash, binding.inputRate);
+    }
+    for (const auto& attribute : attributes) {
+        hashValue(hash, attribute.location);
+        hashValue(hash, attribute.binding);
+        hashValue(hash, attribute.format);
+        hashValue(hash, attribute.offset);
+    }
+    hashValue(hash, topology);
+    hashValue(hash, static_cast<VkCullModeFlags>(cullMode));
+    hashValue(hash, frontFace);
+    hashValue(hash, depthTest);
+    hashValue(hash, depthWrite);
+    hashValue(hash, depthCompare);
+    hashValue(hash, depthBiasConstant);
+    hashValue(hash, depthBiasSlope);
+    hashValue(hash, blend);
+    hashValue(hash, additiveBlend);
+    hashValue(hash, premultipliedBlend);
+    hashValue(hash, weightedBlend);
+    hashValue(hash, colorAttachments);
+    hashValue(hash, writeExtraAttachments);
+    hashValue(hash, colorWrite);
+    hashValue(hash, samples);
+    hashValue(hash, shadingRateImage);
+    for (const Constant& constant : constants) {
+        hashValue(hash, constant.id);
+        hashValue(hash, constant.value);
+    }
+    return hash;
+}
+
+void PipelineDesc::SetConstant(uint32_t id, uint32_t value)
+{
+    // sorted, descs that set the same constants in another order are equal
+    auto it = std::lower_bound(constants.begin(), constants.end(), id, [](const Constant& constant, uint32_t constantId) {
+        return constant.id < constantId;
+    });
+    if (it != constants.end() && it->id == id) {
+        it->value = value;
+    } else {
+        Constant constant;
+        constant.id = id;
+        constant.value = value;
+        constants.insert(it, constant);
+    }
+}
+
+void PipelineDesc::SetConstant(uint32_t id, int32_t value)
+{
+    SetConstant(id, static_cast<uint32_t>(value));
+}
+
+void PipelineDesc::SetConstant(uint32_t id, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    SetConstant(id, bits);
+}
+
+void PipelineDesc::SetConstant(uint32_t id, bool value)
+{
+    SetConstant(id, static_cast<uint32_t>(value ? VK_TRUE : VK_FALSE));
+}
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const
+{
+    return renderPass == other.renderPass && subpass == other.subpass && layout == other.layout
+        && vertexShader == other.vertexShader && fragmentShader == other.fragmentShader
+        && bindings == other.bindings && attributes == other.attributes
+        && topology == other.topology && cullMode == other.cullMode && frontFace == other.frontFace
+        && depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompare == other.depthCompare
+        && depthBiasConstant == other.depthBiasConstant && depthBiasSlope == other.depthBiasSlope && blend == other.blend && additiveBlend == other.additiveBlend
+        && premultipliedBlend == other.premultipliedBlend && weightedBlend == other.weightedBlend
+        && colorAttachments == other.colorAttachments
+        && writeExtraAttachments == other.writeExtraAttachments && colorWrite == other.colorWrite
+        && samples == other.samples && shadingRateImage == other.shadingRateImage && constants == other.constants;
+}
+
+PipelineRegistry::PipelineRegistry(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, const std::string& CachePath, uint32_t warmThreadCount)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , cachePath(CachePath)
+    , warmThreads(new ThreadPool(warmThreadCount, JobSystem::Priority::Background))
+{
+    auto cacheData = loadCache();
+
+    vk::PipelineCacheCreateInfo cacheInfo;
+    if (cacheData) {
+        cacheInfo.initialDataSize = cacheData->size();
+        cacheInfo.pInitialData = cacheData->data();
+    }
+    pipelineCache = device.createPipelineCache(cacheInfo);
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+    // let pending warm jobs finish before their pipelines are destroyed
+    warmThreads->Wait();
+    warmThreads.reset();
+    Save();
+
+    for (auto& pipeline : pipelines) {
+        device.destroyPipeline(pipeline.second.pipeline);
+    }
+    for (auto& pipeline : reloaded) {
+        device.destroyPipeline(pipeline.pipeline);
+    }
+    for (auto& module : shaderModules) {
+        device.destroyShaderModule(module.second);
+    }
+    for (auto& module : replacedModules) {
+        device.destroyShaderModule(module);
+    }
+    for (auto& layout : pipelineLayouts) {
+        device.destroyPipelineLayout(layout.second.layout);
+    }
+    for (auto& layout : setLayouts) {
+        device.destroyDescriptorSetLayout(layout.second.layout);
+    }
+    device.destroyPipelineCache(pipelineCache);
+}
+
+std::shared_ptr<const file::MappedFile> PipelineRegistry::loadCache()
+{
+    auto data = file::MappedFile::open(cachePath.c_str());
+    if (!data) {
+        return nullptr;
+    }
+
+    // VkPipelineCacheHeaderVersionOne: the blob is only useful for the device and driver that wrote it
+    struct Header {
+        uint32_t headerSize;
+        uint32_t headerVersion;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint8_t uuid[VK_UUID_SIZE];
+    } header;
+    if (data->size() < sizeof(Header)) {
+        return nullptr;
+    }
+    memcpy(&header, data->data(), sizeof(Header));
+
+    vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+    bool valid = header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == properties.vendorID
+        && header.deviceID == properties.deviceID
+        && memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if (!valid) {
+        printf("PipelineRegistry: %s was written by another device or driver, starting cold\n", cachePath.c_str());
+        return nullptr;
+    }
+    return data;
+}
+
+bool PipelineRegistry::Save()
+{
+    std::vector<uint8_t> data = device.getPipelineCacheData(pipelineCache);
+    if (data.empty()) {
+        return false;
+    }
+    return file::writeBinary(cachePath.c_str(), data.data(), data.size());
+}
+
+size_t PipelineRegistry::GetPipelineCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pipelines.size();
+}
+
+vk::Pipeline PipelineRegistry::Get(const PipelineDesc& desc)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = pipelines.find(desc);
+    if (it != pipelines.end()) {
+        // being compiled by a warm thread or another caller
+        Entry* entry = &it->second;
+        pipelineReady.wait(lock, [entry]() { return entry->ready; });
+        return entry->pipeline;
+    }
+
+    Entry& entry = pipelines[desc];
+    lock.unlock();
+
+    vk::Pipeline pipeline = create(desc);
+
+    lock.lock();
+    entry.pipeline = pipeline;
+    entry.ready = true;
+    pipelineReady.notify_all();
+    return pipeline;
+}
+
+void PipelineRegistry::Warm(const std::vector<PipelineDesc>& descs)
+{
+    for (const PipelineDesc& desc : descs) {
+        warmThreads->Enqueue([this, desc]() { Get(desc); });
+    }
+}
+
+vk::ShaderModule PipelineRegistry::getShaderModule(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(shaderMutex);
+    auto it = shaderModules.find(fileName);
+    if (it != shaderModules.end()) {
+        return it->second;
+    }
+
+    vk::ShaderModule module = vkhelper::loadShaderModule(device, fileName.c_str());
+    assert(module);
+    shaderModules[fileName] = module;
+    return module;
+}
+
+std::vector<std::string> PipelineRegistry::GetShaderFiles()
+{
+    std::lock_guard<std::mutex> lock(shaderMutex);
+    std::vector<std::string> files;
+    for (auto& module : shaderModules) {
+        files.push_back(module.first);
+    }
+    return files;
+}
+
+uint32_t PipelineRegistry::ReloadShader(const std::string& fileName, const std::vector<uint32_t>& code)
+{
+    vk::ShaderModuleCreateInfo moduleInfo;
+    moduleInfo.codeSize = code.size() * sizeof(uint32_t);
+    moduleInfo.pCode = code.data();
+    vk::ShaderModule module = device.createShaderModule(moduleInfo);
+    {
+        // pipelines created from here on use the new module
+        std::lock_guard<std::mutex> lock(shaderMutex);
+        vk::ShaderModule& current = shaderModules[fileName];
+        if (current) {
+            std::lock_guard<std::mutex> reloadLock(mutex);
+            replacedModules.push_back(current);
+        }
+        current = module;
+    }
+
+    // pipelines still being compiled may have picked up either module, they keep it until the next edit
+    std::vector<PipelineDesc> descs;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& pipeline : pipelines) {
+            const PipelineDesc& desc = pipeline.first;
+            if (pipeline.second.ready && (desc.vertexShader == fileName || desc.fragmentShader == fileName)) {
+                descs.push_back(desc);
+            }
+        }
+    }
+
+    std::vector<Reloaded> rebuilt;
+    for (const PipelineDesc& desc : descs) {
+        Reloaded pipeline;
+        pipeline.desc = desc;
+        pipeline.pipeline = create(desc);
+        rebuilt.push_back(pipeline);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    reloaded.insert(reloaded.end(), rebuilt.begin(), rebuilt.end());
+    return static_cast<uint32_t>(rebuilt.size());
+}
+
+bool PipelineRegistry::HasReloaded()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !reloaded.empty();
+}
+
+bool PipelineRegistry::SwapReloaded(ResourceTrash& trash)
+{
+    std::vector<Reloaded> swapped;
+    std::vector<vk::ShaderModule> modules;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        swapped.swap(reloaded);
+        modules.swap(replacedModules);
+        for (Reloaded& pipeline : swapped) {
+            // the old pipeline goes to the trash in its place
+            std::swap(pipelines[pipeline.desc].pipeline, pipeline.pipeline);
+        }
+    }
+    if (swapped.empty() && modules.empty()) {
+        return false;
+    }
+
+    // frames in flight may still run the old pipelines
+    vk::Device dev = device;
+    trash.Trash([dev, swapped, modules]() {
+        for (const Reloaded& pipeline : swapped) {
+            dev.destroyPipeline(pipeline.pipeline);
+        }
+        for (vk::ShaderModule module : modules) {
+            dev.destroyShaderModule(module);
+        }
+    });
+    return !swapped.empty();
+}
+
+vk::DescriptorSetLayout PipelineRegistry::GetDescriptorSetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& unsorted)
+{
+    std::vector<vk::DescriptorSetLayoutBinding> bindings = unsorted;
+    std::sort(bindings.begin(), bindings.end(), [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+        return a.binding < b.binding;
+    });
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto& binding : bindings) {
+        hashValue(hash, binding.binding);
+        hashValue(hash, binding.descriptorType);
+        hashValue(hash, binding.descriptorCount);
+        hashValue(hash, static_cast<VkShaderStageFlags>(binding.stageFlags));
+        hashValue(hash, binding.pImmutableSamplers);
+    }
+
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    auto range = setLayouts.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.bindings == bindings) {
+            return it->second.layout;
+        }
+    }
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    SetLayout entry;
+    entry.bindings = bindings;
+    entry.layout = device.createDescriptorSetLayout(layoutInfo);
+    setLayouts.insert(std::make_pair(hash, entry));
+    return entry.layout;
+}
+
+vk::PipelineLayout PipelineRegistry::GetPipelineLayout(const std::vector<vk::DescriptorSetLayout>& layouts, const std::vector<vk::PushConstantRange>& pushConstants)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (vk::DescriptorSetLayout layout : layouts) {
+        hashValue(hash, static_cast<VkDescriptorSetLayout>(layout));
+    }
+    for (const auto& range : pushConstants) {
+        hashValue(hash, static_cast<VkShaderStageFlags>(range.stageFlags));
+        hashValue(hash, range.offset);
+        hashValue(hash, range.size);
+    }
+
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    auto range = pipelineLayouts.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.setLayouts == layouts && it->second.pushConstants == pushConstants) {
+            return it->second.layout;
+        }
+    }
+    vk::PipelineLayoutCreateInfo layoutInfo;
+    layoutInfo.setLayoutCount = static_cast<uint32_t>(layouts.size());
+    layoutInfo.pSetLayouts = layouts.data();
+    layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstants.size());
+    layoutInfo.pPushConstantRanges = pushConstants.data();
+    PipelineLayout entry;
+    entry.setLayouts = layouts;
+    entry.pushConstants = pushConstants;
+    entry.layout = device.createPipelineLayout(layoutInfo);
+    pipelineLayouts.insert(std::make_pair(hash, entry));
+    return entry.layout;
+}
+
+vk::PipelineLayout PipelineRegistry::GetPipelineLayout(const ShaderLayout& layout, std::vector<vk::DescriptorSetLayout>* layouts)
+{
+    // sets without bindings in between still need a layout, an empty one
+    std::vector<vk::DescriptorSetLayout> sets;
+    for (uint32_t set = 0; set < layout.GetSetCount(); ++set) {
+        sets.push_back(GetDescriptorSetLayout(layout.GetSetBindings(set)));
+    }
+    if (layouts) {
+        *layouts = sets;
+    }
+    return GetPipelineLayout(sets, layout.GetPushConstantRanges());
+}
+
+size_t PipelineRegistry::GetLayoutCount()
+{
+    std::lock_guard<std::mutex> lock(layoutMutex);
+    return setLayouts.size() + pipelineLayouts.size();
+}
+
+vk::Pipeline PipelineRegistry::create(const PipelineDesc& desc)
+{
+    vk::PipelineVertexInputStateCreateInfo vertexInputState;
+    vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.bindings.size());
+    vertexInputState.pVertexBindingDescriptions = desc.bindings.data();
+    vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.attributes.size());
+    vertexInputState.pVertexAttributeDescriptions = desc.attributes.data();
+
+    vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState;
+    inputAssemblyState.topology = desc.topology;
+
+    vk::PipelineRasterizationStateCreateInfo rasterizationState;
+    rasterizationState.polygonMode = vk::PolygonMode::eFill;
+    rasterizationState.cullMode = desc.cullMode;
+    rasterizationState.frontFace = desc.frontFace;
+    rasterizationState.depthBiasEnable = desc.depthBiasConstant != 0.0f || desc.depthBiasSlope != 0.0f;
+    rasterizationState.depthBiasConstantFactor = desc.depthBiasConstant;
+    rasterizationState.depthBiasSlopeFactor = desc.depthBiasSlope;
+    rasterizationState.lineWidth = 1.0f;
+
+    vk::PipelineColorBlendAttachmentState blendAttachmentState;
+    blendAttachmentState.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+    if (!desc.colorWrite) {
+        blendAttachmentState.colorWriteMask = vk::ColorComponentFlags();
+    }
+    blendAttachmentState.blendEnable = desc.blend ? VK_TRUE : VK_FALSE;
+    blendAttachmentState.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+    blendAttachmentState.dstColorBlendFactor = desc.additiveBlend ? vk::BlendFactor::eOne : vk::BlendFactor::eOneMinusSrcAlpha;
+    blendAttachmentState.colorBlendOp = vk::BlendOp::eAdd;
+    blendAttachmentState.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+    blendAttachmentState.dstAlphaBlendFactor = vk::BlendFactor::eZero;
+    blendAttachmentState.alphaBlendOp = vk::BlendOp::eAdd;
+    if (desc.premultipliedBlend) {
+        blendAttachmentState.srcColorBlendFactor = vk::BlendFactor::eOne;
+        blendAttachmentState.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    }
+
+    // the same state for every attachment; the ones past the first hold integers, which do not blend
+    std::vector<vk::PipelineColorBlendAttachmentState> blendAttachmentStates(desc.colorAttachments, blendAttachmentState);
+    for (uint32_t i = 1; i < desc.colorAttachments; ++i) {
+        blendAttachmentStates[i].blendEnable = VK_FALSE;
+        if (!desc.writeExtraAttachments) {
+            blendAttachmentStates[i].colorWriteMask = vk::ColorComponentFlags();
+        }
+    }
+    if (desc.weightedBlend) {
+        // premultiplied color and coverage summed, the revealage multiplied by what each fragment lets through
+        assert(desc.colorAttachments == 2);
+        blendAttachmentStates[0].blendEnable = VK_TRUE;
+        blendAttachmentStates[0].srcColorBlendFactor = vk::BlendFactor::eOne;
+        blendAttachmentStates[0].dstColorBlendFactor = vk::BlendFactor::eOne;
+        blendAttachmentStates[0].srcAlphaBlendFactor = vk::BlendFactor::eOne;
+        blendAttachmentStates[0].dstAlphaBlendFactor = vk::BlendFactor::eOne;
+        blendAttachmentStates[1] = blendAttachmentStates[0];
+        blendAttachmentStates[1].srcColorBlendFactor = vk::BlendFactor::eZero;
+        blendAttachmentStates[1].dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcColor;
+        blendAttachmentStates[1].srcAlphaBlendFactor = vk::BlendFactor::eZero;
+        blendAttachmentStates[1].dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+    }
+    vk::PipelineColorBlendStateCreateInfo colorBlendState;
+    colorBlendState.attachmentCount = desc.colorAttachments;
+    colorBlendState.pAttachments = blendAttachmentStates.data();
+
+    vk::PipelineViewportStateCreateInfo viewportState;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+    if (desc.shadingRateImage) {
+        viewportState.pNext = ShadingRate::GetViewportState();
+    }
+
+    std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamicState;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    vk::PipelineDepthStencilStateCreateInfo depthStencilState;
+    depthStencilState.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+    depthStencilState.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencilState.depthCompareOp = desc.depthCompare;
+    depthStencilState.back.failOp = vk::StencilOp::eKeep;
+    depthStencilState.back.passOp = vk::StencilOp::eKeep;
+    depthStencilState.back.compareOp = vk::CompareOp::eAlways;
+    depthStencilState.front = depthStencilState.back;
+
+    vk::PipelineMultisampleStateCreateInfo multisampleState;
+    multisampleState.rasterizationSamples = desc.samples;
+
+    // the constants are packed one after the other, each entry points at its value
+    std::vector<vk::SpecializationMapEntry> constantEntries;
+    std::vector<uint32_t> constantData;
+    for (const PipelineDesc::Constant& constant : desc.constants) {
+        constantEntries.push_back(vk::SpecializationMapEntry(constant.id, static_cast<uint32_t>(constantData.size() * sizeof(uint32_t)), sizeof(uint32_t)));
+        constantData.push_back(constant.value);
+    }
+    vk::SpecializationInfo specialization;
+    specialization.mapEntryCount = static_cast<uint32_t>(constantEntries.size());
+    specialization.pMapEntries = constantEntries.data();
+    specialization.dataSize = constantData.size() * sizeof(uint32_t);
+    specialization.pData = constantData.data();
+    const vk::SpecializationInfo* stageSpecialization = desc.constants.empty() ? nullptr : &specialization;
+
+    std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages;
+    shaderStages[0].stage = vk::ShaderStageFlagBits::eVertex;
+    shaderStages[0].module = getShaderModule(desc.vertexShader);
+    shaderStages[0].pName = "main";
+    shaderStages[0].pSpecializationInfo = stageSpecialization;
+    shaderStages[1].stage = vk::ShaderStageFlagBits::eFragment;
+    shaderStages[1].module = desc.fragmentShader.empty() ? vk::ShaderModule() : getShaderModule(desc.fragmentShader);
+    shaderStages[1].pName = "main";
+    shaderStages[1].pSpecializationInfo = stageSpecialization;
+    // depth only, the vertex stage alone
+    const uint32_t stageCount = desc.fragmentShader.empty() ? 1 : 2;
+
+    vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
+    pipelineCreateInfo.layout = desc.layout;
+    pipelineCreateInfo.renderPass = desc.renderPass;
+    pipelineCreateInfo.subpass = desc.subpass;
+    pipelineCreateInfo.stageCount = stageCount;
+    pipelineCreateInfo.pStages = shaderStages.data();
+    pipelineCreateInfo.pVertexInputState = &vertexInputState;
+    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    pipelineCreateInfo.pRasterizationState = &rasterizationState;
+    pipelineCreateInfo.pColorBlendState = &colorBlendState;
+    pipelineCreateInfo.pMultisampleState = &multisampleState;
+    pipelineCreateInfo.pViewportState = &viewportState;
+    pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    pipelineCreateInfo.pDynamicState = &dynamicState;
+
+    // the pipeline cache is internally synchronized, warm threads share it
+    return device.createGraphicsPipeline(pipelineCache, pipelineCreateInfo);
+}
+} // End of namespace m3d
@@ -0,0 +1,397 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "PostProcess.hpp"
+#include "CommandBuffer.hpp"
+#include "ResourceTrash.hpp"
+#include "VulkanHelper.hpp"
+#include "VulkanSwapchain.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t PostProcess::GroupSize;
+const uint32_t PostProcess::BloomTileSize;
+const uint32_t PostProcess::BloomLevels;
+const vk::Format PostProcess::BloomFormat;
+const vk::Format PostProcess::OutputFormat;
+
+// settings, scene color, bloom levels sampled, bloom levels stored, output
+static const uint32_t BindingCount = 5;
+
+bool PostProcess::IsSupported(vk::PhysicalDevice physicalDevice)
+{
+    return physicalDevice.getFeatures().shaderStorageImageWriteWithoutFormat == VK_TRUE;
+}
+
+bool PostProcess::SupportsDirectOutput(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, vk::Format format)
+{
+    const vk::SurfaceCapabilitiesKHR capabilities = physicalDevice.getSurfaceCapabilitiesKHR(surface);
+    const vk::FormatProperties properties = physicalDevice.getFormatProperties(format);
+    return (capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage)
+        && (properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eStorageImage);
+}
+
+vk::Format PostProcess::GetSceneFormat(vk::PhysicalDevice physicalDevice)
+{
+    // a third of the bandwidth of RGBA16F, what tiled GPUs pay for on every resolve and read
+    const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eColorAttachment | vk::FormatFeatureFlagBits::eColorAttachmentBlend
+        | vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    const vk::FormatProperties properties = physicalDevice.getFormatProperties(vk::Format::eB10G11R11UfloatPack32);
+    if ((properties.optimalTilingFeatures & needed) == needed) {
+        return vk::Format::eB10G11R11UfloatPack32;
+    }
+    return vk::Format::eR16G16B16A16Sfloat;
+}
+
+PostProcess::PostProcess(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, uint32_t slotCount, bool DirectOutput)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+    , directOutput(DirectOutput)
+    , bloomLevels(0)
+{
+    static_assert(sizeof(GpuSettings) == 12 * sizeof(float), "post.comp and bloom_downsample.comp read 12 words of settings");
+    static_assert(sizeof(Constants) == 12 * sizeof(uint32_t), "post.comp and bloom_downsample.comp push 12 words");
+
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+    settingsStride = static_cast<uint32_t>((sizeof(GpuSettings) + alignment - 1) / alignment * alignment);
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        slotCount * settingsStride, nullptr, settingsBuffer.buffer, settingsBuffer.memory);
+    assert(settingsBuffer.memory && "out of memory for the post settings");
+    vkx::debug::marker::setName(device, settingsBuffer.buffer, "post settings");
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+        BeginFrame(slot);
+    }
+
+    // the scene and the bloom levels are sampled between texels, explicit levels
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.maxLod = static_cast<float>(BloomLevels);
+    sampler = device.createSampler(samplerInfo);
+
+    createPipelines();
+}
+
+PostProcess::~PostProcess()
+{
+    destroyTargets(nullptr);
+    device.destroyPipeline(bloomPipeline);
+    device.destroyPipeline(postPipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorSetLayout(setLayout);
+    device.destroySampler(sampler);
+    commandBuffer.DestroyBuffer(settingsBuffer.buffer, settingsBuffer.memory);
+}
+
+void PostProcess::createPipelines()
+{
+    std::array<vk::DescriptorSetLayoutBinding, BindingCount> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    bindings[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+    bindings[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[2].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    bindings[3].descriptorType = vk::DescriptorType::eStorageImage;
+    bindings[3].descriptorCount = BloomLevels;
+    bindings[4].descriptorType = vk::DescriptorType::eStorageImage;
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    bloomPipeline = createPipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\bloom_downsample.comp.spv", "bloom downsample");
+    postPipeline = createPipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\post.comp.spv", "post");
+}
+
+vk::Pipeline PostProcess::createPipeline(const char* shader, const char* name)
+{
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, shader);
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    vk::Pipeline computePipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, computePipeline, name);
+    device.destroyShaderModule(pipelineInfo.stage.module);
+    return computePipeline;
+}
+
+void PostProcess::BeginFrame(uint32_t slot)
+{
+    GpuSettings* gpuSettings = reinterpret_cast<GpuSettings*>(static_cast<uint8_t*>(settingsBuffer.memory.mapped) + slot * settingsStride);
+    gpuSettings->exposure = settings.exposure;
+    gpuSettings->bloomIntensity = settings.bloomIntensity;
+    gpuSettings->bloomThreshold = settings.bloomThreshold;
+    // the soft threshold divides by it
+    gpuSettings->bloomKnee = std::max(settings.bloomKnee, 1e-4f);
+    memcpy(gpuSettings->colorFilter, settings.colorFilter, sizeof(settings.colorFilter));
+    gpuSettings->colorFilter[3] = settings.saturation;
+    gpuSettings->sharpen = settings.sharpen;
+    gpuSettings->contrast = settings.contrast;
+    gpuSettings->vignette = settings.vignette;
+    gpuSettings->pad = 0.0f;
+}
+
+void PostProcess::createImage(vk::Format format, vk::ImageUsageFlags usage, vk::Extent2D size, uint32_t levels, const char* name, Image& image)
+{
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = format;
+    imageInfo.extent = vk::Extent3D(size.width, size.height, 1);
+    imageInfo.mipLevels = levels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = usage;
+    image.image = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, image.image, name);
+    // sized after the swapchain like CommandBuffer's targets
+    image.memory = commandBuffer.GetAllocator().AllocateImage(image.image, vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Attachment);
+    assert(image.memory && "out of device memory for post processing");
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = image.image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+    image.view = device.createImageView(viewInfo);
+}
+
+void PostProcess::SetTargets(vk::ImageView sceneView, vk::Extent2D Extent, const VulkanSwapChain& swapChain, ResourceTrash* trash)
+{
+    destroyTargets(trash);
+    extent = Extent;
+    swapchainImages = swapChain.images;
+
+    // level 0 is half the scene, levels stop at a texel
+    bloomSize = vk::Extent2D(std::max(1u, extent.width / 2), std::max(1u, extent.height / 2));
+    bloomLevels = 1;
+    while ((std::max(bloomSize.width, bloomSize.height) >> bloomLevels) > 0 && bloomLevels < BloomLevels) {
+        ++bloomLevels;
+    }
+    createImage(BloomFormat, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled, bloomSize, bloomLevels, "bloom", bloom);
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = bloom.image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = BloomFormat;
+    for (uint32_t level = 0; level < bloomLevels; ++level) {
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1);
+        bloomLevelViews.push_back(device.createImageView(viewInfo));
+    }
+    if (!directOutput) {
+        createImage(OutputFormat, vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc, extent, 1, "post output", output);
+    }
+
+    // the bloom levels stay in general layout, written and sampled every frame
+    uint32_t layoutCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& layoutCmd = commandBuffer.GetCommandBuffer(layoutCmdIndex);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eGeneral;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    barrier.image = bloom.image;
+    barrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, bloomLevels, 0, 1);
+    layoutCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    commandBuffer.Flush(layoutCmdIndex);
+
+    writeDescriptors(sceneView, swapChain);
+}
+
+void PostProcess::writeDescriptors(vk::ImageView sceneView, const VulkanSwapChain& swapChain)
+{
+    // one pool per target set, it is retired together with the targets
+    const uint32_t imageCount = static_cast<uint32_t>(swapChain.images.size());
+    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, imageCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 2 * imageCount),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, (BloomLevels + 1) * imageCount)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = imageCount;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    std::vector<vk::DescriptorSetLayout> layouts(imageCount, setLayout);
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = imageCount;
+    allocInfo.pSetLayouts = layouts.data();
+    sets = device.allocateDescriptorSets(allocInfo);
+
+    vk::DescriptorBufferInfo settingsInfo(settingsBuffer.buffer, 0, sizeof(GpuSettings));
+    vk::DescriptorImageInfo sceneInfo(sampler, sceneView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::DescriptorImageInfo bloomInfo(sampler, bloom.view, vk::ImageLayout::eGeneral);
+    // levels past the last one of a small target are never stored, they repeat it
+    std::array<vk::DescriptorImageInfo, BloomLevels> levelInfos;
+    for (uint32_t level = 0; level < BloomLevels; ++level) {
+        levelInfos[level] = vk::DescriptorImageInfo(vk::Sampler(), bloomLevelViews[std::min(level, bloomLevels - 1)], vk::ImageLayout::eGeneral);
+    }
+    for (uint32_t i = 0; i < imageCount; ++i) {
+        vk::DescriptorImageInfo outputInfo(vk::Sampler(), directOutput ? swapChain.buffers[i].view : output.view, vk::ImageLayout::eGeneral);
+        std::array<vk::WriteDescriptorSet, BindingCount> writes;
+        for (uint32_t binding = 0; binding < writes.size(); ++binding) {
+            writes[binding].dstSet = sets[i];
+            writes[binding].dstBinding = binding;
+            writes[binding].descriptorCount = 1;
+        }
+        writes[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+        writes[0].pBufferInfo = &settingsInfo;
+        writes[1].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+        writes[1].pImageInfo = &sceneInfo;
+        writes[2].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+        writes[2].pImageInfo = &bloomInfo;
+        writes[3].descriptorType = vk::DescriptorType::eStorageImage;
+        writes[3].descriptorCount = BloomLevels;
+        writes[3].pImageInfo = levelInfos.data();
+        writes[4].descriptorType = vk::DescriptorType::eStorageImage;
+        writes[4].pImageInfo = &outputInfo;
+        device.updateDescriptorSets(writes, nullptr);
+    }
+}
+
+void PostProcess::destroyTargets(ResourceTrash* trash)
+{
+    if (!bloom.image) {
+        return;
+    }
+
+    // the descriptor sets go with their pool, frames in flight may still read all of it
+    vk::Device dev = device;
+    MemoryAllocator* allocator = &commandBuffer.GetAllocator();
+    std::vector<vk::ImageView> views(bloomLevelViews);
+    std::array<Image, 2> images = { { bloom, output } };
+    vk::DescriptorPool pool = descriptorPool;
+
+    ResourceTrash::Destroyer destroy = [dev, allocator, views, images, pool]() {
+        dev.destroyDescriptorPool(pool);
+        for (auto& view : views) {
+            dev.destroyImageView(view);
+        }
+        for (const Image& image : images) {
+            if (image.image) {
+                dev.destroyImageView(image.view);
+                dev.destroyImage(image.image);
+                allocator->Free(image.memory);
+            }
+        }
+    };
+    if (trash) {
+        trash->Trash(destroy);
+    } else {
+        destroy();
+    }
+
+    bloomLevelViews.clear();
+    bloom = Image();
+    output = Image();
+    descriptorPool = vk::DescriptorPool();
+    sets.clear();
+}
+
+void PostProcess::Record(vk::CommandBuffer cmd, uint32_t slot, uint32_t imageIndex, vk::Extent2D renderExtent) const
+{
+    Constants constants = {};
+    constants.sceneScale[0] = static_cast<float>(renderExtent.width) / extent.width;
+    constants.sceneScale[1] = static_cast<float>(renderExtent.height) / extent.height;
+    constants.sceneTexel[0] = 1.0f / extent.width;
+    constants.sceneTexel[1] = 1.0f / extent.height;
+    constants.outputSize[0] = extent.width;
+    constants.outputSize[1] = extent.height;
+    constants.bloomSize[0] = bloomSize.width;
+    constants.bloomSize[1] = bloomSize.height;
+    constants.bloomLevels = bloomLevels;
+
+    const uint32_t settingsOffset = slot * settingsStride;
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &sets[imageIndex], 1, &settingsOffset);
+    cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+
+    // the previous frame's passes are done with the bloom levels, on this queue in submission order
+    vk::MemoryBarrier bloomFree;
+    bloomFree.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    bloomFree.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), bloomFree, nullptr, nullptr);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, bloomPipeline);
+    cmd.dispatch((bloomSize.width + BloomTileSize - 1) / BloomTileSize, (bloomSize.height + BloomTileSize - 1) / BloomTileSize, 1);
+
+    vk::MemoryBarrier bloomWritten;
+    bloomWritten.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    bloomWritten.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    // the swapchain image is only known to be acquired at COLOR_ATTACHMENT_OUTPUT, the barrier chains the writes behind that wait
+    vk::ImageMemoryBarrier toStorage;
+    toStorage.srcAccessMask = vk::AccessFlags();
+    toStorage.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toStorage.oldLayout = vk::ImageLayout::eUndefined;
+    toStorage.newLayout = vk::ImageLayout::eGeneral;
+    toStorage.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toStorage.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toStorage.image = directOutput ? swapchainImages[imageIndex] : output.image;
+    toStorage.subresourceRange = vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+    // without direct output the previous frame's blit read the output image
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), bloomWritten, nullptr, toStorage);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, postPipeline);
+    cmd.dispatch((extent.width + GroupSize - 1) / GroupSize, (extent.height + GroupSize - 1) / GroupSize, 1);
+
+    vk::ImageMemoryBarrier toPresent = toStorage;
+    toPresent.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toPresent.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+    toPresent.oldLayout = vk::ImageLayout::eGeneral;
+    toPresent.newLayout = vk::ImageLayout::ePresentSrcKHR;
+    if (directOutput) {
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, toPresent);
+        return;
+    }
+
+    // the same size, a copy that converts RGBA into the swapchain's format
+    std::array<vk::ImageMemoryBarrier, 2> toTransfer = { { toStorage, toStorage } };
+    toTransfer[0].srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toTransfer[0].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+    toTransfer[0].oldLayout = vk::ImageLayout::eGeneral;
+    toTransfer[0].newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toTransfer[1].dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toTransfer[1].newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toTransfer[1].image = swapchainImages[imageIndex];
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+    vk::ImageBlit blit;
+    blit.srcSubresource = vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 };
+    blit.srcOffsets[1] = vk::Offset3D{ static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1 };
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstOffsets[1] = blit.srcOffsets[1];
+    cmd.blitImage(output.image, vk::ImageLayout::eTransferSrcOptimal, swapchainImages[imageIndex], vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eNearest);
+
+    toPresent.image = swapchainImages[imageIndex];
+    toPresent.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toPresent.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, toPresent);
+}
+} // End of namespace m3d
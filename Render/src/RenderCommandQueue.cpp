@@ -0,0 +1,57 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderCommandQueue.hpp"
+
+#include <thread>
+
+namespace m3d {
+
+RenderCommandQueue::RenderCommandQueue(size_t capacity)
+    : game(capacity)
+    , workers(capacity)
+{
+}
+
+bool RenderCommandQueue::TrySubmit(RenderCommand command)
+{
+    return game.TryPush(std::move(command));
+}
+
+void RenderCommandQueue::Submit(RenderCommand command)
+{
+    while (!game.TryPush(command)) {
+        std::this_thread::yield();
+    }
+}
+
+bool RenderCommandQueue::TrySubmitFromWorker(RenderCommand command)
+{
+    return workers.TryPush(std::move(command));
+}
+
+void RenderCommandQueue::SubmitFromWorker(RenderCommand command)
+{
+    while (!workers.TryPush(command)) {
+        std::this_thread::yield();
+    }
+}
+
+size_t RenderCommandQueue::Drain(RendererVulkan& renderer)
+{
+    size_t count = 0;
+    RenderCommand command;
+    // only what is in the rings now: a command submitting another one does not keep the frame waiting
+    const size_t limit = game.GetCapacity() + workers.GetCapacity();
+    while (count < limit && (game.TryPop(command) || workers.TryPop(command))) {
+        command(renderer);
+        command = nullptr;
+        ++count;
+    }
+    executed += count;
+    return count;
+}
+}
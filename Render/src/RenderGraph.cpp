@@ -0,0 +1,299 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderGraph.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace m3d {
+
+const uint32_t RenderGraph::InvalidId;
+const uint64_t RenderGraph::NotAliased;
+
+bool RenderGraph::IsWrite(Access access)
+{
+    switch (access) {
+    case Access::ColorAttachment:
+    case Access::DepthAttachment:
+    case Access::StorageWrite:
+    case Access::TransferDst:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint32_t RenderGraph::PassBuilder::CreateTexture(const char* name, const TextureDesc& desc)
+{
+    Texture texture;
+    texture.name = name;
+    texture.desc = desc;
+    graph.textures.push_back(texture);
+    return static_cast<uint32_t>(graph.textures.size() - 1);
+}
+
+void RenderGraph::PassBuilder::Read(uint32_t texture, Access access)
+{
+    if (IsWrite(access)) {
+        printf("RenderGraph: pass %s reads with a write access, declare it with Write\n", pass.name.c_str());
+    }
+    use(texture, access, LoadOp::Load);
+}
+
+void RenderGraph::PassBuilder::Write(uint32_t texture, Access access, LoadOp load)
+{
+    if (!IsWrite(access)) {
+        printf("RenderGraph: pass %s writes with a read access, declare it with Read\n", pass.name.c_str());
+    }
+    use(texture, access, load);
+}
+
+void RenderGraph::PassBuilder::use(uint32_t texture, Access access, LoadOp load)
+{
+    if (texture >= graph.textures.size()) {
+        printf("RenderGraph: pass %s uses texture %u, which does not exist\n", pass.name.c_str(), texture);
+        return;
+    }
+    // one access per pass, a texture cannot be in two layouts at once
+    for (size_t i = 0; i < pass.uses.size(); i++) {
+        if (pass.uses[i].texture == texture) {
+            printf("RenderGraph: pass %s uses %s twice, only the first use counts\n", pass.name.c_str(), graph.textures[texture].name.c_str());
+            return;
+        }
+    }
+    Use u;
+    u.texture = texture;
+    u.access = access;
+    u.load = load;
+    pass.uses.push_back(u);
+}
+
+uint32_t RenderGraph::ImportTexture(const char* name, const TextureDesc& desc, Access initial, Access final)
+{
+    Texture texture;
+    texture.name = name;
+    texture.desc = desc;
+    texture.imported = true;
+    texture.initialAccess = initial;
+    texture.finalAccess = final;
+    textures.push_back(texture);
+    return static_cast<uint32_t>(textures.size() - 1);
+}
+
+uint32_t RenderGraph::AddPass(const char* name, PassType type, const std::function<void(PassBuilder&)>& setup)
+{
+    passes.push_back(Pass());
+    passes.back().name = name;
+    passes.back().type = type;
+    // setup may create textures but not passes, the reference stays valid
+    PassBuilder builder(*this, passes.back());
+    setup(builder);
+    return static_cast<uint32_t>(passes.size() - 1);
+}
+
+void RenderGraph::Clear()
+{
+    passes.clear();
+    textures.clear();
+    finalBarriers.clear();
+    heapSize = 0;
+    heapAlignment = 1;
+    heapTypeBits = 0xFFFFFFFF;
+    transientSize = 0;
+}
+
+void RenderGraph::Compile(const std::function<MemoryRequirements(uint32_t texture)>& requirements)
+{
+    cull();
+    computeLifetimes();
+    placeTransients(requirements);
+    computeBarriers();
+}
+
+void RenderGraph::cull()
+{
+    // what a kept pass later on needs written
+    std::vector<bool> needed(textures.size(), false);
+    for (size_t i = passes.size(); i-- > 0;) {
+        Pass& pass = passes[i];
+        bool keep = pass.sideEffect;
+        for (size_t u = 0; u < pass.uses.size() && !keep; u++) {
+            const Use& use = pass.uses[u];
+            keep = IsWrite(use.access) && (textures[use.texture].imported || needed[use.texture]);
+        }
+        pass.culled = !keep;
+        if (!keep) {
+            continue;
+        }
+        // reads, and writes that keep part of the old contents, need the passes before
+        for (size_t u = 0; u < pass.uses.size(); u++) {
+            const Use& use = pass.uses[u];
+            if (!IsWrite(use.access) || use.load == LoadOp::Load) {
+                needed[use.texture] = true;
+            }
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes()
+{
+    for (size_t t = 0; t < textures.size(); t++) {
+        textures[t].firstPass = InvalidId;
+        textures[t].lastPass = InvalidId;
+        textures[t].heapOffset = NotAliased;
+    }
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (passes[i].culled) {
+            continue;
+        }
+        for (size_t u = 0; u < passes[i].uses.size(); u++) {
+            const Use& use = passes[i].uses[u];
+            Texture& texture = textures[use.texture];
+            if (texture.firstPass == InvalidId) {
+                texture.firstPass = i;
+                if (!texture.imported && !IsWrite(use.access)) {
+                    printf("RenderGraph: pass %s reads %s before any pass wrote it\n", passes[i].name.c_str(), texture.name.c_str());
+                }
+            }
+            texture.lastPass = i;
+        }
+    }
+}
+
+void RenderGraph::placeTransients(const std::function<MemoryRequirements(uint32_t texture)>& requirements)
+{
+    heapSize = 0;
+    heapAlignment = 1;
+    heapTypeBits = 0xFFFFFFFF;
+    transientSize = 0;
+
+    std::vector<uint32_t> order;
+    for (uint32_t t = 0; t < textures.size(); t++) {
+        Texture& texture = textures[t];
+        if (texture.imported || texture.firstPass == InvalidId) {
+            continue;
+        }
+        texture.requirements = requirements(t);
+        transientSize += texture.requirements.size;
+        // a texture that shares no memory type with the others gets memory of its own
+        if ((heapTypeBits & texture.requirements.typeBits) == 0) {
+            printf("RenderGraph: %s fits no memory type of the transient heap, it is not aliased\n", texture.name.c_str());
+            continue;
+        }
+        heapTypeBits &= texture.requirements.typeBits;
+        heapAlignment = std::max(heapAlignment, texture.requirements.alignment);
+        order.push_back(t);
+    }
+
+    // largest first, the small ones fill the gaps between them
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        if (textures[a].requirements.size != textures[b].requirements.size) {
+            return textures[a].requirements.size > textures[b].requirements.size;
+        }
+        return textures[a].firstPass < textures[b].firstPass;
+    });
+
+    std::vector<uint32_t> placed;
+    for (size_t i = 0; i < order.size(); i++) {
+        Texture& texture = textures[order[i]];
+        const uint64_t alignment = std::max<uint64_t>(1, texture.requirements.alignment);
+
+        // the placed textures alive at the same time, by offset
+        std::vector<uint32_t> live;
+        for (size_t p = 0; p < placed.size(); p++) {
+            const Texture& other = textures[placed[p]];
+            if (other.firstPass <= texture.lastPass && texture.firstPass <= other.lastPass) {
+                live.push_back(placed[p]);
+            }
+        }
+        std::sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b) {
+            return textures[a].heapOffset < textures[b].heapOffset;
+        });
+
+        // first gap that fits
+        uint64_t offset = 0;
+        for (size_t l = 0; l < live.size(); l++) {
+            const Texture& other = textures[live[l]];
+            if (offset + texture.requirements.size <= other.heapOffset) {
+                break;
+            }
+            const uint64_t end = other.heapOffset + other.requirements.size;
+            offset = std::max(offset, (end + alignment - 1) / alignment * alignment);
+        }
+        texture.heapOffset = offset;
+        heapSize = std::max(heapSize, offset + texture.requirements.size);
+        placed.push_back(order[i]);
+    }
+}
+
+void RenderGraph::computeBarriers()
+{
+    finalBarriers.clear();
+
+    // where every texture is as the kept passes run
+    std::vector<Access> access(textures.size());
+    std::vector<PassType> accessType(textures.size(), PassType::Graphics);
+    for (size_t t = 0; t < textures.size(); t++) {
+        access[t] = textures[t].imported ? textures[t].initialAccess : Access::Undefined;
+    }
+
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        Pass& pass = passes[i];
+        pass.barriers.clear();
+        if (pass.culled) {
+            continue;
+        }
+        for (size_t u = 0; u < pass.uses.size(); u++) {
+            const Use& use = pass.uses[u];
+            const Texture& texture = textures[use.texture];
+
+            Barrier barrier;
+            barrier.texture = use.texture;
+            barrier.before = access[use.texture];
+            barrier.beforeType = accessType[use.texture];
+            barrier.after = use.access;
+            barrier.afterType = pass.type;
+            barrier.aliasedAccesses = 0;
+
+            // the textures that had the memory before, all done by now
+            if (texture.firstPass == i && texture.heapOffset != NotAliased) {
+                const uint64_t end = texture.heapOffset + texture.requirements.size;
+                for (size_t t = 0; t < textures.size(); t++) {
+                    const Texture& other = textures[t];
+                    if (t == use.texture || other.imported || other.heapOffset == NotAliased || other.lastPass >= i) {
+                        continue;
+                    }
+                    if (other.heapOffset < end && texture.heapOffset < other.heapOffset + other.requirements.size) {
+                        barrier.aliasedAccesses |= 1u << static_cast<uint32_t>(access[t]);
+                    }
+                }
+            }
+
+            // reads after reads of the same kind need nothing
+            if (barrier.before != barrier.after || IsWrite(barrier.before) || IsWrite(barrier.after) || barrier.aliasedAccesses) {
+                pass.barriers.push_back(barrier);
+            }
+            access[use.texture] = use.access;
+            accessType[use.texture] = pass.type;
+        }
+    }
+
+    for (uint32_t t = 0; t < textures.size(); t++) {
+        if (!textures[t].imported || access[t] == textures[t].finalAccess) {
+            continue;
+        }
+        Barrier barrier;
+        barrier.texture = t;
+        barrier.before = access[t];
+        barrier.beforeType = accessType[t];
+        barrier.after = textures[t].finalAccess;
+        barrier.afterType = PassType::Graphics;
+        barrier.aliasedAccesses = 0;
+        finalBarriers.push_back(barrier);
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,216 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderGraphConfig.hpp"
+
+#include "../../data/schema/rendergraph_generated.h"
+#include "flatbuffers/idl.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+namespace m3d {
+
+using namespace m3d::schema;
+
+// 0 when the file does not exist, e.g. inside an APK
+static int64_t modificationTime(const std::string& path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(info.st_mtime);
+}
+
+static bool isJson(const std::string& path)
+{
+    const std::string extension = ".json";
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+static RenderGraph::TextureDesc toDesc(const STexture* sTexture, uint32_t width, uint32_t height)
+{
+    RenderGraph::TextureDesc desc;
+    const float scale = sTexture->scale();
+    desc.width = sTexture->width() ? sTexture->width() : std::max(1u, static_cast<uint32_t>(width * scale));
+    desc.height = sTexture->height() ? sTexture->height() : std::max(1u, static_cast<uint32_t>(height * scale));
+    desc.mipLevels = std::max(1u, sTexture->mipLevels());
+    desc.format = static_cast<RenderGraph::Format>(sTexture->format());
+    if (sTexture->clearValue()) {
+        for (uint32_t i = 0; i < sTexture->clearValue()->size() && i < 4; ++i) {
+            desc.clearValue[i] = sTexture->clearValue()->Get(i);
+        }
+    }
+    return desc;
+}
+
+bool RenderGraphConfig::Load(const std::string& graphPath, const std::string& graphSchemaPath)
+{
+    path = graphPath;
+    schemaPath = graphSchemaPath;
+    modified = modificationTime(path);
+    return load(path, parsed, mapped);
+}
+
+bool RenderGraphConfig::ReloadIfChanged()
+{
+    const int64_t time = modificationTime(path);
+    if (time == 0 || time == modified) {
+        return false;
+    }
+    modified = time;
+
+    std::vector<uint8_t> newParsed;
+    std::shared_ptr<const file::MappedFile> newMapped;
+    // an edit that does not parse keeps the graph running
+    if (!load(path, newParsed, newMapped)) {
+        return false;
+    }
+    parsed.swap(newParsed);
+    mapped = newMapped;
+    printf("RenderGraphConfig: reloaded %s\n", path.c_str());
+    return true;
+}
+
+bool RenderGraphConfig::load(const std::string& graphPath, std::vector<uint8_t>& graphParsed,
+    std::shared_ptr<const file::MappedFile>& graphMapped) const
+{
+    graphParsed.clear();
+    graphMapped.reset();
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    if (isJson(graphPath)) {
+        std::string schema;
+        std::string json;
+        if (!file::readBinary(schemaPath.c_str(), schema) || !file::readBinary(graphPath.c_str(), json)) {
+            printf("RenderGraphConfig: can not read %s or %s\n", schemaPath.c_str(), graphPath.c_str());
+            return false;
+        }
+        // includes of the schema resolve against its directory
+        const std::string schemaDirectory = schemaPath.substr(0, schemaPath.find_last_of("/\\") + 1);
+        const char* includePaths[] = { schemaDirectory.c_str(), nullptr };
+        flatbuffers::Parser parser;
+        if (!parser.Parse(schema.c_str(), includePaths, schemaPath.c_str()) || !parser.Parse(json.c_str(), includePaths, graphPath.c_str())) {
+            printf("RenderGraphConfig: %s\n", parser.error_.c_str());
+            return false;
+        }
+        graphParsed.assign(parser.builder_.GetBufferPointer(), parser.builder_.GetBufferPointer() + parser.builder_.GetSize());
+        data = graphParsed.data();
+        size = graphParsed.size();
+    } else {
+        graphMapped = file::MappedFile::open(graphPath.c_str());
+        if (!graphMapped) {
+            printf("RenderGraphConfig: can not open %s\n", graphPath.c_str());
+            return false;
+        }
+        data = graphMapped->data();
+        size = graphMapped->size();
+    }
+
+    flatbuffers::Verifier verifier(data, size);
+    if (!SRenderGraphBufferHasIdentifier(data) || !VerifySRenderGraphBuffer(verifier)) {
+        printf("RenderGraphConfig: %s is not a render graph\n", graphPath.c_str());
+        graphParsed.clear();
+        graphMapped.reset();
+        return false;
+    }
+    return true;
+}
+
+const SRenderGraph* RenderGraphConfig::root() const
+{
+    if (!parsed.empty()) {
+        return GetSRenderGraph(parsed.data());
+    }
+    return mapped ? GetSRenderGraph(mapped->data()) : nullptr;
+}
+
+bool RenderGraphConfig::Build(RenderGraphVulkan& graph, uint8_t tier, uint32_t width, uint32_t height, const Executes& executes,
+    ResourceTrash* trash)
+{
+    graph.Clear(trash);
+    textures.clear();
+    const SRenderGraph* sGraph = root();
+    if (!sGraph) {
+        return false;
+    }
+
+    // transient textures are created by the first pass that writes them
+    std::map<std::string, const STexture*> described;
+    const uint32_t textureCount = sGraph->textures() ? sGraph->textures()->size() : 0;
+    for (uint32_t t = 0; t < textureCount; ++t) {
+        const STexture* sTexture = sGraph->textures()->Get(t);
+        if (!sTexture->name()) {
+            continue;
+        }
+        described[sTexture->name()->str()] = sTexture;
+        if (sTexture->imported()) {
+            textures[sTexture->name()->str()] = graph.ImportTexture(sTexture->name()->c_str(), toDesc(sTexture, width, height),
+                static_cast<RenderGraph::Access>(sTexture->initialAccess()), static_cast<RenderGraph::Access>(sTexture->finalAccess()));
+        }
+    }
+
+    bool complete = true;
+    const uint32_t passCount = sGraph->passes() ? sGraph->passes()->size() : 0;
+    for (uint32_t p = 0; p < passCount; ++p) {
+        const SPass* sPass = sGraph->passes()->Get(p);
+        if (!sPass->name() || tier < sPass->minTier() || tier > sPass->maxTier()) {
+            continue;
+        }
+        const std::string callback = sPass->pipeline() && sPass->pipeline()->size() ? sPass->pipeline()->str() : sPass->name()->str();
+        Executes::const_iterator execute = executes.find(callback);
+        if (execute == executes.end()) {
+            printf("RenderGraphConfig: pass %s runs %s, which is not registered\n", sPass->name()->c_str(), callback.c_str());
+            complete = false;
+            continue;
+        }
+
+        graph.AddPass(sPass->name()->c_str(), static_cast<RenderGraph::PassType>(sPass->type()), [&](RenderGraph::PassBuilder& builder) {
+            const uint32_t readCount = sPass->reads() ? sPass->reads()->size() : 0;
+            for (uint32_t r = 0; r < readCount; ++r) {
+                const SUse* sUse = sPass->reads()->Get(r);
+                std::map<std::string, uint32_t>::const_iterator texture = sUse->texture() ? textures.find(sUse->texture()->str()) : textures.end();
+                if (texture == textures.end()) {
+                    printf("RenderGraphConfig: pass %s reads %s, which no pass before wrote\n", sPass->name()->c_str(),
+                        sUse->texture() ? sUse->texture()->c_str() : "");
+                    continue;
+                }
+                builder.Read(texture->second, static_cast<RenderGraph::Access>(sUse->access()));
+            }
+
+            const uint32_t writeCount = sPass->writes() ? sPass->writes()->size() : 0;
+            for (uint32_t w = 0; w < writeCount; ++w) {
+                const SUse* sUse = sPass->writes()->Get(w);
+                const std::string name = sUse->texture() ? sUse->texture()->str() : std::string();
+                if (textures.find(name) == textures.end()) {
+                    std::map<std::string, const STexture*>::const_iterator sTexture = described.find(name);
+                    if (sTexture == described.end()) {
+                        printf("RenderGraphConfig: pass %s writes %s, which is not described\n", sPass->name()->c_str(), name.c_str());
+                        continue;
+                    }
+                    textures[name] = builder.CreateTexture(name.c_str(), toDesc(sTexture->second, width, height));
+                }
+                builder.Write(textures[name], static_cast<RenderGraph::Access>(sUse->access()), static_cast<RenderGraph::LoadOp>(sUse->load()));
+            }
+
+            if (sPass->sideEffect()) {
+                builder.SetSideEffect();
+            }
+        },
+            execute->second);
+    }
+    return complete;
+}
+
+uint32_t RenderGraphConfig::GetTexture(const std::string& name) const
+{
+    std::map<std::string, uint32_t>::const_iterator texture = textures.find(name);
+    return texture == textures.end() ? RenderGraph::InvalidId : texture->second;
+}
+} // End of namespace m3d
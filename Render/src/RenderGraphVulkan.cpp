@@ -0,0 +1,582 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderGraphVulkan.hpp"
+#include "ResourceTrash.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+
+namespace m3d {
+
+typedef RenderGraph::Access Access;
+typedef RenderGraph::PassType PassType;
+
+struct AccessInfo {
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags access;
+    vk::ImageLayout layout;
+};
+
+static vk::PipelineStageFlags shaderStages(PassType type)
+{
+    switch (type) {
+    case PassType::Graphics:
+        return vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader;
+    case PassType::Compute:
+        return vk::PipelineStageFlagBits::eComputeShader;
+    default:
+        return vk::PipelineStageFlagBits::eTransfer;
+    }
+}
+
+static AccessInfo accessInfo(Access access, PassType type)
+{
+    const vk::PipelineStageFlags fragmentTests = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+    AccessInfo info;
+    switch (access) {
+    case Access::Undefined:
+        info.stages = vk::PipelineStageFlagBits::eTopOfPipe;
+        info.layout = vk::ImageLayout::eUndefined;
+        break;
+    case Access::ColorAttachment:
+        info.stages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+        info.access = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+        info.layout = vk::ImageLayout::eColorAttachmentOptimal;
+        break;
+    case Access::DepthAttachment:
+        info.stages = fragmentTests;
+        info.access = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+        info.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+        break;
+    case Access::DepthRead:
+        info.stages = type == PassType::Graphics ? fragmentTests | vk::PipelineStageFlagBits::eFragmentShader : shaderStages(type);
+        info.access = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eShaderRead;
+        info.layout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+        break;
+    case Access::Sampled:
+        info.stages = shaderStages(type);
+        info.access = vk::AccessFlagBits::eShaderRead;
+        info.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        break;
+    case Access::StorageRead:
+        info.stages = shaderStages(type);
+        info.access = vk::AccessFlagBits::eShaderRead;
+        info.layout = vk::ImageLayout::eGeneral;
+        break;
+    case Access::StorageWrite:
+        info.stages = shaderStages(type);
+        info.access = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+        info.layout = vk::ImageLayout::eGeneral;
+        break;
+    case Access::TransferSrc:
+        info.stages = vk::PipelineStageFlagBits::eTransfer;
+        info.access = vk::AccessFlagBits::eTransferRead;
+        info.layout = vk::ImageLayout::eTransferSrcOptimal;
+        break;
+    case Access::TransferDst:
+        info.stages = vk::PipelineStageFlagBits::eTransfer;
+        info.access = vk::AccessFlagBits::eTransferWrite;
+        info.layout = vk::ImageLayout::eTransferDstOptimal;
+        break;
+    case Access::Present:
+        // the presentation engine's reads are ordered by the semaphores
+        info.stages = vk::PipelineStageFlagBits::eBottomOfPipe;
+        info.layout = vk::ImageLayout::ePresentSrcKHR;
+        break;
+    }
+    return info;
+}
+
+static bool isDepth(RenderGraph::Format format)
+{
+    return format == RenderGraph::Format::Depth32F || format == RenderGraph::Format::Depth24Stencil8 || format == RenderGraph::Format::Depth32FStencil8;
+}
+
+static vk::ImageAspectFlags aspects(RenderGraph::Format format)
+{
+    switch (format) {
+    case RenderGraph::Format::Depth32F:
+        return vk::ImageAspectFlagBits::eDepth;
+    case RenderGraph::Format::Depth24Stencil8:
+    case RenderGraph::Format::Depth32FStencil8:
+        return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+    default:
+        return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+static vk::AttachmentLoadOp toVulkan(RenderGraph::LoadOp load)
+{
+    switch (load) {
+    case RenderGraph::LoadOp::Clear:
+        return vk::AttachmentLoadOp::eClear;
+    case RenderGraph::LoadOp::DontCare:
+        return vk::AttachmentLoadOp::eDontCare;
+    default:
+        return vk::AttachmentLoadOp::eLoad;
+    }
+}
+
+vk::Format RenderGraphVulkan::ToVulkan(RenderGraph::Format format)
+{
+    switch (format) {
+    case RenderGraph::Format::RGBA8:
+        return vk::Format::eR8G8B8A8Unorm;
+    case RenderGraph::Format::BGRA8:
+        return vk::Format::eB8G8R8A8Unorm;
+    case RenderGraph::Format::RGBA16F:
+        return vk::Format::eR16G16B16A16Sfloat;
+    case RenderGraph::Format::RG16F:
+        return vk::Format::eR16G16Sfloat;
+    case RenderGraph::Format::R32F:
+        return vk::Format::eR32Sfloat;
+    case RenderGraph::Format::Depth32F:
+        return vk::Format::eD32Sfloat;
+    case RenderGraph::Format::Depth24Stencil8:
+        return vk::Format::eD24UnormS8Uint;
+    case RenderGraph::Format::Depth32FStencil8:
+        return vk::Format::eD32SfloatS8Uint;
+    }
+    return vk::Format::eUndefined;
+}
+
+RenderGraphVulkan::RenderGraphVulkan(vk::Device& device, MemoryAllocator& allocator)
+    : device(device)
+    , allocator(allocator)
+{
+}
+
+RenderGraphVulkan::~RenderGraphVulkan()
+{
+    release(nullptr);
+}
+
+uint32_t RenderGraphVulkan::ImportTexture(const char* name, const RenderGraph::TextureDesc& desc, Access initial, Access final,
+    vk::Image image, vk::ImageView view)
+{
+    const uint32_t texture = graph.ImportTexture(name, desc, initial, final);
+    images.resize(graph.GetTextures().size());
+    views.resize(graph.GetTextures().size());
+    images[texture] = image;
+    views[texture] = view;
+    return texture;
+}
+
+void RenderGraphVulkan::SetImportedTexture(uint32_t texture, vk::Image image, vk::ImageView view)
+{
+    images[texture] = image;
+    views[texture] = view;
+}
+
+uint32_t RenderGraphVulkan::AddPass(const char* name, PassType type, const std::function<void(RenderGraph::PassBuilder&)>& setup,
+    const ExecuteCallback& execute)
+{
+    const uint32_t pass = graph.AddPass(name, type, setup);
+    executes.push_back(execute);
+    // setup may have created textures
+    images.resize(graph.GetTextures().size());
+    views.resize(graph.GetTextures().size());
+    return pass;
+}
+
+// every way the passes use the texture
+vk::ImageUsageFlags RenderGraphVulkan::usage(uint32_t texture) const
+{
+    vk::ImageUsageFlags flags;
+    const std::vector<RenderGraph::Pass>& passes = graph.GetPasses();
+    for (size_t i = 0; i < passes.size(); i++) {
+        for (size_t u = 0; u < passes[i].uses.size(); u++) {
+            if (passes[i].uses[u].texture != texture) {
+                continue;
+            }
+            switch (passes[i].uses[u].access) {
+            case Access::ColorAttachment:
+                flags |= vk::ImageUsageFlagBits::eColorAttachment;
+                break;
+            case Access::DepthAttachment:
+            case Access::DepthRead:
+                flags |= vk::ImageUsageFlagBits::eDepthStencilAttachment;
+                if (passes[i].type != PassType::Graphics) {
+                    flags |= vk::ImageUsageFlagBits::eSampled;
+                }
+                break;
+            case Access::Sampled:
+                flags |= vk::ImageUsageFlagBits::eSampled;
+                break;
+            case Access::StorageRead:
+            case Access::StorageWrite:
+                flags |= vk::ImageUsageFlagBits::eStorage;
+                break;
+            case Access::TransferSrc:
+                flags |= vk::ImageUsageFlagBits::eTransferSrc;
+                break;
+            case Access::TransferDst:
+                flags |= vk::ImageUsageFlagBits::eTransferDst;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return flags;
+}
+
+void RenderGraphVulkan::Compile(ResourceTrash* trash)
+{
+    release(trash);
+
+    // the graph asks for the requirements of the transient textures it keeps, their images are created on the way
+    graph.Compile([this](uint32_t texture) {
+        const RenderGraph::TextureDesc& desc = graph.GetTextures()[texture].desc;
+        vk::ImageCreateInfo info;
+        info.imageType = vk::ImageType::e2D;
+        info.format = ToVulkan(desc.format);
+        info.extent = vk::Extent3D(desc.width, desc.height, 1);
+        info.mipLevels = desc.mipLevels;
+        info.arrayLayers = 1;
+        info.samples = vk::SampleCountFlagBits::e1;
+        info.tiling = vk::ImageTiling::eOptimal;
+        info.usage = usage(texture);
+        info.initialLayout = vk::ImageLayout::eUndefined;
+        images[texture] = device.createImage(info, nullptr);
+        vkx::debug::marker::setName(device, images[texture], graph.GetTextures()[texture].name.c_str());
+
+        const vk::MemoryRequirements memory = device.getImageMemoryRequirements(images[texture]);
+        RenderGraph::MemoryRequirements requirements;
+        requirements.size = memory.size;
+        requirements.alignment = memory.alignment;
+        requirements.typeBits = memory.memoryTypeBits;
+        return requirements;
+    });
+
+    createImages();
+    for (uint32_t i = 0; i < graph.GetPasses().size(); i++) {
+        createRenderPass(i);
+    }
+
+    printf("RenderGraph: %u KB of transient textures in a %u KB heap\n", static_cast<uint32_t>(graph.GetTransientSize() / 1024),
+        static_cast<uint32_t>(graph.GetHeapSize() / 1024));
+}
+
+void RenderGraphVulkan::Clear(ResourceTrash* trash)
+{
+    release(trash);
+    graph.Clear();
+    executes.clear();
+    images.clear();
+    views.clear();
+}
+
+void RenderGraphVulkan::createImages()
+{
+    const std::vector<RenderGraph::Texture>& textures = graph.GetTextures();
+
+    if (graph.GetHeapSize() > 0) {
+        vk::MemoryRequirements requirements;
+        requirements.size = graph.GetHeapSize();
+        requirements.alignment = graph.GetHeapAlignment();
+        requirements.memoryTypeBits = graph.GetHeapTypeBits();
+        // created and destroyed together, as the swapchain's render targets are
+        heap = allocator.Allocate(requirements, vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryAllocator::ResourceKind::Optimal,
+            MemoryAllocator::Strategy::Linear, MemoryAllocator::Category::Attachment);
+        if (!heap) {
+            printf("RenderGraph: no memory for the %u KB transient heap\n", static_cast<uint32_t>(graph.GetHeapSize() / 1024));
+        }
+    }
+
+    for (uint32_t t = 0; t < textures.size(); t++) {
+        if (textures[t].imported || !images[t]) {
+            continue;
+        }
+        if (textures[t].heapOffset != RenderGraph::NotAliased) {
+            if (heap) {
+                device.bindImageMemory(images[t], heap.memory, heap.offset + textures[t].heapOffset);
+            }
+        } else {
+            ownAllocations.push_back(allocator.AllocateImage(images[t], vk::MemoryPropertyFlagBits::eDeviceLocal, true,
+                MemoryAllocator::Strategy::Linear, MemoryAllocator::Category::Attachment));
+        }
+
+        vk::ImageViewCreateInfo info;
+        info.image = images[t];
+        info.viewType = vk::ImageViewType::e2D;
+        info.format = ToVulkan(textures[t].desc.format);
+        info.subresourceRange = vk::ImageSubresourceRange(aspects(textures[t].desc.format), 0, textures[t].desc.mipLevels, 0, 1);
+        views[t] = device.createImageView(info, nullptr);
+    }
+}
+
+void RenderGraphVulkan::createRenderPass(uint32_t index)
+{
+    passResources.resize(graph.GetPasses().size());
+    const RenderGraph::Pass& pass = graph.GetPasses()[index];
+    PassResources& resources = passResources[index];
+    if (pass.culled || pass.type != PassType::Graphics) {
+        return;
+    }
+
+    std::vector<vk::AttachmentDescription> attachments;
+    std::vector<vk::AttachmentReference> colorReferences;
+    vk::AttachmentReference depthReference;
+    bool hasDepth = false;
+
+    for (size_t u = 0; u < pass.uses.size(); u++) {
+        const RenderGraph::Use& use = pass.uses[u];
+        if (use.access != Access::ColorAttachment && use.access != Access::DepthAttachment && use.access != Access::DepthRead) {
+            continue;
+        }
+        const RenderGraph::Texture& texture = graph.GetTextures()[use.texture];
+        const vk::ImageLayout layout = accessInfo(use.access, pass.type).layout;
+
+        vk::AttachmentDescription attachment;
+        attachment.format = ToVulkan(texture.desc.format);
+        attachment.samples = vk::SampleCountFlagBits::e1;
+        attachment.loadOp = toVulkan(use.load);
+        // nothing to load ahead of a transient texture's first pass
+        if (!texture.imported && texture.firstPass == index && attachment.loadOp == vk::AttachmentLoadOp::eLoad) {
+            attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+        }
+        // nothing reads a transient texture after its last pass, a tiler keeps it on chip
+        const bool store = texture.imported || texture.lastPass != index || use.access == Access::DepthRead;
+        attachment.storeOp = store ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+        const bool stencil = (aspects(texture.desc.format) & vk::ImageAspectFlagBits::eStencil) == vk::ImageAspectFlagBits::eStencil;
+        attachment.stencilLoadOp = stencil ? attachment.loadOp : vk::AttachmentLoadOp::eDontCare;
+        attachment.stencilStoreOp = stencil ? attachment.storeOp : vk::AttachmentStoreOp::eDontCare;
+        // the barriers ahead of the pass do the transitions
+        attachment.initialLayout = layout;
+        attachment.finalLayout = layout;
+
+        vk::AttachmentReference reference;
+        reference.attachment = static_cast<uint32_t>(attachments.size());
+        reference.layout = layout;
+        if (isDepth(texture.desc.format)) {
+            if (hasDepth) {
+                printf("RenderGraph: pass %s has a second depth attachment, %s is left out\n", pass.name.c_str(), texture.name.c_str());
+                continue;
+            }
+            depthReference = reference;
+            hasDepth = true;
+        } else {
+            colorReferences.push_back(reference);
+        }
+        attachments.push_back(attachment);
+        resources.attachments.push_back(use.texture);
+
+        vk::ClearValue clear;
+        if (isDepth(texture.desc.format)) {
+            clear.depthStencil = vk::ClearDepthStencilValue(texture.desc.clearValue[0], static_cast<uint32_t>(texture.desc.clearValue[1]));
+        } else {
+            std::array<float, 4> color = { texture.desc.clearValue[0], texture.desc.clearValue[1], texture.desc.clearValue[2], texture.desc.clearValue[3] };
+            clear.color = vk::ClearColorValue(color);
+        }
+        resources.clearValues.push_back(clear);
+
+        if (resources.extent.width == 0) {
+            resources.extent = vk::Extent2D(texture.desc.width, texture.desc.height);
+        }
+    }
+
+    // a graphics pass without attachments, e.g. one that only draws into storage images
+    if (attachments.empty()) {
+        return;
+    }
+
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+    subpass.pColorAttachments = colorReferences.data();
+    subpass.pDepthStencilAttachment = hasDepth ? &depthReference : nullptr;
+
+    vk::RenderPassCreateInfo info;
+    info.attachmentCount = static_cast<uint32_t>(attachments.size());
+    info.pAttachments = attachments.data();
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+    resources.renderPass = device.createRenderPass(info);
+    vkx::debug::marker::setName(device, resources.renderPass, pass.name.c_str());
+}
+
+vk::Framebuffer RenderGraphVulkan::framebuffer(PassResources& resources)
+{
+    std::vector<vk::ImageView> attachmentViews(resources.attachments.size());
+    for (size_t a = 0; a < resources.attachments.size(); a++) {
+        attachmentViews[a] = views[resources.attachments[a]];
+    }
+    for (size_t f = 0; f < resources.framebuffers.size(); f++) {
+        if (resources.framebuffers[f].views == attachmentViews) {
+            return resources.framebuffers[f].framebuffer;
+        }
+    }
+
+    vk::FramebufferCreateInfo info;
+    info.renderPass = resources.renderPass;
+    info.attachmentCount = static_cast<uint32_t>(attachmentViews.size());
+    info.pAttachments = attachmentViews.data();
+    info.width = resources.extent.width;
+    info.height = resources.extent.height;
+    info.layers = 1;
+
+    Framebuffer framebuffer;
+    framebuffer.views = attachmentViews;
+    framebuffer.framebuffer = device.createFramebuffer(info, nullptr);
+    resources.framebuffers.push_back(framebuffer);
+    return framebuffer.framebuffer;
+}
+
+void RenderGraphVulkan::recordBarriers(vk::CommandBuffer cmd, const std::vector<RenderGraph::Barrier>& barriers)
+{
+    if (barriers.empty()) {
+        return;
+    }
+
+    vk::PipelineStageFlags srcStages;
+    vk::PipelineStageFlags dstStages;
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    for (size_t b = 0; b < barriers.size(); b++) {
+        const RenderGraph::Barrier& barrier = barriers[b];
+        const RenderGraph::Texture& texture = graph.GetTextures()[barrier.texture];
+        const AccessInfo before = accessInfo(barrier.before, barrier.beforeType);
+        const AccessInfo after = accessInfo(barrier.after, barrier.afterType);
+
+        vk::ImageMemoryBarrier imageBarrier;
+        // only writes need to be made available
+        imageBarrier.srcAccessMask = RenderGraph::IsWrite(barrier.before) ? before.access : vk::AccessFlags();
+        imageBarrier.dstAccessMask = after.access;
+        imageBarrier.oldLayout = before.layout;
+        imageBarrier.newLayout = after.layout;
+        imageBarrier.image = images[barrier.texture];
+        imageBarrier.subresourceRange = vk::ImageSubresourceRange(aspects(texture.desc.format), 0, texture.desc.mipLevels, 0, 1);
+        srcStages |= before.stages;
+        dstStages |= after.stages;
+
+        // the textures that used the memory before may still be at it, in any kind of pass
+        for (uint32_t a = 0; a <= static_cast<uint32_t>(Access::Present); a++) {
+            if (!(barrier.aliasedAccesses & (1u << a))) {
+                continue;
+            }
+            const Access aliased = static_cast<Access>(a);
+            srcStages |= accessInfo(aliased, PassType::Graphics).stages | accessInfo(aliased, PassType::Compute).stages;
+            if (RenderGraph::IsWrite(aliased)) {
+                imageBarrier.srcAccessMask |= accessInfo(aliased, PassType::Graphics).access;
+            }
+        }
+        imageBarriers.push_back(imageBarrier);
+    }
+    cmd.pipelineBarrier(srcStages, dstStages, vk::DependencyFlags(), nullptr, nullptr, imageBarriers);
+}
+
+void RenderGraphVulkan::Execute(vk::CommandBuffer cmd)
+{
+    const std::vector<RenderGraph::Pass>& passes = graph.GetPasses();
+    for (uint32_t i = 0; i < passes.size(); i++) {
+        if (passes[i].culled) {
+            continue;
+        }
+        recordBarriers(cmd, passes[i].barriers);
+
+        // every kept pass is a region in captures, under its name in the graph
+        if (vkx::debug::marker::active) {
+            vkx::debug::marker::beginRegion(VkCommandBuffer(cmd), passes[i].name, { { 0.5f, 0.5f, 0.8f, 1.0f } });
+        }
+        PassResources& resources = passResources[i];
+        if (!resources.renderPass) {
+            executes[i](cmd, *this);
+            if (vkx::debug::marker::active) {
+                vkx::debug::marker::endRegion(VkCommandBuffer(cmd));
+            }
+            continue;
+        }
+
+        vk::RenderPassBeginInfo begin;
+        begin.renderPass = resources.renderPass;
+        begin.framebuffer = framebuffer(resources);
+        begin.renderArea.extent = resources.extent;
+        begin.clearValueCount = static_cast<uint32_t>(resources.clearValues.size());
+        begin.pClearValues = resources.clearValues.data();
+        cmd.beginRenderPass(begin, vk::SubpassContents::eInline);
+
+        vk::Viewport viewport(0.0f, 0.0f, static_cast<float>(resources.extent.width), static_cast<float>(resources.extent.height), 0.0f, 1.0f);
+        cmd.setViewport(0, 1, &viewport);
+        vk::Rect2D scissor(vk::Offset2D(0, 0), resources.extent);
+        cmd.setScissor(0, 1, &scissor);
+
+        executes[i](cmd, *this);
+        cmd.endRenderPass();
+        if (vkx::debug::marker::active) {
+            vkx::debug::marker::endRegion(VkCommandBuffer(cmd));
+        }
+    }
+    recordBarriers(cmd, graph.GetFinalBarriers());
+}
+
+void RenderGraphVulkan::release(ResourceTrash* trash)
+{
+    vk::Device dev = device;
+    MemoryAllocator* memoryAllocator = &allocator;
+
+    std::vector<vk::Framebuffer> oldFramebuffers;
+    std::vector<vk::RenderPass> oldRenderPasses;
+    for (size_t i = 0; i < passResources.size(); i++) {
+        for (size_t f = 0; f < passResources[i].framebuffers.size(); f++) {
+            oldFramebuffers.push_back(passResources[i].framebuffers[f].framebuffer);
+        }
+        if (passResources[i].renderPass) {
+            oldRenderPasses.push_back(passResources[i].renderPass);
+        }
+    }
+    passResources.clear();
+
+    std::vector<vk::Image> oldImages;
+    std::vector<vk::ImageView> oldViews;
+    const std::vector<RenderGraph::Texture>& textures = graph.GetTextures();
+    for (size_t t = 0; t < textures.size() && t < images.size(); t++) {
+        if (textures[t].imported) {
+            continue;
+        }
+        if (views[t]) {
+            oldViews.push_back(views[t]);
+        }
+        if (images[t]) {
+            oldImages.push_back(images[t]);
+        }
+        images[t] = vk::Image();
+        views[t] = vk::ImageView();
+    }
+
+    std::vector<MemoryAllocator::Allocation> oldAllocations;
+    oldAllocations.swap(ownAllocations);
+    if (heap) {
+        oldAllocations.push_back(heap);
+        heap = MemoryAllocator::Allocation();
+    }
+
+    ResourceTrash::Destroyer destroy = [dev, memoryAllocator, oldFramebuffers, oldRenderPasses, oldViews, oldImages, oldAllocations]() {
+        for (auto& framebuffer : oldFramebuffers) {
+            dev.destroyFramebuffer(framebuffer);
+        }
+        for (auto& renderPass : oldRenderPasses) {
+            dev.destroyRenderPass(renderPass);
+        }
+        for (auto& view : oldViews) {
+            dev.destroyImageView(view);
+        }
+        for (auto& image : oldImages) {
+            dev.destroyImage(image);
+        }
+        for (auto& allocation : oldAllocations) {
+            memoryAllocator->Free(allocation);
+        }
+    };
+    if (trash) {
+        trash->Trash(destroy);
+    } else {
+        destroy();
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,44 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace m3d {
+const uint32_t RenderQueue::MaxPipelines;
+
+void RenderQueue::Clear()
+{
+    pipelines.clear();
+    items.clear();
+}
+
+uint32_t RenderQueue::AddPipeline(vk::Pipeline pipeline)
+{
+    assert(pipelines.size() < MaxPipelines);
+    pipelines.push_back(pipeline);
+    return static_cast<uint32_t>(pipelines.size() - 1);
+}
+
+void RenderQueue::Sort(ThreadPool* threads)
+{
+    RadixSort(items, scratch, threads);
+}
+
+void RenderQueue::GetPassRange(uint32_t pass, uint32_t& first, uint32_t& last) const
+{
+    const uint64_t passFirst = static_cast<uint64_t>(pass) << 60;
+    const uint64_t passLast = passFirst | 0x0fffffffffffffffull;
+    first = static_cast<uint32_t>(std::lower_bound(items.begin(), items.end(), passFirst,
+                                      [](const Item& item, uint64_t key) { return item.key < key; })
+        - items.begin());
+    last = static_cast<uint32_t>(std::upper_bound(items.begin() + first, items.end(), passLast,
+                                     [](uint64_t key, const Item& item) { return key < item.key; })
+        - items.begin());
+}
+} // End of namespace m3d
@@ -0,0 +1,87 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "RenderSnapshot.hpp"
+
+#include <cassert>
+
+namespace m3d {
+
+const int SnapshotBuffer::None;
+
+void RenderSnapshot::Clear()
+{
+    hasCamera = false;
+    transforms.clear();
+    simulateMs = 0.0;
+}
+
+SnapshotBuffer::SnapshotBuffer()
+{
+}
+
+RenderSnapshot& SnapshotBuffer::BeginWrite()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    assert(writing == None);
+    changed.wait(lock, [this]() { return reading != next && ready != next; });
+    writing = next;
+    next = 1 - next;
+    RenderSnapshot& snapshot = snapshots[writing];
+    snapshot.Clear();
+    snapshot.frame = ++frame;
+    return snapshot;
+}
+
+void SnapshotBuffer::EndWrite()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        assert(writing != None);
+        // the reader takes every snapshot, the previous one goes first
+        changed.wait(lock, [this]() { return ready == None; });
+        ready = writing;
+        writing = None;
+    }
+    changed.notify_all();
+}
+
+const RenderSnapshot* SnapshotBuffer::BeginRead()
+{
+    const RenderSnapshot* snapshot = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        assert(reading == None);
+        changed.wait(lock, [this]() { return ready != None || closed; });
+        if (ready == None) {
+            return nullptr;
+        }
+        reading = ready;
+        ready = None;
+        snapshot = &snapshots[reading];
+    }
+    changed.notify_all();
+    return snapshot;
+}
+
+void SnapshotBuffer::EndRead()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading = None;
+    }
+    changed.notify_all();
+}
+
+void SnapshotBuffer::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    changed.notify_all();
+}
+} // End of namespace m3d
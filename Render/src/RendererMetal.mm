@@ -0,0 +1,570 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Objective-C++, built with ARC
+
+#include "RendererMetal.hpp"
+
+#import <Foundation/Foundation.h>
+#import <Metal/Metal.h>
+#import <QuartzCore/CAMetalLayer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "File.hpp"
+#include "Scene.hpp"
+
+namespace m3d {
+
+static const char* ShaderPath = "data/shaders/metal/scene.metal";
+// constant buffer offsets have to be 256 byte aligned on macOS, more than iOS asks for
+static const size_t UniformAlignment = 256;
+static const uint32_t InvalidIndex = 0xFFFFFFFF;
+
+// shaders/metal/scene.metal FrameUniforms
+struct FrameUniforms {
+    m3d::math::Matrix4x4 projectionMatrix;
+    m3d::math::Matrix4x4 viewMatrix;
+};
+
+struct MetalContext {
+    id<MTLDevice> device;
+    id<MTLCommandQueue> queue;
+    CAMetalLayer* layer;
+    id<MTLRenderPipelineState> pipelineState;
+    id<MTLDepthStencilState> depthState;
+    id<MTLTexture> depthTexture;
+
+    id<MTLBuffer> vertexBuffer;
+    id<MTLBuffer> indexBuffer;
+    id<MTLBuffer> drawInfoBuffer;
+    id<MTLBuffer> materialBuffer;
+    id<MTLArgumentEncoder> argumentEncoder;
+    id<MTLBuffer> argumentBuffer;
+    // FramesInFlight slots of uniforms and world matrices
+    id<MTLBuffer> frameBuffer;
+    id<MTLIndirectCommandBuffer> indirectCommands;
+
+    // a slot becomes writable once the frame that last read it completed
+    dispatch_semaphore_t inflight;
+    // command buffers complete in submission order, waiting for the last waits for all
+    id<MTLCommandBuffer> lastCommandBuffer;
+    // written by the completion handlers, read once the slot's semaphore passed
+    double gpuMs[RendererMetal::FramesInFlight];
+    bool supportsIndirect;
+};
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// relative paths are looked up in the application bundle first, like the APK's assets on Android
+static std::string resolvePath(const char* path)
+{
+    if (path[0] == '/') {
+        return path;
+    }
+    NSString* resources = [[NSBundle mainBundle] resourcePath];
+    if (resources) {
+        std::string bundled = std::string([resources UTF8String]) + "/" + path;
+        if (std::FILE* fp = std::fopen(bundled.c_str(), "rb")) {
+            std::fclose(fp);
+            return bundled;
+        }
+    }
+    return path;
+}
+
+RendererMetal::RendererMetal()
+{
+    // Pipeline's default camera
+    viewMatrix = m3d::math::Matrix4x4::Translation(m3d::math::Vector3(0.0f, 0.0f, -100.0f));
+    projectionMatrix = m3d::math::Matrix4x4::Perspective(60.0f, 1.0f, 0.1f, 256.0f);
+}
+
+void RendererMetal::SetCamera(const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection)
+{
+    viewMatrix = view;
+    projectionMatrix = projection;
+    customCamera = true;
+}
+
+uint32_t RendererMetal::AddInstance(uint32_t meshID, const Transform& transform)
+{
+    sceneDirty = true;
+    return scene->AddInstance(meshID, transform);
+}
+
+void RendererMetal::RemoveInstance(uint32_t instanceID)
+{
+    scene->RemoveInstance(instanceID);
+    sceneDirty = true;
+}
+
+void RendererMetal::SetTransform(uint32_t transformID, const Transform& transform)
+{
+    scene->SetTransform(transformID, transform);
+}
+
+void RendererMetal::SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID)
+{
+    scene->SetSliceMaterial(meshID, slice, materialID);
+    sceneDirty = true;
+}
+
+void RendererMetal::CreateDevice()
+{
+    metal = new MetalContext();
+    metal->device = MTLCreateSystemDefaultDevice();
+    if (!metal->device) {
+        printf("RendererMetal: Metal is not supported on this device\n");
+        return;
+    }
+    metal->queue = [metal->device newCommandQueue];
+    metal->inflight = dispatch_semaphore_create(FramesInFlight);
+
+    // baseInstance and indirect command buffers need an A9 on iOS
+    bool apple3 = false;
+    metal->supportsIndirect = false;
+    if (@available(iOS 13.0, macOS 10.15, *)) {
+        apple3 = [metal->device supportsFamily:MTLGPUFamilyApple3] || [metal->device supportsFamily:MTLGPUFamilyMac2];
+        metal->supportsIndirect = apple3;
+    } else {
+#if TARGET_OS_IPHONE
+        apple3 = [metal->device supportsFeatureSet:MTLFeatureSet_iOS_GPUFamily3_v1];
+#else
+        apple3 = true;
+#endif
+    }
+    if (!apple3) {
+        printf("RendererMetal: %s has no baseInstance support, an A9 or newer GPU is needed\n", [[metal->device name] UTF8String]);
+        metal->device = nil;
+        return;
+    }
+    if (useIndirect && !metal->supportsIndirect) {
+        printf("RendererMetal: no indirect command buffers, encoding the draws every frame\n");
+        useIndirect = false;
+    }
+
+    metal->layer = (__bridge CAMetalLayer*)layer;
+    metal->layer.device = metal->device;
+    metal->layer.pixelFormat = MTLPixelFormatBGRA8Unorm;
+    metal->layer.framebufferOnly = YES;
+}
+
+void RendererMetal::CreatePipeline()
+{
+    std::string source;
+    const std::string path = resolvePath(ShaderPath);
+    if (!file::readBinary(path.c_str(), source)) {
+        printf("RendererMetal: cannot read %s\n", path.c_str());
+        return;
+    }
+
+    NSError* error = nil;
+    id<MTLLibrary> library = [metal->device newLibraryWithSource:[NSString stringWithUTF8String:source.c_str()] options:nil error:&error];
+    if (!library) {
+        printf("RendererMetal: %s does not compile: %s\n", path.c_str(), [[error localizedDescription] UTF8String]);
+        return;
+    }
+    id<MTLFunction> vertexFunction = [library newFunctionWithName:@"sceneVertex"];
+    id<MTLFunction> fragmentFunction = [library newFunctionWithName:@"sceneFragment"];
+
+    // PackedVertex
+    MTLVertexDescriptor* vertexDescriptor = [MTLVertexDescriptor vertexDescriptor];
+    vertexDescriptor.attributes[0].format = MTLVertexFormatFloat3;
+    vertexDescriptor.attributes[0].offset = offsetof(PackedVertex, position);
+    vertexDescriptor.attributes[0].bufferIndex = 0;
+    vertexDescriptor.attributes[1].format = MTLVertexFormatShort2Normalized;
+    vertexDescriptor.attributes[1].offset = offsetof(PackedVertex, normal);
+    vertexDescriptor.attributes[1].bufferIndex = 0;
+    vertexDescriptor.attributes[2].format = MTLVertexFormatHalf2;
+    vertexDescriptor.attributes[2].offset = offsetof(PackedVertex, uv);
+    vertexDescriptor.attributes[2].bufferIndex = 0;
+    vertexDescriptor.layouts[0].stride = sizeof(PackedVertex);
+    vertexDescriptor.layouts[0].stepFunction = MTLVertexStepFunctionPerVertex;
+
+    MTLRenderPipelineDescriptor* pipelineDescriptor = [[MTLRenderPipelineDescriptor alloc] init];
+    pipelineDescriptor.label = @"Scene";
+    pipelineDescriptor.vertexFunction = vertexFunction;
+    pipelineDescriptor.fragmentFunction = fragmentFunction;
+    pipelineDescriptor.vertexDescriptor = vertexDescriptor;
+    pipelineDescriptor.colorAttachments[0].pixelFormat = metal->layer.pixelFormat;
+    pipelineDescriptor.depthAttachmentPixelFormat = MTLPixelFormatDepth32Float;
+    if (useIndirect) {
+        if (@available(iOS 12.0, macOS 10.14, *)) {
+            pipelineDescriptor.supportIndirectCommandBuffers = YES;
+        }
+    }
+    metal->pipelineState = [metal->device newRenderPipelineStateWithDescriptor:pipelineDescriptor error:&error];
+    if (!metal->pipelineState) {
+        printf("RendererMetal: pipeline creation failed: %s\n", [[error localizedDescription] UTF8String]);
+        return;
+    }
+
+    // PipelineRegistry's default: less or equal, no culling
+    MTLDepthStencilDescriptor* depthDescriptor = [[MTLDepthStencilDescriptor alloc] init];
+    depthDescriptor.depthCompareFunction = MTLCompareFunctionLessEqual;
+    depthDescriptor.depthWriteEnabled = YES;
+    metal->depthState = [metal->device newDepthStencilStateWithDescriptor:depthDescriptor];
+
+    // the vertex function's view of buffer(1), the fragment function reads the same one
+    metal->argumentEncoder = [vertexFunction newArgumentEncoderWithBufferIndex:1];
+    metal->argumentBuffer = [metal->device newBufferWithLength:metal->argumentEncoder.encodedLength options:MTLResourceStorageModeShared];
+    metal->argumentBuffer.label = @"SceneArguments";
+}
+
+void RendererMetal::CreateDepthBuffer()
+{
+    MTLTextureDescriptor* descriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatDepth32Float width:width height:height mipmapped:NO];
+    descriptor.usage = MTLTextureUsageRenderTarget;
+    descriptor.storageMode = MTLStorageModePrivate;
+#if TARGET_OS_IPHONE
+    // cleared and dropped within the pass, Apple GPUs keep it in tile memory without any backing
+    if (@available(iOS 10.0, *)) {
+        descriptor.storageMode = MTLStorageModeMemoryless;
+    }
+#endif
+    metal->depthTexture = [metal->device newTextureWithDescriptor:descriptor];
+}
+
+void RendererMetal::Init(Scene* scene)
+{
+    if (!layer) {
+        printf("RendererMetal: SetLayer before Init\n");
+        return;
+    }
+    this->scene = scene;
+
+    CreateDevice();
+    if (!metal->device) {
+        return;
+    }
+    CreatePipeline();
+    if (!metal->pipelineState) {
+        return;
+    }
+
+    BuildGeometry();
+    BuildDraws();
+    inited = true;
+    OnWindowSizeChanged();
+}
+
+// Every mesh back to back in one shared vertex and one shared index buffer, unified memory needs no staging
+void RendererMetal::BuildGeometry()
+{
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for (uint32_t meshID : scene->meshes) {
+        const Mesh& mesh = scene->meshes[meshID];
+        vertexCount += mesh.vertexCount();
+        indexCount += mesh.indexCount();
+    }
+
+    geometryRanges.clear();
+    metal->vertexBuffer = nil;
+    metal->indexBuffer = nil;
+    if (vertexCount == 0 || indexCount == 0) {
+        return;
+    }
+    metal->vertexBuffer = [metal->device newBufferWithLength:vertexCount * sizeof(PackedVertex) options:MTLResourceStorageModeShared];
+    metal->vertexBuffer.label = @"Vertices";
+    metal->indexBuffer = [metal->device newBufferWithLength:indexCount * sizeof(uint32_t) options:MTLResourceStorageModeShared];
+    metal->indexBuffer.label = @"Indices";
+
+    PackedVertex* vertices = static_cast<PackedVertex*>([metal->vertexBuffer contents]);
+    uint32_t* indices = static_cast<uint32_t*>([metal->indexBuffer contents]);
+    size_t vertexNext = 0;
+    size_t indexNext = 0;
+    for (uint32_t meshID : scene->meshes) {
+        const Mesh& mesh = scene->meshes[meshID];
+        GeometryRange& range = geometryRanges[meshID];
+        range.baseVertex = static_cast<int32_t>(vertexNext);
+        range.firstIndex = static_cast<uint32_t>(indexNext);
+        range.valid = mesh.vertexCount() > 0 && mesh.indexCount() > 0;
+
+        memcpy(vertices + vertexNext, mesh.vertexData(), mesh.vertexCount() * sizeof(PackedVertex));
+        // one 32 bit index buffer for every mesh, cooked 16 bit indices are widened into it
+        if (mesh.shortIndexData()) {
+            for (size_t i = 0; i < mesh.indexCount(); ++i) {
+                indices[indexNext + i] = mesh.shortIndexData()[i];
+            }
+        } else {
+            memcpy(indices + indexNext, mesh.indexData(), mesh.indexCount() * sizeof(uint32_t));
+        }
+        vertexNext += mesh.vertexCount();
+        indexNext += mesh.indexCount();
+    }
+}
+
+// One draw per instance slice in scene order, the GPU buffers they read and the frame ring sized for them
+void RendererMetal::BuildDraws()
+{
+    // compact material slots, scene material ids may have gaps
+    std::unordered_map<uint32_t, uint32_t> materialSlots;
+    std::vector<GpuMaterial> materials;
+    for (uint32_t materialID : scene->materials) {
+        const Material& material = scene->materials[materialID];
+        GpuMaterial gpuMaterial;
+        for (int c = 0; c < 3; ++c) {
+            gpuMaterial.diffuse[c] = material.diffuse[c];
+        }
+        gpuMaterial.diffuse[3] = 1.0f;
+        materialSlots[materialID] = static_cast<uint32_t>(materials.size());
+        materials.push_back(gpuMaterial);
+    }
+
+    drawCommands.clear();
+    drawInfos.clear();
+    drawTransforms.clear();
+    for (uint32_t instanceID : scene->instances) {
+        const Instance& instance = scene->instances[instanceID];
+        auto found = geometryRanges.find(instance.meshId);
+        if (found == geometryRanges.end() || !found->second.valid) {
+            continue;
+        }
+        const Mesh& mesh = scene->meshes[instance.meshId];
+        const GeometryRange& range = found->second;
+        for (uint32_t s = 0; s < mesh.slices.size(); ++s) {
+            const Mesh::Slice& slice = mesh.slices[s];
+            DrawCommand command;
+            command.indexCount = slice.triangleCount * 3;
+            command.firstIndex = range.firstIndex + slice.indexOffset;
+            command.baseVertex = range.baseVertex;
+            drawCommands.push_back(command);
+
+            DrawInfo drawInfo;
+            drawInfo.transform = static_cast<uint32_t>(drawTransforms.size());
+            drawInfo.material = InvalidIndex;
+            if (s < mesh.materialIds.size()) {
+                auto slot = materialSlots.find(mesh.materialIds[s]);
+                if (slot != materialSlots.end()) {
+                    drawInfo.material = slot->second;
+                }
+            }
+            drawInfos.push_back(drawInfo);
+        }
+        drawTransforms.push_back(instance.transformId);
+    }
+
+    // buffers of zero length are invalid, keep one element
+    metal->drawInfoBuffer = [metal->device newBufferWithLength:std::max<size_t>(1, drawInfos.size()) * sizeof(DrawInfo) options:MTLResourceStorageModeShared];
+    metal->drawInfoBuffer.label = @"DrawInfos";
+    if (!drawInfos.empty()) {
+        memcpy([metal->drawInfoBuffer contents], drawInfos.data(), drawInfos.size() * sizeof(DrawInfo));
+    }
+    metal->materialBuffer = [metal->device newBufferWithLength:std::max<size_t>(1, materials.size()) * sizeof(GpuMaterial) options:MTLResourceStorageModeShared];
+    metal->materialBuffer.label = @"Materials";
+    if (!materials.empty()) {
+        memcpy([metal->materialBuffer contents], materials.data(), materials.size() * sizeof(GpuMaterial));
+    }
+    [metal->argumentEncoder setArgumentBuffer:metal->argumentBuffer offset:0];
+    [metal->argumentEncoder setBuffer:metal->drawInfoBuffer offset:0 atIndex:0];
+    [metal->argumentEncoder setBuffer:metal->materialBuffer offset:0 atIndex:1];
+
+    // uniforms, then a world matrix per drawn instance
+    transformsOffset = alignUp(sizeof(FrameUniforms), UniformAlignment);
+    const size_t newSlotSize = alignUp(transformsOffset + std::max<size_t>(1, drawTransforms.size()) * sizeof(m3d::math::Matrix4x4), UniformAlignment);
+    if (newSlotSize > slotSize || !metal->frameBuffer) {
+        slotSize = newSlotSize;
+        metal->frameBuffer = [metal->device newBufferWithLength:slotSize * FramesInFlight options:MTLResourceStorageModeShared];
+        metal->frameBuffer.label = @"FrameRing";
+    }
+
+    if (useIndirect) {
+        EncodeIndirectCommands();
+    }
+}
+
+// The draws once, replayed by every frame; pipeline and buffers come from the render encoder
+void RendererMetal::EncodeIndirectCommands()
+{
+    if (@available(iOS 12.0, macOS 10.14, *)) {
+        metal->indirectCommands = nil;
+        if (drawCommands.empty()) {
+            return;
+        }
+        MTLIndirectCommandBufferDescriptor* descriptor = [[MTLIndirectCommandBufferDescriptor alloc] init];
+        descriptor.commandTypes = MTLIndirectCommandTypeDrawIndexed;
+        descriptor.inheritPipelineState = YES;
+        descriptor.inheritBuffers = YES;
+        metal->indirectCommands = [metal->device newIndirectCommandBufferWithDescriptor:descriptor maxCommandCount:drawCommands.size() options:MTLResourceStorageModeShared];
+        metal->indirectCommands.label = @"SceneDraws";
+
+        for (uint32_t i = 0; i < drawCommands.size(); ++i) {
+            const DrawCommand& command = drawCommands[i];
+            id<MTLIndirectRenderCommand> draw = [metal->indirectCommands indirectRenderCommandAtIndex:i];
+            [draw drawIndexedPrimitives:MTLPrimitiveTypeTriangle
+                             indexCount:command.indexCount
+                              indexType:MTLIndexTypeUInt32
+                            indexBuffer:metal->indexBuffer
+                      indexBufferOffset:command.firstIndex * sizeof(uint32_t)
+                          instanceCount:1
+                             baseVertex:command.baseVertex
+                           baseInstance:i];
+        }
+    }
+}
+
+void RendererMetal::OnWindowSizeChanged()
+{
+    if (!inited) {
+        return;
+    }
+    CGSize size = metal->layer.bounds.size;
+    const CGFloat scale = metal->layer.contentsScale;
+    const uint32_t newWidth = static_cast<uint32_t>(size.width * scale);
+    const uint32_t newHeight = static_cast<uint32_t>(size.height * scale);
+    if (newWidth == 0 || newHeight == 0 || (newWidth == width && newHeight == height)) {
+        return;
+    }
+    width = newWidth;
+    height = newHeight;
+    metal->layer.drawableSize = CGSizeMake(width, height);
+    // frames in flight keep their reference to the old one
+    CreateDepthBuffer();
+
+    if (!customCamera) {
+        projectionMatrix = m3d::math::Matrix4x4::Perspective(60.0f, static_cast<float>(width) / height, 0.1f, 256.0f);
+    }
+}
+
+// The slot's last frame completed, the CPU owns it
+void RendererMetal::WriteFrame(uint32_t slot)
+{
+    uint8_t* base = static_cast<uint8_t*>([metal->frameBuffer contents]) + slot * slotSize;
+    FrameUniforms* uniforms = reinterpret_cast<FrameUniforms*>(base);
+    uniforms->projectionMatrix = projectionMatrix;
+    uniforms->viewMatrix = viewMatrix;
+
+    scene->transformStore.Update();
+    m3d::math::Matrix4x4* transforms = reinterpret_cast<m3d::math::Matrix4x4*>(base + transformsOffset);
+    for (size_t i = 0; i < drawTransforms.size(); ++i) {
+        transforms[i] = scene->transformStore.GetWorld(drawTransforms[i]);
+    }
+}
+
+void RendererMetal::WaitIdle()
+{
+    if (metal && metal->lastCommandBuffer) {
+        [metal->lastCommandBuffer waitUntilCompleted];
+    }
+}
+
+void RendererMetal::Draw()
+{
+    if (!inited || width == 0 || height == 0) {
+        return;
+    }
+
+    dispatch_semaphore_wait(metal->inflight, DISPATCH_TIME_FOREVER);
+    const uint32_t slot = frameIndex;
+    frameStats.gpuMs = metal->gpuMs[slot];
+
+    @autoreleasepool {
+        id<CAMetalDrawable> drawable = [metal->layer nextDrawable];
+        auto tStart = std::chrono::high_resolution_clock::now();
+        if (!drawable) {
+            dispatch_semaphore_signal(metal->inflight);
+            return;
+        }
+
+        if (sceneDirty) {
+            // the geometry and draw buffers are shared by every frame in flight
+            WaitIdle();
+            BuildGeometry();
+            BuildDraws();
+            sceneDirty = false;
+        }
+        WriteFrame(slot);
+
+        MTLRenderPassDescriptor* pass = [MTLRenderPassDescriptor renderPassDescriptor];
+        // CommandBuffer's clear values
+        pass.colorAttachments[0].texture = drawable.texture;
+        pass.colorAttachments[0].loadAction = MTLLoadActionClear;
+        pass.colorAttachments[0].storeAction = MTLStoreActionStore;
+        pass.colorAttachments[0].clearColor = MTLClearColorMake(1.0, 1.0, 1.0, 1.0);
+        pass.depthAttachment.texture = metal->depthTexture;
+        pass.depthAttachment.loadAction = MTLLoadActionClear;
+        pass.depthAttachment.storeAction = MTLStoreActionDontCare;
+        pass.depthAttachment.clearDepth = 1.0;
+
+        id<MTLCommandBuffer> commandBuffer = [metal->queue commandBuffer];
+        commandBuffer.label = @"Frame";
+        id<MTLRenderCommandEncoder> encoder = [commandBuffer renderCommandEncoderWithDescriptor:pass];
+        [encoder setRenderPipelineState:metal->pipelineState];
+        [encoder setDepthStencilState:metal->depthState];
+        [encoder setCullMode:MTLCullModeNone];
+
+        uint32_t draws = 0;
+        if (!drawCommands.empty()) {
+            [encoder setVertexBuffer:metal->vertexBuffer offset:0 atIndex:0];
+            [encoder setVertexBuffer:metal->argumentBuffer offset:0 atIndex:1];
+            [encoder setVertexBuffer:metal->frameBuffer offset:slot * slotSize atIndex:2];
+            [encoder setVertexBuffer:metal->frameBuffer offset:slot * slotSize + transformsOffset atIndex:3];
+            [encoder setFragmentBuffer:metal->argumentBuffer offset:0 atIndex:1];
+            // only reached through the argument buffer
+            [encoder useResource:metal->drawInfoBuffer usage:MTLResourceUsageRead];
+            [encoder useResource:metal->materialBuffer usage:MTLResourceUsageRead];
+
+            bool encoded = false;
+            if (useIndirect) {
+                if (@available(iOS 12.0, macOS 10.14, *)) {
+                    // the indirect commands reference the index buffer, nothing binds it
+                    [encoder useResource:metal->indexBuffer usage:MTLResourceUsageRead];
+                    [encoder executeCommandsInBuffer:metal->indirectCommands withRange:NSMakeRange(0, drawCommands.size())];
+                    encoded = true;
+                }
+            }
+            if (!encoded) {
+                for (uint32_t i = 0; i < drawCommands.size(); ++i) {
+                    const DrawCommand& command = drawCommands[i];
+                    [encoder drawIndexedPrimitives:MTLPrimitiveTypeTriangle
+                                        indexCount:command.indexCount
+                                         indexType:MTLIndexTypeUInt32
+                                       indexBuffer:metal->indexBuffer
+                                 indexBufferOffset:command.firstIndex * sizeof(uint32_t)
+                                     instanceCount:1
+                                        baseVertex:command.baseVertex
+                                      baseInstance:i];
+                }
+            }
+            draws = static_cast<uint32_t>(drawCommands.size());
+        }
+        [encoder endEncoding];
+        [commandBuffer presentDrawable:drawable];
+
+        dispatch_semaphore_t inflight = metal->inflight;
+        double* gpuMs = &metal->gpuMs[slot];
+        [commandBuffer addCompletedHandler:^(id<MTLCommandBuffer> buffer) {
+            if (@available(iOS 10.3, macOS 10.15, *)) {
+                *gpuMs = (buffer.GPUEndTime - buffer.GPUStartTime) * 1000.0;
+            }
+            dispatch_semaphore_signal(inflight);
+        }];
+        [commandBuffer commit];
+        metal->lastCommandBuffer = commandBuffer;
+
+        frameIndex = (frameIndex + 1) % FramesInFlight;
+        frameStats.draws = draws;
+        frameStats.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+    }
+}
+
+RendererMetal::~RendererMetal()
+{
+    // the completion handlers write into the context
+    WaitIdle();
+    delete metal;
+}
+} // End of namespace m3d
@@ -5,22 +5,157 @@
 */
 
 #include "RendererVulkan.hpp"
+#include "AccelerationStructures.hpp"
+#include "BufferAddress.hpp"
+#include "ClusteredLights.hpp"
+#include "CommandCapture.hpp"
 #include "CommandBuffer.hpp"
+#include "CpuTopology.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DynamicResolution.hpp"
 #include "File.hpp"
+#include "FrameArena.hpp"
+#include "FrameCapture.hpp"
+#include "FramePacer.hpp"
+#include "GeometryArena.hpp"
+#include "GpuCulling.hpp"
+#include "GpuMeshDecoder.hpp"
+#include "GpuProfiler.hpp"
+#include "CrowdRenderer.hpp"
+#include "GpuSkinning.hpp"
+#include "GuiRenderer.hpp"
+#include "IdPicker.hpp"
+#include "ImpostorRenderer.hpp"
+#include "IndirectDraws.hpp"
+#include "JobSystem.hpp"
+#include "MaterialTable.hpp"
 #include "Matrix.h"
+#include "MemoryAllocator.hpp"
+#include "MemoryOverlay.hpp"
+#include "MemoryTags.hpp"
+#include "OcclusionQueries.hpp"
+#include "ParticleSystem.hpp"
+#include "OffscreenTargets.hpp"
+#include "PerfLint.hpp"
 #include "Pipeline.hpp"
+#include "PipelineRegistry.hpp"
+#include "PostProcess.hpp"
+#include "RenderSnapshot.hpp"
+#include "SamplerCache.hpp"
 #include "Scene.hpp"
+#include "SceneStreamer.hpp"
+#include "ShaderWatcher.hpp"
+#include "ShadowAtlas.hpp"
+#include "ShadowCascades.hpp"
+#include "ShadingRate.hpp"
+#include "SoftwareOcclusion.hpp"
+#include "SubmitTimeline.hpp"
+#include "StatsOverlay.hpp"
+#include "TextureArrays.hpp"
+#include "TextureStreamer.hpp"
+#include "WorldPartition.hpp"
+#include "Trace.hpp"
+#include "UploadQueue.hpp"
 #include "VulkanHelper.hpp"
 #include "VulkanSwapchain.hpp"
 #include "vulkanDebug.h"
 #include "vulkanTextureLoader.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <thread>
 
 #define VERTEX_BUFFER_BIND_ID 0
 namespace m3d {
 
+// Rendering on demand: frames drawn after the last change, texture streaming and LODs follow a moved camera over
+// a few; and how long an idle loop sleeps at most, async decodes and shader reloads complete without waking it
+static const uint32_t RedrawSettleFrames = 8;
+static const uint32_t IdlePollMs = 50;
+
+// GpuSkinning limits, every frame slot holds MaxSkinnedVertices * 20 bytes of skinned output
+static const uint32_t MaxBindPoseVertices = 256 * 1024;
+static const uint32_t MaxSkinnedVertices = 512 * 1024;
+static const uint32_t MaxSkinnedJoints = 16 * 1024;
+static const uint32_t MaxSkinnedInstances = 1024;
+// morph entries of every skinned mesh, 28 bytes each, and morph weights of a frame slot
+static const uint32_t MaxMorphEntries = 1024 * 1024;
+static const uint32_t MaxMorphWeights = 16 * 1024;
+// CrowdRenderer limits: bind pose vertices, baked matrices of 48 bytes, clips and meshes of every crowd, and agents
+// of a frame slot, 64 bytes each
+static const uint32_t MaxCrowdVertices = 256 * 1024;
+static const uint32_t MaxCrowdMatrices = 256 * 1024;
+static const uint32_t MaxCrowdClips = 1024;
+static const uint32_t MaxCrowdMeshes = 64;
+static const uint32_t MaxCrowdAgents = 64 * 1024;
+// instances of a frame slot's top level acceleration structure, 64 bytes each
+static const uint32_t MaxTracedInstances = 64 * 1024;
+// heavy instances queried per frame slot, 4 bytes of predicate each
+static const uint32_t MaxOcclusionQueries = 4096;
+// ImpostorRenderer limits: atlas layers, impostor instances per frame and the triangles of the lightest mesh baked
+static const uint32_t MaxImpostorMeshes = 64;
+static const uint32_t MaxImpostorInstances = 64 * 1024;
+static const uint32_t MinImpostorTriangles = 256;
+// ParticleSystem limits: particles alive at once, alpha blended ones sorted per frame and emitters
+static const uint32_t MaxParticles = 1024 * 1024;
+static const uint32_t MaxSortedParticles = 64 * 1024;
+static const uint32_t MaxParticleEmitters = 256;
+// GUI quads of one frame slot, 80 bytes of vertices each
+static const uint32_t MaxGuiQuads = 16 * 1024;
+
+// VK_KHR_get_physical_device_properties2 and VK_EXT_pci_bus_info postdate the vulkan headers
+static const VkStructureType PhysicalDeviceProperties2Type = static_cast<VkStructureType>(1000059001);
+static const VkStructureType PhysicalDevicePciBusInfoPropertiesType = static_cast<VkStructureType>(1000212000);
+
+struct PhysicalDeviceProperties2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceProperties properties;
+};
+
+struct PhysicalDevicePciBusInfoProperties {
+    VkStructureType sType;
+    void* pNext;
+    uint32_t pciDomain;
+    uint32_t pciBus;
+    uint32_t pciDevice;
+    uint32_t pciFunction;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceProperties2)(VkPhysicalDevice physicalDevice, PhysicalDeviceProperties2* properties);
+
+// NUMA node of physicalDevice's PCI slot, -1 without VK_EXT_pci_bus_info or on machines of one node
+static int deviceNumaNode(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    if (cpu::GetTopology().nodeCount < 2 || !vkhelper::checkDeviceExtensionPresent(physicalDevice, "VK_EXT_pci_bus_info")) {
+        return -1;
+    }
+    PFN_vkVoidFunction getProperties2 = instance.getProcAddr("vkGetPhysicalDeviceProperties2KHR");
+    if (!getProperties2) {
+        return -1;
+    }
+    PhysicalDevicePciBusInfoProperties pciBus = {};
+    pciBus.sType = PhysicalDevicePciBusInfoPropertiesType;
+    PhysicalDeviceProperties2 properties = {};
+    properties.sType = PhysicalDeviceProperties2Type;
+    properties.pNext = &pciBus;
+    reinterpret_cast<GetPhysicalDeviceProperties2>(getProperties2)(VkPhysicalDevice(physicalDevice), &properties);
+    return cpu::PciDeviceNode(pciBus.pciDomain, pciBus.pciBus, pciBus.pciDevice, pciBus.pciFunction);
+}
+
+// "<prefix> <index>" in captures, nothing without the debug marker extension
+static void nameImages(vk::Device device, const std::vector<vk::Image>& images, const char* prefix)
+{
+    for (size_t i = 0; i < images.size(); ++i) {
+        char name[48];
+        snprintf(name, sizeof(name), "%s %u", prefix, static_cast<uint32_t>(i));
+        vkx::debug::marker::setName(device, images[i], name);
+    }
+}
+
+#if defined(_WIN32)
 // Win32 : Sets up a console window and redirects standard output to it
 void RendererVulkan::CreateConsole(const char* title)
 {
@@ -30,10 +165,13 @@ void RendererVulkan::CreateConsole(const char* title)
     freopen_s(&stream, "CONOUT$", "w+", stdout);
     SetConsoleTitle(TEXT(title));
 }
+#endif
 
 RendererVulkan::RendererVulkan()
 {
+#if defined(_WIN32)
 	CreateConsole("m3d");
+#endif
 }
 
 std::vector<const char*> RendererVulkan::getAvailableWSIExtensions()
@@ -59,11 +197,14 @@ std::vector<const char*> RendererVulkan::getAvailableWSIExtensions()
     return extensions;
 }
 
+#if defined(_WIN32)
 void RendererVulkan::createWin32Window(HINSTANCE hinstance, WNDPROC wndproc, uint32_t w, uint32_t h)
 {
     const std::string class_name("RendererVulkanWindowClass");
 
     hinstance_ = hinstance;
+    width = w;
+    height = h;
 
     WNDCLASSEX win_class = {};
     win_class.cbSize = sizeof(WNDCLASSEX);
@@ -120,26 +261,25 @@ LRESULT RendererVulkan::handle_message(UINT msg, WPARAM wparam, LPARAM lparam)
         break;
     case WM_PAINT:
         ValidateRect(hwnd_, NULL);
+        RequestRedraw();
         break;
     case WM_KEYDOWN:
-
-        break;
     case WM_KEYUP:
-
-        break;
     case WM_RBUTTONDOWN:
     case WM_LBUTTONDOWN:
     case WM_MBUTTONDOWN:
-        break;
-    case WM_MOUSEWHEEL: {
-
-        break;
-    }
+    case WM_MOUSEWHEEL:
     case WM_MOUSEMOVE:
-
+        // input may move the camera or change the GUI
+        RequestRedraw();
         break;
     case WM_SIZE:
-        //OnWindowSizeChanged();
+        // only flag it, the swapchain is recreated between frames
+        minimized = wparam == SIZE_MINIMIZED;
+        if (!minimized) {
+            resizePending = true;
+            RequestRedraw();
+        }
         break;
     case WM_ENTERSIZEMOVE:
 
@@ -149,14 +289,30 @@ LRESULT RendererVulkan::handle_message(UINT msg, WPARAM wparam, LPARAM lparam)
     }
     return 0;
 }
+#endif
 
 /*
 	 * Setup Vulkan
 	 */
 bool RendererVulkan::CreateInstance()
 {
-    // Use validation layers if this is a debug build, and use WSI extensions regardless
-    std::vector<const char*> extensions = getAvailableWSIExtensions();
+    // Use validation layers if this is a debug build, and use WSI extensions unless headless
+    std::vector<const char*> extensions;
+    if (!headless) {
+        extensions = getAvailableWSIExtensions();
+    }
+#if defined(_DEBUG)
+    else {
+        extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+    }
+#endif
+    // the memory allocator asks the driver for the heap budgets through it
+    for (const vk::ExtensionProperties& extension : vk::enumerateInstanceExtensionProperties()) {
+        if (strcmp(extension.extensionName, "VK_KHR_get_physical_device_properties2") == 0) {
+            extensions.push_back("VK_KHR_get_physical_device_properties2");
+            instanceProperties2 = true;
+        }
+    }
 
 #if defined(_DEBUG)
     std::vector<const char*> layers;
@@ -165,12 +321,24 @@ bool RendererVulkan::CreateInstance()
 
     // vk::ApplicationInfo allows the programmer to specifiy some basic information about the
     // program, which can be useful for layers and tools to provide more debug information.
+    // acceleration structures need 1.1, which loaders older than it do not accept
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    if (useRayTracing) {
+        PFN_vkVoidFunction enumerateVersion = vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateVersion) {
+            reinterpret_cast<VkResult(VKAPI_PTR*)(uint32_t*)>(enumerateVersion)(&loaderVersion);
+        }
+        if (loaderVersion >= VK_MAKE_VERSION(1, 1, 0)) {
+            apiVersion = VK_MAKE_VERSION(1, 1, 0);
+        }
+    }
     vk::ApplicationInfo appInfo = vk::ApplicationInfo()
                                       .setPApplicationName("m3d example")
                                       .setApplicationVersion(1)
                                       .setPEngineName("m3d")
                                       .setEngineVersion(1)
-                                      .setApiVersion(VK_API_VERSION_1_0);
+                                      .setApiVersion(apiVersion);
 
     // vk::InstanceCreateInfo is where the programmer specifies the layers and/or extensions that
     // are needed.
@@ -201,7 +369,13 @@ bool RendererVulkan::CreateInstance()
         vk::DebugReportFlagsEXT debugReportFlags = vk::DebugReportFlagBitsEXT::eError; // | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
         // Additional flags include performance info, loader and layer debug messages, etc.
         //vkDebug::setupDebugging(instance, debugReportFlags, VK_NULL_HANDLE);
-        vkx::debug::setupDebugging(instance, debugReportFlags);
+        if (perflint::IsEnabled()) {
+            // the perf lint counts the performance warnings, then prints them like the errors
+            debugReportFlags |= vk::DebugReportFlagBitsEXT::ePerformanceWarning;
+            vkx::debug::setupDebugging(instance, debugReportFlags, perflint::MessageCallback);
+        } else {
+            vkx::debug::setupDebugging(instance, debugReportFlags);
+        }
     }
 
     return true;
@@ -219,7 +393,18 @@ void RendererVulkan::CreateDevice()
         instance.destroy();
     }
 
-    physicalDevice = physicalDevices[0];
+    // best first, the index counts the same devices as EnumerateDevices
+    physicalDevices = vkhelper::rankPhysicalDevices(physicalDevices);
+    if (physicalDevices.empty()) {
+        printf("no physical device can render\n");
+        exit(1);
+    }
+    if (deviceIndex >= physicalDevices.size()) {
+        printf("no physical device %u, using the best of %zu\n", deviceIndex, physicalDevices.size());
+        deviceIndex = 0;
+    }
+    physicalDevice = physicalDevices[deviceIndex];
+    printf("device %u: %s\n", deviceIndex, physicalDevice.getProperties().deviceName);
     vk::PhysicalDeviceFeatures deviceFeatures;
     deviceFeatures = physicalDevice.getFeatures();
 
@@ -230,21 +415,113 @@ void RendererVulkan::CreateDevice()
     // Find a queue that supports graphics operations
     graphicsQueueIndex = vkhelper::findQueue(physicalDevice, vk::QueueFlagBits::eGraphics);
     std::array<float, 1> queuePriorities = { 0.0f };
-    vk::DeviceQueueCreateInfo queueCreateInfo;
-    queueCreateInfo.queueFamilyIndex = graphicsQueueIndex;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = queuePriorities.data();
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos(1);
+    queueCreateInfos[0].queueFamilyIndex = graphicsQueueIndex;
+    queueCreateInfos[0].queueCount = 1;
+    queueCreateInfos[0].pQueuePriorities = queuePriorities.data();
+
+    // Prefer a transfer only (DMA) family for streaming uploads, otherwise share the graphics queue
+    bool dedicatedTransfer = vkhelper::findDedicatedQueue(physicalDevice, vk::QueueFlagBits::eTransfer,
+        vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute, &transferQueueIndex);
+    if (dedicatedTransfer) {
+        vk::DeviceQueueCreateInfo transferQueueCreateInfo;
+        transferQueueCreateInfo.queueFamilyIndex = transferQueueIndex;
+        transferQueueCreateInfo.queueCount = 1;
+        transferQueueCreateInfo.pQueuePriorities = queuePriorities.data();
+        queueCreateInfos.push_back(transferQueueCreateInfo);
+    } else {
+        transferQueueIndex = graphicsQueueIndex;
+    }
+
+    // A compute family without graphics runs the compute work beside the frames in flight, AMD's async compute queues
+    bool dedicatedCompute = useAsyncCompute && vkhelper::findDedicatedQueue(physicalDevice, vk::QueueFlagBits::eCompute,
+        vk::QueueFlagBits::eGraphics, &computeQueueIndex);
+    if (dedicatedCompute) {
+        vk::DeviceQueueCreateInfo computeQueueCreateInfo;
+        computeQueueCreateInfo.queueFamilyIndex = computeQueueIndex;
+        computeQueueCreateInfo.queueCount = 1;
+        computeQueueCreateInfo.pQueuePriorities = queuePriorities.data();
+        queueCreateInfos.push_back(computeQueueCreateInfo);
+    } else {
+        if (useAsyncCompute) {
+            printf("no compute only queue family, computing on the graphics queue\n");
+        }
+        computeQueueIndex = graphicsQueueIndex;
+    }
 
     vk::DeviceCreateInfo deviceCreateInfo;
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
     // enable the debug marker extension if it is present (likely meaning a debugging tool is present)
-    std::vector<const char*> enabledExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-    if (vkhelper::checkDeviceExtensionPresent(physicalDevice, VK_EXT_DEBUG_MARKER_EXTENSION_NAME)) {
+    std::vector<const char*> enabledExtensions;
+    if (!headless) {
+        enabledExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    const bool debugMarkers = vkhelper::checkDeviceExtensionPresent(physicalDevice, VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
+    if (debugMarkers) {
         enabledExtensions.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
     }
+    // heap budgets and usage of the whole process, paging starts beyond the budget
+    memoryBudget = instanceProperties2 && vkhelper::checkDeviceExtensionPresent(physicalDevice, "VK_EXT_memory_budget");
+    if (memoryBudget) {
+        enabledExtensions.push_back("VK_EXT_memory_budget");
+    }
+    // lets GPU culling compact its output and pass the draw count to the indirect draws
+    if (vkhelper::checkDeviceExtensionPresent(physicalDevice, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+        enabledExtensions.push_back(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+    // counts the submissions of each queue on one semaphore instead of a fence each
+    timelineSemaphores = instanceProperties2 && SubmitTimeline::IsSupported(instance, physicalDevice);
+    const void* featureChain = nullptr;
+    if (timelineSemaphores) {
+        enabledExtensions.push_back(SubmitTimeline::ExtensionName);
+        featureChain = SubmitTimeline::GetFeatureChain(featureChain);
+    }
+    // every view of SetViews in one render pass
+    multiview = viewCameras.size() > 1 && !headless && instanceProperties2 && Pipeline::SupportsMultiview(instance, physicalDevice);
+    if (multiview) {
+        enabledExtensions.push_back(Pipeline::MultiviewExtensionName);
+        featureChain = Pipeline::GetMultiviewFeatureChain(featureChain);
+    } else if (viewCameras.size() > 1) {
+        printf("no multiview, drawing the main camera only\n");
+    }
+    // ray queries against acceleration structures, which are read through buffer device addresses
+    rayTracing = useRayTracing && !headless && instanceProperties2 && AccelerationStructures::IsSupported(instance, physicalDevice);
+    if (rayTracing) {
+        for (const char* extension : AccelerationStructures::ExtensionNames) {
+            enabledExtensions.push_back(extension);
+        }
+        featureChain = AccelerationStructures::GetFeatureChain(featureChain);
+    } else if (useRayTracing) {
+        printf("no ray queries, drawing without acceleration structures\n");
+    }
+    // predicates the previous frame's occlusion queries wrote, read by the GPU
+    conditionalRendering = useOcclusionQueries && instanceProperties2 && OcclusionQueries::IsSupported(instance, physicalDevice);
+    if (conditionalRendering) {
+        enabledExtensions.push_back(OcclusionQueries::ExtensionName);
+        featureChain = OcclusionQueries::GetFeatureChain(featureChain);
+    } else if (useOcclusionQueries) {
+        printf("no conditional rendering, heavy instances are always drawn\n");
+    }
+    // the scene pipelines shade at the rates of an image filled before the render pass
+    shadingRateImage = useShadingRate && !headless && instanceProperties2 && ShadingRate::IsSupported(instance, physicalDevice);
+    if (shadingRateImage) {
+        enabledExtensions.push_back(ShadingRate::ExtensionName);
+        featureChain = ShadingRate::GetFeatureChain(featureChain);
+    } else if (useShadingRate) {
+        printf("no shading rate image, every pixel is shaded\n");
+    }
+    // the indirect draws pull from buffer device addresses, which ray tracing has enabled already
+    vertexPulling = useVertexPulling && useIndirect && (rayTracing || (instanceProperties2 && BufferAddress::IsSupported(instance, physicalDevice)));
+    if (vertexPulling && !rayTracing) {
+        enabledExtensions.push_back(BufferAddress::ExtensionName);
+        featureChain = BufferAddress::GetFeatureChain(featureChain);
+    } else if (useVertexPulling && !vertexPulling) {
+        printf("no buffer device addresses or indirect draws, binding vertex buffers\n");
+    }
+    deviceCreateInfo.pNext = featureChain;
     if (enabledExtensions.size() > 0) {
         deviceCreateInfo.enabledExtensionCount = (uint32_t)enabledExtensions.size();
         deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
@@ -252,128 +529,1670 @@ void RendererVulkan::CreateDevice()
 
     // Create Vulkan Device
     device = physicalDevice.createDevice(deviceCreateInfo);
+    // everything created from here on can be named, passes become regions in captures. The marker
+    // functions are process wide, with a renderer per GPU only the first device's are loaded
+    if (debugMarkers && deviceIndex == 0) {
+        vkx::debug::marker::setup(VkDevice(device));
+    }
 
     swapChain.connect(instance, physicalDevice, device);
 
     queue = device.getQueue(graphicsQueueIndex, 0);
-
-    // SubmitInfo
-    vk::SemaphoreCreateInfo semaphoreCreateInfo;
-    presentComplete = device.createSemaphore(semaphoreCreateInfo);
-    renderComplete = device.createSemaphore(semaphoreCreateInfo);
-
-    //submitInfo = vkTools::initializers::submitInfo();
-    submitInfo.pWaitDstStageMask = &submitPipelineStages;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &presentComplete;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderComplete;
+    transferQueue = device.getQueue(transferQueueIndex, 0);
+    vkx::debug::marker::setName(device, queue, "graphics queue");
+    if (transferQueue != queue) {
+        vkx::debug::marker::setName(device, transferQueue, "transfer queue");
+    }
+    computeQueue = device.getQueue(computeQueueIndex, 0);
+    if (computeQueue != queue) {
+        vkx::debug::marker::setName(device, computeQueue, "compute queue");
+    }
+    // one per queue object, a timeline is signaled by a single queue in submission order
+    graphicsTimeline = new SubmitTimeline(device, queue, timelineSemaphores);
+    transferTimeline = new SubmitTimeline(device, transferQueue, timelineSemaphores);
+    computeTimeline = new SubmitTimeline(device, computeQueue, timelineSemaphores);
 }
 
 /*************** Swapchain ****************/
 void RendererVulkan::CreateSwapChain()
 {
+#if defined(_WIN32)
     swapChain.initSurface(hinstance_, hwnd_);
+#elif defined(__ANDROID__)
+    // the window decides the size, create picks it up from the surface
+    width = static_cast<uint32_t>(ANativeWindow_getWidth(window));
+    height = static_cast<uint32_t>(ANativeWindow_getHeight(window));
+    swapChain.initSurface(window);
+#endif
+    if (usePostProcess) {
+        // the post stack writes the swapchain images, or blits into them
+        postDirectOutput = PostProcess::SupportsDirectOutput(physicalDevice, swapChain.getSurface(), swapChain.colorFormat);
+        swapChain.requestedUsage |= postDirectOutput ? vk::ImageUsageFlagBits::eStorage : vk::ImageUsageFlagBits::eTransferDst;
+    }
+    if (captureEncoder) {
+        // copied out of at the end of every frame
+        swapChain.requestedUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
     swapChain.create(&width, &height, false);
+    nameImages(device, swapChain.images, "swapchain image");
+    printf("swapchain: %zu images, %s\n", swapChain.images.size(), vk::to_string(swapChain.presentMode).c_str());
 }
 
-// Create the Vulkan synchronization primitives used in this example
-void RendererVulkan::CreateFences()
+void RendererVulkan::SetMemoryOverlay(const std::string& fontFace)
 {
-    // Fences (Used to check draw command buffer completion)
-    vk::FenceCreateInfo fenceCreateInfo = {};
-    // Create in signaled state so we don't wait on first render of each command buffer
-    fenceCreateInfo.flags = vk::FenceCreateFlagBits::eSignaled;
-    waitFences.resize(commandBuffer->GetDrawCommandBuffers().size());
-    for (auto& fence : waitFences) {
-        fence = device.createFence(fenceCreateInfo);
+    delete memoryOverlay;
+    memoryOverlay = fontFace.empty() ? nullptr : new MemoryOverlay(fontFace);
+}
+
+void RendererVulkan::SetMetrics(Metrics& registry)
+{
+    // milliseconds, around the frame rates a render server runs at
+    const std::vector<double> frameBounds = { 1.0, 2.0, 4.0, 8.0, 16.7, 33.3, 50.0, 100.0, 250.0 };
+    metrics.frames = &registry.AddCounter("m3d_frames_total", "Frames submitted");
+    metrics.renders = &registry.AddCounter("m3d_renders_total", "Offscreen renders read back");
+    metrics.uploadBytes = &registry.AddCounter("m3d_upload_bytes_total", "Bytes copied to the GPU by the upload queue");
+    metrics.cpuMs = &registry.AddHistogram("m3d_frame_cpu_ms", "CPU time of a frame in milliseconds, without waits", frameBounds);
+    metrics.gpuMs = &registry.AddHistogram("m3d_frame_gpu_ms", "GPU time of a frame in milliseconds, timed frames only", frameBounds);
+    metrics.draws = &registry.AddGauge("m3d_frame_draws", "Scene draws of the last frame");
+    metrics.queueDepth = &registry.AddGauge("m3d_offscreen_queue_depth", "Offscreen renders queued or in flight");
+    metrics.deviceMemoryUsage = &registry.AddGauge("m3d_device_memory_usage_bytes", "Device local memory in use by the process");
+    metrics.deviceMemoryBudget = &registry.AddGauge("m3d_device_memory_budget_bytes", "Device local memory the process may use");
+    if (memtag::IsEnabled()) {
+        // no labels in Metrics, a metric per tag
+        for (uint32_t i = 0; i < memtag::TagCount; ++i) {
+            const char* tag = memtag::GetTagName(static_cast<memtag::Tag>(i));
+            char name[64], help[96];
+            snprintf(name, sizeof(name), "m3d_ram_%s_live_bytes", tag);
+            snprintf(help, sizeof(help), "Heap bytes allocated under the %s memory tag and not freed", tag);
+            metrics.ramLive[i] = &registry.AddGauge(name, help);
+            snprintf(name, sizeof(name), "m3d_ram_%s_peak_bytes", tag);
+            snprintf(help, sizeof(help), "Most heap bytes the %s memory tag held at once", tag);
+            metrics.ramPeak[i] = &registry.AddGauge(name, help);
+            snprintf(name, sizeof(name), "m3d_ram_%s_allocations_total", tag);
+            snprintf(help, sizeof(help), "Heap allocations under the %s memory tag", tag);
+            metrics.ramAllocations[i] = &registry.AddCounter(name, help);
+        }
     }
 }
 
-void RendererVulkan::Init(Scene* scene)
+// Once per submitted frame, the frame's stats are complete
+void RendererVulkan::UpdateMetrics()
+{
+    if (!metrics.frames) {
+        return;
+    }
+    metrics.frames->Add();
+    metrics.uploadBytes->Add(frameStats.uploadBytes);
+    metrics.cpuMs->Observe(frameStats.cpuMs);
+    if (frameStats.gpuMs > 0.0) {
+        metrics.gpuMs->Observe(frameStats.gpuMs);
+    }
+    metrics.draws->Set(frameStats.draws);
+    metrics.queueDepth->Set(static_cast<double>(GetPendingOffscreen()));
+    // the driver's budget is a query, twice a second at 60 frames per second is plenty for a scraper
+    if (memoryAllocator && metrics.frames->Get() % 30 == 1) {
+        uint64_t usage = 0, budget = 0;
+        for (const MemoryAllocator::HeapBudget& heap : memoryAllocator->GetHeapBudgets()) {
+            if (heap.deviceLocal) {
+                usage += heap.usage;
+                budget += heap.budget;
+            }
+        }
+        metrics.deviceMemoryUsage->Set(static_cast<double>(usage));
+        metrics.deviceMemoryBudget->Set(static_cast<double>(budget));
+    }
+    for (uint32_t i = 0; i < memtag::TagCount && metrics.ramLive[i]; ++i) {
+        const memtag::Stats ram = memtag::GetStats(static_cast<memtag::Tag>(i));
+        metrics.ramLive[i]->Set(static_cast<double>(ram.liveBytes));
+        metrics.ramPeak[i]->Set(static_cast<double>(ram.peakBytes));
+        metrics.ramAllocations[i]->Add(ram.allocations - metrics.ramAllocationsAdded[i]);
+        metrics.ramAllocationsAdded[i] = ram.allocations;
+    }
+}
+
+void RendererVulkan::SetStatsOverlay(const std::string& fontFace, const std::string& barTexture)
+{
+    delete statsOverlay;
+    statsOverlay = fontFace.empty() ? nullptr : new StatsOverlay(fontFace, barTexture);
+}
+
+void RendererVulkan::SetPresentMode(vk::PresentModeKHR mode, uint32_t imageCount)
+{
+    swapChain.requestedPresentMode = mode;
+    if (!inited || headless) {
+        // the frame slots are sized after the image count at Init
+        swapChain.requestedImageCount = imageCount;
+        return;
+    }
+    // frames in flight keep presenting to the old swapchain, OnWindowSizeChanged retires it
+    resizePending = true;
+}
+
+#if defined(__ANDROID__)
+void RendererVulkan::SetWindow(ANativeWindow* nativeWindow)
+{
+    window = nativeWindow;
+    // a new window comes at its native size, the render scale is applied to it again
+    ANativeWindow_setBuffersGeometry(window, 0, 0, 0);
+    nativeWidth = ANativeWindow_getWidth(window);
+    nativeHeight = ANativeWindow_getHeight(window);
+    if (renderScale != 1.0f) {
+        ANativeWindow_setBuffersGeometry(window, static_cast<int32_t>(nativeWidth * renderScale), static_cast<int32_t>(nativeHeight * renderScale), 0);
+    }
+    if (!inited || !surfaceLost) {
+        return;
+    }
+    // back from the background: a new surface, the swapchain and everything sized after it follow at the next Draw
+    swapChain.initSurface(window);
+    surfaceLost = false;
+    resizePending = true;
+}
+
+void RendererVulkan::OnWindowTerm()
+{
+    if (!inited || surfaceLost) {
+        return;
+    }
+    // the window is gone once this returns, nothing may still present to it
+    device.waitIdle();
+    trash.Flush();
+    swapChain.destroySurface();
+    surfaceLost = true;
+}
+#endif
+
+// Create the per-frame synchronization primitives and transient command pools
+void RendererVulkan::CreateFrameContexts()
+{
+    vk::SemaphoreCreateInfo semaphoreCreateInfo;
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = graphicsQueueIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+    frames.resize(framesInFlight);
+    frameArena = new FrameArena(framesInFlight);
+    frameDescriptors = new DescriptorAllocator(device, framesInFlight);
+    for (uint32_t f = 0; f < framesInFlight; ++f) {
+        FrameContext& frame = frames[f];
+        frame.presentComplete = device.createSemaphore(semaphoreCreateInfo);
+        frame.renderComplete = device.createSemaphore(semaphoreCreateInfo);
+        if (computeQueueIndex != graphicsQueueIndex && !graphicsTimeline->HasTimelineSemaphore()) {
+            frame.computeComplete = device.createSemaphore(semaphoreCreateInfo);
+        }
+        frame.commandPool = device.createCommandPool(cmdPoolInfo);
+
+        vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+        cmdBufAllocateInfo.commandPool = frame.commandPool;
+        cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+        cmdBufAllocateInfo.commandBufferCount = 1;
+        frame.drawCommandBuffer = device.allocateCommandBuffers(cmdBufAllocateInfo)[0];
+        char name[32];
+        snprintf(name, sizeof(name), "frame %u", f);
+        vkx::debug::marker::setName(device, frame.drawCommandBuffer, name);
+        // complete from the start, nothing waits on the first use of each frame
+        frame.serial = 0;
+        frame.timed = false;
+        frame.firstSlot = 0;
+        frame.slotCount = 0;
+    }
+    frameIndex = 0;
+
+    imagesInFlight.assign(swapChain.images.size(), 0);
+
+    // dynamic resolution follows the GPU time of the frames
+    if (useGpuTimer || dynamicResolution) {
+        CreateGpuTimer();
+    }
+}
+
+// Two timestamp queries per frame in flight, written by command buffers submitted around the frame's own
+void RendererVulkan::CreateGpuTimer()
 {
+    const uint32_t validBits = physicalDevice.getQueueFamilyProperties()[graphicsQueueIndex].timestampValidBits;
+    if (validBits == 0) {
+        printf("The graphics queue has no timestamps, GPU time is not measured\n");
+        return;
+    }
+    timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    vk::QueryPoolCreateInfo queryPoolInfo;
+    queryPoolInfo.queryType = vk::QueryType::eTimestamp;
+    queryPoolInfo.queryCount = 2 * framesInFlight;
+    timerQueries = device.createQueryPool(queryPoolInfo);
+
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = graphicsQueueIndex;
+    timerPool = device.createCommandPool(cmdPoolInfo);
+
+    vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+    cmdBufAllocateInfo.commandPool = timerPool;
+    cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+    cmdBufAllocateInfo.commandBufferCount = 2 * framesInFlight;
+    std::vector<vk::CommandBuffer> timerBuffers = device.allocateCommandBuffers(cmdBufAllocateInfo);
+
+    vk::CommandBufferBeginInfo beginInfo;
+    for (uint32_t f = 0; f < framesInFlight; ++f) {
+        FrameContext& frame = frames[f];
+        frame.timerBegin = timerBuffers[2 * f];
+        frame.timerEnd = timerBuffers[2 * f + 1];
+
+        frame.timerBegin.begin(beginInfo);
+        frame.timerBegin.resetQueryPool(timerQueries, 2 * f, 2);
+        frame.timerBegin.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timerQueries, 2 * f);
+        frame.timerBegin.end();
+
+        frame.timerEnd.begin(beginInfo);
+        frame.timerEnd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timerQueries, 2 * f + 1);
+        frame.timerEnd.end();
+    }
+}
+
+// The frame's serial completed, its timestamps are available
+void RendererVulkan::ReadGpuTimer(uint32_t frame)
+{
+    uint64_t timestamps[2];
+    vk::Result result = device.getQueryPoolResults(timerQueries, 2 * frame, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (result == vk::Result::eSuccess) {
+        frameStats.gpuMs = ((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0;
+    }
+}
+
+void RendererVulkan::InitDevice()
+{
+    M3D_TRACE_ZONE("RendererVulkan::InitDevice");
+    // the thread that brings the device up draws, on a big core where there are little ones
+    cpu::PinCurrentThread(cpu::CoreClass::Big);
 	CreateInstance();
 	CreateDevice();
+    // a headless renderer of a multi socket server draws and keeps its arenas next to its GPU, jobs of a
+    // JobSystem created for GetNumaNode run there too
+    numaNode = deviceNumaNode(instance, physicalDevice);
+    if (headless && numaBinding && numaNode >= 0 && cpu::BindCurrentThread(numaNode)) {
+        printf("drawing on NUMA node %d, the node of the device\n", numaNode);
+    }
 
-    CreateSwapChain();
+    memoryAllocator = new MemoryAllocator(device, physicalDevice);
+    if (memoryBudget) {
+        memoryAllocator->EnableMemoryBudget(instance);
+    }
+    if (rayTracing || vertexPulling) {
+        memoryAllocator->EnableDeviceAddress();
+    }
+    if (headless) {
+        // one batch of images per frame in flight, filled in as the swapchain's
+        offscreen = new OffscreenTargets(device, physicalDevice, *memoryAllocator, graphicsQueueIndex);
+        offscreen->Create(swapChain, width, height, framesInFlight * headlessBatch);
+        // every render of a batch has a camera of its own, nothing per frame may assume one view
+        if (recordThreads > 0 || useGpuCulling || useGpuSkinning || useCrowds || useParticles || useGui || useClusteredLighting || usePostProcess) {
+            printf("headless rendering draws from static command buffers, without GPU culling, skinning, crowds, particles, clustered lighting, "
+                "GUI and post processing\n");
+        }
+        recordThreads = 0;
+        useGpuCulling = false;
+        useClusteredLighting = false;
+        useGpuSkinning = false;
+        useCrowds = false;
+        useParticles = false;
+        useGui = false;
+        usePostProcess = false;
+        dynamicResolution = nullptr;
+    } else {
+        // the views or the scaled scene are blitted into the swapchain image
+        if (multiview || dynamicResolution) {
+            swapChain.requestedUsage = vk::ImageUsageFlagBits::eTransferDst;
+        }
+        // the views tile the swapchain image, the post stack covers all of it
+        if (usePostProcess && (multiview || !PostProcess::IsSupported(physicalDevice))) {
+            printf("post processing needs one view and shaderStorageImageWriteWithoutFormat, presenting the scene as rendered\n");
+            usePostProcess = false;
+        }
+        CreateSwapChain();
+    }
+    commandBuffer = new CommandBuffer(device, physicalDevice, queue, swapChain, *memoryAllocator);
+    uploadQueue = new UploadQueue(device, physicalDevice, *transferTimeline, transferQueueIndex, graphicsQueueIndex);
+    geometry = new GeometryArena(device, physicalDevice, *commandBuffer, uploadQueue);
+    if (vertexPulling) {
+        geometry->EnableDeviceAddress();
+    }
+    if (useGpuGeometryDecode && (useRayTracing || useSoftwareOcclusion)) {
+        printf("ray tracing and software occlusion read the vertices on the CPU, decoding geometry there\n");
+        useGpuGeometryDecode = false;
+    }
+    if (useGpuGeometryDecode) {
+        meshDecoder = new GpuMeshDecoder(device, physicalDevice, *graphicsTimeline, graphicsQueueIndex);
+        geometry->SetDecoder(meshDecoder);
+    }
+    samplerCache = new SamplerCache(device);
+    textureStreamer = new TextureStreamer(device, physicalDevice, *uploadQueue, trash, *memoryAllocator, *samplerCache);
+    // very large textures commit memory per tile when the graphics queue can bind sparse memory
+    if (physicalDevice.getQueueFamilyProperties()[graphicsQueueIndex].queueFlags & vk::QueueFlagBits::eSparseBinding) {
+        textureStreamer->EnableSparse(queue);
+    }
+    // a cache per device, renderers of other devices write theirs at the same time
+    const std::string cachePath = deviceIndex == 0 ? std::string("pipeline_cache.bin") : "pipeline_cache_" + std::to_string(deviceIndex) + ".bin";
+    pipelineRegistry = new PipelineRegistry(device, physicalDevice, cachePath);
+    deviceReady = true;
+}
 
-    commandBuffer = new CommandBuffer(device, physicalDevice, queue, swapChain);
-    commandBuffer->CreateVertices(scene->meshes[0].vertices, scene->meshes[0].indices);
+void RendererVulkan::Init(Scene* scene)
+{
+    M3D_MEMORY_TAG(Render);
+    // StartRenderer brings the device up while the scene loads
+    if (!deviceReady) {
+        InitDevice();
+    }
+    this->scene = scene;
+
+    // before the upload, which may release the CPU geometry the capture cooks
+    if (!commandCapturePath.empty()) {
+        commandCapture = new CommandCapture(commandCapturePath);
+        if (!commandCapture->Begin(*scene, width, height, headless ? headlessBatch : 0)) {
+            delete commandCapture;
+            commandCapture = nullptr;
+        }
+    }
+    LoadTextures();
+    // meshes stream in while frames keep presenting, re-record once they are resident
+    geometry->Upload(*scene, [this]() { MeshesResident(); });
+
+    // a uniform slot per frame in flight when recording per frame, per swapchain image for the static buffers
+    const uint32_t frameSlots = std::max<uint32_t>(framesInFlight, static_cast<uint32_t>(swapChain.images.size()));
+    Pipeline::Options passOptions;
+    if (multiview) {
+        viewCameras.resize(std::min<size_t>(viewCameras.size(), Pipeline::MaxViews));
+        passOptions.viewCount = static_cast<uint32_t>(viewCameras.size());
+        // the frustum, the depth pyramid and the light clusters are those of one camera
+        if (useGpuCulling || useClusteredLighting) {
+            printf("multiview draws without GPU culling and clustered lighting\n");
+        }
+        useGpuCulling = false;
+        useClusteredLighting = false;
+    }
+    passOptions.depthPrepass = useDepthPrepass;
+    passOptions.samples = msaaSamples;
+    passOptions.bindless = useBindless;
+    passOptions.clusteredLighting = useIndirect && useClusteredLighting;
+    // only the indirect shaders write IDs, a batch of offscreen images shares one ID buffer
+    passOptions.idBuffer = useIdBuffer && useIndirect && !headless;
+    if (useIdBuffer && !passOptions.idBuffer) {
+        printf("the ID buffer needs indirect draws and a window, picks read nothing\n");
+    }
+    // only the indirect draws batch the transparent slices apart
+    passOptions.weightedBlended = useTransparency && useIndirect;
+    if (useTransparency && !useIndirect) {
+        printf("weighted blended transparency needs indirect draws, transparent materials draw opaque\n");
+    }
+    // only the indirect draws fill the G-buffer
+    passOptions.deferred = useDeferred && passOptions.clusteredLighting;
+    if (useDeferred && !passOptions.deferred) {
+        printf("deferred shading needs indirect draws and clustered lighting, shading forward\n");
+    }
+    if (msaaSamples != vk::SampleCountFlagBits::e1 && useOcclusionCulling) {
+        // the depth pyramid is built from single sampled depth
+        printf("occlusion culling does not support MSAA, culling against the frustum only\n");
+        useOcclusionCulling = false;
+    }
+    if (dynamicResolution && useOcclusionCulling) {
+        // the depth pyramid covers the whole target, the scene only part of it
+        printf("occlusion culling does not support dynamic resolution, culling against the frustum only\n");
+        useOcclusionCulling = false;
+    }
+    // only occlusion culling reads the depth after the frame, tiled GPUs never write it out otherwise
+    passOptions.storeDepth = useIndirect && useGpuCulling && useOcclusionCulling;
+    if (headless || dynamicResolution) {
+        passOptions.finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+    }
+    if (usePostProcess) {
+        // HDR, sampled by the post stack, which also scales a dynamic resolution
+        passOptions.colorFormat = PostProcess::GetSceneFormat(physicalDevice);
+        passOptions.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    }
+    passOptions.shadingRateImage = shadingRateImage;
+    passOptions.vertexPulling = vertexPulling;
+    pipeLine = new Pipeline(device, physicalDevice, *pipelineRegistry, frameSlots, passOptions);
+
+    if (useIndirect) {
+        // the GPU walks the instances, nothing left to record per frame
+        recordThreads = 0;
+        indirectDraws = new IndirectDraws(device, physicalDevice, *uploadQueue, IndirectDraws::DefaultMaxDraws, pipeLine->IsVertexPulling());
+        if (pipeLine->IsVertexPulling()) {
+            indirectDraws->SetVertexPulling(pipeLine);
+        }
+        indirectDraws->SetInstancing(useInstancing);
+        indirectDraws->SetTransparency(pipeLine->HasWeightedBlended());
+        if (useMeshletCulling && useGpuCulling && indirectDraws->SupportsCulling()) {
+            indirectDraws->SetMeshlets(true, useMeshletConeCulling);
+        }
+        pipeLine->SetInstanceTransforms(indirectDraws->GetTransformDescriptor());
+        pipeLine->SetDrawInfos(indirectDraws->GetDrawInfoDescriptor());
+        indirectDraws->Update(*scene);
+        SubmitInstanceData();
+
+        if (pipeLine->IsBindless()) {
+            // materials and textures of every draw in the one descriptor set
+            materialTable = new MaterialTable(device, physicalDevice, *uploadQueue, *samplerCache, *pipeLine);
+            materialTable->Update(*scene);
+            textureStreamer->SetChangedCallback([this](uint32_t textureID, const vkext::VulkanTexture& texture) {
+                materialTable->SetTexture(textureID, texture);
+            });
+        } else if (pipeLine->UsesTextureArrays()) {
+            // the same materials, their textures packed into a few arrays as they finish loading
+            textureArrays = new TextureArrays(device, physicalDevice, *uploadQueue, *memoryAllocator, *samplerCache, *textureStreamer);
+            materialTable = new MaterialTable(device, physicalDevice, *uploadQueue, *samplerCache, *pipeLine, textureArrays);
+            materialTable->Update(*scene);
+            textureStreamer->SetChangedCallback([this](uint32_t textureID, const vkext::VulkanTexture& texture) {
+                materialTable->SetTexture(textureID, texture);
+            });
+        }
+        if (useImpostors && pipeLine->IsBindless() && pipeLine->GetViewCount() == 1 && !headless) {
+            impostors = new ImpostorRenderer(device, physicalDevice, *commandBuffer, *pipelineRegistry, *pipeLine, *graphicsTimeline, graphicsQueueIndex,
+                frameSlots, MaxImpostorMeshes, MaxImpostorInstances, MinImpostorTriangles);
+            indirectDraws->SetImpostors(impostors, impostorDistance);
+            commandBuffer->SetImpostors(impostors);
+        } else if (useImpostors) {
+            // the bake shades with the bindless materials, the quads face the one eye
+            printf("impostors need bindless materials and one view, distant instances keep their LODs\n");
+        }
+
+        if (useGpuCulling) {
+            if (indirectDraws->SupportsCulling()) {
+                gpuCulling = new GpuCulling(device, physicalDevice, *indirectDraws, useOcclusionCulling);
+                indirectDraws->SetCulling(gpuCulling);
+                UpdateCulling();
+            } else {
+                printf("GPU culling needs drawIndirectFirstInstance and no instancing, drawing unculled\n");
+            }
+        }
+
+        if (pipeLine->IsClusteredLighting()) {
+            clusteredLights = new ClusteredLights(device, physicalDevice);
+            pipeLine->SetClusteredLights(clusteredLights->GetParamsDescriptor(), clusteredLights->GetLightDescriptor(),
+                clusteredLights->GetClusterDescriptor());
+            commandBuffer->SetClusteredLights(clusteredLights);
+            UpdateLights();
+            // the lit shader samples the cascades either way
+            shadowCascades = new ShadowCascades(device, physicalDevice, *pipelineRegistry, *graphicsTimeline, graphicsQueueIndex,
+                useShadows ? ShadowCascades::Resolution : 1);
+            pipeLine->SetShadowMap(shadowCascades->GetDescriptor());
+            shadowAtlas = new ShadowAtlas(device, physicalDevice, *pipelineRegistry, *graphicsTimeline, graphicsQueueIndex,
+                useShadows ? ShadowAtlas::Resolution : 1);
+            pipeLine->SetShadowAtlas(shadowAtlas->GetTableDescriptor(), shadowAtlas->GetDescriptor());
+        } else if (useClusteredLighting) {
+            printf("clustered lighting needs bindless materials, indirect draws stay unlit\n");
+        }
+    }
+    if (useShadows && !shadowCascades) {
+        printf("shadows need clustered lighting, drawing unshadowed\n");
+    }
+    if (useSoftwareOcclusion && recordThreads > 0) {
+        softwareOcclusion = new SoftwareOcclusion();
+        commandBuffer->SetSoftwareOcclusion(softwareOcclusion);
+    } else if (useSoftwareOcclusion) {
+        // static and indirect draws are not recorded per frame, GPU culling covers the indirect ones
+        printf("software occlusion culls per-frame recordings, drawing unculled\n");
+    }
+    if (conditionalRendering && recordThreads > 0 && pipeLine->GetViewCount() == 1) {
+        occlusionQueries = new OcclusionQueries(device, physicalDevice, *commandBuffer, *pipelineRegistry, *pipeLine, frameSlots, MaxOcclusionQueries,
+            occlusionMinTriangles);
+        commandBuffer->SetOcclusionQueries(occlusionQueries);
+    } else if (conditionalRendering) {
+        // indirect draws are predicated as a whole, not per instance
+        printf("occlusion queries need per-frame recordings of one view, heavy instances are always drawn\n");
+    }
 
-    pipeLine = new Pipeline(device, physicalDevice);
+    if (useGpuSkinning) {
+        gpuSkinning = new GpuSkinning(device, physicalDevice, *commandBuffer, frameSlots, MaxBindPoseVertices, MaxSkinnedVertices, MaxSkinnedJoints, MaxSkinnedInstances,
+            MaxMorphEntries, MaxMorphWeights, graphicsQueueIndex, computeQueueIndex);
+        commandBuffer->SetSkinning(gpuSkinning);
+    }
+    if (useCrowds) {
+        crowds = new CrowdRenderer(device, physicalDevice, *commandBuffer, *pipelineRegistry, *pipeLine, frameSlots, MaxCrowdVertices, MaxCrowdMatrices,
+            MaxCrowdClips, MaxCrowdMeshes, MaxCrowdAgents);
+        commandBuffer->SetCrowd(crowds);
+        crowdStart = std::chrono::high_resolution_clock::now();
+    }
+    if (useParticles && pipeLine->GetViewCount() == 1) {
+        particles = new ParticleSystem(device, physicalDevice, *commandBuffer, *pipelineRegistry, *pipeLine, frameSlots, MaxParticles, MaxSortedParticles,
+            MaxParticleEmitters);
+        commandBuffer->SetParticles(particles);
+        particleTime = std::chrono::high_resolution_clock::now();
+    } else if (useParticles) {
+        // the quads face the one camera
+        printf("particles need one view, drawing none\n");
+    }
+    if (rayTracing) {
+        accelerationStructures = new AccelerationStructures(device, physicalDevice, *commandBuffer, frameSlots, MaxTracedInstances,
+            graphicsQueueIndex, computeQueueIndex);
+    }
+    if (pipeLine->HasIdBuffer()) {
+        if (!pipeLine->IsBindless()) {
+            printf("the untextured indirect shader writes no IDs, picks read nothing\n");
+        }
+        idPicker = new IdPicker(device, *memoryAllocator, graphicsQueueIndex, framesInFlight);
+    }
+    if (captureEncoder) {
+        frameCapture = new FrameCapture(device, *memoryAllocator, graphicsQueueIndex, framesInFlight, swapChain.extent, swapChain.colorFormat,
+            captureMatrix, captureEncoder);
+    }
+    if (useGui) {
+        gui = new GuiRenderer(device, physicalDevice, *commandBuffer, *uploadQueue, *pipelineRegistry, pipeLine->GetRenderPass(), pipeLine->GetOverlaySubpass(),
+            pipeLine->GetSamples(), pipeLine->GetColorAttachmentCount(), frameSlots, MaxGuiQuads);
+        commandBuffer->SetGui(gui);
+    }
 
-    commandBuffer->Build(*pipeLine);
+    if (useGpuTimer) {
+        // the passes write the timestamps of the slot of their uniform block, and count their shader invocations
+        profiler = new GpuProfiler(device, physicalDevice, graphicsQueueIndex, frameSlots, !multiview);
+        commandBuffer->SetProfiler(profiler);
+        cpuScopes.wait = profiler->GetScope("wait");
+        cpuScopes.streaming = profiler->GetScope("streaming");
+        cpuScopes.uploads = profiler->GetScope("uploads");
+        cpuScopes.lods = profiler->GetScope("lods");
+        cpuScopes.record = profiler->GetScope("record");
+        cpuScopes.submit = profiler->GetScope("submit");
+    }
+    if (dynamicResolution) {
+        commandBuffer->EnableDynamicResolution();
+        commandBuffer->SetRenderScale(dynamicResolution->GetScale());
+    }
+    if (usePostProcess) {
+        postProcess = new PostProcess(device, physicalDevice, *commandBuffer, frameSlots, postDirectOutput);
+        commandBuffer->SetPostProcess(postProcess);
+    }
+    if (shadingRateImage) {
+        shadingRate = new ShadingRate(instance, device, physicalDevice, *commandBuffer, frameSlots);
+        commandBuffer->SetShadingRate(shadingRate);
+    }
+    commandBuffer->Build(*pipeLine, *scene, *geometry, indirectDraws);
+    if (useShaderHotReload) {
+        shaderWatcher = new ShaderWatcher(*pipelineRegistry);
+    }
 
-    CreateFences();
-    //OnWindowSizeChanged();
+    CreateFrameContexts();
+    if (recordThreads > 0) {
+        commandBuffer->EnableParallelRecording(framesInFlight, recordThreads);
+    }
+    inited = true;
 }
 
 void RendererVulkan::OnWindowSizeChanged()
 {
-    if (inited) {
+    if (!inited) {
         return;
     }
 
-    // Recreate swapChain
-    CreateSwapChain();
+    // The old swapchain goes in as oldSwapchain, it and everything sized after it
+    // is destroyed once the frames still in flight have completed
+    vk::Device dev = device;
+    bool created = swapChain.create(&width, &height, false, [this, dev](vk::SwapchainKHR oldSwapchain, const std::vector<SwapChainBuffer>& oldBuffers) {
+        std::vector<SwapChainBuffer> buffers(oldBuffers);
+        trash.Trash([dev, oldSwapchain, buffers]() {
+            for (auto& buffer : buffers) {
+                dev.destroyImageView(buffer.view);
+            }
+            dev.destroySwapchainKHR(oldSwapchain);
+        });
+    });
+    if (!created) {
+        // no area to render to, try again with the next size change
+        return;
+    }
+    nameImages(device, swapChain.images, "swapchain image");
 
-    // Recreate Command Buffer
-    delete commandBuffer;
-    commandBuffer = new CommandBuffer(device, physicalDevice, queue, swapChain);
-    commandBuffer->Build(*pipeLine);
+    commandBuffer->Resize(*pipeLine, *scene, *geometry, indirectDraws, trash);
+    imagesInFlight.assign(swapChain.images.size(), 0);
+}
 
-    queue.waitIdle();
-    device.waitIdle();
+bool RendererVulkan::PrepareFrame()
+{
+    FrameContext& frame = frames[frameIndex];
+    auto tWait = std::chrono::high_resolution_clock::now();
+
+    // The CPU may run up to framesInFlight frames ahead, only block on the oldest one
+    graphicsTimeline->Wait(frame.serial);
+    // fewer queued frames: the frame maxQueuedFrames before this one must be done as well
+    if (maxQueuedFrames > 0 && maxQueuedFrames < framesInFlight) {
+        graphicsTimeline->Wait(frames[(frameIndex + framesInFlight - maxQueuedFrames) % framesInFlight].serial);
+    }
+    trash.Collect(graphicsTimeline->GetCompleted());
+    frameDescriptors->BeginFrame(frameIndex);
+    if (frame.timed) {
+        ReadGpuTimer(frameIndex);
+        frame.timed = false;
+        // per-frame recordings render at the new scale right away, static ones as their images come around
+        if (dynamicResolution && dynamicResolution->AddFrame(frameStats.gpuMs)) {
+            commandBuffer->SetRenderScale(dynamicResolution->GetScale());
+        }
+    }
+    ResolveProfiler(frameIndex);
+    if (idPicker) {
+        idPicker->Resolve(frameIndex);
+    }
+    if (frameCapture) {
+        frameCapture->Resolve(frameIndex);
+    }
 
-    inited = true;
+    auto tAcquire = std::chrono::high_resolution_clock::now();
+    vk::Result result = swapChain.acquireNextImage(frame.presentComplete, &currentImage);
+    acquireTime = std::chrono::high_resolution_clock::now();
+    frameStats.acquireWaitMs = std::chrono::duration<double, std::milli>(acquireTime - tAcquire).count();
+    if (result == vk::Result::eErrorOutOfDateKHR) {
+        // nothing was submitted, the frame's serial stays complete for the retry
+        resizePending = true;
+        return false;
+    }
+
+    // With more swapchain images than frames in flight an image can still be in use by an older frame
+    graphicsTimeline->Wait(imagesInFlight[currentImage]);
+    frameWaitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+
+    device.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags());
+    return true;
+}
+
+// The frame's serial completed, its pass timings are available
+void RendererVulkan::ResolveProfiler(uint32_t f)
+{
+    FrameContext& frame = frames[f];
+    if (!profiler) {
+        return;
+    }
+    for (uint32_t slot = frame.firstSlot; slot < frame.firstSlot + frame.slotCount; ++slot) {
+        profiler->Resolve(slot);
+    }
+    frame.slotCount = 0;
+}
+
+// Headless: no image to acquire, the frame renders into its own batch of offscreen images
+bool RendererVulkan::PrepareOffscreenFrame()
+{
+    if (offscreenRequests.empty()) {
+        // idle, hand out whatever completed in the meantime without blocking
+        for (uint32_t f = 0; f < framesInFlight; ++f) {
+            if (!frames[f].rendered.empty() && graphicsTimeline->IsComplete(frames[f].serial)) {
+                DeliverReadbacks(f);
+            }
+        }
+        return false;
+    }
+
+    FrameContext& frame = frames[frameIndex];
+    auto tWait = std::chrono::high_resolution_clock::now();
+    graphicsTimeline->Wait(frame.serial);
+    frameWaitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+    trash.Collect(graphicsTimeline->GetCompleted());
+    frameDescriptors->BeginFrame(frameIndex);
+    if (frame.timed) {
+        ReadGpuTimer(frameIndex);
+        frame.timed = false;
+    }
+    ResolveProfiler(frameIndex);
+    // the images of the batch are rendered again
+    DeliverReadbacks(frameIndex);
+
+    device.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags());
+    return true;
+}
+
+// The frame's serial completed, its renders are in the readback buffers
+void RendererVulkan::DeliverReadbacks(uint32_t f)
+{
+    FrameContext& frame = frames[f];
+    const vk::Extent2D extent = offscreen->GetExtent();
+    for (uint32_t i = 0; i < frame.rendered.size(); ++i) {
+        if (readbackCallback) {
+            readbackCallback(frame.rendered[i], offscreen->GetPixels(f * headlessBatch + i), extent.width, extent.height, offscreen->GetRowPitch());
+        }
+    }
+    if (metrics.renders) {
+        metrics.renders->Add(frame.rendered.size());
+    }
+    if (frameCapture) {
+        frameCapture->Resolve(f);
+    }
+    frame.rendered.clear();
+}
+
+// Up to headlessBatch renders in one submission, each the static draw buffer of its image and the image's readback
+void RendererVulkan::SubmitOffscreenFrame()
+{
+    FrameContext& frame = frames[frameIndex];
+    const uint32_t firstImage = frameIndex * headlessBatch;
+
+    std::vector<vk::CommandBuffer> submitBuffers;
+    if (timerQueries) {
+        submitBuffers.push_back(frame.timerBegin);
+    }
+    for (uint32_t i = 0; i < headlessBatch && !offscreenRequests.empty(); ++i) {
+        const OffscreenRequest& request = offscreenRequests.front();
+        // the image's command buffer reads the camera of its own slot
+        pipeLine->SetCamera(request.view, request.projection);
+        pipeLine->BeginFrame(firstImage + i);
+        submitBuffers.push_back(commandBuffer->GetDrawCommandBuffers()[firstImage + i]);
+        submitBuffers.push_back(offscreen->GetReadbackCommandBuffer(firstImage + i));
+        frame.rendered.push_back(request.id);
+        offscreenRequests.pop_front();
+    }
+    frame.firstSlot = firstImage;
+    frame.slotCount = static_cast<uint32_t>(frame.rendered.size());
+    // the batch's images in the layout their readbacks left them in
+    if (frameCapture && frameCapture->Record(frameIndex, &swapChain.images[firstImage], frame.slotCount, swapChain.extent, vk::ImageLayout::eTransferSrcOptimal)) {
+        submitBuffers.push_back(frameCapture->GetCommandBuffer(frameIndex));
+    }
+    if (timerQueries) {
+        submitBuffers.push_back(frame.timerEnd);
+        frame.timed = true;
+    }
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = static_cast<uint32_t>(submitBuffers.size());
+    submitInfo.pCommandBuffers = submitBuffers.data();
+    // the frame's uploads in one submission, the deferred graphics work goes with the frame's
+    transferTimeline->Flush();
+    frame.serial = graphicsTimeline->Submit(submitInfo);
+    const uint32_t images = static_cast<uint32_t>(frame.rendered.size());
+    frameStats.draws = commandBuffer->GetDrawCount() * images;
+    frameStats.triangles = commandBuffer->GetTriangleCount() * images;
+    frameStats.pipelineBinds = commandBuffer->GetPipelineBindCount() * images;
+    trash.Submitted(frame.serial);
+
+    frameIndex = (frameIndex + 1) % framesInFlight;
+}
+
+void RendererVulkan::RenderOffscreen(uint64_t id, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection)
+{
+    OffscreenRequest request;
+    request.id = id;
+    request.view = view;
+    request.projection = projection;
+    offscreenRequests.push_back(request);
+    if (commandCapture) {
+        commandCapture->RenderOffscreen(id, view, projection);
+    }
 }
 
-void RendererVulkan::PrepareFrame()
+size_t RendererVulkan::GetPendingOffscreen() const
 {
-    swapChain.acquireNextImage(presentComplete, &currentImage);
+    size_t pending = offscreenRequests.size();
+    for (const auto& frame : frames) {
+        pending += frame.rendered.size();
+    }
+    return pending;
+}
+
+void RendererVulkan::FinishOffscreen()
+{
+    while (!offscreenRequests.empty()) {
+        Draw();
+    }
+    // oldest first, the callback sees the renders in the order they were queued
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        const uint32_t f = (frameIndex + i) % framesInFlight;
+        graphicsTimeline->Wait(frames[f].serial);
+        DeliverReadbacks(f);
+    }
 }
 
 void RendererVulkan::SubmitFrame()
 {
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &(commandBuffer->GetDrawCommandBuffers()[currentImage]);
-	queue.submit(submitInfo, waitFences[currentImage]);
+    FrameContext& frame = frames[frameIndex];
 
-    swapChain.queuePresent(queue, currentImage, renderComplete);
-    //queue.waitIdle();
+    vk::SubmitInfo submitInfo;
+    submitInfo.pWaitDstStageMask = &submitPipelineStages;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &frame.presentComplete;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &frame.renderComplete;
+    UpdateShadows();
+    // the slot's last reader completed in PrepareFrame, the frame's serial or the image's
+    pipeLine->BeginFrame(recordThreads > 0 ? frameIndex : currentImage);
+    if (gpuSkinning) {
+        gpuSkinning->BeginFrame(recordThreads > 0 ? frameIndex : currentImage);
+        if (skinningCallback) {
+            skinningCallback(*gpuSkinning);
+        }
+    }
+    if (crowds) {
+        const float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - crowdStart).count();
+        crowds->BeginFrame(recordThreads > 0 ? frameIndex : currentImage, time);
+    }
+    if (impostors) {
+        float eye[3];
+        GetViewerPosition(eye);
+        impostors->BeginFrame(recordThreads > 0 ? frameIndex : currentImage, *scene, *indirectDraws, eye);
+    }
+    if (particles) {
+        const std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
+        // a long stall does not fire a burst of spawns
+        const float deltaTime = std::min(std::chrono::duration<float>(now - particleTime).count(), 0.1f);
+        particleTime = now;
+        float eye[3];
+        GetViewerPosition(eye);
+        particles->BeginFrame(recordThreads > 0 ? frameIndex : currentImage, deltaTime, eye);
+    }
+    if (postProcess) {
+        postProcess->BeginFrame(recordThreads > 0 ? frameIndex : currentImage);
+    }
+    if (shadingRate) {
+        shadingRate->BeginFrame(recordThreads > 0 ? frameIndex : currentImage);
+    }
+    if (gui) {
+        M3D_MEMORY_TAG(Gui);
+        gui->BeginFrame(recordThreads > 0 ? frameIndex : currentImage);
+        if (guiCallback) {
+            guiCallback(*gui);
+        }
+        GUISystem::ElementProportions screen;
+        screen.topLeft = m3d::math::Vector2(0.0f, 0.0f);
+        screen.depth = 0.0f;
+        screen.botRight = m3d::math::Vector2(static_cast<float>(width), static_cast<float>(height));
+        screen.width = static_cast<float>(width);
+        screen.height = static_cast<float>(height);
+        if (memoryOverlay) {
+            memoryOverlay->Refresh(*memoryAllocator);
+            memoryOverlay->Add(*gui, screen);
+        }
+        if (statsOverlay) {
+            // the numbers of the previous frame, this one's are counted as it goes
+            statsOverlay->Refresh(*this);
+            statsOverlay->Add(*gui, screen);
+        }
+        gui->EndFrame();
+    }
+    // the timestamps around the draws, the picks copied out of their ID buffer and the captured image
+    vk::CommandBuffer submitBuffers[5];
+    uint32_t submitBufferCount = 0;
+    if (timerQueries) {
+        submitBuffers[submitBufferCount++] = frame.timerBegin;
+    }
+    if (recordThreads > 0) {
+        GpuProfiler::CpuScope recordScope(profiler, cpuScopes.record);
+        commandBuffer->RecordFrame(frameIndex, currentImage, frame.drawCommandBuffer, *pipeLine, *scene, *geometry, *frameArena);
+        submitBuffers[submitBufferCount++] = frame.drawCommandBuffer;
+    } else {
+        // the image's last submission completed in PrepareFrame
+        if (dynamicResolution) {
+            commandBuffer->RecordStale(currentImage, *pipeLine, *scene, *geometry, indirectDraws);
+        }
+        submitBuffers[submitBufferCount++] = commandBuffer->GetDrawCommandBuffers()[currentImage];
+    }
+    if (idPicker && idPicker->Record(frameIndex, commandBuffer->GetIdImage(), commandBuffer->GetRenderExtent())) {
+        submitBuffers[submitBufferCount++] = idPicker->GetCommandBuffer(frameIndex);
+    }
+    if (frameCapture && frameCapture->Record(frameIndex, &swapChain.images[currentImage], 1, swapChain.extent, vk::ImageLayout::ePresentSrcKHR)) {
+        submitBuffers[submitBufferCount++] = frameCapture->GetCommandBuffer(frameIndex);
+    }
+    if (timerQueries) {
+        submitBuffers[submitBufferCount++] = frame.timerEnd;
+        frame.timed = true;
+    }
+    frame.firstSlot = recordThreads > 0 ? frameIndex : currentImage;
+    frame.slotCount = 1;
+    GpuProfiler::CpuScope submitScope(profiler, cpuScopes.submit);
+    // the slot's skinning and acceleration structures go ahead on the compute queue while the previous frames still draw
+    vk::Semaphore waitSemaphores[2] = { frame.presentComplete, frame.computeComplete };
+    vk::PipelineStageFlags waitStages[2] = { submitPipelineStages, vk::PipelineStageFlagBits::eVertexInput };
+    vk::CommandBuffer computeBuffers[2];
+    uint32_t computeBufferCount = 0;
+    if (gpuSkinning && gpuSkinning->IsAsync()) {
+        computeBuffers[computeBufferCount++] = gpuSkinning->GetComputeCommandBuffer(frame.firstSlot);
+    }
+    if (accelerationStructures) {
+        // the worlds of what moved since the last frame, the instances are placed with them
+        scene->transformStore.Update();
+        accelerationStructures->AddMeshes(*scene);
+        accelerationStructures->BeginFrame(frame.firstSlot, *scene);
+        computeBuffers[computeBufferCount++] = accelerationStructures->GetComputeCommandBuffer(frame.firstSlot);
+    }
+    if (computeBufferCount > 0) {
+        vk::SubmitInfo computeSubmitInfo;
+        computeSubmitInfo.commandBufferCount = computeBufferCount;
+        computeSubmitInfo.pCommandBuffers = computeBuffers;
+        // on the graphics queue the acceleration structures end in a barrier to the frame, no wait needed
+        if (frame.computeComplete) {
+            computeSubmitInfo.signalSemaphoreCount = 1;
+            computeSubmitInfo.pSignalSemaphores = &frame.computeComplete;
+            submitInfo.waitSemaphoreCount = 2;
+            submitInfo.pWaitSemaphores = waitSemaphores;
+            submitInfo.pWaitDstStageMask = waitStages;
+        }
+        const uint64_t computeValue = computeTimeline->Submit(computeSubmitInfo);
+        if (!frame.computeComplete && computeQueue != queue) {
+            graphicsTimeline->AddWait(*computeTimeline, computeValue, vk::PipelineStageFlagBits::eVertexInput);
+        }
+    }
+    submitInfo.commandBufferCount = submitBufferCount;
+    submitInfo.pCommandBuffers = submitBuffers;
+    // the frame's uploads in one submission, the shadow maps and impostor bakes deferred on the graphics
+    // timeline in the frame's
+    transferTimeline->Flush();
+    frame.serial = graphicsTimeline->Submit(submitInfo);
+    imagesInFlight[currentImage] = frame.serial;
+    frameStats.draws = commandBuffer->GetDrawCount();
+    frameStats.triangles = commandBuffer->GetTriangleCount();
+    frameStats.pipelineBinds = commandBuffer->GetPipelineBindCount();
+    trash.Submitted(frame.serial);
+
+    vk::Result result = swapChain.queuePresent(queue, currentImage, frame.renderComplete);
+    frameStats.acquireToPresentMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - acquireTime).count();
+    if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
+        resizePending = true;
+    }
+
+    frameIndex = (frameIndex + 1) % framesInFlight;
+}
+
+bool RendererVulkan::Pick(uint32_t x, uint32_t y, PickCallback callback)
+{
+    if (!idPicker || swapChain.extent.width == 0 || swapChain.extent.height == 0) {
+        return false;
+    }
+    // the scene covers the render extent of the ID buffer, the window all of it
+    const vk::Extent2D renderExtent = commandBuffer->GetRenderExtent();
+    const uint32_t idX = static_cast<uint32_t>(static_cast<uint64_t>(x) * renderExtent.width / swapChain.extent.width);
+    const uint32_t idY = static_cast<uint32_t>(static_cast<uint64_t>(y) * renderExtent.height / swapChain.extent.height);
+    // the entry's instance when the pick resolves, the draws keep an entry until their instance is removed
+    IndirectDraws* draws = indirectDraws;
+    return idPicker->Pick(idX, idY, [draws, callback](uint32_t entry, uint32_t primitive) {
+        if (callback) {
+            callback(entry == Pipeline::InvalidId ? IndirectDraws::NoInstance : draws->GetEntryInstance(entry), primitive);
+        }
+    });
+}
+
+// Submit the instance data IndirectDraws staged: the copies wait for the frames reading the buffers, the next
+// frame waits for the copies. On the GPU with timeline semaphores, on the CPU without
+void RendererVulkan::SubmitInstanceData()
+{
+    if (!transferTimeline->AddWait(*graphicsTimeline, graphicsTimeline->GetSubmitted(), vk::PipelineStageFlagBits::eTransfer)) {
+        graphicsTimeline->WaitIdle();
+    }
+    uploadQueue->Submit();
+    if (!graphicsTimeline->AddWait(*transferTimeline, transferTimeline->GetSubmitted(),
+            vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eComputeShader)) {
+        transferTimeline->WaitIdle();
+    }
+}
+
+// The scene is rendered with the pipeline's view and projection, cull against the same frustum
+void RendererVulkan::UpdateCulling()
+{
+    if (!gpuCulling) {
+        return;
+    }
+    m3d::math::Matrix4x4 projection = pipeLine->GetProjectionMatrix();
+    float eye[3];
+    GetViewerPosition(eye);
+    gpuCulling->Update(projection * pipeLine->GetViewMatrix(), eye);
+}
+
+// Lights where the scene's transforms put them, clustered for the pipeline's camera like the culling frustum
+void RendererVulkan::UpdateLights()
+{
+    if (!clusteredLights) {
+        return;
+    }
+    clusteredLights->Update(*scene, pipeLine->GetViewMatrix(), pipeLine->GetProjectionMatrix());
+}
+
+// Cascades of the pipeline's camera, drawn ahead of the frame that samples them
+void RendererVulkan::UpdateShadows()
+{
+    if (!shadowCascades) {
+        return;
+    }
+    const m3d::math::Matrix4x4& projection = pipeLine->GetProjectionMatrix();
+    // the main camera's planes, those of the OpenGL style perspective without one
+    float nearZ = projection.m[2][3] / (projection.m[2][2] - 1.0f);
+    float farZ = projection.m[2][3] / (projection.m[2][2] + 1.0f);
+    if (scene->cameras.contains(scene->mainCameraID)) {
+        const Camera& camera = scene->cameras[scene->mainCameraID];
+        if (camera.nearZ > 0.0f && camera.farZ > camera.nearZ) {
+            nearZ = camera.nearZ;
+            farZ = camera.farZ;
+        }
+    }
+    shadowCascades->Update(*scene, *geometry, pipeLine->GetViewMatrix(), projection, nearZ, farZ);
+    pipeLine->SetShadowCascades(shadowCascades->GetMatrices(), shadowCascades->GetSplits(), shadowCascades->GetCascadeCount());
+    shadowAtlas->Update(*scene, *geometry, pipeLine->GetViewMatrix(), projection);
+}
+
+// eye = -R^T * t of the rigid view matrix
+void RendererVulkan::GetViewerPosition(float eye[3])
+{
+    const m3d::math::Matrix4x4& view = pipeLine->GetViewMatrix();
+    for (int j = 0; j < 3; ++j) {
+        eye[j] = -(view.m[0][j] * view.m[0][3] + view.m[1][j] * view.m[1][3] + view.m[2][j] * view.m[2][3]);
+    }
+}
+
+// Hand the camera position to the streamers and upload whatever they merged since the last frame
+void RendererVulkan::UpdateStreaming()
+{
+    if (!sceneStreamer && !worldStreamer) {
+        return;
+    }
+    float eye[3];
+    GetViewerPosition(eye);
+    const m3d::math::Vector3 viewer(eye[0], eye[1], eye[2]);
+
+    bool merged = false;
+    if (sceneStreamer) {
+        sceneStreamer->SetViewer(viewer);
+        merged = sceneStreamer->Poll(*scene);
+    }
+    if (worldStreamer) {
+        worldStreamer->SetViewer(viewer);
+        merged = worldStreamer->Poll(*scene, [this](const MergedIDs& cell) { ReleaseCell(cell); }) || merged;
+    }
+    if (merged) {
+        geometry->Upload(*scene, [this]() { MeshesResident(); });
+        LoadTextures();
+    }
+}
+
+void RendererVulkan::ReleaseCell(const MergedIDs& cell)
+{
+    for (uint32_t instanceID : cell.instances) {
+        if (scene->instances.contains(instanceID)) {
+            RemoveInstance(instanceID);
+        }
+    }
+    // blocks go once their last mesh did, frames in flight may still draw from them
+    for (uint32_t meshID : cell.meshes) {
+        if (scene->meshes.contains(meshID)) {
+            geometry->Release(scene->meshes[meshID], &trash);
+            if (accelerationStructures) {
+                accelerationStructures->RemoveMesh(meshID, trash);
+            }
+            if (impostors) {
+                impostors->Release(meshID);
+            }
+        }
+    }
+    for (uint32_t diffuseMapID : cell.diffuseMaps) {
+        if (scene->diffuseMaps.contains(diffuseMapID) && scene->diffuseMaps[diffuseMapID].textureID != 0xFFFFFFFF) {
+            // the streamer hands the id out again, its array layer must not stay with it
+            if (textureArrays) {
+                textureArrays->Remove(scene->diffuseMaps[diffuseMapID].textureID, &trash);
+            }
+            textureStreamer->Release(scene->diffuseMaps[diffuseMapID].textureID);
+        }
+    }
+    commandBuffersDirty = true;
+}
+
+void RendererVulkan::MeshesResident()
+{
+    commandBuffersDirty = true;
+    // ray tracing and software occlusion read the vertices of meshes as they come, the geometry stays for them
+    if (!useRayTracing && !useSoftwareOcclusion) {
+        scene->ReleaseGeometry();
+    }
+}
+
+// Queue the scene's diffuse maps the texture streamer does not know yet, they decode on its workers
+void RendererVulkan::LoadTextures()
+{
+    for (uint32_t diffuseMapID : scene->diffuseMaps) {
+        DiffuseMap& diffuseMap = scene->diffuseMaps[diffuseMapID];
+        if (diffuseMap.textureID == TextureStreamer::InvalidTexture && !diffuseMap.path.empty()) {
+            diffuseMap.textureID = textureStreamer->LoadCookedAsync(diffuseMap.path, TextureUsage::Color);
+        }
+    }
+}
+
+// Re-pick instance LODs for the current view, the static indirect commands are only rewritten when one changes
+void RendererVulkan::UpdateLods()
+{
+    if (!indirectDraws) {
+        return;
+    }
+    // the worlds of what moved since the last frame
+    scene->transformStore.Update();
+    float eye[3];
+    GetViewerPosition(eye);
+    // the scene camera when it has one, otherwise the 1 / tan(fovY / 2) of the pipeline's projection
+    float pixelScale = pipeLine->GetProjectionMatrix().m[1][1] * height * 0.5f;
+    if (scene->cameras.contains(scene->mainCameraID)) {
+        pixelScale = scene->cameras[scene->mainCameraID].PixelScale(height);
+    }
+    indirectDraws->SetLodView(eye, pixelScale);
+    if (indirectDraws->LodSelectionChanged(*scene)) {
+        commandBuffersDirty = true;
+    }
 }
 
 /* Draw Loop */
 void RendererVulkan::Draw()
 {
-    PrepareFrame();
+    M3D_TRACE_ZONE("RendererVulkan::Draw");
+    M3D_MEMORY_TAG(Render);
+    // rendering as a job of DrawAll the main thread pumps while it waits
+    if (jobSystem && jobSystem->IsMainThread()) {
+        jobSystem->PumpMainThread();
+    }
+    // nothing of the frame that last used this index is referenced any more
+    frameArena->BeginFrame(frameIndex);
+    if (minimized || paused || surfaceLost) {
+        return;
+    }
+    if (commandCapture) {
+        commandCapture->Frame(pipeLine->GetViewMatrix(), pipeLine->GetProjectionMatrix());
+    }
+    if (framePacer) {
+        framePacer->WaitForFrame();
+        ApplyRenderScale();
+    }
+    perflint::BeginFrame();
+    auto tStart = std::chrono::high_resolution_clock::now();
+    if (resizePending) {
+        resizePending = false;
+        OnWindowSizeChanged();
+    }
 
-    device.waitForFences(1, &waitFences[currentImage], true, UINT64_MAX);
-    device.resetFences(1, &waitFences[currentImage]);
+    {
+        GpuProfiler::CpuScope streamingScope(profiler, cpuScopes.streaming);
+        UpdateStreaming();
+    }
+    {
+        GpuProfiler::CpuScope uploadsScope(profiler, cpuScopes.uploads);
+        uploadQueue->Poll();
+        if (meshDecoder) {
+            meshDecoder->Poll();
+        }
+        textureStreamer->Update(*frameArena);
+    }
+    if (materialTable && materialTable->HasPendingWrites()) {
+        // the set is bound by the recorded command buffers, rewrite it with them
+        commandBuffersDirty = true;
+    }
+    if (impostors && impostors->HasUnbaked(*scene)) {
+        // baked ahead of the re-recording, which switches their instances over
+        commandBuffersDirty = true;
+    }
+    if (gui && gui->HasNewAtlases()) {
+        // the static command buffers bind every atlas known when they were recorded
+        commandBuffersDirty = true;
+    }
+    {
+        GpuProfiler::CpuScope lodsScope(profiler, cpuScopes.lods);
+        UpdateLods();
+    }
+    UpdateViews();
+    if (softwareOcclusion) {
+        // rasterized on its worker while the rest of the frame is prepared, RecordFrame waits for it
+        scene->transformStore.Update();
+        m3d::math::Matrix4x4 viewProjection = pipeLine->GetProjectionMatrix();
+        softwareOcclusion->Begin(*scene, viewProjection * pipeLine->GetViewMatrix());
+    }
+    // shaders the watcher recompiled, their pipelines were built on its thread
+    if (shaderWatcher && pipelineRegistry->SwapReloaded(trash)) {
+        pipeLine->RefreshPipelines();
+        if (occlusionQueries) {
+            occlusionQueries->RefreshPipelines(*pipelineRegistry);
+        }
+        if (crowds) {
+            crowds->RefreshPipelines(*pipelineRegistry);
+        }
+        if (impostors) {
+            impostors->RefreshPipelines(*pipelineRegistry);
+        }
+        if (particles) {
+            particles->RefreshPipelines(*pipelineRegistry);
+        }
+        if (gui) {
+            gui->RefreshPipelines(*pipelineRegistry);
+        }
+        commandBuffersDirty = true;
+    }
+    if (commandBuffersDirty) {
+        GpuProfiler::CpuScope recordScope(profiler, cpuScopes.record);
+        // static draw command buffers: wait until none of them is pending before re-recording,
+        // per-frame recording picks up the new meshes by itself
+        if (recordThreads == 0) {
+            graphicsTimeline->WaitIdle();
+            // the impostor bakes shade with the materials
+            if (materialTable) {
+                materialTable->Update(*scene);
+                materialTable->Flush();
+            }
+            if (impostors) {
+                impostors->Bake(*scene, *geometry);
+            }
+            if (indirectDraws) {
+                indirectDraws->Update(*scene);
+                SubmitInstanceData();
+                UpdateCulling();
+                UpdateLights();
+            }
+            if (shadowCascades) {
+                shadowCascades->Invalidate();
+                shadowAtlas->Invalidate();
+            }
+            commandBuffer->Record(*pipeLine, *scene, *geometry, indirectDraws);
+        }
+        commandBuffersDirty = false;
+        instancesChanged = false;
+    }
+    if (instancesChanged) {
+        instancesChanged = false;
+        // lights follow their transforms
+        UpdateLights();
+        // only the entries of what changed, the recorded indirect draws read them where they are
+        if (indirectDraws->UploadChanges(*scene) > 0) {
+            SubmitInstanceData();
+            if (shadowCascades) {
+                shadowCascades->Invalidate();
+                // only the tiles of the lights the moved instances were or are in range of
+                shadowAtlas->CastersMoved(*scene, indirectDraws->GetMovedSlots());
+            }
+        }
+    }
+
+    bool prepared = false;
+    {
+        GpuProfiler::CpuScope waitScope(profiler, cpuScopes.wait);
+        prepared = headless ? PrepareOffscreenFrame() : PrepareFrame();
+    }
+    if (prepared) {
+        if (headless) {
+            SubmitOffscreenFrame();
+        } else {
+            SubmitFrame();
+        }
+        frameStats.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count() - frameWaitMs;
+        // streaming, textures and glyphs since the last frame's, geometry the GPU decodes as it was encoded
+        const uint64_t uploaded = uploadQueue->GetUploadedBytes() + (meshDecoder ? meshDecoder->GetEncodedBytes() : 0);
+        frameStats.uploadBytes = uploaded - uploadedBytes;
+        uploadedBytes = uploaded;
+        if (framePacer) {
+            framePacer->EndFrame(frameStats.cpuMs, frameStats.gpuMs);
+        }
+        if (profiler) {
+            profiler->EndFrame();
+        }
+        perflint::EndFrame();
+        UpdateMetrics();
+    }
+}
+
+std::vector<RendererVulkan::DeviceInfo> RendererVulkan::EnumerateDevices()
+{
+    std::vector<DeviceInfo> infos;
+    vk::ApplicationInfo appInfo = vk::ApplicationInfo()
+                                      .setPApplicationName("m3d example")
+                                      .setPEngineName("m3d")
+                                      .setApiVersion(VK_API_VERSION_1_0);
+    vk::InstanceCreateInfo instInfo = vk::InstanceCreateInfo().setPApplicationInfo(&appInfo);
+    vk::Instance enumerator;
+    try {
+        enumerator = vk::createInstance(instInfo);
+    } catch (const std::exception& e) {
+        std::cout << "Could not create a Vulkan instance: " << e.what() << std::endl;
+        return infos;
+    }
+
+    std::vector<vk::PhysicalDevice> ranked = vkhelper::rankPhysicalDevices(enumerator.enumeratePhysicalDevices());
+    for (auto& physicalDevice : ranked) {
+        vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+        DeviceInfo info;
+        info.name = properties.deviceName;
+        info.type = properties.deviceType;
+        info.localMemory = vkhelper::getDeviceLocalMemory(physicalDevice);
+        info.score = vkhelper::scorePhysicalDevice(physicalDevice);
+        infos.push_back(info);
+    }
+    enumerator.destroy();
+    return infos;
+}
+
+void RendererVulkan::DrawAll(const std::vector<RendererVulkan*>& renderers, JobSystem& jobs)
+{
+    JobSystem::Counter counter;
+    for (RendererVulkan* renderer : renderers) {
+        jobs.Run([renderer]() { renderer->Draw(); }, &counter);
+    }
+    jobs.PumpMainThread();
+    jobs.WaitFor(counter);
+}
+
+// Follow the pacer's render scale with the window's buffer size, the swapchain is recreated at its size
+void RendererVulkan::ApplyRenderScale()
+{
+    const float scale = framePacer->GetRenderScale();
+    if (scale == renderScale) {
+        return;
+    }
+    renderScale = scale;
+#if defined(__ANDROID__)
+    if (window) {
+        ANativeWindow_setBuffersGeometry(window, static_cast<int32_t>(nativeWidth * scale), static_cast<int32_t>(nativeHeight * scale), 0);
+        resizePending = true;
+    }
+#endif
+}
+
+void RendererVulkan::DrawAndReport(LoopReport& report)
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+    Draw();
+    frameCounter++;
+    report.frames++;
+    report.cpuMs += frameStats.cpuMs;
+    report.gpuMs += frameStats.gpuMs;
+    report.draws += frameStats.draws;
+    report.acquireWaitMs += frameStats.acquireWaitMs;
+    report.acquireToPresentMs += frameStats.acquireToPresentMs;
+
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    double tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+    frameTimer = (float)tDiff / 1000.0f;
+
+    // average over a second, the per-frame cpu time hides the gain of frames in flight
+    double tElapsed = std::chrono::duration<double, std::milli>(tEnd - report.start).count();
+    if (tElapsed > 1000.0) {
+        const uint32_t frames = report.frames;
+        printf("%u frames in flight: %.3f ms/frame (%.1f fps)\n", framesInFlight, tElapsed / frames, frames * 1000.0 / tElapsed);
+        printf("  cpu %.3f ms, gpu %.3f ms, %.0f draws/frame (%.0f draws/s)\n", report.cpuMs / frames, report.gpuMs / frames,
+            double(report.draws) / frames, report.draws * 1000.0 / tElapsed);
+        if (report.simulateMs > 0.0) {
+            printf("  simulate %.3f ms on the main thread\n", report.simulateMs / frames);
+        }
+        printf("  acquire wait %.3f ms, acquire to present %.3f ms\n", report.acquireWaitMs / frames, report.acquireToPresentMs / frames);
+        if (profiler) {
+            profiler->Report(report.cpuMs / frames, report.gpuMs / frames);
+        }
+        // nothing unless perflint::Enable turned the lint on
+        perflint::Print(frames);
+        // nothing unless trace::Begin started a trace
+        trace::Flush();
+        memoryAllocator->PrintStats();
+        report = LoopReport();
+        report.start = tEnd;
+    }
+}
+
+// Every frame, the application moves the cameras of the views in the scene
+void RendererVulkan::UpdateViews()
+{
+    if (!multiview) {
+        return;
+    }
+    m3d::math::Matrix4x4 views[Pipeline::MaxViews];
+    m3d::math::Matrix4x4 projections[Pipeline::MaxViews];
+    for (uint32_t i = 0; i < viewCameras.size(); ++i) {
+        if (scene->cameras.contains(viewCameras[i])) {
+            const Camera& camera = scene->cameras[viewCameras[i]];
+            views[i] = m3d::math::Matrix4x4::LookAt(camera.eye, camera.target, camera.up);
+            projections[i] = m3d::math::Matrix4x4::Perspective(camera.fovY, camera.aspect, camera.nearZ, camera.farZ);
+        } else {
+            // a removed camera shows what the pipeline's camera sees
+            views[i] = pipeLine->GetViewMatrix();
+            projections[i] = pipeLine->GetProjectionMatrix();
+        }
+    }
+    pipeLine->SetViews(views, projections, static_cast<uint32_t>(viewCameras.size()));
+}
+
+void RendererVulkan::RequestRedraw()
+{
+    {
+        std::lock_guard<std::mutex> lock(redrawMutex);
+        redrawRequested = true;
+    }
+    redrawSignal.notify_one();
+}
+
+bool RendererVulkan::NeedsFrame()
+{
+    if (!renderOnDemand) {
+        return true;
+    }
+    // what Draw itself would re-record or poll for, and whatever animates every frame
+    bool changed = redrawRequested.exchange(false) || commandBuffersDirty || instancesChanged || resizePending
+        || !uploadQueue->IsIdle() || (meshDecoder && !meshDecoder->IsIdle()) || textureStreamer->GetDecodingCount() > 0 || (sceneStreamer && !sceneStreamer->Done())
+        || (worldStreamer && !worldStreamer->Idle()) || (materialTable && materialTable->HasPendingWrites()) || (textureArrays && textureArrays->HasChanges())
+        || (impostors && impostors->HasUnbaked(*scene)) || (gui && gui->HasNewAtlases()) || (idPicker && idPicker->HasQueued())
+        || (shaderWatcher && pipelineRegistry->HasReloaded()) || crowds || particles || gpuSkinning;
+    if (changed) {
+        settleFrames = RedrawSettleFrames;
+    } else if (settleFrames > 0) {
+        --settleFrames;
+        changed = true;
+    }
+    idle = !changed;
+    return changed;
+}
 
-    SubmitFrame();
+void RendererVulkan::WaitForRedraw()
+{
+    std::unique_lock<std::mutex> lock(redrawMutex);
+    redrawSignal.wait_for(lock, std::chrono::milliseconds(IdlePollMs), [this]() { return redrawRequested.load(); });
 }
 
 void RendererVulkan::DrawLoop()
 {
+    frameCounter = 0;
+    LoopReport report;
     while (1) {
-        auto tStart = std::chrono::high_resolution_clock::now();
-        Draw();
-        frameCounter++;
-
-        auto tEnd = std::chrono::high_resolution_clock::now();
-        double tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-        //frameTimer = (float)tDiff / 1000.0f;
-        printf("%f\n", tDiff);
+        if (commands.Drain(*this) > 0) {
+            redrawRequested = true;
+        }
+        if (NeedsFrame()) {
+            DrawAndReport(report);
+        } else {
+            // idle time is no frame time
+            report = LoopReport();
+            WaitForRedraw();
+        }
     }
+    commands.Drain(*this);
     device.waitIdle();
 }
 
+// The simulation's changes of the frame, applied on the render thread before it draws
+void RendererVulkan::ApplySnapshot(const RenderSnapshot& snapshot)
+{
+    if (snapshot.hasCamera) {
+        const Camera& camera = snapshot.camera;
+        if (scene->cameras.contains(scene->mainCameraID)) {
+            // snapshots may carry the camera every frame, on demand only a moved one draws
+            if (memcmp(&scene->cameras[scene->mainCameraID], &camera, sizeof(Camera)) != 0) {
+                redrawRequested = true;
+            }
+            scene->cameras[scene->mainCameraID] = camera;
+        } else {
+            redrawRequested = true;
+        }
+        pipeLine->SetCamera(m3d::math::Matrix4x4::LookAt(camera.eye, camera.target, camera.up),
+            m3d::math::Matrix4x4::Perspective(camera.fovY, camera.aspect, camera.nearZ, camera.farZ));
+        // the frustum and the clusters follow the camera, both are read by the frame recorded next
+        if (indirectDraws) {
+            UpdateCulling();
+            UpdateLights();
+        }
+    }
+    for (const auto& change : snapshot.transforms) {
+        if (scene->transforms.contains(change.first)) {
+            SetTransform(change.first, change.second);
+        }
+    }
+}
+
+uint32_t RendererVulkan::AddInstance(uint32_t meshID, const Transform& transform)
+{
+    redrawRequested = true;
+    const uint32_t instanceID = scene->AddInstance(meshID, transform);
+    if (indirectDraws && indirectDraws->AddInstance(*scene, instanceID)) {
+        instancesChanged = true;
+    } else if (indirectDraws || recordThreads == 0) {
+        commandBuffersDirty = true;
+    }
+    if (shadowCascades) {
+        shadowCascades->Invalidate();
+        shadowAtlas->Invalidate();
+    }
+    if (commandCapture) {
+        commandCapture->AddInstance(meshID, transform, instanceID, scene->instances[instanceID].transformId);
+    }
+    return instanceID;
+}
+
+void RendererVulkan::RemoveInstance(uint32_t instanceID)
+{
+    redrawRequested = true;
+    if (indirectDraws && indirectDraws->RemoveInstance(instanceID)) {
+        instancesChanged = true;
+    } else if (indirectDraws || recordThreads == 0) {
+        commandBuffersDirty = true;
+    }
+    scene->RemoveInstance(instanceID);
+    if (shadowCascades) {
+        shadowCascades->Invalidate();
+        shadowAtlas->Invalidate();
+    }
+    if (commandCapture) {
+        commandCapture->RemoveInstance(instanceID);
+    }
+}
+
+void RendererVulkan::SetTransform(uint32_t transformID, const Transform& transform)
+{
+    redrawRequested = true;
+    scene->SetTransform(transformID, transform);
+    if (commandCapture) {
+        commandCapture->SetTransform(transformID, transform);
+    }
+    // per-frame recording reads the transforms as it goes, static command buffers have them baked in and the
+    // instance data gets the ones that moved
+    if (indirectDraws) {
+        instancesChanged = true;
+    } else if (recordThreads == 0) {
+        commandBuffersDirty = true;
+    }
+}
+
+void RendererVulkan::SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID)
+{
+    redrawRequested = true;
+    scene->SetSliceMaterial(meshID, slice, materialID);
+    if (commandCapture) {
+        commandCapture->SetSliceMaterial(meshID, slice, materialID);
+    }
+    // a slice between opaque and transparent materials changes batches, only the Update of a re-record moves it
+    if (indirectDraws && (!materialTable || materialTable->Contains(materialID)) && indirectDraws->UpdateMaterials(*scene, meshID)) {
+        instancesChanged = true;
+    } else if (indirectDraws || recordThreads == 0) {
+        commandBuffersDirty = true;
+    }
+}
+
+void RendererVulkan::DrawLoopThreaded(std::function<bool(RenderSnapshot&)> simulate)
+{
+    frameCounter = 0;
+    SnapshotBuffer snapshots;
+    std::thread renderThread([this, &snapshots]() {
+        M3D_TRACE_THREAD("RendererVulkan render");
+        LoopReport report;
+        while (const RenderSnapshot* snapshot = snapshots.BeginRead()) {
+            // before the snapshot, which may refer to what the commands created
+            if (commands.Drain(*this) > 0) {
+                redrawRequested = true;
+            }
+            ApplySnapshot(*snapshot);
+            report.simulateMs += snapshot->simulateMs;
+            // on demand the window's thread blocks on its events while IsIdle, skipped snapshots cost nothing
+            if (NeedsFrame()) {
+                DrawAndReport(report);
+            } else {
+                report = LoopReport();
+            }
+            snapshots.EndRead();
+        }
+        commands.Drain(*this);
+        device.waitIdle();
+    });
+
+    for (;;) {
+        RenderSnapshot& snapshot = snapshots.BeginWrite();
+        auto tStart = std::chrono::high_resolution_clock::now();
+        if (!simulate(snapshot)) {
+            break;
+        }
+        snapshot.simulateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+        snapshots.EndWrite();
+    }
+    snapshots.Close();
+    renderThread.join();
+}
+
 RendererVulkan::~RendererVulkan()
 {
+    device.waitIdle();
+    trash.Flush();
+    // the last frames' pictures, the encoder finishes them before its capture goes
+    if (frameCapture) {
+        for (uint32_t f = 0; f < framesInFlight; ++f) {
+            frameCapture->Resolve(f);
+        }
+    }
+
+    // it rebuilds pipelines of the registry on its thread
+    delete shaderWatcher;
+    delete materialTable;
+    delete textureArrays;
     delete pipeLine;
+    delete pipelineRegistry;
+    delete gpuCulling;
+    delete clusteredLights;
+    delete shadowCascades;
+    delete shadowAtlas;
+    delete softwareOcclusion;
+    delete occlusionQueries;
+    delete gpuSkinning;
+    delete crowds;
+    delete impostors;
+    delete particles;
+    delete postProcess;
+    delete shadingRate;
+    delete accelerationStructures;
+    delete idPicker;
+    delete frameCapture;
+    delete commandCapture;
+    delete memoryOverlay;
+    delete statsOverlay;
+    delete gui;
+    delete profiler;
+    delete indirectDraws;
+    delete textureStreamer;
+    // after every texture referencing its samplers
+    delete samplerCache;
+    delete uploadQueue;
+    delete meshDecoder;
+    delete geometry;
     delete commandBuffer;
-
-    // TODO: destroy texture, Mesh resources
+    delete offscreen;
+    // everything above suballocates from it
+    delete memoryAllocator;
+    delete frameArena;
+    delete frameDescriptors;
+    // the upload queue submitted to it
+    delete graphicsTimeline;
+    delete transferTimeline;
+    delete computeTimeline;
+
+    for (auto& frame : frames) {
+        device.destroySemaphore(frame.presentComplete);
+        device.destroySemaphore(frame.renderComplete);
+        device.destroySemaphore(frame.computeComplete);
+        device.destroyCommandPool(frame.commandPool);
+    }
+    if (timerQueries) {
+        device.destroyCommandPool(timerPool);
+        device.destroyQueryPool(timerQueries);
+    }
+    // scene textures belong to the texture streamer and meshes to the geometry arena, both are gone
 }
 }
\ No newline at end of file
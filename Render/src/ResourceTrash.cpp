@@ -0,0 +1,38 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ResourceTrash.hpp"
+
+namespace m3d {
+
+ResourceTrash::~ResourceTrash()
+{
+    Flush();
+}
+
+void ResourceTrash::Trash(Destroyer destroy)
+{
+    Entry entry;
+    entry.serial = submitted;
+    entry.destroy = destroy;
+    entries.push_back(entry);
+}
+
+void ResourceTrash::Collect(uint64_t completedSerial)
+{
+    // serials only grow, so entries are ordered
+    while (!entries.empty() && entries.front().serial <= completedSerial) {
+        Destroyer destroy = entries.front().destroy;
+        entries.pop_front();
+        destroy();
+    }
+}
+
+void ResourceTrash::Flush()
+{
+    Collect(UINT64_MAX);
+}
+} // End of namespace m3d
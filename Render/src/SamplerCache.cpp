@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SamplerCache.hpp"
+
+#include <cassert>
+
+namespace m3d {
+
+// VK_LOD_CLAMP_NONE
+const float SamplerCache::NoLodClamp = 1000.0f;
+
+/* FNV-1a */
+template <class T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+SamplerCache::SamplerCache(vk::Device& Device)
+    : device(Device)
+{
+}
+
+SamplerCache::~SamplerCache()
+{
+    for (auto& entry : samplers) {
+        device.destroySampler(entry.second.sampler);
+    }
+}
+
+vk::SamplerCreateInfo SamplerCache::Sampler(vk::Filter filter, vk::SamplerAddressMode addressMode, float maxAnisotropy)
+{
+    vk::SamplerCreateInfo info;
+    info.magFilter = filter;
+    info.minFilter = filter;
+    info.mipmapMode = filter == vk::Filter::eNearest ? vk::SamplerMipmapMode::eNearest : vk::SamplerMipmapMode::eLinear;
+    info.addressModeU = addressMode;
+    info.addressModeV = addressMode;
+    info.addressModeW = addressMode;
+    info.compareOp = vk::CompareOp::eNever;
+    info.maxLod = NoLodClamp;
+    info.anisotropyEnable = maxAnisotropy > 1.0f ? VK_TRUE : VK_FALSE;
+    info.maxAnisotropy = maxAnisotropy > 1.0f ? maxAnisotropy : 1.0f;
+    info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+    return info;
+}
+
+vk::Sampler SamplerCache::Get(vk::Filter filter, vk::SamplerAddressMode addressMode, float maxAnisotropy)
+{
+    return Get(Sampler(filter, addressMode, maxAnisotropy));
+}
+
+vk::Sampler SamplerCache::Get(const vk::SamplerCreateInfo& info)
+{
+    assert(info.pNext == nullptr);
+    uint64_t hash = 14695981039346656037ull;
+    hashValue(hash, static_cast<VkSamplerCreateFlags>(info.flags));
+    hashValue(hash, info.magFilter);
+    hashValue(hash, info.minFilter);
+    hashValue(hash, info.mipmapMode);
+    hashValue(hash, info.addressModeU);
+    hashValue(hash, info.addressModeV);
+    hashValue(hash, info.addressModeW);
+    hashValue(hash, info.mipLodBias);
+    hashValue(hash, info.anisotropyEnable);
+    hashValue(hash, info.maxAnisotropy);
+    hashValue(hash, info.compareEnable);
+    hashValue(hash, info.compareOp);
+    hashValue(hash, info.minLod);
+    hashValue(hash, info.maxLod);
+    hashValue(hash, info.borderColor);
+    hashValue(hash, info.unnormalizedCoordinates);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = samplers.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.info == info) {
+            return it->second.sampler;
+        }
+    }
+    Entry entry;
+    entry.info = info;
+    entry.sampler = device.createSampler(info);
+    samplers.insert(std::make_pair(hash, entry));
+    return entry.sampler;
+}
+
+size_t SamplerCache::GetSamplerCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return samplers.size();
+}
+} // End of namespace m3d
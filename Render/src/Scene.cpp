@@ -6,241 +6,1596 @@
 
 #include "Scene.hpp"
 #include "File.hpp"
+#include "MemoryTags.hpp"
+#include "MeshCodec.hpp"
+#include "MeshOptimizer.hpp"
+#include "SIMD_Batch.h"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 
+#include "../../data/schema/cooked_generated.h"
 #include "../../data/schema/scene_generated.h"
+#include "../../data/schema/snapshot_generated.h"
 #include "flatbuffers/idl.h"
 #include "flatbuffers/util.h"
 
 #include <fbxsdk.h>
 
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
 using namespace m3d::schema;
 
-#define TRIANGLE_VERTEX_COUNT 3
-#define VERTEX_STRIDE 4
-#define NORMAL_STRIDE 3
-#define UV_STRIDE 2
+#define TRIANGLE_VERTEX_COUNT 3
+#define VERTEX_STRIDE 4
+#define NORMAL_STRIDE 3
+#define UV_STRIDE 2
+
+// SCookedScene::version, bump whenever the cooked content changes
+static const uint32_t CookedVersion = 12;
+
+namespace m3d {
+
+static_assert(sizeof(SPackedVertex) == sizeof(PackedVertex), "cooked vertices are uploaded as PackedVertex");
+static_assert(sizeof(SCodecChunk) == sizeof(CodecChunk), "cooked codec chunks are written as they are");
+static_assert(sizeof(SMorphDelta) == sizeof(animation::MorphDelta), "cooked morph deltas are written as they are");
+static_assert(sizeof(SRotationKey) == sizeof(animation::RotationKey) && sizeof(SVectorKey) == sizeof(animation::VectorKey)
+        && sizeof(SScalarKey) == sizeof(animation::ScalarKey) && sizeof(SAnimationTrack) == sizeof(animation::AnimationTrack),
+    "cooked clips are copied as they are");
+
+// FBX animation stacks are sampled at this rate before key reduction
+static const float AnimationSampleRate = 30.0f;
+
+// Octahedral normal encoding, see "A Survey of Efficient Representations for Independent Unit Vectors".
+// Still in [-1, 1], FloatToSnorm16Array quantizes the whole mesh at once
+static void encodeOctahedral(const float* n, float* out)
+{
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 == 0.0f) {
+        out[0] = out[1] = 0.0f;
+        return;
+    }
+    float x = n[0] / l1;
+    float y = n[1] / l1;
+    if (n[2] < 0.0f) {
+        float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    out[0] = x;
+    out[1] = y;
+}
+
+void Mesh::pack()
+{
+    const size_t vertexCount = vertices.size() / VERTEX_STRIDE;
+    const bool hasNormal = normals.size() >= vertexCount * NORMAL_STRIDE;
+    const bool hasUV = uvs.size() >= vertexCount * UV_STRIDE;
+
+    // folded first, PackedVertexFormat quantizes each stream in bulk and interleaves
+    std::vector<float> folded(hasNormal ? vertexCount * 2 : 0);
+    for (size_t i = 0; i < folded.size() / 2; ++i) {
+        encodeOctahedral(&normals[i * NORMAL_STRIDE], &folded[i * 2]);
+    }
+    VertexStream streams[static_cast<size_t>(VertexSemantic::Count)];
+    streams[static_cast<size_t>(VertexSemantic::Position)] = { vertices.data(), VERTEX_STRIDE };
+    if (hasNormal) {
+        streams[static_cast<size_t>(VertexSemantic::Normal)] = { folded.data(), 2 };
+    }
+    if (hasUV) {
+        streams[static_cast<size_t>(VertexSemantic::UV)] = { uvs.data(), UV_STRIDE };
+    }
+    packedVertices.resize(vertexCount);
+    PackedVertexFormat::Pack(streams, vertexCount, packedVertices.data());
+}
+namespace {
+// Import streams of the mesh converting on this thread, their capacity carries over to the next mesh
+struct ImportScratch {
+    std::vector<float> vertices;
+    std::vector<float> uvs;
+    std::vector<float> normals;
+    std::vector<uint32_t> indices;
+    // spent in OptimizeMesh by this thread so far, for LoadStats
+    double dedupMs = 0.0;
+};
+}
+
+static double msSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static ImportScratch& importScratch()
+{
+    // meshes convert on a pool that is torn down after the import, and these with it
+    static thread_local ImportScratch scratch;
+    return scratch;
+}
+
+// Corner c of the triangulated mesh becomes vertex c unless the attributes are all by control point, then
+// control point p becomes vertex p. The kernels below run per combination of that layout and an element's
+// mapping and reference mode, without a branch or an FBX call per vertex.
+
+// vertex i from control point i, or from the control point of corner i
+template <bool ByCorner>
+static void convertPositions(const FbxVector4* controlPoints, const int* cornerControlPoints, uint32_t vertexCount, float* out)
+{
+    for (uint32_t i = 0; i < vertexCount; ++i, out += VERTEX_STRIDE) {
+        const FbxVector4& point = controlPoints[ByCorner ? cornerControlPoints[i] : i];
+        out[0] = static_cast<float>(point[0]);
+        out[1] = static_cast<float>(point[1]);
+        out[2] = static_cast<float>(point[2]);
+        out[3] = 1.0f;
+    }
+}
+
+// element value of vertex i: ThroughControlPoint when the element is by control point but the vertices are corners,
+// Indexed for eIndexToDirect. Neither is the bulk copy of an eByPolygonVertex/eDirect element
+template <bool ThroughControlPoint, bool Indexed, uint32_t Components, typename FbxValue>
+static void gatherElement(const FbxValue* direct, const int* indexArray, const int* cornerControlPoints, uint32_t vertexCount, float* out)
+{
+    for (uint32_t i = 0; i < vertexCount; ++i, out += Components) {
+        const int reference = ThroughControlPoint ? cornerControlPoints[i] : static_cast<int>(i);
+        const FbxValue& value = direct[Indexed ? indexArray[reference] : reference];
+        for (uint32_t c = 0; c < Components; ++c) {
+            out[c] = static_cast<float>(value[c]);
+        }
+    }
+}
+
+// Picks the gatherElement of element's modes, false for the mappings Mesh does not import
+template <uint32_t Components, typename FbxValue>
+static bool convertElement(FbxLayerElementTemplate<FbxValue>* element, bool verticesByCorner, const int* cornerControlPoints, uint32_t vertexCount,
+    float* out)
+{
+    const FbxGeometryElement::EMappingMode mapping = element->GetMappingMode();
+    if (mapping != FbxGeometryElement::eByControlPoint && !(verticesByCorner && mapping == FbxGeometryElement::eByPolygonVertex)) {
+        return false;
+    }
+    const bool throughControlPoint = verticesByCorner && mapping == FbxGeometryElement::eByControlPoint;
+    const bool indexed = element->GetReferenceMode() == FbxLayerElement::eIndexToDirect;
+
+    FbxValue* direct = element->GetDirectArray().GetLocked(FbxLayerElementArray::eReadLock);
+    int* indexArray = indexed ? element->GetIndexArray().GetLocked(FbxLayerElementArray::eReadLock) : nullptr;
+    if (throughControlPoint) {
+        (indexed ? gatherElement<true, true, Components, FbxValue> : gatherElement<true, false, Components, FbxValue>)(direct, indexArray,
+            cornerControlPoints, vertexCount, out);
+    } else {
+        (indexed ? gatherElement<false, true, Components, FbxValue> : gatherElement<false, false, Components, FbxValue>)(direct, indexArray,
+            cornerControlPoints, vertexCount, out);
+    }
+    if (indexArray) {
+        element->GetIndexArray().Release(&indexArray);
+    }
+    element->GetDirectArray().Release(&direct);
+    return true;
+}
+
+// Corners go to their polygon's slice in polygon order, as their vertex or their control point
+template <bool ByCorner>
+static void sliceIndices(const int* cornerControlPoints, const int* polygonMaterials, uint32_t polygonCount, std::vector<Mesh::Slice>& slices,
+    uint32_t* indices)
+{
+    for (uint32_t i = 0; i < polygonCount; ++i) {
+        Mesh::Slice& slice = slices[polygonMaterials ? polygonMaterials[i] : 0];
+        uint32_t* triangle = indices + slice.indexOffset + slice.triangleCount * TRIANGLE_VERTEX_COUNT;
+        for (uint32_t v = 0; v < TRIANGLE_VERTEX_COUNT; ++v) {
+            const uint32_t corner = i * TRIANGLE_VERTEX_COUNT + v;
+            triangle[v] = ByCorner ? corner : static_cast<uint32_t>(cornerControlPoints[corner]);
+        }
+        slice.triangleCount += 1;
+    }
+}
+
+// Deltas under these are exporter noise, not part of the shape
+static const float MorphPositionEpsilon = 1e-5f;
+static const float MorphNormalEpsilon = 1e-3f;
+
+// Every blend shape channel of fbxMesh as a morph target of mesh, once build settled the vertices. A channel is
+// taken at its last, full weight shape, in-between shapes are left out. The shape's normals are read like the
+// mesh's, through importVertices, and a target without them only moves positions
+static void importMorphTargets(FbxMesh* fbxMesh, bool verticesByCorner, const int* cornerControlPoints, uint32_t importVertexCount, Mesh& mesh)
+{
+    const uint32_t vertexCount = static_cast<uint32_t>(mesh.vertices.size() / VERTEX_STRIDE);
+    const bool hasNormal = mesh.normals.size() >= vertexCount * NORMAL_STRIDE;
+    const int controlPointCount = fbxMesh->GetControlPointsCount();
+    const FbxVector4* basePoints = fbxMesh->GetControlPoints();
+    std::vector<float> shapeNormals;
+    for (int b = 0; b < fbxMesh->GetDeformerCount(FbxDeformer::eBlendShape); ++b) {
+        FbxBlendShape* blendShape = static_cast<FbxBlendShape*>(fbxMesh->GetDeformer(b, FbxDeformer::eBlendShape));
+        for (int c = 0; c < blendShape->GetBlendShapeChannelCount(); ++c) {
+            FbxBlendShapeChannel* channel = blendShape->GetBlendShapeChannel(c);
+            const int shapeCount = channel->GetTargetShapeCount();
+            FbxShape* shape = shapeCount > 0 ? channel->GetTargetShape(shapeCount - 1) : nullptr;
+            if (!shape || shape->GetControlPointsCount() != controlPointCount) {
+                printf("Mesh %s: blend shape %s does not cover the control points, not imported\n", fbxMesh->GetName(), channel->GetName());
+                continue;
+            }
+            const FbxVector4* shapePoints = shape->GetControlPoints();
+            bool shapeHasNormals = false;
+            if (hasNormal && shape->GetElementNormalCount() > 0) {
+                shapeNormals.resize(importVertexCount * NORMAL_STRIDE);
+                shapeHasNormals = convertElement<NORMAL_STRIDE>(shape->GetElementNormal(0), verticesByCorner, cornerControlPoints, importVertexCount,
+                    shapeNormals.data());
+            }
+
+            Mesh::MorphTarget target;
+            target.name = channel->GetName();
+            target.firstDelta = static_cast<uint32_t>(mesh.morphDeltas.size());
+            for (uint32_t v = 0; v < vertexCount; ++v) {
+                const uint32_t controlPoint = mesh.controlPoints[v];
+                animation::MorphDelta delta = {};
+                delta.vertex = v;
+                float positionMax = 0.0f;
+                float normalMax = 0.0f;
+                for (int k = 0; k < 3; ++k) {
+                    delta.position[k] = static_cast<float>(shapePoints[controlPoint][k] - basePoints[controlPoint][k]);
+                    positionMax = std::max(positionMax, fabsf(delta.position[k]));
+                }
+                if (shapeHasNormals) {
+                    // welding only merged bit-identical normals, the vertex's is the one of its import vertex
+                    const float* shapeNormal = &shapeNormals[mesh.importVertices[v] * NORMAL_STRIDE];
+                    for (int k = 0; k < 3; ++k) {
+                        delta.normal[k] = shapeNormal[k] - mesh.normals[v * NORMAL_STRIDE + k];
+                        normalMax = std::max(normalMax, fabsf(delta.normal[k]));
+                    }
+                }
+                if (positionMax > MorphPositionEpsilon || normalMax > MorphNormalEpsilon) {
+                    mesh.morphDeltas.push_back(delta);
+                }
+            }
+            target.deltaCount = static_cast<uint32_t>(mesh.morphDeltas.size()) - target.firstDelta;
+            mesh.morphTargets.push_back(target);
+        }
+    }
+}
+
+bool Mesh::init(FbxMesh* pFbxMesh)
+{
+    M3D_TRACE_ZONE("Mesh::init");
+    M3D_MEMORY_TAG(Scene);
+    FbxNode* node = pFbxMesh->GetNode();
+    name = StringId(node ? node->GetName() : pFbxMesh->GetName());
+    // build in the thread's scratch, only packedVertices and an exact copy of the indices stay with the mesh
+    ImportScratch& scratch = importScratch();
+    this->vertices.swap(scratch.vertices);
+    this->uvs.swap(scratch.uvs);
+    this->normals.swap(scratch.normals);
+    this->indices.swap(scratch.indices);
+    this->vertices.clear();
+    this->uvs.clear();
+    this->normals.clear();
+    this->indices.clear();
+
+    uint32_t normalCount = pFbxMesh->GetElementNormalCount();
+    uint32_t uvCount = pFbxMesh->GetElementUVCount();
+    FbxGeometryElement::EMappingMode normalMappingMode = normalCount ? pFbxMesh->GetElementNormal(0)->GetMappingMode()
+                                                                     : FbxGeometryElement::eNone;
+    FbxGeometryElement::EMappingMode uvMappingModel = uvCount ? pFbxMesh->GetElementUV(0)->GetMappingMode()
+                                                              : FbxGeometryElement::eNone;
+
+    bool hasNormal = normalMappingMode != FbxGeometryElement::eNone;
+    bool hasUV = uvMappingModel != FbxGeometryElement::eNone;
+
+    bool byControlPoint = hasNormal && normalMappingMode == FbxGeometryElement::eByControlPoint && hasUV && uvMappingModel == FbxGeometryElement::eByControlPoint;
+
+    uint32_t polygonCount = pFbxMesh->GetPolygonCount();
+    uint32_t controlPointCount = byControlPoint
+        ? pFbxMesh->GetControlPointsCount()
+        : polygonCount * TRIANGLE_VERTEX_COUNT;
+
+    this->vertices.resize(controlPointCount * VERTEX_STRIDE);
+    this->indices.resize(polygonCount * TRIANGLE_VERTEX_COUNT);
+    if (hasNormal)
+        this->normals.resize(controlPointCount * NORMAL_STRIDE);
+
+    if (hasUV) {
+        this->uvs.resize(controlPointCount * UV_STRIDE);
+    }
+
+    /* Vertex Attributes */
+    // the mesh is triangulated, corner i * 3 + v is vertex v of polygon i
+    FBX_ASSERT(pFbxMesh->GetPolygonVertexCount() == static_cast<int>(polygonCount * TRIANGLE_VERTEX_COUNT));
+    const int* cornerControlPoints = pFbxMesh->GetPolygonVertices();
+    const FbxVector4* pControlPoints = pFbxMesh->GetControlPoints();
+    if (byControlPoint) {
+        convertPositions<false>(pControlPoints, cornerControlPoints, controlPointCount, this->vertices.data());
+    } else {
+        convertPositions<true>(pControlPoints, cornerControlPoints, controlPointCount, this->vertices.data());
+    }
+    if (hasNormal && !convertElement<NORMAL_STRIDE>(pFbxMesh->GetElementNormal(0), !byControlPoint, cornerControlPoints, controlPointCount, this->normals.data())) {
+        printf("Mesh %s: normals mapped by %d are not imported\n", pFbxMesh->GetName(), static_cast<int>(normalMappingMode));
+    }
+    if (hasUV && !convertElement<UV_STRIDE>(pFbxMesh->GetElementUV(0), !byControlPoint, cornerControlPoints, controlPointCount, this->uvs.data())) {
+        printf("Mesh %s: uvs mapped by %d are not imported\n", pFbxMesh->GetName(), static_cast<int>(uvMappingModel));
+    }
+
+    /* Slice the mesh according to materials */
+    FbxLayerElementArrayTemplate<int>* pMaterialIndices = nullptr;
+    FbxGeometryElement::EMappingMode materialMappingMode = FbxGeometryElement::eNone;
+    if (pFbxMesh->GetElementMaterial()) {
+        pMaterialIndices = &pFbxMesh->GetElementMaterial()->GetIndexArray();
+        materialMappingMode = pFbxMesh->GetElementMaterial()->GetMappingMode();
+        if (pMaterialIndices && materialMappingMode == FbxGeometryElement::eByPolygon) {
+            FBX_ASSERT(pMaterialIndices->GetCount() == polygonCount);
+            for (uint32_t i = 0; i < polygonCount; ++i) {
+                const uint32_t materialIndex = pMaterialIndices->GetAt(i);
+                // slice i is drawn with material i of the node, materials without polygons keep an empty slice
+                if (materialIndex >= slices.size()) {
+                    slices.resize(materialIndex + 1, Slice(0, 0));
+                }
+                slices[materialIndex].triangleCount += 1;
+            }
+
+            int offset = 0;
+            for (uint32_t i = 0; i < slices.size(); ++i) {
+                slices[i].indexOffset = offset;
+                offset += slices[i].triangleCount * 3;
+                // this will be reused during per-Polygon processing
+                slices[i].triangleCount = 0;
+            }
+            FBX_ASSERT(offset == polygonCount * 3);
+        }
+    }
+
+    // There is only one material.
+    if (slices.size() == 0) {
+        slices.emplace_back(0, 0);
+    }
+
+    /* Indices */
+    int* polygonMaterials = nullptr;
+    if (pMaterialIndices && materialMappingMode == FbxGeometryElement::eByPolygon) {
+        polygonMaterials = pMaterialIndices->GetLocked(FbxLayerElementArray::eReadLock);
+    }
+    if (byControlPoint) {
+        sliceIndices<false>(cornerControlPoints, polygonMaterials, polygonCount, slices, this->indices.data());
+    } else {
+        sliceIndices<true>(cornerControlPoints, polygonMaterials, polygonCount, slices, this->indices.data());
+    }
+    if (polygonMaterials) {
+        pMaterialIndices->Release(&polygonMaterials);
+    }
+
+    // blend shapes find their vertices through where each was read from
+    const bool hasBlendShapes = pFbxMesh->GetDeformerCount(FbxDeformer::eBlendShape) > 0;
+    if (hasBlendShapes) {
+        this->importVertices.resize(controlPointCount);
+        this->controlPoints.resize(controlPointCount);
+        for (uint32_t i = 0; i < controlPointCount; ++i) {
+            this->importVertices[i] = i;
+            this->controlPoints[i] = byControlPoint ? i : static_cast<uint32_t>(cornerControlPoints[i]);
+        }
+    }
+
+    build();
+
+    if (hasBlendShapes) {
+        importMorphTargets(pFbxMesh, !byControlPoint, cornerControlPoints, controlPointCount, *this);
+        std::vector<uint32_t>().swap(this->controlPoints);
+        std::vector<uint32_t>().swap(this->importVertices);
+    }
+
+    std::vector<uint32_t> exactIndices(this->indices.begin(), this->indices.end());
+    this->indices.swap(exactIndices);
+    scratch.indices.swap(exactIndices);
+    this->vertices.swap(scratch.vertices);
+    this->uvs.swap(scratch.uvs);
+    this->normals.swap(scratch.normals);
+    return true;
+}
+
+void Mesh::build()
+{
+    /* Weld duplicated corners, then reorder for the vertex cache and vertex fetch */
+    auto tDedup = std::chrono::high_resolution_clock::now();
+    OptimizeMesh(*this);
+    importScratch().dedupMs += msSince(tDedup);
+
+    /* Bounds per slice and for the whole mesh, sphere around the center of the AABB */
+    const uint32_t vertexCount = static_cast<uint32_t>(this->vertices.size() / VERTEX_STRIDE);
+    if (vertexCount > 0) {
+        for (auto& slice : slices) {
+            const uint32_t* sliceIndices = this->indices.data() + slice.indexOffset;
+            for (int i = 0; i < slice.triangleCount * TRIANGLE_VERTEX_COUNT; ++i) {
+                slice.bounds.Expand(&this->vertices[sliceIndices[i] * VERTEX_STRIDE]);
+            }
+            bounds.Expand(slice.bounds);
+        }
+        float radiusSq = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            boundingSphere[c] = bounds.Center(c);
+        }
+        for (uint32_t i = 0; i < vertexCount; ++i) {
+            float distSq = 0.0f;
+            for (int c = 0; c < 3; ++c) {
+                float d = this->vertices[i * VERTEX_STRIDE + c] - boundingSphere[c];
+                distSq += d * d;
+            }
+            radiusSq = std::max(radiusSq, distSq);
+        }
+        boundingSphere[3] = sqrtf(radiusSq);
+    }
+
+    /* Clusters of the full resolution slices the GPU culls one by one */
+    BuildMeshlets(*this, MeshletVertices, MeshletTriangles);
+
+    /* Coarser levels for distant instances, appended behind the full resolution indices */
+    GenerateLods(*this);
+
+    pack();
+}
+
+uint32_t Mesh::SelectLod(float pixelsPerUnit, float maxPixelError) const
+{
+    // errors grow with the level
+    uint32_t lod = 0;
+    while (lod < lods.size() && lods[lod].error * pixelsPerUnit <= maxPixelError) {
+        ++lod;
+    }
+    return lod;
+}
+
+size_t Mesh::ReleaseGeometry(CpuGeometry policy)
+{
+    if (geometryReleased || mappedVertices || policy == CpuGeometry::Keep || policy == CpuGeometry::Default) {
+        return 0;
+    }
+    // cooked compressed geometry decodes from the mapping, nothing to keep
+    if (policy == CpuGeometry::Compressed && !mappedEncodedVertices) {
+        encodedGeometry.clear();
+        vertexChunks.clear();
+        indexChunks.clear();
+        EncodeVertices(packedVertices.data(), packedVertices.size(), encodedGeometry, vertexChunks);
+        EncodeIndices(indices.data(), indices.size(), encodedGeometry, indexChunks);
+    }
+    const size_t bytes = packedVertices.capacity() * sizeof(PackedVertex) + indices.capacity() * sizeof(uint32_t);
+    releasedVertexCount = static_cast<uint32_t>(packedVertices.size());
+    releasedIndexCount = static_cast<uint32_t>(indices.size());
+    std::vector<PackedVertex>().swap(packedVertices);
+    std::vector<uint32_t>().swap(indices);
+    geometryReleased = true;
+    return bytes > encodedGeometry.capacity() ? bytes - encodedGeometry.capacity() : 0;
+}
+
+bool Mesh::RestoreGeometry()
+{
+    if (!geometryReleased) {
+        return true;
+    }
+    const uint8_t* vertexStream = mappedEncodedVertices ? mappedEncodedVertices : encodedGeometry.data();
+    const uint8_t* indexStream = mappedEncodedIndices ? mappedEncodedIndices : encodedGeometry.data();
+    const size_t vertexBytes = mappedEncodedVertices ? mappedEncodedVertexBytes : encodedGeometry.size();
+    const size_t indexBytes = mappedEncodedIndices ? mappedEncodedIndexBytes : encodedGeometry.size();
+    if (!vertexStream || (vertexChunks.empty() && releasedVertexCount > 0)) {
+        return false;
+    }
+
+    packedVertices.resize(releasedVertexCount);
+    indices.resize(releasedIndexCount);
+    bool decoded = true;
+    for (const CodecChunk& chunk : vertexChunks) {
+        decoded = decoded && static_cast<size_t>(chunk.first) + chunk.count <= packedVertices.size()
+            && DecodeVertexChunk(vertexStream, vertexBytes, chunk, packedVertices.data());
+    }
+    for (const CodecChunk& chunk : indexChunks) {
+        decoded = decoded && static_cast<size_t>(chunk.first) + chunk.count <= indices.size()
+            && DecodeIndexChunk(indexStream, indexBytes, chunk, indices.data());
+    }
+    if (!decoded) {
+        printf("Scene: the released geometry of mesh %s does not decode\n", name.c_str());
+        std::vector<PackedVertex>().swap(packedVertices);
+        std::vector<uint32_t>().swap(indices);
+        return false;
+    }
+    geometryReleased = false;
+    return true;
+}
+
+float Camera::PixelScale(uint32_t viewportHeight) const
+{
+    return viewportHeight * 0.5f / tanf(fovY * 0.5f * m3d::math::PI_F / 180.0f);
+}
+
+m3d::math::Matrix4x4 Transform::ToMatrix() const
+{
+    // Quaternion::ToMatrix is row vector, transpose while applying scale and translation
+    m3d::math::Matrix4x4 rotationMatrix;
+    m3d::math::Quaternion q = rotation;
+    q.ToMatrix(rotationMatrix);
+
+    const float s[3] = { scale.x, scale.y, scale.z };
+    const float t[3] = { position.x, position.y, position.z };
+
+    m3d::math::Matrix4x4 result;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            result.m[i][j] = rotationMatrix.m[j][i] * s[j];
+        }
+        result.m[i][3] = t[i];
+    }
+    return result;
+}
+
+Scene::Scene() {}
+
+void Scene::Init()
+{
+    loadPath.clear();
+
+    diffuseMaps.clear();
+    materials.clear();
+    meshes.clear();
+    transforms.clear();
+    instances.clear();
+    cameras.clear();
+    lights.clear();
+    animations.clear();
+    mainCameraID = InvalidCameraID;
+    transformStore.Clear();
+
+    cooked.reset();
+    mappedModels.clear();
+    mappedModelPaths.clear();
+}
+
+// structure only, vectors of structs are checked for bounds and never walked
+static bool isCookedScene(const file::MappedFile& file)
+{
+    flatbuffers::Verifier verifier(file.data(), file.size());
+    return SCookedSceneBufferHasIdentifier(file.data()) && VerifySCookedSceneBuffer(verifier)
+        && GetSCookedScene(file.data())->version() == CookedVersion;
+}
+
+void Scene::Init(const std::string& fbxPath, bool useCooked)
+{
+    M3D_MEMORY_TAG(Scene);
+    Init();
+    loadPath = fbxPath;
+    printf("fbx path: %s\n", loadPath.c_str());
+
+    if (!useCooked) {
+        return;
+    }
+    std::string cookedPath = CookedPath(loadPath);
+    auto file = file::MappedFile::open(cookedPath.c_str());
+    if (!file) {
+        return;
+    }
+    if (!isCookedScene(*file)) {
+        printf("%s is not a cooked scene of this version, run fbxconv again\n", cookedPath.c_str());
+        return;
+    }
+    cooked = file;
+}
+
+bool Scene::Init(std::shared_ptr<const file::MappedFile> cookedFile, const std::string& path)
+{
+    M3D_MEMORY_TAG(Scene);
+    Init();
+    loadPath = path;
+    if (!cookedFile || !isCookedScene(*cookedFile)) {
+        printf("%s is not a cooked scene of this version, run fbxconv again\n", path.c_str());
+        return false;
+    }
+    cooked = cookedFile;
+    return true;
+}
+
+uint32_t Scene::AddTransform(const Transform& transform)
+{
+    uint32_t transformID = transforms.insert(transform);
+    transformStore.Set(transformID, transform);
+    return transformID;
+}
+
+void Scene::SetTransform(uint32_t transformID, const Transform& transform)
+{
+    transforms[transformID] = transform;
+    transformStore.Set(transformID, transform);
+}
+
+void Scene::SetTransforms(const uint32_t* transformIDs, const m3d::math::Matrix4x4* matrices, size_t count)
+{
+    std::vector<m3d::math::Vector3> positions(count);
+    std::vector<m3d::math::Vector3> scales(count);
+    std::vector<m3d::math::Quaternion> rotations(count);
+    m3d::math::MatrixDecomposeArray(matrices, positions.data(), scales.data(), rotations.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+        Transform transform;
+        transform.position = positions[i];
+        transform.rotation = rotations[i];
+        transform.scale = scales[i];
+        SetTransform(transformIDs[i], transform);
+    }
+}
+
+void Scene::SetParent(uint32_t transformID, uint32_t parentID)
+{
+    transformStore.SetParent(transformID, parentID);
+}
+
+void Scene::RemoveTransform(uint32_t transformID)
+{
+    transforms.erase(transformID);
+    transformStore.Remove(transformID);
+}
+
+uint32_t Scene::AddInstance(uint32_t meshID, const Transform& transform)
+{
+    Instance instance;
+    instance.meshId = meshID;
+    instance.transformId = AddTransform(transform);
+    return instances.insert(instance);
+}
+
+void Scene::RemoveInstance(uint32_t instanceID)
+{
+    instances.erase(instanceID);
+}
+
+void Scene::SetSliceMaterial(uint32_t meshID, uint32_t slice, uint32_t materialID)
+{
+    Mesh& mesh = meshes[meshID];
+    if (mesh.materialIds.size() <= slice) {
+        // no material for the slices in between, as for an id past every slot
+        mesh.materialIds.resize(slice + 1, 0xFFFFFFFF);
+    }
+    mesh.materialIds[slice] = materialID;
+}
+
+uint32_t Scene::FindMesh(StringId name)
+{
+    return meshNames.Find(meshes, name);
+}
+
+uint32_t Scene::FindMaterial(StringId name)
+{
+    return materialNames.Find(materials, name);
+}
+
+size_t Scene::ReleaseGeometry()
+{
+    size_t bytes = 0;
+    for (uint32_t meshID : meshes) {
+        Mesh& mesh = meshes[meshID];
+        if (mesh.resident) {
+            bytes += mesh.ReleaseGeometry(mesh.cpuGeometry == Mesh::CpuGeometry::Default ? cpuGeometry : mesh.cpuGeometry);
+        }
+    }
+    return bytes;
+}
+
+std::string CookedPath(const std::string& fbxPath)
+{
+    return fbxPath.substr(0, fbxPath.find_last_of('.')) + "." + SCookedSceneExtension();
+}
+
+uint32_t CookedSceneVersion()
+{
+    return CookedVersion;
+}
+
+static SAabb toSAabb(const Aabb& box)
+{
+    return SAabb(SVector3(box.lower[0], box.lower[1], box.lower[2]), SVector3(box.upper[0], box.upper[1], box.upper[2]));
+}
+
+static Aabb fromSAabb(const SAabb& box)
+{
+    Aabb result;
+    const SVector3* corners[2] = { &box.lower(), &box.upper() };
+    float* targets[2] = { result.lower, result.upper };
+    for (int i = 0; i < 2; ++i) {
+        targets[i][0] = corners[i]->x();
+        targets[i][1] = corners[i]->y();
+        targets[i][2] = corners[i]->z();
+    }
+    return result;
+}
+
+static flatbuffers::Offset<SCookedMaterial> writeCookedMaterial(flatbuffers::FlatBufferBuilder& fbb, const Material& material, uint32_t diffuseMapId)
+{
+    SVector3 ambient(material.ambient[0], material.ambient[1], material.ambient[2]);
+    SVector3 diffuse(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+    SVector3 specular(material.specular[0], material.specular[1], material.specular[2]);
+    return CreateSCookedMaterial(fbb, fbb.CreateString(material.name.str()), &ambient, &diffuse, &specular, material.shininess, diffuseMapId,
+        material.opacity, static_cast<uint8_t>(material.blend));
+}
+
+static SCookedTransform toCookedTransform(const Transform& transform)
+{
+    return SCookedTransform(SVector3(transform.position.x, transform.position.y, transform.position.z),
+        SQuaternion(transform.rotation.x, transform.rotation.y, transform.rotation.z, transform.rotation.w),
+        SVector3(transform.scale.x, transform.scale.y, transform.scale.z));
+}
+
+bool CookScene(const Scene& scene, const std::string& path, bool compressGeometry)
+{
+    flatbuffers::FlatBufferBuilder fbb(64 * 1024 * 1024);
+
+    std::unordered_map<uint32_t, uint32_t> meshIndices;
+    std::vector<flatbuffers::Offset<SCookedMesh>> cookedMeshes;
+    for (uint32_t meshID : scene.meshes) {
+        const Mesh& mesh = scene.meshes[meshID];
+        std::vector<SSlice> slices;
+        std::vector<SAabb> sliceBounds;
+        for (const auto& slice : mesh.slices) {
+            slices.emplace_back(slice.indexOffset, slice.triangleCount);
+            sliceBounds.push_back(toSAabb(slice.bounds));
+        }
+        std::vector<SSlice> lodSlices;
+        std::vector<float> lodErrors;
+        for (const auto& lod : mesh.lods) {
+            for (const auto& slice : lod.slices) {
+                lodSlices.emplace_back(slice.indexOffset, slice.triangleCount);
+            }
+            lodErrors.push_back(lod.error);
+        }
+        std::vector<SMeshlet> meshlets;
+        for (const auto& meshlet : mesh.meshlets) {
+            meshlets.emplace_back(meshlet.slice, meshlet.indexOffset, meshlet.triangleCount, meshlet.coneCutoff,
+                SSphere(meshlet.sphere[0], meshlet.sphere[1], meshlet.sphere[2], meshlet.sphere[3]),
+                SVector3(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]));
+        }
+        SSphere bounds(mesh.boundingSphere[0], mesh.boundingSphere[1], mesh.boundingSphere[2], mesh.boundingSphere[3]);
+        SAabb aabb = toSAabb(mesh.bounds);
+        flatbuffers::Offset<flatbuffers::Vector<const SPackedVertex*>> vertices;
+        flatbuffers::Offset<flatbuffers::Vector<uint32_t>> indices;
+        flatbuffers::Offset<flatbuffers::Vector<uint16_t>> shortIndices;
+        flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encodedVertices, encodedIndices;
+        flatbuffers::Offset<flatbuffers::Vector<const SCodecChunk*>> vertexChunks, indexChunks;
+        if (compressGeometry) {
+            std::vector<uint8_t> data;
+            std::vector<CodecChunk> chunks;
+            EncodeVertices(mesh.vertexData(), mesh.vertexCount(), data, chunks);
+            encodedVertices = fbb.CreateVector(data);
+            vertexChunks = fbb.CreateVectorOfStructs(reinterpret_cast<const SCodecChunk*>(chunks.data()), chunks.size());
+
+            std::vector<uint32_t> wide(mesh.indexCount());
+            for (size_t i = 0; i < wide.size(); ++i) {
+                wide[i] = mesh.index(i);
+            }
+            data.clear();
+            chunks.clear();
+            EncodeIndices(wide.data(), wide.size(), data, chunks);
+            encodedIndices = fbb.CreateVector(data);
+            indexChunks = fbb.CreateVectorOfStructs(reinterpret_cast<const SCodecChunk*>(chunks.data()), chunks.size());
+        } else {
+            vertices = fbb.CreateVectorOfStructs(reinterpret_cast<const SPackedVertex*>(mesh.vertexData()), mesh.vertexCount());
+            // half the index bytes for every mesh whose vertices 16 bit indices reach
+            if (mesh.indexType() == vk::IndexType::eUint16) {
+                std::vector<uint16_t> narrowed(mesh.indexCount());
+                for (size_t i = 0; i < narrowed.size(); ++i) {
+                    narrowed[i] = static_cast<uint16_t>(mesh.index(i));
+                }
+                shortIndices = fbb.CreateVector(narrowed);
+            } else {
+                indices = fbb.CreateVector(mesh.indexData(), mesh.indexCount());
+            }
+        }
+        std::vector<flatbuffers::Offset<flatbuffers::String>> morphNames;
+        std::vector<uint32_t> morphDeltaCounts;
+        for (const Mesh::MorphTarget& target : mesh.morphTargets) {
+            morphNames.push_back(fbb.CreateString(target.name));
+            morphDeltaCounts.push_back(target.deltaCount);
+        }
+        meshIndices[meshID] = static_cast<uint32_t>(cookedMeshes.size());
+        cookedMeshes.push_back(CreateSCookedMesh(fbb, fbb.CreateString(mesh.name.str()), vertices, indices,
+            fbb.CreateVectorOfStructs(slices.data(), slices.size()), fbb.CreateVector(mesh.materialIds), &bounds, &aabb,
+            fbb.CreateVectorOfStructs(sliceBounds.data(), sliceBounds.size()),
+            fbb.CreateVectorOfStructs(lodSlices.data(), lodSlices.size()), fbb.CreateVector(lodErrors), shortIndices,
+            fbb.CreateVectorOfStructs(meshlets.data(), meshlets.size()), encodedVertices, vertexChunks, encodedIndices, indexChunks,
+            fbb.CreateVector(morphNames), fbb.CreateVector(morphDeltaCounts),
+            fbb.CreateVectorOfStructs(reinterpret_cast<const SMorphDelta*>(mesh.morphDeltas.data()), mesh.morphDeltas.size())));
+    }
+
+    std::vector<flatbuffers::Offset<SCookedMaterial>> cookedMaterials;
+    for (uint32_t materialID : scene.materials) {
+        const Material& material = scene.materials[materialID];
+        cookedMaterials.push_back(writeCookedMaterial(fbb, material, material.diffuseMapId));
+    }
+
+    std::unordered_map<uint32_t, uint32_t> transformIndices;
+    std::vector<SCookedTransform> cookedTransforms;
+    for (uint32_t transformID : scene.transforms) {
+        transformIndices[transformID] = static_cast<uint32_t>(cookedTransforms.size());
+        cookedTransforms.push_back(toCookedTransform(scene.transforms[transformID]));
+    }
+
+    std::vector<uint32_t> cookedParents;
+    for (uint32_t transformID : scene.transforms) {
+        auto parent = transformIndices.find(scene.transformStore.GetParent(transformID));
+        cookedParents.push_back(parent != transformIndices.end() ? parent->second : TransformStore::NoParent);
+    }
+
+    std::vector<SCookedInstance> cookedInstances;
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        auto mesh = meshIndices.find(instance.meshId);
+        auto transform = transformIndices.find(instance.transformId);
+        if (mesh != meshIndices.end() && transform != transformIndices.end()) {
+            cookedInstances.emplace_back(mesh->second, transform->second);
+        }
+    }
+
+    std::vector<flatbuffers::Offset<flatbuffers::String>> cookedTextures;
+    for (uint32_t diffuseMapID : scene.diffuseMaps) {
+        cookedTextures.push_back(fbb.CreateString(scene.diffuseMaps[diffuseMapID].path));
+    }
+
+    std::vector<flatbuffers::Offset<SCookedClip>> cookedClips;
+    for (const Animation& animation : scene.animations) {
+        const animation::AnimationClip& clip = animation.clip;
+        std::vector<uint32_t> targets;
+        for (uint32_t transformID : animation.transformIds) {
+            auto transform = transformIndices.find(transformID);
+            targets.push_back(transform != transformIndices.end() ? transform->second : TransformStore::NoParent);
+        }
+        cookedClips.push_back(CreateSCookedClip(fbb, fbb.CreateString(animation.name), clip.sampleRate, clip.frameCount,
+            fbb.CreateVectorOfStructs(reinterpret_cast<const SAnimationTrack*>(clip.tracks.data()), clip.tracks.size()),
+            fbb.CreateVector(targets),
+            fbb.CreateVectorOfStructs(reinterpret_cast<const SRotationKey*>(clip.rotationKeys.data()), clip.rotationKeys.size()),
+            fbb.CreateVectorOfStructs(reinterpret_cast<const SVectorKey*>(clip.translationKeys.data()), clip.translationKeys.size()),
+            fbb.CreateVectorOfStructs(reinterpret_cast<const SScalarKey*>(clip.scaleKeys.data()), clip.scaleKeys.size())));
+    }
+
+    auto root = CreateSCookedScene(fbb, CookedVersion, fbb.CreateString(scene.loadPath), fbb.CreateVector(cookedMeshes),
+        fbb.CreateVector(cookedMaterials), fbb.CreateVectorOfStructs(cookedTransforms.data(), cookedTransforms.size()),
+        fbb.CreateVectorOfStructs(cookedInstances.data(), cookedInstances.size()), fbb.CreateVector(cookedParents),
+        fbb.CreateVector(cookedTextures), fbb.CreateVector(cookedClips));
+    FinishSCookedSceneBuffer(fbb, root);
+
+    return file::writeBinary(path.c_str(), fbb.GetBufferPointer(), fbb.GetSize());
+}
+
+/* Zero copy: vertex and index data stay in the mapping, GeometryArena stages straight from it */
+/* Vertex and index chunks of the encoded meshes decode in parallel into their packedVertices and indices.
+   A mesh with a chunk that does not decode is left without geometry. With Scene::gpuGeometryDecode the meshes
+   only point at their chunks, released until a GpuMeshDecoder or RestoreGeometry decodes them */
+static void decodeGeometry(Scene* pScene, const std::vector<std::pair<const SCookedMesh*, uint32_t>>& encoded, uint32_t threadCount)
+{
+    struct ChunkTask {
+        const flatbuffers::Vector<uint8_t>* data;
+        CodecChunk chunk;
+        // into the vertices or the indices of encoded[item]
+        bool vertices;
+        uint32_t item;
+    };
+    std::vector<ChunkTask> tasks;
+    std::vector<uint8_t> corrupt(encoded.size(), 0);
+    for (uint32_t e = 0; e < encoded.size(); ++e) {
+        const SCookedMesh* cookedMesh = encoded[e].first;
+        Mesh& mesh = pScene->meshes[encoded[e].second];
+        for (int stream = 0; stream < 2; ++stream) {
+            const auto* chunks = stream == 0 ? cookedMesh->vertexChunks() : cookedMesh->indexChunks();
+            size_t count = 0;
+            for (uint32_t c = 0; c < chunks->size(); ++c) {
+                const SCodecChunk* chunk = chunks->Get(c);
+                count = std::max<size_t>(count, static_cast<size_t>(chunk->first()) + chunk->count());
+                tasks.push_back({ stream == 0 ? cookedMesh->encodedVertices() : cookedMesh->encodedIndices(),
+                    *reinterpret_cast<const CodecChunk*>(chunk), stream == 0, e });
+            }
+            if (pScene->gpuGeometryDecode) {
+                (stream == 0 ? mesh.releasedVertexCount : mesh.releasedIndexCount) = static_cast<uint32_t>(count);
+                mesh.geometryReleased = true;
+            } else if (stream == 0) {
+                mesh.packedVertices.resize(count);
+            } else {
+                mesh.indices.resize(count);
+            }
+            // released geometry decodes again from the mapping
+            const auto* encodedStream = stream == 0 ? cookedMesh->encodedVertices() : cookedMesh->encodedIndices();
+            std::vector<CodecChunk>& meshChunks = stream == 0 ? mesh.vertexChunks : mesh.indexChunks;
+            meshChunks.assign(reinterpret_cast<const CodecChunk*>(chunks->data()), reinterpret_cast<const CodecChunk*>(chunks->data()) + chunks->size());
+            if (stream == 0) {
+                mesh.mappedEncodedVertices = encodedStream->data();
+                mesh.mappedEncodedVertexBytes = encodedStream->size();
+            } else {
+                mesh.mappedEncodedIndices = encodedStream->data();
+                mesh.mappedEncodedIndexBytes = encodedStream->size();
+            }
+        }
+    }
+
+    if (pScene->gpuGeometryDecode) {
+        return;
+    }
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<uint8_t> failed(tasks.size(), 0);
+    {
+        ThreadPool pool(std::max<uint32_t>(1, std::min<uint32_t>(threadCount, static_cast<uint32_t>(tasks.size()))));
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            Mesh* mesh = &pScene->meshes[encoded[tasks[t].item].second];
+            pool.Enqueue([&tasks, &failed, mesh, t]() {
+                const ChunkTask& task = tasks[t];
+                const bool decoded = task.vertices ? DecodeVertexChunk(task.data->data(), task.data->size(), task.chunk, mesh->packedVertices.data())
+                                                   : DecodeIndexChunk(task.data->data(), task.data->size(), task.chunk, mesh->indices.data());
+                failed[t] = decoded ? 0 : 1;
+            });
+        }
+        pool.Wait();
+    }
+
+    for (size_t t = 0; t < tasks.size(); ++t) {
+        corrupt[tasks[t].item] |= failed[t];
+    }
+    for (uint32_t e = 0; e < encoded.size(); ++e) {
+        Mesh& mesh = pScene->meshes[encoded[e].second];
+        // indices past the vertices would read outside of the mesh's block on the GPU
+        for (size_t i = 0; i < mesh.indices.size() && !corrupt[e]; ++i) {
+            corrupt[e] = mesh.indices[i] >= mesh.packedVertices.size() ? 1 : 0;
+        }
+        if (corrupt[e]) {
+            printf("Scene: mesh %s has corrupt compressed geometry, dropped it\n", mesh.name.c_str());
+            mesh.packedVertices.clear();
+            mesh.indices.clear();
+            mesh.slices.clear();
+            mesh.lods.clear();
+            mesh.meshlets.clear();
+        }
+    }
+}
+
+/* Everything of a cooked mesh but its encoded geometry, which decodeGeometry fills in */
+static Mesh readCookedMesh(const SCookedMesh* cookedMesh)
+{
+    Mesh mesh;
+    if (cookedMesh->name()) {
+        mesh.name = StringId(cookedMesh->name()->c_str(), cookedMesh->name()->size());
+    }
+    if (cookedMesh->vertices() && cookedMesh->indices()) {
+        mesh.mappedVertices = reinterpret_cast<const PackedVertex*>(cookedMesh->vertices()->Data());
+        mesh.mappedVertexCount = cookedMesh->vertices()->size();
+        mesh.mappedIndices = cookedMesh->indices()->data();
+        mesh.mappedIndexCount = cookedMesh->indices()->size();
+    } else if (cookedMesh->vertices() && cookedMesh->shortIndices()) {
+        mesh.mappedVertices = reinterpret_cast<const PackedVertex*>(cookedMesh->vertices()->Data());
+        mesh.mappedVertexCount = cookedMesh->vertices()->size();
+        mesh.mappedShortIndices = cookedMesh->shortIndices()->data();
+        mesh.mappedIndexCount = cookedMesh->shortIndices()->size();
+    }
+    if (cookedMesh->slices()) {
+        const auto* sliceBounds = cookedMesh->sliceBounds();
+        for (uint32_t i = 0; i < cookedMesh->slices()->size(); ++i) {
+            const SSlice* slice = cookedMesh->slices()->Get(i);
+            mesh.slices.emplace_back(slice->indexOffset(), slice->triangleCount());
+            if (sliceBounds && i < sliceBounds->size()) {
+                mesh.slices.back().bounds = fromSAabb(*sliceBounds->Get(i));
+            }
+        }
+    }
+    if (cookedMesh->lodSlices() && cookedMesh->lodErrors() && !mesh.slices.empty()) {
+        const auto* lodSlices = cookedMesh->lodSlices();
+        const uint32_t sliceCount = static_cast<uint32_t>(mesh.slices.size());
+        for (uint32_t l = 0; l < cookedMesh->lodErrors()->size() && (l + 1) * sliceCount <= lodSlices->size(); ++l) {
+            Mesh::Lod lod;
+            lod.error = cookedMesh->lodErrors()->Get(l);
+            for (uint32_t i = 0; i < sliceCount; ++i) {
+                const SSlice* slice = lodSlices->Get(l * sliceCount + i);
+                lod.slices.emplace_back(slice->indexOffset(), slice->triangleCount());
+                lod.slices.back().bounds = mesh.slices[i].bounds;
+            }
+            mesh.lods.push_back(lod);
+        }
+    }
+    if (const auto* meshlets = cookedMesh->meshlets()) {
+        mesh.meshlets.resize(meshlets->size());
+        for (uint32_t i = 0; i < meshlets->size(); ++i) {
+            const SMeshlet* cooked = meshlets->Get(i);
+            Mesh::Meshlet& meshlet = mesh.meshlets[i];
+            meshlet.slice = cooked->slice();
+            meshlet.indexOffset = cooked->indexOffset();
+            meshlet.triangleCount = cooked->triangleCount();
+            meshlet.sphere[0] = cooked->sphere().x();
+            meshlet.sphere[1] = cooked->sphere().y();
+            meshlet.sphere[2] = cooked->sphere().z();
+            meshlet.sphere[3] = cooked->sphere().radius();
+            meshlet.coneAxis[0] = cooked->coneAxis().x();
+            meshlet.coneAxis[1] = cooked->coneAxis().y();
+            meshlet.coneAxis[2] = cooked->coneAxis().z();
+            meshlet.coneCutoff = cooked->coneCutoff();
+        }
+    }
+    if (cookedMesh->morphNames() && cookedMesh->morphDeltaCounts() && cookedMesh->morphDeltas()
+        && cookedMesh->morphNames()->size() == cookedMesh->morphDeltaCounts()->size()) {
+        const animation::MorphDelta* deltas = reinterpret_cast<const animation::MorphDelta*>(cookedMesh->morphDeltas()->Data());
+        mesh.morphDeltas.assign(deltas, deltas + cookedMesh->morphDeltas()->size());
+        uint32_t firstDelta = 0;
+        for (uint32_t t = 0; t < cookedMesh->morphNames()->size(); ++t) {
+            Mesh::MorphTarget target;
+            target.name = cookedMesh->morphNames()->Get(t)->str();
+            target.firstDelta = firstDelta;
+            target.deltaCount = cookedMesh->morphDeltaCounts()->Get(t);
+            firstDelta += target.deltaCount;
+            mesh.morphTargets.push_back(target);
+        }
+        if (firstDelta != mesh.morphDeltas.size()) {
+            printf("Scene: mesh %s has corrupt morph targets, dropped them\n", mesh.name.c_str());
+            mesh.morphTargets.clear();
+            mesh.morphDeltas.clear();
+        }
+    }
+    if (const SAabb* aabb = cookedMesh->aabb()) {
+        mesh.bounds = fromSAabb(*aabb);
+    }
+    if (cookedMesh->materialIds()) {
+        const uint32_t* materialIds = cookedMesh->materialIds()->data();
+        mesh.materialIds.assign(materialIds, materialIds + cookedMesh->materialIds()->size());
+    }
+    if (const SSphere* bounds = cookedMesh->bounds()) {
+        mesh.boundingSphere[0] = bounds->x();
+        mesh.boundingSphere[1] = bounds->y();
+        mesh.boundingSphere[2] = bounds->z();
+        mesh.boundingSphere[3] = bounds->radius();
+    }
+    return mesh;
+}
+
+static Material readCookedMaterial(const SCookedMaterial* cookedMaterial)
+{
+    Material material = {};
+    if (cookedMaterial->name()) {
+        material.name = StringId(cookedMaterial->name()->c_str(), cookedMaterial->name()->size());
+    }
+    const SVector3* colors[3] = { cookedMaterial->ambient(), cookedMaterial->diffuse(), cookedMaterial->specular() };
+    float* targets[3] = { material.ambient, material.diffuse, material.specular };
+    for (int i = 0; i < 3; ++i) {
+        if (colors[i]) {
+            targets[i][0] = colors[i]->x();
+            targets[i][1] = colors[i]->y();
+            targets[i][2] = colors[i]->z();
+        }
+    }
+    material.shininess = cookedMaterial->shininess();
+    material.diffuseMapId = cookedMaterial->diffuseMapId();
+    material.opacity = cookedMaterial->opacity();
+    material.blend = cookedMaterial->blend() == static_cast<uint8_t>(Material::Blend::WeightedBlended) ? Material::Blend::WeightedBlended
+                                                                                                  : Material::Blend::Opaque;
+    return material;
+}
+
+static Transform readCookedTransform(const SCookedTransform* cookedTransform)
+{
+    Transform transform;
+    transform.position = m3d::math::Vector3(cookedTransform->position().x(), cookedTransform->position().y(), cookedTransform->position().z());
+    transform.rotation = m3d::math::Quaternion(cookedTransform->rotation().x(), cookedTransform->rotation().y(),
+        cookedTransform->rotation().z(), cookedTransform->rotation().w());
+    transform.scale = m3d::math::Vector3(cookedTransform->scale().x(), cookedTransform->scale().y(), cookedTransform->scale().z());
+    return transform;
+}
+
+static void loadCooked(Scene* pScene, std::vector<uint32_t>* loadedMeshIDs, uint32_t threadCount, LoadStats* stats)
+{
+    const SCookedScene* cookedScene = GetSCookedScene(pScene->cooked->data());
+
+    std::vector<uint32_t> meshIDs;
+    // meshes whose geometry is MeshCodec encoded, decoded once they are all in the scene
+    std::vector<std::pair<const SCookedMesh*, uint32_t>> encoded;
+    if (cookedScene->meshes()) {
+        for (uint32_t m = 0; m < cookedScene->meshes()->size(); ++m) {
+            const SCookedMesh* cookedMesh = cookedScene->meshes()->Get(m);
+            uint32_t meshID = pScene->meshes.insert(readCookedMesh(cookedMesh));
+            if (cookedMesh->encodedVertices() && cookedMesh->vertexChunks() && cookedMesh->encodedIndices() && cookedMesh->indexChunks()) {
+                encoded.emplace_back(cookedMesh, meshID);
+            }
+            meshIDs.push_back(meshID);
+            if (loadedMeshIDs) {
+                loadedMeshIDs->push_back(meshID);
+            }
+        }
+    }
+
+    if (!encoded.empty()) {
+        auto tDecode = std::chrono::high_resolution_clock::now();
+        decodeGeometry(pScene, encoded, threadCount);
+        if (stats) {
+            stats->decodeMs = msSince(tDecode);
+        }
+    }
+
+    if (cookedScene->materials()) {
+        for (uint32_t m = 0; m < cookedScene->materials()->size(); ++m) {
+            pScene->materials.insert(readCookedMaterial(cookedScene->materials()->Get(m)));
+        }
+    }
+
+    std::vector<uint32_t> transformIDs;
+    if (cookedScene->transforms()) {
+        for (uint32_t t = 0; t < cookedScene->transforms()->size(); ++t) {
+            transformIDs.push_back(pScene->AddTransform(readCookedTransform(cookedScene->transforms()->Get(t))));
+        }
+    }
+    if (cookedScene->parents() && cookedScene->parents()->size() == transformIDs.size()) {
+        for (uint32_t t = 0; t < transformIDs.size(); ++t) {
+            uint32_t parent = cookedScene->parents()->Get(t);
+            if (parent < transformIDs.size() && parent != t) {
+                pScene->SetParent(transformIDs[t], transformIDs[parent]);
+            }
+        }
+    }
+
+    if (cookedScene->clips()) {
+        for (uint32_t c = 0; c < cookedScene->clips()->size(); ++c) {
+            const SCookedClip* cookedClip = cookedScene->clips()->Get(c);
+            if (!cookedClip->tracks() || !cookedClip->targets() || !cookedClip->rotationKeys() || !cookedClip->translationKeys()
+                || !cookedClip->scaleKeys() || cookedClip->targets()->size() != cookedClip->tracks()->size()) {
+                continue;
+            }
+            Animation animation;
+            if (cookedClip->name()) {
+                animation.name = cookedClip->name()->str();
+            }
+            animation::AnimationClip& clip = animation.clip;
+            clip.sampleRate = cookedClip->sampleRate();
+            clip.frameCount = cookedClip->frameCount();
+            clip.jointCount = cookedClip->tracks()->size();
+            const auto* tracks = reinterpret_cast<const animation::AnimationTrack*>(cookedClip->tracks()->Data());
+            const auto* rotationKeys = reinterpret_cast<const animation::RotationKey*>(cookedClip->rotationKeys()->Data());
+            const auto* translationKeys = reinterpret_cast<const animation::VectorKey*>(cookedClip->translationKeys()->Data());
+            const auto* scaleKeys = reinterpret_cast<const animation::ScalarKey*>(cookedClip->scaleKeys()->Data());
+            clip.tracks.assign(tracks, tracks + clip.jointCount);
+            clip.rotationKeys.assign(rotationKeys, rotationKeys + cookedClip->rotationKeys()->size());
+            clip.translationKeys.assign(translationKeys, translationKeys + cookedClip->translationKeys()->size());
+            clip.scaleKeys.assign(scaleKeys, scaleKeys + cookedClip->scaleKeys()->size());
+
+            // the key ranges index the key vectors, checked once here instead of on every sample
+            bool valid = true;
+            for (const animation::AnimationTrack& track : clip.tracks) {
+                valid = valid && track.rotationCount && track.translationCount && track.scaleCount
+                    && track.rotationFirst + track.rotationCount <= clip.rotationKeys.size()
+                    && track.translationFirst + track.translationCount <= clip.translationKeys.size()
+                    && track.scaleFirst + track.scaleCount <= clip.scaleKeys.size();
+            }
+            for (uint32_t t = 0; valid && t < clip.jointCount; ++t) {
+                uint32_t target = cookedClip->targets()->Get(t);
+                valid = target < transformIDs.size();
+                if (valid) {
+                    animation.transformIds.push_back(transformIDs[target]);
+                }
+            }
+            if (valid) {
+                pScene->animations.push_back(std::move(animation));
+            }
+        }
+    }
+
+    if (cookedScene->textures()) {
+        for (uint32_t t = 0; t < cookedScene->textures()->size(); ++t) {
+            DiffuseMap diffuseMap;
+            diffuseMap.path = cookedScene->textures()->Get(t)->str();
+            pScene->diffuseMaps.insert(diffuseMap);
+        }
+    }
+
+    if (cookedScene->instances()) {
+        for (uint32_t i = 0; i < cookedScene->instances()->size(); ++i) {
+            const SCookedInstance* cookedInstance = cookedScene->instances()->Get(i);
+            if (cookedInstance->mesh() >= meshIDs.size() || cookedInstance->transform() >= transformIDs.size()) {
+                continue;
+            }
+            Instance instance;
+            instance.meshId = meshIDs[cookedInstance->mesh()];
+            instance.transformId = transformIDs[cookedInstance->transform()];
+            pScene->instances.insert(instance);
+        }
+    }
+}
+
+/* The absolute path stored at export time, else the relative one next to the FBX, empty if neither exists */
+static std::string resolveTexturePath(const std::string& fbxPath, FbxFileTexture* pFbxFileTexture)
+{
+    const char* absolute = pFbxFileTexture->GetFileName();
+    if (absolute && flatbuffers::FileExists(absolute)) {
+        return absolute;
+    }
+    const char* relative = pFbxFileTexture->GetRelativeFileName();
+    if (!relative || !relative[0]) {
+        return std::string();
+    }
+    size_t separator = fbxPath.find_last_of("/\\");
+    std::string path = separator == std::string::npos ? relative : fbxPath.substr(0, separator + 1) + relative;
+    return flatbuffers::FileExists(path.c_str()) ? path : std::string();
+}
+
+bool Light::init(FbxLight* pFbxLight)
+{
+    switch (pFbxLight->LightType.Get()) {
+    case FbxLight::ePoint:
+        type = Point;
+        break;
+    case FbxLight::eSpot:
+        type = Spot;
+        break;
+    case FbxLight::eDirectional:
+        type = Directional;
+        break;
+    default:
+        return false;
+    }
+
+    FbxDouble3 fbxColor = pFbxLight->Color.Get();
+    for (int c = 0; c < 3; ++c) {
+        color[c] = static_cast<float>(fbxColor[c]);
+    }
+    // FBX intensities are percent
+    intensity = static_cast<float>(pFbxLight->Intensity.Get() / 100.0);
+    if (pFbxLight->EnableFarAttenuation.Get()) {
+        range = static_cast<float>(pFbxLight->FarAttenuationEnd.Get());
+    } else {
+        // where the inverse square falloff drops below 1/256 of the intensity
+        range = 16.0f * std::sqrt(std::max(intensity, 0.0f));
+    }
+    // the FBX cone angles are full angles in degrees
+    const float degreesToHalfRadians = 3.14159265f / 360.0f;
+    outerCone = static_cast<float>(pFbxLight->OuterAngle.Get()) * degreesToHalfRadians;
+    innerCone = std::min(static_cast<float>(pFbxLight->InnerAngle.Get()) * degreesToHalfRadians, outerCone);
+    return true;
+}
+
+/* color times its factor, fallback where the material lacks the color */
+static void readColor(FbxSurfaceMaterial* pFbxMaterial, const char* colorName, const char* factorName, float fallback, float* color)
+{
+    FbxProperty colorProperty = pFbxMaterial->FindProperty(colorName);
+    if (!colorProperty.IsValid()) {
+        color[0] = color[1] = color[2] = fallback;
+        return;
+    }
+    FbxDouble3 fbxColor = colorProperty.Get<FbxDouble3>();
+    FbxProperty factorProperty = pFbxMaterial->FindProperty(factorName);
+    const double factor = factorProperty.IsValid() ? factorProperty.Get<FbxDouble>() : 1.0;
+    for (int c = 0; c < 3; ++c) {
+        color[c] = static_cast<float>(fbxColor[c] * factor);
+    }
+}
 
-namespace m3d {
-bool Mesh::init(FbxMesh* pFbxMesh)
+bool Material::init(FbxSurfaceMaterial* pFbxMaterial)
 {
-    uint32_t normalCount = pFbxMesh->GetElementNormalCount();
-    uint32_t uvCount = pFbxMesh->GetElementUVCount();
-    FbxGeometryElement::EMappingMode normalMappingMode = normalCount ? pFbxMesh->GetElementNormal(0)->GetMappingMode()
-                                                                     : FbxGeometryElement::eNone;
-    FbxGeometryElement::EMappingMode uvMappingModel = uvCount ? pFbxMesh->GetElementUV(0)->GetMappingMode()
-                                                              : FbxGeometryElement::eNone;
+    name = StringId(pFbxMaterial->GetName());
+    // Lambert and Phong both use the FbxSurfaceMaterial property names, Lambert has no specular
+    readColor(pFbxMaterial, FbxSurfaceMaterial::sAmbient, FbxSurfaceMaterial::sAmbientFactor, 0.0f, ambient);
+    readColor(pFbxMaterial, FbxSurfaceMaterial::sDiffuse, FbxSurfaceMaterial::sDiffuseFactor, 1.0f, diffuse);
+    readColor(pFbxMaterial, FbxSurfaceMaterial::sSpecular, FbxSurfaceMaterial::sSpecularFactor, 0.0f, specular);
+    FbxProperty shininessProperty = pFbxMaterial->FindProperty(FbxSurfaceMaterial::sShininess);
+    shininess = shininessProperty.IsValid() ? static_cast<float>(shininessProperty.Get<FbxDouble>()) : 0.0f;
+    diffuseMapId = 0xFFFFFFFF;
+    // transparent color times its factor, one channel of coverage for all three
+    float transparent[3];
+    readColor(pFbxMaterial, FbxSurfaceMaterial::sTransparentColor, FbxSurfaceMaterial::sTransparencyFactor, 0.0f, transparent);
+    opacity = std::min(1.0f, std::max(0.0f, 1.0f - (transparent[0] + transparent[1] + transparent[2]) / 3.0f));
+    blend = opacity < 1.0f ? Blend::WeightedBlended : Blend::Opaque;
+    return true;
+}
 
-    bool hasNormal = normalMappingMode != FbxGeometryElement::eNone;
-    bool hasUV = uvMappingModel != FbxGeometryElement::eNone;
+/* FNV-1a over what a material looks like, its name aside */
+static uint64_t materialHash(const Material& material)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    mix(material.ambient, sizeof(material.ambient));
+    mix(material.diffuse, sizeof(material.diffuse));
+    mix(material.specular, sizeof(material.specular));
+    mix(&material.shininess, sizeof(material.shininess));
+    mix(&material.diffuseMapId, sizeof(material.diffuseMapId));
+    mix(&material.opacity, sizeof(material.opacity));
+    mix(&material.blend, sizeof(material.blend));
+    return hash;
+}
 
-    bool byControlPoint = hasNormal && normalMappingMode == FbxGeometryElement::eByControlPoint && hasUV && uvMappingModel == FbxGeometryElement::eByControlPoint;
+static bool sameMaterial(const Material& a, const Material& b)
+{
+    return memcmp(a.ambient, b.ambient, sizeof(a.ambient)) == 0 && memcmp(a.diffuse, b.diffuse, sizeof(a.diffuse)) == 0
+        && memcmp(a.specular, b.specular, sizeof(a.specular)) == 0 && a.shininess == b.shininess && a.diffuseMapId == b.diffuseMapId
+        && a.opacity == b.opacity && a.blend == b.blend;
+}
 
-    uint32_t polygonCount = pFbxMesh->GetPolygonCount();
-    uint32_t controlPointCount = byControlPoint
-        ? pFbxMesh->GetControlPointsCount()
-        : polygonCount * TRIANGLE_VERTEX_COUNT;
+struct NodeRecord {
+    FbxNode* node;
+    // index into the records, -1 below the FBX root
+    int parent;
+    FbxMesh* mesh;
+    FbxLight* light;
+};
 
-    this->vertices.resize(controlPointCount * VERTEX_STRIDE);
-    this->indices.resize(polygonCount * TRIANGLE_VERTEX_COUNT);
-    if (hasNormal)
-        this->normals.resize(controlPointCount * NORMAL_STRIDE);
+/* Meshes and lights are only collected, materials are converted with the meshes using them */
+static void gatherNodes(FbxNode* pFbxNode, int parent, std::vector<NodeRecord>& nodes, std::vector<FbxMesh*>& fbxMeshes, std::unordered_set<FbxMesh*>& visited)
+{
+    // the FBX root itself is not kept, its children become roots
+    int self = parent;
+    if (pFbxNode->GetParent()) {
+        self = static_cast<int>(nodes.size());
+        NodeRecord record = { pFbxNode, parent, nullptr, nullptr };
+        nodes.push_back(record);
+    }
 
-    FbxStringList uvNames;
-    pFbxMesh->GetUVSetNames(uvNames);
-    const char* pUVName = nullptr;
-    if (hasUV) {
-        this->uvs.resize(controlPointCount * UV_STRIDE);
-        pUVName = uvNames[0];
+    FbxNodeAttribute* nodeAttribute = pFbxNode->GetNodeAttribute();
+    if (nodeAttribute) {
+        // Mesh, shared by every node instancing it
+        if (nodeAttribute->GetAttributeType() == FbxNodeAttribute::eMesh) {
+            FbxMesh* pFbxMesh = pFbxNode->GetMesh();
+            if (pFbxMesh && visited.insert(pFbxMesh).second) {
+                fbxMeshes.push_back(pFbxMesh);
+            }
+            if (pFbxMesh && self >= 0) {
+                nodes[self].mesh = pFbxMesh;
+            }
+        }
+        // Light, one per node like instances, it needs the node's transform
+        else if (nodeAttribute->GetAttributeType() == FbxNodeAttribute::eLight) {
+            if (self >= 0) {
+                nodes[self].light = pFbxNode->GetLight();
+            }
+        }
     }
 
-    /* Vertex Attributes */
-    const FbxVector4* pControlPoints = pFbxMesh->GetControlPoints();
-    FbxVector4 currentVertex;
-    FbxVector4 currentNormal;
-    FbxVector2 currentUV;
-    if (byControlPoint) {
-        const FbxGeometryElementNormal* pNormalElement = nullptr;
-        const FbxGeometryElementUV* pUVElement = nullptr;
-        if (hasNormal)
-            pNormalElement = pFbxMesh->GetElementNormal(0);
-        if (hasUV)
-            pUVElement = pFbxMesh->GetElementUV(0);
+    const int childCount = pFbxNode->GetChildCount();
+    for (int i = 0; i < childCount; ++i) {
+        gatherNodes(pFbxNode->GetChild(i), self, nodes, fbxMeshes, visited);
+    }
+}
 
-        for (uint32_t i = 0; i < controlPointCount; ++i) {
-            currentVertex = pControlPoints[i];
-            this->vertices[i * VERTEX_STRIDE] = static_cast<float>(currentVertex[0]);
-            this->vertices[i * VERTEX_STRIDE + 1] = static_cast<float>(currentVertex[1]);
-            this->vertices[i * VERTEX_STRIDE + 2] = static_cast<float>(currentVertex[2]);
-            this->vertices[i * VERTEX_STRIDE + 3] = 1.0f;
-
-            if (hasNormal) {
-                int normalIndex = i;
-                if (pNormalElement->GetReferenceMode() == FbxLayerElement::eIndexToDirect) {
-                    normalIndex = pNormalElement->GetIndexArray().GetAt(i);
+/* meshIDs[i] is the scene mesh of fbxMeshes[i], UINT32_MAX if it failed to convert */
+static void convertMeshes(const std::vector<FbxMesh*>& fbxMeshes, chunked_freelist<Mesh>& sceneMeshes, std::vector<uint32_t>& meshIDs, uint32_t threadCount,
+    LoadStats* stats)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min<uint32_t>(threadCount, static_cast<uint32_t>(std::max<size_t>(1, fbxMeshes.size())));
+
+    // Mesh::init only reads its FbxMesh, so meshes convert independently into their own slot
+    std::vector<Mesh> converted(fbxMeshes.size());
+    std::vector<uint8_t> succeeded(fbxMeshes.size(), 0);
+    // per mesh, summed once the pool is done
+    std::vector<double> initMs(fbxMeshes.size(), 0.0);
+    std::vector<double> dedupMs(fbxMeshes.size(), 0.0);
+    {
+        ThreadPool pool(threadCount);
+        for (size_t i = 0; i < fbxMeshes.size(); ++i) {
+            pool.Enqueue([&fbxMeshes, &converted, &succeeded, &initMs, &dedupMs, i]() {
+                auto tInit = std::chrono::high_resolution_clock::now();
+                const double dedupBefore = importScratch().dedupMs;
+                succeeded[i] = converted[i].init(fbxMeshes[i]) ? 1 : 0;
+                initMs[i] = msSince(tInit);
+                dedupMs[i] = importScratch().dedupMs - dedupBefore;
+            });
+        }
+        pool.Wait();
+        // the waiting thread helps converting, its scratch does not outlive the import like the workers'
+        importScratch() = ImportScratch();
+    }
+
+    if (stats) {
+        for (size_t i = 0; i < fbxMeshes.size(); ++i) {
+            stats->meshInitMs += initMs[i];
+            stats->dedupMs += dedupMs[i];
+        }
+    }
+
+    // merge in traversal order so mesh IDs do not depend on scheduling
+    meshIDs.assign(fbxMeshes.size(), UINT32_MAX);
+    for (size_t i = 0; i < converted.size(); ++i) {
+        if (succeeded[i]) {
+            meshIDs[i] = sceneMeshes.insert(std::move(converted[i]));
+        }
+    }
+}
+
+/* Mesh::materialIds of every converted mesh, slice s uses material s of the first node instancing the mesh.
+   Materials that look the same, by their content hash, become one scene material */
+static void convertMaterials(Scene* pScene, const std::vector<FbxMesh*>& fbxMeshes, const std::vector<uint32_t>& meshIDs,
+    const std::unordered_map<std::string, uint32_t>& diffuseMapIDs)
+{
+    std::unordered_map<FbxSurfaceMaterial*, uint32_t> materialOfFbxMaterial;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> materialsOfHash;
+    auto convert = [&](FbxSurfaceMaterial* pFbxMaterial) {
+        auto known = materialOfFbxMaterial.find(pFbxMaterial);
+        if (known != materialOfFbxMaterial.end()) {
+            return known->second;
+        }
+        uint32_t materialID = UINT32_MAX;
+        Material material;
+        if (material.init(pFbxMaterial)) {
+            FbxProperty diffuseProperty = pFbxMaterial->FindProperty(FbxSurfaceMaterial::sDiffuse);
+            FbxFileTexture* pFbxFileTexture = diffuseProperty.IsValid() && diffuseProperty.GetSrcObjectCount<FbxFileTexture>() > 0
+                ? diffuseProperty.GetSrcObject<FbxFileTexture>(0)
+                : nullptr;
+            if (pFbxFileTexture) {
+                auto diffuseMap = diffuseMapIDs.find(resolveTexturePath(pScene->loadPath, pFbxFileTexture));
+                if (diffuseMap != diffuseMapIDs.end()) {
+                    material.diffuseMapId = diffuseMap->second;
                 }
-                currentNormal = pNormalElement->GetDirectArray().GetAt(normalIndex);
-                this->normals[i * NORMAL_STRIDE] = static_cast<float>(currentNormal[0]);
-                this->normals[i * NORMAL_STRIDE + 1] = static_cast<float>(currentNormal[1]);
-                this->normals[i * NORMAL_STRIDE + 2] = static_cast<float>(currentNormal[2]);
             }
-
-            if (hasUV) {
-                int uvIndex = i;
-                if (pUVElement->GetReferenceMode() == FbxLayerElement::eIndexToDirect) {
-                    uvIndex = pUVElement->GetIndexArray().GetAt(i);
+            std::vector<uint32_t>& candidates = materialsOfHash[materialHash(material)];
+            for (uint32_t candidate : candidates) {
+                if (sameMaterial(pScene->materials[candidate], material)) {
+                    materialID = candidate;
+                    break;
                 }
-                currentUV = pUVElement->GetDirectArray().GetAt(uvIndex);
-                this->uvs[i * UV_STRIDE] = static_cast<float>(currentUV[0]);
-                this->uvs[i * UV_STRIDE + 1] = static_cast<float>(currentUV[1]);
+            }
+            if (materialID == UINT32_MAX) {
+                materialID = pScene->materials.insert(std::move(material));
+                candidates.push_back(materialID);
             }
         }
-    } // end of byControlPoint
+        materialOfFbxMaterial[pFbxMaterial] = materialID;
+        return materialID;
+    };
 
-    /* Slice the mesh according to materials */
-    FbxLayerElementArrayTemplate<int>* pMaterialIndices = nullptr;
-    FbxGeometryElement::EMappingMode materialMappingMode = FbxGeometryElement::eNone;
-    if (pFbxMesh->GetElementMaterial()) {
-        pMaterialIndices = &pFbxMesh->GetElementMaterial()->GetIndexArray();
-        materialMappingMode = pFbxMesh->GetElementMaterial()->GetMappingMode();
-        if (pMaterialIndices && materialMappingMode == FbxGeometryElement::eByPolygon) {
-            FBX_ASSERT(pMaterialIndices->GetCount() == polygonCount);
-            for (uint32_t i = 0; i < polygonCount; ++i) {
-                const uint32_t materialIndex = pMaterialIndices->GetAt(i);
-                if (materialIndex >= slices.size()) // we meet a new material
-                {
-                    slices.emplace_back(0, 0);
-                }
-                slices[materialIndex].triangleCount += 1;
+    for (size_t i = 0; i < fbxMeshes.size(); ++i) {
+        if (meshIDs[i] == UINT32_MAX) {
+            continue;
+        }
+        Mesh& mesh = pScene->meshes[meshIDs[i]];
+        FbxNode* pFbxNode = fbxMeshes[i]->GetNode();
+        const int materialCount = pFbxNode ? pFbxNode->GetMaterialCount() : 0;
+        mesh.materialIds.assign(mesh.slices.size(), UINT32_MAX);
+        for (size_t s = 0; s < mesh.slices.size() && static_cast<int>(s) < materialCount; ++s) {
+            if (FbxSurfaceMaterial* pFbxMaterial = pFbxNode->GetMaterial(static_cast<int>(s))) {
+                mesh.materialIds[s] = convert(pFbxMaterial);
             }
+        }
+    }
+}
 
-            int offset = 0;
-            for (uint32_t i = 0; i < slices.size(); ++i) {
-                slices[i].indexOffset = offset;
-                offset += slices[i].triangleCount * 3;
-                // this will be reused during per-Polygon processing
-                slices[i].triangleCount = 0;
-            }
-            FBX_ASSERT(offset == polygonCount * 3);
+/* One transform per node with its parent kept, one instance per node that carries a mesh, one light per light node */
+static void buildHierarchy(Scene* pScene, const std::vector<NodeRecord>& nodes, const std::vector<FbxMesh*>& fbxMeshes, const std::vector<uint32_t>& meshIDs,
+    std::vector<uint32_t>& transformIDs)
+{
+    std::unordered_map<FbxMesh*, uint32_t> meshOfFbxMesh;
+    for (size_t i = 0; i < fbxMeshes.size(); ++i) {
+        if (meshIDs[i] != UINT32_MAX) {
+            meshOfFbxMesh[fbxMeshes[i]] = meshIDs[i];
         }
     }
 
-    // There is only one material.
-    if (slices.size() == 0) {
-        slices.emplace_back(0, 0);
+    // every local matrix first, decomposed in one batch; FbxAMatrix is row vector, Matrix4x4 column vector
+    std::vector<m3d::math::Matrix4x4> locals(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const FbxAMatrix local = nodes[i].node->EvaluateLocalTransform();
+        for (int row = 0; row < 4; ++row) {
+            for (int column = 0; column < 4; ++column) {
+                locals[i].m[row][column] = static_cast<float>(local.Get(column, row));
+            }
+        }
     }
+    std::vector<m3d::math::Vector3> positions(nodes.size());
+    std::vector<m3d::math::Vector3> scales(nodes.size());
+    std::vector<m3d::math::Quaternion> rotations(nodes.size());
+    m3d::math::MatrixDecomposeArray(locals.data(), positions.data(), scales.data(), rotations.data(), nodes.size());
 
-    /* Indices */
-    for (uint32_t vertexCount = 0, i = 0; i < polygonCount; ++i) {
-        int materialIndex = 0;
-        if (pMaterialIndices && materialMappingMode == FbxGeometryElement::eByPolygon) {
-            materialIndex = pMaterialIndices->GetAt(i);
+    // records are in depth first order, a parent always has its transform already
+    transformIDs.assign(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        Transform transform;
+        transform.position = positions[i];
+        transform.rotation = rotations[i];
+        transform.scale = scales[i];
+        transformIDs[i] = pScene->AddTransform(transform);
+        if (nodes[i].parent >= 0) {
+            pScene->SetParent(transformIDs[i], transformIDs[nodes[i].parent]);
         }
-        const int indexOffset = slices[materialIndex].indexOffset + slices[materialIndex].triangleCount * 3;
-        for (int v = 0; v < TRIANGLE_VERTEX_COUNT; ++v) {
-            const int controlPointIndex = pFbxMesh->GetPolygonVertex(i, v);
 
-            if (byControlPoint) {
-                this->indices[indexOffset + v] = static_cast<unsigned int>(controlPointIndex);
-            } else {
-                this->indices[indexOffset + v] = static_cast<unsigned int>(vertexCount);
-
-                currentVertex = pControlPoints[controlPointIndex];
-                this->vertices[vertexCount * VERTEX_STRIDE] = static_cast<float>(currentVertex[0]);
-                this->vertices[vertexCount * VERTEX_STRIDE + 1] = static_cast<float>(currentVertex[1]);
-                this->vertices[vertexCount * VERTEX_STRIDE + 2] = static_cast<float>(currentVertex[2]);
-                this->vertices[vertexCount * VERTEX_STRIDE + 3] = 1.0f;
-
-                if (hasNormal) {
-                    pFbxMesh->GetPolygonVertexNormal(i, v, currentNormal);
-                    this->normals[vertexCount * NORMAL_STRIDE] = static_cast<float>(currentNormal[0]);
-                    this->normals[vertexCount * NORMAL_STRIDE + 1] = static_cast<float>(currentNormal[1]);
-                    this->normals[vertexCount * NORMAL_STRIDE + 2] = static_cast<float>(currentNormal[2]);
-                }
+        auto mesh = meshOfFbxMesh.find(nodes[i].mesh);
+        if (mesh != meshOfFbxMesh.end()) {
+            Instance instance;
+            instance.meshId = mesh->second;
+            instance.transformId = transformIDs[i];
+            pScene->instances.insert(instance);
+        }
 
-                if (hasUV) {
-                    bool bUnmappedUV;
-                    pFbxMesh->GetPolygonVertexUV(i, v, pUVName, currentUV, bUnmappedUV);
-                    this->uvs[vertexCount * UV_STRIDE] = static_cast<float>(currentUV[0]);
-                    this->uvs[vertexCount * UV_STRIDE] = static_cast<float>(currentUV[1]);
-                }
-            }
-            ++vertexCount;
+        Light light;
+        if (nodes[i].light && light.init(nodes[i].light)) {
+            light.transformId = transformIDs[i];
+            pScene->lights.insert(light);
         }
-        slices[materialIndex].triangleCount += 1;
     }
-
-    return true;
 }
 
-Scene::Scene() {}
-
-void Scene::Init()
+static animation::JointPose toJointPose(const FbxAMatrix& local)
 {
-    std::vector<uint8_t> sceneData;
-    m3d::file::readBinary("D:\\workspace\\m3d\\data\\schema\\scene_data.bin", sceneData);
-    auto mainScene = GetSScene(sceneData.data());
-    loadPath = mainScene->models()->Get(0)->name()->str();
-    printf("fbx path: %s", loadPath.c_str());
+    FbxVector4 t = local.GetT();
+    FbxQuaternion q = local.GetQ();
+    FbxVector4 s = local.GetS();
+
+    animation::JointPose pose;
+    pose.translation = m3d::math::Vector3(static_cast<float>(t[0]), static_cast<float>(t[1]), static_cast<float>(t[2]));
+    pose.rotation = m3d::math::Quaternion(static_cast<float>(q[0]), static_cast<float>(q[1]), static_cast<float>(q[2]), static_cast<float>(q[3]));
+    // joint poses scale uniformly
+    pose.scale = static_cast<float>((s[0] + s[1] + s[2]) / 3.0);
+    return pose;
+}
 
-    diffuseMaps = packed_freelist<DiffuseMap>(512);
-    materials = packed_freelist<Material>(512);
-    meshes = packed_freelist<Mesh>(512);
-    transforms = packed_freelist<Transform>(4096);
-    instances = packed_freelist<Instance>(4096);
-    cameras = packed_freelist<Camera>(32);
+static bool samePose(const animation::JointPose& a, const animation::JointPose& b, const animation::CompressionTolerance& tolerance)
+{
+    const float dot = a.rotation.x * b.rotation.x + a.rotation.y * b.rotation.y + a.rotation.z * b.rotation.z + a.rotation.w * b.rotation.w;
+    return std::fabs(dot) >= std::cos(tolerance.rotation * 0.5f)
+        && std::fabs(a.translation.x - b.translation.x) <= tolerance.translation
+        && std::fabs(a.translation.y - b.translation.y) <= tolerance.translation
+        && std::fabs(a.translation.z - b.translation.z) <= tolerance.translation
+        && std::fabs(a.scale - b.scale) <= tolerance.scale;
 }
 
-void LoadMeshes(FbxNode* pFbxNode, packed_freelist<Mesh>& sceneMeshes)
+/* Every animation stack sampled at AnimationSampleRate, nodes that hold still through a stack get no track */
+static void importAnimations(Scene* pScene, FbxScene* pFbxScene, const std::vector<NodeRecord>& nodes, const std::vector<uint32_t>& transformIDs)
 {
-    // Material
-    const uint32_t materialCount = pFbxNode->GetMaterialCount();
-    for (uint32_t i = 0; i < materialCount; ++i) {
-        FbxSurfaceMaterial* pFbxMaterial = pFbxNode->GetMaterial(i);
-        if (pFbxMaterial && !pFbxMaterial->GetUserDataPtr()) {
-            FbxAutoPtr<Material> pMaterial(new Material);
-            if (pMaterial->init(pFbxMaterial)) {
-                pFbxMaterial->SetUserDataPtr(pMaterial.Release());
+    const animation::CompressionTolerance tolerance;
+    const int stackCount = pFbxScene->GetSrcObjectCount<FbxAnimStack>();
+    for (int i = 0; i < stackCount; ++i) {
+        FbxAnimStack* pFbxAnimStack = pFbxScene->GetSrcObject<FbxAnimStack>(i);
+        pFbxScene->SetCurrentAnimationStack(pFbxAnimStack);
+        FbxTimeSpan span = pFbxAnimStack->GetLocalTimeSpan();
+        const double start = span.GetStart().GetSecondDouble();
+        const double duration = std::max(0.0, span.GetStop().GetSecondDouble() - start);
+        const uint32_t frameCount = std::min<uint32_t>(0x10000, static_cast<uint32_t>(duration * AnimationSampleRate) + 1);
+
+        // node major while sampling, so moving nodes are found before the frames are gathered
+        std::vector<std::vector<animation::JointPose>> samples(nodes.size(), std::vector<animation::JointPose>(frameCount));
+        for (uint32_t frame = 0; frame < frameCount; ++frame) {
+            FbxTime time;
+            time.SetSecondDouble(start + frame / static_cast<double>(AnimationSampleRate));
+            for (size_t n = 0; n < nodes.size(); ++n) {
+                samples[n][frame] = toJointPose(nodes[n].node->EvaluateLocalTransform(time));
             }
         }
-    }
 
-    FbxNodeAttribute* nodeAttribute = pFbxNode->GetNodeAttribute();
-    if (nodeAttribute) {
-        // Mesh
-        if (nodeAttribute->GetAttributeType() == FbxNodeAttribute::eMesh) {
-            FbxMesh* pFbxMesh = pFbxNode->GetMesh();
-            if (pFbxMesh && !pFbxMesh->GetUserDataPtr()) {
-                Mesh mesh;
-                if (mesh.init(pFbxMesh)) {
-                    sceneMeshes.insert(mesh);
-                }
-                // TODO:
-                FbxAutoPtr<Mesh> pMesh(new Mesh);
-                if (pMesh->init(pFbxMesh)) {
-                    pFbxMesh->SetUserDataPtr(pMesh.Release());
+        Animation animation;
+        animation.name = pFbxAnimStack->GetName();
+        std::vector<size_t> moving;
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            for (uint32_t frame = 1; frame < frameCount; ++frame) {
+                if (!samePose(samples[n][0], samples[n][frame], tolerance)) {
+                    moving.push_back(n);
+                    animation.transformIds.push_back(transformIDs[n]);
+                    break;
                 }
             }
         }
-        // Light
-        else if (nodeAttribute->GetAttributeType() == FbxNodeAttribute::eLight) {
-            FbxLight* pFbxLight = pFbxNode->GetLight();
-            if (pFbxLight && !pFbxLight->GetUserDataPtr()) {
-                FbxAutoPtr<Light> pLight(new Light);
-                if (pLight->init(pFbxLight)) {
-                    pFbxLight->SetUserDataPtr(pLight.Release());
-                }
-            }
+        if (moving.empty()) {
+            continue;
         }
-    }
 
-    const int childCount = pFbxNode->GetChildCount();
-    for (int i = 0; i < childCount; ++i) {
-        LoadMeshes(pFbxNode->GetChild(i), sceneMeshes);
+        std::vector<animation::JointPose> frames;
+        frames.reserve(frameCount * moving.size());
+        for (uint32_t frame = 0; frame < frameCount; ++frame) {
+            for (size_t n : moving) {
+                frames.push_back(samples[n][frame]);
+            }
+        }
+        animation.clip = animation::AnimationClip::Compress(frames, static_cast<uint32_t>(moving.size()), AnimationSampleRate, tolerance);
+        printf("animation %s: %u tracks, %u frames, %u KB of keys\n", animation.name.c_str(), animation.clip.jointCount,
+            frameCount, static_cast<uint32_t>(animation.clip.KeyBytes() / 1024));
+        pScene->animations.push_back(std::move(animation));
     }
 }
 
-void LoadMeshes(Scene* pScene, std::vector<uint32_t>* loadedMeshIDs)
+void LoadMeshes(Scene* pScene, std::vector<uint32_t>* loadedMeshIDs, uint32_t threadCount, LoadStats* stats)
 {
+    M3D_TRACE_ZONE("LoadMeshes");
+    auto tStep = std::chrono::high_resolution_clock::now();
+    if (pScene->cooked) {
+        loadCooked(pScene, loadedMeshIDs, threadCount, stats);
+        if (stats) {
+            stats->cookedMs = msSince(tStep);
+        }
+        return;
+    }
+
     FbxManager* fbxManager = FbxManager::Create();
 
     FbxIOSettings* pFbxIOSettings = FbxIOSettings::Create(fbxManager, IOSROOT);
@@ -249,7 +1604,7 @@ void LoadMeshes(Scene* pScene, std::vector<uint32_t>* loadedMeshIDs)
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_MATERIAL, true);
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_TEXTURE, true);
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_LINK, false);
-    (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_SHAPE, false);
+    (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_SHAPE, true);
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_GOBO, false);
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_ANIMATION, true);
     (*(fbxManager->GetIOSettings())).SetBoolProp(IMP_FBX_GLOBAL_SETTINGS, true);
@@ -298,27 +1653,148 @@ void LoadMeshes(Scene* pScene, std::vector<uint32_t>* loadedMeshIDs)
         FbxSystemUnit::cm.ConvertScene(pFbxScene);
     }
 
+    if (stats) {
+        stats->importMs = msSince(tStep);
+    }
+
     // Triangulate Mesh
+    tStep = std::chrono::high_resolution_clock::now();
     FbxGeometryConverter fbxGeometryConverter(fbxManager);
     fbxGeometryConverter.Triangulate(pFbxScene, true);
+    if (stats) {
+        stats->triangulateMs = msSince(tStep);
+    }
 
-    // Load Texture
+    // Textures are only recorded, the renderer decodes them on TextureStreamer's workers.
+    // One diffuse map per image however many FBX textures use it.
+    std::unordered_map<std::string, uint32_t> diffuseMapIDs;
     int textureCount = pFbxScene->GetTextureCount();
     for (int i = 0; i < textureCount; ++i) {
-        FbxTexture* pFbxTexture = pFbxScene->GetTexture(i);
-        FbxFileTexture* pFbxFileTexture = FbxCast<FbxFileTexture>(pFbxTexture);
-        if (pFbxTexture && pFbxFileTexture->GetUserDataPtr()) {
+        FbxFileTexture* pFbxFileTexture = FbxCast<FbxFileTexture>(pFbxScene->GetTexture(i));
+        if (!pFbxFileTexture) {
+            continue;
+        }
+        std::string path = resolveTexturePath(pScene->loadPath, pFbxFileTexture);
+        if (path.empty() || diffuseMapIDs.count(path)) {
+            continue;
+        }
+        DiffuseMap diffuseMap;
+        diffuseMap.path = path;
+        diffuseMapIDs[path] = pScene->diffuseMaps.insert(diffuseMap);
+    }
+    std::vector<NodeRecord> nodes;
+    std::vector<FbxMesh*> fbxMeshes;
+    std::unordered_set<FbxMesh*> visited;
+    gatherNodes(pFbxScene->GetRootNode(), -1, nodes, fbxMeshes, visited);
+
+    std::vector<uint32_t> meshIDs;
+    tStep = std::chrono::high_resolution_clock::now();
+    convertMeshes(fbxMeshes, pScene->meshes, meshIDs, threadCount, stats);
+    convertMaterials(pScene, fbxMeshes, meshIDs, diffuseMapIDs);
+    if (stats) {
+        stats->convertMs = msSince(tStep);
+    }
+    tStep = std::chrono::high_resolution_clock::now();
+    for (uint32_t meshID : meshIDs) {
+        if (loadedMeshIDs && meshID != UINT32_MAX) {
+            loadedMeshIDs->push_back(meshID);
+        }
+    }
+    std::vector<uint32_t> transformIDs;
+    buildHierarchy(pScene, nodes, fbxMeshes, meshIDs, transformIDs);
+    importAnimations(pScene, pFbxScene, nodes, transformIDs);
+    if (stats) {
+        stats->hierarchyMs = msSince(tStep);
+    }
+}
+
+void MergeScene(Scene& source, const std::vector<uint32_t>& meshIDs, Scene& target, uint32_t parentID, MergedIDs* merged)
+{
+    MergedIDs created;
+
+    std::unordered_map<uint32_t, uint32_t> diffuseMapIDs;
+    for (uint32_t diffuseMapID : source.diffuseMaps) {
+        diffuseMapIDs[diffuseMapID] = target.diffuseMaps.insert(source.diffuseMaps[diffuseMapID]);
+        created.diffuseMaps.push_back(diffuseMapIDs[diffuseMapID]);
+    }
+
+    std::unordered_map<uint32_t, uint32_t> materialIDs;
+    for (uint32_t materialID : source.materials) {
+        Material material = source.materials[materialID];
+        auto diffuseMap = diffuseMapIDs.find(material.diffuseMapId);
+        if (diffuseMap != diffuseMapIDs.end()) {
+            material.diffuseMapId = diffuseMap->second;
+        }
+        materialIDs[materialID] = target.materials.insert(material);
+        created.materials.push_back(materialIDs[materialID]);
+    }
+
+    std::unordered_map<uint32_t, uint32_t> targetMeshIDs;
+    for (uint32_t meshID : meshIDs) {
+        Mesh& mesh = source.meshes[meshID];
+        for (auto& materialID : mesh.materialIds) {
+            auto it = materialIDs.find(materialID);
+            if (it != materialIDs.end()) {
+                materialID = it->second;
+            }
+        }
+        targetMeshIDs[meshID] = target.meshes.insert(std::move(mesh));
+        created.meshes.push_back(targetMeshIDs[meshID]);
+    }
+    // cooked meshes point into the mapping
+    if (source.cooked) {
+        target.mappedModels.push_back(source.cooked);
+        target.mappedModelPaths.push_back(CookedPath(source.loadPath));
+    }
+
+    std::unordered_map<uint32_t, uint32_t> transformIDs;
+    for (uint32_t transformID : source.transforms) {
+        transformIDs[transformID] = target.AddTransform(source.transforms[transformID]);
+        created.transforms.push_back(transformIDs[transformID]);
+    }
+    for (const auto& transformID : transformIDs) {
+        auto parent = transformIDs.find(source.transformStore.GetParent(transformID.first));
+        target.SetParent(transformID.second, parent != transformIDs.end() ? parent->second : parentID);
+    }
+
+    if (source.instances.empty()) {
+        // meshes without placement sit at the parent
+        for (uint32_t meshID : meshIDs) {
+            if (parentID == TransformStore::NoParent) {
+                break;
+            }
+            Instance instance;
+            instance.meshId = targetMeshIDs[meshID];
+            instance.transformId = parentID;
+            created.instances.push_back(target.instances.insert(instance));
+        }
+    }
+    for (uint32_t instanceID : source.instances) {
+        const Instance& sourceInstance = source.instances[instanceID];
+        auto mesh = targetMeshIDs.find(sourceInstance.meshId);
+        auto transform = transformIDs.find(sourceInstance.transformId);
+        if (mesh == targetMeshIDs.end() || transform == transformIDs.end()) {
+            continue;
         }
+        Instance instance;
+        instance.meshId = mesh->second;
+        instance.transformId = transform->second;
+        created.instances.push_back(target.instances.insert(instance));
+    }
+
+    if (merged) {
+        *merged = std::move(created);
     }
-    LoadMeshes(pFbxScene->GetRootNode(), pScene->meshes);
 }
 
 void AddInstance(Scene& pFbxScene, uint32_t meshID, uint32_t* newInstanceID)
 {
     Transform newTransform;
+    newTransform.position = m3d::math::Vector3(0.0f, 0.0f, 0.0f);
     newTransform.scale = m3d::math::Vector3(1.0f, 1.0f, 1.0f);
+    newTransform.rotation = m3d::math::Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
 
-    uint32_t newTransformID = pFbxScene.transforms.insert(newTransform);
+    uint32_t newTransformID = pFbxScene.AddTransform(newTransform);
 
     Instance newInstance;
     newInstance.meshId = meshID;
@@ -329,4 +1805,340 @@ void AddInstance(Scene& pFbxScene, uint32_t meshID, uint32_t* newInstanceID)
         *newInstanceID = tmpNewInstanceID;
     }
 }
+
+static const uint32_t SnapshotVersion = 1;
+static const uint32_t NoIndex = 0xFFFFFFFF;
+
+/* First geometry byte of a mesh in the cooked scene it was mapped from, null for one of no cooked scene */
+static const void* mappedGeometry(const Mesh& mesh)
+{
+    return mesh.mappedVertices ? static_cast<const void*>(mesh.mappedVertices) : static_cast<const void*>(mesh.mappedEncodedVertices);
+}
+
+static const void* mappedGeometry(const SCookedMesh* cookedMesh)
+{
+    if (cookedMesh->vertices()) {
+        return cookedMesh->vertices()->Data();
+    }
+    return cookedMesh->encodedVertices() ? cookedMesh->encodedVertices()->data() : nullptr;
+}
+
+/* Where SaveSnapshot cooks the meshes of no cooked scene, never over a file the scene has mapped */
+static std::string snapshotMeshPath(const std::string& path, const std::vector<std::string>& mappedPaths)
+{
+    std::string meshPath = CookedPath(path);
+    const std::string stem = meshPath.substr(0, meshPath.find_last_of('.'));
+    for (uint32_t n = 1; std::find(mappedPaths.begin(), mappedPaths.end(), meshPath) != mappedPaths.end(); ++n) {
+        meshPath = stem + "_" + std::to_string(n) + "." + SCookedSceneExtension();
+    }
+    return meshPath;
+}
+
+bool SaveSnapshot(const Scene& scene, const std::string& path)
+{
+    M3D_TRACE_ZONE("SaveSnapshot");
+    std::vector<std::shared_ptr<const file::MappedFile>> mapped;
+    std::vector<std::string> mappedPaths;
+    if (scene.cooked) {
+        mapped.push_back(scene.cooked);
+        mappedPaths.push_back(CookedPath(scene.loadPath));
+    }
+    mapped.insert(mapped.end(), scene.mappedModels.begin(), scene.mappedModels.end());
+    mappedPaths.insert(mappedPaths.end(), scene.mappedModelPaths.begin(), scene.mappedModelPaths.end());
+
+    // which mapping and which of its meshes every mapped geometry is
+    std::unordered_map<const void*, std::pair<uint32_t, uint32_t>> cookedMeshes;
+    for (uint32_t f = 0; f < mapped.size(); ++f) {
+        const auto* meshes = GetSCookedScene(mapped[f]->data())->meshes();
+        for (uint32_t m = 0; meshes && m < meshes->size(); ++m) {
+            if (const void* geometry = mappedGeometry(meshes->Get(m))) {
+                cookedMeshes[geometry] = std::make_pair(f, m);
+            }
+        }
+    }
+
+    std::unordered_map<uint32_t, uint32_t> diffuseMapIndices, materialIndices, transformIndices, meshIndices;
+    for (uint32_t diffuseMapID : scene.diffuseMaps) {
+        diffuseMapIndices[diffuseMapID] = static_cast<uint32_t>(diffuseMapIndices.size());
+    }
+    for (uint32_t materialID : scene.materials) {
+        materialIndices[materialID] = static_cast<uint32_t>(materialIndices.size());
+    }
+    for (uint32_t transformID : scene.transforms) {
+        transformIndices[transformID] = static_cast<uint32_t>(transformIndices.size());
+    }
+    auto indexOf = [](const std::unordered_map<uint32_t, uint32_t>& indices, uint32_t id) {
+        auto found = indices.find(id);
+        return found != indices.end() ? found->second : NoIndex;
+    };
+
+    // meshes of no cooked scene, or one that is not mapped any more, go into a cooked scene of their own
+    Scene uncooked;
+    std::vector<uint32_t> uncookedMeshes;
+    // source file and mesh of every mesh, the uncooked ones point at their index in uncookedMeshes for now
+    std::vector<std::pair<uint32_t, uint32_t>> references;
+    std::vector<uint32_t> meshMaterials, meshMaterialCounts;
+    std::vector<uint32_t> sources(mapped.size(), NoIndex);
+    std::vector<std::string> sourcePaths;
+    for (uint32_t meshID : scene.meshes) {
+        const Mesh& mesh = scene.meshes[meshID];
+        auto cooked = cookedMeshes.find(mappedGeometry(mesh));
+        if (mappedGeometry(mesh) && cooked != cookedMeshes.end()) {
+            uint32_t& source = sources[cooked->second.first];
+            if (source == NoIndex) {
+                source = static_cast<uint32_t>(sourcePaths.size());
+                sourcePaths.push_back(mappedPaths[cooked->second.first]);
+            }
+            references.push_back(std::make_pair(source, cooked->second.second));
+        } else {
+            Mesh copy = mesh;
+            if (!copy.HasGeometry() && !copy.RestoreGeometry()) {
+                printf("SaveSnapshot: mesh %s released its geometry and kept nothing to restore it from\n", mesh.name.c_str());
+                return false;
+            }
+            references.push_back(std::make_pair(NoIndex, static_cast<uint32_t>(uncookedMeshes.size())));
+            uncookedMeshes.push_back(uncooked.meshes.insert(std::move(copy)));
+        }
+        meshIndices[meshID] = static_cast<uint32_t>(references.size() - 1);
+        for (uint32_t materialID : mesh.materialIds) {
+            meshMaterials.push_back(indexOf(materialIndices, materialID));
+        }
+        meshMaterialCounts.push_back(static_cast<uint32_t>(mesh.materialIds.size()));
+    }
+    if (!uncookedMeshes.empty()) {
+        std::vector<std::string> taken = mappedPaths;
+        taken.push_back(path);
+        const std::string meshPath = snapshotMeshPath(path, taken);
+        // uncompressed, a load maps it instead of decoding
+        if (!CookScene(uncooked, meshPath, false)) {
+            printf("SaveSnapshot: can not write %s\n", meshPath.c_str());
+            return false;
+        }
+        const uint32_t source = static_cast<uint32_t>(sourcePaths.size());
+        sourcePaths.push_back(meshPath);
+        for (auto& reference : references) {
+            if (reference.first == NoIndex) {
+                reference = std::make_pair(source, reference.second);
+            }
+        }
+    }
+
+    flatbuffers::FlatBufferBuilder fbb(1024 * 1024);
+    std::vector<flatbuffers::Offset<flatbuffers::String>> snapshotSources;
+    for (const std::string& sourcePath : sourcePaths) {
+        snapshotSources.push_back(fbb.CreateString(sourcePath));
+    }
+    std::vector<SMeshReference> snapshotMeshes;
+    for (const auto& reference : references) {
+        snapshotMeshes.emplace_back(reference.first, reference.second);
+    }
+    std::vector<flatbuffers::Offset<SCookedMaterial>> snapshotMaterials;
+    for (uint32_t materialID : scene.materials) {
+        const Material& material = scene.materials[materialID];
+        snapshotMaterials.push_back(writeCookedMaterial(fbb, material, indexOf(diffuseMapIndices, material.diffuseMapId)));
+    }
+    std::vector<flatbuffers::Offset<flatbuffers::String>> snapshotTextures;
+    for (uint32_t diffuseMapID : scene.diffuseMaps) {
+        snapshotTextures.push_back(fbb.CreateString(scene.diffuseMaps[diffuseMapID].path));
+    }
+    std::vector<SCookedTransform> snapshotTransforms;
+    std::vector<uint32_t> snapshotParents;
+    for (uint32_t transformID : scene.transforms) {
+        snapshotTransforms.push_back(toCookedTransform(scene.transforms[transformID]));
+        snapshotParents.push_back(indexOf(transformIndices, scene.transformStore.GetParent(transformID)));
+    }
+    std::vector<SCookedInstance> snapshotInstances;
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        const uint32_t mesh = indexOf(meshIndices, instance.meshId);
+        const uint32_t transform = indexOf(transformIndices, instance.transformId);
+        if (mesh != NoIndex && transform != NoIndex) {
+            snapshotInstances.emplace_back(mesh, transform);
+        }
+    }
+    std::vector<SSnapshotLight> snapshotLights;
+    for (uint32_t lightID : scene.lights) {
+        const Light& light = scene.lights[lightID];
+        snapshotLights.emplace_back(static_cast<uint32_t>(light.type), SVector3(light.color[0], light.color[1], light.color[2]), light.intensity,
+            light.range, light.innerCone, light.outerCone, indexOf(transformIndices, light.transformId));
+    }
+    std::vector<SSnapshotCamera> snapshotCameras;
+    uint32_t mainCamera = NoIndex;
+    for (uint32_t cameraID : scene.cameras) {
+        const Camera& camera = scene.cameras[cameraID];
+        if (cameraID == scene.mainCameraID) {
+            mainCamera = static_cast<uint32_t>(snapshotCameras.size());
+        }
+        snapshotCameras.emplace_back(SVector3(camera.eye.x, camera.eye.y, camera.eye.z), SVector3(camera.target.x, camera.target.y, camera.target.z),
+            SVector3(camera.up.x, camera.up.y, camera.up.z), camera.fovY, camera.aspect, camera.nearZ, camera.farZ);
+    }
+
+    auto root = CreateSSnapshot(fbb, SnapshotVersion, fbb.CreateVector(snapshotSources),
+        fbb.CreateVectorOfStructs(snapshotMeshes.data(), snapshotMeshes.size()), fbb.CreateVector(meshMaterials), fbb.CreateVector(meshMaterialCounts),
+        fbb.CreateVector(snapshotMaterials), fbb.CreateVector(snapshotTextures),
+        fbb.CreateVectorOfStructs(snapshotTransforms.data(), snapshotTransforms.size()), fbb.CreateVector(snapshotParents),
+        fbb.CreateVectorOfStructs(snapshotInstances.data(), snapshotInstances.size()),
+        fbb.CreateVectorOfStructs(snapshotLights.data(), snapshotLights.size()),
+        fbb.CreateVectorOfStructs(snapshotCameras.data(), snapshotCameras.size()), mainCamera);
+    FinishSSnapshotBuffer(fbb, root);
+    if (!file::writeBinary(path.c_str(), fbb.GetBufferPointer(), fbb.GetSize())) {
+        printf("SaveSnapshot: can not write %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool loadSnapshot(Scene& scene, const SSnapshot* snapshot, const std::string& path, uint32_t threadCount, LoadStats* stats)
+{
+    std::vector<const SCookedScene*> sources;
+    for (uint32_t s = 0; snapshot->sources() && s < snapshot->sources()->size(); ++s) {
+        const std::string sourcePath = snapshot->sources()->Get(s)->str();
+        auto source = file::MappedFile::open(sourcePath.c_str());
+        if (!source || !isCookedScene(*source)) {
+            printf("LoadSnapshot: %s of %s is missing or not a cooked scene of this version\n", sourcePath.c_str(), path.c_str());
+            return false;
+        }
+        scene.mappedModels.push_back(source);
+        scene.mappedModelPaths.push_back(sourcePath);
+        sources.push_back(GetSCookedScene(source->data()));
+    }
+
+    std::vector<uint32_t> diffuseMapIDs;
+    for (uint32_t t = 0; snapshot->textures() && t < snapshot->textures()->size(); ++t) {
+        DiffuseMap diffuseMap;
+        diffuseMap.path = snapshot->textures()->Get(t)->str();
+        diffuseMapIDs.push_back(scene.diffuseMaps.insert(std::move(diffuseMap)));
+    }
+    std::vector<uint32_t> materialIDs;
+    for (uint32_t m = 0; snapshot->materials() && m < snapshot->materials()->size(); ++m) {
+        Material material = readCookedMaterial(snapshot->materials()->Get(m));
+        material.diffuseMapId = material.diffuseMapId < diffuseMapIDs.size() ? diffuseMapIDs[material.diffuseMapId] : NoIndex;
+        materialIDs.push_back(scene.materials.insert(std::move(material)));
+    }
+
+    const auto* references = snapshot->meshes();
+    const auto* meshMaterials = snapshot->meshMaterials();
+    const auto* meshMaterialCounts = snapshot->meshMaterialCounts();
+    const uint32_t meshCount = references ? references->size() : 0;
+    if (meshCount > 0 && (!meshMaterials || !meshMaterialCounts || meshMaterialCounts->size() != meshCount)) {
+        printf("LoadSnapshot: %s has no materials for its meshes\n", path.c_str());
+        return false;
+    }
+    std::vector<uint32_t> meshIDs;
+    std::vector<std::pair<const SCookedMesh*, uint32_t>> encoded;
+    uint32_t firstMaterial = 0;
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        const SMeshReference* reference = references->Get(m);
+        const auto* cookedMeshes = reference->source() < sources.size() ? sources[reference->source()]->meshes() : nullptr;
+        const uint32_t materialCount = meshMaterialCounts->Get(m);
+        if (!cookedMeshes || reference->mesh() >= cookedMeshes->size() || firstMaterial + materialCount > meshMaterials->size()) {
+            printf("LoadSnapshot: mesh %u of %s is not in its cooked scene\n", m, path.c_str());
+            return false;
+        }
+        const SCookedMesh* cookedMesh = cookedMeshes->Get(reference->mesh());
+        Mesh mesh = readCookedMesh(cookedMesh);
+        mesh.materialIds.clear();
+        for (uint32_t i = 0; i < materialCount; ++i) {
+            const uint32_t material = meshMaterials->Get(firstMaterial + i);
+            mesh.materialIds.push_back(material < materialIDs.size() ? materialIDs[material] : NoIndex);
+        }
+        firstMaterial += materialCount;
+        const uint32_t meshID = scene.meshes.insert(std::move(mesh));
+        if (cookedMesh->encodedVertices() && cookedMesh->vertexChunks() && cookedMesh->encodedIndices() && cookedMesh->indexChunks()) {
+            encoded.emplace_back(cookedMesh, meshID);
+        }
+        meshIDs.push_back(meshID);
+    }
+    if (!encoded.empty()) {
+        auto tDecode = std::chrono::high_resolution_clock::now();
+        decodeGeometry(&scene, encoded, threadCount);
+        if (stats) {
+            stats->decodeMs = msSince(tDecode);
+        }
+    }
+
+    std::vector<uint32_t> transformIDs;
+    for (uint32_t t = 0; snapshot->transforms() && t < snapshot->transforms()->size(); ++t) {
+        transformIDs.push_back(scene.AddTransform(readCookedTransform(snapshot->transforms()->Get(t))));
+    }
+    if (snapshot->parents() && snapshot->parents()->size() == transformIDs.size()) {
+        for (uint32_t t = 0; t < transformIDs.size(); ++t) {
+            const uint32_t parent = snapshot->parents()->Get(t);
+            if (parent < transformIDs.size() && parent != t) {
+                scene.SetParent(transformIDs[t], transformIDs[parent]);
+            }
+        }
+    }
+    for (uint32_t i = 0; snapshot->instances() && i < snapshot->instances()->size(); ++i) {
+        const SCookedInstance* cookedInstance = snapshot->instances()->Get(i);
+        if (cookedInstance->mesh() < meshIDs.size() && cookedInstance->transform() < transformIDs.size()) {
+            Instance instance;
+            instance.meshId = meshIDs[cookedInstance->mesh()];
+            instance.transformId = transformIDs[cookedInstance->transform()];
+            scene.instances.insert(instance);
+        }
+    }
+    for (uint32_t l = 0; snapshot->lights() && l < snapshot->lights()->size(); ++l) {
+        const SSnapshotLight* snapshotLight = snapshot->lights()->Get(l);
+        if (snapshotLight->transform() >= transformIDs.size() || snapshotLight->type() > Light::Directional) {
+            continue;
+        }
+        Light light;
+        light.type = static_cast<Light::Type>(snapshotLight->type());
+        light.color[0] = snapshotLight->color().x();
+        light.color[1] = snapshotLight->color().y();
+        light.color[2] = snapshotLight->color().z();
+        light.intensity = snapshotLight->intensity();
+        light.range = snapshotLight->range();
+        light.innerCone = snapshotLight->innerCone();
+        light.outerCone = snapshotLight->outerCone();
+        light.transformId = transformIDs[snapshotLight->transform()];
+        scene.lights.insert(light);
+    }
+    for (uint32_t c = 0; snapshot->cameras() && c < snapshot->cameras()->size(); ++c) {
+        const SSnapshotCamera* snapshotCamera = snapshot->cameras()->Get(c);
+        Camera camera;
+        camera.eye = m3d::math::Vector3(snapshotCamera->eye().x(), snapshotCamera->eye().y(), snapshotCamera->eye().z());
+        camera.target = m3d::math::Vector3(snapshotCamera->target().x(), snapshotCamera->target().y(), snapshotCamera->target().z());
+        camera.up = m3d::math::Vector3(snapshotCamera->up().x(), snapshotCamera->up().y(), snapshotCamera->up().z());
+        camera.fovY = snapshotCamera->fovY();
+        camera.aspect = snapshotCamera->aspect();
+        camera.nearZ = snapshotCamera->nearZ();
+        camera.farZ = snapshotCamera->farZ();
+        const uint32_t cameraID = scene.cameras.insert(camera);
+        if (c == snapshot->mainCamera()) {
+            scene.mainCameraID = cameraID;
+        }
+    }
+    return true;
+}
+
+bool LoadSnapshot(Scene& scene, const std::string& path, uint32_t threadCount, LoadStats* stats)
+{
+    M3D_TRACE_ZONE("LoadSnapshot");
+    M3D_MEMORY_TAG(Scene);
+    auto tStep = std::chrono::high_resolution_clock::now();
+    scene.Init();
+    scene.loadPath = path;
+
+    // only read while loading, everything of it is copied out
+    auto file = file::MappedFile::open(path.c_str());
+    if (!file) {
+        printf("LoadSnapshot: can not open %s\n", path.c_str());
+        return false;
+    }
+    flatbuffers::Verifier verifier(file->data(), file->size());
+    if (!SSnapshotBufferHasIdentifier(file->data()) || !VerifySSnapshotBuffer(verifier) || GetSSnapshot(file->data())->version() != SnapshotVersion) {
+        printf("LoadSnapshot: %s is not a snapshot of this version\n", path.c_str());
+        return false;
+    }
+    if (!loadSnapshot(scene, GetSSnapshot(file->data()), path, threadCount, stats)) {
+        scene.Init();
+        return false;
+    }
+    if (stats) {
+        stats->cookedMs = msSince(tStep);
+    }
+    return true;
+}
 } // End of namespace m3d
@@ -0,0 +1,684 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SceneManifest.hpp"
+
+#include "../../data/schema/scene_generated.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define M3D_MANIFEST_NEON 1
+#elif !defined(__arm__) && !defined(__aarch64__)
+#include <emmintrin.h>
+#define M3D_MANIFEST_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace m3d::schema;
+
+namespace m3d {
+
+// index of the lowest set bit, mask is not 0
+static inline uint32_t lowestBit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+#if M3D_MANIFEST_NEON
+// one bit per byte of a comparison result, as _mm_movemask_epi8 gives it
+static inline uint32_t byteMask(uint8x16_t compare)
+{
+    static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t masked = vandq_u8(compare, vld1q_u8(bits));
+    const uint8x8_t sum = vpadd_u8(vpadd_u8(vpadd_u8(vget_low_u8(masked), vget_high_u8(masked)), vdup_n_u8(0)), vdup_n_u8(0));
+    // low half sums the first 8 bytes, the next byte the last 8
+    return vget_lane_u8(sum, 0) | (static_cast<uint32_t>(vget_lane_u8(sum, 1)) << 8);
+}
+#endif
+
+// first byte from p on that is not whitespace, everything up to ' ' counts as flatc's lexer treats it
+static const char* skipWhitespace(const char* p, const char* end)
+{
+#if M3D_MANIFEST_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    while (end - p >= 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        // unsigned bytes <= ' '
+        const uint32_t blank = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(bytes, space), space)));
+        if (blank != 0xFFFF) {
+            return p + lowestBit(~blank & 0xFFFF);
+        }
+        p += 16;
+    }
+#elif M3D_MANIFEST_NEON
+    const uint8x16_t space = vdupq_n_u8(' ');
+    while (end - p >= 16) {
+        const uint32_t blank = byteMask(vcleq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), space));
+        if (blank != 0xFFFF) {
+            return p + lowestBit(~blank & 0xFFFF);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && static_cast<unsigned char>(*p) <= ' ') {
+        ++p;
+    }
+    return p;
+}
+
+// first '"' or '\\' from p on, end when there is none
+static const char* findQuoteOrEscape(const char* p, const char* end)
+{
+#if M3D_MANIFEST_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const uint32_t found = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash))));
+        if (found) {
+            return p + lowestBit(found);
+        }
+        p += 16;
+    }
+#elif M3D_MANIFEST_NEON
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    while (end - p >= 16) {
+        const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        const uint32_t found = byteMask(vorrq_u8(vceqq_u8(bytes, quote), vceqq_u8(bytes, backslash)));
+        if (found) {
+            return p + lowestBit(found);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\') {
+        ++p;
+    }
+    return p;
+}
+
+// the eight bytes at p are all digits
+static inline bool eightDigits(const char* p, uint64_t& chunk)
+{
+    memcpy(&chunk, p, sizeof(chunk));
+    // every byte 0x30 to 0x39: the high nibble is 3 before and after adding 6
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ull) | (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+// value of eight digits, the first one the most significant. Little endian loads: byte 0 is the first digit.
+// Pairs, then quads, then all eight, each step one multiplication
+static inline uint32_t eightDigitValue(uint64_t chunk)
+{
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+    return static_cast<uint32_t>(((chunk & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32);
+}
+
+static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22 };
+
+namespace {
+    class ManifestReader {
+    public:
+        ManifestReader(const char* json, size_t length, flatbuffers::FlatBufferBuilder& Builder)
+            : begin(json)
+            , p(json)
+            , end(json + length)
+            , builder(Builder)
+        {
+        }
+
+        bool Read(std::string* error);
+
+    private:
+        bool scene();
+        bool model(std::vector<flatbuffers::Offset<SModel>>& models);
+        bool transform(STransform& result);
+        bool vector3(SVector3& result);
+        bool number(float& value);
+        bool string(flatbuffers::Offset<flatbuffers::String>& result);
+        bool field(const char*& name, size_t& length);
+        bool fields(bool (ManifestReader::*value)(const char* name, size_t length, void* target), void* target);
+
+        bool space();
+        bool expect(char c);
+        bool fail(const char* what);
+
+        const char* begin;
+        const char* p;
+        const char* end;
+        flatbuffers::FlatBufferBuilder& builder;
+        // escaped strings are unescaped here
+        std::string unescaped;
+        std::string message;
+        const char* failedAt = nullptr;
+
+        bool sceneField(const char* name, size_t length, void* target);
+        bool modelField(const char* name, size_t length, void* target);
+        bool transformField(const char* name, size_t length, void* target);
+        bool vectorField(const char* name, size_t length, void* target);
+    };
+
+    struct ModelFields {
+        uint32_t seen = 0;
+        flatbuffers::Offset<flatbuffers::String> name;
+        STransform transform;
+    };
+
+    struct TransformFields {
+        uint32_t seen = 0;
+        SVector3 position;
+        SVector3 rotation;
+        SVector3 scale;
+    };
+
+    struct VectorFields {
+        uint32_t seen = 0;
+        float xyz[3];
+    };
+
+    struct SceneFields {
+        uint32_t seen = 0;
+        std::vector<flatbuffers::Offset<SModel>> models;
+    };
+}
+
+static bool named(const char* name, size_t length, const char* expected)
+{
+    return strlen(expected) == length && memcmp(name, expected, length) == 0;
+}
+
+bool ManifestReader::fail(const char* what)
+{
+    if (!failedAt) {
+        failedAt = p;
+        message = what;
+    }
+    return false;
+}
+
+// whitespace and comments
+bool ManifestReader::space()
+{
+    for (;;) {
+        p = skipWhitespace(p, end);
+        if (end - p < 2 || p[0] != '/') {
+            return true;
+        }
+        if (p[1] == '/') {
+            const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            p = newline ? newline + 1 : end;
+        } else if (p[1] == '*') {
+            const char* close = p + 2;
+            while (end - close >= 2 && !(close[0] == '*' && close[1] == '/')) {
+                ++close;
+            }
+            if (end - close < 2) {
+                return fail("comment not closed");
+            }
+            p = close + 2;
+        } else {
+            return true;
+        }
+    }
+}
+
+bool ManifestReader::expect(char c)
+{
+    if (!space()) {
+        return false;
+    }
+    if (p == end || *p != c) {
+        char what[32];
+        snprintf(what, sizeof(what), "expecting '%c'", c);
+        return fail(what);
+    }
+    ++p;
+    return true;
+}
+
+// A field name, quoted or a bare identifier, and its ':'
+bool ManifestReader::field(const char*& name, size_t& length)
+{
+    if (!space()) {
+        return false;
+    }
+    if (p < end && *p == '"') {
+        name = ++p;
+        const char* close = findQuoteOrEscape(p, end);
+        if (close == end || *close != '"') {
+            return fail("field name not closed, or with an escape");
+        }
+        length = close - name;
+        p = close + 1;
+    } else {
+        name = p;
+        while (p < end && (isalnum(static_cast<unsigned char>(*p)) || *p == '_')) {
+            ++p;
+        }
+        length = p - name;
+        if (length == 0) {
+            return fail("expecting a field name");
+        }
+    }
+    return expect(':');
+}
+
+// '{' name: value, ... '}' with an optional trailing comma, value reads each field's value into target
+bool ManifestReader::fields(bool (ManifestReader::*value)(const char* name, size_t length, void* target), void* target)
+{
+    if (!expect('{')) {
+        return false;
+    }
+    for (;;) {
+        if (!space()) {
+            return false;
+        }
+        if (p < end && *p == '}') {
+            ++p;
+            return true;
+        }
+        const char* name;
+        size_t length;
+        if (!field(name, length) || !(this->*value)(name, length, target) || !space()) {
+            return false;
+        }
+        if (p < end && *p == ',') {
+            ++p;
+        } else if (p == end || *p != '}') {
+            return fail("expecting ',' or '}'");
+        }
+    }
+}
+
+// duplicates are errors, as flatc reports them
+static bool firstTime(uint32_t& seen, uint32_t bit)
+{
+    const bool first = (seen & bit) == 0;
+    seen |= bit;
+    return first;
+}
+
+bool ManifestReader::vectorField(const char* name, size_t length, void* target)
+{
+    VectorFields& vector = *static_cast<VectorFields*>(target);
+    uint32_t index = 3;
+    if (length == 1 && *name >= 'x' && *name <= 'z') {
+        index = *name - 'x';
+    }
+    if (index == 3) {
+        return fail("unknown field of SVector3");
+    }
+    if (!firstTime(vector.seen, 1u << index)) {
+        return fail("field set more than once");
+    }
+    return number(vector.xyz[index]);
+}
+
+bool ManifestReader::vector3(SVector3& result)
+{
+    VectorFields vector;
+    if (!fields(&ManifestReader::vectorField, &vector)) {
+        return false;
+    }
+    if (vector.seen != 7) {
+        return fail("SVector3 needs x, y and z");
+    }
+    result = SVector3(vector.xyz[0], vector.xyz[1], vector.xyz[2]);
+    return true;
+}
+
+bool ManifestReader::transformField(const char* name, size_t length, void* target)
+{
+    TransformFields& transform = *static_cast<TransformFields*>(target);
+    SVector3* vector = nullptr;
+    uint32_t bit = 0;
+    if (named(name, length, "position")) {
+        vector = &transform.position;
+        bit = 1;
+    } else if (named(name, length, "rotation")) {
+        vector = &transform.rotation;
+        bit = 2;
+    } else if (named(name, length, "scale")) {
+        vector = &transform.scale;
+        bit = 4;
+    } else {
+        return fail("unknown field of STransform");
+    }
+    if (!firstTime(transform.seen, bit)) {
+        return fail("field set more than once");
+    }
+    return vector3(*vector);
+}
+
+bool ManifestReader::transform(STransform& result)
+{
+    TransformFields transform;
+    if (!fields(&ManifestReader::transformField, &transform)) {
+        return false;
+    }
+    if (transform.seen != 7) {
+        return fail("STransform needs position, rotation and scale");
+    }
+    result = STransform(transform.position, transform.rotation, transform.scale);
+    return true;
+}
+
+bool ManifestReader::modelField(const char* name, size_t length, void* target)
+{
+    ModelFields& model = *static_cast<ModelFields*>(target);
+    if (named(name, length, "name")) {
+        return firstTime(model.seen, 1) ? string(model.name) : fail("field set more than once");
+    }
+    if (named(name, length, "transform")) {
+        return firstTime(model.seen, 2) ? transform(model.transform) : fail("field set more than once");
+    }
+    return fail("unknown field of SModel");
+}
+
+// the model's string is built before its table starts, as tables may not nest
+bool ManifestReader::model(std::vector<flatbuffers::Offset<SModel>>& models)
+{
+    ModelFields model;
+    if (!fields(&ManifestReader::modelField, &model)) {
+        return false;
+    }
+    models.push_back(CreateSModel(builder, model.name, (model.seen & 2) ? &model.transform : nullptr));
+    return true;
+}
+
+bool ManifestReader::sceneField(const char* name, size_t length, void* target)
+{
+    SceneFields& scene = *static_cast<SceneFields*>(target);
+    if (!named(name, length, "models")) {
+        return fail("unknown field of SScene");
+    }
+    if (!firstTime(scene.seen, 1)) {
+        return fail("field set more than once");
+    }
+    if (!expect('[')) {
+        return false;
+    }
+    for (;;) {
+        if (!space()) {
+            return false;
+        }
+        if (p < end && *p == ']') {
+            ++p;
+            return true;
+        }
+        if (!model(scene.models) || !space()) {
+            return false;
+        }
+        if (p < end && *p == ',') {
+            ++p;
+        } else if (p == end || *p != ']') {
+            return fail("expecting ',' or ']'");
+        }
+    }
+}
+
+bool ManifestReader::scene()
+{
+    SceneFields scene;
+    // about the text of one model with a short name, the vector does not grow for compact manifests
+    scene.models.reserve((end - p) / 96);
+    if (!fields(&ManifestReader::sceneField, &scene)) {
+        return false;
+    }
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SModel>>> models;
+    if (scene.seen & 1) {
+        models = builder.CreateVector(scene.models);
+    }
+    builder.Finish(CreateSScene(builder, models));
+    return true;
+}
+
+static void appendUtf8(std::string& out, uint32_t code)
+{
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+static bool hex4(const char* p, const char* end, uint32_t& code)
+{
+    if (end - p < 4) {
+        return false;
+    }
+    code = 0;
+    for (int i = 0; i < 4; ++i) {
+        const char c = p[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9') {
+            code |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            code |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            code |= c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Names without escapes are copied from the text in one go, the common case of every path
+bool ManifestReader::string(flatbuffers::Offset<flatbuffers::String>& result)
+{
+    if (!expect('"')) {
+        return false;
+    }
+    const char* start = p;
+    const char* stop = findQuoteOrEscape(p, end);
+    if (stop < end && *stop == '"') {
+        result = builder.CreateString(start, stop - start);
+        p = stop + 1;
+        return true;
+    }
+
+    unescaped.assign(start, stop);
+    p = stop;
+    while (p < end && *p != '"') {
+        // *p is '\\'
+        if (end - p < 2) {
+            break;
+        }
+        const char c = p[1];
+        p += 2;
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            unescaped += c;
+            break;
+        case 'b':
+            unescaped += '\b';
+            break;
+        case 'f':
+            unescaped += '\f';
+            break;
+        case 'n':
+            unescaped += '\n';
+            break;
+        case 'r':
+            unescaped += '\r';
+            break;
+        case 't':
+            unescaped += '\t';
+            break;
+        case 'u': {
+            uint32_t code;
+            if (!hex4(p, end, code)) {
+                return fail("\\u needs four hex digits");
+            }
+            p += 4;
+            // a surrogate pair is one code point
+            uint32_t low;
+            if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u' && hex4(p + 2, end, low) && low >= 0xDC00
+                && low < 0xE000) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+            appendUtf8(unescaped, code);
+            break;
+        }
+        default:
+            return fail("unknown escape in string");
+        }
+        const char* next = findQuoteOrEscape(p, end);
+        unescaped.append(p, next);
+        p = next;
+    }
+    if (p == end) {
+        return fail("string not closed");
+    }
+    ++p;
+    result = builder.CreateString(unescaped.data(), unescaped.size());
+    return true;
+}
+
+// digits from p on into mantissa, eight at a time while they last. Digits past the 19 a uint64_t holds
+// only count towards dropped
+static const char* digits(const char* p, const char* end, uint64_t& mantissa, int& count, int& dropped)
+{
+    uint64_t chunk;
+    while (end - p >= 8 && count + 8 <= 19 && eightDigits(p, chunk)) {
+        mantissa = mantissa * 100000000ull + eightDigitValue(chunk);
+        count += 8;
+        p += 8;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (count < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++count;
+        } else {
+            ++dropped;
+        }
+        ++p;
+    }
+    return p;
+}
+
+// A JSON number as float. Digits that make a mantissa below 2^53 with a decimal exponent of at most 22,
+// all of the manifests' numbers, are converted with one exact multiplication or division: the double
+// strtod gives, rounded to float as flatc does. Anything else goes through strtod
+bool ManifestReader::number(float& value)
+{
+    if (!space()) {
+        return false;
+    }
+    const char* start = p;
+    const bool negative = p < end && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int count = 0, dropped = 0;
+    const char* integerEnd = digits(p, end, mantissa, count, dropped);
+    bool any = integerEnd != p;
+    int exponent = dropped;
+    p = integerEnd;
+    if (p < end && *p == '.') {
+        const char* fractionStart = p + 1;
+        const int before = count;
+        p = digits(fractionStart, end, mantissa, count, dropped);
+        exponent -= count - before;
+        any = any || p != fractionStart;
+    }
+    if (!any) {
+        p = start;
+        return fail("expecting a number");
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return fail("exponent without digits");
+        }
+        int written = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            written = std::min(written * 10 + (*p - '0'), 100000);
+            ++p;
+        }
+        exponent += negativeExponent ? -written : written;
+    }
+
+    // mantissa < 2^53 and 10^|exponent| are exact doubles, the one operation rounds correctly
+    if (dropped == 0 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        double result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / powersOf10[-exponent] : result * powersOf10[exponent];
+        value = static_cast<float>(negative ? -result : result);
+        return true;
+    }
+    // the text may not be terminated, strtod reads a copy
+    char text[128];
+    const size_t length = static_cast<size_t>(p - start);
+    if (length >= sizeof(text)) {
+        return fail("number too long");
+    }
+    memcpy(text, start, length);
+    text[length] = '\0';
+    value = static_cast<float>(strtod(text, nullptr));
+    return true;
+}
+
+bool ManifestReader::Read(std::string* error)
+{
+    bool parsed = scene() && space();
+    if (parsed && p != end) {
+        parsed = fail("text after the scene");
+    }
+    if (!parsed && error) {
+        const int line = 1 + static_cast<int>(std::count(begin, failedAt ? failedAt : p, '\n'));
+        *error = "line " + std::to_string(line) + ": " + message;
+    }
+    return parsed;
+}
+
+size_t SceneManifestBufferSize(size_t jsonLength)
+{
+    return jsonLength / 2 + 1024;
+}
+
+bool ParseSceneManifest(const char* json, size_t length, flatbuffers::FlatBufferBuilder& builder, std::string* error)
+{
+    ManifestReader reader(json, length, builder);
+    return reader.Read(error);
+}
+} // End of namespace m3d
@@ -0,0 +1,218 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SceneStreamer.hpp"
+#include "File.hpp"
+#include "MathUtils.h"
+#include "Quaternion.h"
+#include "SceneManifest.hpp"
+#include "ThreadPool.hpp"
+
+#include "../../data/schema/scene_generated.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+
+using namespace m3d::schema;
+
+namespace m3d {
+
+const char* SceneStreamer::DefaultManifestPath = "data/schema/scene_data.bin";
+
+static bool fileExists(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    return file.good();
+}
+
+/* Model names relative to the manifest's directory, absolute ones as they are */
+static std::string resolvePath(const std::string& manifestPath, const std::string& name)
+{
+    bool absolute = !name.empty() && (name[0] == '/' || name[0] == '\\' || (name.size() > 1 && name[1] == ':'));
+    size_t separator = manifestPath.find_last_of("/\\");
+    if (absolute || separator == std::string::npos) {
+        return name;
+    }
+    return manifestPath.substr(0, separator + 1) + name;
+}
+
+/* STransform rotation is euler angles in degrees, applied around x, then y, then z */
+static Transform toTransform(const STransform* sTransform)
+{
+    Transform transform;
+    transform.position = m3d::math::Vector3(0.0f, 0.0f, 0.0f);
+    transform.scale = m3d::math::Vector3(1.0f, 1.0f, 1.0f);
+    transform.rotation = m3d::math::Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
+    if (!sTransform) {
+        return transform;
+    }
+
+    transform.position = m3d::math::Vector3(sTransform->position().x(), sTransform->position().y(), sTransform->position().z());
+    transform.scale = m3d::math::Vector3(sTransform->scale().x(), sTransform->scale().y(), sTransform->scale().z());
+    const float toRadians = m3d::math::PI_F / 180.0f;
+    m3d::math::Quaternion rx(m3d::math::Vector3(1.0f, 0.0f, 0.0f), sTransform->rotation().x() * toRadians);
+    m3d::math::Quaternion ry(m3d::math::Vector3(0.0f, 1.0f, 0.0f), sTransform->rotation().y() * toRadians);
+    m3d::math::Quaternion rz(m3d::math::Vector3(0.0f, 0.0f, 1.0f), sTransform->rotation().z() * toRadians);
+    transform.rotation = rz * ry * rx;
+    return transform;
+}
+
+SceneStreamer::SceneStreamer(uint32_t threadCount)
+    : threads(new ThreadPool(std::max(1u, threadCount), JobSystem::Priority::Background))
+    , viewer(0.0f, 0.0f, 0.0f)
+{
+}
+
+SceneStreamer::~SceneStreamer()
+{
+    // the workers write into models and loaded
+    threads->Wait();
+}
+
+static bool isJson(const std::string& path)
+{
+    const std::string extension = ".json";
+    return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool SceneStreamer::Open(const std::string& manifestPath)
+{
+    // the JSON form during development, the binary one is mapped
+    std::shared_ptr<const file::MappedFile> manifest;
+    std::unique_ptr<flatbuffers::FlatBufferBuilder> parsed;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    if (isJson(manifestPath)) {
+        std::string json;
+        if (!file::readBinary(manifestPath.c_str(), json)) {
+            printf("SceneStreamer: can not read %s\n", manifestPath.c_str());
+            return false;
+        }
+        parsed.reset(new flatbuffers::FlatBufferBuilder(SceneManifestBufferSize(json.size())));
+        std::string error;
+        if (!ParseSceneManifest(json.data(), json.size(), *parsed, &error)) {
+            printf("SceneStreamer: %s %s\n", manifestPath.c_str(), error.c_str());
+            return false;
+        }
+        data = parsed->GetBufferPointer();
+        size = parsed->GetSize();
+    } else {
+        manifest = file::MappedFile::open(manifestPath.c_str());
+        if (!manifest) {
+            printf("SceneStreamer: can not open %s\n", manifestPath.c_str());
+            return false;
+        }
+        data = manifest->data();
+        size = manifest->size();
+    }
+    flatbuffers::Verifier verifier(data, size);
+    if (!VerifySSceneBuffer(verifier)) {
+        printf("SceneStreamer: %s is not a scene manifest\n", manifestPath.c_str());
+        return false;
+    }
+
+    const SScene* sScene = GetSScene(data);
+    uint32_t modelCount = sScene->models() ? sScene->models()->size() : 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t m = 0; m < modelCount; ++m) {
+            const SModel* sModel = sScene->models()->Get(m);
+            if (!sModel->name()) {
+                continue;
+            }
+            Model model;
+            model.path = resolvePath(manifestPath, sModel->name()->str());
+            model.transform = toTransform(sModel->transform());
+            models.push_back(model);
+        }
+    }
+
+    // every task takes the best model left when it runs, not the one it was queued for
+    for (uint32_t m = 0; m < modelCount; ++m) {
+        threads->Enqueue([this]() { loadNext(); });
+    }
+    return true;
+}
+
+void SceneStreamer::SetViewer(const m3d::math::Vector3& position)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    viewer = position;
+}
+
+void SceneStreamer::Wait()
+{
+    threads->Wait();
+}
+
+void SceneStreamer::loadNext()
+{
+    uint32_t next = UINT32_MAX;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        float nearest = FLT_MAX;
+        for (uint32_t m = 0; m < models.size(); ++m) {
+            if (models[m].started) {
+                continue;
+            }
+            m3d::math::Vector3 offset = models[m].transform.position - viewer;
+            float distance = m3d::math::Vector3::DotProduct(offset, offset);
+            if (distance < nearest) {
+                nearest = distance;
+                next = m;
+            }
+        }
+        if (next == UINT32_MAX) {
+            return;
+        }
+        models[next].started = true;
+    }
+
+    // Scene::Init and LoadMeshes only touch the scene they are given
+    Loaded result;
+    result.model = next;
+    const std::string& path = models[next].path;
+    if (fileExists(CookedPath(path)) || fileExists(path)) {
+        result.scene.reset(new Scene);
+        result.scene->Init(path);
+        LoadMeshes(result.scene.get(), &result.meshIDs);
+    } else {
+        printf("SceneStreamer: %s does not exist, skipped\n", path.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    loaded.push_back(std::move(result));
+}
+
+bool SceneStreamer::Poll(Scene& scene)
+{
+    std::vector<Loaded> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(loaded);
+    }
+
+    bool merged = false;
+    for (auto& result : finished) {
+        if (!result.scene) {
+            ++failedCount;
+            continue;
+        }
+        merge(result, scene);
+        ++mergedCount;
+        merged = true;
+    }
+    return merged;
+}
+
+void SceneStreamer::merge(Loaded& result, Scene& scene)
+{
+    // the model transform becomes the parent of the model's root transforms
+    const uint32_t modelTransformID = scene.AddTransform(models[result.model].transform);
+    MergeScene(*result.scene, result.meshIDs, scene, modelTransformID);
+}
+} // End of namespace m3d
@@ -0,0 +1,570 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ShaderReflection.hpp"
+#include "vulkanShaders.h"
+
+#include <algorithm>
+#include <vulkan/spirv.hpp>
+
+namespace m3d {
+
+// SPIR-V 1.3, newer than the vendored header; glslang writes Uniform with BufferBlock for Vulkan 1.0
+static const uint32_t StorageClassStorageBuffer = 12;
+
+static bool fail(std::string* error, const std::string& message)
+{
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+/* Numeric type and component count of vertex formats */
+
+enum class NumericType {
+    Float,
+    Uint,
+    Sint,
+};
+
+// false for formats outside the plain color ranges of VkFormat, compressed and depth ones
+static bool formatInfo(vk::Format format, uint32_t& components, NumericType& type)
+{
+    const uint32_t f = static_cast<uint32_t>(format);
+    // UNORM, SNORM, USCALED, SSCALED, UINT, SINT and SRGB or SFLOAT at the end
+    auto packed = [&type](uint32_t order) {
+        type = order == 4 ? NumericType::Uint : order == 5 ? NumericType::Sint : NumericType::Float;
+    };
+    if (f >= VK_FORMAT_R8_UNORM && f <= VK_FORMAT_A8B8G8R8_SRGB_PACK32) {
+        // R8, R8G8, R8G8B8, B8G8R8, R8G8B8A8, B8G8R8A8, A8B8G8R8
+        static const uint32_t counts[] = { 1, 2, 3, 3, 4, 4, 4 };
+        components = counts[(f - VK_FORMAT_R8_UNORM) / 7];
+        packed((f - VK_FORMAT_R8_UNORM) % 7);
+        return true;
+    }
+    if (f >= VK_FORMAT_A2R10G10B10_UNORM_PACK32 && f <= VK_FORMAT_A2B10G10R10_SINT_PACK32) {
+        components = 4;
+        packed((f - VK_FORMAT_A2R10G10B10_UNORM_PACK32) % 6);
+        return true;
+    }
+    if (f >= VK_FORMAT_R16_UNORM && f <= VK_FORMAT_R16G16B16A16_SFLOAT) {
+        components = (f - VK_FORMAT_R16_UNORM) / 7 + 1;
+        packed((f - VK_FORMAT_R16_UNORM) % 7);
+        return true;
+    }
+    if (f >= VK_FORMAT_R32_UINT && f <= VK_FORMAT_R64G64B64A64_SFLOAT) {
+        // UINT, SINT, SFLOAT of R32 to R64G64B64A64
+        const uint32_t order = (f - VK_FORMAT_R32_UINT) % 3;
+        components = (f - VK_FORMAT_R32_UINT) / 3 % 4 + 1;
+        type = order == 0 ? NumericType::Uint : order == 1 ? NumericType::Sint : NumericType::Float;
+        return true;
+    }
+    if (format == vk::Format::eB10G11R11UfloatPack32) {
+        components = 3;
+        type = NumericType::Float;
+        return true;
+    }
+    return false;
+}
+
+static vk::Format inputFormat(NumericType type, uint32_t components)
+{
+    static const vk::Format formats[3][4] = {
+        { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat },
+        { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint },
+        { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint },
+    };
+    return formats[static_cast<uint32_t>(type)][std::min(components, 4u) - 1];
+}
+
+/* The parts of a module reflection looks at, indexed by result id */
+
+namespace {
+    struct Type {
+        spv::Op op = spv::OpNop;
+        // element of vectors, matrices and arrays, pointee of pointers, image of sampled images
+        uint32_t element = 0;
+        // components of vectors, columns of matrices, the id of the length of arrays
+        uint32_t count = 0;
+        // int and float
+        uint32_t width = 0;
+        bool isSigned = false;
+        // pointer storage class
+        uint32_t storage = 0;
+        // images
+        uint32_t dim = 0;
+        uint32_t sampled = 0;
+        std::vector<uint32_t> members;
+    };
+
+    struct Decorations {
+        bool hasBinding = false;
+        bool hasLocation = false;
+        bool builtin = false;
+        bool block = false;
+        bool bufferBlock = false;
+        uint32_t set = 0;
+        uint32_t binding = 0;
+        uint32_t location = 0;
+        uint32_t arrayStride = 0;
+        std::vector<uint32_t> memberOffsets;
+        std::vector<uint32_t> memberMatrixStrides;
+    };
+
+    struct Variable {
+        uint32_t id;
+        uint32_t type;
+        uint32_t storage;
+    };
+
+    struct Module {
+        std::vector<Type> types;
+        std::vector<Decorations> decorations;
+        std::vector<uint32_t> constants;
+        std::vector<Variable> variables;
+
+        // bytes of a push constant member, matrixStride from the member's decoration
+        uint32_t size(uint32_t id, uint32_t matrixStride = 0) const
+        {
+            const Type& type = types[id];
+            switch (type.op) {
+            case spv::OpTypeBool:
+                return 4;
+            case spv::OpTypeInt:
+            case spv::OpTypeFloat:
+                return type.width / 8;
+            case spv::OpTypeVector:
+                return type.count * size(type.element);
+            case spv::OpTypeMatrix:
+                return type.count * (matrixStride ? matrixStride : size(type.element));
+            case spv::OpTypeArray: {
+                const uint32_t stride = decorations[id].arrayStride;
+                return constants[type.count] * (stride ? stride : size(type.element));
+            }
+            case spv::OpTypeStruct: {
+                const Decorations& members = decorations[id];
+                uint32_t end = 0;
+                for (size_t m = 0; m < type.members.size(); ++m) {
+                    const uint32_t offset = m < members.memberOffsets.size() ? members.memberOffsets[m] : 0;
+                    const uint32_t stride = m < members.memberMatrixStrides.size() ? members.memberMatrixStrides[m] : 0;
+                    end = std::max(end, offset + size(type.members[m], stride));
+                }
+                return end;
+            }
+            default:
+                return 0;
+            }
+        }
+    };
+}
+
+static bool stageOf(uint32_t executionModel, vk::ShaderStageFlagBits& stage)
+{
+    switch (executionModel) {
+    case spv::ExecutionModelVertex: stage = vk::ShaderStageFlagBits::eVertex; return true;
+    case spv::ExecutionModelTessellationControl: stage = vk::ShaderStageFlagBits::eTessellationControl; return true;
+    case spv::ExecutionModelTessellationEvaluation: stage = vk::ShaderStageFlagBits::eTessellationEvaluation; return true;
+    case spv::ExecutionModelGeometry: stage = vk::ShaderStageFlagBits::eGeometry; return true;
+    case spv::ExecutionModelFragment: stage = vk::ShaderStageFlagBits::eFragment; return true;
+    case spv::ExecutionModelGLCompute: stage = vk::ShaderStageFlagBits::eCompute; return true;
+    default: return false;
+    }
+}
+
+static void setMember(std::vector<uint32_t>& values, uint32_t member, uint32_t value)
+{
+    if (values.size() <= member) {
+        values.resize(member + 1, 0);
+    }
+    values[member] = value;
+}
+
+// descriptor type of a variable of class storage whose arrays are stripped down to type
+static bool descriptorType(const Module& module, uint32_t storage, uint32_t typeId, vk::DescriptorType& descriptor)
+{
+    const Type& type = module.types[typeId];
+    if (storage == StorageClassStorageBuffer) {
+        descriptor = vk::DescriptorType::eStorageBuffer;
+        return true;
+    }
+    if (storage == spv::StorageClassUniform) {
+        const Decorations& decorations = module.decorations[typeId];
+        if (type.op != spv::OpTypeStruct || !(decorations.block || decorations.bufferBlock)) {
+            return false;
+        }
+        descriptor = decorations.bufferBlock ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+        return true;
+    }
+    switch (type.op) {
+    case spv::OpTypeSampler:
+        descriptor = vk::DescriptorType::eSampler;
+        return true;
+    case spv::OpTypeSampledImage:
+        descriptor = module.types[type.element].dim == spv::DimBuffer ? vk::DescriptorType::eUniformTexelBuffer : vk::DescriptorType::eCombinedImageSampler;
+        return true;
+    case spv::OpTypeImage:
+        // sampled 2: read and written without a sampler
+        if (type.dim == spv::DimBuffer) {
+            descriptor = type.sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+        } else if (type.dim == spv::DimSubpassData) {
+            descriptor = vk::DescriptorType::eInputAttachment;
+        } else {
+            descriptor = type.sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool ReflectSpirv(const uint32_t* words, size_t wordCount, ShaderLayout& layout, std::string* error)
+{
+    layout = ShaderLayout();
+    if (wordCount < 5 || words[0] != spv::MagicNumber) {
+        return fail(error, "not a SPIR-V module");
+    }
+    // every id is below the bound
+    const uint32_t bound = words[3];
+    Module module;
+    module.types.resize(bound);
+    module.decorations.resize(bound);
+    module.constants.resize(bound, 0);
+
+    uint32_t entryPoints = 0;
+    vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+    for (size_t i = 5; i < wordCount;) {
+        const uint32_t op = words[i] & spv::OpCodeMask;
+        const uint32_t length = words[i] >> spv::WordCountShift;
+        if (length == 0 || i + length > wordCount) {
+            return fail(error, "truncated SPIR-V module");
+        }
+        const uint32_t* w = words + i;
+        // instructions naming ids past the bound are skipped
+        auto valid = [bound](uint32_t id) { return id < bound; };
+        switch (op) {
+        case spv::OpEntryPoint:
+            if (++entryPoints == 1 && !stageOf(w[1], stage)) {
+                return fail(error, "unsupported execution model");
+            }
+            break;
+        case spv::OpDecorate:
+            if (length >= 3 && valid(w[1])) {
+                Decorations& decorations = module.decorations[w[1]];
+                const uint32_t value = length >= 4 ? w[3] : 0;
+                switch (w[2]) {
+                case spv::DecorationBlock: decorations.block = true; break;
+                case spv::DecorationBufferBlock: decorations.bufferBlock = true; break;
+                case spv::DecorationArrayStride: decorations.arrayStride = value; break;
+                case spv::DecorationBuiltIn: decorations.builtin = true; break;
+                case spv::DecorationLocation: decorations.hasLocation = true; decorations.location = value; break;
+                case spv::DecorationBinding: decorations.hasBinding = true; decorations.binding = value; break;
+                case spv::DecorationDescriptorSet: decorations.set = value; break;
+                default: break;
+                }
+            }
+            break;
+        case spv::OpMemberDecorate:
+            if (length >= 5 && valid(w[1])) {
+                Decorations& decorations = module.decorations[w[1]];
+                if (w[3] == spv::DecorationOffset) {
+                    setMember(decorations.memberOffsets, w[2], w[4]);
+                } else if (w[3] == spv::DecorationMatrixStride) {
+                    setMember(decorations.memberMatrixStrides, w[2], w[4]);
+                }
+            }
+            break;
+        case spv::OpTypeBool:
+        case spv::OpTypeSampler:
+            if (valid(w[1])) {
+                module.types[w[1]].op = static_cast<spv::Op>(op);
+            }
+            break;
+        case spv::OpTypeInt:
+        case spv::OpTypeFloat:
+            if (valid(w[1])) {
+                Type& type = module.types[w[1]];
+                type.op = static_cast<spv::Op>(op);
+                type.width = w[2];
+                type.isSigned = op == spv::OpTypeInt && w[3] != 0;
+            }
+            break;
+        case spv::OpTypeVector:
+        case spv::OpTypeMatrix:
+        case spv::OpTypeArray:
+            if (valid(w[1]) && valid(w[2]) && (op != spv::OpTypeArray || valid(w[3]))) {
+                Type& type = module.types[w[1]];
+                type.op = static_cast<spv::Op>(op);
+                type.element = w[2];
+                type.count = w[3];
+            }
+            break;
+        case spv::OpTypeRuntimeArray:
+        case spv::OpTypeSampledImage:
+            if (valid(w[1]) && valid(w[2])) {
+                module.types[w[1]].op = static_cast<spv::Op>(op);
+                module.types[w[1]].element = w[2];
+            }
+            break;
+        case spv::OpTypeImage:
+            if (length >= 9 && valid(w[1])) {
+                Type& type = module.types[w[1]];
+                type.op = spv::OpTypeImage;
+                type.dim = w[3];
+                type.sampled = w[7];
+            }
+            break;
+        case spv::OpTypeStruct:
+            if (valid(w[1])) {
+                Type& type = module.types[w[1]];
+                type.op = spv::OpTypeStruct;
+                for (uint32_t m = 2; m < length; ++m) {
+                    if (valid(w[m])) {
+                        type.members.push_back(w[m]);
+                    }
+                }
+            }
+            break;
+        case spv::OpTypePointer:
+            if (valid(w[1]) && valid(w[3])) {
+                Type& type = module.types[w[1]];
+                type.op = spv::OpTypePointer;
+                type.storage = w[2];
+                type.element = w[3];
+            }
+            break;
+        case spv::OpConstant:
+        case spv::OpSpecConstant:
+            if (length >= 4 && valid(w[2])) {
+                // the low word, array lengths are 32 bit. A specialization constant counts with its
+                // default, a pipeline that specializes an array length declares the largest one
+                module.constants[w[2]] = w[3];
+            }
+            break;
+        case spv::OpVariable:
+            if (valid(w[1]) && valid(w[2])) {
+                module.variables.push_back({ w[2], w[1], w[3] });
+            }
+            break;
+        default:
+            break;
+        }
+        i += length;
+    }
+    if (entryPoints != 1) {
+        return fail(error, "SPIR-V modules with " + std::to_string(entryPoints) + " entry points are not supported");
+    }
+    layout.stages = stage;
+
+    for (const Variable& variable : module.variables) {
+        const Decorations& decorations = module.decorations[variable.id];
+        uint32_t typeId = module.types[variable.type].element;
+
+        if (variable.storage == spv::StorageClassPushConstant) {
+            layout.pushConstantSize = std::max(layout.pushConstantSize, module.size(typeId));
+            layout.pushConstantStages = stage;
+            continue;
+        }
+
+        if (variable.storage == spv::StorageClassInput) {
+            // builtins and the inputs of the other stages, which come from the previous stage
+            if (stage != vk::ShaderStageFlagBits::eVertex || decorations.builtin || !decorations.hasLocation) {
+                continue;
+            }
+            const Type* type = &module.types[typeId];
+            // a matrix takes a location per column
+            uint32_t columns = 1;
+            if (type->op == spv::OpTypeMatrix) {
+                columns = type->count;
+                type = &module.types[type->element];
+            }
+            uint32_t components = 1;
+            if (type->op == spv::OpTypeVector) {
+                components = type->count;
+                type = &module.types[type->element];
+            }
+            if (type->op != spv::OpTypeFloat && type->op != spv::OpTypeInt) {
+                return fail(error, "vertex input at location " + std::to_string(decorations.location) + " is not a number");
+            }
+            const NumericType numeric = type->op == spv::OpTypeFloat ? NumericType::Float : type->isSigned ? NumericType::Sint : NumericType::Uint;
+            for (uint32_t column = 0; column < columns; ++column) {
+                ShaderLayout::Input input;
+                input.location = decorations.location + column;
+                input.format = inputFormat(numeric, components);
+                layout.inputs.push_back(input);
+            }
+            continue;
+        }
+
+        if (variable.storage != spv::StorageClassUniformConstant && variable.storage != spv::StorageClassUniform
+            && variable.storage != StorageClassStorageBuffer) {
+            continue;
+        }
+        if (!decorations.hasBinding) {
+            return fail(error, "resource without a binding");
+        }
+        uint32_t count = 1;
+        while (module.types[typeId].op == spv::OpTypeArray) {
+            count *= module.constants[module.types[typeId].count];
+            typeId = module.types[typeId].element;
+        }
+        if (module.types[typeId].op == spv::OpTypeRuntimeArray) {
+            return fail(error, "binding " + std::to_string(decorations.binding) + " is an array of unknown size");
+        }
+        ShaderLayout::Binding binding;
+        binding.set = decorations.set;
+        binding.binding = decorations.binding;
+        binding.count = count;
+        binding.stages = stage;
+        if (!descriptorType(module, variable.storage, typeId, binding.type)) {
+            return fail(error, "binding " + std::to_string(decorations.binding) + " is not a descriptor");
+        }
+        layout.bindings.push_back(binding);
+    }
+
+    std::sort(layout.bindings.begin(), layout.bindings.end(), [](const ShaderLayout::Binding& a, const ShaderLayout::Binding& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(layout.inputs.begin(), layout.inputs.end(), [](const ShaderLayout::Input& a, const ShaderLayout::Input& b) {
+        return a.location < b.location;
+    });
+    return true;
+}
+
+bool ReflectSpirv(const std::string& path, ShaderLayout& layout, std::string* error)
+{
+    vkx::shader::SpvCodePtr code = vkx::shader::SpvCode::map(path);
+    if (!code) {
+        return fail(error, "can not map " + path);
+    }
+    if (!ReflectSpirv(code->data(), code->size(), layout, error)) {
+        if (error) {
+            *error = path + ": " + *error;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool ShaderLayout::Merge(const ShaderLayout& other, std::string* error)
+{
+    stages |= other.stages;
+    for (const Binding& binding : other.bindings) {
+        auto it = std::find_if(bindings.begin(), bindings.end(), [&binding](const Binding& b) {
+            return b.set == binding.set && b.binding == binding.binding;
+        });
+        if (it == bindings.end()) {
+            bindings.push_back(binding);
+            continue;
+        }
+        if (it->type != binding.type || it->count != binding.count) {
+            return fail(error, "set " + std::to_string(binding.set) + " binding " + std::to_string(binding.binding) + " differs between stages");
+        }
+        it->stages |= binding.stages;
+    }
+    for (const Input& input : other.inputs) {
+        auto it = std::find_if(inputs.begin(), inputs.end(), [&input](const Input& i) { return i.location == input.location; });
+        if (it == inputs.end()) {
+            inputs.push_back(input);
+        } else if (it->format != input.format) {
+            return fail(error, "vertex input at location " + std::to_string(input.location) + " differs between shaders");
+        }
+    }
+    if (other.pushConstantSize) {
+        pushConstantSize = std::max(pushConstantSize, other.pushConstantSize);
+        pushConstantStages |= other.pushConstantStages;
+    }
+
+    std::sort(bindings.begin(), bindings.end(), [](const Binding& a, const Binding& b) {
+        return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.location < b.location; });
+    return true;
+}
+
+bool ShaderLayout::SetDynamic(uint32_t set, uint32_t binding)
+{
+    for (Binding& b : bindings) {
+        if (b.set != set || b.binding != binding) {
+            continue;
+        }
+        if (b.type == vk::DescriptorType::eUniformBuffer) {
+            b.type = vk::DescriptorType::eUniformBufferDynamic;
+        } else if (b.type == vk::DescriptorType::eStorageBuffer) {
+            b.type = vk::DescriptorType::eStorageBufferDynamic;
+        }
+        return b.type == vk::DescriptorType::eUniformBufferDynamic || b.type == vk::DescriptorType::eStorageBufferDynamic;
+    }
+    return false;
+}
+
+uint32_t ShaderLayout::GetSetCount() const
+{
+    return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<vk::DescriptorSetLayoutBinding> ShaderLayout::GetSetBindings(uint32_t set) const
+{
+    std::vector<vk::DescriptorSetLayoutBinding> setBindings;
+    for (const Binding& binding : bindings) {
+        if (binding.set == set) {
+            setBindings.push_back(vk::DescriptorSetLayoutBinding(binding.binding, binding.type, binding.count, binding.stages));
+        }
+    }
+    return setBindings;
+}
+
+std::vector<vk::PushConstantRange> ShaderLayout::GetPushConstantRanges() const
+{
+    std::vector<vk::PushConstantRange> ranges;
+    if (pushConstantSize) {
+        ranges.push_back(vk::PushConstantRange(pushConstantStages, 0, pushConstantSize));
+    }
+    return ranges;
+}
+
+std::vector<vk::DescriptorPoolSize> ShaderLayout::GetPoolSizes(uint32_t set) const
+{
+    std::vector<vk::DescriptorPoolSize> sizes;
+    for (const Binding& binding : bindings) {
+        if (binding.set != set) {
+            continue;
+        }
+        auto it = std::find_if(sizes.begin(), sizes.end(), [&binding](const vk::DescriptorPoolSize& size) { return size.type == binding.type; });
+        if (it == sizes.end()) {
+            sizes.push_back(vk::DescriptorPoolSize(binding.type, binding.count));
+        } else {
+            it->descriptorCount += binding.count;
+        }
+    }
+    return sizes;
+}
+
+bool SelectVertexAttributes(const ShaderLayout& layout, const vk::VertexInputAttributeDescription* stream, size_t streamCount,
+    std::vector<vk::VertexInputAttributeDescription>& attributes, std::string* error)
+{
+    attributes.clear();
+    for (const ShaderLayout::Input& input : layout.inputs) {
+        const vk::VertexInputAttributeDescription* end = stream + streamCount;
+        const vk::VertexInputAttributeDescription* it = std::find_if(stream, end, [&input](const vk::VertexInputAttributeDescription& attribute) {
+            return attribute.location == input.location;
+        });
+        if (it == end) {
+            return fail(error, "the vertex stream has no attribute at location " + std::to_string(input.location));
+        }
+        // components may differ, missing ones read as 0 or 1; integer and float inputs must not mix
+        uint32_t components;
+        NumericType inputType;
+        NumericType streamType;
+        formatInfo(input.format, components, inputType);
+        if (formatInfo(it->format, components, streamType) && streamType != inputType) {
+            return fail(error, "vertex input at location " + std::to_string(input.location) + " reads " + vk::to_string(it->format) + " as another numeric type");
+        }
+        attributes.push_back(*it);
+    }
+    return true;
+}
+} // End of namespace m3d
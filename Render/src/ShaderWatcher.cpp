@@ -0,0 +1,135 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ShaderWatcher.hpp"
+#include "File.hpp"
+#include "PipelineRegistry.hpp"
+#include "vulkanShaders.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace m3d {
+
+static bool endsWith(const std::string& text, const char* suffix)
+{
+    const size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// false for anything that is not a GLSL source
+static bool stageOf(const std::string& sourcePath, vk::ShaderStageFlagBits& stage)
+{
+    static const struct {
+        const char* extension;
+        vk::ShaderStageFlagBits stage;
+    } stages[] = {
+        { ".vert", vk::ShaderStageFlagBits::eVertex },
+        { ".frag", vk::ShaderStageFlagBits::eFragment },
+        { ".comp", vk::ShaderStageFlagBits::eCompute },
+        { ".geom", vk::ShaderStageFlagBits::eGeometry },
+        { ".tesc", vk::ShaderStageFlagBits::eTessellationControl },
+        { ".tese", vk::ShaderStageFlagBits::eTessellationEvaluation },
+    };
+    for (const auto& entry : stages) {
+        if (endsWith(sourcePath, entry.extension)) {
+            stage = entry.stage;
+            return true;
+        }
+    }
+    return false;
+}
+
+ShaderWatcher::ShaderWatcher(PipelineRegistry& Registry, uint32_t IntervalMs)
+    : registry(Registry)
+    , intervalMs(IntervalMs)
+    , reloads(0)
+{
+    thread = std::thread([this]() { run(); });
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+void ShaderWatcher::run()
+{
+    // glslang keeps per thread state
+    vkx::shader::initGlsl();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return stopping; })) {
+        lock.unlock();
+        poll();
+        lock.lock();
+    }
+}
+
+void ShaderWatcher::poll()
+{
+    for (const std::string& spvPath : registry.GetShaderFiles()) {
+        if (!endsWith(spvPath, ".spv")) {
+            continue;
+        }
+        const std::string sourcePath = spvPath.substr(0, spvPath.size() - 4);
+        struct stat info;
+        if (stat(sourcePath.c_str(), &info) != 0) {
+            continue;
+        }
+        // the size too, editors write a file more than once within the second st_mtime resolves
+        Source current;
+        current.modified = static_cast<int64_t>(info.st_mtime);
+        current.size = static_cast<int64_t>(info.st_size);
+        auto it = sources.find(sourcePath);
+        if (it == sources.end()) {
+            // first seen, the .spv the application started with is its compiled form
+            sources[sourcePath] = current;
+            continue;
+        }
+        if (it->second.modified == current.modified && it->second.size == current.size) {
+            continue;
+        }
+        it->second = current;
+        compile(spvPath, sourcePath);
+    }
+}
+
+bool ShaderWatcher::compile(const std::string& spvPath, const std::string& sourcePath)
+{
+    vk::ShaderStageFlagBits stage;
+    std::string source;
+    if (!stageOf(sourcePath, stage) || !file::readBinary(sourcePath.c_str(), source)) {
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    vkx::shader::SpvBuffer code;
+    try {
+        code = vkx::shader::glslToSpv(stage, source);
+    } catch (std::runtime_error* error) {
+        printf("ShaderWatcher: %s\n%s\n", sourcePath.c_str(), error->what());
+        delete error;
+        return false;
+    }
+    if (!file::writeBinary(spvPath.c_str(), code.data(), code.size() * sizeof(uint32_t))) {
+        printf("ShaderWatcher: can not write %s, the next run starts with the old shader\n", spvPath.c_str());
+    }
+
+    const uint32_t pipelines = registry.ReloadShader(spvPath, code);
+    reloads++;
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("ShaderWatcher: reloaded %s, %u pipelines in %.1f ms\n", sourcePath.c_str(), pipelines, ms);
+    return true;
+}
+} // End of namespace m3d
@@ -0,0 +1,423 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ShadingRate.hpp"
+#include "CommandBuffer.hpp"
+#include "ResourceTrash.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdio>
+
+namespace m3d {
+
+const uint32_t ShadingRate::GroupSize;
+const uint32_t ShadingRate::PaletteSize;
+const vk::Format ShadingRate::Format;
+const char* const ShadingRate::ExtensionName = "VK_NV_shading_rate_image";
+
+// VK_KHR_get_physical_device_properties2 and VK_NV_shading_rate_image postdate the vulkan headers
+static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+static const VkStructureType PhysicalDeviceProperties2Type = static_cast<VkStructureType>(1000059001);
+static const VkStructureType PipelineViewportShadingRateImageStateType = static_cast<VkStructureType>(1000164000);
+static const VkStructureType PhysicalDeviceShadingRateImageFeaturesType = static_cast<VkStructureType>(1000164001);
+static const VkStructureType PhysicalDeviceShadingRateImagePropertiesType = static_cast<VkStructureType>(1000164002);
+static const vk::ImageLayout ShadingRateOptimalLayout = static_cast<vk::ImageLayout>(1000164003);
+static const vk::ImageUsageFlagBits ShadingRateImageUsage = static_cast<vk::ImageUsageFlagBits>(0x00000100);
+static const vk::PipelineStageFlagBits ShadingRateImageStage = static_cast<vk::PipelineStageFlagBits>(0x00400000);
+static const vk::AccessFlagBits ShadingRateImageReadAccess = static_cast<vk::AccessFlagBits>(0x00800000);
+
+struct PhysicalDeviceFeatures2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceFeatures features;
+};
+
+struct PhysicalDeviceProperties2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceProperties properties;
+};
+
+struct PhysicalDeviceShadingRateImageFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 shadingRateImage;
+    VkBool32 shadingRateCoarseSampleOrder;
+};
+
+struct PhysicalDeviceShadingRateImageProperties {
+    VkStructureType sType;
+    void* pNext;
+    VkExtent2D shadingRateTexelSize;
+    uint32_t shadingRatePaletteSize;
+    uint32_t shadingRateMaxCoarseSamples;
+};
+
+struct ShadingRatePalette {
+    uint32_t shadingRatePaletteEntryCount;
+    // VkShadingRatePaletteEntryNV
+    const uint32_t* pShadingRatePaletteEntries;
+};
+
+struct PipelineViewportShadingRateImageState {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 shadingRateImageEnable;
+    uint32_t viewportCount;
+    const ShadingRatePalette* pShadingRatePalettes;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+typedef void(VKAPI_PTR* GetPhysicalDeviceProperties2)(VkPhysicalDevice physicalDevice, PhysicalDeviceProperties2* properties);
+typedef void(VKAPI_PTR* CmdBindShadingRateImage)(VkCommandBuffer commandBuffer, VkImageView imageView, VkImageLayout imageLayout);
+
+// the VkShadingRatePaletteEntryNV of the indices the shaders store, in the order of ShadingRate::PaletteSize
+static const uint32_t PaletteEntries[] = {
+    5, // one invocation per pixel
+    6, // per 2 x 1 pixels
+    8, // per 2 x 2
+    9, // per 4 x 2
+    11 // per 4 x 4
+};
+static const ShadingRatePalette Palette = { ShadingRate::PaletteSize, PaletteEntries };
+static const PipelineViewportShadingRateImageState ViewportState = { PipelineViewportShadingRateImageStateType, nullptr, VK_TRUE, 1, &Palette };
+
+// settings, shading rate image, scene color
+static const uint32_t BindingCount = 3;
+
+// the shading rate properties of physicalDevice, false where they can not be queried
+static bool queryProperties(vk::Instance instance, vk::PhysicalDevice physicalDevice, PhysicalDeviceShadingRateImageProperties& shadingRate)
+{
+    PFN_vkVoidFunction getProperties2 = instance.getProcAddr("vkGetPhysicalDeviceProperties2KHR");
+    if (!getProperties2) {
+        return false;
+    }
+    shadingRate = {};
+    shadingRate.sType = PhysicalDeviceShadingRateImagePropertiesType;
+    PhysicalDeviceProperties2 properties = {};
+    properties.sType = PhysicalDeviceProperties2Type;
+    properties.pNext = &shadingRate;
+    reinterpret_cast<GetPhysicalDeviceProperties2>(getProperties2)(VkPhysicalDevice(physicalDevice), &properties);
+    return true;
+}
+
+bool ShadingRate::IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, ExtensionName)) {
+        return false;
+    }
+    PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!getFeatures2) {
+        return false;
+    }
+    PhysicalDeviceShadingRateImageFeatures shadingRate = {};
+    shadingRate.sType = PhysicalDeviceShadingRateImageFeaturesType;
+    PhysicalDeviceFeatures2 features = {};
+    features.sType = PhysicalDeviceFeatures2Type;
+    features.pNext = &shadingRate;
+    reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+    PhysicalDeviceShadingRateImageProperties properties;
+    return shadingRate.shadingRateImage == VK_TRUE && queryProperties(instance, physicalDevice, properties)
+        && properties.shadingRatePaletteSize >= PaletteSize && properties.shadingRateTexelSize.width > 0 && properties.shadingRateTexelSize.height > 0;
+}
+
+const void* ShadingRate::GetFeatureChain(const void* next)
+{
+    // read by vkCreateDevice only, one device at a time
+    static PhysicalDeviceShadingRateImageFeatures features = {};
+    features.sType = PhysicalDeviceShadingRateImageFeaturesType;
+    features.pNext = next;
+    features.shadingRateImage = VK_TRUE;
+    return &features;
+}
+
+const void* ShadingRate::GetViewportState()
+{
+    return &ViewportState;
+}
+
+ShadingRate::ShadingRate(vk::Instance instance, vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, CommandBuffer& CommandBuffer, uint32_t slotCount)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , commandBuffer(CommandBuffer)
+{
+    static_assert(sizeof(GpuSettings) == 8 * sizeof(float), "shading_rate.comp reads 8 words of settings");
+    static_assert(sizeof(Constants) == 8 * sizeof(uint32_t), "shading_rate.comp pushes 8 words");
+
+    PhysicalDeviceShadingRateImageProperties properties;
+    const bool queried = queryProperties(instance, physicalDevice, properties);
+    assert(queried && "the device was created without IsSupported");
+    texelSize = queried ? vk::Extent2D(properties.shadingRateTexelSize.width, properties.shadingRateTexelSize.height) : vk::Extent2D(16, 16);
+    loadEntryPoints();
+
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+    settingsStride = static_cast<uint32_t>((sizeof(GpuSettings) + alignment - 1) / alignment * alignment);
+    commandBuffer.CreateBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        slotCount * settingsStride, nullptr, settingsBuffer, settingsMemory);
+    assert(settingsMemory && "out of memory for the shading rate settings");
+    vkx::debug::marker::setName(device, settingsBuffer, "shading rate settings");
+    for (uint32_t slot = 0; slot < slotCount; ++slot) {
+        BeginFrame(slot);
+    }
+
+    // a sample between 2 x 2 pixels averages them
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    sampler = device.createSampler(samplerInfo);
+
+    createPipelines();
+}
+
+ShadingRate::~ShadingRate()
+{
+    destroyTargets(nullptr);
+    device.destroyPipeline(contrastPipeline);
+    device.destroyPipeline(foveatedPipeline);
+    device.destroyPipelineLayout(pipelineLayout);
+    device.destroyDescriptorSetLayout(setLayout);
+    device.destroySampler(sampler);
+    commandBuffer.DestroyBuffer(settingsBuffer, settingsMemory);
+}
+
+void ShadingRate::loadEntryPoints()
+{
+    cmdBindShadingRateImage = device.getProcAddr("vkCmdBindShadingRateImageNV");
+    if (!cmdBindShadingRateImage) {
+        printf("ShadingRate: no vkCmdBindShadingRateImageNV, every pixel is shaded\n");
+    }
+}
+
+void ShadingRate::createPipelines()
+{
+    std::array<vk::DescriptorSetLayoutBinding, BindingCount> bindings;
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+    bindings[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+    bindings[1].descriptorType = vk::DescriptorType::eStorageImage;
+    bindings[2].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+
+    vk::DescriptorSetLayoutCreateInfo descriptorLayout;
+    descriptorLayout.bindingCount = static_cast<uint32_t>(bindings.size());
+    descriptorLayout.pBindings = bindings.data();
+    setLayout = device.createDescriptorSetLayout(descriptorLayout);
+
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(Constants));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+
+    contrastPipeline = createPipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\shading_rate.comp.spv", "shading rate");
+    // never reads binding 2, which stays unwritten without a scene color
+    foveatedPipeline = createPipeline("D:\\workspace\\m3d\\data\\shaders\\camera\\shading_rate_foveated.comp.spv", "shading rate foveated");
+}
+
+vk::Pipeline ShadingRate::createPipeline(const char* shader, const char* name)
+{
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.stage.module = vkhelper::loadShaderModule(device, shader);
+    assert(pipelineInfo.stage.module);
+    pipelineInfo.layout = pipelineLayout;
+    vk::Pipeline computePipeline = device.createComputePipeline(vk::PipelineCache(), pipelineInfo);
+    vkx::debug::marker::setName(device, computePipeline, name);
+    device.destroyShaderModule(pipelineInfo.stage.module);
+    return computePipeline;
+}
+
+void ShadingRate::BeginFrame(uint32_t slot)
+{
+    GpuSettings* gpuSettings = reinterpret_cast<GpuSettings*>(static_cast<uint8_t*>(settingsMemory.mapped) + slot * settingsStride);
+    gpuSettings->center[0] = settings.center[0];
+    gpuSettings->center[1] = settings.center[1];
+    // without foveation nothing is ever that far from the center
+    gpuSettings->innerRadius = settings.foveated ? settings.innerRadius : 1e6f;
+    gpuSettings->outerRadius = settings.foveated ? std::max(settings.outerRadius, settings.innerRadius) : 1e6f;
+    gpuSettings->contrastThreshold = settings.contrastThreshold;
+    gpuSettings->pad[0] = gpuSettings->pad[1] = gpuSettings->pad[2] = 0.0f;
+}
+
+void ShadingRate::SetTargets(vk::Image sceneImage, vk::ImageView sceneView, vk::Extent2D Extent, ResourceTrash* trash)
+{
+    destroyTargets(trash);
+    extent = Extent;
+    contrast = sceneView;
+
+    // a texel for every part of the targets, the last ones reach past them
+    imageSize.width = (extent.width + texelSize.width - 1) / texelSize.width;
+    imageSize.height = (extent.height + texelSize.height - 1) / texelSize.height;
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = Format;
+    imageInfo.extent = vk::Extent3D(imageSize.width, imageSize.height, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eStorage | ShadingRateImageUsage;
+    image = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, image, "shading rate");
+    // sized after the swapchain like CommandBuffer's targets
+    imageMemory = commandBuffer.GetAllocator().AllocateImage(image, vk::MemoryPropertyFlagBits::eDeviceLocal, true, MemoryAllocator::Strategy::Linear,
+        MemoryAllocator::Category::Attachment);
+    assert(imageMemory && "out of device memory for the shading rate image");
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = Format;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    view = device.createImageView(viewInfo);
+
+    // Record expects the image where the previous frame's render pass left it. The first frame samples the scene
+    // color before a render pass ever wrote it, its rates are whatever the undefined contents give
+    uint32_t layoutCmdIndex = commandBuffer.Create(vk::CommandBufferLevel::ePrimary, true);
+    vk::CommandBuffer& layoutCmd = commandBuffer.GetCommandBuffer(layoutCmdIndex);
+    std::array<vk::ImageMemoryBarrier, 2> barriers;
+    barriers[0].oldLayout = vk::ImageLayout::eUndefined;
+    barriers[0].newLayout = ShadingRateOptimalLayout;
+    barriers[0].dstAccessMask = ShadingRateImageReadAccess;
+    barriers[0].image = image;
+    barriers[0].subresourceRange = viewInfo.subresourceRange;
+    barriers[1] = barriers[0];
+    barriers[1].newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    barriers[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    barriers[1].image = sceneImage;
+    layoutCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlags(ShadingRateImageStage) | vk::PipelineStageFlagBits::eComputeShader,
+        vk::DependencyFlags(), nullptr, nullptr, vk::ArrayProxy<const vk::ImageMemoryBarrier>(contrast ? 2 : 1, barriers.data()));
+    commandBuffer.Flush(layoutCmdIndex);
+
+    // one pool per target set, it is retired together with the image
+    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
+        vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, 1),
+        vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 1)
+    };
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo;
+    descriptorPoolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    descriptorPoolInfo.pPoolSizes = poolSizes.data();
+    descriptorPoolInfo.maxSets = 1;
+    descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+    set = device.allocateDescriptorSets(allocInfo)[0];
+
+    vk::DescriptorBufferInfo settingsInfo(settingsBuffer, 0, sizeof(GpuSettings));
+    vk::DescriptorImageInfo rateInfo(vk::Sampler(), view, vk::ImageLayout::eGeneral);
+    vk::DescriptorImageInfo sceneInfo(sampler, sceneView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    std::array<vk::WriteDescriptorSet, BindingCount> writes;
+    for (uint32_t binding = 0; binding < writes.size(); ++binding) {
+        writes[binding].dstSet = set;
+        writes[binding].dstBinding = binding;
+        writes[binding].descriptorCount = 1;
+    }
+    writes[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+    writes[0].pBufferInfo = &settingsInfo;
+    writes[1].descriptorType = vk::DescriptorType::eStorageImage;
+    writes[1].pImageInfo = &rateInfo;
+    writes[2].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    writes[2].pImageInfo = &sceneInfo;
+    device.updateDescriptorSets(vk::ArrayProxy<const vk::WriteDescriptorSet>(contrast ? BindingCount : BindingCount - 1, writes.data()), nullptr);
+}
+
+void ShadingRate::destroyTargets(ResourceTrash* trash)
+{
+    if (!image) {
+        return;
+    }
+
+    // the descriptor set goes with its pool, frames in flight may still read all of it
+    vk::Device dev = device;
+    MemoryAllocator* allocator = &commandBuffer.GetAllocator();
+    vk::Image oldImage = image;
+    vk::ImageView oldView = view;
+    MemoryAllocator::Allocation memory = imageMemory;
+    vk::DescriptorPool pool = descriptorPool;
+
+    ResourceTrash::Destroyer destroy = [dev, allocator, oldImage, oldView, memory, pool]() {
+        dev.destroyDescriptorPool(pool);
+        dev.destroyImageView(oldView);
+        dev.destroyImage(oldImage);
+        allocator->Free(memory);
+    };
+    if (trash) {
+        trash->Trash(destroy);
+    } else {
+        destroy();
+    }
+
+    image = vk::Image();
+    view = vk::ImageView();
+    imageMemory = MemoryAllocator::Allocation();
+    descriptorPool = vk::DescriptorPool();
+    set = vk::DescriptorSet();
+}
+
+void ShadingRate::Record(vk::CommandBuffer cmd, uint32_t slot, vk::Extent2D renderExtent) const
+{
+    Constants constants = {};
+    constants.imageSize[0] = imageSize.width;
+    constants.imageSize[1] = imageSize.height;
+    constants.texelSize[0] = texelSize.width;
+    constants.texelSize[1] = texelSize.height;
+    constants.renderSize[0] = renderExtent.width;
+    constants.renderSize[1] = renderExtent.height;
+    constants.sceneTexel[0] = 1.0f / extent.width;
+    constants.sceneTexel[1] = 1.0f / extent.height;
+
+    const uint32_t settingsOffset = slot * settingsStride;
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &set, 1, &settingsOffset);
+    cmd.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+
+    // the previous frame's draws are done reading the rates, on this queue in submission order
+    vk::ImageMemoryBarrier toStorage;
+    toStorage.srcAccessMask = vk::AccessFlags();
+    toStorage.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toStorage.oldLayout = ShadingRateOptimalLayout;
+    toStorage.newLayout = vk::ImageLayout::eGeneral;
+    toStorage.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toStorage.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toStorage.image = image;
+    toStorage.subresourceRange = vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+    cmd.pipelineBarrier(ShadingRateImageStage, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, nullptr, toStorage);
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, contrast ? contrastPipeline : foveatedPipeline);
+    cmd.dispatch((imageSize.width + GroupSize - 1) / GroupSize, (imageSize.height + GroupSize - 1) / GroupSize, 1);
+
+    // the render pass overwrites the scene color the dispatch read
+    vk::ImageMemoryBarrier toShadingRate = toStorage;
+    toShadingRate.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+    toShadingRate.dstAccessMask = ShadingRateImageReadAccess;
+    toShadingRate.oldLayout = vk::ImageLayout::eGeneral;
+    toShadingRate.newLayout = ShadingRateOptimalLayout;
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlags(ShadingRateImageStage) | vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::DependencyFlags(), nullptr, nullptr, toShadingRate);
+}
+
+void ShadingRate::Bind(vk::CommandBuffer cmd) const
+{
+    if (cmdBindShadingRateImage) {
+        reinterpret_cast<CmdBindShadingRateImage>(cmdBindShadingRateImage)(VkCommandBuffer(cmd), VkImageView(view), static_cast<VkImageLayout>(ShadingRateOptimalLayout));
+    }
+}
+} // End of namespace m3d
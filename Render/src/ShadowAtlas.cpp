@@ -0,0 +1,742 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ShadowAtlas.hpp"
+#include "Bounds.hpp"
+#include "GeometryArena.hpp"
+#include "PipelineRegistry.hpp"
+#include "Scene.hpp"
+#include "SubmitTimeline.hpp"
+#include "TransformStore.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t ShadowAtlas::MaxFacesPerLight;
+const uint32_t ShadowAtlas::MaxLocalLights;
+const uint32_t ShadowAtlas::NoShadow;
+const float ShadowAtlas::NearCoverage = 0.25f;
+
+static const char* ShadowVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\shadow.vert.spv";
+// of the range, where a light's depth starts
+static const float NearRatio = 0.05f;
+// wider spot cones are drawn at this half angle, a perspective of 180 degrees has no projection
+static const float MaxSpotHalfAngle = 1.4835f;
+// a light keeps its tile size while the size its coverage asks for stays within this much below or above
+static const float ShrinkSlack = 0.75f;
+static const float GrowSlack = 2.5f;
+// the cube faces of a point light, in the order the lit shaders pick them by major axis
+static const float CubeDirections[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+static uint32_t tileLevel(uint32_t size)
+{
+    uint32_t level = 0;
+    while ((ShadowAtlas::MaxTileSize >> level) > size) {
+        ++level;
+    }
+    return level;
+}
+
+// distance of the box to the center is below the radius
+static bool sphereOverlaps(const Aabb& box, const float center[3], float radius)
+{
+    if (box.Empty()) {
+        return false;
+    }
+    float distance = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        const float d = std::max(std::max(box.lower[c] - center[c], center[c] - box.upper[c]), 0.0f);
+        distance += d * d;
+    }
+    return distance <= radius * radius;
+}
+
+bool ShadowAtlas::LightKey::operator==(const LightKey& other) const
+{
+    return memcmp(this, &other, sizeof(LightKey)) == 0;
+}
+
+ShadowAtlas::ShadowAtlas(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, PipelineRegistry& Registry, SubmitTimeline& Timeline,
+    uint32_t queueFamilyIndex, uint32_t Resolution)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , registry(Registry)
+    , timeline(Timeline)
+    , resolution(Resolution)
+{
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    commandPool = device.createCommandPool(poolInfo);
+    vk::CommandBufferAllocateInfo allocInfo;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = 1;
+    commandBuffer = device.allocateCommandBuffers(allocInfo)[0];
+    vkx::debug::marker::setName(device, commandBuffer, "shadow atlas");
+
+    createTargets();
+    createPipeline();
+    resetTiles();
+    clear();
+}
+
+ShadowAtlas::~ShadowAtlas()
+{
+    timeline.Wait(submitted);
+    device.destroyCommandPool(commandPool);
+    device.destroyBuffer(table.buffer);
+    device.freeMemory(table.memory);
+    device.destroyFramebuffer(framebuffer);
+    device.destroyImageView(view);
+    device.destroyImage(image);
+    device.freeMemory(memory);
+    device.destroySampler(sampler);
+    device.destroyRenderPass(renderPass);
+}
+
+void ShadowAtlas::createTargets()
+{
+    // 32 bit float depth where it can be sampled, every device samples 16 bit unorm
+    vk::FormatProperties formatProps = physicalDevice.getFormatProperties(vk::Format::eD32Sfloat);
+    const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+    depthFormat = (formatProps.optimalTilingFeatures & needed) == needed ? vk::Format::eD32Sfloat : vk::Format::eD16Unorm;
+
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = depthFormat;
+    imageInfo.extent = vk::Extent3D(resolution, resolution, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    image = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, image, "shadow atlas");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory = device.allocateMemory(memAlloc);
+    device.bindImageMemory(image, memory, 0);
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = image;
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    viewInfo.format = depthFormat;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
+    view = device.createImageView(viewInfo);
+
+    // Depth only pass over the whole atlas, the tiles not drawn keep what they hold; drawn ones are cleared by a rect
+    vk::AttachmentDescription attachment;
+    attachment.format = depthFormat;
+    attachment.samples = vk::SampleCountFlagBits::e1;
+    attachment.loadOp = vk::AttachmentLoadOp::eLoad;
+    attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachment.initialLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    attachment.finalLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+
+    vk::AttachmentReference depthReference(0, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    // frames submitted earlier are done sampling the atlas, frames submitted later sample what was drawn
+    std::array<vk::SubpassDependency, 2> dependencies;
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+    dependencies[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
+    dependencies[0].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+    dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::RenderPassCreateInfo renderPassInfo;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+    renderPass = device.createRenderPass(renderPassInfo);
+    vkx::debug::marker::setName(device, renderPass, "shadow atlas pass");
+
+    vk::FramebufferCreateInfo framebufferInfo;
+    framebufferInfo.renderPass = renderPass;
+    framebufferInfo.attachmentCount = 1;
+    framebufferInfo.pAttachments = &view;
+    framebufferInfo.width = resolution;
+    framebufferInfo.height = resolution;
+    framebufferInfo.layers = 1;
+    framebuffer = device.createFramebuffer(framebufferInfo);
+
+    // 2x2 percentage closer filtering in the sampler, the shaders keep it inside a tile
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = vk::CompareOp::eLessOrEqual;
+    sampler = device.createSampler(samplerInfo);
+
+    // first faces of every light, then every face
+    vk::BufferCreateInfo bufferInfo;
+    bufferInfo.size = MaxLocalLights * sizeof(uint32_t) + MaxFaces * sizeof(GpuFace);
+    bufferInfo.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    table.buffer = device.createBuffer(bufferInfo);
+    memReqs = device.getBufferMemoryRequirements(table.buffer);
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    table.memory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(table.buffer, table.memory, 0);
+    vkx::debug::marker::setName(device, table.buffer, "shadow atlas table");
+}
+
+void ShadowAtlas::createPipeline()
+{
+    // the world to face matrix of the draw, times its world matrix; the same vertex shader as the cascades
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(m3d::math::Matrix4x4));
+    pipelineLayout = registry.GetPipelineLayout({}, { pushConstantRange });
+
+    PipelineDesc desc;
+    desc.renderPass = renderPass;
+    desc.layout = pipelineLayout;
+    desc.vertexShader = ShadowVertexShader;
+    desc.bindings = { PackedVertexFormat::Binding() };
+    desc.attributes = { PackedVertexFormat::Attribute(VertexSemantic::Position) };
+    desc.colorAttachments = 0;
+    // against acne on surfaces facing away from the light at a grazing angle
+    desc.depthBiasConstant = 1.25f;
+    desc.depthBiasSlope = 1.75f;
+    pipeline = registry.Get(desc);
+    vkx::debug::marker::setName(device, pipeline, "shadow atlas");
+}
+
+void ShadowAtlas::clear()
+{
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    commandBuffer.clearDepthStencilImage(image, vk::ImageLayout::eTransferDstOptimal, vk::ClearDepthStencilValue(1.0f, 0), range);
+    // every byte of NoShadow is 0xFF
+    commandBuffer.fillBuffer(table.buffer, 0, MaxLocalLights * sizeof(uint32_t), NoShadow);
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    vk::BufferMemoryBarrier bufferBarrier;
+    bufferBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    bufferBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    bufferBarrier.buffer = table.buffer;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr,
+        bufferBarrier, barrier);
+    commandBuffer.end();
+
+    uploadedFirstFaces.assign(MaxLocalLights, NoShadow);
+    uploadedFaces.clear();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    // one vkQueueSubmit with the frame
+    submitted = timeline.Defer(submitInfo);
+}
+
+void ShadowAtlas::resetTiles()
+{
+    freeTiles.assign(tileLevel(MinTileSize) + 1, std::vector<Tile>());
+    for (uint32_t y = 0; y + MaxTileSize <= resolution; y += MaxTileSize) {
+        for (uint32_t x = 0; x + MaxTileSize <= resolution; x += MaxTileSize) {
+            const Tile tile = { x, y, MaxTileSize };
+            freeTiles[0].push_back(tile);
+        }
+    }
+}
+
+bool ShadowAtlas::allocateTile(uint32_t size, Tile& tile)
+{
+    const uint32_t level = tileLevel(size);
+    // the smallest free tile that holds size, split down to it
+    uint32_t from = level + 1;
+    while (from > 0 && freeTiles[from - 1].empty()) {
+        --from;
+    }
+    if (from == 0) {
+        return false;
+    }
+    tile = freeTiles[from - 1].back();
+    freeTiles[from - 1].pop_back();
+    for (uint32_t split = from - 1; split < level; ++split) {
+        const uint32_t half = tile.size / 2;
+        const Tile quarters[3] = { { tile.x + half, tile.y, half }, { tile.x, tile.y + half, half }, { tile.x + half, tile.y + half, half } };
+        freeTiles[split + 1].insert(freeTiles[split + 1].end(), quarters, quarters + 3);
+        tile.size = half;
+    }
+    return true;
+}
+
+void ShadowAtlas::freeTile(const Tile& freed)
+{
+    Tile tile = freed;
+    uint32_t level = tileLevel(tile.size);
+    // merge with the three siblings while they are free as well
+    while (level > 0) {
+        std::vector<Tile>& siblings = freeTiles[level];
+        const uint32_t parentX = tile.x & ~(tile.size * 2 - 1);
+        const uint32_t parentY = tile.y & ~(tile.size * 2 - 1);
+        std::vector<Tile>::iterator found[3];
+        uint32_t foundCount = 0;
+        for (auto it = siblings.begin(); it != siblings.end() && foundCount < 3; ++it) {
+            if ((it->x & ~(tile.size * 2 - 1)) == parentX && (it->y & ~(tile.size * 2 - 1)) == parentY) {
+                found[foundCount++] = it;
+            }
+        }
+        if (foundCount < 3) {
+            break;
+        }
+        // back to front, the earlier iterators stay valid
+        for (int i = 2; i >= 0; --i) {
+            siblings.erase(found[i]);
+        }
+        tile.x = parentX;
+        tile.y = parentY;
+        tile.size *= 2;
+        --level;
+    }
+    freeTiles[level].push_back(tile);
+}
+
+void ShadowAtlas::releaseTiles(LightShadow& shadow)
+{
+    for (uint32_t face = 0; face < shadow.faceCount; ++face) {
+        freeTile(shadow.tiles[face]);
+    }
+    shadow.faceCount = 0;
+    shadow.drawn = false;
+    shadow.current = false;
+}
+
+void ShadowAtlas::CastersMoved(const Scene& scene, const std::vector<uint32_t>& slots)
+{
+    if (resolution == 1 || staticDirty || slots.empty()) {
+        return;
+    }
+    bvhStale = true;
+    for (uint32_t slot : slots) {
+        if (slot >= slotBounds.size()) {
+            continue;
+        }
+        // where the instances were and where they are now
+        Aabb moved = slotBounds[slot];
+        slotBounds[slot] = Aabb();
+        for (auto entry = std::lower_bound(slotInstances.begin(), slotInstances.end(), std::make_pair(slot, 0u));
+             entry != slotInstances.end() && entry->first == slot; ++entry) {
+            if (scene.instances.contains(entry->second)) {
+                const Instance& instance = scene.instances[entry->second];
+                if (scene.meshes.contains(instance.meshId)) {
+                    slotBounds[slot].Expand(scene.meshes[instance.meshId].bounds.Transformed(scene.transformStore.GetWorld(instance.transformId)));
+                }
+            }
+        }
+        moved.Expand(slotBounds[slot]);
+        for (auto& entry : shadows) {
+            LightShadow& shadow = entry.second;
+            if (shadow.faceCount > 0 && sphereOverlaps(moved, shadow.key.position, shadow.key.range)) {
+                shadow.castersMoved = true;
+            }
+        }
+    }
+}
+
+void ShadowAtlas::placeFaces(LightShadow& shadow, const m3d::math::Vector3& position, const m3d::math::Vector3& direction, float range, float cone)
+{
+    const float nearZ = range * NearRatio;
+    // clip z = a * z + b over w = z, 0 at the near plane and 1 at the range
+    const float a = range / (range - nearZ);
+    const float b = -range * nearZ / (range - nearZ);
+    const float slope = shadow.faceCount == 1 ? std::tan(std::min(cone, MaxSpotHalfAngle)) : 1.0f;
+    for (uint32_t face = 0; face < shadow.faceCount; ++face) {
+        m3d::math::Vector3 forward = shadow.faceCount == 1 ? direction
+                                                           : m3d::math::Vector3(CubeDirections[face][0], CubeDirections[face][1], CubeDirections[face][2]);
+        m3d::math::Vector3 up = std::fabs(forward.y) < 0.99f ? m3d::math::Vector3(0.0f, 1.0f, 0.0f) : m3d::math::Vector3(1.0f, 0.0f, 0.0f);
+        m3d::math::Vector3 right = m3d::math::Vector3::CrossProduct(forward, up);
+        right.Normalize();
+        up = m3d::math::Vector3::CrossProduct(right, forward);
+
+        // perspective down forward from the light, x and y in [-1, 1] over the cone or the cube face
+        m3d::math::Matrix4x4& matrix = shadow.faces[face].matrix;
+        const m3d::math::Vector3 rows[3] = { right * (1.0f / slope), up * (1.0f / slope), forward * a };
+        for (int r = 0; r < 3; ++r) {
+            matrix.m[r][0] = rows[r].x;
+            matrix.m[r][1] = rows[r].y;
+            matrix.m[r][2] = rows[r].z;
+            matrix.m[r][3] = -m3d::math::Vector3::DotProduct(rows[r], position);
+        }
+        matrix.m[2][3] += b;
+        matrix.m[3][0] = forward.x;
+        matrix.m[3][1] = forward.y;
+        matrix.m[3][2] = forward.z;
+        matrix.m[3][3] = -m3d::math::Vector3::DotProduct(forward, position);
+
+        const Tile& tile = shadow.tiles[face];
+        float* rect = shadow.faces[face].rect;
+        rect[0] = static_cast<float>(tile.x) / resolution;
+        rect[1] = static_cast<float>(tile.y) / resolution;
+        rect[2] = static_cast<float>(tile.size) / resolution;
+        rect[3] = 0.5f / resolution;
+    }
+}
+
+void ShadowAtlas::Update(Scene& scene, GeometryArena& geometry, const m3d::math::Matrix4x4& viewMatrix, const m3d::math::Matrix4x4& projection)
+{
+    redrawCount = 0;
+    redrawTexels = 0;
+    shadowedCount = 0;
+    if (resolution == 1) {
+        return;
+    }
+    ++frame;
+    scene.transformStore.Update();
+
+    if (staticDirty) {
+        bvh.Build(scene);
+        // what every transform slot's instances cover, CastersMoved compares against it
+        slotInstances.clear();
+        slotBounds.clear();
+        for (uint32_t instanceID : scene.instances) {
+            const Instance& instance = scene.instances[instanceID];
+            const uint32_t slot = TransformStore::Slot(instance.transformId);
+            slotInstances.push_back(std::make_pair(slot, instanceID));
+            if (slot >= slotBounds.size()) {
+                slotBounds.resize(slot + 1);
+            }
+            if (scene.meshes.contains(instance.meshId) && scene.transformStore.Contains(instance.transformId)) {
+                slotBounds[slot].Expand(scene.meshes[instance.meshId].bounds.Transformed(scene.transformStore.GetWorld(instance.transformId)));
+            }
+        }
+        std::sort(slotInstances.begin(), slotInstances.end());
+        for (auto& entry : shadows) {
+            entry.second.drawn = false;
+        }
+        staticDirty = false;
+        bvhStale = false;
+    } else if (bvhStale) {
+        bvh.Refit(scene);
+        bvhStale = false;
+    }
+
+    // the point and spot lights in view, with their share of the screen height
+    struct Candidate {
+        LightShadow* shadow;
+        LightKey key;
+        m3d::math::Vector3 position;
+        m3d::math::Vector3 direction;
+    };
+    std::vector<Candidate> candidates;
+    m3d::math::Matrix4x4 viewProjection = projection;
+    const Frustum frustum = Frustum::FromViewProjection(viewProjection * viewMatrix);
+    uint32_t localIndex = 0;
+    for (uint32_t lightID : scene.lights) {
+        const Light& light = scene.lights[lightID];
+        if (light.type == Light::Directional) {
+            continue;
+        }
+        const uint32_t index = localIndex++;
+        if (index >= MaxLocalLights) {
+            break;
+        }
+        // where ClusteredLights puts it: column vector world matrix, -Y is the negated second column
+        const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(light.transformId);
+        float scale = 0.0f;
+        for (int c = 0; c < 3; ++c) {
+            scale = std::max(scale, std::sqrt(world.m[0][c] * world.m[0][c] + world.m[1][c] * world.m[1][c] + world.m[2][c] * world.m[2][c]));
+        }
+        const m3d::math::Vector3 position(world.m[0][3], world.m[1][3], world.m[2][3]);
+        m3d::math::Vector3 direction(-world.m[0][1], -world.m[1][1], -world.m[2][1]);
+        direction.Normalize();
+        const float range = light.range * scale;
+        if (range <= 0.0f) {
+            continue;
+        }
+        bool visible = true;
+        for (int p = 0; p < Frustum::PlaneCount && visible; ++p) {
+            const float* plane = frustum.planes[p];
+            visible = plane[0] * position.x + plane[1] * position.y + plane[2] * position.z + plane[3] >= -range;
+        }
+        if (!visible) {
+            continue;
+        }
+        const float depth = -(viewMatrix.m[2][0] * position.x + viewMatrix.m[2][1] * position.y + viewMatrix.m[2][2] * position.z + viewMatrix.m[2][3]);
+
+        Candidate candidate;
+        candidate.shadow = &shadows[lightID];
+        candidate.shadow->seenFrame = frame;
+        candidate.shadow->localIndex = index;
+        candidate.shadow->coverage = depth <= range ? 1.0f : std::min(1.0f, range * projection.m[1][1] / depth);
+        memset(&candidate.key, 0, sizeof(candidate.key));
+        candidate.key.position[0] = position.x;
+        candidate.key.position[1] = position.y;
+        candidate.key.position[2] = position.z;
+        candidate.key.range = range;
+        candidate.key.type = light.type;
+        // a point light's faces do not turn with it
+        if (light.type == Light::Spot) {
+            candidate.key.direction[0] = direction.x;
+            candidate.key.direction[1] = direction.y;
+            candidate.key.direction[2] = direction.z;
+            candidate.key.cone = light.outerCone;
+        }
+        candidate.position = position;
+        candidate.direction = direction;
+        candidates.push_back(candidate);
+    }
+
+    // the largest first, the ones past MaxShadowedLights and out of view give their tiles back
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.shadow->coverage != b.shadow->coverage ? a.shadow->coverage > b.shadow->coverage : a.shadow->localIndex < b.shadow->localIndex;
+    });
+    if (candidates.size() > MaxShadowedLights) {
+        for (size_t i = MaxShadowedLights; i < candidates.size(); ++i) {
+            candidates[i].shadow->seenFrame = 0;
+        }
+        candidates.resize(MaxShadowedLights);
+    }
+    for (auto it = shadows.begin(); it != shadows.end();) {
+        if (it->second.seenFrame != frame) {
+            releaseTiles(it->second);
+            it = shadows.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // tile sizes, lights whose size changed first give theirs back so larger lights find room
+    std::vector<uint32_t> sizes(candidates.size());
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        LightShadow& shadow = *candidates[i].shadow;
+        const uint32_t faceCount = candidates[i].key.type == Light::Spot ? 1 : MaxFacesPerLight;
+        // a point light's faces each cover a quarter of its sphere's silhouette
+        const float texels = shadow.coverage * MaxTileSize * (faceCount == 1 ? 1.0f : 0.5f);
+        const uint32_t current = shadow.faceCount == faceCount ? shadow.tiles[0].size : 0;
+        if (current && texels >= current * ShrinkSlack && (texels < current * GrowSlack || current == MaxTileSize)) {
+            sizes[i] = current;
+            continue;
+        }
+        uint32_t size = MaxTileSize;
+        while (size > MinTileSize && size > texels) {
+            size /= 2;
+        }
+        sizes[i] = size;
+        if (size != current) {
+            releaseTiles(shadow);
+        }
+    }
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        LightShadow& shadow = *candidates[i].shadow;
+        if (shadow.faceCount > 0) {
+            continue;
+        }
+        const uint32_t faceCount = candidates[i].key.type == Light::Spot ? 1 : MaxFacesPerLight;
+        // smaller tiles while the atlas is full, then the tiles of smaller lights
+        size_t evict = candidates.size();
+        for (uint32_t size = sizes[i]; size >= MinTileSize && shadow.faceCount == 0;) {
+            uint32_t placed = 0;
+            while (placed < faceCount && allocateTile(size, shadow.tiles[placed])) {
+                ++placed;
+            }
+            if (placed == faceCount) {
+                shadow.faceCount = faceCount;
+                break;
+            }
+            for (uint32_t face = 0; face < placed; ++face) {
+                freeTile(shadow.tiles[face]);
+            }
+            while (evict > i + 1 && candidates[evict - 1].shadow->faceCount == 0) {
+                --evict;
+            }
+            if (evict > i + 1) {
+                releaseTiles(*candidates[--evict].shadow);
+            } else {
+                size /= 2;
+            }
+        }
+        shadow.drawn = false;
+        shadow.current = false;
+    }
+
+    // what is due: no drawing yet, then a changed light, then moved casters; the largest and longest waiting first
+    std::vector<Candidate*> due;
+    for (Candidate& candidate : candidates) {
+        LightShadow& shadow = *candidate.shadow;
+        if (shadow.faceCount == 0) {
+            continue;
+        }
+        candidate.key.tileSize = shadow.tiles[0].size;
+        if (!(candidate.key == shadow.key)) {
+            shadow.drawn = false;
+        }
+        const bool refresh = shadow.castersMoved && (shadow.coverage >= NearCoverage || frame - shadow.drawnFrame >= RefreshInterval);
+        if (!shadow.drawn || refresh) {
+            due.push_back(&candidate);
+        }
+    }
+    auto urgency = [](const LightShadow& shadow) { return shadow.current ? (shadow.drawn ? 0 : 1) : 2; };
+    std::sort(due.begin(), due.end(), [&urgency](const Candidate* a, const Candidate* b) {
+        const LightShadow& sa = *a->shadow;
+        const LightShadow& sb = *b->shadow;
+        if (urgency(sa) != urgency(sb)) {
+            return urgency(sa) > urgency(sb);
+        }
+        if (sa.coverage != sb.coverage) {
+            return sa.coverage > sb.coverage;
+        }
+        return sa.drawnFrame < sb.drawnFrame;
+    });
+    std::vector<LightShadow*> redraw;
+    for (Candidate* candidate : due) {
+        LightShadow& shadow = *candidate->shadow;
+        const uint32_t texels = shadow.faceCount * shadow.tiles[0].size * shadow.tiles[0].size;
+        if (!redraw.empty() && redrawTexels + texels > TexelBudget) {
+            continue;
+        }
+        redrawTexels += texels;
+        shadow.key = candidate->key;
+        placeFaces(shadow, candidate->position, candidate->direction, candidate->key.range, candidate->key.cone);
+        shadow.drawn = true;
+        shadow.current = true;
+        shadow.castersMoved = false;
+        shadow.drawnFrame = frame;
+        redraw.push_back(&shadow);
+        redrawCount += shadow.faceCount;
+    }
+
+    // the table of the drawings the shaders use
+    firstFaces.assign(MaxLocalLights, NoShadow);
+    faces.clear();
+    for (const Candidate& candidate : candidates) {
+        const LightShadow& shadow = *candidate.shadow;
+        if (shadow.faceCount > 0 && shadow.current) {
+            firstFaces[shadow.localIndex] = static_cast<uint32_t>(faces.size());
+            faces.insert(faces.end(), shadow.faces, shadow.faces + shadow.faceCount);
+            ++shadowedCount;
+        }
+    }
+    const bool copyTable = firstFaces != uploadedFirstFaces || faces.size() != uploadedFaces.size()
+        || (!faces.empty() && memcmp(faces.data(), uploadedFaces.data(), faces.size() * sizeof(GpuFace)) != 0);
+    if (copyTable || !redraw.empty()) {
+        record(scene, geometry, redraw, copyTable);
+    }
+}
+
+void ShadowAtlas::record(Scene& scene, GeometryArena& geometry, const std::vector<LightShadow*>& redraw, bool copyTable)
+{
+    // normally long done, the command buffer is recorded again
+    timeline.Wait(submitted);
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    if (copyTable) {
+        // frames submitted earlier are done reading the table, frames submitted later read the copy
+        vk::BufferMemoryBarrier barrier;
+        barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.buffer = table.buffer;
+        barrier.size = VK_WHOLE_SIZE;
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr,
+            barrier, nullptr);
+        // both well below the 64 KB of vkCmdUpdateBuffer
+        commandBuffer.updateBuffer(table.buffer, 0, MaxLocalLights * sizeof(uint32_t), firstFaces.data());
+        if (!faces.empty()) {
+            commandBuffer.updateBuffer(table.buffer, MaxLocalLights * sizeof(uint32_t), faces.size() * sizeof(GpuFace), faces.data());
+        }
+        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr,
+            barrier, nullptr);
+        uploadedFirstFaces = firstFaces;
+        uploadedFaces = faces;
+    }
+
+    if (!redraw.empty()) {
+        vk::RenderPassBeginInfo renderPassBeginInfo;
+        renderPassBeginInfo.renderPass = renderPass;
+        renderPassBeginInfo.framebuffer = framebuffer;
+        renderPassBeginInfo.renderArea.extent = vk::Extent2D(resolution, resolution);
+        commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+        vk::DeviceSize offsets[1] = { 0 };
+        vk::ClearAttachment clearAttachment(vk::ImageAspectFlagBits::eDepth, 0, vk::ClearDepthStencilValue(1.0f, 0));
+
+        for (const LightShadow* shadow : redraw) {
+            for (uint32_t face = 0; face < shadow->faceCount; ++face) {
+                const Tile& tile = shadow->tiles[face];
+                vk::Viewport viewport(static_cast<float>(tile.x), static_cast<float>(tile.y), static_cast<float>(tile.size), static_cast<float>(tile.size),
+                    0.0f, 1.0f);
+                vk::Rect2D scissor(vk::Offset2D(tile.x, tile.y), vk::Extent2D(tile.size, tile.size));
+                commandBuffer.setViewport(0, 1, &viewport);
+                commandBuffer.setScissor(0, 1, &scissor);
+                vk::ClearRect clearRect(scissor, 0, 1);
+                commandBuffer.clearAttachments(1, &clearAttachment, 1, &clearRect);
+
+                casters.clear();
+                const m3d::math::Matrix4x4& faceMatrix = shadow->faces[face].matrix;
+                bvh.QueryFrustum(Frustum::FromViewProjection(faceMatrix), casters);
+                uint32_t boundBlock = Mesh::InvalidBlock;
+                for (uint32_t instanceID : casters) {
+                    const Instance& instance = scene.instances[instanceID];
+                    if (!scene.meshes.contains(instance.meshId) || !scene.meshes[instance.meshId].resident) {
+                        continue;
+                    }
+                    const Mesh& mesh = scene.meshes[instance.meshId];
+                    if (mesh.geometryBlock != boundBlock) {
+                        const GeometryArena::Block& block = geometry.GetBlock(mesh.geometryBlock);
+                        commandBuffer.bindVertexBuffers(0, 1, &block.buffer, offsets);
+                        commandBuffer.bindIndexBuffer(block.buffer, 0, block.indexType);
+                        boundBlock = mesh.geometryBlock;
+                    }
+                    m3d::math::Matrix4x4 matrix = faceMatrix;
+                    m3d::math::Matrix4x4 shadowModel = matrix * scene.transformStore.GetWorld(instance.transformId);
+                    commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(shadowModel), &shadowModel);
+                    for (const Mesh::Slice& slice : mesh.slices) {
+                        commandBuffer.drawIndexed(slice.triangleCount * 3, 1, mesh.firstIndex + slice.indexOffset, mesh.vertexOffset, 0);
+                    }
+                }
+            }
+        }
+        commandBuffer.endRenderPass();
+    }
+    commandBuffer.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    // one vkQueueSubmit with the frame
+    submitted = timeline.Defer(submitInfo);
+}
+} // End of namespace m3d
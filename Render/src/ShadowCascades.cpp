@@ -0,0 +1,416 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ShadowCascades.hpp"
+#include "Bounds.hpp"
+#include "GeometryArena.hpp"
+#include "PipelineRegistry.hpp"
+#include "Scene.hpp"
+#include "SubmitTimeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace m3d {
+
+const uint32_t ShadowCascades::CascadeCount;
+const float ShadowCascades::SplitLambda = 0.75f;
+
+static const char* ShadowVertexShader = "D:\\workspace\\m3d\\data\\shaders\\camera\\shadow.vert.spv";
+// of the sphere radius: the center snaps to this grid and the map reaches this far past the sphere
+static const float CachePadding = 0.125f;
+
+bool ShadowCascades::CascadeKey::operator==(const CascadeKey& other) const
+{
+    return memcmp(this, &other, sizeof(CascadeKey)) == 0;
+}
+
+ShadowCascades::ShadowCascades(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, PipelineRegistry& Registry, SubmitTimeline& Timeline,
+    uint32_t queueFamilyIndex, uint32_t Resolution)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , registry(Registry)
+    , timeline(Timeline)
+    , resolution(Resolution)
+{
+    memset(cached, 0, sizeof(cached));
+    memset(keys, 0, sizeof(keys));
+    memset(splits, 0, sizeof(splits));
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+    commandPool = device.createCommandPool(poolInfo);
+    vk::CommandBufferAllocateInfo allocInfo;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = vk::CommandBufferLevel::ePrimary;
+    allocInfo.commandBufferCount = 1;
+    commandBuffer = device.allocateCommandBuffers(allocInfo)[0];
+    vkx::debug::marker::setName(device, commandBuffer, "shadow cascades");
+
+    createTargets();
+    createPipeline();
+    clearMaps();
+}
+
+ShadowCascades::~ShadowCascades()
+{
+    timeline.Wait(submitted);
+    device.destroyCommandPool(commandPool);
+    for (uint32_t i = 0; i < CascadeCount; ++i) {
+        device.destroyFramebuffer(framebuffers[i]);
+        device.destroyImageView(layerViews[i]);
+    }
+    device.destroyImageView(arrayView);
+    device.destroyImage(image);
+    device.freeMemory(memory);
+    device.destroySampler(sampler);
+    device.destroyRenderPass(renderPass);
+}
+
+void ShadowCascades::createTargets()
+{
+    // 32 bit float depth where it can be sampled, every device samples 16 bit unorm
+    vk::FormatProperties formatProps = physicalDevice.getFormatProperties(vk::Format::eD32Sfloat);
+    const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eDepthStencilAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+    depthFormat = (formatProps.optimalTilingFeatures & needed) == needed ? vk::Format::eD32Sfloat : vk::Format::eD16Unorm;
+
+    vk::ImageCreateInfo imageInfo;
+    imageInfo.imageType = vk::ImageType::e2D;
+    imageInfo.format = depthFormat;
+    imageInfo.extent = vk::Extent3D(resolution, resolution, 1);
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = CascadeCount;
+    imageInfo.samples = vk::SampleCountFlagBits::e1;
+    imageInfo.tiling = vk::ImageTiling::eOptimal;
+    imageInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    image = device.createImage(imageInfo);
+    vkx::debug::marker::setName(device, image, "shadow cascades");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(image);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    memory = device.allocateMemory(memAlloc);
+    device.bindImageMemory(image, memory, 0);
+
+    vk::ImageViewCreateInfo viewInfo;
+    viewInfo.image = image;
+    viewInfo.viewType = vk::ImageViewType::e2DArray;
+    viewInfo.format = depthFormat;
+    viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, CascadeCount);
+    arrayView = device.createImageView(viewInfo);
+
+    // Depth only pass, the previous contents of a redrawn cascade are of no use
+    vk::AttachmentDescription attachment;
+    attachment.format = depthFormat;
+    attachment.samples = vk::SampleCountFlagBits::e1;
+    attachment.loadOp = vk::AttachmentLoadOp::eClear;
+    attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    attachment.initialLayout = vk::ImageLayout::eUndefined;
+    attachment.finalLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+
+    vk::AttachmentReference depthReference(0, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+    vk::SubpassDescription subpass;
+    subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+    subpass.pDepthStencilAttachment = &depthReference;
+
+    // frames submitted earlier are done sampling the map, frames submitted later sample what was drawn
+    std::array<vk::SubpassDependency, 2> dependencies;
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests;
+    dependencies[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
+    dependencies[0].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+    dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+    dependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+    dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::RenderPassCreateInfo renderPassInfo;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &attachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+    renderPass = device.createRenderPass(renderPassInfo);
+    vkx::debug::marker::setName(device, renderPass, "shadow pass");
+
+    viewInfo.viewType = vk::ImageViewType::e2D;
+    for (uint32_t i = 0; i < CascadeCount; ++i) {
+        viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, i, 1);
+        layerViews[i] = device.createImageView(viewInfo);
+
+        vk::FramebufferCreateInfo framebufferInfo;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &layerViews[i];
+        framebufferInfo.width = resolution;
+        framebufferInfo.height = resolution;
+        framebufferInfo.layers = 1;
+        framebuffers[i] = device.createFramebuffer(framebufferInfo);
+    }
+
+    // 2x2 percentage closer filtering in the sampler, outside of every map is lit
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = vk::Filter::eLinear;
+    samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToBorder;
+    samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToBorder;
+    samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerInfo.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = vk::CompareOp::eLessOrEqual;
+    sampler = device.createSampler(samplerInfo);
+}
+
+void ShadowCascades::createPipeline()
+{
+    // the world to cascade matrix of the draw, times its world matrix
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(m3d::math::Matrix4x4));
+    pipelineLayout = registry.GetPipelineLayout({}, { pushConstantRange });
+
+    PipelineDesc desc;
+    desc.renderPass = renderPass;
+    desc.layout = pipelineLayout;
+    desc.vertexShader = ShadowVertexShader;
+    desc.bindings = { PackedVertexFormat::Binding() };
+    desc.attributes = { PackedVertexFormat::Attribute(VertexSemantic::Position) };
+    desc.colorAttachments = 0;
+    // against acne on surfaces facing away from the light at a grazing angle
+    desc.depthBiasConstant = 1.25f;
+    desc.depthBiasSlope = 1.75f;
+    pipeline = registry.Get(desc);
+    vkx::debug::marker::setName(device, pipeline, "shadow");
+}
+
+void ShadowCascades::clearMaps()
+{
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, CascadeCount);
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = vk::ImageLayout::eUndefined;
+    barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    commandBuffer.clearDepthStencilImage(image, vk::ImageLayout::eTransferDstOptimal, vk::ClearDepthStencilValue(1.0f, 0), range);
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(), nullptr, nullptr, barrier);
+    commandBuffer.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    // one vkQueueSubmit with the frame
+    submitted = timeline.Defer(submitInfo);
+}
+
+bool ShadowCascades::Update(Scene& scene, GeometryArena& geometry, const m3d::math::Matrix4x4& view, const m3d::math::Matrix4x4& projection,
+    float nearZ, float farZ)
+{
+    redrawCount = 0;
+    scene.transformStore.Update();
+
+    // the main light, ClusteredLights puts the same one first
+    const Light* mainLight = nullptr;
+    for (uint32_t lightID : scene.lights) {
+        if (scene.lights[lightID].type == Light::Directional) {
+            mainLight = &scene.lights[lightID];
+            break;
+        }
+    }
+    cascadeCount = mainLight && resolution > 1 ? CascadeCount : 0;
+    if (!cascadeCount) {
+        return false;
+    }
+
+    if (staticDirty) {
+        bvh.Build(scene);
+        memset(cached, 0, sizeof(cached));
+        staticDirty = false;
+    }
+
+    // light space basis, the light shines down -Y of its node
+    const m3d::math::Matrix4x4& lightWorld = scene.transformStore.GetWorld(mainLight->transformId);
+    m3d::math::Vector3 forward(-lightWorld.m[0][1], -lightWorld.m[1][1], -lightWorld.m[2][1]);
+    forward.Normalize();
+    m3d::math::Vector3 up = std::fabs(forward.y) < 0.99f ? m3d::math::Vector3(0.0f, 1.0f, 0.0f) : m3d::math::Vector3(1.0f, 0.0f, 0.0f);
+    m3d::math::Vector3 right = m3d::math::Vector3::CrossProduct(forward, up);
+    right.Normalize();
+    up = m3d::math::Vector3::CrossProduct(right, forward);
+    const m3d::math::Vector3 axes[3] = { right, up, forward };
+
+    // every static caster lies within the scene's depth range along the light, whatever the cascade
+    const Aabb& sceneBounds = bvh.GetBounds();
+    float depthRange[2] = { 0.0f, 1.0f };
+    if (!sceneBounds.Empty()) {
+        depthRange[0] = FLT_MAX;
+        depthRange[1] = -FLT_MAX;
+        for (uint32_t corner = 0; corner < 8; ++corner) {
+            const m3d::math::Vector3 p((corner & 1) ? sceneBounds.upper[0] : sceneBounds.lower[0], (corner & 2) ? sceneBounds.upper[1] : sceneBounds.lower[1],
+                (corner & 4) ? sceneBounds.upper[2] : sceneBounds.lower[2]);
+            const float z = m3d::math::Vector3::DotProduct(p, forward);
+            depthRange[0] = std::min(depthRange[0], z);
+            depthRange[1] = std::max(depthRange[1], z);
+        }
+        const float margin = std::max(0.01f, (depthRange[1] - depthRange[0]) * 0.01f);
+        depthRange[0] -= margin;
+        depthRange[1] += margin;
+    }
+
+    // world = R^T * (v - t) of the rigid view matrix
+    auto viewToWorld = [&view](float x, float y, float z) {
+        float v[3] = { x - view.m[0][3], y - view.m[1][3], z - view.m[2][3] };
+        return m3d::math::Vector3(view.m[0][0] * v[0] + view.m[1][0] * v[1] + view.m[2][0] * v[2],
+            view.m[0][1] * v[0] + view.m[1][1] * v[1] + view.m[2][1] * v[2], view.m[0][2] * v[0] + view.m[1][2] * v[1] + view.m[2][2] * v[2]);
+    };
+
+    std::vector<uint32_t> redraw;
+    float splitNear = nearZ;
+    for (uint32_t i = 0; i < CascadeCount; ++i) {
+        const float t = static_cast<float>(i + 1) / CascadeCount;
+        const float logSplit = nearZ * std::pow(farZ / nearZ, t);
+        const float uniformSplit = nearZ + (farZ - nearZ) * t;
+        splits[i] = SplitLambda * logSplit + (1.0f - SplitLambda) * uniformSplit;
+
+        // bounding sphere of the cascade's slice of the view frustum, its radius only depends on the projection
+        m3d::math::Vector3 corners[8];
+        m3d::math::Vector3 center(0.0f, 0.0f, 0.0f);
+        for (uint32_t corner = 0; corner < 8; ++corner) {
+            const float depth = (corner & 4) ? splits[i] : splitNear;
+            const float ndc[2] = { (corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f };
+            corners[corner] = viewToWorld((ndc[0] + projection.m[0][2]) * depth / projection.m[0][0], (ndc[1] + projection.m[1][2]) * depth / projection.m[1][1],
+                -depth);
+            center += corners[corner];
+        }
+        center *= 1.0f / 8.0f;
+        float radius = 0.0f;
+        for (const m3d::math::Vector3& corner : corners) {
+            const m3d::math::Vector3 offset = corner - center;
+            radius = std::max(radius, std::sqrt(m3d::math::Vector3::DotProduct(offset, offset)));
+        }
+        // rounded up so float noise does not change the key
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        splitNear = splits[i];
+
+        // snap the center to whole texels of a grid of CachePadding radii, the map reaches past the sphere by as much
+        const float halfExtent = radius * (1.0f + CachePadding);
+        const float texel = 2.0f * halfExtent / resolution;
+        const float step = std::max(texel, std::floor(radius * CachePadding / texel) * texel);
+        CascadeKey key;
+        memset(&key, 0, sizeof(key));
+        key.direction[0] = forward.x;
+        key.direction[1] = forward.y;
+        key.direction[2] = forward.z;
+        key.center[0] = std::floor(m3d::math::Vector3::DotProduct(center, right) / step + 0.5f) * step;
+        key.center[1] = std::floor(m3d::math::Vector3::DotProduct(center, up) / step + 0.5f) * step;
+        key.halfExtent = halfExtent;
+        key.depthRange[0] = depthRange[0];
+        key.depthRange[1] = depthRange[1];
+        if (cached[i] && key == keys[i]) {
+            continue;
+        }
+        keys[i] = key;
+        cached[i] = true;
+        redraw.push_back(i);
+
+        // orthographic along the light, x and y in [-1, 1] around the snapped center, z in [0, 1] over the depth range
+        const float scale[3] = { 1.0f / halfExtent, 1.0f / halfExtent, 1.0f / (depthRange[1] - depthRange[0]) };
+        const float offset[3] = { key.center[0], key.center[1], depthRange[0] };
+        m3d::math::Matrix4x4& matrix = matrices[i];
+        for (int r = 0; r < 3; ++r) {
+            matrix.m[r][0] = axes[r].x * scale[r];
+            matrix.m[r][1] = axes[r].y * scale[r];
+            matrix.m[r][2] = axes[r].z * scale[r];
+            matrix.m[r][3] = -offset[r] * scale[r];
+        }
+        matrix.m[3][0] = matrix.m[3][1] = matrix.m[3][2] = 0.0f;
+        matrix.m[3][3] = 1.0f;
+    }
+
+    if (!redraw.empty()) {
+        drawCascades(scene, geometry, redraw);
+    }
+    return true;
+}
+
+void ShadowCascades::drawCascades(Scene& scene, GeometryArena& geometry, const std::vector<uint32_t>& cascades)
+{
+    // normally long done, the command buffer is recorded again
+    timeline.Wait(submitted);
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    vk::ClearValue clearValue;
+    clearValue.depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+    vk::RenderPassBeginInfo renderPassBeginInfo;
+    renderPassBeginInfo.renderPass = renderPass;
+    renderPassBeginInfo.renderArea.extent = vk::Extent2D(resolution, resolution);
+    renderPassBeginInfo.clearValueCount = 1;
+    renderPassBeginInfo.pClearValues = &clearValue;
+    vk::Viewport viewport(0.0f, 0.0f, static_cast<float>(resolution), static_cast<float>(resolution), 0.0f, 1.0f);
+    vk::Rect2D scissor(vk::Offset2D(0, 0), vk::Extent2D(resolution, resolution));
+    vk::DeviceSize offsets[1] = { 0 };
+
+    for (uint32_t cascade : cascades) {
+        casters.clear();
+        bvh.QueryFrustum(Frustum::FromViewProjection(matrices[cascade]), casters);
+
+        renderPassBeginInfo.framebuffer = framebuffers[cascade];
+        commandBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+        commandBuffer.setViewport(0, 1, &viewport);
+        commandBuffer.setScissor(0, 1, &scissor);
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+
+        uint32_t boundBlock = Mesh::InvalidBlock;
+        for (uint32_t instanceID : casters) {
+            const Instance& instance = scene.instances[instanceID];
+            if (!scene.meshes.contains(instance.meshId) || !scene.meshes[instance.meshId].resident) {
+                continue;
+            }
+            const Mesh& mesh = scene.meshes[instance.meshId];
+            if (mesh.geometryBlock != boundBlock) {
+                const GeometryArena::Block& block = geometry.GetBlock(mesh.geometryBlock);
+                commandBuffer.bindVertexBuffers(0, 1, &block.buffer, offsets);
+                commandBuffer.bindIndexBuffer(block.buffer, 0, block.indexType);
+                boundBlock = mesh.geometryBlock;
+            }
+            m3d::math::Matrix4x4 cascadeMatrix = matrices[cascade];
+            m3d::math::Matrix4x4 shadowModel = cascadeMatrix * scene.transformStore.GetWorld(instance.transformId);
+            commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(shadowModel), &shadowModel);
+            for (const Mesh::Slice& slice : mesh.slices) {
+                commandBuffer.drawIndexed(slice.triangleCount * 3, 1, mesh.firstIndex + slice.indexOffset, mesh.vertexOffset, 0);
+            }
+        }
+        commandBuffer.endRenderPass();
+    }
+    commandBuffer.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    // one vkQueueSubmit with the frame
+    submitted = timeline.Defer(submitInfo);
+    redrawCount = static_cast<uint32_t>(cascades.size());
+}
+} // End of namespace m3d
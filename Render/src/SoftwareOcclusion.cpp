@@ -0,0 +1,324 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SoftwareOcclusion.hpp"
+#include "SIMD_Batch.h"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+namespace m3d {
+
+const uint32_t SoftwareOcclusion::Width;
+const uint32_t SoftwareOcclusion::Height;
+const uint32_t SoftwareOcclusion::Levels;
+
+// clip space w below which a point counts as on or behind the near plane
+static const float NearW = 1e-4f;
+// triangles reaching further off screen than this many pixels are left out, the edge functions lose precision
+static const float GuardBand = 16384.0f;
+// twice the area in square pixels, smaller triangles are not worth the setup
+static const float MinArea = 1e-6f;
+
+static m3d::math::Matrix4x4 transposed(const m3d::math::Matrix4x4& matrix)
+{
+    m3d::math::Matrix4x4 result;
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 4; ++c) {
+            result.m[r][c] = matrix.m[c][r];
+        }
+    }
+    return result;
+}
+
+SoftwareOcclusion::SoftwareOcclusion()
+    : worker(new ThreadPool(1, JobSystem::Priority::High))
+{
+    size_t size = 0;
+    for (uint32_t l = 0; l < Levels; ++l) {
+        size += (Width >> l) * (Height >> l);
+    }
+    // room to align the start
+    storage.resize(size + 4);
+    uintptr_t base = (reinterpret_cast<uintptr_t>(storage.data()) + 15) & ~static_cast<uintptr_t>(15);
+    levels[0] = reinterpret_cast<float*>(base);
+    for (uint32_t l = 1; l < Levels; ++l) {
+        levels[l] = levels[l - 1] + (Width >> (l - 1)) * (Height >> (l - 1));
+    }
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+    Wait();
+}
+
+void SoftwareOcclusion::AddOccluder(const Scene& scene, uint32_t instanceID)
+{
+    Wait();
+    if (!scene.instances.contains(instanceID) || IsOccluder(instanceID)) {
+        return;
+    }
+    const uint32_t meshID = scene.instances[instanceID].meshId;
+    if (!scene.meshes[meshID].HasGeometry()) {
+        // released by Scene::ReleaseGeometry, nothing to rasterize
+        return;
+    }
+    occluders[instanceID] = meshID;
+    OccluderMesh& occluder = meshes[meshID];
+    if (occluder.users++ > 0) {
+        return;
+    }
+
+    // the vertices the coarsest LOD references, in the order it first does
+    const Mesh& mesh = scene.meshes[meshID];
+    const PackedVertex* vertices = mesh.vertexData();
+    std::vector<uint32_t> remap(mesh.vertexCount(), UINT32_MAX);
+    for (const Mesh::Slice& slice : mesh.LodSlices(mesh.LodCount() - 1)) {
+        for (int i = 0; i < slice.triangleCount * 3; ++i) {
+            const uint32_t index = mesh.index(slice.indexOffset + i);
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = static_cast<uint32_t>(occluder.positions.size());
+                m3d::math::Vector4 position;
+                position.x = vertices[index].position[0];
+                position.y = vertices[index].position[1];
+                position.z = vertices[index].position[2];
+                position.w = 1.0f;
+                occluder.positions.push_back(position);
+            }
+            occluder.indices.push_back(remap[index]);
+        }
+    }
+}
+
+void SoftwareOcclusion::RemoveOccluder(uint32_t instanceID)
+{
+    Wait();
+    auto occluder = occluders.find(instanceID);
+    if (occluder == occluders.end()) {
+        return;
+    }
+    auto mesh = meshes.find(occluder->second);
+    if (--mesh->second.users == 0) {
+        meshes.erase(mesh);
+    }
+    occluders.erase(occluder);
+}
+
+void SoftwareOcclusion::Begin(const Scene& scene, const m3d::math::Matrix4x4& viewProjection)
+{
+    Wait();
+    frameViewProjection = viewProjection;
+    jobs.clear();
+    for (const auto& occluder : occluders) {
+        // removed from the scene without RemoveOccluder, nothing left to draw
+        if (!scene.instances.contains(occluder.first)) {
+            continue;
+        }
+        m3d::math::Matrix4x4 mvp = viewProjection;
+        mvp = mvp * scene.transformStore.GetWorld(scene.instances[occluder.first].transformId);
+        Job job;
+        job.mesh = &meshes[occluder.second];
+        job.transposedMvp = transposed(mvp);
+        jobs.push_back(job);
+    }
+    ready = true;
+    worker->Enqueue([this]() { rasterize(); });
+}
+
+void SoftwareOcclusion::Wait()
+{
+    worker->Wait();
+}
+
+void SoftwareOcclusion::rasterize()
+{
+    M3D_TRACE_ZONE("SoftwareOcclusion::rasterize");
+    std::fill(levels[0], levels[0] + Width * Height, FLT_MAX);
+    triangles = 0;
+    for (const Job& job : jobs) {
+        const OccluderMesh& mesh = *job.mesh;
+        clip.resize(mesh.positions.size());
+        m3d::math::VectorTransformArray(clip.data(), mesh.positions.data(), job.transposedMvp, clip.size());
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            float screen[3][3];
+            bool drawn = true;
+            for (int v = 0; v < 3 && drawn; ++v) {
+                const m3d::math::Vector4& p = clip[mesh.indices[i + v]];
+                // crossing the near plane, clipping it would cost more than the triangle is worth
+                drawn = p.w > NearW;
+                if (drawn) {
+                    const float invW = 1.0f / p.w;
+                    screen[v][0] = (p.x * invW * 0.5f + 0.5f) * Width;
+                    screen[v][1] = (p.y * invW * 0.5f + 0.5f) * Height;
+                    screen[v][2] = p.z * invW;
+                    drawn = std::fabs(screen[v][0]) < GuardBand && std::fabs(screen[v][1]) < GuardBand;
+                }
+            }
+            if (drawn) {
+                // both sides, the winding of the occluder LODs is not relied on
+                drawTriangle(screen[0], screen[1], screen[2]);
+                ++triangles;
+            }
+        }
+    }
+    buildMips();
+}
+
+void SoftwareOcclusion::drawTriangle(const float* v0, const float* v1, const float* v2)
+{
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v2[0] - v0[0]) * (v1[1] - v0[1]);
+    if (std::fabs(area) < MinArea) {
+        return;
+    }
+    if (area < 0.0f) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    const int minX = std::max(0, static_cast<int>(std::floor(std::min(v0[0], std::min(v1[0], v2[0])))));
+    const int maxX = std::min(static_cast<int>(Width) - 1, static_cast<int>(std::ceil(std::max(v0[0], std::max(v1[0], v2[0])))));
+    const int minY = std::max(0, static_cast<int>(std::floor(std::min(v0[1], std::min(v1[1], v2[1])))));
+    const int maxY = std::min(static_cast<int>(Height) - 1, static_cast<int>(std::ceil(std::max(v0[1], std::max(v1[1], v2[1])))));
+    if (minX > maxX || minY > maxY) {
+        return;
+    }
+
+    // edge function of the edge opposite to each corner, a * x + b * y + c, positive inside and the
+    // corner's barycentric weight times area; the depth is a plane in screen space as well
+    const float* corners[3] = { v0, v1, v2 };
+    float a[3], b[3], c[3];
+    float depth[3] = { 0.0f, 0.0f, 0.0f };
+    for (int e = 0; e < 3; ++e) {
+        const float* p = corners[(e + 1) % 3];
+        const float* q = corners[(e + 2) % 3];
+        a[e] = p[1] - q[1];
+        b[e] = q[0] - p[0];
+        c[e] = p[0] * q[1] - p[1] * q[0];
+        const float weight = corners[e][2] / area;
+        depth[0] += a[e] * weight;
+        depth[1] += b[e] * weight;
+        depth[2] += c[e] * weight;
+    }
+
+#if USE_SIMD
+    using namespace m3d::math;
+    // pixel centers of a run of 4
+    const VectorSIMD offsets = MakeVectorSIMD(0.5f, 1.5f, 2.5f, 3.5f);
+    const VectorSIMD zero = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f);
+    const VectorSIMD a0 = MakeVectorSIMD(a[0], a[0], a[0], a[0]);
+    const VectorSIMD a1 = MakeVectorSIMD(a[1], a[1], a[1], a[1]);
+    const VectorSIMD a2 = MakeVectorSIMD(a[2], a[2], a[2], a[2]);
+    const VectorSIMD depthX = MakeVectorSIMD(depth[0], depth[0], depth[0], depth[0]);
+    // runs start at multiples of 4, Width is one so they never leave the row
+    const int startX = minX & ~3;
+    for (int y = minY; y <= maxY; ++y) {
+        const float py = y + 0.5f;
+        float* row = levels[0] + y * Width;
+        const float row0 = b[0] * py + c[0], row1 = b[1] * py + c[1], row2 = b[2] * py + c[2], rowDepth = depth[1] * py + depth[2];
+        const VectorSIMD e0Row = MakeVectorSIMD(row0, row0, row0, row0);
+        const VectorSIMD e1Row = MakeVectorSIMD(row1, row1, row1, row1);
+        const VectorSIMD e2Row = MakeVectorSIMD(row2, row2, row2, row2);
+        const VectorSIMD depthRow = MakeVectorSIMD(rowDepth, rowDepth, rowDepth, rowDepth);
+        for (int x = startX; x <= maxX; x += 4) {
+            const float fx = static_cast<float>(x);
+            const VectorSIMD px = VectorAdd(MakeVectorSIMD(fx, fx, fx, fx), offsets);
+            const VectorSIMD inside = VectorAnd(VectorAnd(VectorCompareGreaterEqual(VectorMultiplyAdd(a0, px, e0Row), zero),
+                                                    VectorCompareGreaterEqual(VectorMultiplyAdd(a1, px, e1Row), zero)),
+                VectorCompareGreaterEqual(VectorMultiplyAdd(a2, px, e2Row), zero));
+            if (VectorMoveMask(inside) == 0) {
+                continue;
+            }
+            const VectorSIMD z = VectorMultiplyAdd(depthX, px, depthRow);
+            const VectorSIMD stored = VectorLoad4f(row + x);
+            VectorStore4f(VectorSelect(inside, stored, VectorMin(stored, z)), row + x);
+        }
+    }
+#else
+    for (int y = minY; y <= maxY; ++y) {
+        const float py = y + 0.5f;
+        float* row = levels[0] + y * Width;
+        for (int x = minX; x <= maxX; ++x) {
+            const float px = x + 0.5f;
+            if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f && a[2] * px + b[2] * py + c[2] >= 0.0f) {
+                row[x] = std::min(row[x], depth[0] * px + depth[1] * py + depth[2]);
+            }
+        }
+    }
+#endif
+}
+
+void SoftwareOcclusion::buildMips()
+{
+    for (uint32_t l = 1; l < Levels; ++l) {
+        const uint32_t width = Width >> l;
+        const uint32_t height = Height >> l;
+        const float* source = levels[l - 1];
+        float* target = levels[l];
+        for (uint32_t y = 0; y < height; ++y) {
+            const float* top = source + 2 * y * 2 * width;
+            const float* bottom = top + 2 * width;
+            for (uint32_t x = 0; x < width; ++x) {
+                target[y * width + x] = std::max(std::max(top[2 * x], top[2 * x + 1]), std::max(bottom[2 * x], bottom[2 * x + 1]));
+            }
+        }
+    }
+}
+
+bool SoftwareOcclusion::IsOccluded(const Aabb& worldBox) const
+{
+    if (!ready || worldBox.Empty()) {
+        return false;
+    }
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+    const float(*m)[4] = frameViewProjection.m;
+    for (int corner = 0; corner < 8; ++corner) {
+        const float x = corner & 1 ? worldBox.upper[0] : worldBox.lower[0];
+        const float y = corner & 2 ? worldBox.upper[1] : worldBox.lower[1];
+        const float z = corner & 4 ? worldBox.upper[2] : worldBox.lower[2];
+        const float w = m[3][0] * x + m[3][1] * y + m[3][2] * z + m[3][3];
+        if (w <= NearW) {
+            return false;
+        }
+        const float invW = 1.0f / w;
+        const float sx = ((m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3]) * invW * 0.5f + 0.5f) * Width;
+        const float sy = ((m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3]) * invW * 0.5f + 0.5f) * Height;
+        minX = std::min(minX, sx);
+        maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy);
+        maxY = std::max(maxY, sy);
+        minZ = std::min(minZ, (m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3]) * invW);
+    }
+    // outside of the view, frustum culling is not this test's business
+    if (maxX < 0.0f || maxY < 0.0f || minX >= Width || minY >= Height) {
+        return false;
+    }
+    int x0 = std::max(0, static_cast<int>(minX));
+    int y0 = std::max(0, static_cast<int>(minY));
+    int x1 = std::min(static_cast<int>(Width) - 1, static_cast<int>(maxX));
+    int y1 = std::min(static_cast<int>(Height) - 1, static_cast<int>(maxY));
+    uint32_t level = 0;
+    while (level + 1 < Levels && (x1 - x0 > 3 || y1 - y0 > 3)) {
+        ++level;
+        x0 >>= 1;
+        y0 >>= 1;
+        x1 >>= 1;
+        y1 >>= 1;
+    }
+    const uint32_t width = Width >> level;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            if (levels[level][y * width + x] >= minZ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+}
@@ -0,0 +1,62 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Startup.hpp"
+#include "RendererVulkan.hpp"
+#include "Trace.hpp"
+
+#include <chrono>
+#include <thread>
+
+namespace m3d {
+
+static double msSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void StartRenderer(RendererVulkan& renderer, Scene& scene, const std::string& path, bool useCooked,
+    uint32_t loadThreads, StartupStats* stats)
+{
+    M3D_TRACE_ZONE("StartRenderer");
+    StartupStats local;
+    StartupStats& result = stats ? *stats : local;
+    const auto tStart = std::chrono::high_resolution_clock::now();
+
+    // left encoded when the renderer decodes it
+    scene.gpuGeometryDecode = renderer.GetGpuGeometryDecode();
+    // the loader only writes scene and result.sceneMs/load, the calling thread reads them after the join
+    std::thread loader([&scene, &path, useCooked, loadThreads, &result, tStart]() {
+        M3D_TRACE_THREAD("startup scene");
+        M3D_TRACE_ZONE("startup scene");
+        scene.Init(path, useCooked);
+        std::vector<uint32_t> meshIDs;
+        LoadMeshes(&scene, &meshIDs, loadThreads, &result.load);
+        result.sceneMs = msSince(tStart);
+    });
+
+    {
+        M3D_TRACE_ZONE("startup device");
+        renderer.InitDevice();
+        result.deviceMs = msSince(tStart);
+    }
+
+    const auto tWait = std::chrono::high_resolution_clock::now();
+    {
+        M3D_TRACE_ZONE("startup wait for scene");
+        loader.join();
+    }
+    result.waitMs = msSince(tWait);
+
+    const auto tInit = std::chrono::high_resolution_clock::now();
+    {
+        M3D_TRACE_ZONE("startup init");
+        renderer.Init(&scene);
+    }
+    result.initMs = msSince(tInit);
+    result.totalMs = msSince(tStart);
+}
+} // End of namespace m3d
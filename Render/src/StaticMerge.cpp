@@ -0,0 +1,242 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "StaticMerge.hpp"
+#include "SIMD_Batch.h"
+#include "Scene.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <unordered_set>
+
+// Mesh::vertices, normals and uvs strides
+#define VERTEX_STRIDE 4
+#define NORMAL_STRIDE 3
+#define UV_STRIDE 2
+
+namespace m3d {
+
+namespace {
+    // slice of a static instance going into a merged mesh
+    struct Piece {
+        uint32_t instanceID;
+        uint32_t slice;
+    };
+
+    // cell x, y, z and material
+    typedef std::tuple<int32_t, int32_t, int32_t, uint32_t> GroupKey;
+}
+
+// Inverse of the octahedral encoding of Mesh::pack
+static void decodeOctahedral(const int16_t* encoded, float* n)
+{
+    float x = encoded[0] / 32767.0f;
+    float y = encoded[1] / 32767.0f;
+    const float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        const float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    const float length = sqrtf(x * x + y * y + z * z);
+    n[0] = x / length;
+    n[1] = y / length;
+    n[2] = z / length;
+}
+
+static bool isAnimated(const Scene& scene, const std::unordered_set<uint32_t>& animated, uint32_t transformID)
+{
+    for (uint32_t id = transformID; id != TransformStore::NoParent; id = scene.transformStore.GetParent(id)) {
+        if (animated.count(id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Append the triangles of a slice of mesh placed by world, positions and normals in world space
+static void appendPiece(const Mesh& mesh, const Mesh::Slice& slice, const m3d::math::Matrix4x4& world, Mesh& merged)
+{
+    // cofactors of the upper 3x3, the inverse transpose up to its determinant
+    float normalMatrix[3][3];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            const int r1 = (r + 1) % 3, r2 = (r + 2) % 3, c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+            normalMatrix[r][c] = world.m[r1][c1] * world.m[r2][c2] - world.m[r1][c2] * world.m[r2][c1];
+        }
+    }
+    float determinant = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        determinant += world.m[0][c] * normalMatrix[0][c];
+    }
+    // a mirroring transform turns the triangles inside out, flip them back
+    const bool mirrored = determinant < 0.0f;
+
+    const PackedVertex* vertices = mesh.vertexData();
+    const size_t firstIndex = static_cast<size_t>(slice.indexOffset);
+    const size_t indexCount = static_cast<size_t>(slice.triangleCount) * 3;
+    // the half uvs are gathered and converted at once after the loop
+    std::vector<uint16_t> halfUVs;
+    halfUVs.reserve(indexCount * UV_STRIDE);
+    // every corner gets a vertex of its own, build() welds them again
+    for (size_t i = 0; i < indexCount; ++i) {
+        const size_t corner = mirrored ? i - i % 3 + 2 - i % 3 : i;
+        const PackedVertex& vertex = vertices[mesh.index(firstIndex + corner)];
+
+        float normal[3];
+        decodeOctahedral(vertex.normal, normal);
+        float worldNormal[3];
+        float length = 0.0f;
+        for (int r = 0; r < 3; ++r) {
+            worldNormal[r] = normalMatrix[r][0] * normal[0] + normalMatrix[r][1] * normal[1] + normalMatrix[r][2] * normal[2];
+            length += worldNormal[r] * worldNormal[r];
+        }
+        length = sqrtf(length) * (mirrored ? -1.0f : 1.0f);
+
+        for (int r = 0; r < 3; ++r) {
+            merged.vertices.push_back(world.m[r][0] * vertex.position[0] + world.m[r][1] * vertex.position[1] + world.m[r][2] * vertex.position[2]
+                + world.m[r][3]);
+            merged.normals.push_back(length != 0.0f ? worldNormal[r] / length : 0.0f);
+        }
+        merged.vertices.push_back(1.0f);
+        halfUVs.push_back(vertex.uv[0]);
+        halfUVs.push_back(vertex.uv[1]);
+        merged.indices.push_back(static_cast<uint32_t>(merged.indices.size()));
+    }
+    const size_t firstUV = merged.uvs.size();
+    merged.uvs.resize(firstUV + halfUVs.size());
+    m3d::math::HalfToFloatArray(halfUVs.data(), merged.uvs.data() + firstUV, halfUVs.size());
+}
+
+static void finishMerged(Scene& scene, uint32_t transformID, Mesh& merged, StaticMergeStats& stats)
+{
+    merged.slices.push_back(Mesh::Slice(0, static_cast<int>(merged.indices.size() / 3)));
+    merged.build();
+    // like an imported mesh, only the packed vertices are kept
+    std::vector<float>().swap(merged.vertices);
+    std::vector<float>().swap(merged.normals);
+    std::vector<float>().swap(merged.uvs);
+
+    Instance instance;
+    instance.meshId = scene.meshes.insert(std::move(merged));
+    instance.transformId = transformID;
+    scene.instances.insert(instance);
+    ++stats.mergedMeshes;
+    merged = Mesh();
+}
+
+void MergeStaticInstances(Scene& scene, const StaticMergeSettings& settings, StaticMergeStats* pStats)
+{
+    StaticMergeStats stats;
+    scene.transformStore.Update();
+
+    std::unordered_set<uint32_t> animated;
+    for (const Animation& animation : scene.animations) {
+        animated.insert(animation.transformIds.begin(), animation.transformIds.end());
+    }
+
+    // static small instances by cell, ordered so cooking the same scene gives the same file
+    std::map<std::tuple<int32_t, int32_t, int32_t>, std::vector<uint32_t>> cells;
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        if (!scene.meshes.contains(instance.meshId) || isAnimated(scene, animated, instance.transformId)) {
+            continue;
+        }
+        Mesh& mesh = scene.meshes[instance.meshId];
+        if (mesh.vertexCount() == 0 || mesh.vertexCount() > settings.maxMeshVertices || mesh.bounds.Empty()) {
+            continue;
+        }
+        // the vertices are baked into world space, decoded again when Scene::ReleaseGeometry dropped them
+        if (!mesh.RestoreGeometry()) {
+            continue;
+        }
+        const m3d::math::Matrix4x4& world = scene.transformStore.GetWorld(instance.transformId);
+        int32_t cell[3];
+        for (int r = 0; r < 3; ++r) {
+            const float center = world.m[r][0] * mesh.bounds.Center(0) + world.m[r][1] * mesh.bounds.Center(1) + world.m[r][2] * mesh.bounds.Center(2)
+                + world.m[r][3];
+            cell[r] = static_cast<int32_t>(std::floor(center / settings.cellSize));
+        }
+        cells[std::make_tuple(cell[0], cell[1], cell[2])].push_back(instanceID);
+    }
+
+    std::map<GroupKey, std::vector<Piece>> groups;
+    std::vector<uint32_t> mergedInstances;
+    for (const auto& cell : cells) {
+        // a lone prop stays an instance, merging it saves no draw
+        if (cell.second.size() < 2) {
+            continue;
+        }
+        for (uint32_t instanceID : cell.second) {
+            const Mesh& mesh = scene.meshes[scene.instances[instanceID].meshId];
+            for (uint32_t s = 0; s < mesh.slices.size(); ++s) {
+                if (mesh.slices[s].triangleCount == 0) {
+                    continue;
+                }
+                const uint32_t materialID = s < mesh.materialIds.size() ? mesh.materialIds[s] : 0xFFFFFFFF;
+                Piece piece = { instanceID, s };
+                groups[std::make_tuple(std::get<0>(cell.first), std::get<1>(cell.first), std::get<2>(cell.first), materialID)].push_back(piece);
+            }
+            mergedInstances.push_back(instanceID);
+        }
+    }
+    if (mergedInstances.empty()) {
+        if (pStats) {
+            *pStats = stats;
+        }
+        return;
+    }
+
+    // merged vertices are in world space already
+    Transform identity;
+    identity.position = m3d::math::Vector3(0.0f, 0.0f, 0.0f);
+    identity.scale = m3d::math::Vector3(1.0f, 1.0f, 1.0f);
+    identity.rotation = m3d::math::Quaternion(0.0f, 0.0f, 0.0f, 1.0f);
+    const uint32_t transformID = scene.AddTransform(identity);
+
+    for (const auto& group : groups) {
+        Mesh merged;
+        for (const Piece& piece : group.second) {
+            const Instance& instance = scene.instances[piece.instanceID];
+            const Mesh& mesh = scene.meshes[instance.meshId];
+            const size_t cornerCount = static_cast<size_t>(mesh.slices[piece.slice].triangleCount) * 3;
+            if (!merged.indices.empty() && merged.indices.size() + cornerCount > settings.maxMergedVertices) {
+                finishMerged(scene, transformID, merged, stats);
+            }
+            if (merged.indices.empty()) {
+                merged.name = StringId("static " + std::to_string(std::get<0>(group.first)) + " " + std::to_string(std::get<1>(group.first)) + " "
+                    + std::to_string(std::get<2>(group.first)) + " " + std::to_string(stats.mergedMeshes));
+                merged.materialIds.push_back(std::get<3>(group.first));
+            }
+            appendPiece(mesh, mesh.slices[piece.slice], scene.transformStore.GetWorld(instance.transformId), merged);
+        }
+        if (!merged.indices.empty()) {
+            finishMerged(scene, transformID, merged, stats);
+        }
+    }
+
+    std::unordered_set<uint32_t> candidates;
+    for (uint32_t instanceID : mergedInstances) {
+        candidates.insert(scene.instances[instanceID].meshId);
+        scene.instances.erase(instanceID);
+    }
+    stats.mergedInstances = static_cast<uint32_t>(mergedInstances.size());
+    for (uint32_t instanceID : scene.instances) {
+        candidates.erase(scene.instances[instanceID].meshId);
+    }
+    for (uint32_t meshID : candidates) {
+        scene.meshes.erase(meshID);
+        ++stats.removedMeshes;
+    }
+
+    if (pStats) {
+        *pStats = stats;
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,302 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "StatsOverlay.hpp"
+#include "GUIImage.h"
+#include "GUITextCaption.h"
+#include "GuiRenderer.hpp"
+#include "MemoryAllocator.hpp"
+#include "PerfLint.hpp"
+#include "RendererVulkan.hpp"
+#include "TextureStreamer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace m3d {
+
+static const double MB = 1024.0 * 1024.0;
+static const int BarWidth = 2;
+static const int GraphWidth = StatsOverlay::HistoryFrames * BarWidth;
+static const int GraphHeight = 48;
+static const int Margin = 4;
+// cpu, gpu, draws, triangles, upload, memory, io, then the perf lint and the memory tags when they are on
+static const uint32_t LineCount = 7;
+
+/*
+ * A quad at pixels of the screen the overlay computes itself, the GuiRenderer
+ * draws the proportions of an element as they are. Only changes mark the tree
+ * to be walked again.
+ */
+class StatsOverlay::Bar : public GUISystem::GUIImage {
+public:
+    explicit Bar(const std::string& name)
+        : GUISystem::GUIImage(name)
+    {
+        proportions.topLeft = m3d::math::Vector2(0.0f, 0.0f);
+        proportions.botRight = m3d::math::Vector2(0.0f, 0.0f);
+        proportions.width = 0.0f;
+        proportions.height = 0.0f;
+        proportions.depth = 0.0f;
+    }
+
+    void Place(float x0, float y0, float x1, float y1)
+    {
+        if (proportions.topLeft.x == x0 && proportions.topLeft.y == y0 && proportions.botRight.x == x1 && proportions.botRight.y == y1) {
+            return;
+        }
+        proportions.topLeft = m3d::math::Vector2(x0, y0);
+        proportions.botRight = m3d::math::Vector2(x1, y1);
+        proportions.width = x1 - x0;
+        proportions.height = y1 - y0;
+        MarkChanged();
+    }
+
+    void Tint(int r, int g, int b, int a)
+    {
+        const uint32_t packed = static_cast<uint32_t>(r) | static_cast<uint32_t>(g) << 8 | static_cast<uint32_t>(b) << 16 | static_cast<uint32_t>(a) << 24;
+        if (packed != tint) {
+            SetColor(r, g, b, a);
+            tint = packed;
+        }
+    }
+
+private:
+    // elements start out white
+    uint32_t tint = 0xFFFFFFFF;
+};
+
+StatsOverlay::StatsOverlay(const std::string& FontFace, const std::string& BarTexture, int FontSize, uint32_t RefreshFrames, float TargetMs)
+    : fontFace(FontFace)
+    , barTexture(BarTexture)
+    , fontSize(FontSize)
+    , refreshFrames(RefreshFrames > 0 ? RefreshFrames : 1)
+    , targetMs(TargetMs)
+{
+    createGraph(cpuGraph, "cpu graph");
+    createGraph(gpuGraph, "gpu graph");
+}
+
+StatsOverlay::~StatsOverlay()
+{
+    destroyGraph(cpuGraph);
+    destroyGraph(gpuGraph);
+    for (GUISystem::GUITextCaption* caption : captions) {
+        delete caption;
+    }
+}
+
+void StatsOverlay::createGraph(Graph& graph, const char* name)
+{
+    graph.background = new Bar(name);
+    graph.background->SetTextureName(barTexture);
+    graph.background->Tint(0, 0, 0, 128);
+    graph.bars.resize(HistoryFrames);
+    for (Bar*& bar : graph.bars) {
+        bar = new Bar(name);
+        bar->SetTextureName(barTexture);
+        graph.background->AddChild(bar);
+    }
+    std::fill(graph.samples, graph.samples + HistoryFrames, 0.0f);
+    graph.next = 0;
+}
+
+void StatsOverlay::destroyGraph(Graph& graph)
+{
+    for (Bar* bar : graph.bars) {
+        delete bar;
+    }
+    delete graph.background;
+}
+
+void StatsOverlay::placeGraph(Graph& graph, float left, float top)
+{
+    const float bottom = top + GraphHeight;
+    graph.background->Place(left, top, left + GraphWidth, bottom);
+    for (uint32_t i = 0; i < HistoryFrames; ++i) {
+        // oldest on the left, the full height is twice the target
+        const float ms = graph.samples[(graph.next + i) % HistoryFrames];
+        const float height = std::min(ms / (2.0f * targetMs), 1.0f) * GraphHeight;
+        const float x = left + static_cast<float>(i * BarWidth);
+        graph.bars[i]->Place(x, bottom - height, x + BarWidth, bottom);
+        if (ms <= targetMs) {
+            graph.bars[i]->Tint(64, 200, 64, 255);
+        } else if (ms <= 2.0f * targetMs) {
+            graph.bars[i]->Tint(230, 200, 40, 255);
+        } else {
+            graph.bars[i]->Tint(255, 64, 64, 255);
+        }
+    }
+}
+
+GUISystem::GUITextCaption& StatsOverlay::line(uint32_t index)
+{
+    while (captions.size() <= index) {
+        GUISystem::GUITextCaption* caption = new GUISystem::GUITextCaption("stats overlay");
+        caption->SetFontFace(fontFace);
+        caption->SetFontSize(static_cast<float>(fontSize));
+        // left aligned with the graphs below, from the right edge of the screen
+        const int offset = Margin + static_cast<int>(captions.size()) * (fontSize + fontSize / 4);
+        caption->SetPosition(GUISystem::ElementPos(1.0f, 0.0f, -(GraphWidth + Margin), offset));
+        captions.push_back(caption);
+    }
+    return *captions[index];
+}
+
+void StatsOverlay::setLine(uint32_t index, const char* text)
+{
+    GUISystem::GUITextCaption& caption = line(index);
+    // unchanged text keeps the laid out quads
+    if (caption.GetText() != text) {
+        caption.SetText(text);
+    }
+}
+
+static void average(const float* samples, uint32_t count, float& mean, float& peak)
+{
+    mean = 0.0f;
+    peak = 0.0f;
+    for (uint32_t i = 0; i < count; ++i) {
+        mean += samples[i];
+        peak = std::max(peak, samples[i]);
+    }
+    mean = count > 0 ? mean / count : 0.0f;
+}
+
+void StatsOverlay::Refresh(const RendererVulkan& renderer)
+{
+    const RendererVulkan::FrameStats& stats = renderer.GetFrameStats();
+    cpuGraph.samples[cpuGraph.next] = static_cast<float>(stats.cpuMs);
+    cpuGraph.next = (cpuGraph.next + 1) % HistoryFrames;
+    gpuGraph.samples[gpuGraph.next] = static_cast<float>(stats.gpuMs);
+    gpuGraph.next = (gpuGraph.next + 1) % HistoryFrames;
+    gpuTimed = gpuTimed || stats.gpuMs > 0.0;
+    uploadBytes += stats.uploadBytes;
+    ++uploadFrames;
+    const perflint::Frame& lint = perflint::GetFrame();
+    for (uint32_t i = 0; i < perflint::IssueCount; ++i) {
+        lintCounts[i] += lint.counts[i];
+    }
+
+    if (frame++ % refreshFrames != 0) {
+        return;
+    }
+
+    // the frames recorded so far, the ring is zeroed before
+    const uint32_t samples = std::min(frame, HistoryFrames);
+    char text[128];
+    float mean, peak;
+    average(cpuGraph.samples, samples, mean, peak);
+    snprintf(text, sizeof(text), "cpu %.2f ms, %.2f max", mean, peak);
+    setLine(0, text);
+    if (gpuTimed) {
+        average(gpuGraph.samples, samples, mean, peak);
+        snprintf(text, sizeof(text), "gpu %.2f ms, %.2f max", mean, peak);
+        setLine(1, text);
+    } else {
+        setLine(1, "gpu not timed");
+    }
+    snprintf(text, sizeof(text), "draws %u, pipeline binds %u", stats.draws, stats.pipelineBinds);
+    setLine(2, text);
+    snprintf(text, sizeof(text), "triangles %u", stats.triangles);
+    setLine(3, text);
+    snprintf(text, sizeof(text), "upload %.1f KB/frame", uploadBytes / 1024.0 / uploadFrames);
+    setLine(4, text);
+    const uint32_t textFrames = uploadFrames;
+    uploadBytes = 0;
+    uploadFrames = 0;
+
+    uint64_t usage = 0, budget = 0;
+    if (const MemoryAllocator* allocator = renderer.GetMemoryAllocator()) {
+        for (const MemoryAllocator::HeapBudget& heap : allocator->GetHeapBudgets()) {
+            if (heap.deviceLocal) {
+                usage += heap.usage;
+                budget += heap.budget;
+            }
+        }
+    }
+    snprintf(text, sizeof(text), "device memory %.0f / %.0f MB", usage / MB, budget / MB);
+    setLine(5, text);
+
+    if (const TextureStreamer* streamer = renderer.GetTextureStreamer()) {
+        const file::AsyncReader::Stats io = streamer->GetReadStats();
+        snprintf(text, sizeof(text), "io %u queued, %u in flight, %.1f ms avg, %.1f max", io.pending, io.inFlight, io.averageLatencyMs, io.maxLatencyMs);
+    } else {
+        snprintf(text, sizeof(text), "io idle");
+    }
+    setLine(6, text);
+    lineCount = LineCount;
+
+    if (perflint::IsEnabled()) {
+        // the most frequent issue since the last rewrite, and the site that noted it last
+        uint32_t total = 0, worst = 0;
+        for (uint32_t i = 0; i < perflint::IssueCount; ++i) {
+            total += lintCounts[i];
+            if (lintCounts[i] > lintCounts[worst]) {
+                worst = i;
+            }
+        }
+        if (total > 0) {
+            const char* site = lint.sites[worst] ? lint.sites[worst] : "an earlier frame";
+            snprintf(text, sizeof(text), "lint %.1f/frame, %s %.1f at %s", double(total) / textFrames, perflint::GetIssueName(static_cast<perflint::Issue>(worst)),
+                double(lintCounts[worst]) / textFrames, site);
+        } else {
+            snprintf(text, sizeof(text), "lint clean");
+        }
+        setLine(LineCount, text);
+        ++lineCount;
+    }
+    for (uint32_t i = 0; i < perflint::IssueCount; ++i) {
+        lintCounts[i] = 0;
+    }
+
+    if (memtag::IsEnabled()) {
+        // where the RAM is and who churns it since the last rewrite, Untagged included
+        uint64_t live = 0;
+        uint32_t largest = 0, busiest = 0;
+        memtag::Stats largestRam = {};
+        uint64_t allocations[memtag::TagCount];
+        for (uint32_t i = 0; i < memtag::TagCount; ++i) {
+            const memtag::Stats ram = memtag::GetStats(static_cast<memtag::Tag>(i));
+            live += ram.liveBytes;
+            allocations[i] = ram.allocations - ramAllocations[i];
+            ramAllocations[i] = ram.allocations;
+            if (i == 0 || ram.liveBytes > largestRam.liveBytes) {
+                largest = i;
+                largestRam = ram;
+            }
+            if (allocations[i] > allocations[busiest]) {
+                busiest = i;
+            }
+        }
+        snprintf(text, sizeof(text), "ram %.1f MB, %s %.1f MB (peak %.1f), %s %.0f allocs/frame", live / MB,
+            memtag::GetTagName(static_cast<memtag::Tag>(largest)), largestRam.liveBytes / MB, largestRam.peakBytes / MB,
+            memtag::GetTagName(static_cast<memtag::Tag>(busiest)), double(allocations[busiest]) / textFrames);
+        setLine(lineCount, text);
+        ++lineCount;
+    }
+}
+
+void StatsOverlay::Add(GuiRenderer& gui, const GUISystem::ElementProportions& screen)
+{
+    elements.assign(captions.begin(), captions.begin() + lineCount);
+    if (!barTexture.empty()) {
+        // below the text, the CPU graph above the GPU one
+        const float left = screen.botRight.x - GraphWidth - Margin;
+        float top = static_cast<float>(2 * Margin + static_cast<int>(lineCount) * (fontSize + fontSize / 4));
+        placeGraph(cpuGraph, left, top);
+        elements.push_back(cpuGraph.background);
+        if (gpuTimed) {
+            top += GraphHeight + Margin;
+            placeGraph(gpuGraph, left, top);
+            elements.push_back(gpuGraph.background);
+        }
+    }
+    if (!elements.empty()) {
+        gui.Add(elements, screen);
+    }
+}
+} // End of namespace m3d
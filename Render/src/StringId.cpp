@@ -0,0 +1,83 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "StringId.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace m3d {
+
+namespace {
+    // nodes never move, str() hands out references to the text
+    struct Interner {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::string> texts;
+    };
+
+    Interner& interner()
+    {
+        static Interner instance;
+        return instance;
+    }
+
+    const std::string& emptyText()
+    {
+        static const std::string empty;
+        return empty;
+    }
+
+    void intern(uint64_t value, const char* text, size_t length)
+    {
+        if (value == 0) {
+            return;
+        }
+        Interner& strings = interner();
+        std::lock_guard<std::mutex> lock(strings.mutex);
+        auto it = strings.texts.find(value);
+        if (it == strings.texts.end()) {
+            strings.texts.emplace(value, std::string(text, length));
+        } else if (it->second.compare(0, std::string::npos, text, length) != 0) {
+            printf("StringId: %.*s hashes the same as %s, it is mistaken for it\n", static_cast<int>(length), text, it->second.c_str());
+        }
+    }
+}
+
+StringId::StringId(const char* text, size_t length)
+    : value(StringHash64(text, length))
+{
+    intern(value, text, length);
+}
+
+StringId::StringId(const std::string& text)
+    : StringId(text.data(), text.size())
+{
+}
+
+StringId::StringId(const char* text)
+    : StringId(text, text ? strlen(text) : 0)
+{
+}
+
+const std::string& StringId::str() const
+{
+    if (value == 0) {
+        return emptyText();
+    }
+    Interner& strings = interner();
+    std::lock_guard<std::mutex> lock(strings.mutex);
+    auto it = strings.texts.find(value);
+    return it == strings.texts.end() ? emptyText() : it->second;
+}
+
+size_t StringId::InternedCount()
+{
+    Interner& strings = interner();
+    std::lock_guard<std::mutex> lock(strings.mutex);
+    return strings.texts.size();
+}
+} // End of namespace m3d
@@ -0,0 +1,288 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "SubmitTimeline.hpp"
+#include "PerfLint.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+
+namespace m3d {
+
+// VK_KHR_get_physical_device_properties2 and VK_KHR_timeline_semaphore postdate the vulkan headers
+static const VkStructureType PhysicalDeviceFeatures2Type = static_cast<VkStructureType>(1000059000);
+static const VkStructureType PhysicalDeviceTimelineSemaphoreFeaturesType = static_cast<VkStructureType>(1000207000);
+static const VkStructureType SemaphoreTypeCreateInfoType = static_cast<VkStructureType>(1000207002);
+static const VkStructureType TimelineSemaphoreSubmitInfoType = static_cast<VkStructureType>(1000207003);
+static const VkStructureType SemaphoreWaitInfoType = static_cast<VkStructureType>(1000207004);
+static const uint32_t SemaphoreTypeTimeline = 1;
+
+struct PhysicalDeviceFeatures2 {
+    VkStructureType sType;
+    void* pNext;
+    VkPhysicalDeviceFeatures features;
+};
+
+struct PhysicalDeviceTimelineSemaphoreFeatures {
+    VkStructureType sType;
+    const void* pNext;
+    VkBool32 timelineSemaphore;
+};
+
+struct SemaphoreTypeCreateInfo {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t semaphoreType;
+    uint64_t initialValue;
+};
+
+struct TimelineSemaphoreSubmitInfo {
+    VkStructureType sType;
+    const void* pNext;
+    uint32_t waitSemaphoreValueCount;
+    const uint64_t* pWaitSemaphoreValues;
+    uint32_t signalSemaphoreValueCount;
+    const uint64_t* pSignalSemaphoreValues;
+};
+
+struct SemaphoreWaitInfo {
+    VkStructureType sType;
+    const void* pNext;
+    VkFlags flags;
+    uint32_t semaphoreCount;
+    const VkSemaphore* pSemaphores;
+    const uint64_t* pValues;
+};
+
+typedef void(VKAPI_PTR* GetPhysicalDeviceFeatures2)(VkPhysicalDevice physicalDevice, PhysicalDeviceFeatures2* features);
+typedef VkResult(VKAPI_PTR* GetSemaphoreCounterValue)(VkDevice device, VkSemaphore semaphore, uint64_t* value);
+typedef VkResult(VKAPI_PTR* WaitSemaphores)(VkDevice device, const SemaphoreWaitInfo* waitInfo, uint64_t timeout);
+
+const char* const SubmitTimeline::ExtensionName = "VK_KHR_timeline_semaphore";
+
+bool SubmitTimeline::IsSupported(vk::Instance instance, vk::PhysicalDevice physicalDevice)
+{
+    if (!vkhelper::checkDeviceExtensionPresent(physicalDevice, ExtensionName)) {
+        return false;
+    }
+    PFN_vkVoidFunction getFeatures2 = instance.getProcAddr("vkGetPhysicalDeviceFeatures2KHR");
+    if (!getFeatures2) {
+        return false;
+    }
+    PhysicalDeviceTimelineSemaphoreFeatures timeline = {};
+    timeline.sType = PhysicalDeviceTimelineSemaphoreFeaturesType;
+    PhysicalDeviceFeatures2 features = {};
+    features.sType = PhysicalDeviceFeatures2Type;
+    features.pNext = &timeline;
+    reinterpret_cast<GetPhysicalDeviceFeatures2>(getFeatures2)(VkPhysicalDevice(physicalDevice), &features);
+    return timeline.timelineSemaphore == VK_TRUE;
+}
+
+const void* SubmitTimeline::GetFeatureChain(const void* next)
+{
+    // read by vkCreateDevice only, one device at a time
+    static PhysicalDeviceTimelineSemaphoreFeatures features = {};
+    features.sType = PhysicalDeviceTimelineSemaphoreFeaturesType;
+    features.pNext = next;
+    features.timelineSemaphore = VK_TRUE;
+    return &features;
+}
+
+SubmitTimeline::SubmitTimeline(vk::Device& Device, vk::Queue Queue, bool timelineSemaphores)
+    : device(Device)
+    , queue(Queue)
+{
+    if (!timelineSemaphores) {
+        return;
+    }
+    getCounterValue = device.getProcAddr("vkGetSemaphoreCounterValueKHR");
+    waitSemaphores = device.getProcAddr("vkWaitSemaphoresKHR");
+    if (!getCounterValue || !waitSemaphores) {
+        printf("SubmitTimeline: no timeline semaphore entry points, tracking submissions with fences\n");
+        return;
+    }
+
+    SemaphoreTypeCreateInfo typeInfo = {};
+    typeInfo.sType = SemaphoreTypeCreateInfoType;
+    typeInfo.semaphoreType = SemaphoreTypeTimeline;
+    typeInfo.initialValue = 0;
+    vk::SemaphoreCreateInfo semaphoreInfo;
+    semaphoreInfo.pNext = &typeInfo;
+    semaphore = device.createSemaphore(semaphoreInfo);
+    vkx::debug::marker::setSemaphoreName(VkDevice(device), VkSemaphore(semaphore), "submit timeline");
+}
+
+SubmitTimeline::~SubmitTimeline()
+{
+    WaitIdle();
+    device.destroySemaphore(semaphore);
+    for (auto& fence : freeFences) {
+        device.destroyFence(fence);
+    }
+}
+
+uint64_t SubmitTimeline::Submit(const vk::SubmitInfo& info)
+{
+    const uint64_t value = Defer(info);
+    Flush();
+    return value;
+}
+
+uint64_t SubmitTimeline::Defer(const vk::SubmitInfo& info)
+{
+    const uint64_t value = ++submitted;
+    Batch batch;
+    batch.next = info.pNext;
+    batch.commandBuffers.assign(info.pCommandBuffers, info.pCommandBuffers + info.commandBufferCount);
+    batch.waits.assign(info.pWaitSemaphores, info.pWaitSemaphores + info.waitSemaphoreCount);
+    batch.waitStages.assign(info.pWaitDstStageMask, info.pWaitDstStageMask + info.waitSemaphoreCount);
+    batch.signals.assign(info.pSignalSemaphores, info.pSignalSemaphores + info.signalSemaphoreCount);
+    if (semaphore) {
+        // binary semaphores of info take a value too, it is ignored
+        batch.waitValues.assign(info.waitSemaphoreCount, 0);
+        batch.waits.insert(batch.waits.end(), waits.begin(), waits.end());
+        batch.waitStages.insert(batch.waitStages.end(), waitStages.begin(), waitStages.end());
+        batch.waitValues.insert(batch.waitValues.end(), waitValues.begin(), waitValues.end());
+        waits.clear();
+        waitStages.clear();
+        waitValues.clear();
+
+        batch.signalValues.assign(info.signalSemaphoreCount, 0);
+        batch.signals.push_back(semaphore);
+        batch.signalValues.push_back(value);
+    }
+    batches.push_back(std::move(batch));
+    return value;
+}
+
+void SubmitTimeline::Flush()
+{
+    if (batches.empty()) {
+        return;
+    }
+    std::vector<vk::SubmitInfo> submitInfos(batches.size());
+    std::vector<TimelineSemaphoreSubmitInfo> timelineInfos(batches.size());
+    for (size_t i = 0; i < batches.size(); ++i) {
+        const Batch& batch = batches[i];
+        vk::SubmitInfo& submitInfo = submitInfos[i];
+        submitInfo.pNext = batch.next;
+        submitInfo.commandBufferCount = static_cast<uint32_t>(batch.commandBuffers.size());
+        submitInfo.pCommandBuffers = batch.commandBuffers.data();
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(batch.waits.size());
+        submitInfo.pWaitSemaphores = batch.waits.data();
+        submitInfo.pWaitDstStageMask = batch.waitStages.data();
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(batch.signals.size());
+        submitInfo.pSignalSemaphores = batch.signals.data();
+        if (semaphore) {
+            TimelineSemaphoreSubmitInfo& timelineInfo = timelineInfos[i];
+            timelineInfo.sType = TimelineSemaphoreSubmitInfoType;
+            timelineInfo.pNext = batch.next;
+            timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(batch.waitValues.size());
+            timelineInfo.pWaitSemaphoreValues = batch.waitValues.data();
+            timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(batch.signalValues.size());
+            timelineInfo.pSignalSemaphoreValues = batch.signalValues.data();
+            submitInfo.pNext = &timelineInfo;
+        }
+    }
+
+    if (!semaphore) {
+        // one fence for all of them, it signals once the last batch completed
+        vk::Fence fence;
+        if (freeFences.empty()) {
+            fence = device.createFence(vk::FenceCreateInfo());
+        } else {
+            fence = freeFences.back();
+            freeFences.pop_back();
+        }
+        queue.submit(submitInfos, fence);
+        perflint::Submit("SubmitTimeline::Flush");
+        pending.push_back({ submitted, fence });
+    } else {
+        queue.submit(submitInfos, vk::Fence());
+        perflint::Submit("SubmitTimeline::Flush");
+    }
+    flushed = submitted;
+    batches.clear();
+}
+
+bool SubmitTimeline::AddWait(const SubmitTimeline& other, uint64_t value, vk::PipelineStageFlags stage)
+{
+    if (!semaphore || !other.semaphore) {
+        return false;
+    }
+    waits.push_back(other.semaphore);
+    waitValues.push_back(value);
+    waitStages.push_back(stage);
+    return true;
+}
+
+bool SubmitTimeline::IsComplete(uint64_t value)
+{
+    return value <= completed || value <= GetCompleted();
+}
+
+uint64_t SubmitTimeline::GetCompleted()
+{
+    if (semaphore) {
+        uint64_t counter = 0;
+        if (reinterpret_cast<GetSemaphoreCounterValue>(getCounterValue)(VkDevice(device), VkSemaphore(semaphore), &counter) == VK_SUCCESS) {
+            completed = std::max(completed, counter);
+        }
+    } else {
+        retireFences(false, 0);
+    }
+    return completed;
+}
+
+void SubmitTimeline::Wait(uint64_t value)
+{
+    value = std::min(value, submitted);
+    if (value <= completed) {
+        return;
+    }
+    if (value > flushed) {
+        Flush();
+    }
+    if (!semaphore) {
+        retireFences(true, value);
+        return;
+    }
+    VkSemaphore handle = VkSemaphore(semaphore);
+    SemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = SemaphoreWaitInfoType;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &handle;
+    waitInfo.pValues = &value;
+    reinterpret_cast<WaitSemaphores>(waitSemaphores)(VkDevice(device), &waitInfo, UINT64_MAX);
+    completed = std::max(completed, value);
+}
+
+void SubmitTimeline::WaitIdle()
+{
+    if (perflint::IsEnabled() && !IsComplete(submitted)) {
+        perflint::WaitIdle("SubmitTimeline::WaitIdle");
+    }
+    Wait(submitted);
+}
+
+void SubmitTimeline::retireFences(bool wait, uint64_t value)
+{
+    // one queue completes its submissions in order, a fence covers the values of one Flush
+    while (!pending.empty()) {
+        Pending& front = pending.front();
+        if (wait && completed < value) {
+            device.waitForFences(front.fence, VK_TRUE, UINT64_MAX);
+        } else if (device.getFenceStatus(front.fence) != vk::Result::eSuccess) {
+            break;
+        }
+        completed = front.value;
+        device.resetFences(front.fence);
+        freeFences.push_back(front.fence);
+        pending.pop_front();
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,276 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "TextureArrays.hpp"
+#include "Pipeline.hpp"
+#include "ResourceTrash.hpp"
+#include "SamplerCache.hpp"
+#include "TextureStreamer.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <cstdio>
+
+namespace m3d {
+
+const uint32_t TextureArrays::LayersPerArray;
+const uint32_t TextureArrays::MaxExtent;
+const uint32_t TextureArrays::InvalidLayer;
+
+TextureArrays::TextureArrays(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, UploadQueue& Upload, MemoryAllocator& Allocator,
+    SamplerCache& Samplers, TextureStreamer& Streamer)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , upload(Upload)
+    , allocator(Allocator)
+    , samplers(Samplers)
+    , streamer(Streamer)
+    , white()
+{
+    // every element has to be valid, the array as a whole is statically used
+    createWhiteArray();
+    descriptors.assign(Pipeline::MaxTextureArrays, white.descriptor);
+    descriptorsChanged = true;
+}
+
+TextureArrays::~TextureArrays()
+{
+    for (const Array& array : arrays) {
+        device.destroyImageView(array.texture.view);
+        device.destroyImage(array.texture.image);
+        allocator.Free(array.memory);
+    }
+    device.destroyImageView(white.view);
+    device.destroyImage(white.image);
+    device.freeMemory(white.deviceMemory);
+}
+
+void TextureArrays::createWhiteArray()
+{
+    white.width = 1;
+    white.height = 1;
+    white.mipLevels = 1;
+    white.layerCount = 1;
+    white.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = vk::Format::eR8G8B8A8Unorm;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(1, 1, 1);
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    white.image = device.createImage(imageCreateInfo);
+    vkx::debug::marker::setName(device, white.image, "white texture array");
+
+    vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(white.image);
+    vk::MemoryAllocateInfo memAllocInfo;
+    memAllocInfo.allocationSize = memReqs.size;
+    memAllocInfo.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    white.deviceMemory = device.allocateMemory(memAllocInfo);
+    device.bindImageMemory(white.image, white.deviceMemory, 0);
+
+    const uint32_t texel = 0xFFFFFFFF;
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+    region.imageExtent = vk::Extent3D(1, 1, 1);
+    upload.CopyToImage(&texel, sizeof(texel), white.image, std::vector<vk::BufferImageCopy>(1, region),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1), white.imageLayout);
+    // sampled by the first frame, only happens once at startup
+    upload.Submit();
+    upload.WaitIdle();
+
+    white.sampler = samplers.Get(vk::Filter::eNearest, vk::SamplerAddressMode::eRepeat, 1.0f);
+
+    vk::ImageViewCreateInfo view;
+    view.viewType = vk::ImageViewType::e2DArray;
+    view.format = imageCreateInfo.format;
+    view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+    view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    view.image = white.image;
+    white.view = device.createImageView(view);
+
+    white.descriptor.imageLayout = white.imageLayout;
+    white.descriptor.imageView = white.view;
+    white.descriptor.sampler = white.sampler;
+}
+
+uint32_t TextureArrays::findArray(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+    for (uint32_t i = 0; i < arrays.size(); ++i) {
+        const Array& array = arrays[i];
+        if (array.format == format && array.width == width && array.height == height && array.mipLevels == mipLevels
+            && !array.freeLayers.empty()) {
+            return i;
+        }
+    }
+    if (arrays.size() >= Pipeline::MaxTextureArrays) {
+        return InvalidLayer;
+    }
+
+    Array array;
+    array.format = format;
+    array.width = width;
+    array.height = height;
+    array.mipLevels = mipLevels;
+    array.texture.width = width;
+    array.texture.height = height;
+    array.texture.mipLevels = mipLevels;
+    array.texture.layerCount = LayersPerArray;
+    array.texture.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+    // shared with the graphics queue when uploads run on a transfer queue
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = format;
+    imageCreateInfo.mipLevels = mipLevels;
+    imageCreateInfo.arrayLayers = LayersPerArray;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(width, height, 1);
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    array.texture.image = device.createImage(imageCreateInfo);
+
+    array.memory = allocator.AllocateImage(array.texture.image, vk::MemoryPropertyFlagBits::eDeviceLocal, true,
+        MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Texture);
+    if (!array.memory) {
+        device.destroyImage(array.texture.image);
+        return InvalidLayer;
+    }
+    array.texture.deviceMemory = array.memory.memory;
+
+    const uint32_t index = static_cast<uint32_t>(arrays.size());
+    char name[48];
+    snprintf(name, sizeof(name), "texture array %u, %ux%u", index, width, height);
+    vkx::debug::marker::setName(device, array.texture.image, name);
+
+    // layers that were never uploaded are not sampled, only what is accessed must be in the view's layout
+    vk::ImageViewCreateInfo view;
+    view.viewType = vk::ImageViewType::e2DArray;
+    view.format = format;
+    view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+    view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, mipLevels, 0, LayersPerArray);
+    view.image = array.texture.image;
+    array.texture.view = device.createImageView(view);
+    array.texture.sampler = samplers.Get();
+    array.texture.descriptor.imageLayout = array.texture.imageLayout;
+    array.texture.descriptor.imageView = array.texture.view;
+    array.texture.descriptor.sampler = array.texture.sampler;
+
+    // layer 0 is handed out first
+    for (uint32_t layer = LayersPerArray; layer > 0; --layer) {
+        array.freeLayers.push_back(layer - 1);
+    }
+    descriptors[index] = array.texture.descriptor;
+    descriptorsChanged = true;
+    arrays.push_back(array);
+    return index;
+}
+
+bool TextureArrays::Add(uint32_t textureID)
+{
+    if (textureID < slots.size() && slots[textureID].array != InvalidLayer) {
+        return false;
+    }
+    const std::vector<TextureStreamer::Level>& levels = streamer.GetLevels(textureID);
+    if (levels.empty()) {
+        return false;
+    }
+    // the finest level within MaxExtent and every coarser one
+    uint32_t firstMip = 0;
+    while (firstMip + 1 < levels.size() && (levels[firstMip].width > MaxExtent || levels[firstMip].height > MaxExtent)) {
+        ++firstMip;
+    }
+    const uint32_t mipLevels = static_cast<uint32_t>(levels.size()) - firstMip;
+    const uint32_t index = findArray(streamer.GetFormat(textureID), levels[firstMip].width, levels[firstMip].height, mipLevels);
+    if (index == InvalidLayer) {
+        if (!reportedFull) {
+            printf("TextureArrays: no array left for a %ux%u texture, it stays white\n", levels[firstMip].width, levels[firstMip].height);
+            reportedFull = true;
+        }
+        return false;
+    }
+    Array& array = arrays[index];
+    const uint32_t layer = array.freeLayers.back();
+    array.freeLayers.pop_back();
+
+    // one staged copy per level, the levels are not contiguous in a KTX file
+    for (uint32_t mip = 0; mip < mipLevels; ++mip) {
+        const TextureStreamer::Level& level = levels[firstMip + mip];
+        vk::BufferImageCopy region;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, mip, layer, 1);
+        region.imageExtent = vk::Extent3D(level.width, level.height, 1);
+        upload.CopyToImage(level.data, level.size, array.texture.image, std::vector<vk::BufferImageCopy>(1, region),
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, layer, 1), array.texture.imageLayout);
+    }
+
+    if (slots.size() <= textureID) {
+        slots.resize(textureID + 1);
+    }
+    Slot& slot = slots[textureID];
+    slot.array = index;
+    slot.layer = layer;
+    slot.ready = false;
+    const uint32_t serial = slot.serial;
+    upload.Submit([this, textureID, serial]() {
+        if (slots[textureID].serial == serial) {
+            slots[textureID].ready = true;
+            completed = true;
+        }
+    });
+    return true;
+}
+
+void TextureArrays::Remove(uint32_t textureID, ResourceTrash* trash)
+{
+    if (textureID >= slots.size() || slots[textureID].array == InvalidLayer) {
+        return;
+    }
+    Slot& slot = slots[textureID];
+    const uint32_t index = slot.array;
+    const uint32_t layer = slot.layer;
+    slot.array = InvalidLayer;
+    slot.layer = InvalidLayer;
+    slot.ready = false;
+    ++slot.serial;
+    if (trash) {
+        trash->Trash([this, index, layer]() { arrays[index].freeLayers.push_back(layer); });
+    } else {
+        arrays[index].freeLayers.push_back(layer);
+    }
+}
+
+uint32_t TextureArrays::GetArray(uint32_t textureID) const
+{
+    return textureID < slots.size() && slots[textureID].ready ? slots[textureID].array : InvalidLayer;
+}
+
+uint32_t TextureArrays::GetLayer(uint32_t textureID) const
+{
+    return textureID < slots.size() && slots[textureID].ready ? slots[textureID].layer : InvalidLayer;
+}
+
+bool TextureArrays::TakeChanges()
+{
+    const bool changed = descriptorsChanged;
+    completed = false;
+    descriptorsChanged = false;
+    return changed;
+}
+} // End of namespace m3d
@@ -0,0 +1,925 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "TextureCooker.hpp"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace m3d {
+
+namespace {
+    // glInternalFormat values of the KTX files written here
+    const uint32_t GlRgba8 = 0x8058;
+    const uint32_t GlBc1Rgb = 0x83F0;
+    const uint32_t GlBc3 = 0x83F3;
+    const uint32_t GlBc5 = 0x8DBD;
+    const uint32_t GlEtc2Rgb8 = 0x9274;
+    const uint32_t GlEtc2Rgba8 = 0x9278;
+    const uint32_t GlEacRg11 = 0x9272;
+    // glBaseInternalFormat
+    const uint32_t GlRgb = 0x1907;
+    const uint32_t GlRgba = 0x1908;
+    const uint32_t GlRg = 0x8227;
+    // glType of uncompressed texels
+    const uint32_t GlUnsignedByte = 0x1401;
+
+    // KTX 1.1 header, see https://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/
+    struct KtxHeader {
+        uint8_t identifier[12];
+        uint32_t endianness;
+        uint32_t glType;
+        uint32_t glTypeSize;
+        uint32_t glFormat;
+        uint32_t glInternalFormat;
+        uint32_t glBaseInternalFormat;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t numberOfArrayElements;
+        uint32_t numberOfFaces;
+        uint32_t numberOfMipmapLevels;
+        uint32_t bytesOfKeyValueData;
+    };
+
+    const uint8_t KtxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const uint32_t KtxEndianness = 0x04030201;
+
+    // ETC1 intensity modifiers, per codeword the small and the large one
+    const int EtcModifiers[8][2] = { { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+    // pixel index value to modifier: +small, +large, -small, -large
+    const int EtcSigns[4][2] = { { 1, 0 }, { 1, 1 }, { -1, 0 }, { -1, 1 } };
+
+    const int EacModifiers[16][8] = {
+        { -3, -6, -9, -15, 2, 5, 8, 14 },
+        { -3, -7, -10, -13, 2, 6, 9, 12 },
+        { -2, -5, -8, -13, 1, 4, 7, 12 },
+        { -2, -4, -6, -13, 1, 3, 5, 12 },
+        { -3, -6, -8, -12, 2, 5, 7, 11 },
+        { -3, -7, -9, -11, 2, 6, 8, 10 },
+        { -4, -7, -8, -11, 3, 6, 7, 10 },
+        { -3, -5, -8, -11, 2, 4, 7, 10 },
+        { -2, -6, -8, -10, 1, 5, 7, 9 },
+        { -2, -5, -8, -10, 1, 4, 7, 9 },
+        { -2, -4, -8, -10, 1, 3, 7, 9 },
+        { -2, -5, -7, -10, 1, 4, 6, 9 },
+        { -3, -4, -7, -10, 2, 3, 6, 9 },
+        { -1, -2, -3, -10, 0, 1, 2, 9 },
+        { -4, -6, -8, -9, 3, 5, 7, 8 },
+        { -3, -5, -7, -9, 2, 4, 6, 8 }
+    };
+
+    int clamp255(int value) { return std::min(std::max(value, 0), 255); }
+
+    // 4x4 texels starting at block bx, by, texel i is x = i % 4, y = i / 4, edges repeat
+    void fetchBlock(const RgbaImage& image, uint32_t bx, uint32_t by, uint8_t block[16][4])
+    {
+        for (uint32_t i = 0; i < 16; ++i) {
+            const uint32_t x = std::min(bx * 4 + i % 4, image.width - 1);
+            const uint32_t y = std::min(by * 4 + i / 4, image.height - 1);
+            memcpy(block[i], &image.texels[(static_cast<size_t>(y) * image.width + x) * 4], 4);
+        }
+    }
+
+    uint16_t to565(const float color[3])
+    {
+        const int r = std::min(std::max(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+        const int g = std::min(std::max(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+        const int b = std::min(std::max(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void from565(uint16_t value, int color[3])
+    {
+        const int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // endpoints at the extent of the colours along their principal axis, four colour mode
+    void encodeBc1(const uint8_t block[16][4], uint8_t* out)
+    {
+        float mean[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                mean[c] += block[i][c] / 16.0f;
+            }
+        }
+        float covariance[3][3] = {};
+        for (int i = 0; i < 16; ++i) {
+            float d[3] = { block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2] };
+            for (int r = 0; r < 3; ++r) {
+                for (int c = 0; c < 3; ++c) {
+                    covariance[r][c] += d[r] * d[c];
+                }
+            }
+        }
+        // power iteration converges quickly for the dominant axis
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration) {
+            float next[3];
+            for (int r = 0; r < 3; ++r) {
+                next[r] = covariance[r][0] * axis[0] + covariance[r][1] * axis[1] + covariance[r][2] * axis[2];
+            }
+            const float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+            if (length <= FLT_EPSILON) {
+                break;
+            }
+            for (int c = 0; c < 3; ++c) {
+                axis[c] = next[c] / length;
+            }
+        }
+        const float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        for (int c = 0; c < 3; ++c) {
+            axis[c] /= axisLength;
+        }
+
+        float minT = FLT_MAX, maxT = -FLT_MAX;
+        for (int i = 0; i < 16; ++i) {
+            const float t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        // pull the ends in a little, quantization already pushes the palette outwards
+        const float inset = (maxT - minT) / 16.0f;
+        float end0[3], end1[3];
+        for (int c = 0; c < 3; ++c) {
+            end0[c] = mean[c] + axis[c] * (maxT - inset);
+            end1[c] = mean[c] + axis[c] * (minT + inset);
+        }
+        uint16_t c0 = to565(end0), c1 = to565(end1);
+        if (c0 < c1) {
+            std::swap(c0, c1);
+        }
+
+        uint32_t indices = 0;
+        if (c0 != c1) {
+            int palette[4][3];
+            from565(c0, palette[0]);
+            from565(c1, palette[1]);
+            for (int c = 0; c < 3; ++c) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (int i = 0; i < 16; ++i) {
+                int best = 0, bestError = INT32_MAX;
+                for (int p = 0; p < 4; ++p) {
+                    int error = 0;
+                    for (int c = 0; c < 3; ++c) {
+                        error += (block[i][c] - palette[p][c]) * (block[i][c] - palette[p][c]);
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint32_t>(best) << (2 * i);
+            }
+        }
+        out[0] = c0 & 0xFF;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xFF;
+        out[3] = c1 >> 8;
+        for (int b = 0; b < 4; ++b) {
+            out[4 + b] = (indices >> (8 * b)) & 0xFF;
+        }
+    }
+
+    // one channel, eight values between its minimum and maximum
+    void encodeBc4(const uint8_t values[16], uint8_t* out)
+    {
+        const uint8_t hi = *std::max_element(values, values + 16);
+        const uint8_t lo = *std::min_element(values, values + 16);
+        out[0] = hi;
+        out[1] = lo;
+        uint64_t indices = 0;
+        // hi == lo selects the six value mode where index 0 is still hi
+        if (hi > lo) {
+            int palette[8] = { hi, lo };
+            for (int i = 1; i < 7; ++i) {
+                palette[i + 1] = ((7 - i) * hi + i * lo + 3) / 7;
+            }
+            for (int i = 0; i < 16; ++i) {
+                int best = 0;
+                for (int p = 1; p < 8; ++p) {
+                    if (std::abs(values[i] - palette[p]) < std::abs(values[i] - palette[best])) {
+                        best = p;
+                    }
+                }
+                indices |= static_cast<uint64_t>(best) << (3 * i);
+            }
+        }
+        for (int b = 0; b < 6; ++b) {
+            out[2 + b] = (indices >> (8 * b)) & 0xFF;
+        }
+    }
+
+    // ETC orders pixels column major
+    int etcPixel(int texel) { return (texel % 4) * 4 + texel / 4; }
+
+    // best codeword for one half block around base, returns the squared error
+    uint32_t fitEtcSubblock(const uint8_t block[16][4], const bool half[16], bool second, const int base[3], uint32_t* codeword, uint32_t* pixelBits)
+    {
+        uint32_t bestError = UINT32_MAX;
+        for (uint32_t cw = 0; cw < 8; ++cw) {
+            uint32_t error = 0;
+            uint32_t bits = 0;
+            for (int i = 0; i < 16; ++i) {
+                if (half[i] != second) {
+                    continue;
+                }
+                uint32_t bestPixel = UINT32_MAX;
+                uint32_t bestIndex = 0;
+                for (uint32_t index = 0; index < 4; ++index) {
+                    const int modifier = EtcSigns[index][0] * EtcModifiers[cw][EtcSigns[index][1]];
+                    uint32_t pixelError = 0;
+                    for (int c = 0; c < 3; ++c) {
+                        const int d = clamp255(base[c] + modifier) - block[i][c];
+                        pixelError += d * d;
+                    }
+                    if (pixelError < bestPixel) {
+                        bestPixel = pixelError;
+                        bestIndex = index;
+                    }
+                }
+                error += bestPixel;
+                const int p = etcPixel(i);
+                bits |= ((bestIndex >> 1) << (p + 16)) | ((bestIndex & 1) << p);
+            }
+            if (error < bestError) {
+                bestError = error;
+                *codeword = cw;
+                *pixelBits = bits;
+            }
+        }
+        return bestError;
+    }
+
+    // individual and differential modes only, both flips, which is plain ETC1 and decodes as ETC2 RGB8
+    void encodeEtc2Rgb(const uint8_t block[16][4], uint8_t* out)
+    {
+        uint64_t bestWord = 0;
+        uint64_t bestError = UINT64_MAX;
+        for (uint32_t flip = 0; flip < 2; ++flip) {
+            bool half[16];
+            float average[2][3] = {};
+            for (int i = 0; i < 16; ++i) {
+                half[i] = flip ? i / 4 >= 2 : i % 4 >= 2;
+                for (int c = 0; c < 3; ++c) {
+                    average[half[i]][c] += block[i][c] / 8.0f;
+                }
+            }
+
+            int q4[2][3], q5[2][3];
+            bool differential = true;
+            for (int s = 0; s < 2; ++s) {
+                for (int c = 0; c < 3; ++c) {
+                    q4[s][c] = std::min(static_cast<int>(average[s][c] * 15.0f / 255.0f + 0.5f), 15);
+                    q5[s][c] = std::min(static_cast<int>(average[s][c] * 31.0f / 255.0f + 0.5f), 31);
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                const int delta = q5[1][c] - q5[0][c];
+                differential = differential && delta >= -4 && delta <= 3;
+            }
+
+            for (int mode = 0; mode < (differential ? 2 : 1); ++mode) {
+                int base[2][3];
+                for (int s = 0; s < 2; ++s) {
+                    for (int c = 0; c < 3; ++c) {
+                        base[s][c] = mode ? (q5[s][c] << 3) | (q5[s][c] >> 2) : q4[s][c] * 17;
+                    }
+                }
+                uint32_t cw[2], bits[2];
+                const uint64_t error = static_cast<uint64_t>(fitEtcSubblock(block, half, false, base[0], &cw[0], &bits[0]))
+                    + fitEtcSubblock(block, half, true, base[1], &cw[1], &bits[1]);
+                if (error >= bestError) {
+                    continue;
+                }
+                bestError = error;
+                uint64_t word = static_cast<uint64_t>(cw[0]) << 37 | static_cast<uint64_t>(cw[1]) << 34
+                    | static_cast<uint64_t>(mode) << 33 | static_cast<uint64_t>(flip) << 32 | (bits[0] | bits[1]);
+                for (int c = 0; c < 3; ++c) {
+                    const int shift = 56 - 8 * c;
+                    if (mode) {
+                        word |= static_cast<uint64_t>(q5[0][c]) << (shift + 3) | static_cast<uint64_t>((q5[1][c] - q5[0][c]) & 7) << shift;
+                    } else {
+                        word |= static_cast<uint64_t>(q4[0][c]) << (shift + 4) | static_cast<uint64_t>(q4[1][c]) << shift;
+                    }
+                }
+                bestWord = word;
+            }
+        }
+        for (int b = 0; b < 8; ++b) {
+            out[b] = (bestWord >> (56 - 8 * b)) & 0xFF;
+        }
+    }
+
+    // EAC alpha, also R11 from 8 bit data as its decode is the alpha one times eight plus four
+    void encodeEac(const uint8_t values[16], uint8_t* out)
+    {
+        const int hi = *std::max_element(values, values + 16);
+        const int lo = *std::min_element(values, values + 16);
+        uint32_t bestError = UINT32_MAX;
+        int bestBase = 0, bestMultiplier = 1, bestTable = 0;
+        uint64_t bestIndices = 0;
+        for (int table = 0; table < 16; ++table) {
+            const int tableMin = *std::min_element(EacModifiers[table], EacModifiers[table] + 8);
+            const int tableMax = *std::max_element(EacModifiers[table], EacModifiers[table] + 8);
+            // spread the table over the range, then look at the neighbouring quantizations
+            const int fit = static_cast<int>(static_cast<float>(hi - lo) / (tableMax - tableMin) + 0.5f);
+            for (int multiplier = std::max(fit - 1, 1); multiplier <= std::min(fit + 1, 15); ++multiplier) {
+                const int center = static_cast<int>((hi + lo) * 0.5f - (tableMax + tableMin) * multiplier * 0.5f + 0.5f);
+                for (int base = std::max(center - 1, 0); base <= std::min(center + 1, 255); ++base) {
+                    uint32_t error = 0;
+                    uint64_t indices = 0;
+                    for (int i = 0; i < 16 && error < bestError; ++i) {
+                        uint32_t bestPixel = UINT32_MAX;
+                        uint32_t bestIndex = 0;
+                        for (uint32_t index = 0; index < 8; ++index) {
+                            const int d = clamp255(base + EacModifiers[table][index] * multiplier) - values[i];
+                            if (static_cast<uint32_t>(d * d) < bestPixel) {
+                                bestPixel = d * d;
+                                bestIndex = index;
+                            }
+                        }
+                        error += bestPixel;
+                        indices |= static_cast<uint64_t>(bestIndex) << (45 - 3 * etcPixel(i));
+                    }
+                    if (error < bestError) {
+                        bestError = error;
+                        bestBase = base;
+                        bestMultiplier = multiplier;
+                        bestTable = table;
+                        bestIndices = indices;
+                    }
+                }
+            }
+        }
+        out[0] = static_cast<uint8_t>(bestBase);
+        out[1] = static_cast<uint8_t>((bestMultiplier << 4) | bestTable);
+        for (int b = 0; b < 6; ++b) {
+            out[2 + b] = (bestIndices >> (40 - 8 * b)) & 0xFF;
+        }
+    }
+
+    uint32_t blockBytes(vk::Format format)
+    {
+        return format == vk::Format::eBc1RgbUnormBlock || format == vk::Format::eEtc2R8G8B8UnormBlock ? 8 : 16;
+    }
+
+    std::vector<uint8_t> compress(const RgbaImage& image, vk::Format format)
+    {
+        const uint32_t blocksWide = (image.width + 3) / 4;
+        const uint32_t blocksHigh = (image.height + 3) / 4;
+        const uint32_t bytes = blockBytes(format);
+        std::vector<uint8_t> data(static_cast<size_t>(blocksWide) * blocksHigh * bytes);
+        uint8_t block[16][4];
+        uint8_t channel[2][16];
+        for (uint32_t by = 0; by < blocksHigh; ++by) {
+            for (uint32_t bx = 0; bx < blocksWide; ++bx) {
+                fetchBlock(image, bx, by, block);
+                for (int i = 0; i < 16; ++i) {
+                    // alpha for the colour formats, green for the two channel ones
+                    channel[0][i] = format == vk::Format::eBc5UnormBlock || format == vk::Format::eEacR11G11UnormBlock ? block[i][0] : block[i][3];
+                    channel[1][i] = block[i][1];
+                }
+                uint8_t* out = &data[(static_cast<size_t>(by) * blocksWide + bx) * bytes];
+                switch (format) {
+                case vk::Format::eBc1RgbUnormBlock:
+                    encodeBc1(block, out);
+                    break;
+                case vk::Format::eBc3UnormBlock:
+                    encodeBc4(channel[0], out);
+                    encodeBc1(block, out + 8);
+                    break;
+                case vk::Format::eBc5UnormBlock:
+                    encodeBc4(channel[0], out);
+                    encodeBc4(channel[1], out + 8);
+                    break;
+                case vk::Format::eEtc2R8G8B8UnormBlock:
+                    encodeEtc2Rgb(block, out);
+                    break;
+                case vk::Format::eEtc2R8G8B8A8UnormBlock:
+                    encodeEac(channel[0], out);
+                    encodeEtc2Rgb(block, out + 8);
+                    break;
+                case vk::Format::eEacR11G11UnormBlock:
+                    encodeEac(channel[0], out);
+                    encodeEac(channel[1], out + 8);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        return data;
+    }
+
+    void ktxFormat(vk::Format format, uint32_t* internalFormat, uint32_t* baseFormat)
+    {
+        switch (format) {
+        case vk::Format::eBc1RgbUnormBlock:
+            *internalFormat = GlBc1Rgb;
+            *baseFormat = GlRgb;
+            break;
+        case vk::Format::eBc3UnormBlock:
+            *internalFormat = GlBc3;
+            *baseFormat = GlRgba;
+            break;
+        case vk::Format::eBc5UnormBlock:
+            *internalFormat = GlBc5;
+            *baseFormat = GlRg;
+            break;
+        case vk::Format::eEtc2R8G8B8UnormBlock:
+            *internalFormat = GlEtc2Rgb8;
+            *baseFormat = GlRgb;
+            break;
+        case vk::Format::eEtc2R8G8B8A8UnormBlock:
+            *internalFormat = GlEtc2Rgba8;
+            *baseFormat = GlRgba;
+            break;
+        case vk::Format::eEacR11G11UnormBlock:
+            *internalFormat = GlEacRg11;
+            *baseFormat = GlRg;
+            break;
+        default:
+            *internalFormat = GlRgba8;
+            *baseFormat = GlRgba;
+            break;
+        }
+    }
+}
+
+vk::Format KtxFormat(uint32_t glInternalFormat)
+{
+    switch (glInternalFormat) {
+    case GlRgba8:
+        return vk::Format::eR8G8B8A8Unorm;
+    case GlBc1Rgb:
+        return vk::Format::eBc1RgbUnormBlock;
+    case GlBc3:
+        return vk::Format::eBc3UnormBlock;
+    case GlBc5:
+        return vk::Format::eBc5UnormBlock;
+    case GlEtc2Rgb8:
+        return vk::Format::eEtc2R8G8B8UnormBlock;
+    case GlEtc2Rgba8:
+        return vk::Format::eEtc2R8G8B8A8UnormBlock;
+    case GlEacRg11:
+        return vk::Format::eEacR11G11UnormBlock;
+    default:
+        return vk::Format::eUndefined;
+    }
+}
+
+bool ParseKtx(const uint8_t* data, size_t size, std::vector<KtxLevel>* levels, uint32_t* glInternalFormat)
+{
+    if (size < sizeof(KtxHeader) || memcmp(data, KtxIdentifier, sizeof(KtxIdentifier)) != 0) {
+        return false;
+    }
+    KtxHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.endianness != KtxEndianness || header.pixelDepth > 1 || header.numberOfArrayElements > 1 || header.numberOfFaces != 1) {
+        return false;
+    }
+
+    levels->clear();
+    size_t offset = sizeof(KtxHeader) + header.bytesOfKeyValueData;
+    const uint32_t levelCount = std::max(header.numberOfMipmapLevels, 1u);
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > size) {
+            return false;
+        }
+        memcpy(&imageSize, data + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (offset + imageSize > size) {
+            return false;
+        }
+        KtxLevel level;
+        level.data = data + offset;
+        level.size = imageSize;
+        level.width = std::max(header.pixelWidth >> i, 1u);
+        level.height = std::max(header.pixelHeight >> i, 1u);
+        levels->push_back(level);
+        // mipPadding
+        offset += (imageSize + 3) & ~3u;
+    }
+    if (glInternalFormat) {
+        *glInternalFormat = header.glInternalFormat;
+    }
+    return true;
+}
+
+std::vector<RgbaImage> BuildMipChain(const RgbaImage& image, bool normals)
+{
+    std::vector<RgbaImage> chain(1, image);
+    while (chain.back().width > 1 || chain.back().height > 1) {
+        const RgbaImage& src = chain.back();
+        RgbaImage dst;
+        dst.width = std::max(src.width / 2, 1u);
+        dst.height = std::max(src.height / 2, 1u);
+        dst.texels.resize(static_cast<size_t>(dst.width) * dst.height * 4);
+        for (uint32_t y = 0; y < dst.height; ++y) {
+            for (uint32_t x = 0; x < dst.width; ++x) {
+                const uint32_t x0 = std::min(x * 2, src.width - 1), x1 = std::min(x * 2 + 1, src.width - 1);
+                const uint32_t y0 = std::min(y * 2, src.height - 1), y1 = std::min(y * 2 + 1, src.height - 1);
+                const uint8_t* texels[4] = {
+                    &src.texels[(static_cast<size_t>(y0) * src.width + x0) * 4], &src.texels[(static_cast<size_t>(y0) * src.width + x1) * 4],
+                    &src.texels[(static_cast<size_t>(y1) * src.width + x0) * 4], &src.texels[(static_cast<size_t>(y1) * src.width + x1) * 4]
+                };
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (int t = 0; t < 4; ++t) {
+                    for (int c = 0; c < 4; ++c) {
+                        sum[c] += texels[t][c] * 0.25f;
+                    }
+                }
+                if (normals) {
+                    // averaged unit vectors get shorter, put them back on the sphere
+                    float n[3], length = 0.0f;
+                    for (int c = 0; c < 3; ++c) {
+                        n[c] = sum[c] / 127.5f - 1.0f;
+                        length += n[c] * n[c];
+                    }
+                    length = sqrtf(length);
+                    if (length > FLT_EPSILON) {
+                        for (int c = 0; c < 3; ++c) {
+                            sum[c] = (n[c] / length + 1.0f) * 127.5f;
+                        }
+                    }
+                }
+                uint8_t* out = &dst.texels[(static_cast<size_t>(y) * dst.width + x) * 4];
+                for (int c = 0; c < 4; ++c) {
+                    out[c] = static_cast<uint8_t>(clamp255(static_cast<int>(sum[c] + 0.5f)));
+                }
+            }
+        }
+        chain.push_back(std::move(dst));
+    }
+    return chain;
+}
+
+vk::Format CookedFormat(TextureUsage usage, BlockFamily family)
+{
+    if (family == BlockFamily::BC) {
+        return usage == TextureUsage::Color ? vk::Format::eBc1RgbUnormBlock
+            : usage == TextureUsage::ColorAlpha ? vk::Format::eBc3UnormBlock : vk::Format::eBc5UnormBlock;
+    }
+    return usage == TextureUsage::Color ? vk::Format::eEtc2R8G8B8UnormBlock
+        : usage == TextureUsage::ColorAlpha ? vk::Format::eEtc2R8G8B8A8UnormBlock : vk::Format::eEacR11G11UnormBlock;
+}
+
+std::string CookedTexturePath(const std::string& imagePath, BlockFamily family)
+{
+    return imagePath.substr(0, imagePath.find_last_of('.')) + (family == BlockFamily::BC ? ".bc.ktx" : ".etc2.ktx");
+}
+
+bool LoadRgbaImage(const std::string& imagePath, RgbaImage* image)
+{
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 4);
+    if (!pixels) {
+        return false;
+    }
+    image->width = width;
+    image->height = height;
+    image->texels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+    return true;
+}
+
+bool WriteRgbaKtx(const RgbaImage& image, const std::string& path)
+{
+    uint32_t header[13] = {};
+    // endianness, GL_UNSIGNED_BYTE of size 1, GL_RGBA
+    header[0] = KtxEndianness;
+    header[1] = GlUnsignedByte;
+    header[2] = 1;
+    header[3] = GlRgba;
+    ktxFormat(vk::Format::eR8G8B8A8Unorm, &header[4], &header[5]);
+    header[6] = image.width;
+    header[7] = image.height;
+    header[10] = 1;
+    header[11] = 1;
+
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    // rows of 4 byte texels need no padding
+    const uint32_t imageSize = static_cast<uint32_t>(image.texels.size());
+    bool written = std::fwrite(KtxIdentifier, sizeof(KtxIdentifier), 1, fp) == 1 && std::fwrite(header, sizeof(header), 1, fp) == 1
+        && std::fwrite(&imageSize, sizeof(imageSize), 1, fp) == 1 && std::fwrite(image.texels.data(), image.texels.size(), 1, fp) == 1;
+    written = std::fclose(fp) == 0 && written;
+    if (!written) {
+        std::remove(path.c_str());
+    }
+    return written;
+}
+
+namespace {
+    // PNG, see https://www.w3.org/TR/PNG/, and its zlib stream, RFC 1950 and 1951
+    uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        // built by the first call, thread safe as a local static
+        static const struct Table {
+            uint32_t entries[256];
+            Table()
+            {
+                for (uint32_t n = 0; n < 256; ++n) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k) {
+                        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[n] = c;
+                }
+            }
+        } table;
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i) {
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void putBigEndian(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+    {
+        putBigEndian(out, static_cast<uint32_t>(data.size()));
+        const size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        putBigEndian(out, crc32(0, &out[start], out.size() - start));
+    }
+
+    // deflate's bits, least significant first
+    class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& Out)
+            : out(Out)
+        {
+        }
+        void Put(uint32_t value, int count)
+        {
+            bits |= static_cast<uint64_t>(value) << pending;
+            pending += count;
+            while (pending >= 8) {
+                out.push_back(static_cast<uint8_t>(bits));
+                bits >>= 8;
+                pending -= 8;
+            }
+        }
+        // Huffman codes go most significant bit first
+        void PutCode(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; ++i) {
+                reversed = (reversed << 1) | ((code >> i) & 1);
+            }
+            Put(reversed, length);
+        }
+        void Flush()
+        {
+            if (pending > 0) {
+                out.push_back(static_cast<uint8_t>(bits));
+            }
+            bits = 0;
+            pending = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        uint64_t bits = 0;
+        int pending = 0;
+    };
+
+    const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193,
+        12289, 16385, 24577 };
+    const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    // a literal, a length code or the end of block in the fixed code
+    void putSymbol(BitWriter& writer, uint32_t symbol)
+    {
+        if (symbol < 144) {
+            writer.PutCode(0x30 + symbol, 8);
+        } else if (symbol < 256) {
+            writer.PutCode(0x190 + symbol - 144, 9);
+        } else if (symbol < 280) {
+            writer.PutCode(symbol - 256, 7);
+        } else {
+            writer.PutCode(0xC0 + symbol - 280, 8);
+        }
+    }
+
+    void putMatch(BitWriter& writer, uint32_t length, uint32_t distance)
+    {
+        uint32_t code = 28;
+        while (lengthBase[code] > length) {
+            --code;
+        }
+        putSymbol(writer, 257 + code);
+        writer.Put(length - lengthBase[code], lengthExtra[code]);
+        code = 29;
+        while (distanceBase[code] > distance) {
+            --code;
+        }
+        writer.PutCode(code, 5);
+        writer.Put(distance - distanceBase[code], distanceExtra[code]);
+    }
+
+    // One fixed Huffman block of greedy LZ77 matches, a short hash chain per position
+    std::vector<uint8_t> zlibCompress(const std::vector<uint8_t>& data)
+    {
+        static const uint32_t WindowSize = 32768;
+        static const uint32_t HashBits = 15;
+        static const uint32_t MaxChain = 16;
+        static const uint32_t MinMatch = 3;
+        static const uint32_t MaxMatch = 258;
+        static const int32_t None = -1;
+
+        std::vector<uint8_t> out;
+        // deflate, 32K window, no dictionary, fastest
+        out.push_back(0x78);
+        out.push_back(0x01);
+        BitWriter writer(out);
+        writer.Put(1, 1);
+        writer.Put(1, 2);
+
+        const uint32_t size = static_cast<uint32_t>(data.size());
+        std::vector<int32_t> head(1u << HashBits, None);
+        std::vector<int32_t> previous(size, None);
+        const auto hash = [&data](uint32_t i) {
+            return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1u << HashBits) - 1);
+        };
+        const auto insert = [&](uint32_t i) {
+            if (i + MinMatch <= size) {
+                const uint32_t h = hash(i);
+                previous[i] = head[h];
+                head[h] = static_cast<int32_t>(i);
+            }
+        };
+
+        uint32_t i = 0;
+        while (i < size) {
+            uint32_t bestLength = 0, bestDistance = 0;
+            if (i + MinMatch <= size) {
+                const uint32_t limit = std::min(MaxMatch, size - i);
+                int32_t candidate = head[hash(i)];
+                for (uint32_t chain = 0; candidate != None && chain < MaxChain && i - candidate <= WindowSize; ++chain) {
+                    uint32_t length = 0;
+                    while (length < limit && data[candidate + length] == data[i + length]) {
+                        ++length;
+                    }
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = i - candidate;
+                        if (length == limit) {
+                            break;
+                        }
+                    }
+                    candidate = previous[candidate];
+                }
+            }
+            if (bestLength >= MinMatch) {
+                putMatch(writer, bestLength, bestDistance);
+                for (uint32_t j = 0; j < bestLength; ++j) {
+                    insert(i + j);
+                }
+                i += bestLength;
+            } else {
+                putSymbol(writer, data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        putSymbol(writer, 256);
+        writer.Flush();
+
+        uint32_t a = 1, b = 0;
+        for (uint8_t byte : data) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        putBigEndian(out, (b << 16) | a);
+        return out;
+    }
+}
+
+bool WriteRgbaPng(const RgbaImage& image, const std::string& path)
+{
+    if (image.width == 0 || image.height == 0) {
+        return false;
+    }
+    // every row filtered with Sub or Up, whichever leaves the smaller sum of residuals
+    const size_t rowBytes = image.width * 4;
+    std::vector<uint8_t> filtered;
+    filtered.reserve((rowBytes + 1) * image.height);
+    std::vector<uint8_t> sub(rowBytes), up(rowBytes);
+    for (uint32_t y = 0; y < image.height; ++y) {
+        const uint8_t* row = &image.texels[y * rowBytes];
+        const uint8_t* above = y > 0 ? row - rowBytes : nullptr;
+        uint32_t subCost = 0, upCost = 0;
+        for (size_t x = 0; x < rowBytes; ++x) {
+            sub[x] = static_cast<uint8_t>(row[x] - (x >= 4 ? row[x - 4] : 0));
+            up[x] = static_cast<uint8_t>(row[x] - (above ? above[x] : 0));
+            subCost += std::min<uint32_t>(sub[x], 256 - sub[x]);
+            upCost += std::min<uint32_t>(up[x], 256 - up[x]);
+        }
+        const bool useUp = upCost < subCost;
+        filtered.push_back(useUp ? 2 : 1);
+        filtered.insert(filtered.end(), useUp ? up.begin() : sub.begin(), useUp ? up.end() : sub.end());
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::vector<uint8_t> png(signature, signature + sizeof(signature));
+    std::vector<uint8_t> header;
+    putBigEndian(header, image.width);
+    putBigEndian(header, image.height);
+    // 8 bits, RGBA, deflate, adaptive filters, not interlaced
+    const uint8_t format[5] = { 8, 6, 0, 0, 0 };
+    header.insert(header.end(), format, format + sizeof(format));
+    putChunk(png, "IHDR", header);
+    putChunk(png, "IDAT", zlibCompress(filtered));
+    putChunk(png, "IEND", std::vector<uint8_t>());
+
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    bool written = std::fwrite(png.data(), png.size(), 1, fp) == 1;
+    written = std::fclose(fp) == 0 && written;
+    if (!written) {
+        std::remove(path.c_str());
+    }
+    return written;
+}
+
+bool CookTexture(const std::string& imagePath, TextureUsage usage, BlockFamily family, const std::string& path)
+{
+    RgbaImage image;
+    if (!LoadRgbaImage(imagePath, &image)) {
+        return false;
+    }
+
+    const vk::Format format = CookedFormat(usage, family);
+    const std::vector<RgbaImage> chain = BuildMipChain(image, usage == TextureUsage::Normal);
+
+    uint32_t header[13] = {};
+    // endianness, glType 0 and glTypeSize 1 for compressed data, glFormat 0
+    header[0] = 0x04030201;
+    header[2] = 1;
+    ktxFormat(format, &header[4], &header[5]);
+    header[6] = image.width;
+    header[7] = image.height;
+    header[10] = 1;
+    header[11] = static_cast<uint32_t>(chain.size());
+
+    std::FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+    bool written = std::fwrite(KtxIdentifier, sizeof(KtxIdentifier), 1, fp) == 1 && std::fwrite(header, sizeof(header), 1, fp) == 1;
+    // block sizes are multiples of four, no mip padding
+    for (size_t i = 0; i < chain.size() && written; ++i) {
+        const std::vector<uint8_t> data = compress(chain[i], format);
+        const uint32_t imageSize = static_cast<uint32_t>(data.size());
+        written = std::fwrite(&imageSize, sizeof(imageSize), 1, fp) == 1 && std::fwrite(data.data(), data.size(), 1, fp) == 1;
+    }
+    written = std::fclose(fp) == 0 && written;
+    if (!written) {
+        std::remove(path.c_str());
+    }
+    return written;
+}
+
+bool PickBlockFamily(vk::PhysicalDevice& physicalDevice, TextureUsage usage, BlockFamily* family)
+{
+    const BlockFamily families[] = { BlockFamily::BC, BlockFamily::ETC2 };
+    for (BlockFamily candidate : families) {
+        const vk::FormatProperties properties = physicalDevice.getFormatProperties(CookedFormat(usage, candidate));
+        if (properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage) {
+            *family = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+} // End of namespace m3d
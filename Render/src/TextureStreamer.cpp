@@ -0,0 +1,1077 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "TextureStreamer.hpp"
+#include "File.hpp"
+#include "PerfLint.hpp"
+#include "ResourceTrash.hpp"
+#include "SamplerCache.hpp"
+#include "ThreadPool.hpp"
+#include "UploadQueue.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace m3d {
+
+const vk::DeviceSize TextureStreamer::DefaultBudget;
+const vk::DeviceSize TextureStreamer::UploadPerUpdate;
+const uint32_t TextureStreamer::TailSize;
+const uint32_t TextureStreamer::RequestTimeout;
+const uint32_t TextureStreamer::InvalidTexture;
+const uint32_t TextureStreamer::SparseMinExtent;
+const uint32_t TextureStreamer::SparsePageTiles;
+
+namespace {
+    // texels per side of a compression block, BC, ETC2, EAC and ASTC 4x4 are the block formats in use
+    uint32_t blockSize(vk::Format format)
+    {
+        const int value = static_cast<int>(format);
+        return value >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && value <= VK_FORMAT_ASTC_4x4_SRGB_BLOCK ? 4 : 1;
+    }
+}
+
+struct TextureStreamer::Sparse {
+    enum State {
+        Unbound,
+        // memory binding on the sparse queue
+        Binding,
+        // bound, the copy is on the upload queue
+        Uploading,
+        Resident
+    };
+
+    struct Tile {
+        uint32_t mip;
+        vk::Offset3D offset;
+        vk::Extent3D extent;
+        State state = Unbound;
+        TileSlot slot;
+        uint64_t requestedFrame = 0;
+    };
+
+    vk::Image image;
+    vk::Extent3D granularity;
+    // first level of the mip tail, bound as a whole
+    uint32_t tailMip;
+    vk::DeviceSize tailBytes;
+    uint32_t memoryTypeIndex;
+    // sparse block size of the image
+    vk::DeviceSize tileBytes;
+    // the whole chain left undefined layout with the first copy
+    bool layoutReady = false;
+    // tiles binding or uploading, releasing waits for them
+    uint32_t busyTiles = 0;
+
+    // per level above the tail
+    std::vector<uint32_t> firstTile;
+    std::vector<uint32_t> tilesWide;
+    std::vector<Tile> tiles;
+};
+
+TextureStreamer::TextureStreamer(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, UploadQueue& Upload, ResourceTrash& Trash, MemoryAllocator& Allocator,
+    SamplerCache& Samplers, vk::DeviceSize Budget, uint32_t DecodeThreads)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , upload(Upload)
+    , trash(Trash)
+    , allocator(Allocator)
+    , samplers(Samplers)
+    , budget(Budget)
+    , residentBytes(0)
+    , frame(1)
+    , decodeThreads(DecodeThreads)
+    , reading(0)
+    , decodingCount(0)
+    , sparseEnabled(false)
+    , freedTiles(std::make_shared<std::vector<TileSlot>>())
+{
+}
+
+void TextureStreamer::EnableSparse(vk::Queue bindQueue)
+{
+    vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+    if (!features.sparseBinding || !features.sparseResidencyImage2D) {
+        return;
+    }
+    sparseQueue = bindQueue;
+    sparseEnabled = true;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // workers push into decoded, completions reference the entries. A decoder that failed reads the next
+    // candidate, so wait until neither has work left
+    if (decoders) {
+        do {
+            reader->wait();
+            decoders->Wait();
+        } while (reading > 0);
+    }
+    upload.WaitIdle();
+    for (auto& bind : pendingBinds) {
+        device.waitForFences(bind.fence, VK_TRUE, UINT64_MAX);
+        device.destroyFence(bind.fence);
+    }
+    pendingBinds.clear();
+    for (auto& entry : entries) {
+        if (entry.alive) {
+            if (entry.sparse) {
+                releaseSparse(entry, false);
+            }
+            destroy(entry.texture, false, entry.memory);
+        }
+    }
+    for (auto& page : pages) {
+        device.freeMemory(page.memory);
+    }
+}
+
+/* Only plain 2D KTX files, the levels are used in place */
+bool TextureStreamer::parseKtx(const std::shared_ptr<const file::MappedFile>& file, Entry& entry)
+{
+    std::vector<KtxLevel> ktxLevels;
+    uint32_t glInternalFormat;
+    if (!ParseKtx(file->data(), file->size(), &ktxLevels, &glInternalFormat)) {
+        return false;
+    }
+    if (entry.format == vk::Format::eUndefined) {
+        entry.format = KtxFormat(glInternalFormat);
+    }
+    for (const KtxLevel& ktxLevel : ktxLevels) {
+        Level level;
+        level.data = ktxLevel.data;
+        level.size = ktxLevel.size;
+        level.width = ktxLevel.width;
+        level.height = ktxLevel.height;
+        entry.levels.push_back(level);
+    }
+    entry.source = file;
+    return true;
+}
+
+bool TextureStreamer::decodeGli(const std::shared_ptr<const file::MappedFile>& file, Entry& entry)
+{
+    if (entry.format == vk::Format::eUndefined) {
+        return false;
+    }
+    std::shared_ptr<gli::texture2d> texture = std::make_shared<gli::texture2d>(gli::load(reinterpret_cast<const char*>(file->data()), file->size()));
+    if (texture->empty()) {
+        return false;
+    }
+    for (uint32_t i = 0; i < texture->levels(); ++i) {
+        Level level;
+        level.data = static_cast<const uint8_t*>((*texture)[i].data());
+        level.size = (*texture)[i].size();
+        level.width = static_cast<uint32_t>((*texture)[i].extent().x);
+        level.height = static_cast<uint32_t>((*texture)[i].extent().y);
+        entry.levels.push_back(level);
+    }
+    entry.source = texture;
+    return true;
+}
+
+/* Images that were not cooked, decoded to rgba8 with a box filtered chain */
+bool TextureStreamer::decodeImage(const std::shared_ptr<const file::MappedFile>& file, Entry& entry)
+{
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load_from_memory(file->data(), static_cast<int>(file->size()), &width, &height, &channels, 4);
+    if (!pixels) {
+        return false;
+    }
+    RgbaImage image;
+    image.width = width;
+    image.height = height;
+    image.texels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+
+    std::shared_ptr<std::vector<RgbaImage>> chain = std::make_shared<std::vector<RgbaImage>>(BuildMipChain(image));
+    for (const RgbaImage& mip : *chain) {
+        Level level;
+        level.data = mip.texels.data();
+        level.size = mip.texels.size();
+        level.width = mip.width;
+        level.height = mip.height;
+        entry.levels.push_back(level);
+    }
+    entry.format = vk::Format::eR8G8B8A8Unorm;
+    entry.source = chain;
+    return true;
+}
+
+vk::DeviceSize TextureStreamer::levelBytes(const Entry& entry, uint32_t firstMip)
+{
+    vk::DeviceSize bytes = 0;
+    for (uint32_t i = firstMip; i < entry.levels.size(); ++i) {
+        bytes += entry.levels[i].size;
+    }
+    return bytes;
+}
+
+bool TextureStreamer::decode(const std::string& path, vk::Format format, Entry& entry)
+{
+    auto file = file::MappedFile::open(path.c_str());
+    return file && decode(file, format, entry);
+}
+
+bool TextureStreamer::decode(const std::shared_ptr<const file::MappedFile>& file, vk::Format format, Entry& entry)
+{
+    entry.format = format;
+    bool decoded = parseKtx(file, entry);
+    if (!decoded) {
+        // a KTX that failed half way may have left levels
+        entry.levels.clear();
+        decoded = decodeGli(file, entry) || decodeImage(file, entry);
+    }
+    if (!decoded || entry.format == vk::Format::eUndefined) {
+        entry.levels.clear();
+        entry.source.reset();
+        return false;
+    }
+    return true;
+}
+
+uint32_t TextureStreamer::allocateEntry()
+{
+    if (freeEntries.empty()) {
+        entries.push_back(Entry());
+        return static_cast<uint32_t>(entries.size()) - 1;
+    }
+    uint32_t textureID = freeEntries.back();
+    freeEntries.pop_back();
+    // keep counting, an upload of the previous texture may still complete
+    uint32_t serial = entries[textureID].serial;
+    entries[textureID] = Entry();
+    entries[textureID].serial = serial;
+    return textureID;
+}
+
+void TextureStreamer::makeLoaded(uint32_t textureID, Entry& decoded)
+{
+    Entry& entry = entries[textureID];
+    entry.alive = true;
+    entry.source = std::move(decoded.source);
+    entry.levels = std::move(decoded.levels);
+    entry.format = decoded.format;
+
+    if (sparseEnabled && std::max(entry.levels[0].width, entry.levels[0].height) >= SparseMinExtent && createSparse(textureID)) {
+        return;
+    }
+
+    entry.tailMip = static_cast<uint32_t>(entry.levels.size()) - 1;
+    for (uint32_t i = 0; i < entry.levels.size(); ++i) {
+        if (entry.levels[i].width <= TailSize && entry.levels[i].height <= TailSize) {
+            entry.tailMip = i;
+            break;
+        }
+    }
+    entry.residentMip = entry.targetMip = entry.tailMip;
+    // the tail is not charged against the budget, it never leaves
+    makeResident(textureID, entry.tailMip);
+}
+
+uint32_t TextureStreamer::Load(const std::string& path, vk::Format format)
+{
+    Entry decoded;
+    if (!decode(path, format, decoded)) {
+        return InvalidTexture;
+    }
+    uint32_t textureID = allocateEntry();
+    makeLoaded(textureID, decoded);
+    return textureID;
+}
+
+TextureStreamer::Candidates TextureStreamer::cookedCandidates(const std::string& imagePath, TextureUsage usage)
+{
+    Candidates candidates;
+    BlockFamily family;
+    if (PickBlockFamily(physicalDevice, usage, &family)) {
+        candidates.push_back(std::make_pair(CookedTexturePath(imagePath, family), vk::Format::eUndefined));
+    }
+    candidates.push_back(std::make_pair(imagePath, vk::Format::eR8G8B8A8Unorm));
+    return candidates;
+}
+
+uint32_t TextureStreamer::LoadCooked(const std::string& imagePath, TextureUsage usage)
+{
+    for (const auto& candidate : cookedCandidates(imagePath, usage)) {
+        uint32_t textureID = Load(candidate.first, candidate.second);
+        if (textureID != InvalidTexture) {
+            return textureID;
+        }
+    }
+    return InvalidTexture;
+}
+
+uint32_t TextureStreamer::LoadAsync(const std::string& path, vk::Format format, int32_t priority)
+{
+    return loadAsync(Candidates(1, std::make_pair(path, format)), priority);
+}
+
+uint32_t TextureStreamer::LoadCookedAsync(const std::string& imagePath, TextureUsage usage, int32_t priority)
+{
+    return loadAsync(cookedCandidates(imagePath, usage), priority);
+}
+
+uint32_t TextureStreamer::loadAsync(const Candidates& candidates, int32_t priority)
+{
+    if (!decoders) {
+        decoders.reset(new ThreadPool(decodeThreads ? decodeThreads : std::max(1u, std::thread::hardware_concurrency()), JobSystem::Priority::Background));
+        reader.reset(new file::AsyncReader());
+    }
+
+    // alive without levels until Update takes the decode
+    const uint32_t textureID = allocateEntry();
+    entries[textureID].alive = true;
+    std::shared_ptr<Decode> job = std::make_shared<Decode>();
+    job->textureID = textureID;
+    job->serial = entries[textureID].serial;
+    job->priority = priority;
+    job->candidates = candidates;
+    entries[textureID].loading = job;
+    ++decodingCount;
+
+    std::lock_guard<std::mutex> lock(decodedMutex);
+    readCandidate(job);
+    return textureID;
+}
+
+void TextureStreamer::readCandidate(const std::shared_ptr<Decode>& job)
+{
+    if (job->candidate == job->candidates.size()) {
+        decoded.push_back(job);
+        return;
+    }
+    ++reading;
+    job->request = reader->read(job->candidates[job->candidate].first, [this, job](std::shared_ptr<const file::MappedFile> file) {
+        --reading;
+        // the reader's thread only reads, decoding happens on the decoders
+        decoders->Enqueue([this, job, file]() {
+            const bool succeeded = file && decode(file, job->candidates[job->candidate].second, job->entry);
+            std::lock_guard<std::mutex> lock(decodedMutex);
+            if (succeeded) {
+                job->succeeded = true;
+                decoded.push_back(job);
+                return;
+            }
+            ++job->candidate;
+            readCandidate(job);
+        });
+    }, job->priority);
+}
+
+void TextureStreamer::Release(uint32_t textureID)
+{
+    Entry& entry = entries[textureID];
+    assert(entry.alive);
+    if (entry.sparse) {
+        releaseSparse(entry, true);
+    }
+    destroy(entry.texture, true, entry.memory);
+    residentBytes -= entry.textureBytes;
+
+    if (entry.loading) {
+        // the worker pushes the job into decoded unless its read is dropped before it started
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        if (entry.loading->request != 0 && reader->cancel(entry.loading->request)) {
+            --reading;
+            --decodingCount;
+        }
+        entry.loading.reset();
+    }
+    entry.alive = false;
+    ++entry.serial;
+    entry.texture = vkext::VulkanTexture();
+    entry.memory = MemoryAllocator::Allocation();
+    entry.textureBytes = 0;
+    entry.source.reset();
+    entry.levels.clear();
+    freeEntries.push_back(textureID);
+}
+
+void TextureStreamer::RequestMip(uint32_t textureID, uint32_t mip)
+{
+    Entry& entry = entries[textureID];
+    if (entry.sparse) {
+        const float uvMin[2] = { 0.0f, 0.0f };
+        const float uvMax[2] = { 1.0f, 1.0f };
+        RequestRegion(textureID, mip, uvMin, uvMax);
+        return;
+    }
+    // several requests within a frame, the finest one wins
+    if (entry.requestedFrame == frame) {
+        entry.requestedMip = std::min(entry.requestedMip, mip);
+    } else {
+        entry.requestedMip = mip;
+    }
+    entry.requestedFrame = frame;
+}
+
+void TextureStreamer::RequestRegion(uint32_t textureID, uint32_t mip, const float uvMin[2], const float uvMax[2])
+{
+    Entry& entry = entries[textureID];
+    if (!entry.sparse) {
+        RequestMip(textureID, mip);
+        return;
+    }
+    entry.requestedFrame = frame;
+
+    Sparse& sparse = *entry.sparse;
+    for (uint32_t level = mip; level < sparse.tailMip; ++level) {
+        const Level& texels = entry.levels[level];
+        const uint32_t tilesHigh = (texels.height + sparse.granularity.height - 1) / sparse.granularity.height;
+        // uv repeats, a rectangle outside [0, 1] is clamped rather than wrapped
+        auto tileOf = [](float uv, uint32_t size, uint32_t tileSize, uint32_t tiles) {
+            const float texel = std::min(std::max(uv, 0.0f), 1.0f) * size;
+            return std::min(static_cast<uint32_t>(texel) / tileSize, tiles - 1);
+        };
+        const uint32_t x0 = tileOf(uvMin[0], texels.width, sparse.granularity.width, sparse.tilesWide[level]);
+        const uint32_t x1 = tileOf(uvMax[0], texels.width, sparse.granularity.width, sparse.tilesWide[level]);
+        const uint32_t y0 = tileOf(uvMin[1], texels.height, sparse.granularity.height, tilesHigh);
+        const uint32_t y1 = tileOf(uvMax[1], texels.height, sparse.granularity.height, tilesHigh);
+        for (uint32_t y = y0; y <= y1; ++y) {
+            for (uint32_t x = x0; x <= x1; ++x) {
+                sparse.tiles[sparse.firstTile[level] + y * sparse.tilesWide[level] + x].requestedFrame = frame;
+            }
+        }
+    }
+}
+
+uint32_t TextureStreamer::MipForScreenSize(uint32_t width, float projectedPixels)
+{
+    // coarsest level that still has a texel for every pixel
+    uint32_t mip = 0;
+    float texels = static_cast<float>(width);
+    while (texels * 0.5f >= projectedPixels && texels > 1.0f) {
+        texels *= 0.5f;
+        ++mip;
+    }
+    return mip;
+}
+
+void TextureStreamer::Update(FrameArena& arena)
+{
+    std::vector<std::shared_ptr<Decode>> finished;
+    {
+        std::lock_guard<std::mutex> lock(decodedMutex);
+        finished.swap(decoded);
+    }
+    for (const auto& job : finished) {
+        --decodingCount;
+        Entry& entry = entries[job->textureID];
+        // released while decoding
+        if (!entry.alive || entry.serial != job->serial) {
+            continue;
+        }
+        entry.loading.reset();
+        if (!job->succeeded) {
+            printf("TextureStreamer: can not read %s\n", job->candidates.back().first.c_str());
+            continue;
+        }
+        makeLoaded(job->textureID, job->entry);
+    }
+
+    // what each texture would like, stale requests fall back to the tail
+    FrameVector<uint32_t> live(arena.Get()), sparseLive(arena.Get());
+    live.reserve(entries.size());
+    vk::DeviceSize wanted = 0;
+    for (uint32_t textureID = 0; textureID < entries.size(); ++textureID) {
+        Entry& entry = entries[textureID];
+        if (!entry.alive || entry.levels.empty()) {
+            continue;
+        }
+        if (entry.sparse) {
+            sparseLive.push_back(textureID);
+            continue;
+        }
+        const bool requested = entry.requestedFrame != 0 && frame - entry.requestedFrame <= RequestTimeout;
+        entry.targetMip = requested ? std::min(entry.requestedMip, entry.tailMip) : entry.tailMip;
+        wanted += levelBytes(entry, entry.targetMip);
+        live.push_back(textureID);
+    }
+
+    // least recently requested first, bigger textures first among equals
+    std::sort(live.begin(), live.end(), [this](uint32_t a, uint32_t b) {
+        const Entry& ea = entries[a];
+        const Entry& eb = entries[b];
+        if (ea.requestedFrame != eb.requestedFrame) {
+            return ea.requestedFrame < eb.requestedFrame;
+        }
+        return ea.levels[0].size > eb.levels[0].size;
+    });
+    for (uint32_t i = 0; i < live.size() && wanted > budget; ++i) {
+        Entry& entry = entries[live[i]];
+        while (wanted > budget && entry.targetMip < entry.tailMip) {
+            wanted -= entry.levels[entry.targetMip].size;
+            ++entry.targetMip;
+        }
+    }
+
+    // drop levels first so their memory is on its way back, then grow the most recently requested textures
+    vk::DeviceSize uploaded = 0;
+    for (uint32_t textureID : live) {
+        Entry& entry = entries[textureID];
+        if (!entry.pending && entry.targetMip > entry.residentMip) {
+            uploaded += makeResident(textureID, entry.targetMip);
+        }
+    }
+    for (auto it = live.rbegin(); it != live.rend() && uploaded < UploadPerUpdate; ++it) {
+        Entry& entry = entries[*it];
+        if (entry.pending || entry.targetMip >= entry.residentMip) {
+            continue;
+        }
+        // the old image stays until the new one landed, both count against the budget meanwhile
+        const vk::DeviceSize bytes = levelBytes(entry, entry.targetMip);
+        if (residentBytes + bytes > budget) {
+            continue;
+        }
+        uploaded += makeResident(*it, entry.targetMip);
+    }
+
+    if (sparseEnabled) {
+        updateSparse(sparseLive, uploaded, arena);
+    }
+    ++frame;
+}
+
+// "texture <id>" in captures, the id of Load
+static void nameTexture(vk::Device device, vk::Image image, uint32_t textureID)
+{
+    if (vkx::debug::marker::active) {
+        char name[32];
+        snprintf(name, sizeof(name), "texture %u", textureID);
+        vkx::debug::marker::setName(device, image, name);
+    }
+}
+
+vk::DeviceSize TextureStreamer::makeResident(uint32_t textureID, uint32_t firstMip)
+{
+    Entry& entry = entries[textureID];
+    const Level& top = entry.levels[firstMip];
+
+    vkext::VulkanTexture texture = {};
+    texture.width = top.width;
+    texture.height = top.height;
+    texture.mipLevels = static_cast<uint32_t>(entry.levels.size()) - firstMip;
+    texture.layerCount = 1;
+
+    // shared with the graphics queue when uploads run on a transfer queue
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = entry.format;
+    imageCreateInfo.mipLevels = texture.mipLevels;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(texture.width, texture.height, 1);
+    imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    texture.image = device.createImage(imageCreateInfo);
+    nameTexture(device, texture.image, textureID);
+
+    const MemoryAllocator::Allocation memory = allocator.AllocateImage(texture.image, vk::MemoryPropertyFlagBits::eDeviceLocal, true,
+        MemoryAllocator::Strategy::Buddy, MemoryAllocator::Category::Texture);
+    if (!memory) {
+        device.destroyImage(texture.image);
+        return 0;
+    }
+    texture.deviceMemory = memory.memory;
+
+    // one staged copy per level, the levels are not contiguous in a KTX file
+    texture.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    vk::DeviceSize uploaded = 0;
+    for (uint32_t mip = 0; mip < texture.mipLevels; ++mip) {
+        const Level& level = entry.levels[firstMip + mip];
+        vk::BufferImageCopy region;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, mip, 0, 1);
+        region.imageExtent = vk::Extent3D(level.width, level.height, 1);
+        upload.CopyToImage(level.data, level.size, texture.image, std::vector<vk::BufferImageCopy>(1, region),
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1), texture.imageLayout);
+        uploaded += level.size;
+    }
+    createView(texture, entry.format);
+
+    entry.pending = true;
+    const uint32_t serial = ++entry.serial;
+    const vk::DeviceSize bytes = memory.size;
+    residentBytes += bytes;
+
+    upload.Submit([this, textureID, serial, texture, memory, bytes, firstMip]() {
+        Entry& entry = entries[textureID];
+        if (!entry.alive || entry.serial != serial) {
+            // released meanwhile, the image was never handed out
+            destroy(texture, false, memory);
+            residentBytes -= bytes;
+            return;
+        }
+        if (entry.texture.image) {
+            destroy(entry.texture, true, entry.memory);
+            residentBytes -= entry.textureBytes;
+        }
+        entry.texture = texture;
+        entry.memory = memory;
+        entry.textureBytes = bytes;
+        entry.residentMip = firstMip;
+        entry.pending = false;
+        if (onChanged) {
+            onChanged(textureID, entry.texture);
+        }
+    });
+    return uploaded;
+}
+
+void TextureStreamer::createView(vkext::VulkanTexture& texture, vk::Format format)
+{
+    // the view limits the levels, one sampler serves every texture
+    texture.sampler = samplers.Get();
+
+    vk::ImageViewCreateInfo view;
+    view.viewType = vk::ImageViewType::e2D;
+    view.format = format;
+    view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+    view.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, 1);
+    view.image = texture.image;
+    texture.view = device.createImageView(view);
+
+    texture.descriptor.imageLayout = texture.imageLayout;
+    texture.descriptor.imageView = texture.view;
+    texture.descriptor.sampler = texture.sampler;
+}
+
+void TextureStreamer::destroy(const vkext::VulkanTexture& texture, bool deferred, const MemoryAllocator::Allocation& memory)
+{
+    if (!texture.image) {
+        return;
+    }
+    vk::Device dev = device;
+    vkext::VulkanTexture retired = texture;
+    MemoryAllocator* memoryAllocator = &allocator;
+    auto destroyer = [dev, retired, memory, memoryAllocator]() {
+        dev.destroyImageView(retired.view);
+        dev.destroyImage(retired.image);
+        if (memory) {
+            memoryAllocator->Free(memory);
+        } else {
+            dev.freeMemory(retired.deviceMemory);
+        }
+    };
+    // frames in flight may still sample a texture that was handed out
+    if (deferred) {
+        trash.Trash(destroyer);
+    } else {
+        destroyer();
+    }
+}
+
+bool TextureStreamer::createSparse(uint32_t textureID)
+{
+    Entry& entry = entries[textureID];
+    const vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst;
+    if (physicalDevice.getSparseImageFormatProperties(entry.format, vk::ImageType::e2D, vk::SampleCountFlagBits::e1, usage, vk::ImageTiling::eOptimal).empty()) {
+        return false;
+    }
+
+    vkext::VulkanTexture texture = {};
+    texture.width = entry.levels[0].width;
+    texture.height = entry.levels[0].height;
+    texture.mipLevels = static_cast<uint32_t>(entry.levels.size());
+    texture.layerCount = 1;
+
+    const std::vector<uint32_t>& sharingFamilies = upload.GetSharingFamilies();
+    vk::ImageCreateInfo imageCreateInfo;
+    imageCreateInfo.flags = vk::ImageCreateFlagBits::eSparseBinding | vk::ImageCreateFlagBits::eSparseResidency;
+    imageCreateInfo.imageType = vk::ImageType::e2D;
+    imageCreateInfo.format = entry.format;
+    imageCreateInfo.mipLevels = texture.mipLevels;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+    imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+    imageCreateInfo.sharingMode = sharingFamilies.size() > 1 ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive;
+    imageCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharingFamilies.size());
+    imageCreateInfo.pQueueFamilyIndices = sharingFamilies.data();
+    imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+    imageCreateInfo.extent = vk::Extent3D(texture.width, texture.height, 1);
+    imageCreateInfo.usage = usage;
+    texture.image = device.createImage(imageCreateInfo);
+    nameTexture(device, texture.image, textureID);
+
+    const vk::MemoryRequirements memReqs = device.getImageMemoryRequirements(texture.image);
+    const std::vector<vk::SparseImageMemoryRequirements> sparseReqs = device.getImageSparseMemoryRequirements(texture.image);
+    const vk::SparseImageMemoryRequirements* color = nullptr;
+    const vk::SparseImageMemoryRequirements* metadata = nullptr;
+    for (const auto& reqs : sparseReqs) {
+        if (reqs.formatProperties.aspectMask & vk::ImageAspectFlagBits::eColor) {
+            color = &reqs;
+        }
+        if (reqs.formatProperties.aspectMask & vk::ImageAspectFlagBits::eMetadata) {
+            metadata = &reqs;
+        }
+    }
+    if (!color || (color->formatProperties.flags & vk::SparseImageFormatFlagBits::eNonstandardBlockSize)) {
+        device.destroyImage(texture.image);
+        return false;
+    }
+
+    std::shared_ptr<Sparse> sparse = std::make_shared<Sparse>();
+    sparse->image = texture.image;
+    sparse->granularity = color->formatProperties.imageGranularity;
+    sparse->tailMip = std::min(color->imageMipTailFirstLod, texture.mipLevels);
+    sparse->memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    // memory for a sparse resident image is bound in units of its alignment
+    sparse->tileBytes = memReqs.alignment;
+
+    // the mip tail and the metadata only bind as a whole, both live in one allocation next to the image
+    auto aligned = [&memReqs](vk::DeviceSize bytes) { return (bytes + memReqs.alignment - 1) / memReqs.alignment * memReqs.alignment; };
+    std::vector<vk::SparseMemoryBind> opaqueBinds;
+    sparse->tailBytes = 0;
+    if (sparse->tailMip < texture.mipLevels) {
+        opaqueBinds.push_back(vk::SparseMemoryBind(color->imageMipTailOffset, color->imageMipTailSize));
+        sparse->tailBytes = aligned(color->imageMipTailSize);
+    }
+    if (metadata) {
+        opaqueBinds.push_back(vk::SparseMemoryBind(metadata->imageMipTailOffset, metadata->imageMipTailSize, vk::DeviceMemory(),
+            sparse->tailBytes, vk::SparseMemoryBindFlagBits::eMetadata));
+        sparse->tailBytes += aligned(metadata->imageMipTailSize);
+    }
+    if (sparse->tailBytes > 0) {
+        vk::MemoryAllocateInfo memAllocInfo;
+        memAllocInfo.allocationSize = sparse->tailBytes;
+        memAllocInfo.memoryTypeIndex = sparse->memoryTypeIndex;
+        texture.deviceMemory = device.allocateMemory(memAllocInfo);
+        perflint::Allocate(memAllocInfo.allocationSize, "TextureStreamer mip tail");
+        for (auto& bind : opaqueBinds) {
+            bind.memory = texture.deviceMemory;
+        }
+
+        // loading already blocks on the file, waiting for one bind keeps the tail upload simple
+        vk::SparseImageOpaqueMemoryBindInfo opaqueInfo(texture.image, static_cast<uint32_t>(opaqueBinds.size()), opaqueBinds.data());
+        vk::BindSparseInfo bindInfo;
+        bindInfo.imageOpaqueBindCount = 1;
+        bindInfo.pImageOpaqueBinds = &opaqueInfo;
+        vk::Fence fence = device.createFence(vk::FenceCreateInfo());
+        sparseQueue.bindSparse(bindInfo, fence);
+        device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+        device.destroyFence(fence);
+    }
+
+    // tiles of every level above the tail, the last row and column end at the level's edge
+    const vk::Extent3D& tileSize = sparse->granularity;
+    for (uint32_t mip = 0; mip < sparse->tailMip; ++mip) {
+        const Level& level = entry.levels[mip];
+        const uint32_t tilesWide = (level.width + tileSize.width - 1) / tileSize.width;
+        const uint32_t tilesHigh = (level.height + tileSize.height - 1) / tileSize.height;
+        sparse->firstTile.push_back(static_cast<uint32_t>(sparse->tiles.size()));
+        sparse->tilesWide.push_back(tilesWide);
+        for (uint32_t y = 0; y < tilesHigh; ++y) {
+            for (uint32_t x = 0; x < tilesWide; ++x) {
+                Sparse::Tile tile;
+                tile.mip = mip;
+                tile.offset = vk::Offset3D(x * tileSize.width, y * tileSize.height, 0);
+                tile.extent = vk::Extent3D(std::min(tileSize.width, level.width - x * tileSize.width),
+                    std::min(tileSize.height, level.height - y * tileSize.height), 1);
+                sparse->tiles.push_back(tile);
+            }
+        }
+    }
+
+    // the image never leaves general layout, tiles are copied while the others are sampled
+    texture.imageLayout = vk::ImageLayout::eGeneral;
+    for (uint32_t mip = sparse->tailMip; mip < texture.mipLevels; ++mip) {
+        const Level& level = entry.levels[mip];
+        vk::BufferImageCopy region;
+        region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, mip, 0, 1);
+        region.imageExtent = vk::Extent3D(level.width, level.height, 1);
+        // the first copy moves the whole chain out of undefined layout
+        const vk::ImageSubresourceRange range = sparse->layoutReady
+            ? vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1)
+            : vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, 1);
+        upload.CopyToImage(level.data, level.size, texture.image, std::vector<vk::BufferImageCopy>(1, region), range,
+            texture.imageLayout, sparse->layoutReady ? vk::ImageLayout::eGeneral : vk::ImageLayout::eUndefined);
+        sparse->layoutReady = true;
+    }
+    createView(texture, entry.format);
+
+    entry.sparse = sparse;
+    entry.tailMip = std::min(sparse->tailMip, texture.mipLevels - 1);
+    entry.residentMip = entry.targetMip = sparse->tailMip;
+    entry.pending = true;
+    const uint32_t serial = ++entry.serial;
+    const vk::DeviceSize bytes = sparse->tailBytes;
+    residentBytes += bytes;
+
+    upload.Submit([this, textureID, serial, texture, bytes]() {
+        Entry& entry = entries[textureID];
+        if (!entry.alive || entry.serial != serial) {
+            destroy(texture, false);
+            residentBytes -= bytes;
+            return;
+        }
+        entry.texture = texture;
+        entry.textureBytes = bytes;
+        entry.pending = false;
+        if (onChanged) {
+            onChanged(textureID, entry.texture);
+        }
+    });
+    return true;
+}
+
+void TextureStreamer::updateSparse(const FrameVector<uint32_t>& live, vk::DeviceSize uploaded, FrameArena& arena)
+{
+    for (const TileSlot& slot : *freedTiles) {
+        pages[slot.page].freeTiles.push_back(slot.index);
+    }
+    freedTiles->clear();
+
+    // bindings that landed get their texels, all in one upload batch; the completion keeps these, they are not per frame
+    std::vector<std::pair<uint32_t, uint32_t>> copied;
+    std::vector<uint32_t> copiedSerials;
+    for (auto it = pendingBinds.begin(); it != pendingBinds.end();) {
+        if (device.getFenceStatus(it->fence) != vk::Result::eSuccess) {
+            ++it;
+            continue;
+        }
+        device.destroyFence(it->fence);
+        for (size_t i = 0; i < it->tiles.size(); ++i) {
+            Entry& entry = entries[it->tiles[i].first];
+            if (!entry.alive || entry.serial != it->serials[i]) {
+                continue;
+            }
+            uploadTile(entry, it->tiles[i].second);
+            copied.push_back(it->tiles[i]);
+            copiedSerials.push_back(it->serials[i]);
+        }
+        it = pendingBinds.erase(it);
+    }
+    if (!copied.empty()) {
+        upload.Submit([this, copied, copiedSerials]() {
+            std::vector<uint32_t> changed;
+            for (size_t i = 0; i < copied.size(); ++i) {
+                Entry& entry = entries[copied[i].first];
+                if (!entry.alive || entry.serial != copiedSerials[i]) {
+                    continue;
+                }
+                entry.sparse->tiles[copied[i].second].state = Sparse::Resident;
+                --entry.sparse->busyTiles;
+                changed.push_back(copied[i].first);
+            }
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            // finest level from which on every tile is resident
+            for (uint32_t textureID : changed) {
+                Entry& entry = entries[textureID];
+                const Sparse& sparse = *entry.sparse;
+                uint32_t mip = sparse.tailMip;
+                while (mip > 0) {
+                    const uint32_t end = mip < sparse.tailMip ? sparse.firstTile[mip] : static_cast<uint32_t>(sparse.tiles.size());
+                    bool resident = true;
+                    for (uint32_t t = sparse.firstTile[mip - 1]; t < end && resident; ++t) {
+                        resident = sparse.tiles[t].state == Sparse::Resident;
+                    }
+                    if (!resident) {
+                        break;
+                    }
+                    --mip;
+                }
+                entry.residentMip = mip;
+            }
+        });
+    }
+
+    struct Candidate {
+        uint32_t live;
+        uint32_t tile;
+        uint64_t requestedFrame;
+        uint32_t mip;
+    };
+    FrameVector<Candidate> resident(arena.Get()), wanted(arena.Get());
+    FrameVector<FrameVector<vk::SparseImageMemoryBind>> imageBinds(live.size(), FrameVector<vk::SparseImageMemoryBind>(arena.Get()), arena.Get());
+    std::vector<std::pair<uint32_t, uint32_t>> bound;
+    std::vector<uint32_t> boundSerials;
+
+    // reads of an unbound tile stay defined, a frame in flight that still samples it sees zeros at worst
+    auto evict = [&](uint32_t liveIndex, uint32_t tileIndex) {
+        Sparse& sparse = *entries[live[liveIndex]].sparse;
+        Sparse::Tile& tile = sparse.tiles[tileIndex];
+        imageBinds[liveIndex].push_back(vk::SparseImageMemoryBind(vk::ImageSubresource(vk::ImageAspectFlagBits::eColor, tile.mip, 0), tile.offset, tile.extent));
+        releaseTile(tile.slot, true);
+        tile.state = Sparse::Unbound;
+        residentBytes -= sparse.tileBytes;
+    };
+
+    for (uint32_t i = 0; i < live.size(); ++i) {
+        const Sparse& sparse = *entries[live[i]].sparse;
+        for (uint32_t t = 0; t < sparse.tiles.size(); ++t) {
+            const Sparse::Tile& tile = sparse.tiles[t];
+            const bool requested = tile.requestedFrame != 0 && frame - tile.requestedFrame <= RequestTimeout;
+            Candidate candidate = { i, t, tile.requestedFrame, tile.mip };
+            if (tile.state == Sparse::Resident) {
+                if (requested) {
+                    resident.push_back(candidate);
+                } else {
+                    evict(i, t);
+                }
+            } else if (tile.state == Sparse::Unbound && requested) {
+                wanted.push_back(candidate);
+            }
+        }
+    }
+
+    // longest unrequested and finest tiles go first, the newest requests and coarsest levels bind first
+    std::sort(resident.begin(), resident.end(), [](const Candidate& a, const Candidate& b) {
+        return a.requestedFrame != b.requestedFrame ? a.requestedFrame < b.requestedFrame : a.mip < b.mip;
+    });
+    std::sort(wanted.begin(), wanted.end(), [](const Candidate& a, const Candidate& b) {
+        return a.requestedFrame != b.requestedFrame ? a.requestedFrame > b.requestedFrame : a.mip > b.mip;
+    });
+    size_t evictNext = 0;
+    for (const Candidate& candidate : wanted) {
+        if (uploaded >= UploadPerUpdate) {
+            break;
+        }
+        Entry& entry = entries[live[candidate.live]];
+        Sparse& sparse = *entry.sparse;
+        while (residentBytes + sparse.tileBytes > budget && evictNext < resident.size()
+            && resident[evictNext].requestedFrame < candidate.requestedFrame) {
+            evict(resident[evictNext].live, resident[evictNext].tile);
+            ++evictNext;
+        }
+        if (residentBytes + sparse.tileBytes > budget) {
+            break;
+        }
+
+        Sparse::Tile& tile = sparse.tiles[candidate.tile];
+        tile.slot = allocateTile(sparse.memoryTypeIndex, sparse.tileBytes);
+        tile.state = Sparse::Binding;
+        ++sparse.busyTiles;
+        residentBytes += sparse.tileBytes;
+        uploaded += sparse.tileBytes;
+        imageBinds[candidate.live].push_back(vk::SparseImageMemoryBind(vk::ImageSubresource(vk::ImageAspectFlagBits::eColor, tile.mip, 0),
+            tile.offset, tile.extent, pages[tile.slot.page].memory, tile.slot.index * sparse.tileBytes));
+        bound.push_back(std::make_pair(live[candidate.live], candidate.tile));
+        boundSerials.push_back(entry.serial);
+    }
+
+    FrameVector<vk::SparseImageMemoryBindInfo> bindInfos(arena.Get());
+    for (uint32_t i = 0; i < live.size(); ++i) {
+        if (!imageBinds[i].empty()) {
+            bindInfos.push_back(vk::SparseImageMemoryBindInfo(entries[live[i]].sparse->image, static_cast<uint32_t>(imageBinds[i].size()), imageBinds[i].data()));
+        }
+    }
+    if (bindInfos.empty()) {
+        return;
+    }
+    vk::BindSparseInfo bindInfo;
+    bindInfo.imageBindCount = static_cast<uint32_t>(bindInfos.size());
+    bindInfo.pImageBinds = bindInfos.data();
+    PendingBind pending;
+    pending.fence = device.createFence(vk::FenceCreateInfo());
+    pending.tiles = bound;
+    pending.serials = boundSerials;
+    sparseQueue.bindSparse(bindInfo, pending.fence);
+    pendingBinds.push_back(pending);
+}
+
+void TextureStreamer::uploadTile(Entry& entry, uint32_t tileIndex)
+{
+    Sparse& sparse = *entry.sparse;
+    Sparse::Tile& tile = sparse.tiles[tileIndex];
+    const Level& level = entry.levels[tile.mip];
+
+    // the tile's rows are strided in the level, gather them into one tight copy
+    const uint32_t block = blockSize(entry.format);
+    const uint32_t blocksWide = (level.width + block - 1) / block;
+    const uint32_t blocksHigh = (level.height + block - 1) / block;
+    const size_t blockBytes = static_cast<size_t>(level.size / (blocksWide * blocksHigh));
+    const uint32_t rowBlocks = (tile.extent.width + block - 1) / block;
+    const uint32_t rows = (tile.extent.height + block - 1) / block;
+    std::vector<uint8_t> texels(rowBlocks * rows * blockBytes);
+    for (uint32_t row = 0; row < rows; ++row) {
+        const size_t src = ((tile.offset.y / block + row) * static_cast<size_t>(blocksWide) + tile.offset.x / block) * blockBytes;
+        memcpy(&texels[row * rowBlocks * blockBytes], level.data + src, rowBlocks * blockBytes);
+    }
+
+    vk::BufferImageCopy region;
+    region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, tile.mip, 0, 1);
+    region.imageOffset = tile.offset;
+    region.imageExtent = tile.extent;
+    const vk::ImageSubresourceRange range = sparse.layoutReady
+        ? vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, tile.mip, 1, 0, 1)
+        : vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, static_cast<uint32_t>(entry.levels.size()), 0, 1);
+    upload.CopyToImage(texels.data(), texels.size(), sparse.image, std::vector<vk::BufferImageCopy>(1, region), range,
+        vk::ImageLayout::eGeneral, sparse.layoutReady ? vk::ImageLayout::eGeneral : vk::ImageLayout::eUndefined);
+    sparse.layoutReady = true;
+    tile.state = Sparse::Uploading;
+}
+
+TextureStreamer::TileSlot TextureStreamer::allocateTile(uint32_t memoryTypeIndex, vk::DeviceSize tileBytes)
+{
+    for (uint32_t p = 0; p < pages.size(); ++p) {
+        Page& page = pages[p];
+        if (page.memoryTypeIndex == memoryTypeIndex && page.tileBytes == tileBytes && !page.freeTiles.empty()) {
+            TileSlot slot = { p, page.freeTiles.back() };
+            page.freeTiles.pop_back();
+            return slot;
+        }
+    }
+
+    // pages are kept once allocated, tiles of several textures share them
+    Page page;
+    page.memoryTypeIndex = memoryTypeIndex;
+    page.tileBytes = tileBytes;
+    vk::MemoryAllocateInfo memAllocInfo;
+    memAllocInfo.allocationSize = tileBytes * SparsePageTiles;
+    memAllocInfo.memoryTypeIndex = memoryTypeIndex;
+    page.memory = device.allocateMemory(memAllocInfo);
+    perflint::Allocate(memAllocInfo.allocationSize, "TextureStreamer page");
+    for (uint32_t i = SparsePageTiles - 1; i > 0; --i) {
+        page.freeTiles.push_back(i);
+    }
+    pages.push_back(page);
+    TileSlot slot = { static_cast<uint32_t>(pages.size()) - 1, 0 };
+    return slot;
+}
+
+void TextureStreamer::releaseTile(const TileSlot& slot, bool deferred)
+{
+    if (!deferred) {
+        pages[slot.page].freeTiles.push_back(slot.index);
+        return;
+    }
+    // the trash may outlive the streamer, the list is shared
+    std::shared_ptr<std::vector<TileSlot>> freed = freedTiles;
+    trash.Trash([freed, slot]() { freed->push_back(slot); });
+}
+
+void TextureStreamer::releaseSparse(Entry& entry, bool deferred)
+{
+    Sparse& sparse = *entry.sparse;
+    if (sparse.busyTiles > 0) {
+        // bindings and copies still write to the image
+        for (auto& bind : pendingBinds) {
+            device.waitForFences(bind.fence, VK_TRUE, UINT64_MAX);
+        }
+        upload.WaitIdle();
+    }
+    for (auto& tile : sparse.tiles) {
+        if (tile.state != Sparse::Unbound) {
+            releaseTile(tile.slot, deferred);
+            residentBytes -= sparse.tileBytes;
+        }
+    }
+    entry.sparse.reset();
+}
+} // End of namespace m3d
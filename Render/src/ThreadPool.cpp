@@ -0,0 +1,39 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ThreadPool.hpp"
+
+namespace m3d {
+
+ThreadPool::ThreadPool(uint32_t threadCount, JobSystem::Priority priority)
+    : ownJobs(new JobSystem(threadCount == 0 ? 1 : threadCount, priority))
+    , jobs(ownJobs.get())
+    , priority(priority)
+{
+}
+
+ThreadPool::ThreadPool(JobSystem& jobSystem, JobSystem::Priority priority)
+    : jobs(&jobSystem)
+    , priority(priority)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    // tasks may still be queued on a shared system, none may outlive the pool
+    Wait();
+}
+
+void ThreadPool::Enqueue(std::function<void()> task)
+{
+    jobs->Run(std::move(task), &pending, priority);
+}
+
+void ThreadPool::Wait()
+{
+    jobs->WaitFor(pending);
+}
+} // End of namespace m3d
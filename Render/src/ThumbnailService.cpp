@@ -0,0 +1,165 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ThumbnailService.hpp"
+#include "RendererVulkan.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+namespace m3d {
+
+// Every texel of the result the average of the source texels it covers, at least one
+static RgbaImage resize(const RgbaImage& source, uint32_t width, uint32_t height)
+{
+    RgbaImage result;
+    result.width = width;
+    result.height = height;
+    result.texels.resize(width * height * 4);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint32_t y0 = y * source.height / height;
+        const uint32_t y1 = std::max(y0 + 1, (y + 1) * source.height / height);
+        for (uint32_t x = 0; x < width; ++x) {
+            const uint32_t x0 = x * source.width / width;
+            const uint32_t x1 = std::max(x0 + 1, (x + 1) * source.width / width);
+            uint32_t sum[4] = {};
+            for (uint32_t sy = y0; sy < y1; ++sy) {
+                const uint8_t* texel = &source.texels[(sy * source.width + x0) * 4];
+                for (uint32_t sx = x0; sx < x1; ++sx, texel += 4) {
+                    sum[0] += texel[0];
+                    sum[1] += texel[1];
+                    sum[2] += texel[2];
+                    sum[3] += texel[3];
+                }
+            }
+            const uint32_t count = (x1 - x0) * (y1 - y0);
+            uint8_t* out = &result.texels[(y * width + x) * 4];
+            for (int c = 0; c < 4; ++c) {
+                out[c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+            }
+        }
+    }
+    return result;
+}
+
+ThumbnailService::ThumbnailService(RendererVulkan& Renderer, SceneLoader Loader, ThreadPool& Encoders)
+    : renderer(Renderer)
+    , loader(Loader)
+    , encoders(Encoders)
+{
+    renderer.SetReadbackCallback([this](uint64_t id, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch) {
+        readback(id, pixels, width, height, rowPitch);
+    });
+}
+
+ThumbnailService::~ThumbnailService()
+{
+    encoders.Wait();
+    renderer.SetReadbackCallback(nullptr);
+}
+
+void ThumbnailService::Submit(const Request& request)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    submitted.push_back(request);
+}
+
+uint32_t ThumbnailService::Run()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running.swap(submitted);
+        submitted.clear();
+    }
+    written = 0;
+
+    // the scenes in the order they were first asked for, each with its requests in submission order
+    std::vector<std::string> scenes;
+    std::unordered_map<std::string, std::vector<uint32_t>> groups;
+    for (uint32_t i = 0; i < running.size(); ++i) {
+        std::vector<uint32_t>& group = groups[running[i].scene];
+        if (group.empty()) {
+            scenes.push_back(running[i].scene);
+        }
+        group.push_back(i);
+    }
+
+    for (const std::string& scene : scenes) {
+        const std::vector<uint32_t>& group = groups[scene];
+        if (loader && !loader(scene)) {
+            printf("ThumbnailService: can not load %s, %u thumbnails skipped\n", scene.c_str(), static_cast<uint32_t>(group.size()));
+            for (uint32_t i : group) {
+                finish(running[i], false);
+            }
+            continue;
+        }
+        for (uint32_t i : group) {
+            renderer.RenderOffscreen(i, running[i].view, running[i].projection);
+        }
+        // every render of the scene is read back before the loader replaces it
+        renderer.FinishOffscreen();
+    }
+    encoders.Wait();
+    running.clear();
+    return written;
+}
+
+// On the drawing thread, the pixels are only valid during the call
+void ThumbnailService::readback(uint64_t id, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch)
+{
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->request = running[static_cast<size_t>(id)];
+    job->image.width = width;
+    job->image.height = height;
+    job->image.texels.resize(width * height * 4);
+    for (uint32_t y = 0; y < height; ++y) {
+        memcpy(&job->image.texels[y * width * 4], pixels + y * rowPitch, width * 4);
+    }
+
+    // the copies of a fast GPU would pile up behind slow encoders
+    if (encodes.fetch_add(1) >= MaxEncodes) {
+        encode(*job);
+        return;
+    }
+    encoders.Enqueue([this, job]() { encode(*job); });
+}
+
+void ThumbnailService::encode(Job& job)
+{
+    // the targets are BGRA8
+    std::vector<uint8_t>& texels = job.image.texels;
+    for (size_t i = 0; i < texels.size(); i += 4) {
+        std::swap(texels[i], texels[i + 2]);
+    }
+    const Request& request = job.request;
+    const uint32_t width = request.width > 0 ? request.width : job.image.width;
+    const uint32_t height = request.height > 0 ? request.height : job.image.height;
+    if (width != job.image.width || height != job.image.height) {
+        job.image = resize(job.image, width, height);
+    }
+
+    const bool ok = request.encoding == Encoding::Png ? WriteRgbaPng(job.image, request.path) : WriteRgbaKtx(job.image, request.path);
+    if (!ok) {
+        printf("ThumbnailService: can not write %s\n", request.path.c_str());
+    }
+    finish(request, ok);
+    encodes.fetch_sub(1);
+}
+
+void ThumbnailService::finish(const Request& request, bool ok)
+{
+    if (ok) {
+        ++written;
+    }
+    if (done) {
+        done(request, ok);
+    }
+}
+} // End of namespace m3d
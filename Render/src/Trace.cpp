@@ -0,0 +1,198 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace m3d {
+namespace trace {
+
+struct Event {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// written by its thread only, read by Flush
+struct ThreadRing {
+    Event events[RingSize];
+    // total events written and read, the difference is what the ring holds
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> dropped;
+    uint32_t id;
+    // set by its thread, written out once by the next Flush
+    std::mutex nameMutex;
+    std::string name;
+    bool nameWritten;
+};
+
+// rings outlive their threads, Flush still drains the events of a finished one
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ThreadRing>> rings;
+static thread_local ThreadRing* currentRing = nullptr;
+
+// Flush and End from any thread, one at a time
+static std::mutex fileMutex;
+static FILE* file = nullptr;
+static bool firstEvent = true;
+static uint64_t epoch = 0;
+static std::atomic<bool> recording(false);
+
+static ThreadRing& threadRing()
+{
+    if (!currentRing) {
+        ThreadRing* ring = new ThreadRing();
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->nameWritten = true;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        ring->id = static_cast<uint32_t>(rings.size());
+        rings.emplace_back(ring);
+        currentRing = ring;
+    }
+    return *currentRing;
+}
+
+void SetThreadName(const char* name)
+{
+    ThreadRing& ring = threadRing();
+    std::lock_guard<std::mutex> lock(ring.nameMutex);
+    ring.name = name;
+    ring.nameWritten = false;
+}
+
+void Record(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+    if (!recording.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ThreadRing& ring = threadRing();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) == RingSize) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& event = ring.events[head % RingSize];
+    event.name = name;
+    event.begin = beginNs;
+    event.end = endNs;
+    // publishes the event to Flush
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+// JSON string characters of a zone name, names are literals of the code, quotes and backslashes suffice
+static void writeName(const char* name)
+{
+    for (const char* c = name; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*c, file);
+    }
+}
+
+static void separate()
+{
+    fputs(firstEvent ? "\n" : ",\n", file);
+    firstEvent = false;
+}
+
+bool Begin(const char* path)
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (file) {
+        return false;
+    }
+    file = fopen(path, "w");
+    if (!file) {
+        printf("trace: can not create %s\n", path);
+        return false;
+    }
+    fputs("{\"traceEvents\":[", file);
+    firstEvent = true;
+    epoch = Now();
+
+    // what the rings hold predates the trace
+    {
+        std::lock_guard<std::mutex> registryLock(registryMutex);
+        for (auto& ring : rings) {
+            ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+            std::lock_guard<std::mutex> nameLock(ring->nameMutex);
+            ring->nameWritten = ring->name.empty();
+        }
+    }
+    recording = true;
+    return true;
+}
+
+static void flushLocked()
+{
+    if (!file) {
+        return;
+    }
+    std::lock_guard<std::mutex> registryLock(registryMutex);
+    for (auto& ring : rings) {
+        {
+            std::lock_guard<std::mutex> nameLock(ring->nameMutex);
+            if (!ring->nameWritten) {
+                separate();
+                fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", ring->id);
+                writeName(ring->name.c_str());
+                fputs("\"}}", file);
+                ring->nameWritten = true;
+            }
+        }
+
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (; tail != head; ++tail) {
+            const Event& event = ring->events[tail % RingSize];
+            // complete events in microseconds since Begin
+            const uint64_t begin = event.begin > epoch ? event.begin - epoch : 0;
+            separate();
+            fputs("{\"name\":\"", file);
+            writeName(event.name);
+            fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", ring->id, begin / 1000.0,
+                (event.end - event.begin) / 1000.0);
+        }
+        // the slots can be written again
+        ring->tail.store(tail, std::memory_order_release);
+
+        const uint32_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            printf("trace: thread %u dropped %u events, flush more often\n", ring->id, dropped);
+        }
+    }
+    fflush(file);
+}
+
+void Flush()
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    flushLocked();
+}
+
+void End()
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    recording = false;
+    flushLocked();
+    if (file) {
+        fputs("\n]}\n", file);
+        fclose(file);
+        file = nullptr;
+    }
+}
+}
+} // End of namespace m3d
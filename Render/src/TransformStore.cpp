@@ -0,0 +1,281 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "TransformStore.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace m3d {
+
+const uint32_t TransformStore::NoParent;
+
+uint32_t TransformStore::slot(uint32_t transformID)
+{
+    return transformID & chunked_freelist<Transform>::index_mask;
+}
+
+void TransformStore::grow(uint32_t count)
+{
+    const uint32_t groupCount = (count + GroupSize - 1) / GroupSize;
+    if (groupCount <= groups.size()) {
+        return;
+    }
+    // identity for the padding lanes, they get computed along with their group
+    Group identity = {};
+    for (uint32_t lane = 0; lane < GroupSize; ++lane) {
+        identity.scaleX[lane] = identity.scaleY[lane] = identity.scaleZ[lane] = 1.0f;
+        identity.rotationW[lane] = 1.0f;
+    }
+    groups.resize(groupCount, identity);
+    locals.resize(groupCount * GroupSize);
+    worlds.resize(groupCount * GroupSize);
+    groupDirty.resize(groupCount, 0);
+    parents.resize(groupCount * GroupSize, NoParent);
+    used.resize(groupCount * GroupSize, 0);
+    changed.resize(groupCount * GroupSize, 0);
+    moved.resize(groupCount * GroupSize, 0);
+}
+
+void TransformStore::Set(uint32_t transformID, const Transform& transform)
+{
+    const uint32_t index = slot(transformID);
+    grow(index + 1);
+    if (!used[index]) {
+        used[index] = 1;
+        orderDirty = true;
+    }
+
+    Group& group = groups[index / GroupSize];
+    const uint32_t lane = index % GroupSize;
+    group.positionX[lane] = transform.position.x;
+    group.positionY[lane] = transform.position.y;
+    group.positionZ[lane] = transform.position.z;
+    group.scaleX[lane] = transform.scale.x;
+    group.scaleY[lane] = transform.scale.y;
+    group.scaleZ[lane] = transform.scale.z;
+    group.rotationX[lane] = transform.rotation.x;
+    group.rotationY[lane] = transform.rotation.y;
+    group.rotationZ[lane] = transform.rotation.z;
+    group.rotationW[lane] = transform.rotation.w;
+
+    if (!groupDirty[index / GroupSize]) {
+        groupDirty[index / GroupSize] = 1;
+        dirtyGroups.push_back(index / GroupSize);
+    }
+}
+
+void TransformStore::Remove(uint32_t transformID)
+{
+    const uint32_t index = slot(transformID);
+    if (index >= used.size() || !used[index]) {
+        return;
+    }
+    used[index] = 0;
+    parents[index] = NoParent;
+    orderDirty = true;
+}
+
+void TransformStore::SetParent(uint32_t transformID, uint32_t parentID)
+{
+    const uint32_t index = slot(transformID);
+    assert(Contains(transformID) && (parentID == NoParent || Contains(parentID)));
+    parents[index] = parentID;
+    changed[index] = 1;
+    orderDirty = true;
+}
+
+uint32_t TransformStore::GetParent(uint32_t transformID) const
+{
+    return parents[slot(transformID)];
+}
+
+void TransformStore::sortByDepth()
+{
+    // depth of every used slot, walking up to the first node with a known depth
+    const uint32_t Unknown = 0xFFFFFFFF;
+    std::vector<uint32_t> depths(used.size(), Unknown);
+    std::vector<uint32_t> chain;
+    uint32_t maxDepth = 0;
+    for (uint32_t index = 0; index < used.size(); ++index) {
+        if (!used[index] || depths[index] != Unknown) {
+            continue;
+        }
+        uint32_t node = index;
+        while (node != NoParent && depths[node] == Unknown) {
+            chain.push_back(node);
+            node = parents[node] == NoParent ? NoParent : slot(parents[node]);
+        }
+        uint32_t depth = node == NoParent ? 0 : depths[node] + 1;
+        while (!chain.empty()) {
+            depths[chain.back()] = depth++;
+            chain.pop_back();
+        }
+        maxDepth = std::max(maxDepth, depth - 1);
+    }
+
+    // counting sort, slot order is kept inside a level
+    std::vector<uint32_t> offsets(maxDepth + 2, 0);
+    for (uint32_t index = 0; index < used.size(); ++index) {
+        if (used[index]) {
+            ++offsets[depths[index] + 1];
+        }
+    }
+    for (uint32_t depth = 1; depth < offsets.size(); ++depth) {
+        offsets[depth] += offsets[depth - 1];
+    }
+    order.resize(offsets.back());
+    for (uint32_t index = 0; index < used.size(); ++index) {
+        if (used[index]) {
+            order[offsets[depths[index]]++] = index;
+        }
+    }
+}
+
+uint32_t TransformStore::Update()
+{
+    if (dirtyGroups.empty() && !orderDirty) {
+        return 0;
+    }
+
+    for (uint32_t group : dirtyGroups) {
+        computeLocals(groups[group], &locals[group * GroupSize]);
+        groupDirty[group] = 0;
+        for (uint32_t lane = 0; lane < GroupSize; ++lane) {
+            changed[group * GroupSize + lane] = 1;
+        }
+    }
+    dirtyGroups.clear();
+    if (orderDirty) {
+        sortByDepth();
+        orderDirty = false;
+    }
+
+    // parents come first, a changed parent has already passed the flag on by the time its children are visited
+    uint32_t updated = 0;
+    for (uint32_t index : order) {
+        const uint32_t parent = parents[index] == NoParent ? NoParent : slot(parents[index]);
+        if (parent != NoParent && changed[parent]) {
+            changed[index] = 1;
+        }
+        if (!changed[index]) {
+            continue;
+        }
+        if (parent == NoParent) {
+            worlds[index] = locals[index];
+        } else {
+            m3d::math::MatrixMultiply(&worlds[index], &worlds[parent], &locals[index]);
+        }
+        if (!moved[index]) {
+            moved[index] = 1;
+            movedSlots.push_back(index);
+        }
+        ++updated;
+    }
+    std::fill(changed.begin(), changed.end(), 0);
+    return updated;
+}
+
+void TransformStore::TakeMoved(std::vector<uint32_t>& slots)
+{
+    for (uint32_t index : movedSlots) {
+        moved[index] = 0;
+    }
+    slots.swap(movedSlots);
+    movedSlots.clear();
+}
+
+void TransformStore::Clear()
+{
+    groups.clear();
+    locals.clear();
+    worlds.clear();
+    groupDirty.clear();
+    dirtyGroups.clear();
+    parents.clear();
+    used.clear();
+    changed.clear();
+    moved.clear();
+    movedSlots.clear();
+    order.clear();
+    orderDirty = false;
+}
+
+/* Column vector T * R * S for four entries, lane k of every register belongs to entry k */
+void TransformStore::computeLocals(const Group& group, m3d::math::Matrix4x4* locals)
+{
+    using namespace m3d::math;
+#if USE_SIMD
+    const VectorSIMD one = MakeVectorSIMD(1.0f, 1.0f, 1.0f, 1.0f);
+    const VectorSIMD two = MakeVectorSIMD(2.0f, 2.0f, 2.0f, 2.0f);
+
+    VectorSIMD qx = VectorLoad4f(group.rotationX);
+    VectorSIMD qy = VectorLoad4f(group.rotationY);
+    VectorSIMD qz = VectorLoad4f(group.rotationZ);
+    VectorSIMD qw = VectorLoad4f(group.rotationW);
+    VectorSIMD sx = VectorLoad4f(group.scaleX);
+    VectorSIMD sy = VectorLoad4f(group.scaleY);
+    VectorSIMD sz = VectorLoad4f(group.scaleZ);
+    VectorSIMD px = VectorLoad4f(group.positionX);
+    VectorSIMD py = VectorLoad4f(group.positionY);
+    VectorSIMD pz = VectorLoad4f(group.positionZ);
+
+    VectorSIMD x2 = VectorMultiply(qx, two);
+    VectorSIMD y2 = VectorMultiply(qy, two);
+    VectorSIMD z2 = VectorMultiply(qz, two);
+    VectorSIMD xx = VectorMultiply(qx, x2);
+    VectorSIMD yy = VectorMultiply(qy, y2);
+    VectorSIMD zz = VectorMultiply(qz, z2);
+    VectorSIMD xy = VectorMultiply(qx, y2);
+    VectorSIMD xz = VectorMultiply(qx, z2);
+    VectorSIMD yz = VectorMultiply(qy, z2);
+    VectorSIMD wx = VectorMultiply(qw, x2);
+    VectorSIMD wy = VectorMultiply(qw, y2);
+    VectorSIMD wz = VectorMultiply(qw, z2);
+
+    // rotation column j is scaled by s[j]
+    VectorSIMD row0[4] = {
+        VectorMultiply(VectorSubstract(one, VectorAdd(yy, zz)), sx),
+        VectorMultiply(VectorSubstract(xy, wz), sy),
+        VectorMultiply(VectorAdd(xz, wy), sz),
+        px
+    };
+    VectorSIMD row1[4] = {
+        VectorMultiply(VectorAdd(xy, wz), sx),
+        VectorMultiply(VectorSubstract(one, VectorAdd(xx, zz)), sy),
+        VectorMultiply(VectorSubstract(yz, wx), sz),
+        py
+    };
+    VectorSIMD row2[4] = {
+        VectorMultiply(VectorSubstract(xz, wy), sx),
+        VectorMultiply(VectorAdd(yz, wx), sy),
+        VectorMultiply(VectorSubstract(one, VectorAdd(xx, yy)), sz),
+        pz
+    };
+
+    // lanes hold one matrix element for four entries, transpose to one matrix row per register
+    VectorTranspose4(row0[0], row0[1], row0[2], row0[3]);
+    VectorTranspose4(row1[0], row1[1], row1[2], row1[3]);
+    VectorTranspose4(row2[0], row2[1], row2[2], row2[3]);
+    const VectorSIMD row3 = MakeVectorSIMD(0.0f, 0.0f, 0.0f, 1.0f);
+    for (uint32_t lane = 0; lane < GroupSize; ++lane) {
+        VectorStore4f(row0[lane], locals[lane].m[0]);
+        VectorStore4f(row1[lane], locals[lane].m[1]);
+        VectorStore4f(row2[lane], locals[lane].m[2]);
+        VectorStore4f(row3, locals[lane].m[3]);
+    }
+#else
+    for (uint32_t lane = 0; lane < GroupSize; ++lane) {
+        Transform transform;
+        transform.position = Vector3(group.positionX[lane], group.positionY[lane], group.positionZ[lane]);
+        transform.scale = Vector3(group.scaleX[lane], group.scaleY[lane], group.scaleZ[lane]);
+        transform.rotation = Quaternion(group.rotationX[lane], group.rotationY[lane], group.rotationZ[lane], group.rotationW[lane]);
+        locals[lane] = transform.ToMatrix();
+    }
+#endif
+}
+} // End of namespace m3d
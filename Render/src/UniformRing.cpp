@@ -0,0 +1,72 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "UniformRing.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace m3d {
+
+const vk::DeviceSize UniformRing::DefaultFrameBytes;
+
+UniformRing::UniformRing(vk::Device& Device, vk::PhysicalDevice& physicalDevice, uint32_t FrameSlots, vk::DeviceSize FrameBytes)
+    : device(Device)
+    , frameSlots(FrameSlots)
+    , currentSlot(0)
+    , cursor(0)
+    , overflowReported(false)
+{
+    alignment = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.minUniformBufferOffsetAlignment, 1);
+    // every slot starts aligned
+    frameBytes = (FrameBytes + alignment - 1) / alignment * alignment;
+
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(vk::BufferUsageFlagBits::eUniformBuffer);
+    bufferCreateInfo.setSize(frameBytes * frameSlots);
+    buffer = device.createBuffer(bufferCreateInfo);
+    vkx::debug::marker::setName(device, buffer, "uniform ring");
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(buffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    memory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(buffer, memory, 0);
+    mapped = static_cast<uint8_t*>(device.mapMemory(memory, 0, frameBytes * frameSlots));
+}
+
+UniformRing::~UniformRing()
+{
+    device.unmapMemory(memory);
+    device.destroyBuffer(buffer);
+    device.freeMemory(memory);
+}
+
+void UniformRing::BeginFrame(uint32_t slot)
+{
+    currentSlot = slot % frameSlots;
+    cursor.store(0);
+}
+
+UniformRing::Allocation UniformRing::Allocate(vk::DeviceSize size)
+{
+    const vk::DeviceSize aligned = (size + alignment - 1) / alignment * alignment;
+    const vk::DeviceSize offset = cursor.fetch_add(aligned);
+    Allocation allocation = {};
+    if (offset + size > frameBytes) {
+        if (!overflowReported.exchange(true)) {
+            printf("UniformRing: more than %u bytes of constants in a frame\n", static_cast<uint32_t>(frameBytes));
+        }
+        return allocation;
+    }
+    allocation.offset = GetFrameOffset(currentSlot) + static_cast<uint32_t>(offset);
+    allocation.data = mapped + allocation.offset;
+    return allocation;
+}
+} // End of namespace m3d
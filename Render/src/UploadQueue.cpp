@@ -0,0 +1,304 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "UploadQueue.hpp"
+#include "PerfLint.hpp"
+#include "SubmitTimeline.hpp"
+#include "VulkanHelper.hpp"
+#include "vulkanDebug.h"
+
+#include <cstring>
+
+// staging offsets are kept aligned for optimalBufferCopyOffsetAlignment and texel block sizes
+#define STAGING_ALIGNMENT 16
+
+namespace m3d {
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+UploadQueue::UploadQueue(vk::Device& Device, vk::PhysicalDevice& PhysicalDevice, SubmitTimeline& Timeline, uint32_t QueueFamilyIndex, uint32_t graphicsFamilyIndex, vk::DeviceSize RingSize)
+    : device(Device)
+    , physicalDevice(PhysicalDevice)
+    , timeline(Timeline)
+    , queueFamilyIndex(QueueFamilyIndex)
+    , ringSize(RingSize)
+    , ringHead(0)
+    , ringTail(0)
+    , uploadedBytes(0)
+    , batchOpen(false)
+{
+    if (queueFamilyIndex != graphicsFamilyIndex) {
+        sharingFamilies = { queueFamilyIndex, graphicsFamilyIndex };
+    }
+
+    vk::CommandPoolCreateInfo cmdPoolInfo;
+    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+    cmdPoolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient;
+    cmdPool = device.createCommandPool(cmdPoolInfo);
+
+    vk::BufferCreateInfo bufferCreateInfo;
+    bufferCreateInfo.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+    bufferCreateInfo.setSize(ringSize);
+    ringBuffer = device.createBuffer(bufferCreateInfo);
+    vkx::debug::marker::setName(device, ringBuffer, "upload ring");
+
+    vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(ringBuffer);
+    vk::MemoryAllocateInfo memAlloc;
+    memAlloc.allocationSize = memReqs.size;
+    memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    ringMemory = device.allocateMemory(memAlloc);
+    device.bindBufferMemory(ringBuffer, ringMemory, 0);
+
+    // stays mapped for the lifetime of the queue
+    ringMapped = static_cast<uint8_t*>(device.mapMemory(ringMemory, 0, ringSize));
+}
+
+UploadQueue::~UploadQueue()
+{
+    submitBatch();
+    WaitIdle();
+
+    for (auto& cmd : freeCmdBuffers) {
+        device.freeCommandBuffers(cmdPool, cmd);
+    }
+    device.destroyCommandPool(cmdPool);
+
+    device.unmapMemory(ringMemory);
+    device.destroyBuffer(ringBuffer);
+    device.freeMemory(ringMemory);
+}
+
+UploadQueue::Staging UploadQueue::Stage(vk::DeviceSize size)
+{
+    uploadedBytes += size;
+    Staging staged;
+    staged.size = size;
+    // Larger than the whole ring, give it a staging buffer of its own
+    if (size > ringSize) {
+        vk::BufferCreateInfo bufferCreateInfo;
+        bufferCreateInfo.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+        bufferCreateInfo.setSize(size);
+        vk::Buffer buffer = device.createBuffer(bufferCreateInfo);
+
+        vk::MemoryRequirements memReqs = device.getBufferMemoryRequirements(buffer);
+        vk::MemoryAllocateInfo memAlloc;
+        memAlloc.allocationSize = memReqs.size;
+        memAlloc.memoryTypeIndex = vkhelper::getMemoryType(physicalDevice, memReqs.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        vk::DeviceMemory memory = device.allocateMemory(memAlloc);
+        device.bindBufferMemory(buffer, memory, 0);
+
+        // freeing the memory once the batch retired unmaps it
+        staged.data = static_cast<uint8_t*>(device.mapMemory(memory, 0, size));
+        staged.buffer = buffer;
+        staged.offset = 0;
+
+        beginBatch();
+        openBatch.overflow.emplace_back(buffer, memory);
+        return staged;
+    }
+
+    uint64_t start;
+    for (;;) {
+        start = alignUp(ringHead, STAGING_ALIGNMENT);
+        // do not wrap a single copy around the end of the ring
+        if (start % ringSize + size > ringSize) {
+            start = alignUp(start, ringSize);
+        }
+        if (start + size <= ringTail + ringSize) {
+            break;
+        }
+
+        // Ring is full, make room by retiring the oldest batch
+        if (inFlight.empty()) {
+            if (batchOpen) {
+                submitBatch();
+            } else {
+                ringHead = ringTail = alignUp(ringHead, ringSize);
+            }
+            continue;
+        }
+        timeline.Wait(inFlight.front().value);
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+
+    ringHead = start + size;
+    staged.data = ringMapped + start % ringSize;
+    staged.buffer = ringBuffer;
+    staged.offset = start % ringSize;
+
+    beginBatch();
+    return staged;
+}
+
+void UploadQueue::beginBatch()
+{
+    if (batchOpen) {
+        return;
+    }
+
+    if (freeCmdBuffers.empty()) {
+        vk::CommandBufferAllocateInfo cmdBufAllocateInfo;
+        cmdBufAllocateInfo.commandPool = cmdPool;
+        cmdBufAllocateInfo.level = vk::CommandBufferLevel::ePrimary;
+        cmdBufAllocateInfo.commandBufferCount = 1;
+        openBatch.cmd = device.allocateCommandBuffers(cmdBufAllocateInfo)[0];
+    } else {
+        openBatch.cmd = freeCmdBuffers.back();
+        freeCmdBuffers.pop_back();
+    }
+
+    vk::CommandBufferBeginInfo cmdBufInfo;
+    cmdBufInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    openBatch.cmd.begin(cmdBufInfo);
+    batchOpen = true;
+}
+
+void UploadQueue::submitBatch()
+{
+    if (!batchOpen) {
+        return;
+    }
+
+    openBatch.cmd.end();
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &openBatch.cmd;
+    // reaches the queue with the frame's submissions, or when something waits for it
+    openBatch.value = timeline.Defer(submitInfo);
+
+    openBatch.ringEnd = ringHead;
+    inFlight.push_back(std::move(openBatch));
+    openBatch = Batch();
+    batchOpen = false;
+}
+
+void UploadQueue::retire(Batch& batch)
+{
+    ringTail = batch.ringEnd;
+
+    for (auto& overflow : batch.overflow) {
+        device.destroyBuffer(overflow.first);
+        device.freeMemory(overflow.second);
+    }
+
+    freeCmdBuffers.push_back(batch.cmd);
+
+    for (auto& callback : batch.callbacks) {
+        callback();
+    }
+}
+
+void UploadQueue::CopyToBuffer(const void* data, vk::DeviceSize size, vk::Buffer dst, vk::DeviceSize dstOffset)
+{
+    Staging staged = Stage(size);
+    memcpy(staged.data, data, size);
+    CopyToBuffer(staged, dst, dstOffset);
+}
+
+void UploadQueue::CopyToBuffer(const Staging& staged, vk::Buffer dst, vk::DeviceSize dstOffset)
+{
+    openBatch.cmd.copyBuffer(staged.buffer, dst, vk::BufferCopy(staged.offset, dstOffset, staged.size));
+}
+
+void UploadQueue::CopyToBuffer(const Staging& staged, vk::Buffer dst, const std::vector<vk::BufferCopy>& regions)
+{
+    std::vector<vk::BufferCopy> stagedRegions(regions);
+    for (auto& region : stagedRegions) {
+        region.srcOffset += staged.offset;
+    }
+    openBatch.cmd.copyBuffer(staged.buffer, dst, stagedRegions);
+}
+
+void UploadQueue::CopyToImage(const void* data, vk::DeviceSize size, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions,
+    const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout, vk::ImageLayout initialLayout)
+{
+    Staging staged = Stage(size);
+    memcpy(staged.data, data, size);
+    CopyToImage(staged, dst, regions, range, finalLayout, initialLayout);
+}
+
+void UploadQueue::CopyToImage(const Staging& staged, vk::Image dst, const std::vector<vk::BufferImageCopy>& regions,
+    const vk::ImageSubresourceRange& range, vk::ImageLayout finalLayout, vk::ImageLayout initialLayout)
+{
+    std::vector<vk::BufferImageCopy> stagedRegions(regions);
+    for (auto& region : stagedRegions) {
+        region.bufferOffset += staged.offset;
+    }
+
+    // images that stay in general layout are copied to while other parts of them are sampled
+    const vk::ImageLayout copyLayout = initialLayout == vk::ImageLayout::eGeneral && finalLayout == vk::ImageLayout::eGeneral
+        ? vk::ImageLayout::eGeneral
+        : vk::ImageLayout::eTransferDstOptimal;
+
+    vk::ImageMemoryBarrier barrier;
+    barrier.oldLayout = initialLayout;
+    barrier.newLayout = copyLayout;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.image = dst;
+    barrier.subresourceRange = range;
+    openBatch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, barrier);
+
+    openBatch.cmd.copyBufferToImage(staged.buffer, dst, copyLayout, stagedRegions);
+
+    // Consumers only touch the image after the fence completed, so the
+    // destination stage is left at bottom of pipe (valid on transfer-only queues).
+    barrier.oldLayout = copyLayout;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlags();
+    openBatch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, nullptr, barrier);
+}
+
+void UploadQueue::Submit(Callback onComplete)
+{
+    if (!batchOpen) {
+        // nothing recorded, complete together with the newest batch
+        if (onComplete) {
+            if (inFlight.empty()) {
+                onComplete();
+            } else {
+                inFlight.back().callbacks.push_back(onComplete);
+            }
+        }
+        return;
+    }
+
+    if (onComplete) {
+        openBatch.callbacks.push_back(onComplete);
+    }
+    submitBatch();
+}
+
+void UploadQueue::Poll()
+{
+    // batches finish in submission order on a single queue
+    const uint64_t completed = timeline.GetCompleted();
+    while (!inFlight.empty() && inFlight.front().value <= completed) {
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+}
+
+void UploadQueue::WaitIdle()
+{
+    if (!inFlight.empty()) {
+        perflint::WaitIdle("UploadQueue::WaitIdle");
+    }
+    while (!inFlight.empty()) {
+        timeline.Wait(inFlight.front().value);
+        Batch batch = std::move(inFlight.front());
+        inFlight.pop_front();
+        retire(batch);
+    }
+}
+} // End of namespace m3d
@@ -0,0 +1,484 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "WorldPartition.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+namespace m3d {
+
+static const char WorldMagic[4] = { 'M', '3', 'D', 'W' };
+static const uint32_t WorldVersion = 1;
+
+// What a cell takes of the GPU's geometry, as GeometryArena uploads it
+static uint64_t geometryBytes(const Mesh& mesh)
+{
+    const uint64_t indexBytes = mesh.indexType() == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    return mesh.vertexCount() * sizeof(PackedVertex) + mesh.indexCount() * indexBytes;
+}
+
+/* The transform and its parents into cell, once */
+static uint32_t copyTransform(const Scene& scene, uint32_t transformID, Scene& cell, std::unordered_map<uint32_t, uint32_t>& transformIDs)
+{
+    auto found = transformIDs.find(transformID);
+    if (found != transformIDs.end()) {
+        return found->second;
+    }
+    const uint32_t cellID = cell.AddTransform(scene.transforms[transformID]);
+    transformIDs[transformID] = cellID;
+    const uint32_t parentID = scene.transformStore.GetParent(transformID);
+    if (parentID != TransformStore::NoParent && scene.transforms.contains(parentID)) {
+        cell.SetParent(cellID, copyTransform(scene, parentID, cell, transformIDs));
+    }
+    return cellID;
+}
+
+// Cell names relative to the index's directory
+static std::string fileName(const std::string& path)
+{
+    const size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+static std::string directory(const std::string& path)
+{
+    const size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+}
+
+bool CookWorld(Scene& scene, const std::string& path, float cellSize, bool compressGeometry)
+{
+    if (!(cellSize > 0.0f)) {
+        printf("CookWorld: cell size %f is not positive\n", cellSize);
+        return false;
+    }
+    scene.transformStore.Update();
+
+    // ordered, the index lists cells row by row
+    std::map<std::pair<int32_t, int32_t>, std::vector<uint32_t>> cellInstances;
+    for (uint32_t instanceID : scene.instances) {
+        const Instance& instance = scene.instances[instanceID];
+        if (!scene.meshes.contains(instance.meshId) || !scene.transforms.contains(instance.transformId)) {
+            continue;
+        }
+        const Aabb box = scene.meshes[instance.meshId].bounds.Transformed(scene.transformStore.GetWorld(instance.transformId));
+        const int32_t x = static_cast<int32_t>(floorf(box.Center(0) / cellSize));
+        const int32_t z = static_cast<int32_t>(floorf(box.Center(2) / cellSize));
+        cellInstances[std::make_pair(x, z)].push_back(instanceID);
+    }
+
+    std::vector<uint8_t> index(WorldMagic, WorldMagic + sizeof(WorldMagic));
+    auto append = [&index](const void* data, size_t bytes) {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        index.insert(index.end(), begin, begin + bytes);
+    };
+    const uint32_t cellCount = static_cast<uint32_t>(cellInstances.size());
+    append(&WorldVersion, sizeof(WorldVersion));
+    append(&cellSize, sizeof(cellSize));
+    append(&cellCount, sizeof(cellCount));
+
+    uint64_t totalBytes = 0;
+    for (const auto& entry : cellInstances) {
+        Scene cell;
+        cell.Init();
+        std::unordered_map<uint32_t, uint32_t> diffuseMapIDs, materialIDs, meshIDs, transformIDs;
+        Aabb bounds;
+        uint64_t bytes = 0;
+        for (uint32_t instanceID : entry.second) {
+            const Instance& instance = scene.instances[instanceID];
+            bounds.Expand(scene.meshes[instance.meshId].bounds.Transformed(scene.transformStore.GetWorld(instance.transformId)));
+
+            auto mesh = meshIDs.find(instance.meshId);
+            if (mesh == meshIDs.end()) {
+                Mesh copy = scene.meshes[instance.meshId];
+                for (auto& materialID : copy.materialIds) {
+                    if (!scene.materials.contains(materialID)) {
+                        continue;
+                    }
+                    auto material = materialIDs.find(materialID);
+                    if (material == materialIDs.end()) {
+                        Material materialCopy = scene.materials[materialID];
+                        if (scene.diffuseMaps.contains(materialCopy.diffuseMapId)) {
+                            auto diffuseMap = diffuseMapIDs.find(materialCopy.diffuseMapId);
+                            if (diffuseMap == diffuseMapIDs.end()) {
+                                DiffuseMap map;
+                                map.path = scene.diffuseMaps[materialCopy.diffuseMapId].path;
+                                diffuseMap = diffuseMapIDs.emplace(materialCopy.diffuseMapId, cell.diffuseMaps.insert(map)).first;
+                            }
+                            materialCopy.diffuseMapId = diffuseMap->second;
+                        }
+                        material = materialIDs.emplace(materialID, cell.materials.insert(materialCopy)).first;
+                    }
+                    materialID = material->second;
+                }
+                bytes += geometryBytes(copy);
+                mesh = meshIDs.emplace(instance.meshId, cell.meshes.insert(std::move(copy))).first;
+            }
+
+            Instance cellInstance;
+            cellInstance.meshId = mesh->second;
+            cellInstance.transformId = copyTransform(scene, instance.transformId, cell, transformIDs);
+            cell.instances.insert(cellInstance);
+        }
+
+        // the extension CookedPath replaces
+        const std::string cellPath = CookedPath(path + "_" + std::to_string(entry.first.first) + "_" + std::to_string(entry.first.second) + ".fbx");
+        if (!CookScene(cell, cellPath, compressGeometry)) {
+            printf("CookWorld: can not write %s\n", cellPath.c_str());
+            return false;
+        }
+        totalBytes += bytes;
+
+        const std::string name = fileName(cellPath);
+        const int32_t coordinates[2] = { entry.first.first, entry.first.second };
+        const uint32_t nameLength = static_cast<uint32_t>(name.size());
+        append(coordinates, sizeof(coordinates));
+        append(bounds.lower, sizeof(bounds.lower));
+        append(bounds.upper, sizeof(bounds.upper));
+        append(&bytes, sizeof(bytes));
+        append(&nameLength, sizeof(nameLength));
+        append(name.data(), name.size());
+    }
+
+    if (!file::writeBinary(path.c_str(), index.data(), index.size())) {
+        printf("CookWorld: can not write %s\n", path.c_str());
+        return false;
+    }
+    printf("CookWorld: %u cells of %.0f, %.1f MB of geometry, in %s\n", cellCount, cellSize, totalBytes / (1024.0 * 1024.0), path.c_str());
+    return true;
+}
+
+WorldStreamer::WorldStreamer(uint32_t threadCount)
+    : reader(new file::AsyncReader())
+    , threads(new ThreadPool(std::max(1u, threadCount), JobSystem::Priority::Background))
+    , viewer(0.0f, 0.0f, 0.0f)
+{
+}
+
+WorldStreamer::~WorldStreamer()
+{
+    // the reader hands its files to the workers, which write into decoded
+    reader->wait();
+    threads->Wait();
+}
+
+bool WorldStreamer::Open(const std::string& indexPath)
+{
+    for (const auto& cell : cells) {
+        if (cell.state != CellState::Unloaded) {
+            printf("WorldStreamer: cells of the world before %s are still resident\n", indexPath.c_str());
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> data;
+    if (!file::readBinary(indexPath.c_str(), data)) {
+        printf("WorldStreamer: can not read %s\n", indexPath.c_str());
+        return false;
+    }
+    size_t offset = 0;
+    auto read = [&data, &offset](void* value, size_t bytes) {
+        if (offset + bytes > data.size()) {
+            return false;
+        }
+        memcpy(value, data.data() + offset, bytes);
+        offset += bytes;
+        return true;
+    };
+    char magic[sizeof(WorldMagic)];
+    uint32_t version = 0, cellCount = 0;
+    float cellSize = 0.0f;
+    if (!read(magic, sizeof(magic)) || memcmp(magic, WorldMagic, sizeof(magic)) != 0 || !read(&version, sizeof(version))
+        || version != WorldVersion || !read(&cellSize, sizeof(cellSize)) || !read(&cellCount, sizeof(cellCount))) {
+        printf("WorldStreamer: %s is not a world index of this version, run fbxconv world again\n", indexPath.c_str());
+        return false;
+    }
+
+    std::vector<Cell> opened(cellCount);
+    for (auto& cell : opened) {
+        int32_t coordinates[2];
+        uint32_t nameLength = 0;
+        if (!read(coordinates, sizeof(coordinates)) || !read(cell.bounds.lower, sizeof(cell.bounds.lower))
+            || !read(cell.bounds.upper, sizeof(cell.bounds.upper)) || !read(&cell.bytes, sizeof(cell.bytes))
+            || !read(&nameLength, sizeof(nameLength)) || offset + nameLength > data.size()) {
+            printf("WorldStreamer: %s is truncated\n", indexPath.c_str());
+            return false;
+        }
+        cell.x = coordinates[0];
+        cell.z = coordinates[1];
+        cell.path = directory(indexPath) + std::string(reinterpret_cast<const char*>(data.data() + offset), nameLength);
+        offset += nameLength;
+    }
+    cells.swap(opened);
+    loadingBytes = 0;
+    residentBytes = 0;
+    stats = Stats();
+    return true;
+}
+
+void WorldStreamer::SetSettings(const Settings& newSettings)
+{
+    settings = newSettings;
+    settings.unloadRadius = std::max(settings.unloadRadius, settings.loadRadius);
+    settings.maxLoading = std::max(settings.maxLoading, 1u);
+    settings.maxMerges = std::max(settings.maxMerges, 1u);
+}
+
+void WorldStreamer::SetViewer(const m3d::math::Vector3& position)
+{
+    viewer = position;
+}
+
+float WorldStreamer::distance(const Cell& cell) const
+{
+    const float dx = std::max(std::max(cell.bounds.lower[0] - viewer.x, viewer.x - cell.bounds.upper[0]), 0.0f);
+    const float dz = std::max(std::max(cell.bounds.lower[2] - viewer.z, viewer.z - cell.bounds.upper[2]), 0.0f);
+    return sqrtf(dx * dx + dz * dz);
+}
+
+void WorldStreamer::load(uint32_t cellIndex)
+{
+    Cell& cell = cells[cellIndex];
+    cell.state = CellState::Loading;
+    loadingBytes += cell.bytes;
+    // the reader's thread only reads, decoding happens on the workers
+    const bool gpuGeometryDecode = settings.gpuGeometryDecode;
+    cell.request = reader->read(cell.path, [this, cellIndex, gpuGeometryDecode](std::shared_ptr<const file::MappedFile> file) {
+        threads->Enqueue([this, cellIndex, file, gpuGeometryDecode]() { decode(cellIndex, file, gpuGeometryDecode); });
+    });
+}
+
+void WorldStreamer::decode(uint32_t cellIndex, std::shared_ptr<const file::MappedFile> file, bool gpuGeometryDecode)
+{
+    // Scene::Init and LoadMeshes only touch the scene they are given, the cell's path does not change while it loads
+    Decoded result;
+    result.cell = cellIndex;
+    if (file) {
+        result.scene.reset(new Scene);
+        result.scene->gpuGeometryDecode = gpuGeometryDecode;
+        if (result.scene->Init(file, cells[cellIndex].path)) {
+            // cells decode side by side already
+            LoadMeshes(result.scene.get(), &result.meshIDs, 1);
+        } else {
+            result.scene.reset();
+        }
+    } else {
+        printf("WorldStreamer: can not read %s\n", cells[cellIndex].path.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    decoded.push_back(std::move(result));
+}
+
+void WorldStreamer::drop(uint32_t cellIndex)
+{
+    Cell& cell = cells[cellIndex];
+    if (cell.state == CellState::Loaded) {
+        ready.erase(std::find_if(ready.begin(), ready.end(), [cellIndex](const Decoded& result) { return result.cell == cellIndex; }));
+    } else if (!reader->cancel(cell.request)) {
+        return;
+    }
+    cell.state = CellState::Unloaded;
+    loadingBytes -= cell.bytes;
+    ++stats.cancelled;
+}
+
+void WorldStreamer::merge(Scene& scene, Decoded& result)
+{
+    Cell& cell = cells[result.cell];
+    cell.file = result.scene->cooked;
+    MergeScene(*result.scene, result.meshIDs, scene, TransformStore::NoParent, &cell.ids);
+    cell.state = CellState::Resident;
+    loadingBytes -= cell.bytes;
+    residentBytes += cell.bytes;
+    ++stats.loaded;
+}
+
+void WorldStreamer::unload(Scene& scene, uint32_t cellIndex, const ReleaseCallback& release)
+{
+    Cell& cell = cells[cellIndex];
+    if (release) {
+        release(cell.ids);
+    }
+    for (uint32_t instanceID : cell.ids.instances) {
+        if (scene.instances.contains(instanceID)) {
+            scene.instances.erase(instanceID);
+        }
+    }
+    for (uint32_t meshID : cell.ids.meshes) {
+        if (scene.meshes.contains(meshID)) {
+            scene.meshes.erase(meshID);
+        }
+    }
+    for (uint32_t materialID : cell.ids.materials) {
+        if (scene.materials.contains(materialID)) {
+            scene.materials.erase(materialID);
+        }
+    }
+    for (uint32_t diffuseMapID : cell.ids.diffuseMaps) {
+        if (scene.diffuseMaps.contains(diffuseMapID)) {
+            scene.diffuseMaps.erase(diffuseMapID);
+        }
+    }
+    // the cell's transforms only parent each other
+    for (uint32_t transformID : cell.ids.transforms) {
+        if (scene.transforms.contains(transformID)) {
+            scene.RemoveTransform(transformID);
+        }
+    }
+    auto mapped = std::find(scene.mappedModels.begin(), scene.mappedModels.end(), cell.file);
+    if (cell.file && mapped != scene.mappedModels.end()) {
+        scene.mappedModelPaths.erase(scene.mappedModelPaths.begin() + (mapped - scene.mappedModels.begin()));
+        scene.mappedModels.erase(mapped);
+    }
+
+    cell.ids = MergedIDs();
+    cell.file.reset();
+    cell.state = CellState::Unloaded;
+    residentBytes -= cell.bytes;
+    ++stats.unloaded;
+}
+
+bool WorldStreamer::Poll(Scene& scene, const ReleaseCallback& release)
+{
+    std::vector<Decoded> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(decoded);
+    }
+    for (auto& result : finished) {
+        Cell& cell = cells[result.cell];
+        if (!result.scene) {
+            cell.state = CellState::Unloaded;
+            loadingBytes -= cell.bytes;
+            ++stats.failed;
+            continue;
+        }
+        cell.state = CellState::Loaded;
+        ready.push_back(std::move(result));
+    }
+
+    bool changed = false;
+    for (uint32_t c = 0; c < cells.size(); ++c) {
+        if (cells[c].state == CellState::Unloaded || distance(cells[c]) <= settings.unloadRadius) {
+            continue;
+        }
+        if (cells[c].state == CellState::Resident) {
+            unload(scene, c, release);
+            changed = true;
+        } else {
+            drop(c);
+        }
+    }
+
+    std::vector<std::pair<float, uint32_t>> candidates;
+    uint32_t loading = 0;
+    for (uint32_t c = 0; c < cells.size(); ++c) {
+        if (cells[c].state == CellState::Loading) {
+            ++loading;
+        } else if (cells[c].state == CellState::Unloaded) {
+            const float cellDistance = distance(cells[c]);
+            if (cellDistance <= settings.loadRadius) {
+                candidates.push_back(std::make_pair(cellDistance, c));
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (const auto& candidate : candidates) {
+        if (loading >= settings.maxLoading) {
+            break;
+        }
+        const uint64_t bytes = cells[candidate.second].bytes;
+        // room by unloading what is farther than the cell, a cell over the whole budget still loads alone
+        while (residentBytes + loadingBytes > 0 && residentBytes + loadingBytes + bytes > settings.budgetBytes) {
+            uint32_t farthest = UINT32_MAX;
+            float farthestDistance = candidate.first;
+            for (uint32_t c = 0; c < cells.size(); ++c) {
+                if (cells[c].state == CellState::Resident && distance(cells[c]) > farthestDistance) {
+                    farthestDistance = distance(cells[c]);
+                    farthest = c;
+                }
+            }
+            if (farthest == UINT32_MAX) {
+                break;
+            }
+            unload(scene, farthest, release);
+            changed = true;
+        }
+        if (residentBytes + loadingBytes > 0 && residentBytes + loadingBytes + bytes > settings.budgetBytes) {
+            // the cells behind it are farther, they wait too
+            break;
+        }
+        load(candidate.second);
+        ++loading;
+    }
+
+    std::sort(ready.begin(), ready.end(),
+        [this](const Decoded& a, const Decoded& b) { return distance(cells[a.cell]) < distance(cells[b.cell]); });
+    const size_t merges = std::min<size_t>(ready.size(), settings.maxMerges);
+    for (size_t m = 0; m < merges; ++m) {
+        merge(scene, ready[m]);
+        changed = true;
+    }
+    ready.erase(ready.begin(), ready.begin() + merges);
+    return changed;
+}
+
+void WorldStreamer::Clear(Scene& scene, const ReleaseCallback& release)
+{
+    for (uint32_t c = 0; c < cells.size(); ++c) {
+        if (cells[c].state == CellState::Resident) {
+            unload(scene, c, release);
+        } else if (cells[c].state == CellState::Loading) {
+            reader->cancel(cells[c].request);
+        }
+    }
+    // reads that started finish, their cells are dropped with the rest
+    reader->wait();
+    threads->Wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        decoded.clear();
+    }
+    ready.clear();
+    for (auto& cell : cells) {
+        if (cell.state == CellState::Loading || cell.state == CellState::Loaded) {
+            cell.state = CellState::Unloaded;
+            ++stats.cancelled;
+        }
+    }
+    loadingBytes = 0;
+}
+
+bool WorldStreamer::Idle() const
+{
+    for (const auto& cell : cells) {
+        if (cell.state == CellState::Loading || cell.state == CellState::Loaded) {
+            return false;
+        }
+    }
+    return true;
+}
+
+WorldStreamer::Stats WorldStreamer::GetStats() const
+{
+    Stats current = stats;
+    current.cells = static_cast<uint32_t>(cells.size());
+    current.residentBytes = residentBytes;
+    for (const auto& cell : cells) {
+        current.resident += cell.state == CellState::Resident ? 1 : 0;
+        current.loading += cell.state == CellState::Loading || cell.state == CellState::Loaded ? 1 : 0;
+    }
+    return current;
+}
+} // End of namespace m3d
@@ -62,14 +62,14 @@ namespace vkx {
             return false;
         }
 
-        void setupDebugging(vk::Instance instance, vk::DebugReportFlagsEXT flags) {
+        void setupDebugging(vk::Instance instance, vk::DebugReportFlagsEXT flags, PFN_vkDebugReportCallbackEXT callBack) {
             CreateDebugReportCallback = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(VkInstance(instance), "vkCreateDebugReportCallbackEXT");
             DestroyDebugReportCallback = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(VkInstance(instance), "vkDestroyDebugReportCallbackEXT");
             dbgBreakCallback = (PFN_vkDebugReportMessageEXT)vkGetInstanceProcAddr(VkInstance(instance), "vkDebugReportMessageEXT");
 
             VkDebugReportCallbackCreateInfoEXT dbgCreateInfo = {};
             dbgCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CREATE_INFO_EXT;
-            dbgCreateInfo.pfnCallback = (PFN_vkDebugReportCallbackEXT)messageCallback;
+            dbgCreateInfo.pfnCallback = callBack ? callBack : (PFN_vkDebugReportCallbackEXT)messageCallback;
             dbgCreateInfo.flags = flags.operator VkSubpassDescriptionFlags();
 
             VkResult err = CreateDebugReportCallback(
@@ -141,7 +141,7 @@ namespace vkx {
                 }
             }
 
-            void insert(VkCommandBuffer cmdbuffer, std::string markerName, std::array<float, 4> color) {
+            void insert(VkCommandBuffer cmdbuffer, const std::string& markerName, const std::array<float, 4>& color) {
                 // Check for valid function pointer (may not be present if not running in a debugging application)
                 if (pfnCmdDebugMarkerInsert) {
                     VkDebugMarkerMarkerInfoEXT markerInfo = {};
@@ -7,8 +7,13 @@
 //
 
 #include "vulkanShaders.h"
+#include "File.hpp"
+#include "ThreadPool.hpp"
 #include <GlslangToSpv.h>
 
+#include <cstdio>
+#include <thread>
+
 using namespace vkx;
 using namespace vkx::shader;
 
@@ -131,27 +136,44 @@ void shader::finalizeGlsl() {
 // Compile a given string containing GLSL into SPV for use by VK
 //
 std::vector<uint32_t> shader::glslToSpv(const vk::ShaderStageFlagBits shaderType, const std::string& shaderSource) {
+    return glslToSpv(shaderType, shaderSource, std::vector<std::string>());
+}
+
+std::vector<uint32_t> shader::glslToSpv(const vk::ShaderStageFlagBits shaderType, const std::string& shaderSource, const std::vector<std::string>& defines) {
     std::vector<uint32_t> result;
     TBuiltInResource Resources;
     init_resources(Resources);
 
+    std::string preamble;
+    for (const auto& define : defines) {
+        // NAME=VALUE, the value may hold '=' itself
+        std::string line = define;
+        std::string::size_type equals = line.find('=');
+        if (equals != std::string::npos) {
+            line[equals] = ' ';
+        }
+        preamble += "#define " + line + "\n";
+    }
+
     // Enable SPIR-V and Vulkan rules when parsing GLSL
     EShMessages messages = (EShMessages)(EShMsgSpvRules | EShMsgVulkanRules);
     EShLanguage stage = FindLanguage(shaderType);
-    glslang::TShader *shader = new glslang::TShader(stage);
+    // the program references the shader, it has to go first
+    glslang::TShader shader(stage);
+    glslang::TProgram program;
     {
         const char *shaderStrings[1] = { shaderSource.c_str() };
-        shader->setStrings(shaderStrings, 1);
-        if (!shader->parse(&Resources, 100, false, messages)) {
-            auto log = shader->getInfoLog();
+        shader.setStrings(shaderStrings, 1);
+        shader.setPreamble(preamble.c_str());
+        if (!shader.parse(&Resources, 100, false, messages)) {
+            auto log = shader.getInfoLog();
             throw new std::runtime_error(log);
         }
     }
 
-    glslang::TProgram &program = *new glslang::TProgram;
-    program.addShader(shader);
+    program.addShader(&shader);
     if (!program.link(messages)) {
-        throw new std::runtime_error(shader->getInfoLog());
+        throw new std::runtime_error(shader.getInfoLog());
     }
     glslang::GlslangToSpv(*program.getIntermediate(stage), result);
     return result;
@@ -166,5 +188,125 @@ vk::ShaderModule shader::glslToShaderModule(const vk::Device& device, const vk::
     return device.createShaderModule(moduleCreateInfo);
 }
 
+shader::SpvCode::SpvCode(SpvBuffer&& compiled) : owned(std::move(compiled)) {
+    words = owned.data();
+    wordCount = owned.size();
+}
+
+shader::SpvCodePtr shader::SpvCode::map(const std::string& path) {
+    auto file = m3d::file::MappedFile::open(path.c_str());
+    // SPIR-V magic number, anything else is a truncated or foreign file
+    if (!file || file->size() % sizeof(uint32_t) || *reinterpret_cast<const uint32_t*>(file->data()) != 0x07230203) {
+        return nullptr;
+    }
+    std::shared_ptr<SpvCode> code(new SpvCode());
+    code->file = file;
+    code->words = reinterpret_cast<const uint32_t*>(file->data());
+    code->wordCount = file->size() / sizeof(uint32_t);
+    return code;
+}
+
+// Bump when the compiler options change, old cache files are simply never hit again
+static const uint32_t SpvCacheVersion = 1;
 
+shader::SpvCache::SpvCache(const std::string& directory, uint32_t threadCount) : directory(directory) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    compileThreads.reset(new m3d::ThreadPool(threadCount, m3d::JobSystem::Priority::Background));
+}
+
+shader::SpvCache::~SpvCache() {
+}
+
+// FNV-1a
+static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+uint64_t shader::SpvCache::key(const SpvRequest& request) {
+    uint64_t hash = 14695981039346656037ull;
+    hashBytes(hash, &SpvCacheVersion, sizeof(SpvCacheVersion));
+    VkShaderStageFlagBits stage = static_cast<VkShaderStageFlagBits>(request.stage);
+    hashBytes(hash, &stage, sizeof(stage));
+    for (const auto& define : request.defines) {
+        // include the terminator so {"AB"} and {"A", "B"} differ
+        hashBytes(hash, define.c_str(), define.size() + 1);
+    }
+    uint64_t sourceSize = request.source.size();
+    hashBytes(hash, &sourceSize, sizeof(sourceSize));
+    hashBytes(hash, request.source.data(), request.source.size());
+    return hash;
+}
 
+std::string shader::SpvCache::path(const SpvRequest& request) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key(request)));
+    return directory + "/" + name;
+}
+
+shader::SpvCodePtr shader::SpvCache::compile(const SpvRequest& request) {
+    SpvCodePtr code = std::make_shared<SpvCode>(glslToSpv(request.stage, request.source, request.defines));
+
+    // write to a private name first so concurrent writers never expose a partial file
+    std::string target = path(request);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%zx.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::string temp = target + suffix;
+    std::FILE* fp = std::fopen(temp.c_str(), "wb");
+    if (fp) {
+        size_t written = std::fwrite(code->data(), sizeof(uint32_t), code->size(), fp);
+        std::fclose(fp);
+        // rename fails when another compile of the same key got there first, the content is identical
+        if (written != code->size() || std::rename(temp.c_str(), target.c_str()) != 0) {
+            std::remove(temp.c_str());
+        }
+    }
+    return code;
+}
+
+shader::SpvCodePtr shader::SpvCache::load(const SpvRequest& request) {
+    if (SpvCodePtr code = SpvCode::map(path(request))) {
+        return code;
+    }
+    return compile(request);
+}
+
+std::vector<shader::SpvCodePtr> shader::SpvCache::load(const std::vector<SpvRequest>& requests) {
+    std::vector<SpvCodePtr> result(requests.size());
+    bool missed = false;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        result[i] = SpvCode::map(path(requests[i]));
+        if (result[i]) {
+            continue;
+        }
+        missed = true;
+        compileThreads->Enqueue([this, &requests, &result, i]() {
+            // glslang keeps per thread state, InitializeProcess sets it up for pool threads
+            glslang::InitializeProcess();
+            try {
+                result[i] = compile(requests[i]);
+            } catch (std::runtime_error* error) {
+                printf("SpvCache: %s\n", error->what());
+                delete error;
+            }
+        });
+    }
+    if (missed) {
+        compileThreads->Wait();
+    }
+    return result;
+}
+
+vk::ShaderModule shader::SpvCache::loadModule(const vk::Device& device, const SpvRequest& request) {
+    SpvCodePtr spv = load(request);
+    vk::ShaderModuleCreateInfo moduleCreateInfo;
+    moduleCreateInfo
+        .setCodeSize(spv->size() * sizeof(uint32_t))
+        .setPCode(spv->data());
+    return device.createShaderModule(moduleCreateInfo);
+}
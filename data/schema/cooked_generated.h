@@ -0,0 +1,757 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_COOKED_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_COOKED_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "scene_generated.h"
+
+namespace m3d {
+namespace schema {
+
+struct SPackedVertex;
+
+struct SSlice;
+
+struct SSphere;
+
+struct SAabb;
+
+struct SMeshlet;
+
+struct SCodecChunk;
+
+struct SMorphDelta;
+
+struct SQuaternion;
+
+struct SCookedTransform;
+
+struct SCookedInstance;
+
+struct SRotationKey;
+
+struct SVectorKey;
+
+struct SScalarKey;
+
+struct SAnimationTrack;
+
+struct SCookedMesh;
+
+struct SCookedMaterial;
+
+struct SCookedClip;
+
+struct SCookedScene;
+
+MANUALLY_ALIGNED_STRUCT(4) SPackedVertex FLATBUFFERS_FINAL_CLASS {
+ private:
+  float px_;
+  float py_;
+  float pz_;
+  int16_t nx_;
+  int16_t ny_;
+  uint16_t u_;
+  uint16_t v_;
+
+ public:
+  SPackedVertex() { memset(this, 0, sizeof(SPackedVertex)); }
+  SPackedVertex(const SPackedVertex &_o) { memcpy(this, &_o, sizeof(SPackedVertex)); }
+  SPackedVertex(float _px, float _py, float _pz, int16_t _nx, int16_t _ny, uint16_t _u, uint16_t _v)
+    : px_(flatbuffers::EndianScalar(_px)), py_(flatbuffers::EndianScalar(_py)), pz_(flatbuffers::EndianScalar(_pz)), nx_(flatbuffers::EndianScalar(_nx)), ny_(flatbuffers::EndianScalar(_ny)), u_(flatbuffers::EndianScalar(_u)), v_(flatbuffers::EndianScalar(_v)) { }
+
+  float px() const { return flatbuffers::EndianScalar(px_); }
+  float py() const { return flatbuffers::EndianScalar(py_); }
+  float pz() const { return flatbuffers::EndianScalar(pz_); }
+  int16_t nx() const { return flatbuffers::EndianScalar(nx_); }
+  int16_t ny() const { return flatbuffers::EndianScalar(ny_); }
+  uint16_t u() const { return flatbuffers::EndianScalar(u_); }
+  uint16_t v() const { return flatbuffers::EndianScalar(v_); }
+};
+STRUCT_END(SPackedVertex, 20);
+
+MANUALLY_ALIGNED_STRUCT(4) SSlice FLATBUFFERS_FINAL_CLASS {
+ private:
+  int32_t indexOffset_;
+  int32_t triangleCount_;
+
+ public:
+  SSlice() { memset(this, 0, sizeof(SSlice)); }
+  SSlice(const SSlice &_o) { memcpy(this, &_o, sizeof(SSlice)); }
+  SSlice(int32_t _indexOffset, int32_t _triangleCount)
+    : indexOffset_(flatbuffers::EndianScalar(_indexOffset)), triangleCount_(flatbuffers::EndianScalar(_triangleCount)) { }
+
+  int32_t indexOffset() const { return flatbuffers::EndianScalar(indexOffset_); }
+  int32_t triangleCount() const { return flatbuffers::EndianScalar(triangleCount_); }
+};
+STRUCT_END(SSlice, 8);
+
+MANUALLY_ALIGNED_STRUCT(4) SSphere FLATBUFFERS_FINAL_CLASS {
+ private:
+  float x_;
+  float y_;
+  float z_;
+  float radius_;
+
+ public:
+  SSphere() { memset(this, 0, sizeof(SSphere)); }
+  SSphere(const SSphere &_o) { memcpy(this, &_o, sizeof(SSphere)); }
+  SSphere(float _x, float _y, float _z, float _radius)
+    : x_(flatbuffers::EndianScalar(_x)), y_(flatbuffers::EndianScalar(_y)), z_(flatbuffers::EndianScalar(_z)), radius_(flatbuffers::EndianScalar(_radius)) { }
+
+  float x() const { return flatbuffers::EndianScalar(x_); }
+  float y() const { return flatbuffers::EndianScalar(y_); }
+  float z() const { return flatbuffers::EndianScalar(z_); }
+  float radius() const { return flatbuffers::EndianScalar(radius_); }
+};
+STRUCT_END(SSphere, 16);
+
+MANUALLY_ALIGNED_STRUCT(4) SAabb FLATBUFFERS_FINAL_CLASS {
+ private:
+  SVector3 lower_;
+  SVector3 upper_;
+
+ public:
+  SAabb() { memset(this, 0, sizeof(SAabb)); }
+  SAabb(const SAabb &_o) { memcpy(this, &_o, sizeof(SAabb)); }
+  SAabb(const SVector3 &_lower, const SVector3 &_upper)
+    : lower_(_lower), upper_(_upper) { }
+
+  const SVector3 &lower() const { return lower_; }
+  const SVector3 &upper() const { return upper_; }
+};
+STRUCT_END(SAabb, 24);
+
+MANUALLY_ALIGNED_STRUCT(4) SMeshlet FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t slice_;
+  int32_t indexOffset_;
+  int32_t triangleCount_;
+  float coneCutoff_;
+  SSphere sphere_;
+  SVector3 coneAxis_;
+
+ public:
+  SMeshlet() { memset(this, 0, sizeof(SMeshlet)); }
+  SMeshlet(const SMeshlet &_o) { memcpy(this, &_o, sizeof(SMeshlet)); }
+  SMeshlet(uint32_t _slice, int32_t _indexOffset, int32_t _triangleCount, float _coneCutoff, const SSphere &_sphere, const SVector3 &_coneAxis)
+    : slice_(flatbuffers::EndianScalar(_slice)), indexOffset_(flatbuffers::EndianScalar(_indexOffset)), triangleCount_(flatbuffers::EndianScalar(_triangleCount)), coneCutoff_(flatbuffers::EndianScalar(_coneCutoff)), sphere_(_sphere), coneAxis_(_coneAxis) { }
+
+  uint32_t slice() const { return flatbuffers::EndianScalar(slice_); }
+  int32_t indexOffset() const { return flatbuffers::EndianScalar(indexOffset_); }
+  int32_t triangleCount() const { return flatbuffers::EndianScalar(triangleCount_); }
+  float coneCutoff() const { return flatbuffers::EndianScalar(coneCutoff_); }
+  const SSphere &sphere() const { return sphere_; }
+  const SVector3 &coneAxis() const { return coneAxis_; }
+};
+STRUCT_END(SMeshlet, 44);
+
+MANUALLY_ALIGNED_STRUCT(4) SCodecChunk FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t offset_;
+  uint32_t size_;
+  uint32_t first_;
+  uint32_t count_;
+
+ public:
+  SCodecChunk() { memset(this, 0, sizeof(SCodecChunk)); }
+  SCodecChunk(const SCodecChunk &_o) { memcpy(this, &_o, sizeof(SCodecChunk)); }
+  SCodecChunk(uint32_t _offset, uint32_t _size, uint32_t _first, uint32_t _count)
+    : offset_(flatbuffers::EndianScalar(_offset)), size_(flatbuffers::EndianScalar(_size)), first_(flatbuffers::EndianScalar(_first)), count_(flatbuffers::EndianScalar(_count)) { }
+
+  uint32_t offset() const { return flatbuffers::EndianScalar(offset_); }
+  uint32_t size() const { return flatbuffers::EndianScalar(size_); }
+  uint32_t first() const { return flatbuffers::EndianScalar(first_); }
+  uint32_t count() const { return flatbuffers::EndianScalar(count_); }
+};
+STRUCT_END(SCodecChunk, 16);
+
+MANUALLY_ALIGNED_STRUCT(4) SMorphDelta FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t vertex_;
+  SVector3 position_;
+  SVector3 normal_;
+
+ public:
+  SMorphDelta() { memset(this, 0, sizeof(SMorphDelta)); }
+  SMorphDelta(const SMorphDelta &_o) { memcpy(this, &_o, sizeof(SMorphDelta)); }
+  SMorphDelta(uint32_t _vertex, const SVector3 &_position, const SVector3 &_normal)
+    : vertex_(flatbuffers::EndianScalar(_vertex)), position_(_position), normal_(_normal) { }
+
+  uint32_t vertex() const { return flatbuffers::EndianScalar(vertex_); }
+  const SVector3 &position() const { return position_; }
+  const SVector3 &normal() const { return normal_; }
+};
+STRUCT_END(SMorphDelta, 28);
+
+MANUALLY_ALIGNED_STRUCT(4) SQuaternion FLATBUFFERS_FINAL_CLASS {
+ private:
+  float x_;
+  float y_;
+  float z_;
+  float w_;
+
+ public:
+  SQuaternion() { memset(this, 0, sizeof(SQuaternion)); }
+  SQuaternion(const SQuaternion &_o) { memcpy(this, &_o, sizeof(SQuaternion)); }
+  SQuaternion(float _x, float _y, float _z, float _w)
+    : x_(flatbuffers::EndianScalar(_x)), y_(flatbuffers::EndianScalar(_y)), z_(flatbuffers::EndianScalar(_z)), w_(flatbuffers::EndianScalar(_w)) { }
+
+  float x() const { return flatbuffers::EndianScalar(x_); }
+  float y() const { return flatbuffers::EndianScalar(y_); }
+  float z() const { return flatbuffers::EndianScalar(z_); }
+  float w() const { return flatbuffers::EndianScalar(w_); }
+};
+STRUCT_END(SQuaternion, 16);
+
+MANUALLY_ALIGNED_STRUCT(4) SCookedTransform FLATBUFFERS_FINAL_CLASS {
+ private:
+  SVector3 position_;
+  SQuaternion rotation_;
+  SVector3 scale_;
+
+ public:
+  SCookedTransform() { memset(this, 0, sizeof(SCookedTransform)); }
+  SCookedTransform(const SCookedTransform &_o) { memcpy(this, &_o, sizeof(SCookedTransform)); }
+  SCookedTransform(const SVector3 &_position, const SQuaternion &_rotation, const SVector3 &_scale)
+    : position_(_position), rotation_(_rotation), scale_(_scale) { }
+
+  const SVector3 &position() const { return position_; }
+  const SQuaternion &rotation() const { return rotation_; }
+  const SVector3 &scale() const { return scale_; }
+};
+STRUCT_END(SCookedTransform, 40);
+
+MANUALLY_ALIGNED_STRUCT(4) SCookedInstance FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t mesh_;
+  uint32_t transform_;
+
+ public:
+  SCookedInstance() { memset(this, 0, sizeof(SCookedInstance)); }
+  SCookedInstance(const SCookedInstance &_o) { memcpy(this, &_o, sizeof(SCookedInstance)); }
+  SCookedInstance(uint32_t _mesh, uint32_t _transform)
+    : mesh_(flatbuffers::EndianScalar(_mesh)), transform_(flatbuffers::EndianScalar(_transform)) { }
+
+  uint32_t mesh() const { return flatbuffers::EndianScalar(mesh_); }
+  uint32_t transform() const { return flatbuffers::EndianScalar(transform_); }
+};
+STRUCT_END(SCookedInstance, 8);
+
+MANUALLY_ALIGNED_STRUCT(2) SRotationKey FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint16_t frame_;
+  uint16_t a_;
+  uint16_t b_;
+  uint16_t c_;
+
+ public:
+  SRotationKey() { memset(this, 0, sizeof(SRotationKey)); }
+  SRotationKey(const SRotationKey &_o) { memcpy(this, &_o, sizeof(SRotationKey)); }
+  SRotationKey(uint16_t _frame, uint16_t _a, uint16_t _b, uint16_t _c)
+    : frame_(flatbuffers::EndianScalar(_frame)), a_(flatbuffers::EndianScalar(_a)), b_(flatbuffers::EndianScalar(_b)), c_(flatbuffers::EndianScalar(_c)) { }
+
+  uint16_t frame() const { return flatbuffers::EndianScalar(frame_); }
+  uint16_t a() const { return flatbuffers::EndianScalar(a_); }
+  uint16_t b() const { return flatbuffers::EndianScalar(b_); }
+  uint16_t c() const { return flatbuffers::EndianScalar(c_); }
+};
+STRUCT_END(SRotationKey, 8);
+
+MANUALLY_ALIGNED_STRUCT(2) SVectorKey FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint16_t frame_;
+  uint16_t x_;
+  uint16_t y_;
+  uint16_t z_;
+
+ public:
+  SVectorKey() { memset(this, 0, sizeof(SVectorKey)); }
+  SVectorKey(const SVectorKey &_o) { memcpy(this, &_o, sizeof(SVectorKey)); }
+  SVectorKey(uint16_t _frame, uint16_t _x, uint16_t _y, uint16_t _z)
+    : frame_(flatbuffers::EndianScalar(_frame)), x_(flatbuffers::EndianScalar(_x)), y_(flatbuffers::EndianScalar(_y)), z_(flatbuffers::EndianScalar(_z)) { }
+
+  uint16_t frame() const { return flatbuffers::EndianScalar(frame_); }
+  uint16_t x() const { return flatbuffers::EndianScalar(x_); }
+  uint16_t y() const { return flatbuffers::EndianScalar(y_); }
+  uint16_t z() const { return flatbuffers::EndianScalar(z_); }
+};
+STRUCT_END(SVectorKey, 8);
+
+MANUALLY_ALIGNED_STRUCT(2) SScalarKey FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint16_t frame_;
+  uint16_t value_;
+
+ public:
+  SScalarKey() { memset(this, 0, sizeof(SScalarKey)); }
+  SScalarKey(const SScalarKey &_o) { memcpy(this, &_o, sizeof(SScalarKey)); }
+  SScalarKey(uint16_t _frame, uint16_t _value)
+    : frame_(flatbuffers::EndianScalar(_frame)), value_(flatbuffers::EndianScalar(_value)) { }
+
+  uint16_t frame() const { return flatbuffers::EndianScalar(frame_); }
+  uint16_t value() const { return flatbuffers::EndianScalar(value_); }
+};
+STRUCT_END(SScalarKey, 4);
+
+MANUALLY_ALIGNED_STRUCT(4) SAnimationTrack FLATBUFFERS_FINAL_CLASS {
+ private:
+  SVector3 translationMin_;
+  SVector3 translationExtent_;
+  float scaleMin_;
+  float scaleExtent_;
+  uint32_t rotationFirst_;
+  uint32_t rotationCount_;
+  uint32_t translationFirst_;
+  uint32_t translationCount_;
+  uint32_t scaleFirst_;
+  uint32_t scaleCount_;
+
+ public:
+  SAnimationTrack() { memset(this, 0, sizeof(SAnimationTrack)); }
+  SAnimationTrack(const SAnimationTrack &_o) { memcpy(this, &_o, sizeof(SAnimationTrack)); }
+  SAnimationTrack(const SVector3 &_translationMin, const SVector3 &_translationExtent, float _scaleMin, float _scaleExtent, uint32_t _rotationFirst, uint32_t _rotationCount, uint32_t _translationFirst, uint32_t _translationCount, uint32_t _scaleFirst, uint32_t _scaleCount)
+    : translationMin_(_translationMin), translationExtent_(_translationExtent), scaleMin_(flatbuffers::EndianScalar(_scaleMin)), scaleExtent_(flatbuffers::EndianScalar(_scaleExtent)), rotationFirst_(flatbuffers::EndianScalar(_rotationFirst)), rotationCount_(flatbuffers::EndianScalar(_rotationCount)), translationFirst_(flatbuffers::EndianScalar(_translationFirst)), translationCount_(flatbuffers::EndianScalar(_translationCount)), scaleFirst_(flatbuffers::EndianScalar(_scaleFirst)), scaleCount_(flatbuffers::EndianScalar(_scaleCount)) { }
+
+  const SVector3 &translationMin() const { return translationMin_; }
+  const SVector3 &translationExtent() const { return translationExtent_; }
+  float scaleMin() const { return flatbuffers::EndianScalar(scaleMin_); }
+  float scaleExtent() const { return flatbuffers::EndianScalar(scaleExtent_); }
+  uint32_t rotationFirst() const { return flatbuffers::EndianScalar(rotationFirst_); }
+  uint32_t rotationCount() const { return flatbuffers::EndianScalar(rotationCount_); }
+  uint32_t translationFirst() const { return flatbuffers::EndianScalar(translationFirst_); }
+  uint32_t translationCount() const { return flatbuffers::EndianScalar(translationCount_); }
+  uint32_t scaleFirst() const { return flatbuffers::EndianScalar(scaleFirst_); }
+  uint32_t scaleCount() const { return flatbuffers::EndianScalar(scaleCount_); }
+};
+STRUCT_END(SAnimationTrack, 56);
+
+struct SCookedMesh FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_VERTICES = 6,
+    VT_INDICES = 8,
+    VT_SLICES = 10,
+    VT_MATERIALIDS = 12,
+    VT_BOUNDS = 14,
+    VT_AABB = 16,
+    VT_SLICEBOUNDS = 18,
+    VT_LODSLICES = 20,
+    VT_LODERRORS = 22,
+    VT_SHORTINDICES = 24,
+    VT_MESHLETS = 26,
+    VT_ENCODEDVERTICES = 28,
+    VT_VERTEXCHUNKS = 30,
+    VT_ENCODEDINDICES = 32,
+    VT_INDEXCHUNKS = 34,
+    VT_MORPHNAMES = 36,
+    VT_MORPHDELTACOUNTS = 38,
+    VT_MORPHDELTAS = 40
+  };
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  const flatbuffers::Vector<const SPackedVertex *> *vertices() const { return GetPointer<const flatbuffers::Vector<const SPackedVertex *> *>(VT_VERTICES); }
+  const flatbuffers::Vector<uint32_t> *indices() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_INDICES); }
+  const flatbuffers::Vector<const SSlice *> *slices() const { return GetPointer<const flatbuffers::Vector<const SSlice *> *>(VT_SLICES); }
+  const flatbuffers::Vector<uint32_t> *materialIds() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_MATERIALIDS); }
+  const SSphere *bounds() const { return GetStruct<const SSphere *>(VT_BOUNDS); }
+  const SAabb *aabb() const { return GetStruct<const SAabb *>(VT_AABB); }
+  const flatbuffers::Vector<const SAabb *> *sliceBounds() const { return GetPointer<const flatbuffers::Vector<const SAabb *> *>(VT_SLICEBOUNDS); }
+  const flatbuffers::Vector<const SSlice *> *lodSlices() const { return GetPointer<const flatbuffers::Vector<const SSlice *> *>(VT_LODSLICES); }
+  const flatbuffers::Vector<float> *lodErrors() const { return GetPointer<const flatbuffers::Vector<float> *>(VT_LODERRORS); }
+  const flatbuffers::Vector<uint16_t> *shortIndices() const { return GetPointer<const flatbuffers::Vector<uint16_t> *>(VT_SHORTINDICES); }
+  const flatbuffers::Vector<const SMeshlet *> *meshlets() const { return GetPointer<const flatbuffers::Vector<const SMeshlet *> *>(VT_MESHLETS); }
+  const flatbuffers::Vector<uint8_t> *encodedVertices() const { return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_ENCODEDVERTICES); }
+  const flatbuffers::Vector<const SCodecChunk *> *vertexChunks() const { return GetPointer<const flatbuffers::Vector<const SCodecChunk *> *>(VT_VERTEXCHUNKS); }
+  const flatbuffers::Vector<uint8_t> *encodedIndices() const { return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_ENCODEDINDICES); }
+  const flatbuffers::Vector<const SCodecChunk *> *indexChunks() const { return GetPointer<const flatbuffers::Vector<const SCodecChunk *> *>(VT_INDEXCHUNKS); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *morphNames() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_MORPHNAMES); }
+  const flatbuffers::Vector<uint32_t> *morphDeltaCounts() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_MORPHDELTACOUNTS); }
+  const flatbuffers::Vector<const SMorphDelta *> *morphDeltas() const { return GetPointer<const flatbuffers::Vector<const SMorphDelta *> *>(VT_MORPHDELTAS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_VERTICES) &&
+           verifier.Verify(vertices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_INDICES) &&
+           verifier.Verify(indices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SLICES) &&
+           verifier.Verify(slices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MATERIALIDS) &&
+           verifier.Verify(materialIds()) &&
+           VerifyField<SSphere>(verifier, VT_BOUNDS) &&
+           VerifyField<SAabb>(verifier, VT_AABB) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SLICEBOUNDS) &&
+           verifier.Verify(sliceBounds()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_LODSLICES) &&
+           verifier.Verify(lodSlices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_LODERRORS) &&
+           verifier.Verify(lodErrors()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SHORTINDICES) &&
+           verifier.Verify(shortIndices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MESHLETS) &&
+           verifier.Verify(meshlets()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ENCODEDVERTICES) &&
+           verifier.Verify(encodedVertices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_VERTEXCHUNKS) &&
+           verifier.Verify(vertexChunks()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ENCODEDINDICES) &&
+           verifier.Verify(encodedIndices()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_INDEXCHUNKS) &&
+           verifier.Verify(indexChunks()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MORPHNAMES) &&
+           verifier.Verify(morphNames()) &&
+           verifier.VerifyVectorOfStrings(morphNames()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MORPHDELTACOUNTS) &&
+           verifier.Verify(morphDeltaCounts()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MORPHDELTAS) &&
+           verifier.Verify(morphDeltas()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SCookedMeshBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(SCookedMesh::VT_NAME, name); }
+  void add_vertices(flatbuffers::Offset<flatbuffers::Vector<const SPackedVertex *>> vertices) { fbb_.AddOffset(SCookedMesh::VT_VERTICES, vertices); }
+  void add_indices(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> indices) { fbb_.AddOffset(SCookedMesh::VT_INDICES, indices); }
+  void add_slices(flatbuffers::Offset<flatbuffers::Vector<const SSlice *>> slices) { fbb_.AddOffset(SCookedMesh::VT_SLICES, slices); }
+  void add_materialIds(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> materialIds) { fbb_.AddOffset(SCookedMesh::VT_MATERIALIDS, materialIds); }
+  void add_bounds(const SSphere *bounds) { fbb_.AddStruct(SCookedMesh::VT_BOUNDS, bounds); }
+  void add_aabb(const SAabb *aabb) { fbb_.AddStruct(SCookedMesh::VT_AABB, aabb); }
+  void add_sliceBounds(flatbuffers::Offset<flatbuffers::Vector<const SAabb *>> sliceBounds) { fbb_.AddOffset(SCookedMesh::VT_SLICEBOUNDS, sliceBounds); }
+  void add_lodSlices(flatbuffers::Offset<flatbuffers::Vector<const SSlice *>> lodSlices) { fbb_.AddOffset(SCookedMesh::VT_LODSLICES, lodSlices); }
+  void add_lodErrors(flatbuffers::Offset<flatbuffers::Vector<float>> lodErrors) { fbb_.AddOffset(SCookedMesh::VT_LODERRORS, lodErrors); }
+  void add_shortIndices(flatbuffers::Offset<flatbuffers::Vector<uint16_t>> shortIndices) { fbb_.AddOffset(SCookedMesh::VT_SHORTINDICES, shortIndices); }
+  void add_meshlets(flatbuffers::Offset<flatbuffers::Vector<const SMeshlet *>> meshlets) { fbb_.AddOffset(SCookedMesh::VT_MESHLETS, meshlets); }
+  void add_encodedVertices(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encodedVertices) { fbb_.AddOffset(SCookedMesh::VT_ENCODEDVERTICES, encodedVertices); }
+  void add_vertexChunks(flatbuffers::Offset<flatbuffers::Vector<const SCodecChunk *>> vertexChunks) { fbb_.AddOffset(SCookedMesh::VT_VERTEXCHUNKS, vertexChunks); }
+  void add_encodedIndices(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encodedIndices) { fbb_.AddOffset(SCookedMesh::VT_ENCODEDINDICES, encodedIndices); }
+  void add_indexChunks(flatbuffers::Offset<flatbuffers::Vector<const SCodecChunk *>> indexChunks) { fbb_.AddOffset(SCookedMesh::VT_INDEXCHUNKS, indexChunks); }
+  void add_morphNames(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> morphNames) { fbb_.AddOffset(SCookedMesh::VT_MORPHNAMES, morphNames); }
+  void add_morphDeltaCounts(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> morphDeltaCounts) { fbb_.AddOffset(SCookedMesh::VT_MORPHDELTACOUNTS, morphDeltaCounts); }
+  void add_morphDeltas(flatbuffers::Offset<flatbuffers::Vector<const SMorphDelta *>> morphDeltas) { fbb_.AddOffset(SCookedMesh::VT_MORPHDELTAS, morphDeltas); }
+  SCookedMeshBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SCookedMeshBuilder &operator=(const SCookedMeshBuilder &);
+  flatbuffers::Offset<SCookedMesh> Finish() {
+    auto o = flatbuffers::Offset<SCookedMesh>(fbb_.EndTable(start_, 19));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SCookedMesh> CreateSCookedMesh(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SPackedVertex *>> vertices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> indices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SSlice *>> slices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> materialIds = 0,
+    const SSphere *bounds = 0,
+    const SAabb *aabb = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SAabb *>> sliceBounds = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SSlice *>> lodSlices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<float>> lodErrors = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint16_t>> shortIndices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SMeshlet *>> meshlets = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encodedVertices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCodecChunk *>> vertexChunks = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> encodedIndices = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCodecChunk *>> indexChunks = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> morphNames = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> morphDeltaCounts = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SMorphDelta *>> morphDeltas = 0) {
+  SCookedMeshBuilder builder_(_fbb);
+  builder_.add_morphDeltas(morphDeltas);
+  builder_.add_morphDeltaCounts(morphDeltaCounts);
+  builder_.add_morphNames(morphNames);
+  builder_.add_indexChunks(indexChunks);
+  builder_.add_encodedIndices(encodedIndices);
+  builder_.add_vertexChunks(vertexChunks);
+  builder_.add_encodedVertices(encodedVertices);
+  builder_.add_meshlets(meshlets);
+  builder_.add_shortIndices(shortIndices);
+  builder_.add_lodErrors(lodErrors);
+  builder_.add_lodSlices(lodSlices);
+  builder_.add_sliceBounds(sliceBounds);
+  builder_.add_aabb(aabb);
+  builder_.add_bounds(bounds);
+  builder_.add_materialIds(materialIds);
+  builder_.add_slices(slices);
+  builder_.add_indices(indices);
+  builder_.add_vertices(vertices);
+  builder_.add_name(name);
+  return builder_.Finish();
+}
+
+struct SCookedMaterial FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_AMBIENT = 6,
+    VT_DIFFUSE = 8,
+    VT_SPECULAR = 10,
+    VT_SHININESS = 12,
+    VT_DIFFUSEMAPID = 14,
+    VT_OPACITY = 16,
+    VT_BLEND = 18
+  };
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  const SVector3 *ambient() const { return GetStruct<const SVector3 *>(VT_AMBIENT); }
+  const SVector3 *diffuse() const { return GetStruct<const SVector3 *>(VT_DIFFUSE); }
+  const SVector3 *specular() const { return GetStruct<const SVector3 *>(VT_SPECULAR); }
+  float shininess() const { return GetField<float>(VT_SHININESS, 0.0f); }
+  uint32_t diffuseMapId() const { return GetField<uint32_t>(VT_DIFFUSEMAPID, 0); }
+  float opacity() const { return GetField<float>(VT_OPACITY, 1.0f); }
+  uint8_t blend() const { return GetField<uint8_t>(VT_BLEND, 0); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<SVector3>(verifier, VT_AMBIENT) &&
+           VerifyField<SVector3>(verifier, VT_DIFFUSE) &&
+           VerifyField<SVector3>(verifier, VT_SPECULAR) &&
+           VerifyField<float>(verifier, VT_SHININESS) &&
+           VerifyField<uint32_t>(verifier, VT_DIFFUSEMAPID) &&
+           VerifyField<float>(verifier, VT_OPACITY) &&
+           VerifyField<uint8_t>(verifier, VT_BLEND) &&
+           verifier.EndTable();
+  }
+};
+
+struct SCookedMaterialBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(SCookedMaterial::VT_NAME, name); }
+  void add_ambient(const SVector3 *ambient) { fbb_.AddStruct(SCookedMaterial::VT_AMBIENT, ambient); }
+  void add_diffuse(const SVector3 *diffuse) { fbb_.AddStruct(SCookedMaterial::VT_DIFFUSE, diffuse); }
+  void add_specular(const SVector3 *specular) { fbb_.AddStruct(SCookedMaterial::VT_SPECULAR, specular); }
+  void add_shininess(float shininess) { fbb_.AddElement<float>(SCookedMaterial::VT_SHININESS, shininess, 0.0f); }
+  void add_diffuseMapId(uint32_t diffuseMapId) { fbb_.AddElement<uint32_t>(SCookedMaterial::VT_DIFFUSEMAPID, diffuseMapId, 0); }
+  void add_opacity(float opacity) { fbb_.AddElement<float>(SCookedMaterial::VT_OPACITY, opacity, 1.0f); }
+  void add_blend(uint8_t blend) { fbb_.AddElement<uint8_t>(SCookedMaterial::VT_BLEND, blend, 0); }
+  SCookedMaterialBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SCookedMaterialBuilder &operator=(const SCookedMaterialBuilder &);
+  flatbuffers::Offset<SCookedMaterial> Finish() {
+    auto o = flatbuffers::Offset<SCookedMaterial>(fbb_.EndTable(start_, 8));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SCookedMaterial> CreateSCookedMaterial(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    const SVector3 *ambient = 0,
+    const SVector3 *diffuse = 0,
+    const SVector3 *specular = 0,
+    float shininess = 0.0f,
+    uint32_t diffuseMapId = 0,
+    float opacity = 1.0f,
+    uint8_t blend = 0) {
+  SCookedMaterialBuilder builder_(_fbb);
+  builder_.add_opacity(opacity);
+  builder_.add_diffuseMapId(diffuseMapId);
+  builder_.add_shininess(shininess);
+  builder_.add_specular(specular);
+  builder_.add_diffuse(diffuse);
+  builder_.add_ambient(ambient);
+  builder_.add_name(name);
+  builder_.add_blend(blend);
+  return builder_.Finish();
+}
+
+struct SCookedClip FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_SAMPLERATE = 6,
+    VT_FRAMECOUNT = 8,
+    VT_TRACKS = 10,
+    VT_TARGETS = 12,
+    VT_ROTATIONKEYS = 14,
+    VT_TRANSLATIONKEYS = 16,
+    VT_SCALEKEYS = 18
+  };
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  float sampleRate() const { return GetField<float>(VT_SAMPLERATE, 0.0f); }
+  uint32_t frameCount() const { return GetField<uint32_t>(VT_FRAMECOUNT, 0); }
+  const flatbuffers::Vector<const SAnimationTrack *> *tracks() const { return GetPointer<const flatbuffers::Vector<const SAnimationTrack *> *>(VT_TRACKS); }
+  const flatbuffers::Vector<uint32_t> *targets() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_TARGETS); }
+  const flatbuffers::Vector<const SRotationKey *> *rotationKeys() const { return GetPointer<const flatbuffers::Vector<const SRotationKey *> *>(VT_ROTATIONKEYS); }
+  const flatbuffers::Vector<const SVectorKey *> *translationKeys() const { return GetPointer<const flatbuffers::Vector<const SVectorKey *> *>(VT_TRANSLATIONKEYS); }
+  const flatbuffers::Vector<const SScalarKey *> *scaleKeys() const { return GetPointer<const flatbuffers::Vector<const SScalarKey *> *>(VT_SCALEKEYS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<float>(verifier, VT_SAMPLERATE) &&
+           VerifyField<uint32_t>(verifier, VT_FRAMECOUNT) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TRACKS) &&
+           verifier.Verify(tracks()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TARGETS) &&
+           verifier.Verify(targets()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ROTATIONKEYS) &&
+           verifier.Verify(rotationKeys()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TRANSLATIONKEYS) &&
+           verifier.Verify(translationKeys()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SCALEKEYS) &&
+           verifier.Verify(scaleKeys()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SCookedClipBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(SCookedClip::VT_NAME, name); }
+  void add_sampleRate(float sampleRate) { fbb_.AddElement<float>(SCookedClip::VT_SAMPLERATE, sampleRate, 0.0f); }
+  void add_frameCount(uint32_t frameCount) { fbb_.AddElement<uint32_t>(SCookedClip::VT_FRAMECOUNT, frameCount, 0); }
+  void add_tracks(flatbuffers::Offset<flatbuffers::Vector<const SAnimationTrack *>> tracks) { fbb_.AddOffset(SCookedClip::VT_TRACKS, tracks); }
+  void add_targets(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> targets) { fbb_.AddOffset(SCookedClip::VT_TARGETS, targets); }
+  void add_rotationKeys(flatbuffers::Offset<flatbuffers::Vector<const SRotationKey *>> rotationKeys) { fbb_.AddOffset(SCookedClip::VT_ROTATIONKEYS, rotationKeys); }
+  void add_translationKeys(flatbuffers::Offset<flatbuffers::Vector<const SVectorKey *>> translationKeys) { fbb_.AddOffset(SCookedClip::VT_TRANSLATIONKEYS, translationKeys); }
+  void add_scaleKeys(flatbuffers::Offset<flatbuffers::Vector<const SScalarKey *>> scaleKeys) { fbb_.AddOffset(SCookedClip::VT_SCALEKEYS, scaleKeys); }
+  SCookedClipBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SCookedClipBuilder &operator=(const SCookedClipBuilder &);
+  flatbuffers::Offset<SCookedClip> Finish() {
+    auto o = flatbuffers::Offset<SCookedClip>(fbb_.EndTable(start_, 8));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SCookedClip> CreateSCookedClip(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    float sampleRate = 0.0f,
+    uint32_t frameCount = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SAnimationTrack *>> tracks = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> targets = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SRotationKey *>> rotationKeys = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SVectorKey *>> translationKeys = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SScalarKey *>> scaleKeys = 0) {
+  SCookedClipBuilder builder_(_fbb);
+  builder_.add_scaleKeys(scaleKeys);
+  builder_.add_translationKeys(translationKeys);
+  builder_.add_rotationKeys(rotationKeys);
+  builder_.add_targets(targets);
+  builder_.add_tracks(tracks);
+  builder_.add_frameCount(frameCount);
+  builder_.add_sampleRate(sampleRate);
+  builder_.add_name(name);
+  return builder_.Finish();
+}
+
+struct SCookedScene FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_VERSION = 4,
+    VT_SOURCE = 6,
+    VT_MESHES = 8,
+    VT_MATERIALS = 10,
+    VT_TRANSFORMS = 12,
+    VT_INSTANCES = 14,
+    VT_PARENTS = 16,
+    VT_TEXTURES = 18,
+    VT_CLIPS = 20
+  };
+  uint32_t version() const { return GetField<uint32_t>(VT_VERSION, 0); }
+  const flatbuffers::String *source() const { return GetPointer<const flatbuffers::String *>(VT_SOURCE); }
+  const flatbuffers::Vector<flatbuffers::Offset<SCookedMesh>> *meshes() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SCookedMesh>> *>(VT_MESHES); }
+  const flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>> *materials() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>> *>(VT_MATERIALS); }
+  const flatbuffers::Vector<const SCookedTransform *> *transforms() const { return GetPointer<const flatbuffers::Vector<const SCookedTransform *> *>(VT_TRANSFORMS); }
+  const flatbuffers::Vector<const SCookedInstance *> *instances() const { return GetPointer<const flatbuffers::Vector<const SCookedInstance *> *>(VT_INSTANCES); }
+  const flatbuffers::Vector<uint32_t> *parents() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_PARENTS); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *textures() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_TEXTURES); }
+  const flatbuffers::Vector<flatbuffers::Offset<SCookedClip>> *clips() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SCookedClip>> *>(VT_CLIPS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_VERSION) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SOURCE) &&
+           verifier.Verify(source()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MESHES) &&
+           verifier.Verify(meshes()) &&
+           verifier.VerifyVectorOfTables(meshes()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MATERIALS) &&
+           verifier.Verify(materials()) &&
+           verifier.VerifyVectorOfTables(materials()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TRANSFORMS) &&
+           verifier.Verify(transforms()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_INSTANCES) &&
+           verifier.Verify(instances()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PARENTS) &&
+           verifier.Verify(parents()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXTURES) &&
+           verifier.Verify(textures()) &&
+           verifier.VerifyVectorOfStrings(textures()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_CLIPS) &&
+           verifier.Verify(clips()) &&
+           verifier.VerifyVectorOfTables(clips()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SCookedSceneBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_version(uint32_t version) { fbb_.AddElement<uint32_t>(SCookedScene::VT_VERSION, version, 0); }
+  void add_source(flatbuffers::Offset<flatbuffers::String> source) { fbb_.AddOffset(SCookedScene::VT_SOURCE, source); }
+  void add_meshes(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMesh>>> meshes) { fbb_.AddOffset(SCookedScene::VT_MESHES, meshes); }
+  void add_materials(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>>> materials) { fbb_.AddOffset(SCookedScene::VT_MATERIALS, materials); }
+  void add_transforms(flatbuffers::Offset<flatbuffers::Vector<const SCookedTransform *>> transforms) { fbb_.AddOffset(SCookedScene::VT_TRANSFORMS, transforms); }
+  void add_instances(flatbuffers::Offset<flatbuffers::Vector<const SCookedInstance *>> instances) { fbb_.AddOffset(SCookedScene::VT_INSTANCES, instances); }
+  void add_parents(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> parents) { fbb_.AddOffset(SCookedScene::VT_PARENTS, parents); }
+  void add_textures(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures) { fbb_.AddOffset(SCookedScene::VT_TEXTURES, textures); }
+  void add_clips(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedClip>>> clips) { fbb_.AddOffset(SCookedScene::VT_CLIPS, clips); }
+  SCookedSceneBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SCookedSceneBuilder &operator=(const SCookedSceneBuilder &);
+  flatbuffers::Offset<SCookedScene> Finish() {
+    auto o = flatbuffers::Offset<SCookedScene>(fbb_.EndTable(start_, 9));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SCookedScene> CreateSCookedScene(flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t version = 0,
+    flatbuffers::Offset<flatbuffers::String> source = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMesh>>> meshes = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>>> materials = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCookedTransform *>> transforms = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCookedInstance *>> instances = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> parents = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedClip>>> clips = 0) {
+  SCookedSceneBuilder builder_(_fbb);
+  builder_.add_clips(clips);
+  builder_.add_textures(textures);
+  builder_.add_parents(parents);
+  builder_.add_instances(instances);
+  builder_.add_transforms(transforms);
+  builder_.add_materials(materials);
+  builder_.add_meshes(meshes);
+  builder_.add_source(source);
+  builder_.add_version(version);
+  return builder_.Finish();
+}
+
+inline const m3d::schema::SCookedScene *GetSCookedScene(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SCookedScene>(buf);
+}
+
+inline const char *SCookedSceneIdentifier() {
+  return "M3DC";
+}
+
+inline bool SCookedSceneBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SCookedSceneIdentifier());
+}
+
+inline bool VerifySCookedSceneBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SCookedScene>(SCookedSceneIdentifier());
+}
+
+inline const char *SCookedSceneExtension() { return "m3dc"; }
+
+inline void FinishSCookedSceneBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SCookedScene> root) {
+  fbb.Finish(root, SCookedSceneIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_COOKED_M3D_SCHEMA_H_
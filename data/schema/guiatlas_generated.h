@@ -0,0 +1,116 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_GUIATLAS_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_GUIATLAS_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace m3d {
+namespace schema {
+
+struct SGuiRegion;
+
+struct SGuiAtlases;
+
+MANUALLY_ALIGNED_STRUCT(4) SGuiRegion FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t atlas_;
+  float u0_;
+  float v0_;
+  float u1_;
+  float v1_;
+
+ public:
+  SGuiRegion() { memset(this, 0, sizeof(SGuiRegion)); }
+  SGuiRegion(const SGuiRegion &_o) { memcpy(this, &_o, sizeof(SGuiRegion)); }
+  SGuiRegion(uint32_t _atlas, float _u0, float _v0, float _u1, float _v1)
+    : atlas_(flatbuffers::EndianScalar(_atlas)), u0_(flatbuffers::EndianScalar(_u0)), v0_(flatbuffers::EndianScalar(_v0)), u1_(flatbuffers::EndianScalar(_u1)), v1_(flatbuffers::EndianScalar(_v1)) { }
+
+  uint32_t atlas() const { return flatbuffers::EndianScalar(atlas_); }
+  float u0() const { return flatbuffers::EndianScalar(u0_); }
+  float v0() const { return flatbuffers::EndianScalar(v0_); }
+  float u1() const { return flatbuffers::EndianScalar(u1_); }
+  float v1() const { return flatbuffers::EndianScalar(v1_); }
+};
+STRUCT_END(SGuiRegion, 20);
+
+struct SGuiAtlases FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_VERSION = 4,
+    VT_ATLASES = 6,
+    VT_NAMES = 8,
+    VT_REGIONS = 10
+  };
+  uint32_t version() const { return GetField<uint32_t>(VT_VERSION, 0); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *atlases() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_ATLASES); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *names() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_NAMES); }
+  const flatbuffers::Vector<const SGuiRegion *> *regions() const { return GetPointer<const flatbuffers::Vector<const SGuiRegion *> *>(VT_REGIONS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_VERSION) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ATLASES) &&
+           verifier.Verify(atlases()) &&
+           verifier.VerifyVectorOfStrings(atlases()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAMES) &&
+           verifier.Verify(names()) &&
+           verifier.VerifyVectorOfStrings(names()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_REGIONS) &&
+           verifier.Verify(regions()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SGuiAtlasesBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_version(uint32_t version) { fbb_.AddElement<uint32_t>(SGuiAtlases::VT_VERSION, version, 0); }
+  void add_atlases(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> atlases) { fbb_.AddOffset(SGuiAtlases::VT_ATLASES, atlases); }
+  void add_names(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> names) { fbb_.AddOffset(SGuiAtlases::VT_NAMES, names); }
+  void add_regions(flatbuffers::Offset<flatbuffers::Vector<const SGuiRegion *>> regions) { fbb_.AddOffset(SGuiAtlases::VT_REGIONS, regions); }
+  SGuiAtlasesBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SGuiAtlasesBuilder &operator=(const SGuiAtlasesBuilder &);
+  flatbuffers::Offset<SGuiAtlases> Finish() {
+    auto o = flatbuffers::Offset<SGuiAtlases>(fbb_.EndTable(start_, 4));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SGuiAtlases> CreateSGuiAtlases(flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t version = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> atlases = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> names = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SGuiRegion *>> regions = 0) {
+  SGuiAtlasesBuilder builder_(_fbb);
+  builder_.add_regions(regions);
+  builder_.add_names(names);
+  builder_.add_atlases(atlases);
+  builder_.add_version(version);
+  return builder_.Finish();
+}
+
+inline const m3d::schema::SGuiAtlases *GetSGuiAtlases(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SGuiAtlases>(buf);
+}
+
+inline const char *SGuiAtlasesIdentifier() {
+  return "M3DA";
+}
+
+inline bool SGuiAtlasesBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SGuiAtlasesIdentifier());
+}
+
+inline bool VerifySGuiAtlasesBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SGuiAtlases>(SGuiAtlasesIdentifier());
+}
+
+inline const char *SGuiAtlasesExtension() { return "m3da"; }
+
+inline void FinishSGuiAtlasesBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SGuiAtlases> root) {
+  fbb.Finish(root, SGuiAtlasesIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_GUIATLAS_M3D_SCHEMA_H_
@@ -0,0 +1,368 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_GUISCREEN_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_GUISCREEN_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace m3d {
+namespace schema {
+
+struct SGuiPos;
+
+struct SGuiDim;
+
+struct SGuiColor;
+
+struct SGuiElement;
+
+struct SGuiScreen;
+
+enum SGuiElementType {
+  SGuiElementType_Panel = 0,
+  SGuiElementType_Image = 1,
+  SGuiElementType_Button = 2,
+  SGuiElementType_CheckBox = 3,
+  SGuiElementType_TextCaption = 4,
+  SGuiElementType_MIN = SGuiElementType_Panel,
+  SGuiElementType_MAX = SGuiElementType_TextCaption
+};
+
+inline const char **EnumNamesSGuiElementType() {
+  static const char *names[] = { "Panel", "Image", "Button", "CheckBox", "TextCaption", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSGuiElementType(SGuiElementType e) { return EnumNamesSGuiElementType()[static_cast<int>(e)]; }
+
+enum SGuiOrigin {
+  SGuiOrigin_TL = 0,
+  SGuiOrigin_TR = 1,
+  SGuiOrigin_BL = 2,
+  SGuiOrigin_BR = 3,
+  SGuiOrigin_C = 4,
+  SGuiOrigin_MIN = SGuiOrigin_TL,
+  SGuiOrigin_MAX = SGuiOrigin_C
+};
+
+inline const char **EnumNamesSGuiOrigin() {
+  static const char *names[] = { "TL", "TR", "BL", "BR", "C", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSGuiOrigin(SGuiOrigin e) { return EnumNamesSGuiOrigin()[static_cast<int>(e)]; }
+
+MANUALLY_ALIGNED_STRUCT(4) SGuiPos FLATBUFFERS_FINAL_CLASS {
+ private:
+  float x_;
+  float y_;
+  int32_t offsetX_;
+  int32_t offsetY_;
+
+ public:
+  SGuiPos() { memset(this, 0, sizeof(SGuiPos)); }
+  SGuiPos(const SGuiPos &_o) { memcpy(this, &_o, sizeof(SGuiPos)); }
+  SGuiPos(float _x, float _y, int32_t _offsetX, int32_t _offsetY)
+    : x_(flatbuffers::EndianScalar(_x)), y_(flatbuffers::EndianScalar(_y)), offsetX_(flatbuffers::EndianScalar(_offsetX)), offsetY_(flatbuffers::EndianScalar(_offsetY)) { }
+
+  float x() const { return flatbuffers::EndianScalar(x_); }
+  float y() const { return flatbuffers::EndianScalar(y_); }
+  int32_t offsetX() const { return flatbuffers::EndianScalar(offsetX_); }
+  int32_t offsetY() const { return flatbuffers::EndianScalar(offsetY_); }
+};
+STRUCT_END(SGuiPos, 16);
+
+MANUALLY_ALIGNED_STRUCT(4) SGuiDim FLATBUFFERS_FINAL_CLASS {
+ private:
+  float w_;
+  float h_;
+  int32_t pixelW_;
+  int32_t pixelH_;
+  float ar_;
+
+ public:
+  SGuiDim() { memset(this, 0, sizeof(SGuiDim)); }
+  SGuiDim(const SGuiDim &_o) { memcpy(this, &_o, sizeof(SGuiDim)); }
+  SGuiDim(float _w, float _h, int32_t _pixelW, int32_t _pixelH, float _ar)
+    : w_(flatbuffers::EndianScalar(_w)), h_(flatbuffers::EndianScalar(_h)), pixelW_(flatbuffers::EndianScalar(_pixelW)), pixelH_(flatbuffers::EndianScalar(_pixelH)), ar_(flatbuffers::EndianScalar(_ar)) { }
+
+  float w() const { return flatbuffers::EndianScalar(w_); }
+  float h() const { return flatbuffers::EndianScalar(h_); }
+  int32_t pixelW() const { return flatbuffers::EndianScalar(pixelW_); }
+  int32_t pixelH() const { return flatbuffers::EndianScalar(pixelH_); }
+  float ar() const { return flatbuffers::EndianScalar(ar_); }
+};
+STRUCT_END(SGuiDim, 20);
+
+MANUALLY_ALIGNED_STRUCT(1) SGuiColor FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint8_t r_;
+  uint8_t g_;
+  uint8_t b_;
+  uint8_t a_;
+
+ public:
+  SGuiColor() { memset(this, 0, sizeof(SGuiColor)); }
+  SGuiColor(const SGuiColor &_o) { memcpy(this, &_o, sizeof(SGuiColor)); }
+  SGuiColor(uint8_t _r, uint8_t _g, uint8_t _b, uint8_t _a)
+    : r_(flatbuffers::EndianScalar(_r)), g_(flatbuffers::EndianScalar(_g)), b_(flatbuffers::EndianScalar(_b)), a_(flatbuffers::EndianScalar(_a)) { }
+
+  uint8_t r() const { return flatbuffers::EndianScalar(r_); }
+  uint8_t g() const { return flatbuffers::EndianScalar(g_); }
+  uint8_t b() const { return flatbuffers::EndianScalar(b_); }
+  uint8_t a() const { return flatbuffers::EndianScalar(a_); }
+};
+STRUCT_END(SGuiColor, 4);
+
+struct SGuiElement FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_TYPE = 4,
+    VT_NAME = 6,
+    VT_PARENT = 8,
+    VT_POS = 10,
+    VT_ORIGIN = 12,
+    VT_DIM = 14,
+    VT_MAXW = 16,
+    VT_MAXH = 18,
+    VT_COLOR = 20,
+    VT_VISIBLE = 22,
+    VT_TEXTURES = 24,
+    VT_TEXT = 26,
+    VT_FONTFACE = 28,
+    VT_FONTSIZE = 30,
+    VT_ONCLICK = 32,
+    VT_ONDOWN = 34,
+    VT_ONUP = 36,
+    VT_ONOVER = 38,
+    VT_ONSTATECHANGE = 40,
+    VT_WHILEDOWN = 42,
+    VT_WHILEHOVER = 44
+  };
+  SGuiElementType type() const { return static_cast<SGuiElementType>(GetField<uint8_t>(VT_TYPE, 0)); }
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  int32_t parent() const { return GetField<int32_t>(VT_PARENT, -1); }
+  const SGuiPos *pos() const { return GetStruct<const SGuiPos *>(VT_POS); }
+  SGuiOrigin origin() const { return static_cast<SGuiOrigin>(GetField<uint8_t>(VT_ORIGIN, 0)); }
+  const SGuiDim *dim() const { return GetStruct<const SGuiDim *>(VT_DIM); }
+  int32_t maxW() const { return GetField<int32_t>(VT_MAXW, 0); }
+  int32_t maxH() const { return GetField<int32_t>(VT_MAXH, 0); }
+  const SGuiColor *color() const { return GetStruct<const SGuiColor *>(VT_COLOR); }
+  bool visible() const { return GetField<uint8_t>(VT_VISIBLE, 1) != 0; }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *textures() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_TEXTURES); }
+  const flatbuffers::String *text() const { return GetPointer<const flatbuffers::String *>(VT_TEXT); }
+  const flatbuffers::String *fontFace() const { return GetPointer<const flatbuffers::String *>(VT_FONTFACE); }
+  float fontSize() const { return GetField<float>(VT_FONTSIZE, 0.0f); }
+  const flatbuffers::String *onClick() const { return GetPointer<const flatbuffers::String *>(VT_ONCLICK); }
+  const flatbuffers::String *onDown() const { return GetPointer<const flatbuffers::String *>(VT_ONDOWN); }
+  const flatbuffers::String *onUp() const { return GetPointer<const flatbuffers::String *>(VT_ONUP); }
+  const flatbuffers::String *onOver() const { return GetPointer<const flatbuffers::String *>(VT_ONOVER); }
+  const flatbuffers::String *onStateChange() const { return GetPointer<const flatbuffers::String *>(VT_ONSTATECHANGE); }
+  const flatbuffers::String *whileDown() const { return GetPointer<const flatbuffers::String *>(VT_WHILEDOWN); }
+  const flatbuffers::String *whileHover() const { return GetPointer<const flatbuffers::String *>(VT_WHILEHOVER); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_TYPE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<int32_t>(verifier, VT_PARENT) &&
+           VerifyField<SGuiPos>(verifier, VT_POS) &&
+           VerifyField<uint8_t>(verifier, VT_ORIGIN) &&
+           VerifyField<SGuiDim>(verifier, VT_DIM) &&
+           VerifyField<int32_t>(verifier, VT_MAXW) &&
+           VerifyField<int32_t>(verifier, VT_MAXH) &&
+           VerifyField<SGuiColor>(verifier, VT_COLOR) &&
+           VerifyField<uint8_t>(verifier, VT_VISIBLE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXTURES) &&
+           verifier.Verify(textures()) &&
+           verifier.VerifyVectorOfStrings(textures()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXT) &&
+           verifier.Verify(text()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_FONTFACE) &&
+           verifier.Verify(fontFace()) &&
+           VerifyField<float>(verifier, VT_FONTSIZE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ONCLICK) &&
+           verifier.Verify(onClick()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ONDOWN) &&
+           verifier.Verify(onDown()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ONUP) &&
+           verifier.Verify(onUp()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ONOVER) &&
+           verifier.Verify(onOver()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ONSTATECHANGE) &&
+           verifier.Verify(onStateChange()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_WHILEDOWN) &&
+           verifier.Verify(whileDown()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_WHILEHOVER) &&
+           verifier.Verify(whileHover()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SGuiElementBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_type(SGuiElementType type) { fbb_.AddElement<uint8_t>(SGuiElement::VT_TYPE, static_cast<uint8_t>(type), 0); }
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(SGuiElement::VT_NAME, name); }
+  void add_parent(int32_t parent) { fbb_.AddElement<int32_t>(SGuiElement::VT_PARENT, parent, -1); }
+  void add_pos(const SGuiPos *pos) { fbb_.AddStruct(SGuiElement::VT_POS, pos); }
+  void add_origin(SGuiOrigin origin) { fbb_.AddElement<uint8_t>(SGuiElement::VT_ORIGIN, static_cast<uint8_t>(origin), 0); }
+  void add_dim(const SGuiDim *dim) { fbb_.AddStruct(SGuiElement::VT_DIM, dim); }
+  void add_maxW(int32_t maxW) { fbb_.AddElement<int32_t>(SGuiElement::VT_MAXW, maxW, 0); }
+  void add_maxH(int32_t maxH) { fbb_.AddElement<int32_t>(SGuiElement::VT_MAXH, maxH, 0); }
+  void add_color(const SGuiColor *color) { fbb_.AddStruct(SGuiElement::VT_COLOR, color); }
+  void add_visible(bool visible) { fbb_.AddElement<uint8_t>(SGuiElement::VT_VISIBLE, static_cast<uint8_t>(visible), 1); }
+  void add_textures(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures) { fbb_.AddOffset(SGuiElement::VT_TEXTURES, textures); }
+  void add_text(flatbuffers::Offset<flatbuffers::String> text) { fbb_.AddOffset(SGuiElement::VT_TEXT, text); }
+  void add_fontFace(flatbuffers::Offset<flatbuffers::String> fontFace) { fbb_.AddOffset(SGuiElement::VT_FONTFACE, fontFace); }
+  void add_fontSize(float fontSize) { fbb_.AddElement<float>(SGuiElement::VT_FONTSIZE, fontSize, 0.0f); }
+  void add_onClick(flatbuffers::Offset<flatbuffers::String> onClick) { fbb_.AddOffset(SGuiElement::VT_ONCLICK, onClick); }
+  void add_onDown(flatbuffers::Offset<flatbuffers::String> onDown) { fbb_.AddOffset(SGuiElement::VT_ONDOWN, onDown); }
+  void add_onUp(flatbuffers::Offset<flatbuffers::String> onUp) { fbb_.AddOffset(SGuiElement::VT_ONUP, onUp); }
+  void add_onOver(flatbuffers::Offset<flatbuffers::String> onOver) { fbb_.AddOffset(SGuiElement::VT_ONOVER, onOver); }
+  void add_onStateChange(flatbuffers::Offset<flatbuffers::String> onStateChange) { fbb_.AddOffset(SGuiElement::VT_ONSTATECHANGE, onStateChange); }
+  void add_whileDown(flatbuffers::Offset<flatbuffers::String> whileDown) { fbb_.AddOffset(SGuiElement::VT_WHILEDOWN, whileDown); }
+  void add_whileHover(flatbuffers::Offset<flatbuffers::String> whileHover) { fbb_.AddOffset(SGuiElement::VT_WHILEHOVER, whileHover); }
+  SGuiElementBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SGuiElementBuilder &operator=(const SGuiElementBuilder &);
+  flatbuffers::Offset<SGuiElement> Finish() {
+    auto o = flatbuffers::Offset<SGuiElement>(fbb_.EndTable(start_, 21));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SGuiElement> CreateSGuiElement(flatbuffers::FlatBufferBuilder &_fbb,
+    SGuiElementType type = SGuiElementType_Panel,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    int32_t parent = -1,
+    const SGuiPos *pos = 0,
+    SGuiOrigin origin = SGuiOrigin_TL,
+    const SGuiDim *dim = 0,
+    int32_t maxW = 0,
+    int32_t maxH = 0,
+    const SGuiColor *color = 0,
+    bool visible = true,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures = 0,
+    flatbuffers::Offset<flatbuffers::String> text = 0,
+    flatbuffers::Offset<flatbuffers::String> fontFace = 0,
+    float fontSize = 0.0f,
+    flatbuffers::Offset<flatbuffers::String> onClick = 0,
+    flatbuffers::Offset<flatbuffers::String> onDown = 0,
+    flatbuffers::Offset<flatbuffers::String> onUp = 0,
+    flatbuffers::Offset<flatbuffers::String> onOver = 0,
+    flatbuffers::Offset<flatbuffers::String> onStateChange = 0,
+    flatbuffers::Offset<flatbuffers::String> whileDown = 0,
+    flatbuffers::Offset<flatbuffers::String> whileHover = 0) {
+  SGuiElementBuilder builder_(_fbb);
+  builder_.add_whileHover(whileHover);
+  builder_.add_whileDown(whileDown);
+  builder_.add_onStateChange(onStateChange);
+  builder_.add_onOver(onOver);
+  builder_.add_onUp(onUp);
+  builder_.add_onDown(onDown);
+  builder_.add_onClick(onClick);
+  builder_.add_fontSize(fontSize);
+  builder_.add_fontFace(fontFace);
+  builder_.add_text(text);
+  builder_.add_textures(textures);
+  builder_.add_color(color);
+  builder_.add_maxH(maxH);
+  builder_.add_maxW(maxW);
+  builder_.add_dim(dim);
+  builder_.add_pos(pos);
+  builder_.add_parent(parent);
+  builder_.add_name(name);
+  builder_.add_visible(visible);
+  builder_.add_origin(origin);
+  builder_.add_type(type);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SGuiElement> CreateSGuiElementDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    SGuiElementType type = SGuiElementType_Panel,
+    const char *name = nullptr,
+    int32_t parent = -1,
+    const SGuiPos *pos = 0,
+    SGuiOrigin origin = SGuiOrigin_TL,
+    const SGuiDim *dim = 0,
+    int32_t maxW = 0,
+    int32_t maxH = 0,
+    const SGuiColor *color = 0,
+    bool visible = true,
+    const std::vector<flatbuffers::Offset<flatbuffers::String>> *textures = nullptr,
+    const char *text = nullptr,
+    const char *fontFace = nullptr,
+    float fontSize = 0.0f,
+    const char *onClick = nullptr,
+    const char *onDown = nullptr,
+    const char *onUp = nullptr,
+    const char *onOver = nullptr,
+    const char *onStateChange = nullptr,
+    const char *whileDown = nullptr,
+    const char *whileHover = nullptr) {
+  return CreateSGuiElement(_fbb, type, name ? _fbb.CreateString(name) : 0, parent, pos, origin, dim, maxW, maxH, color, visible, textures ? _fbb.CreateVector<flatbuffers::Offset<flatbuffers::String>>(*textures) : 0, text ? _fbb.CreateString(text) : 0, fontFace ? _fbb.CreateString(fontFace) : 0, fontSize, onClick ? _fbb.CreateString(onClick) : 0, onDown ? _fbb.CreateString(onDown) : 0, onUp ? _fbb.CreateString(onUp) : 0, onOver ? _fbb.CreateString(onOver) : 0, onStateChange ? _fbb.CreateString(onStateChange) : 0, whileDown ? _fbb.CreateString(whileDown) : 0, whileHover ? _fbb.CreateString(whileHover) : 0);
+}
+
+struct SGuiScreen FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ELEMENTS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<SGuiElement>> *elements() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SGuiElement>> *>(VT_ELEMENTS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ELEMENTS) &&
+           verifier.Verify(elements()) &&
+           verifier.VerifyVectorOfTables(elements()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SGuiScreenBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_elements(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SGuiElement>>> elements) { fbb_.AddOffset(SGuiScreen::VT_ELEMENTS, elements); }
+  SGuiScreenBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SGuiScreenBuilder &operator=(const SGuiScreenBuilder &);
+  flatbuffers::Offset<SGuiScreen> Finish() {
+    auto o = flatbuffers::Offset<SGuiScreen>(fbb_.EndTable(start_, 1));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SGuiScreen> CreateSGuiScreen(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SGuiElement>>> elements = 0) {
+  SGuiScreenBuilder builder_(_fbb);
+  builder_.add_elements(elements);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SGuiScreen> CreateSGuiScreenDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<SGuiElement>> *elements = nullptr) {
+  return CreateSGuiScreen(_fbb, elements ? _fbb.CreateVector<flatbuffers::Offset<SGuiElement>>(*elements) : 0);
+}
+
+inline const m3d::schema::SGuiScreen *GetSGuiScreen(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SGuiScreen>(buf);
+}
+
+inline const char *SGuiScreenIdentifier() {
+  return "M3DU";
+}
+
+inline bool SGuiScreenBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SGuiScreenIdentifier());
+}
+
+inline bool VerifySGuiScreenBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SGuiScreen>(SGuiScreenIdentifier());
+}
+
+inline const char *SGuiScreenExtension() { return "m3du"; }
+
+inline void FinishSGuiScreenBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SGuiScreen> root) {
+  fbb.Finish(root, SGuiScreenIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_GUISCREEN_M3D_SCHEMA_H_
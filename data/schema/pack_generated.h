@@ -0,0 +1,108 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_PACK_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_PACK_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace m3d {
+namespace schema {
+
+struct SPackEntry;
+
+struct SPackage;
+
+MANUALLY_ALIGNED_STRUCT(8) SPackEntry FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint64_t hash_;
+  uint64_t offset_;
+  uint64_t size_;
+  uint32_t codec_;
+  uint32_t pad_;
+
+ public:
+  SPackEntry() { memset(this, 0, sizeof(SPackEntry)); }
+  SPackEntry(const SPackEntry &_o) { memcpy(this, &_o, sizeof(SPackEntry)); }
+  SPackEntry(uint64_t _hash, uint64_t _offset, uint64_t _size, uint32_t _codec, uint32_t _pad)
+    : hash_(flatbuffers::EndianScalar(_hash)), offset_(flatbuffers::EndianScalar(_offset)), size_(flatbuffers::EndianScalar(_size)), codec_(flatbuffers::EndianScalar(_codec)), pad_(flatbuffers::EndianScalar(_pad)) { }
+
+  uint64_t hash() const { return flatbuffers::EndianScalar(hash_); }
+  uint64_t offset() const { return flatbuffers::EndianScalar(offset_); }
+  uint64_t size() const { return flatbuffers::EndianScalar(size_); }
+  uint32_t codec() const { return flatbuffers::EndianScalar(codec_); }
+  uint32_t pad() const { return flatbuffers::EndianScalar(pad_); }
+};
+STRUCT_END(SPackEntry, 32);
+
+struct SPackage FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_VERSION = 4,
+    VT_ENTRIES = 6,
+    VT_PATHS = 8
+  };
+  uint32_t version() const { return GetField<uint32_t>(VT_VERSION, 0); }
+  const flatbuffers::Vector<const SPackEntry *> *entries() const { return GetPointer<const flatbuffers::Vector<const SPackEntry *> *>(VT_ENTRIES); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *paths() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_PATHS); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_VERSION) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_ENTRIES) &&
+           verifier.Verify(entries()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PATHS) &&
+           verifier.Verify(paths()) &&
+           verifier.VerifyVectorOfStrings(paths()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SPackageBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_version(uint32_t version) { fbb_.AddElement<uint32_t>(SPackage::VT_VERSION, version, 0); }
+  void add_entries(flatbuffers::Offset<flatbuffers::Vector<const SPackEntry *>> entries) { fbb_.AddOffset(SPackage::VT_ENTRIES, entries); }
+  void add_paths(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> paths) { fbb_.AddOffset(SPackage::VT_PATHS, paths); }
+  SPackageBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SPackageBuilder &operator=(const SPackageBuilder &);
+  flatbuffers::Offset<SPackage> Finish() {
+    auto o = flatbuffers::Offset<SPackage>(fbb_.EndTable(start_, 3));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SPackage> CreateSPackage(flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t version = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SPackEntry *>> entries = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> paths = 0) {
+  SPackageBuilder builder_(_fbb);
+  builder_.add_paths(paths);
+  builder_.add_entries(entries);
+  builder_.add_version(version);
+  return builder_.Finish();
+}
+
+inline const m3d::schema::SPackage *GetSPackage(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SPackage>(buf);
+}
+
+inline const char *SPackageIdentifier() {
+  return "M3DP";
+}
+
+inline bool SPackageBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SPackageIdentifier());
+}
+
+inline bool VerifySPackageBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SPackage>(SPackageIdentifier());
+}
+
+inline const char *SPackageExtension() { return "m3dp"; }
+
+inline void FinishSPackageBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SPackage> root) {
+  fbb.Finish(root, SPackageIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_PACK_M3D_SCHEMA_H_
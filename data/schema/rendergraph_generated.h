@@ -0,0 +1,406 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_RENDERGRAPH_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_RENDERGRAPH_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace m3d {
+namespace schema {
+
+struct STexture;
+
+struct SUse;
+
+struct SPass;
+
+struct SRenderGraph;
+
+enum SFormat {
+  SFormat_RGBA8 = 0,
+  SFormat_BGRA8 = 1,
+  SFormat_RGBA16F = 2,
+  SFormat_RG16F = 3,
+  SFormat_R32F = 4,
+  SFormat_Depth32F = 5,
+  SFormat_Depth24Stencil8 = 6,
+  SFormat_Depth32FStencil8 = 7,
+  SFormat_MIN = SFormat_RGBA8,
+  SFormat_MAX = SFormat_Depth32FStencil8
+};
+
+inline const char **EnumNamesSFormat() {
+  static const char *names[] = { "RGBA8", "BGRA8", "RGBA16F", "RG16F", "R32F", "Depth32F", "Depth24Stencil8", "Depth32FStencil8", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSFormat(SFormat e) { return EnumNamesSFormat()[static_cast<int>(e)]; }
+
+enum SAccess {
+  SAccess_Undefined = 0,
+  SAccess_ColorAttachment = 1,
+  SAccess_DepthAttachment = 2,
+  SAccess_DepthRead = 3,
+  SAccess_Sampled = 4,
+  SAccess_StorageRead = 5,
+  SAccess_StorageWrite = 6,
+  SAccess_TransferSrc = 7,
+  SAccess_TransferDst = 8,
+  SAccess_Present = 9,
+  SAccess_MIN = SAccess_Undefined,
+  SAccess_MAX = SAccess_Present
+};
+
+inline const char **EnumNamesSAccess() {
+  static const char *names[] = { "Undefined", "ColorAttachment", "DepthAttachment", "DepthRead", "Sampled", "StorageRead", "StorageWrite", "TransferSrc", "TransferDst", "Present", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSAccess(SAccess e) { return EnumNamesSAccess()[static_cast<int>(e)]; }
+
+enum SPassType {
+  SPassType_Graphics = 0,
+  SPassType_Compute = 1,
+  SPassType_Transfer = 2,
+  SPassType_MIN = SPassType_Graphics,
+  SPassType_MAX = SPassType_Transfer
+};
+
+inline const char **EnumNamesSPassType() {
+  static const char *names[] = { "Graphics", "Compute", "Transfer", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSPassType(SPassType e) { return EnumNamesSPassType()[static_cast<int>(e)]; }
+
+enum SLoadOp {
+  SLoadOp_Load = 0,
+  SLoadOp_Clear = 1,
+  SLoadOp_DontCare = 2,
+  SLoadOp_MIN = SLoadOp_Load,
+  SLoadOp_MAX = SLoadOp_DontCare
+};
+
+inline const char **EnumNamesSLoadOp() {
+  static const char *names[] = { "Load", "Clear", "DontCare", nullptr };
+  return names;
+}
+
+inline const char *EnumNameSLoadOp(SLoadOp e) { return EnumNamesSLoadOp()[static_cast<int>(e)]; }
+
+struct STexture FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_FORMAT = 6,
+    VT_SCALE = 8,
+    VT_WIDTH = 10,
+    VT_HEIGHT = 12,
+    VT_MIPLEVELS = 14,
+    VT_CLEARVALUE = 16,
+    VT_IMPORTED = 18,
+    VT_INITIALACCESS = 20,
+    VT_FINALACCESS = 22
+  };
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  SFormat format() const { return static_cast<SFormat>(GetField<uint8_t>(VT_FORMAT, 0)); }
+  float scale() const { return GetField<float>(VT_SCALE, 1.0f); }
+  uint32_t width() const { return GetField<uint32_t>(VT_WIDTH, 0); }
+  uint32_t height() const { return GetField<uint32_t>(VT_HEIGHT, 0); }
+  uint32_t mipLevels() const { return GetField<uint32_t>(VT_MIPLEVELS, 1); }
+  const flatbuffers::Vector<float> *clearValue() const { return GetPointer<const flatbuffers::Vector<float> *>(VT_CLEARVALUE); }
+  bool imported() const { return GetField<uint8_t>(VT_IMPORTED, 0) != 0; }
+  SAccess initialAccess() const { return static_cast<SAccess>(GetField<uint8_t>(VT_INITIALACCESS, 0)); }
+  SAccess finalAccess() const { return static_cast<SAccess>(GetField<uint8_t>(VT_FINALACCESS, 0)); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<uint8_t>(verifier, VT_FORMAT) &&
+           VerifyField<float>(verifier, VT_SCALE) &&
+           VerifyField<uint32_t>(verifier, VT_WIDTH) &&
+           VerifyField<uint32_t>(verifier, VT_HEIGHT) &&
+           VerifyField<uint32_t>(verifier, VT_MIPLEVELS) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_CLEARVALUE) &&
+           verifier.Verify(clearValue()) &&
+           VerifyField<uint8_t>(verifier, VT_IMPORTED) &&
+           VerifyField<uint8_t>(verifier, VT_INITIALACCESS) &&
+           VerifyField<uint8_t>(verifier, VT_FINALACCESS) &&
+           verifier.EndTable();
+  }
+};
+
+struct STextureBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(STexture::VT_NAME, name); }
+  void add_format(SFormat format) { fbb_.AddElement<uint8_t>(STexture::VT_FORMAT, static_cast<uint8_t>(format), 0); }
+  void add_scale(float scale) { fbb_.AddElement<float>(STexture::VT_SCALE, scale, 1.0f); }
+  void add_width(uint32_t width) { fbb_.AddElement<uint32_t>(STexture::VT_WIDTH, width, 0); }
+  void add_height(uint32_t height) { fbb_.AddElement<uint32_t>(STexture::VT_HEIGHT, height, 0); }
+  void add_mipLevels(uint32_t mipLevels) { fbb_.AddElement<uint32_t>(STexture::VT_MIPLEVELS, mipLevels, 1); }
+  void add_clearValue(flatbuffers::Offset<flatbuffers::Vector<float>> clearValue) { fbb_.AddOffset(STexture::VT_CLEARVALUE, clearValue); }
+  void add_imported(bool imported) { fbb_.AddElement<uint8_t>(STexture::VT_IMPORTED, static_cast<uint8_t>(imported), 0); }
+  void add_initialAccess(SAccess initialAccess) { fbb_.AddElement<uint8_t>(STexture::VT_INITIALACCESS, static_cast<uint8_t>(initialAccess), 0); }
+  void add_finalAccess(SAccess finalAccess) { fbb_.AddElement<uint8_t>(STexture::VT_FINALACCESS, static_cast<uint8_t>(finalAccess), 0); }
+  STextureBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  STextureBuilder &operator=(const STextureBuilder &);
+  flatbuffers::Offset<STexture> Finish() {
+    auto o = flatbuffers::Offset<STexture>(fbb_.EndTable(start_, 10));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<STexture> CreateSTexture(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    SFormat format = SFormat_RGBA8,
+    float scale = 1.0f,
+    uint32_t width = 0,
+    uint32_t height = 0,
+    uint32_t mipLevels = 1,
+    flatbuffers::Offset<flatbuffers::Vector<float>> clearValue = 0,
+    bool imported = false,
+    SAccess initialAccess = SAccess_Undefined,
+    SAccess finalAccess = SAccess_Undefined) {
+  STextureBuilder builder_(_fbb);
+  builder_.add_clearValue(clearValue);
+  builder_.add_mipLevels(mipLevels);
+  builder_.add_height(height);
+  builder_.add_width(width);
+  builder_.add_scale(scale);
+  builder_.add_name(name);
+  builder_.add_finalAccess(finalAccess);
+  builder_.add_initialAccess(initialAccess);
+  builder_.add_imported(imported);
+  builder_.add_format(format);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<STexture> CreateSTextureDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    const char *name = nullptr,
+    SFormat format = SFormat_RGBA8,
+    float scale = 1.0f,
+    uint32_t width = 0,
+    uint32_t height = 0,
+    uint32_t mipLevels = 1,
+    const std::vector<float> *clearValue = nullptr,
+    bool imported = false,
+    SAccess initialAccess = SAccess_Undefined,
+    SAccess finalAccess = SAccess_Undefined) {
+  return CreateSTexture(_fbb, name ? _fbb.CreateString(name) : 0, format, scale, width, height, mipLevels, clearValue ? _fbb.CreateVector<float>(*clearValue) : 0, imported, initialAccess, finalAccess);
+}
+
+struct SUse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_TEXTURE = 4,
+    VT_ACCESS = 6,
+    VT_LOAD = 8
+  };
+  const flatbuffers::String *texture() const { return GetPointer<const flatbuffers::String *>(VT_TEXTURE); }
+  SAccess access() const { return static_cast<SAccess>(GetField<uint8_t>(VT_ACCESS, 0)); }
+  SLoadOp load() const { return static_cast<SLoadOp>(GetField<uint8_t>(VT_LOAD, 0)); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXTURE) &&
+           verifier.Verify(texture()) &&
+           VerifyField<uint8_t>(verifier, VT_ACCESS) &&
+           VerifyField<uint8_t>(verifier, VT_LOAD) &&
+           verifier.EndTable();
+  }
+};
+
+struct SUseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_texture(flatbuffers::Offset<flatbuffers::String> texture) { fbb_.AddOffset(SUse::VT_TEXTURE, texture); }
+  void add_access(SAccess access) { fbb_.AddElement<uint8_t>(SUse::VT_ACCESS, static_cast<uint8_t>(access), 0); }
+  void add_load(SLoadOp load) { fbb_.AddElement<uint8_t>(SUse::VT_LOAD, static_cast<uint8_t>(load), 0); }
+  SUseBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SUseBuilder &operator=(const SUseBuilder &);
+  flatbuffers::Offset<SUse> Finish() {
+    auto o = flatbuffers::Offset<SUse>(fbb_.EndTable(start_, 3));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SUse> CreateSUse(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> texture = 0,
+    SAccess access = SAccess_Undefined,
+    SLoadOp load = SLoadOp_Load) {
+  SUseBuilder builder_(_fbb);
+  builder_.add_texture(texture);
+  builder_.add_load(load);
+  builder_.add_access(access);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SUse> CreateSUseDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    const char *texture = nullptr,
+    SAccess access = SAccess_Undefined,
+    SLoadOp load = SLoadOp_Load) {
+  return CreateSUse(_fbb, texture ? _fbb.CreateString(texture) : 0, access, load);
+}
+
+struct SPass FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_TYPE = 6,
+    VT_PIPELINE = 8,
+    VT_MINTIER = 10,
+    VT_MAXTIER = 12,
+    VT_READS = 14,
+    VT_WRITES = 16,
+    VT_SIDEEFFECT = 18
+  };
+  const flatbuffers::String *name() const { return GetPointer<const flatbuffers::String *>(VT_NAME); }
+  SPassType type() const { return static_cast<SPassType>(GetField<uint8_t>(VT_TYPE, 0)); }
+  const flatbuffers::String *pipeline() const { return GetPointer<const flatbuffers::String *>(VT_PIPELINE); }
+  uint8_t minTier() const { return GetField<uint8_t>(VT_MINTIER, 0); }
+  uint8_t maxTier() const { return GetField<uint8_t>(VT_MAXTIER, 255); }
+  const flatbuffers::Vector<flatbuffers::Offset<SUse>> *reads() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SUse>> *>(VT_READS); }
+  const flatbuffers::Vector<flatbuffers::Offset<SUse>> *writes() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SUse>> *>(VT_WRITES); }
+  bool sideEffect() const { return GetField<uint8_t>(VT_SIDEEFFECT, 0) != 0; }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<uint8_t>(verifier, VT_TYPE) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PIPELINE) &&
+           verifier.Verify(pipeline()) &&
+           VerifyField<uint8_t>(verifier, VT_MINTIER) &&
+           VerifyField<uint8_t>(verifier, VT_MAXTIER) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_READS) &&
+           verifier.Verify(reads()) &&
+           verifier.VerifyVectorOfTables(reads()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_WRITES) &&
+           verifier.Verify(writes()) &&
+           verifier.VerifyVectorOfTables(writes()) &&
+           VerifyField<uint8_t>(verifier, VT_SIDEEFFECT) &&
+           verifier.EndTable();
+  }
+};
+
+struct SPassBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) { fbb_.AddOffset(SPass::VT_NAME, name); }
+  void add_type(SPassType type) { fbb_.AddElement<uint8_t>(SPass::VT_TYPE, static_cast<uint8_t>(type), 0); }
+  void add_pipeline(flatbuffers::Offset<flatbuffers::String> pipeline) { fbb_.AddOffset(SPass::VT_PIPELINE, pipeline); }
+  void add_minTier(uint8_t minTier) { fbb_.AddElement<uint8_t>(SPass::VT_MINTIER, minTier, 0); }
+  void add_maxTier(uint8_t maxTier) { fbb_.AddElement<uint8_t>(SPass::VT_MAXTIER, maxTier, 255); }
+  void add_reads(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SUse>>> reads) { fbb_.AddOffset(SPass::VT_READS, reads); }
+  void add_writes(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SUse>>> writes) { fbb_.AddOffset(SPass::VT_WRITES, writes); }
+  void add_sideEffect(bool sideEffect) { fbb_.AddElement<uint8_t>(SPass::VT_SIDEEFFECT, static_cast<uint8_t>(sideEffect), 0); }
+  SPassBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SPassBuilder &operator=(const SPassBuilder &);
+  flatbuffers::Offset<SPass> Finish() {
+    auto o = flatbuffers::Offset<SPass>(fbb_.EndTable(start_, 8));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SPass> CreateSPass(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    SPassType type = SPassType_Graphics,
+    flatbuffers::Offset<flatbuffers::String> pipeline = 0,
+    uint8_t minTier = 0,
+    uint8_t maxTier = 255,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SUse>>> reads = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SUse>>> writes = 0,
+    bool sideEffect = false) {
+  SPassBuilder builder_(_fbb);
+  builder_.add_writes(writes);
+  builder_.add_reads(reads);
+  builder_.add_pipeline(pipeline);
+  builder_.add_name(name);
+  builder_.add_sideEffect(sideEffect);
+  builder_.add_maxTier(maxTier);
+  builder_.add_minTier(minTier);
+  builder_.add_type(type);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SPass> CreateSPassDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    const char *name = nullptr,
+    SPassType type = SPassType_Graphics,
+    const char *pipeline = nullptr,
+    uint8_t minTier = 0,
+    uint8_t maxTier = 255,
+    const std::vector<flatbuffers::Offset<SUse>> *reads = nullptr,
+    const std::vector<flatbuffers::Offset<SUse>> *writes = nullptr,
+    bool sideEffect = false) {
+  return CreateSPass(_fbb, name ? _fbb.CreateString(name) : 0, type, pipeline ? _fbb.CreateString(pipeline) : 0, minTier, maxTier, reads ? _fbb.CreateVector<flatbuffers::Offset<SUse>>(*reads) : 0, writes ? _fbb.CreateVector<flatbuffers::Offset<SUse>>(*writes) : 0, sideEffect);
+}
+
+struct SRenderGraph FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_TEXTURES = 4,
+    VT_PASSES = 6
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<STexture>> *textures() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<STexture>> *>(VT_TEXTURES); }
+  const flatbuffers::Vector<flatbuffers::Offset<SPass>> *passes() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SPass>> *>(VT_PASSES); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXTURES) &&
+           verifier.Verify(textures()) &&
+           verifier.VerifyVectorOfTables(textures()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PASSES) &&
+           verifier.Verify(passes()) &&
+           verifier.VerifyVectorOfTables(passes()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SRenderGraphBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_textures(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<STexture>>> textures) { fbb_.AddOffset(SRenderGraph::VT_TEXTURES, textures); }
+  void add_passes(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SPass>>> passes) { fbb_.AddOffset(SRenderGraph::VT_PASSES, passes); }
+  SRenderGraphBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SRenderGraphBuilder &operator=(const SRenderGraphBuilder &);
+  flatbuffers::Offset<SRenderGraph> Finish() {
+    auto o = flatbuffers::Offset<SRenderGraph>(fbb_.EndTable(start_, 2));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SRenderGraph> CreateSRenderGraph(flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<STexture>>> textures = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SPass>>> passes = 0) {
+  SRenderGraphBuilder builder_(_fbb);
+  builder_.add_passes(passes);
+  builder_.add_textures(textures);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SRenderGraph> CreateSRenderGraphDirect(flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<STexture>> *textures = nullptr,
+    const std::vector<flatbuffers::Offset<SPass>> *passes = nullptr) {
+  return CreateSRenderGraph(_fbb, textures ? _fbb.CreateVector<flatbuffers::Offset<STexture>>(*textures) : 0, passes ? _fbb.CreateVector<flatbuffers::Offset<SPass>>(*passes) : 0);
+}
+
+inline const m3d::schema::SRenderGraph *GetSRenderGraph(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SRenderGraph>(buf);
+}
+
+inline const char *SRenderGraphIdentifier() {
+  return "M3DG";
+}
+
+inline bool SRenderGraphBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SRenderGraphIdentifier());
+}
+
+inline bool VerifySRenderGraphBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SRenderGraph>(SRenderGraphIdentifier());
+}
+
+inline const char *SRenderGraphExtension() { return "m3dg"; }
+
+inline void FinishSRenderGraphBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SRenderGraph> root) {
+  fbb.Finish(root, SRenderGraphIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_RENDERGRAPH_M3D_SCHEMA_H_
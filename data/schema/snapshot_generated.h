@@ -0,0 +1,232 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+#ifndef FLATBUFFERS_GENERATED_SNAPSHOT_M3D_SCHEMA_H_
+#define FLATBUFFERS_GENERATED_SNAPSHOT_M3D_SCHEMA_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+#include "cooked_generated.h"
+#include "scene_generated.h"
+
+namespace m3d {
+namespace schema {
+
+struct SMeshReference;
+
+struct SSnapshotLight;
+
+struct SSnapshotCamera;
+
+struct SSnapshot;
+
+MANUALLY_ALIGNED_STRUCT(4) SMeshReference FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t source_;
+  uint32_t mesh_;
+
+ public:
+  SMeshReference() { memset(this, 0, sizeof(SMeshReference)); }
+  SMeshReference(const SMeshReference &_o) { memcpy(this, &_o, sizeof(SMeshReference)); }
+  SMeshReference(uint32_t _source, uint32_t _mesh)
+    : source_(flatbuffers::EndianScalar(_source)), mesh_(flatbuffers::EndianScalar(_mesh)) { }
+
+  uint32_t source() const { return flatbuffers::EndianScalar(source_); }
+  uint32_t mesh() const { return flatbuffers::EndianScalar(mesh_); }
+};
+STRUCT_END(SMeshReference, 8);
+
+MANUALLY_ALIGNED_STRUCT(4) SSnapshotLight FLATBUFFERS_FINAL_CLASS {
+ private:
+  uint32_t type_;
+  SVector3 color_;
+  float intensity_;
+  float range_;
+  float innerCone_;
+  float outerCone_;
+  uint32_t transform_;
+
+ public:
+  SSnapshotLight() { memset(this, 0, sizeof(SSnapshotLight)); }
+  SSnapshotLight(const SSnapshotLight &_o) { memcpy(this, &_o, sizeof(SSnapshotLight)); }
+  SSnapshotLight(uint32_t _type, const SVector3 &_color, float _intensity, float _range, float _innerCone, float _outerCone, uint32_t _transform)
+    : type_(flatbuffers::EndianScalar(_type)), color_(_color), intensity_(flatbuffers::EndianScalar(_intensity)), range_(flatbuffers::EndianScalar(_range)), innerCone_(flatbuffers::EndianScalar(_innerCone)), outerCone_(flatbuffers::EndianScalar(_outerCone)), transform_(flatbuffers::EndianScalar(_transform)) { }
+
+  uint32_t type() const { return flatbuffers::EndianScalar(type_); }
+  const SVector3 &color() const { return color_; }
+  float intensity() const { return flatbuffers::EndianScalar(intensity_); }
+  float range() const { return flatbuffers::EndianScalar(range_); }
+  float innerCone() const { return flatbuffers::EndianScalar(innerCone_); }
+  float outerCone() const { return flatbuffers::EndianScalar(outerCone_); }
+  uint32_t transform() const { return flatbuffers::EndianScalar(transform_); }
+};
+STRUCT_END(SSnapshotLight, 36);
+
+MANUALLY_ALIGNED_STRUCT(4) SSnapshotCamera FLATBUFFERS_FINAL_CLASS {
+ private:
+  SVector3 eye_;
+  SVector3 target_;
+  SVector3 up_;
+  float fovY_;
+  float aspect_;
+  float nearZ_;
+  float farZ_;
+
+ public:
+  SSnapshotCamera() { memset(this, 0, sizeof(SSnapshotCamera)); }
+  SSnapshotCamera(const SSnapshotCamera &_o) { memcpy(this, &_o, sizeof(SSnapshotCamera)); }
+  SSnapshotCamera(const SVector3 &_eye, const SVector3 &_target, const SVector3 &_up, float _fovY, float _aspect, float _nearZ, float _farZ)
+    : eye_(_eye), target_(_target), up_(_up), fovY_(flatbuffers::EndianScalar(_fovY)), aspect_(flatbuffers::EndianScalar(_aspect)), nearZ_(flatbuffers::EndianScalar(_nearZ)), farZ_(flatbuffers::EndianScalar(_farZ)) { }
+
+  const SVector3 &eye() const { return eye_; }
+  const SVector3 &target() const { return target_; }
+  const SVector3 &up() const { return up_; }
+  float fovY() const { return flatbuffers::EndianScalar(fovY_); }
+  float aspect() const { return flatbuffers::EndianScalar(aspect_); }
+  float nearZ() const { return flatbuffers::EndianScalar(nearZ_); }
+  float farZ() const { return flatbuffers::EndianScalar(farZ_); }
+};
+STRUCT_END(SSnapshotCamera, 52);
+
+struct SSnapshot FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_VERSION = 4,
+    VT_SOURCES = 6,
+    VT_MESHES = 8,
+    VT_MESHMATERIALS = 10,
+    VT_MESHMATERIALCOUNTS = 12,
+    VT_MATERIALS = 14,
+    VT_TEXTURES = 16,
+    VT_TRANSFORMS = 18,
+    VT_PARENTS = 20,
+    VT_INSTANCES = 22,
+    VT_LIGHTS = 24,
+    VT_CAMERAS = 26,
+    VT_MAINCAMERA = 28
+  };
+  uint32_t version() const { return GetField<uint32_t>(VT_VERSION, 0); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *sources() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_SOURCES); }
+  const flatbuffers::Vector<const SMeshReference *> *meshes() const { return GetPointer<const flatbuffers::Vector<const SMeshReference *> *>(VT_MESHES); }
+  const flatbuffers::Vector<uint32_t> *meshMaterials() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_MESHMATERIALS); }
+  const flatbuffers::Vector<uint32_t> *meshMaterialCounts() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_MESHMATERIALCOUNTS); }
+  const flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>> *materials() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>> *>(VT_MATERIALS); }
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *textures() const { return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *>(VT_TEXTURES); }
+  const flatbuffers::Vector<const SCookedTransform *> *transforms() const { return GetPointer<const flatbuffers::Vector<const SCookedTransform *> *>(VT_TRANSFORMS); }
+  const flatbuffers::Vector<uint32_t> *parents() const { return GetPointer<const flatbuffers::Vector<uint32_t> *>(VT_PARENTS); }
+  const flatbuffers::Vector<const SCookedInstance *> *instances() const { return GetPointer<const flatbuffers::Vector<const SCookedInstance *> *>(VT_INSTANCES); }
+  const flatbuffers::Vector<const SSnapshotLight *> *lights() const { return GetPointer<const flatbuffers::Vector<const SSnapshotLight *> *>(VT_LIGHTS); }
+  const flatbuffers::Vector<const SSnapshotCamera *> *cameras() const { return GetPointer<const flatbuffers::Vector<const SSnapshotCamera *> *>(VT_CAMERAS); }
+  uint32_t mainCamera() const { return GetField<uint32_t>(VT_MAINCAMERA, 4294967295); }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_VERSION) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_SOURCES) &&
+           verifier.Verify(sources()) &&
+           verifier.VerifyVectorOfStrings(sources()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MESHES) &&
+           verifier.Verify(meshes()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MESHMATERIALS) &&
+           verifier.Verify(meshMaterials()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MESHMATERIALCOUNTS) &&
+           verifier.Verify(meshMaterialCounts()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_MATERIALS) &&
+           verifier.Verify(materials()) &&
+           verifier.VerifyVectorOfTables(materials()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TEXTURES) &&
+           verifier.Verify(textures()) &&
+           verifier.VerifyVectorOfStrings(textures()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_TRANSFORMS) &&
+           verifier.Verify(transforms()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_PARENTS) &&
+           verifier.Verify(parents()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_INSTANCES) &&
+           verifier.Verify(instances()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_LIGHTS) &&
+           verifier.Verify(lights()) &&
+           VerifyField<flatbuffers::uoffset_t>(verifier, VT_CAMERAS) &&
+           verifier.Verify(cameras()) &&
+           VerifyField<uint32_t>(verifier, VT_MAINCAMERA) &&
+           verifier.EndTable();
+  }
+};
+
+struct SSnapshotBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_version(uint32_t version) { fbb_.AddElement<uint32_t>(SSnapshot::VT_VERSION, version, 0); }
+  void add_sources(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> sources) { fbb_.AddOffset(SSnapshot::VT_SOURCES, sources); }
+  void add_meshes(flatbuffers::Offset<flatbuffers::Vector<const SMeshReference *>> meshes) { fbb_.AddOffset(SSnapshot::VT_MESHES, meshes); }
+  void add_meshMaterials(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> meshMaterials) { fbb_.AddOffset(SSnapshot::VT_MESHMATERIALS, meshMaterials); }
+  void add_meshMaterialCounts(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> meshMaterialCounts) { fbb_.AddOffset(SSnapshot::VT_MESHMATERIALCOUNTS, meshMaterialCounts); }
+  void add_materials(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>>> materials) { fbb_.AddOffset(SSnapshot::VT_MATERIALS, materials); }
+  void add_textures(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures) { fbb_.AddOffset(SSnapshot::VT_TEXTURES, textures); }
+  void add_transforms(flatbuffers::Offset<flatbuffers::Vector<const SCookedTransform *>> transforms) { fbb_.AddOffset(SSnapshot::VT_TRANSFORMS, transforms); }
+  void add_parents(flatbuffers::Offset<flatbuffers::Vector<uint32_t>> parents) { fbb_.AddOffset(SSnapshot::VT_PARENTS, parents); }
+  void add_instances(flatbuffers::Offset<flatbuffers::Vector<const SCookedInstance *>> instances) { fbb_.AddOffset(SSnapshot::VT_INSTANCES, instances); }
+  void add_lights(flatbuffers::Offset<flatbuffers::Vector<const SSnapshotLight *>> lights) { fbb_.AddOffset(SSnapshot::VT_LIGHTS, lights); }
+  void add_cameras(flatbuffers::Offset<flatbuffers::Vector<const SSnapshotCamera *>> cameras) { fbb_.AddOffset(SSnapshot::VT_CAMERAS, cameras); }
+  void add_mainCamera(uint32_t mainCamera) { fbb_.AddElement<uint32_t>(SSnapshot::VT_MAINCAMERA, mainCamera, 4294967295); }
+  SSnapshotBuilder(flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) { start_ = fbb_.StartTable(); }
+  SSnapshotBuilder &operator=(const SSnapshotBuilder &);
+  flatbuffers::Offset<SSnapshot> Finish() {
+    auto o = flatbuffers::Offset<SSnapshot>(fbb_.EndTable(start_, 13));
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SSnapshot> CreateSSnapshot(flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t version = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> sources = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SMeshReference *>> meshes = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> meshMaterials = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> meshMaterialCounts = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<SCookedMaterial>>> materials = 0,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>> textures = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCookedTransform *>> transforms = 0,
+    flatbuffers::Offset<flatbuffers::Vector<uint32_t>> parents = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SCookedInstance *>> instances = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SSnapshotLight *>> lights = 0,
+    flatbuffers::Offset<flatbuffers::Vector<const SSnapshotCamera *>> cameras = 0,
+    uint32_t mainCamera = 4294967295) {
+  SSnapshotBuilder builder_(_fbb);
+  builder_.add_mainCamera(mainCamera);
+  builder_.add_cameras(cameras);
+  builder_.add_lights(lights);
+  builder_.add_instances(instances);
+  builder_.add_parents(parents);
+  builder_.add_transforms(transforms);
+  builder_.add_textures(textures);
+  builder_.add_materials(materials);
+  builder_.add_meshMaterialCounts(meshMaterialCounts);
+  builder_.add_meshMaterials(meshMaterials);
+  builder_.add_meshes(meshes);
+  builder_.add_sources(sources);
+  builder_.add_version(version);
+  return builder_.Finish();
+}
+
+inline const m3d::schema::SSnapshot *GetSSnapshot(const void *buf) {
+  return flatbuffers::GetRoot<m3d::schema::SSnapshot>(buf);
+}
+
+inline const char *SSnapshotIdentifier() {
+  return "M3DS";
+}
+
+inline bool SSnapshotBufferHasIdentifier(const void *buf) {
+  return flatbuffers::BufferHasIdentifier(buf, SSnapshotIdentifier());
+}
+
+inline bool VerifySSnapshotBuffer(flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<m3d::schema::SSnapshot>(SSnapshotIdentifier());
+}
+
+inline const char *SSnapshotExtension() { return "m3ds"; }
+
+inline void FinishSSnapshotBuffer(flatbuffers::FlatBufferBuilder &fbb, flatbuffers::Offset<m3d::schema::SSnapshot> root) {
+  fbb.Finish(root, SSnapshotIdentifier());
+}
+
+}  // namespace schema
+}  // namespace m3d
+
+#endif  // FLATBUFFERS_GENERATED_SNAPSHOT_M3D_SCHEMA_H_
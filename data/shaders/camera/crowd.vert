@@ -0,0 +1,105 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// m3d::animation::SkinnedVertex, straight from the bind pose
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inNormal;
+layout (location = 2) in vec2 inUV;
+layout (location = 3) in uvec4 inJoints;
+// the fourth weight is 1 minus these
+layout (location = 4) in vec3 inWeights;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+
+// set 0 is the scene pipeline's
+layout (set = 0, binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+// CrowdRenderer::GpuAgent, the agents of a mesh are the instances of its command
+struct Agent
+{
+	mat3x4 world;
+	uint clip;
+	float timeOffset;
+	float speed;
+	uint pad;
+};
+
+// CrowdRenderer::GpuClip
+struct Clip
+{
+	uint firstMatrix;
+	uint frameCount;
+	uint jointCount;
+	uint loop;
+	float frameRate;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Agents
+{
+	Agent agents[];
+};
+
+// m3d::animation::BakedAnimation::palettes of every animation, frame after frame
+layout (std430, set = 1, binding = 1) readonly buffer Palettes
+{
+	mat3x4 palettes[];
+};
+
+layout (std430, set = 1, binding = 2) readonly buffer Clips
+{
+	Clip clips[];
+};
+
+layout (set = 1, binding = 3) uniform Frame
+{
+	float time;
+} frame;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+void main()
+{
+	Agent agent = agents[gl_InstanceIndex];
+	Clip clip = clips[agent.clip];
+
+	// the two baked frames around the agent's time, wrapped or clamped like SampleClip
+	float lastFrame = float(clip.frameCount - 1);
+	float position = (frame.time + agent.timeOffset) * agent.speed * clip.frameRate;
+	if (clip.loop != 0u && lastFrame > 0.0) {
+		position = mod(position, lastFrame);
+	} else {
+		position = clamp(position, 0.0, lastFrame);
+	}
+	uint frame0 = min(uint(position), clip.frameCount - 1);
+	uint frame1 = min(frame0 + 1, clip.frameCount - 1);
+	float alpha = position - float(frame0);
+	uint first0 = clip.firstMatrix + frame0 * clip.jointCount;
+	uint first1 = clip.firstMatrix + frame1 * clip.jointCount;
+
+	// row vectors times the palettes, like skinning.comp, each joint blended between both frames
+	vec4 weights = vec4(inWeights, 1.0 - inWeights.x - inWeights.y - inWeights.z);
+	mat3x4 skin = (palettes[first0 + inJoints.x] * (1.0 - alpha) + palettes[first1 + inJoints.x] * alpha) * weights.x
+		+ (palettes[first0 + inJoints.y] * (1.0 - alpha) + palettes[first1 + inJoints.y] * alpha) * weights.y
+		+ (palettes[first0 + inJoints.z] * (1.0 - alpha) + palettes[first1 + inJoints.z] * alpha) * weights.z
+		+ (palettes[first0 + inJoints.w] * (1.0 - alpha) + palettes[first1 + inJoints.w] * alpha) * weights.w;
+	vec3 modelPos = vec4(inPos, 1.0) * skin;
+	vec3 worldPos = vec4(modelPos, 1.0) * agent.world;
+	// joint poses and agents scale uniformly, the upper 3x3 keep normals perpendicular
+	outNormal = normalize(inNormal * mat3(skin) * mat3(agent.world));
+	outUV = inUV;
+	gl_Position = vec4(worldPos, 1.0) * ubo.viewMatrix * ubo.projectionMatrix;
+}
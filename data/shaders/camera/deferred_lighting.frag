@@ -0,0 +1,194 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inNdc;
+
+layout (location = 0) out vec4 outFragColor;
+
+// Pipeline::UniformBlock, the camera and the cascades of the main directional light
+layout (set = 0, binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+	// world to cascade, z in [0, 1]
+	mat4 shadowMatrices[4];
+	// view depth each cascade ends at
+	vec4 cascadeSplits;
+	uint cascadeCount;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+} ubo;
+
+// std430 layout of ClusteredLights::GpuLight, world space
+struct Light
+{
+	// xyz position, w range
+	vec4 position;
+	// rgb color * intensity, w type
+	vec4 color;
+	// xyz direction, w cos of the outer cone
+	vec4 direction;
+	// x cos of the inner cone
+	vec4 cone;
+};
+
+// the same block light_cluster.comp clustered with
+layout (set = 0, binding = 5) uniform ClusterParams
+{
+	mat4 viewMatrix;
+	vec4 unproject;
+	// near, far, slice scale, slice bias: slice = log(depth) * scale - bias
+	vec4 depth;
+	vec4 ambient;
+	uvec4 grid;
+	uint lightCount;
+	uint directionalCount;
+	uint pad0;
+	uint pad1;
+} params;
+
+layout (std430, set = 0, binding = 6) readonly buffer Lights
+{
+	Light lights[];
+};
+
+// the light count of every cluster, then grid.w light indices per cluster
+layout (std430, set = 0, binding = 7) readonly buffer Clusters
+{
+	uint clusters[];
+};
+
+// ShadowCascades, one layer per cascade, compared against on sampling
+layout (set = 0, binding = 8) uniform sampler2DArrayShadow shadowMap;
+
+// std430 layout of ShadowAtlas::GpuFace
+struct ShadowFace
+{
+	// world to the face's clip space, z in [0, 1]
+	mat4 matrix;
+	// atlas uv of the tile's corner, its size and half an atlas texel
+	vec4 rect;
+};
+
+layout (std430, set = 0, binding = 9) readonly buffer LocalShadows
+{
+	// of every point and spot light, by its index in lights after the directional ones
+	uint firstFaces[1024];
+	ShadowFace faces[];
+};
+
+// ShadowAtlas, a tile per spot light and six per point light, compared against on sampling
+layout (set = 0, binding = 10) uniform sampler2DShadow shadowAtlas;
+
+// what indirect_gbuffer.frag wrote at this pixel
+layout (input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput albedo;
+layout (input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput normals;
+layout (input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput depth;
+
+// Light::Type
+const float spotLight = 1.0;
+// ShadowAtlas::NoShadow
+const uint noShadow = 0xFFFFFFFF;
+
+// windowed inverse square, nothing is left at the range
+float attenuation(float distance, float range)
+{
+	float ratio = distance / range;
+	float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+	return window * window / (distance * distance + 1.0);
+}
+
+// 1 lit, 0 shadowed, by the first cascade that reaches past viewDepth
+float shadow(vec3 worldPos, float viewDepth)
+{
+	for (uint cascade = 0; cascade < ubo.cascadeCount; ++cascade) {
+		if (viewDepth <= ubo.cascadeSplits[cascade]) {
+			vec3 p = (vec4(worldPos, 1.0) * ubo.shadowMatrices[cascade]).xyz;
+			return texture(shadowMap, vec4(p.xy * 0.5 + 0.5, float(cascade), p.z));
+		}
+	}
+	return 1.0;
+}
+
+// 1 lit, 0 shadowed, by the tile of lights[index]; a point light's face is the one of the major axis towards the pixel
+float localShadow(uint index, vec3 worldPos)
+{
+	uint face = firstFaces[index - params.directionalCount];
+	if (face == noShadow) {
+		return 1.0;
+	}
+	Light light = lights[index];
+	if (light.color.w != spotLight) {
+		// +x, -x, +y, -y, +z, -z as ShadowAtlas places them
+		vec3 d = worldPos - light.position.xyz;
+		vec3 a = abs(d);
+		face += a.x >= a.y && a.x >= a.z ? (d.x >= 0.0 ? 0u : 1u) : (a.y >= a.z ? (d.y >= 0.0 ? 2u : 3u) : (d.z >= 0.0 ? 4u : 5u));
+	}
+	vec4 p = vec4(worldPos, 1.0) * faces[face].matrix;
+	if (p.w <= 0.0) {
+		return 1.0;
+	}
+	p.xyz /= p.w;
+	// the filter stays inside the tile
+	vec4 rect = faces[face].rect;
+	vec2 uv = clamp(rect.xy + (p.xy * 0.5 + 0.5) * rect.z, rect.xy + rect.w, rect.xy + rect.z - rect.w);
+	return texture(shadowAtlas, vec3(uv, p.z));
+}
+
+vec3 pointLight(uint index, vec3 worldPos, vec3 normal)
+{
+	Light light = lights[index];
+	vec3 toLight = light.position.xyz - worldPos;
+	float distance = length(toLight);
+	vec3 l = toLight / max(distance, 1e-4);
+	float intensity = attenuation(distance, light.position.w);
+	if (light.color.w == spotLight) {
+		intensity *= smoothstep(light.direction.w, light.cone.x, dot(-l, light.direction.xyz));
+	}
+	return light.color.rgb * intensity * max(dot(normal, l), 0.0) * localShadow(index, worldPos);
+}
+
+void main()
+{
+	// the clear color stays where no indirect draw covers the pixel, forward draws follow
+	float shadowDepth = subpassLoad(depth).r;
+	if (shadowDepth <= 0.0) {
+		discard;
+	}
+
+	// back through the projection, then the rigid camera transform: view = world * R + t, world = R (view - t)
+	vec4 unproject = vec4(ubo.projectionMatrix[0][0], ubo.projectionMatrix[1][1], ubo.projectionMatrix[0][2], ubo.projectionMatrix[1][2]);
+	vec3 cameraPos = vec3((inNdc + unproject.zw) * shadowDepth / unproject.xy, -shadowDepth);
+	vec3 translation = vec3(ubo.viewMatrix[0].w, ubo.viewMatrix[1].w, ubo.viewMatrix[2].w);
+	vec3 worldPos = mat3(ubo.viewMatrix) * (cameraPos - translation);
+
+	vec4 color = subpassLoad(albedo);
+	vec3 normal = normalize(subpassLoad(normals).xyz * 2.0 - 1.0);
+	vec3 light = params.ambient.rgb;
+	for (uint i = 0; i < params.directionalCount; ++i) {
+		// the first one is the main light ShadowCascades draws
+		float lit = i == 0 ? shadow(worldPos, shadowDepth) : 1.0;
+		light += lights[i].color.rgb * max(dot(normal, -lights[i].direction.xyz), 0.0) * lit;
+	}
+
+	// the cluster of the pixel in the camera the clusters were built for
+	vec3 viewPos = (vec4(worldPos, 1.0) * params.viewMatrix).xyz;
+	float viewDepth = max(-viewPos.z, params.depth.x);
+	vec2 ndc = viewPos.xy * params.unproject.xy / viewDepth - params.unproject.zw;
+	uvec3 cell;
+	cell.xy = uvec2(clamp((ndc * 0.5 + 0.5) * vec2(params.grid.xy), vec2(0.0), vec2(params.grid.xy - 1)));
+	cell.z = uint(clamp(log(viewDepth) * params.depth.z - params.depth.w, 0.0, float(params.grid.z - 1)));
+	uint cluster = cell.x + params.grid.x * (cell.y + params.grid.y * cell.z);
+
+	uint clusterCount = params.grid.x * params.grid.y * params.grid.z;
+	uint count = clusters[cluster];
+	uint listBase = clusterCount + cluster * params.grid.w;
+	for (uint i = 0; i < count; ++i) {
+		light += pointLight(clusters[listBase + i], worldPos, normal);
+	}
+	outFragColor = vec4(color.rgb * light, color.a);
+}
@@ -0,0 +1,20 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// the fragment's position in normalized device coordinates, with the scene's viewport
+layout (location = 0) out vec2 outNdc;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// one triangle over the whole render area, drawn with three vertices and no buffers
+void main()
+{
+	vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	outNdc = corner * 2.0 - 1.0;
+	gl_Position = vec4(outNdc, 0.0, 1.0);
+}
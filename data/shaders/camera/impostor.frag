@@ -0,0 +1,26 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) flat in uint inLayer;
+layout (location = 2) flat in uint inTransform;
+
+layout (location = 0) out vec4 outFragColor;
+// Pipeline's ID buffer, discarded without one
+layout (location = 1) out uvec2 outId;
+
+// ImpostorRenderer's atlas, one layer per baked mesh
+layout (set = 1, binding = 3) uniform sampler2DArray atlas;
+
+void main()
+{
+	vec4 color = texture(atlas, vec3(inUV, float(inLayer)));
+	// the frames are cleared transparent around the mesh
+	if (color.a < 0.5) {
+		discard;
+	}
+	outId = uvec2(inTransform, 0u);
+	outFragColor = vec4(color.rgb, 1.0);
+}
@@ -0,0 +1,102 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) out vec2 outUV;
+// atlas layer of the instance's mesh
+layout (location = 1) flat out uint outLayer;
+// transform entry of the instance, for the ID buffer
+layout (location = 2) flat out uint outTransform;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+layout (std430, binding = 1) readonly buffer InstanceTransforms
+{
+	mat4 modelMatrices[];
+};
+
+// ImpostorRenderer::GpuInstance
+struct Instance
+{
+	uint transform;
+	uint layer;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+// ImpostorRenderer::GpuImpostor per atlas layer, the object space bounding sphere
+layout (std430, set = 1, binding = 1) readonly buffer Impostors
+{
+	vec4 spheres[];
+};
+
+layout (set = 1, binding = 2) uniform Frame
+{
+	vec4 eye;
+} frame;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// ImpostorRenderer::FramesPerSide
+const float framesPerSide = 8.0;
+
+// two triangles of the quad, corners in [-1, 1]^2
+const vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+	vec2(-1.0, 1.0), vec2(1.0, -1.0), vec2(1.0, 1.0)
+);
+
+vec2 encodeOctahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0) {
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return e;
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main()
+{
+	Instance instance = instances[gl_InstanceIndex];
+	mat4 model = modelMatrices[instance.transform];
+	vec4 sphere = spheres[instance.layer];
+	vec3 center = (vec4(sphere.xyz, 1.0) * model).xyz;
+
+	// the frame baked closest to the object space direction of the eye
+	vec3 toEye = normalize(mat3(model) * (frame.eye.xyz - center));
+	vec2 cell = clamp(floor((encodeOctahedral(toEye) * 0.5 + 0.5) * framesPerSide), 0.0, framesPerSide - 1.0);
+	vec3 forward = decodeOctahedral((cell + 0.5) / framesPerSide * 2.0 - 1.0);
+	// ImpostorRenderer's frameBasis
+	vec3 worldUp = abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+	vec3 right = normalize(cross(worldUp, forward));
+	vec3 up = cross(forward, right);
+
+	vec2 corner = corners[gl_VertexIndex];
+	vec3 worldPos = center + (vec4(right, 0.0) * model).xyz * corner.x * sphere.w + (vec4(up, 0.0) * model).xyz * corner.y * sphere.w;
+	outUV = (cell + vec2(corner.x * 0.5 + 0.5, 0.5 - corner.y * 0.5)) / framesPerSide;
+	outLayer = instance.layer;
+	outTransform = instance.transform;
+	gl_Position = vec4(worldPos, 1.0) * ubo.viewMatrix * ubo.projectionMatrix;
+}
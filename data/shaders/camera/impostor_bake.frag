@@ -0,0 +1,52 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+// ImpostorRenderer::BakeConstants
+layout (push_constant) uniform Frame
+{
+	vec4 sphere;
+	vec4 right;
+	vec4 up;
+	vec4 forward;
+	uint material;
+} frame;
+
+// std430 layout of MaterialTable::GpuMaterial
+struct Material
+{
+	vec4 diffuse;
+	uint texture;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, binding = 3) readonly buffer Materials
+{
+	Material materials[];
+};
+
+// Pipeline::MaxTextures, unused elements hold a white texel
+layout (binding = 4) uniform sampler2D textures[1024];
+
+const uint invalidIndex = 0xFFFFFFFF;
+
+void main()
+{
+	// as indirect.frag, opaque wherever the mesh covers the frame
+	vec3 color = vec3(1.0, 0.0, 0.0);
+	if (frame.material != invalidIndex) {
+		Material material = materials[frame.material];
+		color = material.diffuse.rgb;
+		if (material.texture != invalidIndex) {
+			color *= texture(textures[material.texture], inUV).rgb;
+		}
+	}
+	outFragColor = vec4(color, 1.0);
+}
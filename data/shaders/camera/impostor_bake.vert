@@ -0,0 +1,32 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inPos;
+layout (location = 2) in vec2 inUV;
+
+layout (location = 0) out vec2 outUV;
+
+// ImpostorRenderer::BakeConstants, object space
+layout (push_constant) uniform Frame
+{
+	vec4 sphere;
+	vec4 right;
+	vec4 up;
+	vec4 forward;
+	uint material;
+} frame;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+void main()
+{
+	// orthographic over the bounding sphere, looking down -forward; depth 0 on the viewer's side
+	vec3 p = (inPos - frame.sphere.xyz) / frame.sphere.w;
+	outUV = inUV;
+	gl_Position = vec4(dot(p, frame.right.xyz), -dot(p, frame.up.xyz), 0.5 - 0.5 * dot(p, frame.forward.xyz), 1.0);
+}
@@ -0,0 +1,49 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+layout (location = 4) flat in uint inTransform;
+
+layout (location = 0) out vec4 outFragColor;
+// Pipeline's ID buffer, discarded without one
+layout (location = 1) out uvec2 outId;
+
+// std430 layout of MaterialTable::GpuMaterial
+struct Material
+{
+	vec4 diffuse;
+	uint texture;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, binding = 3) readonly buffer Materials
+{
+	Material materials[];
+};
+
+// Pipeline::MaxTextures, unused elements hold a white texel
+layout (binding = 4) uniform sampler2D textures[1024];
+
+const uint invalidIndex = 0xFFFFFFFF;
+
+void main()
+{
+	outId = uvec2(inTransform, uint(gl_PrimitiveID));
+	if (inMaterial == invalidIndex) {
+		outFragColor = vec4(1.0, 0.0, 0.0, 1.0);
+		return;
+	}
+	Material material = materials[inMaterial];
+	vec4 color = material.diffuse;
+	// the same for every fragment of a draw, dynamically uniform
+	if (material.texture != invalidIndex) {
+		color *= texture(textures[material.texture], inUV);
+	}
+	outFragColor = color;
+}
@@ -0,0 +1,63 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+layout (location = 4) flat in uint inTransform;
+
+layout (location = 0) out vec4 outFragColor;
+// Pipeline's ID buffer, discarded without one
+layout (location = 1) out uvec2 outId;
+
+// std430 layout of MaterialTable::GpuMaterial, texture is the array
+struct Material
+{
+	vec4 diffuse;
+	uint texture;
+	uint layer;
+	uint pad0;
+	uint pad1;
+};
+
+layout (std430, binding = 3) readonly buffer Materials
+{
+	Material materials[];
+};
+
+// Pipeline::MaxTextureArrays, unused elements hold a white texel
+layout (binding = 4) uniform sampler2DArray textureArrays[8];
+
+const uint invalidIndex = 0xFFFFFFFF;
+
+// constant indices only, the device cannot index sampler arrays dynamically
+vec4 sampleArray(uint array, vec3 uvw)
+{
+	switch (array) {
+	case 0: return texture(textureArrays[0], uvw);
+	case 1: return texture(textureArrays[1], uvw);
+	case 2: return texture(textureArrays[2], uvw);
+	case 3: return texture(textureArrays[3], uvw);
+	case 4: return texture(textureArrays[4], uvw);
+	case 5: return texture(textureArrays[5], uvw);
+	case 6: return texture(textureArrays[6], uvw);
+	default: return texture(textureArrays[7], uvw);
+	}
+}
+
+void main()
+{
+	outId = uvec2(inTransform, uint(gl_PrimitiveID));
+	if (inMaterial == invalidIndex) {
+		outFragColor = vec4(1.0, 0.0, 0.0, 1.0);
+		return;
+	}
+	Material material = materials[inMaterial];
+	vec4 color = material.diffuse;
+	if (material.texture != invalidIndex) {
+		color *= sampleArray(material.texture, vec3(inUV, float(material.layer)));
+	}
+	outFragColor = color;
+}
@@ -0,0 +1,64 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+layout (location = 3) in vec3 inWorldPos;
+layout (location = 4) flat in uint inTransform;
+
+// Pipeline::GBufferAlbedoFormat, the material's color
+layout (location = 0) out vec4 outAlbedo;
+// Pipeline::GBufferNormalFormat, the world space normal in [0, 1]
+layout (location = 1) out vec4 outNormal;
+// Pipeline::GBufferDepthFormat, the view depth, 0 where nothing was drawn
+layout (location = 2) out float outDepth;
+// Pipeline's ID buffer, discarded without one
+layout (location = 3) out uvec2 outId;
+
+// Pipeline::UniformBlock, the camera only
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+// std430 layout of MaterialTable::GpuMaterial
+struct Material
+{
+	vec4 diffuse;
+	uint texture;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, binding = 3) readonly buffer Materials
+{
+	Material materials[];
+};
+
+// Pipeline::MaxTextures, unused elements hold a white texel
+layout (binding = 4) uniform sampler2D textures[1024];
+
+const uint invalidIndex = 0xFFFFFFFF;
+
+void main()
+{
+	outId = uvec2(inTransform, uint(gl_PrimitiveID));
+	vec4 color = vec4(1.0, 0.0, 0.0, 1.0);
+	if (inMaterial != invalidIndex) {
+		Material material = materials[inMaterial];
+		color = material.diffuse;
+		// the same for every fragment of a draw, dynamically uniform
+		if (material.texture != invalidIndex) {
+			color *= texture(textures[material.texture], inUV);
+		}
+	}
+	outAlbedo = color;
+	outNormal = vec4(normalize(inNormal) * 0.5 + 0.5, 0.0);
+	outDepth = -(vec4(inWorldPos, 1.0) * ubo.viewMatrix).z;
+}
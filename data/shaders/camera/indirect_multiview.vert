@@ -0,0 +1,81 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_multiview : enable
+
+layout (location = 0) in vec3 inPos;
+// octahedral encoded, see Mesh::pack
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in vec2 inUV;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+// scene material id, constant over a draw
+layout (location = 2) flat out uint outMaterial;
+// lit shading only, lights and clusters are in world space
+layout (location = 3) out vec3 outWorldPos;
+// transform entry of the draw, for the ID buffer
+layout (location = 4) flat out uint outTransform;
+
+// Pipeline's uniform block up to the matrices of every view
+layout (binding = 0) uniform UBO 
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+	mat4 shadowMatrices[4];
+	vec4 cascadeSplits;
+	uint cascadeCount;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+	// Pipeline::MaxViews
+	mat4 viewMatrices[4];
+	mat4 projectionMatrices[4];
+} ubo;
+
+layout (std430, binding = 1) readonly buffer InstanceTransforms
+{
+	mat4 modelMatrices[];
+};
+
+struct DrawInfo
+{
+	uint transform;
+	uint material;
+};
+
+// firstInstance of each indirect command selects its draw info
+layout (std430, binding = 2) readonly buffer DrawInfos
+{
+	DrawInfo drawInfos[];
+};
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() 
+{
+	DrawInfo drawInfo = drawInfos[gl_InstanceIndex];
+	mat4 model = modelMatrices[drawInfo.transform];
+	// world space, scaling is uniform enough for the normal to stay perpendicular
+	outNormal = normalize((vec4(decodeOctahedral(inNormal), 0.0) * model).xyz);
+	outUV = inUV;
+	outMaterial = drawInfo.material;
+	outTransform = drawInfo.transform;
+	vec4 worldPos = vec4(inPos, 1.0) * model;
+	outWorldPos = worldPos.xyz;
+	gl_Position = worldPos * ubo.viewMatrices[gl_ViewIndex] * ubo.projectionMatrices[gl_ViewIndex];
+}
@@ -0,0 +1,52 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inNormal;
+layout (location = 1) in vec2 inUV;
+layout (location = 2) flat in uint inMaterial;
+
+// Pipeline::AccumFormat, premultiplied color and coverage times the weight, summed
+layout (location = 0) out vec4 outAccumulation;
+// Pipeline::RevealFormat, the coverage; the attachment keeps the product of one minus it
+layout (location = 1) out float outRevealage;
+
+// std430 layout of MaterialTable::GpuMaterial
+struct Material
+{
+	vec4 diffuse;
+	uint texture;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+layout (std430, binding = 3) readonly buffer Materials
+{
+	Material materials[];
+};
+
+// Pipeline::MaxTextures, unused elements hold a white texel
+layout (binding = 4) uniform sampler2D textures[1024];
+
+const uint invalidIndex = 0xFFFFFFFF;
+
+void main()
+{
+	vec4 color = vec4(1.0, 0.0, 0.0, 1.0);
+	if (inMaterial != invalidIndex) {
+		Material material = materials[inMaterial];
+		color = material.diffuse;
+		// the same for every fragment of a draw, dynamically uniform
+		if (material.texture != invalidIndex) {
+			color *= texture(textures[material.texture], inUV);
+		}
+	}
+
+	// McGuire and Bavoil's weight of window depth, near fragments count for more
+	float alpha = clamp(color.a, 0.0, 1.0);
+	float weight = alpha * max(1e-2, 3e3 * pow(1.0 - gl_FragCoord.z, 3.0));
+	outAccumulation = vec4(color.rgb * alpha, alpha) * weight;
+	outRevealage = alpha;
+}
@@ -0,0 +1,91 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+
+// indirect.vert without vertex input: the vertex, its instance's world matrix and draw info are read
+// through the addresses of Pipeline::PullConstants
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+// scene material id, constant over a draw
+layout (location = 2) flat out uint outMaterial;
+// lit shading only, lights and clusters are in world space
+layout (location = 3) out vec3 outWorldPos;
+// transform entry of the draw, for the ID buffer
+layout (location = 4) flat out uint outTransform;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+// a GeometryArena block, m3d::PackedVertex is 5 words
+layout (buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertices
+{
+	uint words[];
+};
+
+layout (buffer_reference, std430, buffer_reference_align = 16) readonly buffer InstanceTransforms
+{
+	mat4 modelMatrices[];
+};
+
+struct DrawInfo
+{
+	uint transform;
+	uint material;
+};
+
+layout (buffer_reference, std430, buffer_reference_align = 8) readonly buffer DrawInfos
+{
+	DrawInfo drawInfos[];
+};
+
+// Pipeline::PullConstants behind Pipeline::DrawConstants, which the triangle shaders declare
+layout (push_constant) uniform PullConstants
+{
+	layout (offset = 80) uvec2 vertices;
+	uvec2 transforms;
+	uvec2 drawInfos;
+} pull;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main()
+{
+	// vertexOffset is part of gl_VertexIndex, vertices are counted from the start of the block
+	Vertices vertices = Vertices(pull.vertices);
+	uint word = uint(gl_VertexIndex) * 5;
+	vec3 inPos = uintBitsToFloat(uvec3(vertices.words[word], vertices.words[word + 1], vertices.words[word + 2]));
+	// R16G16_SNORM and R16G16_SFLOAT, as the vertex input would have converted them
+	vec2 inNormal = unpackSnorm2x16(vertices.words[word + 3]);
+	vec2 inUV = unpackHalf2x16(vertices.words[word + 4]);
+
+	DrawInfo drawInfo = DrawInfos(pull.drawInfos).drawInfos[gl_InstanceIndex];
+	mat4 model = InstanceTransforms(pull.transforms).modelMatrices[drawInfo.transform];
+	// world space, scaling is uniform enough for the normal to stay perpendicular
+	outNormal = normalize((vec4(decodeOctahedral(inNormal), 0.0) * model).xyz);
+	outUV = inUV;
+	outMaterial = drawInfo.material;
+	outTransform = drawInfo.transform;
+	vec4 worldPos = vec4(inPos, 1.0) * model;
+	outWorldPos = worldPos.xyz;
+	gl_Position = worldPos * ubo.viewMatrix * ubo.projectionMatrix;
+}
@@ -0,0 +1,41 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+// OcclusionQueries::GpuBox in place of Pipeline::DrawConstants, world space
+layout (push_constant) uniform Box
+{
+	vec4 lower;
+	vec4 upper;
+} box;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// corner bits x, y and z of the two triangles of each face, drawn without culling
+const uint corners[36] = uint[](
+	0, 2, 1, 1, 2, 3,
+	4, 5, 6, 5, 7, 6,
+	0, 1, 4, 1, 5, 4,
+	2, 6, 3, 3, 6, 7,
+	0, 4, 2, 2, 4, 6,
+	1, 3, 5, 3, 7, 5
+);
+
+void main()
+{
+	uint corner = corners[gl_VertexIndex];
+	vec3 select = vec3(corner & 1u, (corner >> 1) & 1u, (corner >> 2) & 1u);
+	vec4 worldPos = vec4(mix(box.lower.xyz, box.upper.xyz, select), 1.0);
+	gl_Position = worldPos * ubo.viewMatrix * ubo.projectionMatrix;
+}
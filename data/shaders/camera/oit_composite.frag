@@ -0,0 +1,26 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// the transparent subpass's attachments at this pixel
+layout (input_attachment_index = 0, binding = 0) uniform subpassInput accumulation;
+layout (input_attachment_index = 1, binding = 1) uniform subpassInput revealage;
+
+// blended over the opaque scene by one minus the revealage
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	float reveal = subpassLoad(revealage).r;
+	// nothing transparent covers the pixel
+	if (reveal >= 1.0) {
+		discard;
+	}
+	vec4 accum = subpassLoad(accumulation);
+	// a sum past half float range keeps its hue
+	if (isinf(max(abs(accum.r), max(abs(accum.g), abs(accum.b))))) {
+		accum.rgb = vec3(accum.a);
+	}
+	outFragColor = vec4(accum.rgb / max(accum.a, 1e-5), 1.0 - reveal);
+}
@@ -0,0 +1,16 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// one triangle over the whole render area, drawn with three vertices and no buffers
+void main()
+{
+	vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
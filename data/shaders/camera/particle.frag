@@ -0,0 +1,19 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inCorner;
+layout (location = 1) in vec4 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	// a soft disc in the quad
+	float falloff = 1.0 - smoothstep(0.5, 1.0, length(inCorner));
+	if (falloff <= 0.0) {
+		discard;
+	}
+	outFragColor = vec4(inColor.rgb, inColor.a * falloff);
+}
@@ -0,0 +1,73 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) out vec2 outCorner;
+layout (location = 1) out vec4 outColor;
+
+// true for the alpha blended draw, which reads the sorted keys
+layout (constant_id = 0) const bool sorted = false;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+// std430 layout of ParticleSystem::GpuParticle
+struct Particle
+{
+	// xyz, w age
+	vec4 position;
+	// xyz, w lifetime
+	vec4 velocity;
+	vec4 color;
+	float size;
+	float gravity;
+	uint blend;
+	uint pad;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Particles
+{
+	Particle particles[];
+};
+
+layout (std430, set = 1, binding = 1) readonly buffer AdditiveList
+{
+	uint additiveList[];
+};
+
+// (key, particle), back to front
+layout (std430, set = 1, binding = 2) readonly buffer SortKeys
+{
+	uvec2 sortKeys[];
+};
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+// two triangles of the quad, corners in [-1, 1]^2
+const vec2 corners[6] = vec2[](
+	vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),
+	vec2(-1.0, 1.0), vec2(1.0, -1.0), vec2(1.0, 1.0)
+);
+
+void main()
+{
+	uint index = sorted ? sortKeys[gl_InstanceIndex].y : additiveList[gl_InstanceIndex];
+	Particle particle = particles[index];
+	// the view matrix's rows are the camera's axes in world space
+	vec3 right = ubo.viewMatrix[0].xyz;
+	vec3 up = ubo.viewMatrix[1].xyz;
+	vec2 corner = corners[gl_VertexIndex];
+	vec3 worldPos = particle.position.xyz + (right * corner.x + up * corner.y) * (0.5 * particle.size);
+	outCorner = corner;
+	// fades out over its lifetime
+	outColor = vec4(particle.color.rgb, particle.color.a * (1.0 - particle.position.w / particle.velocity.w));
+	gl_Position = vec4(worldPos, 1.0) * ubo.viewMatrix * ubo.projectionMatrix;
+}
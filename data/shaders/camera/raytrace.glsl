@@ -0,0 +1,22 @@
+// Ray queried shadows against m3d::AccelerationStructures, for shaders built with
+// GL_EXT_ray_query. Define RAYTRACE_SET to the set AccelerationStructures'
+// descriptor set is bound as before including this file.
+
+#ifndef RAYTRACE_SET
+#define RAYTRACE_SET 2
+#endif
+
+layout (set = RAYTRACE_SET, binding = 0) uniform accelerationStructureEXT sceneInstances;
+
+// 1 when nothing is between position and the light toLight (unit length) points at, up to maxDistance
+// away, 0 otherwise. The origin leaves the surface along its normal so it does not hit itself
+float traceShadow(vec3 position, vec3 normal, vec3 toLight, float maxDistance)
+{
+	const float bias = 0.01;
+	vec3 origin = position + normal * bias;
+	rayQueryEXT query;
+	rayQueryInitializeEXT(query, sceneInstances, gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsOpaqueEXT, 0xFF, origin, 0.0, toLight, maxDistance);
+	while (rayQueryProceedEXT(query)) {
+	}
+	return rayQueryGetIntersectionTypeEXT(query, true) == gl_RayQueryCommittedIntersectionNoneEXT ? 1.0 : 0.0;
+}
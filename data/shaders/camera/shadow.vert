@@ -0,0 +1,22 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec3 inPos;
+
+// world to cascade or atlas face times the world matrix of the draw, see ShadowCascades::drawCascades and ShadowAtlas::record
+layout (push_constant) uniform ShadowConstants
+{
+	mat4 shadowModelMatrix;
+} constants;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+void main() 
+{
+	gl_Position = vec4(inPos, 1.0) * constants.shadowModelMatrix;
+}
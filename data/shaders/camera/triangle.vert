@@ -3,7 +3,13 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
-layout (location = 0) in vec4 inPos;
+layout (location = 0) in vec3 inPos;
+// octahedral encoded, see Mesh::pack
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in vec2 inUV;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
 
 layout (binding = 0) uniform UBO 
 {
@@ -12,13 +18,32 @@ layout (binding = 0) uniform UBO
 	mat4 viewMatrix;
 } ubo;
 
+// Pipeline::DrawConstants, the model matrix of the camera block is not used
+layout (push_constant) uniform DrawConstants
+{
+	mat4 modelMatrix;
+	uint material;
+	uint instanceOffset;
+} draw;
+
 out gl_PerVertex 
 {
     vec4 gl_Position;   
 };
 
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void main() 
 {
-	gl_Position = inPos * ubo.modelMatrix * ubo.viewMatrix * ubo.projectionMatrix;
+	outNormal = decodeOctahedral(inNormal);
+	outUV = inUV;
+	gl_Position = vec4(inPos, 1.0) * draw.modelMatrix * ubo.viewMatrix * ubo.projectionMatrix;
 	//gl_Position = ubo.projectionMatrix * ubo.viewMatrix * ubo.modelMatrix * inPos;
 }
@@ -0,0 +1,59 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_multiview : enable
+
+layout (location = 0) in vec3 inPos;
+// octahedral encoded, see Mesh::pack
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in vec2 inUV;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+
+// Pipeline's uniform block up to the matrices of every view
+layout (binding = 0) uniform UBO 
+{
+	mat4 projectionMatrix;
+	mat4 modelMatrix;
+	mat4 viewMatrix;
+	mat4 shadowMatrices[4];
+	vec4 cascadeSplits;
+	uint cascadeCount;
+	uint pad0;
+	uint pad1;
+	uint pad2;
+	// Pipeline::MaxViews
+	mat4 viewMatrices[4];
+	mat4 projectionMatrices[4];
+} ubo;
+
+// Pipeline::DrawConstants, the model matrix of the camera block is not used
+layout (push_constant) uniform DrawConstants
+{
+	mat4 modelMatrix;
+	uint material;
+	uint instanceOffset;
+} draw;
+
+out gl_PerVertex 
+{
+    vec4 gl_Position;   
+};
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main() 
+{
+	outNormal = decodeOctahedral(inNormal);
+	outUV = inUV;
+	gl_Position = vec4(inPos, 1.0) * draw.modelMatrix * ubo.viewMatrices[gl_ViewIndex] * ubo.projectionMatrices[gl_ViewIndex];
+}
@@ -0,0 +1,23 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in vec4 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+// the atlas of the draw
+layout (binding = 0) uniform sampler2D atlas;
+
+// GuiRenderer's panel bakes, composited with premultiplied blending
+layout (constant_id = 0) const bool premultiply = false;
+
+void main()
+{
+	vec4 texel = texture(atlas, inUV);
+	// GUIElement::SetColor: the color replaces the texture by its alpha
+	vec4 color = vec4(mix(texel.rgb, inColor.rgb, inColor.a), texel.a);
+	outFragColor = premultiply ? vec4(color.rgb * color.a, color.a) : color;
+}
@@ -0,0 +1,21 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+layout (location = 0) in vec2 inUV;
+layout (location = 1) in vec4 inColor;
+
+layout (location = 0) out vec4 outFragColor;
+
+// GUIFontRenderer's distance field, 0.5 on the glyph outline
+layout (binding = 0) uniform sampler2D font;
+
+void main()
+{
+	float distance = texture(font, inUV).r;
+	// about one pixel of antialiasing at any scale
+	float width = fwidth(distance);
+	float coverage = smoothstep(0.5 - width, 0.5 + width, distance);
+	outFragColor = vec4(inColor.rgb, inColor.a * coverage);
+}
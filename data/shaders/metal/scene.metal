@@ -0,0 +1,82 @@
+// RendererMetal's scene shaders, the Metal counterpart of camera/indirect.vert and indirect.frag
+
+#include <metal_stdlib>
+
+using namespace metal;
+
+// PackedVertex, see Mesh::pack
+struct VertexIn {
+    float3 position [[attribute(0)]];
+    // octahedral encoded, R16G16_SNORM
+    float2 normal [[attribute(1)]];
+    half2 uv [[attribute(2)]];
+};
+
+struct VertexOut {
+    float4 position [[position]];
+    float3 normal;
+    float2 uv;
+    // scene material slot, constant over a draw
+    uint material [[flat]];
+};
+
+// one slot of the frame ring, the world matrices follow at their own offset
+struct FrameUniforms {
+    float4x4 projectionMatrix;
+    float4x4 viewMatrix;
+};
+
+struct DrawInfo {
+    uint transform;
+    uint material;
+};
+
+struct Material {
+    float4 diffuse;
+};
+
+// the argument buffer, written once the draws are built
+struct SceneArguments {
+    device const DrawInfo* drawInfos [[id(0)]];
+    device const Material* materials [[id(1)]];
+};
+
+constant uint invalidIndex = 0xFFFFFFFF;
+
+float3 decodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// The matrices are row major Matrix4x4s, as in the GLSL shaders they are multiplied from the left
+vertex VertexOut sceneVertex(VertexIn in [[stage_in]],
+    constant SceneArguments& scene [[buffer(1)]],
+    constant FrameUniforms& frame [[buffer(2)]],
+    device const float4x4* transforms [[buffer(3)]],
+    // includes the draw's baseInstance
+    uint instance [[instance_id]])
+{
+    DrawInfo drawInfo = scene.drawInfos[instance];
+
+    VertexOut out;
+    out.normal = decodeOctahedral(in.normal);
+    out.uv = float2(in.uv);
+    out.material = drawInfo.material;
+    out.position = float4(in.position, 1.0) * transforms[drawInfo.transform] * frame.viewMatrix * frame.projectionMatrix;
+    // Vulkan's clip space y points down, draw the same image
+    out.position.y = -out.position.y;
+    return out;
+}
+
+fragment float4 sceneFragment(VertexOut in [[stage_in]],
+    constant SceneArguments& scene [[buffer(1)]])
+{
+    if (in.material == invalidIndex) {
+        return float4(1.0, 0.0, 0.0, 1.0);
+    }
+    return scene.materials[in.material].diffuse;
+}
@@ -10,7 +10,6 @@
 #include <io.h>
 #include <windows.h>
 #elif defined(__ANDROID__)
-#include "vulkanandroid.h"
 #include <android/asset_manager.h>
 #include <android/native_activity.h>
 #include <android_native_app_glue.h>
@@ -23,11 +22,16 @@
 #include <iostream>
 #include <vector>
 
+#include "File.hpp"
+#include "FramePacer.hpp"
+#include "RenderSnapshot.hpp"
 #include "RendererVulkan.hpp"
 #include "Scene.hpp"
+#include "SceneStreamer.hpp"
 
 //VulkanExample *vulkanExample;
 m3d::RendererVulkan* renderer;
+#if defined(_WIN32)
 LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
     if (renderer != NULL) {
@@ -38,24 +42,122 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow)
 {
+    // shaders, manifest and models out of one mapped package when there is one, loose files otherwise
+    m3d::file::mountPackage(m3d::file::DefaultPackagePath, "D:\\workspace\\m3d");
+
     m3d::Scene scene;
     scene.Init();
 
-    // fill the Scene
-    std::vector<uint32_t> loadedMeshIds;
-    LoadMeshes(&scene, &loadedMeshIds);
-    for (auto& meshId : loadedMeshIds) {
-        uint32_t instanceId;
-        AddInstance(scene, meshId, &instanceId);
-        // do some translation
+    // models of the manifest stream in after the first frame, nearest to the camera first
+    m3d::SceneStreamer streamer;
+    std::string manifestPath = (pCmdLine && *pCmdLine) ? pCmdLine : m3d::SceneStreamer::DefaultManifestPath;
+    if (!streamer.Open(manifestPath)) {
+        return -1;
     }
 
+    m3d::FramePacer pacer;
+
     renderer = new m3d::RendererVulkan();
     renderer->createWin32Window(hInstance, WndProc, 1280, 720);
+    renderer->SetSceneStreamer(&streamer);
+    renderer->SetFramePacer(&pacer);
+    // frames while the models stream in and the window is used, none once the view sits still
+    renderer->SetRenderOnDemand(true);
     renderer->Init(&scene);
-    renderer->DrawLoop();
+    // the window's messages on this thread, the frames on the renderer's
+    renderer->DrawLoopThreaded([](m3d::RenderSnapshot&) {
+        if (renderer->IsIdle()) {
+            // the next message, or a look whether something completed meanwhile
+            MsgWaitForMultipleObjects(0, nullptr, FALSE, 50, QS_ALLINPUT);
+        }
+        MSG msg;
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_QUIT) {
+                return false;
+            }
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+        return true;
+    });
 
     delete (renderer);
 
     return 0;
 }
+#elif defined(__ANDROID__)
+struct AndroidExample {
+    m3d::Scene scene;
+    m3d::SceneStreamer streamer;
+    m3d::FramePacer pacer;
+    bool initialized = false;
+};
+
+// android_native_app_glue lifecycle, runs on the thread that draws
+static void handleCommand(android_app* app, int32_t cmd)
+{
+    AndroidExample* example = static_cast<AndroidExample*>(app->userData);
+    switch (cmd) {
+    case APP_CMD_INIT_WINDOW:
+        // first window initializes, the ones after a pause only bring the surface back
+        renderer->SetWindow(app->window);
+        if (!example->initialized) {
+            renderer->Init(&example->scene);
+            example->initialized = true;
+        }
+        break;
+    case APP_CMD_TERM_WINDOW:
+        renderer->OnWindowTerm();
+        break;
+    case APP_CMD_WINDOW_RESIZED:
+    case APP_CMD_CONFIG_CHANGED:
+        renderer->OnWindowSizeChanged();
+        break;
+    case APP_CMD_GAINED_FOCUS:
+        renderer->SetPaused(false);
+        break;
+    case APP_CMD_LOST_FOCUS:
+        renderer->SetPaused(true);
+        break;
+    }
+}
+
+void android_main(android_app* app)
+{
+    // keeps the glue's entry point from being stripped
+    app_dummy();
+    m3d::file::setAssetManager(app->activity->assetManager);
+    m3d::file::mountPackage(m3d::file::DefaultPackagePath);
+
+    AndroidExample example;
+    example.scene.Init();
+    if (!example.streamer.Open(m3d::SceneStreamer::DefaultManifestPath)) {
+        ANativeActivity_finish(app->activity);
+    }
+
+    renderer = new m3d::RendererVulkan();
+    renderer->SetSceneStreamer(&example.streamer);
+    // the vsync callbacks run inside ALooper_pollAll below, on this thread
+    example.pacer.StartChoreographer();
+    renderer->SetFramePacer(&example.pacer);
+    app->userData = &example;
+    app->onAppCmd = handleCommand;
+
+    while (true) {
+        int events;
+        android_poll_source* source;
+        // sleep in the looper while there is nothing to draw
+        while (ALooper_pollAll(example.initialized && !renderer->IsPaused() ? 0 : -1, nullptr, &events, reinterpret_cast<void**>(&source)) >= 0) {
+            if (source) {
+                source->process(app, source);
+            }
+            if (app->destroyRequested) {
+                delete renderer;
+                renderer = nullptr;
+                return;
+            }
+        }
+        renderer->Draw();
+    }
+}
+#endif
@@ -0,0 +1,533 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// fbxconv <input.fbx> [output.m3dc] [raw]
+// Imports, triangulates and converts an FBX once and writes the cooked scene Scene::Init maps.
+// Geometry is MeshCodec compressed unless raw, raw geometry is used straight out of the mapping.
+// Small static meshes are merged per material and cell of the world, see MergeStaticInstances.
+// fbxconv batch <root> [--jobs n] [--raw] [--force]
+// Converts every FBX under root next to itself, n at a time, one per hardware thread by default. The FBX SDK is not
+// thread safe, every file is converted by an fbxconv process of its own. A file is skipped when the content hash,
+// converter version and raw of its last conversion, kept in root's fbxconv.cache, match and its output exists;
+// --force converts all of them again.
+// fbxconv <image> [color|alpha|normal]
+// Block compresses an image into the BC and the ETC2 KTX files TextureStreamer::LoadCooked picks from.
+// fbxconv <manifest.json> [manifest.bin]
+// Converts a scene manifest into the binary form SceneStreamer maps, like flatc -b data/schema/scene.fbs.
+// fbxconv pack <output.m3dp> <root> <file|@list>...
+// Packages files, or the files listed one per line in a list, under their path relative to root, see file::mountPackage.
+// fbxconv guiatlas <output.m3da> <root> [--size n] <image|@list>...
+// Packs GUI images into n x n atlases, 2048 by default, and writes the table GuiRenderer::LoadAtlases reads, see
+// PackGuiAtlases. Images are named by their path relative to root.
+// fbxconv world <input.fbx> <output.m3dw> [--cell size] [--raw]
+// Converts an FBX like the first form, then splits it into cells of size, 256 by default, on the ground plane and
+// writes a cooked scene per cell and the index WorldStreamer opens, see CookWorld.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "File.hpp"
+#include "GuiAtlasPacker.hpp"
+#include "GuiRenderer.hpp"
+#include "Scene.hpp"
+#include "SceneManifest.hpp"
+#include "StaticMerge.hpp"
+#include "TextureCooker.hpp"
+#include "WorldPartition.hpp"
+
+// Bump with any change of what fbxconv does to an FBX that CookedSceneVersion does not cover, merge settings say
+static const uint32_t ConverterVersion = 1;
+static const char* const BatchCacheName = "fbxconv.cache";
+
+static std::string lowerExtension(const std::string& path)
+{
+    const size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+// FBX files under directory, paths relative to it
+static void findFbxFiles(const std::string& directory, const std::string& relative, std::vector<std::string>& files)
+{
+    const std::string path = relative.empty() ? directory : directory + "/" + relative;
+#if defined(_WIN32)
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((path + "/*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        const std::string name = data.cFileName;
+        const bool isDirectory = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return;
+    }
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        struct stat info;
+        if (stat((path + "/" + name).c_str(), &info) != 0) {
+            continue;
+        }
+        const bool isDirectory = S_ISDIR(info.st_mode);
+#endif
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string child = relative.empty() ? name : relative + "/" + name;
+        if (isDirectory) {
+            findFbxFiles(directory, child, files);
+        } else if (lowerExtension(name) == "fbx") {
+            files.push_back(child);
+        }
+#if defined(_WIN32)
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    }
+    closedir(dir);
+#endif
+}
+
+// FNV-1a of the content, 0 when it can not be read
+static uint64_t hashFile(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    std::vector<unsigned char> chunk(1 << 20);
+    size_t read;
+    while ((read = fread(chunk.data(), 1, chunk.size(), file)) > 0) {
+        for (size_t i = 0; i < read; ++i) {
+            hash ^= chunk[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    fclose(file);
+    return hash;
+}
+
+static bool fileExists(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file) {
+        fclose(file);
+    }
+    return file != nullptr;
+}
+
+// what the last conversion of a file was made from, by its path relative to root
+struct CacheEntry {
+    uint64_t hash = 0;
+    uint32_t cookedVersion = 0;
+    uint32_t converterVersion = 0;
+    bool raw = false;
+};
+
+// one line per file: hash, cooked version, converter version, raw and the relative path
+static std::map<std::string, CacheEntry> readCache(const std::string& path)
+{
+    std::map<std::string, CacheEntry> cache;
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        return cache;
+    }
+    unsigned long long hash;
+    unsigned int cookedVersion;
+    unsigned int converterVersion;
+    int raw;
+    char name[4096];
+    while (fscanf(file, "%llx %u %u %d %4095[^\n]", &hash, &cookedVersion, &converterVersion, &raw, name) == 5) {
+        CacheEntry& entry = cache[name];
+        entry.hash = hash;
+        entry.cookedVersion = cookedVersion;
+        entry.converterVersion = converterVersion;
+        entry.raw = raw != 0;
+    }
+    fclose(file);
+    return cache;
+}
+
+static bool writeCache(const std::string& path, const std::map<std::string, CacheEntry>& cache)
+{
+    // a batch killed halfway keeps the previous cache
+    const std::string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    for (const auto& it : cache) {
+        fprintf(file, "%016llx %u %u %d %s\n", static_cast<unsigned long long>(it.second.hash), it.second.cookedVersion,
+            it.second.converterVersion, it.second.raw ? 1 : 0, it.first.c_str());
+    }
+    const bool written = fclose(file) == 0;
+    remove(path.c_str());
+    return written && rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+static std::string quoted(const std::string& argument)
+{
+    return "\"" + argument + "\"";
+}
+
+static int convertBatch(const std::string& self, const std::string& root, uint32_t jobs, bool raw, bool force)
+{
+    std::vector<std::string> files;
+    findFbxFiles(root, std::string(), files);
+    std::sort(files.begin(), files.end());
+    if (files.empty()) {
+        printf("no FBX files under %s\n", root.c_str());
+        return 1;
+    }
+    const std::string cachePath = root + "/" + BatchCacheName;
+    const std::map<std::string, CacheEntry> previous = force ? std::map<std::string, CacheEntry>() : readCache(cachePath);
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = std::min(jobs, static_cast<uint32_t>(files.size()));
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    std::map<std::string, CacheEntry> cache;
+    std::mutex cacheMutex;
+    std::atomic<size_t> next(0);
+    std::atomic<uint32_t> converted(0);
+    std::atomic<uint32_t> skipped(0);
+    std::atomic<uint32_t> failed(0);
+    // every worker hashes its files and runs the conversions one after the other
+    auto work = [&]() {
+        for (size_t i = next++; i < files.size(); i = next++) {
+            const std::string& relative = files[i];
+            const std::string input = root + "/" + relative;
+            CacheEntry entry;
+            entry.hash = hashFile(input);
+            entry.cookedVersion = m3d::CookedSceneVersion();
+            entry.converterVersion = ConverterVersion;
+            entry.raw = raw;
+            if (entry.hash == 0) {
+                printf("can not read %s\n", input.c_str());
+                ++failed;
+                continue;
+            }
+
+            auto it = previous.find(relative);
+            if (it != previous.end() && it->second.hash == entry.hash && it->second.cookedVersion == entry.cookedVersion
+                && it->second.converterVersion == entry.converterVersion && it->second.raw == entry.raw
+                && fileExists(m3d::CookedPath(input))) {
+                ++skipped;
+            } else {
+                std::string command = quoted(self) + " " + quoted(input) + " " + quoted(m3d::CookedPath(input)) + (raw ? " raw" : "");
+#if defined(_WIN32)
+                // cmd strips the outer quotes of the whole line
+                command = quoted(command);
+#endif
+                if (std::system(command.c_str()) != 0) {
+                    printf("failed to convert %s\n", input.c_str());
+                    ++failed;
+                    continue;
+                }
+                ++converted;
+            }
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            cache[relative] = entry;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < jobs; ++i) {
+        workers.emplace_back(work);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (!writeCache(cachePath, cache)) {
+        printf("failed to write %s\n", cachePath.c_str());
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+    printf("\n%zu files under %s: %u converted, %u up to date, %u failed in %.1f s, %u at a time\n", files.size(), root.c_str(),
+        converted.load(), skipped.load(), failed.load(), seconds, jobs);
+    return failed > 0 ? 1 : 0;
+}
+
+static int cookTexture(const std::string& input, const std::string& usageName)
+{
+    m3d::TextureUsage usage = m3d::TextureUsage::Color;
+    if (usageName == "alpha") {
+        usage = m3d::TextureUsage::ColorAlpha;
+    } else if (usageName == "normal") {
+        usage = m3d::TextureUsage::Normal;
+    } else if (!usageName.empty() && usageName != "color") {
+        printf("unknown texture usage %s, expected color, alpha or normal\n", usageName.c_str());
+        return 1;
+    }
+
+    const m3d::BlockFamily families[] = { m3d::BlockFamily::BC, m3d::BlockFamily::ETC2 };
+    for (m3d::BlockFamily family : families) {
+        const std::string output = m3d::CookedTexturePath(input, family);
+        if (!m3d::CookTexture(input, usage, family, output)) {
+            printf("failed to cook %s into %s\n", input.c_str(), output.c_str());
+            return 1;
+        }
+        printf("%s -> %s\n", input.c_str(), output.c_str());
+    }
+    return 0;
+}
+
+static int convertManifest(const std::string& input, const std::string& output)
+{
+    std::string json;
+    if (!m3d::file::readBinary(input.c_str(), json)) {
+        printf("can not read %s\n", input.c_str());
+        return 1;
+    }
+    auto tStart = std::chrono::high_resolution_clock::now();
+    flatbuffers::FlatBufferBuilder builder(m3d::SceneManifestBufferSize(json.size()));
+    std::string error;
+    if (!m3d::ParseSceneManifest(json.data(), json.size(), builder, &error)) {
+        printf("%s %s\n", input.c_str(), error.c_str());
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+    FILE* file = fopen(output.c_str(), "wb");
+    if (!file || fwrite(builder.GetBufferPointer(), 1, builder.GetSize(), file) != builder.GetSize()) {
+        printf("failed to write %s\n", output.c_str());
+        if (file) {
+            fclose(file);
+        }
+        return 1;
+    }
+    fclose(file);
+    printf("%s -> %s, %.1f MB parsed in %.3f s\n", input.c_str(), output.c_str(), json.size() / (1024.0 * 1024.0), seconds);
+    return 0;
+}
+
+// inputs with every @list replaced by the files it names, one per line
+static bool expandLists(const std::vector<std::string>& inputs, std::vector<std::string>& files)
+{
+    for (const std::string& input : inputs) {
+        if (input.empty() || input[0] != '@') {
+            files.push_back(input);
+            continue;
+        }
+        std::string list;
+        if (!m3d::file::readBinary(input.c_str() + 1, list)) {
+            printf("can not read %s\n", input.c_str() + 1);
+            return false;
+        }
+        size_t begin = 0;
+        while (begin < list.size()) {
+            size_t end = list.find('\n', begin);
+            end = end == std::string::npos ? list.size() : end;
+            std::string line = list.substr(begin, end - begin);
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                files.push_back(line);
+            }
+            begin = end + 1;
+        }
+    }
+    return true;
+}
+
+static int writePackage(const std::string& output, const std::string& root, const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> files;
+    if (!expandLists(inputs, files)) {
+        return 1;
+    }
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    if (!m3d::file::writePackage(output.c_str(), files, root)) {
+        printf("failed to write %s\n", output.c_str());
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+    printf("%zu files -> %s in %.3f s\n", files.size(), output.c_str(), seconds);
+    return 0;
+}
+
+static int packGuiAtlases(const std::string& output, const std::string& root, uint32_t size, const std::vector<std::string>& inputs)
+{
+    std::vector<std::string> images;
+    if (!expandLists(inputs, images)) {
+        return 1;
+    }
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    m3d::GuiAtlasPackStats stats;
+    std::string error;
+    if (!m3d::PackGuiAtlases(images, root, output, size, m3d::GuiRenderer::MaxAtlases, &stats, &error)) {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+    printf("%u images -> %s, %u atlases of %u, %.0f%% covered in %.3f s\n", stats.images, output.c_str(), stats.atlases, size,
+        stats.coverage * 100.0f, seconds);
+    return 0;
+}
+
+static int cookWorld(const std::string& input, const std::string& output, float cellSize, bool raw)
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+
+    m3d::Scene scene;
+    scene.Init(input, false);
+    std::vector<uint32_t> loadedMeshIds;
+    LoadMeshes(&scene, &loadedMeshIds);
+    if (scene.instances.empty()) {
+        for (auto& meshId : loadedMeshIds) {
+            AddInstance(scene, meshId, nullptr);
+        }
+    }
+    // merged meshes stay within a merge cell, which may straddle world cells; they go to the one their box centers in
+    m3d::MergeStaticInstances(scene, m3d::StaticMergeSettings());
+
+    if (!m3d::CookWorld(scene, output, cellSize, !raw)) {
+        printf("\nfailed to write %s\n", output.c_str());
+        return 1;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+    printf("\n%zu meshes -> %s in %.1f s\n", loadedMeshIds.size(), output.c_str(), seconds);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("usage: %s <input.fbx> [output.m3dc] [raw]\n", argv[0]);
+        printf("       %s batch <root> [--jobs n] [--raw] [--force]\n", argv[0]);
+        printf("       %s <image> [color|alpha|normal]\n", argv[0]);
+        printf("       %s <manifest.json> [manifest.bin]\n", argv[0]);
+        printf("       %s pack <output.m3dp> <root> <file|@list>...\n", argv[0]);
+        printf("       %s guiatlas <output.m3da> <root> [--size n] <image|@list>...\n", argv[0]);
+        printf("       %s world <input.fbx> <output.m3dw> [--cell size] [--raw]\n", argv[0]);
+        return 1;
+    }
+    const std::string input = argv[1];
+    if (input == "world") {
+        float cellSize = 256.0f;
+        bool raw = false;
+        bool valid = argc >= 4;
+        for (int i = 4; i < argc && valid; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--cell" && i + 1 < argc) {
+                cellSize = static_cast<float>(atof(argv[++i]));
+            } else if (arg == "--raw") {
+                raw = true;
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid || !(cellSize > 0.0f)) {
+            printf("usage: %s world <input.fbx> <output.m3dw> [--cell size] [--raw]\n", argv[0]);
+            return 1;
+        }
+        return cookWorld(argv[2], argv[3], cellSize, raw);
+    }
+    if (input == "guiatlas") {
+        int first = 4;
+        uint32_t size = 2048;
+        if (argc > 5 && std::string(argv[4]) == "--size") {
+            size = static_cast<uint32_t>(std::max(0, atoi(argv[5])));
+            first = 6;
+        }
+        if (argc <= first || size == 0) {
+            printf("usage: %s guiatlas <output.m3da> <root> [--size n] <image|@list>...\n", argv[0]);
+            return 1;
+        }
+        return packGuiAtlases(argv[2], argv[3], size, std::vector<std::string>(argv + first, argv + argc));
+    }
+    if (input == "pack") {
+        if (argc < 5) {
+            printf("usage: %s pack <output.m3dp> <root> <file|@list>...\n", argv[0]);
+            return 1;
+        }
+        return writePackage(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+    }
+    if (input == "batch") {
+        if (argc < 3) {
+            printf("usage: %s batch <root> [--jobs n] [--raw] [--force]\n", argv[0]);
+            return 1;
+        }
+        uint32_t jobs = 0;
+        bool raw = false;
+        bool force = false;
+        for (int i = 3; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--jobs" && i + 1 < argc) {
+                jobs = static_cast<uint32_t>(std::max(0, atoi(argv[++i])));
+            } else if (arg == "--raw") {
+                raw = true;
+            } else if (arg == "--force") {
+                force = true;
+            } else {
+                printf("unknown option %s\n", arg.c_str());
+                return 1;
+            }
+        }
+        return convertBatch(argv[0], argv[2], jobs, raw, force);
+    }
+    std::string extension = input.substr(input.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == "json") {
+        return convertManifest(input, argc > 2 ? argv[2] : input.substr(0, input.size() - extension.size()) + "bin");
+    }
+    if (extension != "fbx") {
+        return cookTexture(input, argc > 2 ? argv[2] : "");
+    }
+    const std::string output = argc > 2 ? argv[2] : m3d::CookedPath(input);
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+
+    m3d::Scene scene;
+    scene.Init(input, false);
+    std::vector<uint32_t> loadedMeshIds;
+    LoadMeshes(&scene, &loadedMeshIds);
+    // the FBX nodes carry the instances, place unreferenced meshes once at the origin
+    if (scene.instances.empty()) {
+        for (auto& meshId : loadedMeshIds) {
+            AddInstance(scene, meshId, nullptr);
+        }
+    }
+    m3d::StaticMergeStats mergeStats;
+    m3d::MergeStaticInstances(scene, m3d::StaticMergeSettings(), &mergeStats);
+    if (mergeStats.mergedInstances > 0) {
+        printf("\nmerged %u static instances into %u meshes, %u meshes left unused\n", mergeStats.mergedInstances, mergeStats.mergedMeshes,
+            mergeStats.removedMeshes);
+    }
+
+    const bool raw = argc > 3 && std::string(argv[3]) == "raw";
+    if (!m3d::CookScene(scene, output, !raw)) {
+        printf("\nfailed to write %s\n", output.c_str());
+        return 1;
+    }
+
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("\n%zu meshes -> %s in %.1f s\n", loadedMeshIds.size(), output.c_str(),
+        std::chrono::duration<double>(tEnd - tStart).count());
+    return 0;
+}
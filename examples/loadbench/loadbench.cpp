@@ -0,0 +1,368 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Import benchmark, loads every input the way the renderer does and reports what each step costs.
+//   loadbench [--fbx] [--gpu] [--overlap] [--threads n] [--repeat n] [--json out.json] <input.fbx|snapshot.m3ds>...
+// --fbx      import the FBX even when fbxconv's cooked scene is next to it
+// --gpu      also upload the geometry with a headless renderer and wait until every mesh is resident
+// --overlap  --gpu, bringing the renderer's device up while the scene loads (StartRenderer), not for snapshots
+// --threads  mesh conversion threads, 0 (the default) one per hardware thread
+// --repeat   load every input n times, each run is reported
+// --json     write the runs there as well, for tracking them between builds
+// A .m3ds input is a SaveSnapshot, loaded with LoadSnapshot.
+// Wall time of every step, the allocations and bytes allocated by the load, the input's MB/s and the
+// process's peak resident set so far.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "RendererVulkan.hpp"
+#include "Scene.hpp"
+#include "Startup.hpp"
+
+/* Every allocation of the process goes through these, counted while a step runs */
+static std::atomic<uint64_t> allocationCount(0);
+static std::atomic<uint64_t> allocatedBytes(0);
+
+static void* countedAlloc(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size > 0 ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return countedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+static uint64_t peakRssKB()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / 1024;
+    }
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+static uint64_t fileSize(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fclose(file);
+    return size > 0 ? static_cast<uint64_t>(size) : 0;
+}
+
+static double msSince(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+struct Config {
+    bool useCooked = true;
+    bool gpu = false;
+    bool overlap = false;
+    uint32_t threads = 0;
+    uint32_t repeat = 1;
+    std::string jsonPath;
+    std::vector<std::string> inputs;
+};
+
+struct Phase {
+    const char* name;
+    double ms;
+};
+
+struct Run {
+    std::string input;
+    bool cooked = false;
+    uint32_t repeat = 0;
+    uint64_t inputBytes = 0;
+    uint32_t meshes = 0;
+    uint64_t triangles = 0;
+    std::vector<Phase> phases;
+    // Scene::Init and LoadMeshes, with --overlap while the device came up
+    double loadMs = 0.0;
+    uint64_t allocations = 0;
+    uint64_t allocationBytes = 0;
+    // --gpu: vertices and indices staged and the time to residency
+    uint64_t uploadBytes = 0;
+    double uploadMs = 0.0;
+    uint64_t peakRssKB = 0;
+};
+
+static bool allResident(const m3d::Scene& scene)
+{
+    for (uint32_t meshID : scene.meshes) {
+        if (!scene.meshes[meshID].resident) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Run loadInput(const std::string& input, uint32_t repeat, const Config& config)
+{
+    Run run;
+    run.input = input;
+    run.repeat = repeat;
+
+    const uint64_t allocationsBefore = allocationCount.load();
+    const uint64_t bytesBefore = allocatedBytes.load();
+    auto tLoad = std::chrono::high_resolution_clock::now();
+
+    m3d::Scene scene;
+    // Init stages the geometry on the transfer queue, Draw polls it until the meshes are resident
+    std::unique_ptr<m3d::RendererVulkan> renderer;
+    if (config.gpu) {
+        renderer.reset(new m3d::RendererVulkan());
+        renderer->SetHeadless(64, 64, 1);
+    }
+
+    const std::string snapshotExtension = ".m3ds";
+    const bool snapshot = input.size() > snapshotExtension.size()
+        && input.compare(input.size() - snapshotExtension.size(), snapshotExtension.size(), snapshotExtension) == 0;
+    const bool overlap = config.overlap && !snapshot;
+
+    m3d::LoadStats stats;
+    double loadMeshesMs = 0.0;
+    auto tStep = std::chrono::high_resolution_clock::now();
+    if (snapshot) {
+        if (!m3d::LoadSnapshot(scene, input, config.threads, &stats)) {
+            printf("%s did not load\n", input.c_str());
+        }
+        run.loadMs = msSince(tLoad);
+        run.phases.push_back(Phase{ "snapshot.load", run.loadMs });
+    } else if (overlap) {
+        // the allocations count the device's as well
+        m3d::StartupStats startup;
+        m3d::StartRenderer(*renderer, scene, input, config.useCooked, config.threads, &startup);
+        stats = startup.load;
+        run.loadMs = startup.sceneMs;
+        run.phases.push_back(Phase{ "startup.scene", startup.sceneMs });
+        run.phases.push_back(Phase{ "startup.device", startup.deviceMs });
+        run.phases.push_back(Phase{ "startup.wait", startup.waitMs });
+        run.phases.push_back(Phase{ "renderer.init", startup.initMs });
+        run.phases.push_back(Phase{ "startup", startup.totalMs });
+    } else {
+        scene.Init(input, config.useCooked);
+        run.phases.push_back(Phase{ "scene.init", msSince(tStep) });
+
+        std::vector<uint32_t> meshIDs;
+        tStep = std::chrono::high_resolution_clock::now();
+        LoadMeshes(&scene, &meshIDs, config.threads, &stats);
+        loadMeshesMs = msSince(tStep);
+        run.loadMs = msSince(tLoad);
+    }
+    run.allocations = allocationCount.load() - allocationsBefore;
+    run.allocationBytes = allocatedBytes.load() - bytesBefore;
+
+    run.cooked = scene.cooked != nullptr || snapshot;
+    run.inputBytes = scene.cooked ? scene.cooked->size() : fileSize(input);
+    for (const auto& model : scene.mappedModels) {
+        run.inputBytes += model->size();
+    }
+    if (run.cooked) {
+        run.phases.push_back(Phase{ "cooked.meshes", stats.cookedMs });
+        run.phases.push_back(Phase{ "cooked.decode", stats.decodeMs });
+    } else {
+        run.phases.push_back(Phase{ "fbx.import", stats.importMs });
+        run.phases.push_back(Phase{ "fbx.triangulate", stats.triangulateMs });
+        run.phases.push_back(Phase{ "mesh.convert", stats.convertMs });
+        // summed over the converting threads, more than the wall clock of mesh.convert with several
+        run.phases.push_back(Phase{ "mesh.init (thread sum)", stats.meshInitMs });
+        run.phases.push_back(Phase{ "mesh.dedup (thread sum)", stats.dedupMs });
+        run.phases.push_back(Phase{ "scene.hierarchy", stats.hierarchyMs });
+    }
+    if (!overlap && !snapshot) {
+        run.phases.push_back(Phase{ "LoadMeshes", loadMeshesMs });
+    }
+
+    for (uint32_t meshID : scene.meshes) {
+        const m3d::Mesh& mesh = scene.meshes[meshID];
+        ++run.meshes;
+        for (const auto& slice : mesh.slices) {
+            run.triangles += slice.triangleCount;
+        }
+        run.uploadBytes += mesh.vertexCount() * sizeof(m3d::PackedVertex) + mesh.indexCount() * (mesh.indexType() == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t));
+    }
+
+    if (config.gpu) {
+        if (!overlap) {
+            tStep = std::chrono::high_resolution_clock::now();
+            renderer->Init(&scene);
+            run.phases.push_back(Phase{ "renderer.init", msSince(tStep) });
+        }
+        tStep = std::chrono::high_resolution_clock::now();
+        while (!allResident(scene)) {
+            renderer->Draw();
+        }
+        run.uploadMs = msSince(tStep);
+        run.phases.push_back(Phase{ "gpu.upload", run.uploadMs });
+    } else {
+        run.uploadBytes = 0;
+    }
+
+    run.peakRssKB = peakRssKB();
+    return run;
+}
+
+static double mbPerSecond(uint64_t bytes, double ms)
+{
+    return ms > 0.0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0;
+}
+
+static void printRun(const Run& run)
+{
+    printf("\n%s (%s), run %u: %u meshes, %llu triangles\n", run.input.c_str(), run.cooked ? "cooked" : "fbx", run.repeat, run.meshes,
+        static_cast<unsigned long long>(run.triangles));
+    for (const Phase& phase : run.phases) {
+        printf("  %-26s %10.2f ms\n", phase.name, phase.ms);
+    }
+    printf("  load %.2f ms, %.1f MB/s of %.1f MB input\n", run.loadMs, mbPerSecond(run.inputBytes, run.loadMs), run.inputBytes / (1024.0 * 1024.0));
+    printf("  %llu allocations, %.1f MB allocated\n", static_cast<unsigned long long>(run.allocations), run.allocationBytes / (1024.0 * 1024.0));
+    if (run.uploadBytes > 0) {
+        printf("  upload %.1f MB at %.1f MB/s\n", run.uploadBytes / (1024.0 * 1024.0), mbPerSecond(run.uploadBytes, run.uploadMs));
+    }
+    printf("  peak RSS %.1f MB\n", run.peakRssKB / 1024.0);
+}
+
+// paths are the only strings with characters to escape
+static void writeString(FILE* file, const std::string& value)
+{
+    fputc('"', file);
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+static bool writeJson(const std::string& path, const Config& config, const std::vector<Run>& runs)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("can not write %s\n", path.c_str());
+        return false;
+    }
+    fprintf(file, "{\n  \"threads\": %u,\n  \"runs\": [", config.threads);
+    for (size_t r = 0; r < runs.size(); ++r) {
+        const Run& run = runs[r];
+        fputs(r == 0 ? "\n    {\"input\": " : ",\n    {\"input\": ", file);
+        writeString(file, run.input);
+        fprintf(file, ", \"source\": \"%s\", \"repeat\": %u, \"meshes\": %u, \"triangles\": %llu,\n", run.cooked ? "cooked" : "fbx", run.repeat,
+            run.meshes, static_cast<unsigned long long>(run.triangles));
+        fputs("     \"phasesMs\": {", file);
+        for (size_t p = 0; p < run.phases.size(); ++p) {
+            fprintf(file, "%s\"%s\": %.3f", p == 0 ? "" : ", ", run.phases[p].name, run.phases[p].ms);
+        }
+        fprintf(file, "},\n     \"loadMs\": %.3f, \"inputBytes\": %llu, \"loadMBps\": %.2f, \"allocations\": %llu, \"allocatedBytes\": %llu,\n", run.loadMs,
+            static_cast<unsigned long long>(run.inputBytes), mbPerSecond(run.inputBytes, run.loadMs), static_cast<unsigned long long>(run.allocations),
+            static_cast<unsigned long long>(run.allocationBytes));
+        fprintf(file, "     \"uploadBytes\": %llu, \"uploadMBps\": %.2f, \"peakRssKB\": %llu}", static_cast<unsigned long long>(run.uploadBytes),
+            mbPerSecond(run.uploadBytes, run.uploadMs), static_cast<unsigned long long>(run.peakRssKB));
+    }
+    fputs("\n  ]\n}\n", file);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--fbx") {
+            config.useCooked = false;
+        } else if (arg == "--gpu") {
+            config.gpu = true;
+        } else if (arg == "--overlap") {
+            config.gpu = true;
+            config.overlap = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            config.threads = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            config.repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            config.jsonPath = argv[++i];
+        } else if (arg.compare(0, 2, "--") == 0) {
+            printf("unknown option %s\n", arg.c_str());
+            return 1;
+        } else {
+            config.inputs.push_back(arg);
+        }
+    }
+    if (config.inputs.empty()) {
+        printf("usage: %s [--fbx] [--gpu] [--overlap] [--threads n] [--repeat n] [--json out.json] <input.fbx|snapshot.m3ds>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<Run> runs;
+    for (const std::string& input : config.inputs) {
+        for (uint32_t r = 0; r < config.repeat; ++r) {
+            runs.push_back(loadInput(input, r, config));
+            printRun(runs.back());
+        }
+    }
+    if (!config.jsonPath.empty() && !writeJson(config.jsonPath, config, runs)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Renderer throughput benchmark on a synthetic scene, a fixed number of frames per run.
+//   renderbench [--meshes n] [--instances m] [--materials k] [--tess t] [--mode draw|threads|indirect|instanced]
+//               [--threads n] [--frames-in-flight n] [--no-bindless] [--frames n] [--warmup n] [--window]
+// n meshes of spheres with t segments, m instances of each in a cube in front of the default camera and
+// k materials spread over the meshes' slices.
+// draw:      static command buffers, one drawIndexed per instance slice
+// threads:   every frame recorded on --threads workers; needs --window, headless rendering only replays
+// indirect:  one indirect command per instance slice, materials bindless unless --no-bindless
+// instanced: the instances of a mesh slice merged into one indirect command
+// Headless by default, one offscreen render and its readback per frame; --window draws into a 1280x720
+// window on Windows instead. Reports CPU and GPU ms, frame time percentiles and draws per second.
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "RendererVulkan.hpp"
+#include "Scene.hpp"
+
+struct BenchmarkConfig {
+    uint32_t meshes = 16;
+    uint32_t instances = 64;
+    uint32_t materials = 16;
+    uint32_t tessellation = 32;
+    std::string mode = "draw";
+    uint32_t threads = 4;
+    uint32_t framesInFlight = 2;
+    bool bindless = true;
+    uint32_t frames = 600;
+    uint32_t warmup = 60;
+    bool window = false;
+};
+
+// UV sphere of unit radius with segments around and segments / 2 rings, split into sliceCount slices of whole rings
+static m3d::Mesh sphereMesh(uint32_t segments, uint32_t sliceCount)
+{
+    const uint32_t rings = std::max<uint32_t>(segments / 2, 2);
+    const float pi = 3.14159265f;
+
+    m3d::Mesh mesh;
+    mesh.name = m3d::StringId("sphere");
+    for (uint32_t r = 0; r <= rings; ++r) {
+        const float theta = pi * r / rings;
+        for (uint32_t s = 0; s <= segments; ++s) {
+            const float phi = 2.0f * pi * s / segments;
+            const float normal[3] = { sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi) };
+            mesh.vertices.insert(mesh.vertices.end(), { normal[0], normal[1], normal[2], 1.0f });
+            mesh.normals.insert(mesh.normals.end(), normal, normal + 3);
+            mesh.uvs.insert(mesh.uvs.end(), { static_cast<float>(s) / segments, static_cast<float>(r) / rings });
+        }
+    }
+
+    sliceCount = std::min(std::max<uint32_t>(sliceCount, 1), rings);
+    uint32_t ring = 0;
+    for (uint32_t slice = 0; slice < sliceCount; ++slice) {
+        const uint32_t end = rings * (slice + 1) / sliceCount;
+        const int offset = static_cast<int>(mesh.indices.size());
+        for (; ring < end; ++ring) {
+            for (uint32_t s = 0; s < segments; ++s) {
+                const uint32_t a = ring * (segments + 1) + s;
+                const uint32_t b = a + segments + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+            }
+        }
+        mesh.slices.push_back(m3d::Mesh::Slice(offset, static_cast<int>(mesh.indices.size() - offset) / 3));
+    }
+    return mesh;
+}
+
+// Materials first so the meshes can reference them; every material is used once there are at least as many slices
+static void buildScene(m3d::Scene& scene, const BenchmarkConfig& config)
+{
+    scene.Init();
+    std::vector<uint32_t> materialIDs;
+    for (uint32_t k = 0; k < std::max<uint32_t>(config.materials, 1); ++k) {
+        m3d::Material material;
+        material.name = m3d::StringId("material " + std::to_string(k));
+        for (int c = 0; c < 3; ++c) {
+            material.ambient[c] = 0.1f;
+            // spread over the hue circle
+            material.diffuse[c] = 0.5f + 0.5f * cosf(6.2831853f * (static_cast<float>(k) / config.materials + c / 3.0f));
+            material.specular[c] = 0.5f;
+        }
+        material.shininess = 32.0f;
+        material.diffuseMapId = 0xFFFFFFFF;
+        materialIDs.push_back(scene.materials.insert(material));
+    }
+
+    const uint32_t slicesPerMesh = (static_cast<uint32_t>(materialIDs.size()) + config.meshes - 1) / config.meshes;
+    std::vector<uint32_t> meshIDs;
+    for (uint32_t n = 0; n < config.meshes; ++n) {
+        m3d::Mesh mesh = sphereMesh(config.tessellation, slicesPerMesh);
+        mesh.name = m3d::StringId("sphere " + std::to_string(n));
+        for (size_t s = 0; s < mesh.slices.size(); ++s) {
+            mesh.materialIds.push_back(materialIDs[(n * slicesPerMesh + s) % materialIDs.size()]);
+        }
+        mesh.build();
+        meshIDs.push_back(scene.meshes.insert(mesh));
+    }
+
+    // the smallest cube of instances that holds them all, 120 units wide like the teapots grid
+    const uint32_t total = config.meshes * config.instances;
+    uint32_t side = 1;
+    while (side * side * side < total) {
+        ++side;
+    }
+    const float totalWidth = 120.0f;
+    const float gap = side > 1 ? totalWidth / (side - 1) : 0.0f;
+    const float offset = side > 1 ? -totalWidth / 2.0f : 0.0f;
+    const float scale = side > 1 ? 0.45f * gap : 10.0f;
+    for (uint32_t i = 0; i < total; ++i) {
+        m3d::Transform transform;
+        transform.position = m3d::math::Vector3((i % side) * gap + offset, (i / side % side) * gap + offset, (i / (side * side)) * gap + offset);
+        transform.scale = m3d::math::Vector3(scale, scale, scale);
+        transform.rotation = m3d::math::Quaternion(m3d::math::Vector3(0.0f, 1.0f, 0.0f), 0.0f);
+
+        m3d::Instance instance;
+        // neighbours draw different meshes
+        instance.meshId = meshIDs[i % meshIDs.size()];
+        instance.transformId = scene.AddTransform(transform);
+        scene.instances.insert(instance);
+    }
+}
+
+static bool configureRenderer(m3d::RendererVulkan& renderer, const BenchmarkConfig& config)
+{
+    if (config.mode == "draw") {
+        renderer.SetRecordThreads(0);
+    } else if (config.mode == "threads") {
+        if (!config.window) {
+            printf("threads records every frame, which only windowed rendering does, add --window\n");
+            return false;
+        }
+        renderer.SetRecordThreads(std::max<uint32_t>(config.threads, 1));
+    } else if (config.mode == "indirect") {
+        renderer.SetIndirectDraw(true);
+    } else if (config.mode == "instanced") {
+        renderer.SetIndirectDraw(true, true);
+    } else {
+        printf("unknown mode %s, use draw, threads, indirect or instanced\n", config.mode.c_str());
+        return false;
+    }
+    renderer.SetFramesInFlight(std::max<uint32_t>(config.framesInFlight, 1));
+    renderer.SetBindless(config.bindless);
+    renderer.SetGpuTimer(true);
+    if (!config.window) {
+        renderer.SetHeadless(1280, 720, 1);
+    }
+    return true;
+}
+
+static bool allResident(const m3d::Scene& scene)
+{
+    for (uint32_t meshID : scene.meshes) {
+        if (!scene.meshes[meshID].resident) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    const size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * (samples.size() - 1) + 0.5));
+    return samples[index];
+}
+
+static double average(const std::vector<double>& samples)
+{
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    return samples.empty() ? 0.0 : sum / samples.size();
+}
+
+#if defined(_WIN32)
+m3d::RendererVulkan* windowRenderer;
+LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    if (windowRenderer != NULL) {
+        windowRenderer->handle_message(uMsg, wParam, lParam);
+    }
+    return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+}
+
+// false once the window was closed
+static bool pumpMessages()
+{
+    MSG message;
+    while (PeekMessage(&message, NULL, 0, 0, PM_REMOVE)) {
+        if (message.message == WM_QUIT) {
+            return false;
+        }
+        TranslateMessage(&message);
+        DispatchMessage(&message);
+    }
+    return true;
+}
+#endif
+
+class FrameDriver {
+public:
+    FrameDriver(m3d::RendererVulkan& Renderer, bool Window)
+        : renderer(Renderer)
+        , window(Window)
+    {
+        // the pipeline's default camera, looking down -z from 100 units away
+        view = m3d::math::Matrix4x4::Translation(m3d::math::Vector3(0.0f, 0.0f, -100.0f));
+        projection = m3d::math::Matrix4x4::Perspective(60.0f, 1280.0f / 720.0f, 0.1f, 256.0f);
+    }
+
+    // one frame, false when the window was closed
+    bool Frame()
+    {
+#if defined(_WIN32)
+        if (window && !pumpMessages()) {
+            return false;
+        }
+#endif
+        if (!window) {
+            renderer.RenderOffscreen(frame, view, projection);
+        }
+        renderer.Draw();
+        ++frame;
+        return true;
+    }
+
+private:
+    m3d::RendererVulkan& renderer;
+    bool window;
+    uint64_t frame = 0;
+    m3d::math::Matrix4x4 view;
+    m3d::math::Matrix4x4 projection;
+};
+
+static int run(const BenchmarkConfig& config)
+{
+    m3d::Scene scene;
+    buildScene(scene, config);
+
+    m3d::RendererVulkan renderer;
+    if (!configureRenderer(renderer, config)) {
+        return 1;
+    }
+#if defined(_WIN32)
+    if (config.window) {
+        windowRenderer = &renderer;
+        renderer.createWin32Window(GetModuleHandle(NULL), WndProc, 1280, 720);
+    }
+#else
+    if (config.window) {
+        printf("--window is only supported on Windows\n");
+        return 1;
+    }
+#endif
+    renderer.Init(&scene);
+
+    printf("%u meshes x %u instances, %u materials, %u segments: %s, %u frames in flight%s, %s\n", config.meshes, config.instances,
+        config.materials, config.tessellation, config.mode.c_str(), config.framesInFlight, config.bindless ? "" : ", no bindless",
+        config.window ? "window" : "headless");
+
+    // uploads finish before anything is timed
+    FrameDriver driver(renderer, config.window);
+    uint32_t warmup = 0;
+    while (!allResident(scene) || warmup < config.warmup) {
+        if (!driver.Frame()) {
+            return 1;
+        }
+        warmup += allResident(scene) ? 1 : 0;
+    }
+
+    std::vector<double> cpuMs, gpuMs, frameMs;
+    uint64_t draws = 0, triangles = 0;
+    auto tStart = std::chrono::high_resolution_clock::now();
+    auto tFrame = tStart;
+    for (uint32_t f = 0; f < config.frames; ++f) {
+        if (!driver.Frame()) {
+            return 1;
+        }
+        auto now = std::chrono::high_resolution_clock::now();
+        frameMs.push_back(std::chrono::duration<double, std::milli>(now - tFrame).count());
+        tFrame = now;
+        const m3d::RendererVulkan::FrameStats& stats = renderer.GetFrameStats();
+        cpuMs.push_back(stats.cpuMs);
+        gpuMs.push_back(stats.gpuMs);
+        draws += stats.draws;
+        triangles += stats.triangles;
+    }
+    const double elapsedMs = std::chrono::duration<double, std::milli>(tFrame - tStart).count();
+    if (!config.window) {
+        renderer.FinishOffscreen();
+    }
+
+    const double frames = static_cast<double>(std::max<uint32_t>(config.frames, 1));
+    printf("cpu   %8.3f ms avg, %8.3f p50, %8.3f p99\n", average(cpuMs), percentile(cpuMs, 0.5), percentile(cpuMs, 0.99));
+    printf("gpu   %8.3f ms avg, %8.3f p50, %8.3f p99\n", average(gpuMs), percentile(gpuMs, 0.5), percentile(gpuMs, 0.99));
+    printf("frame %8.3f ms avg, %8.3f p50, %8.3f p99, %.1f fps\n", average(frameMs), percentile(frameMs, 0.5), percentile(frameMs, 0.99),
+        elapsedMs > 0.0 ? frames * 1000.0 / elapsedMs : 0.0);
+    printf("%.0f draws/frame, %.0f draws/s, %.0f triangles/frame\n", draws / frames, elapsedMs > 0.0 ? draws * 1000.0 / elapsedMs : 0.0,
+        triangles / frames);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--meshes" && hasValue) {
+            config.meshes = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--instances" && hasValue) {
+            config.instances = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--materials" && hasValue) {
+            config.materials = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--tess" && hasValue) {
+            config.tessellation = std::max(4, atoi(argv[++i]));
+        } else if (arg == "--mode" && hasValue) {
+            config.mode = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            config.threads = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (arg == "--frames-in-flight" && hasValue) {
+            config.framesInFlight = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--no-bindless") {
+            config.bindless = false;
+        } else if (arg == "--frames" && hasValue) {
+            config.frames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--warmup" && hasValue) {
+            config.warmup = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (arg == "--window") {
+            config.window = true;
+        } else {
+            printf("usage: %s [--meshes n] [--instances m] [--materials k] [--tess t] [--mode draw|threads|indirect|instanced]\n"
+                   "       [--threads n] [--frames-in-flight n] [--no-bindless] [--frames n] [--warmup n] [--window]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    return run(config);
+}
@@ -0,0 +1,162 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Replays a RendererVulkan::SetCommandCapture file headless at full speed, for A/B runs of two builds on the same frames.
+//   replay capture [--mode draw|indirect|instanced] [--frames-in-flight n] [--no-bindless] [--warmup n]
+// The scene cooked next to the capture is loaded and made resident, warmup frames of the capture are drawn
+// untimed, then every remaining frame is drawn back to back at the capture's size, a frame captured from a window
+// as one offscreen render with its camera. Reports CPU and GPU ms and frame time percentiles like renderbench.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "CommandCapture.hpp"
+#include "RendererVulkan.hpp"
+#include "Scene.hpp"
+
+struct ReplayConfig {
+    std::string path;
+    std::string mode = "draw";
+    uint32_t framesInFlight = 2;
+    bool bindless = true;
+    uint32_t warmup = 0;
+};
+
+static bool configureRenderer(m3d::RendererVulkan& renderer, const ReplayConfig& config, const m3d::CommandReplay& replay)
+{
+    // headless rendering only replays static command buffers, there is no per frame recording mode
+    if (config.mode == "draw") {
+        renderer.SetRecordThreads(0);
+    } else if (config.mode == "indirect") {
+        renderer.SetIndirectDraw(true);
+    } else if (config.mode == "instanced") {
+        renderer.SetIndirectDraw(true, true);
+    } else {
+        printf("unknown mode %s, use draw, indirect or instanced\n", config.mode.c_str());
+        return false;
+    }
+    renderer.SetFramesInFlight(std::max<uint32_t>(config.framesInFlight, 1));
+    renderer.SetBindless(config.bindless);
+    renderer.SetGpuTimer(true);
+    renderer.SetHeadless(replay.GetWidth(), replay.GetHeight(), replay.GetBatch());
+    return true;
+}
+
+static bool allResident(const m3d::Scene& scene)
+{
+    for (uint32_t meshID : scene.meshes) {
+        if (!scene.meshes[meshID].resident) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    const size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * (samples.size() - 1) + 0.5));
+    return samples[index];
+}
+
+static double average(const std::vector<double>& samples)
+{
+    double sum = 0.0;
+    for (double sample : samples) {
+        sum += sample;
+    }
+    return samples.empty() ? 0.0 : sum / samples.size();
+}
+
+static int run(const ReplayConfig& config)
+{
+    m3d::Scene scene;
+    m3d::CommandReplay replay;
+    if (!replay.Open(config.path, scene)) {
+        return 1;
+    }
+
+    m3d::RendererVulkan renderer;
+    if (!configureRenderer(renderer, config, replay)) {
+        return 1;
+    }
+    renderer.Init(&scene);
+
+    printf("%s: %ux%u, %u renders per draw, %s, %u frames in flight%s\n", config.path.c_str(), replay.GetWidth(), replay.GetHeight(),
+        replay.GetBatch(), config.mode.c_str(), config.framesInFlight, config.bindless ? "" : ", no bindless");
+
+    // a Draw without renders queued only polls the uploads
+    while (!allResident(scene)) {
+        renderer.Draw();
+    }
+    for (uint32_t f = 0; f < config.warmup; ++f) {
+        if (!replay.ReplayFrame(renderer)) {
+            printf("the capture has no more than %u frames\n", f);
+            return 1;
+        }
+    }
+
+    std::vector<double> cpuMs, gpuMs, frameMs;
+    uint64_t draws = 0, triangles = 0;
+    auto tStart = std::chrono::high_resolution_clock::now();
+    auto tFrame = tStart;
+    while (replay.ReplayFrame(renderer)) {
+        auto now = std::chrono::high_resolution_clock::now();
+        frameMs.push_back(std::chrono::duration<double, std::milli>(now - tFrame).count());
+        tFrame = now;
+        const m3d::RendererVulkan::FrameStats& stats = renderer.GetFrameStats();
+        cpuMs.push_back(stats.cpuMs);
+        gpuMs.push_back(stats.gpuMs);
+        draws += stats.draws;
+        triangles += stats.triangles;
+    }
+    const double elapsedMs = std::chrono::duration<double, std::milli>(tFrame - tStart).count();
+    renderer.FinishOffscreen();
+
+    const double frames = static_cast<double>(std::max<size_t>(frameMs.size(), 1));
+    printf("%zu frames timed, %llu commands skipped\n", frameMs.size(), static_cast<unsigned long long>(replay.GetSkipped()));
+    printf("cpu   %8.3f ms avg, %8.3f p50, %8.3f p99\n", average(cpuMs), percentile(cpuMs, 0.5), percentile(cpuMs, 0.99));
+    printf("gpu   %8.3f ms avg, %8.3f p50, %8.3f p99\n", average(gpuMs), percentile(gpuMs, 0.5), percentile(gpuMs, 0.99));
+    printf("frame %8.3f ms avg, %8.3f p50, %8.3f p99, %.1f fps\n", average(frameMs), percentile(frameMs, 0.5), percentile(frameMs, 0.99),
+        elapsedMs > 0.0 ? frames * 1000.0 / elapsedMs : 0.0);
+    printf("%.0f draws/frame, %.0f triangles/frame\n", draws / frames, triangles / frames);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    ReplayConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--mode" && hasValue) {
+            config.mode = argv[++i];
+        } else if (arg == "--frames-in-flight" && hasValue) {
+            config.framesInFlight = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--no-bindless") {
+            config.bindless = false;
+        } else if (arg == "--warmup" && hasValue) {
+            config.warmup = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (config.path.empty() && arg[0] != '-') {
+            config.path = arg;
+        } else {
+            config.path.clear();
+            break;
+        }
+    }
+    if (config.path.empty()) {
+        printf("usage: %s capture [--mode draw|indirect|instanced] [--frames-in-flight n] [--no-bindless] [--warmup n]\n", argv[0]);
+        return 1;
+    }
+    return run(config);
+}
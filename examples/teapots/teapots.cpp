@@ -0,0 +1,256 @@
+/*
+* Copyright (C) 2017 Tracy Ma
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+// Throughput benchmark, the teapot grid of MoreTeapotsSample on the Vulkan renderer.
+//   teapots [x y z] [draw|instanced|indirect] [threads]
+// draw:      one drawIndexed per teapot, its world matrix behind a dynamic uniform offset
+// instanced: one instanced draw for every teapot, matrices from the transform SSBO
+// indirect:  one indirect command per teapot
+// CPU ms, GPU ms and draws/s are printed every second.
+
+#ifdef _WIN32
+#pragma comment(linker, "/subsystem:windows")
+#include <windows.h>
+#elif defined(__ANDROID__)
+#include <android/native_activity.h>
+#include <android_native_app_glue.h>
+#endif
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "File.hpp"
+#include "RendererVulkan.hpp"
+#include "Scene.hpp"
+
+#include "../../C++/MoreTeaPotsSample/MoreTeaPotsSample.NativeActivity/teapot.inl"
+
+struct BenchmarkConfig {
+    uint32_t x = 8;
+    uint32_t y = 8;
+    uint32_t z = 8;
+    char mode[16] = "instanced";
+    uint32_t threads = 4;
+};
+
+// Mesh of teapot.inl, z up as in the sample
+static uint32_t addTeapotMesh(m3d::Scene& scene)
+{
+    const size_t vertexCount = sizeof(teapotPositions) / sizeof(float) / 3;
+    const size_t indexCount = sizeof(teapotIndices) / sizeof(teapotIndices[0]);
+
+    m3d::Mesh mesh;
+    mesh.name = m3d::StringId("teapot");
+    mesh.vertices.resize(vertexCount * 4);
+    mesh.normals.assign(teapotNormals, teapotNormals + vertexCount * 3);
+    mesh.uvs.resize(vertexCount * 2);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        mesh.vertices[i * 4] = teapotPositions[i * 3];
+        mesh.vertices[i * 4 + 1] = teapotPositions[i * 3 + 1];
+        mesh.vertices[i * 4 + 2] = teapotPositions[i * 3 + 2];
+        mesh.vertices[i * 4 + 3] = 1.0f;
+        mesh.uvs[i * 2] = teapotTexCoords[i * 3];
+        mesh.uvs[i * 2 + 1] = teapotTexCoords[i * 3 + 1];
+    }
+    mesh.indices.assign(teapotIndices, teapotIndices + indexCount);
+    mesh.slices.push_back(m3d::Mesh::Slice(0, static_cast<int>(indexCount / 3)));
+    mesh.build();
+    return scene.meshes.insert(mesh);
+}
+
+// x * y * z teapots in a cube in front of the default camera, each turned by a fixed random rotation.
+// The sample spins them every frame; here they stay put so no mode pays for transform uploads
+static void buildScene(m3d::Scene& scene, const BenchmarkConfig& config)
+{
+    scene.Init();
+    const uint32_t meshID = addTeapotMesh(scene);
+    const float radius = scene.meshes[meshID].boundingSphere[3];
+
+    const float totalWidth = 120.0f;
+    const uint32_t counts[3] = { config.x, config.y, config.z };
+    float gap[3], offset[3];
+    for (int c = 0; c < 3; ++c) {
+        gap[c] = counts[c] > 1 ? totalWidth / (counts[c] - 1) : 0.0f;
+        offset[c] = counts[c] > 1 ? -totalWidth / 2.0f : 0.0f;
+    }
+    // neighbours never overlap, whatever their rotation
+    float minGap = totalWidth;
+    for (int c = 0; c < 3; ++c) {
+        if (counts[c] > 1 && gap[c] < minGap) {
+            minGap = gap[c];
+        }
+    }
+    const float scale = 0.45f * minGap / radius;
+
+    srand(0);
+    for (uint32_t iX = 0; iX < config.x; ++iX) {
+        for (uint32_t iY = 0; iY < config.y; ++iY) {
+            for (uint32_t iZ = 0; iZ < config.z; ++iZ) {
+                float fX = rand() / float(RAND_MAX) - 0.5f;
+                float fY = rand() / float(RAND_MAX) - 0.5f;
+
+                m3d::Transform transform;
+                transform.position = m3d::math::Vector3(iX * gap[0] + offset[0], iY * gap[1] + offset[1], iZ * gap[2] + offset[2]);
+                transform.scale = m3d::math::Vector3(scale, scale, scale);
+                transform.rotation = m3d::math::Quaternion(m3d::math::Vector3(1.0f, 0.0f, 0.0f), fX * 3.14159265f)
+                    * m3d::math::Quaternion(m3d::math::Vector3(0.0f, 1.0f, 0.0f), fY * 3.14159265f);
+
+                m3d::Instance instance;
+                instance.meshId = meshID;
+                instance.transformId = scene.AddTransform(transform);
+                scene.instances.insert(instance);
+            }
+        }
+    }
+}
+
+static bool configureRenderer(m3d::RendererVulkan& renderer, const BenchmarkConfig& config)
+{
+    if (strcmp(config.mode, "draw") == 0) {
+        renderer.SetRecordThreads(config.threads > 0 ? config.threads : 1);
+    } else if (strcmp(config.mode, "instanced") == 0) {
+        renderer.SetIndirectDraw(true, true);
+    } else if (strcmp(config.mode, "indirect") == 0) {
+        renderer.SetIndirectDraw(true);
+    } else {
+        printf("unknown mode %s, use draw, instanced or indirect\n", config.mode);
+        return false;
+    }
+    renderer.SetGpuTimer(true);
+    printf("%u x %u x %u = %u teapots, %s draws\n", config.x, config.y, config.z, config.x * config.y * config.z, config.mode);
+    return true;
+}
+
+m3d::RendererVulkan* renderer;
+#if defined(_WIN32)
+LRESULT CALLBACK WndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    if (renderer != NULL) {
+        renderer->handle_message(uMsg, wParam, lParam);
+    }
+    return (DefWindowProc(hWnd, uMsg, wParam, lParam));
+}
+
+int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow)
+{
+    BenchmarkConfig config;
+    if (pCmdLine && *pCmdLine) {
+        sscanf(pCmdLine, "%u %u %u %15s %u", &config.x, &config.y, &config.z, config.mode, &config.threads);
+    }
+
+    m3d::Scene scene;
+    buildScene(scene, config);
+
+    renderer = new m3d::RendererVulkan();
+    if (!configureRenderer(*renderer, config)) {
+        delete renderer;
+        return -1;
+    }
+    renderer->createWin32Window(hInstance, WndProc, 1280, 720);
+    renderer->Init(&scene);
+    renderer->DrawLoop();
+
+    delete (renderer);
+
+    return 0;
+}
+#elif defined(__ANDROID__)
+struct AndroidExample {
+    m3d::Scene scene;
+    bool initialized = false;
+};
+
+static void handleCommand(android_app* app, int32_t cmd)
+{
+    AndroidExample* example = static_cast<AndroidExample*>(app->userData);
+    switch (cmd) {
+    case APP_CMD_INIT_WINDOW:
+        renderer->SetWindow(app->window);
+        if (!example->initialized) {
+            renderer->Init(&example->scene);
+            example->initialized = true;
+        }
+        break;
+    case APP_CMD_TERM_WINDOW:
+        renderer->OnWindowTerm();
+        break;
+    case APP_CMD_WINDOW_RESIZED:
+    case APP_CMD_CONFIG_CHANGED:
+        renderer->OnWindowSizeChanged();
+        break;
+    case APP_CMD_GAINED_FOCUS:
+        renderer->SetPaused(false);
+        break;
+    case APP_CMD_LOST_FOCUS:
+        renderer->SetPaused(true);
+        break;
+    }
+}
+
+// DrawLoop's report, for the looper driven frames
+struct StatsReport {
+    uint32_t frames = 0;
+    double cpuMs = 0.0;
+    double gpuMs = 0.0;
+    uint64_t draws = 0;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    void Add(const m3d::RendererVulkan::FrameStats& stats)
+    {
+        ++frames;
+        cpuMs += stats.cpuMs;
+        gpuMs += stats.gpuMs;
+        draws += stats.draws;
+        auto now = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double, std::milli>(now - start).count();
+        if (elapsed > 1000.0) {
+            printf("%.1f fps, cpu %.3f ms, gpu %.3f ms, %.0f draws/frame (%.0f draws/s)\n", frames * 1000.0 / elapsed, cpuMs / frames, gpuMs / frames,
+                double(draws) / frames, draws * 1000.0 / elapsed);
+            *this = StatsReport();
+        }
+    }
+};
+
+// the default grid and mode, the report goes to stdout
+void android_main(android_app* app)
+{
+    app_dummy();
+    m3d::file::setAssetManager(app->activity->assetManager);
+
+    BenchmarkConfig config;
+    AndroidExample example;
+    buildScene(example.scene, config);
+
+    renderer = new m3d::RendererVulkan();
+    configureRenderer(*renderer, config);
+    app->userData = &example;
+    app->onAppCmd = handleCommand;
+
+    StatsReport report;
+    while (true) {
+        int events;
+        android_poll_source* source;
+        while (ALooper_pollAll(example.initialized && !renderer->IsPaused() ? 0 : -1, nullptr, &events, reinterpret_cast<void**>(&source)) >= 0) {
+            if (source) {
+                source->process(app, source);
+            }
+            if (app->destroyRequested) {
+                delete renderer;
+                renderer = nullptr;
+                return;
+            }
+        }
+        renderer->Draw();
+        if (example.initialized && !renderer->IsPaused()) {
+            report.Add(renderer->GetFrameStats());
+        }
+    }
+}
+#endif
@@ -0,0 +1,172 @@
+#include "tests/gtest/gtest.h"
+
+#include "C++/Core/Allocator.h"
+
+#include <unordered_map>
+#include <vector>
+
+using namespace m3d;
+
+static bool aligned(const Blk& b)
+{
+	return reinterpret_cast<uintptr_t>(b.ptr) % AllocatorAlignment == 0;
+}
+
+TEST(Allocator, StackFallsBackWhenFull)
+{
+	Localloc a;
+	Blk small = a.allocate(100);
+	Blk large = a.allocate(20000);
+	EXPECT_TRUE(small.ptr != nullptr);
+	EXPECT_TRUE(large.ptr != nullptr);
+	EXPECT_TRUE(aligned(small));
+	EXPECT_EQ(100u, small.length);
+	a.deallocate(large);
+	a.deallocate(small);
+}
+
+TEST(Allocator, StackReclaimsTheLastBlock)
+{
+	StackAllocator<256> a;
+	Blk first = a.allocate(64);
+	Blk second = a.allocate(64);
+	a.deallocate(second);
+	Blk third = a.allocate(64);
+	EXPECT_EQ(second.ptr, third.ptr);
+	EXPECT_TRUE(a.owns(first));
+	EXPECT_TRUE(a.allocate(512).ptr == nullptr);
+}
+
+TEST(Allocator, PagesOfHugeLengths)
+{
+	PageAllocator a;
+	Blk small = a.allocate(100);
+	Blk huge = a.allocate(HugePageBytes + 1);
+	EXPECT_TRUE(small.ptr != nullptr);
+	EXPECT_TRUE(huge.ptr != nullptr);
+	EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(small.ptr) % SmallPageBytes);
+	EXPECT_EQ(HugePageBytes + 1, huge.length);
+	// both pages of the rounded length are mapped
+	memset(huge.ptr, 1, 2 * HugePageBytes);
+	a.deallocate(huge);
+	a.deallocate(small);
+}
+
+TEST(Allocator, RegionTakesItsPagesOnFirstUse)
+{
+	RegionAllocator<PageAllocator, HugePageBytes> a;
+	EXPECT_EQ(0u, a.used());
+	Blk first = a.allocate(64);
+	Blk second = a.allocate(64);
+	EXPECT_TRUE(aligned(first));
+	EXPECT_TRUE(a.owns(second));
+	EXPECT_EQ(128u, a.used());
+	a.deallocate(second);
+	EXPECT_EQ(second.ptr, a.allocate(64).ptr);
+	EXPECT_TRUE(a.allocate(HugePageBytes).ptr == nullptr);
+	a.deallocateAll();
+	EXPECT_EQ(0u, a.used());
+	EXPECT_EQ(first.ptr, a.allocate(32).ptr);
+}
+
+TEST(Allocator, FreeListReusesBlocks)
+{
+	FreeList<Mallocator, 8, 32> a;
+	Blk first = a.allocate(24);
+	a.deallocate(first);
+	Blk second = a.allocate(16);
+	EXPECT_EQ(first.ptr, second.ptr);
+	EXPECT_EQ(16u, second.length);
+	a.deallocate(second);
+}
+
+TEST(Allocator, BitmappedBlockFreesInAnyOrder)
+{
+	BitmappedBlock<Mallocator, 64, 130> a;
+	Blk blocks[4];
+	for (auto& b : blocks)
+	{
+		b = a.allocate(64 * 30);
+		EXPECT_TRUE(b.ptr != nullptr);
+		EXPECT_TRUE(aligned(b));
+	}
+	// 120 of 130 blocks are used
+	EXPECT_TRUE(a.allocate(64 * 11).ptr == nullptr);
+	a.deallocate(blocks[1]);
+	Blk reused = a.allocate(64 * 25);
+	EXPECT_EQ(blocks[1].ptr, reused.ptr);
+	EXPECT_TRUE(a.owns(reused));
+	EXPECT_FALSE(a.owns({ &reused, 8 }));
+}
+
+TEST(Allocator, SegregatorRoutesBySize)
+{
+	Segregator<64, FreeList<Mallocator, 1, 64>, BitmappedBlock<Mallocator, 4096, 16>> a;
+	Blk small = a.allocate(40);
+	Blk large = a.allocate(5000);
+	EXPECT_TRUE(large.ptr != nullptr);
+	a.deallocate(small);
+	Blk reused = a.allocate(8);
+	EXPECT_EQ(small.ptr, reused.ptr);
+	a.deallocate(reused);
+	a.deallocate(large);
+}
+
+TEST(Allocator, ChainsOwnWhatTheyAllocate)
+{
+	Segregator<64, FreeList<Mallocator, 1, 64>, FallbackAllocator<BitmappedBlock<Mallocator, 4096, 1024>, Mallocator>> a;
+	Blk small = a.allocate(40);
+	Blk block = a.allocate(5000);
+	Blk large = a.allocate(8 * 1024 * 1024);
+	EXPECT_TRUE(a.owns(small));
+	EXPECT_TRUE(a.owns(block));
+	EXPECT_TRUE(a.owns(large));
+	a.deallocate(large);
+	a.deallocate(block);
+	a.deallocate(small);
+
+	// past the block's 4 MB the heap takes over
+	FallbackAllocator<BitmappedBlock<Mallocator, 4096, 1024>, Mallocator> fallback;
+	block = fallback.allocate(5000);
+	large = fallback.allocate(8 * 1024 * 1024);
+	EXPECT_TRUE(fallback.primary().owns(block));
+	EXPECT_FALSE(fallback.primary().owns(large));
+	EXPECT_TRUE(fallback.owns(large));
+	fallback.deallocate(large);
+	fallback.deallocate(block);
+}
+
+TEST(Allocator, StatsCountThisThread)
+{
+	StatsAllocator<Mallocator> a;
+	const AllocationStats before = threadAllocationStats();
+	Blk b = a.allocate(1000);
+	EXPECT_TRUE(aligned(b));
+	EXPECT_EQ(before.bytesInUse + 1000, threadAllocationStats().bytesInUse);
+	a.deallocate(b);
+	EXPECT_EQ(before.bytesInUse, threadAllocationStats().bytesInUse);
+	EXPECT_EQ(before.allocations + 1, threadAllocationStats().allocations);
+	EXPECT_GE(threadAllocationStats().peakBytesInUse, before.bytesInUse + 1000);
+}
+
+TEST(Allocator, StlContainers)
+{
+	typedef Segregator<64, FreeList<Mallocator, 1, 64>, FallbackAllocator<BitmappedBlock<Mallocator, 4096, 64>, Mallocator>> Scratch;
+	Scratch scratch;
+	{
+		std::vector<int, StlAllocator<int, Scratch>> values{ StlAllocator<int, Scratch>(scratch) };
+		for (int i = 0; i < 100000; ++i)
+		{
+			values.push_back(i);
+		}
+		EXPECT_EQ(99999, values.back());
+
+		typedef StlAllocator<std::pair<const int, int>, Scratch> MapAllocator;
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, MapAllocator> map(16, std::hash<int>(), std::equal_to<int>(), MapAllocator(scratch));
+		for (int i = 0; i < 1000; ++i)
+		{
+			map[i] = i * 2;
+		}
+		EXPECT_EQ(1998, map[999]);
+	}
+}
@@ -0,0 +1,339 @@
+#include "tests/gtest/gtest.h"
+
+#include "Render/include/chunked_freelist.h"
+#include "Render/include/packed_freelist.h"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// the low 16 bits of a packed_freelist id
+static uint32_t allocationIndex(uint32_t id)
+{
+	return id & 0xFFFF;
+}
+
+// ids of the dense array in iteration order
+template<class List>
+static std::vector<uint32_t> iterated(const List& list)
+{
+	std::vector<uint32_t> ids;
+	for (uint32_t id : list)
+	{
+		ids.push_back(id);
+	}
+	return ids;
+}
+
+TEST(PackedFreelist, InsertLookupErase)
+{
+	packed_freelist<std::string> list(8);
+	EXPECT_TRUE(list.empty());
+	const uint32_t a = list.insert("a");
+	const uint32_t b = list.emplace(2, 'b');
+	EXPECT_EQ(2u, list.size());
+	EXPECT_EQ(8u, list.capacity());
+	EXPECT_TRUE(list.contains(a));
+	EXPECT_TRUE(list.contains(b));
+	EXPECT_EQ("a", list[a]);
+	EXPECT_EQ("bb", list[b]);
+	list.erase(a);
+	EXPECT_FALSE(list.contains(a));
+	EXPECT_TRUE(list.contains(b));
+	EXPECT_EQ("bb", list[b]);
+	EXPECT_EQ(1u, list.size());
+}
+
+TEST(PackedFreelist, ReusesAllocationsLastFreedLast)
+{
+	packed_freelist<int> list(4);
+	const uint32_t first = list.insert(0);
+	list.erase(first);
+	// the other three allocations are handed out before the freed one comes around again
+	std::set<uint32_t> indices;
+	std::vector<uint32_t> ids;
+	for (int i = 0; i < 3; ++i)
+	{
+		ids.push_back(list.insert(i));
+		indices.insert(allocationIndex(ids.back()));
+	}
+	EXPECT_EQ(0u, indices.count(allocationIndex(first)));
+	const uint32_t reused = list.insert(3);
+	EXPECT_EQ(allocationIndex(first), allocationIndex(reused));
+	EXPECT_NE(first, reused);
+	EXPECT_FALSE(list.contains(first));
+	EXPECT_TRUE(list.contains(reused));
+	EXPECT_EQ(4u, list.size());
+}
+
+TEST(PackedFreelist, EraseFromFullList)
+{
+	packed_freelist<int> list(4);
+	uint32_t ids[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		ids[i] = list.insert(i);
+	}
+	// the only free allocation is the erased one
+	list.erase(ids[2]);
+	const uint32_t reused = list.insert(20);
+	EXPECT_EQ(allocationIndex(ids[2]), allocationIndex(reused));
+	EXPECT_EQ(0, list[ids[0]]);
+	EXPECT_EQ(1, list[ids[1]]);
+	EXPECT_EQ(3, list[ids[3]]);
+	EXPECT_EQ(20, list[reused]);
+	EXPECT_EQ(4u, list.size());
+	ids[2] = reused;
+
+	// every allocation erased and reused twice while the list stays full
+	for (int round = 0; round < 8; ++round)
+	{
+		list.erase(ids[round % 4]);
+		ids[round % 4] = list.insert(100 + round);
+		EXPECT_EQ(4u, list.size());
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		EXPECT_TRUE(list.contains(ids[i]));
+		EXPECT_EQ(104 + i, list[ids[i]]);
+	}
+}
+
+// 16 bits of reuse count: the 65536th reuse of an allocation hands out the id it started with
+TEST(PackedFreelist, GenerationWraps)
+{
+	packed_freelist<int> list(1);
+	const uint32_t first = list.insert(0);
+	list.erase(first);
+	for (uint32_t i = 1; i < 0x10000; ++i)
+	{
+		const uint32_t id = list.insert(static_cast<int>(i));
+		ASSERT_NE(first, id);
+		ASSERT_EQ(allocationIndex(first), allocationIndex(id));
+		list.erase(id);
+	}
+	EXPECT_EQ(first, list.insert(0));
+}
+
+TEST(PackedFreelist, EraseCompacts)
+{
+	packed_freelist<int> list(16);
+	std::vector<uint32_t> ids;
+	for (int i = 0; i < 10; ++i)
+	{
+		ids.push_back(list.insert(i));
+	}
+	// the last object moves into the hole
+	list.erase(ids[3]);
+	EXPECT_EQ(9u, list.size());
+	EXPECT_EQ(9, list.data()[3]);
+	EXPECT_EQ(ids[9], list.id_data()[3]);
+	EXPECT_EQ(9, list[ids[9]]);
+	// erasing the last one moves nothing
+	list.erase(ids[8]);
+	EXPECT_EQ(8u, list.size());
+	EXPECT_EQ(9, list.data()[3]);
+	EXPECT_EQ(7, list.data()[7]);
+
+	// dense arrays, iteration and lookups agree
+	const std::vector<uint32_t> order = iterated(list);
+	ASSERT_EQ(list.size(), order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		EXPECT_EQ(list.id_data()[i], order[i]);
+		EXPECT_EQ(&list.data()[i], &list[order[i]]);
+	}
+	int sum = 0;
+	list.for_each([&sum](uint32_t, int value) { sum += value; });
+	EXPECT_EQ(0 + 1 + 2 + 9 + 4 + 5 + 6 + 7, sum);
+}
+
+TEST(PackedFreelist, DestroysObjects)
+{
+	std::shared_ptr<int> counter = std::make_shared<int>(0);
+	{
+		packed_freelist<std::shared_ptr<int>> list(8);
+		std::vector<uint32_t> ids;
+		for (int i = 0; i < 4; ++i)
+		{
+			ids.push_back(list.insert(counter));
+		}
+		EXPECT_EQ(5, counter.use_count());
+		list.erase(ids[0]);
+		EXPECT_EQ(4, counter.use_count());
+
+		packed_freelist<std::shared_ptr<int>> copy(list);
+		EXPECT_EQ(7, counter.use_count());
+		EXPECT_EQ(counter, copy[ids[1]]);
+
+		// assigned a shorter list, the objects past its end are destroyed
+		packed_freelist<std::shared_ptr<int>> shorter(8);
+		shorter.insert(counter);
+		copy = shorter;
+		EXPECT_EQ(1u, copy.size());
+		EXPECT_EQ(6, counter.use_count());
+
+		packed_freelist<std::shared_ptr<int>> moved(std::move(list));
+		EXPECT_TRUE(list.empty());
+		EXPECT_EQ(3u, moved.size());
+		EXPECT_EQ(6, counter.use_count());
+	}
+	EXPECT_EQ(1, counter.use_count());
+}
+
+TEST(ChunkedFreelist, GrowsWithStableAddresses)
+{
+	typedef chunked_freelist<int> List;
+	List list;
+	const uint32_t first = list.insert(-1);
+	const int* address = &list[first];
+	std::vector<uint32_t> ids;
+	for (uint32_t i = 0; i < 3 * List::chunk_size; ++i)
+	{
+		ids.push_back(list.insert(static_cast<int>(i)));
+	}
+	EXPECT_EQ(address, &list[first]);
+	EXPECT_EQ(3 * List::chunk_size + 1, list.size());
+	for (uint32_t i = 0; i < ids.size(); ++i)
+	{
+		ASSERT_TRUE(list.contains(ids[i]));
+		ASSERT_EQ(static_cast<int>(i), list[ids[i]]);
+	}
+	EXPECT_FALSE(list.contains(List::index_mask - 1));
+}
+
+TEST(ChunkedFreelist, ReusesSlotsWithNewGeneration)
+{
+	typedef chunked_freelist<int> List;
+	List list;
+	const uint32_t a = list.insert(1);
+	const uint32_t b = list.insert(2);
+	list.erase(a);
+	EXPECT_FALSE(list.contains(a));
+	const uint32_t c = list.insert(3);
+	EXPECT_EQ(a & List::index_mask, c & List::index_mask);
+	EXPECT_NE(a, c);
+	EXPECT_FALSE(list.contains(a));
+	EXPECT_EQ(2, list[b]);
+	EXPECT_EQ(3, list[c]);
+
+	// 10 bits of generation
+	const uint32_t generations = 1u << (32 - List::index_bits);
+	uint32_t id = c;
+	for (uint32_t i = 1; i < generations; ++i)
+	{
+		list.erase(id);
+		id = list.insert(0);
+		ASSERT_NE(c, id);
+	}
+	list.erase(id);
+	EXPECT_EQ(c, list.insert(0));
+}
+
+TEST(ChunkedFreelist, EraseCompactsIds)
+{
+	typedef chunked_freelist<int> List;
+	List list;
+	std::vector<uint32_t> ids;
+	for (uint32_t i = 0; i < List::chunk_size + 10; ++i)
+	{
+		ids.push_back(list.insert(static_cast<int>(i)));
+	}
+	// every other one, across the chunk boundary
+	for (size_t i = 0; i < ids.size(); i += 2)
+	{
+		list.erase(ids[i]);
+	}
+	EXPECT_EQ(ids.size() / 2, list.size());
+	const std::vector<uint32_t> order = iterated(list);
+	ASSERT_EQ(list.size(), order.size());
+	std::set<uint32_t> unique(order.begin(), order.end());
+	EXPECT_EQ(order.size(), unique.size());
+	for (uint32_t id : order)
+	{
+		ASSERT_TRUE(list.contains(id));
+		ASSERT_EQ(1, list[id] % 2);
+	}
+	list.clear();
+	EXPECT_TRUE(list.empty());
+	for (uint32_t id : ids)
+	{
+		EXPECT_FALSE(list.contains(id));
+	}
+}
+
+TEST(ChunkedFreelist, EraseCountTellsChanges)
+{
+	chunked_freelist<int> list;
+	const uint32_t first = list.insert(1);
+	list.insert(2);
+	EXPECT_EQ(0u, list.erase_count());
+	// an erase and an insert leave the size as it was
+	list.erase(first);
+	list.insert(3);
+	EXPECT_EQ(2u, list.size());
+	EXPECT_EQ(1u, list.erase_count());
+	list.clear();
+	EXPECT_EQ(3u, list.erase_count());
+}
+
+TEST(ChunkedFreelist, ConcurrentInserts)
+{
+	typedef chunked_freelist<int> List;
+	List list;
+	// a few erased slots for the threads to race over
+	std::vector<uint32_t> erased;
+	for (int i = 0; i < 64; ++i)
+	{
+		erased.push_back(list.insert(-1));
+	}
+	for (uint32_t id : erased)
+	{
+		list.erase(id);
+	}
+
+	const int threadCount = 8;
+	const int perThread = 4000;
+	std::vector<std::vector<uint32_t>> ids(threadCount);
+	std::vector<int> misreads(threadCount, 0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t)
+	{
+		threads.push_back(std::thread([&list, &ids, &misreads, t, perThread]() {
+			for (int i = 0; i < perThread; ++i)
+			{
+				const uint32_t id = list.emplace(t * perThread + i);
+				ids[t].push_back(id);
+				// read back while the other threads keep inserting
+				if (list[id] != t * perThread + i)
+				{
+					misreads[t]++;
+				}
+			}
+		}));
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	EXPECT_EQ(static_cast<size_t>(threadCount * perThread), list.size());
+	std::set<uint32_t> unique;
+	for (int t = 0; t < threadCount; ++t)
+	{
+		EXPECT_EQ(0, misreads[t]);
+		ASSERT_EQ(static_cast<size_t>(perThread), ids[t].size());
+		for (int i = 0; i < perThread; ++i)
+		{
+			ASSERT_TRUE(list.contains(ids[t][i]));
+			ASSERT_EQ(t * perThread + i, list[ids[t][i]]);
+			unique.insert(ids[t][i]);
+		}
+	}
+	EXPECT_EQ(static_cast<size_t>(threadCount * perThread), unique.size());
+	const std::vector<uint32_t> order = iterated(list);
+	EXPECT_EQ(unique, std::set<uint32_t>(order.begin(), order.end()));
+}
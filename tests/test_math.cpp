@@ -1,11 +1,275 @@
 #include "tests/gtest/gtest.h"
 
 #include "Matrix.h"
+#include "SIMD_Batch.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
 
 using namespace m3d::math;
 
 TEST(Math, Matrix)
 {
-	Matrix m0;
-	EXPECT_EQ(m0[0][0] == 0.0f);
-}
\ No newline at end of file
+	Matrix4x4 m0;
+	EXPECT_EQ(1.0f, m0.m[0][0]);
+	EXPECT_EQ(0.0f, m0.m[0][1]);
+}
+
+TEST(Math, Matrix4x3)
+{
+	Matrix4x4 rotation = Matrix4x4::RotationY(0.7f);
+	Matrix4x4 translation = Matrix4x4::Translation(Vector3(1.0f, -2.0f, 3.0f));
+	Matrix4x4 scaled;
+	scaled.m[0][0] = 2.0f;
+	Matrix4x4 full = translation * rotation;
+	const Matrix4x3 a(full);
+	const Matrix4x3 b(scaled * Matrix4x4::RotationX(-0.3f));
+
+	// the affine product drops nothing the full one keeps
+	const Matrix4x4 expected = full * b.ToMatrix4x4();
+	const Matrix4x3 product = a * b;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			EXPECT_NEAR(expected.m[i][j], product.m[i][j], 1e-5f);
+		}
+	}
+
+	const Matrix4x3 identity = product * product.Inverse();
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			EXPECT_NEAR(i == j ? 1.0f : 0.0f, identity.m[i][j], 1e-5f);
+		}
+	}
+
+	const Vector3A point = product.TransformPoint(Vector3A(0.5f, 1.0f, -1.5f));
+	const Vector3A back = product.Inverse().TransformPoint(point);
+	EXPECT_NEAR(0.5f, back.x, 1e-5f);
+	EXPECT_NEAR(1.0f, back.y, 1e-5f);
+	EXPECT_NEAR(-1.5f, back.z, 1e-5f);
+	const Vector3A vector = a.TransformVector(Vector3A(0.0f, 0.0f, 0.0f));
+	EXPECT_EQ(0.0f, vector.x);
+	EXPECT_EQ(0.0f, vector.z);
+
+	Matrix4x3 singular;
+	singular.m[2][2] = 0.0f;
+	EXPECT_EQ(1.0f, singular.Inverse().m[2][2]);
+}
+
+#if USE_SIMD
+TEST(Math, VectorSelect)
+{
+	const VectorSIMD a = MakeVectorSIMD(1.0f, 2.0f, 3.0f, 4.0f);
+	const VectorSIMD b = MakeVectorSIMD(4.0f, 2.0f, 1.0f, 0.0f);
+	const VectorSIMD mask = VectorCompareGreaterEqual(a, b);
+	EXPECT_EQ(0xE, VectorMoveMask(mask));
+
+	alignas(16) float lanes[4];
+	VectorStore4f(VectorSelect(mask, MakeVectorSIMD(0.0f, 0.0f, 0.0f, 0.0f), a), lanes);
+	EXPECT_EQ(0.0f, lanes[0]);
+	EXPECT_EQ(4.0f, lanes[3]);
+	VectorStore4f(VectorMin(a, b), lanes);
+	EXPECT_EQ(1.0f, lanes[0]);
+	EXPECT_EQ(0.0f, lanes[3]);
+	VectorStore4f(VectorMax(a, b), lanes);
+	EXPECT_EQ(4.0f, lanes[0]);
+	EXPECT_EQ(4.0f, lanes[3]);
+}
+#endif
+
+template <int X, int Y, int Z, int W>
+static void expectSwizzle()
+{
+	const float lanes[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+	alignas(16) float result[4];
+	const VectorSIMD swizzled = Swizzle<X, Y, Z, W>(VectorLoad4fUnaligned(lanes));
+	VectorStore4f(swizzled, result);
+	EXPECT_EQ(lanes[X], result[0]);
+	EXPECT_EQ(lanes[Y], result[1]);
+	EXPECT_EQ(lanes[Z], result[2]);
+	EXPECT_EQ(lanes[W], result[3]);
+}
+
+TEST(Math, Swizzle)
+{
+	// every specialization and a generic shuffle
+	expectSwizzle<0, 1, 2, 3>();
+	expectSwizzle<0, 0, 0, 0>();
+	expectSwizzle<3, 3, 3, 3>();
+	expectSwizzle<1, 0, 3, 2>();
+	expectSwizzle<1, 2, 3, 0>();
+	expectSwizzle<2, 3, 0, 1>();
+	expectSwizzle<3, 0, 1, 2>();
+	expectSwizzle<3, 2, 1, 0>();
+	expectSwizzle<0, 1, 0, 1>();
+	expectSwizzle<2, 3, 2, 3>();
+	expectSwizzle<0, 0, 1, 1>();
+	expectSwizzle<2, 2, 3, 3>();
+	expectSwizzle<0, 2, 0, 2>();
+	expectSwizzle<1, 3, 1, 3>();
+	expectSwizzle<0, 0, 2, 2>();
+	expectSwizzle<1, 1, 3, 3>();
+	expectSwizzle<1, 2, 0, 3>();
+
+	alignas(16) float cross[4];
+	VectorStore4f(VectorCross3(MakeVectorSIMD(1.0f, 2.0f, 3.0f, 5.0f), MakeVectorSIMD(4.0f, 5.0f, 6.0f, 7.0f)), cross);
+	EXPECT_EQ(-3.0f, cross[0]);
+	EXPECT_EQ(6.0f, cross[1]);
+	EXPECT_EQ(-3.0f, cross[2]);
+	EXPECT_EQ(0.0f, cross[3]);
+}
+
+TEST(Math, FrustumCullArray)
+{
+	// the unit cube of clip space, straight from an identity view-projection
+	Matrix4x4 identity;
+	const Frustum frustum = Frustum::FromViewProjection(identity);
+
+	// a box in every case of the 8 and 4 wide steps and the single ones, across two words
+	const size_t count = 45;
+	std::vector<float> lower[3], upper[3];
+	for (size_t i = 0; i < count; ++i) {
+		const float x = -3.0f + 0.15f * i;
+		lower[0].push_back(x);
+		upper[0].push_back(x + 0.5f);
+		lower[1].push_back(-0.5f);
+		upper[1].push_back(0.5f);
+		lower[2].push_back(0.25f);
+		upper[2].push_back(0.75f);
+	}
+	// empty like a default Aabb
+	for (int c = 0; c < 3; ++c) {
+		lower[c][40] = FLT_MAX;
+		upper[c][40] = -FLT_MAX;
+	}
+	const float* lowers[3] = { lower[0].data(), lower[1].data(), lower[2].data() };
+	const float* uppers[3] = { upper[0].data(), upper[1].data(), upper[2].data() };
+	uint32_t visible[2] = { 0xFFFFFFFF, 0xFFFFFFFF };
+	FrustumCullArray(frustum, lowers, uppers, count, visible);
+
+	for (size_t i = 0; i < count; ++i) {
+		// x from -1 to 1, box 40 is empty
+		const bool expected = i != 40 && upper[0][i] >= -1.0f && lower[0][i] <= 1.0f;
+		EXPECT_EQ(expected, ((visible[i / 32] >> (i % 32)) & 1) != 0) << "box " << i;
+	}
+	EXPECT_EQ(0u, visible[1] >> (count - 32));
+}
+
+TEST(Math, MatrixDecomposeArray)
+{
+	// past the 4 wide step: half turns about every axis and a diagonal, a mirror, zero rotation, arbitrary ones
+	const Vector3 axes[] = { Vector3(1.0f, 0.0f, 0.0f), Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f), Vector3(0.70710678f, 0.70710678f, 0.0f),
+		Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, 0.0f, 1.0f), Vector3(0.48f, 0.6f, -0.64f), Vector3(-0.8f, 0.0f, 0.6f), Vector3(0.0f, -0.6f, 0.8f) };
+	const float angles[] = { PI_F, PI_F, PI_F, PI_F, 0.0f, 0.3f, 2.5f, -1.2f, 3.0f };
+	const size_t count = sizeof(angles) / sizeof(angles[0]);
+	std::vector<Vector3> positions, scales;
+	std::vector<Quaternion> rotations;
+	for (size_t i = 0; i < count; ++i) {
+		positions.push_back(Vector3(1.0f * i, -2.0f, 0.5f * i));
+		scales.push_back(Vector3(i == 4 ? -2.0f : 1.0f + 0.5f * i, 0.5f, 3.0f - 0.25f * i));
+		rotations.push_back(Quaternion(axes[i], angles[i]));
+	}
+
+	std::vector<Matrix4x4> matrices(count);
+	MatrixComposeArray(positions.data(), scales.data(), rotations.data(), matrices.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		// T * R * S of column vectors, Quaternion::ToMatrix's rows are the columns
+		Matrix4x4 rotation;
+		rotations[i].ToMatrix(rotation);
+		const float scale[3] = { scales[i].x, scales[i].y, scales[i].z };
+		const float position[3] = { positions[i].x, positions[i].y, positions[i].z };
+		for (int row = 0; row < 3; ++row) {
+			for (int column = 0; column < 3; ++column) {
+				EXPECT_NEAR(rotation.m[column][row] * scale[column], matrices[i].m[row][column], 1e-5f) << "matrix " << i;
+			}
+			EXPECT_EQ(position[row], matrices[i].m[row][3]);
+		}
+		EXPECT_EQ(1.0f, matrices[i].m[3][3]);
+	}
+
+	std::vector<Vector3> decomposedPositions(count), decomposedScales(count);
+	std::vector<Quaternion> decomposedRotations(count);
+	MatrixDecomposeArray(matrices.data(), decomposedPositions.data(), decomposedScales.data(), decomposedRotations.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		EXPECT_EQ(positions[i].x, decomposedPositions[i].x);
+		EXPECT_EQ(positions[i].z, decomposedPositions[i].z);
+		EXPECT_NEAR(scales[i].x, decomposedScales[i].x, 1e-5f) << "matrix " << i;
+		EXPECT_NEAR(scales[i].y, decomposedScales[i].y, 1e-5f) << "matrix " << i;
+		EXPECT_NEAR(scales[i].z, decomposedScales[i].z, 1e-5f) << "matrix " << i;
+		// q and -q are the same rotation
+		EXPECT_NEAR(1.0f, std::fabs(rotations[i] | decomposedRotations[i]), 1e-5f) << "matrix " << i;
+	}
+
+	// the composition of a decomposition is the matrix again
+	std::vector<Matrix4x4> recomposed(count);
+	MatrixComposeArray(decomposedPositions.data(), decomposedScales.data(), decomposedRotations.data(), recomposed.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		for (int row = 0; row < 4; ++row) {
+			for (int column = 0; column < 4; ++column) {
+				EXPECT_NEAR(matrices[i].m[row][column], recomposed[i].m[row][column], 1e-4f) << "matrix " << i;
+			}
+		}
+	}
+
+	// a zero scale stays finite
+	Matrix4x4 flat;
+	flat.m[1][1] = 0.0f;
+	Vector3 position, scale;
+	Quaternion rotation;
+	MatrixDecomposeArray(&flat, &position, &scale, &rotation, 1);
+	EXPECT_EQ(0.0f, scale.y);
+	EXPECT_TRUE(std::isfinite(rotation.x) && std::isfinite(rotation.w));
+}
+
+TEST(Math, HalfArrays)
+{
+	// every step width and the single values: 8, 4, then 3
+	const float values[] = { 1.0f, -2.0f, 0.5f, 65504.0f, 1e6f, 5.9604645e-8f, 0.0f, -0.0f,
+		1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f, 0.1f, 3.0f, -65520.0f };
+	const uint16_t expected[] = { 0x3C00, 0xC000, 0x3800, 0x7BFF, 0x7C00, 0x0001, 0x0000, 0x8000,
+		0x3C00, 0x3C02, 0x2E66, 0x4200, 0xFC00 };
+	const size_t count = sizeof(values) / sizeof(values[0]);
+	uint16_t halves[count];
+	FloatToHalfArray(values, halves, count);
+	for (size_t i = 0; i < count; ++i) {
+		EXPECT_EQ(expected[i], halves[i]) << "value " << i;
+	}
+
+	// every half that is not a NaN comes back as itself
+	std::vector<uint16_t> all;
+	for (uint32_t h = 0; h < 0x10000; ++h) {
+		if ((h & 0x7C00) != 0x7C00 || (h & 0x3FF) == 0) {
+			all.push_back(static_cast<uint16_t>(h));
+		}
+	}
+	std::vector<float> floats(all.size());
+	std::vector<uint16_t> back(all.size());
+	HalfToFloatArray(all.data(), floats.data(), all.size());
+	FloatToHalfArray(floats.data(), back.data(), floats.size());
+	EXPECT_EQ(all, back);
+	EXPECT_EQ(0.5f, floats[0x3800]);
+	EXPECT_EQ(5.9604645e-8f, floats[1]);
+}
+
+TEST(Math, NormalizedIntegerArrays)
+{
+	// past the 16 wide step of FloatToUnorm8Array and the 8 wide one of FloatToSnorm16Array
+	const float values[] = { -2.0f, -1.0f, -0.5f, 0.0f, 0.5f, 1.0f, 2.0f, 1e30f, -1e30f, 0.25f,
+		1.0f / 255.0f, 0.5f / 32767.0f, 1.5f / 32767.0f, 0.75f, 0.999f, -0.999f, 0.1f, 0.9f, 0.3f };
+	const size_t count = sizeof(values) / sizeof(values[0]);
+	int16_t snorm[count];
+	uint8_t unorm[count];
+	FloatToSnorm16Array(values, snorm, count);
+	FloatToUnorm8Array(values, unorm, count);
+	for (size_t i = 0; i < count; ++i) {
+		const float clamped = std::max(-1.0f, std::min(1.0f, values[i]));
+		EXPECT_EQ(static_cast<int16_t>(std::nearbyint(clamped * 32767.0f)), snorm[i]) << "value " << i;
+		EXPECT_EQ(static_cast<uint8_t>(std::nearbyint(std::max(0.0f, clamped) * 255.0f)), unorm[i]) << "value " << i;
+	}
+	// ties go to even
+	EXPECT_EQ(16384, snorm[4]);
+	EXPECT_EQ(0, snorm[11]);
+	EXPECT_EQ(2, snorm[12]);
+	EXPECT_EQ(128, unorm[4]);
+}